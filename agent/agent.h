@@ -38,6 +38,7 @@
 #include "../common/session-env.h"
 #include "../common/shareddefs.h"
 #include "../common/name-value.h"
+#include "../common/metrics.h"
 
 /* To convey some special hash algorithms we use algorithm numbers
    reserved for application use. */
@@ -109,6 +110,10 @@ struct
      upon this timeout value.  */
   unsigned long pinentry_timeout;
 
+  /* If not 0 a Pinentry is kept running for this many seconds after
+     use so that it can be used again for the next prompt.  */
+  unsigned long pinentry_idle_timeout;
+
   /* If set, then passphrase formatting is enabled in pinentry.  */
   int pinentry_formatted_passphrase;
 
@@ -118,6 +123,21 @@ struct
   unsigned long max_cache_ttl;     /* Default. */
   unsigned long max_cache_ttl_ssh; /* for SSH. */
 
+  /* The TTL for cached unprotected private keys; 0 disables that
+   * cache.  */
+  unsigned long seckey_cache_ttl;
+
+  /* The TTL for decrypted session keys; 0 disables that cache.  */
+  unsigned long sesskey_cache_ttl;
+
+  /* The number of pre-generated keys per parameter set; 0 disables
+   * the key pool.  */
+  unsigned int genkey_pool_size;
+
+  /* The size of the per connection scratch arena in secure memory; 0
+   * disables the arenas.  */
+  unsigned int secmem_arena_size;
+
   /* Flag disallowing bypassing of the warning.  */
   int enforce_passphrase_constraints;
 
@@ -309,6 +329,10 @@ struct server_control_s
   /* If pinentry is active for this thread.  It can be more than 1,
      when pinentry is called recursively.  */
   int pinentry_active;
+
+  /* The scratch arena of the current command in secure memory
+   * (secarena.c).  */
+  struct agent_secarena_s *secarena;
 };
 
 
@@ -367,7 +391,10 @@ typedef enum
     CACHE_MODE_SSH,        /* SSH related cache. */
     CACHE_MODE_NONCE,      /* This is a non-predictable nonce.  */
     CACHE_MODE_PIN,        /* PINs stored/retrieved by scdaemon.  */
-    CACHE_MODE_DATA        /* Arbitrary data.  */
+    CACHE_MODE_DATA,       /* Arbitrary data.  */
+    CACHE_MODE_SECKEY,     /* Unprotected private keys.  */
+    CACHE_MODE_KEK,        /* Derived key protection keys.  */
+    CACHE_MODE_SESSKEY     /* Decrypted session keys.  */
   }
 cache_mode_t;
 
@@ -422,6 +449,8 @@ void agent_exit (int rc)
 void agent_set_progress_cb (void (*cb)(ctrl_t ctrl, const char *what,
                                        int printchar, int current, int total),
                             ctrl_t ctrl);
+int agent_unprotect_crypto (void);
+void agent_protect_crypto (int unprotected);
 gpg_error_t agent_copy_startup_env (ctrl_t ctrl);
 const char *get_agent_socket_name (void);
 const char *get_agent_ssh_socket_name (void);
@@ -444,6 +473,7 @@ gpg_error_t agent_print_status (ctrl_t ctrl, const char *keyword,
 void bump_key_eventcounter (void);
 void bump_card_eventcounter (void);
 void start_command_handler (ctrl_t, gnupg_fd_t, gnupg_fd_t);
+void agent_command_metrics (metrics_writer_t w);
 gpg_error_t pinentry_loopback (ctrl_t, const char *keyword,
                                unsigned char **buffer, size_t *size,
                                size_t max_length);
@@ -467,6 +497,8 @@ gpg_error_t ssh_search_control_file (ssh_control_file_t cf,
                                      int *r_disabled,
                                      int *r_ttl, int *r_confirm);
 
+char *ssh_get_keylist_stats (void);
+
 void start_command_handler_ssh_stream (ctrl_t ctrl, estream_t stream);
 void start_command_handler_ssh (ctrl_t, gnupg_fd_t);
 
@@ -500,6 +532,7 @@ gpg_error_t agent_ssh_key_from_file (ctrl_t ctrl,
 int agent_pk_get_algo (gcry_sexp_t s_key);
 int agent_is_tpm2_key(gcry_sexp_t s_key);
 int agent_key_available (ctrl_t ctrl, const unsigned char *grip);
+unsigned int agent_keydir_generation (int *r_watched);
 gpg_error_t agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
                                       int *r_keytype,
                                       unsigned char **r_shadow_info,
@@ -542,6 +575,18 @@ void agent_flush_cache (int pincache_only);
 int agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
                      const char *data, int ttl);
 char *agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode);
+void agent_cache_get_stats (cache_mode_t cache_mode, int reset,
+                            unsigned long *r_hits, unsigned long *r_misses);
+void agent_put_cache_seckey (ctrl_t ctrl, const char *hexgrip,
+                             const unsigned char *sexp);
+unsigned char *agent_get_cache_seckey (ctrl_t ctrl, const char *hexgrip);
+void agent_flush_cache_seckey (const char *hexgrip);
+void agent_put_cache_sesskey (ctrl_t ctrl,
+                              const unsigned char *ciphertext, size_t len,
+                              const unsigned char *plain);
+unsigned char *agent_get_cache_sesskey (ctrl_t ctrl,
+                                        const unsigned char *ciphertext,
+                                        size_t len);
 void agent_store_cache_hit (const char *key);
 
 
@@ -554,11 +599,19 @@ gpg_error_t agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 gpg_error_t agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                           const char *desc_text,
                           membuf_t *outbuf, cache_mode_t cache_mode);
+gpg_error_t agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                                const char *desc_text, int algo,
+                                const unsigned char *hashes, size_t nhashes,
+                                membuf_t *outbuf, cache_mode_t cache_mode);
 
 /*-- pkdecrypt.c --*/
 gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
                              const unsigned char *ciphertext, size_t ciphertextlen,
                              membuf_t *outbuf, int *r_padding);
+gpg_error_t agent_pkdecrypt_batch (ctrl_t ctrl, const char *desc_text,
+                                   const unsigned char *ciphertexts,
+                                   size_t ciphertextslen,
+                                   membuf_t *outbuf, int *r_padding);
 
 enum kemids
   {
@@ -594,9 +647,25 @@ int agent_genkey (ctrl_t ctrl, unsigned int flags,
 gpg_error_t agent_protect_and_store (ctrl_t ctrl, gcry_sexp_t s_skey,
                                      char **passphrase_addr);
 
+/*-- keypool.c --*/
+void agent_keypool_fill (void);
+gcry_sexp_t agent_keypool_get (const char *keyparam, size_t keyparamlen);
+void agent_keypool_flush (void);
+void agent_keypool_dump_state (void);
+
+/*-- secarena.c --*/
+void *agent_secarena_alloc (ctrl_t ctrl, size_t n);
+void agent_secarena_free (ctrl_t ctrl, void *p, size_t n);
+void agent_secarena_release (ctrl_t ctrl);
+char *agent_secarena_get_stats (void);
+void agent_secarena_dump_state (void);
+
 /*-- protect.c --*/
 void set_s2k_calibration_time (unsigned int milliseconds);
 unsigned long get_calibrated_s2k_count (void);
+int s2k_calibration_is_stale (void);
+unsigned long compute_s2k_calibration (void);
+void store_s2k_calibration (unsigned long count);
 unsigned long get_standard_s2k_count (void);
 unsigned char get_standard_s2k_count_rfc4880 (void);
 unsigned long get_standard_s2k_time (void);
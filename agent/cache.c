@@ -50,17 +50,21 @@ static gcry_cipher_hd_t encryption_handle;
 
 struct secret_data_s {
   int  totallen; /* This includes the padding and space for AESWRAP. */
-  char data[1];  /* A string.  */
+  char data[1];  /* A string or a canonical S-expression.  */
 };
 
 /* The type of cache object.  */
 typedef struct cache_item_s *ITEM;
 
-/* The timer entry in a linked list.  */
+/* The timer information of a cache item.  TV_SEC is the relative
+ * timeout as computed by compute_expiration and EXPIRE the absolute
+ * time with respect to npth_clock_gettime.  HEAPIDX is the index in
+ * the timer heap or -1.  */
 struct timer_s {
-  ITEM next;
   int tv_sec;
   int reason;
+  time_t expire;
+  int heapidx;
 };
 #define CACHE_EXPIRE_UNUSED      0
 #define CACHE_EXPIRE_LAST_ACCESS 1
@@ -68,7 +72,7 @@ struct timer_s {
 
 /* The cache object.  */
 struct cache_item_s {
-  ITEM next;
+  ITEM next;        /* Next item in the same hash bucket.  */
   time_t created;
   time_t accessed;  /* Not updated for CACHE_MODE_DATA */
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
@@ -79,17 +83,30 @@ struct cache_item_s {
   char key[1];
 };
 
-/* The cache himself.  */
-static ITEM thecache;
-
-/* The timer list of expiration, in active.  */
-static ITEM the_timer_list;
-/* Newly created entries, to be inserted into the timer list.  */
-static ITEM the_timer_list_new;
+/* The cache himself.  This is a hash table indexed by the case
+ * folded KEY; the other parts of the lookup key are compared while
+ * walking a bucket.  New items are inserted at the head of a bucket
+ * so that the most recent item for a key is found first.  */
+#define CACHE_INITIAL_BUCKETS 64
+static ITEM *thecache;
+static unsigned int thecache_size;   /* Number of buckets.  */
+static unsigned int thecache_items;  /* Number of items.  */
+
+/* The timers of all items as a binary min-heap ordered by the
+ * expiration time.  The heap has room for all items so that inserting
+ * a timer never fails.  */
+static ITEM *timer_heap;
+static unsigned int timer_heap_used;
+static unsigned int timer_heap_size;
 
 /* NULL or the last cache key stored by agent_store_cache_hit.  */
 static char *last_stored_cache_key;
 
+/* Hit and miss counters of agent_get_cache indexed by the cache
+ * mode.  */
+static unsigned long cache_hits[CACHE_MODE_SESSKEY+1];
+static unsigned long cache_misses[CACHE_MODE_SESSKEY+1];
+
 
 /* This function must be called once to initialize this module. It
    has to be done before a second thread is spawned.  */
@@ -161,12 +178,12 @@ release_data (struct secret_data_s *data)
    xfree (data);
 }
 
+/* Encrypt the LENGTH bytes at DATA into a new secret data object.  */
 static gpg_error_t
-new_data (const char *string, struct secret_data_s **r_data)
+new_data (const void *data, size_t length, struct secret_data_s **r_data)
 {
   gpg_error_t err;
   struct secret_data_s *d, *d_enc;
-  size_t length;
   int total;
 
   *r_data = NULL;
@@ -175,8 +192,6 @@ new_data (const char *string, struct secret_data_s **r_data)
   if (err)
     return err;
 
-  length = strlen (string) + 1;
-
   /* We pad the data to 32 bytes so that it get more complicated
      finding something out by watching allocation patterns.  This is
      usually not possible but we better assume nothing about our secure
@@ -187,7 +202,8 @@ new_data (const char *string, struct secret_data_s **r_data)
   d = xtrymalloc_secure (sizeof *d + total - 1);
   if (!d)
     return gpg_error_from_syserror ();
-  memcpy (d->data, string, length);
+  memcpy (d->data, data, length);
+  memset (d->data + length, 0, total - length);
 
   d_enc = xtrymalloc (sizeof *d_enc + total - 1);
   if (!d_enc)
@@ -211,105 +227,172 @@ new_data (const char *string, struct secret_data_s **r_data)
 }
 
 
-static void
-insert_to_timer_list_new (ITEM entry)
+/* Return the hash bucket for KEY.  */
+static unsigned int
+cache_bucket (const char *key)
 {
-  entry->t.next = the_timer_list_new;
-  the_timer_list_new = entry;
+  unsigned int hash = 2166136261u;  /* FNV-1a.  */
+
+  for (; *key; key++)
+    {
+      hash ^= (unsigned char)ascii_toupper (*key);
+      hash *= 16777619u;
+    }
+  return hash & (thecache_size - 1);
 }
 
-/* Insert to the active timer list.  */
-static void
-insert_to_timer_list (struct timespec *ts, ITEM entry)
+
+/* Make sure that there is room for one more item in the hash table
+ * and the timer heap.  */
+static gpg_error_t
+reserve_cache_item (void)
 {
-  ITEM e, eprev;
+  unsigned int n, i, idx, oldsize;
+  ITEM *newtbl, *oldtbl, *tails, r, rnext;
 
-  if (!the_timer_list || ts->tv_sec >= entry->t.tv_sec)
+  if (thecache_items + 1 > timer_heap_size)
     {
-      if (the_timer_list)
-        {
-          the_timer_list->t.tv_sec += ts->tv_sec - entry->t.tv_sec;
-          if (ts->tv_nsec >= 500000000)
-            the_timer_list->t.tv_sec++;
-        }
-
-      ts->tv_sec = entry->t.tv_sec;
-      ts->tv_nsec = 0;
-
-      entry->t.tv_sec = 0;
-      entry->t.next = the_timer_list;
-      the_timer_list = entry;
-      return;
+      n = timer_heap_size? 2 * timer_heap_size : CACHE_INITIAL_BUCKETS;
+      newtbl = xtryreallocarray (timer_heap, timer_heap_size, n,
+                                 sizeof *timer_heap);
+      if (!newtbl)
+        return gpg_error_from_syserror ();
+      timer_heap = newtbl;
+      timer_heap_size = n;
     }
 
-  entry->t.tv_sec -= ts->tv_sec;
-  eprev = NULL;
-  for (e = the_timer_list; e; e = e->t.next)
-    {
-      if (e->t.tv_sec > entry->t.tv_sec)
-        break;
+  if (thecache && thecache_items + 1 <= 2 * thecache_size)
+    return 0;
 
-      eprev = e;
-      entry->t.tv_sec -= e->t.tv_sec;
+  n = thecache_size? 2 * thecache_size : CACHE_INITIAL_BUCKETS;
+  newtbl = xtrycalloc (n, sizeof *newtbl);
+  if (!newtbl)
+    return thecache? 0 : gpg_error_from_syserror ();
+  tails = xtrycalloc (n, sizeof *tails);
+  if (!tails)
+    {
+      xfree (newtbl);
+      return thecache? 0 : gpg_error_from_syserror ();
     }
 
-  entry->t.next = e;
-  if (e)
-    e->t.tv_sec -= entry->t.tv_sec;
-
-  if (eprev)
-    eprev->t.next = entry;
-  else
-    the_timer_list = entry;
+  /* Rehash while keeping the order of the items of each bucket.  */
+  oldtbl = thecache;
+  oldsize = thecache_size;
+  thecache = newtbl;
+  thecache_size = n;
+  for (i=0; i < oldsize; i++)
+    for (r = oldtbl[i]; r; r = rnext)
+      {
+        rnext = r->next;
+        r->next = NULL;
+        idx = cache_bucket (r->key);
+        if (tails[idx])
+          tails[idx]->next = r;
+        else
+          thecache[idx] = r;
+        tails[idx] = r;
+      }
+  xfree (oldtbl);
+  xfree (tails);
+  return 0;
 }
 
+
+/* Remove the item R from its hash bucket.  */
 static void
-remove_from_timer_list (ITEM entry)
+unlink_cache_item (ITEM r)
 {
-  ITEM e, eprev;
+  ITEM *rp;
 
-  eprev = NULL;
-  for (e = the_timer_list; e; e = e->t.next)
-    if (e != entry)
-      eprev = e;
-    else
+  for (rp = &thecache[cache_bucket (r->key)]; *rp; rp = &(*rp)->next)
+    if (*rp == r)
       {
-        if (e->t.next)
-          e->t.next->t.tv_sec += e->t.tv_sec;
-
-        if (eprev)
-          eprev->t.next = e->t.next;
-        else
-          the_timer_list = e->t.next;
-
+        *rp = r->next;
+        r->next = NULL;
+        thecache_items--;
         break;
       }
+}
 
-  entry->t.next = NULL;
-  entry->t.tv_sec = 0;
+
+static void
+timer_heap_swap (unsigned int a, unsigned int b)
+{
+  ITEM tmp = timer_heap[a];
+
+  timer_heap[a] = timer_heap[b];
+  timer_heap[b] = tmp;
+  timer_heap[a]->t.heapidx = a;
+  timer_heap[b]->t.heapidx = b;
 }
 
+
+/* Restore the heap property for the element at IDX.  */
 static void
-remove_from_timer_list_new (ITEM entry)
+timer_heap_fix (unsigned int idx)
 {
-  ITEM e, eprev;
+  unsigned int parent, child;
 
-  eprev = NULL;
-  for (e = the_timer_list_new; e; e = e->t.next)
-    if (e != entry)
-      eprev = e;
-    else
-      {
-        if (eprev)
-          eprev->t.next = e->t.next;
-        else
-          the_timer_list_new = e->t.next;
+  while (idx && (timer_heap[(parent = (idx - 1) / 2)]->t.expire
+                 > timer_heap[idx]->t.expire))
+    {
+      timer_heap_swap (idx, parent);
+      idx = parent;
+    }
 
+  for (;;)
+    {
+      child = 2 * idx + 1;
+      if (child >= timer_heap_used)
         break;
-      }
+      if (child + 1 < timer_heap_used
+          && (timer_heap[child + 1]->t.expire
+              < timer_heap[child]->t.expire))
+        child++;
+      if (timer_heap[idx]->t.expire <= timer_heap[child]->t.expire)
+        break;
+      timer_heap_swap (idx, child);
+      idx = child;
+    }
+}
+
 
-  entry->t.next = NULL;
+/* Start the timer of ENTRY which fires after ENTRY->T.TV_SEC seconds.
+ * Returns true if this is now the first timer to fire.  */
+static int
+insert_to_timer_heap (ITEM entry)
+{
+  struct timespec curtime;
+  unsigned int idx;
+
+  npth_clock_gettime (&curtime);
+  entry->t.expire = curtime.tv_sec + entry->t.tv_sec;
+  /* reserve_cache_item makes sure that there is room.  */
+  log_assert (timer_heap_used < timer_heap_size);
+  idx = timer_heap_used++;
+  timer_heap[idx] = entry;
+  entry->t.heapidx = idx;
+  timer_heap_fix (idx);
+  return !entry->t.heapidx;
+}
+
+
+static void
+remove_from_timer_heap (ITEM entry)
+{
+  unsigned int idx;
+
+  if (entry->t.heapidx < 0)
+    return;
+  idx = entry->t.heapidx;
+  entry->t.heapidx = -1;
   entry->t.tv_sec = 0;
+  if (idx != --timer_heap_used)
+    {
+      timer_heap[idx] = timer_heap[timer_heap_used];
+      timer_heap[idx]->t.heapidx = idx;
+      timer_heap_fix (idx);
+    }
 }
 
 static int
@@ -375,15 +458,13 @@ static void
 update_expiration (ITEM entry, int is_new_entry)
 {
   if (!is_new_entry)
-    {
-      remove_from_timer_list (entry);
-      remove_from_timer_list_new (entry);
-    }
+    remove_from_timer_heap (entry);
 
   if (compute_expiration (entry))
     {
-      insert_to_timer_list_new (entry);
-      agent_kick_the_loop ();
+      /* Wake up the main loop if its timeout needs to be shortened.  */
+      if (insert_to_timer_heap (entry))
+        agent_kick_the_loop ();
     }
 }
 
@@ -415,90 +496,50 @@ do_expire (ITEM e)
   e->accessed = 0;
 
   if (compute_expiration (e))
-    insert_to_timer_list_new (e);
+    insert_to_timer_heap (e);
 
   return 0;
 }
 
 
+/* Expire all due cache entries.  Returns the time until the next
+ * expiration or NULL if there is none.  */
 struct timespec *
 agent_cache_expiration (void)
 {
-  static struct timespec abstime;
   static struct timespec timeout;
   struct timespec *tp;
   struct timespec curtime;
   int res;
-  int expired = 0;
-  ITEM e, enext;
+  ITEM e;
 
   res = npth_mutex_lock (&cache_lock);
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
 
   npth_clock_gettime (&curtime);
-  if (the_timer_list)
+  while (timer_heap_used && timer_heap[0]->t.expire <= curtime.tv_sec)
     {
-      if (npth_timercmp (&abstime, &curtime, <))
-        expired = 1;
-      else
-        npth_timersub (&abstime, &curtime, &timeout);
-    }
-
-  if (expired && (e = the_timer_list) && e->t.tv_sec == 0)
-    {
-      the_timer_list = e->t.next;
-      e->t.next = NULL;
+      e = timer_heap[0];
+      remove_from_timer_heap (e);
 
       if (do_expire (e))
         {
-          ITEM r, rprev;
-
           if (DBG_CACHE)
             log_debug ("  removed '%s'.%d (mode %d) (slot not used for 30m)\n",
                        e->key, e->restricted, e->cache_mode);
 
-          rprev = NULL;
-          for (r = thecache; r; r = r->next)
-            if (r == e)
-              {
-                if (!rprev)
-                  thecache = r->next;
-                else
-                  rprev->next = r->next;
-                break;
-              }
-            else
-              rprev = r;
-
-          remove_from_timer_list_new (e);
-
+          unlink_cache_item (e);
           xfree (e);
         }
     }
 
-  if (expired || !the_timer_list)
-    timeout.tv_sec = timeout.tv_nsec = 0;
-
-  for (e = the_timer_list_new; e; e = enext)
-    {
-      enext = e->t.next;
-      e->t.next = NULL;
-      insert_to_timer_list (&timeout, e);
-    }
-  the_timer_list_new = NULL;
-
-  if (!the_timer_list)
+  if (!timer_heap_used)
     tp = NULL;
   else
     {
-      if (the_timer_list->t.tv_sec != 0)
-        {
-          timeout.tv_sec += the_timer_list->t.tv_sec;
-          the_timer_list->t.tv_sec = 0;
-        }
-
-      npth_timeradd (&timeout, &curtime, &abstime);
+      timeout.tv_sec = timer_heap[0]->t.expire - curtime.tv_sec;
+      timeout.tv_nsec = 0;
       tp = &timeout;
     }
 
@@ -515,6 +556,7 @@ agent_flush_cache (int pincache_only)
 {
   ITEM r;
   int res;
+  unsigned int i;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache%s\n", pincache_only?" (pincache only)":"");
@@ -523,20 +565,21 @@ agent_flush_cache (int pincache_only)
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
 
-  for (r=thecache; r; r = r->next)
-    {
-      if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
-        continue;
-      if (r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-          update_expiration (r, 0);
-        }
-    }
+  for (i=0; i < thecache_size; i++)
+    for (r=thecache[i]; r; r = r->next)
+      {
+        if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
+          continue;
+        if (r->pw)
+          {
+            if (DBG_CACHE)
+              log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
+            release_data (r->pw);
+            r->pw = NULL;
+            r->accessed = 0;
+            update_expiration (r, 0);
+          }
+      }
 
   res = npth_mutex_unlock (&cache_lock);
   if (res)
@@ -544,28 +587,50 @@ agent_flush_cache (int pincache_only)
 }
 
 
+/* Return true if CACHE_MODE is used for internal items which must
+ * never be returned for a different mode.  */
+static int
+cache_mode_internal (cache_mode_t cache_mode)
+{
+  return (cache_mode == CACHE_MODE_SECKEY || cache_mode == CACHE_MODE_KEK
+          || cache_mode == CACHE_MODE_SESSKEY);
+}
+
+
 /* Compare two cache modes.  */
 static int
 cache_mode_equal (cache_mode_t a, cache_mode_t b)
 {
   /* CACHE_MODE_ANY matches any mode other than CACHE_MODE_IGNORE.  */
   return ((a == CACHE_MODE_ANY
-           && !(b == CACHE_MODE_IGNORE || b == CACHE_MODE_DATA))
+           && !(b == CACHE_MODE_IGNORE || b == CACHE_MODE_DATA
+                || cache_mode_internal (b)))
           || (b == CACHE_MODE_ANY
-              && !(a == CACHE_MODE_IGNORE || a == CACHE_MODE_DATA))
+              && !(a == CACHE_MODE_IGNORE || a == CACHE_MODE_DATA
+                   || cache_mode_internal (a)))
           || a == b);
 }
 
 
-/* Store the string DATA in the cache under KEY and mark it with a
-   maximum lifetime of TTL seconds.  If there is already data under
-   this key, it will be replaced.  Using a DATA of NULL deletes the
-   entry.  A TTL of 0 is replaced by the default TTL and a TTL of -1
-   set infinite timeout.  CACHE_MODE is stored with the cache entry
-   and used to select different timeouts.  */
-int
-agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
-                 const char *data, int ttl)
+/* Return true if the cache item R may be used for a request with
+ * CACHE_MODE.  Cached private keys and key protection keys are
+ * strictly separated from all other items so that they can't be
+ * retrieved by other means.  */
+static int
+cache_mode_usable (ITEM r, cache_mode_t cache_mode)
+{
+  if (cache_mode_internal (r->cache_mode) || cache_mode_internal (cache_mode))
+    return r->cache_mode == cache_mode;
+  return ((cache_mode != CACHE_MODE_USER && cache_mode != CACHE_MODE_NONCE)
+          || cache_mode_equal (r->cache_mode, cache_mode));
+}
+
+
+/* Store DATALEN bytes of DATA in the cache under KEY; see
+ * agent_put_cache.  */
+static gpg_error_t
+put_cache_item (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
+                const void *data, size_t datalen, int ttl)
 {
   gpg_error_t err = 0;
   ITEM r;
@@ -587,13 +652,15 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
         case CACHE_MODE_SSH: ttl = opt.def_cache_ttl_ssh; break;
         case CACHE_MODE_DATA: ttl = DEF_CACHE_TTL_DATA; break;
         case CACHE_MODE_PIN: ttl = -1; break;
+        case CACHE_MODE_SECKEY: ttl = opt.seckey_cache_ttl; break;
+        case CACHE_MODE_SESSKEY: ttl = opt.sesskey_cache_ttl; break;
         default: ttl = opt.def_cache_ttl; break;
         }
     }
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     goto out;
 
-  for (r=thecache; r; r = r->next)
+  for (r = thecache? thecache[cache_bucket (key)] : NULL; r; r = r->next)
     {
       if (cache_mode == CACHE_MODE_PIN && data)
         {
@@ -608,9 +675,7 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
           if (!strcmp (r->key, key))
             break;
         }
-      else if (((cache_mode != CACHE_MODE_USER
-                 && cache_mode != CACHE_MODE_NONCE)
-                || cache_mode_equal (r->cache_mode, cache_mode))
+      else if (cache_mode_usable (r, cache_mode)
                && r->restricted == restricted
                && !strcmp (r->key, key))
         break;
@@ -627,7 +692,7 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          err = new_data (data, datalen, &r->pw);
           if (err)
             log_error ("error replacing cache item: %s\n", gpg_strerror (err));
           update_expiration (r, 0);
@@ -635,23 +700,31 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
     }
   else if (data) /* Insert.  */
     {
-      r = xtrycalloc (1, sizeof *r + strlen (key));
+      err = reserve_cache_item ();
+      r = err? NULL : xtrycalloc (1, sizeof *r + strlen (key));
       if (!r)
-        err = gpg_error_from_syserror ();
+        {
+          if (!err)
+            err = gpg_error_from_syserror ();
+        }
       else
         {
           strcpy (r->key, key);
+          r->t.heapidx = -1;
           r->restricted = restricted;
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          err = new_data (data, datalen, &r->pw);
           if (err)
             xfree (r);
           else
             {
-              r->next = thecache;
-              thecache = r;
+              unsigned int idx = cache_bucket (key);
+
+              r->next = thecache[idx];
+              thecache[idx] = r;
+              thecache_items++;
               update_expiration (r, 1);
             }
         }
@@ -668,6 +741,40 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
 }
 
 
+/* Store the string DATA in the cache under KEY and mark it with a
+   maximum lifetime of TTL seconds.  If there is already data under
+   this key, it will be replaced.  Using a DATA of NULL deletes the
+   entry.  A TTL of 0 is replaced by the default TTL and a TTL of -1
+   set infinite timeout.  CACHE_MODE is stored with the cache entry
+   and used to select different timeouts.  */
+int
+agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
+                 const char *data, int ttl)
+{
+  return put_cache_item (ctrl, key, cache_mode,
+                         data, data? strlen (data) + 1 : 0, ttl);
+}
+
+
+/* Return the number of hits and misses of agent_get_cache for
+ * CACHE_MODE at R_HITS and R_MISSES.  If RESET is set the counters
+ * are cleared.  */
+void
+agent_cache_get_stats (cache_mode_t cache_mode, int reset,
+                       unsigned long *r_hits, unsigned long *r_misses)
+{
+  if ((unsigned int)cache_mode >= DIM (cache_hits))
+    {
+      *r_hits = *r_misses = 0;
+      return;
+    }
+  *r_hits = cache_hits[cache_mode];
+  *r_misses = cache_misses[cache_mode];
+  if (reset)
+    cache_hits[cache_mode] = cache_misses[cache_mode] = 0;
+}
+
+
 /* Try to find an item in the cache.  Returns NULL if not found or an
  * malloced string with the value.  */
 char *
@@ -701,14 +808,12 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
                key, restricted, cache_mode,
                last_stored? " (stored cache key)":"");
 
-  for (r=thecache; r; r = r->next)
+  for (r = thecache? thecache[cache_bucket (key)] : NULL; r; r = r->next)
     {
       if (cache_mode == CACHE_MODE_PIN)
         yes = (r->pw && !strcmp (r->key, key));
       else if (r->pw
-               && ((cache_mode != CACHE_MODE_USER
-                    && cache_mode != CACHE_MODE_NONCE)
-                   || cache_mode_equal (r->cache_mode, cache_mode))
+               && cache_mode_usable (r, cache_mode)
                && r->restricted == restricted
                && !strcmp (r->key, key))
         yes = 1;
@@ -753,6 +858,13 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
     log_debug ("... miss\n");
 
  out:
+  if ((unsigned int)cache_mode < DIM (cache_hits))
+    {
+      if (value)
+        cache_hits[cache_mode]++;
+      else
+        cache_misses[cache_mode]++;
+    }
   res = npth_mutex_unlock (&cache_lock);
   if (res)
     log_fatal ("failed to release cache mutex: %s\n", strerror (res));
@@ -793,3 +905,125 @@ agent_store_cache_hit (const char *key)
 
   xfree (old);
 }
+
+
+/* Store the unprotected private key given as canonical S-expression
+ * SEXP under the hex encoded keygrip HEXGRIP.  This is a no-op unless
+ * the option --seckey-cache-ttl has been used.  */
+void
+agent_put_cache_seckey (ctrl_t ctrl, const char *hexgrip,
+                        const unsigned char *sexp)
+{
+  size_t len;
+
+  if (!opt.seckey_cache_ttl)
+    return;
+  len = gcry_sexp_canon_len (sexp, 0, NULL, NULL);
+  if (!len)
+    return;
+  put_cache_item (ctrl, hexgrip, CACHE_MODE_SECKEY, sexp, len, 0);
+}
+
+
+/* Return a private key stored by agent_put_cache_seckey as a canonical
+ * S-expression in secure memory or NULL if there is none.  */
+unsigned char *
+agent_get_cache_seckey (ctrl_t ctrl, const char *hexgrip)
+{
+  if (!opt.seckey_cache_ttl)
+    return NULL;
+  return (unsigned char *)agent_get_cache (ctrl, hexgrip, CACHE_MODE_SECKEY);
+}
+
+
+/* Store the cache key for the LEN bytes of CIPHERTEXT decrypted with
+ * the key from CTRL at KEY, which must have a size of at least
+ * 40+1+64+1 bytes.  The key is the keygrip followed by the SHA-256
+ * hash of the ciphertext.  */
+static void
+make_sesskey_cache_key (ctrl_t ctrl, const unsigned char *ciphertext,
+                        size_t len, char *key)
+{
+  unsigned char hash[32];
+
+  gcry_md_hash_buffer (GCRY_MD_SHA256, hash, ciphertext, len);
+  bin2hex (ctrl->keygrip, 20, key);
+  key[40] = ':';
+  bin2hex (hash, 32, key + 41);
+}
+
+
+/* Store the result PLAIN, a canonical S-expression, of decrypting the
+ * LEN bytes of CIPHERTEXT with the key from CTRL.  This is a no-op
+ * unless the option --session-key-cache-ttl has been used.  */
+void
+agent_put_cache_sesskey (ctrl_t ctrl,
+                         const unsigned char *ciphertext, size_t len,
+                         const unsigned char *plain)
+{
+  char key[40+1+64+1];
+  size_t plainlen;
+
+  if (!opt.sesskey_cache_ttl || !ctrl->have_keygrip || ctrl->ephemeral_mode)
+    return;
+  plainlen = gcry_sexp_canon_len (plain, 0, NULL, NULL);
+  if (!plainlen)
+    return;
+  make_sesskey_cache_key (ctrl, ciphertext, len, key);
+  put_cache_item (ctrl, key, CACHE_MODE_SESSKEY, plain, plainlen, 0);
+}
+
+
+/* Return the result of decrypting the LEN bytes of CIPHERTEXT with
+ * the key from CTRL as stored by agent_put_cache_sesskey, or NULL if
+ * it is not in the cache.  The canonical S-expression is returned in
+ * secure memory.  */
+unsigned char *
+agent_get_cache_sesskey (ctrl_t ctrl,
+                         const unsigned char *ciphertext, size_t len)
+{
+  char key[40+1+64+1];
+
+  if (!opt.sesskey_cache_ttl || !ctrl->have_keygrip || ctrl->ephemeral_mode)
+    return NULL;
+  make_sesskey_cache_key (ctrl, ciphertext, len, key);
+  return (unsigned char *)agent_get_cache (ctrl, key, CACHE_MODE_SESSKEY);
+}
+
+
+/* Remove the private key with the hex encoded keygrip HEXGRIP and
+ * the session keys decrypted with it from the cache.  With HEXGRIP
+ * NULL all cached private keys and session keys are removed.  This
+ * is called whenever a key file is changed.  */
+void
+agent_flush_cache_seckey (const char *hexgrip)
+{
+  ITEM r;
+  int res;
+  unsigned int i;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  for (i=0; i < thecache_size; i++)
+    for (r=thecache[i]; r; r = r->next)
+      {
+        if ((r->cache_mode != CACHE_MODE_SECKEY
+             && r->cache_mode != CACHE_MODE_SESSKEY) || !r->pw)
+          continue;
+        /* The key of a session key item starts with the keygrip.  */
+        if (hexgrip && ascii_strncasecmp (r->key, hexgrip, 40))
+          continue;
+        if (DBG_CACHE)
+          log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
+        release_data (r->pw);
+        r->pw = NULL;
+        r->accessed = 0;
+        update_expiration (r, 0);
+      }
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+}
@@ -76,6 +76,28 @@ static struct
 } entry_features;
 
 
+/* Information about the current pinentry required to keep it
+ * running for later use (see --pinentry-idle-timeout).  ENTRY_ENVSTR
+ * describes the environment used to start it, ENTRY_PID and
+ * ENTRY_FLAVOR_VERSION are used to notify the client and
+ * ENTRY_REUSABLE is cleared if the pinentry is killed.  */
+static char *entry_envstr;
+static unsigned long entry_pid;
+static char *entry_flavor_version;
+static int entry_reusable;
+
+/* A pinentry kept running after use.  This object is protected by
+ * ENTRY_LOCK.  */
+static struct
+{
+  assuan_context_t ctx;  /* NULL or the Assuan context.  */
+  char *envstr;          /* The entry_envstr of that pinentry.  */
+  unsigned long pid;
+  char *flavor_version;
+  time_t since;          /* Time the pinentry has become idle.  */
+  int timer_running;     /* The idle_entry_thread is running.  */
+} idle_entry;
+
 /* A mutex used to serialize access to the pinentry. */
 static npth_mutex_t entry_lock;
 
@@ -145,15 +167,112 @@ agent_reset_query (ctrl_t ctrl)
 }
 
 
+/* Disconnect the idle pinentry.  Must be called with ENTRY_LOCK
+ * held.  */
+static void
+release_idle_entry (void)
+{
+  if (!idle_entry.ctx)
+    return;
+  if (DBG_IPC)
+    log_debug ("closing the idle PIN Entry\n");
+  assuan_release (idle_entry.ctx);
+  idle_entry.ctx = NULL;
+  xfree (idle_entry.envstr);
+  idle_entry.envstr = NULL;
+  xfree (idle_entry.flavor_version);
+  idle_entry.flavor_version = NULL;
+}
+
+
+/* Thread to disconnect the idle pinentry after the timeout.  */
+static void *
+idle_entry_thread (void *arg)
+{
+  time_t now;
+  int err;
+
+  (void)arg;
+
+  for (;;)
+    {
+      err = npth_mutex_lock (&entry_lock);
+      if (err)
+        {
+          log_error ("failed to acquire the entry lock: %s\n",
+                     strerror (err));
+          /* The timer_running flag stays set, thus the pinentry will
+           * not be put into the idle state again.  */
+          return NULL;
+        }
+      now = gnupg_get_time ();
+      if (idle_entry.ctx
+          && now >= idle_entry.since + (time_t)opt.pinentry_idle_timeout)
+        release_idle_entry ();
+      if (!idle_entry.ctx)
+        {
+          idle_entry.timer_running = 0;
+          npth_mutex_unlock (&entry_lock);
+          break;
+        }
+      now = idle_entry.since + opt.pinentry_idle_timeout - now;
+      npth_mutex_unlock (&entry_lock);
+      npth_sleep (now);
+    }
+
+  return NULL;
+}
+
+
+/* Make sure that the idle_entry_thread is running.  Must be called
+ * with ENTRY_LOCK held.  */
+static gpg_error_t
+start_idle_entry_timer (void)
+{
+  npth_attr_t tattr;
+  npth_t thread;
+  int err;
+
+  if (idle_entry.timer_running)
+    return 0;
+
+  err = npth_attr_init (&tattr);
+  if (err)
+    return gpg_error_from_errno (err);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  err = npth_create (&thread, &tattr, idle_entry_thread, NULL);
+  npth_attr_destroy (&tattr);
+  if (err)
+    {
+      log_error ("error spawning pinentry timer thread: %s\n",
+                 strerror (err));
+      return gpg_error_from_errno (err);
+    }
+  npth_setname_np (thread, "pinentry-idle");
+  idle_entry.timer_running = 1;
+  return 0;
+}
+
+
 /* Unlock the pinentry so that another thread can start one and
    disconnect that pinentry - we do this after the unlock so that a
    stalled pinentry does not block other threads.  Fixme: We should
-   have a timeout in Assuan for the disconnect operation. */
+   have a timeout in Assuan for the disconnect operation.  If the
+   pinentry is to be kept for later use it is not disconnected but
+   stored in IDLE_ENTRY.  */
 static gpg_error_t
 unlock_pinentry (ctrl_t ctrl, gpg_error_t rc)
 {
   assuan_context_t ctx = entry_ctx;
   int err;
+  int keep;
+
+  /* Only these return codes guarantee that the pinentry is still in
+   * a sane state.  */
+  keep = (!rc
+          || gpg_err_code (rc) == GPG_ERR_CANCELED
+          || gpg_err_code (rc) == GPG_ERR_FULLY_CANCELED
+          || gpg_err_code (rc) == GPG_ERR_NOT_CONFIRMED);
 
   if (rc)
     {
@@ -191,6 +310,24 @@ unlock_pinentry (ctrl_t ctrl, gpg_error_t rc)
   if (--ctrl->pinentry_active == 0)
     {
       entry_ctx = NULL;
+      if (keep && ctx && entry_reusable && entry_envstr
+          && opt.pinentry_idle_timeout && !idle_entry.ctx
+          && !start_idle_entry_timer ())
+        {
+          idle_entry.ctx = ctx;
+          ctx = NULL;
+          idle_entry.envstr = entry_envstr;
+          entry_envstr = NULL;
+          idle_entry.pid = entry_pid;
+          idle_entry.flavor_version = entry_flavor_version;
+          entry_flavor_version = NULL;
+          idle_entry.since = gnupg_get_time ();
+        }
+      xfree (entry_envstr);
+      entry_envstr = NULL;
+      xfree (entry_flavor_version);
+      entry_flavor_version = NULL;
+      entry_reusable = 0;
       err = npth_mutex_unlock (&entry_lock);
       if (err)
         {
@@ -301,6 +438,88 @@ getinfo_pid_cb (void *opaque, const void *buffer, size_t length)
 }
 
 
+/* Return a malloced string describing everything which is used to
+ * start and set up a pinentry from PGMNAME for CTRL.  A pinentry kept
+ * running after use is only used again if this string matches.
+ * Returns NULL on error.  */
+static char *
+make_entry_envstr (ctrl_t ctrl, const char *pgmname)
+{
+  membuf_t mb;
+  int iterator = 0;
+  const char *name, *value;
+
+  init_membuf (&mb, 512);
+  put_membuf_printf (&mb, "%s\n%d%d%d%d\n%lu\n%s\n%s\n%s\n%s\n",
+                     pgmname,
+                     opt.keep_display, opt.no_grab,
+                     opt.allow_external_cache, opt.allow_emacs_pinentry,
+                     opt.pinentry_timeout,
+                     opt.pinentry_invisible_char?
+                     opt.pinentry_invisible_char : "",
+                     opt.pinentry_touch_file? opt.pinentry_touch_file : "",
+                     ctrl->lc_ctype? ctrl->lc_ctype : "",
+                     ctrl->lc_messages? ctrl->lc_messages : "");
+  while ((name = session_env_list_stdenvnames (&iterator, NULL)))
+    {
+      value = session_env_getenv (ctrl->session_env, name);
+      if (value)
+        put_membuf_printf (&mb, "%s=%s\n", name, value);
+    }
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
+
+
+/* Tell the pinentry about the client of CTRL.  */
+static void
+set_entry_owner (ctrl_t ctrl)
+{
+  char *optstr;
+  const char *nodename = "";
+#ifndef HAVE_W32_SYSTEM
+  struct utsname utsbuf;
+#endif
+
+  if (!ctrl->client_pid)
+    return;
+
+#ifndef HAVE_W32_SYSTEM
+  if (!uname (&utsbuf))
+    nodename = utsbuf.nodename;
+#endif /*!HAVE_W32_SYSTEM*/
+
+  if ((optstr = xtryasprintf ("OPTION owner=%lu/%d %s",
+                              ctrl->client_pid, ctrl->client_uid,
+                              nodename)))
+    {
+      assuan_transact (entry_ctx, optstr, NULL, NULL, NULL, NULL, NULL,
+                       NULL);
+      /* We ignore errors because this is just a fancy thing and
+         older pinentries do not support this feature.  */
+      xfree (optstr);
+    }
+}
+
+
+/* Notify the client of CTRL about the pinentry.  */
+static gpg_error_t
+notify_entry_launched (ctrl_t ctrl)
+{
+  gpg_error_t rc;
+
+  if (entry_pid == (unsigned long)(-1L))
+    return 0;
+
+  rc = agent_inq_pinentry_launched (ctrl, entry_pid, entry_flavor_version);
+  if (gpg_err_code (rc) == GPG_ERR_CANCELED
+      || gpg_err_code (rc) == GPG_ERR_FULLY_CANCELED)
+    return unlock_pinentry (ctrl, gpg_err_make (GPG_ERR_SOURCE_DEFAULT,
+                                                gpg_err_code (rc)));
+  return 0;
+}
+
+
 /* Fork off the pin entry if this has not already been done.  Note,
    that this function must always be used to acquire the lock for the
    pinentry - we will serialize _all_ pinentry calls.
@@ -320,6 +539,7 @@ start_pinentry (ctrl_t ctrl)
   const char *value;
   struct timespec abstime;
   char *flavor_version;
+  char *envstr = NULL;
   int err;
 
   if (ctrl->pinentry_active)
@@ -377,6 +597,33 @@ start_pinentry (ctrl_t ctrl)
   else
     pgmname++;
 
+  if (opt.pinentry_idle_timeout)
+    envstr = make_entry_envstr (ctrl, full_pgmname);
+
+  /* Use the pinentry kept from a former request if it has been
+   * started for the same environment and is still alive.  */
+  if (idle_entry.ctx && envstr && !strcmp (envstr, idle_entry.envstr)
+      && !assuan_transact (idle_entry.ctx, "RESET",
+                           NULL, NULL, NULL, NULL, NULL, NULL))
+    {
+      if (opt.verbose)
+        log_info ("using the running PIN Entry\n");
+      ctrl->pinentry_active = 1;
+      entry_ctx = idle_entry.ctx;
+      idle_entry.ctx = NULL;
+      entry_envstr = envstr;
+      entry_pid = idle_entry.pid;
+      entry_flavor_version = idle_entry.flavor_version;
+      idle_entry.flavor_version = NULL;
+      xfree (idle_entry.envstr);
+      idle_entry.envstr = NULL;
+      entry_reusable = 1;
+
+      set_entry_owner (ctrl);
+      return notify_entry_launched (ctrl);
+    }
+  release_idle_entry ();
+
   /* OS X needs the entire file name in argv[0], so that it can locate
      the resource bundle.  For other systems we stick to the usual
      convention of supplying only the name of the program.  */
@@ -405,11 +652,13 @@ start_pinentry (ctrl_t ctrl)
   if (rc)
     {
       log_error ("can't allocate assuan context: %s\n", gpg_strerror (rc));
+      xfree (envstr);
       return rc;
     }
 
   ctrl->pinentry_active = 1;
   entry_ctx = ctx;
+  entry_envstr = envstr;
 
   /* We don't want to log the pinentry communication to make the logs
      easier to read.  We might want to add a new debug option to enable
@@ -636,28 +885,7 @@ start_pinentry (ctrl_t ctrl)
     }
 
   /* Tell Pinentry about our client.  */
-  if (ctrl->client_pid)
-    {
-      char *optstr;
-      const char *nodename = "";
-
-#ifndef HAVE_W32_SYSTEM
-      struct utsname utsbuf;
-      if (!uname (&utsbuf))
-        nodename = utsbuf.nodename;
-#endif /*!HAVE_W32_SYSTEM*/
-
-      if ((optstr = xtryasprintf ("OPTION owner=%lu/%d %s",
-                                  ctrl->client_pid, ctrl->client_uid,
-                                  nodename)))
-        {
-          assuan_transact (entry_ctx, optstr, NULL, NULL, NULL, NULL, NULL,
-                           NULL);
-          /* We ignore errors because this is just a fancy thing and
-             older pinentries do not support this feature.  */
-          xfree (optstr);
-        }
-    }
+  set_entry_owner (ctrl);
 
 
   /* Ask the pinentry for its version and flavor and store that as a
@@ -685,12 +913,15 @@ start_pinentry (ctrl_t ctrl)
     put_membuf (&mb, "", 1);
     flavor_version = get_membuf (&mb, NULL);
   }
+  entry_flavor_version = flavor_version;
 
 
   /* Now ask the Pinentry for its PID.  If the Pinentry is new enough
      it will send the pid back and we will use an inquire to notify
      our client.  The client may answer the inquiry either with END or
      with CAN to cancel the pinentry. */
+  entry_pid = (unsigned long)(-1L);
+  entry_reusable = 1;
   rc = assuan_transact (entry_ctx, "GETINFO pid",
                         getinfo_pid_cb, &pinentry_pid,
                         NULL, NULL, NULL, NULL);
@@ -703,16 +934,10 @@ start_pinentry (ctrl_t ctrl)
     log_error ("pinentry did not return a PID\n");
   else
     {
-      rc = agent_inq_pinentry_launched (ctrl, pinentry_pid, flavor_version);
-      if (gpg_err_code (rc) == GPG_ERR_CANCELED
-          || gpg_err_code (rc) == GPG_ERR_FULLY_CANCELED)
-        return unlock_pinentry (ctrl, gpg_err_make (GPG_ERR_SOURCE_DEFAULT,
-                                                    gpg_err_code (rc)));
-      rc = 0;
+      entry_pid = pinentry_pid;
+      rc = notify_entry_launched (ctrl);
     }
 
-  xfree (flavor_version);
-
   return rc;
 }
 
@@ -1316,6 +1541,7 @@ watch_sock (void *arg)
         break;
     }
 
+  entry_reusable = 0;
   assuan_pipe_kill_server (entry_ctx);
 
   return NULL;
@@ -2128,7 +2354,10 @@ agent_popup_message_stop (ctrl_t ctrl)
   if (popup_finished)
     ; /* Already finished and ready for joining. */
   else
-    assuan_pipe_kill_server (entry_ctx);
+    {
+      entry_reusable = 0;
+      assuan_pipe_kill_server (entry_ctx);
+    }
 
   /* Now wait for the thread to terminate. */
   rc = npth_join (popup_tid, NULL);
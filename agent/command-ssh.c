@@ -234,9 +234,10 @@ struct ssh_control_file_s
 /* Two objects definition to hold keys for later sorting.  */
 struct key_collection_item_s
 {
-  gcry_sexp_t key;  /* Public key. (owned by us)                        */
+  gcry_sexp_t key;  /* Public key. (owned by us unless SHARED is set)   */
   char *cardsn;     /* Serial number of a card or NULL. (owned by us)   */
   int order;        /* Computed ordinal                                 */
+  int shared;       /* KEY is owned by an ssh_keylist_s object.         */
 };
 
 struct key_collection_s
@@ -247,6 +248,55 @@ struct key_collection_s
 };
 
 
+/* The state of the files used to build the key list for
+ * REQUEST_IDENTITIES.  If this changes the key list is rebuilt.  */
+struct ssh_keylist_stamp_s
+{
+  unsigned int gen;        /* Value of ssh_keylist_gen.  */
+  unsigned int keydir_gen; /* Value from agent_keydir_generation.  */
+  time_t keydir_mtime;     /* Only used if the directory is not watched.  */
+  time_t cf_mtime;         /* The stat info of the sshcontrol file.  */
+  off_t cf_size;
+  ino_t cf_ino;
+};
+
+/* An item of that list; this describes one file in the private key
+ * directory. */
+struct ssh_keylist_item_s
+{
+  unsigned char grip[KEYGRIP_LEN];
+  gcry_sexp_t key;  /* The public key or NULL if it is not to be used. */
+  int order;        /* The computed ordinal.  */
+};
+
+/* The list of keys used for REQUEST_IDENTITIES.  Keys on cards are
+ * not cached because they depend on the inserted cards.  */
+struct ssh_keylist_s
+{
+  unsigned int refcount;
+  struct ssh_keylist_stamp_s stamp;
+  size_t nitems;
+  struct ssh_keylist_item_s *items;
+  /* The serialized answer if no card is available and its number of
+   * keys; BLOB is NULL if not yet known.  */
+  void *blob;
+  size_t bloblen;
+  u32 blobcount;
+};
+typedef struct ssh_keylist_s *ssh_keylist_t;
+
+/* The current key list or NULL.  */
+static ssh_keylist_t ssh_keylist;
+
+/* Incremented to invalidate the key list.  */
+static unsigned int ssh_keylist_gen;
+
+/* Counters for ssh_get_keylist_stats.  */
+static unsigned long ssh_keylist_hits;    /* The serialized list was used. */
+static unsigned long ssh_keylist_partial; /* The cached keys were used.  */
+static unsigned long ssh_keylist_misses;  /* The list was rebuilt.  */
+
+
 /* Prototypes.  */
 static gpg_error_t ssh_handler_request_identities (ctrl_t ctrl,
 						   estream_t request,
@@ -1129,6 +1179,7 @@ add_control_entry (ctrl_t ctrl, ssh_key_type_spec_t *spec,
       /* Not yet in the file - add it. Because the file has been
          opened in append mode, we simply need to write to it.  */
       tp = localtime (&atime);
+      ssh_keylist_gen++;
       es_fprintf (cf->fp,
                ("# %s key added on: %04d-%02d-%02d %02d:%02d:%02d\n"
                 "# Fingerprints:  %s\n"
@@ -2516,7 +2567,7 @@ get_ssh_keyinfo_on_cards (ctrl_t ctrl)
  * CARDSN.  */
 static gpg_error_t
 add_to_key_array (struct key_collection_s *array, gcry_sexp_t key,
-                  char *cardsn, int order)
+                  char *cardsn, int order, int shared)
 {
   if (array->nitems == array->allocated)
     {
@@ -2533,6 +2584,7 @@ add_to_key_array (struct key_collection_s *array, gcry_sexp_t key,
   array->items[array->nitems].key = key;
   array->items[array->nitems].cardsn = cardsn;
   array->items[array->nitems].order = order;
+  array->items[array->nitems].shared = shared;
   array->nitems++;
   return 0;
 }
@@ -2547,7 +2599,8 @@ free_key_array (struct key_collection_s *array)
 
       for (n = 0; n < array->nitems; n++)
         {
-          gcry_sexp_release (array->items[n].key);
+          if (!array->items[n].shared)
+            gcry_sexp_release (array->items[n].key);
           xfree (array->items[n].cardsn);
         }
       xfree (array->items);
@@ -2573,8 +2626,84 @@ compare_key_collection_items (const void *arg_a, const void *arg_b)
 }
 
 
+/* Release a reference to LIST.  */
+static void
+release_keylist (ssh_keylist_t list)
+{
+  size_t n;
+
+  if (!list)
+    return;
+  log_assert (list->refcount);
+  if (--list->refcount)
+    return;
+  for (n=0; n < list->nitems; n++)
+    gcry_sexp_release (list->items[n].key);
+  xfree (list->items);
+  xfree (list->blob);
+  xfree (list);
+}
+
+
+/* Store the current state of the files used for the key list at
+ * STAMP.  */
+static void
+get_keylist_stamp (struct ssh_keylist_stamp_s *stamp)
+{
+  char *fname;
+  struct stat st;
+  int watched;
+
+  memset (stamp, 0, sizeof *stamp);
+  stamp->gen = ssh_keylist_gen;
+  stamp->keydir_gen = agent_keydir_generation (&watched);
+  if (!watched)
+    {
+      /* Key files are replaced by a rename thus the mtime of the
+       * directory is sufficient to detect changes by other
+       * processes.  */
+      fname = make_filename_try (gnupg_homedir (),
+                                 GNUPG_PRIVATE_KEYS_DIR, NULL);
+      if (fname && !gnupg_stat (fname, &st))
+        stamp->keydir_mtime = st.st_mtime;
+      else
+        stamp->keydir_mtime = (time_t)(-1);
+      xfree (fname);
+    }
+
+  fname = make_filename_try (gnupg_homedir (), SSH_CONTROL_FILE_NAME, NULL);
+  if (fname && !gnupg_stat (fname, &st))
+    {
+      stamp->cf_mtime = st.st_mtime;
+      stamp->cf_size = st.st_size;
+      stamp->cf_ino = st.st_ino;
+    }
+  else
+    stamp->cf_mtime = (time_t)(-1);
+  xfree (fname);
+}
+
+
+/* Return true if the stamps A and B describe the same state.  */
+static int
+keylist_stamp_equal (const struct ssh_keylist_stamp_s *a,
+                     const struct ssh_keylist_stamp_s *b)
+{
+  return (a->gen == b->gen
+          && a->keydir_gen == b->keydir_gen
+          && a->keydir_mtime == b->keydir_mtime
+          && a->cf_mtime == b->cf_mtime
+          && a->cf_size == b->cf_size
+          && a->cf_ino == b->cf_ino
+          && a->cf_mtime != (time_t)(-1)
+          && a->keydir_mtime != (time_t)(-1));
+}
+
+
+/* Build a new key list from the private key directory and the
+ * sshcontrol file and store it at R_LIST.  */
 static gpg_error_t
-ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
+build_keylist (ctrl_t ctrl, ssh_keylist_t *r_list)
 {
   gpg_error_t err;
   char *dirname;
@@ -2582,18 +2711,23 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
   gnupg_dirent_t dir_entry;
   char hexgrip[41];
   ssh_control_file_t cf = NULL;
-  struct card_key_info_s *keyinfo_on_cards, *l;
-  char *cardsn;
-  gcry_sexp_t key_public = NULL;
-  int count;
-  struct key_collection_s keyarray = { NULL };
+  ssh_keylist_t list;
+  struct ssh_keylist_item_s *item;
+  size_t allocated = 0;
+
+  *r_list = NULL;
+
+  list = xtrycalloc (1, sizeof *list);
+  if (!list)
+    return gpg_error_from_syserror ();
+  list->refcount = 1;
+  /* Take the stamp first so that changes done while we are reading
+   * the files lead to a rebuild with the next request.  */
+  get_keylist_stamp (&list->stamp);
 
   err = open_control_file (&cf, 0);
   if (err)
-    return err;
-
-  /* First, get information keys available on cards on-line. */
-  keyinfo_on_cards = get_ssh_keyinfo_on_cards (ctrl);
+    goto leave;
 
   /* Look at all the registered and non-disabled keys, in sshcontrol.  */
   /* And, look at all keys with "Use-for-ssh:" flag.  */
@@ -2602,28 +2736,23 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
   if (!dirname)
     {
       err = gpg_error_from_syserror ();
-      ssh_close_control_file (cf);
-      agent_card_free_keyinfo (keyinfo_on_cards);
-      return err;
+      goto leave;
     }
   dir = gnupg_opendir (dirname);
   if (!dir)
     {
       err = gpg_error_from_syserror ();
       xfree (dirname);
-      ssh_close_control_file (cf);
-      agent_card_free_keyinfo (keyinfo_on_cards);
-      return err;
+      goto leave;
     }
   xfree (dirname);
 
   while ( (dir_entry = gnupg_readdir (dir)) )
     {
-      struct card_key_info_s *l_prev = NULL;
       int disabled, is_ssh, lnr, order;
       unsigned char grip[20];
+      gcry_sexp_t key_public = NULL;
 
-      cardsn = NULL;
       if (strlen (dir_entry->d_name) != 44
           || strcmp (dir_entry->d_name + 40, ".key"))
         continue;
@@ -2633,13 +2762,6 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
       if ( hex2bin (hexgrip, grip, 20) < 0 )
         continue; /* Bad hex string.  */
 
-      /* Check if it's a key on card.  */
-      for (l = keyinfo_on_cards; l; l = l->next)
-        if (!memcmp (l->keygrip, hexgrip, 40))
-          break;
-        else
-          l_prev = l;
-
       /* Check if it's listed in "ssh_control" file.  */
       disabled = is_ssh = 0;
       err = search_control_file (cf, hexgrip, &disabled, NULL, NULL, &lnr);
@@ -2651,7 +2773,12 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
             }
         }
       else if (gpg_err_code (err) != GPG_ERR_EOF)
-        break;
+        {
+          /* Stop at a broken sshcontrol file but use the keys found
+           * so far.  */
+          err = 0;
+          break;
+        }
 
       /* Clamp LNR value and set the ordinal.
        * Current use of ordinals:
@@ -2667,7 +2794,173 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
           else if (lnr > 99999)
             lnr = 99999;
           order = lnr + 100000;
+          err = agent_public_key_from_file (ctrl, grip, &key_public);
+        }
+      else /* Examine the file if it's suitable for SSH.  */
+        {
+          err = agent_ssh_key_from_file (ctrl, grip, &key_public, &order);
+          if (err)
+            order = 0;
+          else if (order < 0)
+            {
+              order = -order;
+              if (order > 999)
+                order = 999;
+            }
+          else if (order > 99999)
+            order =  299999;
+          else
+            order += 200000;
         }
+      /* On error we keep the item with KEY_PUBLIC set to NULL so that
+       * the key is still recognized as being on a card.  */
+      err = 0;
+
+      if (list->nitems == allocated)
+        {
+          size_t newsize = allocated + 64;
+
+          item = xtryreallocarray (list->items, allocated, newsize,
+                                   sizeof *item);
+          if (!item)
+            {
+              err = gpg_error_from_syserror ();
+              gcry_sexp_release (key_public);
+              goto leave;
+            }
+          allocated = newsize;
+          list->items = item;
+        }
+      item = list->items + list->nitems++;
+      memcpy (item->grip, grip, KEYGRIP_LEN);
+      item->key = key_public;
+      item->order = order;
+    }
+
+ leave:
+  if (dir)
+    gnupg_closedir (dir);
+  ssh_close_control_file (cf);
+  if (err)
+    release_keylist (list);
+  else
+    *r_list = list;
+  return err;
+}
+
+
+/* Return a reference to the current key list at R_LIST.  The list is
+ * rebuilt if one of the involved files has changed.  */
+static gpg_error_t
+get_keylist (ctrl_t ctrl, ssh_keylist_t *r_list)
+{
+  gpg_error_t err;
+  struct ssh_keylist_stamp_s stamp;
+  ssh_keylist_t list;
+
+  *r_list = NULL;
+
+  if (ssh_keylist)
+    {
+      get_keylist_stamp (&stamp);
+      if (ssh_keylist && keylist_stamp_equal (&stamp, &ssh_keylist->stamp))
+        {
+          ssh_keylist->refcount++;
+          *r_list = ssh_keylist;
+          return 0;
+        }
+    }
+
+  ssh_keylist_misses++;
+  err = build_keylist (ctrl, &list);
+  if (err)
+    return err;
+
+  /* Another thread might have built a list meanwhile; we replace it
+   * because ours is at least as new.  */
+  release_keylist (ssh_keylist);
+  ssh_keylist = list;
+  list->refcount++;
+  *r_list = list;
+  return 0;
+}
+
+
+/* Return a malloced string with statistics about the key list for
+ * "GETINFO ssh_keylist_stats".  Returns NULL on error.  */
+char *
+ssh_get_keylist_stats (void)
+{
+  return xtryasprintf ("hits=%lu partial=%lu misses=%lu keys=%lu",
+                       ssh_keylist_hits, ssh_keylist_partial,
+                       ssh_keylist_misses,
+                       ssh_keylist? (unsigned long)ssh_keylist->nitems : 0);
+}
+
+
+static gpg_error_t
+ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
+{
+  gpg_error_t err;
+  struct card_key_info_s *keyinfo_on_cards, *l;
+  char *cardsn;
+  gcry_sexp_t key_public = NULL;
+  int count;
+  struct key_collection_s keyarray = { NULL };
+  ssh_keylist_t list = NULL;
+  struct ssh_keylist_item_s *item;
+  size_t n;
+  estream_t blobfp = NULL;
+  void *blob;
+  size_t bloblen;
+  unsigned long misses = ssh_keylist_misses;
+
+  /* First, get information keys available on cards on-line. */
+  keyinfo_on_cards = get_ssh_keyinfo_on_cards (ctrl);
+
+  err = get_keylist (ctrl, &list);
+  if (err)
+    goto leave;
+
+  /* Without any card the answer depends only on the files.  */
+  if (!keyinfo_on_cards && list->blob)
+    {
+      ssh_keylist_hits++;
+      if (es_write (key_blobs, list->blob, list->bloblen, NULL))
+        err = gpg_error_from_syserror ();
+      else
+        *r_key_counter = list->blobcount;
+      goto leave;
+    }
+  if (misses == ssh_keylist_misses)
+    ssh_keylist_partial++;
+
+  if (!keyinfo_on_cards)
+    {
+      /* Render into a separate buffer to cache the answer.  */
+      blobfp = es_fopenmem (0, "w+b");
+    }
+
+  for (n=0; n < list->nitems; n++)
+    {
+      struct card_key_info_s *l_prev = NULL;
+      char itemhex[2*KEYGRIP_LEN+1];
+
+      item = list->items + n;
+      cardsn = NULL;
+
+      /* Check if it's a key on card.  */
+      if (keyinfo_on_cards)
+        {
+          bin2hex (item->grip, KEYGRIP_LEN, itemhex);
+          for (l = keyinfo_on_cards; l; l = l->next)
+            if (!memcmp (l->keygrip, itemhex, 40))
+              break;
+            else
+              l_prev = l;
+        }
+      else
+        l = NULL;
 
       if (l)
         {
@@ -2682,51 +2975,32 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
           xfree (l->usage);
           xfree (l);
           l = NULL;
+          if (err)
+            {
+              /* Clear ERR, skipping the key in question.  */
+              err = 0;
+              continue;
+            }
           /* If we want to allow that the user to change the sorting
            * order of card keys (which are sorted by their s/n), we
            * would need to get the use-for-ssh: value from the stub
            * file and set an appropriate ordinal.  */
-          order = 1000;
-        }
-      else if (is_ssh)
-        err = agent_public_key_from_file (ctrl, grip, &key_public);
-      else /* Examine the file if it's suitable for SSH.  */
-        {
-          err = agent_ssh_key_from_file (ctrl, grip, &key_public, &order);
+          err = add_to_key_array (&keyarray, key_public, cardsn, 1000, 0);
           if (err)
-            order = 0;
-          else if (order < 0)
             {
-              order = -order;
-              if (order > 999)
-                order = 999;
+              gcry_sexp_release (key_public);
+              xfree (cardsn);
+              goto leave;
             }
-          else if (order > 99999)
-            order =  299999;
-          else
-            order += 200000;
-        }
-      if (err)
-        {
-          /* Clear ERR, skipping the key in question.  */
-          err = 0;
-          continue;
         }
-
-      err = add_to_key_array (&keyarray, key_public, cardsn, order);
-      if (err)
+      else if (item->key)
         {
-          gnupg_closedir (dir);
-          ssh_close_control_file (cf);
-          gcry_sexp_release (key_public);
-          xfree (cardsn);
-          goto leave;
+          err = add_to_key_array (&keyarray, item->key, NULL, item->order, 1);
+          if (err)
+            goto leave;
         }
     }
 
-  gnupg_closedir (dir);
-  ssh_close_control_file (cf);
-
   /* Lastly, handle remaining keys which don't have the stub files.  */
   for (l = keyinfo_on_cards, count=0; l; l = l->next, count++)
      {
@@ -2734,7 +3008,8 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
        if (card_key_available (ctrl, l, &key_public, &cardsn))
          continue;
 
-       err = add_to_key_array (&keyarray, key_public, cardsn, 300000+count);
+       err = add_to_key_array (&keyarray, key_public, cardsn, 300000+count,
+                               0);
        if (err)
          {
            gcry_sexp_release (key_public);
@@ -2755,7 +3030,8 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
   /* And print the keys.  */
   for (count=0; count < keyarray.nitems; count++)
     {
-      err = ssh_send_key_public (key_blobs, keyarray.items[count].key,
+      err = ssh_send_key_public (blobfp? blobfp : key_blobs,
+                                 keyarray.items[count].key,
                                  keyarray.items[count].cardsn);
       if (err)
         {
@@ -2774,12 +3050,39 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
     }
   *r_key_counter = count;
 
+  if (blobfp)
+    {
+      if (es_fclose_snatch (blobfp, &blob, &bloblen))
+        {
+          err = gpg_error_from_syserror ();
+          blobfp = NULL;
+          goto leave;
+        }
+      blobfp = NULL;
+      if (bloblen && es_write (key_blobs, blob, bloblen, NULL))
+        {
+          err = gpg_error_from_syserror ();
+          xfree (blob);
+          goto leave;
+        }
+      if (!list->blob)
+        {
+          list->blob = blob;
+          list->bloblen = bloblen;
+          list->blobcount = count;
+        }
+      else
+        xfree (blob);
+    }
+
  leave:
+  es_fclose (blobfp);
   agent_card_free_keyinfo (keyinfo_on_cards);
   free_key_array (&keyarray);
+  release_keylist (list);
   return err;
 }
-
+
 
 /*
 
@@ -3933,6 +4236,7 @@ start_command_handler_ssh_stream (ctrl_t ctrl, estream_t stream)
          another request.  */
       int c;
 
+      agent_secarena_release (ctrl);
       c = es_fgetc (stream);
       if (c == EOF)
         break;
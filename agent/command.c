@@ -33,6 +33,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <npth.h>
 
 #include "agent.h"
 #include <assuan.h>
@@ -49,6 +50,11 @@
 #define MAXLEN_KEYPARAM 1024
 /* Maximum allowed size of key data as used in inquiries (bytes). */
 #define MAXLEN_KEYDATA 8192
+/* Maximum allowed size of the inquired hashes for PKSIGN --batch.  */
+#define MAXLEN_PKSIGN_BATCH (256*1024)
+/* Maximum allowed size of the inquired ciphertexts for
+ * PKDECRYPT --batch.  */
+#define MAXLEN_PKDECRYPT_BATCH (256*1024)
 /* Maximum length of a secret to store under one key.  */
 #define MAXLEN_PUT_SECRET 4096
 /* The size of the import/export KEK key (in bytes).  */
@@ -122,9 +128,46 @@ struct server_local_s
     unsigned int maybe_key_change;
   } last_card_keyinfo;
 
+  /* The time the current command has been started and a flag set
+   * by leave_cmd if it failed.  Used for "GETINFO stats".  */
+  struct timespec cmd_start;
+  int cmd_failed;
 };
 
 
+/* The number of buckets of the command latency histograms.  Bucket N
+ * counts the commands which took less than 2^N milliseconds; the last
+ * bucket also counts all slower commands.  */
+#define CMD_STATS_BUCKETS 18
+
+/* The commands for which statistics are kept.  All other commands are
+ * accounted to the last entry.  */
+static const char * const cmd_stats_names[] =
+  {
+    "PKSIGN", "PKDECRYPT", "GET_PASSPHRASE", "SCD", "GENKEY", "PASSWD",
+    "IMPORT_KEY", "EXPORT_KEY", "READKEY", "HAVEKEY", "KEYINFO",
+    "other"
+  };
+
+/* Statistics for the commands from CMD_STATS_NAMES as returned by
+ * "GETINFO stats".  */
+static struct
+{
+  unsigned long count;
+  unsigned long errors;
+  unsigned long long total_ms;
+  unsigned long max_ms;
+  unsigned long hist[CMD_STATS_BUCKETS];
+} cmd_stats[DIM (cmd_stats_names)];
+
+/* The names of the cache modes for "GETINFO stats".  */
+static const char * const cache_mode_names[] =
+  {
+    NULL, "any", "normal", "user", "ssh", "nonce", "pin", "data",
+    "seckey", "kek", "sesskey"
+  };
+
+
 /* An entry for the getval/putval commands. */
 struct putval_item_s
 {
@@ -416,15 +459,17 @@ leave_cmd (assuan_context_t ctx, gpg_error_t err)
   if (err)
     {
       const char *name = assuan_get_command_name (ctx);
+      ctrl_t ctrl = assuan_get_pointer (ctx);
+
       if (!name)
         name = "?";
 
+      ctrl->server_local->cmd_failed = 1;
+
       /* Not all users of gpg-agent know about the fully canceled
          error code; map it back if needed.  */
       if (gpg_err_code (err) == GPG_ERR_FULLY_CANCELED)
         {
-          ctrl_t ctrl = assuan_get_pointer (ctx);
-
           if (!ctrl->server_local->allow_fully_canceled)
             err = gpg_err_make (gpg_err_source (err), GPG_ERR_CANCELED);
         }
@@ -875,6 +920,40 @@ cmd_setkeydesc (assuan_context_t ctx, char *line)
 }
 
 
+/* Parse the --hash=<name> option in LINE of CTX and store the
+ * algorithm at R_ALGO.  0 is stored if the option is not given or for
+ * "none".  */
+static gpg_error_t
+parse_hash_option (assuan_context_t ctx, const char *line, int *r_algo)
+{
+  *r_algo = 0;
+  if (has_option_name (line, "--hash"))
+    {
+      if (has_option (line, "--hash=sha1"))
+        *r_algo = GCRY_MD_SHA1;
+      else if (has_option (line, "--hash=sha224"))
+        *r_algo = GCRY_MD_SHA224;
+      else if (has_option (line, "--hash=sha256"))
+        *r_algo = GCRY_MD_SHA256;
+      else if (has_option (line, "--hash=sha384"))
+        *r_algo = GCRY_MD_SHA384;
+      else if (has_option (line, "--hash=sha512"))
+        *r_algo = GCRY_MD_SHA512;
+      else if (has_option (line, "--hash=rmd160"))
+        *r_algo = GCRY_MD_RMD160;
+      else if (has_option (line, "--hash=md5"))
+        *r_algo = GCRY_MD_MD5;
+      else if (has_option (line, "--hash=tls-md5sha1"))
+        *r_algo = MD_USER_TLS_MD5SHA1;
+      else if (has_option (line, "--hash=none"))
+        *r_algo = 0;
+      else
+        return set_error (GPG_ERR_ASS_PARAMETER, "invalid hash algorithm");
+    }
+  return 0;
+}
+
+
 static const char hlp_sethash[] =
   "SETHASH (--hash=<name>)|(<algonumber>) <hexstring>]\n"
   "SETHASH [--pss] --inquire\n"
@@ -897,34 +976,9 @@ cmd_sethash (assuan_context_t ctx, char *line)
 
   /* Parse the alternative hash options which may be used instead of
      the algo number.  */
-  if (has_option_name (line, "--hash"))
-    {
-      if (has_option (line, "--hash=sha1"))
-        algo = GCRY_MD_SHA1;
-      else if (has_option (line, "--hash=sha224"))
-        algo = GCRY_MD_SHA224;
-      else if (has_option (line, "--hash=sha256"))
-        algo = GCRY_MD_SHA256;
-      else if (has_option (line, "--hash=sha384"))
-        algo = GCRY_MD_SHA384;
-      else if (has_option (line, "--hash=sha512"))
-        algo = GCRY_MD_SHA512;
-      else if (has_option (line, "--hash=rmd160"))
-        algo = GCRY_MD_RMD160;
-      else if (has_option (line, "--hash=md5"))
-        algo = GCRY_MD_MD5;
-      else if (has_option (line, "--hash=tls-md5sha1"))
-        algo = MD_USER_TLS_MD5SHA1;
-      else if (has_option (line, "--hash=none"))
-        algo = 0;
-      else
-        {
-          err = set_error (GPG_ERR_ASS_PARAMETER, "invalid hash algorithm");
-          goto leave;
-        }
-    }
-  else
-    algo = 0;
+  err = parse_hash_option (ctx, line, &algo);
+  if (err)
+    goto leave;
 
   opt_pss = has_option (line, "--pss");
   opt_inquire = has_option (line, "--inquire");
@@ -1008,9 +1062,16 @@ cmd_sethash (assuan_context_t ctx, char *line)
 
 static const char hlp_pksign[] =
   "PKSIGN [<options>] [<cache_nonce>]\n"
+  "PKSIGN --batch --hash=<name> [<cache_nonce>]\n"
   "\n"
   "Perform the actual sign operation.  Neither input nor output are\n"
-  "sensitive to eavesdropping.";
+  "sensitive to eavesdropping.\n"
+  "\n"
+  "With --batch the concatenated hash values of algorithm <name> are\n"
+  "inquired using the keyword HASHES and the key is unprotected only\n"
+  "once to sign all of them.  The signatures are returned as a\n"
+  "sequence of canonical S-expressions in the same order.  SETHASH\n"
+  "is not required in this case.";
 static gpg_error_t
 cmd_pksign (assuan_context_t ctx, char *line)
 {
@@ -1020,7 +1081,25 @@ cmd_pksign (assuan_context_t ctx, char *line)
   membuf_t outbuf;
   char *cache_nonce = NULL;
   char *p;
+  int opt_batch;
+  int algo = 0;
+  unsigned char *hashes = NULL;
+  size_t hasheslen = 0;
+  size_t dlen;
 
+  opt_batch = has_option (line, "--batch");
+  if (opt_batch)
+    {
+      err = parse_hash_option (ctx, line, &algo);
+      if (err)
+        goto leave;
+      if (!algo)
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER,
+                           "--batch requires a hash algorithm");
+          goto leave;
+        }
+    }
   line = skip_options (line);
 
   for (p=line; *p && *p != ' ' && *p != '\t'; p++)
@@ -1034,15 +1113,40 @@ cmd_pksign (assuan_context_t ctx, char *line)
   else if (!ctrl->server_local->use_cache_for_signing)
     cache_mode = CACHE_MODE_IGNORE;
 
+  if (opt_batch)
+    {
+      dlen = (algo == MD_USER_TLS_MD5SHA1)? 36 : gcry_md_get_algo_dlen (algo);
+      err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u",
+                                 MAXLEN_PKSIGN_BATCH);
+      if (!err)
+        err = assuan_inquire (ctx, "HASHES", &hashes, &hasheslen,
+                              MAXLEN_PKSIGN_BATCH);
+      if (err)
+        goto leave;
+      if (!dlen || !hasheslen || (hasheslen % dlen))
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER,
+                           "invalid length of the hash values");
+          goto leave;
+        }
+    }
+
   init_membuf (&outbuf, 512);
 
-  err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
-                      &outbuf, cache_mode);
+  if (opt_batch)
+    err = agent_pksign_batch (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                              algo, hashes, hasheslen / dlen,
+                              &outbuf, cache_mode);
+  else
+    err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                        &outbuf, cache_mode);
   if (err)
     clear_outbuf (&outbuf);
   else
     err = write_and_clear_outbuf (ctx, &outbuf);
 
+ leave:
+  xfree (hashes);
   xfree (cache_nonce);
   xfree (ctrl->server_local->keydesc);
   ctrl->server_local->keydesc = NULL;
@@ -1052,13 +1156,19 @@ cmd_pksign (assuan_context_t ctx, char *line)
 
 static const char hlp_pkdecrypt[] =
   "PKDECRYPT [--kem[=<kemid>] [<options>]\n"
+  "PKDECRYPT --batch\n"
   "\n"
   "Perform the actual decrypt operation.  Input is not\n"
   "sensitive to eavesdropping.\n"
   "If the --kem option is used, decryption is done with the KEM,\n"
   "inquiring upper-layer option, when needed.  KEMID can be\n"
   "specified with --kem option;  Valid value is: PQC-PGP, PGP, or CMS.\n"
-  "Default is PQC-PGP.";
+  "Default is PQC-PGP.\n"
+  "\n"
+  "With --batch the concatenated ciphertexts are inquired using the\n"
+  "keyword CIPHERTEXTS and decrypted with the same key.  For each\n"
+  "ciphertext one canonical S-expression is returned in the same\n"
+  "order: either the plaintext or (error <errorcode>).";
 static gpg_error_t
 cmd_pkdecrypt (assuan_context_t ctx, char *line)
 {
@@ -1072,8 +1182,13 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
   size_t optionlen = 0;
   const char *p;
   int kemid = -1;
+  int opt_batch;
 
+  opt_batch = has_option (line, "--batch");
   p = has_option_name (line, "--kem");
+  if (p && opt_batch)
+    return set_error (GPG_ERR_ASS_PARAMETER,
+                      "--batch may not be combined with --kem");
   if (p)
     {
       kemid = KEM_PQC_PGP;
@@ -1092,10 +1207,22 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
     }
 
   /* First inquire the data to decrypt */
-  rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_CIPHERTEXT);
-  if (!rc)
-    rc = assuan_inquire (ctx, "CIPHERTEXT",
-			&value, &valuelen, MAXLEN_CIPHERTEXT);
+  if (opt_batch)
+    {
+      rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u",
+                                MAXLEN_PKDECRYPT_BATCH);
+      if (!rc)
+        rc = assuan_inquire (ctx, "CIPHERTEXTS",
+                             &value, &valuelen, MAXLEN_PKDECRYPT_BATCH);
+    }
+  else
+    {
+      rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u",
+                                MAXLEN_CIPHERTEXT);
+      if (!rc)
+        rc = assuan_inquire (ctx, "CIPHERTEXT",
+                             &value, &valuelen, MAXLEN_CIPHERTEXT);
+    }
   if (!rc && kemid > KEM_PQC_PGP)
     rc = assuan_inquire (ctx, "OPTION",
                          &option, &optionlen, MAXLEN_CIPHERTEXT);
@@ -1104,7 +1231,10 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
 
   init_membuf (&outbuf, 512);
 
-  if (kemid < 0)
+  if (opt_batch)
+    rc = agent_pkdecrypt_batch (ctrl, ctrl->server_local->keydesc,
+                                value, valuelen, &outbuf, &padding);
+  else if (kemid < 0)
     rc = agent_pkdecrypt (ctrl, ctrl->server_local->keydesc,
                           value, valuelen, &outbuf, &padding);
   else
@@ -2319,6 +2449,7 @@ cmd_clear_passphrase (assuan_context_t ctx, char *line)
     return set_error (GPG_ERR_ASS_PARAMETER, "invalid length of cacheID");
 
   agent_put_cache (ctrl, cacheid, cache_mode, NULL, 0);
+  agent_flush_cache_seckey (cacheid);
 
   agent_clear_passphrase (ctrl, cacheid, cache_mode);
 
@@ -3903,6 +4034,92 @@ cmd_reloadagent (assuan_context_t ctx, char *line)
 
 
 
+/* Return a malloced string with the statistics for "GETINFO stats"
+ * or NULL on error.  If RESET is set all counters are cleared.  */
+static char *
+format_stats (int reset)
+{
+  membuf_t mb;
+  unsigned long hits, misses;
+  int i, n;
+
+  init_membuf (&mb, 1024);
+  for (i=0; i < DIM (cmd_stats); i++)
+    {
+      if (!cmd_stats[i].count)
+        continue;
+      put_membuf_printf (&mb, "cmd %s count=%lu errors=%lu total_ms=%llu"
+                         " max_ms=%lu hist=",
+                         cmd_stats_names[i],
+                         cmd_stats[i].count, cmd_stats[i].errors,
+                         cmd_stats[i].total_ms, cmd_stats[i].max_ms);
+      for (n=0; n < CMD_STATS_BUCKETS; n++)
+        put_membuf_printf (&mb, "%s%lu", n? ",":"", cmd_stats[i].hist[n]);
+      put_membuf (&mb, "\n", 1);
+    }
+  if (reset)
+    memset (cmd_stats, 0, sizeof cmd_stats);
+
+  for (i=0; i < DIM (cache_mode_names); i++)
+    {
+      if (!cache_mode_names[i])
+        continue;
+      agent_cache_get_stats (i, reset, &hits, &misses);
+      if (hits || misses)
+        put_membuf_printf (&mb, "cache %s hits=%lu misses=%lu\n",
+                           cache_mode_names[i], hits, misses);
+    }
+
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
+
+
+/* The metrics source for the statistics also returned by "GETINFO
+ * stats".  */
+void
+agent_command_metrics (metrics_writer_t w)
+{
+  unsigned long long bounds[CMD_STATS_BUCKETS - 1];
+  unsigned long hits[DIM (cache_mode_names)];
+  unsigned long misses[DIM (cache_mode_names)];
+  int i;
+
+  metrics_begin (w, METRIC_GAUGE, "connections",
+                 "Number of active connections.");
+  metrics_put (w, NULL, NULL, get_agent_active_connection_count ());
+
+  /* The buckets count commands which took less than 2^N ms.  */
+  for (i=0; i < DIM (bounds); i++)
+    bounds[i] = (1ULL << i) - 1;
+  metrics_begin (w, METRIC_HISTOGRAM, "command_duration_ms",
+                 "Duration of the commands in milliseconds.");
+  for (i=0; i < DIM (cmd_stats); i++)
+    metrics_put_histogram (w, "cmd", cmd_stats_names[i],
+                           bounds, cmd_stats[i].hist, CMD_STATS_BUCKETS,
+                           cmd_stats[i].total_ms);
+
+  metrics_begin (w, METRIC_COUNTER, "command_errors_total",
+                 "Number of commands which returned an error.");
+  for (i=0; i < DIM (cmd_stats); i++)
+    metrics_put (w, "cmd", cmd_stats_names[i], cmd_stats[i].errors);
+
+  for (i=0; i < DIM (cache_mode_names); i++)
+    if (cache_mode_names[i])
+      agent_cache_get_stats (i, 0, &hits[i], &misses[i]);
+  metrics_begin (w, METRIC_COUNTER, "cache_hits_total",
+                 "Number of cache lookups which found an item.");
+  for (i=0; i < DIM (cache_mode_names); i++)
+    if (cache_mode_names[i])
+      metrics_put (w, "mode", cache_mode_names[i], hits[i]);
+  metrics_begin (w, METRIC_COUNTER, "cache_misses_total",
+                 "Number of cache lookups which found no item.");
+  for (i=0; i < DIM (cache_mode_names); i++)
+    if (cache_mode_names[i])
+      metrics_put (w, "mode", cache_mode_names[i], misses[i]);
+}
+
+
 static const char hlp_getinfo[] =
   "GETINFO <what>\n"
   "\n"
@@ -3925,6 +4142,10 @@ static const char hlp_getinfo[] =
   "  jent_active     - Returns OK if Libgcrypt's JENT is active.\n"
   "  ephemeral       - Returns OK if the connection is in ephemeral mode.\n"
   "  restricted      - Returns OK if the connection is in restricted mode.\n"
+  "  ssh_keylist_stats - Return statistics about the cached ssh key list.\n"
+  "  secarena        - Return statistics about the secure memory arenas.\n"
+  "  stats [--reset] - Return command latency and cache statistics.\n"
+  "  metrics         - Return all metrics in the Prometheus text format.\n"
   "  cmd_has_option CMD OPT\n"
   "                  - Returns OK if command CMD has option OPT.\n";
 static gpg_error_t
@@ -4108,6 +4329,54 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       snprintf (numbuf, sizeof numbuf, "%lu", get_calibrated_s2k_count ());
       rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strncmp (line, "stats", 5) && (line[5] == ' ' || !line[5]))
+    {
+      char *s = format_stats (has_option (line, "--reset"));
+
+      if (!s)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          rc = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *s = metrics_format ();
+
+      if (!s)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          rc = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
+  else if (!strcmp (line, "ssh_keylist_stats"))
+    {
+      char *s = ssh_get_keylist_stats ();
+
+      if (!s)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          rc = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
+  else if (!strcmp (line, "secarena"))
+    {
+      char *s = agent_secarena_get_stats ();
+
+      if (!s)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          rc = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
   else if (!strcmp (line, "s2k_time"))
     {
       char numbuf[50];
@@ -4244,17 +4513,71 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)cmd;
+
+  npth_clock_gettime (&ctrl->server_local->cmd_start);
+  ctrl->server_local->cmd_failed = 0;
+  return 0;
+}
+
+
+/* Account the time since pre_cmd_notify to the statistics of the
+ * command NAME.  FAILED is true if the command returned an error.  */
+static void
+update_cmd_stats (ctrl_t ctrl, const char *name, int failed)
+{
+  struct timespec now;
+  unsigned long ms;
+  int i, n;
+
+  npth_clock_gettime (&now);
+  if (now.tv_sec < ctrl->server_local->cmd_start.tv_sec)
+    ms = 0;  /* Clock went backwards.  */
+  else
+    ms = ((now.tv_sec - ctrl->server_local->cmd_start.tv_sec) * 1000
+          + (now.tv_nsec - ctrl->server_local->cmd_start.tv_nsec) / 1000000);
+  if ((long)ms < 0)
+    ms = 0;
+
+  for (i=0; i < DIM (cmd_stats_names) - 1; i++)
+    if (name && !strcmp (name, cmd_stats_names[i]))
+      break;
+
+  for (n=0; n < CMD_STATS_BUCKETS - 1 && ms >= (1UL << n); n++)
+    ;
+
+  cmd_stats[i].count++;
+  if (failed)
+    cmd_stats[i].errors++;
+  cmd_stats[i].total_ms += ms;
+  if (ms > cmd_stats[i].max_ms)
+    cmd_stats[i].max_ms = ms;
+  cmd_stats[i].hist[n]++;
+}
+
+
 /* Called by libassuan after all commands. ERR is the error from the
-   last assuan operation and not the one returned from the command. */
+   last assuan operation and not the one returned from the command.
+   The latter is recorded by leave_cmd. */
 static void
 post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
 
-  (void)err;
+  update_cmd_stats (ctrl, assuan_get_command_name (ctx),
+                    err || ctrl->server_local->cmd_failed);
 
   /* Switch off any I/O monitor controlled logging pausing. */
   ctrl->server_local->pause_io_logging = 0;
+
+  /* Do not keep secure memory while the connection is idle.  */
+  agent_secarena_release (ctrl);
 }
 
 
@@ -4324,6 +4647,11 @@ command_has_option (const char *cmd, const char *cmdopt)
       if (!strcmp (cmdopt, "mode1003"))
         return 1;
     }
+  else if (!strcmp (cmd, "PKDECRYPT"))
+    {
+      if (!strcmp (cmdopt, "batch"))
+        return 1;
+    }
 
   return 0;
 }
@@ -4388,6 +4716,7 @@ register_commands (assuan_context_t ctx)
       if (rc)
         return rc;
     }
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
   assuan_register_post_cmd_notify (ctx, post_cmd_notify);
   assuan_register_reset_notify (ctx, reset_notify);
   assuan_register_option_handler (ctx, option_handler);
@@ -73,6 +73,192 @@ fname_from_keygrip (const unsigned char *grip, int for_new)
 }
 
 
+/* Information about a key file as returned by agent_key_info_from_file
+ * and agent_key_available.  These commands are used very often by
+ * clients and thus we keep the information in memory.  If the private
+ * key directory can be watched for changes, the cache is flushed on
+ * each change; else each item is checked against the file's stat
+ * information.  */
+struct keyinfo_item_s
+{
+  struct keyinfo_item_s *next;
+  unsigned char grip[KEYGRIP_LEN];
+  unsigned int missing:1;   /* There is no such key file.  */
+  unsigned int have_info:1; /* The fields below are valid.  */
+  int keytype;              /* The PRIVATE_KEY_ value.  */
+  unsigned char *shadow_info;      /* Malloced shadow info or NULL.  */
+  unsigned char *shadow_info_type; /* Malloced shadow type or NULL.  */
+  time_t mtime;             /* Stat info of the file when read.  */
+  off_t size;
+  ino_t ino;
+};
+typedef struct keyinfo_item_s *keyinfo_item_t;
+
+/* The number of hash buckets and the maximum number of items.  */
+#define KEYINFO_CACHE_BUCKETS 256
+#define KEYINFO_CACHE_MAX     8192
+
+static keyinfo_item_t keyinfo_cache[KEYINFO_CACHE_BUCKETS];
+static unsigned int keyinfo_cache_items;
+
+/* Incremented with each flush so that information read while a key
+ * file is changed will not be cached.  */
+static unsigned int keyinfo_cache_gen;
+
+/* The inotify handle for the private key directory or -1.  */
+static int keydir_inotify_fd = -1;
+/* Set if we can't watch the private key directory.  */
+static int keydir_inotify_failed;
+
+
+/* Remove the information about the key GRIP from the keyinfo cache.
+ * With GRIP NULL all items are removed.  */
+static void
+remove_keyinfo (const unsigned char *grip)
+{
+  keyinfo_item_t r, *rp;
+  int i;
+
+  for (i = grip? grip[0] : 0; i < KEYINFO_CACHE_BUCKETS; i++)
+    {
+      for (rp = &keyinfo_cache[i]; (r = *rp); )
+        {
+          if (grip && memcmp (r->grip, grip, KEYGRIP_LEN))
+            {
+              rp = &r->next;
+              continue;
+            }
+          *rp = r->next;
+          xfree (r->shadow_info);
+          xfree (r->shadow_info_type);
+          xfree (r);
+          keyinfo_cache_items--;
+        }
+      if (grip)
+        break;
+    }
+}
+
+
+/* Flush the information about the key GRIP or with GRIP NULL the
+ * entire keyinfo cache.  */
+static void
+flush_keyinfo_cache (const unsigned char *grip)
+{
+  keyinfo_cache_gen++;
+  remove_keyinfo (grip);
+}
+
+
+/* Check for changes in the private key directory and flush the
+ * keyinfo cache if needed.  Returns true if the directory is watched
+ * and thus the cached items may be used without a stat.  */
+static int
+check_keyinfo_cache (void)
+{
+  gpg_error_t err;
+  char *dirname;
+
+  if (keydir_inotify_fd != -1)
+    {
+      switch (gnupg_inotify_changed (keydir_inotify_fd))
+        {
+        case 0:
+          return 1;
+        case 1:
+          flush_keyinfo_cache (NULL);
+          return 1;
+        default:
+          close (keydir_inotify_fd);
+          keydir_inotify_fd = -1;
+          break;
+        }
+    }
+  if (keydir_inotify_failed)
+    return 0;
+
+  /* Items inserted until now have been checked using stat; flush them
+   * because they might have changed before the watch was created.  */
+  flush_keyinfo_cache (NULL);
+  dirname = make_filename_try (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR, NULL);
+  if (!dirname)
+    return 0;
+  err = gnupg_inotify_watch_dir (&keydir_inotify_fd, dirname);
+  xfree (dirname);
+  if (err)
+    {
+      /* Try again later if the directory has not yet been created.  */
+      if (gpg_err_code (err) != GPG_ERR_ENOENT)
+        keydir_inotify_failed = 1;
+      return 0;
+    }
+  return 1;
+}
+
+
+/* Return a number which is changed whenever a key file might have
+ * been changed.  If changes made by other processes are detected
+ * too, true is stored at R_WATCHED; if not, only changes made by
+ * this process are reflected.  */
+unsigned int
+agent_keydir_generation (int *r_watched)
+{
+  *r_watched = check_keyinfo_cache ();
+  return keyinfo_cache_gen;
+}
+
+
+/* Return the keyinfo cache item for GRIP or NULL.  */
+static keyinfo_item_t
+find_keyinfo (const unsigned char *grip)
+{
+  keyinfo_item_t r;
+
+  for (r = keyinfo_cache[grip[0]]; r; r = r->next)
+    if (!memcmp (r->grip, grip, KEYGRIP_LEN))
+      break;
+  return r;
+}
+
+
+/* Insert a new item for GRIP into the keyinfo cache and return it.
+ * Returns NULL if the cache has been flushed since GEN was taken or
+ * on error.  */
+static keyinfo_item_t
+insert_keyinfo (const unsigned char *grip, unsigned int gen)
+{
+  keyinfo_item_t r;
+
+  if (gen != keyinfo_cache_gen)
+    return NULL;
+  remove_keyinfo (grip);
+  if (keyinfo_cache_items >= KEYINFO_CACHE_MAX)
+    remove_keyinfo (NULL);
+  r = xtrycalloc (1, sizeof *r);
+  if (!r)
+    return NULL;
+  memcpy (r->grip, grip, KEYGRIP_LEN);
+  r->next = keyinfo_cache[grip[0]];
+  keyinfo_cache[grip[0]] = r;
+  keyinfo_cache_items++;
+  return r;
+}
+
+
+/* Remove a cached copy of the private key GRIP and all other cached
+ * information about it.  This needs to be called whenever a key file
+ * is changed.  */
+static void
+flush_cached_seckey (const unsigned char *grip)
+{
+  char hexgrip[40+1];
+
+  flush_keyinfo_cache (grip);
+  bin2hex (grip, 20, hexgrip);
+  agent_flush_cache_seckey (hexgrip);
+}
+
+
 /* Helper until we have a "wipe" mode flag in es_fopen.  */
 static void
 wipe_and_fclose (estream_t fp)
@@ -159,6 +345,8 @@ agent_write_private_key (ctrl_t ctrl,
   const char *s;
   int force_modify = 0;
 
+  flush_cached_seckey (grip);
+
   fname = (ctrl->ephemeral_mode
            ? xtrystrdup ("[ephemeral key store]")
            : fname_from_keygrip (grip, 0));
@@ -445,6 +633,8 @@ agent_update_private_key (ctrl_t ctrl, const unsigned char *grip, nvc_t pk)
   int removetmp = 0;
   int blocksigs = 0;
 
+  flush_cached_seckey (grip);
+
   if (ctrl->ephemeral_mode)
     {
       ephemeral_private_key_t ek;
@@ -820,6 +1010,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
            char **r_passphrase)
 {
   struct pin_entry_info_s *pi;
+  const size_t pisize = sizeof (*pi) + MAX_PASSPHRASE_LEN + 1;
   struct try_unprotect_arg_s arg;
   int rc;
   unsigned char *result;
@@ -944,7 +1135,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
         }
     }
 
-  pi = gcry_calloc_secure (1, sizeof (*pi) + MAX_PASSPHRASE_LEN + 1);
+  pi = agent_secarena_alloc (ctrl, pisize);
   if (!pi)
     return gpg_error_from_syserror ();
   pi->max_length = MAX_PASSPHRASE_LEN + 1;
@@ -989,7 +1180,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
                          (unsigned int)erroff, gpg_strerror (rc));
               wipememory (arg.unprotected_key, canlen);
               xfree (arg.unprotected_key);
-              xfree (pi);
+              agent_secarena_free (ctrl, pi, pisize);
               return rc;
             }
           rc = agent_protect_and_store (ctrl, s_skey, NULL);
@@ -1000,7 +1191,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
                          gpg_strerror (rc));
               wipememory (arg.unprotected_key, canlen);
               xfree (arg.unprotected_key);
-              xfree (pi);
+              agent_secarena_free (ctrl, pi, pisize);
               return rc;
             }
         }
@@ -1016,7 +1207,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
       xfree (*keybuf);
       *keybuf = arg.unprotected_key;
     }
-  xfree (pi);
+  agent_secarena_free (ctrl, pi, pisize);
   return rc;
 }
 
@@ -1204,6 +1395,8 @@ remove_key_file (const unsigned char *grip)
   gpg_error_t err = 0;
   char *fname;
 
+  flush_cached_seckey (grip);
+
   fname = fname_from_keygrip (grip, 0);
   if (!fname)
     {
@@ -1374,6 +1567,9 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   gcry_sexp_t s_skey;
   nvc_t keymeta = NULL;
   char *desc_text_buffer = NULL;  /* Used in case we extend DESC_TEXT.  */
+  char hexgrip[40+1];
+  int use_seckey_cache;
+  int cacheable = 0;
 
   *result = NULL;
   if (shadow_info)
@@ -1386,6 +1582,32 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   if (!grip && !ctrl->have_keygrip)
     return gpg_error (GPG_ERR_NO_SECKEY);
 
+  /* Try the cache of unprotected keys.  It is not used if the caller
+   * wants the passphrase or the creation time or asked to bypass the
+   * cache.  */
+  use_seckey_cache = (opt.seckey_cache_ttl
+                      && !r_passphrase && !r_timestamp
+                      && cache_mode != CACHE_MODE_IGNORE
+                      && !ctrl->ephemeral_mode);
+  if (use_seckey_cache)
+    {
+      bin2hex (grip? grip : ctrl->keygrip, 20, hexgrip);
+      buf = agent_get_cache_seckey (ctrl, hexgrip);
+      if (buf)
+        {
+          len = gcry_sexp_canon_len (buf, 0, NULL, NULL);
+          err = len? sexp_sscan_private_key (result, &erroff, buf)
+                   : gpg_error (GPG_ERR_INV_SEXP);
+          if (len)
+            wipememory (buf, len);
+          xfree (buf);
+          if (!err)
+            return 0;
+          log_error ("failed to use cached secret key: %s\n",
+                     gpg_strerror (err));
+        }
+    }
+
   err = read_key_file (ctrl, grip? grip : ctrl->keygrip,
                        &s_skey, &keymeta, NULL);
   if (err)
@@ -1456,6 +1678,10 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
         }
     }
 
+  /* Keys which require a confirmation are never cached.  */
+  if (use_seckey_cache && !(keymeta && nvc_get_string (keymeta, "Confirm:")))
+    cacheable = 1;
+
   switch (agent_private_key_type (buf))
     {
     case PRIVATE_KEY_CLEAR:
@@ -1531,6 +1757,7 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
       }
       break;
     case PRIVATE_KEY_SHADOWED:
+      cacheable = 0;
       if (shadow_info)
         {
           const unsigned char *s;
@@ -1590,6 +1817,8 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
     }
 
   err = sexp_sscan_private_key (result, &erroff, buf);
+  if (!err && cacheable)
+    agent_put_cache_seckey (ctrl, hexgrip, buf);
   xfree (buf);
   nvc_release (keymeta);
   xfree (desc_text_buffer);
@@ -1825,6 +2054,10 @@ agent_key_available (ctrl_t ctrl, const unsigned char *grip)
   char *fname;
   char hexgrip[40+4+1];
   ephemeral_private_key_t ek;
+  keyinfo_item_t r;
+  int watched;
+  unsigned int gen;
+  gpg_err_code_t ec;
 
   if (ctrl && ctrl->ephemeral_mode)
     {
@@ -1835,25 +2068,34 @@ agent_key_available (ctrl_t ctrl, const unsigned char *grip)
       return -1;
     }
 
+  watched = check_keyinfo_cache ();
+  if (watched && (r = find_keyinfo (grip)))
+    return r->missing? -1 : 0;
+  gen = keyinfo_cache_gen;
+
   bin2hex (grip, 20, hexgrip);
   strcpy (hexgrip+40, ".key");
 
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
                          hexgrip, NULL);
-  result = !gnupg_access (fname, R_OK)? 0 : -1;
+  ec = gnupg_access (fname, R_OK);
+  result = !ec? 0 : -1;
   xfree (fname);
+
+  if (watched && (!ec || ec == GPG_ERR_ENOENT)
+      && (r = insert_keyinfo (grip, gen)))
+    r->missing = !!ec;
+
   return result;
 }
 
 
-/* Return the information about the secret key specified by the binary
-   keygrip GRIP.  If the key is a shadowed one the shadow information
-   will be stored at the address R_SHADOW_INFO as an allocated
-   S-expression.  */
-gpg_error_t
-agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
-                          int *r_keytype, unsigned char **r_shadow_info,
-                          unsigned char **r_shadow_info_type)
+/* Read the information for agent_key_info_from_file from the key
+ * file.  */
+static gpg_error_t
+key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
+                    int *r_keytype, unsigned char **r_shadow_info,
+                    unsigned char **r_shadow_info_type)
 {
   gpg_error_t err;
   unsigned char *buf;
@@ -1926,6 +2168,148 @@ agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
 }
 
 
+/* Return the information about the secret key specified by the binary
+   keygrip GRIP.  If the key is a shadowed one the shadow information
+   will be stored at the address R_SHADOW_INFO as an allocated
+   S-expression.  */
+gpg_error_t
+agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
+                          int *r_keytype, unsigned char **r_shadow_info,
+                          unsigned char **r_shadow_info_type)
+{
+  gpg_error_t err;
+  keyinfo_item_t r;
+  int watched;
+  unsigned int gen;
+  struct stat st;
+  char *fname;
+  int keytype;
+  unsigned char *shadow_info = NULL;
+  unsigned char *shadow_info_type = NULL;
+  size_t n;
+
+  if (ctrl && ctrl->ephemeral_mode)
+    return key_info_from_file (ctrl, grip, r_keytype, r_shadow_info,
+                               r_shadow_info_type);
+
+  if (r_keytype)
+    *r_keytype = PRIVATE_KEY_UNKNOWN;
+  if (r_shadow_info)
+    *r_shadow_info = NULL;
+  if (r_shadow_info_type)
+    *r_shadow_info_type = NULL;
+
+  watched = check_keyinfo_cache ();
+  if (!watched)
+    {
+      fname = fname_from_keygrip (grip, 0);
+      if (!fname)
+        return gpg_error_from_syserror ();
+      if (gnupg_stat (fname, &st))
+        {
+          /* Let the actual read return the proper error.  */
+          xfree (fname);
+          return key_info_from_file (ctrl, grip, r_keytype, r_shadow_info,
+                                     r_shadow_info_type);
+        }
+      xfree (fname);
+    }
+
+  gen = keyinfo_cache_gen;
+  r = find_keyinfo (grip);
+  if (r && !r->missing && !r->have_info)
+    r = NULL;
+  else if (r && !watched
+           && (r->missing || r->mtime != st.st_mtime
+               || r->size != st.st_size || r->ino != st.st_ino))
+    r = NULL;
+
+  if (!r)
+    {
+      err = key_info_from_file (ctrl, grip, &keytype,
+                                &shadow_info, &shadow_info_type);
+      if (err && !(watched && gpg_err_code (err) == GPG_ERR_NOT_FOUND))
+        goto leave;
+      r = insert_keyinfo (grip, gen);
+      if (!r)
+        {
+          /* Not cached - return the result directly.  */
+          if (err)
+            goto leave;
+          if (r_keytype)
+            *r_keytype = keytype;
+          if (r_shadow_info)
+            {
+              *r_shadow_info = shadow_info;
+              shadow_info = NULL;
+            }
+          if (r_shadow_info_type)
+            {
+              *r_shadow_info_type = shadow_info_type;
+              shadow_info_type = NULL;
+            }
+          goto leave;
+        }
+      if (err)
+        {
+          r->missing = 1;
+          goto leave;
+        }
+      r->have_info = 1;
+      r->keytype = keytype;
+      r->shadow_info = shadow_info;
+      shadow_info = NULL;
+      r->shadow_info_type = shadow_info_type;
+      shadow_info_type = NULL;
+      if (!watched)
+        {
+          r->mtime = st.st_mtime;
+          r->size = st.st_size;
+          r->ino = st.st_ino;
+        }
+    }
+
+  if (r->missing)
+    {
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+
+  err = 0;
+  if (r_shadow_info && r->shadow_info)
+    {
+      n = gcry_sexp_canon_len (r->shadow_info, 0, NULL, NULL);
+      *r_shadow_info = xtrymalloc (n);
+      if (!*r_shadow_info)
+        err = gpg_error_from_syserror ();
+      else
+        memcpy (*r_shadow_info, r->shadow_info, n);
+    }
+  if (!err && r_shadow_info_type && r->shadow_info_type)
+    {
+      *r_shadow_info_type = (unsigned char *)
+        xtrystrdup ((char *)r->shadow_info_type);
+      if (!*r_shadow_info_type)
+        err = gpg_error_from_syserror ();
+    }
+  if (err)
+    {
+      if (r_shadow_info)
+        {
+          xfree (*r_shadow_info);
+          *r_shadow_info = NULL;
+        }
+    }
+  else if (r_keytype)
+    *r_keytype = r->keytype;
+
+ leave:
+  xfree (shadow_info);
+  xfree (shadow_info_type);
+  return err;
+}
+
+
 
 /* Delete the key with GRIP from the disk after having asked for
  * confirmation using DESC_TEXT.  If FORCE is set the function won't
@@ -574,7 +574,11 @@ agent_genkey (ctrl_t ctrl, unsigned int flags,
       passphrase = passphrase_buffer;
     }
 
-  rc = gcry_pk_genkey (&s_key, s_keyparam );
+  s_key = agent_keypool_get (keyparam, keyparamlen);
+  if (s_key)
+    rc = 0;
+  else
+    rc = gcry_pk_genkey (&s_key, s_keyparam );
   gcry_sexp_release (s_keyparam);
   if (rc)
     {
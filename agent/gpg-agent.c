@@ -61,6 +61,7 @@
 #include "../common/asshelp.h"
 #include "../common/comopt.h"
 #include "../common/init.h"
+#include "../common/asynclog.h"
 
 
 enum cmd_and_opt_values
@@ -87,6 +88,8 @@ enum cmd_and_opt_values
   oGrab,
   oNoGrab,
   oLogFile,
+  oAsyncLog,
+  oMetricsLogInterval,
   oServer,
   oDaemon,
   oSupervised,
@@ -96,6 +99,7 @@ enum cmd_and_opt_values
   oPinentryTouchFile,
   oPinentryInvisibleChar,
   oPinentryTimeout,
+  oPinentryIdleTimeout,
   oPinentryFormattedPassphrase,
   oDisplay,
   oTTYname,
@@ -109,6 +113,10 @@ enum cmd_and_opt_values
   oDefCacheTTLSSH,
   oMaxCacheTTL,
   oMaxCacheTTLSSH,
+  oSeckeyCacheTTL,
+  oSesskeyCacheTTL,
+  oGenkeyPoolSize,
+  oSecmemArenaSize,
   oEnforcePassphraseConstraints,
   oMinPassphraseLen,
   oMinPassphraseNonalpha,
@@ -198,6 +206,10 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDebugPinentry, "debug-pinentry", "@"),
   ARGPARSE_s_s (oLogFile,   "log-file",
                 /* */       N_("|FILE|write server mode logs to FILE")),
+  ARGPARSE_s_n (oAsyncLog,  "async-log",
+                /* */       N_("write the log file in the background")),
+  ARGPARSE_s_u (oMetricsLogInterval, "metrics-log-interval",
+                /* */       N_("|N|log the metrics every N seconds")),
 
 
   ARGPARSE_header ("Configuration",
@@ -251,6 +263,13 @@ static gpgrt_opt_t opts[] = {
                 /* */     N_("|N|set maximum PIN cache lifetime to N seconds")),
   ARGPARSE_s_u (oMaxCacheTTLSSH, "max-cache-ttl-ssh",
                 /* */     N_("|N|set maximum SSH key lifetime to N seconds")),
+  ARGPARSE_s_u (oSeckeyCacheTTL, "seckey-cache-ttl",
+                /* */     N_("|N|cache unprotected keys for N seconds")),
+  ARGPARSE_s_u (oSesskeyCacheTTL, "session-key-cache-ttl",
+                /* */     N_("|N|cache decrypted session keys for N seconds")),
+  ARGPARSE_s_u (oGenkeyPoolSize, "genkey-pool-size",
+                /* */     N_("|N|keep N pre-generated keys")),
+  ARGPARSE_s_u (oSecmemArenaSize, "secmem-arena-size", "@"),
   ARGPARSE_s_n (oIgnoreCacheForSigning, "ignore-cache-for-signing",
                 /* */    N_("do not use the PIN cache when signing")),
   ARGPARSE_s_n (oNoAllowExternalCache,  "no-allow-external-cache",
@@ -299,6 +318,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (oPinentryInvisibleChar, "pinentry-invisible-char", "@"),
   ARGPARSE_s_u (oPinentryTimeout, "pinentry-timeout",
                 N_("|N|set the Pinentry timeout to N seconds")),
+  ARGPARSE_s_u (oPinentryIdleTimeout, "pinentry-idle-timeout", "@"),
   ARGPARSE_s_n (oPinentryFormattedPassphrase, "pinentry-formatted-passphrase",
                 "@"),
   ARGPARSE_s_n (oAllowEmacsPinentry,  "allow-emacs-pinentry",
@@ -340,6 +360,7 @@ static struct debug_flags_s debug_flags [] =
 #define MIN_PASSPHRASE_LEN    (8)
 #define MIN_PASSPHRASE_NONALPHA (1)
 #define MAX_PASSPHRASE_DAYS   (0)
+#define DEFAULT_SECMEM_ARENA_SIZE (4096)
 
 /* CHECK_OWN_SOCKET_INTERVAL defines how often we check our own socket
  * in standard socket mode.  If that value is 0 we don't check at all.
@@ -348,6 +369,9 @@ static struct debug_flags_s debug_flags [] =
 /* CHECK_PROBLEMS_INTERVAL defines how often we check the existence of
  * parent process and homedir.  Value is in seconds.  */
 #define CHECK_PROBLEMS_INTERVAL     (4)
+/* S2K_CALIBRATION_CHECK_INTERVAL defines how often we check whether
+ * the S2K calibration needs to be redone.  Value is in seconds.  */
+#define S2K_CALIBRATION_CHECK_INTERVAL (3600)
 
 /* Flag indicating that the ssh-agent subsystem has been enabled.  */
 static int ssh_support;
@@ -464,6 +488,14 @@ static const char *debug_level;
    the log file after a SIGHUP if it didn't changed. Malloced. */
 static char *current_logfile;
 
+/* Flag indicating that the log file shall be written by a background
+ * thread; set by --async-log.  */
+static int async_log;
+
+/* If not 0, the interval in seconds for writing the metrics to the
+ * log; set by --metrics-log-interval.  */
+static unsigned int metrics_log_interval;
+
 #ifdef HAVE_W32_SYSTEM
 #define HAVE_PARENT_PID_SUPPORT 0
 #else
@@ -506,6 +538,15 @@ struct progress_dispatch_s
 };
 struct progress_dispatch_s *progress_dispatch_list;
 
+/* The key used to mark a thread which runs a CPU bound crypto
+ * operation without holding the nPth lock.  Our windows
+ * implementation does not yet feature the nPth TLS functions and thus
+ * this is not used there.  */
+#ifndef HAVE_W32_SYSTEM
+static npth_key_t my_tlskey_unprotected;
+static int have_tlskey_unprotected;
+#endif
+
 
 
 
@@ -535,6 +576,7 @@ static int check_for_running_agent (int silent);
 static void *check_own_socket_thread (void *arg);
 #endif
 static void *check_others_thread (void *arg);
+static void *s2k_calibration_thread (void *arg);
 
 /*
    Functions.
@@ -882,12 +924,17 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       xfree (opt.pinentry_invisible_char);
       opt.pinentry_invisible_char = NULL;
       opt.pinentry_timeout = 0;
+      opt.pinentry_idle_timeout = 0;
       opt.pinentry_formatted_passphrase = 0;
       memset (opt.daemon_program, 0, sizeof opt.daemon_program);
       opt.def_cache_ttl = DEFAULT_CACHE_TTL;
       opt.def_cache_ttl_ssh = DEFAULT_CACHE_TTL_SSH;
       opt.max_cache_ttl = MAX_CACHE_TTL;
       opt.max_cache_ttl_ssh = MAX_CACHE_TTL_SSH;
+      opt.seckey_cache_ttl = 0;
+      opt.sesskey_cache_ttl = 0;
+      opt.genkey_pool_size = 0;
+      opt.secmem_arena_size = DEFAULT_SECMEM_ARENA_SIZE;
       opt.enforce_passphrase_constraints = 0;
       opt.min_passphrase_len = MIN_PASSPHRASE_LEN;
       opt.min_passphrase_nonalpha = MIN_PASSPHRASE_NONALPHA;
@@ -947,6 +994,9 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.pinentry_invisible_char = xtrystrdup (pargs->r.ret_str); break;
       break;
     case oPinentryTimeout: opt.pinentry_timeout = pargs->r.ret_ulong; break;
+    case oPinentryIdleTimeout:
+      opt.pinentry_idle_timeout = pargs->r.ret_ulong;
+      break;
     case oPinentryFormattedPassphrase:
       opt.pinentry_formatted_passphrase = 1;
       break;
@@ -965,6 +1015,10 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
     case oDefCacheTTLSSH: opt.def_cache_ttl_ssh = pargs->r.ret_ulong; break;
     case oMaxCacheTTL: opt.max_cache_ttl = pargs->r.ret_ulong; break;
     case oMaxCacheTTLSSH: opt.max_cache_ttl_ssh = pargs->r.ret_ulong; break;
+    case oSeckeyCacheTTL: opt.seckey_cache_ttl = pargs->r.ret_ulong; break;
+    case oSesskeyCacheTTL: opt.sesskey_cache_ttl = pargs->r.ret_ulong; break;
+    case oGenkeyPoolSize: opt.genkey_pool_size = pargs->r.ret_ulong; break;
+    case oSecmemArenaSize: opt.secmem_arena_size = pargs->r.ret_ulong; break;
 
     case oEnforcePassphraseConstraints:
       opt.enforce_passphrase_constraints=1;
@@ -1045,6 +1099,37 @@ finalize_rereadable_options (void)
 }
 
 
+/* Return true if the current thread runs without holding the nPth
+ * lock due to agent_unprotect_crypto.  */
+static int
+running_unprotected (void)
+{
+#ifndef HAVE_W32_SYSTEM
+  return have_tlskey_unprotected && npth_getspecific (my_tlskey_unprotected);
+#else
+  return 0;
+#endif
+}
+
+
+/* The system call clamp.  A thread which already released the nPth
+ * lock for a crypto operation must not do this again for a system
+ * call done by Libgcrypt (e.g. getrandom).  */
+static void
+pre_syscall (void)
+{
+  if (!running_unprotected ())
+    npth_unprotect ();
+}
+
+static void
+post_syscall (void)
+{
+  if (!running_unprotected ())
+    npth_protect ();
+}
+
+
 static void
 thread_init_once (void)
 {
@@ -1054,8 +1139,12 @@ thread_init_once (void)
     {
       npth_initialized++;
       npth_init ();
+#ifndef HAVE_W32_SYSTEM
+      if (npth_key_create (&my_tlskey_unprotected, NULL) == 0)
+        have_tlskey_unprotected = 1;
+#endif
     }
-  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+  gpgrt_set_syscall_clamp (pre_syscall, post_syscall);
   /* Now that we have set the syscall clamp we need to tell Libgcrypt
    * that it should get them from libgpg-error.  Note that Libgcrypt
    * has already been initialized but at that point nPth was not
@@ -1074,6 +1163,26 @@ initialize_modules (void)
   initialize_module_call_pinentry ();
   initialize_module_daemon ();
   initialize_module_trustlist ();
+  metrics_set_prefix ("gpg_agent");
+  metrics_register_source (agent_command_metrics);
+}
+
+
+/* Switch to the asynchronous log sink if requested by --async-log.
+ * This is a no-op if it is already active.  nPth needs to be
+ * initialized.  */
+static void
+start_async_log (void)
+{
+  gpg_error_t err;
+
+  if (!async_log || !current_logfile)
+    return;
+
+  err = async_log_set_file (current_logfile);
+  if (err)
+    log_info ("not using asynchronous logging for '%s': %s\n",
+              current_logfile, gpg_strerror (err));
 }
 
 
@@ -1263,6 +1372,10 @@ main (int argc, char **argv)
         case oHomedir: gnupg_set_homedir (pargs.r.ret_str); break;
         case oNoDetach: nodetach = 1; break;
         case oLogFile: logfile = pargs.r.ret_str; break;
+        case oAsyncLog: async_log = 1; break;
+        case oMetricsLogInterval:
+          metrics_log_interval = pargs.r.ret_ulong;
+          break;
         case oCsh: csh_style = 1; break;
         case oSh: csh_style = 0; break;
         case oServer: pipe_server = 1; break;
@@ -1480,6 +1593,14 @@ main (int argc, char **argv)
                  GC_OPT_FLAG_DEFAULT, MAX_CACHE_TTL );
       es_printf ("max-cache-ttl-ssh:%lu:%d:\n",
                  GC_OPT_FLAG_DEFAULT, MAX_CACHE_TTL_SSH );
+      es_printf ("seckey-cache-ttl:%lu:%d:\n",
+                 GC_OPT_FLAG_DEFAULT, 0 );
+      es_printf ("session-key-cache-ttl:%lu:%d:\n",
+                 GC_OPT_FLAG_DEFAULT, 0 );
+      es_printf ("genkey-pool-size:%lu:%d:\n",
+                 GC_OPT_FLAG_DEFAULT, 0 );
+      es_printf ("pinentry-idle-timeout:%lu:%d:\n",
+                 GC_OPT_FLAG_DEFAULT, 0 );
       es_printf ("min-passphrase-len:%lu:%d:\n",
                  GC_OPT_FLAG_DEFAULT, MIN_PASSPHRASE_LEN );
       es_printf ("min-passphrase-nonalpha:%lu:%d:\n",
@@ -1896,6 +2017,11 @@ agent_libgcrypt_progress_cb (void *data, const char *what, int printchar,
 
   (void)data;
 
+  /* Without the nPth lock we may neither walk the list nor call into
+   * Assuan.  */
+  if (running_unprotected ())
+    return;
+
   for (dispatch = progress_dispatch_list; dispatch; dispatch = dispatch->next)
     if (dispatch->ctrl && dispatch->tid == mytid)
       break;
@@ -1904,6 +2030,42 @@ agent_libgcrypt_progress_cb (void *data, const char *what, int printchar,
 }
 
 
+/* Release the nPth lock so that a CPU bound crypto operation can run
+ * in parallel to other threads.  Only Libgcrypt functions working on
+ * objects private to the calling thread may be used until
+ * agent_protect_crypto is called with the returned value.  */
+int
+agent_unprotect_crypto (void)
+{
+#ifndef HAVE_W32_SYSTEM
+  if (have_tlskey_unprotected
+      && !npth_setspecific (my_tlskey_unprotected, (void*)1))
+    {
+      npth_unprotect ();
+      return 1;
+    }
+#endif
+  return 0;
+}
+
+
+/* Take the nPth lock again after a call to agent_unprotect_crypto
+ * which returned UNPROTECTED.  */
+void
+agent_protect_crypto (int unprotected)
+{
+#ifndef HAVE_W32_SYSTEM
+  if (unprotected)
+    {
+      npth_protect ();
+      npth_setspecific (my_tlskey_unprotected, NULL);
+    }
+#else
+  (void)unprotected;
+#endif
+}
+
+
 /* If a progress dispatcher callback has been associated with the
  * current connection unregister it.  */
 static void
@@ -2005,6 +2167,7 @@ agent_deinit_default_ctrl (ctrl_t ctrl)
   unregister_progress_cb ();
   session_env_release (ctrl->session_env);
   clear_ephemeral_keys (ctrl);
+  agent_secarena_release (ctrl);
 
   xfree (ctrl->digest.data);
   ctrl->digest.data = NULL;
@@ -2114,6 +2277,8 @@ reread_configuration (void)
           current_logfile = comopt.logfile? xtrystrdup (comopt.logfile) : NULL;
         }
     }
+
+  start_async_log ();
 }
 
 
@@ -2454,6 +2619,7 @@ agent_sighup_action (void)
             "re-reading configuration and flushing cache\n");
 
   agent_flush_cache (0);
+  agent_keypool_flush ();
   reread_configuration ();
   agent_reload_trustlist ();
   /* We flush the module name cache so that after installing a
@@ -2497,6 +2663,8 @@ handle_signal (int signo)
       /* pth_ctrl (PTH_CTRL_DUMPSTATE, log_get_stream ()); */
       agent_query_dump_state ();
       agent_daemon_dump_state ();
+      agent_keypool_dump_state ();
+      agent_secarena_dump_state ();
       break;
 
     case SIGUSR2:
@@ -3003,6 +3171,11 @@ handle_connections (gnupg_fd_t listen_fd,
   };
 
 
+  start_async_log ();
+  if ((err = metrics_start_logging (metrics_log_interval)))
+    log_error ("error starting the metrics logging: %s\n",
+               gpg_strerror (err));
+
   ret = npth_attr_init(&tattr);
   if (ret)
     log_fatal ("error allocating thread attributes: %s\n",
@@ -3077,6 +3250,15 @@ handle_connections (gnupg_fd_t listen_fd,
         log_error ("error spawning check_others_thread: %s\n", strerror (err));
     }
 
+  {
+    npth_t thread;
+
+    err = npth_create (&thread, &tattr, s2k_calibration_thread, NULL);
+    if (err)
+      log_error ("error spawning s2k_calibration_thread: %s\n",
+                 strerror (err));
+  }
+
   /* On Windows we need to fire up a separate thread to listen for
      requests from Putty (an SSH client), so we can replace Putty's
      Pageant (its ssh-agent implementation). */
@@ -3477,6 +3659,34 @@ check_others_thread (void *arg)
   return NULL;
 }
 
+
+/* The thread doing the S2K calibration in the background.  A freshly
+ * started agent takes the count from the calibration file; if there
+ * is none or it is outdated the calibration is done here so that the
+ * first S2K operation does not need to wait for it.  */
+static void *
+s2k_calibration_thread (void *arg)
+{
+  unsigned long count;
+  int unprotected;
+
+  (void)arg;
+
+  while (!shutdown_pending && !problem_detected)
+    {
+      if (s2k_calibration_is_stale ())
+        {
+          unprotected = agent_unprotect_crypto ();
+          count = compute_s2k_calibration ();
+          agent_protect_crypto (unprotected);
+          store_s2k_calibration (count);
+        }
+      gnupg_sleep (S2K_CALIBRATION_CHECK_INTERVAL);
+    }
+
+  return NULL;
+}
+
 /* Figure out whether an agent is available and running. Prints an
    error if not.  If SILENT is true, no messages are printed.
    Returns 0 if the agent is running. */
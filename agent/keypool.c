@@ -0,0 +1,320 @@
+/* keypool.c - A pool of pre-generated keys
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Generating an RSA key takes a long time and keeps the connection
+ * waiting.  With --genkey-pool-size the agent remembers the
+ * parameters of the last GENKEY commands and generates keys for them
+ * in background threads.  The next GENKEY with exactly the same
+ * parameters takes a key from the pool, which triggers the generation
+ * of a replacement.  A pooled key is handed out only once.
+ *
+ * The pool is only accessed while holding the nPth lock; the filler
+ * threads release that lock only around gcry_pk_genkey which works on
+ * thread private objects.  Thus no extra mutex is required.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "agent.h"
+
+/* The number of different parameter sets kept in the pool.  */
+#define KEYPOOL_MAX_PARAMS 4
+
+/* The maximum number of keys per parameter set.  */
+#define KEYPOOL_MAX_SIZE 8
+
+/* The maximum number of filler threads running at the same time.  */
+#define KEYPOOL_MAX_THREADS 4
+
+
+/* An entry of the pool.  */
+struct keypool_item_s
+{
+  struct keypool_item_s *next;
+  char *keyparam;               /* The parameters (malloced).  */
+  size_t keyparamlen;
+  unsigned int pending;         /* Number of running filler threads.  */
+  unsigned int nkeys;           /* Number of keys in KEYS.  */
+  gcry_sexp_t keys[KEYPOOL_MAX_SIZE];
+  unsigned long generation;     /* Incremented on flush.  */
+};
+typedef struct keypool_item_s *keypool_item_t;
+
+/* The list of entries; the most recently used one comes first.  */
+static keypool_item_t keypool;
+
+/* The number of running filler threads.  */
+static unsigned int keypool_threads;
+
+/* Incremented by agent_keypool_flush so that filler threads started
+ * before the flush drop their key.  */
+static unsigned long keypool_generation;
+
+/* Counters for the statistics.  */
+static unsigned long keypool_hits;
+static unsigned long keypool_misses;
+
+
+/* Return the configured number of keys per parameter set.  */
+static unsigned int
+keypool_size (void)
+{
+  return opt.genkey_pool_size > KEYPOOL_MAX_SIZE
+    ? KEYPOOL_MAX_SIZE : opt.genkey_pool_size;
+}
+
+
+static void
+release_item (keypool_item_t item)
+{
+  unsigned int i;
+
+  for (i=0; i < item->nkeys; i++)
+    gcry_sexp_release (item->keys[i]);
+  xfree (item->keyparam);
+  xfree (item);
+}
+
+
+/* Find the entry for KEYPARAM and move it to the front.  */
+static keypool_item_t
+find_item (const char *keyparam, size_t keyparamlen)
+{
+  keypool_item_t item, prev;
+
+  for (prev=NULL, item=keypool; item; prev=item, item=item->next)
+    if (item->keyparamlen == keyparamlen
+        && !memcmp (item->keyparam, keyparam, keyparamlen))
+      {
+        if (prev)
+          {
+            prev->next = item->next;
+            item->next = keypool;
+            keypool = item;
+          }
+        return item;
+      }
+  return NULL;
+}
+
+
+/* The filler thread for the entry ARG.  */
+static void *
+keypool_thread (void *arg)
+{
+  keypool_item_t item = arg;
+  unsigned long generation = item->generation;
+  gcry_sexp_t s_keyparam, s_key = NULL;
+  int unprotected;
+  gpg_error_t err;
+
+  err = gcry_sexp_sscan (&s_keyparam, NULL, item->keyparam,
+                         item->keyparamlen);
+  if (!err)
+    {
+      unprotected = agent_unprotect_crypto ();
+      err = gcry_pk_genkey (&s_key, s_keyparam);
+      agent_protect_crypto (unprotected);
+      gcry_sexp_release (s_keyparam);
+    }
+  if (err)
+    log_error ("background key generation failed: %s\n",
+               gpg_strerror (err));
+
+  /* ITEM is not released while a thread is pending.  */
+  item->pending--;
+  keypool_threads--;
+  if (s_key && generation == item->generation
+      && item->nkeys < keypool_size ())
+    {
+      item->keys[item->nkeys++] = s_key;
+      s_key = NULL;
+    }
+  gcry_sexp_release (s_key);
+
+  if (DBG_CACHE)
+    log_debug ("keypool: %u keys for entry %p\n", item->nkeys, item);
+
+  if (!err)
+    agent_keypool_fill ();
+  return NULL;
+}
+
+
+/* Start filler threads for all entries which have less than the
+ * configured number of keys.  */
+void
+agent_keypool_fill (void)
+{
+  keypool_item_t item;
+  npth_attr_t tattr;
+  npth_t thread;
+  unsigned int size = keypool_size ();
+  int rc;
+
+  for (item=keypool; item; item=item->next)
+    while (item->nkeys + item->pending < size
+           && keypool_threads < KEYPOOL_MAX_THREADS)
+      {
+        rc = npth_attr_init (&tattr);
+        if (rc)
+          return;
+        npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+        item->pending++;
+        keypool_threads++;
+        rc = npth_create (&thread, &tattr, keypool_thread, item);
+        npth_attr_destroy (&tattr);
+        if (rc)
+          {
+            item->pending--;
+            keypool_threads--;
+            log_error ("error spawning key generation thread: %s\n",
+                       strerror (rc));
+            return;
+          }
+      }
+}
+
+
+/* Return a key generated for exactly KEYPARAM from the pool or NULL
+ * if there is none.  The key is removed from the pool and the
+ * generation of a replacement is started.  If no key is available
+ * the parameters are remembered for the next request.  */
+gcry_sexp_t
+agent_keypool_get (const char *keyparam, size_t keyparamlen)
+{
+  keypool_item_t item, prev;
+  gcry_sexp_t s_key = NULL;
+  int n;
+
+  if (!keypool_size ())
+    {
+      if (keypool)
+        agent_keypool_flush ();
+      return NULL;
+    }
+
+  item = find_item (keyparam, keyparamlen);
+  if (item && item->nkeys)
+    {
+      s_key = item->keys[--item->nkeys];
+      item->keys[item->nkeys] = NULL;
+      keypool_hits++;
+    }
+  else
+    keypool_misses++;
+
+  if (!item)
+    {
+      item = xtrycalloc (1, sizeof *item);
+      if (item)
+        item->keyparam = xtrymalloc (keyparamlen);
+      if (!item || !item->keyparam)
+        {
+          xfree (item);
+          return NULL;
+        }
+      memcpy (item->keyparam, keyparam, keyparamlen);
+      item->keyparamlen = keyparamlen;
+      item->generation = keypool_generation;
+      item->next = keypool;
+      keypool = item;
+
+      /* Drop the least recently used entries without pending
+       * threads.  */
+      for (n=0, prev=NULL, item=keypool; item; )
+        {
+          if (++n > KEYPOOL_MAX_PARAMS && !item->pending)
+            {
+              keypool_item_t tmp = item->next;
+
+              prev->next = tmp;
+              release_item (item);
+              item = tmp;
+            }
+          else
+            {
+              prev = item;
+              item = item->next;
+            }
+        }
+    }
+
+  agent_keypool_fill ();
+  return s_key;
+}
+
+
+/* Release all pooled keys and forget the parameters.  Entries with
+ * running threads are kept but marked so that the generated keys are
+ * dropped.  */
+void
+agent_keypool_flush (void)
+{
+  keypool_item_t item, prev, next;
+  unsigned int i;
+
+  keypool_generation++;
+  for (prev=NULL, item=keypool; item; item=next)
+    {
+      next = item->next;
+      if (item->pending)
+        {
+          for (i=0; i < item->nkeys; i++)
+            {
+              gcry_sexp_release (item->keys[i]);
+              item->keys[i] = NULL;
+            }
+          item->nkeys = 0;
+          item->generation = keypool_generation;
+          prev = item;
+        }
+      else
+        {
+          if (prev)
+            prev->next = next;
+          else
+            keypool = next;
+          release_item (item);
+        }
+    }
+}
+
+
+/* Print statistics about the pool to the log.  */
+void
+agent_keypool_dump_state (void)
+{
+  keypool_item_t item;
+  unsigned int nitems = 0, nkeys = 0;
+
+  for (item=keypool; item; item=item->next)
+    {
+      nitems++;
+      nkeys += item->nkeys;
+    }
+  log_info ("keypool: %u entries, %u keys, %u threads,"
+            " %lu hits, %lu misses\n",
+            nitems, nkeys, keypool_threads, keypool_hits, keypool_misses);
+}
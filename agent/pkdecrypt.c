@@ -104,52 +104,23 @@ get_ecc_params (const char *curve)
 
 
 
-/* DECRYPT the stuff in ciphertext which is expected to be a S-Exp.
-   Try to get the key from CTRL and write the decoded stuff back to
-   OUTFP.   The padding information is stored at R_PADDING with -1
-   for not known.  */
-gpg_error_t
-agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
-                 const unsigned char *ciphertext, size_t ciphertextlen,
-                 membuf_t *outbuf, int *r_padding)
+/* Decrypt CIPHERTEXT, which has already been parsed into S_CIPHER,
+ * using the key S_SKEY or, if SHADOW_INFO is set or S_SKEY is NULL,
+ * using the card or TPM.  On success the result is appended to
+ * OUTBUF.  */
+static gpg_error_t
+do_pkdecrypt (ctrl_t ctrl, gcry_sexp_t s_skey,
+              const unsigned char *shadow_info,
+              const unsigned char *ciphertext, size_t ciphertextlen,
+              gcry_sexp_t s_cipher, membuf_t *outbuf, int *r_padding)
 {
-  gcry_sexp_t s_skey = NULL, s_cipher = NULL, s_plain = NULL;
-  unsigned char *shadow_info = NULL;
-  gpg_error_t err = 0;
+  gcry_sexp_t s_plain = NULL;
+  gpg_error_t err;
   char *buf = NULL;
   size_t len;
+  int unprotected;
 
-  *r_padding = -1;
-
-  if (!ctrl->have_keygrip)
-    {
-      log_error ("speculative decryption not yet supported\n");
-      err = gpg_error (GPG_ERR_NO_SECKEY);
-      goto leave;
-    }
-
-  err = gcry_sexp_sscan (&s_cipher, NULL, (char*)ciphertext, ciphertextlen);
-  if (err)
-    {
-      log_error ("failed to convert ciphertext: %s\n", gpg_strerror (err));
-      err = gpg_error (GPG_ERR_INV_DATA);
-      goto leave;
-    }
-
-  if (DBG_CRYPTO)
-    {
-      log_printhex (ctrl->keygrip, 20, "keygrip:");
-      log_printhex (ciphertext, ciphertextlen, "cipher: ");
-    }
-  err = agent_key_from_file (ctrl, NULL, desc_text,
-                             NULL, &shadow_info,
-                             CACHE_MODE_NORMAL, NULL, &s_skey, NULL, NULL);
-  if (err && gpg_err_code (err) != GPG_ERR_NO_SECKEY)
-    {
-      log_error ("failed to read the secret key\n");
-    }
-  else if (shadow_info
-           || err /* gpg_err_code (err) == GPG_ERR_NO_SECKEY */)
+  if (shadow_info || !s_skey)
     { /* divert operation to the smartcard */
       if (!gcry_sexp_canon_len (ciphertext, ciphertextlen, NULL, NULL))
         {
@@ -189,7 +160,9 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
 /*           gcry_sexp_dump (s_skey); */
 /*         } */
 
+      unprotected = agent_unprotect_crypto ();
       err = gcry_pk_decrypt (&s_plain, s_cipher, s_skey);
+      agent_protect_crypto (unprotected);
       if (err)
         {
           log_error ("decryption failed: %s\n", gpg_strerror (err));
@@ -218,12 +191,198 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
         }
     }
 
+ leave:
+  gcry_sexp_release (s_plain);
+  xfree (buf);
+  return err;
+}
+
+
+/* DECRYPT the stuff in ciphertext which is expected to be a S-Exp.
+   Try to get the key from CTRL and write the decoded stuff back to
+   OUTFP.   The padding information is stored at R_PADDING with -1
+   for not known.  */
+gpg_error_t
+agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
+                 const unsigned char *ciphertext, size_t ciphertextlen,
+                 membuf_t *outbuf, int *r_padding)
+{
+  gcry_sexp_t s_skey = NULL, s_cipher = NULL;
+  unsigned char *shadow_info = NULL;
+  gpg_error_t err = 0;
+  unsigned char *cached;
+  const char *p;
+  size_t n, start;
+
+  *r_padding = -1;
+
+  if (!ctrl->have_keygrip)
+    {
+      log_error ("speculative decryption not yet supported\n");
+      err = gpg_error (GPG_ERR_NO_SECKEY);
+      goto leave;
+    }
+
+  /* If the same ciphertext has been decrypted before we may have the
+   * result in the cache and don't need the private key.  */
+  cached = agent_get_cache_sesskey (ctrl, ciphertext, ciphertextlen);
+  if (cached)
+    {
+      n = gcry_sexp_canon_len (cached, 0, NULL, NULL);
+      if (n)
+        {
+          if (DBG_CACHE)
+            log_debug ("using cached session key\n");
+          put_membuf (outbuf, cached, n);
+        }
+      wipememory (cached, n);
+      xfree (cached);
+      if (n)
+        goto leave;
+    }
+
+  err = gcry_sexp_sscan (&s_cipher, NULL, (char*)ciphertext, ciphertextlen);
+  if (err)
+    {
+      log_error ("failed to convert ciphertext: %s\n", gpg_strerror (err));
+      err = gpg_error (GPG_ERR_INV_DATA);
+      goto leave;
+    }
+
+  if (DBG_CRYPTO)
+    {
+      log_printhex (ctrl->keygrip, 20, "keygrip:");
+      log_printhex (ciphertext, ciphertextlen, "cipher: ");
+    }
+  err = agent_key_from_file (ctrl, NULL, desc_text,
+                             NULL, &shadow_info,
+                             CACHE_MODE_NORMAL, NULL, &s_skey, NULL, NULL);
+  if (err && gpg_err_code (err) != GPG_ERR_NO_SECKEY)
+    {
+      log_error ("failed to read the secret key\n");
+    }
+  else
+    {
+      start = get_membuf_len (outbuf);
+      err = do_pkdecrypt (ctrl, s_skey, shadow_info, ciphertext,
+                          ciphertextlen, s_cipher, outbuf, r_padding);
+      /* The padding information is not cached; thus we don't cache
+       * results which come with it.  */
+      if (!err && *r_padding == -1
+          && (p = peek_membuf (outbuf, &n)) && n > start)
+        agent_put_cache_sesskey (ctrl, ciphertext, ciphertextlen,
+                                 (const unsigned char *)p + start);
+    }
 
  leave:
   gcry_sexp_release (s_skey);
-  gcry_sexp_release (s_plain);
   gcry_sexp_release (s_cipher);
-  xfree (buf);
+  xfree (shadow_info);
+  return err;
+}
+
+
+/* Decrypt the concatenated canonical S-expressions in CIPHERTEXTS,
+ * all for the key from CTRL, and append one S-expression for each of
+ * them to OUTBUF: Either the plaintext as returned by agent_pkdecrypt
+ * or "(5:error<n>:<errorcode>)" if that ciphertext could not be
+ * decrypted.  The key is read and unprotected only once.  The
+ * padding information of the first decrypted item is stored at
+ * R_PADDING; it does not depend on the ciphertext.  */
+gpg_error_t
+agent_pkdecrypt_batch (ctrl_t ctrl, const char *desc_text,
+                       const unsigned char *ciphertexts, size_t ciphertextslen,
+                       membuf_t *outbuf, int *r_padding)
+{
+  gcry_sexp_t s_skey = NULL, s_cipher;
+  unsigned char *shadow_info = NULL;
+  gpg_error_t err, err2;
+  const unsigned char *p;
+  size_t n, len, itemlen;
+  int padding;
+  char numbuf[35];
+  membuf_t itembuf;
+  char *item;
+
+  *r_padding = -1;
+
+  if (!ctrl->have_keygrip)
+    {
+      log_error ("speculative decryption not yet supported\n");
+      return gpg_error (GPG_ERR_NO_SECKEY);
+    }
+
+  /* Check the framing first so that we don't ask for the passphrase
+   * if the request is garbled.  */
+  for (p = ciphertexts, n = ciphertextslen; n; p += len, n -= len)
+    {
+      len = gcry_sexp_canon_len (p, n, NULL, NULL);
+      if (!len)
+        return gpg_error (GPG_ERR_INV_SEXP);
+    }
+
+  err = agent_key_from_file (ctrl, NULL, desc_text,
+                             NULL, &shadow_info,
+                             CACHE_MODE_NORMAL, NULL, &s_skey, NULL, NULL);
+  if (err && gpg_err_code (err) != GPG_ERR_NO_SECKEY)
+    {
+      log_error ("failed to read the secret key\n");
+      goto leave;
+    }
+  err = 0;
+
+  for (p = ciphertexts, n = ciphertextslen; n; p += len, n -= len)
+    {
+      len = gcry_sexp_canon_len (p, n, NULL, NULL);
+      padding = -1;
+      err2 = gcry_sexp_sscan (&s_cipher, NULL, (const char*)p, len);
+      if (err2)
+        {
+          log_error ("failed to convert ciphertext: %s\n",
+                     gpg_strerror (err2));
+          err2 = gpg_error (GPG_ERR_INV_DATA);
+        }
+      else
+        {
+          /* Use a temporary buffer so that we can strip the trailing
+           * Nul some code paths of do_pkdecrypt append.  */
+          init_membuf (&itembuf, 512);
+          err2 = do_pkdecrypt (ctrl, s_skey, shadow_info, p, len,
+                               s_cipher, &itembuf, &padding);
+          gcry_sexp_release (s_cipher);
+          item = get_membuf (&itembuf, &itemlen);
+          if (!err2 && !item)
+            err2 = gpg_error_from_syserror ();
+          if (!err2)
+            {
+              while (itemlen && !item[itemlen-1])
+                itemlen--;
+              put_membuf (outbuf, item, itemlen);
+            }
+          if (item)
+            wipememory (item, itemlen);
+          xfree (item);
+        }
+      if (gpg_err_code (err2) == GPG_ERR_CANCELED
+          || gpg_err_code (err2) == GPG_ERR_FULLY_CANCELED)
+        {
+          /* The user does not want to enter the PIN; don't ask again
+           * for the remaining items.  */
+          err = err2;
+          goto leave;
+        }
+      if (err2)
+        {
+          snprintf (numbuf, sizeof numbuf, "%u", err2);
+          put_membuf_printf (outbuf, "(5:error%u:%s)",
+                             (unsigned int)strlen (numbuf), numbuf);
+        }
+      else if (*r_padding == -1)
+        *r_padding = padding;
+    }
+
+ leave:
+  gcry_sexp_release (s_skey);
   xfree (shadow_info);
   return err;
 }
@@ -268,6 +268,43 @@ do_encode_raw_pkcs1 (const byte *md, size_t mdlen, unsigned int nbits,
 
 
 
+/* Encode DATA of length DATALEN for signing with the secret key
+ * S_SKEY of public key algorithm ALGO.  The hash algorithm and flags
+ * are taken from CTRL.  On success the data S-expression is stored
+ * at R_HASH.  */
+static gpg_error_t
+encode_for_skey (ctrl_t ctrl, int algo, gcry_sexp_t s_skey,
+                 const unsigned char *data, size_t datalen,
+                 gcry_sexp_t *r_hash)
+{
+  gpg_error_t err;
+
+  if (algo == GCRY_PK_EDDSA)
+    err = do_encode_eddsa (gcry_pk_get_nbits (s_skey), data, datalen,
+                           r_hash);
+  else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
+    err = do_encode_raw_pkcs1 (data, datalen,
+                               gcry_pk_get_nbits (s_skey),
+                               r_hash);
+  else if (algo == GCRY_PK_DSA || algo == GCRY_PK_ECC)
+    err = do_encode_dsa (data, datalen,
+                         algo, s_skey,
+                         r_hash);
+  else if (ctrl->digest.is_pss)
+    {
+      log_info ("signing with rsaPSS is currently only supported"
+                " for (some) smartcards\n");
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  else
+    err = do_encode_md (data, datalen,
+                        ctrl->digest.algo,
+                        r_hash,
+                        ctrl->digest.raw_value);
+  return err;
+}
+
+
 /* SIGN whatever information we have accumulated in CTRL and return
  * the signature S-expression.  LOOKUP is an optional function to
  * provide a way for lower layers to ask for the caching TTL.  If a
@@ -294,6 +331,7 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
   int datalen;
   int check_signature = 0;
   int algo;
+  int unprotected;
 
   if (overridedata)
     {
@@ -496,28 +534,7 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
       /* No smartcard, but a private key (in S_SKEY). */
 
       /* Put the hash into a sexp */
-      if (algo == GCRY_PK_EDDSA)
-        err = do_encode_eddsa (gcry_pk_get_nbits (s_skey), data, datalen,
-                               &s_hash);
-      else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
-        err = do_encode_raw_pkcs1 (data, datalen,
-                                   gcry_pk_get_nbits (s_skey),
-                                   &s_hash);
-      else if (algo == GCRY_PK_DSA || algo == GCRY_PK_ECC)
-        err = do_encode_dsa (data, datalen,
-                             algo, s_skey,
-                             &s_hash);
-      else if (ctrl->digest.is_pss)
-        {
-          log_info ("signing with rsaPSS is currently only supported"
-                    " for (some) smartcards\n");
-          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
-        }
-      else
-        err = do_encode_md (data, datalen,
-                            ctrl->digest.algo,
-                            &s_hash,
-                            ctrl->digest.raw_value);
+      err = encode_for_skey (ctrl, algo, s_skey, data, datalen, &s_hash);
       if (err)
         goto leave;
 
@@ -528,7 +545,9 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
         }
 
       /* sign */
+      unprotected = agent_unprotect_crypto ();
       err = gcry_pk_sign (&s_sig, s_hash, s_skey);
+      agent_protect_crypto (unprotected);
       if (err)
         {
           log_error ("signing failed: %s\n", gpg_strerror (err));
@@ -632,3 +651,118 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 
   return err;
 }
+
+
+/* Sign each of the NHASHES hash values of algorithm ALGO in the
+ * buffer HASHES with the key set in CTRL and write the signatures as
+ * a sequence of canonical S-expressions to OUTBUF.  The key is read
+ * and unprotected only once for all hashes.  The digest information
+ * in CTRL is replaced by the last hash.  If a CACHE_NONCE is given
+ * that cache item is first tried to get a passphrase.  */
+gpg_error_t
+agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                    const char *desc_text, int algo,
+                    const unsigned char *hashes, size_t nhashes,
+                    membuf_t *outbuf, cache_mode_t cache_mode)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_skey = NULL;
+  gcry_sexp_t s_hash = NULL;
+  gcry_sexp_t s_sig = NULL;
+  unsigned char *shadow_info = NULL;
+  char *buf = NULL;
+  size_t buflen = 0;
+  size_t len, dlen, n;
+  int pkalgo;
+  int unprotected;
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  if (algo == MD_USER_TLS_MD5SHA1)
+    dlen = 36;
+  else
+    dlen = gcry_md_get_algo_dlen (algo);
+  if (!dlen || dlen > MAX_DIGEST_LEN)
+    return gpg_error (GPG_ERR_DIGEST_ALGO);
+
+  xfree (ctrl->digest.data);
+  ctrl->digest.data = NULL;
+  ctrl->digest.algo = algo;
+  ctrl->digest.valuelen = dlen;
+  ctrl->digest.raw_value = 0;
+  ctrl->digest.is_pss = 0;
+
+  err = agent_key_from_file (ctrl, cache_nonce, desc_text, NULL,
+                             &shadow_info, cache_mode, NULL,
+                             &s_skey, NULL, NULL);
+  if (err && gpg_err_code (err) != GPG_ERR_NO_SECKEY)
+    {
+      log_error ("failed to read the secret key\n");
+      goto leave;
+    }
+
+  if (err || shadow_info)
+    {
+      /* The key is on a smartcard; there is nothing to gain from
+       * keeping it loaded and thus we do each signature the usual
+       * way.  */
+      for (n=0; n < nhashes; n++)
+        {
+          memcpy (ctrl->digest.value, hashes + n * dlen, dlen);
+          err = agent_pksign (ctrl, cache_nonce, desc_text, outbuf,
+                              cache_mode);
+          if (err)
+            goto leave;
+        }
+      goto leave;
+    }
+
+  pkalgo = get_pk_algo_from_key (s_skey);
+  for (n=0; n < nhashes; n++)
+    {
+      memcpy (ctrl->digest.value, hashes + n * dlen, dlen);
+      err = encode_for_skey (ctrl, pkalgo, s_skey,
+                             ctrl->digest.value, dlen, &s_hash);
+      if (err)
+        goto leave;
+
+      unprotected = agent_unprotect_crypto ();
+      err = gcry_pk_sign (&s_sig, s_hash, s_skey);
+      agent_protect_crypto (unprotected);
+      gcry_sexp_release (s_hash);
+      s_hash = NULL;
+      if (err)
+        {
+          log_error ("signing failed: %s\n", gpg_strerror (err));
+          goto leave;
+        }
+
+      len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
+      log_assert (len);
+      if (len > buflen)
+        {
+          xfree (buf);
+          buf = xtrymalloc (len);
+          if (!buf)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          buflen = len;
+        }
+      len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
+      log_assert (len);
+      put_membuf (outbuf, buf, len);
+      gcry_sexp_release (s_sig);
+      s_sig = NULL;
+    }
+
+ leave:
+  gcry_sexp_release (s_sig);
+  gcry_sexp_release (s_hash);
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
+  xfree (buf);
+  return err;
+}
@@ -771,6 +771,33 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
   return NULL;
 }
 
+int
+agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
+                 const char *data, int ttl)
+{
+  (void)ctrl;
+  (void)key;
+  (void)cache_mode;
+  (void)data;
+  (void)ttl;
+  return 0;
+}
+
+void *
+agent_secarena_alloc (ctrl_t ctrl, size_t n)
+{
+  (void)ctrl;
+  return xtrycalloc_secure (1, n);
+}
+
+void
+agent_secarena_free (ctrl_t ctrl, void *p, size_t n)
+{
+  (void)ctrl;
+  (void)n;
+  xfree (p);
+}
+
 gpg_error_t
 agent_askpin (ctrl_t ctrl,
               const char *desc_text, const char *prompt_text,
@@ -42,6 +42,7 @@
 #include "cvt-openpgp.h"
 #include "../common/sexp-parse.h"
 #include "../common/openpgpdefs.h"  /* For s2k functions.  */
+#include "../common/gettime.h"
 
 
 /* The protection mode for encryption.  The supported modes for
@@ -75,6 +76,23 @@ static const struct {
 static unsigned int s2k_calibration_time = AGENT_S2K_CALIBRATION;
 static unsigned long s2k_calibrated_count;
 
+/* The calibrated count is stored in this file below the homedir so
+ * that a new agent process does not need to calibrate again.  The
+ * file has one line
+ *
+ *   1 <created> <milliseconds> <count> <libgcrypt-version> <cpu-model>
+ *
+ * and is only used if the calibration time, the version of Libgcrypt
+ * and the CPU model match.  */
+#define S2K_CALIBRATION_FILE "s2k-calibration"
+
+/* A stored calibration older than this number of seconds is redone
+ * in the background.  */
+#define S2K_RECALIBRATION_INTERVAL (7*86400)
+
+/* The time the calibrated count was computed.  */
+static time_t s2k_calibration_created;
+
 
 /* A helper object for time measurement.  */
 struct calibrate_time_s
@@ -215,6 +233,124 @@ calibrate_s2k_count (void)
 }
 
 
+/* Store a string describing the CPU at BUFFER of size BUFLEN.  */
+static void
+get_cpu_model (char *buffer, size_t buflen)
+{
+#ifdef __linux__
+  estream_t fp;
+  char line[256];
+  char *p;
+
+  fp = es_fopen ("/proc/cpuinfo", "r");
+  if (fp)
+    {
+      while (es_fgets (line, sizeof line, fp))
+        if (!strncmp (line, "model name", 10) && (p = strchr (line, ':')))
+          {
+            trim_spaces (++p);
+            if (*p)
+              {
+                snprintf (buffer, buflen, "%s", p);
+                es_fclose (fp);
+                return;
+              }
+          }
+      es_fclose (fp);
+    }
+#endif
+  snprintf (buffer, buflen, "%s", PRINTABLE_OS_NAME);
+}
+
+
+/* Try to read the calibrated count from the calibration file.  On
+ * success S2K_CALIBRATED_COUNT and S2K_CALIBRATION_CREATED are set
+ * and true is returned.  */
+static int
+load_s2k_calibration (void)
+{
+  char *fname;
+  estream_t fp;
+  char line[512], cpu[256];
+  unsigned long created, ms, count;
+  int n;
+  char *p;
+
+  fname = make_filename (gnupg_homedir (), S2K_CALIBRATION_FILE, NULL);
+  fp = es_fopen (fname, "r");
+  xfree (fname);
+  if (!fp)
+    return 0;
+  p = es_fgets (line, sizeof line, fp);
+  es_fclose (fp);
+  if (!p)
+    return 0;
+  trim_spaces (line);
+
+  n = 0;
+  if (sscanf (line, "1 %lu %lu %lu %n", &created, &ms, &count, &n) != 3
+      || !n || ms != s2k_calibration_time || count < 65536)
+    return 0;
+  p = line + n;
+  n = strlen (gcry_check_version (NULL));
+  if (strncmp (p, gcry_check_version (NULL), n) || p[n] != ' ')
+    return 0;
+  get_cpu_model (cpu, sizeof cpu);
+  if (strcmp (p + n + 1, cpu))
+    return 0;
+
+  s2k_calibrated_count = count;
+  s2k_calibration_created = created;
+  if (opt.verbose)
+    log_info ("S2K calibration: using stored count %lu\n", count);
+  return 1;
+}
+
+
+/* Write the current calibrated count to the calibration file.
+ * Errors are only logged.  */
+static void
+save_s2k_calibration (void)
+{
+  char *fname, *tmpfname;
+  estream_t fp;
+  char cpu[256];
+  gpg_error_t err;
+
+  fname = make_filename (gnupg_homedir (), S2K_CALIBRATION_FILE, NULL);
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  get_cpu_model (cpu, sizeof cpu);
+  fp = es_fopen (tmpfname, "w");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  es_fprintf (fp, "1 %lu %u %lu %s %s\n",
+              (unsigned long)s2k_calibration_created, s2k_calibration_time,
+              s2k_calibrated_count, gcry_check_version (NULL), cpu);
+  if (es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  err = gnupg_rename_file (tmpfname, fname, NULL);
+
+ leave:
+  if (err)
+    log_info ("error writing '%s': %s\n", fname, gpg_strerror (err));
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
 /* Set the calibration time.  This may be called early at startup or
  * at any time.  Thus it should one set variables.  */
 void
@@ -234,14 +370,51 @@ set_s2k_calibration_time (unsigned int milliseconds)
 unsigned long
 get_calibrated_s2k_count (void)
 {
-  if (!s2k_calibrated_count)
-    s2k_calibrated_count = calibrate_s2k_count ();
+  if (!s2k_calibrated_count && !load_s2k_calibration ())
+    {
+      s2k_calibrated_count = calibrate_s2k_count ();
+      s2k_calibration_created = gnupg_get_time ();
+      save_s2k_calibration ();
+    }
 
   /* Enforce a lower limit.  */
   return s2k_calibrated_count < 65536 ? 65536 : s2k_calibrated_count;
 }
 
 
+/* Return true if the S2K count has not yet been calibrated or the
+ * calibration is old enough to be redone.  This is used by gpg-agent
+ * to run the calibration in the background.  */
+int
+s2k_calibration_is_stale (void)
+{
+  if (!s2k_calibrated_count && !load_s2k_calibration ())
+    return 1;
+  return (gnupg_get_time () - s2k_calibration_created
+          > S2K_RECALIBRATION_INTERVAL);
+}
+
+
+/* Run the calibration and return the count.  This does not change
+ * the count in use and may thus be run without the nPth lock.  */
+unsigned long
+compute_s2k_calibration (void)
+{
+  return calibrate_s2k_count ();
+}
+
+
+/* Take COUNT as computed by compute_s2k_calibration as the new count
+ * in use and store it.  */
+void
+store_s2k_calibration (unsigned long count)
+{
+  s2k_calibrated_count = count;
+  s2k_calibration_created = gnupg_get_time ();
+  save_s2k_calibration ();
+}
+
+
 /* Return the standard S2K count.  */
 unsigned long
 get_standard_s2k_count (void)
@@ -715,9 +888,81 @@ agent_protect (const unsigned char *plainkey, const char *passphrase,
 
 
 
+/* Derive the key protection key of length KEYLEN from PASSPHRASE
+ * and store it at KEY.  The derived key is kept in the passphrase
+ * cache along with a digest of the passphrase, so that the costly
+ * S2K with the same passphrase, S2KSALT and S2KCOUNT needs to be done
+ * only once.  */
+static gpg_error_t
+derive_kek (ctrl_t ctrl, const char *passphrase,
+            const unsigned char *s2ksalt, unsigned long s2kcount,
+            unsigned char *key, size_t keylen)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+  unsigned char check[32];
+  char cacheid[4 + 2*8 + 1 + 20 + 1 + 20 + 1];
+  char *value;
+  size_t n;
+
+  if (!passphrase || !*passphrase || keylen > 32)
+    return hash_passphrase (passphrase, GCRY_MD_SHA1,
+                            3, s2ksalt, s2kcount, key, keylen);
+
+  err = gcry_md_open (&md, GCRY_MD_SHA256, GCRY_MD_FLAG_SECURE);
+  if (err)
+    return err;
+  gcry_md_write (md, s2ksalt, 8);
+  gcry_md_write (md, passphrase, strlen (passphrase));
+  memcpy (check, gcry_md_read (md, GCRY_MD_SHA256), 32);
+  gcry_md_close (md);
+
+  memcpy (cacheid, "kek:", 4);
+  bin2hex (s2ksalt, 8, cacheid + 4);
+  snprintf (cacheid + 4 + 16, sizeof cacheid - 4 - 16, ":%lu:%zu",
+            s2kcount, keylen);
+
+  value = agent_get_cache (ctrl, cacheid, CACHE_MODE_KEK);
+  if (value)
+    {
+      n = strlen (value);
+      if (n == 2 * (32 + keylen)
+          && hex2bin (value, value, n/2) >= 0
+          && !memcmp (value, check, 32))
+        {
+          memcpy (key, value + 32, keylen);
+          wipememory (value, n);
+          xfree (value);
+          wipememory (check, sizeof check);
+          return 0;
+        }
+      wipememory (value, n);
+      xfree (value);
+    }
+
+  err = hash_passphrase (passphrase, GCRY_MD_SHA1,
+                         3, s2ksalt, s2kcount, key, keylen);
+  if (!err)
+    {
+      value = xtrymalloc_secure (2 * (32 + keylen) + 1);
+      if (value)
+        {
+          bin2hex (check, 32, value);
+          bin2hex (key, keylen, value + 64);
+          agent_put_cache (ctrl, cacheid, CACHE_MODE_KEK, value, 0);
+          wipememory (value, 2 * (32 + keylen));
+          xfree (value);
+        }
+    }
+  wipememory (check, sizeof check);
+  return err;
+}
+
+
 /* Do the actual decryption and check the return list for consistency.  */
 static gpg_error_t
-do_decryption (const unsigned char *aad_begin, size_t aad_len,
+do_decryption (ctrl_t ctrl,
+               const unsigned char *aad_begin, size_t aad_len,
                const unsigned char *aadhole_begin, size_t aadhole_len,
                const unsigned char *protected, size_t protectedlen,
                const char *passphrase,
@@ -754,7 +999,7 @@ do_decryption (const unsigned char *aad_begin, size_t aad_len,
   if (rc)
     return rc;
 
-  outbuf = gcry_malloc_secure (protectedlen);
+  outbuf = agent_secarena_alloc (ctrl, protectedlen);
   if (!outbuf)
     rc = out_of_core ();
 
@@ -763,16 +1008,16 @@ do_decryption (const unsigned char *aad_begin, size_t aad_len,
     {
       unsigned char *key;
 
-      key = gcry_malloc_secure (prot_cipher_keylen);
+      key = agent_secarena_alloc (ctrl, prot_cipher_keylen);
       if (!key)
         rc = out_of_core ();
       else
         {
-          rc = hash_passphrase (passphrase, GCRY_MD_SHA1,
-                                3, s2ksalt, s2kcount, key, prot_cipher_keylen);
+          rc = derive_kek (ctrl, passphrase, s2ksalt, s2kcount,
+                           key, prot_cipher_keylen);
           if (!rc)
             rc = gcry_cipher_setkey (hd, key, prot_cipher_keylen);
-          xfree (key);
+          agent_secarena_free (ctrl, key, prot_cipher_keylen);
         }
     }
 
@@ -821,14 +1066,14 @@ do_decryption (const unsigned char *aad_begin, size_t aad_len,
   gcry_cipher_close (hd);
   if (rc)
     {
-      xfree (outbuf);
+      agent_secarena_free (ctrl, outbuf, protectedlen);
       return rc;
     }
 
   /* Do a quick check on the data structure. */
   if (*outbuf != '(' && outbuf[1] != '(')
     {
-      xfree (outbuf);
+      agent_secarena_free (ctrl, outbuf, protectedlen);
       return gpg_error (GPG_ERR_BAD_PASSPHRASE);
     }
 
@@ -836,7 +1081,7 @@ do_decryption (const unsigned char *aad_begin, size_t aad_len,
   reallen = gcry_sexp_canon_len (outbuf, protectedlen, NULL, NULL);
   if (!reallen || (reallen + blklen < protectedlen) )
     {
-      xfree (outbuf);
+      agent_secarena_free (ctrl, outbuf, protectedlen);
       return gpg_error (GPG_ERR_BAD_PASSPHRASE);
     }
   *result = outbuf;
@@ -1240,7 +1485,7 @@ agent_unprotect (ctrl_t ctrl,
     return gpg_error (GPG_ERR_INV_SEXP);
 
   cleartext = NULL; /* Avoid cc warning. */
-  rc = do_decryption (aad_begin, aad_end - aad_begin,
+  rc = do_decryption (ctrl, aad_begin, aad_end - aad_begin,
                       aadhole_begin, aadhole_end - aadhole_begin,
                       s, n,
                       passphrase, s2ksalt, s2kcount,
@@ -1254,10 +1499,10 @@ agent_unprotect (ctrl_t ctrl,
                     is_ocb? NULL : sha1hash,
                     &final, &finallen, &cutoff, &cutlen);
   /* Albeit cleartext has been allocated in secure memory and thus
-     xfree will wipe it out, we do an extra wipe just in case
-     somethings goes badly wrong. */
+     agent_secarena_free will wipe it out, we do an extra wipe just in
+     case somethings goes badly wrong. */
   wipememory (cleartext, n);
-  xfree (cleartext);
+  agent_secarena_free (ctrl, cleartext, n);
   if (rc)
     return rc;
 
@@ -0,0 +1,218 @@
+/* secarena.c - Per connection scratch arenas in secure memory
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Each command which uses a protected key allocates and releases
+ * several short lived buffers for the passphrase, the derived key and
+ * the decrypted key from the secure memory pool of Libgcrypt.  With
+ * many concurrent connections these allocations contend for the pool
+ * and fragment it.  Thus a command takes one block of
+ * --secmem-arena-size bytes from the pool on first use and carves
+ * such buffers from it.  The arena is wiped and returned to the pool
+ * after each command so that idle connections do not hold any secure
+ * memory.  If the arena is exhausted or disabled the buffers are
+ * taken from the pool as before.
+ *
+ * Memory from an arena must only be released with
+ * agent_secarena_free and must not be kept beyond the command.  An
+ * arena is only used by its connection's thread; the counters are
+ * only updated while holding the nPth lock.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "agent.h"
+
+/* The alignment of the returned buffers.  */
+#define SECARENA_ALIGN 16
+
+/* The maximum size of an arena.  */
+#define SECARENA_MAX_SIZE (256*1024)
+
+
+struct agent_secarena_s
+{
+  size_t size;                  /* Allocated size of BUFFER.  */
+  size_t used;                  /* Number of bytes in use.  */
+  unsigned char *buffer;        /* Points into this object.  */
+};
+
+
+/* Counters for the statistics.  */
+static unsigned int arena_count;
+static size_t arena_bytes;
+static size_t arena_bytes_used;
+static size_t arena_bytes_peak;
+static unsigned long arena_allocs;
+static unsigned long arena_fallbacks;
+
+
+/* Return the configured size of a new arena rounded to the
+ * alignment.  */
+static size_t
+secarena_size (void)
+{
+  size_t size = opt.secmem_arena_size;
+
+  if (size > SECARENA_MAX_SIZE)
+    size = SECARENA_MAX_SIZE;
+  return size & ~(size_t)(SECARENA_ALIGN - 1);
+}
+
+
+/* Return true if P has been carved from ARENA.  */
+static int
+in_arena (struct agent_secarena_s *arena, const void *p)
+{
+  const unsigned char *s = p;
+
+  return (arena && s >= arena->buffer && s < arena->buffer + arena->size);
+}
+
+
+/* Return a buffer of N bytes in secure memory which is cleared.  The
+ * buffer is taken from the arena of CTRL if possible.  CTRL may be
+ * NULL.  Returns NULL and sets ERRNO on error.  */
+void *
+agent_secarena_alloc (ctrl_t ctrl, size_t n)
+{
+  struct agent_secarena_s *arena;
+  size_t size, need;
+  void *p;
+
+  if (!ctrl || !n)
+    goto fallback;
+
+  arena = ctrl->secarena;
+  if (!arena)
+    {
+      size = secarena_size ();
+      if (!size)
+        goto fallback;
+      arena = xtrycalloc_secure (1, sizeof *arena + SECARENA_ALIGN + size);
+      if (!arena)
+        goto fallback;
+      arena->buffer = (unsigned char *)(arena + 1);
+      arena->buffer += ((SECARENA_ALIGN - ((uintptr_t)arena->buffer
+                                           % SECARENA_ALIGN))
+                        % SECARENA_ALIGN);
+      arena->size = size;
+      ctrl->secarena = arena;
+      arena_count++;
+      arena_bytes += size;
+    }
+
+  need = (n + SECARENA_ALIGN - 1) & ~(size_t)(SECARENA_ALIGN - 1);
+  if (need < n || need > arena->size - arena->used)
+    goto fallback;
+
+  /* The arena is wiped on free and on reset and thus the new buffer
+   * is already cleared.  */
+  p = arena->buffer + arena->used;
+  arena->used += need;
+  arena_allocs++;
+  arena_bytes_used += need;
+  if (arena_bytes_used > arena_bytes_peak)
+    arena_bytes_peak = arena_bytes_used;
+  return p;
+
+ fallback:
+  if (ctrl)
+    arena_fallbacks++;
+  return xtrycalloc_secure (1, n);
+}
+
+
+/* Release the buffer P of N bytes which has been allocated by
+ * agent_secarena_alloc.  The buffer is wiped.  If the buffer is the
+ * last one carved from the arena its space is reused right away;
+ * all other space is reclaimed by agent_secarena_release.  */
+void
+agent_secarena_free (ctrl_t ctrl, void *p, size_t n)
+{
+  struct agent_secarena_s *arena = ctrl? ctrl->secarena : NULL;
+  unsigned char *s = p;
+  size_t need;
+
+  if (!p)
+    return;
+  if (!in_arena (arena, p))
+    {
+      xfree (p);
+      return;
+    }
+
+  need = (n + SECARENA_ALIGN - 1) & ~(size_t)(SECARENA_ALIGN - 1);
+  log_assert (s + need <= arena->buffer + arena->used);
+  wipememory (s, need);
+  if (s + need == arena->buffer + arena->used)
+    {
+      arena->used -= need;
+      arena_bytes_used -= need;
+    }
+}
+
+
+/* Wipe all buffers of the arena of CTRL and return it to the secure
+ * memory pool.  This is called after each command; nothing carved
+ * from the arena may be used thereafter.  */
+void
+agent_secarena_release (ctrl_t ctrl)
+{
+  struct agent_secarena_s *arena = ctrl? ctrl->secarena : NULL;
+
+  if (!arena)
+    return;
+  if (arena->used)
+    {
+      wipememory (arena->buffer, arena->used);
+      arena_bytes_used -= arena->used;
+      arena->used = 0;
+    }
+  arena_count--;
+  arena_bytes -= arena->size;
+  xfree (arena);
+  ctrl->secarena = NULL;
+}
+
+
+/* Return a malloced string with statistics about the arenas.  */
+char *
+agent_secarena_get_stats (void)
+{
+  return xtryasprintf ("pool=%u arena_size=%zu arenas=%u bytes=%zu"
+                       " used=%zu peak=%zu allocs=%lu fallbacks=%lu\n",
+                       (unsigned int)SECMEM_BUFFER_SIZE, secarena_size (),
+                       arena_count, arena_bytes, arena_bytes_used,
+                       arena_bytes_peak, arena_allocs, arena_fallbacks);
+}
+
+
+/* Print statistics about the arenas to the log.  */
+void
+agent_secarena_dump_state (void)
+{
+  log_info ("secarena: %u arenas, %zu bytes, %zu used, %zu peak,"
+            " %lu allocs, %lu fallbacks\n",
+            arena_count, arena_bytes, arena_bytes_used, arena_bytes_peak,
+            arena_allocs, arena_fallbacks);
+}
@@ -349,3 +349,43 @@ convert_from_openpgp_native (gcry_sexp_t s_pgp, const char *passphrase,
   (void)r_key;
   return gpg_error (GPG_ERR_BUG);
 }
+
+/* Stub function.  */
+char *
+agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
+{
+  (void)ctrl;
+  (void)key;
+  (void)cache_mode;
+  return NULL;
+}
+
+/* Stub function.  */
+int
+agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
+                 const char *data, int ttl)
+{
+  (void)ctrl;
+  (void)key;
+  (void)cache_mode;
+  (void)data;
+  (void)ttl;
+  return 0;
+}
+
+/* Stub function.  */
+void *
+agent_secarena_alloc (ctrl_t ctrl, size_t n)
+{
+  (void)ctrl;
+  return xtrycalloc_secure (1, n);
+}
+
+/* Stub function.  */
+void
+agent_secarena_free (ctrl_t ctrl, void *p, size_t n)
+{
+  (void)ctrl;
+  (void)n;
+  xfree (p);
+}
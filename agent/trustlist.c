@@ -54,6 +54,14 @@ typedef struct trustitem_s trustitem_t;
 /* Malloced table and its allocated size with all trust items. */
 static trustitem_t *trusttable;
 static size_t trusttablesize;
+/* Malloced array of TRUSTTABLESIZE pointers into TRUSTTABLE sorted
+   by fingerprint and then by position in the table.  */
+static trustitem_t **trustindex;
+/* True if the table has been read; it may still be empty.  */
+static int trusttable_valid;
+/* Size and mtime of the user and the system trustlist at the time
+   the table was read.  */
+static uint64_t trustfiles_stamp[4];
 /* A mutex used to protect the table. */
 static npth_mutex_t trusttable_lock;
 
@@ -125,7 +133,10 @@ clear_trusttable (void)
 {
   xfree (trusttable);
   trusttable = NULL;
+  xfree (trustindex);
+  trustindex = NULL;
   trusttablesize = 0;
+  trusttable_valid = 0;
 }
 
 
@@ -147,6 +158,49 @@ make_sys_trustlist_name (void)
 }
 
 
+/* Store the size and mtime of the user and the system trustlist at
+   STAMP.  Missing files are indicated by zeroes.  */
+static void
+get_trustfiles_stamp (uint64_t *stamp)
+{
+  struct stat st;
+  char *fname;
+
+  memset (stamp, 0, 4 * sizeof *stamp);
+  if (!opt.no_user_trustlist)
+    {
+      fname = make_filename_try (gnupg_homedir (), "trustlist.txt", NULL);
+      if (fname && !gnupg_stat (fname, &st))
+        {
+          stamp[0] = st.st_size;
+          stamp[1] = st.st_mtime;
+        }
+      xfree (fname);
+    }
+  fname = make_sys_trustlist_name ();
+  if (!gnupg_stat (fname, &st))
+    {
+      stamp[2] = st.st_size;
+      stamp[3] = st.st_mtime;
+    }
+  xfree (fname);
+}
+
+
+static int
+cmp_trustindex (const void *a_arg, const void *b_arg)
+{
+  const trustitem_t *a = *(const trustitem_t * const *)a_arg;
+  const trustitem_t *b = *(const trustitem_t * const *)b_arg;
+  int cmp;
+
+  cmp = memcmp (a->fpr, b->fpr, 20);
+  if (cmp)
+    return cmp;
+  return a < b? -1 : a > b;
+}
+
+
 static gpg_error_t
 read_one_trustfile (const char *fname, int systrust,
                     trustitem_t **addr_of_table,
@@ -357,8 +411,9 @@ read_trustfiles (void)
 {
   gpg_error_t err;
   trustitem_t *table, *ti;
+  trustitem_t **index;
   int tableidx;
-  size_t tablesize;
+  size_t tablesize, n;
   char *fname;
   int systrust = 0;
   gpg_err_code_t ec;
@@ -407,12 +462,12 @@ read_trustfiles (void)
         {
           /* Take a missing trustlist as an empty one.  */
           clear_trusttable ();
+          trusttable_valid = 1;
           err = 0;
         }
       return err;
     }
 
-  /* Fixme: we should drop duplicates and sort the table. */
   ti = xtryrealloc (table, (tableidx?tableidx:1) * sizeof *table);
   if (!ti)
     {
@@ -421,14 +476,46 @@ read_trustfiles (void)
       return err;
     }
 
+  /* Build the index.  Duplicates are kept in the order of the table
+     because the first entry for a fingerprint takes precedence.  */
+  index = xtrycalloc (tableidx?tableidx:1, sizeof *index);
+  if (!index)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (ti);
+      return err;
+    }
+  for (n=0; n < tableidx; n++)
+    index[n] = ti + n;
+  qsort (index, tableidx, sizeof *index, cmp_trustindex);
+
   /* Replace the trusttable.  */
   xfree (trusttable);
+  xfree (trustindex);
   trusttable = ti;
+  trustindex = index;
   trusttablesize = tableidx;
+  trusttable_valid = 1;
   return 0;
 }
 
 
+/* Make sure that the trusttable has been read and is up to date with
+   the trust files.  The trusttable is assumed to be locked.  */
+static gpg_error_t
+update_trusttable (void)
+{
+  uint64_t stamp[4];
+
+  get_trustfiles_stamp (stamp);
+  if (trusttable_valid && !memcmp (stamp, trustfiles_stamp, sizeof stamp))
+    return 0;
+  clear_trusttable ();
+  memcpy (trustfiles_stamp, stamp, sizeof stamp);
+  return read_trustfiles ();
+}
+
+
 /* Check whether the given fpr is in our trustdb.  We expect FPR to be
  * an all uppercase hexstring of 40 characters.  If ALREADY_LOCKED is
  * true the function assumes that the trusttable is already locked.
@@ -442,7 +529,7 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int listmode, int *r_disabled,
   gpg_error_t err = 0;
   int locked = already_locked;
   trustitem_t *ti;
-  size_t len;
+  size_t lo, hi, mid;
   unsigned char fprbin[20];
 
   if (r_disabled)
@@ -460,56 +547,64 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int listmode, int *r_disabled,
       locked = 1;
     }
 
-  if (!trusttable)
+  err = update_trusttable ();
+  if (err)
     {
-      err = read_trustfiles ();
-      if (err)
-        {
-          log_error (_("error reading list of trusted root certificates\n"));
-          goto leave;
-        }
+      log_error (_("error reading list of trusted root certificates\n"));
+      goto leave;
     }
 
-  if (trusttable)
+  if (trusttablesize)
     {
-      for (ti=trusttable, len = trusttablesize; len; ti++, len--)
-        if (!memcmp (ti->fpr, fprbin, 20))
-          {
-            if (listmode && ti->flags.disabled)
-              continue;
-            if (ti->flags.disabled && r_disabled)
-              *r_disabled = 1;
-
-            /* Print status messages only if we have not been called
-               in a locked state.  */
-            if (already_locked)
-              ;
-            else if (listmode || ti->flags.relax || ti->flags.cm
-                     || ti->flags.qual || ti->flags.de_vs)
-              {
-                unlock_trusttable ();
-                locked = 0;
-                err = 0;
-                if (listmode)
-                  {
-                    char hexfpr[2*20+1];
-                    bin2hex (ti->fpr, 20, hexfpr);
-                    err = agent_write_status (ctrl,"TRUSTLISTFPR", hexfpr,NULL);
-                  }
-                if (!err && ti->flags.relax)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "relax",NULL);
-                if (!err && ti->flags.cm)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "cm", NULL);
-                if (!err && ti->flags.qual)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "qual",NULL);
-                if (!err && ti->flags.de_vs)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "de-vs",NULL);
-              }
-
-            if (!err)
-              err = ti->flags.disabled? gpg_error (GPG_ERR_NOT_TRUSTED) : 0;
-            goto leave;
-          }
+      /* Find the first index entry for FPRBIN.  */
+      lo = 0;
+      hi = trusttablesize;
+      while (lo < hi)
+        {
+          mid = lo + (hi - lo) / 2;
+          if (memcmp (trustindex[mid]->fpr, fprbin, 20) < 0)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+      for (; lo < trusttablesize
+             && !memcmp ((ti = trustindex[lo])->fpr, fprbin, 20); lo++)
+        {
+          if (listmode && ti->flags.disabled)
+            continue;
+          if (ti->flags.disabled && r_disabled)
+            *r_disabled = 1;
+
+          /* Print status messages only if we have not been called
+             in a locked state.  */
+          if (already_locked)
+            ;
+          else if (listmode || ti->flags.relax || ti->flags.cm
+                   || ti->flags.qual || ti->flags.de_vs)
+            {
+              unlock_trusttable ();
+              locked = 0;
+              err = 0;
+              if (listmode)
+                {
+                  char hexfpr[2*20+1];
+                  bin2hex (ti->fpr, 20, hexfpr);
+                  err = agent_write_status (ctrl,"TRUSTLISTFPR", hexfpr,NULL);
+                }
+              if (!err && ti->flags.relax)
+                err = agent_write_status (ctrl,"TRUSTLISTFLAG", "relax",NULL);
+              if (!err && ti->flags.cm)
+                err = agent_write_status (ctrl,"TRUSTLISTFLAG", "cm", NULL);
+              if (!err && ti->flags.qual)
+                err = agent_write_status (ctrl,"TRUSTLISTFLAG", "qual",NULL);
+              if (!err && ti->flags.de_vs)
+                err = agent_write_status (ctrl,"TRUSTLISTFLAG", "de-vs",NULL);
+            }
+
+          if (!err)
+            err = ti->flags.disabled? gpg_error (GPG_ERR_NOT_TRUSTED) : 0;
+          goto leave;
+        }
     }
   err = gpg_error (GPG_ERR_NOT_TRUSTED);
 
@@ -543,15 +638,12 @@ agent_listtrusted (ctrl_t ctrl, void *assuan_context, int status_mode)
 
   lock_trusttable ();
   table_locked = 1;
-  if (!trusttable)
+  err = update_trusttable ();
+  if (err)
     {
-      err = read_trustfiles ();
-      if (err)
-        {
-          unlock_trusttable ();
-          log_error (_("error reading list of trusted root certificates\n"));
-          return err;
-        }
+      unlock_trusttable ();
+      log_error (_("error reading list of trusted root certificates\n"));
+      return err;
     }
 
   err = 0;
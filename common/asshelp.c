@@ -370,6 +370,54 @@ wait_for_sock (int secs, int module_name_id, const char *sockname,
 }
 
 
+#ifndef HAVE_W32_SYSTEM
+/* Spawn the service PGMNAME with ARGV and wait until it is ready.
+ * All our daemons create and listen on their socket before they fork
+ * and let the foreground process terminate; thus the exit of the
+ * spawned process tells us that the socket is ready and we can
+ * connect right away instead of polling.  On success R_READY is set
+ * to true if CTX is connected; if it is false the caller should fall
+ * back to wait_for_sock.  If the process terminated with an error
+ * status (e.g. because another instance is already running) we still
+ * try to connect once and return an error if that fails.  */
+static gpg_error_t
+spawn_and_wait_for_ready (const char *pgmname, const char *argv[],
+                          const char *sockname, unsigned int connect_flags,
+                          assuan_context_t ctx, int *r_ready)
+{
+  gpg_error_t err;
+  gpgrt_process_t proc = NULL;
+  int status = 0;
+
+  *r_ready = 0;
+
+  err = gpgrt_process_spawn (pgmname, argv, 0, NULL, &proc);
+  if (err)
+    return err;
+
+  err = gpgrt_process_wait (proc, 1);
+  if (!err)
+    gpgrt_process_ctl (proc, GPGRT_PROCESS_GET_EXIT_ID, &status);
+  gpgrt_process_release (proc);
+  if (err)
+    return err;
+
+  err = assuan_socket_connect (ctx, sockname, 0, connect_flags);
+  if (!err)
+    {
+      *r_ready = 1;
+      return 0;
+    }
+  if (status)
+    {
+      log_info ("'%s' terminated with status %d\n", pgmname, status);
+      return gpg_error (GPG_ERR_GENERAL);
+    }
+  return 0;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 /* Try to connect to a new service via socket or start it if it is not
  * running and AUTOSTART is set.  Handle the server's initial
  * greeting.  Returns a new assuan context at R_CTX or an error code.
@@ -454,6 +502,7 @@ start_new_service (assuan_context_t *r_ctx,
       char *p;
       const char *s;
       int i;
+      int ready = 0;
 
       /* With no success start a new server.  */
       if (!program_name || !*program_name)
@@ -524,14 +573,15 @@ start_new_service (assuan_context_t *r_ctx,
           err = gpgrt_process_spawn (program? program : program_name, argv,
                                      GPGRT_PROCESS_DETACHED, NULL, NULL);
 #else /*!W32*/
-          err = gpgrt_process_spawn (program? program : program_name, argv,
-                                     0, NULL, NULL);
+          err = spawn_and_wait_for_ready (program? program : program_name,
+                                          argv, sockname, connect_flags,
+                                          ctx, &ready);
 #endif /*!W32*/
           if (err)
             log_error ("failed to start %s '%s': %s\n",
                        printed_name, program? program : program_name,
                        gpg_strerror (err));
-          else
+          else if (!ready)
             err = wait_for_sock (seconds_to_wait, module_name_id,
                                  sockname, connect_flags,
                                  verbose, ctx, &did_success_msg);
@@ -0,0 +1,353 @@
+/* asynclog.c - An asynchronous log sink
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The log functions of libgpg-error write each line synchronously to
+ * the log file.  With many debug flags enabled this slows down a
+ * daemon considerably and changes its timing.  This module provides
+ * a log stream whose write function only copies the data into a ring
+ * buffer; a separate thread writes it out to the file.  If the ring
+ * buffer is full further output is dropped instead of blocking the
+ * caller and a note is written once the writer caught up.
+ *
+ * Producers and the writer thread only hold the mutex for updating
+ * the ring indices; the actual write is done without the mutex and
+ * with the nPth lock released because producers never touch the part
+ * of the ring which is being written.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <npth.h>
+
+#include "util.h"
+#include "asynclog.h"
+
+
+static struct
+{
+  npth_mutex_t mutex;
+  npth_cond_t cond;
+  npth_t thd;
+  int fd;
+  char *ring;
+  size_t head;            /* Total number of bytes put into the ring.  */
+  size_t tail;            /* Total number of bytes written out.        */
+  size_t inflight;        /* Bytes at TAIL currently being written.    */
+  unsigned long dropped;  /* Number of bytes dropped.                  */
+  int stop;               /* Ask the writer thread to terminate.       */
+  int skipping;           /* Drop the rest of a partly dropped line.   */
+  unsigned int initialized:1;
+  unsigned int active:1;
+} alog;
+
+
+static void
+lock_alog (void)
+{
+  int rc = npth_mutex_lock (&alog.mutex);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_alog (void)
+{
+  int rc = npth_mutex_unlock (&alog.mutex);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* Write all LENGTH bytes of BUFFER to the log file.  Errors are
+ * ignored because there is no way to report them.  If NOTHREAD is
+ * set the nPth lock is not released.  */
+static void
+write_all (const char *buffer, size_t length, int nothread)
+{
+  ssize_t n;
+
+  while (length)
+    {
+      if (nothread)
+        n = write (alog.fd, buffer, length);
+      else
+        n = npth_write (alog.fd, buffer, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      buffer += n;
+      length -= n;
+    }
+}
+
+
+/* The cookie write function of the log stream.  */
+static gpgrt_ssize_t
+alog_cookie_write (void *cookie, const void *buffer, size_t size)
+{
+  size_t off, n;
+
+  (void)cookie;
+
+  if (!size)
+    return 0;  /* Flush - nothing to do.  */
+
+  lock_alog ();
+  if (alog.skipping || size > ASYNC_LOG_RING_SIZE - (alog.head - alog.tail))
+    {
+      alog.dropped += size;
+      alog.skipping = ((const char *)buffer)[size-1] != '\n';
+    }
+  else
+    {
+      off = alog.head % ASYNC_LOG_RING_SIZE;
+      n = ASYNC_LOG_RING_SIZE - off;
+      if (n > size)
+        n = size;
+      memcpy (alog.ring + off, buffer, n);
+      if (n < size)
+        memcpy (alog.ring, (const char *)buffer + n, size - n);
+      alog.head += size;
+      npth_cond_signal (&alog.cond);
+    }
+  unlock_alog ();
+
+  return size;
+}
+
+
+/* The writer thread.  */
+static void *
+alog_writer_thread (void *arg)
+{
+  size_t off, n;
+  unsigned long dropped;
+  char note[80];
+  int at_bol = 1;
+
+  (void)arg;
+
+  lock_alog ();
+  for (;;)
+    {
+      while (alog.head == alog.tail && !alog.dropped && !alog.stop)
+        npth_cond_wait (&alog.cond, &alog.mutex);
+      if (alog.head == alog.tail && alog.dropped)
+        {
+          dropped = alog.dropped;
+          alog.dropped = 0;
+          unlock_alog ();
+          snprintf (note, sizeof note,
+                    "%s[%lu bytes of log output dropped]\n",
+                    at_bol? "" : "\n", dropped);
+          at_bol = 1;
+          write_all (note, strlen (note), 0);
+          lock_alog ();
+          continue;
+        }
+      if (alog.head == alog.tail)
+        break;  /* Stop requested and all data written.  */
+
+      off = alog.tail % ASYNC_LOG_RING_SIZE;
+      n = alog.head - alog.tail;
+      if (n > ASYNC_LOG_RING_SIZE - off)
+        n = ASYNC_LOG_RING_SIZE - off;
+      alog.inflight = n;
+      unlock_alog ();
+
+      write_all (alog.ring + off, n, 0);
+      at_bol = alog.ring[off + n - 1] == '\n';
+
+      lock_alog ();
+      alog.tail += n;
+      alog.inflight = 0;
+    }
+  unlock_alog ();
+
+  return NULL;
+}
+
+
+/* Stop the writer thread after it wrote out the pending data.  */
+static void
+stop_writer (void)
+{
+  if (!alog.active)
+    return;
+
+  lock_alog ();
+  alog.stop = 1;
+  npth_cond_signal (&alog.cond);
+  unlock_alog ();
+  npth_join (alog.thd, NULL);
+
+  close (alog.fd);
+  alog.fd = -1;
+  xfree (alog.ring);
+  alog.ring = NULL;
+  alog.head = alog.tail = 0;
+  alog.dropped = 0;
+  alog.stop = 0;
+  alog.active = 0;
+}
+
+
+/* The cookie close function of the log stream.  This is called by
+ * libgpg-error if another log file is set.  */
+static int
+alog_cookie_close (void *cookie)
+{
+  (void)cookie;
+  stop_writer ();
+  return 0;
+}
+
+
+/* Write out what is left in the ring.  This is used at process
+ * termination where we can't wait for the writer thread.  */
+void
+async_log_flush (void)
+{
+  size_t start, off, n;
+
+  if (!alog.active)
+    return;
+
+  lock_alog ();
+  alog.stop = 1;
+  start = alog.tail + alog.inflight;
+  while (start != alog.head)
+    {
+      off = start % ASYNC_LOG_RING_SIZE;
+      n = alog.head - start;
+      if (n > ASYNC_LOG_RING_SIZE - off)
+        n = ASYNC_LOG_RING_SIZE - off;
+      write_all (alog.ring + off, n, 1);
+      start += n;
+    }
+  /* The writer thread will add what it is currently writing.  */
+  alog.tail = alog.head - alog.inflight;
+  unlock_alog ();
+}
+
+
+static void
+alog_atexit (void)
+{
+  async_log_flush ();
+}
+
+
+/* Switch the log output to the file NAME using the asynchronous log
+ * sink.  NAME may be NULL or "-" for stderr.  Socket names are not
+ * supported and GPG_ERR_NOT_SUPPORTED is returned for them; the
+ * caller should then keep the synchronous logging.  Calling this
+ * again while the sink is active is a no-op; if libgpg-error has
+ * switched to another log file in the meantime the sink has already
+ * been shut down.  nPth must have been initialized.  */
+gpg_error_t
+async_log_set_file (const char *name)
+{
+  static es_cookie_io_functions_t io_functions =
+    { NULL, alog_cookie_write, NULL, alog_cookie_close };
+  gpg_error_t err;
+  npth_attr_t tattr;
+  estream_t stream;
+  int rc;
+
+  if (alog.active)
+    return 0;
+
+  if (name && strstr (name, "://"))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  if (!alog.initialized)
+    {
+      rc = npth_mutex_init (&alog.mutex, NULL);
+      if (!rc)
+        {
+          rc = npth_cond_init (&alog.cond, NULL);
+          if (rc)
+            npth_mutex_destroy (&alog.mutex);
+        }
+      if (rc)
+        return gpg_error_from_errno (rc);
+      atexit (alog_atexit);
+      alog.initialized = 1;
+    }
+
+  alog.ring = xtrymalloc (ASYNC_LOG_RING_SIZE);
+  if (!alog.ring)
+    return gpg_error_from_syserror ();
+
+  if (!name || !strcmp (name, "-"))
+    alog.fd = dup (2);
+  else
+    alog.fd = open (name, O_WRONLY | O_APPEND | O_CREAT, 0666);
+  if (alog.fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      goto leave;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  rc = npth_create (&alog.thd, &tattr, alog_writer_thread, NULL);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      goto leave;
+    }
+  alog.active = 1;
+
+  stream = es_fopencookie (&alog, "w", io_functions);
+  if (!stream)
+    {
+      err = gpg_error_from_syserror ();
+      stop_writer ();
+      return err;
+    }
+  log_set_stream (stream);
+  /* Make sure that we get complete lines so that we drop only
+   * complete lines if the ring is full.  */
+  es_setvbuf (stream, NULL, _IOLBF, 0);
+  return 0;
+
+ leave:
+  if (alog.fd != -1)
+    close (alog.fd);
+  alog.fd = -1;
+  xfree (alog.ring);
+  alog.ring = NULL;
+  return err;
+}
@@ -0,0 +1,33 @@
+/* asynclog.h - Definitions for the asynchronous log sink
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_COMMON_ASYNCLOG_H
+#define GNUPG_COMMON_ASYNCLOG_H
+
+/* The size of the ring buffer.  Log output which does not fit into
+ * it is dropped and a note about the number of dropped bytes is
+ * written instead.  */
+#define ASYNC_LOG_RING_SIZE (256*1024)
+
+gpg_error_t async_log_set_file (const char *name);
+void async_log_flush (void);
+
+
+#endif /*GNUPG_COMMON_ASYNCLOG_H*/
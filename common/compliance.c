@@ -41,6 +41,40 @@ static int initialized;
 static int module;
 
 
+/* The curves allowed in de-vs mode.  The OIDs are converted by
+ * gnupg_initialize_compliance to the format of the curve parameter
+ * of a key so that a key can be checked without converting its OID
+ * to a string.  */
+static struct
+{
+  const char *name;
+  const char *oidstr;
+  unsigned char oid[16];
+  size_t oidlen;
+} de_vs_curves[] =
+  {
+    { "brainpoolP256r1", "1.3.36.3.3.2.8.1.1.7"  },
+    { "brainpoolP384r1", "1.3.36.3.3.2.8.1.1.11" },
+    { "brainpoolP512r1", "1.3.36.3.3.2.8.1.1.13" }
+  };
+
+
+/* The results of the cipher and digest checks for de-vs mode which
+ * are computed by gnupg_initialize_compliance.  The tables are
+ * indexed by the algorithm; bit N of a cipher entry is for mode N.
+ * The first index of the cipher table is 0 for the compliance check
+ * and 1 or 2 for the consumer or producer check.  The digest table
+ * uses the bits DIGEST_TBL_*.  */
+#define COMPL_TBL_ALGOS 256
+#define COMPL_TBL_MODES 32
+#define DIGEST_TBL_COMPLIANT 1
+#define DIGEST_TBL_CONSUMER  2
+#define DIGEST_TBL_PRODUCER  4
+static int tables_ready;
+static unsigned int de_vs_cipher_tbl[3][COMPL_TBL_ALGOS];
+static unsigned char de_vs_digest_tbl[COMPL_TBL_ALGOS];
+
+
 /* This value is used by DSA and RSA checks in addition to the hard
  * coded length checks.  It allows one to increase the required key length
  * using a config file.  */
@@ -114,6 +148,79 @@ get_compliance_cache (enum gnupg_compliance_mode compliance, int for_rng)
 }
 
 
+/* Return true if the curve given by CURVENAME or, if that is NULL,
+ * by the curve parameter of KEY is allowed in de-vs mode.  */
+static int
+is_de_vs_curve (const char *curvename, gcry_mpi_t key[])
+{
+  const unsigned char *buf;
+  unsigned int nbits;
+  size_t len;
+  int i;
+
+  if (curvename)
+    {
+      for (i=0; i < DIM (de_vs_curves); i++)
+        if (!strcmp (curvename, de_vs_curves[i].name))
+          return 1;
+      return 0;
+    }
+
+  if (!key || !key[0]
+      || !gcry_mpi_get_flag (key[0], GCRYMPI_FLAG_OPAQUE)
+      || !(buf = gcry_mpi_get_opaque (key[0], &nbits)))
+    return 0;
+  len = (nbits+7)/8;
+  for (i=0; i < DIM (de_vs_curves); i++)
+    if (de_vs_curves[i].oidlen == len
+        && !memcmp (de_vs_curves[i].oid, buf, len))
+      return 1;
+  return 0;
+}
+
+
+/* Fill the tables used by the compliance checks.  */
+static void
+init_compliance_tables (void)
+{
+  gcry_mpi_t a;
+  const unsigned char *buf;
+  unsigned int nbits;
+  int i, algo, mode;
+
+  for (i=0; i < DIM (de_vs_curves); i++)
+    {
+      if (openpgp_oid_from_str (de_vs_curves[i].oidstr, &a))
+        log_fatal ("%s: bad OID for %s\n", __func__, de_vs_curves[i].name);
+      buf = gcry_mpi_get_opaque (a, &nbits);
+      log_assert (buf && (nbits+7)/8 <= sizeof de_vs_curves[i].oid);
+      de_vs_curves[i].oidlen = (nbits+7)/8;
+      memcpy (de_vs_curves[i].oid, buf, de_vs_curves[i].oidlen);
+      gcry_mpi_release (a);
+    }
+
+  for (algo=0; algo < COMPL_TBL_ALGOS; algo++)
+    {
+      for (mode=0; mode < COMPL_TBL_MODES; mode++)
+        {
+          if (gnupg_cipher_is_compliant (CO_DE_VS, algo, mode))
+            de_vs_cipher_tbl[0][algo] |= (1u << mode);
+          if (gnupg_cipher_is_allowed (CO_DE_VS, 0, algo, mode))
+            de_vs_cipher_tbl[1][algo] |= (1u << mode);
+          if (gnupg_cipher_is_allowed (CO_DE_VS, 1, algo, mode))
+            de_vs_cipher_tbl[2][algo] |= (1u << mode);
+        }
+      if (gnupg_digest_is_compliant (CO_DE_VS, algo))
+        de_vs_digest_tbl[algo] |= DIGEST_TBL_COMPLIANT;
+      if (gnupg_digest_is_allowed (CO_DE_VS, 0, algo))
+        de_vs_digest_tbl[algo] |= DIGEST_TBL_CONSUMER;
+      if (gnupg_digest_is_allowed (CO_DE_VS, 1, algo))
+        de_vs_digest_tbl[algo] |= DIGEST_TBL_PRODUCER;
+    }
+  tables_ready = 1;
+}
+
+
 /* Initializes the module.  Must be called with the current
  * GNUPG_MODULE_NAME.  Checks a few invariants, and tunes the policies
  * for the given module.  */
@@ -165,6 +272,7 @@ gnupg_initialize_compliance (int gnupg_module_name)
 
   module = gnupg_module_name;
   initialized = 1;
+  init_compliance_tables ();
 }
 
 /* Return true if ALGO with a key of KEYLENGTH is compliant to the
@@ -223,8 +331,6 @@ gnupg_pk_is_compliant (enum gnupg_compliance_mode compliance, int algo,
 
   if (compliance == CO_DE_VS)
     {
-      char *curve = NULL;
-
       switch (algotype)
         {
         case is_elg:
@@ -253,45 +359,22 @@ gnupg_pk_is_compliant (enum gnupg_compliance_mode compliance, int algo,
 	  break;
 
         case is_ecc:
-          if (!curvename && key)
-            {
-              curve = openpgp_oid_to_str (key[0]);
-              curvename = openpgp_oid_to_curve (curve, 0);
-              if (!curvename)
-                curvename = curve;
-            }
-
-          result = (curvename
-                    && (algo == PUBKEY_ALGO_ECDH
-                        || algo == PUBKEY_ALGO_ECDSA
-                        || algo == GCRY_PK_ECDH
-                        || algo == GCRY_PK_ECDSA)
-                    && (!strcmp (curvename, "brainpoolP256r1")
-                        || !strcmp (curvename, "brainpoolP384r1")
-                        || !strcmp (curvename, "brainpoolP512r1")));
+          result = ((algo == PUBKEY_ALGO_ECDH
+                     || algo == PUBKEY_ALGO_ECDSA
+                     || algo == GCRY_PK_ECDH
+                     || algo == GCRY_PK_ECDSA)
+                    && is_de_vs_curve (curvename, key));
           break;
 
         case is_kem:
-          if (!curvename && key)
-            {
-              curve = openpgp_oid_to_str (key[0]);
-              curvename = openpgp_oid_to_curve (curve, 0);
-              if (!curvename)
-                curvename = curve;
-            }
-
-          result = (curvename
-                    && (keylength == 768 || keylength == 1024)
+          result = ((keylength == 768 || keylength == 1024)
                     && (algo == PUBKEY_ALGO_KYBER)
-                    && (!strcmp (curvename, "brainpoolP256r1")
-                        || !strcmp (curvename, "brainpoolP384r1")
-                        || !strcmp (curvename, "brainpoolP512r1")));
+                    && is_de_vs_curve (curvename, key));
           break;
 
         default:
           result = 0;
         }
-      xfree (curve);
     }
   else
     {
@@ -373,24 +456,7 @@ gnupg_pk_is_allowed (enum gnupg_compliance_mode compliance,
 	  if (use == PK_USE_DECRYPTION)
             result = 1;
           else if (use == PK_USE_ENCRYPTION)
-            {
-              char *curve = NULL;
-
-              if (!curvename && key)
-                {
-                  curve = openpgp_oid_to_str (key[0]);
-                  curvename = openpgp_oid_to_curve (curve, 0);
-                  if (!curvename)
-                    curvename = curve;
-                }
-
-              result = (curvename
-                        && (!strcmp (curvename, "brainpoolP256r1")
-                            || !strcmp (curvename, "brainpoolP384r1")
-                            || !strcmp (curvename, "brainpoolP512r1")));
-
-              xfree (curve);
-            }
+            result = is_de_vs_curve (curvename, key);
           break;
 
 	case PUBKEY_ALGO_ECDSA:
@@ -398,24 +464,8 @@ gnupg_pk_is_allowed (enum gnupg_compliance_mode compliance,
           if (use == PK_USE_VERIFICATION)
             result = 1;
           else
-            {
-              char *curve = NULL;
-
-              if (! curvename && key)
-	      {
-		curve = openpgp_oid_to_str (key[0]);
-		curvename = openpgp_oid_to_curve (curve, 0);
-		if (!curvename)
-		  curvename = curve;
-	      }
-
-              result = (use == PK_USE_SIGNING
-                         && curvename
-                         && (!strcmp (curvename, "brainpoolP256r1")
-                             || !strcmp (curvename, "brainpoolP384r1")
-                             || !strcmp (curvename, "brainpoolP512r1")));
-              xfree (curve);
-            }
+            result = (use == PK_USE_SIGNING
+                      && is_de_vs_curve (curvename, key));
           break;
 
 
@@ -430,25 +480,8 @@ gnupg_pk_is_allowed (enum gnupg_compliance_mode compliance,
 	  if (use == PK_USE_DECRYPTION)
             result = 1;
           else if (use == PK_USE_ENCRYPTION)
-            {
-              char *curve = NULL;
-
-              if (!curvename && key)
-                {
-                  curve = openpgp_oid_to_str (key[0]);
-                  curvename = openpgp_oid_to_curve (curve, 0);
-                  if (!curvename)
-                    curvename = curve;
-                }
-
-              result = (curvename
-                        && (keylength == 768 || keylength == 1024)
-                        && (!strcmp (curvename, "brainpoolP256r1")
-                            || !strcmp (curvename, "brainpoolP384r1")
-                            || !strcmp (curvename, "brainpoolP512r1")));
-
-              xfree (curve);
-            }
+            result = ((keylength == 768 || keylength == 1024)
+                      && is_de_vs_curve (curvename, key));
           break;
 
 	default:
@@ -474,6 +507,11 @@ gnupg_cipher_is_compliant (enum gnupg_compliance_mode compliance,
   if (! initialized)
     return 0;
 
+  if (tables_ready && compliance == CO_DE_VS
+      && (unsigned int)cipher < COMPL_TBL_ALGOS
+      && (unsigned int)mode < COMPL_TBL_MODES)
+    return !!(de_vs_cipher_tbl[0][cipher] & (1u << mode));
+
   switch (compliance)
     {
     case CO_DE_VS:
@@ -517,6 +555,11 @@ gnupg_cipher_is_allowed (enum gnupg_compliance_mode compliance, int producer,
   if (! initialized)
     return 1;
 
+  if (tables_ready && compliance == CO_DE_VS
+      && (unsigned int)cipher < COMPL_TBL_ALGOS
+      && (unsigned int)mode < COMPL_TBL_MODES)
+    return !!(de_vs_cipher_tbl[producer? 2:1][cipher] & (1u << mode));
+
   switch (compliance)
     {
     case CO_DE_VS:
@@ -571,6 +614,10 @@ gnupg_digest_is_compliant (enum gnupg_compliance_mode compliance,
   if (! initialized)
     return 0;
 
+  if (tables_ready && compliance == CO_DE_VS
+      && (unsigned int)digest < COMPL_TBL_ALGOS)
+    return !!(de_vs_digest_tbl[digest] & DIGEST_TBL_COMPLIANT);
+
   switch (compliance)
     {
     case CO_DE_VS:
@@ -604,6 +651,11 @@ gnupg_digest_is_allowed (enum gnupg_compliance_mode compliance, int producer,
   if (! initialized)
     return 1;
 
+  if (tables_ready && compliance == CO_DE_VS
+      && (unsigned int)digest < COMPL_TBL_ALGOS)
+    return !!(de_vs_digest_tbl[digest]
+              & (producer? DIGEST_TBL_PRODUCER : DIGEST_TBL_CONSUMER));
+
   switch (compliance)
     {
     case CO_DE_VS:
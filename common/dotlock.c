@@ -256,6 +256,16 @@
      the best solution.
    - O_EXCL seems to have a race and may re-create a file anyway.
 
+   On waiting for a lock:
+   - Where open file description locks (F_OFD_SETLKW, Linux 3.15)
+     are available, the owner of a hardlink lock additionally puts an
+     OFD write lock on the lock file.  A process on the same node
+     waiting forever for the lock blocks on that record lock instead
+     of polling and is thus woken up right when the lock is released.
+     The hardlink remains the actual lock so that this interoperates
+     with older versions and NFS; waiting for an owner without such a
+     record lock falls back to polling.
+
 */
 
 #ifdef HAVE_CONFIG_H
@@ -297,6 +307,9 @@
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#if defined(HAVE_POSIX_SYSTEM) && defined(F_OFD_SETLKW) && defined(O_CLOEXEC)
+# define DOTLOCK_USE_OFD 1
+#endif
 #ifdef HAVE_SIGNAL_H
 # include <signal.h>
 #endif
@@ -412,6 +425,7 @@ struct dotlock_handle
   char *tname;         /* Name of the lockfile template.        */
   size_t nodename_off; /* Offset in TNAME of the nodename part. */
   size_t nodename_len; /* Length of the nodename part.          */
+  int ofd_fd;          /* Descriptor holding the OFD lock or -1. */
 #endif /*!HAVE_DOSISH_SYSTEM */
 };
 
@@ -1071,6 +1085,7 @@ dotlock_create (const char *file_to_lock, unsigned int flags)
     return NULL;
   h->extra_fd = -1;
 #ifndef HAVE_DOSISH_SYSTEM
+  h->ofd_fd = -1;
   h->by_parent = by_parent;
   h->no_write = no_write;
 #endif
@@ -1149,12 +1164,91 @@ dotlock_set_info_cb (dotlock_t h,
 
 
 #ifdef HAVE_POSIX_SYSTEM
+/* Put an OFD write lock on the lock file of H which we just took.
+ * Waiters block on it; see wait_for_ofd_lock.  Errors are ignored
+ * because waiters then just fall back to polling.  */
+static void
+take_ofd_lock (dotlock_t h)
+{
+#ifdef DOTLOCK_USE_OFD
+  struct flock fl;
+  int fd;
+
+  /* Use close-on-exec so that spawned processes do not keep the
+   * record lock alive.  */
+  fd = open (h->tname, O_WRONLY|O_CLOEXEC);
+  if (fd == -1)
+    return;
+  memset (&fl, 0, sizeof fl);
+  fl.l_type = F_WRLCK;
+  fl.l_whence = SEEK_SET;
+  if (fcntl (fd, F_OFD_SETLK, &fl))
+    {
+      close (fd);
+      return;
+    }
+  h->ofd_fd = fd;
+#else
+  (void)h;
+#endif
+}
+
+
+/* Release the OFD lock of H.  This must be done after the lock file
+ * has been removed.  */
+static void
+release_ofd_lock (dotlock_t h)
+{
+  if (h->ofd_fd != -1)
+    {
+      close (h->ofd_fd);
+      h->ofd_fd = -1;
+    }
+}
+
+
+#ifdef DOTLOCK_USE_OFD
+/* Wait until the owner with PID of the lock H releases its OFD lock
+ * on the lock file opened at FD.  Returns 0 if we waited, -1 if the
+ * owner does not hold an OFD lock and 1 if the info callback asked
+ * us to cancel.  */
+static int
+wait_for_ofd_lock (dotlock_t h, int fd, int pid)
+{
+  struct flock fl;
+  int rc;
+
+  memset (&fl, 0, sizeof fl);
+  fl.l_type = F_RDLCK;
+  fl.l_whence = SEEK_SET;
+  if (!fcntl (fd, F_OFD_SETLK, &fl))
+    return -1;  /* Not locked; our lock goes away with FD.  */
+  if (errno != EAGAIN && errno != EACCES)
+    return -1;
+
+  my_info_3 (_("waiting for lock (held by %d%s) %s...\n"),
+             pid, "", maybe_deadlock(h)? _("(deadlock?) "):"");
+  if (h->info_cb
+      && h->info_cb (h, h->info_cb_value, DOTLOCK_WAITING,
+                     _("waiting for lock (held by %d%s) %s...\n"),
+                     pid, "", maybe_deadlock(h)? _("(deadlock?) "):""))
+    return 1;
+
+  do
+    rc = fcntl (fd, F_OFD_SETLKW, &fl);
+  while (rc == -1 && errno == EINTR);
+  return rc? -1 : 0;
+}
+#endif /*DOTLOCK_USE_OFD*/
+
+
 /* Unix specific code of destroy_dotlock.  */
 static void
 dotlock_destroy_unix (dotlock_t h)
 {
   if (h->locked && h->lockname)
     unlink (h->lockname);
+  release_ofd_lock (h);
   if (h->tname && !h->use_o_excl)
     unlink (h->tname);
 }
@@ -1369,6 +1463,7 @@ dotlock_take_unix (dotlock_t h, long timeout)
       if (sb.st_nlink == 2)
         {
           h->locked = 1;
+          take_ofd_lock (h);
           return 0; /* Okay.  */
         }
     }
@@ -1441,6 +1536,27 @@ dotlock_take_unix (dotlock_t h, long timeout)
       goto again;
     }
 
+#ifdef DOTLOCK_USE_OFD
+  /* If we shall wait forever for an owner on the same node, block on
+   * its OFD lock instead of polling.  */
+  if (timeout < 0 && same_node && !h->use_o_excl && !h->by_parent)
+    {
+      int rc = wait_for_ofd_lock (h, fd, pid);
+
+      if (rc == 1)
+        {
+          close (fd);
+          my_set_errno (ECANCELED);
+          return -1;
+        }
+      if (!rc)
+        {
+          close (fd);
+          goto again;
+        }
+    }
+#endif /*DOTLOCK_USE_OFD*/
+
   close (fd);
   if (lastpid == -1)
     lastpid = pid;
@@ -1620,6 +1736,7 @@ dotlock_release_unix (dotlock_t h)
       my_set_errno (saveerrno);
       return -1;
     }
+  release_ofd_lock (h);
   /* Fixme: As an extra check we could check whether the link count is
      now really at 1. */
   return 0;
@@ -177,6 +177,34 @@ get_max_fds (void)
 }
 
 
+#ifdef HAVE_CLOSE_RANGE
+/* Helper for close_all_fds which uses the close_range system call to
+   close the descriptors between the entries of EXCEPT with just a few
+   calls.  Returns -1 if close_range is not supported by the kernel;
+   the caller then needs to fall back to the close loop.  */
+static int
+close_fds_by_range (int first, const int *except)
+{
+  unsigned int fd = first;
+  int i;
+
+  if (except)
+    {
+      for (i=0; except[i] != -1; i++)
+        {
+          if (except[i] < first || (unsigned int)except[i] < fd)
+            continue;
+          if ((unsigned int)except[i] > fd
+              && close_range (fd, except[i] - 1, 0))
+            return -1;
+          fd = except[i] + 1;
+        }
+    }
+  return close_range (fd, ~0U, 0)? -1 : 0;
+}
+#endif /*HAVE_CLOSE_RANGE*/
+
+
 /* Close all file descriptors starting with descriptor FIRST.  If
    EXCEPT is not NULL, it is expected to be a list of file descriptors
    which shall not be closed.  This list shall be sorted in ascending
@@ -184,9 +212,21 @@ get_max_fds (void)
 void
 close_all_fds (int first, const int *except)
 {
-  int max_fd = get_max_fds ();
+  int max_fd;
   int fd, i, except_start;
 
+#ifdef HAVE_CLOSE_RANGE
+  /* This is independent of the number of allowed descriptors and
+     does not need to scan /proc.  */
+  if (!close_fds_by_range (first, except))
+    {
+      gpg_err_set_errno (0);
+      return;
+    }
+#endif /*HAVE_CLOSE_RANGE*/
+
+  max_fd = get_max_fds ();
+
   if (except)
     {
       except_start = 0;
@@ -35,6 +35,15 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <assert.h>
+#ifdef HAVE_SPLICE
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <unistd.h>
+# include <fcntl.h>
+# ifdef SPLICE_F_NONBLOCK
+#  define USE_SPLICE 1
+# endif
+#endif
 #include <gpg-error.h>
 
 #include <assuan.h>
@@ -196,21 +205,45 @@ read_and_log_stderr (read_and_log_buffer_t *state, es_poll_t *fderr)
 
 
 
+/* The initial and the maximum size of a copy buffer.  The buffer
+ * is doubled each time a read fills it completely.  */
+#define COPY_BUFFER_MIN_SIZE  (16 * 1024)
+#define COPY_BUFFER_MAX_SIZE  (256 * 1024)
+
+/* The maximum number of bytes moved by one splice call.  */
+#define COPY_SPLICE_SIZE      (256 * 1024)
+
 /* A buffer to copy from one stream to another.  */
 struct copy_buffer
 {
-  char buffer[4096];
+  char *buffer;
+  size_t size;          /* Allocated size of BUFFER.  */
   char *writep;
   size_t nread;
+#ifdef USE_SPLICE
+  int splice_in;        /* If not -1 splice from this fd ...  */
+  int splice_out;       /* ... to this one.  */
+  estream_t resync_in;  /* Regular file streams whose position needs */
+  estream_t resync_out; /* to be updated after splicing.  */
+  int splice_eof;       /* EOF seen on SPLICE_IN.  */
+#endif
 };
 
 
-/* Initialize a copy buffer.  */
+/* Initialize a copy buffer.  The buffer is allocated on first
+ * use.  */
 static void
 copy_buffer_init (struct copy_buffer *c)
 {
-  c->writep = c->buffer;
+  c->buffer = NULL;
+  c->size = 0;
+  c->writep = NULL;
   c->nread = 0;
+#ifdef USE_SPLICE
+  c->splice_in = c->splice_out = -1;
+  c->resync_in = c->resync_out = NULL;
+  c->splice_eof = 0;
+#endif
 }
 
 
@@ -220,23 +253,166 @@ copy_buffer_shred (struct copy_buffer *c)
 {
   if (c == NULL)
     return;
-  wipememory (c->buffer, sizeof c->buffer);
+  if (c->buffer)
+    wipememory (c->buffer, c->size);
+  xfree (c->buffer);
+  c->buffer = NULL;
+  c->size = 0;
   c->writep = NULL;
   c->nread = ~0U;
 }
 
 
+#ifdef USE_SPLICE
+/* Check whether the data from SOURCE to SINK can be moved with splice
+ * and if so prepare C for it.  This requires that one of the streams
+ * is a pipe and the other a pipe or a regular file.  SOURCE_IS_CHILD
+ * is true if SOURCE is connected to the child process and thus has
+ * not yet been read.  For a stream provided by the caller we need to
+ * make sure that splicing does not bypass buffered data.  */
+static void
+copy_buffer_setup_splice (struct copy_buffer *c, estream_t source,
+                          estream_t sink, int source_is_child)
+{
+  struct stat stin, stout;
+  int fdin, fdout, flags;
+
+  if (!source || !sink)
+    return;
+  fdin = es_fileno (source);
+  fdout = es_fileno (sink);
+  if (fdin == -1 || fdout == -1
+      || fstat (fdin, &stin) || fstat (fdout, &stout))
+    return;
+  if (!(S_ISFIFO (stin.st_mode) || S_ISREG (stin.st_mode))
+      || !(S_ISFIFO (stout.st_mode) || S_ISREG (stout.st_mode))
+      || (!S_ISFIFO (stin.st_mode) && !S_ISFIFO (stout.st_mode)))
+    return;
+
+  if (!source_is_child)
+    {
+      /* We can't tell whether a pipe stream holds read ahead data;
+       * for a regular file this is the case if the position of the
+       * stream differs from the file position.  */
+      if (!S_ISREG (stin.st_mode)
+          || es_ftello (source) != lseek (fdin, 0, SEEK_CUR))
+        return;
+      c->resync_in = source;
+    }
+  else
+    {
+      /* Write out what the caller has buffered; splice does not
+       * support files opened for appending.  */
+      if (es_fflush (sink))
+        return;
+      flags = fcntl (fdout, F_GETFL);
+      if (flags == -1 || (flags & O_APPEND))
+        return;
+      if (S_ISREG (stout.st_mode))
+        c->resync_out = sink;
+    }
+
+  c->splice_in = fdin;
+  c->splice_out = fdout;
+}
+
+
+/* Tell the regular file streams of C that splice moved their file
+ * position.  */
+static void
+copy_buffer_resync (struct copy_buffer *c)
+{
+  if (c->resync_in)
+    es_fseeko (c->resync_in, lseek (c->splice_in, 0, SEEK_CUR), SEEK_SET);
+  if (c->resync_out)
+    es_fseeko (c->resync_out, lseek (c->splice_out, 0, SEEK_CUR), SEEK_SET);
+  c->resync_in = c->resync_out = NULL;
+}
+
+
+/* Move data from the splice source to the splice sink of C.  If
+ * splice is not supported for these fds the copy buffer is used from
+ * now on.  */
+static gpg_error_t
+copy_buffer_do_splice (struct copy_buffer *c)
+{
+  ssize_t n;
+
+  n = splice (c->splice_in, NULL, c->splice_out, NULL, COPY_SPLICE_SIZE,
+              SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (n < 0)
+    {
+      if (errno == EAGAIN || errno == EINTR)
+        return 0;	/* We will just retry next time.  */
+      if (errno == EINVAL || errno == ENOSYS)
+        {
+          /* Not supported for these fds.  */
+          copy_buffer_resync (c);
+          c->splice_in = c->splice_out = -1;
+          return 0;
+        }
+      return my_error_from_syserror ();
+    }
+
+  if (!n)
+    {
+      c->splice_eof = 1;
+      copy_buffer_resync (c);
+    }
+  return 0;
+}
+#endif /*USE_SPLICE*/
+
+
+/* Return true if all data has been read from SOURCE.  */
+static int
+copy_buffer_eof (struct copy_buffer *c, estream_t source)
+{
+#ifdef USE_SPLICE
+  if (c->splice_in != -1)
+    return c->splice_eof;
+#endif
+  return es_feof (source);
+}
+
+
 /* Copy data from SOURCE to SINK using copy buffer C.  */
 static gpg_error_t
 copy_buffer_do_copy (struct copy_buffer *c, estream_t source, estream_t sink)
 {
   gpg_error_t err;
   size_t nwritten = 0;
+  char *p;
+
+#ifdef USE_SPLICE
+  if (c->splice_in != -1)
+    return copy_buffer_do_splice (c);
+#endif
 
   if (c->nread == 0)
     {
+      /* Grow the buffer if the last read filled it.  */
+      if (!c->buffer || (c->writep == c->buffer + c->size
+                         && c->size < COPY_BUFFER_MAX_SIZE))
+        {
+          p = xtrymalloc (c->size? 2 * c->size : COPY_BUFFER_MIN_SIZE);
+          if (!p)
+            {
+              if (!c->buffer)
+                return my_error_from_syserror ();
+            }
+          else
+            {
+              if (c->buffer)
+                wipememory (c->buffer, c->size);
+              xfree (c->buffer);
+              c->buffer = p;
+              c->size = c->size? 2 * c->size : COPY_BUFFER_MIN_SIZE;
+            }
+        }
+
       c->writep = c->buffer;
-      if (es_read (source, c->buffer, sizeof c->buffer, &c->nread))
+      if (es_read (source, c->buffer, c->size, &c->nread))
         {
           err = my_error_from_syserror ();
           if (gpg_err_code (err) == GPG_ERR_EAGAIN)
@@ -245,7 +421,7 @@ copy_buffer_do_copy (struct copy_buffer *c, estream_t source, estream_t sink)
           return err;
         }
 
-      log_assert (c->nread <= sizeof c->buffer);
+      log_assert (c->nread <= c->size);
     }
 
   if (c->nread == 0)
@@ -260,7 +436,7 @@ copy_buffer_do_copy (struct copy_buffer *c, estream_t source, estream_t sink)
   log_assert (nwritten <= c->nread);
   c->writep += nwritten;
   c->nread -= nwritten;
-  log_assert (c->writep - c->buffer <= sizeof c->buffer);
+  log_assert (c->writep - c->buffer <= c->size);
 
   if (err)
     {
@@ -284,16 +460,19 @@ copy_buffer_flush (struct copy_buffer *c, estream_t sink)
   gpg_error_t err = 0;
   size_t nwritten = 0;
 
-  if (es_write (sink, c->writep, c->nread, &nwritten))
-    err = my_error_from_syserror ();
+  if (c->nread)
+    {
+      if (es_write (sink, c->writep, c->nread, &nwritten))
+        err = my_error_from_syserror ();
 
-  log_assert (nwritten <= c->nread);
-  c->writep += nwritten;
-  c->nread -= nwritten;
-  log_assert (c->writep - c->buffer <= sizeof c->buffer);
+      log_assert (nwritten <= c->nread);
+      c->writep += nwritten;
+      c->nread -= nwritten;
+      log_assert (c->writep - c->buffer <= c->size);
 
-  if (err)
-    return err;
+      if (err)
+        return err;
+    }
 
   if (es_fflush (sink))
     err = my_error_from_syserror ();
@@ -467,6 +646,13 @@ gnupg_exec_tool_stream (const char *pgmname, const char *argv[],
   if (!inextra)
     fds[3].ignore = 1;
 
+#ifdef USE_SPLICE
+  /* Bypass the copy buffers if the kernel can move the data.  */
+  copy_buffer_setup_splice (cpbuf_in, input, infp, 0);
+  copy_buffer_setup_splice (cpbuf_extra, inextra, extrafp, 0);
+  copy_buffer_setup_splice (cpbuf_out, outfp, output, 1);
+#endif
+
   /* Now read as long as we have something to poll.  We continue
      reading even after EOF or error on stdout so that we get the
      other error messages or remaining output.  */
@@ -502,7 +688,7 @@ gnupg_exec_tool_stream (const char *pgmname, const char *argv[],
               goto leave;
             }
 
-          if (es_feof (input))
+          if (copy_buffer_eof (cpbuf_in, input))
             {
               err = copy_buffer_flush (cpbuf_in, fds[0].stream);
               if (gpg_err_code (err) == GPG_ERR_EAGAIN)
@@ -530,7 +716,7 @@ gnupg_exec_tool_stream (const char *pgmname, const char *argv[],
               goto leave;
             }
 
-          if (es_feof (inextra))
+          if (copy_buffer_eof (cpbuf_extra, inextra))
             {
               err = copy_buffer_flush (cpbuf_extra, fds[3].stream);
               if (gpg_err_code (err) == GPG_ERR_EAGAIN)
@@ -557,7 +743,7 @@ gnupg_exec_tool_stream (const char *pgmname, const char *argv[],
               goto leave;
             }
 
-          if (es_feof (fds[1].stream))
+          if (copy_buffer_eof (cpbuf_out, fds[1].stream))
             {
               err = copy_buffer_flush (cpbuf_out, output);
               if (err)
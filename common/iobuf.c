@@ -36,10 +36,21 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+# define USE_IOBUF_MMAP 1
+#endif
+#if defined(HAVE_LINUX_IO_URING_H) && !defined(HAVE_W32_SYSTEM)
+# define USE_IOBUF_URING 1
+#endif
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
 #  include <winsock2.h>
@@ -56,6 +67,7 @@
 #include "util.h"
 #include "sysutils.h"
 #include "iobuf.h"
+#include "uring.h"
 
 /*-- Begin configurable part.  --*/
 
@@ -70,12 +82,56 @@
    instead of the internal buffers. */
 #define IOBUF_ZEROCOPY_THRESHOLD_SIZE 1024
 
+/* Limits for the adaptive buffer sizing.  Input buffers are not made
+   smaller than IOBUF_MIN_BUFFER_SIZE and are enlarged up to
+   IOBUF_MAX_BUFFER_SIZE after IOBUF_GROW_AFTER_NFULL consecutive
+   reads which completely filled the buffer.  */
+#define IOBUF_MIN_BUFFER_SIZE  (4*1024)
+#define IOBUF_MAX_BUFFER_SIZE  (1024*1024)
+#define IOBUF_GROW_AFTER_NFULL 4
+
+/* The buffer of a pipeline writing partial body length chunks is
+   enlarged up to this size in the same way.  Each flush of this
+   buffer yields one chunk; thus a larger buffer means fewer headers
+   and filter calls for large streams.  */
+#define IOBUF_MAX_CHUNK_BUFFER_SIZE (8*1024*1024)
+
+/* The largest partial body length allowed by RFC 4880 is 2^30.  */
+#define OP_MAX_PARTIAL_CHUNK_2POW 30
+
+/* Files opened by iobuf_open are only mapped into memory if they are
+   at least this large.  The mapping is done in windows of
+   IOBUF_MMAP_WINDOW_SIZE bytes which must be a multiple of the page
+   size.  */
+#define IOBUF_MMAP_THRESHOLD   (1024*1024)
+#define IOBUF_MMAP_WINDOW_SIZE (16*1024*1024)
+
+/* In io_uring mode up to IOBUF_URING_SLOTS reads of
+   IOBUF_URING_READ_SIZE bytes are kept in flight ahead of the reader
+   of a regular file.  For output files up to that many writes are in
+   flight behind the writer.  */
+#define IOBUF_URING_SLOTS      4
+#define IOBUF_URING_READ_SIZE  (128*1024)
+
 /*-- End configurable part.  --*/
 
 /* The size of the iobuffers.  This can be changed using the
  * iobuf_set_buffer_size function.  */
 static unsigned int iobuf_buffer_size = DEFAULT_IOBUF_BUFFER_SIZE;
 
+/* Whether the buffer sizes are adapted to the input.  This is
+ * disabled if iobuf_set_buffer_size has been used.  */
+static int iobuf_adaptive_size = 1;
+
+/* Whether iobuf_open shall use mmap for regular files.  This can be
+ * changed using the iobuf_set_mmap_mode function.  */
+static int iobuf_use_mmap;
+
+/* Whether regular files opened by iobuf_open and iobuf_create shall
+ * use io_uring if the kernel supports it.  This can be changed using
+ * the iobuf_set_uring_mode function.  */
+static int iobuf_use_uring;
+
 
 #ifdef HAVE_W32_SYSTEM
 # define FD_FOR_STDIN  (GetStdHandle (STD_INPUT_HANDLE))
@@ -86,6 +142,20 @@ static unsigned int iobuf_buffer_size = DEFAULT_IOBUF_BUFFER_SIZE;
 #endif /*!HAVE_W32_SYSTEM*/
 
 
+#ifdef USE_IOBUF_URING
+/* A read or write buffer of the io_uring mode.  */
+struct uring_slot_s
+{
+  byte *buf;           /* The buffer or NULL.  */
+  size_t size;         /* The allocated size of BUF.  */
+  size_t len;          /* The length of the read or write.  */
+  size_t used;         /* Number of bytes already consumed.  */
+  off_t off;           /* The file offset of the read or write.  */
+  int res;             /* The result of a completed read.  */
+  int busy;            /* The operation is in flight.  */
+};
+#endif /*USE_IOBUF_URING*/
+
 /* The context used by the file filter.  */
 typedef struct
 {
@@ -98,6 +168,23 @@ typedef struct
   char peeked[32];     /* Read ahead buffer.  */
   byte npeeked;        /* Number of bytes valid in peeked.  */
   byte upeeked;        /* Number of bytes used from peeked.  */
+#ifdef USE_IOBUF_MMAP
+  int use_mmap;        /* Read via a mapping instead of read(2).  */
+  off_t mm_fpos;       /* The current read position in mmap mode.  */
+  byte *mm_base;       /* The current mapping window or NULL.  */
+  size_t mm_len;       /* The length of that window.  */
+  off_t mm_off;        /* The file offset of that window.  */
+#endif
+#ifdef USE_IOBUF_URING
+  int use_uring;       /* Try to use io_uring on first use.  */
+  int ur_output;       /* The ring is used for writing.  */
+  gnupg_uring_t ur;    /* The ring or NULL if not in use.  */
+  off_t ur_fpos;       /* File offset of the next read or write.  */
+  off_t ur_rpos;       /* The read position of the consumer.  */
+  unsigned int ur_head;/* The next slot to consume or to write.  */
+  gpg_error_t ur_err;  /* A deferred write error.  */
+  struct uring_slot_s ur_slot[IOBUF_URING_SLOTS];
+#endif
   char fname[1];       /* Name of the file.  */
 } file_filter_ctx_t;
 
@@ -127,6 +214,39 @@ static close_cache_t close_cache;
 
 int iobuf_debug_mode;
 
+#define MAX_IOBUF_DESC 32
+
+/* If set, the filter calls done by underflow and filter_flush are
+ * accounted per filter; see iobuf_dump_stats.  */
+int iobuf_profile_mode;
+
+/* The statistics for one filter function.  */
+struct filter_stats_s
+{
+  struct filter_stats_s *next;
+  int (*filter) (void *opaque, int control,
+                 iobuf_t chain, byte *buf, size_t *len);
+  unsigned long calls;
+  unsigned long long bytes_in;
+  unsigned long long bytes_out;
+  unsigned long long total_usec;  /* Including the called filters.  */
+  unsigned long long self_usec;   /* Excluding the called filters.  */
+  char desc[MAX_IOBUF_DESC];
+};
+static struct filter_stats_s *filter_stats;
+
+/* A profiled filter call which is still active.  Filters call the
+ * next filter in the pipeline from within their own filter function
+ * and thus these frames form a stack.  */
+struct filter_frame_s
+{
+  struct filter_frame_s *outer;
+  iobuf_t chain;                 /* The next filter of the call.  */
+  unsigned long long inner_usec; /* Time spent in nested calls.  */
+  unsigned long long inner_bytes;/* Bytes passed by calls of CHAIN.  */
+};
+static struct filter_frame_s *filter_frame;
+
 
 #ifdef HAVE_W32_SYSTEM
 typedef struct
@@ -167,6 +287,8 @@ block_filter_ctx_t;
 static int underflow (iobuf_t a, int clear_pending_eof);
 static int underflow_target (iobuf_t a, int clear_pending_eof, size_t target);
 static iobuf_t do_iobuf_fdopen (gnupg_fd_t fp, const char *mode, int keep_open);
+static int do_iobuf_write (iobuf_t a, const void *buffer, unsigned int buflen,
+                           int lendable);
 
 
 /* Sends any pending data to the filter's FILTER function.  Note: this
@@ -455,6 +577,387 @@ fd_cache_open (const char *fname, const char *mode)
 }
 
 
+#ifdef USE_IOBUF_MMAP
+/* Release the current mapping window of the file filter A.  */
+static void
+mmap_release (file_filter_ctx_t *a)
+{
+  if (a->mm_base)
+    {
+      munmap (a->mm_base, a->mm_len);
+      a->mm_base = NULL;
+      a->mm_len = 0;
+      a->mm_off = 0;
+    }
+}
+
+
+/* Switch the file filter A from mmap mode back to read(2) mode.  */
+static void
+mmap_fallback (file_filter_ctx_t *a)
+{
+  if (DBG_IOBUF)
+    log_debug ("%s: mmap mode disabled at offset %llu\n",
+               a->fname, (unsigned long long)a->mm_fpos);
+  mmap_release (a);
+  a->use_mmap = 0;
+  if (lseek (a->fp, a->mm_fpos, SEEK_SET) == (off_t)(-1))
+    {
+      a->delayed_rc = gpg_error_from_syserror ();
+      log_error ("%s: can't lseek: %s\n", a->fname,
+                 gpg_strerror (a->delayed_rc));
+    }
+}
+
+
+/* Make sure that the mapping window of A covers the current read
+ * position.  Returns the number of bytes available at that position,
+ * 0 on EOF or -1 if the mmap mode has been disabled and the caller
+ * needs to use read(2).  The size of the file is checked each time a
+ * new window is mapped, so that a file which has been truncated meanwhile
+ * makes us fall back to read(2) instead of running into a SIGBUS.  */
+static ssize_t
+mmap_window (file_filter_ctx_t *a)
+{
+  struct stat st;
+  off_t off;
+  size_t len;
+  void *p;
+
+  if (a->mm_base
+      && a->mm_fpos >= a->mm_off && a->mm_fpos < a->mm_off + a->mm_len)
+    return a->mm_off + a->mm_len - a->mm_fpos;
+
+  mmap_release (a);
+  if (fstat (a->fp, &st) || !S_ISREG (st.st_mode) || st.st_size < a->mm_fpos)
+    {
+      mmap_fallback (a);
+      return -1;
+    }
+  if (st.st_size == a->mm_fpos)
+    return 0;  /* EOF */
+
+  off = a->mm_fpos - (a->mm_fpos % IOBUF_MMAP_WINDOW_SIZE);
+  if (st.st_size - off > IOBUF_MMAP_WINDOW_SIZE)
+    len = IOBUF_MMAP_WINDOW_SIZE;
+  else
+    len = st.st_size - off;
+
+  p = mmap (NULL, len, PROT_READ, MAP_SHARED, a->fp, off);
+  if (p == MAP_FAILED)
+    {
+      if (DBG_IOBUF)
+        log_debug ("%s: mmap failed: %s\n", a->fname, strerror (errno));
+      mmap_fallback (a);
+      return -1;
+    }
+#ifdef MADV_SEQUENTIAL
+  madvise (p, len, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+  madvise (p, len, MADV_WILLNEED);
+#endif
+  a->mm_base = p;
+  a->mm_len = len;
+  a->mm_off = off;
+
+  return a->mm_off + a->mm_len - a->mm_fpos;
+}
+
+
+/* Enable the mmap mode for the file filter A if the file is a
+ * regular file of a suitable size.  */
+static void
+mmap_enable (file_filter_ctx_t *a)
+{
+  struct stat st;
+
+  if (fstat (a->fp, &st) || !S_ISREG (st.st_mode)
+      || st.st_size < IOBUF_MMAP_THRESHOLD)
+    return;
+
+  a->use_mmap = 1;
+  a->mm_fpos = lseek (a->fp, 0, SEEK_CUR);
+  if (a->mm_fpos == (off_t)(-1))
+    {
+      a->use_mmap = 0;
+      return;
+    }
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_SEQUENTIAL)
+  posix_fadvise (a->fp, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  if (DBG_IOBUF)
+    log_debug ("%s: using mmap mode\n", a->fname);
+}
+#endif /*USE_IOBUF_MMAP*/
+
+
+#ifdef USE_IOBUF_URING
+/* Write the remaining bytes of the slot S of A after a short write
+ * using plain pwrite calls.  */
+static void
+uring_finish_write (file_filter_ctx_t *a, struct uring_slot_s *s)
+{
+  ssize_t n;
+
+  while (s->used < s->len && !a->ur_err)
+    {
+      do
+        n = pwrite (a->fp, s->buf + s->used, s->len - s->used,
+                    s->off + s->used);
+      while (n == -1 && errno == EINTR);
+      if (n > 0)
+        s->used += n;
+      else
+        a->ur_err = n? gpg_error_from_syserror () : gpg_error (GPG_ERR_EIO);
+    }
+}
+
+
+/* Wait for the next completion of A's ring and update its slot.
+ * Returns an error if the ring can't be used anymore.  */
+static gpg_error_t
+uring_reap (file_filter_ctx_t *a)
+{
+  struct uring_slot_s *s;
+  gpg_error_t err;
+  uint64_t tag;
+  int res;
+
+  err = gnupg_uring_wait (a->ur, &tag, &res);
+  if (err)
+    return err;
+  s = a->ur_slot + (tag % IOBUF_URING_SLOTS);
+  s->busy = 0;
+  if (!a->ur_output)
+    s->res = res;
+  else if (res < 0)
+    {
+      if (!a->ur_err)
+        a->ur_err = gpg_error_from_errno (-res);
+    }
+  else
+    {
+      s->used = res;
+      uring_finish_write (a, s);
+    }
+  return 0;
+}
+
+
+/* Wait for all operations in flight of A.  */
+static void
+uring_drain (file_filter_ctx_t *a)
+{
+  int i;
+
+  while (gnupg_uring_pending (a->ur))
+    if (uring_reap (a))
+      log_fatal ("%s: waiting for io_uring failed\n", a->fname);
+  for (i=0; i < IOBUF_URING_SLOTS; i++)
+    a->ur_slot[i].len = a->ur_slot[i].used = 0;
+  a->ur_head = 0;
+}
+
+
+/* Start the io_uring mode for A.  Returns false if that is not
+ * possible; the caller shall then use the portable code.  */
+static int
+uring_start (file_filter_ctx_t *a, int output)
+{
+  struct stat st;
+  int flags;
+
+  a->use_uring = 0;
+  if (fstat (a->fp, &st) || !S_ISREG (st.st_mode))
+    return 0;
+  /* Writes are done at explicit offsets and may complete out of
+   * order; thus they do not work with the append mode.  */
+  if (output
+      && ((flags = fcntl (a->fp, F_GETFL)) == -1 || (flags & O_APPEND)))
+    return 0;
+  a->ur_fpos = lseek (a->fp, 0, SEEK_CUR);
+  if (a->ur_fpos == (off_t)(-1))
+    return 0;
+  a->ur = gnupg_uring_new (IOBUF_URING_SLOTS);
+  if (!a->ur)
+    return 0;
+
+  a->use_uring = 1;
+  a->ur_output = output;
+  a->ur_rpos = a->ur_fpos;
+  a->ur_head = 0;
+  if (DBG_IOBUF)
+    log_debug ("%s: using io_uring mode\n", a->fname);
+  return 1;
+}
+
+
+/* Stop the io_uring mode for A and set the file position to the
+ * position of the reader or writer.  The mode is restarted with the
+ * next read or write.  */
+static void
+uring_stop (file_filter_ctx_t *a)
+{
+  int i;
+
+  if (!a->ur)
+    return;
+
+  uring_drain (a);
+  gnupg_uring_release (a->ur);
+  a->ur = NULL;
+  for (i=0; i < IOBUF_URING_SLOTS; i++)
+    {
+      xfree (a->ur_slot[i].buf);
+      a->ur_slot[i].buf = NULL;
+      a->ur_slot[i].size = 0;
+    }
+  if (lseek (a->fp, a->ur_output? a->ur_fpos : a->ur_rpos, SEEK_SET)
+      == (off_t)(-1) && !a->ur_err)
+    a->ur_err = gpg_error_from_syserror ();
+  a->use_uring = 1;
+}
+
+
+/* Read up to SIZE bytes into BUF using the io_uring mode of A.  All
+ * free slots are used to read ahead.  Returns -1 at EOF.  On error
+ * the io_uring mode is stopped.  */
+static int
+uring_read (file_filter_ctx_t *a, byte *buf, size_t size, size_t *r_nbytes)
+{
+  struct uring_slot_s *s;
+  unsigned int i, idx;
+  gpg_error_t err;
+  size_t n;
+
+  *r_nbytes = 0;
+
+  /* The free slots are always those behind the newest read; thus we
+   * start the reads in ring order.  */
+  for (i=0; i < IOBUF_URING_SLOTS; i++)
+    {
+      idx = (a->ur_head + i) % IOBUF_URING_SLOTS;
+      s = a->ur_slot + idx;
+      if (s->busy || s->len)
+        continue;
+      if (!s->buf)
+        {
+          s->buf = xtrymalloc (IOBUF_URING_READ_SIZE);
+          if (!s->buf)
+            break;
+          s->size = IOBUF_URING_READ_SIZE;
+        }
+      if (gnupg_uring_read (a->ur, a->fp, s->buf, s->size, a->ur_fpos, idx))
+        break;
+      s->off = a->ur_fpos;
+      s->len = s->size;
+      s->used = 0;
+      s->busy = 1;
+      a->ur_fpos += s->size;
+    }
+  gnupg_uring_submit (a->ur);
+
+  s = a->ur_slot + a->ur_head;
+  while (s->busy)
+    if ((err = uring_reap (a)))
+      {
+        log_error ("%s: io_uring error: %s\n", a->fname, gpg_strerror (err));
+        uring_stop (a);
+        a->use_uring = 0;
+        return err;
+      }
+  if (!s->len)  /* Out of core or the ring is full.  */
+    {
+      uring_stop (a);
+      a->use_uring = 0;
+      return gpg_error_from_syserror ();
+    }
+
+  if (s->res < 0)
+    {
+      err = gpg_error_from_errno (-s->res);
+      log_error ("%s: read error: %s\n", a->fname, gpg_strerror (err));
+      uring_stop (a);
+      return err;
+    }
+  if (!s->res)
+    return -1;
+
+  n = s->res - s->used;
+  if (n > size)
+    n = size;
+  memcpy (buf, s->buf + s->used, n);
+  s->used += n;
+  a->ur_rpos += n;
+  *r_nbytes = n;
+  if (s->used == s->res)
+    {
+      if (s->res < s->len)
+        {
+          /* A short read; most likely the end of the file.  The
+           * reads ahead are restarted at its end.  */
+          uring_drain (a);
+          a->ur_fpos = a->ur_rpos;
+        }
+      else
+        {
+          s->len = 0;
+          a->ur_head = (a->ur_head + 1) % IOBUF_URING_SLOTS;
+        }
+    }
+  return 0;
+}
+
+
+/* Write SIZE bytes from BUF using the io_uring mode of A.  The data
+ * is copied so that the caller can reuse BUF.  Errors of the write
+ * are reported by a later call or by uring_stop.  */
+static int
+uring_write (file_filter_ctx_t *a, const byte *buf, size_t size)
+{
+  struct uring_slot_s *s;
+  gpg_error_t err;
+
+  s = a->ur_slot + a->ur_head;
+  while (s->busy)
+    if ((err = uring_reap (a)))
+      {
+        log_error ("%s: io_uring error: %s\n", a->fname, gpg_strerror (err));
+        return err;
+      }
+  if (a->ur_err)
+    return a->ur_err;
+
+  if (s->size < size)
+    {
+      xfree (s->buf);
+      s->buf = xtrymalloc (size);
+      if (!s->buf)
+        {
+          s->size = 0;
+          return gpg_error_from_syserror ();
+        }
+      s->size = size;
+    }
+  memcpy (s->buf, buf, size);
+  err = gnupg_uring_write (a->ur, a->fp, s->buf, size, a->ur_fpos,
+                           a->ur_head);
+  if (!err)
+    err = gnupg_uring_submit (a->ur);
+  if (err)
+    return err;
+  s->off = a->ur_fpos;
+  s->len = size;
+  s->used = 0;
+  s->busy = 1;
+  a->ur_fpos += size;
+  a->ur_head = (a->ur_head + 1) % IOBUF_URING_SLOTS;
+  return 0;
+}
+#endif /*USE_IOBUF_URING*/
+
+
 static int
 file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 	     size_t * ret_len)
@@ -464,6 +967,9 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
   size_t size = *ret_len;
   size_t nbytes = 0;
   int rc = 0;
+#ifdef USE_IOBUF_MMAP
+  ssize_t avail;
+#endif
 
   (void)chain; /* Not used.  */
 
@@ -492,6 +998,38 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
             a->eof_seen = -1;
 	  *ret_len = 0;
         }
+#ifdef USE_IOBUF_MMAP
+      else if (a->use_mmap && (avail = mmap_window (a)) >= 0)
+        {
+          if (!avail && a->delayed_rc)
+            {
+              rc = a->delayed_rc;
+              a->delayed_rc = 0;
+              a->eof_seen = 1;
+            }
+          else if (!avail)
+            {
+              a->eof_seen = 1;
+              rc = -1;
+            }
+          else
+            {
+              nbytes = (size_t)avail < size? (size_t)avail : size;
+              memcpy (buf, a->mm_base + (a->mm_fpos - a->mm_off), nbytes);
+              a->mm_fpos += nbytes;
+            }
+          *ret_len = nbytes;
+        }
+#endif /*USE_IOBUF_MMAP*/
+#ifdef USE_IOBUF_URING
+      else if (a->ur || (a->use_uring && uring_start (a, 0)))
+        {
+          rc = uring_read (a, buf, size, &nbytes);
+          if (rc == -1)
+            a->eof_seen = 1;
+          *ret_len = nbytes;
+        }
+#endif /*USE_IOBUF_URING*/
       else
 	{
 #ifdef HAVE_W32_SYSTEM
@@ -562,6 +1100,17 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
     }
   else if (control == IOBUFCTRL_FLUSH)
     {
+#ifdef USE_IOBUF_URING
+      if (size && (a->ur || (a->use_uring && uring_start (a, 1))))
+        {
+          rc = uring_write (a, buf, size);
+          if (rc)
+            log_error ("%s: write error: %s\n", a->fname, gpg_strerror (rc));
+          else
+            nbytes = size;
+        }
+      else
+#endif /*USE_IOBUF_URING*/
       if (size)
 	{
 #ifdef HAVE_W32_SYSTEM
@@ -621,7 +1170,32 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
       a->no_cache = 0;
       a->npeeked = 0;
       a->upeeked = 0;
+#ifdef USE_IOBUF_MMAP
+      a->use_mmap = 0;
+      a->mm_fpos = 0;
+      a->mm_base = NULL;
+      a->mm_len = 0;
+      a->mm_off = 0;
+#endif
+#ifdef USE_IOBUF_URING
+      a->use_uring = 0;
+      a->ur_output = 0;
+      a->ur = NULL;
+      a->ur_err = 0;
+      memset (a->ur_slot, 0, sizeof a->ur_slot);
+#endif
     }
+#ifdef USE_IOBUF_MMAP
+  else if (control == IOBUFCTRL_PEEK && a->use_mmap
+           && (avail = mmap_window (a)) >= 0)
+    {
+      /* Peek into the mapping without moving the read position.  */
+      size = (size_t)avail < size? (size_t)avail : size;
+      if (size)
+        memcpy (buf, a->mm_base + (a->mm_fpos - a->mm_off), size);
+      *ret_len = size;
+    }
+#endif /*USE_IOBUF_MMAP*/
   else if (control == IOBUFCTRL_PEEK)
     {
       /* Peek on the input.  */
@@ -694,6 +1268,21 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
     }
   else if (control == IOBUFCTRL_FREE)
     {
+#ifdef USE_IOBUF_URING
+      if (a->ur)
+        {
+          uring_stop (a);
+          if (a->ur_err)
+            {
+              rc = a->ur_err;
+              log_error ("%s: %s error: %s\n", a->fname,
+                         a->ur_output? "write":"read", gpg_strerror (rc));
+            }
+        }
+#endif
+#ifdef USE_IOBUF_MMAP
+      mmap_release (a);
+#endif
       if (f != FD_FOR_STDIN && f != FD_FOR_STDOUT)
 	{
 	  if (DBG_IOBUF)
@@ -1060,8 +1649,14 @@ block_filter (void *opaque, int control, iobuf_t chain, byte * buffer,
 	}
       *ret_len = n;
     }
-  else if (control == IOBUFCTRL_FLUSH)
+  else if (control == IOBUFCTRL_LEND && !buf)
+    {
+      *ret_len = 1;  /* We support lent buffers.  */
+    }
+  else if (control == IOBUFCTRL_FLUSH || control == IOBUFCTRL_LEND)
     {
+      int lent = (control == IOBUFCTRL_LEND);
+
       if (a->partial)
 	{			/* the complicated openpgp scheme */
 	  size_t blen, n, nbytes = size + a->buflen;
@@ -1084,13 +1679,14 @@ block_filter (void *opaque, int control, iobuf_t chain, byte * buffer,
 		  /* find the best matching block length - this is limited
 		   * by the size of the internal buffering */
 		  for (blen = OP_MIN_PARTIAL_CHUNK * 2,
-		       c = OP_MIN_PARTIAL_CHUNK_2POW + 1; blen <= nbytes;
+		       c = OP_MIN_PARTIAL_CHUNK_2POW + 1;
+		       blen <= nbytes && c <= OP_MAX_PARTIAL_CHUNK_2POW;
 		       blen *= 2, c++)
 		    ;
 		  blen /= 2;
 		  c--;
 		  /* write the partial length header */
-		  log_assert (c <= 0x1f);	/*;-) */
+		  log_assert (c <= OP_MAX_PARTIAL_CHUNK_2POW);
 		  c |= 0xe0;
 		  iobuf_put (chain, c);
 		  if ((n = a->buflen))
@@ -1103,7 +1699,7 @@ block_filter (void *opaque, int control, iobuf_t chain, byte * buffer,
 		    }
 		  if ((n = nbytes) > blen)
 		    n = blen;
-		  if (n && iobuf_write (chain, p, n))
+		  if (n && do_iobuf_write (chain, p, n, lent))
 		    rc = gpg_error_from_syserror ();
 		  p += n;
 		  nbytes -= n;
@@ -1222,13 +1818,71 @@ iobuf_set_buffer_size (unsigned int kilobyte)
         kilobyte = 16*1024;
 
       iobuf_buffer_size = kilobyte * 1024;
+      iobuf_adaptive_size = 0;
       used = 1;
     }
   return iobuf_buffer_size / 1024;
 }
 
 
-#define MAX_IOBUF_DESC 32
+/* Return a buffer size suitable for an input filter reading from a
+ * source of LENGTH bytes.  A LENGTH of 0 indicates an unknown
+ * length.  */
+static size_t
+adaptive_buffer_size (uint64_t length)
+{
+  if (!iobuf_adaptive_size || !length || length >= iobuf_buffer_size)
+    return iobuf_buffer_size;
+  if (length < IOBUF_MIN_BUFFER_SIZE)
+    return IOBUF_MIN_BUFFER_SIZE;
+  /* Round up to the next KiB.  */
+  return (length + 1023) & ~(size_t)1023;
+}
+
+
+/* Return the size of the buffer for a block_filter with context BFX
+ * which is pushed onto an input pipeline with buffers of SIZE bytes.
+ * The other filters of the pipeline are not known to this module;
+ * they inherit the buffer size of the filter below.  In partial body
+ * length mode the writer has usually used the same length for all
+ * chunks, so the first chunk tells how much data comes with each
+ * underflow.  A buffer smaller than that is enlarged by
+ * underflow_target after repeated full reads.  */
+static size_t
+partial_buffer_size (block_filter_ctx_t *bfx, size_t size)
+{
+  size_t chunklen;
+
+  if (!iobuf_adaptive_size || bfx->partial != 1)
+    return size;
+
+  if (bfx->first_c < 224 || bfx->first_c >= 255)
+    return size;  /* Not a partial length octet.  */
+
+  chunklen = adaptive_buffer_size ((uint64_t)1 << (bfx->first_c & 0x1f));
+  return chunklen < size? chunklen : size;
+}
+
+
+/* Enable or disable the use of mmap for regular input files opened
+ * by iobuf_open.  Has no effect on systems without mmap.  */
+void
+iobuf_set_mmap_mode (int enable)
+{
+  iobuf_use_mmap = !!enable;
+}
+
+
+/* Enable or disable the use of io_uring for regular files opened by
+ * iobuf_open and iobuf_create.  If the system or the kernel does not
+ * support io_uring the files are accessed the usual way.  */
+void
+iobuf_set_uring_mode (int enable)
+{
+  iobuf_use_uring = !!enable;
+}
+
+
 /*
  * Fill the buffer by the description of iobuf A.
  * The buffer size should be MAX_IOBUF_DESC (or larger).
@@ -1269,6 +1923,124 @@ iobuf_print_chain (iobuf_t a)
   return 0;
 }
 
+
+/* Return a monotonic time stamp in microseconds for the profiling.  */
+static unsigned long long
+profile_time (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER count;
+
+  if (!freq.QuadPart && !QueryPerformanceFrequency (&freq))
+    return 0;
+  QueryPerformanceCounter (&count);
+  return (unsigned long long)(count.QuadPart / (freq.QuadPart / 1000000.0));
+#else
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts))
+    return 0;
+  return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+
+/* Call the filter of A like A->FILTER (A->FILTER_OV, CONTROL,
+ * A->CHAIN, BUF, LEN) and account the call in the statistics of the
+ * filter.  This is used instead of a direct call if
+ * iobuf_profile_mode is set.  */
+static int
+profiled_filter_call (iobuf_t a, int control, byte *buf, size_t *len)
+{
+  struct filter_stats_s *st;
+  struct filter_frame_s frame;
+  unsigned long long t0, elapsed, nin, nout;
+  size_t chain_len = 0;
+  size_t requested = *len;
+  int rc;
+
+  for (st = filter_stats; st; st = st->next)
+    if (st->filter == a->filter)
+      break;
+  if (!st)
+    {
+      st = xcalloc (1, sizeof *st);
+      st->filter = a->filter;
+      iobuf_desc (a, (byte *)st->desc);
+      st->next = filter_stats;
+      filter_stats = st;
+    }
+
+  frame.outer = filter_frame;
+  frame.chain = a->chain;
+  frame.inner_usec = 0;
+  frame.inner_bytes = 0;
+  if (a->chain)
+    chain_len = a->chain->d.len;
+  filter_frame = &frame;
+
+  t0 = profile_time ();
+  rc = a->filter (a->filter_ov, control, a->chain, buf, len);
+  elapsed = profile_time () - t0;
+
+  filter_frame = frame.outer;
+
+  /* For an input filter the output is what it returned and the input
+   * what it got from the next filter.  For an output filter the input
+   * is what it was given and the output what it wrote to the next
+   * filter, including data still buffered there.  A filter without a
+   * next filter is a source or sink and we take its input as its
+   * output.  */
+  if (control == IOBUFCTRL_UNDERFLOW)
+    {
+      nout = (rc == 0 || rc == -1)? *len : 0;
+      nin = a->chain? frame.inner_bytes : nout;
+    }
+  else
+    {
+      nin = requested;
+      nout = a->chain? (frame.inner_bytes + a->chain->d.len - chain_len) : nin;
+    }
+
+  st->calls++;
+  st->bytes_in += nin;
+  st->bytes_out += nout;
+  st->total_usec += elapsed;
+  st->self_usec += elapsed - frame.inner_usec;
+
+  if (frame.outer)
+    {
+      frame.outer->inner_usec += elapsed;
+      if (frame.outer->chain == a)
+        frame.outer->inner_bytes += (control == IOBUFCTRL_UNDERFLOW
+                                     ? nout : nin);
+    }
+
+  return rc;
+}
+
+
+/* Call the filter of A for CONTROL with BUF and LEN.  */
+#define call_filter(a,control,buf,len)                          \
+  (iobuf_profile_mode                                           \
+   ? profiled_filter_call ((a), (control), (buf), (len))        \
+   : (a)->filter ((a)->filter_ov, (control), (a)->chain, (buf), (len)))
+
+
+/* Print the statistics collected in iobuf_profile_mode.  */
+void
+iobuf_dump_stats (void)
+{
+  struct filter_stats_s *st;
+
+  for (st = filter_stats; st; st = st->next)
+    log_info ("iobuf: %-20s calls=%lu in=%llu out=%llu"
+              " time=%llums self=%llums\n",
+              st->desc, st->calls, st->bytes_in, st->bytes_out,
+              st->total_usec / 1000, st->self_usec / 1000);
+}
+
 iobuf_t
 iobuf_alloc (int use, size_t bufsize)
 {
@@ -1291,6 +2063,10 @@ iobuf_alloc (int use, size_t bufsize)
   a->e_d.len = 0;
   a->e_d.used = 0;
   a->e_d.preferred = 0;
+  a->e_d.lendable = 0;
+  a->lend_mode = 0;
+  a->d_hwm = 0;
+  a->nfull = 0;
   a->no = ++number;
   a->subno = 0;
   a->real_fname = NULL;
@@ -1460,7 +2236,24 @@ do_open (const char *fname, int special_filenames,
 	return NULL;
     }
 
-  a = iobuf_alloc (use, iobuf_buffer_size);
+  if (use == IOBUF_INPUT && !print_only && iobuf_adaptive_size)
+    {
+      uint64_t length = 0;
+#ifdef HAVE_W32_SYSTEM
+      LARGE_INTEGER exsize;
+
+      if (GetFileSizeEx (fp, &exsize))
+        length = exsize.QuadPart;
+#else
+      struct stat st;
+
+      if (!fstat (fp, &st) && S_ISREG (st.st_mode))
+        length = st.st_size;
+#endif
+      a = iobuf_alloc (use, adaptive_buffer_size (length));
+    }
+  else
+    a = iobuf_alloc (use, iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   fcx->print_only_name = print_only;
@@ -1470,6 +2263,15 @@ do_open (const char *fname, int special_filenames,
   a->filter = file_filter;
   a->filter_ov = fcx;
   file_filter (fcx, IOBUFCTRL_INIT, NULL, NULL, &len);
+#ifdef USE_IOBUF_MMAP
+  if (iobuf_use_mmap && use == IOBUF_INPUT && !print_only)
+    mmap_enable (fcx);
+#endif
+#ifdef USE_IOBUF_URING
+  if (iobuf_use_uring && !print_only
+      && (use == IOBUF_INPUT || *opentype == 'w'))
+    fcx->use_uring = 1;
+#endif
   if (DBG_IOBUF)
     log_debug ("iobuf-%d.%d: open '%s' desc=%s fd=%d\n",
 	       a->no, a->subno, fname, iobuf_desc (a, desc),
@@ -1684,6 +2486,22 @@ iobuf_ioctl (iobuf_t a, iobuf_ioctl_t cmd, int intval, void *ptrval)
             return (int)len;
         }
     }
+  else if (cmd == IOBUF_IOCTL_BUFFER_HWM)
+    {
+      /* Store the high-water mark of the buffers of the entire
+       * pipeline A at the size_t variable PTRVAL.  That is the
+       * largest number of bytes which ever were buffered by one of
+       * the filters.  */
+      size_t hwm = 0;
+
+      if (!ptrval)
+        return -1;
+      for (; a; a = a->chain)
+        if (a->d_hwm > hwm)
+          hwm = a->d_hwm;
+      *(size_t *)ptrval = hwm;
+      return 0;
+    }
 
 
   return -1;
@@ -1794,11 +2612,14 @@ iobuf_push_filter2 (iobuf_t a,
       a->d.size = iobuf_buffer_size;
     }
   else if (a->use == IOBUF_INPUT_TEMP)
-    /* Same idea as above.  */
+    /* Same idea as above.  However, the amount of data is known and
+       thus we do not need a buffer larger than that.  */
     {
       a->use = IOBUF_INPUT;
-      a->d.size = iobuf_buffer_size;
+      a->d.size = adaptive_buffer_size (b->d.len - b->d.start);
     }
+  if (a->use == IOBUF_INPUT && f == block_filter)
+    a->d.size = partial_buffer_size (ov, a->d.size);
 
   /* The new filter (A) gets a new buffer.
 
@@ -1826,6 +2647,9 @@ iobuf_push_filter2 (iobuf_t a,
   a->filter = f;
   a->filter_ov = ov;
   a->filter_ov_owner = rel_ov;
+  a->lend_mode = 0;
+  a->d_hwm = 0;
+  a->nfull = 0;
 
   a->subno = b->subno + 1;
 
@@ -2023,6 +2847,34 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
     /* We have a filter function and the last time we tried to read we
        didn't get an EOF or an error.  Try to fill the buffer.  */
     {
+      size_t requested;
+
+      /* If the last reads all filled the buffer, it is likely that
+         the input is large and we better enlarge the buffer to cut
+         down the number of filter calls.  */
+      if (iobuf_adaptive_size && a->nfull >= IOBUF_GROW_AFTER_NFULL
+          && a->d.size < IOBUF_MAX_BUFFER_SIZE)
+        {
+          size_t newsize = a->d.size * 2;
+          byte *newbuf;
+
+          if (newsize > IOBUF_MAX_BUFFER_SIZE)
+            newsize = IOBUF_MAX_BUFFER_SIZE;
+          if (DBG_IOBUF)
+            log_debug ("iobuf-%d.%d: underflow: growing buffer from %lu to %lu\n",
+                       a->no, a->subno, (ulong)a->d.size, (ulong)newsize);
+          /* The buffer may hold plaintext; thus do not use realloc
+             which may leave a copy in the freed memory.  The buffered
+             data has been moved to the start above.  */
+          newbuf = xmalloc (newsize);
+          memcpy (newbuf, a->d.buf, a->d.len);
+          wipememory (a->d.buf, a->d.size);
+          xfree (a->d.buf);
+          a->d.buf = newbuf;
+          a->d.size = newsize;
+          a->nfull = 0;
+        }
+
       /* Be careful to account for any buffered data.  */
       len = a->d.size - a->d.len;
 
@@ -2053,8 +2905,7 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	      log_debug ("iobuf-%d.%d: underflow: A->FILTER (%lu bytes, to external drain)\n",
 			 a->no, a->subno, (ulong)len);
 
-	    rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
-			    a->e_d.buf, &len);
+	    rc = call_filter (a, IOBUFCTRL_UNDERFLOW, a->e_d.buf, &len);
 	    a->e_d.used = len;
 	    len = 0;
 	  }
@@ -2064,11 +2915,18 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	      log_debug ("iobuf-%d.%d: underflow: A->FILTER (%lu bytes)\n",
 			 a->no, a->subno, (ulong)len);
 
-	    rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
-			    &a->d.buf[a->d.len], &len);
+	    requested = len;
+	    rc = call_filter (a, IOBUFCTRL_UNDERFLOW,
+			      &a->d.buf[a->d.len], &len);
+	    if (!rc && len == requested && a->d.len + len == a->d.size)
+	      a->nfull++;
+	    else
+	      a->nfull = 0;
 	  }
       }
       a->d.len += len;
+      if (a->d.len > a->d_hwm)
+        a->d_hwm = a->d.len;
 
       if (DBG_IOBUF)
 	log_debug ("iobuf-%d.%d: A->FILTER() returned rc=%d (%s), read %lu bytes%s\n",
@@ -2146,6 +3004,26 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 }
 
 
+/* Return true if the filter of A supports IOBUFCTRL_LEND.  The
+   filter is asked only once.  */
+static int
+filter_supports_lend (iobuf_t a)
+{
+  if (!a->lend_mode)
+    {
+      size_t len = 0;
+
+      a->filter (a->filter_ov, IOBUFCTRL_LEND, a->chain, NULL, &len);
+      a->lend_mode = len? 1 : -1;
+      if (DBG_IOBUF)
+        log_debug ("iobuf-%d.%d: filter %s lent buffers\n",
+                   a->no, a->subno,
+                   a->lend_mode > 0? "supports":"does not support");
+    }
+  return a->lend_mode > 0;
+}
+
+
 static int
 filter_flush (iobuf_t a)
 {
@@ -2153,6 +3031,7 @@ filter_flush (iobuf_t a)
   byte *src_buf;
   size_t src_len;
   size_t len;
+  int control;
   int rc;
 
   a->e_d.used = 0;
@@ -2187,8 +3066,21 @@ filter_flush (iobuf_t a)
       external_used = 0;
     }
 
+  /* Our internal buffer is discarded after the flush and thus can
+     always be lent to the filter; an external buffer only if the
+     caller allowed for it.  There is no point in lending an empty
+     buffer.  */
+  if (src_len && (!external_used || a->e_d.lendable)
+      && filter_supports_lend (a))
+    control = IOBUFCTRL_LEND;
+  else
+    control = IOBUFCTRL_FLUSH;
+
+  if (a->d.len > a->d_hwm)
+    a->d_hwm = a->d.len;
+
   len = src_len;
-  rc = a->filter (a->filter_ov, IOBUFCTRL_FLUSH, a->chain, src_buf, &len);
+  rc = call_filter (a, control, src_buf, &len);
   if (!rc && len != src_len)
     {
       log_info ("filter_flush did not write all!\n");
@@ -2196,6 +3088,33 @@ filter_flush (iobuf_t a)
     }
   else if (rc)
     a->error = rc;
+
+  /* A stream written with partial body lengths which keeps filling
+     the buffer is likely large; enlarge the buffer so that the
+     block_filter can use larger chunks.  */
+  if (!rc && a->filter == block_filter && iobuf_adaptive_size
+      && !external_used)
+    {
+      if (src_len < a->d.size)
+        a->nfull = 0;
+      else if (++a->nfull >= IOBUF_GROW_AFTER_NFULL
+               && a->d.size < IOBUF_MAX_CHUNK_BUFFER_SIZE)
+        {
+          size_t newsize = a->d.size * 2;
+
+          if (newsize > IOBUF_MAX_CHUNK_BUFFER_SIZE)
+            newsize = IOBUF_MAX_CHUNK_BUFFER_SIZE;
+          if (DBG_IOBUF)
+            log_debug ("iobuf-%d.%d: flush: growing buffer from %lu to %lu\n",
+                       a->no, a->subno, (ulong)a->d.size, (ulong)newsize);
+          wipememory (a->d.buf, a->d.size);
+          xfree (a->d.buf);
+          a->d.buf = xmalloc (newsize);
+          a->d.size = newsize;
+          a->nfull = 0;
+        }
+    }
+
   a->d.len = 0;
   if (external_used)
     a->e_d.used = len;
@@ -2410,8 +3329,11 @@ iobuf_writebyte (iobuf_t a, unsigned int c)
 }
 
 
-int
-iobuf_write (iobuf_t a, const void *buffer, unsigned int buflen)
+/* Worker for iobuf_write and iobuf_write_lent.  If LENDABLE is set
+   BUFFER may be modified by the filters.  */
+static int
+do_iobuf_write (iobuf_t a, const void *buffer, unsigned int buflen,
+                int lendable)
 {
   const unsigned char *buf = (const unsigned char *)buffer;
   int rc;
@@ -2424,6 +3346,7 @@ iobuf_write (iobuf_t a, const void *buffer, unsigned int buflen)
 
   a->e_d.buf = NULL;
   a->e_d.len = 0;
+  a->e_d.lendable = 0;
 
   /* Hint for how full to fill iobuf internal drain buffer. */
   a->e_d.preferred = (a->use != IOBUF_OUTPUT_TEMP)
@@ -2439,11 +3362,13 @@ iobuf_write (iobuf_t a, const void *buffer, unsigned int buflen)
 	  a->e_d.buf = (byte *)buf;
 	  a->e_d.len = buflen / IOBUF_ZEROCOPY_THRESHOLD_SIZE
 			* IOBUF_ZEROCOPY_THRESHOLD_SIZE;
+	  a->e_d.lendable = lendable;
 	  if (a->e_d.len == 0)
 	    a->e_d.buf = NULL;
 	  if (a->e_d.buf && DBG_IOBUF)
-	    log_debug ("iobuf-%d.%d: writing from external buffer, %lu bytes\n",
-			a->no, a->subno, (ulong)a->e_d.len);
+	    log_debug ("iobuf-%d.%d: writing from external%s buffer, %lu bytes\n",
+			a->no, a->subno, lendable? " lent":"",
+                       (ulong)a->e_d.len);
 	}
 
       if (a->e_d.buf == NULL && buflen && a->d.len < a->d.size)
@@ -2470,6 +3395,7 @@ iobuf_write (iobuf_t a, const void *buffer, unsigned int buflen)
 	    {
 	      a->e_d.buf = NULL;
 	      a->e_d.len = 0;
+	      a->e_d.lendable = 0;
 	      return rc;
 	    }
 	}
@@ -2482,12 +3408,27 @@ iobuf_write (iobuf_t a, const void *buffer, unsigned int buflen)
 
       a->e_d.buf = NULL;
       a->e_d.len = 0;
+      a->e_d.lendable = 0;
     }
   while (buflen);
   return 0;
 }
 
 
+int
+iobuf_write (iobuf_t a, const void *buffer, unsigned int buflen)
+{
+  return do_iobuf_write (a, buffer, buflen, 0);
+}
+
+
+int
+iobuf_write_lent (iobuf_t a, void *buffer, unsigned int buflen)
+{
+  return do_iobuf_write (a, buffer, buflen, 1);
+}
+
+
 int
 iobuf_writestr (iobuf_t a, const char *buf)
 {
@@ -2569,7 +3510,9 @@ iobuf_copy (iobuf_t dest, iobuf_t source)
       if (nread > max_read)
         max_read = nread;
 
-      err = iobuf_write (dest, temp, nread);
+      /* TEMP is ours and will be burned anyway; thus the filters may
+       * work on it in place.  */
+      err = iobuf_write_lent (dest, temp, nread);
       if (err)
         break;
       nwrote += nread;
@@ -2721,11 +3664,18 @@ iobuf_seek (iobuf_t a, off_t newpos)
 	  return -1;
 	}
 #else
+# ifdef USE_IOBUF_URING
+      uring_stop (b);
+# endif
       if (lseek (b->fp, newpos, SEEK_SET) == (off_t) - 1)
 	{
 	  log_error ("can't lseek: %s\n", strerror (errno));
 	  return -1;
 	}
+# ifdef USE_IOBUF_MMAP
+      if (b->use_mmap)
+        b->mm_fpos = newpos;
+# endif
 #endif
       /* Discard the buffer it is not a temp stream.  */
       a->d.len = 0;
@@ -107,6 +107,7 @@ enum
     IOBUFCTRL_DESC	= 5,
     IOBUFCTRL_CANCEL    = 6,
     IOBUFCTRL_PEEK      = 7,
+    IOBUFCTRL_LEND      = 8,
     IOBUFCTRL_USER	= 16
   };
 
@@ -118,7 +119,8 @@ typedef enum
     IOBUF_IOCTL_INVALIDATE_CACHE = 2, /* Uses ptrval.  */
     IOBUF_IOCTL_NO_CACHE         = 3, /* Uses intval.  */
     IOBUF_IOCTL_FSYNC            = 4, /* Uses ptrval.  */
-    IOBUF_IOCTL_PEEK             = 5  /* Uses intval and ptrval.  */
+    IOBUF_IOCTL_PEEK             = 5, /* Uses intval and ptrval.  */
+    IOBUF_IOCTL_BUFFER_HWM       = 6  /* Uses ptrval.  */
   } iobuf_ioctl_t;
 
 enum iobuf_use
@@ -222,8 +224,23 @@ struct iobuf_struct
     /* Gives hint for processing that the external buffer is preferred and
        that internal buffer should be consumed early. */
     int preferred;
+    /* The external buffer has been lent to us; that is the filters
+       may modify it in place (see IOBUFCTRL_LEND). */
+    int lendable;
   } e_d;
 
+  /* Whether the filter supports IOBUFCTRL_LEND.  0 = not yet known,
+     1 = supported, -1 = not supported.  */
+  int lend_mode;
+
+  /* The largest number of bytes ever held in D.BUF.  This is used
+     for the IOBUF_IOCTL_BUFFER_HWM statistics.  */
+  size_t d_hwm;
+
+  /* The number of consecutive underflows which completely filled
+     D.BUF.  Used to decide whether the buffer shall be enlarged.  */
+  int nfull;
+
   /* When FILTER is called to read some data, it may read some data
      and then return EOF.  We can't return the EOF immediately.
      Instead, we note that we observed the EOF and when the buffer is
@@ -272,14 +289,30 @@ struct iobuf_struct
 };
 
 extern int iobuf_debug_mode;
+extern int iobuf_profile_mode;
+
+/* Print the per filter statistics collected while iobuf_profile_mode
+ * was set using log_info.  */
+void iobuf_dump_stats (void);
 
 
 /* Change the default size for all IOBUFs to KILOBYTE.  This needs to
  * be called before any iobufs are used and can only be used once.
  * Returns the current value.  Using 0 has no effect except for
- * returning the current value.  */
+ * returning the current value.  Setting a size disables the adaptive
+ * buffer sizing.  */
 unsigned int iobuf_set_buffer_size (unsigned int kilobyte);
 
+/* Enable or disable the use of mmap for reading regular files opened
+ * with iobuf_open.  Pipes, special filenames and small files are
+ * always read using read(2).  */
+void iobuf_set_mmap_mode (int enable);
+
+/* Enable or disable the use of io_uring for regular files opened with
+ * iobuf_open or iobuf_create.  This keeps several reads ahead of the
+ * reader and several writes behind the writer in flight.  */
+void iobuf_set_uring_mode (int enable);
+
 /* Returns whether the specified filename corresponds to a pipe.  In
    particular, this function checks if FNAME is "-" and, if special
    filenames are enabled (see check_special_filename), whether
@@ -417,6 +450,16 @@ int iobuf_cancel (iobuf_t iobuf);
        otherwise.  *LEN must be set to the number of bytes that were
        written out.
 
+     IOBUFCTRL_LEND: Same as IOBUFCTRL_FLUSH but BUF is lent to the
+       filter.  That is, the filter may modify the data in BUF in
+       place (e.g. encrypt it) and hand it on to the next filter using
+       iobuf_write_lent without copying it into a buffer of its own.
+       The content of BUF is undefined after the call.  This is only
+       used for filters which announced support for it: Before the
+       first flush the filter is called with BUF set to NULL and *LEN
+       set to 0; a filter supporting lending sets *LEN to 1.  Filters
+       not supporting it are called with IOBUFCTRL_FLUSH.
+
      IOBUFCTRL_CANCEL: Called with this value when iobuf_cancel() is
        called on the pipeline.
 
@@ -553,6 +596,11 @@ int iobuf_writebyte (iobuf_t a, unsigned c);
    and an error code otherwise.  */
 int iobuf_write (iobuf_t a, const void *buf, unsigned buflen);
 
+/* Same as iobuf_write but the caller allows the filters to modify
+   the data in BUF (see IOBUFCTRL_LEND).  The content of BUF is
+   undefined after the call.  */
+int iobuf_write_lent (iobuf_t a, void *buf, unsigned buflen);
+
 /* Write a string (not including the NUL terminator) to the pipeline.
    Returns 0 on success and an error code otherwise.  */
 int iobuf_writestr (iobuf_t a, const char *buf);
@@ -0,0 +1,343 @@
+/* mdfanout.c - Feed several message digests from one buffer
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* A fan-out object holds a set of digest contexts, called lanes,
+ * which are all fed from the same buffer.  With MD_FANOUT_THREADS
+ * each lane but the first one gets its own worker thread so that
+ * different hash algorithms are computed in parallel; the caller's
+ * thread hashes the first lane and then waits until all workers are
+ * done with the buffer.  Thus the buffer needs not to be copied and
+ * md_fanout_write has the same semantics as gcry_md_write.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <npth.h>
+
+#include "util.h"
+#include "mdfanout.h"
+
+/* Buffers shorter than this are hashed in the caller's thread; the
+ * synchronization would cost more than it saves.  */
+#define MD_FANOUT_MIN_THREAD_LEN 4096
+
+
+struct md_fanout_lane_s
+{
+  struct md_fanout_s *fan;
+  gcry_md_hd_t md;
+  int algo;                 /* The algo or 0 for a caller provided MD.  */
+  unsigned int owned:1;     /* MD is to be closed by us.  */
+  unsigned int running:1;   /* The worker thread has been started.  */
+  unsigned int seen;        /* Last generation hashed by the worker.  */
+  npth_t thd;
+};
+
+struct md_fanout_s
+{
+  npth_mutex_t mutex;
+  npth_cond_t cond;
+  unsigned int use_threads:1;
+  unsigned int started:1;   /* Worker threads have been started.     */
+  unsigned int stop:1;      /* Ask the workers to terminate.          */
+  const void *buffer;       /* The buffer of the current generation.  */
+  size_t length;
+  unsigned int generation;  /* Incremented for each threaded write.  */
+  int pending;              /* Workers still hashing the buffer.      */
+  int nlanes;
+  struct md_fanout_lane_s lanes[MD_FANOUT_MAX_LANES];
+};
+
+
+static void
+lock_fan (md_fanout_t fan)
+{
+  int rc = npth_mutex_lock (&fan->mutex);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_fan (md_fanout_t fan)
+{
+  int rc = npth_mutex_unlock (&fan->mutex);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* Create a new fan-out object and store it at R_FAN.  FLAGS may be
+ * MD_FANOUT_THREADS to compute the digests in parallel.  */
+gpg_error_t
+md_fanout_new (md_fanout_t *r_fan, unsigned int flags)
+{
+  md_fanout_t fan;
+  int rc;
+
+  *r_fan = NULL;
+  fan = xtrycalloc (1, sizeof *fan);
+  if (!fan)
+    return gpg_error_from_syserror ();
+
+  rc = npth_mutex_init (&fan->mutex, NULL);
+  if (rc)
+    {
+      xfree (fan);
+      return gpg_error_from_errno (rc);
+    }
+  rc = npth_cond_init (&fan->cond, NULL);
+  if (rc)
+    {
+      npth_mutex_destroy (&fan->mutex);
+      xfree (fan);
+      return gpg_error_from_errno (rc);
+    }
+  fan->use_threads = !!(flags & MD_FANOUT_THREADS);
+
+  *r_fan = fan;
+  return 0;
+}
+
+
+/* Stop all worker threads and release FAN.  Digest contexts created
+ * by md_fanout_enable are closed; those given to md_fanout_add_md
+ * are left to the caller.  */
+void
+md_fanout_release (md_fanout_t fan)
+{
+  int i;
+
+  if (!fan)
+    return;
+
+  if (fan->started)
+    {
+      lock_fan (fan);
+      fan->stop = 1;
+      npth_cond_broadcast (&fan->cond);
+      unlock_fan (fan);
+      for (i = 0; i < fan->nlanes; i++)
+        if (fan->lanes[i].running)
+          npth_join (fan->lanes[i].thd, NULL);
+    }
+
+  for (i = 0; i < fan->nlanes; i++)
+    if (fan->lanes[i].owned)
+      gcry_md_close (fan->lanes[i].md);
+
+  npth_cond_destroy (&fan->cond);
+  npth_mutex_destroy (&fan->mutex);
+  xfree (fan);
+}
+
+
+static gpg_error_t
+add_lane (md_fanout_t fan, gcry_md_hd_t md, int algo, int owned)
+{
+  struct md_fanout_lane_s *lane;
+
+  if (fan->started)
+    return gpg_error (GPG_ERR_CONFLICT);
+  if (fan->nlanes >= MD_FANOUT_MAX_LANES)
+    return gpg_error (GPG_ERR_TOO_MANY);
+
+  lane = fan->lanes + fan->nlanes++;
+  lane->fan = fan;
+  lane->md = md;
+  lane->algo = algo;
+  lane->owned = owned;
+  return 0;
+}
+
+
+/* Open a digest context for ALGO and add it to FAN.  Enabling an
+ * algorithm twice is a no-op.  All lanes must be added before the
+ * first call to md_fanout_write.  */
+gpg_error_t
+md_fanout_enable (md_fanout_t fan, int algo)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+
+  if (!algo)
+    return gpg_error (GPG_ERR_DIGEST_ALGO);
+  if (md_fanout_get_md (fan, algo))
+    return 0;
+
+  err = gcry_md_open (&md, algo, 0);
+  if (err)
+    return err;
+  err = add_lane (fan, md, algo, 1);
+  if (err)
+    gcry_md_close (md);
+  return err;
+}
+
+
+/* Add the caller provided digest context MD to FAN.  MD may have
+ * several algorithms enabled; it stays owned by the caller and must
+ * not be used while md_fanout_write is running.  */
+gpg_error_t
+md_fanout_add_md (md_fanout_t fan, gcry_md_hd_t md)
+{
+  return add_lane (fan, md, 0, 0);
+}
+
+
+/* Return the digest context for ALGO as created by md_fanout_enable
+ * or NULL if ALGO has not been enabled.  */
+gcry_md_hd_t
+md_fanout_get_md (md_fanout_t fan, int algo)
+{
+  int i;
+
+  for (i = 0; i < fan->nlanes; i++)
+    if (fan->lanes[i].algo == algo)
+      return fan->lanes[i].md;
+  return NULL;
+}
+
+
+/* Return the number of lanes of FAN.  */
+int
+md_fanout_count (md_fanout_t fan)
+{
+  return fan->nlanes;
+}
+
+
+static void *
+fanout_worker (void *arg)
+{
+  struct md_fanout_lane_s *lane = arg;
+  md_fanout_t fan = lane->fan;
+  const void *buffer;
+  size_t length;
+
+  lock_fan (fan);
+  for (;;)
+    {
+      while (!fan->stop && lane->seen == fan->generation)
+        npth_cond_wait (&fan->cond, &fan->mutex);
+      if (fan->stop)
+        break;
+      lane->seen = fan->generation;
+      buffer = fan->buffer;
+      length = fan->length;
+      unlock_fan (fan);
+
+      npth_unprotect ();
+      gcry_md_write (lane->md, buffer, length);
+      npth_protect ();
+
+      lock_fan (fan);
+      if (!--fan->pending)
+        npth_cond_broadcast (&fan->cond);
+    }
+  unlock_fan (fan);
+
+  return NULL;
+}
+
+
+/* Start a worker for each lane but the first.  On error the lanes
+ * without a worker are hashed by the caller's thread.  */
+static void
+start_workers (md_fanout_t fan)
+{
+  npth_attr_t tattr;
+  int i, rc;
+
+  fan->started = 1;
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      log_error ("%s: error creating thread attribute: %s\n", __func__,
+                 gpg_strerror (gpg_error_from_errno (rc)));
+      return;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i = 1; i < fan->nlanes; i++)
+    {
+      rc = npth_create (&fan->lanes[i].thd, &tattr,
+                        fanout_worker, fan->lanes + i);
+      if (rc)
+        {
+          log_error ("%s: error spawning thread: %s\n", __func__,
+                     gpg_strerror (gpg_error_from_errno (rc)));
+          break;
+        }
+      fan->lanes[i].running = 1;
+    }
+  npth_attr_destroy (&tattr);
+}
+
+
+/* Hash LENGTH bytes of BUFFER with all lanes of FAN.  The function
+ * returns after all digests have been updated.  */
+void
+md_fanout_write (md_fanout_t fan, const void *buffer, size_t length)
+{
+  int i, nworkers;
+
+  if (!length)
+    return;
+
+  if (!fan->use_threads || fan->nlanes < 2
+      || length < MD_FANOUT_MIN_THREAD_LEN)
+    {
+      for (i = 0; i < fan->nlanes; i++)
+        gcry_md_write (fan->lanes[i].md, buffer, length);
+      return;
+    }
+
+  if (!fan->started)
+    start_workers (fan);
+
+  nworkers = 0;
+  for (i = 1; i < fan->nlanes; i++)
+    if (fan->lanes[i].running)
+      nworkers++;
+
+  lock_fan (fan);
+  fan->buffer = buffer;
+  fan->length = length;
+  fan->pending = nworkers;
+  fan->generation++;
+  npth_cond_broadcast (&fan->cond);
+  unlock_fan (fan);
+
+  npth_unprotect ();
+  gcry_md_write (fan->lanes[0].md, buffer, length);
+  for (i = 1; i < fan->nlanes; i++)
+    if (!fan->lanes[i].running)
+      gcry_md_write (fan->lanes[i].md, buffer, length);
+  npth_protect ();
+
+  lock_fan (fan);
+  while (fan->pending)
+    npth_cond_wait (&fan->cond, &fan->mutex);
+  fan->buffer = NULL;
+  unlock_fan (fan);
+}
@@ -0,0 +1,44 @@
+/* mdfanout.h - Feed several message digests from one buffer
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_COMMON_MDFANOUT_H
+#define GNUPG_COMMON_MDFANOUT_H
+
+#include <gcrypt.h>
+
+/* The maximum number of digest contexts a fan-out object can feed.  */
+#define MD_FANOUT_MAX_LANES 16
+
+/* Flags for md_fanout_new.  */
+#define MD_FANOUT_THREADS 1  /* Hash the lanes in worker threads.  */
+
+struct md_fanout_s;
+typedef struct md_fanout_s *md_fanout_t;
+
+gpg_error_t md_fanout_new (md_fanout_t *r_fan, unsigned int flags);
+void md_fanout_release (md_fanout_t fan);
+gpg_error_t md_fanout_enable (md_fanout_t fan, int algo);
+gpg_error_t md_fanout_add_md (md_fanout_t fan, gcry_md_hd_t md);
+gcry_md_hd_t md_fanout_get_md (md_fanout_t fan, int algo);
+int md_fanout_count (md_fanout_t fan);
+void md_fanout_write (md_fanout_t fan, const void *buffer, size_t length);
+
+
+#endif /*GNUPG_COMMON_MDFANOUT_H*/
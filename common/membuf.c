@@ -41,32 +41,113 @@
    create a buffer, put_membuf to append bytes and get_membuf to
    release and return the buffer.  Allocation errors are detected but
    only returned at the final get_membuf(), this helps not to clutter
-   the code with out of core checks.  */
+   the code with out of core checks.
+
+   Up to MEMBUF_SMALL_SIZE bytes are stored in an inline buffer and
+   the heap is only used for larger data; INITIALLEN is then used as
+   a hint for the first allocation.  The heap buffer grows
+   geometrically so that appending many small chunks is not
+   quadratic.  */
+
+/* Return a pointer to the data of MB.  */
+static GPGRT_INLINE char *
+membuf_ptr (membuf_t *mb)
+{
+  return mb->use_small? mb->small : mb->buf;
+}
+
 
 void
 init_membuf (membuf_t *mb, int initiallen)
 {
   mb->len = 0;
-  mb->size = initiallen;
+  mb->size = initiallen > 0? initiallen : 0;
   mb->out_of_core = 0;
-  mb->buf = xtrymalloc (initiallen);
-  if (!mb->buf)
-    mb->out_of_core = errno;
+  mb->buf = NULL;
+  mb->use_small = 1;
+  mb->secure = 0;
 }
 
-/* Same as init_membuf but allocates the buffer in secure memory.  */
+/* Same as init_membuf but allocates the buffer in secure memory.  The
+   inline buffer is not used in this case.  */
 void
 init_membuf_secure (membuf_t *mb, int initiallen)
 {
   mb->len = 0;
   mb->size = initiallen;
   mb->out_of_core = 0;
+  mb->use_small = 0;
+  mb->secure = 1;
   mb->buf = xtrymalloc_secure (initiallen);
   if (!mb->buf)
     mb->out_of_core = errno;
 }
 
 
+/* Switch MB into the error state and wipe out what we already
+   accumulated.  This is required in case we are storing sensitive
+   data here.  The membuf API does not provide another way to cleanup
+   after an error. */
+static void
+membuf_set_oom (membuf_t *mb, int err)
+{
+  mb->out_of_core = err ? err : ENOMEM;
+  wipememory (membuf_ptr (mb), mb->len);
+}
+
+
+/* Make sure that MB has room for at least NEEDED bytes plus one
+   spare byte and that the data is stored on the heap.  Returns false
+   on error.  */
+static int
+membuf_grow (membuf_t *mb, size_t needed)
+{
+  size_t newsize;
+  char *p;
+
+  if (needed + 1 + 1024 < needed)
+    {
+      membuf_set_oom (mb, ENOMEM);
+      return 0;
+    }
+
+  if (mb->use_small)
+    {
+      /* Spill over from the inline buffer.  */
+      newsize = needed + 1024;
+      if (newsize < mb->size)
+        newsize = mb->size;
+      p = xtrymalloc (newsize);
+      if (!p)
+        {
+          membuf_set_oom (mb, errno);
+          return 0;
+        }
+      memcpy (p, mb->small, mb->len);
+      wipememory (mb->small, mb->len);
+      mb->use_small = 0;
+    }
+  else
+    {
+      /* Grow by half of the current size but at least by the
+         requested amount; this keeps the number of reallocs
+         logarithmic in the final size.  */
+      newsize = mb->size + mb->size / 2;
+      if (newsize < mb->size || newsize < needed + 1024)
+        newsize = needed + 1024;
+      p = xtryrealloc (mb->buf, newsize);
+      if (!p)
+        {
+          membuf_set_oom (mb, errno);
+          return 0;
+        }
+    }
+  mb->buf = p;
+  mb->size = newsize;
+  return 1;
+}
+
+
 /* Shift the content of the membuf MB by AMOUNT bytes.  The next
    operation will then behave as if AMOUNT bytes had not been put into
    the buffer.  If AMOUNT is greater than the actual accumulated
@@ -74,6 +155,8 @@ init_membuf_secure (membuf_t *mb, int initiallen)
 void
 clear_membuf (membuf_t *mb, size_t amount)
 {
+  char *p;
+
   /* No need to clear if we are already out of core.  */
   if (mb->out_of_core)
     return;
@@ -81,8 +164,9 @@ clear_membuf (membuf_t *mb, size_t amount)
     mb->len = 0;
   else
     {
+      p = membuf_ptr (mb);
       mb->len -= amount;
-      memmove (mb->buf, mb->buf+amount, mb->len);
+      memmove (p, p+amount, mb->len);
     }
 }
 
@@ -90,31 +174,25 @@ clear_membuf (membuf_t *mb, size_t amount)
 void
 put_membuf (membuf_t *mb, const void *buf, size_t len)
 {
+  char *p;
+
   if (mb->out_of_core || !len)
     return;
 
-  if (mb->len + len >= mb->size)
+  if (mb->use_small)
     {
-      char *p;
-
-      mb->size += len + 1024;
-      p = xtryrealloc (mb->buf, mb->size);
-      if (!p)
-        {
-          mb->out_of_core = errno ? errno : ENOMEM;
-          /* Wipe out what we already accumulated.  This is required
-             in case we are storing sensitive data here.  The membuf
-             API does not provide another way to cleanup after an
-             error. */
-          wipememory (mb->buf, mb->len);
-          return;
-        }
-      mb->buf = p;
+      if (mb->len + len >= MEMBUF_SMALL_SIZE
+          && !membuf_grow (mb, mb->len + len))
+        return;
     }
+  else if (mb->len + len >= mb->size && !membuf_grow (mb, mb->len + len))
+    return;
+
+  p = membuf_ptr (mb);
   if (buf)
-    memcpy (mb->buf + mb->len, buf, len);
+    memcpy (p + mb->len, buf, len);
   else
-    memset (mb->buf + mb->len, 0, len);
+    memset (p + mb->len, 0, len);
   mb->len += len;
 }
 
@@ -149,8 +227,8 @@ put_membuf_printf (membuf_t *mb, const char *format, ...)
 
   va_start (arg_ptr, format);
   rc = gpgrt_vasprintf (&buf, format, arg_ptr);
-  if (rc < 0)
-    mb->out_of_core = errno ? errno : ENOMEM;
+  if (rc < 0 && !mb->out_of_core)
+    membuf_set_oom (mb, errno);
   va_end (arg_ptr);
   if (rc >= 0)
     {
@@ -167,17 +245,39 @@ get_membuf (membuf_t *mb, size_t *len)
 
   if (mb->out_of_core)
     {
-      if (mb->buf)
+      if (mb->use_small)
+        wipememory (mb->small, mb->len);
+      else if (mb->buf)
         {
           wipememory (mb->buf, mb->len);
           xfree (mb->buf);
           mb->buf = NULL;
         }
+      mb->use_small = 0;
       gpg_err_set_errno (mb->out_of_core);
       return NULL;
     }
 
-  p = mb->buf;
+  if (mb->use_small)
+    {
+      /* The caller expects a malloced buffer.  Allocate just what is
+         needed plus the spare byte we always guarantee.  */
+      p = xtrymalloc (mb->len + 1);
+      if (!p)
+        {
+          int saveerr = errno;
+          wipememory (mb->small, mb->len);
+          mb->use_small = 0;
+          mb->out_of_core = ENOMEM;
+          gpg_err_set_errno (saveerr);
+          return NULL;
+        }
+      memcpy (p, mb->small, mb->len);
+      wipememory (mb->small, mb->len);
+      mb->use_small = 0;
+    }
+  else
+    p = mb->buf;
   if (len)
     *len = mb->len;
   mb->buf = NULL;
@@ -197,6 +297,9 @@ get_membuf_shrink (membuf_t *mb, size_t *len)
   if (!len)
     len = &dummylen;
 
+  if (mb->use_small && !mb->out_of_core)
+    return get_membuf (mb, len);  /* Already allocated to size.  */
+
   p = get_membuf (mb, len);
   if (!p)
     return NULL;
@@ -226,12 +329,47 @@ peek_membuf (membuf_t *mb, size_t *len)
       return NULL;
     }
 
-  p = mb->buf;
+  p = membuf_ptr (mb);
   if (len)
     *len = mb->len;
   return p;
 }
 
+
+/* Release the membuf MB and return its data as a memory stream opened
+   with MODE without copying the data.  The stream is positioned at
+   the start and owns the buffer; it may grow if MODE allows writing.
+   On error NULL is returned and ERRNO is set; MB is released in all
+   cases.  */
+estream_t
+get_membuf_stream (membuf_t *mb, const char *mode)
+{
+  estream_t fp;
+  char *p;
+  size_t len, size;
+
+  /* Move inline data to the heap so that the stream can own it.  */
+  if (mb->use_small && !mb->out_of_core)
+    membuf_grow (mb, mb->len);
+  if (mb->out_of_core)
+    {
+      get_membuf (mb, NULL);  /* Release and set ERRNO.  */
+      return NULL;
+    }
+  size = mb->size;
+  p = get_membuf (mb, &len);
+
+  fp = es_mopen (p, size, len, 1, gcry_realloc, gcry_free, mode);
+  if (!fp)
+    {
+      int saveerr = errno;
+      wipememory (p, len);
+      xfree (p);
+      gpg_err_set_errno (saveerr);
+    }
+  return fp;
+}
+
 /* To assist using membuf with function returning an error, this
  * function sets the membuf into the error state.  */
 void
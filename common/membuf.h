@@ -32,21 +32,29 @@
 
 #include "mischelp.h"
 
+/* Short data is kept in an inline buffer of this size so that no
+   heap allocation is required as long as it fits.  */
+#define MEMBUF_SMALL_SIZE 256
+
 /* The definition of the structure is private, we only need it here,
    so it can be allocated on the stack. */
 struct private_membuf_s
 {
   size_t len;
-  size_t size;
+  size_t size;     /* Allocated size of BUF; while USE_SMALL is set
+                      this is the size hint given to init_membuf.  */
   char *buf;
   int out_of_core;
+  unsigned int use_small:1;  /* The data is stored in SMALL.  */
+  unsigned int secure:1;     /* Allocated in secure memory.  */
+  char small[MEMBUF_SMALL_SIZE];
 };
 
 typedef struct private_membuf_s membuf_t;
 
 /* Return the current length of the membuf.  */
 #define get_membuf_len(a)  ((a)->len)
-#define is_membuf_ready(a) ((a)->buf || (a)->out_of_core)
+#define is_membuf_ready(a) ((a)->buf || (a)->use_small || (a)->out_of_core)
 #define MEMBUF_ZERO        { 0, 0, NULL, 0}
 
 void init_membuf (membuf_t *mb, int initiallen);
@@ -60,6 +68,7 @@ void put_membuf_printf (membuf_t *mb, const char *format,
 void *get_membuf (membuf_t *mb, size_t *len);
 void *get_membuf_shrink (membuf_t *mb, size_t *len);
 const void *peek_membuf (membuf_t *mb, size_t *len);
+estream_t get_membuf_stream (membuf_t *mb, const char *mode);
 void set_membuf_err (membuf_t *mb, gpg_error_t err);
 
 #endif /*GNUPG_COMMON_MEMBUF_H*/
@@ -0,0 +1,294 @@
+/* metrics.c - A registry for metrics
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The daemons keep their statistics in the modules which are
+ * responsible for the counted objects.  To present them in a uniform
+ * way each module registers a source function which emits its
+ * counters, gauges and histograms using the functions below.  The
+ * result is rendered in the Prometheus text exposition format and can
+ * be retrieved using "GETINFO metrics" or be written to the log at a
+ * regular interval.  */
+
+#include <config.h>
+
+#ifdef WITHOUT_NPTH /* Give the Makefile a chance to build without Pth.  */
+# undef HAVE_NPTH
+# undef USE_NPTH
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef HAVE_NPTH
+# include <npth.h>
+#endif
+
+#include "util.h"
+#include "membuf.h"
+#include "metrics.h"
+
+
+/* The object passed to the sources.  */
+struct metrics_writer_s
+{
+  membuf_t mb;
+  char name[64];      /* The current metric including the prefix.  */
+};
+
+/* The prefix for all metric names; e.g. "gpg_agent".  */
+static char metrics_prefix[32];
+
+/* The registered sources.  */
+static metrics_source_t metrics_sources[METRICS_MAX_SOURCES];
+static int metrics_nsources;
+
+
+/* Set the prefix for all metric names to PREFIX.  This should be the
+ * name of the daemon with dashes replaced by underscores.  */
+void
+metrics_set_prefix (const char *prefix)
+{
+  if (!prefix)
+    *metrics_prefix = 0;
+  else
+    snprintf (metrics_prefix, sizeof metrics_prefix, "%s_", prefix);
+}
+
+
+/* Register the function SOURCE.  Registering the same function twice
+ * has no effect.  */
+void
+metrics_register_source (metrics_source_t source)
+{
+  int i;
+
+  for (i=0; i < metrics_nsources; i++)
+    if (metrics_sources[i] == source)
+      return;
+  if (metrics_nsources >= METRICS_MAX_SOURCES)
+    log_bug ("%s: too many sources\n", __func__);
+  metrics_sources[metrics_nsources++] = source;
+}
+
+
+/* Start the metric NAME of TYPE described by HELP.  This must be
+ * followed by one or more calls to metrics_put or, for a histogram,
+ * to metrics_put_histogram.  */
+void
+metrics_begin (metrics_writer_t w, metric_type_t type,
+               const char *name, const char *help)
+{
+  const char *s;
+
+  snprintf (w->name, sizeof w->name, "%s%s", metrics_prefix, name);
+  switch (type)
+    {
+    case METRIC_COUNTER:   s = "counter"; break;
+    case METRIC_GAUGE:     s = "gauge"; break;
+    case METRIC_HISTOGRAM: s = "histogram"; break;
+    default: s = "untyped"; break;
+    }
+  put_membuf_printf (&w->mb, "# HELP %s %s\n# TYPE %s %s\n",
+                     w->name, help, w->name, s);
+}
+
+
+/* Write the label for VALUE named LABEL.  Backslashes, double quotes
+ * and linefeeds are escaped.  */
+static void
+put_label (membuf_t *mb, const char *label, const char *value)
+{
+  size_t n;
+
+  put_membuf_printf (mb, "%s=\"", label);
+  while (*value)
+    {
+      n = strcspn (value, "\\\"\n");
+      put_membuf (mb, value, n);
+      value += n;
+      if (!*value)
+        break;
+      if (*value == '\n')
+        put_membuf_str (mb, "\\n");
+      else if (*value == '"')
+        put_membuf_str (mb, "\\\"");
+      else
+        put_membuf_str (mb, "\\\\");
+      value++;
+    }
+  put_membuf (mb, "\"", 1);
+}
+
+
+/* Put a sample with NUMBER for the current metric.  If LABEL is not
+ * NULL the sample is labeled with LABEL="VALUE".  */
+void
+metrics_put (metrics_writer_t w, const char *label, const char *value,
+             unsigned long long number)
+{
+  put_membuf_str (&w->mb, w->name);
+  if (label)
+    {
+      put_membuf (&w->mb, "{", 1);
+      put_label (&w->mb, label, value);
+      put_membuf (&w->mb, "}", 1);
+    }
+  put_membuf_printf (&w->mb, " %llu\n", number);
+}
+
+
+/* Put a histogram sample for the current metric.  BUCKETS has the
+ * non-cumulative counts for NBUCKETS buckets; the upper bounds of the
+ * buckets are given by BOUNDS which needs to have NBUCKETS-1
+ * elements; the last bucket has no upper bound.  SUM is the sum of
+ * all observed values.  LABEL and VALUE are as for metrics_put.  */
+void
+metrics_put_histogram (metrics_writer_t w,
+                       const char *label, const char *value,
+                       const unsigned long long *bounds,
+                       const unsigned long *buckets, int nbuckets,
+                       unsigned long long sum)
+{
+  unsigned long long count = 0;
+  int i;
+
+  for (i=0; i < nbuckets; i++)
+    {
+      count += buckets[i];
+      put_membuf_printf (&w->mb, "%s_bucket{", w->name);
+      if (label)
+        {
+          put_label (&w->mb, label, value);
+          put_membuf (&w->mb, ",", 1);
+        }
+      if (i < nbuckets - 1)
+        put_membuf_printf (&w->mb, "le=\"%llu\"} %llu\n", bounds[i], count);
+      else
+        put_membuf_printf (&w->mb, "le=\"+Inf\"} %llu\n", count);
+    }
+
+  put_membuf_printf (&w->mb, "%s_sum", w->name);
+  if (label)
+    {
+      put_membuf (&w->mb, "{", 1);
+      put_label (&w->mb, label, value);
+      put_membuf (&w->mb, "}", 1);
+    }
+  put_membuf_printf (&w->mb, " %llu\n%s_count", sum, w->name);
+  if (label)
+    {
+      put_membuf (&w->mb, "{", 1);
+      put_label (&w->mb, label, value);
+      put_membuf (&w->mb, "}", 1);
+    }
+  put_membuf_printf (&w->mb, " %llu\n", count);
+}
+
+
+/* Return a malloced string with the metrics of all sources in the
+ * Prometheus text format.  Returns NULL on error with ERRNO set.  */
+char *
+metrics_format (void)
+{
+  struct metrics_writer_s w;
+  int i;
+
+  init_membuf (&w.mb, 4096);
+  *w.name = 0;
+  for (i=0; i < metrics_nsources; i++)
+    metrics_sources[i] (&w);
+  put_membuf (&w.mb, "", 1);
+  return get_membuf (&w.mb, NULL);
+}
+
+
+/* Write all samples to the log.  The HELP and TYPE comments are not
+ * logged.  */
+void
+metrics_log (void)
+{
+  char *text, *line, *endp;
+
+  text = metrics_format ();
+  if (!text)
+    {
+      log_error ("error formatting the metrics: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      return;
+    }
+  for (line = text; *line; line = endp)
+    {
+      endp = strchr (line, '\n');
+      if (endp)
+        *endp++ = 0;
+      else
+        endp = line + strlen (line);
+      if (*line && *line != '#')
+        log_info ("metrics: %s\n", line);
+    }
+  xfree (text);
+}
+
+
+#ifdef HAVE_NPTH
+static void *
+metrics_log_thread (void *arg)
+{
+  unsigned int interval = (unsigned int)(uintptr_t)arg;
+
+  for (;;)
+    {
+      npth_sleep (interval);
+      metrics_log ();
+    }
+  return NULL;
+}
+#endif /*HAVE_NPTH*/
+
+
+/* Start a thread which writes the metrics to the log every INTERVAL
+ * seconds.  This is only supported by the nPth version of the
+ * library.  */
+gpg_error_t
+metrics_start_logging (unsigned int interval)
+{
+#ifdef HAVE_NPTH
+  npth_attr_t tattr;
+  npth_t thread;
+  int rc;
+
+  if (!interval)
+    return 0;
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    return gpg_error_from_errno (rc);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  rc = npth_create (&thread, &tattr, metrics_log_thread,
+                    (void *)(uintptr_t)interval);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    return gpg_error_from_errno (rc);
+  return 0;
+#else
+  (void)interval;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif
+}
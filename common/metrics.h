@@ -0,0 +1,61 @@
+/* metrics.h - Definitions for the metrics registry
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_COMMON_METRICS_H
+#define GNUPG_COMMON_METRICS_H
+
+/* The metric types as used by the Prometheus text format.  */
+typedef enum
+  {
+    METRIC_COUNTER = 1,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM
+  } metric_type_t;
+
+struct metrics_writer_s;
+typedef struct metrics_writer_s *metrics_writer_t;
+
+/* A source is a function which emits a set of metrics using
+ * metrics_begin and metrics_put or metrics_put_histogram.  It is
+ * called for each request of the metrics.  */
+typedef void (*metrics_source_t) (metrics_writer_t w);
+
+/* The maximum number of sources which can be registered.  */
+#define METRICS_MAX_SOURCES 16
+
+void metrics_set_prefix (const char *prefix);
+void metrics_register_source (metrics_source_t source);
+
+void metrics_begin (metrics_writer_t w, metric_type_t type,
+                    const char *name, const char *help);
+void metrics_put (metrics_writer_t w, const char *label, const char *value,
+                  unsigned long long number);
+void metrics_put_histogram (metrics_writer_t w,
+                            const char *label, const char *value,
+                            const unsigned long long *bounds,
+                            const unsigned long *buckets, int nbuckets,
+                            unsigned long long sum);
+
+char *metrics_format (void);
+void metrics_log (void);
+gpg_error_t metrics_start_logging (unsigned int interval);
+
+
+#endif /*GNUPG_COMMON_METRICS_H*/
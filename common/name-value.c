@@ -41,14 +41,28 @@
 #include "mischelp.h"
 #include "strlist.h"
 #include "util.h"
+#include "membuf.h"
 #include "name-value.h"
 
+/* Number of buckets of the name index.  Must be a power of 2.  */
+#define NVC_HTABLE_SIZE 32
+
 struct name_value_container
 {
   struct name_value_entry *first;
   struct name_value_entry *last;
   unsigned int private_key_mode:1;
   unsigned int modified:1;
+
+  /* The parsed file.  Entries created by the parser reference their
+     name and raw value in this buffer instead of having their own
+     copies.  */
+  char *pool;
+  size_t poolsize;
+
+  /* Index of the named entries by a hash of their name.  Each
+     bucket lists the entries in the same order as the main list.  */
+  struct name_value_entry *htable[NVC_HTABLE_SIZE];
 };
 
 
@@ -57,6 +71,9 @@ struct name_value_entry
   struct name_value_entry *prev;
   struct name_value_entry *next;
 
+  /* Next entry in the same bucket of the name index.  */
+  struct name_value_entry *hnext;
+
   /* The name.  Comments and blank lines have NAME set to NULL.  */
   char *name;
 
@@ -64,8 +81,17 @@ struct name_value_entry
      a file so that we can reproduce it.  */
   strlist_t raw_value;
 
-  /* The decoded value.  */
+  /* Instead of RAW_VALUE the parser sets RAW_BUF to the RAW_LEN
+     bytes of the value in the pool of the container.  These are
+     complete lines including the linefeeds.  */
+  char *raw_buf;
+  size_t raw_len;
+
+  /* The decoded value.  It is only computed on demand.  */
   char *value;
+
+  /* NAME points into the pool of the container.  */
+  unsigned int name_in_pool:1;
 };
 
 
@@ -117,12 +143,17 @@ nve_release (nve_t entry, int private_key_mode)
   if (entry == NULL)
     return;
 
-  xfree (entry->name);
+  if (!entry->name_in_pool)
+    xfree (entry->name);
   if (entry->value && private_key_mode)
     wipememory (entry->value, strlen (entry->value));
   xfree (entry->value);
   if (private_key_mode)
-    free_strlist_wipe (entry->raw_value);
+    {
+      free_strlist_wipe (entry->raw_value);
+      if (entry->raw_buf)
+        wipememory (entry->raw_buf, entry->raw_len);
+    }
   else
     free_strlist (entry->raw_value);
   xfree (entry);
@@ -144,6 +175,9 @@ nvc_release (nvc_t pk)
       nve_release (e, pk->private_key_mode);
     }
 
+  if (pk->pool && pk->private_key_mode)
+    wipememory (pk->pool, pk->poolsize);
+  xfree (pk->pool);
   xfree (pk);
 }
 
@@ -169,6 +203,62 @@ nvc_modified (nvc_t pk, int clear)
 
 /* Dealing with names and values.  */
 
+/* Return the bucket of the name index for NAME.  Names are compared
+   case-insensitive and thus we hash the lowercase version.  */
+static unsigned int
+name_hash (const char *name)
+{
+  unsigned int hash = 0;
+
+  for (; *name; name++)
+    hash = hash * 31 + ascii_tolower (*(const unsigned char *)name);
+  return hash & (NVC_HTABLE_SIZE - 1);
+}
+
+
+/* Insert the new entry E, which must already be linked into the main
+   list of PK, into the name index.  */
+static void
+index_entry (nvc_t pk, nve_t e)
+{
+  nve_t *pp;
+
+  if (!e->name)
+    return;
+
+  if (e->prev && e->prev->name && !ascii_strcasecmp (e->prev->name, e->name))
+    {
+      /* Grouped with an entry of the same name; keep the order.  */
+      e->hnext = e->prev->hnext;
+      e->prev->hnext = e;
+      return;
+    }
+
+  /* Otherwise E has been appended.  */
+  for (pp = &pk->htable[name_hash (e->name)]; *pp; pp = &(*pp)->hnext)
+    ;
+  *pp = e;
+  e->hnext = NULL;
+}
+
+
+/* Remove entry E from the name index of PK.  */
+static void
+unindex_entry (nvc_t pk, nve_t e)
+{
+  nve_t *pp;
+
+  if (!e->name)
+    return;
+
+  for (pp = &pk->htable[name_hash (e->name)]; *pp; pp = &(*pp)->hnext)
+    if (*pp == e)
+      {
+        *pp = e->hnext;
+        break;
+      }
+}
+
 /* Check whether the given name is valid.  Valid names start with a
    letter, end with a colon, and contain only alphanumeric characters
    and the hyphen.  */
@@ -194,10 +284,11 @@ assert_raw_value (nve_t entry)
 {
   gpg_error_t err = 0;
   size_t len, offset;
+  strlist_t tail = NULL;
 #define LINELEN	70
   char buf[LINELEN+3];
 
-  if (entry->raw_value)
+  if (entry->raw_value || entry->raw_buf)
     return 0;
 
   len = strlen (entry->value);
@@ -236,7 +327,9 @@ assert_raw_value (nve_t entry)
 
       snprintf (buf, sizeof buf, " %.*s\n", (int) amount,
 		&entry->value[offset]);
-      if (append_to_strlist_try (&entry->raw_value, buf) == NULL)
+      /* Append to the last line to avoid walking the list.  */
+      tail = append_to_strlist_try (tail? &tail : &entry->raw_value, buf);
+      if (!tail)
 	{
 	  err = my_error_from_syserror ();
 	  goto leave;
@@ -258,12 +351,13 @@ assert_raw_value (nve_t entry)
 }
 
 
-/* Computes the length of the value encoded as continuation.  If
-   *SWALLOW_WS is set, all whitespace at the beginning of S is
-   swallowed.  If START is given, a pointer to the beginning of the
-   value is stored there.  */
+/* Computes the length of the value encoded as continuation in the N
+   bytes at S.  If *SWALLOW_WS is set, all whitespace at the beginning
+   of S is swallowed.  If START is given, a pointer to the beginning of
+   the value is stored there.  */
 static size_t
-continuation_length (const char *s, int *swallow_ws, const char **start)
+continuation_length (const char *s, size_t n, int *swallow_ws,
+                     const char **start)
 {
   size_t len;
 
@@ -271,19 +365,19 @@ continuation_length (const char *s, int *swallow_ws, const char **start)
     {
       /* The previous line was a blank line and we inserted a newline.
 	 Swallow all whitespace at the beginning of this line.  */
-      while (ascii_isspace (*s))
-	s++;
+      while (n && ascii_isspace (*s))
+	s++, n--;
     }
   else
     {
       /* Iff a continuation starts with more than one space, it
 	 encodes a space.  */
-      if (ascii_isspace (*s))
-	s++;
+      if (n && ascii_isspace (*s))
+	s++, n--;
     }
 
   /* Strip whitespace at the end.  */
-  len = strlen (s);
+  len = n;
   while (len > 0 && ascii_isspace (s[len-1]))
     len--;
 
@@ -304,13 +398,25 @@ continuation_length (const char *s, int *swallow_ws, const char **start)
 }
 
 
+/* Return the length of the line at S, which has N bytes remaining,
+   including its linefeed.  */
+static size_t
+line_length (const char *s, size_t n)
+{
+  const char *lf = memchr (s, '\n', n);
+
+  return lf? (lf - s + 1) : n;
+}
+
+
 /* Makes sure that ENTRY has a VALUE.  */
 static gpg_error_t
 assert_value (nve_t entry)
 {
-  size_t len;
+  size_t len, n, l;
   int swallow_ws;
   strlist_t s;
+  const char *r, *start;
   char *p;
 
   if (entry->value)
@@ -319,7 +425,12 @@ assert_value (nve_t entry)
   len = 0;
   swallow_ws = 0;
   for (s = entry->raw_value; s; s = s->next)
-    len += continuation_length (s->d, &swallow_ws, NULL);
+    len += continuation_length (s->d, strlen (s->d), &swallow_ws, NULL);
+  for (r = entry->raw_buf, n = entry->raw_len; n; r += l, n -= l)
+    {
+      l = line_length (r, n);
+      len += continuation_length (r, l, &swallow_ws, NULL);
+    }
 
   /* Add one for the terminating zero.  */
   len += 1;
@@ -331,11 +442,20 @@ assert_value (nve_t entry)
   swallow_ws = 0;
   for (s = entry->raw_value; s; s = s->next)
     {
-      const char *start;
-      size_t l = continuation_length (s->d, &swallow_ws, &start);
+      size_t vl = continuation_length (s->d, strlen (s->d),
+                                       &swallow_ws, &start);
+
+      memcpy (p, start, vl);
+      p += vl;
+    }
+  for (r = entry->raw_buf, n = entry->raw_len; n; r += l, n -= l)
+    {
+      size_t vl;
 
-      memcpy (p, start, l);
-      p += l;
+      l = line_length (r, n);
+      vl = continuation_length (r, l, &swallow_ws, &start);
+      memcpy (p, start, vl);
+      p += vl;
     }
 
   *p++ = 0;
@@ -366,55 +486,21 @@ nve_value (nve_t pke)
 
 /* Adding and modifying values.  */
 
-/* Add (NAME, VALUE, RAW_VALUE) to PK.  NAME may be NULL for comments
-   and blank lines.  At least one of VALUE and RAW_VALUE must be
-   given.  If PRESERVE_ORDER is not given, entries with the same name
-   are grouped.  NAME, VALUE and RAW_VALUE is consumed.  */
-static gpg_error_t
-_nvc_add (nvc_t pk, char *name, char *value, strlist_t raw_value,
-	  int preserve_order)
+/* Link the new entry E into PK.  If PRESERVE_ORDER is not given,
+   entries with the same name are grouped.  */
+static void
+link_entry (nvc_t pk, nve_t e, int preserve_order)
 {
-  gpg_error_t err = 0;
-  nve_t e;
-
-  assert (value || raw_value);
-
-  if (name && ! valid_name (name))
-    {
-      err = my_error (GPG_ERR_INV_NAME);
-      goto leave;
-    }
-
-  if (name
-      && pk->private_key_mode
-      && !ascii_strcasecmp (name, "Key:")
-      && nvc_lookup (pk, "Key:"))
-    {
-      err = my_error (GPG_ERR_INV_NAME);
-      goto leave;
-    }
-
-  e = xtrycalloc (1, sizeof *e);
-  if (e == NULL)
-    {
-      err = my_error_from_syserror ();
-      goto leave;
-    }
-
-  e->name = name;
-  e->value = value;
-  e->raw_value = raw_value;
-
   if (pk->first)
     {
       nve_t last;
 
-      if (preserve_order || name == NULL)
+      if (preserve_order || e->name == NULL)
 	last = pk->last;
       else
 	{
 	  /* See if there is already an entry with NAME.  */
-	  last = nvc_lookup (pk, name);
+	  last = nvc_lookup (pk, e->name);
 
 	  /* If so, find the last in that block.  */
 	  if (last)
@@ -423,7 +509,8 @@ _nvc_add (nvc_t pk, char *name, char *value, strlist_t raw_value,
                 {
                   nve_t next = last->next;
 
-                  if (next->name && ascii_strcasecmp (next->name, name) == 0)
+                  if (next->name
+                      && ascii_strcasecmp (next->name, e->name) == 0)
                     last = next;
                   else
                     break;
@@ -450,7 +537,51 @@ _nvc_add (nvc_t pk, char *name, char *value, strlist_t raw_value,
   else
     pk->first = pk->last = e;
 
+  index_entry (pk, e);
   pk->modified = 1;
+}
+
+
+/* Add (NAME, VALUE, RAW_VALUE) to PK.  NAME may be NULL for comments
+   and blank lines.  At least one of VALUE and RAW_VALUE must be
+   given.  If PRESERVE_ORDER is not given, entries with the same name
+   are grouped.  NAME, VALUE and RAW_VALUE is consumed.  */
+static gpg_error_t
+_nvc_add (nvc_t pk, char *name, char *value, strlist_t raw_value,
+	  int preserve_order)
+{
+  gpg_error_t err = 0;
+  nve_t e;
+
+  assert (value || raw_value);
+
+  if (name && ! valid_name (name))
+    {
+      err = my_error (GPG_ERR_INV_NAME);
+      goto leave;
+    }
+
+  if (name
+      && pk->private_key_mode
+      && !ascii_strcasecmp (name, "Key:")
+      && nvc_lookup (pk, "Key:"))
+    {
+      err = my_error (GPG_ERR_INV_NAME);
+      goto leave;
+    }
+
+  e = xtrycalloc (1, sizeof *e);
+  if (e == NULL)
+    {
+      err = my_error_from_syserror ();
+      goto leave;
+    }
+
+  e->name = name;
+  e->value = value;
+  e->raw_value = raw_value;
+
+  link_entry (pk, e, preserve_order);
 
  leave:
   if (err)
@@ -466,6 +597,36 @@ _nvc_add (nvc_t pk, char *name, char *value, strlist_t raw_value,
 }
 
 
+/* Append an entry to PK whose NAME and the RAW_LEN bytes of its raw
+   value at RAW_BUF are both stored in the pool of PK.  NAME may be
+   NULL for comments and blank lines.  */
+static gpg_error_t
+_nvc_add_pooled (nvc_t pk, char *name, char *raw_buf, size_t raw_len)
+{
+  nve_t e;
+
+  if (name && ! valid_name (name))
+    return my_error (GPG_ERR_INV_NAME);
+
+  if (name
+      && pk->private_key_mode
+      && !ascii_strcasecmp (name, "Key:")
+      && nvc_lookup (pk, "Key:"))
+    return my_error (GPG_ERR_INV_NAME);
+
+  e = xtrycalloc (1, sizeof *e);
+  if (e == NULL)
+    return my_error_from_syserror ();
+
+  e->name = name;
+  e->name_in_pool = 1;
+  e->raw_buf = raw_buf;
+  e->raw_len = raw_len;
+  link_entry (pk, e, 1);
+  return 0;
+}
+
+
 /* Add (NAME, VALUE) to PK.  If an entry with NAME already exists, it
    is not updated but the new entry is appended.  */
 gpg_error_t
@@ -530,6 +691,10 @@ nve_set (nvc_t pk, nve_t e, const char *value)
 
   free_strlist_wipe (e->raw_value);
   e->raw_value = NULL;
+  if (e->raw_buf)
+    wipememory (e->raw_buf, e->raw_len);
+  e->raw_buf = NULL;
+  e->raw_len = 0;
   if (e->value)
     wipememory (e->value, strlen (e->value));
   xfree (e->value);
@@ -545,6 +710,8 @@ nve_set (nvc_t pk, nve_t e, const char *value)
 void
 nvc_delete (nvc_t pk, nve_t entry)
 {
+  unindex_entry (pk, entry);
+
   if (entry->prev)
     entry->prev->next = entry->next;
   else
@@ -605,8 +772,8 @@ nvc_lookup (nvc_t pk, const char *name)
   if (!pk)
     return NULL;
 
-  for (entry = pk->first; entry; entry = entry->next)
-    if (entry->name && ascii_strcasecmp (entry->name, name) == 0)
+  for (entry = pk->htable[name_hash (name)]; entry; entry = entry->hnext)
+    if (ascii_strcasecmp (entry->name, name) == 0)
       return entry;
 
   return NULL;
@@ -628,6 +795,15 @@ nve_next (nve_t entry)
 nve_t
 nve_next_value (nve_t entry, const char *name)
 {
+  if (entry->name && !ascii_strcasecmp (entry->name, name))
+    {
+      /* The index keeps entries of the same name in order.  */
+      for (entry = entry->hnext; entry; entry = entry->hnext)
+        if (ascii_strcasecmp (entry->name, name) == 0)
+          return entry;
+      return NULL;
+    }
+
   for (entry = entry->next; entry; entry = entry->next)
     if (entry->name && ascii_strcasecmp (entry->name, name) == 0)
       return entry;
@@ -764,115 +940,133 @@ nvc_set_private_key (nvc_t pk, gcry_sexp_t sexp)
 
 /* Parsing and serialization.  */
 
+/* Parse the first LENGTH bytes in the pool of the new container NVC.
+ * The entries reference their raw values in the pool; the names are
+ * copied to the area behind the parsed data which must provide room
+ * for LENGTH+1 bytes.  */
 static gpg_error_t
-do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
-              int for_private_key)
+parse_pool (nvc_t nvc, size_t length, int *errlinep)
 {
   gpg_error_t err = 0;
-  gpgrt_ssize_t len;
-  char *buf = NULL;
-  size_t buf_len = 0;
+  char *names = nvc->pool + length;
+  char *line, *end, *p, *colon;
+  size_t n, l;
   char *name = NULL;
-  strlist_t raw_value = NULL;
+  char *raw = NULL;
+  size_t rawlen = 0;
 
-  *result = for_private_key? nvc_new_private_key () : nvc_new ();
-  if (*result == NULL)
-    return my_error_from_syserror ();
-
-  if (errlinep)
-    *errlinep = 0;
-  while ((len = es_read_line (stream, &buf, &buf_len, NULL)) > 0)
+  for (line = nvc->pool, n = length; n; line += l, n -= l)
     {
-      char *p;
+      l = line_length (line, n);
+      end = line + l;
       if (errlinep)
 	*errlinep += 1;
 
       /* Skip any whitespace.  */
-      for (p = buf; *p && ascii_isspace (*p); p++)
+      for (p = line; p < end && ascii_isspace (*p); p++)
 	/* Do nothing.  */;
 
-      if (name && (spacep (buf) || *p == 0))
+      if (name && (spacep (line) || p == end))
 	{
 	  /* A continuation.  */
-	  if (append_to_strlist_try (&raw_value, buf) == NULL)
-	    {
-	      err = my_error_from_syserror ();
-	      goto leave;
-	    }
+	  rawlen += l;
 	  continue;
 	}
 
       /* No continuation.  Add the current entry if any.  */
-      if (raw_value)
+      if (raw)
 	{
-	  err = _nvc_add (*result, name, NULL, raw_value, 1);
-          name = NULL;
+	  err = _nvc_add_pooled (nvc, name, raw, rawlen);
 	  if (err)
-	    goto leave;
+	    return err;
 	}
 
       /* And prepare for the next one.  */
       name = NULL;
-      raw_value = NULL;
+      raw = NULL;
 
-      if (*p != 0 && *p != '#')
+      if (p < end && *p != '#')
 	{
-	  char *colon, *value, tmp;
-
-	  colon = strchr (buf, ':');
+	  colon = memchr (line, ':', l);
 	  if (colon == NULL)
-	    {
-	      err = my_error (GPG_ERR_INV_VALUE);
-	      goto leave;
-	    }
-
-	  value = colon + 1;
-	  tmp = *value;
-	  *value = 0;
-	  name = xtrystrdup (p);
-	  *value = tmp;
-
-	  if (name == NULL)
-	    {
-	      err = my_error_from_syserror ();
-	      goto leave;
-	    }
-
-	  if (append_to_strlist_try (&raw_value, value) == NULL)
-	    {
-	      err = my_error_from_syserror ();
-	      goto leave;
-	    }
+	    return my_error (GPG_ERR_INV_VALUE);
+
+	  name = names;
+	  memcpy (names, p, colon + 1 - p);
+	  names += colon + 1 - p;
+	  *names++ = 0;
+	  raw = colon + 1;
+	  rawlen = end - raw;
 	  continue;
 	}
 
-      if (append_to_strlist_try (&raw_value, buf) == NULL)
-	{
-	  err = my_error_from_syserror ();
-	  goto leave;
-	}
+      /* A comment or a blank line.  */
+      raw = line;
+      rawlen = l;
     }
-  if (len < 0)
+
+  /* Add the final entry.  */
+  if (raw)
+    err = _nvc_add_pooled (nvc, name, raw, rawlen);
+
+  return err;
+}
+
+
+/* Parse STREAM into a new container stored at RESULT.  The entire
+ * stream is read into the pool of the container and the entries
+ * reference that buffer; values are only decoded on access.  */
+static gpg_error_t
+do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
+              int for_private_key)
+{
+  gpg_error_t err = 0;
+  nvc_t nvc;
+  membuf_t mb;
+  char buffer[4096];
+  size_t nread, length;
+
+  *result = NULL;
+  if (errlinep)
+    *errlinep = 0;
+
+  nvc = for_private_key? nvc_new_private_key () : nvc_new ();
+  if (nvc == NULL)
+    return my_error_from_syserror ();
+
+  init_membuf (&mb, sizeof buffer);
+  while (!es_read (stream, buffer, sizeof buffer, &nread) && nread)
+    put_membuf (&mb, buffer, nread);
+  wipememory (buffer, sizeof buffer);
+  if (es_ferror (stream))
     {
+      char *p;
+
       err = gpg_error_from_syserror ();
+      p = get_membuf (&mb, &length);
+      if (p)
+        wipememory (p, length);
+      xfree (p);
       goto leave;
     }
 
-  /* Add the final entry.  */
-  if (raw_value)
+  /* Reserve room for the names behind the data.  */
+  length = get_membuf_len (&mb);
+  put_membuf (&mb, NULL, length + 1);
+  nvc->pool = get_membuf (&mb, &nvc->poolsize);
+  if (nvc->pool == NULL)
     {
-      err = _nvc_add (*result, name, NULL, raw_value, 1);
-      name = NULL;
+      err = my_error_from_syserror ();
+      goto leave;
     }
 
+  err = parse_pool (nvc, length, errlinep);
+
  leave:
-  xfree (name);
-  gpgrt_free (buf);
   if (err)
-    {
-      nvc_release (*result);
-      *result = NULL;
-    }
+    nvc_release (nvc);
+  else
+    *result = nvc;
 
   return err;
 }
@@ -915,6 +1109,8 @@ write_one_entry (nve_t entry, estream_t stream)
 
   for (sl = entry->raw_value; sl; sl = sl->next)
     es_fputs (sl->d, stream);
+  if (entry->raw_buf)
+    es_write (stream, entry->raw_buf, entry->raw_len, NULL);
 
   if (es_ferror (stream))
     return my_error_from_syserror ();
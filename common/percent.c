@@ -31,11 +31,49 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <ctype.h>
+#include <string.h>
 #include <assert.h>
 
 #include "util.h"
 
 
+/* The characters escaped by percent_plus_escape; a space is mapped to
+ * a plus sign.  */
+static const char plus_escape_chars[] =
+  "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+  "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f"
+  " +\"%";
+
+static const char hexdigits[] = "0123456789ABCDEF";
+
+
+/* Store the escape sequence for C at P.  */
+static GPGRT_INLINE char *
+put_escape (char *p, unsigned char c)
+{
+  *p++ = '%';
+  *p++ = hexdigits[c >> 4];
+  *p++ = hexdigits[c & 15];
+  return p;
+}
+
+
+/* Return the number of bytes C in (S,N).  */
+static size_t
+count_byte (const unsigned char *s, size_t n, int c)
+{
+  const unsigned char *end = s + n;
+  size_t count = 0;
+
+  while (s < end && (s = memchr (s, c, end - s)))
+    {
+      count++;
+      s++;
+    }
+  return count;
+}
+
+
 /* Create a newly alloced string from STRING with all spaces and
  * control characters converted to plus signs or %xx sequences.  The
  * function returns the new string or NULL in case of a malloc
@@ -52,38 +90,40 @@ percent_plus_escape (const char *string)
 {
   char *buffer, *p;
   const char *s;
-  size_t length;
+  size_t length, n;
 
-  for (length=1, s=string; *s; s++)
+  /* Only the escaped characters need to be looked at individually;
+   * the runs between them are handled by strcspn and memcpy.  */
+  for (length=1, s=string; ; s++)
     {
-      if (*s == '+' || *s == '\"' || *s == '%'
-          || *(const unsigned char *)s < 0x20)
-        length += 3;
-      else
-        length++;
+      n = strcspn (s, plus_escape_chars);
+      length += n;
+      s += n;
+      if (!*s)
+        break;
+      length += (*s == ' ')? 1 : 3;
     }
 
   buffer = p = xtrymalloc (length);
   if (!buffer)
     return NULL;
 
-  for (s=string; *s; s++)
+  for (s=string; ; s++)
     {
-      if (*s == '+' || *s == '\"' || *s == '%'
-          || *(const unsigned char *)s < 0x20)
-        {
-          snprintf (p, 4, "%%%02X", *(unsigned char *)s);
-          p += 3;
-        }
-      else if (*s == ' ')
+      n = strcspn (s, plus_escape_chars);
+      memcpy (p, s, n);
+      p += n;
+      s += n;
+      if (!*s)
+        break;
+      if (*s == ' ')
         *p++ = '+';
       else
-        *p++ = *s;
+        p = put_escape (p, *s);
     }
   *p = 0;
 
   return buffer;
-
 }
 
 
@@ -99,7 +139,8 @@ percent_data_escape (int plus_escape, const char *prefix,
                      const void *data, size_t datalen)
 {
   char *buffer, *p;
-  const unsigned char *s;
+  const unsigned char *s, *end;
+  const unsigned char *nextnul, *nextpct;
   size_t n;
   size_t length = 1;
 
@@ -114,13 +155,19 @@ percent_data_escape (int plus_escape, const char *prefix,
         }
     }
 
-  for (s=data, n=datalen; n; s++, n--)
+  if (plus_escape)
     {
-      if (!*s || *s == '%' || (plus_escape && (*s < ' ' || *s == '+')))
-        length += 3;
-      else
-        length++;
+      for (s=data, n=datalen; n; s++, n--)
+        {
+          if (!*s || *s == '%' || *s < ' ' || *s == '+')
+            length += 3;
+          else
+            length++;
+        }
     }
+  else /* Only Nul and '%' are escaped; let memchr find them.  */
+    length += datalen + 2 * (count_byte (data, datalen, 0)
+                             + count_byte (data, datalen, '%'));
 
   buffer = p = xtrymalloc (length);
   if (!buffer)
@@ -131,38 +178,53 @@ percent_data_escape (int plus_escape, const char *prefix,
       for (s = prefix; *s; s++)
         {
           if (*s == '%' || *s < 0x20)
-            {
-              snprintf (p, 4, "%%%02X", *s);
-              p += 3;
-            }
+            p = put_escape (p, *s);
           else
             *p++ = *s;
         }
     }
 
-  for (s=data, n=datalen; n; s++, n--)
+  if (plus_escape)
     {
-      if (!*s)
+      for (s=data, n=datalen; n; s++, n--)
         {
-          memcpy (p, "%00", 3);
-          p += 3;
-        }
-      else if (*s == '%')
-        {
-          memcpy (p, "%25", 3);
-          p += 3;
-        }
-      else if (plus_escape && *s == ' ')
-        {
-          *p++ = '+';
+          if (*s == ' ')
+            *p++ = '+';
+          else if (!*s || *s == '%' || *s < ' ' || *s == '+')
+            p = put_escape (p, *s);
+          else
+            *p++ = *s;
         }
-      else if (plus_escape && (*s < ' ' || *s == '+'))
+    }
+  else
+    {
+      /* Copy the runs between the next Nul and the next percent
+       * sign in one go.  The positions of both are remembered so
+       * that each byte is scanned only once.  */
+      s = data;
+      end = s + datalen;
+      nextnul = memchr (s, 0, datalen);
+      nextpct = memchr (s, '%', datalen);
+      while (s < end)
         {
-          snprintf (p, 4, "%%%02X", *s);
-          p += 3;
+          const unsigned char *stop = end;
+
+          if (nextnul && nextnul < stop)
+            stop = nextnul;
+          if (nextpct && nextpct < stop)
+            stop = nextpct;
+          memcpy (p, s, stop - s);
+          p += stop - s;
+          s = stop;
+          if (s == end)
+            break;
+          p = put_escape (p, *s);
+          s++;
+          if (stop == nextnul)
+            nextnul = memchr (s, 0, end - s);
+          else
+            nextpct = memchr (s, '%', end - s);
         }
-      else
-        *p++ = *s;
     }
   *p = 0;
 
@@ -178,10 +240,19 @@ static size_t
 do_unescape (unsigned char *buffer, const unsigned char *string,
              int withplus, int nulrepl)
 {
+  const char *reject = withplus? "%+" : "%";
   unsigned char *p = buffer;
+  size_t n;
 
   while (*string)
     {
+      n = strcspn ((const char *)string, reject);
+      memcpy (p, string, n);
+      p += n;
+      string += n;
+      if (!*string)
+        break;
+
       if (*string == '%' && string[1] && string[2])
         {
           string++;
@@ -208,9 +279,16 @@ static size_t
 count_unescape (const unsigned char *string)
 {
   size_t n = 0;
+  size_t span;
 
   while (*string)
     {
+      span = strcspn ((const char *)string, "%");
+      n += span;
+      string += span;
+      if (!*string)
+        break;
+
       if (*string == '%' && string[1] && string[2])
         {
           string++;
@@ -268,11 +346,22 @@ percent_unescape (const char *string, int nulrepl)
 static size_t
 do_unescape_inplace (char *string, int withplus, int nulrepl)
 {
+  const char *reject = withplus? "%+" : "%";
   unsigned char *p, *p0;
+  size_t n;
 
   p = p0 = string;
   while (*string)
     {
+      /* Nothing moves until the first escape.  */
+      n = strcspn (string, reject);
+      if (p != (unsigned char *)string)
+        memmove (p, string, n);
+      p += n;
+      string += n;
+      if (!*string)
+        break;
+
       if (*string == '%' && string[1] && string[2])
         {
           string++;
@@ -64,7 +64,9 @@ struct recsel_expr_s
   unsigned int not:1;   /* Negate operators. */
   unsigned int disjun:1;/* Start of a disjunction.  */
   unsigned int xcase:1; /* String match is case sensitive.  */
+  unsigned int numeric:1; /* OP compares numerical values.  */
   const char *value;    /* (Points into NAME.)  */
+  size_t valuelen;      /* strlen of VALUE.  */
   long numvalue;        /* strtol of VALUE.  */
   char name[1];         /* Name of the property.  */
 };
@@ -106,6 +108,83 @@ find_next_lc (char *string)
 }
 
 
+/* Return the relative cost of evaluating the expression SE.  */
+static int
+expr_cost (recsel_expr_t se)
+{
+  switch (se->op)
+    {
+    case SELECT_NONEMPTY:
+    case SELECT_ISTRUE:
+    case SELECT_EQ:
+    case SELECT_LE:
+    case SELECT_GE:
+    case SELECT_LT:
+    case SELECT_GT:
+      return 0;
+    case SELECT_SAME:
+      return 1;
+    case SELECT_STRLE:
+    case SELECT_STRGE:
+    case SELECT_STRLT:
+    case SELECT_STRGT:
+      return 2;
+    case SELECT_SUB:
+      break;
+    }
+  return 3;
+}
+
+
+/* Reorder the terms of each conjunction in SELECTOR so that the cheap
+ * ones are evaluated first.  This is possible because all terms are
+ * free of side effects and a conjunction is evaluated only until the
+ * first false term.  The sort is stable so that terms of the same
+ * cost keep their order.  Returns the new head of the list.  */
+static recsel_expr_t
+reorder_conjunctions (recsel_expr_t selector)
+{
+  recsel_expr_t head = NULL;
+  recsel_expr_t *tailp = &head;
+  recsel_expr_t group, se, next, *pp;
+  int disjun;
+
+  while (selector)
+    {
+      /* Detach the next conjunction.  */
+      group = selector;
+      disjun = group->disjun;
+      for (se = group; se->next && !se->next->disjun; se = se->next)
+        ;
+      selector = se->next;
+      se->next = NULL;
+
+      /* Insertion sort by cost.  */
+      se = group;
+      group = NULL;
+      for (; se; se = next)
+        {
+          next = se->next;
+          se->disjun = 0;
+          for (pp = &group;
+               *pp && expr_cost (*pp) <= expr_cost (se);
+               pp = &(*pp)->next)
+            ;
+          se->next = *pp;
+          *pp = se;
+        }
+      group->disjun = disjun;
+
+      *tailp = group;
+      for (se = group; se->next; se = se->next)
+        ;
+      tailp = &se->next;
+    }
+
+  return head;
+}
+
+
 /* Parse an expression.  The expression syntax is:
  *
  *   [<lc>] {{<flag>} PROPNAME <op> VALUE [<lc>]}
@@ -164,6 +243,9 @@ find_next_lc (char *string)
  * function and initialize the value of the function to NULL before
  * the first call.  recsel_release needs to be called to free the
  * selector.
+ *
+ * The terms of a conjunction are reordered so that numerical tests
+ * are evaluated before string and substring matches.
  */
 gpg_error_t
 recsel_parse_expr (recsel_expr_t *selector, const char *expression)
@@ -419,7 +501,14 @@ recsel_parse_expr (recsel_expr_t *selector, const char *expression)
       return my_error (GPG_ERR_MISSING_VALUE);
     }
 
+  se->valuelen = strlen (se->value);
   se->numvalue = strtol (se->value, NULL, 0);
+  se->numeric = (se->op == SELECT_ISTRUE
+                 || se->op == SELECT_EQ
+                 || se->op == SELECT_LE
+                 || se->op == SELECT_GE
+                 || se->op == SELECT_LT
+                 || se->op == SELECT_GT);
 
   if (next_lc)
     {
@@ -437,6 +526,7 @@ recsel_parse_expr (recsel_expr_t *selector, const char *expression)
         ;
       se2->next = se_head;
     }
+  *selector = reorder_conjunctions (*selector);
 
   xfree (expr_buffer);
   return 0;
@@ -494,6 +584,23 @@ int
 recsel_select (recsel_expr_t selector,
                const char *(*getval)(void *cookie, const char *propname),
                void *cookie)
+{
+  return recsel_select_ext (selector, getval, NULL, cookie);
+}
+
+
+/* Same as recsel_select but with an additional optional GETNUM
+ * function.  It is called for numerical comparisons and shall return
+ * true and store the value of the property at R_VALUE if the property
+ * has a numerical value.  If it returns false or GETNUM is NULL the
+ * value is taken from GETVAL as usual.  This avoids the formatting
+ * and parsing of numbers for each record.  */
+int
+recsel_select_ext (recsel_expr_t selector,
+                   const char *(*getval)(void *cookie, const char *propname),
+                   int (*getnum)(void *cookie, const char *propname,
+                                 long *r_value),
+                   void *cookie)
 {
   recsel_expr_t se;
   const char *value;
@@ -504,6 +611,21 @@ recsel_select (recsel_expr_t selector,
   se = selector;
   while (se)
     {
+      if (se->numeric && getnum && getnum (cookie, se->name, &numvalue))
+        {
+          switch (se->op)
+            {
+            case SELECT_ISTRUE: result = !!numvalue; break;
+            case SELECT_EQ: result = (numvalue == se->numvalue); break;
+            case SELECT_GT: result = (numvalue >  se->numvalue); break;
+            case SELECT_GE: result = (numvalue >= se->numvalue); break;
+            case SELECT_LT: result = (numvalue <  se->numvalue); break;
+            case SELECT_LE: result = (numvalue <= se->numvalue); break;
+            default: result = 0; break;
+            }
+          goto next;
+        }
+
       value = getval? getval (cookie, se->name) : NULL;
       if (!value)
         value = "";
@@ -516,8 +638,8 @@ recsel_select (recsel_expr_t selector,
       else /* Field has a value.  */
         {
           valuelen = strlen (value);
-          numvalue = strtol (value, NULL, 0);
-          selen = strlen (se->value);
+          numvalue = se->numeric? strtol (value, NULL, 0) : 0;
+          selen = se->valuelen;
 
           switch (se->op)
             {
@@ -581,6 +703,7 @@ recsel_select (recsel_expr_t selector,
             }
         }
 
+    next:
       if (se->not)
         result = !result;
 
@@ -38,6 +38,12 @@ void recsel_dump (recsel_expr_t selector);
 int recsel_select (recsel_expr_t selector,
                    const char *(*getval)(void *cookie, const char *propname),
                    void *cookie);
+int recsel_select_ext (recsel_expr_t selector,
+                       const char *(*getval)(void *cookie,
+                                             const char *propname),
+                       int (*getnum)(void *cookie, const char *propname,
+                                     long *r_value),
+                       void *cookie);
 
 
 #endif /*GNUPG_COMMON_RECSEL_H*/
@@ -444,6 +444,118 @@ hash_algo_from_sigval (const unsigned char *sigval)
 }
 
 
+/* Store the length prefix "N:" at P and return the new end.  */
+static unsigned char *
+put_canon_len (unsigned char *p, size_t n)
+{
+  unsigned char digits[24];
+  int i = 0;
+
+  do
+    digits[i++] = '0' + (n % 10);
+  while ((n /= 10));
+  while (i)
+    *p++ = digits[--i];
+  *p++ = ':';
+  return p;
+}
+
+
+/* Return the number of decimal digits of N.  */
+static size_t
+count_canon_len (size_t n)
+{
+  size_t i = 1;
+
+  while ((n /= 10))
+    i++;
+  return i;
+}
+
+
+/* Build a canonical S-expression from the template TMPL and the
+ * values ARGS.  TMPL is a canonical S-expression where each value is
+ * replaced by one of the CANON_SEXP_BYTES, CANON_SEXP_UINT or
+ * CANON_SEXP_STRING markers; the markers are consumed from ARGS in
+ * order.  Using the predefined templates from util.h this builds the
+ * S-expressions without any format parsing.  Returns a newly
+ * allocated buffer or NULL with ERRNO set.  If R_LEN is not NULL the
+ * length of the canonical S-expression is stored there.  */
+unsigned char *
+make_canon_sexp_from_template (const char *tmpl,
+                               const struct canon_sexp_value_s *args,
+                               size_t *r_len)
+{
+  const unsigned char *t;
+  const struct canon_sexp_value_s *a;
+  const unsigned char *v;
+  size_t vlen, length;
+  int extra;
+  unsigned char *buffer, *p;
+
+  /* First pass: compute the length.  */
+  length = 0;
+  for (t = (const unsigned char *)tmpl, a = args; *t; t++)
+    {
+      if (*t > *CANON_SEXP_STRING)
+        {
+          length++;
+          continue;
+        }
+      v = a->data;
+      vlen = *t == *CANON_SEXP_STRING? strlen (a->data) : a->len;
+      a++;
+      extra = 0;
+      if (*t == *CANON_SEXP_UINT)
+        {
+          for (; vlen && !*v; vlen--, v++)
+            ;
+          if (!vlen || (*v & 0x80))
+            extra = 1;
+        }
+      length += count_canon_len (vlen + extra) + 1 + vlen + extra;
+    }
+
+  buffer = p = xtrymalloc (length + 1);
+  if (!buffer)
+    return NULL;
+
+  /* Second pass: fill in the layout.  */
+  for (t = (const unsigned char *)tmpl, a = args; *t; t++)
+    {
+      if (*t > *CANON_SEXP_STRING)
+        {
+          *p++ = *t;
+          continue;
+        }
+      v = a->data;
+      vlen = *t == *CANON_SEXP_STRING? strlen (a->data) : a->len;
+      a++;
+      extra = 0;
+      if (*t == *CANON_SEXP_UINT)
+        {
+          /* Remove leading zeroes and insert a single one if the
+           * number would be empty or interpreted as negative.  */
+          for (; vlen && !*v; vlen--, v++)
+            ;
+          if (!vlen || (*v & 0x80))
+            extra = 1;
+        }
+      p = put_canon_len (p, vlen + extra);
+      if (extra)
+        *p++ = 0;
+      memcpy (p, v, vlen);
+      p += vlen;
+    }
+  *p = 0;
+
+  if (r_len)
+    *r_len = p - buffer;
+
+  return buffer;
+}
+
+
 /* Create a public key S-expression for an RSA public key from the
    modulus M with length MLEN and the public exponent E with length
    ELEN.  Returns a newly allocated buffer of NULL in case of a memory
@@ -454,58 +566,13 @@ make_canon_sexp_from_rsa_pk (const void *m_arg, size_t mlen,
                              const void *e_arg, size_t elen,
                              size_t *r_len)
 {
-  const unsigned char *m = m_arg;
-  const unsigned char *e = e_arg;
-  int m_extra = 0;
-  int e_extra = 0;
-  char mlen_str[35];
-  char elen_str[35];
-  unsigned char *keybuf, *p;
-  const char part1[] = "(10:public-key(3:rsa(1:n";
-  const char part2[] = ")(1:e";
-  const char part3[] = ")))";
-
-  /* Remove leading zeroes.  */
-  for (; mlen && !*m; mlen--, m++)
-    ;
-  for (; elen && !*e; elen--, e++)
-    ;
-
-  /* Insert a leading zero if the number would be zero or interpreted
-     as negative.  */
-  if (!mlen || (m[0] & 0x80))
-    m_extra = 1;
-  if (!elen || (e[0] & 0x80))
-    e_extra = 1;
-
-  /* Build the S-expression.  */
-  snprintf (mlen_str, sizeof mlen_str, "%u:", (unsigned int)mlen+m_extra);
-  snprintf (elen_str, sizeof elen_str, "%u:", (unsigned int)elen+e_extra);
-
-  keybuf = xtrymalloc (strlen (part1) + strlen (mlen_str) + mlen + m_extra
-                       + strlen (part2) + strlen (elen_str) + elen + e_extra
-                       + strlen (part3) + 1);
-  if (!keybuf)
-    return NULL;
-
-  p = stpcpy (keybuf, part1);
-  p = stpcpy (p, mlen_str);
-  if (m_extra)
-    *p++ = 0;
-  memcpy (p, m, mlen);
-  p += mlen;
-  p = stpcpy (p, part2);
-  p = stpcpy (p, elen_str);
-  if (e_extra)
-    *p++ = 0;
-  memcpy (p, e, elen);
-  p += elen;
-  p = stpcpy (p, part3);
-
-  if (r_len)
-    *r_len = p - keybuf;
+  struct canon_sexp_value_s args[2];
 
-  return keybuf;
+  args[0].data = m_arg;
+  args[0].len = mlen;
+  args[1].data = e_arg;
+  args[1].len = elen;
+  return make_canon_sexp_from_template (CANON_SEXP_RSA_PUBKEY, args, r_len);
 }
 
 
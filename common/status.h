@@ -90,6 +90,7 @@ enum
     STATUS_BEGIN_ENCRYPTION,
     STATUS_END_ENCRYPTION,
     STATUS_BEGIN_SIGNING,
+    STATUS_COMPRESS_PROBE,
 
     STATUS_DELETE_PROBLEM,
 
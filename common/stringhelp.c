@@ -297,26 +297,20 @@ trim_trailing_spaces( char *string )
 }
 
 
+/* Remove the trailing characters from TRIMCHARS from the LEN bytes
+ * at LINE and return the new length.  The line is scanned backwards
+ * so that long lines don't need to be inspected entirely.  */
 unsigned
 trim_trailing_chars( byte *line, unsigned len, const char *trimchars )
 {
-    byte *p, *mark;
-    unsigned n;
+    unsigned n = len;
 
-    for(mark=NULL, p=line, n=0; n < len; n++, p++ ) {
-	if( strchr(trimchars, *p ) ) {
-	    if( !mark )
-		mark = p;
-	}
-	else
-	    mark = NULL;
-    }
+    while( n && strchr(trimchars, line[n-1] ) )
+	n--;
 
-    if( mark ) {
-	*mark = 0;
-	return mark - line;
-    }
-    return len;
+    if( n < len )
+	line[n] = 0;
+    return n;
 }
 
 /****************
@@ -332,22 +326,9 @@ size_t
 length_sans_trailing_chars (const unsigned char *line, size_t len,
                             const char *trimchars )
 {
-  const unsigned char *p, *mark;
-  size_t n;
-
-  for( mark=NULL, p=line, n=0; n < len; n++, p++ )
-    {
-      if (strchr (trimchars, *p ))
-        {
-          if( !mark )
-            mark = p;
-        }
-      else
-        mark = NULL;
-    }
+  while (len && strchr (trimchars, line[len-1]))
+    len--;
 
-  if (mark)
-    return mark - line;
   return len;
 }
 
@@ -954,23 +935,56 @@ ascii_strcmp( const char *a, const char *b )
 }
 
 
+/* Find the first occurrence of NEEDLE in HAYSTACK while ignoring the
+ * case of ASCII letters.  Candidate positions are located with
+ * memchr for both cases of the first needle byte; memchr is highly
+ * optimized in any decent libc and thus we avoid the byte-by-byte
+ * compare at each position of the haystack.  */
 void *
 ascii_memcasemem (const void *haystack, size_t nhaystack,
                   const void *needle, size_t nneedle)
 {
+  const char *a, *end, *lo, *up, *p;
+  const char *n = needle;
+  int c1, c2;
 
   if (!nneedle)
     return (void*)haystack; /* finding an empty needle is really easy */
-  if (nneedle <= nhaystack)
+  if (nneedle > nhaystack)
+    return NULL;
+
+  a = haystack;
+  end = a + nhaystack - nneedle + 1;  /* Last possible start plus one.  */
+  c1 = ascii_tolower (*(const unsigned char *)n);
+  c2 = ascii_toupper (*(const unsigned char *)n);
+
+  if (c1 == c2)
     {
-      const char *a = haystack;
-      const char *b = a + nhaystack - nneedle;
+      while (a < end && (p = memchr (a, c1, end - a)))
+        {
+          if (!ascii_memcasecmp (p+1, n+1, nneedle-1))
+            return (void *)p;
+          a = p + 1;
+        }
+      return NULL;
+    }
 
-      for (; a <= b; a++)
+  lo = memchr (a, c1, end - a);
+  up = memchr (a, c2, end - a);
+  while (lo || up)
+    {
+      if (lo && (!up || lo < up))
+        {
+          p = lo;
+          lo = p + 1 < end? memchr (p + 1, c1, end - p - 1) : NULL;
+        }
+      else
         {
-          if ( !ascii_memcasecmp (a, needle, nneedle) )
-            return (void *)a;
+          p = up;
+          up = p + 1 < end? memchr (p + 1, c2, end - p - 1) : NULL;
         }
+      if (!ascii_memcasecmp (p+1, n+1, nneedle-1))
+        return (void *)p;
     }
   return NULL;
 }
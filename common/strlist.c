@@ -199,7 +199,8 @@ tokenize_to_strlist (strlist_t *list, const char *string, const char *delim)
   const char *s, *se;
   size_t n;
   strlist_t newlist = NULL;
-  strlist_t tail;
+  strlist_t tail = NULL;
+  strlist_t sl;
 
   s = string;
   do
@@ -211,28 +212,24 @@ tokenize_to_strlist (strlist_t *list, const char *string, const char *delim)
         n = strlen (s);
       if (!n)
         continue;  /* Skip empty string.  */
-      tail = do_append_to_strlist (&newlist, s, n);
-      if (!tail)
+      /* Appending to TAIL avoids walking the list for each token.  */
+      sl = do_append_to_strlist (tail? &tail : &newlist, s, n);
+      if (!sl)
         {
           free_strlist (newlist);
           return NULL;
         }
-      trim_spaces (tail->d);
-      if (!*tail->d)  /* Remove new but empty item from the list.  */
+      trim_spaces (sl->d);
+      if (!*sl->d)  /* Remove new but empty item from the list.  */
         {
-          tail = strlist_prev (newlist, tail);
+          free_strlist (sl);
           if (tail)
-            {
-              free_strlist (tail->next);
-              tail->next = NULL;
-            }
-          else if (newlist)
-            {
-              free_strlist (newlist);
-              newlist = NULL;
-            }
+            tail->next = NULL;
+          else
+            newlist = NULL;
           continue;
         }
+      tail = sl;
     }
   while (se && (s = se + 1));
 
@@ -248,11 +245,7 @@ tokenize_to_strlist (strlist_t *list, const char *string, const char *delim)
   if (!*list)
     *list = newlist;
   else
-    {
-      for (tail = *list; tail->next; tail = tail->next)
-        ;
-      tail->next = newlist;
-    }
+    strlist_last (*list)->next = newlist;
   return newlist;
 }
 
@@ -272,7 +265,7 @@ strlist_copy (strlist_t list)
       strcpy(sl->d, list->d);
       sl->next = NULL;
       *last = sl;
-      last = &sl;
+      last = &sl->next;
     }
   return newlist;
 }
@@ -544,6 +544,26 @@ gnupg_usleep (unsigned int usecs)
 }
 
 
+/* Return the number of online processors.  This is used to size
+ * worker thread pools.  Returns at least 1.  */
+unsigned int
+gnupg_get_ncpus (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  SYSTEM_INFO si;
+
+  GetSystemInfo (&si);
+  return si.dwNumberOfProcessors? si.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return n > 0? (unsigned int)n : 1;
+#else
+  return 1;
+#endif
+}
+
+
 /* This function is a NOP for POSIX systems but required under Windows
    as the file handles as returned by OS calls (like CreateFile) are
    different from the libc file descriptors (like open). This function
@@ -1878,6 +1898,103 @@ gnupg_inotify_watch_socket (int *r_fd, const char *socket_name)
 }
 
 
+/* Store a new non-blocking inotify file handle for DIRNAME at R_FD or
+ * return an error code.  This file descriptor watches all changes of
+ * files in DIRNAME; use gnupg_inotify_changed to check for them.  */
+gpg_error_t
+gnupg_inotify_watch_dir (int *r_fd, const char *dirname)
+{
+#if HAVE_INOTIFY_INIT
+  gpg_error_t err;
+  int fd, flags;
+
+  *r_fd = -1;
+
+  if (!dirname)
+    return my_error (GPG_ERR_INV_VALUE);
+
+  fd = inotify_init ();
+  if (fd == -1)
+    return my_error_from_syserror ();
+
+  flags = fcntl (fd, F_GETFL);
+  if (flags == -1 || fcntl (fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+      err = my_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+
+  if (inotify_add_watch (fd, dirname,
+                         (IN_CREATE|IN_DELETE|IN_MODIFY|IN_ATTRIB
+                          |IN_CLOSE_WRITE|IN_MOVED_FROM|IN_MOVED_TO
+                          |IN_DELETE_SELF|IN_MOVE_SELF)) == -1)
+    {
+      err = my_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+
+  *r_fd = fd;
+  return 0;
+#else /*!HAVE_INOTIFY_INIT*/
+
+  (void)dirname;
+  *r_fd = -1;
+  return my_error (GPG_ERR_NOT_SUPPORTED);
+
+#endif /*!HAVE_INOTIFY_INIT*/
+}
+
+
+/* Consume all pending events of the inotify file handle FD created by
+ * gnupg_inotify_watch_dir.  Returns 0 if there was no event, 1 if a
+ * file in the directory may have changed and 2 if the directory
+ * itself is not watched anymore; in the latter case the caller should
+ * close FD.  This function never blocks.  */
+int
+gnupg_inotify_changed (int fd)
+{
+#if HAVE_INOTIFY_INIT
+  union {
+    struct inotify_event ev;
+    char _buf[sizeof (struct inotify_event) + 255 + 1];
+  } buf;
+  struct inotify_event *evp;
+  int changed = 0;
+  ssize_t n;
+
+  for (;;)
+    {
+      n = read (fd, &buf, sizeof buf);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      if (n <= 0)
+        return 2;
+      changed = 1;
+      evp = &buf.ev;
+      while (n >= sizeof (struct inotify_event))
+        {
+          if ((evp->mask & (IN_DELETE_SELF|IN_MOVE_SELF
+                            |IN_IGNORED|IN_UNMOUNT)))
+            return 2;
+          n -= sizeof (*evp) + evp->len;
+          evp = (struct inotify_event *)(void *)
+            ((char *)evp + sizeof (*evp) + evp->len);
+        }
+    }
+  return changed;
+#else /*!HAVE_INOTIFY_INIT*/
+
+  (void)fd;
+  return 2;
+
+#endif /*!HAVE_INOTIFY_INIT*/
+}
+
+
 /* Read an inotify event and return true if it matches NAME or if it
  * sees an IN_DELETE_SELF event for the directory of NAME.  */
 int
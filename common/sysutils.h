@@ -82,6 +82,7 @@ unsigned int get_uint_nonce (void);
 /*int check_permissions (const char *path,int extension,int checkonly);*/
 void gnupg_sleep (unsigned int seconds);
 void gnupg_usleep (unsigned int usecs);
+unsigned int gnupg_get_ncpus (void);
 int translate_sys2libc_fd_int (int fd, int for_write);
 gpg_error_t gnupg_parse_fdstr (const char *fdstr, es_syshd_t *r_syshd);
 int check_special_filename (const char *fname, int for_write, int notranslate);
@@ -118,6 +119,8 @@ int gnupg_fd_valid (int fd);
 gpg_error_t gnupg_inotify_watch_delete_self (int *r_fd, const char *fname);
 gpg_error_t gnupg_inotify_watch_socket (int *r_fd, const char *socket_name);
 int gnupg_inotify_has_name (int fd, const char *name);
+gpg_error_t gnupg_inotify_watch_dir (int *r_fd, const char *dirname);
+int gnupg_inotify_changed (int fd);
 
 estream_t open_stream_nc (gnupg_fd_t fd, const char *mode);
 
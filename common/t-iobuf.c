@@ -122,6 +122,58 @@ double_filter (void *opaque, int control,
   return 0;
 }
 
+/* Convert lowercase letters to uppercase.  This filter supports
+   lent buffers, in which case it works in place.  */
+static int
+upcase_filter (void *opaque, int control,
+               iobuf_t chain, byte *buf, size_t *len)
+{
+  int *lent_count = opaque;
+
+  if (control == IOBUFCTRL_DESC)
+    {
+      mem2str (buf, "upcase_filter", *len);
+    }
+  else if (control == IOBUFCTRL_LEND && !buf)
+    {
+      *len = 1;
+    }
+  else if (control == IOBUFCTRL_LEND)
+    {
+      size_t i;
+
+      (*lent_count)++;
+      for (i = 0; i < *len; i++)
+        buf[i] = ascii_toupper (buf[i]);
+      return iobuf_write_lent (chain, buf, *len);
+    }
+  else if (control == IOBUFCTRL_FLUSH)
+    {
+      size_t i;
+      int rc;
+
+      for (i = 0; i < *len; i++)
+        if ((rc = iobuf_writebyte (chain, ascii_toupper (buf[i]))))
+          return rc;
+    }
+
+  return 0;
+}
+
+/* Return an endless stream of 'x'.  */
+static int
+x_filter (void *opaque, int control,
+          iobuf_t chain, byte *buf, size_t *len)
+{
+  (void) opaque;
+  (void) chain;
+
+  if (control == IOBUFCTRL_UNDERFLOW)
+    memset (buf, 'x', *len);
+
+  return 0;
+}
+
 struct content_filter_state
 {
   int pos;
@@ -436,5 +488,225 @@ main (int argc, char *argv[])
     iobuf_close (iobuf);
   }
 
+  /* Check that a lent buffer is processed in place and that an
+     ordinary buffer is not modified.  */
+  {
+    iobuf_t iobuf;
+    int rc;
+    int lent_count = 0;
+    char content[4096];
+    char *result;
+    int i, n;
+
+    for (i = 0; i < sizeof content; i++)
+      content[i] = 'a' + (i % 26);
+
+    iobuf = iobuf_temp ();
+    assert (iobuf);
+    rc = iobuf_push_filter (iobuf, upcase_filter, &lent_count);
+    assert (rc == 0);
+
+    rc = iobuf_write (iobuf, content, sizeof content);
+    assert (rc == 0);
+    assert (content[0] == 'a' && content[1] == 'b');
+
+    rc = iobuf_write_lent (iobuf, content, sizeof content);
+    assert (rc == 0);
+    assert (lent_count);
+    assert (content[0] == 'A');
+
+    result = xmalloc (2 * sizeof content);
+    n = iobuf_temp_to_buffer (iobuf, result, 2 * sizeof content);
+    assert (n == 2 * sizeof content);
+    for (i = 0; i < n; i++)
+      assert (result[i] == 'A' + ((i % sizeof content) % 26));
+    free (result);
+
+    iobuf_close (iobuf);
+  }
+
+  /* Check that the buffer of a filter which always fills the buffer
+     is enlarged and that the high-water mark is reported.  */
+  {
+    iobuf_t iobuf;
+    int rc;
+    int i;
+    size_t hwm;
+    size_t initial_size;
+
+    iobuf = iobuf_temp_with_content ("a", 1);
+    rc = iobuf_push_filter (iobuf, x_filter, NULL);
+    assert (rc == 0);
+    /* The buffer size is adapted to the small temp buffer.  */
+    initial_size = iobuf->d.size;
+    assert (initial_size < iobuf_set_buffer_size (0) * 1024);
+
+    for (i = 0; i < 1024 * 1024; i++)
+      assert (iobuf_get (iobuf) == 'x');
+    assert (iobuf->d.size > initial_size);
+
+    rc = iobuf_ioctl (iobuf, IOBUF_IOCTL_BUFFER_HWM, 0, &hwm);
+    assert (rc == 0);
+    assert (hwm > initial_size && hwm <= iobuf->d.size);
+
+    iobuf_close (iobuf);
+  }
+
+  /* Read a large file using the mmap mode.  */
+  {
+    const char *fname = "t-iobuf-mmap.tmp";
+    FILE *fp;
+    iobuf_t iobuf;
+    size_t filelen = 3 * 1024 * 1024 + 17;
+    char *buffer;
+    byte peekbuf[8];
+    size_t i, total;
+    int n;
+
+    buffer = xmalloc (65536);
+    fp = fopen (fname, "wb");
+    assert (fp);
+    for (i = 0; i < filelen; i++)
+      putc ((i % 251), fp);
+    fclose (fp);
+
+    iobuf_set_mmap_mode (1);
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+    assert (iobuf_get_filelength (iobuf) == filelen);
+
+    n = iobuf_peek (iobuf, peekbuf, sizeof peekbuf);
+    assert (n == sizeof peekbuf);
+    assert (peekbuf[0] == 0 && peekbuf[7] == 7);
+
+    total = 0;
+    while ((n = iobuf_read (iobuf, buffer, 65536 - 3)) != -1)
+      {
+        for (i = 0; i < n; i++)
+          assert ((byte)buffer[i] == ((total + i) % 251));
+        total += n;
+      }
+    assert (total == filelen);
+    iobuf_close (iobuf);
+    iobuf_set_mmap_mode (0);
+    remove (fname);
+    free (buffer);
+  }
+
+  /* Write and read a file using the io_uring mode.  Without kernel
+     support the usual code is used.  */
+  {
+    const char *fname = "t-iobuf-uring.tmp";
+    iobuf_t iobuf;
+    size_t filelen = 1024 * 1024 + 4711;
+    char *buffer;
+    byte peekbuf[8];
+    size_t i, total;
+    int n;
+
+    buffer = xmalloc (65536);
+    iobuf_set_uring_mode (1);
+    iobuf = iobuf_create (fname, 0);
+    assert (iobuf);
+    for (total = 0; total < filelen; total += n)
+      {
+        n = filelen - total < 10000? filelen - total : 10000;
+        for (i = 0; i < n; i++)
+          buffer[i] = ((total + i) % 251);
+        assert (!iobuf_write (iobuf, buffer, n));
+      }
+    assert (!iobuf_close (iobuf));
+
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+    assert (iobuf_get_filelength (iobuf) == filelen);
+
+    n = iobuf_peek (iobuf, peekbuf, sizeof peekbuf);
+    assert (n == sizeof peekbuf);
+    assert (peekbuf[0] == 0 && peekbuf[7] == 7);
+
+    total = 0;
+    while ((n = iobuf_read (iobuf, buffer, 65536 - 3)) != -1)
+      {
+        for (i = 0; i < n; i++)
+          assert ((byte)buffer[i] == ((total + i) % 251));
+        total += n;
+      }
+    assert (total == filelen);
+    iobuf_close (iobuf);
+    iobuf_set_uring_mode (0);
+    remove (fname);
+    free (buffer);
+  }
+
+  /* Write a large stream with small writes in partial body length
+     mode, check that large chunks are used, and read it back.  */
+  {
+    iobuf_t iobuf, inp;
+    byte piece[100];
+    size_t npieces = 40000;
+    size_t initial_size, i, pos, total, outlen;
+    byte *out;
+    int nchunks;
+    int c;
+
+    iobuf = iobuf_temp ();
+    iobuf_set_partial_body_length_mode (iobuf, 1);
+    initial_size = iobuf->d.size;
+    for (i = 0; i < npieces; i++)
+      {
+        memset (piece, i % 251, sizeof piece);
+        assert (!iobuf_write (iobuf, piece, sizeof piece));
+      }
+    /* The buffer of the block filter has been enlarged.  */
+    assert (iobuf->d.size > initial_size);
+    iobuf_set_partial_body_length_mode (iobuf, 0);
+
+    out = iobuf_get_temp_buffer (iobuf);
+    outlen = iobuf_get_temp_length (iobuf);
+
+    /* Walk the length headers.  */
+    nchunks = 0;
+    for (pos = 0; pos < outlen; )
+      {
+        c = out[pos++];
+        if (c >= 224 && c < 255)
+          {
+            pos += 1 << (c & 0x1f);
+            nchunks++;
+          }
+        else
+          {
+            if (c < 192)
+              pos += c;
+            else if (c < 224)
+              {
+                pos += ((c - 192) << 8) + out[pos] + 192 + 1;
+              }
+            else
+              {
+                pos += ((out[pos] << 24) | (out[pos+1] << 16)
+                        | (out[pos+2] << 8) | out[pos+3]) + 4;
+              }
+            break;
+          }
+      }
+    assert (pos == outlen);
+    assert (nchunks < npieces * sizeof piece / (64 * 1024));
+
+    inp = iobuf_temp_with_content ((char *)out, outlen);
+    iobuf_close (iobuf);
+    iobuf = inp;
+    iobuf_set_partial_body_length_mode (iobuf, iobuf_get (iobuf));
+    total = 0;
+    while ((c = iobuf_get (iobuf)) != -1)
+      {
+        assert (c == (total / sizeof piece) % 251);
+        total++;
+      }
+    assert (total == npieces * sizeof piece);
+    iobuf_close (iobuf);
+  }
+
   return 0;
 }
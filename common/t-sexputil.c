@@ -498,6 +498,79 @@ test_ecc_uncompress (void)
 
 
 
+/* Check that the templates yield the same as gcry_sexp_build.  */
+static void
+test_make_canon_sexp_from_template (void)
+{
+  static struct {
+    const char *tmpl;
+    const char *format;
+  } tests[] = {
+    { CANON_SEXP_RSA_SIGVAL,   "(sig-val(rsa(s%b)))" },
+    { CANON_SEXP_ECDSA_SIGVAL, "(sig-val(ecdsa(r%b)(s%b)))" },
+    { CANON_SEXP_EDDSA_SIGVAL, "(sig-val(eddsa(r%b)(s%b)))" },
+    { CANON_SEXP_ECC_PUBKEY,   "(public-key(ecc(curve%s)(q%b)))" },
+    { NULL }
+  };
+  static const unsigned char value[300] = { 0, 0, 0x81, 0x42 };
+  static const size_t lengths[] = { 0, 1, 9, 10, 99, 100, 300 };
+  struct canon_sexp_value_s args[2];
+  gpg_error_t err;
+  gcry_sexp_t sexp;
+  unsigned char *abuf, *bbuf;
+  size_t abuflen, bbuflen;
+  int idx, i;
+
+  for (idx=0; tests[idx].tmpl; idx++)
+    for (i=0; i < DIM (lengths); i++)
+      {
+        if (idx == 3)
+          {
+            args[0].data = "Ed25519";
+            args[1].data = value;
+            args[1].len = lengths[i];
+            err = gcry_sexp_build (&sexp, NULL, tests[idx].format,
+                                   "Ed25519", (int)lengths[i], value);
+          }
+        else
+          {
+            args[0].data = value;
+            args[0].len = lengths[i];
+            args[1].data = value + 1;
+            args[1].len = lengths[i] / 2;
+            err = gcry_sexp_build (&sexp, NULL, tests[idx].format,
+                                   (int)lengths[i], value,
+                                   (int)lengths[i] / 2, value + 1);
+          }
+        if (err)
+          {
+            fprintf (stderr, "%s:%d: %s\n", __FILE__, __LINE__,
+                     gpg_strerror (err));
+            exit (1);
+          }
+        err = make_canon_sexp (sexp, &abuf, &abuflen);
+        gcry_sexp_release (sexp);
+        if (err)
+          {
+            fprintf (stderr, "%s:%d: %s\n", __FILE__, __LINE__,
+                     gpg_strerror (err));
+            exit (1);
+          }
+        bbuf = make_canon_sexp_from_template (tests[idx].tmpl, args,
+                                              &bbuflen);
+        if (!bbuf)
+          {
+            fprintf (stderr, "%s:%d: out of core\n", __FILE__, __LINE__);
+            exit (1);
+          }
+        if (abuflen != bbuflen || memcmp (abuf, bbuf, abuflen))
+          fail (idx);
+        xfree (abuf);
+        xfree (bbuf);
+      }
+}
+
+
 
 int
 main (int argc, char **argv)
@@ -507,6 +580,7 @@ main (int argc, char **argv)
 
   test_hash_algo_from_sigval ();
   test_make_canon_sexp_from_rsa_pk ();
+  test_make_canon_sexp_from_template ();
   test_cmp_canon_sexp ();
   test_ecc_uncompress ();
 
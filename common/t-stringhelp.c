@@ -1295,6 +1295,88 @@ test_substitute_envvars (void)
 }
 
 
+static void
+test_ascii_memcasemem (void)
+{
+  struct {
+    const char *haystack;
+    const char *needle;
+    int offset;  /* Expected offset or -1 for no match.  */
+  } tests[] = {
+    { "foo bar", "foo", 0 },
+    { "foo bar", "BAR", 4 },
+    { "Foo BaR", "bar", 4 },
+    { "aaaaAB", "aab", 3 },
+    { "xAxaxaB", "Ab", 5 },
+    { "<joe@example.org>", "@EXAMPLE.org", 4 },
+    { "<joe@example.org>", "ORG>", 13 },
+    { "<joe@example.org>", "org>x", -1 },
+    { "foo bar", "baz", -1 },
+    { "foo bar", "foo bar baz", -1 },
+    { "12345", "345", 2 },
+    { "12345", "346", -1 },
+    { "foo", "", 0 },
+    { "", "", 0 },
+    { "", "a", -1 }
+  };
+  int idx;
+  const char *res;
+
+  for (idx=0; idx < DIM(tests); idx++)
+    {
+      res = ascii_memcasemem (tests[idx].haystack,
+                              strlen (tests[idx].haystack),
+                              tests[idx].needle,
+                              strlen (tests[idx].needle));
+      if (tests[idx].offset == -1)
+        {
+          if (res)
+            fail (idx);
+        }
+      else if (!res || res - tests[idx].haystack != tests[idx].offset)
+        fail (idx);
+    }
+}
+
+
+static void
+test_trim_trailing_chars (void)
+{
+  struct {
+    const char *string;
+    unsigned int length;  /* Expected length.  */
+  } tests[] = {
+    { "", 0 },
+    { " ", 0 },
+    { "\r\n", 0 },
+    { "foo", 3 },
+    { "foo \t\r\n", 3 },
+    { " \tfoo", 5 },
+    { "foo bar \r\n", 7 },
+    { "foo\r\nbar \n", 8 },
+    { "foo \t bar", 9 }
+  };
+  int idx;
+  char buffer[64];
+  unsigned int len;
+
+  for (idx=0; idx < DIM(tests); idx++)
+    {
+      len = strlen (tests[idx].string);
+      if (length_sans_trailing_chars ((const unsigned char *)tests[idx].string,
+                                      len, " \t\r\n") != tests[idx].length)
+        fail (idx);
+      strcpy (buffer, tests[idx].string);
+      if (trim_trailing_chars ((unsigned char *)buffer, len, " \t\r\n")
+          != tests[idx].length)
+        fail (idx);
+      if (strncmp (buffer, tests[idx].string, tests[idx].length)
+          || buffer[tests[idx].length])
+        fail (idx);
+    }
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -1315,6 +1397,8 @@ main (int argc, char **argv)
   test_compare_version_strings ();
   test_format_text ();
   test_substitute_envvars ();
+  test_ascii_memcasemem ();
+  test_trim_trailing_chars ();
 
   xfree (home_buffer);
   return !!errcount;
@@ -72,6 +72,20 @@ test_gnupg_tmpfile (void)
 
 
 
+static void
+test_gnupg_get_ncpus (void)
+{
+  unsigned int n;
+
+  n = gnupg_get_ncpus ();
+  if (!n)
+    fail (0);
+  if (verbose)
+    printf ("number of CPUs: %u\n", n);
+}
+
+
+
 int
 main (int argc, char **argv)
 {
@@ -79,6 +93,7 @@ main (int argc, char **argv)
     verbose = 1;
 
   test_gnupg_tmpfile ();
+  test_gnupg_get_ncpus ();
   /* Fixme: Add tests for setenv and unsetenv.  */
 
   return !!errcount;
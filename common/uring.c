@@ -0,0 +1,615 @@
+/* uring.c - A minimal io_uring wrapper
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This module allows to keep several reads and writes on regular
+ * files in flight using the Linux io_uring interface.  The system
+ * calls are used directly so that no extra library is required.  If
+ * io_uring is not available at build time or is not supported or
+ * disabled by the running kernel, gnupg_uring_new returns NULL and
+ * the callers are expected to use their portable code.  The rings
+ * are meant to be used by a single thread.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_LINUX_IO_URING_H
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+# if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) \
+     && defined(IORING_FEAT_RW_CUR_POS)
+#  define USE_URING 1
+# endif
+#endif
+
+#include "util.h"
+#include "uring.h"
+
+
+/* The number of slots and their size used by gnupg_uring_copy.  */
+#define COPY_SLOTS 4
+#define COPY_CHUNK (128*1024)
+
+
+#ifdef USE_URING
+
+struct gnupg_uring_s
+{
+  int fd;                       /* The ring's file descriptor.  */
+  unsigned int queued;          /* Prepared but not yet submitted.  */
+  unsigned int pending;         /* Submitted but not yet reaped.  */
+  unsigned int sq_entries;
+  unsigned int cq_entries;
+
+  void *ring_ptr;               /* The mapping of the SQ and the CQ.  */
+  size_t ring_len;
+  struct io_uring_sqe *sqes;    /* The mapping of the SQ entries.  */
+  size_t sqes_len;
+
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+/* Set if the kernel does not support io_uring; we then do not try
+ * again.  */
+static int uring_unavailable;
+
+
+static int
+sys_io_uring_setup (unsigned int entries, struct io_uring_params *p)
+{
+  return syscall (__NR_io_uring_setup, entries, p);
+}
+
+
+static int
+sys_io_uring_enter (int fd, unsigned int to_submit,
+                    unsigned int min_complete, unsigned int flags)
+{
+  return syscall (__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                  NULL, 0);
+}
+
+
+/* Create a new ring for DEPTH concurrent operations.  Returns NULL if
+ * io_uring can't be used.  */
+gnupg_uring_t
+gnupg_uring_new (unsigned int depth)
+{
+  struct io_uring_params p;
+  gnupg_uring_t ring;
+  unsigned char *ptr;
+  int fd;
+
+  if (uring_unavailable || !depth)
+    return NULL;
+
+  memset (&p, 0, sizeof p);
+  fd = sys_io_uring_setup (depth, &p);
+  if (fd == -1)
+    {
+      /* ENOSYS is returned by old kernels and EPERM if io_uring has
+       * been disabled by the admin or a seccomp filter.  */
+      if (errno == ENOSYS || errno == EPERM || errno == EINVAL)
+        uring_unavailable = 1;
+      return NULL;
+    }
+
+  /* We require the single mapping of SQ and CQ (5.4) and the
+   * IORING_OP_READ and IORING_OP_WRITE operations (5.6) which are
+   * indicated by the RW_CUR_POS feature.  */
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)
+      || !(p.features & IORING_FEAT_RW_CUR_POS))
+    {
+      close (fd);
+      uring_unavailable = 1;
+      return NULL;
+    }
+
+  ring = xtrycalloc (1, sizeof *ring);
+  if (!ring)
+    {
+      close (fd);
+      return NULL;
+    }
+  ring->fd = fd;
+  ring->sq_entries = p.sq_entries;
+  ring->cq_entries = p.cq_entries;
+
+  ring->ring_len = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+  if (p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe)
+      > ring->ring_len)
+    ring->ring_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  ring->ring_ptr = mmap (NULL, ring->ring_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->ring_ptr == MAP_FAILED)
+    {
+      ring->ring_ptr = NULL;
+      gnupg_uring_release (ring);
+      return NULL;
+    }
+  ring->sqes_len = p.sq_entries * sizeof (struct io_uring_sqe);
+  ring->sqes = mmap (NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    {
+      ring->sqes = NULL;
+      gnupg_uring_release (ring);
+      return NULL;
+    }
+
+  ptr = ring->ring_ptr;
+  ring->sq_head  = (unsigned int *)(ptr + p.sq_off.head);
+  ring->sq_tail  = (unsigned int *)(ptr + p.sq_off.tail);
+  ring->sq_mask  = (unsigned int *)(ptr + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned int *)(ptr + p.sq_off.array);
+  ring->cq_head  = (unsigned int *)(ptr + p.cq_off.head);
+  ring->cq_tail  = (unsigned int *)(ptr + p.cq_off.tail);
+  ring->cq_mask  = (unsigned int *)(ptr + p.cq_off.ring_mask);
+  ring->cqes     = (struct io_uring_cqe *)(ptr + p.cq_off.cqes);
+
+  return ring;
+}
+
+
+/* Release RING.  Operations still in flight are waited for because
+ * the kernel may still access their buffers.  */
+void
+gnupg_uring_release (gnupg_uring_t ring)
+{
+  uint64_t tag;
+  int res;
+
+  if (!ring)
+    return;
+
+  if (ring->ring_ptr && ring->sqes)
+    while (gnupg_uring_pending (ring)
+           && !gnupg_uring_wait (ring, &tag, &res))
+      ;
+  if (ring->sqes)
+    munmap (ring->sqes, ring->sqes_len);
+  if (ring->ring_ptr)
+    munmap (ring->ring_ptr, ring->ring_len);
+  close (ring->fd);
+  xfree (ring);
+}
+
+
+/* Return the number of operations which have not yet been returned
+ * by gnupg_uring_wait.  */
+unsigned int
+gnupg_uring_pending (gnupg_uring_t ring)
+{
+  return ring? ring->queued + ring->pending : 0;
+}
+
+
+/* Return a zeroed submission entry or NULL if the ring is full.  */
+static struct io_uring_sqe *
+get_sqe (gnupg_uring_t ring)
+{
+  unsigned int tail, head;
+  struct io_uring_sqe *sqe;
+
+  /* Do not queue more than the CQ can hold.  */
+  if (ring->queued + ring->pending >= ring->cq_entries)
+    return NULL;
+  tail = *ring->sq_tail;
+  head = __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE);
+  if (tail - head >= ring->sq_entries)
+    return NULL;
+
+  sqe = ring->sqes + (tail & *ring->sq_mask);
+  memset (sqe, 0, sizeof *sqe);
+  return sqe;
+}
+
+
+/* Append SQE to the submission queue.  */
+static void
+queue_sqe (gnupg_uring_t ring, struct io_uring_sqe *sqe)
+{
+  unsigned int tail = *ring->sq_tail;
+
+  ring->sq_array[tail & *ring->sq_mask] = sqe - ring->sqes;
+  __atomic_store_n (ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+}
+
+
+static gpg_error_t
+queue_rw (gnupg_uring_t ring, int opcode, int fd, const void *buffer,
+          size_t length, off_t offset, uint64_t tag)
+{
+  struct io_uring_sqe *sqe;
+
+  if (!ring)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (offset < 0 || length > 0x7ffff000)
+    return gpg_error (GPG_ERR_INV_ARG);
+  sqe = get_sqe (ring);
+  if (!sqe)
+    return gpg_error (GPG_ERR_EAGAIN);
+
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->addr = (uintptr_t)buffer;
+  sqe->len = length;
+  sqe->user_data = tag;
+  queue_sqe (ring, sqe);
+  return 0;
+}
+
+
+/* Queue a read of LENGTH bytes at OFFSET of FD into BUFFER.  TAG is
+ * returned by gnupg_uring_wait along with the result.  BUFFER must
+ * stay valid until then.  Returns GPG_ERR_EAGAIN if the ring is
+ * full.  */
+gpg_error_t
+gnupg_uring_read (gnupg_uring_t ring, int fd, void *buffer,
+                  size_t length, off_t offset, uint64_t tag)
+{
+  return queue_rw (ring, IORING_OP_READ, fd, buffer, length, offset, tag);
+}
+
+
+/* Queue a write of LENGTH bytes from BUFFER at OFFSET of FD.  See
+ * gnupg_uring_read.  */
+gpg_error_t
+gnupg_uring_write (gnupg_uring_t ring, int fd, const void *buffer,
+                   size_t length, off_t offset, uint64_t tag)
+{
+  return queue_rw (ring, IORING_OP_WRITE, fd, buffer, length, offset, tag);
+}
+
+
+/* Queue a fsync of FD.  The fsync is started only after all
+ * operations queued before have completed.  */
+gpg_error_t
+gnupg_uring_fsync (gnupg_uring_t ring, int fd, uint64_t tag)
+{
+  struct io_uring_sqe *sqe;
+
+  if (!ring)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  sqe = get_sqe (ring);
+  if (!sqe)
+    return gpg_error (GPG_ERR_EAGAIN);
+
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->flags = IOSQE_IO_DRAIN;
+  sqe->fd = fd;
+  sqe->user_data = tag;
+  queue_sqe (ring, sqe);
+  return 0;
+}
+
+
+/* Hand all queued operations to the kernel.  With MIN_COMPLETE also
+ * wait for that many completions.  */
+static gpg_error_t
+enter_ring (gnupg_uring_t ring, unsigned int min_complete)
+{
+  int n;
+
+  do
+    n = sys_io_uring_enter (ring->fd, ring->queued, min_complete,
+                            min_complete? IORING_ENTER_GETEVENTS : 0);
+  while (n == -1 && errno == EINTR);
+  if (n == -1)
+    return gpg_error_from_syserror ();
+  if (n > ring->queued)
+    n = ring->queued;
+  ring->queued -= n;
+  ring->pending += n;
+  return 0;
+}
+
+
+/* Submit all queued operations without waiting.  */
+gpg_error_t
+gnupg_uring_submit (gnupg_uring_t ring)
+{
+  if (!ring)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (!ring->queued)
+    return 0;
+  return enter_ring (ring, 0);
+}
+
+
+/* Submit all queued operations and wait for the next completion.  Its
+ * tag is stored at R_TAG and its result at R_RESULT; that is the
+ * number of bytes transferred or a negative errno value.  Returns
+ * GPG_ERR_NO_DATA if no operation is in flight.  */
+gpg_error_t
+gnupg_uring_wait (gnupg_uring_t ring, uint64_t *r_tag, int *r_result)
+{
+  struct io_uring_cqe *cqe;
+  unsigned int head;
+  gpg_error_t err;
+
+  if (!ring)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (!ring->queued && !ring->pending)
+    return gpg_error (GPG_ERR_NO_DATA);
+
+  for (;;)
+    {
+      head = *ring->cq_head;
+      if (head != __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE))
+        break;
+      err = enter_ring (ring, 1);
+      if (err)
+        return err;
+    }
+
+  cqe = ring->cqes + (head & *ring->cq_mask);
+  *r_tag = cqe->user_data;
+  *r_result = cqe->res;
+  __atomic_store_n (ring->cq_head, head + 1, __ATOMIC_RELEASE);
+  if (ring->pending)
+    ring->pending--;
+  return 0;
+}
+
+
+#else /*!USE_URING*/
+
+gnupg_uring_t
+gnupg_uring_new (unsigned int depth)
+{
+  (void)depth;
+  return NULL;
+}
+
+void
+gnupg_uring_release (gnupg_uring_t ring)
+{
+  (void)ring;
+}
+
+unsigned int
+gnupg_uring_pending (gnupg_uring_t ring)
+{
+  (void)ring;
+  return 0;
+}
+
+gpg_error_t
+gnupg_uring_read (gnupg_uring_t ring, int fd, void *buffer,
+                  size_t length, off_t offset, uint64_t tag)
+{
+  (void)ring; (void)fd; (void)buffer; (void)length; (void)offset; (void)tag;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+gpg_error_t
+gnupg_uring_write (gnupg_uring_t ring, int fd, const void *buffer,
+                   size_t length, off_t offset, uint64_t tag)
+{
+  (void)ring; (void)fd; (void)buffer; (void)length; (void)offset; (void)tag;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+gpg_error_t
+gnupg_uring_fsync (gnupg_uring_t ring, int fd, uint64_t tag)
+{
+  (void)ring; (void)fd; (void)tag;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+gpg_error_t
+gnupg_uring_submit (gnupg_uring_t ring)
+{
+  (void)ring;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+gpg_error_t
+gnupg_uring_wait (gnupg_uring_t ring, uint64_t *r_tag, int *r_result)
+{
+  (void)ring; (void)r_tag; (void)r_result;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+#endif /*!USE_URING*/
+
+
+/* Copy the data of file INFD starting at INOFF to OUTFD at OUTOFF.
+ * If MAXLEN is not negative at most that many bytes are copied;
+ * otherwise the copy runs up to the end of the input.  Several reads
+ * and writes are kept in flight.  The file positions of both file
+ * descriptors are not changed.  The number of bytes written is stored
+ * at R_NBYTES.  Returns GPG_ERR_NOT_SUPPORTED without doing anything
+ * if io_uring can't be used; the caller should then do a plain
+ * copy.  */
+gpg_error_t
+gnupg_uring_copy (int infd, off_t inoff, int outfd, off_t outoff,
+                  off_t maxlen, off_t *r_nbytes)
+{
+  enum { IDLE, READING, READ_DONE, WRITING };
+  struct {
+    unsigned char *buf;
+    off_t off;                  /* The offset relative to the start.  */
+    size_t want;                /* The requested length of the read.  */
+    size_t len;                 /* The length of the data.  */
+    size_t done;                /* Number of bytes written.  */
+    int res;                    /* The result of the read.  */
+    int gen;                    /* The generation of the read.  */
+    int state;
+  } slots[COPY_SLOTS];
+  gnupg_uring_t ring;
+  unsigned char *buffer;
+  gpg_error_t err = 0;
+  off_t rpos = 0;
+  int eof = 0;
+  int gen = 0;
+  unsigned int head = 0;        /* The oldest slot in read order.  */
+  unsigned int tail = 0;        /* The next slot to start a read.  */
+  unsigned int i;
+  uint64_t tag;
+  int res;
+
+  *r_nbytes = 0;
+
+  ring = gnupg_uring_new (2 * COPY_SLOTS);
+  if (!ring)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  buffer = xtrymalloc (COPY_SLOTS * COPY_CHUNK);
+  if (!buffer)
+    {
+      err = gpg_error_from_syserror ();
+      gnupg_uring_release (ring);
+      return err;
+    }
+  memset (slots, 0, sizeof slots);
+  for (i=0; i < COPY_SLOTS; i++)
+    slots[i].buf = buffer + i * COPY_CHUNK;
+
+  for (;;)
+    {
+      /* Start reads for all idle slots in ring order.  */
+      while (!err && !eof && slots[tail].state == IDLE
+             && (maxlen < 0 || rpos < maxlen))
+        {
+          size_t want = COPY_CHUNK;
+
+          if (maxlen >= 0 && maxlen - rpos < want)
+            want = maxlen - rpos;
+          err = gnupg_uring_read (ring, infd, slots[tail].buf, want,
+                                  inoff + rpos, tail << 1);
+          if (err)
+            break;
+          slots[tail].off = rpos;
+          slots[tail].want = want;
+          slots[tail].gen = gen;
+          slots[tail].state = READING;
+          rpos += want;
+          tail = (tail + 1) % COPY_SLOTS;
+        }
+
+      if (!gnupg_uring_pending (ring))
+        break;
+      if (gnupg_uring_wait (ring, &tag, &res))
+        {
+          /* We can't continue if we can't reap the completions.  */
+          log_fatal ("%s: waiting for io_uring failed\n", __func__);
+        }
+      i = (tag >> 1) % COPY_SLOTS;
+
+      if ((tag & 1))  /* A write completed.  */
+        {
+          if (res <= 0)
+            {
+              if (!err)
+                err = res? gpg_error_from_errno (-res)
+                  /**/   : gpg_error (GPG_ERR_EIO);
+              slots[i].state = IDLE;
+            }
+          else if ((slots[i].done += res) < slots[i].len && !err)
+            {
+              /* Short write - write the remaining data.  */
+              err = gnupg_uring_write (ring, outfd,
+                                       slots[i].buf + slots[i].done,
+                                       slots[i].len - slots[i].done,
+                                       outoff + slots[i].off + slots[i].done,
+                                       tag);
+              if (err)
+                slots[i].state = IDLE;
+            }
+          else
+            {
+              *r_nbytes += slots[i].done;
+              slots[i].state = IDLE;
+            }
+          continue;
+        }
+
+      /* A read completed.  Reads started before a short read are
+       * dropped.  */
+      if (slots[i].gen != gen || err)
+        {
+          slots[i].state = IDLE;
+          continue;
+        }
+      slots[i].res = res;
+      slots[i].state = READ_DONE;
+
+      /* Write the completed reads in order.  */
+      while (!err && slots[head].state == READ_DONE
+             && slots[head].gen == gen)
+        {
+          i = head;
+          head = (head + 1) % COPY_SLOTS;
+          if (slots[i].res < 0)
+            {
+              err = gpg_error_from_errno (-slots[i].res);
+              slots[i].state = IDLE;
+              break;
+            }
+          if (slots[i].res < slots[i].want)
+            {
+              /* A short read.  This is most likely the end of the
+               * file; we restart the reading at its end to be
+               * sure.  */
+              gen++;
+              rpos = slots[i].off + slots[i].res;
+              if (!slots[i].res)
+                eof = 1;
+              tail = head;
+            }
+          if (!slots[i].res)
+            {
+              slots[i].state = IDLE;
+              continue;
+            }
+          slots[i].len = slots[i].res;
+          slots[i].done = 0;
+          slots[i].state = WRITING;
+          err = gnupg_uring_write (ring, outfd, slots[i].buf, slots[i].len,
+                                   outoff + slots[i].off, (i << 1) | 1);
+          if (err)
+            slots[i].state = IDLE;
+        }
+
+      /* Slots which completed their read after a short read carry
+       * stale data.  */
+      for (i=0; i < COPY_SLOTS; i++)
+        if (slots[i].state == READ_DONE && slots[i].gen != gen)
+          slots[i].state = IDLE;
+    }
+
+  gnupg_uring_release (ring);
+  xfree (buffer);
+  return err;
+}
@@ -0,0 +1,47 @@
+/* uring.h - Definitions for the io_uring wrapper
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_COMMON_URING_H
+#define GNUPG_COMMON_URING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct gnupg_uring_s;
+typedef struct gnupg_uring_s *gnupg_uring_t;
+
+/*-- uring.c --*/
+gnupg_uring_t gnupg_uring_new (unsigned int depth);
+void gnupg_uring_release (gnupg_uring_t ring);
+unsigned int gnupg_uring_pending (gnupg_uring_t ring);
+gpg_error_t gnupg_uring_read (gnupg_uring_t ring, int fd, void *buffer,
+                              size_t length, off_t offset, uint64_t tag);
+gpg_error_t gnupg_uring_write (gnupg_uring_t ring, int fd,
+                               const void *buffer, size_t length,
+                               off_t offset, uint64_t tag);
+gpg_error_t gnupg_uring_fsync (gnupg_uring_t ring, int fd, uint64_t tag);
+gpg_error_t gnupg_uring_submit (gnupg_uring_t ring);
+gpg_error_t gnupg_uring_wait (gnupg_uring_t ring,
+                              uint64_t *r_tag, int *r_result);
+gpg_error_t gnupg_uring_copy (int infd, off_t inoff, int outfd, off_t outoff,
+                              off_t maxlen, off_t *r_nbytes);
+
+
+#endif /*GNUPG_COMMON_URING_H*/
@@ -150,6 +150,40 @@ ssize_t read_line (FILE *fp,
 
 
 /*-- sexputil.c */
+
+/* Markers for the values in a template of
+ * make_canon_sexp_from_template.  */
+#define CANON_SEXP_BYTES  "\001"  /* An octet string.  */
+#define CANON_SEXP_UINT   "\002"  /* An unsigned big endian integer.  */
+#define CANON_SEXP_STRING "\003"  /* A Nul terminated string.  */
+
+/* Templates for the common public keys and signature values.  */
+#define CANON_SEXP_RSA_PUBKEY \
+  "(10:public-key(3:rsa(1:n" CANON_SEXP_UINT ")(1:e" CANON_SEXP_UINT ")))"
+#define CANON_SEXP_ECC_PUBKEY \
+  "(10:public-key(3:ecc(5:curve" CANON_SEXP_STRING ")(1:q" CANON_SEXP_BYTES \
+  ")))"
+#define CANON_SEXP_RSA_SIGVAL \
+  "(7:sig-val(3:rsa(1:s" CANON_SEXP_BYTES ")))"
+#define CANON_SEXP_ECDSA_SIGVAL \
+  "(7:sig-val(5:ecdsa(1:r" CANON_SEXP_BYTES ")(1:s" CANON_SEXP_BYTES ")))"
+#define CANON_SEXP_EDDSA_SIGVAL \
+  "(7:sig-val(5:eddsa(1:r" CANON_SEXP_BYTES ")(1:s" CANON_SEXP_BYTES ")))"
+#define CANON_SEXP_ECDH_ENCVAL \
+  "(7:enc-val(4:ecdh(1:s" CANON_SEXP_UINT ")(1:e" CANON_SEXP_UINT ")))"
+#define CANON_SEXP_KYBER_ENCVAL \
+  "(7:enc-val(3:pqc(1:e" CANON_SEXP_UINT ")(1:k" CANON_SEXP_UINT \
+  ")(1:s" CANON_SEXP_UINT ")(1:c" CANON_SEXP_STRING \
+  ")(10:fixed-info" CANON_SEXP_BYTES ")))"
+
+/* A value for make_canon_sexp_from_template.  LEN is not used for
+ * CANON_SEXP_STRING.  */
+struct canon_sexp_value_s
+{
+  const void *data;
+  size_t len;
+};
+
 char *canon_sexp_to_string (const unsigned char *canon, size_t canonlen);
 void log_printcanon (const char *text,
                      const unsigned char *sexp, size_t sexplen);
@@ -171,6 +205,9 @@ int cmp_canon_sexp (const unsigned char *a, size_t alen,
 unsigned char *make_simple_sexp_from_hexstr (const char *line,
                                              size_t *nscanned);
 int hash_algo_from_sigval (const unsigned char *sigval);
+unsigned char *make_canon_sexp_from_template (const char *tmpl,
+                             const struct canon_sexp_value_s *args,
+                             size_t *r_len);
 unsigned char *make_canon_sexp_from_rsa_pk (const void *m, size_t mlen,
                                             const void *e, size_t elen,
                                             size_t *r_len);
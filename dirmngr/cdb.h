@@ -71,6 +71,12 @@ struct cdb_make {
   char cdb_buf[4096];		/* write buffer */
   char *cdb_bpos;		/* current buf position */
   struct cdb_rl *cdb_rec[256];	/* list of arrays of record infos */
+  int cdb_spillfd;		/* spill file or -1 */
+  cdbi_t cdb_spillmax;		/* max. record infos kept in memory */
+  cdbi_t cdb_memcnt;		/* record infos kept in memory */
+  cdbi_t cdb_spillpos;		/* size of the spill file */
+  unsigned int cdb_nruns;	/* number of spilled runs */
+  struct cdb_run *cdb_runs;	/* table of the spilled runs */
 };
 
 
@@ -90,5 +96,6 @@ int cdb_make_put(struct cdb_make *cdbmp,
 #define CDB_PUT_INSERT	2	/* add only if not already exists */
 #define CDB_PUT_WARN	3	/* add unconditionally but ret. 1 if exists */
 int cdb_make_finish(struct cdb_make *cdbmp);
+int cdb_make_set_spill(struct cdb_make *cdbmp, int fd, cdbi_t maxrecs);
 
 #endif /* include guard */
@@ -96,11 +96,19 @@ struct cdb_rl {
   struct cdb_rec rec[254];
 };
 
+/* Location of the record infos of one spilled run in the spill
+   file, separately for each hash table.  */
+struct cdb_run {
+  cdbi_t pos[256];
+  cdbi_t cnt[256];
+};
+
 static int make_find(struct cdb_make *cdbmp,
 		   const void *key, cdbi_t klen, cdbi_t hval,
 		   struct cdb_rl **rlp);
 static int make_write(struct cdb_make *cdbmp,
 		    const char *ptr, cdbi_t len);
+static int make_spill(struct cdb_make *cdbmp);
 
 
 
@@ -573,12 +581,15 @@ cdb_make_add(struct cdb_make *cdbmp,
   rl->rec[rl->cnt].rpos = cdbmp->cdb_dpos;
   ++rl->cnt;
   ++cdbmp->cdb_rcnt;
+  ++cdbmp->cdb_memcnt;
   cdb_pack(klen, rlen);
   cdb_pack(vlen, rlen + 4);
   if (make_write(cdbmp, rlen, 8) < 0 ||
       make_write(cdbmp, key, klen) < 0 ||
       make_write(cdbmp, val, vlen) < 0)
     return -1;
+  if (cdbmp->cdb_spillfd != -1 && cdbmp->cdb_memcnt >= cdbmp->cdb_spillmax)
+    return make_spill(cdbmp);
   return 0;
 }
 
@@ -646,6 +657,7 @@ cdb_make_put(struct cdb_make *cdbmp,
   if (c == rl->cnt) {
     ++rl->cnt;
     ++cdbmp->cdb_rcnt;
+    ++cdbmp->cdb_memcnt;
   }
   cdb_pack(klen, rlen);
   cdb_pack(vlen, rlen + 4);
@@ -653,6 +665,9 @@ cdb_make_put(struct cdb_make *cdbmp,
       make_write(cdbmp, key, klen) < 0 ||
       make_write(cdbmp, val, vlen) < 0)
     return -1;
+  if (cdbmp->cdb_spillfd != -1 && cdbmp->cdb_memcnt >= cdbmp->cdb_spillmax
+      && make_spill(cdbmp) < 0)
+    return -1;
   return r;
 }
 
@@ -692,6 +707,11 @@ make_find (struct cdb_make *cdbmp,
   struct cdb_rl *rl = cdbmp->cdb_rec[hval&255];
   int r, i;
   int sought = 0;
+  if (cdbmp->cdb_nruns) {
+    /* Spilled records can't be searched.  */
+    gpg_err_set_errno (EINVAL);
+    return -1;
+  }
   while(rl) {
     for(i = rl->cnt - 1; i >= 0; --i) { /* search backward */
       if (rl->rec[i].hval != hval)
@@ -751,6 +771,7 @@ cdb_make_start(struct cdb_make *cdbmp, int fd)
 {
   memset (cdbmp, 0, sizeof *cdbmp);
   cdbmp->cdb_fd = fd;
+  cdbmp->cdb_spillfd = -1;
   cdbmp->cdb_dpos = 2048;
   cdbmp->cdb_bpos = cdbmp->cdb_buf + 2048;
   return 0;
@@ -773,6 +794,84 @@ ewrite(int fd, const char *buf, int len)
   return 0;
 }
 
+/* Let the database given by CDBMP keep at most MAXRECS record infos
+   in memory; the others are moved to the spill file FD which must be
+   opened read-write and should be seekable.  All its content may be
+   overwritten; cdb_make_finish does not close it.  This bounds the
+   memory needed for very large databases; cdb_make_exists and the
+   non-adding modes of cdb_make_put will however fail once records
+   have been spilled.  Returns 0 on success or a negative value on
+   error. */
+int
+cdb_make_set_spill(struct cdb_make *cdbmp, int fd, cdbi_t maxrecs)
+{
+  if (fd == -1 || !maxrecs || cdbmp->cdb_nruns) {
+    gpg_err_set_errno (EINVAL);
+    return -1;
+  }
+  cdbmp->cdb_spillfd = fd;
+  cdbmp->cdb_spillmax = maxrecs;
+  return 0;
+}
+
+/* Move all record infos kept in memory to a new run of the spill
+   file.  */
+static int
+make_spill(struct cdb_make *cdbmp)
+{
+  unsigned char buf[2048];
+  struct cdb_run *runs, *run;
+  struct cdb_rl *rl, *rlt, *rln;
+  unsigned t, i, n;
+
+  runs = (struct cdb_run*)realloc(cdbmp->cdb_runs,
+                                  (cdbmp->cdb_nruns + 1) * sizeof *runs);
+  if (!runs) {
+    gpg_err_set_errno (ENOMEM);
+    return -1;
+  }
+  cdbmp->cdb_runs = runs;
+  run = runs + cdbmp->cdb_nruns++;
+  memset (run, 0, sizeof *run);
+
+  if (lseek(cdbmp->cdb_spillfd, cdbmp->cdb_spillpos, SEEK_SET) < 0)
+    return -1;
+  for (t = 0; t < 256; ++t) {
+    /* Reverse the list so that the records are written in the order
+       they have been added.  */
+    for (rlt = NULL, rl = cdbmp->cdb_rec[t]; rl; rl = rln) {
+      rln = rl->next;
+      rl->next = rlt;
+      rlt = rl;
+    }
+    cdbmp->cdb_rec[t] = rlt;
+    run->pos[t] = cdbmp->cdb_spillpos;
+    n = 0;
+    for (rl = cdbmp->cdb_rec[t]; rl; rl = rl->next)
+      for (i = 0; i < rl->cnt; ++i) {
+        cdb_pack(rl->rec[i].hval, buf + n);
+        cdb_pack(rl->rec[i].rpos, buf + n + 4);
+        n += 8;
+        if (n == sizeof buf) {
+          if (ewrite(cdbmp->cdb_spillfd, (char*)buf, n) < 0)
+            return -1;
+          n = 0;
+        }
+        ++run->cnt[t];
+        cdbmp->cdb_spillpos += 8;
+      }
+    if (n && ewrite(cdbmp->cdb_spillfd, (char*)buf, n) < 0)
+      return -1;
+    for (rl = cdbmp->cdb_rec[t]; rl; rl = rln) {
+      rln = rl->next;
+      free(rl);
+    }
+    cdbmp->cdb_rec[t] = NULL;
+  }
+  cdbmp->cdb_memcnt = 0;
+  return 0;
+}
+
 static int
 make_write(struct cdb_make *cdbmp, const char *ptr, cdbi_t len)
 {
@@ -808,7 +907,7 @@ cdb_make_finish_internal(struct cdb_make *cdbmp)
   unsigned char *p;
   struct cdb_rl *rl;
   cdbi_t hsize;
-  unsigned t, i;
+  unsigned t, i, r;
 
   if (((0xffffffff - cdbmp->cdb_dpos) >> 3) < cdbmp->cdb_rcnt) {
     gpg_err_set_errno (ENOMEM);
@@ -829,6 +928,8 @@ cdb_make_finish_internal(struct cdb_make *cdbmp)
       rl = rln;
     }
     cdbmp->cdb_rec[t] = rlt;
+    for (r = 0; r < cdbmp->cdb_nruns; ++r)
+      i += cdbmp->cdb_runs[r].cnt[t];
     if (hsize < (hcnt[t] = i << 1))
       hsize = hcnt[t];
   }
@@ -850,6 +951,35 @@ cdb_make_finish_internal(struct cdb_make *cdbmp)
       continue;
     for (i = 0; i < len; ++i)
       htab[i].hval = htab[i].rpos = 0;
+    /* First the spilled records in the order of the runs.  */
+    for (r = 0; r < cdbmp->cdb_nruns; ++r) {
+      cdbi_t todo = cdbmp->cdb_runs[r].cnt[t];
+      if (!todo)
+        continue;
+      if (lseek(cdbmp->cdb_spillfd, cdbmp->cdb_runs[r].pos[t], SEEK_SET) < 0) {
+        free(p);
+        return -1;
+      }
+      while (todo) {
+        unsigned char buf[2048];
+        unsigned n = todo > sizeof buf / 8? sizeof buf / 8 : todo;
+        struct cdb_rec rec;
+        if (cdb_bread(cdbmp->cdb_spillfd, buf, n * 8) < 0) {
+          free(p);
+          return -1;
+        }
+        for (i = 0; i < n; ++i) {
+          rec.hval = cdb_unpack(buf + (i << 3));
+          rec.rpos = cdb_unpack(buf + (i << 3) + 4);
+          hi = (rec.hval >> 8) % len;
+          while(htab[hi].rpos)
+            if (++hi == len)
+              hi = 0;
+          htab[hi] = rec;
+        }
+        todo -= n;
+      }
+    }
     for (rl = cdbmp->cdb_rec[t]; rl; rl = rl->next)
       for (i = 0; i < rl->cnt; ++i) {
 	hi = (rl->rec[i].hval >> 8) % len;
@@ -896,6 +1026,9 @@ cdb_make_free(struct cdb_make *cdbmp)
       free(tm);
     }
   }
+  free(cdbmp->cdb_runs);
+  cdbmp->cdb_runs = NULL;
+  cdbmp->cdb_nruns = 0;
 }
 
 
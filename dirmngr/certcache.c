@@ -24,16 +24,33 @@
 #include <errno.h>
 #include <assert.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef HAVE_W32_SYSTEM
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+#endif
 #include <npth.h>
 
 #include "dirmngr.h"
+#include "../common/host2net.h"
+#include "../common/sysutils.h"
 #include "misc.h"
 #include "../common/ksba-io-support.h"
 #include "crlfetch.h"
 #include "certcache.h"
 
-#define MAX_NONPERM_CACHED_CERTS 1000
+/* The number of buckets of the secondary indexes.  */
+#define NO_OF_INDEX_BUCKETS 1021
+
+/* The file in the cache directory with the compiled system trust
+ * store and its version.  */
+#define TRUSTSTORE_CACHE_FILE    "trust-store.cache"
+#define TRUSTSTORE_CACHE_VERSION 1
 
 /* Constants used to classify search patterns.  */
 enum pattern_class
@@ -53,19 +70,44 @@ enum pattern_class
   };
 
 
+/* The secondary indexes of the cache.  */
+enum cert_index
+  {
+    CERT_INDEX_SUBJECT = 0, /* By subject DN.  */
+    CERT_INDEX_ISSUER,      /* By issuer DN.  */
+    CERT_INDEX_SN,          /* By issuer DN and serial number.  */
+    CERT_INDEX_SKI,         /* By subjectKeyIdentifier.  */
+    N_CERT_INDEXES
+  };
+
+
 /* A certificate cache item.  This consists of a the KSBA cert object
    and some meta data for easier lookup.  We use a hash table to keep
    track of all items and use the (randomly distributed) first byte of
-   the fingerprint directly as the hash which makes it pretty easy. */
+   the fingerprint directly as the hash which makes it pretty easy.
+   Valid items are also linked into the secondary indexes. */
 struct cert_item_s
 {
   struct cert_item_s *next; /* Next item with the same hash value. */
-  ksba_cert_t cert;         /* The KSBA cert object or NULL is this is
-                               not a valid item.  */
+  ksba_cert_t cert;         /* The KSBA cert object or NULL if this is
+                               not a valid or not yet parsed item.  */
+  const unsigned char *der; /* If not NULL, the not yet parsed DER
+                               encoded cert in the trust store cache.  */
+  size_t derlen;            /* Its length.  */
   unsigned char fpr[20];    /* The fingerprint of this object. */
   char *issuer_dn;          /* The malloced issuer DN.  */
   ksba_sexp_t sn;           /* The malloced serial number  */
   char *subject_dn;         /* The malloced subject DN - maybe NULL.  */
+  ksba_sexp_t ski;          /* The malloced subjectKeyIdentifier - maybe
+                               NULL.  */
+
+  /* The next items in the secondary indexes and the bucket numbers
+   * used there; -1 if not linked into that index.  */
+  struct cert_item_s *inext[N_CERT_INDEXES];
+  int ibucket[N_CERT_INDEXES];
+
+  /* Set on each lookup and cleared by the eviction sweep.  */
+  unsigned char referenced;
 
   /* If this field is set the certificate has been taken from some
    * configuration and shall not be flushed from the cache.  */
@@ -77,10 +119,16 @@ struct cert_item_s
 };
 typedef struct cert_item_s *cert_item_t;
 
+/* Return true if CI is a valid item.  */
+#define ITEM_VALID(ci) ((ci)->cert || (ci)->der)
+
 /* The actual cert cache consisting of 256 slots for items indexed by
    the first byte of the fingerprint.  */
 static cert_item_t cert_cache[256];
 
+/* The secondary indexes.  */
+static cert_item_t cert_index[N_CERT_INDEXES][NO_OF_INDEX_BUCKETS];
+
 /* This is the global cache_lock variable. In general locking is not
    needed but it would take extra efforts to make sure that no
    indirect use of npth functions is done, so we simply lock it
@@ -91,6 +139,10 @@ static npth_rwlock_t cert_cache_lock;
 /* Flag to track whether the cache has been initialized.  */
 static int initialization_done;
 
+/* The mapped trust store cache file and its length.  */
+static void *trust_store_map;
+static size_t trust_store_maplen;
+
 /* Total number of non-permanent certificates.  */
 static unsigned int total_nonperm_certificates;
 
@@ -225,6 +277,97 @@ cert_compute_fpr (ksba_cert_t cert, unsigned char *digest)
 
 
 
+/* Hash the LEN bytes at BUFFER and add them to HASHVAL.  */
+static u32
+hash_buffer (u32 hashval, const void *buffer, size_t len)
+{
+  const unsigned char *s = buffer;
+  u32 carry;
+
+  for (; len; len--, s++)
+    {
+      hashval = (hashval << 4) + *s;
+      if ((carry = (hashval & 0xf0000000)))
+        {
+          hashval ^= (carry >> 24);
+          hashval ^= carry;
+        }
+    }
+  return hashval;
+}
+
+/* Return the bucket of the string DN.  */
+static int
+dn_bucket (const char *dn)
+{
+  return hash_buffer (0, dn, strlen (dn)) % NO_OF_INDEX_BUCKETS;
+}
+
+/* Return the bucket of ISSUER_DN and the serial number SN.  */
+static int
+sn_bucket (const char *issuer_dn, ksba_sexp_t sn)
+{
+  u32 hashval = hash_buffer (0, issuer_dn, strlen (issuer_dn));
+  size_t n = gcry_sexp_canon_len (sn, 0, NULL, NULL);
+
+  return hash_buffer (hashval, sn, n) % NO_OF_INDEX_BUCKETS;
+}
+
+/* Return the bucket of the keyidentifier KEYID.  */
+static int
+ski_bucket (ksba_sexp_t keyid)
+{
+  size_t n = gcry_sexp_canon_len (keyid, 0, NULL, NULL);
+
+  return hash_buffer (0, keyid, n) % NO_OF_INDEX_BUCKETS;
+}
+
+
+/* Link CI into the secondary index IDX using BUCKET.  */
+static void
+index_link (cert_item_t ci, enum cert_index idx, int bucket)
+{
+  ci->ibucket[idx] = bucket;
+  ci->inext[idx] = cert_index[idx][bucket];
+  cert_index[idx][bucket] = ci;
+}
+
+/* Link the valid item CI into all secondary indexes.  */
+static void
+index_insert (cert_item_t ci)
+{
+  if (ci->subject_dn)
+    index_link (ci, CERT_INDEX_SUBJECT, dn_bucket (ci->subject_dn));
+  index_link (ci, CERT_INDEX_ISSUER, dn_bucket (ci->issuer_dn));
+  index_link (ci, CERT_INDEX_SN, sn_bucket (ci->issuer_dn, ci->sn));
+  if (ci->ski)
+    index_link (ci, CERT_INDEX_SKI, ski_bucket (ci->ski));
+}
+
+/* Remove CI from all secondary indexes.  */
+static void
+index_remove (cert_item_t ci)
+{
+  cert_item_t *cip;
+  int idx;
+
+  for (idx = 0; idx < N_CERT_INDEXES; idx++)
+    {
+      if (ci->ibucket[idx] == -1)
+        continue;
+      for (cip = &cert_index[idx][ci->ibucket[idx]]; *cip;
+           cip = &(*cip)->inext[idx])
+        if (*cip == ci)
+          {
+            *cip = ci->inext[idx];
+            break;
+          }
+      ci->inext[idx] = NULL;
+      ci->ibucket[idx] = -1;
+    }
+}
+
+
 /* Cleanup one slot.  This releases all resources but keeps the actual
    slot in the cache marked for reuse. */
 static void
@@ -232,9 +375,14 @@ clean_cache_slot (cert_item_t ci)
 {
   ksba_cert_t cert;
 
-  if (!ci->cert)
+  if (!ITEM_VALID (ci))
     return; /* Already cleaned.  */
 
+  index_remove (ci);
+  ci->der = NULL;
+  ci->derlen = 0;
+  ksba_free (ci->ski);
+  ci->ski = NULL;
   ksba_free (ci->sn);
   ci->sn = NULL;
   ksba_free (ci->issuer_dn);
@@ -246,32 +394,138 @@ clean_cache_slot (cert_item_t ci)
 
   ci->permanent = 0;
   ci->trustclasses = 0;
+  ci->referenced = 0;
 
   ksba_cert_release (cert);
 }
 
 
-/* Put the certificate CERT into the cache.  It is assumed that the
- * cache is locked while this function is called.
+/* Drop a couple of certs from the cache.  We use the clock algorithm
+ * as approximation of a LRU strategy: A static index points to the
+ * bucket where the last sweep stopped.  From there we walk over the
+ * non-permanent certificates and drop those which have not been used
+ * since the last sweep; for the others we clear the referenced flag.
+ * Thus after at most two rounds enough certificates have been found.
+ * Returns the number of dropped certificates.  It is assumed that
+ * the cache is write locked.  */
+static unsigned int
+drop_nonperm_certs (void)
+{
+  static int idx;
+  cert_item_t ci;
+  unsigned int drop_count, count;
+
+  drop_count = opt.max_cached_certs / 20;
+  if (drop_count < 2)
+    drop_count = 2;
+  if (drop_count > total_nonperm_certificates)
+    drop_count = total_nonperm_certificates;
+  count = drop_count;
+
+  assert (idx < 256);
+  for (; drop_count; idx = ((idx+1)%256))
+    for (ci = cert_cache[idx]; ci && drop_count; ci = ci->next)
+      {
+        if (!ITEM_VALID (ci) || ci->permanent)
+          continue;
+        if (ci->referenced)
+          ci->referenced = 0;
+        else
+          {
+            clean_cache_slot (ci);
+            drop_count--;
+            total_nonperm_certificates--;
+          }
+      }
+
+  return count;
+}
+
+
+/* Return an unused slot in the bucket for FPR.  Returns NULL if out
+ * of core.  */
+static cert_item_t
+alloc_cache_slot (const unsigned char *fpr)
+{
+  cert_item_t ci;
+  int i;
+
+  /* Try to reuse an existing entry.  */
+  for (ci=cert_cache[*fpr]; ci; ci = ci->next)
+    if (!ITEM_VALID (ci))
+      return ci;
+
+  /* No: Create a new entry.  */
+  ci = xtrycalloc (1, sizeof *ci);
+  if (!ci)
+    return NULL;
+  for (i=0; i < N_CERT_INDEXES; i++)
+    ci->ibucket[i] = -1;
+  ci->next = cert_cache[*fpr];
+  cert_cache[*fpr] = ci;
+  return ci;
+}
+
+
+/* Return a new reference to the certificate of the valid item CI.
+ * Certificates from the trust store cache are parsed on first use;
+ * if that fails the item is removed and NULL is returned.  It is
+ * assumed that the cache is locked.  Although a parsed certificate is
+ * stored in CI, a read lock is sufficient because this function does
+ * not cause a thread switch.  */
+static ksba_cert_t
+ref_item_cert (cert_item_t ci)
+{
+  gpg_error_t err;
+  ksba_cert_t cert;
+  unsigned char fpr[20];
+
+  if (!ci->cert && ci->der)
+    {
+      err = ksba_cert_new (&cert);
+      if (!err)
+        err = ksba_cert_init_from_mem (cert, ci->der, ci->derlen);
+      if (!err && memcmp (cert_compute_fpr (cert, fpr), ci->fpr, 20))
+        err = gpg_error (GPG_ERR_BAD_CERT);
+      if (err)
+        {
+          log_error ("invalid certificate in '%s': %s\n",
+                     TRUSTSTORE_CACHE_FILE, gpg_strerror (err));
+          ksba_cert_release (cert);
+          clean_cache_slot (ci);
+          return NULL;
+        }
+      ci->cert = cert;
+      ci->der = NULL;
+      ci->derlen = 0;
+    }
+
+  ksba_cert_ref (ci->cert);
+  return ci->cert;
+}
+
+
+/* Put the certificate CERT with the fingerprint FPR into the cache.
+ * It is assumed that the cache is write locked while this function
+ * is called.  This function must not call anything which may cause
+ * a thread switch so that other threads never wait for the lock.
  *
  * FROM_CONFIG indicates that CERT is a permanent certificate and
  * should stay in the cache.  IS_TRUSTED requests that the trusted
  * flag is set for the certificate; a value of 1 indicates the
  * cert is trusted due to GnuPG mechanisms, a value of 2 indicates
  * that it is trusted because it has been taken from the system's
- * store of trusted certificates.  If FPR_BUFFER is not NULL the
- * fingerprint of the certificate will be stored there.  FPR_BUFFER
- * needs to point to a buffer of at least 20 bytes.  The fingerprint
- * will be stored on success or when the function returns
- * GPG_ERR_DUP_VALUE or GPG_ERR_NOT_ENABLED.  */
+ * store of trusted certificates.  If certificates had to be dropped
+ * to make room, their number is stored at R_DROPPED.  */
 static gpg_error_t
-put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
-          void *fpr_buffer)
+put_cert_fpr (ksba_cert_t cert, int permanent, unsigned int trustclass,
+              const unsigned char *fpr, unsigned int *r_dropped)
 {
-  unsigned char help_fpr_buffer[20], *fpr;
   cert_item_t ci;
   fingerprint_list_t ignored;
 
+  *r_dropped = 0;
+
   /* Do not keep expired certificates in the permanent cache.  */
   if (permanent && !opt.debug_cache_expired_certs)
     {
@@ -287,53 +541,6 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
         return gpg_error (GPG_ERR_CERT_EXPIRED);
     }
 
-  fpr = fpr_buffer? fpr_buffer : &help_fpr_buffer;
-
-  /* If we already reached the caching limit, drop a couple of certs
-   * from the cache.  Our dropping strategy is simple: We keep a
-   * static index counter and use this to start looking for
-   * certificates, then we drop 5 percent of the oldest certificates
-   * starting at that index.  For a large cache this is a fair way of
-   * removing items.  An LRU strategy would be better of course.
-   * Because we append new entries to the head of the list and we want
-   * to remove old ones first, we need to do this from the tail.  The
-   * implementation is not very efficient but compared to the long
-   * time it takes to retrieve a certificate from an external resource
-   * it seems to be reasonable.  */
-  if (!permanent && total_nonperm_certificates >= MAX_NONPERM_CACHED_CERTS)
-    {
-      static int idx;
-      cert_item_t ci_mark;
-      int i;
-      unsigned int drop_count;
-
-      drop_count = MAX_NONPERM_CACHED_CERTS / 20;
-      if (drop_count < 2)
-        drop_count = 2;
-
-      log_info (_("dropping %u certificates from the cache\n"), drop_count);
-      assert (idx < 256);
-      for (i=idx; drop_count; i = ((i+1)%256))
-        {
-          ci_mark = NULL;
-          for (ci = cert_cache[i]; ci; ci = ci->next)
-            if (ci->cert && !ci->permanent)
-              ci_mark = ci;
-          if (ci_mark)
-            {
-              clean_cache_slot (ci_mark);
-              drop_count--;
-              total_nonperm_certificates--;
-            }
-        }
-      if (i==idx)
-        idx++;
-      else
-        idx = i;
-      idx %= 256;
-    }
-
-  cert_compute_fpr (cert, fpr);
   /* Compare against the list of to be ignored certificates.  */
   for (ignored = opt.ignored_certs; ignored; ignored = ignored->next)
     if (ignored->binlen == 20 && !memcmp (fpr, ignored->hexfpr, 20))
@@ -343,20 +550,17 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
       }
 
   for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (ci->cert && !memcmp (ci->fpr, fpr, 20))
+    if (ITEM_VALID (ci) && !memcmp (ci->fpr, fpr, 20))
       return gpg_error (GPG_ERR_DUP_VALUE);
-  /* Try to reuse an existing entry.  */
-  for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (!ci->cert)
-      break;
+
+  /* If we already reached the caching limit, make room.  */
+  if (!permanent && opt.max_cached_certs
+      && total_nonperm_certificates >= opt.max_cached_certs)
+    *r_dropped = drop_nonperm_certs ();
+
+  ci = alloc_cache_slot (fpr);
   if (!ci)
-    { /* No: Create a new entry.  */
-      ci = xtrycalloc (1, sizeof *ci);
-      if (!ci)
-        return gpg_error_from_errno (errno);
-      ci->next = cert_cache[*fpr];
-      cert_cache[*fpr] = ci;
-    }
+    return gpg_error_from_errno (errno);
 
   ksba_cert_ref (cert);
   ci->cert = cert;
@@ -369,8 +573,12 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
       return gpg_error (GPG_ERR_INV_CERT_OBJ);
     }
   ci->subject_dn = ksba_cert_get_subject (cert, 0);
+  if (ksba_cert_get_subj_key_id (cert, NULL, &ci->ski))
+    ci->ski = NULL;
   ci->permanent = !!permanent;
   ci->trustclasses = trustclass;
+  ci->referenced = 1;
+  index_insert (ci);
 
   if (permanent)
     any_cert_of_class |= trustclass;
@@ -381,6 +589,56 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
 }
 
 
+/* Put the certificate CERT into the cache.  It is assumed that the
+ * cache is write locked while this function is called.  This is used
+ * to load the permanent certificates; see put_cert_fpr for the
+ * arguments.  */
+static gpg_error_t
+put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass)
+{
+  unsigned char fpr[20];
+  unsigned int dropped;
+
+  cert_compute_fpr (cert, fpr);
+  return put_cert_fpr (cert, permanent, trustclass, fpr, &dropped);
+}
+
+
+/* Put the non-permanent certificate CERT into the cache.  Other than
+ * put_cert this function takes care of the locking: The fingerprint
+ * is computed without holding a lock and the common case of an
+ * already cached certificate is detected using only the read lock.
+ * If FPR_BUFFER is not NULL the fingerprint of the certificate will
+ * be stored there.  FPR_BUFFER needs to point to a buffer of at least
+ * 20 bytes.  */
+static gpg_error_t
+put_runtime_cert (ksba_cert_t cert, void *fpr_buffer)
+{
+  gpg_error_t err;
+  unsigned char help_fpr_buffer[20], *fpr;
+  unsigned int dropped;
+  cert_item_t ci;
+
+  fpr = fpr_buffer? fpr_buffer : help_fpr_buffer;
+  cert_compute_fpr (cert, fpr);
+
+  acquire_cache_read_lock ();
+  for (ci=cert_cache[*fpr]; ci; ci = ci->next)
+    if (ITEM_VALID (ci) && !memcmp (ci->fpr, fpr, 20))
+      break;
+  release_cache_lock ();
+  if (ci)
+    return gpg_error (GPG_ERR_DUP_VALUE);
+
+  acquire_cache_write_lock ();
+  err = put_cert_fpr (cert, 0, 0, fpr, &dropped);
+  release_cache_lock ();
+  if (dropped)
+    log_info (_("dropping %u certificates from the cache\n"), dropped);
+  return err;
+}
+
+
 /* Load certificates from the directory DIRNAME.  All certificates
    matching the pattern "*.crt" or "*.der"  are loaded.  We assume that
    certificates are DER encoded and not PEM encapsulated.  The cache
@@ -443,7 +701,7 @@ load_certs_from_dir (const char *dirname, unsigned int trustclass)
           continue;
         }
 
-      err = put_cert (cert, 1, trustclass, NULL);
+      err = put_cert (cert, 1, trustclass);
       if (gpg_err_code (err) == GPG_ERR_DUP_VALUE)
         log_info (_("certificate '%s' already cached\n"), fname);
       else if (!err)
@@ -534,7 +792,7 @@ load_certs_from_file (const char *fname, unsigned int trustclasses,
           goto leave;
         }
 
-      err = put_cert (cert, 1, trustclasses, NULL);
+      err = put_cert (cert, 1, trustclasses);
       if (gpg_err_code (err) == GPG_ERR_DUP_VALUE)
         log_info (_("certificate '%s' already cached\n"), fname);
       else if (gpg_err_code (err) == GPG_ERR_NOT_ENABLED)
@@ -646,7 +904,7 @@ load_certs_from_w32_store (const char *storename)
               break;
             }
 
-          err = put_cert (cert, 1, CERTTRUST_CLASS_SYSTEM, NULL);
+          err = put_cert (cert, 1, CERTTRUST_CLASS_SYSTEM);
           if (!err)
             count++;
           if (gpg_err_code (err) == GPG_ERR_DUP_VALUE)
@@ -686,6 +944,369 @@ load_certs_from_w32_store (const char *storename)
 #endif /*HAVE_W32_SYSTEM*/
 
 
+#ifndef HAVE_W32_SYSTEM
+/* A record of the trust store cache.  The file starts with the header
+ * line as returned by trust_store_header followed by records of this
+ * layout:
+ *
+ *   20 byte fingerprint
+ *   16 byte notAfter as Nul terminated ISO time or all zero
+ *    4 byte length of the DER encoded certificate
+ *    4 byte length of the issuer DN
+ *    4 byte length of the subject DN (0 if there is none)
+ *    4 byte length of the canonical S-expression with the serial number
+ *    4 byte length of the canonical S-expression with the SKI (or 0)
+ *
+ * followed by the data of the given lengths.  All numbers are in
+ * network byte order.  */
+struct stored_cert_s
+{
+  const unsigned char *fpr;
+  const char *not_after;
+  const unsigned char *der;
+  size_t derlen;
+  const char *issuer;
+  size_t issuerlen;
+  const char *subject;
+  size_t subjectlen;
+  const unsigned char *sn;
+  size_t snlen;
+  const unsigned char *ski;
+  size_t skilen;
+};
+
+
+/* Return a malloced header line for the trust store cache build from
+ * the bundle FNAME with the stat info ST.  This also covers the
+ * options which affect the set of loaded certificates.  */
+static char *
+trust_store_header (const char *fname, struct stat *st)
+{
+  fingerprint_list_t ignored;
+  gcry_md_hd_t md;
+  char hexdigest[41];
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    return NULL;
+  for (ignored = opt.ignored_certs; ignored; ignored = ignored->next)
+    gcry_md_write (md, ignored->hexfpr, ignored->binlen);
+  bin2hex (gcry_md_read (md, GCRY_MD_SHA1), 20, hexdigest);
+  gcry_md_close (md);
+
+  return xtryasprintf ("GnuPG trust store cache v%d %lu %lu %s %d %s\n",
+                       TRUSTSTORE_CACHE_VERSION,
+                       (unsigned long)st->st_mtime,
+                       (unsigned long)st->st_size,
+                       hexdigest, !!opt.debug_cache_expired_certs, fname);
+}
+
+
+/* Parse the record at P and store it at SC.  END is the end of the
+ * buffer.  Returns the address of the next record or NULL for an
+ * invalid record.  */
+static const unsigned char *
+parse_stored_cert (const unsigned char *p, const unsigned char *end,
+                   struct stored_cert_s *sc)
+{
+  size_t n;
+
+  if (end - p < 20 + 16 + 5*4)
+    return NULL;
+  sc->fpr = p;
+  sc->not_after = (const char *)p + 20;
+  sc->derlen     = buf32_to_size_t (p + 36);
+  sc->issuerlen  = buf32_to_size_t (p + 40);
+  sc->subjectlen = buf32_to_size_t (p + 44);
+  sc->snlen      = buf32_to_size_t (p + 48);
+  sc->skilen     = buf32_to_size_t (p + 52);
+  p += 56;
+  n = end - p;
+  if (sc->not_after[15] || !sc->derlen || !sc->issuerlen || !sc->snlen
+      || sc->derlen > n || sc->issuerlen > n || sc->subjectlen > n
+      || sc->snlen > n || sc->skilen > n
+      || (sc->derlen + sc->issuerlen + sc->subjectlen
+          + sc->snlen + sc->skilen) > n)
+    return NULL;
+  sc->der = p;
+  p += sc->derlen;
+  sc->issuer = (const char *)p;
+  p += sc->issuerlen;
+  sc->subject = (const char *)p;
+  p += sc->subjectlen;
+  sc->sn = p;
+  p += sc->snlen;
+  sc->ski = p;
+  p += sc->skilen;
+
+  if (gcry_sexp_canon_len (sc->sn, sc->snlen, NULL, NULL) != sc->snlen
+      || (sc->skilen
+          && gcry_sexp_canon_len (sc->ski, sc->skilen, NULL, NULL)
+          != sc->skilen))
+    return NULL;
+  return p;
+}
+
+
+/* Put the not yet parsed system certificate SC into the cache.  It is
+ * assumed that the cache is write locked.  */
+static gpg_error_t
+put_stored_cert (struct stored_cert_s *sc)
+{
+  cert_item_t ci;
+  fingerprint_list_t ignored;
+
+  for (ignored = opt.ignored_certs; ignored; ignored = ignored->next)
+    if (ignored->binlen == 20 && !memcmp (sc->fpr, ignored->hexfpr, 20))
+      return gpg_error (GPG_ERR_NOT_ENABLED);
+
+  for (ci=cert_cache[*sc->fpr]; ci; ci = ci->next)
+    if (ITEM_VALID (ci) && !memcmp (ci->fpr, sc->fpr, 20))
+      return gpg_error (GPG_ERR_DUP_VALUE);
+
+  ci = alloc_cache_slot (sc->fpr);
+  if (!ci)
+    return gpg_error_from_syserror ();
+
+  ci->der = sc->der;
+  ci->derlen = sc->derlen;
+  memcpy (ci->fpr, sc->fpr, 20);
+  ci->issuer_dn = xtrymalloc (sc->issuerlen + 1);
+  ci->sn = xtrymalloc (sc->snlen);
+  if (sc->subjectlen)
+    ci->subject_dn = xtrymalloc (sc->subjectlen + 1);
+  if (sc->skilen)
+    ci->ski = xtrymalloc (sc->skilen);
+  if (!ci->issuer_dn || !ci->sn
+      || (sc->subjectlen && !ci->subject_dn) || (sc->skilen && !ci->ski))
+    {
+      gpg_error_t err = gpg_error_from_syserror ();
+      clean_cache_slot (ci);
+      return err;
+    }
+  memcpy (ci->issuer_dn, sc->issuer, sc->issuerlen);
+  ci->issuer_dn[sc->issuerlen] = 0;
+  memcpy (ci->sn, sc->sn, sc->snlen);
+  if (sc->subjectlen)
+    {
+      memcpy (ci->subject_dn, sc->subject, sc->subjectlen);
+      ci->subject_dn[sc->subjectlen] = 0;
+    }
+  if (sc->skilen)
+    memcpy (ci->ski, sc->ski, sc->skilen);
+  ci->permanent = 1;
+  ci->trustclasses = CERTTRUST_CLASS_SYSTEM;
+  ci->referenced = 1;
+  index_insert (ci);
+  any_cert_of_class |= CERTTRUST_CLASS_SYSTEM;
+
+  return 0;
+}
+
+
+/* Load the system certificates from the trust store cache if it has
+ * been built from the bundle FNAME with the stat info ST.  The cache
+ * file is mapped into memory and the certificates are only parsed on
+ * first use.  The cache should be in a locked state when calling this
+ * function.  */
+static gpg_error_t
+load_trust_store_cache (const char *fname, struct stat *st)
+{
+  gpg_error_t err = 0;
+  char *cachename = NULL;
+  char *header = NULL;
+  int fd = -1;
+  struct stat cst;
+  void *map = NULL;
+  size_t maplen = 0;
+  size_t headerlen;
+  const unsigned char *p, *end;
+  struct stored_cert_s sc;
+  ksba_isotime_t current_time;
+  unsigned int count = 0;
+
+  cachename = make_filename_try (opt.homedir_cache, TRUSTSTORE_CACHE_FILE,
+                                 NULL);
+  header = trust_store_header (fname, st);
+  if (!cachename || !header)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  fd = gnupg_open (cachename, O_RDONLY, 0);
+  if (fd == -1 || fstat (fd, &cst))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  headerlen = strlen (header);
+  if (cst.st_size <= headerlen || cst.st_size > 64*1024*1024)
+    {
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto leave;
+    }
+  maplen = cst.st_size;
+  map = mmap (NULL, maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    {
+      map = NULL;
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (memcmp (map, header, headerlen))
+    {
+      err = gpg_error (GPG_ERR_NOT_FOUND);  /* Stale cache.  */
+      goto leave;
+    }
+
+  /* First check the entire file so that we don't end up with a
+   * partially loaded store.  */
+  end = (const unsigned char *)map + maplen;
+  for (p = (const unsigned char *)map + headerlen; p && p < end; )
+    p = parse_stored_cert (p, end, &sc);
+  if (!p)
+    {
+      log_info ("invalid record in '%s' - ignoring file\n", cachename);
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto leave;
+    }
+
+  gnupg_get_isotime (current_time);
+  for (p = (const unsigned char *)map + headerlen; p < end; )
+    {
+      p = parse_stored_cert (p, end, &sc);
+      if (!opt.debug_cache_expired_certs
+          && *sc.not_after && strcmp (current_time, sc.not_after) > 0)
+        continue;
+      if (!put_stored_cert (&sc))
+        count++;
+    }
+
+  trust_store_map = map;
+  trust_store_maplen = maplen;
+  map = NULL;
+  if (opt.verbose)
+    log_info ("%u system certificates taken from '%s'\n", count, cachename);
+
+ leave:
+  if (map)
+    munmap (map, maplen);
+  if (fd != -1)
+    close (fd);
+  xfree (header);
+  xfree (cachename);
+  return err;
+}
+
+
+/* Write the four byte number N to FP.  */
+static void
+write_u32 (estream_t fp, size_t n)
+{
+  es_putc ((n >> 24) & 0xff, fp);
+  es_putc ((n >> 16) & 0xff, fp);
+  es_putc ((n >>  8) & 0xff, fp);
+  es_putc (n & 0xff, fp);
+}
+
+
+/* Write all system certificates to the trust store cache for the
+ * bundle FNAME with the stat info ST.  This is called right after
+ * loading that bundle with the cache locked.  Errors are only
+ * logged.  */
+static void
+save_trust_store_cache (const char *fname, struct stat *st)
+{
+  gpg_error_t err = 0;
+  char *cachename = NULL;
+  char *tmpname = NULL;
+  char *header = NULL;
+  estream_t fp = NULL;
+  cert_item_t ci;
+  int idx;
+  ksba_isotime_t not_after;
+  const unsigned char *der;
+  size_t derlen, snlen, skilen;
+
+  cachename = make_filename_try (opt.homedir_cache, TRUSTSTORE_CACHE_FILE,
+                                 NULL);
+  tmpname = cachename? strconcat (cachename, ".tmp", NULL) : NULL;
+  header = trust_store_header (fname, st);
+  if (!cachename || !tmpname || !header)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  fp = es_fopen (tmpname, "wb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  es_fputs (header, fp);
+
+  for (idx = 0; idx < 256; idx++)
+    for (ci = cert_cache[idx]; ci; ci = ci->next)
+      {
+        if (!ci->cert || !ci->permanent
+            || !(ci->trustclasses & CERTTRUST_CLASS_SYSTEM))
+          continue;
+        der = ksba_cert_get_image (ci->cert, &derlen);
+        if (!der)
+          continue;
+        memset (not_after, 0, sizeof not_after);
+        if (ksba_cert_get_validity (ci->cert, 1, not_after))
+          memset (not_after, 0, sizeof not_after);
+        snlen = gcry_sexp_canon_len (ci->sn, 0, NULL, NULL);
+        skilen = ci->ski? gcry_sexp_canon_len (ci->ski, 0, NULL, NULL) : 0;
+
+        es_fwrite (ci->fpr, 20, 1, fp);
+        es_fwrite (not_after, 16, 1, fp);
+        write_u32 (fp, derlen);
+        write_u32 (fp, strlen (ci->issuer_dn));
+        write_u32 (fp, ci->subject_dn? strlen (ci->subject_dn) : 0);
+        write_u32 (fp, snlen);
+        write_u32 (fp, skilen);
+        es_fwrite (der, derlen, 1, fp);
+        es_fputs (ci->issuer_dn, fp);
+        if (ci->subject_dn)
+          es_fputs (ci->subject_dn, fp);
+        es_fwrite (ci->sn, snlen, 1, fp);
+        if (skilen)
+          es_fwrite (ci->ski, skilen, 1, fp);
+      }
+
+  if (es_ferror (fp))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      fp = NULL;
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fp = NULL;
+  err = gnupg_rename_file (tmpname, cachename, NULL);
+
+ leave:
+  if (err)
+    log_info ("error writing '%s': %s\n",
+              tmpname? tmpname : TRUSTSTORE_CACHE_FILE, gpg_strerror (err));
+  if (fp)
+    {
+      es_fclose (fp);
+      gnupg_remove (tmpname);
+    }
+  xfree (header);
+  xfree (tmpname);
+  xfree (cachename);
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 /* Load the trusted certificates provided by the system.  */
 static gpg_error_t
 load_certs_from_system (void)
@@ -715,12 +1336,22 @@ load_certs_from_system (void)
   };
   int idx;
   gpg_error_t err = 0;
+  struct stat st;
 
   for (idx=0; idx < DIM (table); idx++)
     if (!gnupg_access (table[idx].name, F_OK))
       {
-        /* Take the first available bundle.  */
+        /* Take the first available bundle.  Parsing a large bundle
+         * takes a while; thus we use a compiled copy of it if it is
+         * still current.  */
+        if (gnupg_stat (table[idx].name, &st))
+          st.st_mtime = 0;
+        if (st.st_mtime
+            && !load_trust_store_cache (table[idx].name, &st))
+          break;
         err = load_certs_from_file (table[idx].name, CERTTRUST_CLASS_SYSTEM, 0);
+        if (!err && st.st_mtime)
+          save_trust_store_cache (table[idx].name, &st);
         break;
       }
 
@@ -789,6 +1420,15 @@ cert_cache_deinit (int full)
     for (ci=cert_cache[i]; ci; ci = ci->next)
       clean_cache_slot (ci);
 
+#ifndef HAVE_W32_SYSTEM
+  if (trust_store_map)
+    {
+      munmap (trust_store_map, trust_store_maplen);
+      trust_store_map = NULL;
+      trust_store_maplen = 0;
+    }
+#endif
+
   if (full)
     {
       for (i=0; i < 256; i++)
@@ -810,58 +1450,96 @@ cert_cache_deinit (int full)
   release_cache_lock ();
 }
 
-/* Print some statistics to the log file.  */
-void
-cert_cache_print_stats (ctrl_t ctrl)
+/* The number of cached certificates by kind.  */
+struct cert_cache_counts_s
+{
+  unsigned int nonperm;
+  unsigned int permanent;
+  unsigned int trusted;
+  unsigned int trustclass_system;
+  unsigned int trustclass_config;
+  unsigned int trustclass_hkp;
+  unsigned int trustclass_hkpspool;
+};
+
+
+/* Count the items of the cache and store the result at R_COUNTS.  */
+static void
+count_cached_certs (struct cert_cache_counts_s *r_counts)
 {
   cert_item_t ci;
   int idx;
-  unsigned int n_nonperm = 0;
-  unsigned int n_permanent = 0;
-  unsigned int n_trusted = 0;
-  unsigned int n_trustclass_system = 0;
-  unsigned int n_trustclass_config = 0;
-  unsigned int n_trustclass_hkp = 0;
-  unsigned int n_trustclass_hkpspool = 0;
 
+  memset (r_counts, 0, sizeof *r_counts);
   acquire_cache_read_lock ();
   for (idx = 0; idx < 256; idx++)
     for (ci=cert_cache[idx]; ci; ci = ci->next)
-      if (ci->cert)
+      if (ITEM_VALID (ci))
         {
           if (ci->permanent)
-            n_permanent++;
+            r_counts->permanent++;
           else
-            n_nonperm++;
+            r_counts->nonperm++;
           if (ci->trustclasses)
             {
-              n_trusted++;
+              r_counts->trusted++;
               if ((ci->trustclasses & CERTTRUST_CLASS_SYSTEM))
-                n_trustclass_system++;
+                r_counts->trustclass_system++;
               if ((ci->trustclasses & CERTTRUST_CLASS_CONFIG))
-                n_trustclass_config++;
+                r_counts->trustclass_config++;
               if ((ci->trustclasses & CERTTRUST_CLASS_HKP))
-                n_trustclass_hkp++;
+                r_counts->trustclass_hkp++;
               if ((ci->trustclasses & CERTTRUST_CLASS_HKPSPOOL))
-                n_trustclass_hkpspool++;
+                r_counts->trustclass_hkpspool++;
             }
         }
 
   release_cache_lock ();
+}
+
+
+/* Print some statistics to the log file.  */
+void
+cert_cache_print_stats (ctrl_t ctrl)
+{
+  struct cert_cache_counts_s n;
+
+  count_cached_certs (&n);
 
   dirmngr_status_helpf (ctrl,
                  _("permanently loaded certificates: %u\n"),
-                        n_permanent);
+                        n.permanent);
   dirmngr_status_helpf (ctrl,
                  _("    runtime cached certificates: %u\n"),
-                        n_nonperm);
+                        n.nonperm);
   dirmngr_status_helpf (ctrl,
                  _("           trusted certificates: %u (%u,%u,%u,%u)\n"),
-                        n_trusted,
-                        n_trustclass_system,
-                        n_trustclass_config,
-                        n_trustclass_hkp,
-                        n_trustclass_hkpspool);
+                        n.trusted,
+                        n.trustclass_system,
+                        n.trustclass_config,
+                        n.trustclass_hkp,
+                        n.trustclass_hkpspool);
+}
+
+
+/* The metrics source for the certificate cache.  */
+void
+cert_cache_metrics (metrics_writer_t w)
+{
+  struct cert_cache_counts_s n;
+
+  count_cached_certs (&n);
+
+  metrics_begin (w, METRIC_GAUGE, "certcache_certs",
+                 "Number of cached certificates.");
+  metrics_put (w, "kind", "permanent", n.permanent);
+  metrics_put (w, "kind", "runtime", n.nonperm);
+  metrics_begin (w, METRIC_GAUGE, "certcache_trusted_certs",
+                 "Number of cached trusted certificates by class.");
+  metrics_put (w, "class", "system", n.trustclass_system);
+  metrics_put (w, "class", "config", n.trustclass_config);
+  metrics_put (w, "class", "hkp", n.trustclass_hkp);
+  metrics_put (w, "class", "hkpspool", n.trustclass_hkpspool);
 }
 
 
@@ -880,9 +1558,7 @@ cache_cert (ksba_cert_t cert)
 {
   gpg_error_t err;
 
-  acquire_cache_write_lock ();
-  err = put_cert (cert, 0, 0, NULL);
-  release_cache_lock ();
+  err = put_runtime_cert (cert, NULL);
   if (gpg_err_code (err) == GPG_ERR_DUP_VALUE)
     log_info (_("certificate already cached\n"));
   else if (!err)
@@ -904,9 +1580,7 @@ cache_cert_silent (ksba_cert_t cert, void *fpr_buffer)
 {
   gpg_error_t err;
 
-  acquire_cache_write_lock ();
-  err = put_cert (cert, 0, 0, fpr_buffer);
-  release_cache_lock ();
+  err = put_runtime_cert (cert, fpr_buffer);
   if (gpg_err_code (err) == GPG_ERR_DUP_VALUE)
     err = 0;
 
@@ -929,14 +1603,16 @@ ksba_cert_t
 get_cert_byfpr (const unsigned char *fpr)
 {
   cert_item_t ci;
+  ksba_cert_t cert;
 
   acquire_cache_read_lock ();
   for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (ci->cert && !memcmp (ci->fpr, fpr, 20))
+    if (ITEM_VALID (ci) && !memcmp (ci->fpr, fpr, 20))
       {
-        ksba_cert_ref (ci->cert);
+        ci->referenced = 1;
+        cert = ref_item_cert (ci);
         release_cache_lock ();
-        return ci->cert;
+        return cert;
       }
 
   release_cache_lock ();
@@ -989,22 +1665,20 @@ get_cert_byhexfpr (const char *string)
 ksba_cert_t
 get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 {
-  /* Simple and inefficient implementation.   fixme! */
   cert_item_t ci;
-  int i;
+  ksba_cert_t cert;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn)
-            && !compare_serialno (ci->sn, serialno))
-          {
-            ksba_cert_ref (ci->cert);
-            release_cache_lock ();
-            return ci->cert;
-          }
-    }
+  for (ci = cert_index[CERT_INDEX_SN][sn_bucket (issuer_dn, serialno)];
+       ci; ci = ci->inext[CERT_INDEX_SN])
+    if (!strcmp (ci->issuer_dn, issuer_dn)
+        && !compare_serialno (ci->sn, serialno))
+      {
+        ci->referenced = 1;
+        cert = ref_item_cert (ci);
+        release_cache_lock ();
+        return cert;
+      }
 
   release_cache_lock ();
   return NULL;
@@ -1016,22 +1690,20 @@ get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 ksba_cert_t
 get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
+  ksba_cert_t cert;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci = cert_index[CERT_INDEX_ISSUER][dn_bucket (issuer_dn)];
+       ci; ci = ci->inext[CERT_INDEX_ISSUER])
+    if (!strcmp (ci->issuer_dn, issuer_dn))
+      if (!seq--)
+        {
+          ci->referenced = 1;
+          cert = ref_item_cert (ci);
+          release_cache_lock ();
+          return cert;
+        }
 
   release_cache_lock ();
   return NULL;
@@ -1043,26 +1715,23 @@ get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 ksba_cert_t
 get_cert_bysubject (const char *subject_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
+  ksba_cert_t cert;
 
   if (!subject_dn)
     return NULL;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && ci->subject_dn
-            && !strcmp (ci->subject_dn, subject_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci = cert_index[CERT_INDEX_SUBJECT][dn_bucket (subject_dn)];
+       ci; ci = ci->inext[CERT_INDEX_SUBJECT])
+    if (!strcmp (ci->subject_dn, subject_dn))
+      if (!seq--)
+        {
+          ci->referenced = 1;
+          cert = ref_item_cert (ci);
+          release_cache_lock ();
+          return cert;
+        }
 
   release_cache_lock ();
   return NULL;
@@ -1503,24 +2172,23 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
     {
       cert_item_t ci;
       cert_ref_t cr;
-      int i;
 
       /* For efficiency reasons we won't use get_cert_bysubject here. */
       acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && ci->subject_dn
-              && !strcmp (ci->subject_dn, subject_dn))
-            for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
-              if (!memcmp (ci->fpr, cr->fpr, 20))
-                {
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  if (DBG_LOOKUP)
-                    log_debug ("%s: certificate found in the cache"
-                               " via ocsp_certs\n", __func__);
-                  return ci->cert; /* We use this certificate. */
-                }
+      for (ci = cert_index[CERT_INDEX_SUBJECT][dn_bucket (subject_dn)];
+           ci; ci = ci->inext[CERT_INDEX_SUBJECT])
+        if (!strcmp (ci->subject_dn, subject_dn))
+          for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
+            if (!memcmp (ci->fpr, cr->fpr, 20))
+              {
+                ci->referenced = 1;
+                cert = ref_item_cert (ci);
+                release_cache_lock ();
+                if (DBG_LOOKUP)
+                  log_debug ("%s: certificate found in the cache"
+                             " via ocsp_certs\n", __func__);
+                return cert; /* We use this certificate. */
+              }
       release_cache_lock ();
       if (DBG_LOOKUP)
         log_debug ("find_cert_bysubject: certificate not in ocsp_certs\n");
@@ -1572,27 +2240,21 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
    * by keyid.  */
   if (!subject_dn && keyid)
     {
-      int i;
       cert_item_t ci;
-      ksba_sexp_t ski;
 
       acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && !ksba_cert_get_subj_key_id (ci->cert, NULL, &ski))
-            {
-              if (!cmp_simple_canon_sexp (keyid, ski))
-                {
-                  ksba_free (ski);
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  if (DBG_LOOKUP)
-                    log_debug ("%s: certificate found in the cache"
-                               " via ski\n", __func__);
-                  return ci->cert;
-                }
-              ksba_free (ski);
-            }
+      for (ci = cert_index[CERT_INDEX_SKI][ski_bucket (keyid)];
+           ci; ci = ci->inext[CERT_INDEX_SKI])
+        if (!cmp_simple_canon_sexp (keyid, ci->ski))
+          {
+            ci->referenced = 1;
+            cert = ref_item_cert (ci);
+            release_cache_lock ();
+            if (DBG_LOOKUP)
+              log_debug ("%s: certificate found in the cache"
+                         " via ski\n", __func__);
+            return cert;
+          }
       release_cache_lock ();
     }
 
@@ -1719,7 +2381,7 @@ is_trusted_cert (ksba_cert_t cert, unsigned int trustclasses)
 
   acquire_cache_read_lock ();
   for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (ci->cert && !memcmp (ci->fpr, fpr, 20))
+    if (ITEM_VALID (ci) && !memcmp (ci->fpr, fpr, 20))
       {
         if ((ci->trustclasses & trustclasses))
           {
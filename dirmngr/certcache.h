@@ -38,6 +38,7 @@ void cert_cache_deinit (int full);
 
 /* Print some statistics to the log file.  */
 void cert_cache_print_stats (ctrl_t ctrl);
+void cert_cache_metrics (metrics_writer_t w);
 
 /* Return true if any cert of a class in MASK is permanently loaded.  */
 int cert_cache_any_in_class (unsigned int mask);
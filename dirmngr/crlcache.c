@@ -109,6 +109,7 @@
 #include "crlfetch.h"
 #include "misc.h"
 #include "cdb.h"
+#include "../common/tlv.h"
 
 /* Change this whenever the format changes */
 #define DBDIR_D "crls.d"
@@ -118,8 +119,26 @@
 /* The number of DB files we may have open at one time.  We need to
    limit this because there is no guarantee that the number of issuers
    has a upper limit.  We are currently using mmap, so it is a good
-   idea anyway to limit the number of opened cache files. */
-#define MAX_OPEN_DB_FILES 5
+   idea anyway to limit the number of opened cache files.  The open
+   files are kept mapped between checks so that a revocation check is
+   a hash probe; thus the limit should cover the issuers of a typical
+   batch of certificates. */
+#define MAX_OPEN_DB_FILES 16
+
+/* The number of CRL entries for which the index information is kept
+   in memory while building a cache file.  For larger CRLs the index
+   information is moved to a temporary spill file.  */
+#define MAX_CDB_MEMORY_RECORDS 65536
+
+/* Cached CRLs are refreshed in the background once their nextUpdate
+   is less than CRL_REFRESH_AHEAD seconds away.  To avoid fetching all
+   CRLs of a common nextUpdate at the same time each CRL gets a fixed
+   offset of up to CRL_REFRESH_JITTER seconds.  At most
+   CRL_REFRESH_MAX_PER_RUN downloads are scheduled per housekeeping
+   run to limit the used bandwidth.  */
+#define CRL_REFRESH_AHEAD       (2*60*60)
+#define CRL_REFRESH_JITTER      (60*60)
+#define CRL_REFRESH_MAX_PER_RUN 2
 
 #ifndef O_BINARY
 # define O_BINARY 0
@@ -133,8 +152,10 @@
 
 
 static const char oidstr_crlNumber[] = "2.5.29.20";
+static const char oidstr_deltaCRLIndicator[] = "2.5.29.27";
 /* static const char oidstr_issuingDistributionPoint[] = "2.5.29.28"; */
 static const char oidstr_authorityKeyIdentifier[] = "2.5.29.35";
+static const char oidstr_freshestCRL[] = "2.5.29.46";
 
 
 /* Definition of one cached item. */
@@ -162,9 +183,10 @@ struct crl_cache_entry_s
   struct cdb *cdb;             /* The cache file handle or NULL if not open. */
 
   unsigned int cdb_use_count;  /* Current use count. */
-  unsigned int cdb_lru_count;  /* Used for LRU purposes. */
+  unsigned int cdb_lru_count;  /* Value of LRU_TICK at the last use. */
   int dbfile_checked;          /* Set to true if the dbfile_hash value has
                                   been checked once. */
+  int refresh_scheduled;       /* A background refresh has been queued. */
 };
 
 
@@ -172,6 +194,7 @@ struct crl_cache_entry_s
 struct crl_cache_s
 {
   crl_cache_entry_t entries;
+  unsigned int lru_tick;       /* Incremented for each use of a DB file. */
 };
 
 typedef struct crl_cache_s *crl_cache_t;
@@ -1084,6 +1107,7 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   if (entry->cdb)
     {
       entry->cdb_use_count++;
+      entry->cdb_lru_count = ++cache->lru_tick;
       return entry->cdb;
     }
 
@@ -1168,7 +1192,7 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   xfree (fname);
 
   entry->cdb_use_count = 1;
-  entry->cdb_lru_count = 0;
+  entry->cdb_lru_count = ++cache->lru_tick;
 
   return entry->cdb;
 }
@@ -1182,26 +1206,29 @@ unlock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   else if (!entry->cdb_use_count)
     log_error (_("calling unlock_db_file on an unlocked file\n"));
   else
-    {
-      entry->cdb_use_count--;
-      entry->cdb_lru_count++;
-    }
+    entry->cdb_use_count--;
 
   /* If the entry was marked for deletion in the meantime do it now.
-     We do this for the sake of Pth thread safeness. */
+     We do this for the sake of Pth thread safeness.  The file has
+     been replaced by a new CRL and thus we also close it; the new
+     entry will open the new file.  */
   if (!entry->cdb_use_count && entry->deleted)
     {
-      crl_cache_entry_t eprev, enext;
+      crl_cache_entry_t *ep;
 
-      enext = entry->next;
-      for (eprev = cache->entries;
-           eprev && eprev->next != entry; eprev = eprev->next)
+      if (entry->cdb)
+        {
+          int fd = cdb_fileno (entry->cdb);
+          cdb_free (entry->cdb);
+          xfree (entry->cdb);
+          entry->cdb = NULL;
+          if (close (fd))
+            log_error (_("error closing cache file: %s\n"), strerror(errno));
+        }
+      for (ep = &cache->entries; *ep && *ep != entry; ep = &(*ep)->next)
         ;
-      assert (eprev);
-      if (eprev == cache->entries)
-        cache->entries = enext;
-      else
-        eprev->next = enext;
+      if (*ep)
+        *ep = entry->next;
       /* FIXME: Do we leak ENTRY? */
     }
 }
@@ -1908,7 +1935,7 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
                   struct cdb_make *cdb, const char *fname,
                   char **r_crlissuer,
                   ksba_isotime_t thisupdate, ksba_isotime_t nextupdate,
-                  char **r_trust_anchor)
+                  char **r_trust_anchor, strlist_t *r_removed)
 {
   gpg_error_t err;
   ksba_stop_reason_t stopreason;
@@ -1985,6 +2012,24 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
             p = serial_to_buffer (serial, &n);
             if (!p)
               BUG ();
+            if ((reason & KSBA_CRLREASON_REMOVE_FROM_CRL))
+              {
+                /* This reason is only used by delta CRLs to remove
+                 * an entry from the base CRL; we keep a list of them
+                 * for merge_delta_crl.  */
+                char *hexserial = bin2hex (p, n, NULL);
+
+                if (!hexserial || !add_to_strlist_try (r_removed, hexserial))
+                  {
+                    err = gpg_error_from_syserror ();
+                    xfree (hexserial);
+                    ksba_free (serial);
+                    goto failure;
+                  }
+                xfree (hexserial);
+                ksba_free (serial);
+                break;
+              }
             record[0] = (reason & 0xff);
             memcpy (record+1, rdate, 15);
             rc = cdb_make_add (cdb, p, n, record, 1+15);
@@ -2187,6 +2232,314 @@ get_auth_key_id (ksba_crl_t crl, char **serialno)
 
 
 
+
+/* If CRL is a delta CRL store the hex encoded BaseCRLNumber at
+   R_NUMBER and return 0.  Returns GPG_ERR_NOT_FOUND for a complete
+   CRL.  */
+static gpg_error_t
+get_delta_base_number (ksba_crl_t crl, char **r_number)
+{
+  gpg_error_t err;
+  int idx, crit;
+  const char *oid;
+  const unsigned char *der;
+  size_t derlen, objlen, hdrlen;
+  int class, tag, constructed, ndef;
+
+  *r_number = NULL;
+
+  for (idx=0; !(err=ksba_crl_get_extension (crl, idx, &oid, &crit,
+                                             &der, &derlen)); idx++)
+    if (!strcmp (oid, oidstr_deltaCRLIndicator))
+      break;
+  if (gpg_err_code (err) == GPG_ERR_EOF
+      || gpg_err_code (err) == GPG_ERR_NO_DATA)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  if (err)
+    return err;
+
+  /* BaseCRLNumber ::= CRLNumber ::= INTEGER (0..MAX) */
+  if (parse_ber_header (&der, &derlen, &class, &tag, &constructed,
+                        &ndef, &objlen, &hdrlen)
+      || class != CLASS_UNIVERSAL || tag != TAG_INTEGER || constructed
+      || ndef || !objlen || objlen > derlen)
+    {
+      log_error ("invalid deltaCRLIndicator in CRL\n");
+      return gpg_error (GPG_ERR_INV_CRL);
+    }
+
+  *r_number = bin2hex (der, objlen, NULL);
+  if (!*r_number)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Compare the hex encoded CRL numbers A and B numerically.  */
+static int
+compare_crl_numbers (const char *a, const char *b)
+{
+  size_t alen, blen;
+
+  while (*a == '0')
+    a++;
+  while (*b == '0')
+    b++;
+  alen = strlen (a);
+  blen = strlen (b);
+  if (alen != blen)
+    return alen < blen? -1 : 1;
+  return ascii_strcasecmp (a, b);
+}
+
+
+/* Copy all entries from the cache file CDB to the database being
+   built in NEWCDB.  If SKIPCDB is not NULL entries also found in
+   SKIPCDB are not copied; entries with a serial number listed in
+   SKIPLIST are neither copied.  The number of copied entries is
+   added to R_COUNT.  */
+static gpg_error_t
+copy_crl_entries (struct cdb *cdb, struct cdb_make *newcdb,
+                  struct cdb *skipcdb, strlist_t skiplist,
+                  unsigned int *r_count)
+{
+  struct cdb_find cdbfp;
+  unsigned char keyrecord[256];
+  char hexkey[2*sizeof keyrecord+1];
+  unsigned char record[16];
+  cdbi_t n;
+  int rc;
+
+  rc = cdb_findinit (&cdbfp, cdb, NULL, 0);
+  while (!rc && (rc=cdb_findnext (&cdbfp)) > 0 )
+    {
+      rc = 0;
+      n = cdb_keylen (cdb);
+      if (cdb_datalen (cdb) != sizeof record || !n || n > sizeof keyrecord)
+        {
+          log_error (_(" WARNING: invalid cache record length\n"));
+          return gpg_error (GPG_ERR_INV_CRL);
+        }
+      if (cdb_read (cdb, record, sizeof record, cdb_datapos (cdb))
+          || cdb_read (cdb, keyrecord, n, cdb_keypos (cdb)))
+        {
+          log_error (_("problem reading cache record: %s\n"),
+                     strerror (errno));
+          return gpg_error_from_syserror ();
+        }
+
+      if (skipcdb)
+        {
+          rc = cdb_find (skipcdb, keyrecord, n);
+          if (rc < 0)
+            break;
+          if (rc)
+            {
+              rc = 0;
+              continue;  /* Replaced by the delta CRL.  */
+            }
+        }
+      if (skiplist
+          && strlist_find (skiplist, bin2hex (keyrecord, n, hexkey)))
+        continue;  /* Removed by the delta CRL.  */
+
+      if (cdb_make_add (newcdb, keyrecord, n, record, sizeof record))
+        {
+          log_error (_("error inserting item into "
+                       "temporary cache file: %s\n"), strerror (errno));
+          return gpg_error_from_syserror ();
+        }
+      ++*r_count;
+    }
+  if (rc)
+    {
+      log_error (_("error reading cache entry from db: %s\n"),
+                 strerror (errno));
+      return gpg_error (GPG_ERR_INV_CRL);
+    }
+  return 0;
+}
+
+
+/* Apply the delta CRL which has been parsed into the temporary cache
+   file DELTAFNAME to the cached CRL BASE.  REMOVED is the list of
+   hex encoded serial numbers the delta CRL removes from the base CRL.
+   On success the name of a new temporary cache file with the
+   resulting complete CRL is stored at R_FNAME.  */
+static gpg_error_t
+merge_delta_crl (crl_cache_t cache, crl_cache_entry_t base,
+                 const char *deltafname, strlist_t removed, char **r_fname)
+{
+  gpg_error_t err;
+  struct cdb *basecdb;
+  struct cdb deltacdb;
+  int deltacdb_open = 0;
+  struct cdb_make cdb;
+  int cdb_started = 0;
+  int fd_delta = -1;
+  int fd_cdb = -1;
+  int fd_spill = -1;
+  char *fname = NULL;
+  char *spillfname = NULL;
+  unsigned int nbase = 0;
+  unsigned int ndelta = 0;
+
+  *r_fname = NULL;
+
+  basecdb = lock_db_file (cache, base);
+  if (!basecdb)
+    return gpg_error (GPG_ERR_GENERAL);
+  if (!base->dbfile_checked)
+    {
+      log_error ("not applying delta CRL: base CRL may have been"
+                 " tampered with\n");
+      err = gpg_error (GPG_ERR_CHECKSUM);
+      goto leave;
+    }
+
+  fd_delta = gnupg_open (deltafname, O_RDONLY | O_BINARY, 0);
+  if (fd_delta == -1 || cdb_init (&deltacdb, fd_delta))
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("error opening cache file '%s': %s\n"),
+                 deltafname, gpg_strerror (err));
+      goto leave;
+    }
+  deltacdb_open = 1;
+
+  fname = strconcat (deltafname, ".merge", NULL);
+  spillfname = fname? strconcat (fname, ".spill", NULL) : NULL;
+  if (!spillfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fd_cdb = gnupg_open (fname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  if (fd_cdb != -1)
+    fd_spill = gnupg_open (spillfname,
+                           O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0600);
+  if (fd_spill == -1)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("error creating temporary cache file '%s': %s\n"),
+                 fd_cdb == -1? fname : spillfname, gpg_strerror (err));
+      goto leave;
+    }
+  cdb_make_start (&cdb, fd_cdb);
+  cdb_make_set_spill (&cdb, fd_spill, MAX_CDB_MEMORY_RECORDS);
+  cdb_started = 1;
+
+  /* First the entries of the base CRL which are not changed by the
+     delta CRL and then those of the delta CRL.  */
+  err = copy_crl_entries (basecdb, &cdb, &deltacdb, removed, &nbase);
+  if (!err)
+    err = copy_crl_entries (&deltacdb, &cdb, NULL, NULL, &ndelta);
+  if (err)
+    goto leave;
+
+  cdb_started = 0;
+  if (cdb_make_finish (&cdb))
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("error finishing temporary cache file '%s': %s\n"),
+                 fname, gpg_strerror (err));
+      goto leave;
+    }
+  if (close (fd_cdb))
+    {
+      err = gpg_error_from_syserror ();
+      fd_cdb = -1;
+      log_error (_("error closing temporary cache file '%s': %s\n"),
+                 fname, gpg_strerror (err));
+      goto leave;
+    }
+  fd_cdb = -1;
+
+  if (opt.verbose)
+    log_info ("delta CRL applied: %u entries kept, %u set, %u removed\n",
+              nbase, ndelta, strlist_length (removed));
+
+ leave:
+  if (cdb_started)
+    cdb_make_finish (&cdb);
+  if (fd_cdb != -1)
+    close (fd_cdb);
+  if (fd_spill != -1)
+    close (fd_spill);
+  if (spillfname)
+    {
+      gnupg_remove (spillfname);
+      xfree (spillfname);
+    }
+  if (deltacdb_open)
+    cdb_free (&deltacdb);
+  if (fd_delta != -1)
+    close (fd_delta);
+  unlock_db_file (cache, base);
+  if (err)
+    {
+      if (fname)
+        gnupg_remove (fname);
+      xfree (fname);
+    }
+  else
+    *r_fname = fname;
+  return err;
+}
+
+
+/* Check whether the delta CRL CRL can be applied to the cached CRL of
+   ISSUER and do so.  DELTAFNAME is the temporary cache file with the
+   entries of the delta CRL and REMOVED the list of entries to be
+   removed.  On success the name of a new temporary cache file with
+   the complete CRL is stored at R_FNAME.  */
+static gpg_error_t
+apply_delta_crl (crl_cache_t cache, ksba_crl_t crl, const char *issuer,
+                 const char *basenumber, const char *deltafname,
+                 strlist_t removed, char **r_fname)
+{
+  gpg_error_t err;
+  char *issuer_hash;
+  char *number;
+  crl_cache_entry_t base;
+
+  *r_fname = NULL;
+
+  issuer_hash = hashify_data (issuer, strlen (issuer));
+  base = find_entry (cache->entries, issuer_hash);
+  xfree (issuer_hash);
+  number = get_crl_number (crl);
+
+  if (!base || base->invalid || !base->crl_number)
+    {
+      log_info ("no usable base CRL for delta CRL of '%s'\n", issuer);
+      err = gpg_error (GPG_ERR_NO_CRL_KNOWN);
+    }
+  else if (compare_crl_numbers (base->crl_number, basenumber) < 0)
+    {
+      log_info ("cached CRL %s is older than the base CRL %s "
+                "of the delta CRL\n", base->crl_number, basenumber);
+      err = gpg_error (GPG_ERR_NO_CRL_KNOWN);
+    }
+  else if (!number || compare_crl_numbers (base->crl_number, number) >= 0)
+    {
+      log_info ("delta CRL %s is not newer than the cached CRL %s\n",
+                number? number : "[none]", base->crl_number);
+      err = gpg_error (GPG_ERR_NO_CRL_KNOWN);
+    }
+  else
+    {
+      if (opt.verbose)
+        log_info ("applying delta CRL %s to cached CRL %s\n",
+                  number, base->crl_number);
+      err = merge_delta_crl (cache, base, deltafname, removed, r_fname);
+    }
+
+  xfree (number);
+  return err;
+}
+
+
 /* Insert the CRL retrieved using URL into the cache specified by
    CACHE.  The CRL itself will be read from the stream FP and is
    expected in binary format.
@@ -2210,8 +2563,13 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   ksba_crl_t crl;
   char *fname = NULL;
   char *newfname = NULL;
+  char *spillfname = NULL;
+  char *basenumber = NULL;
+  strlist_t removed = NULL;
+  int is_delta = 0;
   struct cdb_make cdb;
   int fd_cdb = -1;
+  int fd_spill = -1;
   char *issuer = NULL;
   char *issuer_hash = NULL;
   ksba_isotime_t thisupdate, nextupdate;
@@ -2295,8 +2653,29 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
   cdb_make_start(&cdb, fd_cdb);
 
+  /* Bound the memory used for large CRLs by using a spill file.  */
+  spillfname = strconcat (fname, ".spill", NULL);
+  if (!spillfname)
+    {
+      err = gpg_error_from_syserror ();
+      cdb_make_finish (&cdb);
+      goto leave;
+    }
+  fd_spill = gnupg_open (spillfname,
+                         O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0600);
+  if (fd_spill == -1)
+    {
+      err = gpg_error_from_errno (errno);
+      log_error (_("error creating temporary cache file '%s': %s\n"),
+                 spillfname, strerror (errno));
+      cdb_make_finish (&cdb);
+      goto leave;
+    }
+  cdb_make_set_spill (&cdb, fd_spill, MAX_CDB_MEMORY_RECORDS);
+
   err = crl_parse_insert (ctrl, crl, &cdb, fname,
-                          &issuer, thisupdate, nextupdate, &trust_anchor);
+                          &issuer, thisupdate, nextupdate, &trust_anchor,
+                          &removed);
   if (err)
     {
       log_error (_("crl_parse_insert failed: %s\n"), gpg_strerror (err));
@@ -2321,6 +2700,30 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
       goto leave;
     }
   fd_cdb = -1;
+  close (fd_spill);
+  fd_spill = -1;
+  gnupg_remove (spillfname);
+
+  /* A delta CRL is applied to the cached CRL of that issuer which
+     results in a new temporary cache file with the complete CRL.  */
+  err = get_delta_base_number (crl, &basenumber);
+  if (!err)
+    {
+      char *mergedfname;
+
+      err = apply_delta_crl (cache, crl, issuer, basenumber, fname,
+                             removed, &mergedfname);
+      if (err)
+        goto leave;
+      gnupg_remove (fname);
+      xfree (fname);
+      fname = mergedfname;
+      is_delta = 1;
+    }
+  else if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    err = 0;
+  else
+    goto leave;
 
 
   /* Create a checksum. */
@@ -2361,7 +2764,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
 
       if (!critical
           || !strcmp (oid, oidstr_authorityKeyIdentifier)
-          || !strcmp (oid, oidstr_crlNumber) )
+          || !strcmp (oid, oidstr_crlNumber)
+          || (is_delta && !strcmp (oid, oidstr_deltaCRLIndicator)))
         continue;
 
       for (sl=opt.ignored_crl_extensions;
@@ -2488,12 +2892,21 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   release_one_cache_entry (entry);
   if (fd_cdb != -1)
     close (fd_cdb);
+  if (fd_spill != -1)
+    close (fd_spill);
+  if (spillfname)
+    {
+      gnupg_remove (spillfname);
+      xfree (spillfname);
+    }
   if (fname)
     {
       gnupg_remove (fname);
       xfree (fname);
     }
   xfree (newfname);
+  xfree (basenumber);
+  free_strlist (removed);
   ksba_crl_release (crl);
   xfree (issuer);
   xfree (issuer_hash);
@@ -2686,8 +3099,219 @@ crl_cache_load (ctrl_t ctrl, const char *filename)
 }
 
 
+/* Fetch the CRL from the distribution point URL and store it in the
+   cache.  If another connection is already doing this for the same
+   URL we wait for it and return its result.  */
+static gpg_error_t
+reload_crl_from_dp (ctrl_t ctrl, const char *url)
+{
+  gpg_error_t err;
+  ksba_reader_t reader = NULL;
+  char *key;
+
+  key = strconcat ("crl:", url, NULL);
+  if (!key)
+    return gpg_error_from_syserror ();
+  if (!singleflight_enter (key, &err, NULL))
+    {
+      if (opt.verbose)
+        log_info ("CRL from '%s' has been fetched by another request: %s\n",
+                  url, gpg_strerror (err));
+      xfree (key);
+      return err;
+    }
+
+  err = crl_fetch (ctrl, url, &reader);
+  if (err)
+    log_error (_("crl_fetch via DP failed: %s\n"), gpg_strerror (err));
+  else
+    {
+      if (opt.verbose)
+        log_info ("inserting CRL (reader %p)\n", reader);
+      err = crl_cache_insert (ctrl, url, reader);
+      if (err)
+        log_error (_("crl_cache_insert via DP failed: %s\n"),
+                   gpg_strerror (err));
+    }
+  crl_close_reader (reader);
+
+  singleflight_leave (key, err, NULL);
+  xfree (key);
+  return err;
+}
+
+
+/* Store the URIs of the freshestCRL extension of CERT - the locations
+   of the delta CRLs - at R_URIS.  Returns GPG_ERR_NOT_FOUND if CERT
+   has no such extension.  */
+static gpg_error_t
+get_freshest_crl_uris (ksba_cert_t cert, strlist_t *r_uris)
+{
+  gpg_error_t err;
+  int idx, crit;
+  const char *oid;
+  size_t off, derlen, imagelen, objlen, hdrlen, dplen;
+  const unsigned char *image, *der, *dp;
+  int class, tag, constructed, ndef;
+  char *uri;
+
+  *r_uris = NULL;
+
+  for (idx=0; !(err=ksba_cert_get_extension (cert, idx, &oid, &crit,
+                                              &off, &derlen)); idx++)
+    if (!strcmp (oid, oidstr_freshestCRL))
+      break;
+  if (gpg_err_code (err) == GPG_ERR_EOF
+      || gpg_err_code (err) == GPG_ERR_NO_DATA)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  if (err)
+    return err;
+
+  image = ksba_cert_get_image (cert, &imagelen);
+  if (!image || off > imagelen || derlen > imagelen - off)
+    return gpg_error (GPG_ERR_INV_CERT_OBJ);
+  der = image + off;
+
+  /* FreshestCRL ::= CRLDistributionPoints
+   *                ::= SEQUENCE SIZE (1..MAX) OF DistributionPoint */
+  if (parse_ber_header (&der, &derlen, &class, &tag, &constructed,
+                        &ndef, &objlen, &hdrlen)
+      || class != CLASS_UNIVERSAL || tag != TAG_SEQUENCE || !constructed
+      || ndef || objlen > derlen)
+    goto bad;
+  derlen = objlen;
+  while (derlen)
+    {
+      /* DistributionPoint ::= SEQUENCE {
+       *     distributionPoint [0] DistributionPointName OPTIONAL, ... } */
+      if (parse_ber_header (&der, &derlen, &class, &tag, &constructed,
+                            &ndef, &objlen, &hdrlen)
+          || class != CLASS_UNIVERSAL || tag != TAG_SEQUENCE || !constructed
+          || ndef || objlen > derlen)
+        goto bad;
+      dp = der;
+      dplen = objlen;
+      der += objlen;
+      derlen -= objlen;
+
+      if (!dplen)
+        continue;
+      if (parse_ber_header (&dp, &dplen, &class, &tag, &constructed,
+                            &ndef, &objlen, &hdrlen)
+          || ndef || objlen > dplen)
+        goto bad;
+      if (class != CLASS_CONTEXT || tag != 0 || !constructed)
+        continue;  /* No distributionPoint.  */
+      dplen = objlen;
+
+      /* DistributionPointName ::= CHOICE {
+       *     fullName [0] GeneralNames, ... } */
+      if (parse_ber_header (&dp, &dplen, &class, &tag, &constructed,
+                            &ndef, &objlen, &hdrlen)
+          || ndef || objlen > dplen)
+        goto bad;
+      if (class != CLASS_CONTEXT || tag != 0 || !constructed)
+        continue;  /* Not a fullName.  */
+      dplen = objlen;
+
+      while (dplen)
+        {
+          if (parse_ber_header (&dp, &dplen, &class, &tag, &constructed,
+                                &ndef, &objlen, &hdrlen)
+              || ndef || objlen > dplen)
+            goto bad;
+          /* We only want uniformResourceIdentifier [6] IA5String.  */
+          if (class == CLASS_CONTEXT && tag == 6 && !constructed && objlen)
+            {
+              uri = xtrymalloc (objlen + 1);
+              if (!uri)
+                goto oom;
+              memcpy (uri, dp, objlen);
+              uri[objlen] = 0;
+              if (!append_to_strlist_try (r_uris, uri))
+                {
+                  xfree (uri);
+                  goto oom;
+                }
+              xfree (uri);
+            }
+          dp += objlen;
+          dplen -= objlen;
+        }
+    }
+
+  return *r_uris? 0 : gpg_error (GPG_ERR_NOT_FOUND);
+
+ oom:
+  err = gpg_error_from_syserror ();
+  free_strlist (*r_uris);
+  *r_uris = NULL;
+  return err;
+
+ bad:
+  log_error ("invalid freshestCRL extension in certificate\n");
+  free_strlist (*r_uris);
+  *r_uris = NULL;
+  return gpg_error (GPG_ERR_INV_CERT_OBJ);
+}
+
+
+/* Try to bring the cached CRL for the issuer of CERT up to date using
+   one of the delta CRLs announced by CERT.  */
+static gpg_error_t
+reload_crl_from_delta (ctrl_t ctrl, ksba_cert_t cert)
+{
+  gpg_error_t err;
+  crl_cache_t cache = get_current_cache ();
+  char *issuer, *issuer_hash;
+  crl_cache_entry_t base;
+  strlist_t uris, sl;
+
+  issuer = ksba_cert_get_issuer (cert, 0);
+  if (!issuer)
+    return gpg_error (GPG_ERR_INV_CERT_OBJ);
+  issuer_hash = hashify_data (issuer, strlen (issuer));
+  ksba_free (issuer);
+  base = find_entry (cache->entries, issuer_hash);
+  xfree (issuer_hash);
+  if (!base || base->invalid || !base->crl_number)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  err = get_freshest_crl_uris (cert, &uris);
+  if (err)
+    return err;
+
+  err = gpg_error (GPG_ERR_NOT_FOUND);
+  for (sl = uris; sl; sl = sl->next)
+    {
+      if (!strncmp (sl->d, "ldap:", 5) || !strncmp (sl->d, "ldaps:", 6))
+        {
+          if (opt.ignore_ldap_dp)
+            continue;
+        }
+      else if (!strncmp (sl->d, "http:", 5) || !strncmp (sl->d, "https:", 6))
+        {
+          if (opt.ignore_http_dp)
+            continue;
+        }
+      else
+        continue; /* Skip unknown schemes. */
+
+      if (opt.verbose)
+        log_info ("trying delta CRL from '%s'\n", sl->d);
+      err = reload_crl_from_dp (ctrl, sl->d);
+      if (!err)
+        break;
+    }
+
+  free_strlist (uris);
+  return err;
+}
+
+
 /* Locate the corresponding CRL for the certificate CERT, read and
-   verify the CRL and store it in the cache.  */
+   verify the CRL and store it in the cache.  If we already have a CRL
+   for the issuer a delta CRL is tried first.  */
 gpg_error_t
 crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
 {
@@ -2701,6 +3325,11 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
   int seq;
   gpg_error_t last_err = 0;
 
+  /* Updating a cached CRL with a delta CRL is much cheaper than
+     fetching the complete CRL.  */
+  if (!reload_crl_from_delta (ctrl, cert))
+    return 0;
+
   /* Loop over all distribution points, get the CRLs and put them into
      the cache. */
   if (opt.verbose)
@@ -2748,23 +3377,9 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
 
           any_dist_point = 1;
 
-          crl_close_reader (reader);
-          err = crl_fetch (ctrl, distpoint_uri, &reader);
-          if (err)
-            {
-              log_error (_("crl_fetch via DP failed: %s\n"),
-                         gpg_strerror (err));
-              last_err = err;
-              continue; /* with the next name. */
-            }
-
-          if (opt.verbose)
-            log_info ("inserting CRL (reader %p)\n", reader);
-          err = crl_cache_insert (ctrl, distpoint_uri, reader);
+          err = reload_crl_from_dp (ctrl, distpoint_uri);
           if (err)
             {
-              log_error (_("crl_cache_insert via DP failed: %s\n"),
-                         gpg_strerror (err));
               last_err = err;
               continue; /* with the next name. */
             }
@@ -2823,3 +3438,114 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
   ksba_free (issuer);
   return err;
 }
+
+
+/* Return the number of seconds ahead of the nextUpdate of ENTRY at
+   which a background refresh shall be done.  The jitter is derived
+   from the issuer hash so that it is stable for an entry but spreads
+   the refreshes of different CRLs.  */
+static int
+refresh_ahead_time (crl_cache_entry_t entry)
+{
+  unsigned int val = 0;
+  const char *s;
+  int i;
+
+  for (i=0, s = entry->issuer_hash; i < 4 && hexdigitp (s); i++, s++)
+    val = (val << 4) | xtoi_1 (s);
+  return CRL_REFRESH_AHEAD - (int)(val % CRL_REFRESH_JITTER);
+}
+
+
+/* A workqueue task to refresh the CRL with ISSUER_HASH from the URL
+   it has been fetched from.  */
+static const char *
+task_refresh_crl (ctrl_t ctrl, const char *issuer_hash)
+{
+  crl_cache_entry_t entry;
+  gnupg_isotime_t threshold;
+  char *url;
+
+  if (!ctrl || !issuer_hash)
+    return "refresh_crl";
+
+  entry = find_entry (get_current_cache ()->entries, issuer_hash);
+  if (!entry)
+    return NULL;  /* Meanwhile removed from the cache.  */
+  entry->refresh_scheduled = 0;
+
+  /* Check that meanwhile no other request updated the CRL.  */
+  gnupg_get_isotime (threshold);
+  add_seconds_to_isotime (threshold, refresh_ahead_time (entry));
+  if (entry->invalid || strcmp (entry->next_update, threshold) > 0)
+    return NULL;
+
+  /* Take a copy of the URL because ENTRY will be replaced.  */
+  url = xtrystrdup (entry->url);
+  if (!url)
+    {
+      log_error ("%s: %s\n", __func__,
+                 gpg_strerror (gpg_error_from_syserror ()));
+      return NULL;
+    }
+  if (opt.verbose)
+    log_info ("refreshing CRL for issuer id %s from '%s'\n",
+              issuer_hash, url);
+  reload_crl_from_dp (ctrl, url);
+  xfree (url);
+  return NULL;
+}
+
+
+/* Schedule background refreshes for all cached CRLs which are about
+   to expire.  This is called by the housekeeping thread; the actual
+   downloads are done by the workqueue.  */
+void
+crl_cache_schedule_refresh (void)
+{
+  crl_cache_t cache;
+  crl_cache_entry_t entry;
+  gnupg_isotime_t current_time, threshold;
+  int count = 0;
+
+  if (!current_cache || (opt.disable_http && opt.disable_ldap))
+    return;
+  cache = current_cache;
+
+  gnupg_get_isotime (current_time);
+  for (entry = cache->entries; entry; entry = entry->next)
+    {
+      if (entry->deleted || entry->invalid || entry->refresh_scheduled
+          || !*entry->next_update)
+        continue;
+
+      /* Only CRLs fetched from a distribution point can be refreshed
+         without the certificate.  */
+      if (!strncmp (entry->url, "ldap:", 5)
+          || !strncmp (entry->url, "ldaps:", 6))
+        {
+          if (opt.ignore_ldap_dp)
+            continue;
+        }
+      else if (!strncmp (entry->url, "http:", 5)
+               || !strncmp (entry->url, "https:", 6))
+        {
+          if (opt.ignore_http_dp)
+            continue;
+        }
+      else
+        continue;
+
+      gnupg_copy_time (threshold, current_time);
+      add_seconds_to_isotime (threshold, refresh_ahead_time (entry));
+      if (strcmp (entry->next_update, threshold) > 0)
+        continue;  /* Not yet due.  */
+
+      if (count >= CRL_REFRESH_MAX_PER_RUN)
+        break;  /* The remaining ones will be done by the next run.  */
+      if (workqueue_add_task (task_refresh_crl, entry->issuer_hash, 0, 1))
+        break;
+      entry->refresh_scheduled = 1;
+      count++;
+    }
+}
@@ -68,6 +68,8 @@ gpg_error_t crl_cache_load (ctrl_t ctrl, const char *filename);
 
 gpg_error_t crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert);
 
+void crl_cache_schedule_refresh (void);
+
 
 /*-- fakecrl.c --*/
 gpg_error_t fakecrl_isvalid (ctrl_t ctrl,
@@ -62,6 +62,7 @@
 
 #include "certcache.h"
 #include "crlcache.h"
+#include "ocsp.h"
 #include "crlfetch.h"
 #include "misc.h"
 #if USE_LDAP
@@ -73,6 +74,7 @@
 #endif
 #include "../common/comopt.h"
 #include "../common/init.h"
+#include "../common/asynclog.h"
 #include "../common/gc-opt-flags.h"
 #include "dns-stuff.h"
 #include "http-common.h"
@@ -114,6 +116,8 @@ enum cmd_and_opt_values {
   oHomedir,
   oNoDetach,
   oLogFile,
+  oAsyncLog,
+  oMetricsLogInterval,
   oBatch,
   oDisableHTTP,
   oDisableLDAP,
@@ -136,6 +140,7 @@ enum cmd_and_opt_values {
   oOCSPMaxPeriod,
   oOCSPCurrentPeriod,
   oMaxReplies,
+  oMaxCachedCerts,
   oHkpCaCert,
   oFakedSystemTime,
   oForce,
@@ -211,6 +216,10 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_i (oDebugWait, "debug-wait", "@"),
   ARGPARSE_s_s (oLogFile,  "log-file",
                 N_("|FILE|write server mode logs to FILE")),
+  ARGPARSE_s_n (oAsyncLog, "async-log",
+                N_("write the log file in the background")),
+  ARGPARSE_s_u (oMetricsLogInterval, "metrics-log-interval",
+                N_("|N|log the metrics every N seconds")),
 
 
   ARGPARSE_header ("Configuration",
@@ -221,6 +230,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
   ARGPARSE_s_i (oMaxReplies, "max-replies",
                 N_("|N|do not return more than N items in one query")),
+  ARGPARSE_s_u (oMaxCachedCerts, "max-cached-certs",
+                N_("|N|cache at most N certificates at runtime")),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
   ARGPARSE_s_n (oDisableCheckOwnSocket, "disable-check-own-socket", "@"),
   ARGPARSE_s_s (oIgnoreCert,"ignore-cert", "@"),
@@ -342,6 +353,7 @@ static struct compatibility_flags_s compatibility_flags [] =
 
 
 #define DEFAULT_MAX_REPLIES 10
+#define DEFAULT_MAX_CACHED_CERTS 1000
 #define DEFAULT_LDAP_TIMEOUT 15  /* seconds */
 
 #define DEFAULT_CONNECT_TIMEOUT       (15*1000)  /* 15 seconds */
@@ -368,6 +380,14 @@ static int cleanup_socket;
    the log file after a SIGHUP if it didn't changed. Malloced. */
 static char *current_logfile;
 
+/* Flag indicating that the log file shall be written by a background
+ * thread; set by --async-log.  */
+static int async_log;
+
+/* If not 0, the interval in seconds for writing the metrics to the
+ * log; set by --metrics-log-interval.  */
+static unsigned int metrics_log_interval;
+
 /* Helper to implement --debug-level. */
 static const char *debug_level;
 
@@ -695,6 +715,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.ocsp_max_period = 90 * 86400;       /* 90 days.  */
       opt.ocsp_current_period = 3 * 60 * 60;  /* 3 hours. */
       opt.max_replies = DEFAULT_MAX_REPLIES;
+      opt.max_cached_certs = DEFAULT_MAX_CACHED_CERTS;
       while (opt.ocsp_signer)
         {
           fingerprint_list_t tmp = opt.ocsp_signer->next;
@@ -785,6 +806,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
     case oOCSPCurrentPeriod: opt.ocsp_current_period = pargs->r.ret_int; break;
 
     case oMaxReplies: opt.max_replies = pargs->r.ret_int; break;
+    case oMaxCachedCerts: opt.max_cached_certs = pargs->r.ret_ulong; break;
 
     case oHkpCaCert:
       {
@@ -990,6 +1012,30 @@ thread_init (void)
     if (npth_setspecific (my_tlskey_current_fd, NULL) == 0)
       log_set_pid_suffix_cb (pid_suffix_callback);
 #endif /*!HAVE_W32_SYSTEM*/
+
+  metrics_set_prefix ("dirmngr");
+  metrics_register_source (cert_cache_metrics);
+  metrics_register_source (domaininfo_metrics);
+  metrics_register_source (dns_stuff_metrics);
+  metrics_register_source (ks_hkp_metrics);
+}
+
+
+/* Switch to the asynchronous log sink if requested by --async-log.
+ * This is a no-op if it is already active.  nPth needs to be
+ * initialized.  */
+static void
+start_async_log (void)
+{
+  gpg_error_t err;
+
+  if (!async_log || !current_logfile)
+    return;
+
+  err = async_log_set_file (current_logfile);
+  if (err)
+    log_info ("not using asynchronous logging for '%s': %s\n",
+              current_logfile, gpg_strerror (err));
 }
 
 
@@ -1165,6 +1211,10 @@ main (int argc, char **argv)
         case oNoDetach: nodetach = 1; break;
         case oStealSocket: steal_socket = 1; break;
         case oLogFile: logfile = pargs.r.ret_str; break;
+        case oAsyncLog: async_log = 1; break;
+        case oMetricsLogInterval:
+          metrics_log_interval = pargs.r.ret_ulong;
+          break;
         case oCsh: csh_style = 1; break;
         case oSh: csh_style = 0; break;
 	case oLDAPFile:
@@ -1322,6 +1372,8 @@ main (int argc, char **argv)
       cert_cache_init (hkp_cacert_filenames);
       crl_cache_init ();
       ks_hkp_init ();
+      domaininfo_load ();
+      ocsp_cache_load ();
       http_register_netactivity_cb (netactivity_action);
       start_command_handler (ASSUAN_INVALID_FD, 0);
       shutdown_reaper ();
@@ -1364,6 +1416,8 @@ main (int argc, char **argv)
       cert_cache_init (hkp_cacert_filenames);
       crl_cache_init ();
       ks_hkp_init ();
+      domaininfo_load ();
+      ocsp_cache_load ();
       http_register_netactivity_cb (netactivity_action);
       handle_connections (3);
       shutdown_reaper ();
@@ -1590,6 +1644,8 @@ main (int argc, char **argv)
       cert_cache_init (hkp_cacert_filenames);
       crl_cache_init ();
       ks_hkp_init ();
+      domaininfo_load ();
+      ocsp_cache_load ();
       http_register_netactivity_cb (netactivity_action);
       handle_connections (fd);
       shutdown_reaper ();
@@ -1690,6 +1746,8 @@ main (int argc, char **argv)
 static void
 cleanup (void)
 {
+  domaininfo_save ();
+  ocsp_cache_save ();
   crl_cache_deinit ();
   cert_cache_deinit (1);
   reload_dns_stuff (1);
@@ -2030,6 +2088,8 @@ reread_configuration (void)
           current_logfile = comopt.logfile? xtrystrdup (comopt.logfile) : NULL;
         }
     }
+
+  start_async_log ();
 }
 
 
@@ -2049,6 +2109,9 @@ dirmngr_sighup_action (void)
   http_reinitialize ();
   reload_dns_stuff (0);
   ks_hkp_reload ();
+#if USE_LDAP
+  ks_ldap_housekeeping (0);
+#endif
 }
 
 
@@ -2139,6 +2202,13 @@ housekeeping_thread (void *arg)
 
   dns_stuff_housekeeping ();
   ks_hkp_housekeeping (curtime);
+#if USE_LDAP
+  ks_ldap_housekeeping (curtime);
+#endif
+  http_housekeeping ();
+  domaininfo_save ();
+  crl_cache_schedule_refresh ();
+  ocsp_cache_housekeeping ();
   if (network_activity_seen)
     {
       network_activity_seen = 0;
@@ -2337,6 +2407,12 @@ handle_connections (assuan_fd_t listen_fd)
   struct timespec timeout;
   int saved_errno;
   int my_inotify_fd = -1;
+  gpg_error_t err;
+
+  start_async_log ();
+  if ((err = metrics_start_logging (metrics_log_interval)))
+    log_error ("error starting the metrics logging: %s\n",
+               gpg_strerror (err));
 
   npth_attr_init (&tattr);
   npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
@@ -37,6 +37,7 @@
 #include "../common/asshelp.h"  /* (assuan_context_t) */
 #include "../common/i18n.h"
 #include "../common/name-value.h"
+#include "../common/metrics.h"
 #include "dirmngr-status.h"
 #include "http.h"     /* (parsed_uri_t) */
 
@@ -143,6 +144,7 @@ struct
   int allow_ocsp;     /* Allow using OCSP. */
 
   int max_replies;
+  unsigned int max_cached_certs; /* Limit for runtime cached certs.  */
   unsigned int ldaptimeout;
 
   ldap_server_t ldapservers;
@@ -263,6 +265,8 @@ int dirmngr_never_use_tor_p (void);
 void ks_hkp_housekeeping (time_t curtime);
 void ks_hkp_reload (void);
 void ks_hkp_init (void);
+void ks_hkp_metrics (metrics_writer_t w);
+void ks_ldap_housekeeping (time_t curtime);
 
 /*-- server.c --*/
 void release_uri_item_list (uri_item_t list);
@@ -294,11 +298,14 @@ gpg_error_t dirmngr_load_swdb (ctrl_t ctrl, int force);
 
 /*-- domaininfo.c --*/
 void domaininfo_print_stats (ctrl_t ctrl);
+void domaininfo_metrics (metrics_writer_t w);
 int  domaininfo_is_wkd_not_supported (const char *domain);
 void domaininfo_set_no_name (const char *domain);
 void domaininfo_set_wkd_supported (const char *domain);
 void domaininfo_set_wkd_not_supported (const char *domain);
 void domaininfo_set_wkd_not_found (const char *domain);
+void domaininfo_load (void);
+void domaininfo_save (void);
 
 /*-- workqueue.c --*/
 typedef const char *(*wqtask_t)(ctrl_t ctrl, const char *args);
@@ -74,6 +74,7 @@
 #include "./dirmngr-err.h"
 #include "../common/util.h"
 #include "../common/host2net.h"
+#include "../common/metrics.h"
 #include "dirmngr-status.h"
 #include "dns-stuff.h"
 
@@ -118,6 +119,13 @@
 
 #define RESOLV_CONF_NAME "/etc/resolv.conf"
 
+/* Limits for the cache of DNS answers.  DNSCACHE_DEF_TTL is used if
+ * the resolver does not tell us the TTL.  */
+#define DNSCACHE_MAX_ITEMS  256
+#define DNSCACHE_MAX_TTL   3600
+#define DNSCACHE_DEF_TTL     60
+#define DNSCACHE_NEG_TTL     60
+
 /* Two flags to enable verbose and debug mode.  */
 static int opt_verbose;
 static int opt_debug;
@@ -159,6 +167,247 @@ static struct
 } cached_inet_support;
 
 
+/* The types of answers we keep in the DNS cache.  */
+enum dnscache_types
+  {
+    DNSCACHE_ADDR,
+    DNSCACHE_SRV,
+    DNSCACHE_CNAME,
+    DNSCACHE_CERT
+  };
+
+/* An item of the DNS cache.  */
+struct dnscache_item_s;
+typedef struct dnscache_item_s *dnscache_item_t;
+struct dnscache_item_s
+{
+  dnscache_item_t next;
+  time_t expires;          /* The time the item expires.  */
+  enum dnscache_types type;
+  int parm[4];             /* Additional query parameters.  */
+  gpg_error_t err;         /* The error for a negative answer or 0.  */
+  dns_addrinfo_t ai;       /* DNSCACHE_ADDR: The addresses.  */
+  struct srventry *srvlist;/* DNSCACHE_SRV: The unsorted records.  */
+  unsigned int srvcount;   /* DNSCACHE_SRV: Number of records.  */
+  char *str;               /* The canonical name or NULL.  */
+  char name[1];            /* The queried name.  */
+};
+
+/* The DNS cache with the most recently used items first.  */
+static dnscache_item_t dnscache;
+static int dnscache_count;
+
+/* Counters for the DNS cache.  */
+static struct
+{
+  unsigned long hits;
+  unsigned long neg_hits;
+  unsigned long misses;
+} dnscache_stats;
+
+
+
+/* Release the DNS cache ITEM.  */
+static void
+dnscache_release_item (dnscache_item_t item)
+{
+  if (!item)
+    return;
+  free_dns_addrinfo (item->ai);
+  xfree (item->srvlist);
+  xfree (item->str);
+  xfree (item);
+}
+
+
+/* Remove all items from the DNS cache.  With ONLY_EXPIRED set only
+ * items with an elapsed TTL are removed.  */
+static void
+dnscache_flush (int only_expired)
+{
+  dnscache_item_t item, *itemp;
+  time_t now = gnupg_get_time ();
+
+  for (itemp = &dnscache; (item = *itemp); )
+    {
+      if (!only_expired || item->expires <= now)
+        {
+          *itemp = item->next;
+          dnscache_release_item (item);
+          dnscache_count--;
+        }
+      else
+        itemp = &item->next;
+    }
+}
+
+
+/* Return true if ERR is a definite answer that no such record
+ * exists.  Only those errors are cached.  */
+static int
+dnscache_negative_p (gpg_error_t err)
+{
+  switch (gpg_err_code (err))
+    {
+    case GPG_ERR_NO_NAME:
+    case GPG_ERR_NO_DATA:
+    case GPG_ERR_NOT_FOUND:
+    case GPG_ERR_ENOENT:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+
+/* Look up an answer of TYPE for NAME and the parameters PARM in the
+ * DNS cache.  Returns NULL if no valid item is cached.  Note that the
+ * returned item is only valid until the next call to a function of
+ * this module.  */
+static dnscache_item_t
+dnscache_find (enum dnscache_types type, const char *name, const int *parm)
+{
+  dnscache_item_t item, *itemp;
+  time_t now = gnupg_get_time ();
+
+  for (itemp = &dnscache; (item = *itemp); itemp = &item->next)
+    if (item->type == type
+        && !memcmp (item->parm, parm, sizeof item->parm)
+        && !ascii_strcasecmp (item->name, name))
+      break;
+  if (!item)
+    {
+      dnscache_stats.misses++;
+      return NULL;
+    }
+
+  *itemp = item->next;
+  if (item->expires <= now)
+    {
+      dnscache_release_item (item);
+      dnscache_count--;
+      dnscache_stats.misses++;
+      return NULL;
+    }
+
+  /* Move it to the front so that the tail has the least recently
+   * used items.  */
+  item->next = dnscache;
+  dnscache = item;
+  if (item->err)
+    dnscache_stats.neg_hits++;
+  else
+    dnscache_stats.hits++;
+  return item;
+}
+
+
+/* Create a new DNS cache item for the answer ERR to the query of TYPE
+ * for NAME with PARM.  TTL is the lifetime of a positive answer.
+ * Returns NULL if the answer shall not be cached or on memory
+ * shortage.  The caller needs to fill in the data and then call
+ * dnscache_insert.  */
+static dnscache_item_t
+dnscache_new (enum dnscache_types type, const char *name, const int *parm,
+              gpg_error_t err, unsigned int ttl)
+{
+  dnscache_item_t item;
+
+  if (err)
+    {
+      if (!dnscache_negative_p (err))
+        return NULL;
+      ttl = DNSCACHE_NEG_TTL;
+    }
+  else if (!ttl)
+    return NULL;
+  else if (ttl > DNSCACHE_MAX_TTL)
+    ttl = DNSCACHE_MAX_TTL;
+
+  item = xtrycalloc (1, sizeof *item + strlen (name));
+  if (!item)
+    return NULL;
+  item->expires = gnupg_get_time () + ttl;
+  item->type = type;
+  memcpy (item->parm, parm, sizeof item->parm);
+  item->err = err;
+  strcpy (item->name, name);
+  return item;
+}
+
+
+/* Put ITEM into the DNS cache.  */
+static void
+dnscache_insert (dnscache_item_t item)
+{
+  dnscache_item_t *itemp;
+
+  if (dnscache_count >= DNSCACHE_MAX_ITEMS)
+    {
+      for (itemp = &dnscache; (*itemp)->next; itemp = &(*itemp)->next)
+        ;
+      dnscache_release_item (*itemp);
+      *itemp = NULL;
+      dnscache_count--;
+    }
+  item->next = dnscache;
+  dnscache = item;
+  dnscache_count++;
+}
+
+
+/* Return a copy of the address list AI or NULL on error.  */
+static dns_addrinfo_t
+copy_dns_addrinfo (dns_addrinfo_t ai)
+{
+  dns_addrinfo_t list = NULL;
+  dns_addrinfo_t *tail = &list;
+  dns_addrinfo_t newai;
+
+  for (; ai; ai = ai->next)
+    {
+      newai = xtrymalloc (sizeof *newai);
+      if (!newai)
+        {
+          free_dns_addrinfo (list);
+          return NULL;
+        }
+      memcpy (newai, ai, sizeof *newai);
+      newai->next = NULL;
+      *tail = newai;
+      tail = &newai->next;
+    }
+  return list;
+}
+
+
+/* Print statistics about the DNS cache.  */
+void
+dns_stuff_print_stats (ctrl_t ctrl)
+{
+  dirmngr_status_helpf (ctrl,
+                        "dnscache: items=%d hits=%lu neg_hits=%lu misses=%lu\n",
+                        dnscache_count,
+                        dnscache_stats.hits, dnscache_stats.neg_hits,
+                        dnscache_stats.misses);
+}
+
+
+/* The metrics source for the DNS cache.  */
+void
+dns_stuff_metrics (metrics_writer_t w)
+{
+  metrics_begin (w, METRIC_GAUGE, "dnscache_items",
+                 "Number of items in the DNS cache.");
+  metrics_put (w, NULL, NULL, dnscache_count);
+  metrics_begin (w, METRIC_COUNTER, "dnscache_lookups_total",
+                 "Number of DNS cache lookups by result.");
+  metrics_put (w, "result", "hit", dnscache_stats.hits);
+  metrics_put (w, "result", "neg_hit", dnscache_stats.neg_hits);
+  metrics_put (w, "result", "miss", dnscache_stats.misses);
+}
+
+
 
 #ifdef USE_LIBDNS
 /* Libdns global data.  */
@@ -187,6 +436,7 @@ void
 enable_standard_resolver (int yes)
 {
   standard_resolver = yes;
+  dnscache_flush (0);
 }
 
 
@@ -237,6 +487,8 @@ enable_dns_tormode (int new_circuit)
                       "p%u", counter);
       counter++;
     }
+  if (!tor_mode)
+    dnscache_flush (0);
   tor_mode = 1;
 }
 
@@ -245,6 +497,8 @@ enable_dns_tormode (int new_circuit)
 void
 disable_dns_tormode (void)
 {
+  if (tor_mode)
+    dnscache_flush (0);
   tor_mode = 0;
 }
 
@@ -264,6 +518,7 @@ void
 set_dns_disable_ipv4 (int yes)
 {
   opt_disable_ipv4 = !!yes;
+  dnscache_flush (0);
 }
 
 
@@ -273,6 +528,7 @@ void
 set_dns_disable_ipv6 (int yes)
 {
   opt_disable_ipv6 = !!yes;
+  dnscache_flush (0);
 }
 
 
@@ -697,8 +953,10 @@ reload_dns_stuff (int force)
   (void)force;
 #endif
 
-  /* We also flush the IPv4/v6 support flag cache.  */
+  /* We also flush the IPv4/v6 support flag cache and the DNS
+   * cache.  */
   cached_inet_support.valid = 0;
+  dnscache_flush (0);
 }
 
 
@@ -711,6 +969,8 @@ dns_stuff_housekeeping (void)
    * later than 10 minutes after it changed.  This way the user does
    * not need a reload.  */
   cached_inet_support.valid = 0;
+
+  dnscache_flush (1);
 }
 
 
@@ -1004,8 +1264,12 @@ resolve_name_standard (ctrl_t ctrl, const char *name, unsigned short port,
 
   /* We can't use the AI_IDN flag because that does the conversion
      using the current locale.  However, GnuPG always used UTF-8.  To
-     support IDN we would need to make use of the libidn API.  */
+     support IDN we would need to make use of the libidn API.  The
+     system resolver may block for a long time; thus we let other
+     threads run meanwhile.  */
+  my_unprotect ();
   ret = getaddrinfo (name, *portstr? portstr : NULL, &hints, &aibuf);
+  my_protect ();
   if (ret)
     {
       aibuf = NULL;
@@ -1021,7 +1285,9 @@ resolve_name_standard (ctrl_t ctrl, const char *name, unsigned short port,
           if (get_dns_cname (ctrl, name, &cname))
             goto leave; /* Still no success.  */
 
+          my_unprotect ();
           ret = getaddrinfo (cname, *portstr? portstr : NULL, &hints, &aibuf);
+          my_protect ();
           xfree (cname);
           if (ret)
             {
@@ -1100,6 +1366,34 @@ resolve_dns_name (ctrl_t ctrl, const char *name, unsigned short port,
                   dns_addrinfo_t *r_ai, char **r_canonname)
 {
   gpg_error_t err;
+  int parm[4];
+  dnscache_item_t item;
+
+  parm[0] = port;
+  parm[1] = want_family;
+  parm[2] = want_socktype;
+  parm[3] = !!r_canonname;
+  if (!is_ip_address (name)
+      && (item = dnscache_find (DNSCACHE_ADDR, name, parm)))
+    {
+      *r_ai = NULL;
+      if (r_canonname)
+        *r_canonname = NULL;
+      err = item->err;
+      if (!err && !(*r_ai = copy_dns_addrinfo (item->ai)))
+        err = gpg_error_from_syserror ();
+      if (!err && r_canonname && item->str
+          && !(*r_canonname = xtrystrdup (item->str)))
+        {
+          err = gpg_error_from_syserror ();
+          free_dns_addrinfo (*r_ai);
+          *r_ai = NULL;
+        }
+      if (opt_debug)
+        log_debug ("dns: resolve_dns_name(%s): %s (cached)\n",
+                   name, gpg_strerror (err));
+      return err;
+    }
 
 #ifdef USE_LIBDNS
   if (!standard_resolver)
@@ -1116,6 +1410,26 @@ resolve_dns_name (ctrl_t ctrl, const char *name, unsigned short port,
                                  r_ai, r_canonname);
   if (opt_debug)
     log_debug ("dns: resolve_dns_name(%s): %s\n", name, gpg_strerror (err));
+
+  /* The resolvers do not tell us the TTL; thus we use a short
+   * default lifetime.  */
+  if (!is_ip_address (name)
+      && (item = dnscache_new (DNSCACHE_ADDR, name, parm,
+                               err, DNSCACHE_DEF_TTL)))
+    {
+      if (!err)
+        {
+          item->ai = copy_dns_addrinfo (*r_ai);
+          if (r_canonname && *r_canonname)
+            item->str = xtrystrdup (*r_canonname);
+        }
+      if (!err && (!item->ai
+                   || (r_canonname && *r_canonname && !item->str)))
+        dnscache_release_item (item);
+      else
+        dnscache_insert (item);
+    }
+
   return err;
 }
 
@@ -1276,8 +1590,12 @@ resolve_addr_standard (const struct sockaddr_storage *addr, int addrlen,
   if ((flags & DNS_NUMERICHOST) || tor_mode)
     ec = EAI_NONAME;
   else
-    ec = getnameinfo ((const struct sockaddr *)addr,
-                      addrlen, buffer, buflen, NULL, 0, NI_NAMEREQD);
+    {
+      my_unprotect ();
+      ec = getnameinfo ((const struct sockaddr *)addr,
+                        addrlen, buffer, buflen, NULL, 0, NI_NAMEREQD);
+      my_protect ();
+    }
 
   if (!ec && *buffer == '[')
     ec = EAI_FAIL;  /* A name may never start with a bracket.  */
@@ -1620,11 +1938,13 @@ get_dns_cert_standard (const char *name, int want_certtype,
     return gpg_error_from_syserror ();
 
   err = gpg_error (GPG_ERR_NOT_FOUND);
+  my_unprotect ();
   r = res_query (name, C_IN,
                  (want_certtype < DNS_CERTTYPE_RRBASE
                   ? T_CERT
                   : (want_certtype - DNS_CERTTYPE_RRBASE)),
                  answer, 65536);
+  my_protect ();
   /* Not too big, not too small, no errors and at least 1 answer. */
   if (r >= sizeof (HEADER) && r <= 65536
       && (((HEADER *)(void *) answer)->rcode) == NOERROR
@@ -1821,6 +2141,8 @@ get_dns_cert (ctrl_t ctrl, const char *name, int want_certtype,
               unsigned char **r_fpr, size_t *r_fprlen, char **r_url)
 {
   gpg_error_t err;
+  int parm[4];
+  dnscache_item_t item;
 
   if (r_key)
     *r_key = NULL;
@@ -1830,6 +2152,17 @@ get_dns_cert (ctrl_t ctrl, const char *name, int want_certtype,
   *r_fprlen = 0;
   *r_url = NULL;
 
+  /* Only negative answers are cached for CERT records.  */
+  memset (parm, 0, sizeof parm);
+  parm[0] = want_certtype;
+  if ((item = dnscache_find (DNSCACHE_CERT, name, parm)))
+    {
+      if (opt_debug)
+        log_debug ("dns: get_dns_cert(%s): %s (cached)\n",
+                   name, gpg_strerror (item->err));
+      return item->err;
+    }
+
 #ifdef USE_LIBDNS
   if (!standard_resolver)
     {
@@ -1846,6 +2179,9 @@ get_dns_cert (ctrl_t ctrl, const char *name, int want_certtype,
 
   if (opt_debug)
     log_debug ("dns: get_dns_cert(%s): %s\n", name, gpg_strerror (err));
+
+  if (err && (item = dnscache_new (DNSCACHE_CERT, name, parm, err, 0)))
+    dnscache_insert (item);
   return err;
 }
 
@@ -1865,11 +2201,13 @@ priosort(const void *a,const void *b)
 
 /* Libdns based helper for getsrv.  Note that it is expected that NULL
  * is stored at the address of LIST and 0 is stored at the address of
- * R_COUNT.  */
+ * R_COUNT and R_TTL.  The smallest TTL of the records is stored at
+ * R_TTL.  */
 #ifdef USE_LIBDNS
 static gpg_error_t
 getsrv_libdns (ctrl_t ctrl,
-               const char *name, struct srventry **list, unsigned int *r_count)
+               const char *name, struct srventry **list, unsigned int *r_count,
+               unsigned int *r_ttl)
 {
   gpg_error_t err;
   struct dns_resolver *res = NULL;
@@ -1944,6 +2282,8 @@ getsrv_libdns (ctrl_t ctrl,
       srv->priority = dsrv.priority;
       srv->weight   = dsrv.weight;
       srv->port     = dsrv.port;
+      if (srvcount == 1 || rr.ttl < *r_ttl)
+        *r_ttl = rr.ttl;
       mem2str (srv->target, dsrv.target, sizeof srv->target);
       /* Libdns appends the root zone part which is problematic for
        * most other functions - strip it.  */
@@ -1968,10 +2308,12 @@ getsrv_libdns (ctrl_t ctrl,
 
 /* Standard resolver based helper for getsrv.  Note that it is
  * expected that NULL is stored at the address of LIST and 0 is stored
- * at the address of R_COUNT.  */
+ * at the address of R_COUNT and R_TTL.  The smallest TTL of the
+ * records is stored at R_TTL.  */
 static gpg_error_t
 getsrv_standard (const char *name,
-                 struct srventry **list, unsigned int *r_count)
+                 struct srventry **list, unsigned int *r_count,
+                 unsigned int *r_ttl)
 {
 #ifdef HAVE_SYSTEM_RESOLVER
   union {
@@ -2047,7 +2389,9 @@ getsrv_standard (const char *name,
       if (class != C_IN)
         goto fail;
 
-      pt += 4; /* ttl */
+      if (srvcount == 1 || buf32_to_uint (pt) < *r_ttl)
+        *r_ttl = buf32_to_uint (pt);
+      pt += 4;
       dlen = buf16_to_u16 (pt);
       pt += 2;
 
@@ -2088,6 +2432,7 @@ getsrv_standard (const char *name,
   (void)name;
   (void)list;
   (void)r_count;
+  (void)r_ttl;
   return gpg_error (GPG_ERR_NOT_SUPPORTED);
 
 #endif /*!HAVE_SYSTEM_RESOLVER*/
@@ -2106,7 +2451,10 @@ get_dns_srv (ctrl_t ctrl,
   gpg_error_t err;
   char *namebuffer = NULL;
   unsigned int srvcount;
+  unsigned int ttl = 0;
   int i;
+  int parm[4];
+  dnscache_item_t item;
 
   *list = NULL;
   *r_count = 0;
@@ -2126,16 +2474,60 @@ get_dns_srv (ctrl_t ctrl,
     }
 
 
-#ifdef USE_LIBDNS
-  if (!standard_resolver)
+  memset (parm, 0, sizeof parm);
+  if ((item = dnscache_find (DNSCACHE_SRV, name, parm)))
     {
-      err = getsrv_libdns (ctrl, name, list, &srvcount);
-      if (err && libdns_switch_port_p (err))
-        err = getsrv_libdns (ctrl, name, list, &srvcount);
+      err = item->err;
+      if (!err && item->srvcount)
+        {
+          *list = xtrymalloc (item->srvcount * sizeof (struct srventry));
+          if (!*list)
+            err = gpg_error_from_syserror ();
+          else
+            {
+              memcpy (*list, item->srvlist,
+                      item->srvcount * sizeof (struct srventry));
+              srvcount = item->srvcount;
+            }
+        }
+      if (opt_debug)
+        log_debug ("dns: getsrv(%s): using cached answer\n", name);
     }
   else
+    {
+#ifdef USE_LIBDNS
+      if (!standard_resolver)
+        {
+          err = getsrv_libdns (ctrl, name, list, &srvcount, &ttl);
+          if (err && libdns_switch_port_p (err))
+            err = getsrv_libdns (ctrl, name, list, &srvcount, &ttl);
+        }
+      else
 #endif /*USE_LIBDNS*/
-    err = getsrv_standard (name, list, &srvcount);
+        err = getsrv_standard (name, list, &srvcount, &ttl);
+
+      /* Cache the records before they are sorted according to the
+       * weights so that a cached answer is randomized anew.  */
+      if (!err && !srvcount)
+        ttl = DNSCACHE_NEG_TTL;  /* A "." record or no records.  */
+      if ((item = dnscache_new (DNSCACHE_SRV, name, parm, err, ttl)))
+        {
+          if (srvcount)
+            {
+              item->srvlist = xtrymalloc (srvcount * sizeof (struct srventry));
+              if (item->srvlist)
+                {
+                  memcpy (item->srvlist, *list,
+                          srvcount * sizeof (struct srventry));
+                  item->srvcount = srvcount;
+                }
+            }
+          if (srvcount && !item->srvlist)
+            dnscache_release_item (item);
+          else
+            dnscache_insert (item);
+        }
+    }
 
   if (err)
     {
@@ -2392,24 +2784,45 @@ gpg_error_t
 get_dns_cname (ctrl_t ctrl, const char *name, char **r_cname)
 {
   gpg_error_t err;
+  int parm[4];
+  dnscache_item_t item;
 
   *r_cname = NULL;
 
+  memset (parm, 0, sizeof parm);
+  if ((item = dnscache_find (DNSCACHE_CNAME, name, parm)))
+    {
+      err = item->err;
+      if (!err && !(*r_cname = xtrystrdup (item->str)))
+        err = gpg_error_from_syserror ();
+      return err;
+    }
+
 #ifdef USE_LIBDNS
   if (!standard_resolver)
     {
       err = get_dns_cname_libdns (ctrl, name, r_cname);
       if (err && libdns_switch_port_p (err))
         err = get_dns_cname_libdns (ctrl, name, r_cname);
-      return err;
     }
+  else
 #endif /*USE_LIBDNS*/
+    {
+      err = get_dns_cname_standard (name, r_cname);
+      if (opt_debug)
+        log_debug ("get_dns_cname(%s)%s%s\n", name,
+                   err ? ": " : " -> ",
+                   err ? gpg_strerror (err) : *r_cname);
+    }
 
-  err = get_dns_cname_standard (name, r_cname);
-  if (opt_debug)
-    log_debug ("get_dns_cname(%s)%s%s\n", name,
-               err ? ": " : " -> ",
-               err ? gpg_strerror (err) : *r_cname);
+  if ((item = dnscache_new (DNSCACHE_CNAME, name, parm,
+                            err, DNSCACHE_DEF_TTL)))
+    {
+      if (!err && !(item->str = xtrystrdup (*r_cname)))
+        dnscache_release_item (item);
+      else
+        dnscache_insert (item);
+    }
   return err;
 }
 
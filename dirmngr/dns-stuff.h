@@ -137,6 +137,13 @@ void reload_dns_stuff (int force);
 /* Housekeeping for this module.  */
 void dns_stuff_housekeeping (void);
 
+/* Print statistics for this module.  */
+void dns_stuff_print_stats (ctrl_t ctrl);
+
+/* The metrics source for this module.  */
+struct metrics_writer_s;
+void dns_stuff_metrics (struct metrics_writer_s *w);
+
 void free_dns_addrinfo (dns_addrinfo_t ai);
 
 /* Function similar to getaddrinfo.  */
@@ -22,8 +22,10 @@
 #include <config.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "dirmngr.h"
+#include "../common/sysutils.h"
 
 
 /* Number of bucket for the hash array and limit for the length of a
@@ -38,6 +40,13 @@
 #define NO_OF_DOMAINBUCKETS  103
 #define MAX_DOMAINBUCKET_LEN  20
 
+/* The file used to keep the table across restarts, its version, and
+ * the number of seconds after which we forget what we learned about
+ * a domain.  */
+#define DOMAININFO_FILE      "domaininfo.txt"
+#define DOMAININFO_VERSION   1
+#define DOMAININFO_MAX_AGE   (3*86400)
+
 
 /* Object to keep track of a domain name.  */
 struct domaininfo_s
@@ -48,6 +57,7 @@ struct domaininfo_s
   unsigned int wkd_supported:1;      /* One WKD entry was found.          */
   unsigned int wkd_not_supported:1;  /* Definitely does not support WKD.  */
   unsigned int keepmark:1;           /* Private to insert_or_update().    */
+  time_t timestamp;                  /* Time of the last update.          */
   char name[1];
 };
 typedef struct domaininfo_s *domaininfo_t;
@@ -55,6 +65,12 @@ typedef struct domaininfo_s *domaininfo_t;
 /* And the hashed array.  */
 static domaininfo_t domainbuckets[NO_OF_DOMAINBUCKETS];
 
+/* Incremented for each change of the table; used to detect changes
+ * done by other threads while saving and to skip saving an unchanged
+ * table.  */
+static unsigned int domaininfo_generation;
+static unsigned int domaininfo_saved_generation;
+
 
 /* The hash function we use.  Must not call a system function.  */
 static inline u32
@@ -121,6 +137,42 @@ domaininfo_print_stats (ctrl_t ctrl)
 }
 
 
+/* The metrics source for the domain info cache.  */
+void
+domaininfo_metrics (metrics_writer_t w)
+{
+  int bidx;
+  domaininfo_t di;
+  unsigned int count, no_name, wkd_not_found, wkd_supported;
+  unsigned int wkd_not_supported;
+
+  count = no_name = wkd_not_found = wkd_supported = wkd_not_supported = 0;
+  for (bidx = 0; bidx < NO_OF_DOMAINBUCKETS; bidx++)
+    for (di = domainbuckets[bidx]; di; di = di->next)
+      {
+        count++;
+        if (di->no_name)
+          no_name++;
+        if (di->wkd_not_found)
+          wkd_not_found++;
+        if (di->wkd_supported)
+          wkd_supported++;
+        if (di->wkd_not_supported)
+          wkd_not_supported++;
+      }
+
+  metrics_begin (w, METRIC_GAUGE, "domaininfo_items",
+                 "Number of domains in the domain info cache.");
+  metrics_put (w, NULL, NULL, count);
+  metrics_begin (w, METRIC_GAUGE, "domaininfo_flagged_items",
+                 "Number of domains in the domain info cache by flag.");
+  metrics_put (w, "flag", "no_name", no_name);
+  metrics_put (w, "flag", "wkd_not_found", wkd_not_found);
+  metrics_put (w, "flag", "wkd_supported", wkd_supported);
+  metrics_put (w, "flag", "wkd_not_supported", wkd_not_supported);
+}
+
+
 /* Return true if DOMAIN definitely does not support WKD.  Note that
  * DOMAIN is expected to be lowercase.  */
 int
@@ -130,7 +182,11 @@ domaininfo_is_wkd_not_supported (const char *domain)
 
   for (di = domainbuckets[hash_domain (domain)]; di; di = di->next)
     if (!strcmp (di->name, domain))
-      return !!di->wkd_not_supported;
+      {
+        if (di->timestamp + DOMAININFO_MAX_AGE < gnupg_get_time ())
+          return 0;  /* Outdated - try again.  */
+        return !!di->wkd_not_supported;
+      }
 
   return 0;  /* We don't know.  */
 }
@@ -151,12 +207,15 @@ insert_or_update (const char *domain,
   int ndropped = 0;
   u32 hash;
   int count;
+  time_t now = gnupg_get_time ();
 
+  domaininfo_generation++;
   hash = hash_domain (domain);
   for (di = domainbuckets[hash]; di; di = di->next)
     if (!strcmp (di->name, domain))
       {
         callback (di, 0);  /* Update */
+        di->timestamp = now;
         return;
       }
 
@@ -171,6 +230,7 @@ insert_or_update (const char *domain,
     if (!strcmp (di->name, domain))
       {
         callback (di, 0);  /* Update */
+        di->timestamp = now;
         xfree (di_new);
         return;
       }
@@ -263,6 +323,7 @@ insert_or_update (const char *domain,
 
   /* Insert */
   callback (di_new, 1);
+  di_new->timestamp = now;
   di = di_new;
   di->next = domainbuckets[hash];
   domainbuckets[hash] = di;
@@ -377,3 +438,220 @@ domaininfo_set_wkd_not_found (const char *domain)
 {
   insert_or_update (domain, set_wkd_not_found_cb);
 }
+
+
+
+/* Insert a line from the domaininfo file into the table.  Returns
+ * false for an invalid line.  This is only used at startup.  */
+static int
+load_line (char *line, time_t now)
+{
+  const char *fields[3];
+  domaininfo_t di;
+  unsigned long flags;
+  time_t timestamp;
+  u32 hash;
+  int count;
+
+  if (split_fields (line, fields, DIM (fields)) != DIM (fields))
+    return 0;
+  if (!*fields[0] || strlen (fields[0]) > 255)
+    return 0;
+  flags = strtoul (fields[1], NULL, 16);
+  timestamp = (time_t)strtoul (fields[2], NULL, 10);
+  if (timestamp > now || timestamp + DOMAININFO_MAX_AGE < now)
+    return 1; /* Skip outdated or bogus entries.  */
+
+  hash = hash_domain (fields[0]);
+  for (count=0, di = domainbuckets[hash]; di; di = di->next, count++)
+    if (!strcmp (di->name, fields[0]))
+      return 1;  /* Duplicate.  */
+  if (count >= MAX_DOMAINBUCKET_LEN)
+    return 1;
+
+  di = xtrycalloc (1, sizeof *di + strlen (fields[0]));
+  if (!di)
+    return 1;  /* Out of core - we ignore this.  */
+  strcpy (di->name, fields[0]);
+  di->no_name           = !!(flags & 1);
+  di->wkd_not_found     = !!(flags & 2);
+  di->wkd_supported     = !!(flags & 4);
+  di->wkd_not_supported = !!(flags & 8);
+  di->timestamp = timestamp;
+  di->next = domainbuckets[hash];
+  domainbuckets[hash] = di;
+  return 1;
+}
+
+
+/* Load the table from the file written by domaininfo_save.  This is
+ * called at startup before any other thread is running.  */
+void
+domaininfo_load (void)
+{
+  char *fname;
+  estream_t fp;
+  char line[300];
+  unsigned int lineno = 0;
+  time_t now = gnupg_get_time ();
+  int n;
+
+  fname = make_filename (opt.homedir_cache, DOMAININFO_FILE, NULL);
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        log_info ("error opening '%s': %s\n",
+                  fname, gpg_strerror (gpg_error_from_syserror ()));
+      xfree (fname);
+      return;
+    }
+
+  while (es_fgets (line, DIM (line), fp))
+    {
+      lineno++;
+      n = strlen (line);
+      if (!n || line[n-1] != '\n')
+        {
+          log_info ("%s:%u: line too long - ignoring file\n", fname, lineno);
+          break;
+        }
+      line[--n] = 0;
+      if (lineno == 1)
+        {
+          if (strncmp (line, "# domaininfo v", 14)
+              || atoi (line+14) != DOMAININFO_VERSION)
+            {
+              log_info ("%s: unknown version - ignoring file\n", fname);
+              break;
+            }
+          continue;
+        }
+      if (!*line || *line == '#')
+        continue;
+      if (!load_line (line, now))
+        log_info ("%s:%u: invalid line ignored\n", fname, lineno);
+    }
+
+  if (opt.verbose)
+    log_info ("domaininfo: loaded '%s'\n", fname);
+  es_fclose (fp);
+  xfree (fname);
+}
+
+
+/* Format the table into a malloced buffer and store its length at
+ * R_LEN.  Returns NULL on error or if another thread modified the
+ * table meanwhile.  Entries older than NOW - DOMAININFO_MAX_AGE are
+ * not included.  */
+static char *
+format_table (time_t now, size_t *r_len)
+{
+  unsigned int generation = domaininfo_generation;
+  int bidx;
+  domaininfo_t di;
+  size_t size, len;
+  char *buffer;
+
+  /* Compute the required size; no syscalls are allowed here.  */
+  size = 50;
+  for (bidx = 0; bidx < NO_OF_DOMAINBUCKETS; bidx++)
+    for (di = domainbuckets[bidx]; di; di = di->next)
+      size += strlen (di->name) + 1 + 2 + 1 + 20 + 1;
+
+  buffer = xtrymalloc (size);
+  if (!buffer || generation != domaininfo_generation)
+    {
+      xfree (buffer);
+      return NULL;
+    }
+
+  len = snprintf (buffer, size, "# domaininfo v%d\n", DOMAININFO_VERSION);
+  for (bidx = 0; bidx < NO_OF_DOMAINBUCKETS; bidx++)
+    for (di = domainbuckets[bidx]; di; di = di->next)
+      {
+        if (di->timestamp + DOMAININFO_MAX_AGE < now)
+          continue;
+        len += snprintf (buffer + len, size - len, "%s %02x %lu\n",
+                         di->name,
+                         ((di->no_name? 1:0)
+                          | (di->wkd_not_found? 2:0)
+                          | (di->wkd_supported? 4:0)
+                          | (di->wkd_not_supported? 8:0)),
+                         (unsigned long)di->timestamp);
+      }
+  *r_len = len;
+  return buffer;
+}
+
+
+/* Write the table to a file in the cache directory so that a
+ * restarted dirmngr does not need to probe the same domains again.
+ * Nothing is done if the table has not been changed since the last
+ * save.  */
+void
+domaininfo_save (void)
+{
+  gpg_error_t err = 0;
+  unsigned int generation;
+  char *buffer = NULL;
+  size_t len = 0;
+  char *fname = NULL;
+  char *tmpfname = NULL;
+  estream_t fp = NULL;
+  int tries;
+
+  generation = domaininfo_generation;
+  if (generation == domaininfo_saved_generation)
+    return;
+
+  for (tries = 0; tries < 3 && !buffer; tries++)
+    {
+      generation = domaininfo_generation;
+      buffer = format_table (gnupg_get_time (), &len);
+    }
+  if (!buffer)
+    return;  /* Try again at the next housekeeping.  */
+
+  fname = make_filename (opt.homedir_cache, DOMAININFO_FILE, NULL);
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fp = es_fopen (tmpfname, "w");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (es_fwrite (buffer, len, 1, fp) != 1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      fp = NULL;
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fp = NULL;
+  err = gnupg_rename_file (tmpfname, fname, NULL);
+  if (!err)
+    domaininfo_saved_generation = generation;
+
+ leave:
+  if (err)
+    log_info ("error writing '%s': %s\n",
+              tmpfname? tmpfname : DOMAININFO_FILE, gpg_strerror (err));
+  if (fp)
+    {
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+    }
+  xfree (tmpfname);
+  xfree (fname);
+  xfree (buffer);
+}
@@ -23,5 +23,6 @@
 const char *get_default_keyserver (int name_only);
 
 void http_reinitialize (void);
+void http_housekeeping (void);
 
 #endif /* HTTP_COMMON_H */
@@ -131,6 +131,26 @@
 
 #define HTTP_PROXY_ENV           "http_proxy"
 #define MAX_LINELEN 20000  /* Max. length of a HTTP header line. */
+
+/* Limits for the pool of persistent connections.  The idle timeout
+ * is used if the server does not announce a shorter one; the replay
+ * limit is the maximum size of a request we resend if a reused
+ * connection turned out to be closed by the server.  */
+#define CONN_POOL_MAX           16
+#define CONN_POOL_MAX_PER_HOST   4
+#define CONN_POOL_IDLE_TIMEOUT  15   /* Seconds.  */
+#define CONN_POOL_REPLAY_LIMIT  (64*1024)
+
+/* Limits for the cache of TLS sessions used for resumption.  */
+#define TLS_CACHE_MAX           32
+#define TLS_CACHE_LIFETIME      3600 /* Seconds.  */
+
+/* Parameters for the staggered connects (RFC-8305): The delay before
+ * the next address is tried and the maximum number of concurrent
+ * connection attempts.  */
+#define CONNECT_ATTEMPT_DELAY   250  /* Milliseconds.  */
+#define CONNECT_ATTEMPTS_MAX      8
+
 #define VALID_URI_CHARS "abcdefghijklmnopqrstuvwxyz"   \
                         "ABCDEFGHIJKLMNOPQRSTUVWXYZ"   \
                         "01234567890@"                 \
@@ -158,6 +178,8 @@ static gpg_error_t send_request (ctrl_t ctrl, http_t hd, const char *httphost,
                                  strlist_t headers);
 static char *build_rel_path (parsed_uri_t uri);
 static gpg_error_t parse_response (http_t hd);
+static int keep_connection_p (http_t hd);
+static gpg_error_t resend_request (http_t hd);
 
 static gpg_error_t connect_server (ctrl_t ctrl,
                                    const char *server, unsigned short port,
@@ -186,6 +208,51 @@ struct my_socket_s
 typedef struct my_socket_s *my_socket_t;
 
 
+/* An item of the pool of persistent connections.  The item is
+ * created by send_request with the properties of the connection and
+ * moved to the pool by the close function of the read stream if the
+ * response has been read completely and the server agreed to keep
+ * the connection open.  A connection is only reused for requests
+ * with exactly the same properties; this makes sure that we do not
+ * mix connections with different trust settings or Tor usage.  */
+struct conn_pool_s
+{
+  struct conn_pool_s *next;
+  my_socket_t sock;          /* The socket or NULL.  */
+  http_session_t session;    /* The session for TLS or NULL.  */
+  time_t expires;            /* Time after which we close the connection.  */
+  unsigned int idle_timeout; /* The idle timeout in seconds.  */
+  unsigned short port;       /* The port of the server.  */
+  unsigned int use_tls:1;    /* TLS is used for the connection.  */
+  unsigned int flags;        /* The connection related HTTP_FLAG_*.  */
+  unsigned int sess_flags;   /* The HTTP_FLAG_TRUST_* of the session.  */
+  http_verify_cb_t verify_cb;/* The verification callback of the session.  */
+  char host[1];              /* The server and the SNI name.  */
+};
+typedef struct conn_pool_s *conn_pool_t;
+
+/* The list of idle persistent connections.  */
+static conn_pool_t conn_pool;
+
+
+#if HTTP_USE_GNUTLS
+/* An item of the cache of TLS sessions.  The session data is stored
+ * at the end of a TLS session and used for the next connection to
+ * the same server to allow for an abbreviated handshake.  */
+struct tls_cache_s
+{
+  struct tls_cache_s *next;
+  time_t created;          /* Time the item was stored.  */
+  gnutls_datum_t data;     /* The session data allocated by GnuTLS.  */
+  char name[1];            /* The lookup key; see tls_cache_name.  */
+};
+typedef struct tls_cache_s *tls_cache_t;
+
+/* The list of cached TLS sessions.  */
+static tls_cache_t tls_cache;
+#endif /*HTTP_USE_GNUTLS*/
+
+
 /* Cookie function structure and cookie object.  */
 static es_cookie_io_functions_t cookie_functions =
   {
@@ -230,6 +297,16 @@ struct cookie_s
   unsigned int up_to_empty_line:1;
   unsigned int last_was_lf:1;      /* Helper to detect empty line.  */
   unsigned int last_was_lfcr:1;    /* Helper to detect empty line.  */
+
+  /* If not NULL the connection is put into the pool of persistent
+   * connections on close if the response has been read completely.
+   * Only used for the read stream.  */
+  conn_pool_t pool_item;
+
+  /* If not NULL a memory stream to which all written data is copied
+   * so that the request can be resent.  Only used for the write
+   * stream.  */
+  estream_t replay;
 };
 typedef struct cookie_s *cookie_t;
 
@@ -311,6 +388,16 @@ struct http_session_s
 
 #ifdef HTTP_USE_GNUTLS
   gnutls_certificate_credentials_t certcred;
+
+  /* The name used to store the TLS session for resumption or NULL.
+   * The session is only stored if RESUMABLE is set, i.e. the
+   * handshake and the verification succeeded.  */
+  char *resume_name;
+  unsigned int resumable:1;
+
+  /* The application protocol negotiated via ALPN or the empty
+   * string if the server did not select one.  */
+  char alpn[16];
 #endif /*HTTP_USE_GNUTLS*/
 };
 
@@ -341,6 +428,7 @@ struct http_context_s
   unsigned int in_data:1;
   unsigned int is_http_0_9:1;
   unsigned int keep_alive:1;  /* Keep the connection alive.  */
+  unsigned int reused:1;      /* The connection was taken from the pool.  */
   estream_t fp_read;
   estream_t fp_write;
   void *write_cookie;
@@ -352,6 +440,11 @@ struct http_context_s
   size_t buffer_size;
   unsigned int flags;
   header_t headers;      /* Received headers. */
+  ctrl_t ctrl;           /* The ctrl passed to http_open.  */
+  unsigned int connect_timeout; /* The timeout used for connecting.  */
+  conn_pool_t pool_item; /* Properties of a persistent connection.  */
+  http_session_t spare_session; /* The caller's session if REUSED.  */
+  estream_t replay;      /* Copy of the request if REUSED.  */
 };
 
 
@@ -725,6 +818,119 @@ notify_netactivity (void)
 
 
 
+#if HTTP_USE_GNUTLS
+/* Return a malloced name for the TLS session cache describing the
+ * connection of HD to SERVER.  Returns NULL if the session shall not
+ * be cached.  */
+static char *
+tls_cache_name (http_t hd, const char *server)
+{
+  /* A resumed session allows the server to link our connections.
+   * That is not what we want when using Tor.  */
+  if ((hd->flags & HTTP_FLAG_FORCE_TOR))
+    return NULL;
+
+  return xtryasprintf ("%s:%hu %s %u", server, hd->uri->port,
+                       hd->session->servername? hd->session->servername : "",
+                       hd->session->flags);
+}
+
+
+/* Remove the items from the TLS session cache which have expired.
+ * If NAME is not NULL remove the item NAME instead; if ALL is set
+ * remove all items.  */
+static void
+tls_cache_remove (const char *name, int all)
+{
+  tls_cache_t item, next, prev;
+  time_t now = gnupg_get_time ();
+
+  for (prev = NULL, item = tls_cache; item; item = next)
+    {
+      next = item->next;
+      if (all
+          || (name && !strcmp (item->name, name))
+          || (!name && item->created + TLS_CACHE_LIFETIME <= now))
+        {
+          if (prev)
+            prev->next = next;
+          else
+            tls_cache = next;
+          gnutls_free (item->data.data);
+          xfree (item);
+        }
+      else
+        prev = item;
+    }
+}
+
+
+/* Return the cached session data for NAME or NULL.  */
+static tls_cache_t
+tls_cache_get (const char *name)
+{
+  tls_cache_t item;
+
+  tls_cache_remove (NULL, 0);
+  for (item = tls_cache; item; item = item->next)
+    if (!strcmp (item->name, name))
+      return item;
+  return NULL;
+}
+
+
+/* Store the data of the TLS session TLS under NAME in the cache.  */
+static void
+tls_cache_put (const char *name, tls_session_t tls)
+{
+  tls_cache_t item, tmp, prev, oldest, oldestprev;
+  int rc, n;
+
+  item = xtrycalloc (1, sizeof *item + strlen (name));
+  if (!item)
+    return;
+  strcpy (item->name, name);
+  rc = gnutls_session_get_data2 (tls, &item->data);
+  if (rc < 0)
+    {
+      if (opt_debug)
+        log_debug ("http.c:tls_cache: can't get session data: %s\n",
+                   gnutls_strerror (rc));
+      xfree (item);
+      return;
+    }
+  item->created = gnupg_get_time ();
+
+  tls_cache_remove (name, 0);
+  n = 0;
+  oldest = oldestprev = NULL;
+  for (prev = NULL, tmp = tls_cache; tmp; prev = tmp, tmp = tmp->next)
+    {
+      n++;
+      if (!oldest || tmp->created < oldest->created)
+        {
+          oldest = tmp;
+          oldestprev = prev;
+        }
+    }
+  if (n >= TLS_CACHE_MAX)
+    {
+      if (oldestprev)
+        oldestprev->next = oldest->next;
+      else
+        tls_cache = oldest->next;
+      gnutls_free (oldest->data.data);
+      xfree (oldest);
+    }
+
+  item->next = tls_cache;
+  tls_cache = item;
+  if (opt_debug)
+    log_debug ("http.c:tls_cache: stored session for '%s'\n", name);
+}
+#endif /*HTTP_USE_GNUTLS*/
+
+
 /* Free the TLS session associated with SESS, if any.  */
 static void
 close_tls_session (http_session_t sess)
@@ -740,6 +946,11 @@ close_tls_session (http_session_t sess)
 #elif HTTP_USE_GNUTLS
       my_socket_t sock = gnutls_transport_get_ptr (sess->tls_session);
       my_socket_unref (sock, NULL, NULL);
+      if (sess->resume_name && sess->resumable)
+        tls_cache_put (sess->resume_name, sess->tls_session);
+      xfree (sess->resume_name);
+      sess->resume_name = NULL;
+      sess->resumable = 0;
       gnutls_deinit (sess->tls_session);
       if (sess->certcred)
         gnutls_certificate_free_credentials (sess->certcred);
@@ -1012,6 +1223,22 @@ http_session_new (http_session_t *r_session,
         err = gpg_error (GPG_ERR_GENERAL);
         goto leave;
       }
+
+    /* Tell the server via ALPN which protocol we are going to speak.
+     * We only implement HTTP/1.1; this list is the place to add "h2"
+     * once we have a transport for it.  A server not supporting ALPN
+     * simply ignores this.  */
+    {
+      gnutls_datum_t protos[1];
+
+      protos[0].data = (unsigned char *)"http/1.1";
+      protos[0].size = 8;
+      rc = gnutls_alpn_set_protocols (sess->tls_session, protos,
+                                      DIM (protos), 0);
+      if (rc < 0)
+        log_info ("gnutls_alpn_set_protocols failed: %s\n",
+                  gnutls_strerror (rc));
+    }
   }
 #else /*!HTTP_USE_GNUTLS && !HTTP_USE_NTBTLS*/
   {
@@ -1070,6 +1297,237 @@ http_session_set_timeout (http_session_t sess, unsigned int timeout)
 
 
 
+/* Create a new pool item describing the connection for the request
+ * HD to SERVER at PORT using SNINAME for TLS.  Returns NULL on
+ * error.  */
+static conn_pool_t
+conn_pool_new_item (http_t hd, const char *server, unsigned short port,
+                    const char *sniname)
+{
+  conn_pool_t item;
+
+  item = xtrycalloc (1, sizeof *item + strlen (server) + 1 + strlen (sniname));
+  if (!item)
+    return NULL;
+  strcpy (stpcpy (stpcpy (item->host, server), " "), sniname);
+  item->port = port;
+  item->use_tls = !!hd->uri->use_tls;
+  item->flags = (hd->flags & (HTTP_FLAG_FORCE_TOR
+                              | HTTP_FLAG_IGNORE_IPv4
+                              | HTTP_FLAG_IGNORE_IPv6));
+  if (hd->session)
+    {
+      item->sess_flags = hd->session->flags;
+      item->verify_cb = hd->session->verify_cb;
+    }
+  item->idle_timeout = CONN_POOL_IDLE_TIMEOUT;
+  return item;
+}
+
+
+/* Release the pool ITEM and close its connection.  */
+static void
+conn_pool_release_item (conn_pool_t item)
+{
+  if (!item)
+    return;
+
+  if (opt_debug)
+    log_debug ("http.c:pool: closing connection to '%s'\n", item->host);
+  my_socket_unref (item->sock, NULL, NULL);
+  http_session_unref (item->session);
+  xfree (item);
+}
+
+
+/* Return true if the pool items A and B describe the same kind of
+ * connection.  */
+static int
+conn_pool_match_p (conn_pool_t a, conn_pool_t b)
+{
+  return (a->port == b->port
+          && a->use_tls == b->use_tls
+          && a->flags == b->flags
+          && a->sess_flags == b->sess_flags
+          && a->verify_cb == b->verify_cb
+          && !ascii_strcasecmp (a->host, b->host));
+}
+
+
+/* Return true if the idle connection of ITEM is still usable.  A
+ * readable socket indicates that the server closed the connection or
+ * sent unexpected data.  Note that this function may yield.  */
+static int
+conn_pool_alive_p (conn_pool_t item)
+{
+  fd_set rfds;
+  struct timeval tv;
+
+  if (item->use_tls && (!item->session || !item->session->tls_session))
+    return 0;
+
+#ifndef HAVE_W32_SYSTEM
+  if (FD2INT (item->sock->fd) >= FD_SETSIZE)
+    return 0;
+#endif
+  FD_ZERO (&rfds);
+  FD_SET (FD2INT (item->sock->fd), &rfds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+  if (my_select (FD2NUM (item->sock->fd)+1, &rfds, NULL, NULL, &tv))
+    return 0;
+
+  return 1;
+}
+
+
+/* Close all idle connections which have expired.  If ALL is set close
+ * all idle connections.  */
+static void
+conn_pool_flush (int all)
+{
+  conn_pool_t item, next, prev, dead;
+  time_t now = gnupg_get_time ();
+
+  /* First unlink the items because closing a socket may yield.  */
+  dead = NULL;
+  for (prev = NULL, item = conn_pool; item; item = next)
+    {
+      next = item->next;
+      if (all || item->expires <= now)
+        {
+          if (prev)
+            prev->next = next;
+          else
+            conn_pool = next;
+          item->next = dead;
+          dead = item;
+        }
+      else
+        prev = item;
+    }
+
+  for (item = dead; item; item = next)
+    {
+      next = item->next;
+      conn_pool_release_item (item);
+    }
+}
+
+
+/* Take an idle connection matching KEY from the pool.  Returns NULL
+ * if there is none.  */
+static conn_pool_t
+conn_pool_get (conn_pool_t key)
+{
+  conn_pool_t item, prev;
+
+  conn_pool_flush (0);
+
+ again:
+  for (prev = NULL, item = conn_pool; item; prev = item, item = item->next)
+    if (conn_pool_match_p (item, key))
+      break;
+  if (!item)
+    return NULL;
+
+  if (prev)
+    prev->next = item->next;
+  else
+    conn_pool = item->next;
+  item->next = NULL;
+
+  if (!conn_pool_alive_p (item))
+    {
+      if (opt_debug)
+        log_debug ("http.c:pool: connection to '%s' is stale\n", item->host);
+      conn_pool_release_item (item);
+      goto again;  /* The list may have changed meanwhile.  */
+    }
+
+  if (opt_debug)
+    log_debug ("http.c:pool: reusing connection to '%s'\n", item->host);
+  return item;
+}
+
+
+/* Put the connection SOCK with SESSION described by ITEM into the
+ * pool.  ITEM is consumed.  */
+static void
+conn_pool_put (conn_pool_t item, my_socket_t sock, http_session_t session)
+{
+  conn_pool_t tmp, prev, oldest, oldestprev;
+  int n, nhost;
+
+  if (item->use_tls)
+    {
+      if (!session || !session->tls_session)
+        {
+          xfree (item);
+          return;
+        }
+#if HTTP_USE_GNUTLS
+      /* Data we did not expect; don't reuse.  */
+      if (gnutls_record_check_pending (session->tls_session))
+        {
+          xfree (item);
+          return;
+        }
+#endif /*HTTP_USE_GNUTLS*/
+    }
+
+  conn_pool_flush (0);
+
+  n = nhost = 0;
+  oldest = oldestprev = NULL;
+  for (prev = NULL, tmp = conn_pool; tmp; prev = tmp, tmp = tmp->next)
+    {
+      n++;
+      if (conn_pool_match_p (tmp, item))
+        nhost++;
+      if (!oldest || tmp->expires < oldest->expires)
+        {
+          oldest = tmp;
+          oldestprev = prev;
+        }
+    }
+  if (nhost >= CONN_POOL_MAX_PER_HOST)
+    {
+      xfree (item);
+      return;
+    }
+
+  if (n >= CONN_POOL_MAX)
+    {
+      /* Make room by closing the connection which would expire first.  */
+      if (oldestprev)
+        oldestprev->next = oldest->next;
+      else
+        conn_pool = oldest->next;
+      conn_pool_release_item (oldest);
+    }
+
+  item->sock = my_socket_ref (sock);
+  if (item->use_tls)
+    {
+      item->session = http_session_ref (session);
+      /* The callbacks are only used for the handshake.  Clear them so
+       * that we do not keep pointers to objects of a finished
+       * request.  */
+      session->verify_cb = NULL;
+      session->verify_cb_value = NULL;
+      session->cert_log_cb = NULL;
+    }
+  item->expires = gnupg_get_time () + item->idle_timeout;
+  item->next = conn_pool;
+  conn_pool = item;
+  if (opt_debug)
+    log_debug ("http.c:pool: keeping connection to '%s' for %us\n",
+               item->host, item->idle_timeout);
+}
+
+
+
 
 /* Start a HTTP retrieval and on success store at R_HD a context
    pointer for completing the request and to wait for the response.
@@ -1097,6 +1555,7 @@ http_open (ctrl_t ctrl, http_t *r_hd, http_req_t reqtype, const char *url,
   hd->req_type = reqtype;
   hd->flags = flags;
   hd->session = http_session_ref (session);
+  hd->ctrl = ctrl;
 
   err = parse_uri (&hd->uri, url, 0, !!(flags & HTTP_FLAG_FORCE_TLS));
   if (!err)
@@ -1112,6 +1571,9 @@ http_open (ctrl_t ctrl, http_t *r_hd, http_req_t reqtype, const char *url,
       if (hd->fp_write)
         es_fclose (hd->fp_write);
       http_session_unref (hd->session);
+      http_session_unref (hd->spare_session);
+      xfree (hd->pool_item);
+      es_fclose (hd->replay);
       xfree (hd);
     }
   else
@@ -1271,6 +1733,29 @@ http_wait_response (http_t hd)
     }
 
   err = parse_response (hd);
+  if (err && hd->reused && !hd->status_code && newfpread
+      && hd->replay && !es_ferror (hd->replay))
+    {
+      /* The server closed the reused connection before we got a
+       * response.  This may happen if the server's idle timeout
+       * kicked in while we were sending the request.  */
+      if (opt_verbose || opt_debug)
+        log_info ("http.c: reused connection closed by peer (%s)"
+                  " - resending request\n", gpg_strerror (err));
+      err = resend_request (hd);
+      if (!err)
+        err = parse_response (hd);
+    }
+  es_fclose (hd->replay);
+  hd->replay = NULL;
+
+  if (!err && newfpread && hd->pool_item && keep_connection_p (hd))
+    {
+      /* Let the close function of the read stream put the connection
+       * into the pool.  */
+      ((cookie_t)(hd->read_cookie))->pool_item = hd->pool_item;
+      hd->pool_item = NULL;
+    }
 
   if (!err && newfpread)
     err = es_onclose (hd->fp_read, 1, fp_onclose_notification, hd);
@@ -1325,6 +1810,9 @@ http_close (http_t hd, int keep_read_stream)
   if (hd->fp_write)
     es_fclose (hd->fp_write);
   http_session_unref (hd->session);
+  http_session_unref (hd->spare_session);
+  xfree (hd->pool_item);
+  es_fclose (hd->replay);
   hd->magic = 0xdeadbeef;
   http_release_parsed_uri (hd->uri);
   while (hd->headers)
@@ -1363,16 +1851,26 @@ http_get_status_code (http_t hd)
      (NULL) := Only check whether TLS is in use.  Returns an
                unspecified string if TLS is in use.  That string may
                even be the empty string.
+     "alpn"   := Return the application protocol negotiated via ALPN.
+                 The empty string is returned if no protocol was
+                 negotiated or the TLS library does not support this.
  */
 const char *
 http_get_tls_info (http_t hd, const char *what)
 {
-  (void)what;
-
   if (!hd)
     return NULL;
 
-  return hd->uri->use_tls? "":NULL;
+  if (!hd->uri->use_tls)
+    return NULL;
+
+#if HTTP_USE_GNUTLS
+  if (what && !strcmp (what, "alpn") && hd->session)
+    return hd->session->alpn;
+#endif /*HTTP_USE_GNUTLS*/
+
+  (void)what;
+  return "";
 }
 
 
@@ -2295,6 +2793,7 @@ run_gnutls_handshake (http_t hd, const char *server)
 {
   gpg_error_t err;
   int rc;
+  tls_cache_t item;
 
   if (hd->uri->use_tls)
     {
@@ -2305,6 +2804,22 @@ run_gnutls_handshake (http_t hd, const char *server)
       gnutls_transport_set_push_function (hd->session->tls_session,
                                           my_gnutls_write);
 
+      /* Try to resume a former session with this server.  */
+      xfree (hd->session->resume_name);
+      hd->session->resume_name = tls_cache_name (hd, server);
+      hd->session->resumable = 0;
+      item = NULL;
+      if (hd->session->resume_name)
+        item = tls_cache_get (hd->session->resume_name);
+      if (item)
+        {
+          rc = gnutls_session_set_data (hd->session->tls_session,
+                                        item->data.data, item->data.size);
+          if (rc < 0)
+            log_info ("gnutls_session_set_data failed: %s\n",
+                      gnutls_strerror (rc));
+        }
+
     handshake_again:
       do
         {
@@ -2333,10 +2848,31 @@ run_gnutls_handshake (http_t hd, const char *server)
             }
           else
             log_info ("TLS handshake failed: %s\n", gnutls_strerror (rc));
+          /* Don't try to resume this session again.  */
+          if (item)
+            tls_cache_remove (hd->session->resume_name, 0);
           err = gpg_error (GPG_ERR_NETWORK);
           goto leave;
         }
 
+      if (opt_debug && gnutls_session_is_resumed (hd->session->tls_session))
+        log_debug ("http.c: TLS session for '%s' resumed\n", server);
+
+      {
+        gnutls_datum_t proto;
+
+        *hd->session->alpn = 0;
+        if (!gnutls_alpn_get_selected_protocol (hd->session->tls_session,
+                                                &proto)
+            && proto.size < sizeof hd->session->alpn)
+          {
+            memcpy (hd->session->alpn, proto.data, proto.size);
+            hd->session->alpn[proto.size] = 0;
+          }
+        if (opt_debug && *hd->session->alpn)
+          log_debug ("http.c: ALPN selected '%s'\n", hd->session->alpn);
+      }
+
       hd->session->verify.done = 0;
       if (tls_callback)
         err = tls_callback (hd, hd->session, 0);
@@ -2348,6 +2884,7 @@ run_gnutls_handshake (http_t hd, const char *server)
                     gpg_strerror (err));
           goto leave;
         }
+      hd->session->resumable = 1;
     }
   else
     err =0;
@@ -2809,13 +3346,14 @@ mk_std_request (http_t hd,
   else
     snprintf (portstr, sizeof portstr, ":%u", port);
 
-  request = es_bsprintf ("%s %s%s HTTP/1.0\r\nHost: %s%s\r\n%s",
+  request = es_bsprintf ("%s %s%s HTTP/1.0\r\nHost: %s%s\r\n%s%s",
                          hd->req_type == HTTP_REQ_GET ? "GET" :
                          hd->req_type == HTTP_REQ_HEAD ? "HEAD" :
                          hd->req_type == HTTP_REQ_POST ? "POST" : "OOPS",
                          *relpath == '/' ? "" : "/", relpath,
                          httphost? httphost : server,
                          portstr,
+                         hd->pool_item? "Connection: keep-alive\r\n" : "",
                          authstr? authstr:"");
   if (!request)
     {
@@ -2865,6 +3403,8 @@ send_request (ctrl_t ctrl,
       timeout = 0;
     }
 
+  hd->connect_timeout = timeout;
+
   server = *hd->uri->host ? hd->uri->host : "localhost";
   port = hd->uri->port ? hd->uri->port : 80;
 
@@ -2874,7 +3414,39 @@ send_request (ctrl_t ctrl,
   if ((err = get_proxy_for_url (hd, override_proxy, &proxy)))
     goto leave;
 
-  if (proxy && proxy->is_http_proxy)
+  /* Direct connections without credentials may be kept open for
+   * further requests.  Try to reuse such a connection.  */
+  if (!proxy && !srvtag && !auth && !hd->uri->auth
+      && !(hd->flags & (HTTP_FLAG_IGNORE_CL | HTTP_FLAG_SHUTDOWN)))
+    {
+      hd->pool_item = conn_pool_new_item (hd, server, port,
+                                          httphost? httphost : server);
+      if (hd->pool_item)
+        {
+          conn_pool_t item = conn_pool_get (hd->pool_item);
+
+          if (item)
+            {
+              hd->sock = item->sock;
+              item->sock = NULL;
+              if (item->session)
+                {
+                  hd->spare_session = hd->session;
+                  hd->session = item->session;
+                  item->session = NULL;
+                }
+              xfree (item);
+              hd->reused = 1;
+              /* Errors are ignored; we won't be able to resend the
+               * request then.  */
+              hd->replay = es_fopenmem (CONN_POOL_REPLAY_LIMIT, "w+b");
+            }
+        }
+    }
+
+  if (hd->reused)
+    ;
+  else if (proxy && proxy->is_http_proxy)
     {
       use_http_proxy = 1;  /* We want to use a proxy for the connection.  */
       err = connect_server (ctrl,
@@ -2890,34 +3462,37 @@ send_request (ctrl_t ctrl,
   if (err)
     goto leave;
 
-  hd->sock = my_socket_new (sock);
-  if (!hd->sock)
+  if (!hd->reused)
     {
-      err = gpg_error_from_syserror ();
-      goto leave;
-    }
+      hd->sock = my_socket_new (sock);
+      if (!hd->sock)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
 
-  if (use_http_proxy && hd->uri->use_tls)
-    {
-      err = run_proxy_connect (hd, proxy, httphost, server, port);
-      if (err)
-        goto leave;
+      if (use_http_proxy && hd->uri->use_tls)
+        {
+          err = run_proxy_connect (hd, proxy, httphost, server, port);
+          if (err)
+            goto leave;
 
-      /* We are done with the proxy, the code below will establish a
-       * TLS session and talk directly to the target server.  Thus we
-       * clear the flag to indicate this.  */
-      use_http_proxy = 0;
-    }
+          /* We are done with the proxy, the code below will establish
+           * a TLS session and talk directly to the target server.
+           * Thus we clear the flag to indicate this.  */
+          use_http_proxy = 0;
+        }
 
 #if HTTP_USE_NTBTLS
-  err = run_ntbtls_handshake (hd);
+      err = run_ntbtls_handshake (hd);
 #elif HTTP_USE_GNUTLS
-  err = run_gnutls_handshake (hd, server);
+      err = run_gnutls_handshake (hd, server);
 #else
-  err = 0;
+      err = 0;
 #endif
-  if (err)
-    goto leave;
+      if (err)
+        goto leave;
+    }
 
   if (auth || hd->uri->auth)
     {
@@ -2975,6 +3550,7 @@ send_request (ctrl_t ctrl,
   err = make_fp_write (hd, hd->uri->use_tls, hd->session);
   if (err)
     goto leave;
+  ((cookie_t)(hd->write_cookie))->replay = hd->replay;
 
   if (es_fputs (request, hd->fp_write) || es_fflush (hd->fp_write))
     {
@@ -3005,6 +3581,90 @@ send_request (ctrl_t ctrl,
 }
 
 
+/* Helper for http_wait_response to send the request again after the
+ * server closed the reused connection HD->SOCK.  A new connection is
+ * established and the copy of the request in HD->REPLAY is sent.  */
+static gpg_error_t
+resend_request (http_t hd)
+{
+  gpg_error_t err;
+  const char *server;
+  unsigned short port;
+  assuan_fd_t sock;
+  void *buffer = NULL;
+  size_t buflen;
+
+  /* Drop the stale connection and switch back to the session of the
+   * caller.  */
+  es_fclose (hd->fp_read);
+  hd->fp_read = NULL;
+  hd->read_cookie = NULL;
+  my_socket_unref (hd->sock, NULL, NULL);
+  hd->sock = NULL;
+  if (hd->spare_session)
+    {
+      http_session_unref (hd->session);
+      hd->session = hd->spare_session;
+      hd->spare_session = NULL;
+    }
+  hd->reused = 0;
+
+  err = es_fclose_snatch (hd->replay, &buffer, &buflen);
+  hd->replay = NULL;
+  if (err || !buflen)
+    {
+      err = err? gpg_error_from_syserror () : gpg_error (GPG_ERR_EOF);
+      goto leave;
+    }
+
+  server = *hd->uri->host ? hd->uri->host : "localhost";
+  port = hd->uri->port ? hd->uri->port : 80;
+
+  err = connect_server (hd->ctrl, server, port, hd->flags, NULL,
+                        hd->connect_timeout, &sock);
+  if (err)
+    goto leave;
+
+  hd->sock = my_socket_new (sock);
+  if (!hd->sock)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+#if HTTP_USE_NTBTLS
+  err = run_ntbtls_handshake (hd);
+#elif HTTP_USE_GNUTLS
+  err = run_gnutls_handshake (hd, server);
+#else
+  err = 0;
+#endif
+  if (err)
+    goto leave;
+
+  err = make_fp_write (hd, hd->uri->use_tls, hd->session);
+  if (err)
+    goto leave;
+  if (es_fwrite (buffer, buflen, 1, hd->fp_write) != 1
+      || es_fflush (hd->fp_write))
+    err = gpg_error_from_syserror ();
+  es_fclose (hd->fp_write);
+  hd->fp_write = NULL;
+  hd->write_cookie = NULL;
+  if (err)
+    goto leave;
+
+  err = make_fp_read (hd, hd->uri->use_tls, hd->session);
+  if (err)
+    goto leave;
+  ((cookie_t)(hd->read_cookie))->up_to_empty_line = 1;
+
+ leave:
+  es_free (buffer);
+  return err;
+}
+
+
 /*
  * Build the relative path from the parsed URI.  Minimal
  * implementation.  May return NULL in case of memory failure; errno
@@ -3321,6 +3981,62 @@ parse_response (http_t hd)
   return 0;
 }
 
+
+/* Return true if the comma separated header VALUE contains TOKEN.  */
+static int
+header_has_token_p (const char *value, const char *token)
+{
+  size_t n = strlen (token);
+  const char *s = value;
+
+  while (*s)
+    {
+      while (*s == ' ' || *s == '\t' || *s == ',')
+        s++;
+      if (!ascii_strncasecmp (s, token, n)
+          && (!s[n] || s[n] == ' ' || s[n] == '\t' || s[n] == ','))
+        return 1;
+      while (*s && *s != ',')
+        s++;
+    }
+  return 0;
+}
+
+
+/* Return true if the response in HD allows to keep the connection
+ * open for further requests.  We only do this if the end of the
+ * response can be detected by means of the Content-Length.  As a side
+ * effect the idle timeout of the pool item is adjusted to what the
+ * server announced.  */
+static int
+keep_connection_p (http_t hd)
+{
+  cookie_t cookie = hd->read_cookie;
+  const char *s;
+  unsigned long n;
+
+  if (hd->is_http_0_9 || !cookie || !cookie->content_length_valid)
+    return 0;
+
+  s = http_get_header (hd, "Connection", 0);
+  if (!s || !header_has_token_p (s, "keep-alive")
+      || header_has_token_p (s, "close"))
+    return 0;
+
+  s = http_get_header (hd, "Keep-Alive", 0);
+  if (s && (s = ascii_memistr (s, strlen (s), "timeout=")))
+    {
+      n = strtoul (s+8, NULL, 10);
+      /* Use a safety margin of one second.  */
+      if (n < 2)
+        return 0;
+      if (n - 1 < hd->pool_item->idle_timeout)
+        hd->pool_item->idle_timeout = n - 1;
+    }
+
+  return 1;
+}
+
 #if 0
 static int
 start_server ()
@@ -3610,12 +4326,249 @@ connect_with_timeout (assuan_fd_t sock,
 }
 
 
+/* Return the current time in milliseconds.  This is only used to
+ * compute intervals.  */
+static unsigned long
+get_msecs (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  return GetTickCount ();
+#else
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (unsigned long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+
+/* Connect to one of the NAI addresses in the array AIARRAY the "Happy
+ * Eyeballs" way (RFC-8305): A new connection attempt is started every
+ * CONNECT_ATTEMPT_DELAY milliseconds or as soon as an attempt failed,
+ * while the former attempts are kept pending.  The first established
+ * connection is used.  The caller should sort AIARRAY so that the
+ * address families alternate.  TIMEOUT is the timeout for each
+ * attempt in milliseconds or 0 for no timeout.  On success 0 is
+ * returned and the socket is stored at R_SOCK; if no connection
+ * could be established ASSUAN_INVALID_FD is stored there and the
+ * error of the last attempt at R_LAST_ERR.  An error is only returned
+ * for fatal problems.  R_ANYHOSTADDR is set if a socket was created.
+ * This must not be used in Tor mode.  */
+static gpg_error_t
+connect_happy_eyeballs (dns_addrinfo_t *aiarray, int nai,
+                        unsigned int timeout, int *r_anyhostaddr,
+                        gpg_error_t *r_last_err, assuan_fd_t *r_sock)
+{
+  gpg_error_t err = 0;
+  struct {
+    assuan_fd_t sock;
+    unsigned long started;
+#ifndef HAVE_W32_SYSTEM
+    int oflags;
+#endif
+  } att[CONNECT_ATTEMPTS_MAX];
+  int natt = 0;
+  int idx = 0;
+  int i, n, syserr;
+  assuan_fd_t sock = ASSUAN_INVALID_FD;
+  unsigned long now, next_start, wait, elapsed;
+  fd_set rset, wset;
+  struct timeval tval;
+  int maxfd;
+  socklen_t slen;
+
+  *r_sock = ASSUAN_INVALID_FD;
+  next_start = get_msecs ();
+
+  for (;;)
+    {
+      now = get_msecs ();
+      if (idx < nai && natt < DIM (att) && (!natt || now >= next_start))
+        {
+          /* Start the next connection attempt.  */
+          dns_addrinfo_t ai = aiarray[idx++];
+
+          sock = my_sock_new_for_addr (ai->addr, ai->socktype, ai->protocol);
+          if (sock == ASSUAN_INVALID_FD)
+            {
+              if (errno == EAFNOSUPPORT)
+                continue;
+              err = gpg_err_make (default_errsource,
+                                  gpg_err_code_from_syserror ());
+              log_error ("error creating socket: %s\n", gpg_strerror (err));
+              goto leave;
+            }
+          *r_anyhostaddr = 1;
+
+#ifdef HAVE_W32_SYSTEM
+          {
+            unsigned long along = 1;
+            if (ioctlsocket (FD2INT (sock), FIONBIO, &along))
+              {
+                err = my_wsagetlasterror ();
+                assuan_sock_close (sock);
+                sock = ASSUAN_INVALID_FD;
+                goto leave;
+              }
+          }
+#else
+          att[natt].oflags = fcntl (sock, F_GETFL, 0);
+          if (fcntl (sock, F_SETFL, att[natt].oflags | O_NONBLOCK))
+            {
+              err = gpg_err_make (default_errsource,
+                                  gpg_err_code_from_syserror ());
+              assuan_sock_close (sock);
+              sock = ASSUAN_INVALID_FD;
+              goto leave;
+            }
+#endif
+          att[natt].sock = sock;
+          att[natt].started = now;
+          natt++;
+          sock = ASSUAN_INVALID_FD;
+
+          if (!assuan_sock_connect (att[natt-1].sock,
+                                    (struct sockaddr *)ai->addr, ai->addrlen))
+            {
+              /* Immediate connect.  */
+              i = natt - 1;
+              break;
+            }
+          err = gpg_err_make (default_errsource,
+                              gpg_err_code_from_syserror ());
+          if (gpg_err_code (err) != GPG_ERR_EINPROGRESS
+#ifdef HAVE_W32_SYSTEM
+              && gpg_err_code (err) != GPG_ERR_EAGAIN
+#endif
+              )
+            {
+              *r_last_err = err;
+              natt--;
+              assuan_sock_close (att[natt].sock);
+              continue;
+            }
+          err = 0;
+          next_start = now + CONNECT_ATTEMPT_DELAY;
+          if (opt_debug)
+            log_debug ("http.c:connect: attempt %d started\n", idx);
+          continue;
+        }
+
+      if (!natt)
+        goto leave;  /* All attempts failed.  */
+
+      /* Wait for the pending connects, the next start, or the first
+       * timeout.  */
+      FD_ZERO (&rset);
+      maxfd = 0;
+      for (i=0; i < natt; i++)
+        {
+          FD_SET (FD2INT (att[i].sock), &rset);
+          if (FD2NUM (att[i].sock) > maxfd)
+            maxfd = FD2NUM (att[i].sock);
+        }
+      wset = rset;
+      wait = (unsigned long)(-1);
+      if (idx < nai && natt < DIM (att))
+        wait = next_start > now? next_start - now : 0;
+      if (timeout)
+        for (i=0; i < natt; i++)
+          {
+            elapsed = now - att[i].started;
+            if (elapsed >= timeout)
+              wait = 0;
+            else if (timeout - elapsed < wait)
+              wait = timeout - elapsed;
+          }
+      tval.tv_sec = wait / 1000;
+      tval.tv_usec = (wait % 1000) * 1000;
+      n = my_select (maxfd+1, &rset, &wset, NULL,
+                     wait == (unsigned long)(-1)? NULL : &tval);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          *r_last_err = gpg_err_make (default_errsource,
+                                      gpg_err_code_from_syserror ());
+          goto leave;
+        }
+
+      /* Check the state of the attempts.  */
+      now = get_msecs ();
+      for (i=natt-1; i >= 0; i--)
+        {
+          if (n && (FD_ISSET (FD2INT (att[i].sock), &rset)
+                    || FD_ISSET (FD2INT (att[i].sock), &wset)))
+            {
+              slen = sizeof (syserr);
+              if (getsockopt (FD2INT (att[i].sock), SOL_SOCKET, SO_ERROR,
+                              (void*)&syserr, &slen) < 0)
+                err = gpg_err_make (default_errsource,
+                                    gpg_err_code_from_syserror ());
+              else if (syserr)
+                err = gpg_err_make (default_errsource,
+                                    gpg_err_code_from_errno (syserr));
+              else
+                break; /* Connected.  */
+              /* Failed - start the next attempt right away.  */
+              next_start = now;
+            }
+          else if (timeout && now - att[i].started >= timeout)
+            err = gpg_err_make (default_errsource, GPG_ERR_ETIMEDOUT);
+          else
+            continue;
+
+          *r_last_err = err;
+          err = 0;
+          assuan_sock_close (att[i].sock);
+          att[i] = att[--natt];
+        }
+      if (i >= 0)
+        break;
+    }
+
+  /* Connected using the attempt with index I.  */
+#ifdef HAVE_W32_SYSTEM
+  {
+    unsigned long along = 0;
+    ioctlsocket (FD2INT (att[i].sock), FIONBIO, &along);
+  }
+#else
+  fcntl (att[i].sock, F_SETFL, att[i].oflags);
+#endif
+  *r_sock = att[i].sock;
+  att[i] = att[--natt];
+  err = 0;
+
+ leave:
+  /* Close all pending attempts.  */
+  for (i=0; i < natt; i++)
+    assuan_sock_close (att[i].sock);
+  return err;
+}
+
+
+/* Return true if the address AI may be used given the FLAGS and the
+ * usable address families.  */
+static int
+usable_addr_p (dns_addrinfo_t ai, unsigned int flags,
+               int v4_valid, int v6_valid)
+{
+  if (ai->family == AF_INET)
+    return !(flags & HTTP_FLAG_IGNORE_IPv4) && v4_valid;
+  if (ai->family == AF_INET6)
+    return !(flags & HTTP_FLAG_IGNORE_IPv6) && v6_valid;
+  return 0;
+}
+
+
 /* Actually connect to a server.  On success 0 is returned and the
  * file descriptor for the socket is stored at R_SOCK; on error an
  * error code is returned and ASSUAN_INVALID_FD is stored at R_SOCK.
  * TIMEOUT is the connect timeout in milliseconds.  Note that the
  * function tries to connect to all known addresses and the timeout is
- * for each one. */
+ * for each one.  If there are several addresses and Tor is not used,
+ * the connects are staggered as described by RFC-8305. */
 static gpg_error_t
 connect_server (ctrl_t ctrl, const char *server, unsigned short port,
                 unsigned int flags, const char *srvtag, unsigned int timeout,
@@ -3629,6 +4582,9 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
   int srv, connected, v4_valid, v6_valid;
   gpg_error_t last_err = 0;
   struct srventry *serverlist = NULL;
+  dns_addrinfo_t *aiarray = NULL;
+  dns_addrinfo_t ai4, ai6;
+  int nai, aiidx, want6;
 
   *r_sock = ASSUAN_INVALID_FD;
 
@@ -3714,13 +4670,69 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
         }
       hostfound = 1;
 
-      for (ai = aibuf; ai && !connected; ai = ai->next)
+      /* Put the usable addresses into an array with alternating
+       * address families, starting with the family of the first
+       * address as preferred by the resolver.  */
+      nai = 0;
+      for (ai = aibuf; ai; ai = ai->next)
+        if (usable_addr_p (ai, flags, v4_valid, v6_valid))
+          nai++;
+      xfree (aiarray);
+      aiarray = NULL;
+      if (nai && !(aiarray = xtrycalloc (nai, sizeof *aiarray)))
         {
-          if (ai->family == AF_INET
-              && ((flags & HTTP_FLAG_IGNORE_IPv4) || !v4_valid))
-            continue;
-          if (ai->family == AF_INET6
-              && ((flags & HTTP_FLAG_IGNORE_IPv6) || !v6_valid))
+          err = gpg_err_make (default_errsource,
+                              gpg_err_code_from_syserror ());
+          free_dns_addrinfo (aibuf);
+          xfree (serverlist);
+          return err;
+        }
+      ai4 = ai6 = aibuf;
+      want6 = (nai && aibuf->family == AF_INET6);
+      for (aiidx = 0; aiidx < nai; want6 = !want6)
+        {
+          dns_addrinfo_t *aip = want6? &ai6 : &ai4;
+
+          while (*aip && !((*aip)->family == (want6? AF_INET6 : AF_INET)
+                           && usable_addr_p (*aip, flags,
+                                             v4_valid, v6_valid)))
+            *aip = (*aip)->next;
+          if (*aip)
+            {
+              aiarray[aiidx++] = *aip;
+              *aip = (*aip)->next;
+            }
+        }
+
+      if (nai > 1 && !use_socks (aiarray[0]->addr))
+        {
+          if (sock != ASSUAN_INVALID_FD)
+            {
+              assuan_sock_close (sock);
+              sock = ASSUAN_INVALID_FD;
+            }
+          err = connect_happy_eyeballs (aiarray, nai, timeout,
+                                        &anyhostaddr, &last_err, &sock);
+          if (err)
+            {
+              free_dns_addrinfo (aibuf);
+              xfree (aiarray);
+              xfree (serverlist);
+              return err;
+            }
+          if (sock != ASSUAN_INVALID_FD)
+            {
+              connected = 1;
+              notify_netactivity ();
+            }
+          free_dns_addrinfo (aibuf);
+          continue;
+        }
+
+      for (aiidx = 0; aiidx < nai && !connected; aiidx++)
+        {
+          ai = aiarray[aiidx];
+          if (!usable_addr_p (ai, flags, v4_valid, v6_valid))
             continue;
 
           if (sock != ASSUAN_INVALID_FD)
@@ -3741,6 +4753,7 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
                                   gpg_err_code_from_syserror ());
               log_error ("error creating socket: %s\n", gpg_strerror (err));
               free_dns_addrinfo (aibuf);
+              xfree (aiarray);
               xfree (serverlist);
               return err;
             }
@@ -3761,6 +4774,7 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
       free_dns_addrinfo (aibuf);
     }
 
+  xfree (aiarray);
   xfree (serverlist);
 
   if (!connected)
@@ -3954,7 +4968,9 @@ cookie_read (void *cookie, void *buffer, size_t size)
           if (nread == GNUTLS_E_PREMATURE_TERMINATION)
             {
               /* The server terminated the connection.  Close the TLS
-                 session, and indicate EOF using a short read.  */
+                 session, and indicate EOF using a short read.  We
+                 do not resume such a session.  */
+              c->session->resumable = 0;
               close_tls_session (c->session);
               return 0;
             }
@@ -4063,6 +5079,10 @@ cookie_write (void *cookie, const void *buffer_arg, size_t size)
   cookie_t c = cookie;
   int nwritten = 0;
 
+  /* Note that a size of 0 is used to flush the stream.  */
+  if (c->replay && size)
+    es_fwrite (buffer, 1, size, c->replay);
+
 #if HTTP_USE_NTBTLS
   if (c->use_tls && c->session && c->session->tls_session)
     {
@@ -4184,6 +5204,17 @@ cookie_close (void *cookie)
   if (!c)
     return 0;
 
+  /* Keep the connection open if the response has been read
+   * completely.  */
+  if (c->pool_item)
+    {
+      if (c->sock && !c->content_length && !c->pending.len)
+        conn_pool_put (c->pool_item, c->sock, c->session);
+      else
+        xfree (c->pool_item);
+      c->pool_item = NULL;
+    }
+
 #if HTTP_USE_NTBTLS
   if (c->use_tls && c->session && c->session->tls_session)
     {
@@ -4603,4 +5634,22 @@ http_reinitialize (void)
 #ifdef HAVE_W32_SYSTEM
   w32_get_internet_session (1);  /* Clear our session.  */
 #endif /*HAVE_W32_SYSTEM*/
+  /* Close all persistent connections.  With Tor this also makes sure
+   * that new circuits are used.  */
+  conn_pool_flush (1);
+#if HTTP_USE_GNUTLS
+  tls_cache_remove (NULL, 1);
+#endif
+}
+
+
+/* Function called by the housekeeping to close expired persistent
+ * connections and to drop expired TLS sessions.  */
+void
+http_housekeeping (void)
+{
+  conn_pool_flush (0);
+#if HTTP_USE_GNUTLS
+  tls_cache_remove (NULL, 0);
+#endif
 }
@@ -317,7 +317,7 @@ ks_action_search (ctrl_t ctrl, uri_item_t keyservers,
 
           if (!err)
             {
-              err = copy_stream (infp, outfp);
+              err = copy_stream_flush (infp, outfp);
               es_fclose (infp);
               any_results = 1;
               break;
@@ -333,6 +333,35 @@ ks_action_search (ctrl_t ctrl, uri_item_t keyservers,
 }
 
 
+/* Parameter for get_multi_cb.  */
+struct get_multi_parm_s
+{
+  estream_t outfp;
+  gpg_error_t first_err;
+  int any_data;
+};
+
+
+/* Callback for ks_hkp_get_multi used by ks_action_get.  */
+static gpg_error_t
+get_multi_cb (void *opaque, gpg_error_t err, estream_t infp)
+{
+  struct get_multi_parm_s *parm = opaque;
+
+  if (err)
+    {
+      /* See ks_action_get.  */
+      parm->first_err = err;
+      return 0;
+    }
+
+  err = copy_stream (infp, parm->outfp);
+  if (!err)
+    parm->any_data = 1;
+  return err;
+}
+
+
 /* Get the requested keys (matching PATTERNS) using all configured
    keyservers and write the result to the provided output stream.  */
 gpg_error_t
@@ -377,7 +406,23 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
       (void)newer;
 #endif
 
-      if (is_hkp_s || is_http_s || is_ldap)
+      if (is_hkp_s && patterns->next)
+        {
+          /* With several patterns we run the requests concurrently
+             and pass the keys on as they arrive.  */
+          struct get_multi_parm_s parm;
+
+          any_server = 1;
+          memset (&parm, 0, sizeof parm);
+          parm.outfp = outfp;
+          err = ks_hkp_get_multi (ctrl, uri->parsed_uri, patterns,
+                                  get_multi_cb, &parm);
+          if (parm.first_err)
+            first_err = parm.first_err;
+          if (parm.any_data)
+            any_data = 1;
+        }
+      else if (is_hkp_s || is_http_s || is_ldap)
         {
           any_server = 1;
           for (sl = patterns; !err && sl; sl = sl->next)
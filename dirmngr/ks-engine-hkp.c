@@ -71,6 +71,10 @@
 /* Number of retries done in case of transient errors.  */
 #define SEND_REQUEST_EXTRA_RETRIES 5
 
+/* Maximum number of concurrent requests ks_hkp_get_multi sends to a
+   keyserver (or keyserver pool).  */
+#define MAX_CONCURRENT_GETS 4
+
 
 enum ks_protocol { KS_PROTOCOL_HKP, KS_PROTOCOL_HKPS, KS_PROTOCOL_MAX };
 
@@ -861,6 +865,41 @@ ks_hkp_mark_host (ctrl_t ctrl, const char *name, int alive)
 }
 
 
+/* The metrics source for the hosttable.  */
+void
+ks_hkp_metrics (metrics_writer_t w)
+{
+  int idx;
+  hostinfo_t hi;
+  unsigned int pools = 0;
+  unsigned int hosts = 0;
+  unsigned int dead = 0;
+
+  if (npth_mutex_lock (&hosttable_lock))
+    log_fatal ("failed to acquire mutex\n");
+  for (idx=0; idx < hosttable_size; idx++)
+    if ((hi=hosttable[idx]))
+      {
+        if (hi->pool)
+          pools++;
+        else
+          hosts++;
+        if (hi->dead)
+          dead++;
+      }
+  if (npth_mutex_unlock (&hosttable_lock))
+    log_fatal ("failed to release mutex\n");
+
+  metrics_begin (w, METRIC_GAUGE, "hkp_hosts",
+                 "Number of keyserver hosts and pools known.");
+  metrics_put (w, "kind", "host", hosts);
+  metrics_put (w, "kind", "pool", pools);
+  metrics_begin (w, METRIC_GAUGE, "hkp_dead_hosts",
+                 "Number of keyserver hosts marked as dead.");
+  metrics_put (w, NULL, NULL, dead);
+}
+
+
 /* Debug function to print the entire hosttable.  */
 gpg_error_t
 ks_hkp_print_hosttable (ctrl_t ctrl)
@@ -1638,12 +1677,12 @@ ks_hkp_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 }
 
 
-/* Get the key described key the KEYSPEC string from the keyserver
-   identified by URI.  On success R_FP has an open stream to read the
-   data.  The data will be provided in a format GnuPG can import
-   (either a binary OpenPGP message or an armored one).  */
-gpg_error_t
-ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
+/* Worker for ks_hkp_get and ks_hkp_get_multi.  On return R_HOSTPORT
+   is either NULL or has the malloced name of the server which
+   answered the request; this is to be emitted as SOURCE status.  */
+static gpg_error_t
+get_one_key (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec,
+             estream_t *r_fp, char **r_hostport)
 {
   gpg_error_t err;
   KEYDB_SEARCH_DESC desc;
@@ -1662,6 +1701,7 @@ ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
   unsigned int extra_tries = SEND_REQUEST_EXTRA_RETRIES;
 
   *r_fp = NULL;
+  *r_hostport = NULL;
 
   /* Remove search type indicator and adjust PATTERN accordingly.
      Note that HKP keyservers like the 0x to be present when searching
@@ -1760,17 +1800,18 @@ ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
   if (err)
     {
       if (gpg_err_code (err) == GPG_ERR_NO_DATA)
-        dirmngr_status (ctrl, "SOURCE", hostport, NULL);
+        {
+          *r_hostport = hostport;
+          hostport = NULL;
+        }
       goto leave;
     }
 
-  err = dirmngr_status (ctrl, "SOURCE", hostport, NULL);
-  if (err)
-    goto leave;
-
   /* Return the read stream and close the HTTP context.  */
   *r_fp = fp;
   fp = NULL;
+  *r_hostport = hostport;
+  hostport = NULL;
 
  leave:
   es_fclose (fp);
@@ -1783,6 +1824,242 @@ ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
 }
 
 
+/* Get the key described key the KEYSPEC string from the keyserver
+   identified by URI.  On success R_FP has an open stream to read the
+   data.  The data will be provided in a format GnuPG can import
+   (either a binary OpenPGP message or an armored one).  */
+gpg_error_t
+ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
+{
+  gpg_error_t err, err2;
+  char *hostport;
+
+  err = get_one_key (ctrl, uri, keyspec, r_fp, &hostport);
+  if (hostport)
+    {
+      err2 = dirmngr_status (ctrl, "SOURCE", hostport, NULL);
+      if (!err && err2)
+        {
+          es_fclose (*r_fp);
+          *r_fp = NULL;
+          err = err2;
+        }
+      xfree (hostport);
+    }
+  return err;
+}
+
+
+
+/* Object to track a result of ks_hkp_get_multi.  */
+struct get_multi_result_s
+{
+  struct get_multi_result_s *next;
+  gpg_error_t err;   /* The error returned for the pattern.  */
+  estream_t fp;      /* The key data or NULL.  */
+  char *hostport;    /* The server which answered or NULL.  */
+};
+typedef struct get_multi_result_s *get_multi_result_t;
+
+/* The state shared by the worker threads of ks_hkp_get_multi. All
+   fields below MUTEX are protected by it.  */
+struct get_multi_s
+{
+  ctrl_t ctrl;            /* The caller's control object.  */
+  parsed_uri_t uri;       /* The keyserver.  */
+  npth_mutex_t mutex;
+  npth_cond_t cond;       /* Signaled for each result and exit.  */
+  strlist_t next_pattern; /* The next pattern to process.  */
+  int nworkers;           /* Number of running workers.  */
+  int stop;               /* Request the workers to stop.  */
+  gpg_error_t err;        /* A fatal error of a worker.   */
+  get_multi_result_t results;  /* Queue of finished requests.  */
+  get_multi_result_t *results_tail;
+};
+
+
+/* The worker thread of ks_hkp_get_multi.  */
+static void *
+get_multi_worker (void *arg)
+{
+  struct get_multi_s *gm = arg;
+  ctrl_t ctrl;
+  strlist_t sl;
+  get_multi_result_t res;
+  estream_t infp;
+  gpg_error_t err = 0;
+
+  /* We use our own control object so that requests from different
+     threads do not interfere.  Status lines are emitted by the
+     caller's thread.  */
+  ctrl = xtrycalloc (1, sizeof *ctrl);
+  if (ctrl)
+    {
+      dirmngr_init_default_ctrl (ctrl);
+      ctrl->timeout = gm->ctrl->timeout;
+      ctrl->http_no_crl = gm->ctrl->http_no_crl;
+      xfree (ctrl->http_proxy);
+      ctrl->http_proxy = (gm->ctrl->http_proxy
+                          ? xtrystrdup (gm->ctrl->http_proxy) : NULL);
+    }
+  else
+    err = gpg_error_from_syserror ();
+
+  npth_mutex_lock (&gm->mutex);
+  if (err)
+    {
+      gm->err = err;
+      gm->stop = 1;
+    }
+  while (!gm->stop && (sl = gm->next_pattern))
+    {
+      gm->next_pattern = sl->next;
+      npth_mutex_unlock (&gm->mutex);
+
+      res = xtrycalloc (1, sizeof *res);
+      if (!res)
+        {
+          err = gpg_error_from_syserror ();
+          npth_mutex_lock (&gm->mutex);
+          gm->err = err;
+          gm->stop = 1;
+          break;
+        }
+      res->err = get_one_key (ctrl, gm->uri, sl->d, &infp, &res->hostport);
+      if (!res->err)
+        {
+          /* Read the entire response here so that the transfers run
+             concurrently as well.  */
+          res->fp = es_fopenmem (0, "w+b");
+          if (!res->fp)
+            res->err = gpg_error_from_syserror ();
+          else
+            res->err = copy_stream (infp, res->fp);
+          es_fclose (infp);
+          if (!res->err)
+            es_rewind (res->fp);
+          else
+            {
+              es_fclose (res->fp);
+              res->fp = NULL;
+            }
+        }
+
+      npth_mutex_lock (&gm->mutex);
+      *gm->results_tail = res;
+      gm->results_tail = &res->next;
+      npth_cond_broadcast (&gm->cond);
+    }
+  gm->nworkers--;
+  npth_cond_broadcast (&gm->cond);
+  npth_mutex_unlock (&gm->mutex);
+
+  if (ctrl)
+    {
+      dirmngr_deinit_default_ctrl (ctrl);
+      xfree (ctrl);
+    }
+  return NULL;
+}
+
+
+/* Get the keys described by the strings in PATTERNS from the
+   keyserver identified by URI.  Up to MAX_CONCURRENT_GETS requests
+   are run in parallel; the pool logic in make_host_part and thus the
+   tracking of dead hosts is used as with ks_hkp_get.  For each
+   pattern CB is called in the caller's thread as soon as its request
+   has finished; ERR is the error for this pattern and FP, if ERR is
+   0, the stream with the key data.  If CB returns an error no further
+   requests are sent and that error is returned.  Note that the
+   callbacks are not called in the order of PATTERNS.  */
+gpg_error_t
+ks_hkp_get_multi (ctrl_t ctrl, parsed_uri_t uri, strlist_t patterns,
+                  gpg_error_t (*cb)(void *opaque, gpg_error_t err,
+                                    estream_t fp),
+                  void *cb_value)
+{
+  gpg_error_t err = 0;
+  struct get_multi_s gm;
+  get_multi_result_t res;
+  npth_attr_t tattr;
+  npth_t thread;
+  int i, n, rc;
+
+  memset (&gm, 0, sizeof gm);
+  gm.ctrl = ctrl;
+  gm.uri = uri;
+  gm.next_pattern = patterns;
+  gm.results_tail = &gm.results;
+  rc = npth_mutex_init (&gm.mutex, NULL);
+  if (rc)
+    return gpg_error_from_errno (rc);
+  rc = npth_cond_init (&gm.cond, NULL);
+  if (rc)
+    {
+      npth_mutex_destroy (&gm.mutex);
+      return gpg_error_from_errno (rc);
+    }
+
+  n = strlist_length (patterns);
+  if (n > MAX_CONCURRENT_GETS)
+    n = MAX_CONCURRENT_GETS;
+
+  npth_mutex_lock (&gm.mutex);
+  rc = npth_attr_init (&tattr);
+  if (!rc)
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+      for (i=0; i < n; i++)
+        {
+          rc = npth_create (&thread, &tattr, get_multi_worker, &gm);
+          if (rc)
+            break;
+          gm.nworkers++;
+        }
+      npth_attr_destroy (&tattr);
+    }
+  if (!gm.nworkers)
+    {
+      err = gpg_error_from_errno (rc);
+      log_error ("error spawning keyserver worker: %s\n", gpg_strerror (err));
+    }
+
+  while (gm.nworkers || gm.results)
+    {
+      if (!gm.results)
+        {
+          npth_cond_wait (&gm.cond, &gm.mutex);
+          continue;
+        }
+      res = gm.results;
+      gm.results = res->next;
+      if (!gm.results)
+        gm.results_tail = &gm.results;
+      npth_mutex_unlock (&gm.mutex);
+
+      if (!err && res->hostport
+          && (!res->err || gpg_err_code (res->err) == GPG_ERR_NO_DATA))
+        err = dirmngr_status (ctrl, "SOURCE", res->hostport, NULL);
+      if (!err)
+        err = cb (cb_value, res->err, res->fp);
+      es_fclose (res->fp);
+      xfree (res->hostport);
+      xfree (res);
+
+      npth_mutex_lock (&gm.mutex);
+      if (err)
+        gm.stop = 1;
+    }
+  if (!err)
+    err = gm.err;
+  npth_mutex_unlock (&gm.mutex);
+
+  npth_cond_destroy (&gm.cond);
+  npth_mutex_destroy (&gm.mutex);
+  return err;
+}
+
+
 
 
 /* Callback parameters for put_post_cb.  */
@@ -26,6 +26,11 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <npth.h>
+#ifndef HAVE_W32_SYSTEM
+# ifdef HAVE_SYS_SELECT_H
+#  include <sys/select.h>
+# endif
+#endif
 #ifdef HAVE_W32_SYSTEM
 # ifndef WINVER
 #  define WINVER 0x0500  /* Same as in common/sysutils.c */
@@ -59,6 +64,11 @@
 /* The page size requested from the server.  */
 #define PAGE_SIZE  100
 
+/* The maximum number of idle connections we keep open and the time
+ * in seconds after which an idle connection is closed.  */
+#define CONN_POOL_MAX_IDLE   8
+#define CONN_POOL_IDLE_TIME 60
+
 
 #ifndef HAVE_TIMEGM
 time_t timegm(struct tm *tm);
@@ -82,6 +92,29 @@ struct ks_engine_ldap_local_s
   int more_pages;       /* More pages announced by server.      */
 };
 
+/* An item of the connection pool.  Connections are identified by a
+ * key built from the URI and by the generic flag; along with the
+ * handle we keep the values returned by my_ldap_connect for that
+ * connection.  */
+struct conn_pool_item_s
+{
+  struct conn_pool_item_s *next;
+  LDAP *ldap_conn;
+  unsigned int generic:1;  /* Connected in generic mode.              */
+  unsigned int in_use:1;   /* Currently handed out to a caller.       */
+  int use_tls;
+  unsigned int serverinfo;
+  char *basedn;
+  char *host;
+  time_t idle_since;       /* Time the connection was put back.      */
+  char key[1];             /* See conn_pool_key.                     */
+};
+typedef struct conn_pool_item_s *conn_pool_item_t;
+
+/* The list of pooled connections.  */
+static conn_pool_item_t conn_pool;
+
+
 /*-- prototypes --*/
 static char *map_rid_to_dn (ctrl_t ctrl, const char *rid);
 static char *basedn_from_rootdse (ctrl_t ctrl, parsed_uri_t uri);
@@ -1041,6 +1074,305 @@ my_ldap_connect (parsed_uri_t uri, unsigned int generic, LDAP **ldap_connp,
   return err;
 }
 
+
+/* Release the pool item ITEM which must already be unlinked.  */
+static void
+release_conn_pool_item (conn_pool_item_t item)
+{
+  if (item->ldap_conn)
+    ldap_unbind (item->ldap_conn);
+  xfree (item->basedn);
+  xfree (item->host);
+  xfree (item);
+}
+
+
+/* Return true if the idle connection LDAP_CONN still looks usable.
+ * A server does not send anything on an idle connection unless it
+ * is going to close it (notice of disconnection) or has already done
+ * so; thus a readable socket means the connection is gone.  */
+static int
+conn_pool_alive_p (LDAP *ldap_conn)
+{
+#if !defined(HAVE_W32_SYSTEM) && defined(LDAP_OPT_DESC)
+  int fd = -1;
+  fd_set rfds;
+  struct timeval tv;
+
+  if (ldap_get_option (ldap_conn, LDAP_OPT_DESC, &fd) || fd == -1)
+    return 0;
+  if (fd >= FD_SETSIZE)
+    return 1;  /* Can't check - assume it is alive.  */
+  FD_ZERO (&rfds);
+  FD_SET (fd, &rfds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+  return !select (fd + 1, &rfds, NULL, NULL, &tv);
+#else
+  (void)ldap_conn;
+  return 1;
+#endif
+}
+
+
+/* Remove ITEM from the pool.  */
+static void
+conn_pool_unlink (conn_pool_item_t item)
+{
+  conn_pool_item_t *pp;
+
+  for (pp = &conn_pool; *pp; pp = &(*pp)->next)
+    if (*pp == item)
+      {
+        *pp = item->next;
+        item->next = NULL;
+        return;
+      }
+}
+
+
+/* Return a malloced string identifying the server and the
+ * credentials described by URI.  Returns NULL on error.  */
+static char *
+conn_pool_key (parsed_uri_t uri)
+{
+  if (uri->opaque)
+    return xtrystrdup (uri->path? uri->path : "");
+  return xtryasprintf ("%s://%s@%s:%u/%s?%s%s",
+                       uri->scheme? uri->scheme : "",
+                       uri->auth? uri->auth : "",
+                       uri->host? uri->host : "",
+                       (unsigned int)uri->port,
+                       uri->path? uri->path : "",
+                       (uri->auth && uri_query_value (uri, "password"))
+                       ? uri_query_value (uri, "password") : "",
+                       uri->ad_current? "#ad" : "");
+}
+
+
+/* Close all idle connections of the pool which are older than
+ * CURTIME - CONN_POOL_IDLE_TIME.  If CURTIME is 0 all idle
+ * connections are closed.  */
+static void
+conn_pool_expire (time_t curtime)
+{
+  conn_pool_item_t item, next, expired;
+
+  /* First unlink the items and only then unbind them so that we do
+   * not run into trouble if ldap_unbind yields.  */
+  expired = NULL;
+  for (item = conn_pool; item; item = next)
+    {
+      next = item->next;
+      if (!item->in_use
+          && (!curtime || item->idle_since + CONN_POOL_IDLE_TIME < curtime))
+        {
+          conn_pool_unlink (item);
+          item->next = expired;
+          expired = item;
+        }
+    }
+
+  for (item = expired; item; item = next)
+    {
+      next = item->next;
+      release_conn_pool_item (item);
+    }
+}
+
+
+/* Same as my_ldap_connect but take an idle connection from the pool
+ * if one for URI and GENERIC is available.  The returned connection
+ * must be returned with put_ldap_conn instead of using ldap_unbind.
+ * All returned strings are newly allocated.  */
+static gpg_error_t
+get_ldap_conn (parsed_uri_t uri, unsigned int generic, LDAP **ldap_connp,
+               char **r_basedn, char **r_host, int *r_use_tls,
+               unsigned int *r_serverinfo)
+{
+  gpg_error_t err;
+  conn_pool_item_t item;
+  char *key;
+  LDAP *ldap_conn;
+  char *basedn = NULL;
+  char *host = NULL;
+  int use_tls;
+  unsigned int serverinfo;
+
+  *ldap_connp = NULL;
+  if (r_basedn)
+    *r_basedn = NULL;
+  if (r_host)
+    *r_host = NULL;
+  if (r_use_tls)
+    *r_use_tls = 0;
+  *r_serverinfo = 0;
+
+  conn_pool_expire (gnupg_get_time ());
+
+  key = conn_pool_key (uri);
+  if (!key)
+    return gpg_error_from_syserror ();
+
+  for (item = conn_pool; item; item = item->next)
+    if (!item->in_use && item->generic == !!generic
+        && !strcmp (item->key, key))
+      break;
+  if (item)
+    item->in_use = 1;  /* Claim it before we may yield.  */
+  if (item && !conn_pool_alive_p (item->ldap_conn))
+    {
+      if (opt.verbose)
+        log_info ("ks-ldap: pooled connection to '%s' has been closed\n",
+                  item->host? item->host : "");
+      conn_pool_unlink (item);
+      release_conn_pool_item (item);
+      item = NULL;
+    }
+  if (item)
+    {
+      if ((item->basedn && !(basedn = xtrystrdup (item->basedn)))
+          || (item->host && !(host = xtrystrdup (item->host))))
+        {
+          err = gpg_error_from_syserror ();
+          xfree (basedn);
+          item->in_use = 0;
+          xfree (key);
+          return err;
+        }
+      if (opt.debug)
+        log_debug ("ks-ldap: reusing connection to '%s'\n",
+                   item->host? item->host : "");
+      ldap_conn = item->ldap_conn;
+      use_tls = item->use_tls;
+      serverinfo = item->serverinfo;
+    }
+  else
+    {
+      err = my_ldap_connect (uri, generic, &ldap_conn, &basedn, &host,
+                             &use_tls, &serverinfo);
+      if (err)
+        {
+          xfree (key);
+          return err;
+        }
+
+      /* Register the connection so that put_ldap_conn can return it
+       * to the pool.  On error the connection is simply not pooled.  */
+      item = xtrycalloc (1, sizeof *item + strlen (key));
+      if (item)
+        {
+          strcpy (item->key, key);
+          item->generic = !!generic;
+          item->use_tls = use_tls;
+          item->serverinfo = serverinfo;
+          item->basedn = basedn? xtrystrdup (basedn) : NULL;
+          item->host = host? xtrystrdup (host) : NULL;
+          if ((basedn && !item->basedn) || (host && !item->host))
+            {
+              xfree (item->basedn);
+              xfree (item->host);
+              xfree (item);
+            }
+          else
+            {
+              item->ldap_conn = ldap_conn;
+              item->in_use = 1;
+              item->next = conn_pool;
+              conn_pool = item;
+            }
+        }
+    }
+  xfree (key);
+
+  *ldap_connp = ldap_conn;
+  if (r_basedn)
+    *r_basedn = basedn;
+  else
+    xfree (basedn);
+  if (r_host)
+    *r_host = host;
+  else
+    xfree (host);
+  if (r_use_tls)
+    *r_use_tls = use_tls;
+  *r_serverinfo = serverinfo;
+  return 0;
+}
+
+
+/* Give back the connection LDAP_CONN obtained by get_ldap_conn.  If
+ * REUSABLE is false or the connection is not known to the pool it is
+ * closed.  */
+static void
+put_ldap_conn (LDAP *ldap_conn, int reusable)
+{
+  conn_pool_item_t item;
+  int nidle;
+
+  if (!ldap_conn)
+    return;
+
+  for (item = conn_pool; item; item = item->next)
+    if (item->ldap_conn == ldap_conn)
+      break;
+  if (!item)
+    {
+      ldap_unbind (ldap_conn);
+      return;
+    }
+
+  if (!reusable)
+    {
+      conn_pool_unlink (item);
+      release_conn_pool_item (item);
+      return;
+    }
+
+  item->in_use = 0;
+  item->idle_since = gnupg_get_time ();
+
+  /* Move the item to the front and drop the oldest idle connections
+   * if we have too many.  */
+  conn_pool_unlink (item);
+  item->next = conn_pool;
+  conn_pool = item;
+  for (nidle = 0, item = conn_pool; item; item = item->next)
+    if (!item->in_use)
+      nidle++;
+  while (nidle-- > CONN_POOL_MAX_IDLE)
+    {
+      conn_pool_item_t oldest = NULL;
+
+      for (item = conn_pool; item; item = item->next)
+        if (!item->in_use)
+          oldest = item;
+      conn_pool_unlink (oldest);
+      release_conn_pool_item (oldest);
+    }
+}
+
+
+/* Release idle LDAP connections.  This is called by the housekeeping
+ * thread with the current time; a CURTIME of 0 closes all idle
+ * connections.  */
+void
+ks_ldap_housekeeping (time_t curtime)
+{
+  conn_pool_expire (curtime);
+}
+
+
+/* Check whether ERR is an error which does not affect the
+ * connection used for the request.  */
+static int
+conn_reusable_p (gpg_error_t err)
+{
+  return (!err
+          || gpg_err_code (err) == GPG_ERR_NO_DATA
+          || gpg_err_code (err) == GPG_ERR_NOT_FOUND);
+}
+
 /* Extract keys from an LDAP reply and write them out to the output
    stream OUTPUT in a format GnuPG can import (either the OpenPGP
    binary format or armored format).  */
@@ -1706,8 +2038,14 @@ ks_ldap_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec,
     }
   else /* Not in --next mode.  */
     {
-      /* Make sure we are talking to an OpenPGP LDAP server.  */
-      err = my_ldap_connect (uri, 0, &ldap_conn,
+      /* Make sure we are talking to an OpenPGP LDAP server.  In
+       * --first mode the connection is kept in the state object and
+       * thus can't be taken from the pool.  */
+      if ((ks_get_flags & KS_GET_FLAG_FIRST))
+        err = my_ldap_connect (uri, 0, &ldap_conn,
+                               &basedn, &host, &use_tls, &serverinfo);
+      else
+        err = get_ldap_conn (uri, 0, &ldap_conn,
                              &basedn, &host, &use_tls, &serverinfo);
       if (err || !basedn)
         {
@@ -1838,8 +2176,7 @@ ks_ldap_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec,
   xfree (basedn);
   xfree (host);
 
-  if (ldap_conn)
-    ldap_unbind (ldap_conn);
+  put_ldap_conn (ldap_conn, conn_reusable_p (err));
 
   xfree (filter);
 
@@ -1847,6 +2184,125 @@ ks_ldap_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec,
 }
 
 
+/* Run a search with the paged results control (RFC-2696) so that
+ * the result is not truncated by the server's size limit.  The
+ * result messages of all pages are stored in a newly allocated array
+ * at R_PAGES and their number at R_NPAGES; the caller must release
+ * them using free_search_pages even on error.  Returns an LDAP error
+ * code.  Servers not supporting the control return everything they
+ * have in one page.  */
+static int
+search_paged (LDAP *ldap_conn, const char *basedn, const char *filter,
+              char **attrs, LDAPMessage ***r_pages, int *r_npages)
+{
+  int l_err, l_reserr;
+  LDAPControl *srvctrls[2] = { NULL, NULL };
+  LDAPControl **resctrls;
+  struct berval *cookie = NULL;
+  unsigned int totalcount;
+  LDAPMessage *res, **pages = NULL, **tmppages;
+  int npages = 0;
+
+  for (;;)
+    {
+      l_err = ldap_create_page_control (ldap_conn, PAGE_SIZE, cookie, 0,
+                                        &srvctrls[0]);
+      if (l_err != LDAP_SUCCESS)
+        break;
+
+      res = NULL;
+      npth_unprotect ();
+      l_err = ldap_search_ext_s (ldap_conn, basedn, LDAP_SCOPE_SUBTREE,
+                                 filter, attrs, 0, srvctrls, NULL,
+                                 NULL, 0, &res);
+      npth_protect ();
+      ldap_control_free (srvctrls[0]);
+      srvctrls[0] = NULL;
+
+      if (res)
+        {
+          tmppages = xtryrealloc (pages, (npages + 1) * sizeof *pages);
+          if (!tmppages)
+            {
+              ldap_msgfree (res);
+              l_err = LDAP_NO_MEMORY;
+              break;
+            }
+          pages = tmppages;
+          pages[npages++] = res;
+        }
+      if (l_err != LDAP_SUCCESS || !res)
+        break;
+
+      resctrls = NULL;
+      l_err = ldap_parse_result (ldap_conn, res, &l_reserr, NULL, NULL,
+                                 NULL, &resctrls, 0);
+      if (l_err != LDAP_SUCCESS)
+        break;
+
+      if (cookie)
+        {
+          ber_bvfree (cookie);
+          cookie = NULL;
+        }
+      l_err = ldap_parse_page_control (ldap_conn, resctrls,
+                                       &totalcount, &cookie);
+      if (resctrls)
+        ldap_controls_free (resctrls);
+      if (l_err != LDAP_SUCCESS)
+        {
+          /* No paging support - that was all.  */
+          l_err = LDAP_SUCCESS;
+          break;
+        }
+      if (!cookie || !cookie->bv_len)
+        break;  /* That was the last page.  */
+      if (opt.debug)
+        log_debug ("ks-ldap: fetching page %d of the search result\n",
+                   npages + 1);
+    }
+
+  if (cookie)
+    ber_bvfree (cookie);
+  *r_pages = pages;
+  *r_npages = npages;
+  return l_err;
+}
+
+
+/* Release the result of search_paged.  */
+static void
+free_search_pages (LDAPMessage **pages, int npages)
+{
+  int i;
+
+  for (i = 0; i < npages; i++)
+    ldap_msgfree (pages[i]);
+  xfree (pages);
+}
+
+
+/* Iterate over all entries of the NPAGES result messages PAGES.  To
+ * get the first entry pass NULL for CURRENT.  *PAGENO is used to
+ * keep track of the current page.  */
+static LDAPMessage *
+next_paged_entry (LDAP *ldap_conn, LDAPMessage **pages, int npages,
+                  int *pageno, LDAPMessage *current)
+{
+  if (!current)
+    *pageno = 0;
+  else if ((current = ldap_next_entry (ldap_conn, current)))
+    return current;
+  else
+    ++*pageno;
+
+  for (; *pageno < npages; ++*pageno)
+    if ((current = ldap_first_entry (ldap_conn, pages[*pageno])))
+      return current;
+  return NULL;
+}
+
+
 /* Search the keyserver identified by URI for keys matching PATTERN.
    On success R_FP has an open stream to read the data.  */
 gpg_error_t
@@ -1869,7 +2325,7 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
     }
 
   /* Make sure we are talking to an OpenPGP LDAP server.  */
-  err = my_ldap_connect (uri, 0, &ldap_conn, &basedn, NULL, NULL, &serverinfo);
+  err = get_ldap_conn (uri, 0, &ldap_conn, &basedn, NULL, NULL, &serverinfo);
   if (err || !basedn)
     {
       if (!err)
@@ -1896,7 +2352,9 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 
   {
     char **vals;
-    LDAPMessage *res, *each;
+    LDAPMessage **pages = NULL, *each;
+    int npages = 0;
+    int eachpage, uidspage;
     int count = 0;
     strlist_t dupelist = NULL;
 
@@ -1913,10 +2371,8 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
     if (opt.debug)
       log_debug ("SEARCH '%s' => '%s' BEGIN\n", pattern, filter);
 
-    npth_unprotect ();
-    ldap_err = ldap_search_s (ldap_conn, basedn,
-			      LDAP_SCOPE_SUBTREE, filter, attrs, 0, &res);
-    npth_protect ();
+    ldap_err = search_paged (ldap_conn, basedn, filter, attrs,
+                             &pages, &npages);
 
     xfree (filter);
     filter = NULL;
@@ -1928,17 +2384,20 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 	log_error ("SEARCH %s FAILED %d\n", pattern, err);
 	log_error ("ks-ldap: LDAP search error: %s\n",
 		   ldap_err2string (err));
+        free_search_pages (pages, npages);
 	goto out;
     }
 
     /* The LDAP server doesn't return a real count of unique keys, so we
        can't use ldap_count_entries here. */
     for (npth_unprotect (),
-           each = ldap_first_entry (ldap_conn, res),
+           each = next_paged_entry (ldap_conn, pages, npages,
+                                    &eachpage, NULL),
            npth_protect ();
 	 each;
          npth_unprotect (),
-           each = ldap_next_entry (ldap_conn, each),
+           each = next_paged_entry (ldap_conn, pages, npages,
+                                    &eachpage, each),
            npth_protect ())
       {
 	char **certid = ldap_get_values (ldap_conn, each, "pgpcertid");
@@ -1969,9 +2428,11 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
       {
 	es_fprintf (fp, "info:1:%d\n", count);
 
-	for (each = ldap_first_entry (ldap_conn, res);
+	for (each = next_paged_entry (ldap_conn, pages, npages,
+                                      &eachpage, NULL);
 	     each;
-	     each = ldap_next_entry (ldap_conn, each))
+	     each = next_paged_entry (ldap_conn, pages, npages,
+                                      &eachpage, each))
 	  {
 	    char **certid;
 	    LDAPMessage *uids;
@@ -2074,9 +2535,11 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 		es_fprintf (fp, "\n");
 
 		/* Now print all the uids that have this certid */
-		for (uids = ldap_first_entry (ldap_conn, res);
+		for (uids = next_paged_entry (ldap_conn, pages, npages,
+                                              &uidspage, NULL);
 		     uids;
-		     uids = ldap_next_entry (ldap_conn, uids))
+		     uids = next_paged_entry (ldap_conn, pages, npages,
+                                              &uidspage, uids))
 		  {
 		    vals = ldap_get_values (ldap_conn, uids, "pgpcertid");
                     if (!vals || !vals[0])
@@ -2115,7 +2578,7 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 	  }
       }
 
-    ldap_msgfree (res);
+    free_search_pages (pages, npages);
     free_strlist (dupelist);
   }
 
@@ -2138,8 +2601,7 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 
   xfree (basedn);
 
-  if (ldap_conn)
-    ldap_unbind (ldap_conn);
+  put_ldap_conn (ldap_conn, conn_reusable_p (err));
 
   xfree (filter);
 
@@ -3136,7 +3598,11 @@ ks_ldap_query (ctrl_t ctrl, parsed_uri_t uri, unsigned int ks_get_flags,
       /* Connect to the LDAP server in generic mode. */
       char *tmpbasedn;
 
-      err = my_ldap_connect (uri, 1 /*generic*/, &ldap_conn,
+      if ((ks_get_flags & KS_GET_FLAG_FIRST))
+        err = my_ldap_connect (uri, 1 /*generic*/, &ldap_conn,
+                               &tmpbasedn, &host, &use_tls, &serverinfo);
+      else
+        err = get_ldap_conn (uri, 1 /*generic*/, &ldap_conn,
                              &tmpbasedn, &host, &use_tls, &serverinfo);
       if (err)
         goto leave;
@@ -3236,8 +3702,7 @@ ks_ldap_query (ctrl_t ctrl, parsed_uri_t uri, unsigned int ks_get_flags,
   xfree (basedn);
   xfree (host);
 
-  if (ldap_conn)
-    ldap_unbind (ldap_conn);
+  put_ldap_conn (ldap_conn, conn_reusable_p (err));
 
   xfree (filter);
   xfree (filter_arg_buffer);
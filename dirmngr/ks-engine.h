@@ -46,6 +46,12 @@ gpg_error_t ks_hkp_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
                            estream_t *r_fp, unsigned int *r_http_status);
 gpg_error_t ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri,
                         const char *keyspec, estream_t *r_fp);
+gpg_error_t ks_hkp_get_multi (ctrl_t ctrl, parsed_uri_t uri,
+                              strlist_t patterns,
+                              gpg_error_t (*cb)(void *opaque,
+                                                gpg_error_t err,
+                                                estream_t fp),
+                              void *cb_value);
 gpg_error_t ks_hkp_put (ctrl_t ctrl, parsed_uri_t uri,
                         const void *data, size_t datalen);
 
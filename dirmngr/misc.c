@@ -25,6 +25,7 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <npth.h>
 
 #include "dirmngr.h"
 #include "../common/util.h"
@@ -660,3 +661,131 @@ copy_stream (estream_t in, estream_t out)
     }
   return gpg_error_from_syserror ();
 }
+
+
+/* Same as copy_stream but flush OUT after each chunk so that the
+ * receiver can start to process the data while it is still being
+ * read from IN.  This is used for search results which are shown to
+ * the user page by page.  */
+gpg_error_t
+copy_stream_flush (estream_t in, estream_t out)
+{
+  char buffer[512];
+  size_t nread;
+
+  while (!es_read (in, buffer, sizeof buffer, &nread))
+    {
+      if (!nread)
+        return 0; /* EOF */
+      if (es_write (out, buffer, nread, NULL) || es_fflush (out))
+        break;
+    }
+  return gpg_error_from_syserror ();
+}
+
+
+/* An operation in progress; see singleflight_enter.  */
+struct singleflight_s
+{
+  struct singleflight_s *next;
+  unsigned int refcount;  /* The leader and the waiting threads.  */
+  int done;               /* The leader has finished.             */
+  gpg_error_t err;        /* The result of the operation.          */
+  char *value;            /* An optional result string.            */
+  char key[1];
+};
+static struct singleflight_s *singleflight_list;
+static npth_mutex_t singleflight_lock = NPTH_MUTEX_INITIALIZER;
+static npth_cond_t  singleflight_cond = NPTH_COND_INITIALIZER;
+
+
+static void
+singleflight_unref (struct singleflight_s *sf)
+{
+  if (!--sf->refcount)
+    {
+      xfree (sf->value);
+      xfree (sf);
+    }
+}
+
+
+/* Make sure that an operation identified by KEY, like the fetching of
+ * a CRL from a certain URL, is run only once even when it is
+ * requested concurrently by several connections.  If no such
+ * operation is in progress, register the caller as the one running it
+ * and return true; the caller must then run the operation and call
+ * singleflight_leave.  If the operation is already in progress, wait
+ * until it has been finished, store its error code at R_ERR and a
+ * malloced copy of its result string at R_VALUE (if not NULL), and
+ * return false.  */
+int
+singleflight_enter (const char *key, gpg_error_t *r_err, char **r_value)
+{
+  struct singleflight_s *sf;
+  int leader = 0;
+
+  *r_err = 0;
+  if (r_value)
+    *r_value = NULL;
+
+  npth_mutex_lock (&singleflight_lock);
+  for (sf = singleflight_list; sf; sf = sf->next)
+    if (!strcmp (sf->key, key))
+      break;
+  if (sf)
+    {
+      sf->refcount++;
+      while (!sf->done)
+        npth_cond_wait (&singleflight_cond, &singleflight_lock);
+      *r_err = sf->err;
+      if (r_value && sf->value && !(*r_value = xtrystrdup (sf->value)))
+        *r_err = gpg_error_from_syserror ();
+      singleflight_unref (sf);
+    }
+  else
+    {
+      leader = 1;
+      /* If we are out of core we simply run the operation without
+       * registering it.  */
+      sf = xtrycalloc (1, sizeof *sf + strlen (key));
+      if (sf)
+        {
+          strcpy (sf->key, key);
+          sf->refcount = 1;
+          sf->next = singleflight_list;
+          singleflight_list = sf;
+        }
+    }
+  npth_mutex_unlock (&singleflight_lock);
+
+  return leader;
+}
+
+
+/* Finish the operation KEY started by singleflight_enter with the
+ * error code ERR and the optional result string VALUE and wake up all
+ * waiting threads.  A new operation with the same key may be started
+ * right after this call.  */
+void
+singleflight_leave (const char *key, gpg_error_t err, const char *value)
+{
+  struct singleflight_s *sf, **sfp;
+
+  npth_mutex_lock (&singleflight_lock);
+  for (sfp = &singleflight_list; (sf = *sfp); sfp = &sf->next)
+    if (!strcmp (sf->key, key))
+      break;
+  if (sf)
+    {
+      *sfp = sf->next;
+      sf->next = NULL;
+      sf->err = err;
+      if (value && !(sf->value = xtrystrdup (value)) && !err)
+        sf->err = gpg_error_from_syserror ();
+      sf->done = 1;
+      npth_cond_broadcast (&singleflight_cond);
+      singleflight_unref (sf);
+    }
+  npth_mutex_unlock (&singleflight_lock);
+}
@@ -87,5 +87,10 @@ gpg_error_t armor_data (char **r_string, const void *data, size_t datalen);
 
 /* Copy all data from IN to OUT.  */
 gpg_error_t copy_stream (estream_t in, estream_t out);
+gpg_error_t copy_stream_flush (estream_t in, estream_t out);
+
+/* Run an operation only once for concurrent requests.  */
+int singleflight_enter (const char *key, gpg_error_t *r_err, char **r_value);
+void singleflight_leave (const char *key, gpg_error_t err, const char *value);
 
 #endif /* MISC_H */
@@ -25,6 +25,7 @@
 #include <assert.h>
 
 #include "dirmngr.h"
+#include "../common/sysutils.h"
 #include "misc.h"
 #include "http.h"
 #include "validate.h"
@@ -47,6 +48,469 @@ static const char oidstr_ocsp[] = "1.3.6.1.5.5.7.48.1";
 /* static const char oidstr_certHash[] = "1.3.36.8.3.13"; */
 
 
+/* Number of buckets of the OCSP response cache and the limit for the
+   length of a bucket chain.  */
+#define NO_OF_OCSPBUCKETS   211
+#define MAX_OCSPBUCKET_LEN  50
+
+/* The file used to keep the OCSP response cache across restarts and
+   its version.  */
+#define OCSPCACHE_FILE      "ocspcache.txt"
+#define OCSPCACHE_VERSION   1
+
+/* Responses which have been used at least OCSP_REFRESH_MIN_HITS times
+   are fetched again in the background OCSP_REFRESH_AHEAD seconds
+   before their nextUpdate, reduced by a per response offset of up to
+   OCSP_REFRESH_JITTER seconds.  At most OCSP_REFRESH_MAX_PER_RUN
+   requests are scheduled per housekeeping run.  */
+#define OCSP_REFRESH_AHEAD       (30*60)
+#define OCSP_REFRESH_JITTER      (15*60)
+#define OCSP_REFRESH_MIN_HITS    3
+#define OCSP_REFRESH_MAX_PER_RUN 10
+
+
+/* The result of an OCSP check as returned by do_ocsp_isvalid.  */
+struct ocsp_result_s
+{
+  int revoked;                /* The certificate has been revoked.  */
+  ksba_isotime_t revoked_at;  /* Revocation time or empty.  */
+  ksba_crl_reason_t reason;   /* Revocation reason.  */
+  char signer_fpr[41];        /* If not empty the status is only valid
+                                 if this responder cert is valid.  */
+};
+typedef struct ocsp_result_s *ocsp_result_t;
+
+
+/* An object for one cached OCSP response.  We only store what we
+   learned from the verified response and not the response itself.  */
+struct ocsp_cache_s
+{
+  struct ocsp_cache_s *next;
+  unsigned int revoked:1;           /* The certificate is revoked.     */
+  unsigned int default_signer:1;    /* Verified using the default
+                                       responder's signer.             */
+  unsigned int refresh_scheduled:1; /* A refresh has been queued.      */
+  unsigned int hits;                /* Number of lookups served.       */
+  ksba_isotime_t this_update;
+  ksba_isotime_t next_update;
+  ksba_isotime_t revoked_at;
+  ksba_crl_reason_t reason;
+  char cert_fpr[41];                /* Fingerprint of the target cert. */
+  char signer_fpr[41];              /* See struct ocsp_result_s.       */
+  char certid[1];                   /* Issuer fingerprint and serial.  */
+};
+typedef struct ocsp_cache_s *ocsp_cache_t;
+
+/* The hashed array with the cached responses.  */
+static ocsp_cache_t ocspbuckets[NO_OF_OCSPBUCKETS];
+
+/* Incremented for each change of the cache; used to detect changes
+   done by other threads while saving and to skip saving an unchanged
+   cache.  */
+static unsigned int ocspcache_generation;
+static unsigned int ocspcache_saved_generation;
+
+
+/* The hash function we use for the CERTID.  Must not call a system
+   function.  */
+static u32
+hash_certid (const char *certid)
+{
+  const unsigned char *s = (const unsigned char*)certid;
+  u32 hashval = 0;
+  u32 carry;
+
+  for (; *s; s++)
+    {
+      hashval = (hashval << 4) + *s;
+      if ((carry = (hashval & 0xf0000000)))
+        {
+          hashval ^= (carry >> 24);
+          hashval ^= carry;
+        }
+    }
+
+  return hashval;
+}
+
+
+/* Return a malloced string identifying the OCSP target CERT issued
+   by ISSUER_CERT.  We use the issuer's fingerprint and the serial
+   number which has the same meaning as the CertID of the request.  */
+static char *
+make_certid (ksba_cert_t cert, ksba_cert_t issuer_cert)
+{
+  ksba_sexp_t serial;
+  char *issuer_fpr, *serialstr, *certid;
+
+  issuer_fpr = get_fingerprint_hexstring (issuer_cert);
+  serial = ksba_cert_get_serial (cert);
+  serialstr = serial_hex (serial);
+  ksba_free (serial);
+  if (issuer_fpr && serialstr)
+    certid = strconcat (issuer_fpr, ":", serialstr, NULL);
+  else
+    certid = NULL;
+  xfree (serialstr);
+  xfree (issuer_fpr);
+  return certid;
+}
+
+
+/* Return true if the cached response ITEM may still be used at
+   CURRENT_TIME.  */
+static int
+cached_response_current_p (ocsp_cache_t item, const ksba_isotime_t current_time)
+{
+  ksba_isotime_t tmp_time;
+
+  if (strcmp (item->next_update, current_time) <= 0)
+    return 0;
+  gnupg_copy_time (tmp_time, item->this_update);
+  add_seconds_to_isotime (tmp_time, opt.ocsp_max_period);
+  if (!*tmp_time || strcmp (tmp_time, current_time) < 0)
+    return 0;
+  return 1;
+}
+
+
+/* Look up CERTID in the cache.  If a current response is found, store
+   its outcome at R_RESULT and return true.  With NEED_DEFAULT_SIGNER
+   only responses verified with the default signer are considered.  */
+static int
+ocsp_cache_get (const char *certid, int need_default_signer,
+                ocsp_result_t r_result)
+{
+  ocsp_cache_t item;
+  ksba_isotime_t current_time;
+
+  for (item = ocspbuckets[hash_certid (certid) % NO_OF_OCSPBUCKETS];
+       item; item = item->next)
+    if (!strcmp (item->certid, certid))
+      break;
+  if (!item || (need_default_signer && !item->default_signer))
+    return 0;
+
+  gnupg_get_isotime (current_time);
+  if (!cached_response_current_p (item, current_time))
+    return 0;
+
+  item->hits++;
+  memset (r_result, 0, sizeof *r_result);
+  if (item->revoked)
+    {
+      r_result->revoked = 1;
+      gnupg_copy_time (r_result->revoked_at, item->revoked_at);
+      r_result->reason = item->reason;
+    }
+  strcpy (r_result->signer_fpr, item->signer_fpr);
+  return 1;
+}
+
+
+/* Store a verified response for CERTID in the cache.  */
+static void
+ocsp_cache_put (const char *certid, const char *cert_fpr,
+                const ksba_isotime_t this_update,
+                const ksba_isotime_t next_update,
+                int default_signer, ocsp_result_t result)
+{
+  ocsp_cache_t item, prev, *bucket;
+  int count;
+
+  if (!*next_update || strlen (cert_fpr) >= sizeof item->cert_fpr)
+    return;  /* Without a nextUpdate the response is not cacheable.  */
+
+  bucket = &ocspbuckets[hash_certid (certid) % NO_OF_OCSPBUCKETS];
+  for (prev = NULL, item = *bucket; item; prev = item, item = item->next)
+    if (!strcmp (item->certid, certid))
+      {
+        if (prev)
+          prev->next = item->next;
+        else
+          *bucket = item->next;
+        xfree (item);
+        break;
+      }
+
+  /* Make room by dropping the oldest entry of a full chain.  */
+  for (count = 0, prev = NULL, item = *bucket;
+       item && item->next; prev = item, item = item->next)
+    count++;
+  if (item && count + 1 >= MAX_OCSPBUCKET_LEN)
+    {
+      if (prev)
+        prev->next = NULL;
+      else
+        *bucket = NULL;
+      xfree (item);
+    }
+
+  item = xtrycalloc (1, sizeof *item + strlen (certid));
+  if (!item)
+    return;  /* Out of core - we ignore this.  */
+  strcpy (item->certid, certid);
+  strcpy (item->cert_fpr, cert_fpr);
+  strcpy (item->signer_fpr, result->signer_fpr);
+  gnupg_copy_time (item->this_update, this_update);
+  gnupg_copy_time (item->next_update, next_update);
+  if (result->revoked)
+    {
+      item->revoked = 1;
+      gnupg_copy_time (item->revoked_at, result->revoked_at);
+      item->reason = result->reason;
+    }
+  item->default_signer = !!default_signer;
+  item->next = *bucket;
+  *bucket = item;
+  ocspcache_generation++;
+}
+
+
+/* Remove all expired entries from the cache.  */
+static void
+ocsp_cache_expire (void)
+{
+  ocsp_cache_t item, prev, tmp;
+  ksba_isotime_t current_time;
+  int bidx;
+
+  gnupg_get_isotime (current_time);
+  for (bidx = 0; bidx < NO_OF_OCSPBUCKETS; bidx++)
+    for (prev = NULL, item = ocspbuckets[bidx]; item; )
+      {
+        if (cached_response_current_p (item, current_time))
+          {
+            prev = item;
+            item = item->next;
+            continue;
+          }
+        tmp = item->next;
+        if (prev)
+          prev->next = tmp;
+        else
+          ocspbuckets[bidx] = tmp;
+        xfree (item);
+        item = tmp;
+        ocspcache_generation++;
+      }
+}
+
+
+/* Insert a line from the OCSP cache file into the cache.  Returns
+   false for an invalid line.  This is only used at startup.  */
+static int
+load_line (char *line, const ksba_isotime_t current_time)
+{
+  const char *fields[8];
+  struct ocsp_result_s result;
+  unsigned long flags;
+
+  if (split_fields (line, fields, DIM (fields)) != DIM (fields))
+    return 0;
+  if (strlen (fields[1]) != 40 || strlen (fields[0]) < 42
+      || strlen (fields[0]) > 200
+      || check_isotime (fields[3]) || check_isotime (fields[4]))
+    return 0;
+  flags = strtoul (fields[2], NULL, 16);
+  if (strcmp (fields[4], current_time) <= 0)
+    return 1;  /* Skip expired entries.  */
+
+  memset (&result, 0, sizeof result);
+  if ((flags & 1))
+    {
+      if (check_isotime (fields[5]))
+        return 0;
+      result.revoked = 1;
+      gnupg_copy_time (result.revoked_at, fields[5]);
+      result.reason = strtoul (fields[6], NULL, 10);
+    }
+  if (strcmp (fields[7], "-"))
+    {
+      if (strlen (fields[7]) != 40)
+        return 0;
+      strcpy (result.signer_fpr, fields[7]);
+    }
+
+  ocsp_cache_put (fields[0], fields[1], fields[3], fields[4],
+                  !!(flags & 2), &result);
+  return 1;
+}
+
+
+/* Load the cache from the file written by ocsp_cache_save.  This is
+   called at startup before any other thread is running.  */
+void
+ocsp_cache_load (void)
+{
+  char *fname;
+  estream_t fp;
+  char line[512];
+  unsigned int lineno = 0;
+  ksba_isotime_t current_time;
+  int n;
+
+  fname = make_filename (opt.homedir_cache, OCSPCACHE_FILE, NULL);
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        log_info ("error opening '%s': %s\n",
+                  fname, gpg_strerror (gpg_error_from_syserror ()));
+      xfree (fname);
+      return;
+    }
+
+  gnupg_get_isotime (current_time);
+  while (es_fgets (line, DIM (line), fp))
+    {
+      lineno++;
+      n = strlen (line);
+      if (!n || line[n-1] != '\n')
+        {
+          log_info ("%s:%u: line too long - ignoring file\n", fname, lineno);
+          break;
+        }
+      line[--n] = 0;
+      if (lineno == 1)
+        {
+          if (strncmp (line, "# ocspcache v", 13)
+              || atoi (line+13) != OCSPCACHE_VERSION)
+            {
+              log_info ("%s: unknown version - ignoring file\n", fname);
+              break;
+            }
+          continue;
+        }
+      if (!*line || *line == '#')
+        continue;
+      if (!load_line (line, current_time))
+        log_info ("%s:%u: invalid line ignored\n", fname, lineno);
+    }
+  ocsp_cache_expire ();
+  ocspcache_saved_generation = ocspcache_generation;
+
+  if (opt.verbose)
+    log_info ("ocsp: loaded '%s'\n", fname);
+  es_fclose (fp);
+  xfree (fname);
+}
+
+
+/* Format the cache into a malloced buffer and store its length at
+   R_LEN.  Returns NULL on error or if another thread modified the
+   cache meanwhile.  */
+static char *
+format_cache (size_t *r_len)
+{
+  unsigned int generation = ocspcache_generation;
+  int bidx;
+  ocsp_cache_t item;
+  size_t size, len;
+  char *buffer;
+
+  /* Compute the required size; no syscalls are allowed here.  */
+  size = 50;
+  for (bidx = 0; bidx < NO_OF_OCSPBUCKETS; bidx++)
+    for (item = ocspbuckets[bidx]; item; item = item->next)
+      size += strlen (item->certid) + 1 + 40 + 1 + 2 + 3*(15+1)
+        + 10 + 1 + 40 + 1;
+
+  buffer = xtrymalloc (size);
+  if (!buffer || generation != ocspcache_generation)
+    {
+      xfree (buffer);
+      return NULL;
+    }
+
+  len = snprintf (buffer, size, "# ocspcache v%d\n", OCSPCACHE_VERSION);
+  for (bidx = 0; bidx < NO_OF_OCSPBUCKETS; bidx++)
+    for (item = ocspbuckets[bidx]; item; item = item->next)
+      len += snprintf (buffer + len, size - len, "%s %s %02x %s %s %s %u %s\n",
+                       item->certid, item->cert_fpr,
+                       ((item->revoked? 1:0)
+                        | (item->default_signer? 2:0)),
+                       item->this_update, item->next_update,
+                       item->revoked? item->revoked_at : "-",
+                       (unsigned int)item->reason,
+                       *item->signer_fpr? item->signer_fpr : "-");
+  *r_len = len;
+  return buffer;
+}
+
+
+/* Write the cache to a file in the cache directory so that a
+   restarted dirmngr does not need to ask the responders again.
+   Nothing is done if the cache has not been changed since the last
+   save.  */
+void
+ocsp_cache_save (void)
+{
+  gpg_error_t err = 0;
+  unsigned int generation;
+  char *buffer = NULL;
+  size_t len = 0;
+  char *fname = NULL;
+  char *tmpfname = NULL;
+  estream_t fp = NULL;
+  int tries;
+
+  generation = ocspcache_generation;
+  if (generation == ocspcache_saved_generation)
+    return;
+
+  for (tries = 0; tries < 3 && !buffer; tries++)
+    {
+      generation = ocspcache_generation;
+      buffer = format_cache (&len);
+    }
+  if (!buffer)
+    return;  /* Try again at the next housekeeping.  */
+
+  fname = make_filename (opt.homedir_cache, OCSPCACHE_FILE, NULL);
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fp = es_fopen (tmpfname, "w");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (es_fwrite (buffer, len, 1, fp) != 1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      fp = NULL;
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fp = NULL;
+  err = gnupg_rename_file (tmpfname, fname, NULL);
+  if (!err)
+    ocspcache_saved_generation = generation;
+
+ leave:
+  if (err)
+    log_info ("error writing '%s': %s\n",
+              tmpfname? tmpfname : OCSPCACHE_FILE, gpg_strerror (err));
+  if (fp)
+    {
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+    }
+  xfree (tmpfname);
+  xfree (fname);
+  xfree (buffer);
+}
+
+
 
 
 /* Read from FP and return a newly allocated buffer in R_BUFFER with the
@@ -528,11 +992,13 @@ check_signature_core (ctrl_t ctrl, ksba_cert_t cert, gcry_sexp_t s_sig,
    the response.  This function automagically finds the correct public
    key.  If SIGNER_FPR_LIST is not NULL, the default OCSP responder has been
    used and thus the certificate is one of those identified by
-   the fingerprints. */
+   the fingerprints.  Otherwise the fingerprint of the responder's
+   certificate is stored at R_SIGNER_FPR which must provide space for
+   41 bytes. */
 static gpg_error_t
 check_signature (ctrl_t ctrl,
                  ksba_ocsp_t ocsp, gcry_sexp_t s_sig, gcry_md_hd_t md,
-                 fingerprint_list_t signer_fpr_list)
+                 fingerprint_list_t signer_fpr_list, char *r_signer_fpr)
 {
   gpg_error_t err;
   int cert_idx;
@@ -620,6 +1086,13 @@ check_signature (ctrl_t ctrl,
       if (cert)
         {
           err = check_signature_core (ctrl, cert, s_sig, md, signer_fpr_list);
+          if (!err && !signer_fpr_list)
+            {
+              char *fpr = get_fingerprint_hexstring (cert);
+              if (fpr && strlen (fpr) < 41)
+                strcpy (r_signer_fpr, fpr);
+              xfree (fpr);
+            }
           ksba_cert_release (cert);
           if (!err)
             {
@@ -647,16 +1120,50 @@ check_signature (ctrl_t ctrl,
 }
 
 
-/* Check whether the certificate either given by fingerprint CERT_FPR
-   or directly through the CERT object is valid by running an OCSP
-   transaction.  With FORCE_DEFAULT_RESPONDER set only the configured
-   default responder is used.  If R_REVOKED_AT or R_REASON are not
-   NULL and the certificate has been revoked the revocation time and
-   the reasons are stored there. */
-gpg_error_t
-ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
-              int force_default_responder, ksba_isotime_t r_revoked_at,
-              const char **r_reason)
+/* Return a constant string describing the revocation REASON.  */
+static const char *
+reason_to_string (ksba_crl_reason_t reason)
+{
+  const char *sreason;
+
+  switch (reason)
+    {
+    case KSBA_CRLREASON_UNSPECIFIED:
+      sreason = "unspecified"; break;
+    case KSBA_CRLREASON_KEY_COMPROMISE:
+      sreason = "key compromise"; break;
+    case KSBA_CRLREASON_CA_COMPROMISE:
+      sreason = "CA compromise"; break;
+    case KSBA_CRLREASON_AFFILIATION_CHANGED:
+      sreason = "affiliation changed"; break;
+    case KSBA_CRLREASON_SUPERSEDED:
+      sreason = "superseded"; break;
+    case KSBA_CRLREASON_CESSATION_OF_OPERATION:
+      sreason = "cessation of operation"; break;
+    case KSBA_CRLREASON_CERTIFICATE_HOLD:
+      sreason = "certificate on hold"; break;
+    case KSBA_CRLREASON_REMOVE_FROM_CRL:
+      sreason = "removed from CRL"; break;
+    case KSBA_CRLREASON_PRIVILEGE_WITHDRAWN:
+      sreason = "privilege withdrawn"; break;
+    case KSBA_CRLREASON_AA_COMPROMISE:
+      sreason = "AA compromise"; break;
+    case KSBA_CRLREASON_OTHER:
+      sreason = "other"; break;
+    default: sreason = "?"; break;
+    }
+
+  return sreason;
+}
+
+
+/* Worker for ocsp_isvalid.  The outcome is stored at R_RESULT.  A
+   current response from the cache is used unless BYPASS_CACHE is
+   set.  */
+static gpg_error_t
+do_ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
+                 int force_default_responder, int bypass_cache,
+                 ocsp_result_t r_result)
 {
   gpg_error_t err;
   ksba_ocsp_t ocsp = NULL;
@@ -676,11 +1183,10 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   ksba_name_t name;
   fingerprint_list_t default_signer = NULL;
   const char *sreason;
+  char *certid = NULL;
+  char *target_fpr = NULL;
 
-  if (r_revoked_at)
-    *r_revoked_at = 0;
-  if (r_reason)
-    *r_reason = NULL;
+  memset (r_result, 0, sizeof *r_result);
 
   /* Get the certificate.  */
   if (cert)
@@ -713,6 +1219,26 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
         }
     }
 
+  /* Check whether we already have a current response.  The responder
+     and its certificate have been verified when it was stored.  */
+  certid = make_certid (cert, issuer_cert);
+  if (!certid)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (!bypass_cache
+      && ocsp_cache_get (certid, force_default_responder, r_result))
+    {
+      if (opt.verbose)
+        log_info ("using cached OCSP response\n");
+      if (*r_result->signer_fpr)
+        dirmngr_status (ctrl, "ONLY_VALID_IF_CERT_VALID",
+                        r_result->signer_fpr, NULL);
+      err = r_result->revoked? gpg_error (GPG_ERR_CERT_REVOKED) : 0;
+      goto leave;
+    }
+
   /* Create an OCSP instance.  */
   err = ksba_ocsp_new (&ocsp);
   if (err)
@@ -820,7 +1346,8 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
     goto leave;
   xfree (sigval);
   sigval = NULL;
-  err = check_signature (ctrl, ocsp, s_sig, md, default_signer);
+  err = check_signature (ctrl, ocsp, s_sig, md, default_signer,
+                         r_result->signer_fpr);
   if (err)
     goto leave;
 
@@ -852,32 +1379,7 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
                       cache. */
         }
 
-      switch (reason)
-        {
-        case KSBA_CRLREASON_UNSPECIFIED:
-          sreason = "unspecified"; break;
-        case KSBA_CRLREASON_KEY_COMPROMISE:
-          sreason = "key compromise"; break;
-        case KSBA_CRLREASON_CA_COMPROMISE:
-          sreason = "CA compromise"; break;
-        case KSBA_CRLREASON_AFFILIATION_CHANGED:
-          sreason = "affiliation changed"; break;
-        case KSBA_CRLREASON_SUPERSEDED:
-          sreason = "superseded"; break;
-        case KSBA_CRLREASON_CESSATION_OF_OPERATION:
-          sreason = "cessation of operation"; break;
-        case KSBA_CRLREASON_CERTIFICATE_HOLD:
-          sreason = "certificate on hold"; break;
-        case KSBA_CRLREASON_REMOVE_FROM_CRL:
-          sreason = "removed from CRL"; break;
-        case KSBA_CRLREASON_PRIVILEGE_WITHDRAWN:
-          sreason = "privilege withdrawn"; break;
-        case KSBA_CRLREASON_AA_COMPROMISE:
-          sreason = "AA compromise"; break;
-        case KSBA_CRLREASON_OTHER:
-          sreason = "other"; break;
-        default: sreason = "?"; break;
-        }
+      sreason = reason_to_string (reason);
     }
   else
     sreason = "";
@@ -900,10 +1402,9 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   if (status == KSBA_STATUS_REVOKED)
     {
       err = gpg_error (GPG_ERR_CERT_REVOKED);
-      if (r_revoked_at)
-        gnupg_copy_time (r_revoked_at, revocation_time);
-      if (r_reason)
-        *r_reason = sreason;
+      r_result->revoked = 1;
+      gnupg_copy_time (r_result->revoked_at, revocation_time);
+      r_result->reason = reason;
     }
   else if (status == KSBA_STATUS_UNKNOWN)
     err = gpg_error (GPG_ERR_NO_DATA);
@@ -951,8 +1452,18 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
         }
     }
 
+  /* Remember a good or revoked status until NEXT_UPDATE.  */
+  if (!err || gpg_err_code (err) == GPG_ERR_CERT_REVOKED)
+    {
+      target_fpr = get_fingerprint_hexstring (cert);
+      if (target_fpr)
+        ocsp_cache_put (certid, target_fpr, this_update, next_update,
+                        !!default_signer, r_result);
+    }
 
  leave:
+  xfree (target_fpr);
+  xfree (certid);
   gcry_md_close (md);
   gcry_sexp_release (s_sig);
   xfree (sigval);
@@ -964,6 +1475,192 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
 }
 
 
+/* Check whether the certificate either given by fingerprint CERT_FPR
+   or directly through the CERT object is valid by running an OCSP
+   transaction.  With FORCE_DEFAULT_RESPONDER set only the configured
+   default responder is used.  If R_REVOKED_AT or R_REASON are not
+   NULL and the certificate has been revoked the revocation time and
+   the reasons are stored there.  If R_SIGNER_FPR is not NULL the
+   hexified fingerprint of the responder certificate announced with
+   ONLY_VALID_IF_CERT_VALID is stored at this 41 byte buffer; it is
+   set to the empty string if there is none.  Concurrent checks of
+   the same certificate share one OCSP transaction. */
+gpg_error_t
+ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
+              int force_default_responder, ksba_isotime_t r_revoked_at,
+              const char **r_reason, char *r_signer_fpr)
+{
+  gpg_error_t err;
+  struct ocsp_result_s result;
+  char *fpr, *key, *value;
+  const char *fields[4];
+  char valuebuf[100];
+
+  if (r_revoked_at)
+    *r_revoked_at = 0;
+  if (r_reason)
+    *r_reason = NULL;
+  if (r_signer_fpr)
+    *r_signer_fpr = 0;
+
+  /* A certificate given by fingerprint is only known after an inquiry
+     to our client; thus we can't coalesce those requests.  */
+  if (!cert)
+    {
+      err = do_ocsp_isvalid (ctrl, NULL, cert_fpr, force_default_responder,
+                             0, &result);
+      goto leave;
+    }
+
+  fpr = get_fingerprint_hexstring (cert);
+  if (!fpr)
+    return gpg_error_from_syserror ();
+  key = strconcat ("ocsp:", fpr, force_default_responder? ":default":"",
+                   NULL);
+  xfree (fpr);
+  if (!key)
+    return gpg_error_from_syserror ();
+
+  if (singleflight_enter (key, &err, &value))
+    {
+      err = do_ocsp_isvalid (ctrl, cert, NULL, force_default_responder,
+                             0, &result);
+      snprintf (valuebuf, sizeof valuebuf, "%d %s %s %u",
+                result.revoked,
+                *result.signer_fpr? result.signer_fpr : "-",
+                *result.revoked_at? result.revoked_at : "-",
+                (unsigned int)result.reason);
+      singleflight_leave (key, err, valuebuf);
+    }
+  else
+    {
+      if (opt.verbose)
+        log_info ("OCSP status has been retrieved by another request\n");
+      memset (&result, 0, sizeof result);
+      if (value && split_fields (value, fields, DIM (fields)) == DIM (fields))
+        {
+          result.revoked = atoi (fields[0]);
+          if (strlen (fields[1]) < sizeof result.signer_fpr
+              && strcmp (fields[1], "-"))
+            strcpy (result.signer_fpr, fields[1]);
+          if (!check_isotime (fields[2]))
+            gnupg_copy_time (result.revoked_at, fields[2]);
+          result.reason = strtoul (fields[3], NULL, 10);
+        }
+      else if (!err)
+        err = gpg_error (GPG_ERR_GENERAL);
+      else if (gpg_err_code (err) == GPG_ERR_CERT_REVOKED)
+        result.revoked = 1;
+      xfree (value);
+
+      /* The leader already told its client; tell ours too.  */
+      if ((!err || gpg_err_code (err) == GPG_ERR_CERT_REVOKED)
+          && *result.signer_fpr)
+        dirmngr_status (ctrl, "ONLY_VALID_IF_CERT_VALID",
+                        result.signer_fpr, NULL);
+    }
+  xfree (key);
+
+ leave:
+  if (gpg_err_code (err) == GPG_ERR_CERT_REVOKED)
+    {
+      if (r_revoked_at)
+        gnupg_copy_time (r_revoked_at, result.revoked_at);
+      if (r_reason)
+        *r_reason = result.revoked? reason_to_string (result.reason) : "?";
+    }
+  if (r_signer_fpr && (!err || gpg_err_code (err) == GPG_ERR_CERT_REVOKED))
+    strcpy (r_signer_fpr, result.signer_fpr);
+  return err;
+}
+
+
+/* Store at R_THRESHOLD the time based on CURRENT_TIME up to which a
+   nextUpdate of ITEM makes it due for a background refresh.  */
+static void
+refresh_threshold (ocsp_cache_t item, const ksba_isotime_t current_time,
+                   ksba_isotime_t r_threshold)
+{
+  gnupg_copy_time (r_threshold, current_time);
+  add_seconds_to_isotime (r_threshold,
+                          (OCSP_REFRESH_AHEAD
+                           - (int)(hash_certid (item->certid)
+                                   % OCSP_REFRESH_JITTER)));
+}
+
+
+/* A workqueue task to fetch a new OCSP response for the cached
+   response CERTID.  */
+static const char *
+task_refresh_ocsp (ctrl_t ctrl, const char *certid)
+{
+  ocsp_cache_t item;
+  ksba_isotime_t current_time, threshold;
+  struct ocsp_result_s result;
+  ksba_cert_t cert;
+  int default_signer;
+
+  if (!ctrl || !certid)
+    return "refresh_ocsp";
+
+  for (item = ocspbuckets[hash_certid (certid) % NO_OF_OCSPBUCKETS];
+       item; item = item->next)
+    if (!strcmp (item->certid, certid))
+      break;
+  if (!item)
+    return NULL;  /* Meanwhile expired.  */
+  item->refresh_scheduled = 0;
+
+  gnupg_get_isotime (current_time);
+  refresh_threshold (item, current_time, threshold);
+  if (strcmp (item->next_update, threshold) > 0)
+    return NULL;  /* Meanwhile updated.  */
+
+  default_signer = item->default_signer;
+  cert = get_cert_byhexfpr (item->cert_fpr);
+  if (!cert)
+    return NULL;  /* No more in the certificate cache.  */
+
+  if (opt.verbose)
+    log_info ("refreshing OCSP response for %s\n", certid);
+  do_ocsp_isvalid (ctrl, cert, NULL, default_signer, 1, &result);
+  ksba_cert_release (cert);
+  return NULL;
+}
+
+
+/* Expire old responses from the OCSP cache, schedule the refresh of
+   frequently used responses and write the cache to disk.  This is
+   called by the housekeeping thread.  */
+void
+ocsp_cache_housekeeping (void)
+{
+  ocsp_cache_t item;
+  ksba_isotime_t current_time, threshold;
+  int bidx, count = 0;
+
+  ocsp_cache_expire ();
+
+  gnupg_get_isotime (current_time);
+  for (bidx = 0; bidx < NO_OF_OCSPBUCKETS; bidx++)
+    for (item = ocspbuckets[bidx]; item; item = item->next)
+      {
+        if (item->refresh_scheduled || item->hits < OCSP_REFRESH_MIN_HITS
+            || count >= OCSP_REFRESH_MAX_PER_RUN)
+          continue;
+        refresh_threshold (item, current_time, threshold);
+        if (strcmp (item->next_update, threshold) > 0)
+          continue;  /* Not yet due.  */
+        if (workqueue_add_task (task_refresh_ocsp, item->certid, 0, 1))
+          continue;
+        item->refresh_scheduled = 1;
+        count++;
+      }
+
+  ocsp_cache_save ();
+}
+
+
 /* Release the list of OCSP certificates hold in the CTRL object. */
 void
 release_ctrl_ocsp_certs (ctrl_t ctrl)
@@ -25,9 +25,13 @@
 gpg_error_t ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
                           int force_default_responder,
                           gnupg_isotime_t r_revoked_at,
-                          const char **r_reason);
+                          const char **r_reason, char *r_signer_fpr);
 
 /* Release the list of OCSP certificates hold in the CTRL object. */
 void release_ctrl_ocsp_certs (ctrl_t ctrl);
 
+void ocsp_cache_load (void);
+void ocsp_cache_save (void);
+void ocsp_cache_housekeeping (void);
+
 #endif /*OCSP_H*/
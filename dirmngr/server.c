@@ -42,6 +42,7 @@
 
 #include "dirmngr.h"
 #include <assuan.h>
+#include <npth.h>
 
 #include "crlcache.h"
 #include "crlfetch.h"
@@ -74,6 +75,19 @@
  * certificates but also take PEM encoding into account.  */
 #define MAX_CERTLIST_LENGTH ((MAX_CERT_LENGTH * 20 * 4)/3)
 
+/* The maximum number of certificates for ISVALID --multi and the
+ * maximum number of those checks run in parallel.  */
+#define MAX_ISVALID_MULTI      16
+#define MAX_CONCURRENT_ISVALID  8
+
+/* The maximum number of mechanisms of a LOCATE command.  */
+#define MAX_LOCATE_JOBS  4
+
+/* The number of slots of the cache used by VALIDCACHE and the
+ * maximum time in seconds an entry is kept.  */
+#define VALIDCACHE_SLOTS    256
+#define VALIDCACHE_MAX_TTL 3600
+
 /* The same goes for OpenPGP keyblocks, but here we need to allow for
    much longer blocks; a 200k keyblock is not too unusual for keys
    with a lot of signatures (e.g. 0x5b0358a2).  9C31503C6D866396 even
@@ -136,6 +150,19 @@ static es_cookie_io_functions_t data_line_cookie_functions =
   };
 
 
+/* An entry of the cache used by VALIDCACHE.  */
+struct validcache_s
+{
+  char key[82];
+  gnupg_isotime_t expires;
+  char value[50];
+};
+
+/* The cache used by VALIDCACHE.  A new entry simply replaces the one
+ * in its slot.  */
+static struct validcache_s validcache[VALIDCACHE_SLOTS];
+
+
 /* Local prototypes */
 static const char *task_check_wkd_support (ctrl_t ctrl, const char *domain);
 
@@ -657,6 +684,49 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Store the name of the DANE OPENPGPKEY record for the mailbox of
+ * USERID at R_NAME.  */
+static gpg_error_t
+make_dane_name (const char *userid, char **r_name)
+{
+  gpg_error_t err = 0;
+  char *mbox, *domain;
+  char *encodedhash = NULL;
+  char hashbuf[32];
+
+  *r_name = NULL;
+
+  /* We lowercase ascii characters but the DANE I-D does not allow
+     this.  FIXME: Check after the release of the RFC whether to
+     change this.  */
+  mbox = mailbox_from_userid (userid, 0);
+  if (!mbox || !(domain = strchr (mbox, '@')))
+    {
+      xfree (mbox);
+      return gpg_error (GPG_ERR_INV_USER_ID);
+    }
+  *domain++ = 0;
+
+  /* Note: The hash is truncated to 28 bytes and we lowercase the
+     result only for aesthetic reasons.  */
+  gcry_md_hash_buffer (GCRY_MD_SHA256, hashbuf, mbox, strlen (mbox));
+  encodedhash = bin2hex (hashbuf, 28, NULL);
+  if (!encodedhash)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      ascii_strlwr (encodedhash);
+      *r_name = strconcat (encodedhash, "._openpgpkey.", domain, NULL);
+      if (!*r_name)
+        err = gpg_error_from_syserror ();
+    }
+
+  xfree (encodedhash);
+  xfree (mbox);
+  return err;
+}
+
+
 static const char hlp_dns_cert[] =
   "DNS_CERT <subtype> <name>\n"
   "DNS_CERT --pka <user_id>\n"
@@ -730,14 +800,21 @@ cmd_dns_cert (assuan_context_t ctx, char *line)
         }
     }
 
-  if (pka_mode || dane_mode)
+  if (dane_mode)
+    {
+      err = make_dane_name (line, &namebuf);
+      if (gpg_err_code (err) == GPG_ERR_INV_USER_ID)
+        err = set_error (GPG_ERR_INV_USER_ID, "no mailbox in user id");
+      if (err)
+        goto leave;
+      name = namebuf;
+      certtype = DNS_CERTTYPE_RR61;
+    }
+  else if (pka_mode)
     {
       char *domain;     /* Points to mbox.  */
-      char hashbuf[32]; /* For SHA-1 and SHA-256. */
+      char hashbuf[20]; /* For SHA-1.  */
 
-      /* We lowercase ascii characters but the DANE I-D does not allow
-         this.  FIXME: Check after the release of the RFC whether to
-         change this.  */
       mbox = mailbox_from_userid (line, 0);
       if (!mbox || !(domain = strchr (mbox, '@')))
         {
@@ -746,45 +823,21 @@ cmd_dns_cert (assuan_context_t ctx, char *line)
         }
       *domain++ = 0;
 
-      if (pka_mode)
+      gcry_md_hash_buffer (GCRY_MD_SHA1, hashbuf, mbox, strlen (mbox));
+      encodedhash = zb32_encode (hashbuf, 8*20);
+      if (!encodedhash)
         {
-          gcry_md_hash_buffer (GCRY_MD_SHA1, hashbuf, mbox, strlen (mbox));
-          encodedhash = zb32_encode (hashbuf, 8*20);
-          if (!encodedhash)
-            {
-              err = gpg_error_from_syserror ();
-              goto leave;
-            }
-          namebuf = strconcat (encodedhash, "._pka.", domain, NULL);
-          if (!namebuf)
-            {
-              err = gpg_error_from_syserror ();
-              goto leave;
-            }
-          name = namebuf;
-          certtype = DNS_CERTTYPE_IPGP;
+          err = gpg_error_from_syserror ();
+          goto leave;
         }
-      else
+      namebuf = strconcat (encodedhash, "._pka.", domain, NULL);
+      if (!namebuf)
         {
-          /* Note: The hash is truncated to 28 bytes and we lowercase
-             the result only for aesthetic reasons.  */
-          gcry_md_hash_buffer (GCRY_MD_SHA256, hashbuf, mbox, strlen (mbox));
-          encodedhash = bin2hex (hashbuf, 28, NULL);
-          if (!encodedhash)
-            {
-              err = gpg_error_from_syserror ();
-              goto leave;
-            }
-          ascii_strlwr (encodedhash);
-          namebuf = strconcat (encodedhash, "._openpgpkey.", domain, NULL);
-          if (!namebuf)
-            {
-              err = gpg_error_from_syserror ();
-              goto leave;
-            }
-          name = namebuf;
-          certtype = DNS_CERTTYPE_RR61;
+          err = gpg_error_from_syserror ();
+          goto leave;
         }
+      name = namebuf;
+      certtype = DNS_CERTTYPE_IPGP;
     }
   else
     name = line;
@@ -836,10 +889,14 @@ cmd_dns_cert (assuan_context_t ctx, char *line)
 
 
 
-/* Core of cmd_wkd_get and task_check_wkd_support.  If CTX is NULL
- * this function will not write anything to the assuan output.  */
+/* Core of cmd_wkd_get, task_check_wkd_support and the LOCATE
+ * command.  If CTX is NULL this function will not write anything to
+ * the assuan output; the data is then written to OUTFP if that is
+ * not NULL.  If R_SOURCE is not NULL the source of a WKD query is
+ * stored there as a malloced string.  */
 static gpg_error_t
-proc_wkd_get (ctrl_t ctrl, assuan_context_t ctx, char *line)
+proc_wkd_get (ctrl_t ctrl, assuan_context_t ctx, estream_t outfp_arg,
+              char *line, char **r_source)
 {
   gpg_error_t err = 0;
   char *mbox = NULL;
@@ -1041,6 +1098,15 @@ proc_wkd_get (ctrl_t ctrl, assuan_context_t ctx, char *line)
                                            domain, portstr);
               if (err)
                 goto leave;
+              if (r_source)
+                {
+                  *r_source = strconcat ("https://", domain, portstr, NULL);
+                  if (!*r_source)
+                    {
+                      err = gpg_error_from_syserror ();
+                      goto leave;
+                    }
+                }
             }
         }
     }
@@ -1054,7 +1120,10 @@ proc_wkd_get (ctrl_t ctrl, assuan_context_t ctx, char *line)
   {
     estream_t outfp;
 
-    outfp = ctx? es_fopencookie (ctx, "w", data_line_cookie_functions) : NULL;
+    if (ctx)
+      outfp = es_fopencookie (ctx, "w", data_line_cookie_functions);
+    else
+      outfp = outfp_arg;
     if (!outfp && ctx)
       err = set_error (GPG_ERR_ASS_GENERAL,
                        "error setting up a data stream");
@@ -1068,7 +1137,8 @@ proc_wkd_get (ctrl_t ctrl, assuan_context_t ctx, char *line)
             ctrl->server_local->inhibit_data_logging_count = 0;
           }
         err = ks_action_fetch (ctrl, uri, outfp);
-        es_fclose (outfp);
+        if (ctx)
+          es_fclose (outfp);
         if (ctrl->server_local)
           ctrl->server_local->inhibit_data_logging = 0;
 
@@ -1123,7 +1193,7 @@ cmd_wkd_get (assuan_context_t ctx, char *line)
   ctrl_t ctrl = assuan_get_pointer (ctx);
   gpg_error_t err;
 
-  err = proc_wkd_get (ctrl, ctx, line);
+  err = proc_wkd_get (ctrl, ctx, NULL, line, NULL);
 
   return leave_cmd (ctx, err);
 }
@@ -1144,7 +1214,7 @@ task_check_wkd_support (ctrl_t ctrl, const char *domain)
     log_error ("%s: %s\n", __func__, gpg_strerror (gpg_error_from_syserror ()));
   else
     {
-      proc_wkd_get (ctrl, NULL, string);
+      proc_wkd_get (ctrl, NULL, NULL, string, NULL);
       xfree (string);
     }
 
@@ -1152,6 +1222,323 @@ task_check_wkd_support (ctrl_t ctrl, const char *domain)
 }
 
 
+/* A job of the LOCATE command.  */
+struct locate_job_s
+{
+  struct locate_s *loc;    /* The shared state.  */
+  const char *mechanism;   /* "wkd" or "dane".  */
+  int done;                /* The job has finished.  */
+  gpg_error_t err;         /* The result of the job.  */
+  estream_t data;          /* The key if ERR is 0.  */
+  char *source;            /* NULL or the malloced source of the key.  */
+};
+
+/* The state shared by the LOCATE command and its workers.  The
+ * command does not wait for the workers which are not anymore
+ * required; thus the object is reference counted and released by the
+ * last user.  */
+struct locate_s
+{
+  npth_mutex_t mutex;
+  npth_cond_t cond;
+  unsigned int refcount;   /* The command and the running workers.  */
+  char *mbox;              /* The mailbox to locate.  */
+  int timeout;             /* Copied from the command's ctrl.  */
+  char *http_proxy;        /* Ditto.  */
+  int njobs;
+  struct locate_job_s jobs[MAX_LOCATE_JOBS];
+};
+
+
+/* Drop a reference to LOC.  Must be called with LOC->MUTEX locked;
+ * it is unlocked on return.  */
+static void
+locate_unref (struct locate_s *loc)
+{
+  int i, last;
+
+  last = !--loc->refcount;
+  npth_mutex_unlock (&loc->mutex);
+  if (!last)
+    return;
+
+  for (i=0; i < loc->njobs; i++)
+    {
+      es_fclose (loc->jobs[i].data);
+      xfree (loc->jobs[i].source);
+    }
+  npth_cond_destroy (&loc->cond);
+  npth_mutex_destroy (&loc->mutex);
+  xfree (loc->http_proxy);
+  xfree (loc->mbox);
+  xfree (loc);
+}
+
+
+/* Run the WKD mechanism of a LOCATE job.  */
+static gpg_error_t
+locate_wkd (ctrl_t ctrl, const char *mbox, estream_t fp, char **r_source)
+{
+  gpg_error_t err;
+  char *line;
+
+  line = xtrystrdup (mbox);
+  if (!line)
+    return gpg_error_from_syserror ();
+  err = proc_wkd_get (ctrl, NULL, fp, line, r_source);
+  xfree (line);
+  return err;
+}
+
+
+/* Run the DANE mechanism of a LOCATE job.  */
+static gpg_error_t
+locate_dane (ctrl_t ctrl, const char *mbox, estream_t fp)
+{
+  gpg_error_t err;
+  char *name;
+  void *key = NULL;
+  size_t keylen;
+  unsigned char *fpr = NULL;
+  size_t fprlen;
+  char *url = NULL;
+
+  err = make_dane_name (mbox, &name);
+  if (err)
+    return err;
+  err = get_dns_cert (ctrl, name, DNS_CERTTYPE_RR61,
+                      &key, &keylen, &fpr, &fprlen, &url);
+  if (!err && !key)
+    err = gpg_error (GPG_ERR_NO_DATA);
+  if (!err && es_write (fp, key, keylen, NULL))
+    err = gpg_error_from_syserror ();
+
+  xfree (key);
+  xfree (fpr);
+  xfree (url);
+  xfree (name);
+  return err;
+}
+
+
+/* Thread to run one job of the LOCATE command given by ARG.  */
+static void *
+locate_worker (void *arg)
+{
+  struct locate_job_s *job = arg;
+  struct locate_s *loc = job->loc;
+  gpg_error_t err;
+  ctrl_t ctrl;
+  estream_t fp = NULL;
+  char *source = NULL;
+
+  /* We use our own control object so that nothing is sent to the
+   * client; the caller's thread does this.  */
+  ctrl = xtrycalloc (1, sizeof *ctrl);
+  if (!ctrl)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      dirmngr_init_default_ctrl (ctrl);
+      ctrl->timeout = loc->timeout;
+      xfree (ctrl->http_proxy);
+      ctrl->http_proxy = loc->http_proxy? xtrystrdup (loc->http_proxy) : NULL;
+
+      fp = es_fopenmem (MAX_KEYBLOCK_LENGTH, "w+b");
+      if (!fp)
+        err = gpg_error_from_syserror ();
+      else if (!strcmp (job->mechanism, "wkd"))
+        err = locate_wkd (ctrl, loc->mbox, fp, &source);
+      else
+        err = locate_dane (ctrl, loc->mbox, fp);
+
+      dirmngr_deinit_default_ctrl (ctrl);
+      xfree (ctrl);
+    }
+  if (err)
+    {
+      es_fclose (fp);
+      fp = NULL;
+      xfree (source);
+      source = NULL;
+    }
+  if (opt.verbose)
+    log_info ("locate: %s finished: %s\n", job->mechanism, gpg_strerror (err));
+
+  npth_mutex_lock (&loc->mutex);
+  job->err = err;
+  job->data = fp;
+  job->source = source;
+  job->done = 1;
+  npth_cond_broadcast (&loc->cond);
+  locate_unref (loc);
+  return NULL;
+}
+
+
+static const char hlp_locate[] =
+  "LOCATE <mechanisms> <user_id>\n"
+  "\n"
+  "Locate the key for the mailbox of <user_id>.  <mechanisms> is a\n"
+  "comma delimited list of the mechanisms \"wkd\" and \"dane\" in the\n"
+  "order of their priority.  All mechanisms are started at once.  The\n"
+  "key found by the first mechanism of the list which succeeds is\n"
+  "returned by data lines, the mechanism by the status line LOCATE,\n"
+  "and the source, if known, by the status line SOURCE.  The results\n"
+  "of the other mechanisms are not waited for and are discarded.";
+static gpg_error_t
+cmd_locate (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err = 0;
+  struct locate_s *loc;
+  struct locate_job_s *job = NULL;
+  npth_attr_t tattr;
+  npth_t thread;
+  char *mechs, *p;
+  char *buffer = NULL;
+  size_t buflen;
+  estream_t fp = NULL;
+  char *source = NULL;
+  const char *mechanism = NULL;
+  int i, rc;
+
+  line = skip_options (line);
+  mechs = line;
+  for (p = line; *p && !spacep (p); p++)
+    ;
+  if (*p)
+    *p++ = 0;
+  while (spacep (p))
+    p++;
+  if (!*mechs || !*p)
+    return leave_cmd (ctx, PARM_ERROR ("missing arguments"));
+
+  loc = xtrycalloc (1, sizeof *loc);
+  if (!loc)
+    return leave_cmd (ctx, gpg_error_from_syserror ());
+  rc = npth_mutex_init (&loc->mutex, NULL);
+  if (rc)
+    {
+      xfree (loc);
+      return leave_cmd (ctx, gpg_error_from_errno (rc));
+    }
+  rc = npth_cond_init (&loc->cond, NULL);
+  if (rc)
+    {
+      npth_mutex_destroy (&loc->mutex);
+      xfree (loc);
+      return leave_cmd (ctx, gpg_error_from_errno (rc));
+    }
+  loc->refcount = 1;
+  npth_mutex_lock (&loc->mutex);
+
+  loc->mbox = mailbox_from_userid (p, 0);
+  if (!loc->mbox)
+    {
+      err = set_error (GPG_ERR_INV_USER_ID, "no mailbox in user id");
+      goto leave;
+    }
+  loc->timeout = ctrl->timeout;
+  if (ctrl->http_proxy)
+    {
+      loc->http_proxy = xtrystrdup (ctrl->http_proxy);
+      if (!loc->http_proxy)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  while ((p = strsep (&mechs, ",")))
+    {
+      if (strcmp (p, "wkd") && strcmp (p, "dane"))
+        {
+          err = PARM_ERROR ("unknown mechanism");
+          goto leave;
+        }
+      for (i=0; i < loc->njobs; i++)
+        if (!strcmp (loc->jobs[i].mechanism, p))
+          break;
+      if (i < loc->njobs)
+        continue;  /* Ignore duplicates.  */
+      if (loc->njobs == MAX_LOCATE_JOBS)
+        {
+          err = PARM_ERROR ("too many mechanisms");
+          goto leave;
+        }
+      job = loc->jobs + loc->njobs++;
+      job->loc = loc;
+      job->mechanism = !strcmp (p, "wkd")? "wkd" : "dane";
+    }
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      goto leave;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  for (i=0; i < loc->njobs; i++)
+    {
+      job = loc->jobs + i;
+      rc = npth_create (&thread, &tattr, locate_worker, job);
+      if (rc)
+        {
+          log_error ("error spawning locate worker: %s\n", strerror (rc));
+          job->err = gpg_error_from_errno (rc);
+          job->done = 1;
+        }
+      else
+        loc->refcount++;
+    }
+  npth_attr_destroy (&tattr);
+
+  /* Take the first successful job in the order of priority.  */
+  job = NULL;
+  for (i=0; i < loc->njobs; i++)
+    {
+      while (!loc->jobs[i].done)
+        npth_cond_wait (&loc->cond, &loc->mutex);
+      if (!loc->jobs[i].err)
+        {
+          job = loc->jobs + i;
+          break;
+        }
+    }
+  if (!job)
+    {
+      err = gpg_error (GPG_ERR_NO_DATA);
+      goto leave;
+    }
+  fp = job->data;
+  job->data = NULL;
+  source = job->source;
+  job->source = NULL;
+  mechanism = job->mechanism;
+
+ leave:
+  locate_unref (loc);
+
+  if (!err && mechanism)
+    err = dirmngr_status (ctrl, "LOCATE", mechanism, NULL);
+  if (!err && source)
+    err = dirmngr_status (ctrl, "SOURCE", source, NULL);
+  if (!err && fp)
+    {
+      if (es_fclose_snatch (fp, (void **)&buffer, &buflen))
+        err = gpg_error_from_syserror ();
+      else if (buflen)
+        err = data_line_write (ctx, buffer, buflen);
+      fp = NULL;
+    }
+  es_fclose (fp);
+  xfree (buffer);
+  xfree (source);
+  return leave_cmd (ctx, err);
+}
+
+
 
 static const char hlp_ldapserver[] =
   "LDAPSERVER [--clear] <data>\n"
@@ -1240,9 +1627,284 @@ cmd_ldapserver (assuan_context_t ctx, char *line)
 }
 
 
+/* One certificate of an ISVALID --multi command.  */
+struct isvalid_item_s
+{
+  ksba_cert_t cert;
+  char fpr[41];             /* Hexified fingerprint of CERT.  */
+  gpg_error_t err;
+  gnupg_isotime_t revoked_at;
+  const char *reason;
+  char signer_fpr[41];      /* See ocsp_isvalid.  */
+};
+
+
+/* The state shared by the workers of an ISVALID --multi command.  */
+struct isvalid_multi_s
+{
+  ctrl_t ctrl;              /* The control object of the command.  */
+  struct isvalid_item_s *items;
+  int nitems;
+  int next_item;            /* Index of the next item to check.  */
+  int ocsp_mode;
+  int only_ocsp;
+  int force_default_responder;
+  int nworkers;
+  npth_mutex_t mutex;
+  npth_cond_t cond;
+};
+
+
+/* Check whether the certificate of ITEM is valid and store the
+ * result in ITEM.  This does the same as cmd_isvalid but starts off
+ * with the certificate and thus CTRL may also be a control object
+ * without a client connection.  */
+static void
+isvalid_check_item (ctrl_t ctrl, struct isvalid_item_s *item,
+                    int ocsp_mode, int only_ocsp, int force_default_responder)
+{
+  gpg_error_t err;
+  int did_reload = 0;
+
+  item->revoked_at[0] = 0;
+  item->reason = NULL;
+  *item->signer_fpr = 0;
+
+ again:
+  if (ocsp_mode)
+    {
+      if (!opt.allow_ocsp)
+        err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      else
+        err = ocsp_isvalid (ctrl, item->cert, NULL, force_default_responder,
+                            item->revoked_at, &item->reason,
+                            item->signer_fpr);
+
+      if (gpg_err_code (err) == GPG_ERR_CONFIGURATION
+          && gpg_err_source (err) == GPG_ERR_SOURCE_DIRMNGR)
+        {
+          /* No default responder configured - fallback to CRL.  */
+          if (!only_ocsp)
+            log_info ("falling back to CRL check\n");
+          ocsp_mode = 0;
+          goto again;
+        }
+    }
+  else if (only_ocsp)
+    err = gpg_error (GPG_ERR_NO_CRL_KNOWN);
+  else
+    {
+      err = crl_cache_cert_isvalid (ctrl, item->cert, ctrl->force_crl_refresh);
+      if (gpg_err_code (err) == GPG_ERR_NO_CRL_KNOWN && !did_reload)
+        {
+          did_reload = 1;
+          err = crl_cache_reload_crl (ctrl, item->cert);
+          if (!err)
+            goto again;
+        }
+    }
+
+  item->err = err;
+}
+
+
+/* Thread to run the checks of an ISVALID --multi command.  The
+ * thread takes items from the shared state ARG until all items are
+ * done.  */
+static void *
+isvalid_multi_worker (void *arg)
+{
+  struct isvalid_multi_s *im = arg;
+  ctrl_t ctrl;
+  struct isvalid_item_s *item;
+
+  /* We use our own control object so that nothing is inquired or
+   * sent to the client; the caller's thread does this.  */
+  ctrl = xtrycalloc (1, sizeof *ctrl);
+  if (ctrl)
+    {
+      dirmngr_init_default_ctrl (ctrl);
+      ctrl->force_crl_refresh = im->ctrl->force_crl_refresh;
+      ctrl->timeout = im->ctrl->timeout;
+      ctrl->http_no_crl = im->ctrl->http_no_crl;
+      xfree (ctrl->http_proxy);
+      ctrl->http_proxy = (im->ctrl->http_proxy
+                          ? xtrystrdup (im->ctrl->http_proxy) : NULL);
+    }
+
+  npth_mutex_lock (&im->mutex);
+  while (ctrl && im->next_item < im->nitems)
+    {
+      item = im->items + im->next_item++;
+      npth_mutex_unlock (&im->mutex);
+
+      isvalid_check_item (ctrl, item, im->ocsp_mode, im->only_ocsp,
+                          im->force_default_responder);
+
+      npth_mutex_lock (&im->mutex);
+    }
+  im->nworkers--;
+  npth_cond_broadcast (&im->cond);
+  npth_mutex_unlock (&im->mutex);
+
+  if (ctrl)
+    {
+      dirmngr_deinit_default_ctrl (ctrl);
+      xfree (ctrl);
+    }
+  return NULL;
+}
+
+
+/* Implementation of ISVALID --multi.  LINE has the space delimited
+ * fingerprints of the certificates.  */
+static gpg_error_t
+isvalid_multi (assuan_context_t ctx, char *line, int ocsp_mode,
+               int only_ocsp, int force_default_responder)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err = 0;
+  struct isvalid_multi_s im;
+  struct isvalid_item_s *item;
+  const char *fields[MAX_ISVALID_MULTI+1];
+  npth_attr_t tattr;
+  npth_t thread;
+  int i, n, rc;
+
+  if (opt.fake_crl)
+    return leave_cmd (ctx, gpg_error (GPG_ERR_NOT_SUPPORTED));
+
+  memset (&im, 0, sizeof im);
+  im.ctrl = ctrl;
+  im.ocsp_mode = ocsp_mode;
+  im.only_ocsp = only_ocsp;
+  im.force_default_responder = force_default_responder;
+
+  /* We need to work on a copy of the line because an inquiry reuses
+   * the line buffer.  */
+  line = xtrystrdup (line);
+  if (!line)
+    return leave_cmd (ctx, gpg_error_from_syserror ());
+  n = split_fields (line, fields, DIM (fields));
+  if (n > MAX_ISVALID_MULTI)
+    {
+      err = PARM_ERROR ("too many certificates");
+      goto leave;
+    }
+  for (i=0; i < n; i++)
+    if (strlen (fields[i]) != 40
+        || strspn (fields[i], "0123456789abcdefABCDEF") != 40)
+      {
+        err = PARM_ERROR ("invalid fingerprint");
+        goto leave;
+      }
+
+  im.items = xtrycalloc (n, sizeof *im.items);
+  if (!im.items)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  im.nitems = n;
+
+  /* Get all certificates first.  They are put into the cache so that
+   * the workers are able to find the issuers without asking back.  */
+  for (i=0; i < n; i++)
+    {
+      item = im.items + i;
+      strcpy (item->fpr, fields[i]);
+      ascii_strupr (item->fpr);
+      item->cert = get_cert_byhexfpr (item->fpr);
+      if (!item->cert)
+        {
+          item->cert = get_cert_local (ctrl, item->fpr);
+          if (!item->cert)
+            {
+              err = gpg_error (GPG_ERR_MISSING_CERT);
+              goto leave;
+            }
+          cache_cert (item->cert);
+        }
+    }
+
+  rc = npth_mutex_init (&im.mutex, NULL);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      goto leave;
+    }
+  rc = npth_cond_init (&im.cond, NULL);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      npth_mutex_destroy (&im.mutex);
+      goto leave;
+    }
+
+  npth_mutex_lock (&im.mutex);
+  rc = npth_attr_init (&tattr);
+  if (!rc)
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+      for (i=0; i < n && i < MAX_CONCURRENT_ISVALID; i++)
+        {
+          if (npth_create (&thread, &tattr, isvalid_multi_worker, &im))
+            break;
+          im.nworkers++;
+        }
+      npth_attr_destroy (&tattr);
+    }
+  if (!im.nworkers)
+    log_info ("error spawning isvalid worker - checking serially\n");
+  while (im.nworkers)
+    npth_cond_wait (&im.cond, &im.mutex);
+  npth_mutex_unlock (&im.mutex);
+  npth_cond_destroy (&im.cond);
+  npth_mutex_destroy (&im.mutex);
+
+  /* The workers are not able to inquire anything from the client.
+   * Thus we run all checks which did not end with a definite result
+   * again with our connection.  This is cheap because the responses
+   * and CRLs are meanwhile cached.  Items not handled by the workers
+   * are checked here too.  */
+  for (i=0; i < n; i++)
+    {
+      item = im.items + i;
+      if (i < im.next_item
+          && (!item->err || gpg_err_code (item->err) == GPG_ERR_CERT_REVOKED))
+        continue;
+      isvalid_check_item (ctrl, item, ocsp_mode, only_ocsp,
+                          force_default_responder);
+    }
+
+  for (i=0; !err && i < n; i++)
+    {
+      item = im.items + i;
+      err = dirmngr_status_printf (ctrl, "ISVALID_RESULT", "%s %u %s %s %s",
+                                   item->fpr, item->err,
+                                   *item->signer_fpr? item->signer_fpr : "-",
+                                   (gpg_err_code (item->err)
+                                    == GPG_ERR_CERT_REVOKED
+                                    && *item->revoked_at)?
+                                   item->revoked_at : "-",
+                                   item->reason? item->reason : "-");
+    }
+
+ leave:
+  if (im.items)
+    for (i=0; i < im.nitems; i++)
+      ksba_cert_release (im.items[i].cert);
+  xfree (im.items);
+  xfree (line);
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_isvalid[] =
   "ISVALID [--only-ocsp] [--force-default-responder]"
   " <certificate_id> [<certificate_fpr>]\n"
+  "ISVALID --multi [--ocsp] [--only-ocsp] [--force-default-responder]"
+  " <certificate_fpr>...\n"
   "\n"
   "This command checks whether the certificate identified by the\n"
   "certificate_id is valid.  This is done by consulting CRLs or\n"
@@ -1263,7 +1925,19 @@ static const char hlp_isvalid[] =
   "\n"
   "If the option --force-default-responder is given, only the default\n"
   "OCSP responder will be used and any other methods of obtaining an\n"
-  "OCSP responder URL won't be used.";
+  "OCSP responder URL won't be used.\n"
+  "\n"
+  "With --multi the certificates given by their hex encoded SHA-1\n"
+  "fingerprints are checked in parallel.  Missing certificates are\n"
+  "inquired using SENDCERT.  An OCSP check is done if --ocsp is given.\n"
+  "For each certificate in the given order a status line\n"
+  "\n"
+  "  ISVALID_RESULT <certificate_fpr> <errorcode> <signer_fpr>\n"
+  "                 <revocation_time> <reason>\n"
+  "\n"
+  "is emitted where the last three fields are \"-\" if not\n"
+  "applicable.  SIGNER_FPR is the certificate the result is only\n"
+  "valid with, as with the ONLY_VALID_IF_CERT_VALID status line.";
 static gpg_error_t
 cmd_isvalid (assuan_context_t ctx, char *line)
 {
@@ -1277,6 +1951,10 @@ cmd_isvalid (assuan_context_t ctx, char *line)
 
   only_ocsp = has_option (line, "--only-ocsp");
   force_default_responder = has_option (line, "--force-default-responder");
+  if (has_option (line, "--multi"))
+    return isvalid_multi (ctx, skip_options (line),
+                          has_option (line, "--ocsp"), only_ocsp,
+                          force_default_responder);
   line = skip_options (line);
 
   /* We need to work on a copy of the line because that same Assuan
@@ -1328,7 +2006,7 @@ cmd_isvalid (assuan_context_t ctx, char *line)
         err = gpg_error (GPG_ERR_NOT_SUPPORTED);
       else
         err = ocsp_isvalid (ctrl, NULL, NULL, force_default_responder,
-                            revoked_at, &reason);
+                            revoked_at, &reason, NULL);
 
       if (gpg_err_code (err) == GPG_ERR_CERT_REVOKED)
         dirmngr_status_printf (ctrl, "REVOCATIONINFO", "%s %s",
@@ -1577,7 +2255,7 @@ cmd_checkocsp (assuan_context_t ctx, char *line)
     err = gpg_error (GPG_ERR_NOT_SUPPORTED);
   else
     err = ocsp_isvalid (ctrl, cert, NULL, force_default_responder,
-                        revoked_at, &reason);
+                        revoked_at, &reason, NULL);
 
   if (gpg_err_code (err) == GPG_ERR_CERT_REVOKED)
     dirmngr_status_printf (ctrl, "REVOCATIONINFO", "%s %s",
@@ -2021,6 +2699,91 @@ cmd_cachecert (assuan_context_t ctx, char *line)
 }
 
 
+/* Return the slot of the VALIDCACHE entry for KEY.  */
+static unsigned int
+validcache_slot (const char *key)
+{
+  unsigned int hash = 0;
+
+  for (; *key; key++)
+    hash = hash * 31 + *(const unsigned char *)key;
+  return hash % VALIDCACHE_SLOTS;
+}
+
+
+/* Remove all entries from the VALIDCACHE cache.  */
+static void
+validcache_flush (void)
+{
+  memset (validcache, 0, sizeof validcache);
+}
+
+
+static const char hlp_validcache[] =
+  "VALIDCACHE --get <key>\n"
+  "VALIDCACHE --put <key> <expires> <value>\n"
+  "VALIDCACHE --flush\n"
+  "\n"
+  "This command is used by gpgsm to share the results of certificate\n"
+  "chain validations between its processes.  KEY is a string without\n"
+  "spaces and VALUE an opaque string, both of limited length.  With\n"
+  "--put VALUE is stored under KEY until the ISO time EXPIRES but not\n"
+  "longer than an hour.  With --get the status line\n"
+  "\n"
+  "  VALIDCACHE <expires> <value>\n"
+  "\n"
+  "is returned for KEY or the error GPG_ERR_NOT_FOUND.  The option\n"
+  "--flush removes all entries; this is also done by FLUSHCRLS.";
+static gpg_error_t
+cmd_validcache (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err = 0;
+  int do_get, do_put;
+  const char *fields[3];
+  struct validcache_s *vc;
+  gnupg_isotime_t current_time, maxtime;
+
+  do_get = has_option (line, "--get");
+  do_put = has_option (line, "--put");
+  if (has_option (line, "--flush"))
+    {
+      validcache_flush ();
+      return leave_cmd (ctx, 0);
+    }
+  line = skip_options (line);
+  if (do_get == do_put)
+    return leave_cmd (ctx, PARM_ERROR ("either --get or --put is required"));
+
+  if (split_fields (line, fields, do_put? 3 : 1) != (do_put? 3 : 1)
+      || strlen (fields[0]) >= sizeof vc->key
+      || (do_put && (check_isotime (fields[1])
+                     || strlen (fields[2]) >= sizeof vc->value)))
+    return leave_cmd (ctx, PARM_ERROR ("invalid arguments"));
+
+  gnupg_get_isotime (current_time);
+  vc = validcache + validcache_slot (fields[0]);
+  if (do_put)
+    {
+      gnupg_copy_time (maxtime, current_time);
+      add_seconds_to_isotime (maxtime, VALIDCACHE_MAX_TTL);
+      strcpy (vc->key, fields[0]);
+      gnupg_copy_time (vc->expires,
+                       strcmp (fields[1], maxtime) > 0? maxtime : fields[1]);
+      strcpy (vc->value, fields[2]);
+    }
+  else if (!*vc->key || strcmp (vc->key, fields[0])
+           || strcmp (vc->expires, current_time) < 0)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+  else
+    err = dirmngr_status_printf (ctrl, "VALIDCACHE", "%s %s",
+                                 vc->expires, vc->value);
+
+  return leave_cmd (ctx, err);
+}
+
+
+
 static const char hlp_validate[] =
   "VALIDATE [--systrust] [--tls] [--no-crl]\n"
   "\n"
@@ -2867,6 +3630,7 @@ static const char hlp_getinfo[] =
   "session_id  - Return the current session_id\n"
   "workqueue   - Inspect the work queue\n"
   "stats       - Print stats\n"
+  "metrics     - Return all metrics in the Prometheus text format\n"
   "getenv NAME - Return value of envvar NAME\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
@@ -2935,10 +3699,23 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       workqueue_dump_queue (ctrl);
       err = 0;
     }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *s = metrics_format ();
+
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
   else if (!strcmp (line, "stats"))
     {
       cert_cache_print_stats (ctrl);
       domaininfo_print_stats (ctrl);
+      dns_stuff_print_stats (ctrl);
       err = 0;
     }
   else if (!strncmp (line, "getenv", 6)
@@ -3035,6 +3812,8 @@ cmd_flushcrls (assuan_context_t ctx, char *line)
 {
   (void)line;
 
+  /* Chain validations cached by the clients are based on the CRLs.  */
+  validcache_flush ();
   return leave_cmd (ctx, crl_cache_flush () ? GPG_ERR_GENERAL : 0);
 }
 
@@ -3051,6 +3830,7 @@ register_commands (assuan_context_t ctx)
   } table[] = {
     { "DNS_CERT",   cmd_dns_cert,   hlp_dns_cert },
     { "WKD_GET",    cmd_wkd_get,    hlp_wkd_get },
+    { "LOCATE",     cmd_locate,     hlp_locate },
     { "LDAPSERVER", cmd_ldapserver, hlp_ldapserver },
     { "ISVALID",    cmd_isvalid,    hlp_isvalid },
     { "CHECKCRL",   cmd_checkcrl,   hlp_checkcrl },
@@ -3060,6 +3840,7 @@ register_commands (assuan_context_t ctx)
     { "LISTCRLS",   cmd_listcrls,   hlp_listcrls },
     { "CACHECERT",  cmd_cachecert,  hlp_cachecert },
     { "VALIDATE",   cmd_validate,   hlp_validate },
+    { "VALIDCACHE", cmd_validcache, hlp_validcache },
     { "KEYSERVER",  cmd_keyserver,  hlp_keyserver },
     { "KS_SEARCH",  cmd_ks_search,  hlp_ks_search },
     { "KS_GET",     cmd_ks_get,     hlp_ks_get },
@@ -37,10 +37,15 @@
 
 #define MAX_LINELEN 20000
 
+/* Number of full lines the radix64 encoder collects before writing
+   them out.  */
+#define ARMOR_ENCODE_LINES 16
+
 static const byte bintoasc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                                "abcdefghijklmnopqrstuvwxyz"
                                "0123456789+/";
 static u32 asctobin[4][256]; /* runtime initialized */
+static byte bintoasc2[4096][2]; /* runtime initialized */
 static int is_initialized;
 
 
@@ -190,6 +195,14 @@ initialize(void)
 	asctobin[3][*s] = i << (3 * 6);
       }
 
+    /* Build the helptable for bin to radix64 conversion of 12 bits at
+       a time; this halves the number of lookups in the encoder.  */
+    for (i=0; i < 4096; i++)
+      {
+        bintoasc2[i][0] = bintoasc[(i >> 6) & 077];
+        bintoasc2[i][1] = bintoasc[i & 077];
+      }
+
     is_initialized=1;
 }
 
@@ -1171,7 +1184,7 @@ armor_output_buf_as_radix64 (armor_filter_context_t *afx, IOBUF a,
 			     byte *buf, size_t size)
 {
   byte radbuf[sizeof (afx->radbuf)];
-  byte outbuf[64 + sizeof (afx->eol)];
+  byte outbuf[ARMOR_ENCODE_LINES * (64 + sizeof (afx->eol))];
   unsigned int eollen = strlen (afx->eol);
   u32 in, in2;
   int idx, idx2;
@@ -1214,35 +1227,42 @@ armor_output_buf_as_radix64 (armor_filter_context_t *afx, IOBUF a,
 
   if (size >= (64/4)*3)
     {
-      /* preload eol to outbuf buffer */
-      memcpy (outbuf + 64, afx->eol, sizeof(afx->eol));
+      byte *p;
+      int nlines;
 
       do
 	{
 	  /* idx and idx2 == 0 */
 
-	  for (i = 0; i < (64/8); i++)
+	  /* Encode as many full lines as fit into the output buffer so
+	     that we don't need to call iobuf_write for each line.  */
+	  p = outbuf;
+	  for (nlines = 0;
+	       nlines < ARMOR_ENCODE_LINES && size >= (64/4)*3;
+	       nlines++)
 	    {
-	      in = (u32)buf[0] << (2 * 8);
-	      in |= (u32)buf[1] << (1 * 8);
-	      in |= (u32)buf[2] << (0 * 8);
-	      in2 = (u32)buf[3] << (2 * 8);
-	      in2 |= (u32)buf[4] << (1 * 8);
-	      in2 |= (u32)buf[5] << (0 * 8);
-	      outbuf[i*8+0] = bintoasc[(in >> 18) & 077];
-	      outbuf[i*8+1] = bintoasc[(in >> 12) & 077];
-	      outbuf[i*8+2] = bintoasc[(in >> 6) & 077];
-	      outbuf[i*8+3] = bintoasc[(in >> 0) & 077];
-	      outbuf[i*8+4] = bintoasc[(in2 >> 18) & 077];
-	      outbuf[i*8+5] = bintoasc[(in2 >> 12) & 077];
-	      outbuf[i*8+6] = bintoasc[(in2 >> 6) & 077];
-	      outbuf[i*8+7] = bintoasc[(in2 >> 0) & 077];
-	      buf+=6;
-	      size-=6;
+	      for (i = 0; i < (64/8); i++)
+		{
+		  in = (u32)buf[0] << (2 * 8);
+		  in |= (u32)buf[1] << (1 * 8);
+		  in |= (u32)buf[2] << (0 * 8);
+		  in2 = (u32)buf[3] << (2 * 8);
+		  in2 |= (u32)buf[4] << (1 * 8);
+		  in2 |= (u32)buf[5] << (0 * 8);
+		  memcpy (p + 0, bintoasc2[(in >> 12) & 07777], 2);
+		  memcpy (p + 2, bintoasc2[(in >> 0) & 07777], 2);
+		  memcpy (p + 4, bintoasc2[(in2 >> 12) & 07777], 2);
+		  memcpy (p + 6, bintoasc2[(in2 >> 0) & 07777], 2);
+		  p += 8;
+		  buf+=6;
+		  size-=6;
+		}
+	      /* pgp doesn't like 72 here */
+	      memcpy (p, afx->eol, eollen);
+	      p += eollen;
 	    }
 
-	  /* pgp doesn't like 72 here */
-	  iobuf_write (a, outbuf, 64 + eollen);
+	  iobuf_write (a, outbuf, p - outbuf);
 	}
       while (size >= (64/4)*3);
 
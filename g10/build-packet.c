@@ -1260,6 +1260,8 @@ delete_sig_subpkt (subpktarea_t *area, sigsubpkttype_t reqtype )
         log_error ("delete_subpkt: buffer shorter than subpacket\n");
     log_assert (unused <= area->len);
     area->len -= unused;
+    if (unused)
+      area->indexed = 0;
     return !!unused;
 }
 
@@ -1402,6 +1404,7 @@ build_sig_subpkt (PKT_signature *sig, sigsubpkttype_t type,
         /*log_debug ("allocating area for type %d\n", type );*/
     }
     newarea->len = n;
+    newarea->indexed = 0;
 
     p = newarea->data + n0;
     if (nlen == 5) {
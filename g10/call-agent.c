@@ -38,6 +38,7 @@
 #include "../common/i18n.h"
 #include "../common/asshelp.h"
 #include "../common/sysutils.h"
+#include "main.h"
 #include "call-agent.h"
 #include "../common/status.h"
 #include "../common/shareddefs.h"
@@ -50,6 +51,23 @@
 static assuan_context_t agent_ctx = NULL;
 static int did_early_card_test;
 
+/* The connection to the agent is kept for the lifetime of the
+ * process.  To avoid needless round trips we track some of the state
+ * of that connection: AGENT_CTX_FRESH is set if the connection has
+ * just been established by the current operation and thus does not
+ * need a RESET; AGENT_EPHEMERAL caches the ephemeral mode (-1 if not
+ * known); and the results of "GETINFO cmd_has_option" are cached
+ * in AGENT_OPTION_CACHE.  */
+static int agent_ctx_fresh;
+static int agent_ephemeral = -1;
+#define AGENT_OPTION_CACHE_SIZE 8
+static struct
+{
+  const char *name;     /* "COMMAND OPTION" - always a string literal.  */
+  int supported;
+} agent_option_cache[AGENT_OPTION_CACHE_SIZE];
+static int agent_option_cache_used;
+
 struct confirm_parm_s
 {
   char *desc;
@@ -243,9 +261,13 @@ start_agent (ctrl_t ctrl, int flag_for_card)
   /* Fixme: We need a context for each thread or serialize the access
      to the agent. */
   if (agent_ctx)
-    rc = 0;
+    {
+      agent_ctx_fresh = 0;
+      rc = 0;
+    }
   else
     {
+      agent_ctx_fresh = 1;
       rc = start_new_gpg_agent (&agent_ctx,
                                 GPG_ERR_SOURCE_DEFAULT,
                                 opt.agent_program,
@@ -254,6 +276,7 @@ start_agent (ctrl_t ctrl, int flag_for_card)
                                 opt.autostart?ASSHELP_FLAG_AUTOSTART:0,
                                 opt.verbose, DBG_IPC,
                                 NULL, NULL);
+      log_startup_phase ("agent-connect");
       if (!opt.autostart && gpg_err_code (rc) == GPG_ERR_NO_AGENT)
         {
           static int shown;
@@ -383,6 +406,49 @@ start_agent (ctrl_t ctrl, int flag_for_card)
 }
 
 
+/* Send a RESET to the agent unless the connection has just been
+ * established by the current operation.  Must be called after
+ * start_agent and before any command which changes the state of the
+ * session.  */
+static gpg_error_t
+reset_agent (void)
+{
+  if (agent_ctx_fresh)
+    {
+      agent_ctx_fresh = 0;
+      return 0;
+    }
+  return assuan_transact (agent_ctx, "RESET",
+                          NULL, NULL, NULL, NULL, NULL, NULL);
+}
+
+
+/* Return true if the agent supports the option given as "COMMAND
+ * OPTION" in NAME.  NAME must be a string literal.  The answer is
+ * cached for the lifetime of the connection.  */
+static int
+agent_has_option (const char *name)
+{
+  char line[ASSUAN_LINELENGTH];
+  int i, supported;
+
+  for (i=0; i < agent_option_cache_used; i++)
+    if (!strcmp (agent_option_cache[i].name, name))
+      return agent_option_cache[i].supported;
+
+  snprintf (line, sizeof line, "GETINFO cmd_has_option %s", name);
+  supported = !assuan_transact (agent_ctx, line,
+                                NULL, NULL, NULL, NULL, NULL, NULL);
+  if (agent_option_cache_used < AGENT_OPTION_CACHE_SIZE)
+    {
+      agent_option_cache[agent_option_cache_used].name = name;
+      agent_option_cache[agent_option_cache_used].supported = supported;
+      agent_option_cache_used++;
+    }
+  return supported;
+}
+
+
 /* Return a new malloced string by unescaping the string S.  Escaping
    is percent escaping and '+'/space mapping.  A binary nul will
    silently be replaced by a 0xFF.  Function returns NULL to indicate
@@ -2021,14 +2087,9 @@ agent_get_passphrase (const char *cache_id,
   dfltparm.ctx = agent_ctx;
 
   /* Check that the gpg-agent understands the repeat option.  */
-  if (assuan_transact (agent_ctx,
-                       "GETINFO cmd_has_option GET_PASSPHRASE repeat",
-                       NULL, NULL, NULL, NULL, NULL, NULL))
+  if (!agent_has_option ("GET_PASSPHRASE repeat"))
     return gpg_error (GPG_ERR_NOT_SUPPORTED);
-  have_newsymkey = !(assuan_transact
-                     (agent_ctx,
-                      "GETINFO cmd_has_option GET_PASSPHRASE newsymkey",
-                      NULL, NULL, NULL, NULL, NULL, NULL));
+  have_newsymkey = agent_has_option ("GET_PASSPHRASE newsymkey");
 
   if (cache_id && *cache_id)
     if (!(arg1 = percent_plus_escape (cache_id)))
@@ -2630,8 +2691,7 @@ agent_genkey (ctrl_t ctrl, char **cache_nonce_addr, char **passwd_nonce_addr,
     ; /* A RESET would flush the passwd nonce cache.  */
   else
     {
-      err = assuan_transact (agent_ctx, "RESET",
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = reset_agent ();
       if (err)
         return err;
     }
@@ -2700,7 +2760,7 @@ agent_readkey (ctrl_t ctrl, int fromcard, const char *hexkeygrip,
     return err;
   dfltparm.ctx = agent_ctx;
 
-  err = assuan_transact (agent_ctx, "RESET",NULL, NULL, NULL, NULL, NULL, NULL);
+  err = reset_agent ();
   if (err)
     return err;
 
@@ -2766,8 +2826,7 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
   if (digestlen*2 + 50 > DIM(line))
     return gpg_error (GPG_ERR_GENERAL);
 
-  err = assuan_transact (agent_ctx, "RESET",
-                         NULL, NULL, NULL, NULL, NULL, NULL);
+  err = reset_agent ();
   if (err)
     return err;
 
@@ -2827,15 +2886,17 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
 
 
 
-/* Handle a CIPHERTEXT inquiry.  Note, we only send the data,
-   assuan_transact takes care of flushing and writing the END. */
+/* Handle a CIPHERTEXT or CIPHERTEXTS inquiry.  Note, we only send
+   the data, assuan_transact takes care of flushing and writing the
+   END. */
 static gpg_error_t
 inq_ciphertext_cb (void *opaque, const char *line)
 {
   struct cipher_parm_s *parm = opaque;
   int rc;
 
-  if (has_leading_keyword (line, "CIPHERTEXT"))
+  if (has_leading_keyword (line, "CIPHERTEXT")
+      || has_leading_keyword (line, "CIPHERTEXTS"))
     {
       assuan_begin_confidential (parm->ctx);
       rc = assuan_send_data (parm->dflt->ctx,
@@ -2917,8 +2978,7 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
     return err;
   dfltparm.ctx = agent_ctx;
 
-  err = assuan_transact (agent_ctx, "RESET",
-                         NULL, NULL, NULL, NULL, NULL, NULL);
+  err = reset_agent ();
   if (err)
     return err;
 
@@ -3010,6 +3070,180 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
 }
 
 
+/* Call the agent to decrypt the N ciphertexts S_CIPHERTEXTS with the
+ * key identified by the hex string KEYGRIP using a single PKDECRYPT
+ * command.  KEYGRIP may not describe a dual key.  For each item the
+ * decoded value is stored verbatim at R_BUFS[i] and its length at
+ * R_BUFLENS[i]; if an item could not be decrypted, its error code is
+ * stored at R_ERRS[i] and NULL at R_BUFS[i].  The caller needs to
+ * release the buffers.  KEYID, MAINKEYID and PUBKEY_ALGO are used to
+ * construct additional prompts or status messages.  The padding
+ * information is stored at R_PADDING with -1 for not known.  If the
+ * agent does not support this, GPG_ERR_NOT_SUPPORTED is returned.  */
+gpg_error_t
+agent_pkdecrypt_batch (ctrl_t ctrl, const char *keygrip, const char *desc,
+                       u32 *keyid, u32 *mainkeyid, int pubkey_algo,
+                       gcry_sexp_t *s_ciphertexts, unsigned int n,
+                       unsigned char **r_bufs, size_t *r_buflens,
+                       gpg_error_t *r_errs, int *r_padding)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  membuf_t data, cipherbuf;
+  struct default_inq_parm_s dfltparm;
+  struct cipher_parm_s parm;
+  unsigned char *tmpbuf;
+  size_t tmplen, len, itemlen, datalen;
+  unsigned int idx;
+  char *buf = NULL;
+  const char *p, *s;
+  unsigned long ul;
+  char *endp;
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+  dfltparm.keyinfo.keyid       = keyid;
+  dfltparm.keyinfo.mainkeyid   = mainkeyid;
+  dfltparm.keyinfo.pubkey_algo = pubkey_algo;
+
+  if (!keygrip || strlen (keygrip) != 40 || !s_ciphertexts || !n
+      || !r_bufs || !r_buflens || !r_errs || !r_padding)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  for (idx=0; idx < n; idx++)
+    {
+      r_bufs[idx] = NULL;
+      r_buflens[idx] = 0;
+      r_errs[idx] = gpg_error (GPG_ERR_NO_DATA);
+    }
+  *r_padding = -1;
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+  dfltparm.ctx = agent_ctx;
+
+  if (!agent_has_option ("PKDECRYPT batch"))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  err = reset_agent ();
+  if (err)
+    return err;
+
+  snprintf (line, sizeof line, "SETKEY %.40s", keygrip);
+  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    return err;
+
+  if (desc)
+    {
+      snprintf (line, DIM(line), "SETKEYDESC %s", desc);
+      err = assuan_transact (agent_ctx, line,
+                            NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err)
+        return err;
+    }
+
+  init_membuf (&cipherbuf, 4096);
+  for (idx=0; idx < n; idx++)
+    {
+      err = make_canon_sexp (s_ciphertexts[idx], &tmpbuf, &tmplen);
+      if (err)
+        {
+          xfree (get_membuf (&cipherbuf, NULL));
+          return err;
+        }
+      put_membuf (&cipherbuf, tmpbuf, tmplen);
+      xfree (tmpbuf);
+    }
+  parm.dflt = &dfltparm;
+  parm.ctx = agent_ctx;
+  parm.ciphertext = get_membuf (&cipherbuf, &parm.ciphertextlen);
+  if (!parm.ciphertext)
+    return gpg_error_from_syserror ();
+
+  init_membuf_secure (&data, 1024);
+  err = assuan_transact (agent_ctx, "PKDECRYPT --batch",
+                         put_membuf_cb, &data,
+                         inq_ciphertext_cb, &parm,
+                         padding_info_cb, r_padding);
+  xfree (parm.ciphertext);
+  buf = get_membuf (&data, &datalen);
+  if (err)
+    goto leave;
+  if (!buf)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Split the result into the items; each is either "(5:valueN:D)"
+   * or "(5:errorN:D)".  */
+  p = buf;
+  len = datalen;
+  for (idx=0; idx < n; idx++, p += itemlen, len -= itemlen)
+    {
+      itemlen = len? gcry_sexp_canon_len (p, len, NULL, NULL) : 0;
+      if (itemlen < 12 || *p != '(' || p[itemlen-1] != ')'
+          || (memcmp (p, "(5:value", 8) && memcmp (p, "(5:error", 8)))
+        {
+          err = gpg_error (GPG_ERR_INV_SEXP);
+          goto leave;
+        }
+      ul = strtoul (p+8, &endp, 10);
+      if (!ul || *endp != ':' || (endp+1 - p) + ul + 1 != itemlen)
+        {
+          err = gpg_error (GPG_ERR_INV_SEXP);
+          goto leave;
+        }
+      s = endp + 1;
+      if (p[3] == 'e') /* error */
+        {
+          char numbuf[35];
+
+          if (ul >= sizeof numbuf)
+            {
+              err = gpg_error (GPG_ERR_INV_SEXP);
+              goto leave;
+            }
+          memcpy (numbuf, s, ul);
+          numbuf[ul] = 0;
+          r_errs[idx] = strtoul (numbuf, NULL, 10);
+          if (!r_errs[idx])
+            r_errs[idx] = gpg_error (GPG_ERR_GENERAL);
+        }
+      else
+        {
+          r_bufs[idx] = xtrymalloc_secure (ul);
+          if (!r_bufs[idx])
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          memcpy (r_bufs[idx], s, ul);
+          r_buflens[idx] = ul;
+          r_errs[idx] = 0;
+        }
+    }
+
+ leave:
+  if (err)
+    {
+      for (idx=0; idx < n; idx++)
+        {
+          xfree (r_bufs[idx]);
+          r_bufs[idx] = NULL;
+          r_buflens[idx] = 0;
+          r_errs[idx] = err;
+        }
+    }
+  if (buf)
+    wipememory (buf, datalen);
+  xfree (buf);
+  return err;
+}
+
+
 
 /* Retrieve a key encryption key from the agent.  With FOREXPORT true
    the key shall be used for export, with false for import.  On success
@@ -3182,9 +3416,7 @@ agent_export_key (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
   dfltparm.ctx = agent_ctx;
 
   /* Check that the gpg-agent supports the --mode1003 option.  */
-  if (mode1003 && assuan_transact (agent_ctx,
-                                   "GETINFO cmd_has_option EXPORT_KEY mode1003",
-                                   NULL, NULL, NULL, NULL, NULL, NULL))
+  if (mode1003 && !agent_has_option ("EXPORT_KEY mode1003"))
     return gpg_error (GPG_ERR_NOT_SUPPORTED);
 
   if (desc)
@@ -3370,7 +3602,9 @@ agent_set_ephemeral_mode (ctrl_t ctrl, int enable, int *r_previous)
   if (err)
     goto leave;
 
-  if (r_previous)
+  if (r_previous && agent_ephemeral != -1)
+    *r_previous = agent_ephemeral;
+  else if (r_previous)
     {
       err = assuan_transact (agent_ctx, "GETINFO ephemeral",
                              NULL, NULL, NULL, NULL, NULL, NULL);
@@ -3380,15 +3614,20 @@ agent_set_ephemeral_mode (ctrl_t ctrl, int enable, int *r_previous)
         *r_previous = 0;
       else
         goto leave;
+      agent_ephemeral = *r_previous;
     }
 
   /* Skip setting if we are only querying or if the mode is already set. */
-  if (enable == -1 || (r_previous && !!*r_previous == !!enable))
+  if (enable == -1 || (agent_ephemeral != -1 && agent_ephemeral == !!enable))
     err = 0;
   else
-    err = assuan_transact (agent_ctx,
-                           enable? "OPTION ephemeral=1" : "OPTION ephemeral=0",
-                           NULL, NULL, NULL, NULL, NULL, NULL);
+    {
+      err = assuan_transact (agent_ctx,
+                             enable? "OPTION ephemeral=1" : "OPTION ephemeral=0",
+                             NULL, NULL, NULL, NULL, NULL, NULL);
+      if (!err)
+        agent_ephemeral = !!enable;
+    }
  leave:
   return err;
 }
@@ -221,6 +221,15 @@ gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
                              unsigned char **r_buf, size_t *r_buflen,
                              int *r_padding);
 
+/* Decrypt several ciphertexts for the same key.  */
+gpg_error_t agent_pkdecrypt_batch (ctrl_t ctrl, const char *keygrip,
+                                   const char *desc,
+                                   u32 *keyid, u32 *mainkeyid,
+                                   int pubkey_algo,
+                                   gcry_sexp_t *s_ciphertexts, unsigned int n,
+                                   unsigned char **r_bufs, size_t *r_buflens,
+                                   gpg_error_t *r_errs, int *r_padding);
+
 /* Retrieve a key encryption key.  */
 gpg_error_t agent_keywrap_key (ctrl_t ctrl, int forexport,
                                void **r_kek, size_t *r_keklen);
@@ -69,6 +69,14 @@ struct ks_search_parm_s
 };
 
 
+/* Parameter structure used with the LOCATE command.  */
+struct locate_status_parm_s
+{
+  struct ks_status_parm_s stparm;  /* For the other status lines.  */
+  char *mechanism;                 /* The arg of the LOCATE status.  */
+};
+
+
 /* Parameter structure used with the KS_GET command.  */
 struct ks_get_parm_s
 {
@@ -1231,6 +1239,98 @@ gpg_dirmngr_dns_cert (ctrl_t ctrl, const char *name, const char *certtype,
 
 
 
+/* Status callback for the LOCATE command.  */
+static gpg_error_t
+locate_status_cb (void *opaque, const char *line)
+{
+  struct locate_status_parm_s *parm = opaque;
+  const char *s;
+
+  if ((s = has_leading_keyword (line, "LOCATE")))
+    {
+      if (!parm->mechanism && !(parm->mechanism = xtrystrdup (s)))
+        return gpg_error_from_syserror ();
+      return 0;
+    }
+  return ks_status_cb (&parm->stparm, line);
+}
+
+
+/* Ask the dirmngr to locate the key for NAME by running the
+ * comma delimited list of MECHANISMS concurrently.  On success the
+ * key of the first successful mechanism in the order of MECHANISMS
+ * is stored as a new estream at R_KEY, the name of that mechanism at
+ * R_MECHANISM, and the URL of the source (if any) at R_URL.  Returns
+ * GPG_ERR_NO_DATA if all mechanisms failed.  */
+gpg_error_t
+gpg_dirmngr_locate (ctrl_t ctrl, const char *name, const char *mechanisms,
+                    char **r_mechanism, estream_t *r_key, char **r_url)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  struct locate_status_parm_s stparm = { { NULL } };
+  struct dns_cert_parm_s parm = { NULL };
+  char *line = NULL;
+
+  *r_mechanism = NULL;
+  *r_key = NULL;
+  if (r_url)
+    *r_url = NULL;
+
+  err = open_context (ctrl, &ctx);
+  if (err)
+    return err;
+
+  line = es_bsprintf ("LOCATE %s %s", mechanisms, name);
+  if (!line)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (strlen (line) + 2 >= ASSUAN_LINELENGTH)
+    {
+      err = gpg_error (GPG_ERR_TOO_LARGE);
+      goto leave;
+    }
+
+  parm.memfp = es_fopenmem (MAX_WKD_RESULT_LENGTH, "rwb");
+  if (!parm.memfp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  err = assuan_transact (ctx, line, dns_cert_data_cb, &parm,
+                         NULL, NULL, locate_status_cb, &stparm);
+  if (gpg_err_code (err) == GPG_ERR_ENOSPC)
+    err = gpg_error (GPG_ERR_TOO_LARGE);
+  if (!err && !stparm.mechanism)
+    err = gpg_error (GPG_ERR_INV_RESPONSE);
+  if (err)
+    goto leave;
+
+  es_rewind (parm.memfp);
+  *r_key = parm.memfp;
+  parm.memfp = NULL;
+  *r_mechanism = stparm.mechanism;
+  stparm.mechanism = NULL;
+  if (r_url)
+    {
+      *r_url = stparm.stparm.source;
+      stparm.stparm.source = NULL;
+    }
+
+ leave:
+  xfree (stparm.stparm.source);
+  xfree (stparm.mechanism);
+  xfree (parm.fpr);
+  xfree (parm.url);
+  es_fclose (parm.memfp);
+  xfree (line);
+  close_context (ctrl, ctx);
+  return err;
+}
+
+
 /* Ask the dirmngr to retrieve a key via the Web Key Directory
  * protocol.  If QUICK is set the dirmngr is advised to use a shorter
  * timeout.  On success a new estream with the key stored at R_KEY and the
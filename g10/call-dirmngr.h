@@ -40,6 +40,9 @@ gpg_error_t gpg_dirmngr_dns_cert (ctrl_t ctrl,
                                   char **r_url);
 gpg_error_t gpg_dirmngr_wkd_get (ctrl_t ctrl, const char *name, int quick,
                                  estream_t *r_key, char **r_url);
+gpg_error_t gpg_dirmngr_locate (ctrl_t ctrl, const char *name,
+                                const char *mechanisms, char **r_mechanism,
+                                estream_t *r_key, char **r_url);
 
 
 #endif /*GNUPG_G10_CALL_DIRMNGR_H*/
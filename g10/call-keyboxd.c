@@ -70,12 +70,86 @@ struct keyboxd_local_s
   /* Flag indicating that a search reset is required.  */
   unsigned int need_search_reset : 1;
 
+  /* Flag indicating that the keyboxd has no more results for the
+   * NEXT --batch commands.  */
+  unsigned int stream_eof : 1;
+
+  /* If not 0 the number of results requested with the next NEXT
+   * --batch command.  This is used to list all keys.  */
+  unsigned int stream_batch;
+
+  /* The results of the last NEXT --batch not yet returned.  */
+  struct prefetch_result_s *stream;
+};
+
+
+/* A keyblock returned by a batched search.  */
+struct prefetch_result_s
+{
+  struct prefetch_result_s *next;
+  unsigned char ubid[UBID_LEN];
+  int uid_no;
+  int pk_no;
+  char *sigstatus;      /* Points into DATA after the keyblock or NULL.  */
+  size_t datalen;
+  char data[1];
+};
+
+/* The search description and the results for one pattern of a
+ * batched search.  */
+struct prefetch_entry_s
+{
+  KEYDB_SEARCH_DESC desc;
+  char *name;           /* Backing store for DESC.U.NAME.  */
+  struct prefetch_result_s *results;
+};
+
+/* The results of a batched search as done by keydb_prefetch.  Note
+ * that gpg.h defines the type keydb_prefetch_t for this structure.  */
+struct keydb_prefetch_s
+{
+  unsigned int serial;  /* Used to detect stale handles.  */
+  unsigned int nentries;
+  struct prefetch_entry_s entries[1];
 };
 
 
+/* Signature status strings longer than this are not sent to the
+ * keyboxd; there is no point in caching keys with that many
+ * signatures and the command needs to fit into an Assuan line.  */
+#define MAX_SIGSTATUS_LEN 900
+
+/* The number of keys requested by the first and at most by a NEXT
+ * --batch command.  The size is doubled for each request so that a
+ * caller looking only at a few keys does not fetch all of them.  */
+#define STREAM_BATCH_MIN 4
+#define STREAM_BATCH_MAX 256
+
+
 /* Flag indicating that for example bulk import is enabled.  */
 static unsigned int in_transaction;
 
+/* Counter used to assign serial numbers to prefetch objects.  */
+static unsigned int prefetch_serial;
+
+
+
+/* Release the pending results of NEXT --batch commands and stop using
+ * this command for the current search.  */
+static void
+release_stream (keyboxd_local_t kbl)
+{
+  struct prefetch_result_s *r;
+
+  while ((r = kbl->stream))
+    {
+      kbl->stream = r->next;
+      xfree (r);
+    }
+  kbl->stream_batch = 0;
+  kbl->stream_eof = 0;
+}
+
 
 
 
@@ -86,6 +160,8 @@ gpg_keyboxd_deinit_session_data (ctrl_t ctrl)
   keyboxd_local_t kbl;
   gpg_error_t err;
 
+  keydb_prefetch_release (ctrl);
+
   while ((kbl = ctrl->keyboxd_local))
     {
       ctrl->keyboxd_local = kbl->next;
@@ -119,6 +195,7 @@ gpg_keyboxd_deinit_session_data (ctrl_t ctrl)
           kbx_client_data_release (kbl->kcd);
           kbl->kcd = NULL;
         }
+      release_stream (kbl);
       xfree (kbl);
     }
 }
@@ -168,7 +245,7 @@ create_new_context (ctrl_t ctrl, assuan_context_t *r_ctx)
 
       if ((opt.import_options & IMPORT_BULK) && !in_transaction)
         {
-          err = assuan_transact (ctx, "TRANSACTION begin",
+          err = assuan_transact (ctx, "TRANSACTION --bulk begin",
                                  NULL, NULL, NULL, NULL, NULL, NULL);
           if (err)
             {
@@ -319,8 +396,10 @@ keydb_release (KEYDB_HANDLE hd)
       if (!kbl->is_active)
         log_fatal ("closing inactive keyboxd context %p\n", kbl);
       kbl->is_active = 0;
+      release_stream (kbl);
       hd->kbl = NULL;
       hd->ctrl = NULL;
+      xfree (hd->last_sigstatus);
     }
   xfree (hd);
 }
@@ -340,6 +419,51 @@ keydb_lock (KEYDB_HANDLE hd)
 }
 
 
+/* Set the signature status received for the last keyblock of HD to
+ * a copy of SIGSTATUS or clear it if SIGSTATUS is NULL.  */
+static void
+set_last_sigstatus (KEYDB_HANDLE hd, const char *sigstatus)
+{
+  xfree (hd->last_sigstatus);
+  /* On malloc failure we simply don't use the cached status.  */
+  hd->last_sigstatus = sigstatus? xtrystrdup (sigstatus) : NULL;
+}
+
+
+/* Mark the signatures of KEYBLOCK as checked according to SIGSTATUS
+ * as received from the keyboxd.  The string has one character for
+ * each signature packet in order; see keydb_put_sigcache.  */
+static void
+apply_sigstatus (kbnode_t keyblock, const char *sigstatus)
+{
+  kbnode_t node;
+  PKT_signature *sig;
+
+  for (node = keyblock; node && *sigstatus; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      switch (*sigstatus++)
+        {
+        case 'g':
+          /* As with the keyring's cache we don't trust a good status
+           * if the algorithms are not supported anymore.  */
+          if (!openpgp_md_test_algo (sig->digest_algo)
+              && !openpgp_pk_test_algo (sig->pubkey_algo))
+            sig->flags.checked = sig->flags.valid = 1;
+          break;
+        case 'b':
+          sig->flags.checked = 1;
+          sig->flags.valid = 0;
+          break;
+        default:
+          break;
+        }
+    }
+}
+
+
 /* Return the keyblock last found by keydb_search() in *RET_KB.
  *
  * On success, the function returns 0 and the caller must free *RET_KB
@@ -370,10 +494,23 @@ keydb_get_keyblock (KEYDB_HANDLE hd, kbnode_t *ret_kb)
 
   if (hd->kbl->search_result)
     {
+      /* Remember the hash of the keyblock so that keydb_put_sigcache
+       * can tell the keyboxd for which version of the keyblock the
+       * signatures have been checked.  */
+      hd->sigcache_pending = 0;
+      if (hd->last_ubid_valid && !opt.no_sig_cache && !hd->skip_pkttypes)
+        {
+          gcry_md_hash_buffer (GCRY_MD_SHA256, hd->sigcache_digest,
+                               iobuf_get_temp_buffer (hd->kbl->search_result),
+                               iobuf_get_temp_length (hd->kbl->search_result));
+          hd->sigcache_pending = 1;
+        }
       err = keydb_parse_keyblock (hd->kbl->search_result,
                                   hd->last_ubid_valid? hd->last_pk_no  : 0,
                                   hd->last_ubid_valid? hd->last_uid_no : 0,
-                                  ret_kb);
+                                  hd->skip_pkttypes, ret_kb);
+      if (!err && hd->sigcache_pending && hd->last_sigstatus)
+        apply_sigstatus (*ret_kb, hd->last_sigstatus);
       /* In contrast to the old code we close the iobuf here and thus
        * this function may be called only once to get a keyblock.  */
       iobuf_close (hd->kbl->search_result);
@@ -392,6 +529,99 @@ keydb_get_keyblock (KEYDB_HANDLE hd, kbnode_t *ret_kb)
 }
 
 
+/* Return the image of the keyblock last found by keydb_search as
+ * stored in the database at R_IMAGE.  This is an alternative to
+ * keydb_get_keyblock for callers which do not need the parsed
+ * keyblock; keydb_get_keyblock may still be called afterwards.  The
+ * image may contain ring trust packets.  On success the
+ * caller must close the returned iobuf, which can be accessed with
+ * iobuf_get_temp_buffer and iobuf_get_temp_length.
+ * GPG_ERR_NOT_SUPPORTED is returned if the database can't provide
+ * the image.  */
+gpg_error_t
+keydb_get_keyblock_image (KEYDB_HANDLE hd, iobuf_t *r_image)
+{
+  *r_image = NULL;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_ARG);
+
+  if (!hd->use_keyboxd)
+    return internal_keydb_get_keyblock_image (hd, r_image);
+
+  if (!hd->kbl->search_result)
+    return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
+
+  *r_image = iobuf_temp_with_content
+    (iobuf_get_temp_buffer (hd->kbl->search_result),
+     iobuf_get_temp_length (hd->kbl->search_result));
+  return 0;
+}
+
+
+/* Tell the keyboxd which signatures of KEYBLOCK have been checked.
+ * KEYBLOCK must have been returned by the last keydb_get_keyblock on
+ * HD and should have passed merge_selfsigs.  The keyboxd attaches
+ * the status to its cached copy of the keyblock and returns it to
+ * other gpg processes so that they don't need to verify the
+ * signatures again.  Without the keyboxd the status is stored in the
+ * keybox record.  Errors are ignored because this is only an
+ * optimization.  */
+void
+keydb_put_sigcache (KEYDB_HANDLE hd, kbnode_t keyblock)
+{
+  gpg_error_t err;
+  kbnode_t node;
+  char status[MAX_SIGSTATUS_LEN+1];
+  char line[ASSUAN_LINELENGTH];
+  char hexubid[2*UBID_LEN+1];
+  char hexdigest[2*32+1];
+  size_t n, len;
+
+  if (!hd)
+    return;
+  if (!hd->use_keyboxd)
+    {
+      internal_keydb_put_sigcache (hd, keyblock);
+      return;
+    }
+  if (!hd->sigcache_pending || opt.no_sig_cache)
+    return;
+  hd->sigcache_pending = 0;
+  if (!hd->last_ubid_valid)
+    return;
+
+  for (n = len = 0, node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      if (n == MAX_SIGSTATUS_LEN)
+        return;  /* Too many signatures.  */
+      if (!node->pkt->pkt.signature->flags.checked)
+        status[n++] = '-';
+      else
+        {
+          status[n++] = node->pkt->pkt.signature->flags.valid? 'g' : 'b';
+          len = n;
+        }
+    }
+  status[len] = 0;  /* Trailing unchecked signatures are not needed.  */
+  if (!len || (hd->last_sigstatus && !strcmp (hd->last_sigstatus, status)))
+    return;  /* Nothing checked or nothing new.  */
+
+  bin2hex (hd->last_ubid, UBID_LEN, hexubid);
+  bin2hex (hd->sigcache_digest, 32, hexdigest);
+  snprintf (line, sizeof line, "SIGCACHE %s %s %s",
+            hexubid, hexdigest, status);
+  err = kbx_client_data_simple (hd->kbl->kcd, line);
+  if (err && DBG_KEYDB)
+    log_debug ("%s: keyboxd did not take the status: %s\n",
+               __func__, gpg_strerror (err));
+  else if (!err)
+    set_last_sigstatus (hd, status);
+}
+
+
 /* Default status callback used to show diagnostics from the keyboxd  */
 static gpg_error_t
 keydb_default_status_cb (void *opaque, const char *line)
@@ -478,6 +708,9 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
       goto leave;
     }
 
+  /* Cached search results might be outdated after the update.  */
+  keydb_prefetch_release (ctrl);
+
   err = build_keyblock_image (kb, &iobuf);
   if (err)
     goto leave;
@@ -530,6 +763,8 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
       goto leave;
     }
 
+  keydb_prefetch_release (hd->ctrl);
+
   err = build_keyblock_image (kb, &iobuf);
   if (err)
     goto leave;
@@ -548,6 +783,41 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
 }
 
 
+/* Store the keyblock IMAGE of IMAGELEN bytes as is into the keyboxd.
+ * This is used to migrate keyrings whose keys do not need to be
+ * checked again.  An existing key is not replaced; instead
+ * GPG_ERR_CONFLICT is returned.  This works only in keyboxd mode.
+ *
+ * Note: this doesn't do anything if --dry-run was specified.  */
+gpg_error_t
+keydb_insert_keyblock_image (KEYDB_HANDLE hd,
+                             const void *image, size_t imagelen)
+{
+  gpg_error_t err;
+  struct store_parm_s parm = {NULL};
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_ARG);
+  if (!hd->use_keyboxd)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (opt.dry_run)
+    return 0;
+
+  parm.ctx = hd->kbl->ctx;
+  parm.data = image;
+  parm.datalen = imagelen;
+  err = assuan_transact (hd->kbl->ctx, "STORE --insert",
+                         NULL, NULL,
+                         store_inq_cb, &parm,
+                         keydb_default_status_cb, hd);
+  /* The SQLite backend reports an existing key as constraint
+   * violation.  */
+  if (gpg_err_code (err) == GPG_ERR_SQL_CONSTRAINT)
+    err = gpg_error (GPG_ERR_CONFLICT);
+  return err;
+}
+
+
 /* Delete the currently selected keyblock.  If you haven't done a
  * search yet on this database handle (or called keydb_search_reset),
  * then this function returns an error.
@@ -581,6 +851,8 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
       goto leave;
     }
 
+  keydb_prefetch_release (hd->ctrl);
+
   bin2hex (hd->last_ubid, UBID_LEN, hexubid);
   snprintf (line, sizeof line, "DELETE %s", hexubid);
   err = assuan_transact (hd->kbl->ctx, line,
@@ -622,6 +894,8 @@ keydb_search_reset (KEYDB_HANDLE hd)
    * ubid flag so that after a reset a delete can't be performed.  */
   hd->kbl->need_search_reset = 1;
   hd->last_ubid_valid = 0;
+  hd->sigcache_pending = 0;
+  hd->pf_valid = 0;
   err = 0;
 
  leave:
@@ -630,6 +904,43 @@ keydb_search_reset (KEYDB_HANDLE hd)
 
 
 
+/* Parse the arguments S of a PUBKEY_INFO status line and store the
+ * UBID at R_UBID and the ordinals at R_UID_NO and R_PK_NO.  */
+static gpg_error_t
+parse_pubkey_info (const char *s, unsigned char *r_ubid,
+                   int *r_uid_no, int *r_pk_no)
+{
+  unsigned int n;
+
+  *r_uid_no = 0;
+  *r_pk_no = 0;
+  if (atoi (s) != PUBKEY_TYPE_OPGP)
+    return gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+
+  while (*s && !spacep (s))
+    s++;
+  if (!(n=hex2fixedbuf (s, r_ubid, UBID_LEN)))
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  s += n;
+  while (*s && !spacep (s))
+    s++;
+  while (spacep (s))
+    s++;
+  if (*s)
+    {
+      *r_uid_no = atoi (s);
+      while (*s && !spacep (s))
+        s++;
+      while (spacep (s))
+        s++;
+      if (*s)
+        *r_pk_no = atoi (s);
+    }
+  return 0;
+}
+
+
 /* Status callback for SEARCH and NEXT operations.  */
 static gpg_error_t
 search_status_cb (void *opaque, const char *line)
@@ -637,49 +948,605 @@ search_status_cb (void *opaque, const char *line)
   KEYDB_HANDLE hd = opaque;
   gpg_error_t err = 0;
   const char *s;
-  unsigned int n;
 
   if ((s = has_leading_keyword (line, "PUBKEY_INFO")))
     {
-      if (atoi (s) != PUBKEY_TYPE_OPGP)
-        err = gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+      hd->last_ubid_valid = 0;
+      set_last_sigstatus (hd, NULL);
+      err = parse_pubkey_info (s, hd->last_ubid,
+                               &hd->last_uid_no, &hd->last_pk_no);
+      if (!err)
+        hd->last_ubid_valid = 1;
+    }
+  else if ((s = has_leading_keyword (line, "SIGCACHE")))
+    set_last_sigstatus (hd, s);
+  else
+    err = keydb_default_status_cb (opaque, line);
+
+  return err;
+}
+
+
+/* Store the search pattern for DESC as used by the keyboxd's SEARCH
+ * command in BUFFER which has a size of BUFSIZE.  */
+static gpg_error_t
+format_search_pattern (KEYDB_SEARCH_DESC *desc, char *buffer, size_t bufsize)
+{
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_EXACT:
+      snprintf (buffer, bufsize, "=%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SUBSTR:
+      snprintf (buffer, bufsize, "*%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAIL:
+      snprintf (buffer, bufsize, "<%s",
+                desc->u.name+(desc->u.name[0] == '<') );
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILSUB:
+      snprintf (buffer, bufsize, "@%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILEND:
+      snprintf (buffer, bufsize, ".%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_WORDS:
+      snprintf (buffer, bufsize, "+%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SHORT_KID:
+      snprintf (buffer, bufsize, "0x%08lX", (ulong)desc->u.kid[1]);
+      break;
+
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      snprintf (buffer, bufsize, "0x%08lX%08lX",
+                (ulong)desc->u.kid[0], (ulong)desc->u.kid[1]);
+      break;
+
+    case KEYDB_SEARCH_MODE_FPR:
+      {
+        unsigned char hexfpr[MAX_FINGERPRINT_LEN * 2 + 1];
+        log_assert (desc->fprlen <= MAX_FINGERPRINT_LEN);
+        bin2hex (desc->u.fpr, desc->fprlen, hexfpr);
+        snprintf (buffer, bufsize, "0x%s", hexfpr);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_ISSUER:
+      snprintf (buffer, bufsize, "#/%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_ISSUER_SN:
+    case KEYDB_SEARCH_MODE_SN:
+      snprintf (buffer, bufsize, "#%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_SUBJECT:
+      snprintf (buffer, bufsize, "/%s", desc->u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      {
+        unsigned char hexgrip[KEYGRIP_LEN * 2 + 1];
+        bin2hex (desc->u.grip, KEYGRIP_LEN, hexgrip);
+        snprintf (buffer, bufsize, "&%s", hexgrip);
+      }
+      break;
+
+    case KEYDB_SEARCH_MODE_UBID:
+      {
+        unsigned char hexubid[UBID_LEN * 2 + 1];
+        bin2hex (desc->u.ubid, UBID_LEN, hexubid);
+        snprintf (buffer, bufsize, "^%s", hexubid);
+      }
+      break;
+
+    default:
+      return gpg_error (GPG_ERR_INV_ARG);
+    }
+
+  return 0;
+}
+
+
+/* Release the results of a previous keydb_prefetch.  Handles still
+ * using them will return GPG_ERR_NOT_FOUND for further searches.  */
+void
+keydb_prefetch_release (ctrl_t ctrl)
+{
+  keydb_prefetch_t pf = ctrl->keydb_prefetch;
+  struct prefetch_result_s *r, *rnext;
+  unsigned int i;
+
+  if (!pf)
+    return;
+  ctrl->keydb_prefetch = NULL;
+
+  for (i = 0; i < pf->nentries; i++)
+    {
+      for (r = pf->entries[i].results; r; r = rnext)
+        {
+          rnext = r->next;
+          xfree (r);
+        }
+      xfree (pf->entries[i].name);
+    }
+  xfree (pf);
+}
+
+
+/* Return true if the search descriptions A and B are equal.  */
+static int
+same_search_desc (KEYDB_SEARCH_DESC *a, KEYDB_SEARCH_DESC *b)
+{
+  if (a->mode != b->mode)
+    return 0;
+
+  switch (a->mode)
+    {
+    case KEYDB_SEARCH_MODE_SHORT_KID:
+      return a->u.kid[1] == b->u.kid[1];
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      return a->u.kid[0] == b->u.kid[0] && a->u.kid[1] == b->u.kid[1];
+    case KEYDB_SEARCH_MODE_FPR:
+      return (a->fprlen == b->fprlen
+              && !memcmp (a->u.fpr, b->u.fpr, a->fprlen));
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      return !memcmp (a->u.grip, b->u.grip, KEYGRIP_LEN);
+    case KEYDB_SEARCH_MODE_UBID:
+      return !memcmp (a->u.ubid, b->u.ubid, UBID_LEN);
+    case KEYDB_SEARCH_MODE_FIRST:
+    case KEYDB_SEARCH_MODE_NEXT:
+      return 0;
+    default:
+      return (a->u.name && b->u.name && !strcmp (a->u.name, b->u.name));
+    }
+}
+
+
+/* Communication object for a batched search.  */
+struct prefetch_parm_s
+{
+  assuan_context_t ctx;
+  membuf_t patterns;   /* The LF delimited patterns.  */
+
+  /* The parsed PUBKEY_INFO lines.  */
+  struct {
+    unsigned char ubid[UBID_LEN];
+    int uid_no;
+    int pk_no;
+    char *sigstatus;   /* From a SIGCACHE status line or NULL.  */
+  } *infos;
+  unsigned int ninfos;
+  unsigned int infossize;
+};
+
+
+/* Release the parsed PUBKEY_INFO lines of PARM.  */
+static void
+release_prefetch_infos (struct prefetch_parm_s *parm)
+{
+  unsigned int n;
+
+  for (n = 0; n < parm->ninfos; n++)
+    xfree (parm->infos[n].sigstatus);
+  xfree (parm->infos);
+  parm->infos = NULL;
+  parm->ninfos = parm->infossize = 0;
+}
+
+
+/* Create a result object for the keyblock (DATA,DATALEN) described by
+ * the Nth PUBKEY_INFO line of PARM.  Returns NULL on malloc
+ * failure.  */
+static struct prefetch_result_s *
+new_prefetch_result (struct prefetch_parm_s *parm, unsigned int n,
+                     const char *data, size_t datalen)
+{
+  struct prefetch_result_s *r;
+  const char *sigstatus = parm->infos[n].sigstatus;
+  size_t sslen = sigstatus? strlen (sigstatus) + 1 : 0;
+
+  r = xtrymalloc (sizeof *r + datalen + sslen);
+  if (!r)
+    return NULL;
+  r->next = NULL;
+  memcpy (r->ubid, parm->infos[n].ubid, UBID_LEN);
+  r->uid_no = parm->infos[n].uid_no;
+  r->pk_no = parm->infos[n].pk_no;
+  r->datalen = datalen;
+  memcpy (r->data, data, datalen);
+  if (sslen)
+    {
+      r->sigstatus = r->data + datalen;
+      memcpy (r->sigstatus, sigstatus, sslen);
+    }
+  else
+    r->sigstatus = NULL;
+  return r;
+}
+
+
+/* Handle the inquiries from the SEARCH --batch command.  */
+static gpg_error_t
+prefetch_inq_cb (void *opaque, const char *line)
+{
+  struct prefetch_parm_s *parm = opaque;
+  const void *data;
+  size_t datalen;
+
+  if (!has_leading_keyword (line, "PATTERNS"))
+    return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+
+  data = peek_membuf (&parm->patterns, &datalen);
+  if (!data)
+    return gpg_error_from_syserror ();
+  return assuan_send_data (parm->ctx, data, datalen);
+}
+
+
+/* Status callback for SEARCH --batch.  */
+static gpg_error_t
+prefetch_status_cb (void *opaque, const char *line)
+{
+  struct prefetch_parm_s *parm = opaque;
+  gpg_error_t err;
+  const char *s;
+  void *tmp;
+
+  if ((s = has_leading_keyword (line, "SIGCACHE")))
+    {
+      /* The status belongs to the keyblock of the last PUBKEY_INFO.  */
+      if (parm->ninfos && !parm->infos[parm->ninfos-1].sigstatus)
+        parm->infos[parm->ninfos-1].sigstatus = xtrystrdup (s);
+      return 0;
+    }
+  if (!(s = has_leading_keyword (line, "PUBKEY_INFO")))
+    return keydb_default_status_cb (opaque, line);
+
+  if (parm->ninfos == parm->infossize)
+    {
+      parm->infossize += 64;
+      tmp = xtryrealloc (parm->infos, parm->infossize * sizeof *parm->infos);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      parm->infos = tmp;
+    }
+  parm->infos[parm->ninfos].sigstatus = NULL;
+  err = parse_pubkey_info (s, parm->infos[parm->ninfos].ubid,
+                           &parm->infos[parm->ninfos].uid_no,
+                           &parm->infos[parm->ninfos].pk_no);
+  if (!err)
+    parm->ninfos++;
+  return err;
+}
+
+
+/* Search the keyboxd for all (DESC,NDESC) using one batched request
+ * and keep the results in CTRL so that subsequent calls to
+ * keydb_search with one of these descriptions are answered without
+ * asking the keyboxd again.  This is useful if a caller knows that it
+ * will look up many keys, for example the keys of all recipients.
+ * The results are kept until keydb_prefetch_release is called or the
+ * database is modified.  Errors are not fatal because keydb_search
+ * falls back to asking the keyboxd.  Nothing is done without
+ * --use-keyboxd.  */
+gpg_error_t
+keydb_prefetch (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, size_t ndesc)
+{
+  gpg_error_t err;
+  KEYDB_HANDLE hd = NULL;
+  struct prefetch_parm_s parm;
+  keydb_prefetch_t pf = NULL;
+  struct prefetch_result_s *r, **tail;
+  char pattern[ASSUAN_LINELENGTH];
+  char *buffer = NULL;
+  size_t len, off, reclen;
+  unsigned int i, n, idx;
+
+  memset (&parm, 0, sizeof parm);
+  init_membuf (&parm.patterns, 1024);
+
+  keydb_prefetch_release (ctrl);
+  if (!opt.use_keyboxd || ndesc < 2)
+    {
+      err = 0;
+      goto leave;
+    }
+
+  if (DBG_CLOCK)
+    log_clock ("%s enter", __func__);
+
+  pf = xtrycalloc (1, sizeof *pf + (ndesc - 1) * sizeof *pf->entries);
+  if (!pf)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  pf->serial = ++prefetch_serial;
+
+  /* Build the list of patterns.  Descriptions which can't be
+   * expressed as a pattern are skipped; keydb_search will ask the
+   * keyboxd for them.  */
+  for (i = 0; i < ndesc; i++)
+    {
+      if (desc[i].mode == KEYDB_SEARCH_MODE_FIRST
+          || desc[i].mode == KEYDB_SEARCH_MODE_NEXT
+          || format_search_pattern (desc + i, pattern, sizeof pattern)
+          || strchr (pattern, '\n'))
+        continue;
+
+      n = pf->nentries;
+      pf->entries[n].desc = desc[i];
+      pf->entries[n].desc.skipfnc = NULL;
+      pf->entries[n].desc.skipfncvalue = NULL;
+      pf->entries[n].desc.sn = NULL;
+      pf->entries[n].desc.snlen = 0;
+      if (desc[i].name_used)
+        {
+          pf->entries[n].name = xtrystrdup (desc[i].u.name);
+          if (!pf->entries[n].name)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          pf->entries[n].desc.u.name = pf->entries[n].name;
+        }
+      pf->nentries++;
+      put_membuf_str (&parm.patterns, pattern);
+      put_membuf (&parm.patterns, "\n", 1);
+    }
+  if (pf->nentries < 2)
+    {
+      err = 0;
+      goto leave;
+    }
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  parm.ctx = hd->kbl->ctx;
+  err = kbx_client_data_cmd_inq (hd->kbl->kcd, "SEARCH --openpgp --batch",
+                                 prefetch_inq_cb, &parm,
+                                 prefetch_status_cb, &parm);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      /* Nothing found at all - keep the empty result lists.  */
+      err = 0;
+      goto store;
+    }
+  if (!err)
+    err = kbx_client_data_wait (hd->kbl->kcd, &buffer, &len);
+  if (err)
+    goto leave;
+
+  /* Distribute the records to the entries.  */
+  for (off = 0, n = 0; off < len; off += 8 + reclen, n++)
+    {
+      if (len - off < 8)
+        {
+          err = gpg_error (GPG_ERR_INV_RESPONSE);
+          goto leave;
+        }
+      idx = buf32_to_uint (buffer + off);
+      reclen = buf32_to_size_t (buffer + off + 4);
+      if (idx >= pf->nentries || reclen > len - off - 8 || n >= parm.ninfos)
+        {
+          err = gpg_error (GPG_ERR_INV_RESPONSE);
+          goto leave;
+        }
+      r = new_prefetch_result (&parm, n, buffer + off + 8, reclen);
+      if (!r)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      for (tail = &pf->entries[idx].results; *tail; tail = &(*tail)->next)
+        ;
+      *tail = r;
+    }
+
+ store:
+  if (DBG_KEYDB)
+    log_debug ("%s: prefetched %u patterns\n", __func__, pf->nentries);
+  ctrl->keydb_prefetch = pf;
+  pf = NULL;
+
+ leave:
+  if (pf)
+    {
+      /* Use the release function to free the partial object.  */
+      ctrl->keydb_prefetch = pf;
+      keydb_prefetch_release (ctrl);
+    }
+  if (err)
+    log_info ("batched key lookup failed: %s\n", gpg_strerror (err));
+  keydb_release (hd);
+  xfree (buffer);
+  release_prefetch_infos (&parm);
+  xfree (get_membuf (&parm.patterns, NULL));
+  if (DBG_CLOCK)
+    log_clock ("%s leave", __func__);
+  return err;
+}
+
+
+/* Try to find DESC in the prefetched results and on success prepare
+ * HD to return them.  Returns true on success.  */
+static int
+use_prefetched (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc)
+{
+  keydb_prefetch_t pf = hd->ctrl->keydb_prefetch;
+  unsigned int i;
+
+  if (!pf)
+    return 0;
+
+  for (i = 0; i < pf->nentries; i++)
+    if (same_search_desc (&pf->entries[i].desc, desc))
+      {
+        hd->pf_valid = 1;
+        hd->pf_serial = pf->serial;
+        hd->pf_entry = i;
+        hd->pf_next = 0;
+        return 1;
+      }
+  return 0;
+}
+
+
+/* Return the next prefetched result for HD.  */
+static gpg_error_t
+next_prefetched (KEYDB_HANDLE hd)
+{
+  keydb_prefetch_t pf = hd->ctrl->keydb_prefetch;
+  struct prefetch_result_s *r;
+  unsigned int n;
+
+  hd->last_ubid_valid = 0;
+  hd->sigcache_pending = 0;
+  if (!pf || pf->serial != hd->pf_serial)
+    return gpg_error (GPG_ERR_NOT_FOUND);  /* Database has been modified.  */
+
+  for (n = 0, r = pf->entries[hd->pf_entry].results;
+       r && n < hd->pf_next; r = r->next, n++)
+    ;
+  if (!r)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  hd->pf_next++;
+
+  hd->kbl->search_result = iobuf_temp_with_content (r->data, r->datalen);
+  memcpy (hd->last_ubid, r->ubid, UBID_LEN);
+  hd->last_uid_no = r->uid_no;
+  hd->last_pk_no = r->pk_no;
+  hd->last_ubid_valid = 1;
+  set_last_sigstatus (hd, r->sigstatus);
+  if (DBG_KEYDB)
+    log_printhex (hd->last_ubid, 20, "prefetched UBID (%d,%d):",
+                  hd->last_uid_no, hd->last_pk_no);
+  return 0;
+}
+
+
+/* Get the next results of the current search from the keyboxd using
+ * the NEXT --batch command.  */
+static gpg_error_t
+fetch_stream (KEYDB_HANDLE hd)
+{
+  gpg_error_t err;
+  keyboxd_local_t kbl = hd->kbl;
+  struct prefetch_parm_s parm;
+  struct prefetch_result_s *r, **tail;
+  char line[ASSUAN_LINELENGTH];
+  char *buffer = NULL;
+  size_t len, off, reclen;
+  unsigned int n;
+
+  memset (&parm, 0, sizeof parm);
+  snprintf (line, sizeof line, "NEXT --batch=%u", kbl->stream_batch);
+  err = kbx_client_data_cmd (kbl->kcd, line, prefetch_status_cb, &parm);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      kbl->stream_eof = 1;
+      err = 0;
+      goto leave;
+    }
+  if (!err)
+    err = kbx_client_data_wait (kbl->kcd, &buffer, &len);
+  if (err)
+    goto leave;
+
+  if (kbl->stream_batch < STREAM_BATCH_MAX)
+    kbl->stream_batch *= 2;
+
+  for (tail = &kbl->stream; *tail; tail = &(*tail)->next)
+    ;
+  for (off = 0, n = 0; off < len; off += reclen, n++)
+    {
+      /* A keyboxd not supporting --batch ignores the option and sends
+       * a plain keyblock.  Such a keyblock never starts with a zero
+       * byte but our records do because the index is always 0.  */
+      if (!off && buffer[0])
+        reclen = len;
+      else if (len - off < 8 || buf32_to_uint (buffer + off))
+        {
+          err = gpg_error (GPG_ERR_INV_RESPONSE);
+          goto leave;
+        }
       else
         {
-          hd->last_ubid_valid = 0;
-          while (*s && !spacep (s))
-            s++;
-          if (!(n=hex2fixedbuf (s, hd->last_ubid, sizeof hd->last_ubid)))
-            err = gpg_error (GPG_ERR_INV_VALUE);
-          else
+          reclen = buf32_to_size_t (buffer + off + 4);
+          off += 8;
+          if (reclen > len - off)
             {
-              hd->last_ubid_valid = 1;
-              hd->last_uid_no = 0;
-              hd->last_pk_no = 0;
-              s += n;
-              while (*s && !spacep (s))
-                s++;
-              while (spacep (s))
-                s++;
-              if (*s)
-                {
-                  hd->last_uid_no = atoi (s);
-                  while (*s && !spacep (s))
-                    s++;
-                  while (spacep (s))
-                    s++;
-                  if (*s)
-                    hd->last_pk_no = atoi (s);
-                }
+              err = gpg_error (GPG_ERR_INV_RESPONSE);
+              goto leave;
             }
         }
+      if (n >= parm.ninfos)
+        {
+          err = gpg_error (GPG_ERR_INV_RESPONSE);
+          goto leave;
+        }
+      r = new_prefetch_result (&parm, n, buffer + off, reclen);
+      if (!r)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      *tail = r;
+      tail = &r->next;
     }
-  else
-    err = keydb_default_status_cb (opaque, line);
 
+ leave:
+  xfree (buffer);
+  release_prefetch_infos (&parm);
   return err;
 }
 
 
+/* Return the next result of a search using NEXT --batch.  */
+static gpg_error_t
+next_streamed (KEYDB_HANDLE hd)
+{
+  gpg_error_t err;
+  struct prefetch_result_s *r;
+
+  hd->last_ubid_valid = 0;
+  hd->sigcache_pending = 0;
+  if (!hd->kbl->stream && !hd->kbl->stream_eof)
+    {
+      err = fetch_stream (hd);
+      if (err)
+        return err;
+    }
+  r = hd->kbl->stream;
+  if (!r)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  hd->kbl->stream = r->next;
+
+  hd->kbl->search_result = iobuf_temp_with_content (r->data, r->datalen);
+  memcpy (hd->last_ubid, r->ubid, UBID_LEN);
+  hd->last_uid_no = r->uid_no;
+  hd->last_pk_no = r->pk_no;
+  hd->last_ubid_valid = 1;
+  set_last_sigstatus (hd, r->sigstatus);
+  xfree (r);
+  if (DBG_KEYDB)
+    log_printhex (hd->last_ubid, 20, "streamed UBID (%d,%d):",
+                  hd->last_uid_no, hd->last_pk_no);
+  return 0;
+}
+
+
 /* Search the database for keys matching the search description.  If
  * the DB contains any legacy keys, these are silently ignored.
  *
@@ -707,6 +1574,7 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   char line[ASSUAN_LINELENGTH];
   char *buffer;
   size_t len;
+  int list_all = 0;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
@@ -741,6 +1609,20 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       hd->kbl->search_result = NULL;
     }
 
+  /* Check whether the results have already been fetched.  */
+  if (hd->kbl->need_search_reset)
+    {
+      release_stream (hd->kbl);
+      hd->pf_valid = 0;
+      if (ndesc == 1 && use_prefetched (hd, desc))
+        hd->kbl->need_search_reset = 0;
+    }
+  if (hd->pf_valid)
+    {
+      err = next_prefetched (hd);
+      goto leave;
+    }
+
   /* Check whether this is a NEXT search.  */
   if (!hd->kbl->need_search_reset)
     {
@@ -751,6 +1633,11 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
        * search pattern between searches but that is not anymore
        * supported by keyboxd and a cursory check does not show that
        * we actually made used of that misfeature.  */
+      if (hd->kbl->stream_batch)
+        {
+          err = next_streamed (hd);
+          goto leave;
+        }
       snprintf (line, sizeof line, "NEXT");
       goto do_search;
     }
@@ -766,101 +1653,33 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
     if (desc->mode == KEYDB_SEARCH_MODE_FIRST)
       {
         /* If any description has mode FIRST, this item trumps all
-         * other descriptions.  */
+         * other descriptions.  Because the caller will likely walk
+         * over all keys, the following results are fetched in
+         * batches.  */
         snprintf (line, sizeof line, "SEARCH --openpgp");
+        list_all = 1;
         goto do_search;
       }
 
   for ( ; ndesc; desc++, ndesc--)
     {
       const char *more = ndesc > 1 ? "--openpgp --more" : "--openpgp";
+      char pattern[ASSUAN_LINELENGTH];
 
-      switch (desc->mode)
+      if (desc->mode == KEYDB_SEARCH_MODE_NEXT)
         {
-        case KEYDB_SEARCH_MODE_EXACT:
-          snprintf (line, sizeof line, "SEARCH %s -- =%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_SUBSTR:
-          snprintf (line, sizeof line, "SEARCH %s -- *%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_MAIL:
-          snprintf (line, sizeof line, "SEARCH %s -- <%s",
-                    more, desc->u.name+(desc->u.name[0] == '<') );
-          break;
-
-        case KEYDB_SEARCH_MODE_MAILSUB:
-          snprintf (line, sizeof line, "SEARCH %s -- @%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_MAILEND:
-          snprintf (line, sizeof line, "SEARCH %s -- .%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_WORDS:
-          snprintf (line, sizeof line, "SEARCH %s -- +%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_SHORT_KID:
-          snprintf (line, sizeof line, "SEARCH %s -- 0x%08lX", more,
-                    (ulong)desc->u.kid[1]);
-          break;
-
-        case KEYDB_SEARCH_MODE_LONG_KID:
-          snprintf (line, sizeof line, "SEARCH %s -- 0x%08lX%08lX", more,
-                    (ulong)desc->u.kid[0], (ulong)desc->u.kid[1]);
-          break;
-
-        case KEYDB_SEARCH_MODE_FPR:
-          {
-            unsigned char hexfpr[MAX_FINGERPRINT_LEN * 2 + 1];
-            log_assert (desc->fprlen <= MAX_FINGERPRINT_LEN);
-            bin2hex (desc->u.fpr, desc->fprlen, hexfpr);
-            snprintf (line, sizeof line, "SEARCH %s -- 0x%s", more, hexfpr);
-          }
-          break;
-
-        case KEYDB_SEARCH_MODE_ISSUER:
-          snprintf (line, sizeof line, "SEARCH %s -- #/%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_ISSUER_SN:
-        case KEYDB_SEARCH_MODE_SN:
-          snprintf (line, sizeof line, "SEARCH %s -- #%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_SUBJECT:
-          snprintf (line, sizeof line, "SEARCH %s -- /%s", more, desc->u.name);
-          break;
-
-        case KEYDB_SEARCH_MODE_KEYGRIP:
-          {
-            unsigned char hexgrip[KEYGRIP_LEN * 2 + 1];
-            bin2hex (desc->u.grip, KEYGRIP_LEN, hexgrip);
-            snprintf (line, sizeof line, "SEARCH %s -- &%s", more, hexgrip);
-          }
-          break;
-
-        case KEYDB_SEARCH_MODE_UBID:
-          {
-            unsigned char hexubid[UBID_LEN * 2 + 1];
-            bin2hex (desc->u.ubid, UBID_LEN, hexubid);
-            snprintf (line, sizeof line, "SEARCH %s -- ^%s", more, hexubid);
-          }
-          break;
-
-        case KEYDB_SEARCH_MODE_NEXT:
           log_debug ("%s: mode next - we should not get to here!\n", __func__);
           snprintf (line, sizeof line, "NEXT");
-          break;
-
-        case KEYDB_SEARCH_MODE_FIRST:
-          log_debug ("%s: mode first - we should not get to here!\n", __func__);
-          /*fallthru*/
-        default:
-          err = gpg_error (GPG_ERR_INV_ARG);
-          goto leave;
+        }
+      else
+        {
+          if (desc->mode == KEYDB_SEARCH_MODE_FIRST)
+            log_debug ("%s: mode first - we should not get to here!\n",
+                       __func__);
+          err = format_search_pattern (desc, pattern, sizeof pattern);
+          if (err)
+            goto leave;
+          snprintf (line, sizeof line, "SEARCH %s -- %s", more, pattern);
         }
 
       if (ndesc > 1)
@@ -875,6 +1694,7 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 
  do_search:
   hd->last_ubid_valid = 0;
+  hd->sigcache_pending = 0;
   err = kbx_client_data_cmd (hd->kbl->kcd, line, search_status_cb, hd);
   if (!err && !(err = kbx_client_data_wait (hd->kbl->kcd, &buffer, &len)))
     {
@@ -883,6 +1703,8 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       if (DBG_KEYDB && hd->last_ubid_valid)
         log_printhex (hd->last_ubid, 20, "found UBID (%d,%d):",
                       hd->last_uid_no, hd->last_pk_no);
+      if (list_all)
+        hd->kbl->stream_batch = STREAM_BATCH_MIN;
     }
 
  leave:
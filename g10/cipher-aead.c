@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/status.h"
@@ -38,6 +39,71 @@
  * be a multiple of the OCB blocksize (16 byte).  */
 #define AEAD_ENC_BUFFER_SIZE (64*1024)
 
+/* The largest chunk size we encrypt using worker threads.  Each job
+ * slot needs a buffer of this size.  */
+#define AEAD_PAR_MAX_CHUNKSIZE (16*1024*1024)
+
+
+/* Multi-threaded encryption.
+ *
+ * With --aead-threads the plaintext is collected into buffers holding
+ * a full chunk.  The complete chunks are put into a ring of job slots
+ * from which a set of worker threads takes them for encryption.  Each
+ * worker uses its own cipher handle; the nonce of a chunk depends
+ * only on its index and thus the chunks can be processed in any
+ * order.  The filter itself writes the encrypted chunks and their
+ * tags in the order of their index.  The ring has room for two jobs
+ * per thread; if it is full the filter waits for the oldest job.  */
+
+enum aead_job_states
+  {
+    AEAD_JOB_FREE = 0,  /* The slot is unused or being filled.  */
+    AEAD_JOB_QUEUED,    /* Waiting for a worker.                */
+    AEAD_JOB_BUSY,      /* A worker is encrypting it.           */
+    AEAD_JOB_DONE       /* Encrypted; ready to be written.      */
+  };
+
+struct aead_job_s
+{
+  enum aead_job_states state;
+  uint64_t chunkindex;
+  byte *buffer;       /* Buffer with room for a full chunk.  */
+  size_t buflen;      /* Used length of BUFFER.              */
+  byte tag[16];       /* The computed authentication tag.    */
+  gpg_error_t err;    /* Error code from the worker.         */
+};
+
+struct aead_worker_s
+{
+  struct aead_par_s *par;
+  gcry_cipher_hd_t hd;
+  npth_t thread;
+};
+
+struct aead_par_s
+{
+  cipher_filter_context_t *cfx;   /* Back pointer.  */
+  enum gcry_cipher_modes ciphermode;
+
+  npth_mutex_t lock;
+  npth_cond_t  cond;        /* Signaled on each job state change.  */
+  unsigned int stop : 1;    /* Request to terminate the workers.  */
+
+  int maxworkers;           /* Requested number of threads.  */
+  int nworkers;             /* Number of running threads.    */
+  struct aead_worker_s *workers;
+
+  int nslots;
+  struct aead_job_s *slots;
+  struct aead_job_s *cur;   /* The job being filled or NULL.  */
+  uint64_t nsubmitted;      /* Number of jobs handed to the workers.  */
+  uint64_t npicked;         /* Number of jobs taken by the workers.   */
+  uint64_t nwritten;        /* Number of jobs written out.            */
+};
+
+static gpg_error_t par_new (cipher_filter_context_t *cfx,
+                            enum gcry_cipher_modes ciphermode);
+
 
 /* Wrapper around iobuf_write to make sure that a proper error code is
  * always returned.  */
@@ -55,12 +121,29 @@ my_iobuf_write (iobuf_t a, const void *buffer, size_t buflen)
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  If
- * FINAL is set the final AEAD chunk is processed.  This also reset
- * the encryption machinery so that the handle can be used for a new
- * chunk.  */
+/* Same as my_iobuf_write but allows the next filters to modify
+ * BUFFER in place.  */
 static gpg_error_t
-set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
+my_iobuf_write_lent (iobuf_t a, void *buffer, size_t buflen)
+{
+  if (iobuf_write_lent (a, buffer, buflen))
+    {
+      gpg_error_t err = iobuf_error (a);
+      if (!err || !gpg_err_code (err)) /* (The latter should never happen) */
+        err = gpg_error (GPG_ERR_EIO);
+      return err;
+    }
+  return 0;
+}
+
+
+/* Set the nonce and the additional data for chunk CHUNKINDEX using
+ * the cipher handle HD.  If FINAL is set the final AEAD chunk is
+ * processed.  This also reset the encryption machinery so that the
+ * handle can be used for a new chunk.  */
+static gpg_error_t
+set_nonce_and_ad_hd (cipher_filter_context_t *cfx, gcry_cipher_hd_t hd,
+                     uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char nonce[16];
@@ -83,18 +166,18 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
       BUG ();
     }
 
-  nonce[i++] ^= cfx->chunkindex >> 56;
-  nonce[i++] ^= cfx->chunkindex >> 48;
-  nonce[i++] ^= cfx->chunkindex >> 40;
-  nonce[i++] ^= cfx->chunkindex >> 32;
-  nonce[i++] ^= cfx->chunkindex >> 24;
-  nonce[i++] ^= cfx->chunkindex >> 16;
-  nonce[i++] ^= cfx->chunkindex >>  8;
-  nonce[i++] ^= cfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, 15, "nonce:");
-  err = gcry_cipher_setiv (cfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -103,14 +186,14 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
   ad[2] = cfx->dek->algo;
   ad[3] = cfx->dek->use_aead;
   ad[4] = cfx->chunkbyte;
-  ad[5] = cfx->chunkindex >> 56;
-  ad[6] = cfx->chunkindex >> 48;
-  ad[7] = cfx->chunkindex >> 40;
-  ad[8] = cfx->chunkindex >> 32;
-  ad[9] = cfx->chunkindex >> 24;
-  ad[10]= cfx->chunkindex >> 16;
-  ad[11]= cfx->chunkindex >>  8;
-  ad[12]= cfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = cfx->total >> 56;
@@ -124,7 +207,18 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (cfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
+}
+
+
+/* Set the nonce and the additional data for the current chunk.  If
+ * FINAL is set the final AEAD chunk is processed.  This also reset
+ * the encryption machinery so that the handle can be used for a new
+ * chunk.  */
+static gpg_error_t
+set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
+{
+  return set_nonce_and_ad_hd (cfx, cfx->cipher_hd, cfx->chunkindex, final);
 }
 
 
@@ -198,6 +292,13 @@ write_header (cipher_filter_context_t *cfx, iobuf_t a)
   if (err)
     return err;
 
+  if (opt.aead_threads > 1 && cfx->chunksize <= AEAD_PAR_MAX_CHUNKSIZE)
+    {
+      err = par_new (cfx, ciphermode);
+      if (err)
+        goto leave;
+    }
+
   cfx->wrote_header = 1;
 
  leave:
@@ -251,14 +352,392 @@ write_final_chunk (cipher_filter_context_t *cfx, iobuf_t a)
 }
 
 
-/* The core of the flush sub-function of cipher_filter_aead.   */
+static void
+lock_par (struct aead_par_s *par)
+{
+  int rc = npth_mutex_lock (&par->lock);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_par (struct aead_par_s *par)
+{
+  int rc = npth_mutex_unlock (&par->lock);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* The thread function of an AEAD worker.  */
+static void *
+aead_worker (void *arg)
+{
+  struct aead_worker_s *w = arg;
+  struct aead_par_s *par = w->par;
+  struct aead_job_s *job;
+  gpg_error_t err;
+
+  lock_par (par);
+  for (;;)
+    {
+      while (!par->stop && par->npicked == par->nsubmitted)
+        npth_cond_wait (&par->cond, &par->lock);
+      if (par->stop)
+        break;
+
+      job = par->slots + (par->npicked % par->nslots);
+      log_assert (job->state == AEAD_JOB_QUEUED);
+      job->state = AEAD_JOB_BUSY;
+      par->npicked++;
+      unlock_par (par);
+
+      err = set_nonce_and_ad_hd (par->cfx, w->hd, job->chunkindex, 0);
+      if (!err)
+        {
+          npth_unprotect ();
+          gcry_cipher_final (w->hd);
+          err = gcry_cipher_encrypt (w->hd, job->buffer, job->buflen,
+                                     NULL, 0);
+          if (!err)
+            err = gcry_cipher_gettag (w->hd, job->tag, 16);
+          npth_protect ();
+        }
+
+      lock_par (par);
+      job->err = err;
+      job->state = AEAD_JOB_DONE;
+      npth_cond_broadcast (&par->cond);
+    }
+  unlock_par (par);
+
+  return NULL;
+}
+
+
+/* Allocate the state for multi-threaded encryption.  The threads are
+ * started only when the first complete chunk is available.  */
+static gpg_error_t
+par_new (cipher_filter_context_t *cfx, enum gcry_cipher_modes ciphermode)
+{
+  struct aead_par_s *par;
+  int rc;
+
+  par = xtrycalloc (1, sizeof *par);
+  if (!par)
+    return gpg_error_from_syserror ();
+  par->cfx = cfx;
+  par->ciphermode = ciphermode;
+  par->maxworkers = opt.aead_threads;
+  par->nslots = 2 * par->maxworkers;
+  par->workers = xtrycalloc (par->maxworkers, sizeof *par->workers);
+  par->slots = xtrycalloc (par->nslots, sizeof *par->slots);
+  if (!par->workers || !par->slots)
+    {
+      gpg_error_t err = gpg_error_from_syserror ();
+      xfree (par->workers);
+      xfree (par->slots);
+      xfree (par);
+      return err;
+    }
+
+  rc = npth_mutex_init (&par->lock, NULL);
+  if (!rc)
+    {
+      rc = npth_cond_init (&par->cond, NULL);
+      if (rc)
+        npth_mutex_destroy (&par->lock);
+    }
+  if (rc)
+    {
+      xfree (par->workers);
+      xfree (par->slots);
+      xfree (par);
+      return gpg_error_from_errno (rc);
+    }
+
+  if (DBG_FILTER)
+    log_debug ("using up to %d threads for AEAD encryption\n",
+               par->maxworkers);
+  cfx->par = par;
+  return 0;
+}
+
+
+/* Start the worker threads.  It is not an error if only some of the
+ * threads could be started.  */
 static gpg_error_t
-do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
+par_start_workers (cipher_filter_context_t *cfx)
+{
+  struct aead_par_s *par = cfx->par;
+  struct aead_worker_s *w;
+  gpg_error_t err = 0;
+  npth_attr_t tattr;
+  int rc;
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    return gpg_error_from_errno (rc);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+
+  while (par->nworkers < par->maxworkers)
+    {
+      w = par->workers + par->nworkers;
+      w->par = par;
+      err = openpgp_cipher_open (&w->hd, cfx->dek->algo, par->ciphermode,
+                                 GCRY_CIPHER_SECURE);
+      if (!err)
+        err = gcry_cipher_setkey (w->hd, cfx->dek->key, cfx->dek->keylen);
+      if (!err)
+        {
+          rc = npth_create (&w->thread, &tattr, aead_worker, w);
+          if (rc)
+            err = gpg_error_from_errno (rc);
+        }
+      if (err)
+        {
+          gcry_cipher_close (w->hd);
+          w->hd = NULL;
+          break;
+        }
+      par->nworkers++;
+    }
+  npth_attr_destroy (&tattr);
+
+  if (err && par->nworkers)
+    {
+      log_info ("only %d of %d AEAD threads started: %s\n",
+                par->nworkers, par->maxworkers, gpg_strerror (err));
+      err = 0;
+    }
+  return err;
+}
+
+
+/* Stop the worker threads and release the multi-threaded state.  */
+static void
+par_release (cipher_filter_context_t *cfx)
+{
+  struct aead_par_s *par = cfx->par;
+  int i;
+
+  if (!par)
+    return;
+
+  lock_par (par);
+  par->stop = 1;
+  npth_cond_broadcast (&par->cond);
+  unlock_par (par);
+
+  for (i=0; i < par->nworkers; i++)
+    {
+      npth_join (par->workers[i].thread, NULL);
+      gcry_cipher_close (par->workers[i].hd);
+    }
+  for (i=0; i < par->nslots; i++)
+    if (par->slots[i].buffer)
+      {
+        /* The buffer may still hold plaintext.  */
+        wipememory (par->slots[i].buffer, cfx->chunksize);
+        xfree (par->slots[i].buffer);
+      }
+
+  npth_cond_destroy (&par->cond);
+  npth_mutex_destroy (&par->lock);
+  xfree (par->workers);
+  xfree (par->slots);
+  xfree (par);
+  cfx->par = NULL;
+}
+
+
+/* Hand the current job over to the workers.  */
+static gpg_error_t
+par_submit (cipher_filter_context_t *cfx)
+{
+  struct aead_par_s *par = cfx->par;
+  struct aead_job_s *job = par->cur;
+  gpg_error_t err;
+
+  if (!par->nworkers)
+    {
+      err = par_start_workers (cfx);
+      if (err)
+        return err;
+    }
+
+  if (DBG_FILTER)
+    log_debug ("submitting chunk %ju with %zu bytes\n",
+               (uintmax_t)cfx->chunkindex, job->buflen);
+
+  lock_par (par);
+  job->chunkindex = cfx->chunkindex++;
+  job->err = 0;
+  job->state = AEAD_JOB_QUEUED;
+  par->nsubmitted++;
+  par->cur = NULL;
+  npth_cond_broadcast (&par->cond);
+  unlock_par (par);
+
+  cfx->total += job->buflen;
+  return 0;
+}
+
+
+/* Write the encrypted chunks and their tags to stream A in the order
+ * of their index.  If ALL is set all submitted jobs are written;
+ * otherwise only jobs which are already done are written but we wait
+ * until there is a free slot.  */
+static gpg_error_t
+par_write_jobs (cipher_filter_context_t *cfx, iobuf_t a, int all)
+{
+  struct aead_par_s *par = cfx->par;
+  struct aead_job_s *job;
+  gpg_error_t err = 0;
+
+  lock_par (par);
+  while (par->nwritten < par->nsubmitted)
+    {
+      job = par->slots + (par->nwritten % par->nslots);
+      if (job->state != AEAD_JOB_DONE)
+        {
+          if (!all && par->nsubmitted - par->nwritten < par->nslots)
+            break;  /* We have a free slot.  */
+          npth_cond_wait (&par->cond, &par->lock);
+          continue;
+        }
+      unlock_par (par);
+
+      /* A done job is not touched by the workers, thus we may write
+       * it without holding the lock.  */
+      err = job->err;
+      if (!err)
+        err = my_iobuf_write_lent (a, job->buffer, job->buflen);
+      if (!err)
+        err = my_iobuf_write (a, job->tag, 16);
+
+      lock_par (par);
+      job->state = AEAD_JOB_FREE;
+      par->nwritten++;
+      if (err)
+        break;
+    }
+  unlock_par (par);
+
+  if (err)
+    log_error ("writing AEAD chunk failed: %s\n", gpg_strerror (err));
+  return err;
+}
+
+
+/* The flush sub-function for multi-threaded encryption.  */
+static gpg_error_t
+par_do_flush (cipher_filter_context_t *cfx, iobuf_t a,
+              const byte *buf, size_t size)
+{
+  struct aead_par_s *par = cfx->par;
+  struct aead_job_s *job;
+  gpg_error_t err;
+  size_t n;
+
+  while (size)
+    {
+      if (!par->cur)
+        {
+          err = par_write_jobs (cfx, a, 0);
+          if (err)
+            return err;
+          job = par->slots + (par->nsubmitted % par->nslots);
+          log_assert (job->state == AEAD_JOB_FREE);
+          if (!job->buffer)
+            {
+              job->buffer = xtrymalloc (cfx->chunksize);
+              if (!job->buffer)
+                return gpg_error_from_syserror ();
+            }
+          job->buflen = 0;
+          par->cur = job;
+        }
+
+      job = par->cur;
+      n = cfx->chunksize - job->buflen;
+      if (n > size)
+        n = size;
+      memcpy (job->buffer + job->buflen, buf, n);
+      job->buflen += n;
+      buf  += n;
+      size -= n;
+
+      if (job->buflen == cfx->chunksize)
+        {
+          err = par_submit (cfx);
+          if (err)
+            return err;
+        }
+    }
+
+  return 0;
+}
+
+
+/* Encrypt and write the last data chunk and all pending jobs for
+ * multi-threaded encryption.  */
+static gpg_error_t
+par_finish (cipher_filter_context_t *cfx, iobuf_t a)
+{
+  struct aead_par_s *par = cfx->par;
+  struct aead_job_s *job = par->cur;
+  gpg_error_t err;
+
+  if (job && !par->nworkers)
+    {
+      /* All data fits into one chunk; no need to start threads.  */
+      par->cur = NULL;
+      err = set_nonce_and_ad (cfx, 0);
+      if (err)
+        return err;
+      gcry_cipher_final (cfx->cipher_hd);
+      err = gcry_cipher_encrypt (cfx->cipher_hd, job->buffer, job->buflen,
+                                 NULL, 0);
+      if (!err)
+        err = my_iobuf_write (a, job->buffer, job->buflen);
+      if (err)
+        return err;
+      cfx->total += job->buflen;
+      err = write_auth_tag (cfx, a);
+      if (err)
+        return err;
+      cfx->chunkindex++;
+      return 0;
+    }
+
+  if (job)
+    {
+      err = par_submit (cfx);
+      if (err)
+        return err;
+    }
+
+  return par_write_jobs (cfx, a, 1);
+}
+
+
+/* The core of the flush sub-function of cipher_filter_aead.  If LENT
+ * is set BUF has been lent to us and may be encrypted in place.  */
+static gpg_error_t
+do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size,
+          int lent)
 {
   gpg_error_t err = 0;
   int finalize = 0;
   size_t n;
 
+  if (cfx->par)
+    return par_do_flush (cfx, a, buf, size);
+
   /* Put the data into a buffer, flush and encrypt as needed.  */
   if (DBG_FILTER)
     log_debug ("flushing %zu bytes (cur buflen=%zu)\n", size, cfx->buflen);
@@ -266,6 +745,7 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
     {
       const unsigned fast_threshold = 512;
       const byte *src_buf = NULL;
+      byte *dst_buf = (byte *)cfx->buffer;
       int enc_now = 0;
 
       if (cfx->buflen + size < cfx->bufsize)
@@ -313,9 +793,13 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
       else if (cfx->buflen == 0 && n >= fast_threshold)
 	{
 	  /* Fast path for large input buffer. This avoids memcpy and
-	   * instead encrypts directly from input to cfx->buffer. */
+	   * instead encrypts directly from input to cfx->buffer.  If
+	   * the input buffer has been lent to us we encrypt it in place
+	   * and pass it on.  */
 	  log_assert (n % 16 == 0 || finalize);
 	  src_buf = buf;
+	  if (lent)
+	    dst_buf = buf;
 	  cfx->buflen = n;
 	  buf += n;
 	  size -= n;
@@ -361,13 +845,20 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
            * be called after gcry_cipher_final and before
            * gcry_cipher_gettag - at least with libgcrypt 1.8 and OCB
            * mode.  */
-	  err = gcry_cipher_encrypt (cfx->cipher_hd, cfx->buffer,
-				     cfx->buflen, src_buf, cfx->buflen);
+          if ((const byte *)dst_buf == src_buf)
+            err = gcry_cipher_encrypt (cfx->cipher_hd, dst_buf,
+                                       cfx->buflen, NULL, 0);
+          else
+            err = gcry_cipher_encrypt (cfx->cipher_hd, dst_buf,
+                                       cfx->buflen, src_buf, cfx->buflen);
           if (err)
             goto leave;
           if (finalize && DBG_FILTER)
-            log_printhex (cfx->buffer, cfx->buflen, "ciphr(1):");
-          err = my_iobuf_write (a, cfx->buffer, cfx->buflen);
+            log_printhex (dst_buf, cfx->buflen, "ciphr(1):");
+          if (dst_buf != (byte *)cfx->buffer)
+            err = my_iobuf_write_lent (a, dst_buf, cfx->buflen);
+          else
+            err = my_iobuf_write (a, dst_buf, cfx->buflen);
           if (err)
             goto leave;
           cfx->chunklen += cfx->buflen;
@@ -405,7 +896,13 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
   if (DBG_FILTER)
     log_debug ("do_free: buflen=%zu\n", cfx->buflen);
 
-  if (cfx->chunklen || cfx->buflen)
+  if (cfx->par)
+    {
+      err = par_finish (cfx, a);
+      if (err)
+        goto leave;
+    }
+  else if (cfx->chunklen || cfx->buflen)
     {
       if (DBG_FILTER)
         log_debug ("encrypting last %zu bytes of the last chunk\n",cfx->buflen);
@@ -448,6 +945,7 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
   err = write_final_chunk (cfx, a);
 
  leave:
+  par_release (cfx);
   xfree (cfx->buffer);
   cfx->buffer = NULL;
   gcry_cipher_close (cfx->cipher_hd);
@@ -471,12 +969,17 @@ cipher_filter_aead (void *opaque, int control,
     {
       rc = -1; /* not used */
     }
-  else if (control == IOBUFCTRL_FLUSH) /* encrypt */
+  else if (control == IOBUFCTRL_LEND && !buf)
+    {
+      *ret_len = 1;  /* We can encrypt lent buffers in place.  */
+    }
+  else if (control == IOBUFCTRL_FLUSH || control == IOBUFCTRL_LEND)
     {
+      /* Encrypt.  */
       if (!cfx->wrote_header && (rc=write_header (cfx, a)))
         ;
       else
-        rc = do_flush (cfx, a, buf, size);
+        rc = do_flush (cfx, a, buf, size, control == IOBUFCTRL_LEND);
     }
   else if (control == IOBUFCTRL_FREE)
     {
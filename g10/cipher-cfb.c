@@ -127,8 +127,13 @@ cipher_filter_cfb (void *opaque, int control,
     {
       rc = -1; /* not yet used */
     }
-  else if (control == IOBUFCTRL_FLUSH) /* encrypt */
+  else if (control == IOBUFCTRL_LEND && !buf)
     {
+      *ret_len = 1;  /* We can encrypt lent buffers in place.  */
+    }
+  else if (control == IOBUFCTRL_FLUSH || control == IOBUFCTRL_LEND)
+    {
+      /* Encrypt.  */
       log_assert (a);
       if (!cfx->wrote_header)
         write_header (cfx, a);
@@ -147,7 +152,10 @@ cipher_filter_cfb (void *opaque, int control,
             }
         }
 
-      rc = iobuf_write (a, buf, size);
+      if (control == IOBUFCTRL_LEND)
+        rc = iobuf_write_lent (a, buf, size);
+      else
+        rc = iobuf_write (a, buf, size);
     }
   else if (control == IOBUFCTRL_FREE)
     {
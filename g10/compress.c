@@ -33,6 +33,7 @@
 #ifdef HAVE_ZIP
 # include <zlib.h>
 #endif
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -40,8 +41,18 @@
 #include "filter.h"
 #include "main.h"
 #include "options.h"
+#include "../common/status.h"
 
 
+/* The number of bytes compress_probe tries to sample and the minimum
+ * number of bytes required to decide.  */
+#define PROBE_SAMPLE_SIZE (256*1024)
+#define PROBE_MIN_SIZE    4096
+
+/* If a sample does not compress to less than PROBE_MAX_RATIO per
+ * mille of its size we do not compress at all.  */
+#define PROBE_MAX_RATIO   950
+
 #ifdef __riscos__
 #define BYTEF_CAST(a) ((Bytef *)(a))
 #else
@@ -54,10 +65,10 @@ int compress_filter_bz2( void *opaque, int control,
 			 IOBUF a, byte *buf, size_t *ret_len);
 
 #ifdef HAVE_ZIP
-static void
-init_compress( compress_filter_context_t *zfx, z_stream *zs )
+/* Return the zlib compression level from the options.  */
+static int
+get_compress_level (void)
 {
-    int rc;
     int level;
 
     if( opt.compress_level >= 1 && opt.compress_level <= 9 )
@@ -68,6 +79,14 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
 	log_error("invalid compression level; using default level\n");
 	level = Z_DEFAULT_COMPRESSION;
     }
+    return level;
+}
+
+static void
+init_compress( compress_filter_context_t *zfx, z_stream *zs )
+{
+    int rc;
+    int level = get_compress_level ();
 
     if( (rc = zfx->algo == 1? deflateInit2( zs, level, Z_DEFLATED,
 					    -13, 8, Z_DEFAULT_STRATEGY)
@@ -220,6 +239,986 @@ do_uncompress( compress_filter_context_t *zfx, z_stream *zs,
     return rc;
 }
 
+/* Threaded operation.
+ *
+ * With --compress-threads the actual deflate or inflate is done by a
+ * separate thread so that it overlaps with the cipher work of the
+ * other filters.  The data is exchanged using two input buffers and
+ * two output buffers; the worker thread owns the z_stream and all
+ * iobuf operations are done by the filter itself.  */
+
+#define ZTHD_BUFSIZE 65536
+
+struct zthd_buffer_s
+{
+  byte *buf;
+  size_t len;             /* Used length.  */
+  size_t off;             /* Output only: Bytes already taken.  */
+  unsigned int full : 1;  /* The buffer is owned by the consumer.  */
+  unsigned int last : 1;  /* Input: No more data follows.
+                           * Output: End of the stream.  */
+};
+
+struct compress_thd_s
+{
+  int compress;  /* True for deflate, false for inflate.  */
+  z_stream *zs;
+  npth_t thd;
+  npth_mutex_t mutex;
+  npth_cond_t cond;
+  unsigned int stop : 1;
+  unsigned int in_eof : 1;      /* The last input buffer was sent.  */
+  unsigned int out_eof : 1;     /* The last output buffer was taken.  */
+  struct zthd_buffer_s in[2];
+  struct zthd_buffer_s out[2];
+  unsigned int in_fill;   /* Counter of input buffers filled.   */
+  unsigned int in_take;   /* Counter of input buffers consumed. */
+  unsigned int out_fill;  /* Counter of output buffers filled.  */
+  unsigned int out_take;  /* Counter of output buffers taken.   */
+  int zrc;                /* The zlib error code or Z_OK.  */
+  const char *zmsg;       /* The zlib error message or NULL.  */
+};
+
+
+static void
+lock_zthd (struct compress_thd_s *zt)
+{
+  int rc = npth_mutex_lock (&zt->mutex);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_zthd (struct compress_thd_s *zt)
+{
+  int rc = npth_mutex_unlock (&zt->mutex);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* The thread function which runs zlib.  */
+static void *
+zthd_worker (void *arg)
+{
+  struct compress_thd_s *zt = arg;
+  z_stream *zs = zt->zs;
+  struct zthd_buffer_s *in, *out;
+  int zrc, flush;
+  int end = 0;
+
+  lock_zthd (zt);
+  while (!end)
+    {
+      in = &zt->in[zt->in_take & 1];
+      while (!zt->stop && !in->full)
+        npth_cond_wait (&zt->cond, &zt->mutex);
+      if (zt->stop)
+        break;
+
+      zs->next_in = BYTEF_CAST (in->buf);
+      zs->avail_in = in->len;
+      if (!zt->compress)
+        flush = Z_SYNC_FLUSH;
+      else
+        flush = in->last? Z_FINISH : Z_NO_FLUSH;
+
+      for (;;)
+        {
+          out = &zt->out[zt->out_fill & 1];
+          while (!zt->stop && out->full)
+            npth_cond_wait (&zt->cond, &zt->mutex);
+          if (zt->stop)
+            goto leave;
+
+          zs->next_out = BYTEF_CAST (out->buf + out->len);
+          zs->avail_out = ZTHD_BUFSIZE - out->len;
+          unlock_zthd (zt);
+          npth_unprotect ();
+          zrc = zt->compress? deflate (zs, flush) : inflate (zs, flush);
+          npth_protect ();
+          lock_zthd (zt);
+          out->len = ZTHD_BUFSIZE - zs->avail_out;
+
+          if (zrc == Z_STREAM_END)
+            end = 1;
+          else if (zrc == Z_BUF_ERROR)
+            {
+              /* No progress possible.  For inflate this means that
+               * the input ended without an end of stream marker.  */
+              if (!zt->compress && in->last)
+                end = 1;
+            }
+          else if (zrc != Z_OK)
+            {
+              zt->zrc = zrc;
+              zt->zmsg = zs->msg;
+              end = 1;
+            }
+
+          /* Pass the output on if the buffer is full, at the end, or
+           * if all input has been consumed.  */
+          if (end || !zs->avail_out || (!zs->avail_in && out->len))
+            {
+              out->off = 0;
+              out->last = end;
+              out->full = 1;
+              zt->out_fill++;
+              npth_cond_broadcast (&zt->cond);
+            }
+          if (end)
+            break;
+          if (!zs->avail_out)
+            continue;  /* More output is pending.  */
+          if (zs->avail_in || (zt->compress && flush == Z_FINISH))
+            continue;  /* Not yet done with this input.  */
+          if (!zt->compress && in->last)
+            {
+              /* Input ended w/o an end of stream marker.  */
+              end = 1;
+              out = &zt->out[zt->out_fill & 1];
+              while (!zt->stop && out->full)
+                npth_cond_wait (&zt->cond, &zt->mutex);
+              if (zt->stop)
+                goto leave;
+              out->off = 0;
+              out->last = 1;
+              out->full = 1;
+              zt->out_fill++;
+              npth_cond_broadcast (&zt->cond);
+            }
+          break;
+        }
+
+      in->len = 0;
+      in->full = 0;
+      zt->in_take++;
+      npth_cond_broadcast (&zt->cond);
+    }
+
+ leave:
+  unlock_zthd (zt);
+  return NULL;
+}
+
+
+/* Create the thread state and start the worker thread for the stream
+ * ZS.  Returns NULL on error.  */
+static struct compress_thd_s *
+zthd_start (z_stream *zs, int compress)
+{
+  struct compress_thd_s *zt;
+  npth_attr_t tattr;
+  int i, rc;
+
+  zt = xtrycalloc (1, sizeof *zt);
+  if (!zt)
+    return NULL;
+  zt->compress = compress;
+  zt->zs = zs;
+  for (i=0; i < 2; i++)
+    {
+      /* The extra bytes are used for the algo 1 hack.  */
+      zt->in[i].buf = xtrymalloc (ZTHD_BUFSIZE + 4);
+      zt->out[i].buf = xtrymalloc (ZTHD_BUFSIZE);
+      if (!zt->in[i].buf || !zt->out[i].buf)
+        goto fail;
+    }
+
+  rc = npth_mutex_init (&zt->mutex, NULL);
+  if (rc)
+    goto fail;
+  rc = npth_cond_init (&zt->cond, NULL);
+  if (rc)
+    {
+      npth_mutex_destroy (&zt->mutex);
+      goto fail;
+    }
+  rc = npth_attr_init (&tattr);
+  if (!rc)
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      rc = npth_create (&zt->thd, &tattr, zthd_worker, zt);
+      npth_attr_destroy (&tattr);
+    }
+  if (rc)
+    {
+      npth_cond_destroy (&zt->cond);
+      npth_mutex_destroy (&zt->mutex);
+      goto fail;
+    }
+  return zt;
+
+ fail:
+  for (i=0; i < 2; i++)
+    {
+      xfree (zt->in[i].buf);
+      xfree (zt->out[i].buf);
+    }
+  xfree (zt);
+  return NULL;
+}
+
+
+/* Stop the worker thread and release ZT.  */
+static void
+zthd_release (struct compress_thd_s *zt)
+{
+  int i;
+
+  if (!zt)
+    return;
+
+  lock_zthd (zt);
+  zt->stop = 1;
+  npth_cond_broadcast (&zt->cond);
+  unlock_zthd (zt);
+  npth_join (zt->thd, NULL);
+
+  npth_cond_destroy (&zt->cond);
+  npth_mutex_destroy (&zt->mutex);
+  for (i=0; i < 2; i++)
+    {
+      xfree (zt->in[i].buf);
+      xfree (zt->out[i].buf);
+    }
+  xfree (zt);
+}
+
+
+/* Act on a zlib error reported by the worker thread.  */
+static void
+zthd_check_error (struct compress_thd_s *zt)
+{
+  if (zt->zrc == Z_OK)
+    return;
+
+  if (zt->compress)
+    {
+      if (zt->zmsg)
+        log_error ("zlib deflate problem: %s\n", zt->zmsg );
+      else
+        log_error ("zlib deflate problem: rc=%d\n", zt->zrc );
+      write_status_error ("zlib.deflate", gpg_error (GPG_ERR_INTERNAL));
+    }
+  else
+    {
+      if (zt->zmsg)
+        log_error ("zlib inflate problem: %s\n", zt->zmsg );
+      else
+        log_error ("zlib inflate problem: rc=%d\n", zt->zrc );
+      write_status_error ("zlib.inflate", gpg_error (GPG_ERR_BAD_DATA));
+    }
+  g10_exit (2);
+}
+
+
+/* Write the compressed output of the worker to A.  If FINISH is set
+ * wait until the end of the stream; otherwise wait only until the
+ * next input buffer is available.  */
+static int
+zthd_write_output (struct compress_thd_s *zt, IOBUF a, int finish)
+{
+  struct zthd_buffer_s *out;
+  int rc = 0;
+
+  lock_zthd (zt);
+  for (;;)
+    {
+      out = &zt->out[zt->out_take & 1];
+      if (out->full)
+        {
+          unlock_zthd (zt);
+          if (out->last)
+            zthd_check_error (zt);
+          if (out->len && (rc = iobuf_write (a, out->buf, out->len)))
+            log_error ("deflate: iobuf_write failed\n");
+          lock_zthd (zt);
+          out->len = 0;
+          out->full = 0;
+          zt->out_take++;
+          npth_cond_broadcast (&zt->cond);
+          if (out->last)
+            zt->out_eof = 1;
+          if (rc || zt->out_eof)
+            break;
+          continue;
+        }
+      if (!finish && !zt->in[zt->in_fill & 1].full)
+        break;
+      npth_cond_wait (&zt->cond, &zt->mutex);
+    }
+  unlock_zthd (zt);
+
+  return rc;
+}
+
+
+/* The flush sub-function of compress_filter for threaded operation.  */
+static int
+zthd_compress (compress_filter_context_t *zfx, IOBUF a,
+               const byte *buf, size_t size)
+{
+  struct compress_thd_s *zt = zfx->thd;
+  struct zthd_buffer_s *in;
+  size_t n;
+  int rc;
+
+  while (size)
+    {
+      rc = zthd_write_output (zt, a, 0);
+      if (rc)
+        return rc;
+
+      /* The input buffer at IN_FILL is now ours.  */
+      in = &zt->in[zt->in_fill & 1];
+      n = ZTHD_BUFSIZE - in->len;
+      if (n > size)
+        n = size;
+      memcpy (in->buf + in->len, buf, n);
+      in->len += n;
+      buf += n;
+      size -= n;
+
+      if (in->len == ZTHD_BUFSIZE)
+        {
+          lock_zthd (zt);
+          in->last = 0;
+          in->full = 1;
+          zt->in_fill++;
+          npth_cond_broadcast (&zt->cond);
+          unlock_zthd (zt);
+        }
+    }
+
+  return 0;
+}
+
+
+/* Send the remaining input to the worker and write all output.  */
+static int
+zthd_compress_finish (compress_filter_context_t *zfx, IOBUF a)
+{
+  struct compress_thd_s *zt = zfx->thd;
+  struct zthd_buffer_s *in;
+  int rc;
+
+  rc = zthd_write_output (zt, a, 0);
+  if (rc)
+    return rc;
+
+  in = &zt->in[zt->in_fill & 1];
+  lock_zthd (zt);
+  in->last = 1;
+  in->full = 1;
+  zt->in_fill++;
+  zt->in_eof = 1;
+  npth_cond_broadcast (&zt->cond);
+  unlock_zthd (zt);
+
+  return zthd_write_output (zt, a, 1);
+}
+
+
+/* The underflow sub-function of compress_filter for threaded
+ * operation.  Returns -1 on EOF.  */
+static int
+zthd_uncompress (compress_filter_context_t *zfx, IOBUF a,
+                 byte *buf, size_t *ret_len)
+{
+  struct compress_thd_s *zt = zfx->thd;
+  struct zthd_buffer_s *in, *out;
+  size_t size = *ret_len;
+  size_t n;
+  int nread;
+
+  *ret_len = 0;
+  lock_zthd (zt);
+  for (;;)
+    {
+      out = &zt->out[zt->out_take & 1];
+      if (out->full)
+        {
+          unlock_zthd (zt);
+          if (out->last)
+            zthd_check_error (zt);
+          n = out->len - out->off;
+          if (n > size)
+            n = size;
+          memcpy (buf, out->buf + out->off, n);
+          out->off += n;
+          *ret_len = n;
+          lock_zthd (zt);
+          if (out->off == out->len)
+            {
+              if (out->last)
+                zt->out_eof = 1;
+              out->len = 0;
+              out->full = 0;
+              zt->out_take++;
+              npth_cond_broadcast (&zt->cond);
+            }
+          if (n)
+            break;
+          continue;
+        }
+      if (zt->out_eof)
+        break;
+
+      in = &zt->in[zt->in_fill & 1];
+      if (!zt->in_eof && !in->full)
+        {
+          /* Read the next input buffer while the worker inflates.  */
+          unlock_zthd (zt);
+          nread = iobuf_read (a, in->buf, ZTHD_BUFSIZE);
+          if (nread == -1)
+            nread = 0;
+          in->len = nread;
+          in->last = !nread;
+          if (in->last && zfx->algo == 1)
+            {
+              /* Algo 1 has no zlib header which requires us to give
+               * inflate extra dummy bytes to read.  See
+               * do_uncompress.  */
+              memset (in->buf + in->len, 0xff, 4);
+              in->len += 4;
+            }
+          lock_zthd (zt);
+          in->full = 1;
+          zt->in_fill++;
+          if (in->last)
+            zt->in_eof = 1;
+          npth_cond_broadcast (&zt->cond);
+          continue;
+        }
+
+      npth_cond_wait (&zt->cond, &zt->mutex);
+    }
+  unlock_zthd (zt);
+
+  if (DBG_FILTER)
+    log_debug ("zthd_uncompress: returning %zu bytes%s\n",
+               *ret_len, zt->out_eof && !*ret_len? " (eof)":"");
+  return (zt->out_eof && !*ret_len)? -1 : 0;
+}
+
+/* Parallel deflate.
+ *
+ * With --parallel-compress the input is split into blocks of
+ * PZ_BLOCKSIZE bytes which are compressed concurrently by a set of
+ * worker threads.  Each block is primed with the end of the preceding
+ * block as dictionary and is terminated by a sync flush; thus the
+ * concatenation of all blocks is a single valid deflate stream.  For
+ * ZLIB the filter adds the header and the Adler-32 checksum.  The
+ * blocks are written in order using a ring of job slots like the one
+ * used for AEAD encryption.  */
+
+#define PZ_BLOCKSIZE (128*1024)
+#define PZ_MAX_THREADS 64
+
+enum pz_job_states
+  {
+    PZ_JOB_FREE = 0,  /* The slot is unused or being filled.  */
+    PZ_JOB_QUEUED,    /* Waiting for a worker.                */
+    PZ_JOB_BUSY,      /* A worker is compressing it.          */
+    PZ_JOB_DONE       /* Compressed; ready to be written.     */
+  };
+
+struct pz_job_s
+{
+  enum pz_job_states state;
+  unsigned int last : 1;  /* This is the last block.  */
+  byte *in;               /* Input buffer of PZ_BLOCKSIZE.  */
+  size_t inlen;
+  byte *dict;             /* Dictionary buffer of the window size.  */
+  size_t dictlen;
+  byte *out;              /* Output buffer.  */
+  size_t outsize;
+  size_t outlen;
+  int zrc;                /* Z_OK or the zlib error code.  */
+  const char *zmsg;
+};
+
+struct pz_worker_s
+{
+  struct compress_pz_s *pz;
+  z_stream zs;
+  npth_t thd;
+};
+
+struct compress_pz_s
+{
+  int algo;
+  int level;
+  unsigned int wsize;       /* Size of the window.  */
+
+  npth_mutex_t mutex;
+  npth_cond_t cond;         /* Signaled on each job state change.  */
+  unsigned int stop : 1;    /* Request to terminate the workers.  */
+  unsigned int wrote_header : 1;
+
+  int nworkers;
+  struct pz_worker_s *workers;
+
+  int nslots;
+  struct pz_job_s *slots;
+  struct pz_job_s *cur;     /* The job being filled or NULL.  */
+  unsigned int nsubmitted;  /* Number of jobs handed to the workers.  */
+  unsigned int npicked;     /* Number of jobs taken by the workers.   */
+  unsigned int nwritten;    /* Number of jobs written out.            */
+
+  uLong adler;              /* Checksum of the input for ZLIB.  */
+  byte *lastdict;           /* End of the last submitted block.  */
+  size_t lastdictlen;
+};
+
+
+static void
+lock_pz (struct compress_pz_s *pz)
+{
+  int rc = npth_mutex_lock (&pz->mutex);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_pz (struct compress_pz_s *pz)
+{
+  int rc = npth_mutex_unlock (&pz->mutex);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* Compress the block of JOB using the stream ZS.  */
+static void
+pz_deflate_block (z_stream *zs, struct pz_job_s *job)
+{
+  int zrc, flush;
+  byte *p;
+
+  zrc = deflateReset (zs);
+  if (zrc == Z_OK && job->dictlen)
+    zrc = deflateSetDictionary (zs, BYTEF_CAST (job->dict), job->dictlen);
+  if (zrc != Z_OK)
+    goto leave;
+
+  zs->next_in = BYTEF_CAST (job->in);
+  zs->avail_in = job->inlen;
+  flush = job->last? Z_FINISH : Z_SYNC_FLUSH;
+  job->outlen = 0;
+  for (;;)
+    {
+      zs->next_out = BYTEF_CAST (job->out + job->outlen);
+      zs->avail_out = job->outsize - job->outlen;
+      zrc = deflate (zs, flush);
+      job->outlen = job->outsize - zs->avail_out;
+      if (zrc == Z_STREAM_END)
+        {
+          zrc = Z_OK;
+          break;
+        }
+      if (zrc != Z_OK && zrc != Z_BUF_ERROR)
+        break;
+      zrc = Z_OK;
+      if (!zs->avail_out)
+        {
+          /* Should not happen due to deflateBound; but be safe.  */
+          p = xtryrealloc (job->out, 2 * job->outsize);
+          if (!p)
+            {
+              zrc = Z_MEM_ERROR;
+              break;
+            }
+          job->out = p;
+          job->outsize *= 2;
+        }
+      else if (!job->last)
+        break;  /* The sync flush is complete.  */
+    }
+
+ leave:
+  job->zrc = zrc;
+  job->zmsg = zrc == Z_OK? NULL : zs->msg;
+}
+
+
+/* The thread function of a parallel deflate worker.  */
+static void *
+pz_worker (void *arg)
+{
+  struct pz_worker_s *w = arg;
+  struct compress_pz_s *pz = w->pz;
+  struct pz_job_s *job;
+
+  lock_pz (pz);
+  for (;;)
+    {
+      while (!pz->stop && pz->npicked == pz->nsubmitted)
+        npth_cond_wait (&pz->cond, &pz->mutex);
+      if (pz->stop)
+        break;
+
+      job = pz->slots + (pz->npicked % pz->nslots);
+      log_assert (job->state == PZ_JOB_QUEUED);
+      job->state = PZ_JOB_BUSY;
+      pz->npicked++;
+      unlock_pz (pz);
+
+      npth_unprotect ();
+      pz_deflate_block (&w->zs, job);
+      npth_protect ();
+
+      lock_pz (pz);
+      job->state = PZ_JOB_DONE;
+      npth_cond_broadcast (&pz->cond);
+    }
+  unlock_pz (pz);
+
+  return NULL;
+}
+
+
+/* Stop the workers and release the parallel deflate state.  */
+static void
+pz_release (struct compress_pz_s *pz)
+{
+  int i;
+
+  if (!pz)
+    return;
+
+  lock_pz (pz);
+  pz->stop = 1;
+  npth_cond_broadcast (&pz->cond);
+  unlock_pz (pz);
+
+  for (i=0; i < pz->nworkers; i++)
+    {
+      npth_join (pz->workers[i].thd, NULL);
+      deflateEnd (&pz->workers[i].zs);
+    }
+  for (i=0; i < pz->nslots; i++)
+    {
+      xfree (pz->slots[i].in);
+      xfree (pz->slots[i].dict);
+      xfree (pz->slots[i].out);
+    }
+
+  npth_cond_destroy (&pz->cond);
+  npth_mutex_destroy (&pz->mutex);
+  xfree (pz->lastdict);
+  xfree (pz->workers);
+  xfree (pz->slots);
+  xfree (pz);
+}
+
+
+/* Create the parallel deflate state for ALGO and start the workers.
+ * Returns NULL on error; the caller may then fall back to the
+ * standard code.  */
+static struct compress_pz_s *
+pz_start (int algo)
+{
+  struct compress_pz_s *pz;
+  npth_attr_t tattr;
+  struct pz_worker_s *w;
+  int i, rc, zrc;
+  int nthreads;
+
+  nthreads = opt.compress_threads > 1? opt.compress_threads
+    /*                             */: gnupg_get_ncpus ();
+  if (nthreads > PZ_MAX_THREADS)
+    nthreads = PZ_MAX_THREADS;
+
+  pz = xtrycalloc (1, sizeof *pz);
+  if (!pz)
+    return NULL;
+  pz->algo = algo;
+  pz->level = get_compress_level ();
+  /* PGP uses a window size of 13 bits for ZIP; see init_compress.  */
+  pz->wsize = 1 << (algo == COMPRESS_ALGO_ZIP? 13 : 15);
+  pz->adler = adler32 (0L, Z_NULL, 0);
+  pz->nslots = 2 * nthreads;
+  pz->workers = xtrycalloc (nthreads, sizeof *pz->workers);
+  pz->slots = xtrycalloc (pz->nslots, sizeof *pz->slots);
+  pz->lastdict = xtrymalloc (pz->wsize);
+  if (!pz->workers || !pz->slots || !pz->lastdict)
+    goto fail;
+
+  for (i=0; i < pz->nslots; i++)
+    {
+      pz->slots[i].in = xtrymalloc (PZ_BLOCKSIZE);
+      pz->slots[i].dict = xtrymalloc (pz->wsize);
+      if (!pz->slots[i].in || !pz->slots[i].dict)
+        goto fail;
+    }
+
+  rc = npth_mutex_init (&pz->mutex, NULL);
+  if (rc)
+    goto fail;
+  rc = npth_cond_init (&pz->cond, NULL);
+  if (rc)
+    {
+      npth_mutex_destroy (&pz->mutex);
+      goto fail;
+    }
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      pz_release (pz);
+      return NULL;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i=0; i < nthreads; i++)
+    {
+      w = pz->workers + pz->nworkers;
+      w->pz = pz;
+      zrc = deflateInit2 (&w->zs, pz->level, Z_DEFLATED,
+                          algo == COMPRESS_ALGO_ZIP? -13 : -15,
+                          8, Z_DEFAULT_STRATEGY);
+      if (zrc != Z_OK)
+        break;
+      if (npth_create (&w->thd, &tattr, pz_worker, w))
+        {
+          deflateEnd (&w->zs);
+          break;
+        }
+      pz->nworkers++;
+    }
+  npth_attr_destroy (&tattr);
+  if (!pz->nworkers)
+    {
+      pz_release (pz);
+      return NULL;
+    }
+
+  /* Allocate the output buffers using the bound of the stream.  */
+  for (i=0; i < pz->nslots; i++)
+    {
+      pz->slots[i].outsize = deflateBound (&pz->workers[0].zs,
+                                           PZ_BLOCKSIZE) + 16;
+      pz->slots[i].out = xtrymalloc (pz->slots[i].outsize);
+      if (!pz->slots[i].out)
+        {
+          pz_release (pz);
+          return NULL;
+        }
+    }
+
+  if (DBG_FILTER)
+    log_debug ("using %d threads for deflate\n", pz->nworkers);
+  return pz;
+
+ fail:
+  if (pz->slots)
+    for (i=0; i < pz->nslots; i++)
+      {
+        xfree (pz->slots[i].in);
+        xfree (pz->slots[i].dict);
+      }
+  xfree (pz->lastdict);
+  xfree (pz->workers);
+  xfree (pz->slots);
+  xfree (pz);
+  return NULL;
+}
+
+
+/* Write the zlib header for the parallel deflate to A.  This is the
+ * same header as written by deflateInit.  */
+static int
+pz_write_header (struct compress_pz_s *pz, IOBUF a)
+{
+  unsigned int header, flags;
+  byte hbuf[2];
+
+  if (pz->level < 0 || pz->level == 6)
+    flags = 2;
+  else if (pz->level < 2)
+    flags = 0;
+  else if (pz->level < 6)
+    flags = 1;
+  else
+    flags = 3;
+  header = ((Z_DEFLATED + ((15-8) << 4)) << 8) | (flags << 6);
+  header += 31 - (header % 31);
+  hbuf[0] = header >> 8;
+  hbuf[1] = header;
+  return iobuf_write (a, hbuf, 2);
+}
+
+
+/* Write the compressed blocks to stream A in order.  If ALL is set all
+ * submitted jobs are written; otherwise only jobs which are already
+ * done are written but we wait until there is a free slot.  */
+static int
+pz_write_jobs (struct compress_pz_s *pz, IOBUF a, int all)
+{
+  struct pz_job_s *job;
+  int rc = 0;
+
+  lock_pz (pz);
+  while (pz->nwritten != pz->nsubmitted)
+    {
+      job = pz->slots + (pz->nwritten % pz->nslots);
+      if (job->state != PZ_JOB_DONE)
+        {
+          if (!all && pz->nsubmitted - pz->nwritten < pz->nslots)
+            break;  /* We have a free slot.  */
+          npth_cond_wait (&pz->cond, &pz->mutex);
+          continue;
+        }
+      unlock_pz (pz);
+
+      /* A done job is not touched by the workers.  */
+      if (job->zrc != Z_OK)
+        {
+          if (job->zmsg)
+            log_error ("zlib deflate problem: %s\n", job->zmsg );
+          else
+            log_error ("zlib deflate problem: rc=%d\n", job->zrc );
+          write_status_error ("zlib.deflate", gpg_error (GPG_ERR_INTERNAL));
+          g10_exit (2);
+        }
+      if (!pz->wrote_header && pz->algo == COMPRESS_ALGO_ZLIB)
+        rc = pz_write_header (pz, a);
+      pz->wrote_header = 1;
+      if (!rc)
+        rc = iobuf_write (a, job->out, job->outlen);
+      if (rc)
+        log_error ("deflate: iobuf_write failed\n");
+
+      lock_pz (pz);
+      job->state = PZ_JOB_FREE;
+      pz->nwritten++;
+      if (rc)
+        break;
+    }
+  unlock_pz (pz);
+
+  return rc;
+}
+
+
+/* Hand the current job over to the workers.  */
+static void
+pz_submit (struct compress_pz_s *pz, int last)
+{
+  struct pz_job_s *job = pz->cur;
+  size_t n;
+
+  /* Prime with the end of the previous block and remember the end of
+   * this block for the next one.  */
+  memcpy (job->dict, pz->lastdict, pz->lastdictlen);
+  job->dictlen = pz->lastdictlen;
+  if (job->inlen >= pz->wsize)
+    {
+      memcpy (pz->lastdict, job->in + job->inlen - pz->wsize, pz->wsize);
+      pz->lastdictlen = pz->wsize;
+    }
+  else if (job->inlen)
+    {
+      n = pz->lastdictlen + job->inlen;
+      if (n > pz->wsize)
+        {
+          n -= pz->wsize;
+          memmove (pz->lastdict, pz->lastdict + n, pz->lastdictlen - n);
+          pz->lastdictlen -= n;
+        }
+      memcpy (pz->lastdict + pz->lastdictlen, job->in, job->inlen);
+      pz->lastdictlen += job->inlen;
+    }
+
+  lock_pz (pz);
+  job->last = last;
+  job->zrc = Z_OK;
+  job->state = PZ_JOB_QUEUED;
+  pz->nsubmitted++;
+  pz->cur = NULL;
+  npth_cond_broadcast (&pz->cond);
+  unlock_pz (pz);
+}
+
+
+/* The flush sub-function of compress_filter for parallel deflate.  */
+static int
+pz_compress (struct compress_pz_s *pz, IOBUF a, const byte *buf, size_t size)
+{
+  struct pz_job_s *job;
+  size_t n;
+  int rc;
+
+  if (pz->algo == COMPRESS_ALGO_ZLIB && size)
+    pz->adler = adler32 (pz->adler, BYTEF_CAST (buf), size);
+
+  while (size)
+    {
+      if (!pz->cur)
+        {
+          rc = pz_write_jobs (pz, a, 0);
+          if (rc)
+            return rc;
+          job = pz->slots + (pz->nsubmitted % pz->nslots);
+          log_assert (job->state == PZ_JOB_FREE);
+          job->inlen = 0;
+          pz->cur = job;
+        }
+
+      job = pz->cur;
+      n = PZ_BLOCKSIZE - job->inlen;
+      if (n > size)
+        n = size;
+      memcpy (job->in + job->inlen, buf, n);
+      job->inlen += n;
+      buf += n;
+      size -= n;
+
+      if (job->inlen == PZ_BLOCKSIZE)
+        pz_submit (pz, 0);
+    }
+
+  return 0;
+}
+
+
+/* Compress the rest, write all blocks and the trailer.  */
+static int
+pz_compress_finish (struct compress_pz_s *pz, IOBUF a)
+{
+  byte trailer[4];
+  int rc;
+
+  if (!pz->cur)
+    {
+      rc = pz_write_jobs (pz, a, 0);
+      if (rc)
+        return rc;
+      pz->cur = pz->slots + (pz->nsubmitted % pz->nslots);
+      pz->cur->inlen = 0;
+    }
+  pz_submit (pz, 1);
+
+  rc = pz_write_jobs (pz, a, 1);
+  if (!rc && pz->algo == COMPRESS_ALGO_ZLIB)
+    {
+      trailer[0] = pz->adler >> 24;
+      trailer[1] = pz->adler >> 16;
+      trailer[2] = pz->adler >> 8;
+      trailer[3] = pz->adler;
+      rc = iobuf_write (a, trailer, 4);
+    }
+  return rc;
+}
+
+
 static int
 compress_filter( void *opaque, int control,
 		 IOBUF a, byte *buf, size_t *ret_len)
@@ -234,12 +1233,20 @@ compress_filter( void *opaque, int control,
 	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
 	    init_uncompress( zfx, zs );
 	    zfx->status = 1;
+            if (opt.compress_threads > 0
+                && !(zfx->thd = zthd_start (zs, 0)))
+              log_info ("error starting compress thread: %s\n",
+                        gpg_strerror (gpg_error_from_syserror ()));
 	}
 
-	zs->next_out = BYTEF_CAST (buf);
-	zs->avail_out = size;
-	zfx->outbufsize = size; /* needed only for calculation */
-	rc = do_uncompress( zfx, zs, a, ret_len );
+        if (zfx->thd)
+          rc = zthd_uncompress (zfx, a, buf, ret_len);
+        else {
+	    zs->next_out = BYTEF_CAST (buf);
+	    zs->avail_out = size;
+	    zfx->outbufsize = size; /* needed only for calculation */
+	    rc = do_uncompress( zfx, zs, a, ret_len );
+        }
     }
     else if( control == IOBUFCTRL_FLUSH ) {
 	if( !zfx->status ) {
@@ -259,31 +1266,63 @@ compress_filter( void *opaque, int control,
 	    pkt.pkt.compressed = &cd;
 	    if( build_packet( a, &pkt ))
 		log_bug("build_packet(PKT_COMPRESSED) failed\n");
-	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
-	    init_compress( zfx, zs );
-	    zfx->status = 2;
+            if (opt.parallel_compress
+                && !(zfx->pz = pz_start (zfx->algo)))
+              log_info ("error starting compress threads: %s\n",
+                        gpg_strerror (gpg_error_from_syserror ()));
+            if (zfx->pz)
+              zfx->status = 3;
+            else {
+	        zs = zfx->opaque = xmalloc_clear( sizeof *zs );
+	        init_compress( zfx, zs );
+	        zfx->status = 2;
+                if (opt.compress_threads > 0
+                    && !(zfx->thd = zthd_start (zs, 1)))
+                  log_info ("error starting compress thread: %s\n",
+                            gpg_strerror (gpg_error_from_syserror ()));
+            }
 	}
 
-	zs->next_in = BYTEF_CAST (buf);
-	zs->avail_in = size;
-	rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+        if (zfx->pz)
+          rc = pz_compress (zfx->pz, a, buf, size);
+        else if (zfx->thd)
+          rc = zthd_compress (zfx, a, buf, size);
+        else {
+	    zs->next_in = BYTEF_CAST (buf);
+	    zs->avail_in = size;
+	    rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+        }
     }
     else if( control == IOBUFCTRL_FREE ) {
 	if( zfx->status == 1 ) {
+            zthd_release (zfx->thd);
+            zfx->thd = NULL;
 	    inflateEnd(zs);
 	    xfree(zs);
 	    zfx->opaque = NULL;
 	    xfree(zfx->outbuf); zfx->outbuf = NULL;
 	}
 	else if( zfx->status == 2 ) {
-	    zs->next_in = BYTEF_CAST (buf);
-	    zs->avail_in = 0;
-	    do_compress( zfx, zs, Z_FINISH, a );
+            if (zfx->thd) {
+                zthd_compress_finish (zfx, a);
+                zthd_release (zfx->thd);
+                zfx->thd = NULL;
+            }
+            else {
+	        zs->next_in = BYTEF_CAST (buf);
+	        zs->avail_in = 0;
+	        do_compress( zfx, zs, Z_FINISH, a );
+            }
 	    deflateEnd(zs);
 	    xfree(zs);
 	    zfx->opaque = NULL;
 	    xfree(zfx->outbuf); zfx->outbuf = NULL;
 	}
+	else if( zfx->status == 3 ) {
+            pz_compress_finish (zfx->pz, a);
+            pz_release (zfx->pz);
+            zfx->pz = NULL;
+	}
         if (zfx->release)
           zfx->release (zfx);
     }
@@ -376,3 +1415,70 @@ push_compress_filter2(IOBUF out,compress_filter_context_t *zfx,
 
   return err;
 }
+
+
+/* Check whether the data at the start of INP compresses well enough
+ * to be worth the CPU time.  This compresses a sample taken with
+ * iobuf_peek using the fastest level and returns false if the ratio
+ * is poor; this catches already compressed or encrypted data which
+ * is_file_compressed does not detect.  In case of doubt true is
+ * returned.  */
+int
+compress_probe (iobuf_t inp)
+{
+#ifdef HAVE_ZIP
+  z_stream zs;
+  byte *sample = NULL;
+  byte *outbuf = NULL;
+  int samplelen;
+  uLong outlen;
+  unsigned int ratio;
+  int result = 1;
+
+  if (!inp)
+    return 1;
+
+  sample = xtrymalloc (PROBE_SAMPLE_SIZE);
+  if (!sample)
+    return 1;
+  samplelen = iobuf_peek (inp, sample, PROBE_SAMPLE_SIZE);
+  if (samplelen < PROBE_MIN_SIZE)
+    goto leave;  /* Too short to decide.  */
+
+  memset (&zs, 0, sizeof zs);
+  if (deflateInit (&zs, Z_BEST_SPEED) != Z_OK)
+    goto leave;
+  outlen = deflateBound (&zs, samplelen);
+  outbuf = xtrymalloc (outlen);
+  if (outbuf)
+    {
+      zs.next_in = BYTEF_CAST (sample);
+      zs.avail_in = samplelen;
+      zs.next_out = BYTEF_CAST (outbuf);
+      zs.avail_out = outlen;
+      if (deflate (&zs, Z_FINISH) == Z_STREAM_END)
+        {
+          outlen = zs.total_out;
+          ratio = (unsigned int)(outlen * 1000 / samplelen);
+          result = ratio < PROBE_MAX_RATIO;
+          if (opt.verbose)
+            log_info ("compression probe: %d bytes compress to %lu bytes"
+                      " (%u.%u%%) - %s\n",
+                      samplelen, (unsigned long)outlen,
+                      ratio / 10, ratio % 10,
+                      result? "compressing" : "not compressing");
+          write_status_printf (STATUS_COMPRESS_PROBE, "%d %d %lu",
+                               result, samplelen, (unsigned long)outlen);
+        }
+    }
+  deflateEnd (&zs);
+
+ leave:
+  xfree (outbuf);
+  xfree (sample);
+  return result;
+#else /*!HAVE_ZIP*/
+  (void)inp;
+  return 1;
+#endif /*!HAVE_ZIP*/
+}
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -40,6 +41,11 @@ static int mdc_decode_filter ( void *opaque, int control, IOBUF a,
 static int decode_filter ( void *opaque, int control, IOBUF a,
 					byte *buf, size_t *ret_len);
 
+/* The largest chunk size we decrypt using worker threads.  */
+#define AEAD_PAR_MAX_CHUNKSIZE (16*1024*1024)
+
+struct aead_dec_par_s;
+
 /* Our context object.  */
 struct decode_filter_context_s
 {
@@ -99,10 +105,77 @@ struct decode_filter_context_s
   /* Remaining bytes in the packet according to the packet header.
    * Not used if PARTIAL is true.  */
   size_t length;
+
+  /* State for the multi-threaded AEAD decryption or NULL.  */
+  struct aead_dec_par_s *par;
 };
 typedef struct decode_filter_context_s *decode_filter_ctx_t;
 
 
+/* Multi-threaded AEAD decryption.
+ *
+ * With --aead-threads the filter reads several chunks ahead, each
+ * into its own job slot, and a set of worker threads decrypts them
+ * and checks their tags.  The filter returns the plaintext of a chunk
+ * only after its tag has been verified and strictly in the order of
+ * the chunks.  Thus, unlike the single threaded code, no
+ * unauthenticated data is ever released.  */
+
+enum aead_dec_job_states
+  {
+    AEAD_JOB_FREE = 0,  /* The slot is unused or being filled.  */
+    AEAD_JOB_QUEUED,    /* Waiting for a worker.                */
+    AEAD_JOB_BUSY,      /* A worker is decrypting it.           */
+    AEAD_JOB_DONE       /* Decrypted and checked.               */
+  };
+
+struct aead_dec_job_s
+{
+  enum aead_dec_job_states state;
+  uint64_t chunkindex;
+  byte *buffer;       /* Room for a full chunk, its tag and 17 more.  */
+  size_t buflen;      /* Length of the chunk's data in BUFFER.  */
+  size_t outoff;      /* Number of plaintext bytes already returned.  */
+  byte tag[16];       /* The chunk's authentication tag.  */
+  gpg_error_t err;    /* Error code from the worker.  */
+};
+
+struct aead_dec_worker_s
+{
+  struct aead_dec_par_s *par;
+  gcry_cipher_hd_t hd;
+  npth_t thread;
+};
+
+struct aead_dec_par_s
+{
+  decode_filter_ctx_t dfx;  /* Back pointer.  */
+
+  npth_mutex_t lock;
+  npth_cond_t  cond;        /* Signaled on each job state change.  */
+  unsigned int stop : 1;    /* Request to terminate the workers.  */
+  unsigned int input_done : 1;  /* The final tag has been read.  */
+  unsigned int output_done : 1; /* EOF or error has been returned.  */
+
+  int maxworkers;           /* Number of allocated workers.  */
+  int nworkers;             /* Number of running threads.    */
+  struct aead_dec_worker_s *workers;
+
+  int nslots;
+  struct aead_dec_job_s *slots;
+  struct aead_dec_job_s *out;   /* The job being returned or NULL.  */
+  uint64_t nsubmitted;      /* Number of jobs handed to the workers.  */
+  uint64_t npicked;         /* Number of jobs taken by the workers.   */
+  uint64_t nwritten;        /* Number of jobs returned.               */
+
+  byte finaltag[16];        /* The tag of the final chunk.  */
+};
+
+static gpg_error_t dpar_new (decode_filter_ctx_t dfx, DEK *dek,
+                             enum gcry_cipher_modes ciphermode);
+static void dpar_release (decode_filter_ctx_t dfx);
+
+
 /* Helper to release the decode context.  */
 static void
 release_dfx_context (decode_filter_ctx_t dfx)
@@ -113,6 +186,7 @@ release_dfx_context (decode_filter_ctx_t dfx)
   log_assert (dfx->refcount);
   if ( !--dfx->refcount )
     {
+      dpar_release (dfx);
       gcry_cipher_close (dfx->cipher_hd);
       dfx->cipher_hd = NULL;
       gcry_md_close (dfx->mdc_hash);
@@ -122,12 +196,13 @@ release_dfx_context (decode_filter_ctx_t dfx)
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  This
- * also reset the decryption machinery so that the handle can be
- * used for a new chunk.  If FINAL is set the final AEAD chunk is
- * processed.  */
+/* Set the nonce and the additional data for chunk CHUNKINDEX using
+ * the cipher handle HD.  This also reset the decryption machinery so
+ * that the handle can be used for a new chunk.  If FINAL is set the
+ * final AEAD chunk is processed.  */
 static gpg_error_t
-aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
+aead_set_nonce_and_ad_hd (decode_filter_ctx_t dfx, gcry_cipher_hd_t hd,
+                          uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char ad[21];
@@ -149,18 +224,18 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     default:
       BUG ();
     }
-  nonce[i++] ^= dfx->chunkindex >> 56;
-  nonce[i++] ^= dfx->chunkindex >> 48;
-  nonce[i++] ^= dfx->chunkindex >> 40;
-  nonce[i++] ^= dfx->chunkindex >> 32;
-  nonce[i++] ^= dfx->chunkindex >> 24;
-  nonce[i++] ^= dfx->chunkindex >> 16;
-  nonce[i++] ^= dfx->chunkindex >>  8;
-  nonce[i++] ^= dfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, i, "nonce:");
-  err = gcry_cipher_setiv (dfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -169,14 +244,14 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
   ad[2] = dfx->cipher_algo;
   ad[3] = dfx->aead_algo;
   ad[4] = dfx->chunkbyte;
-  ad[5] = dfx->chunkindex >> 56;
-  ad[6] = dfx->chunkindex >> 48;
-  ad[7] = dfx->chunkindex >> 40;
-  ad[8] = dfx->chunkindex >> 32;
-  ad[9] = dfx->chunkindex >> 24;
-  ad[10]= dfx->chunkindex >> 16;
-  ad[11]= dfx->chunkindex >>  8;
-  ad[12]= dfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = dfx->total >> 56;
@@ -190,7 +265,30 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (dfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
+}
+
+
+/* Set the nonce and the additional data for the current chunk.  This
+ * also reset the decryption machinery so that the handle can be
+ * used for a new chunk.  If FINAL is set the final AEAD chunk is
+ * processed.  */
+static gpg_error_t
+aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
+{
+  return aead_set_nonce_and_ad_hd (dfx, dfx->cipher_hd, dfx->chunkindex,
+                                   final);
+}
+
+
+/* Helper to report a failed tag check.  */
+static void
+aead_checktag_failed (decode_filter_ctx_t dfx, int final, gpg_error_t err)
+{
+  log_error ("gcry_cipher_checktag%s failed: %s\n",
+             final? " (final)":"", gpg_strerror (err));
+  write_status_error ("aead_checktag", err);
+  dfx->checktag_failed = 1;
 }
 
 
@@ -206,10 +304,7 @@ aead_checktag (decode_filter_ctx_t dfx, int final, const void *tagbuf)
   err = gcry_cipher_checktag (dfx->cipher_hd, tagbuf, 16);
   if (err)
     {
-      log_error ("gcry_cipher_checktag%s failed: %s\n",
-                 final? " (final)":"", gpg_strerror (err));
-      write_status_error ("aead_checktag", err);
-      dfx->checktag_failed = 1;
+      aead_checktag_failed (dfx, final, err);
       return err;
     }
   if (DBG_FILTER)
@@ -397,6 +492,12 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek,
           goto leave;
         }
 
+      if (opt.aead_threads > 1 && dfx->chunksize <= AEAD_PAR_MAX_CHUNKSIZE)
+        {
+          rc = dpar_new (dfx, dek, ciphermode);
+          if (rc)
+            goto leave;
+        }
     }
   else /* CFB encryption.  */
     {
@@ -881,6 +982,438 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
 }
 
 
+static void
+lock_dpar (struct aead_dec_par_s *par)
+{
+  int rc = npth_mutex_lock (&par->lock);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_dpar (struct aead_dec_par_s *par)
+{
+  int rc = npth_mutex_unlock (&par->lock);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* Decrypt the chunk of JOB using the cipher handle HD and check its
+ * tag.  If UNPROTECT is set the npth lock is released during the
+ * actual crypto operation.  */
+static gpg_error_t
+dpar_process_job (decode_filter_ctx_t dfx, gcry_cipher_hd_t hd,
+                  struct aead_dec_job_s *job, int unprotect)
+{
+  gpg_error_t err;
+
+  err = aead_set_nonce_and_ad_hd (dfx, hd, job->chunkindex, 0);
+  if (err)
+    return err;
+
+  if (unprotect)
+    npth_unprotect ();
+  gcry_cipher_final (hd);
+  err = gcry_cipher_decrypt (hd, job->buffer, job->buflen, NULL, 0);
+  if (!err)
+    err = gcry_cipher_checktag (hd, job->tag, 16);
+  if (unprotect)
+    npth_protect ();
+
+  return err;
+}
+
+
+/* The thread function of an AEAD decryption worker.  */
+static void *
+dpar_worker (void *arg)
+{
+  struct aead_dec_worker_s *w = arg;
+  struct aead_dec_par_s *par = w->par;
+  struct aead_dec_job_s *job;
+  gpg_error_t err;
+
+  lock_dpar (par);
+  for (;;)
+    {
+      while (!par->stop && par->npicked == par->nsubmitted)
+        npth_cond_wait (&par->cond, &par->lock);
+      if (par->stop)
+        break;
+
+      job = par->slots + (par->npicked % par->nslots);
+      log_assert (job->state == AEAD_JOB_QUEUED);
+      job->state = AEAD_JOB_BUSY;
+      par->npicked++;
+      unlock_dpar (par);
+
+      err = dpar_process_job (par->dfx, w->hd, job, 1);
+
+      lock_dpar (par);
+      job->err = err;
+      job->state = AEAD_JOB_DONE;
+      npth_cond_broadcast (&par->cond);
+    }
+  unlock_dpar (par);
+
+  return NULL;
+}
+
+
+/* Allocate the state for multi-threaded decryption.  The cipher
+ * handles are set up right away using the key from DEK but the
+ * threads are started only if there is more than one chunk.  */
+static gpg_error_t
+dpar_new (decode_filter_ctx_t dfx, DEK *dek, enum gcry_cipher_modes ciphermode)
+{
+  struct aead_dec_par_s *par;
+  gpg_error_t err = 0;
+  int i, rc;
+
+  par = xtrycalloc (1, sizeof *par);
+  if (!par)
+    return gpg_error_from_syserror ();
+  par->dfx = dfx;
+  par->maxworkers = opt.aead_threads;
+  par->nslots = 2 * par->maxworkers;
+  par->workers = xtrycalloc (par->maxworkers, sizeof *par->workers);
+  par->slots = xtrycalloc (par->nslots, sizeof *par->slots);
+  if (!par->workers || !par->slots)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  for (i=0; i < par->maxworkers; i++)
+    {
+      par->workers[i].par = par;
+      err = openpgp_cipher_open (&par->workers[i].hd, dfx->cipher_algo,
+                                 ciphermode, GCRY_CIPHER_SECURE);
+      if (!err)
+        {
+          err = gcry_cipher_setkey (par->workers[i].hd,
+                                    dek->key, dek->keylen);
+          if (gpg_err_code (err) == GPG_ERR_WEAK_KEY)
+            err = 0;  /* Already warned about.  */
+        }
+      if (err)
+        goto leave;
+    }
+
+  rc = npth_mutex_init (&par->lock, NULL);
+  if (!rc)
+    {
+      rc = npth_cond_init (&par->cond, NULL);
+      if (rc)
+        npth_mutex_destroy (&par->lock);
+    }
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      goto leave;
+    }
+
+  if (DBG_FILTER)
+    log_debug ("using up to %d threads for AEAD decryption\n",
+               par->maxworkers);
+  dfx->par = par;
+  par = NULL;
+
+ leave:
+  if (par)
+    {
+      if (par->workers)
+        for (i=0; i < par->maxworkers; i++)
+          gcry_cipher_close (par->workers[i].hd);
+      xfree (par->workers);
+      xfree (par->slots);
+      xfree (par);
+    }
+  return err;
+}
+
+
+/* Start the worker threads.  It is not an error if only some of the
+ * threads could be started.  */
+static gpg_error_t
+dpar_start_workers (decode_filter_ctx_t dfx)
+{
+  struct aead_dec_par_s *par = dfx->par;
+  struct aead_dec_worker_s *w;
+  gpg_error_t err = 0;
+  npth_attr_t tattr;
+  int rc;
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    return gpg_error_from_errno (rc);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+
+  while (par->nworkers < par->maxworkers)
+    {
+      w = par->workers + par->nworkers;
+      rc = npth_create (&w->thread, &tattr, dpar_worker, w);
+      if (rc)
+        {
+          err = gpg_error_from_errno (rc);
+          break;
+        }
+      par->nworkers++;
+    }
+  npth_attr_destroy (&tattr);
+
+  if (err && par->nworkers)
+    {
+      log_info ("only %d of %d AEAD threads started: %s\n",
+                par->nworkers, par->maxworkers, gpg_strerror (err));
+      err = 0;
+    }
+  return err;
+}
+
+
+/* Stop the worker threads and release the multi-threaded state.  */
+static void
+dpar_release (decode_filter_ctx_t dfx)
+{
+  struct aead_dec_par_s *par = dfx->par;
+  int i;
+
+  if (!par)
+    return;
+
+  lock_dpar (par);
+  par->stop = 1;
+  npth_cond_broadcast (&par->cond);
+  unlock_dpar (par);
+
+  for (i=0; i < par->nworkers; i++)
+    npth_join (par->workers[i].thread, NULL);
+  for (i=0; i < par->maxworkers; i++)
+    gcry_cipher_close (par->workers[i].hd);
+  for (i=0; i < par->nslots; i++)
+    if (par->slots[i].buffer)
+      {
+        /* The buffer may hold not yet authenticated plaintext.  */
+        wipememory (par->slots[i].buffer, dfx->chunksize + 33);
+        xfree (par->slots[i].buffer);
+      }
+
+  npth_cond_destroy (&par->cond);
+  npth_mutex_destroy (&par->lock);
+  xfree (par->workers);
+  xfree (par->slots);
+  xfree (par);
+  dfx->par = NULL;
+}
+
+
+/* Read the next chunk from stream A into a free job slot and hand it
+ * over to the workers.  After the final tag has been read INPUT_DONE
+ * is set.  */
+static gpg_error_t
+dpar_read_chunk (decode_filter_ctx_t dfx, iobuf_t a)
+{
+  struct aead_dec_par_s *par = dfx->par;
+  struct aead_dec_job_s *job;
+  const size_t want = dfx->chunksize + 33;
+  size_t len;
+  gpg_error_t err;
+
+  job = par->slots + (par->nsubmitted % par->nslots);
+  log_assert (job->state == AEAD_JOB_FREE);
+  if (!job->buffer)
+    {
+      job->buffer = xtrymalloc (want);
+      if (!job->buffer)
+        return gpg_error_from_syserror ();
+    }
+
+  /* We read the chunk, its tag, and 17 more bytes.  Those are either
+   * the start of the next chunk (which needs at least one data byte
+   * and two tags) or we hit the EOF and the last 16 bytes are the
+   * final tag.  The extra bytes are kept in the holdback buffer.  */
+  len = dfx->holdbacklen;
+  memcpy (job->buffer, dfx->holdback, len);
+  dfx->holdbacklen = 0;
+  len = fill_buffer (dfx, a, job->buffer, want, len);
+
+  if (len == want)
+    {
+      dfx->holdbacklen = 17;
+      memcpy (dfx->holdback, job->buffer + dfx->chunksize + 16, 17);
+      job->buflen = dfx->chunksize;
+    }
+  else if (len == 16)
+    {
+      /* Only the final tag is left.  */
+      memcpy (par->finaltag, job->buffer, 16);
+      par->input_done = 1;
+      return 0;
+    }
+  else if (len < 33)
+    {
+      /* Not enough data for a chunk and the final tag.  */
+      return gpg_error (GPG_ERR_TRUNCATED);
+    }
+  else
+    {
+      /* This is the last chunk.  */
+      memcpy (par->finaltag, job->buffer + len - 16, 16);
+      par->input_done = 1;
+      job->buflen = len - 32;
+    }
+  memcpy (job->tag, job->buffer + job->buflen, 16);
+
+  if (DBG_FILTER)
+    log_debug ("submitting chunk %llu with %zu bytes%s\n",
+               (unsigned long long)dfx->chunkindex, job->buflen,
+               par->input_done? " (last)":"");
+
+  job->chunkindex = dfx->chunkindex++;
+  job->outoff = 0;
+  dfx->total += job->buflen;
+
+  if (!par->nworkers && par->input_done && !par->nsubmitted)
+    {
+      /* All data is in a single chunk; no need for the threads.  */
+      job->err = dpar_process_job (dfx, par->workers[0].hd, job, 0);
+      job->state = AEAD_JOB_DONE;
+      par->nsubmitted++;
+      par->npicked++;
+      return 0;
+    }
+
+  if (!par->nworkers)
+    {
+      err = dpar_start_workers (dfx);
+      if (err)
+        return err;
+    }
+
+  lock_dpar (par);
+  job->err = 0;
+  job->state = AEAD_JOB_QUEUED;
+  par->nsubmitted++;
+  npth_cond_broadcast (&par->cond);
+  unlock_dpar (par);
+
+  return 0;
+}
+
+
+/* Check the final tag using the main cipher handle.  */
+static gpg_error_t
+dpar_check_final (decode_filter_ctx_t dfx)
+{
+  gpg_error_t err;
+
+  err = aead_set_nonce_and_ad (dfx, 1);
+  if (err)
+    return err;
+  gcry_cipher_final (dfx->cipher_hd);
+  /* Decrypt an empty string (using HOLDBACK as a dummy).  */
+  err = gcry_cipher_decrypt (dfx->cipher_hd, dfx->holdback, 0, NULL, 0);
+  if (err)
+    {
+      log_error ("gcry_cipher_decrypt failed (final): %s\n",
+                 gpg_strerror (err));
+      return err;
+    }
+  return aead_checktag (dfx, 1, dfx->par->finaltag);
+}
+
+
+/* The underflow function of the aead_decode_filter for
+ * multi-threaded decryption.  */
+static gpg_error_t
+dpar_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
+{
+  struct aead_dec_par_s *par = dfx->par;
+  const size_t size = *ret_len; /* The allocated size of BUF.  */
+  struct aead_dec_job_s *job;
+  gpg_error_t err = 0;
+  size_t n;
+
+  *ret_len = 0;
+  if (par->output_done)
+    return gpg_error (GPG_ERR_EOF);
+
+  /* Continue with the current job.  */
+  if ((job = par->out))
+    goto copy_out;
+
+  /* Read ahead as long as we have free slots.  */
+  while (!par->input_done && par->nsubmitted - par->nwritten < par->nslots)
+    {
+      err = dpar_read_chunk (dfx, a);
+      if (err)
+        goto leave;
+    }
+
+  if (par->nwritten == par->nsubmitted)
+    {
+      log_assert (par->input_done);
+      err = dpar_check_final (dfx);
+      if (!err)
+        err = gpg_error (GPG_ERR_EOF);
+      goto leave;
+    }
+
+  /* Wait for the oldest job.  */
+  job = par->slots + (par->nwritten % par->nslots);
+  lock_dpar (par);
+  while (job->state != AEAD_JOB_DONE)
+    npth_cond_wait (&par->cond, &par->lock);
+  unlock_dpar (par);
+  if (job->err)
+    {
+      err = job->err;
+      if (gpg_err_code (err) == GPG_ERR_CHECKSUM)
+        aead_checktag_failed (dfx, 0, err);
+      else
+        log_error ("gcry_cipher_decrypt failed (3): %s\n",
+                   gpg_strerror (err));
+      goto leave;
+    }
+  par->out = job;
+
+ copy_out:
+  n = job->buflen - job->outoff;
+  if (n > size)
+    n = size;
+  memcpy (buf, job->buffer + job->outoff, n);
+  job->outoff += n;
+  *ret_len = n;
+  if (job->outoff == job->buflen)
+    {
+      par->out = NULL;
+      lock_dpar (par);
+      job->state = AEAD_JOB_FREE;
+      par->nwritten++;
+      unlock_dpar (par);
+    }
+
+ leave:
+  if (err)
+    par->output_done = 1;
+  if (DBG_FILTER)
+    log_debug ("dpar_underflow: returning %zu (%s)\n",
+               *ret_len, gpg_strerror (err));
+
+  /* In case of an auth error we map the error code to the same as
+   * used by the MDC decryption.  */
+  if (gpg_err_code (err) == GPG_ERR_CHECKSUM)
+    err = gpg_error (GPG_ERR_BAD_SIGNATURE);
+
+  return err;
+}
+
+
 /* The IOBUF filter used to decrypt AEAD encrypted data.  */
 static int
 aead_decode_filter (void *opaque, int control, IOBUF a,
@@ -889,7 +1422,17 @@ aead_decode_filter (void *opaque, int control, IOBUF a,
   decode_filter_ctx_t dfx = opaque;
   int rc = 0;
 
-  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
+  if ( control == IOBUFCTRL_UNDERFLOW && dfx->par )
+    {
+      log_assert (a);
+
+      /* Note that EOF_SEEN is already set while we still have
+       * decrypted chunks in the queue.  */
+      rc = dpar_underflow (dfx, a, buf, ret_len);
+      if (gpg_err_code (rc) == GPG_ERR_EOF)
+        rc = -1; /* We need to use the old convention in the filter.  */
+    }
+  else if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
     {
       *ret_len = 0;
       rc = -1;
@@ -223,6 +223,97 @@ decrypt_message_fd (ctrl_t ctrl, gnupg_fd_t input_fd,
 }
 
 
+/* Read the leading PKESK packets of the NFILES FILES and let gpg-agent
+ * decrypt the session keys for the same key in one go.  The actual
+ * decryption later takes them via get_session_key.  */
+static void
+prefetch_session_keys_of_files (ctrl_t ctrl, int nfiles, char *files[])
+{
+  struct pubkey_enc_list *list = NULL, *x;
+  struct parse_packet_ctx_s parsectx;
+  armor_filter_context_t *afx;
+  PACKET pkt;
+  iobuf_t fp;
+  int i, rc, save_mode;
+
+  if (opt.override_session_key || opt.list_only)
+    return;
+
+  save_mode = set_packet_list_mode (0);
+  for (i=0; i < nfiles; i++)
+    {
+      fp = iobuf_open (files[i]);
+      if (fp)
+        iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+      if (fp && is_secured_file (iobuf_get_fd (fp)))
+        {
+          iobuf_close (fp);
+          fp = NULL;
+        }
+      if (!fp)
+        continue;  /* The error will be shown by the actual decryption.  */
+
+      if (!opt.no_armor && use_armor_filter (fp))
+        {
+          afx = new_armor_context ();
+          rc = push_armor_filter (afx, fp);
+          release_armor_context (afx);
+          if (rc)
+            {
+              iobuf_close (fp);
+              continue;
+            }
+        }
+
+      init_packet (&pkt);
+      init_parse_packet (&parsectx, fp);
+      while (!(rc = parse_packet (&parsectx, &pkt)))
+        {
+          if (pkt.pkttype == PKT_PUBKEY_ENC)
+            {
+              x = xtrycalloc (1, sizeof *x);
+              if (!x)
+                break;
+              copy_pubkey_enc_parts (&x->d, pkt.pkt.pubkey_enc);
+              x->result = -1;
+              x->next = list;
+              list = x;
+            }
+          else if (pkt.pkttype != PKT_SYMKEY_ENC
+                   && pkt.pkttype != PKT_MARKER)
+            {
+              /* We are done with this file.  Make sure that the
+               * packet body is not read by free_packet.  */
+              if (pkt.pkttype == PKT_ENCRYPTED
+                  || pkt.pkttype == PKT_ENCRYPTED_MDC
+                  || pkt.pkttype == PKT_ENCRYPTED_AEAD)
+                pkt.pkt.encrypted->buf = NULL;
+              else if (pkt.pkttype == PKT_COMPRESSED)
+                pkt.pkt.compressed->buf = NULL;
+              else if (pkt.pkttype == PKT_PLAINTEXT)
+                pkt.pkt.plaintext->buf = NULL;
+              break;
+            }
+          free_packet (&pkt, &parsectx);
+        }
+      free_packet (&pkt, &parsectx);
+      deinit_parse_packet (&parsectx);
+      iobuf_close (fp);
+    }
+  set_packet_list_mode (save_mode);
+
+  prefetch_session_keys (ctrl, list);
+
+  while (list)
+    {
+      x = list->next;
+      release_pubkey_enc_parts (&list->d);
+      xfree (list);
+      list = x;
+    }
+}
+
+
 void
 decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
 {
@@ -242,6 +333,8 @@ decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
 
   if(!nfiles)
     use_stdin=1;
+  else if (nfiles > 1)
+    prefetch_session_keys_of_files (ctrl, nfiles, files);
 
   for(;;)
     {
@@ -324,5 +417,6 @@ decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
     }
 
   set_next_passphrase(NULL);
+  release_prefetched_session_keys (ctrl);
   release_progress_context (pfx);
 }
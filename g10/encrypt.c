@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "options.h"
@@ -614,7 +615,7 @@ encrypt_simple (const char *filename, int mode, int use_seskey)
       && cfx.dek
       && (cfx.dek->use_mdc || cfx.dek->use_aead)
       && !opt.explicit_compress_option
-      && is_file_compressed (inp))
+      && (is_file_compressed (inp) || !compress_probe (inp)))
     {
       if (opt.verbose)
         log_info(_("'%s' already compressed\n"), filename? filename: "[stdin]");
@@ -963,7 +964,7 @@ encrypt_crypt (ctrl_t ctrl, gnupg_fd_t filefd, const char *filename,
   if (do_compress
       && (cfx.dek->use_mdc || cfx.dek->use_aead)
       && !opt.explicit_compress_option
-      && is_file_compressed (inp))
+      && (is_file_compressed (inp) || !compress_probe (inp)))
     {
       if (opt.verbose)
         log_info(_("'%s' already compressed\n"), filename? filename: "[stdin]");
@@ -1213,17 +1214,34 @@ encrypt_filter (void *opaque, int control,
 }
 
 
-/*
- * Write a pubkey-enc packet for the public key PK to OUT.
- */
-int
-write_pubkey_enc (ctrl_t ctrl,
-                  PKT_public_key *pk, int throw_keyid, DEK *dek, iobuf_t out)
+/* A public key encryption of the session key to be run by a worker
+ * thread.  */
+struct pubkey_enc_job_s
 {
-  PACKET pkt;
+  PKT_public_key *pk;
   PKT_pubkey_enc *enc;
-  int rc;
   gcry_mpi_t frame;
+  gpg_error_t err;
+};
+
+struct pubkey_enc_batch_s
+{
+  npth_mutex_t lock;
+  npth_cond_t cond;       /* Signaled when the last job is done.  */
+  struct pubkey_enc_job_s *jobs;
+  int njobs;
+  int npicked;            /* Number of jobs taken by the threads.  */
+  int ndone;              /* Number of finished jobs.              */
+};
+
+
+/* Create the pubkey-enc packet for PK without the encrypted session
+ * key.  The session key encoded for PK is stored at R_FRAME.  */
+static PKT_pubkey_enc *
+prepare_pubkey_enc (PKT_public_key *pk, int throw_keyid, DEK *dek,
+                    gcry_mpi_t *r_frame)
+{
+  PKT_pubkey_enc *enc;
 
   print_pubkey_algo_note ( pk->pubkey_algo );
   enc = xmalloc_clear ( sizeof *enc );
@@ -1244,10 +1262,20 @@ write_pubkey_enc (ctrl_t ctrl,
    * for Elgamal).  We don't need frame anymore because we have
    * everything now in enc->data which is the passed to
    * build_packet().  */
-  frame = encode_session_key (pk->pubkey_algo, dek,
-                              pubkey_nbits (pk->pubkey_algo, pk->pkey));
-  rc = pk_encrypt (pk, frame, dek->algo, enc->data);
-  gcry_mpi_release (frame);
+  *r_frame = encode_session_key (pk->pubkey_algo, dek,
+                                 pubkey_nbits (pk->pubkey_algo, pk->pkey));
+  return enc;
+}
+
+
+/* Write the pubkey-enc packet ENC for PK to OUT.  RC is the result of
+ * the encryption of the session key.  ENC is released.  */
+static int
+finish_pubkey_enc (ctrl_t ctrl, PKT_public_key *pk, PKT_pubkey_enc *enc,
+                   DEK *dek, int rc, iobuf_t out)
+{
+  PACKET pkt;
+
   if (rc)
     log_error ("pubkey_encrypt failed: %s\n", gpg_strerror (rc) );
   else
@@ -1268,6 +1296,192 @@ write_pubkey_enc (ctrl_t ctrl,
 }
 
 
+/*
+ * Write a pubkey-enc packet for the public key PK to OUT.
+ */
+int
+write_pubkey_enc (ctrl_t ctrl,
+                  PKT_public_key *pk, int throw_keyid, DEK *dek, iobuf_t out)
+{
+  PKT_pubkey_enc *enc;
+  gcry_mpi_t frame;
+  int rc;
+
+  enc = prepare_pubkey_enc (pk, throw_keyid, dek, &frame);
+  rc = pk_encrypt (pk, frame, dek->algo, enc->data);
+  gcry_mpi_release (frame);
+  return finish_pubkey_enc (ctrl, pk, enc, dek, rc, out);
+}
+
+
+static void
+lock_pubkey_enc_batch (struct pubkey_enc_batch_s *batch)
+{
+  int rc = npth_mutex_lock (&batch->lock);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_pubkey_enc_batch (struct pubkey_enc_batch_s *batch)
+{
+  int rc = npth_mutex_unlock (&batch->lock);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* The thread function of the parallel session key encryption.  It is
+ * also run by the caller's thread.  */
+static void *
+pubkey_enc_worker (void *arg)
+{
+  struct pubkey_enc_batch_s *batch = arg;
+  struct pubkey_enc_job_s *job;
+  gpg_error_t err;
+
+  lock_pubkey_enc_batch (batch);
+  while (batch->npicked < batch->njobs)
+    {
+      job = batch->jobs + batch->npicked++;
+      unlock_pubkey_enc_batch (batch);
+
+      npth_unprotect ();
+      err = pk_encrypt (job->pk, job->frame, job->enc->seskey_algo,
+                        job->enc->data);
+      npth_protect ();
+
+      lock_pubkey_enc_batch (batch);
+      job->err = err;
+      if (++batch->ndone == batch->njobs)
+        npth_cond_broadcast (&batch->cond);
+    }
+  unlock_pubkey_enc_batch (batch);
+
+  return NULL;
+}
+
+
+/* Run the public key operations of the NJOBS JOBS using up to
+ * NTHREADS threads including the caller's thread.  */
+static void
+run_pubkey_enc_jobs (struct pubkey_enc_job_s *jobs, int njobs, int nthreads)
+{
+  struct pubkey_enc_batch_s batch;
+  npth_t *threads = NULL;
+  npth_attr_t tattr;
+  int i, rc, nstarted;
+
+  memset (&batch, 0, sizeof batch);
+  batch.jobs = jobs;
+  batch.njobs = njobs;
+
+  if (nthreads > njobs)
+    nthreads = njobs;
+  if (nthreads > 1)
+    threads = xtrycalloc (nthreads - 1, sizeof *threads);
+
+  rc = npth_mutex_init (&batch.lock, NULL);
+  if (!rc)
+    {
+      rc = npth_cond_init (&batch.cond, NULL);
+      if (rc)
+        npth_mutex_destroy (&batch.lock);
+    }
+  if (rc)
+    {
+      log_error ("%s: error initializing mutex: %s\n", __func__,
+                 gpg_strerror (gpg_error_from_errno (rc)));
+      /* Do the work ourselves.  */
+      for (i=0; i < njobs; i++)
+        jobs[i].err = pk_encrypt (jobs[i].pk, jobs[i].frame,
+                                  jobs[i].enc->seskey_algo,
+                                  jobs[i].enc->data);
+      xfree (threads);
+      return;
+    }
+
+  nstarted = 0;
+  if (threads && !npth_attr_init (&tattr))
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      for (i=0; i < nthreads - 1; i++)
+        {
+          rc = npth_create (threads + nstarted, &tattr,
+                            pubkey_enc_worker, &batch);
+          if (rc)
+            {
+              log_info ("only %d of %d public key encryption threads"
+                        " started: %s\n", nstarted + 1, nthreads,
+                        gpg_strerror (gpg_error_from_errno (rc)));
+              break;
+            }
+          nstarted++;
+        }
+      npth_attr_destroy (&tattr);
+    }
+
+  pubkey_enc_worker (&batch);
+
+  lock_pubkey_enc_batch (&batch);
+  while (batch.ndone < batch.njobs)
+    npth_cond_wait (&batch.cond, &batch.lock);
+  unlock_pubkey_enc_batch (&batch);
+
+  for (i=0; i < nstarted; i++)
+    npth_join (threads[i], NULL);
+  npth_cond_destroy (&batch.cond);
+  npth_mutex_destroy (&batch.lock);
+  xfree (threads);
+}
+
+
+/* Write the pubkey-enc packets for the NJOBS recipients of PK_LIST to
+ * OUT.  The session key is encrypted using OPT.PUBKEY_ENC_THREADS
+ * threads and the packets are written in the order of PK_LIST.  */
+static int
+write_pubkey_enc_parallel (ctrl_t ctrl, PK_LIST pk_list, int njobs,
+                           DEK *dek, iobuf_t out)
+{
+  struct pubkey_enc_job_s *jobs;
+  PKT_public_key *pk;
+  int i, throw_keyid;
+  int rc = 0;
+
+  jobs = xtrycalloc (njobs, sizeof *jobs);
+  if (!jobs)
+    return gpg_error_from_syserror ();
+
+  for (i=0; i < njobs; i++, pk_list = pk_list->next)
+    {
+      pk = pk_list->pk;
+      throw_keyid = (opt.throw_keyids || (pk_list->flags&1));
+      jobs[i].pk = pk;
+      jobs[i].enc = prepare_pubkey_enc (pk, throw_keyid, dek, &jobs[i].frame);
+    }
+
+  if (DBG_CRYPTO)
+    log_debug ("%s: encrypting the session key to %d keys with %d threads\n",
+               __func__, njobs, opt.pubkey_enc_threads);
+  run_pubkey_enc_jobs (jobs, njobs, opt.pubkey_enc_threads);
+
+  for (i=0; i < njobs; i++)
+    {
+      gcry_mpi_release (jobs[i].frame);
+      if (rc)
+        free_pubkey_enc (jobs[i].enc);
+      else
+        rc = finish_pubkey_enc (ctrl, jobs[i].pk, jobs[i].enc, dek,
+                                jobs[i].err, out);
+    }
+  xfree (jobs);
+  return rc;
+}
+
+
 /*
  * Write pubkey-enc packets from the list of PKs to OUT.
  */
@@ -1282,6 +1496,17 @@ write_pubkey_enc_from_list (ctrl_t ctrl, PK_LIST pk_list, DEK *dek, iobuf_t out)
       compliance_failure();
     }
 
+  if (opt.pubkey_enc_threads >= 2)
+    {
+      PK_LIST r;
+      int n = 0;
+
+      for (r = pk_list; r; r = r->next)
+        n++;
+      if (n > 1)
+        return write_pubkey_enc_parallel (ctrl, pk_list, n, dek, out);
+    }
+
   for ( ; pk_list; pk_list = pk_list->next )
     {
       PKT_public_key *pk = pk_list->pk;
@@ -1294,10 +1519,14 @@ write_pubkey_enc_from_list (ctrl_t ctrl, PK_LIST pk_list, DEK *dek, iobuf_t out)
   return 0;
 }
 
+/* Encrypt the NFILES FILES or, if NFILES is 0, the files listed on
+ * stdin for the recipients REMUSR.  The recipients are resolved only
+ * once and the same key list is used for all files.  */
 void
 encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
 {
   int rc = 0;
+  pk_list_t pk_list = NULL;
 
   if (opt.outfile)
     {
@@ -1305,6 +1534,15 @@ encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
       return;
     }
 
+  /* Looking up and validating the keys is the same for all files;
+   * thus we do it here and not in encrypt_crypt.  */
+  rc = build_pk_list (ctrl, remusr, &pk_list);
+  if (rc)
+    {
+      log_error ("encryption failed: %s\n", gpg_strerror (rc));
+      return;
+    }
+
   if (!nfiles)
     {
       char line[2048];
@@ -1315,12 +1553,12 @@ encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
           if (!*line || line[strlen(line)-1] != '\n')
             {
               log_error("input line %u too long or missing LF\n", lno);
-              return;
+              break;
             }
           line[strlen(line)-1] = '\0';
           print_file_status(STATUS_FILE_START, line, 2);
           rc = encrypt_crypt (ctrl, GNUPG_INVALID_FD, line, remusr,
-                              0, NULL, GNUPG_INVALID_FD);
+                              0, pk_list, GNUPG_INVALID_FD);
           if (rc)
             log_error ("encryption of '%s' failed: %s\n",
                        print_fname_stdin(line), gpg_strerror (rc) );
@@ -1333,11 +1571,13 @@ encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
         {
           print_file_status(STATUS_FILE_START, *files, 2);
           if ((rc = encrypt_crypt (ctrl, GNUPG_INVALID_FD, *files, remusr,
-                                   0, NULL, GNUPG_INVALID_FD)))
+                                   0, pk_list, GNUPG_INVALID_FD)))
             log_error("encryption of '%s' failed: %s\n",
                       print_fname_stdin(*files), gpg_strerror (rc) );
           write_status( STATUS_FILE_DONE );
           files++;
         }
     }
+
+  release_pk_list (pk_list);
 }
@@ -1637,7 +1637,8 @@ apply_keep_uid_filter (ctrl_t ctrl, kbnode_t keyblock, recsel_expr_t selector)
       if (node->pkt->pkttype == PKT_USER_ID)
         {
           parm.node = node;
-          if (!recsel_select (selector, impex_filter_getval, &parm))
+          if (!recsel_select_ext (selector, impex_filter_getval,
+                                  impex_filter_getnum, &parm))
             {
               /* log_debug ("keep-uid: deleting '%s'\n", */
               /*            node->pkt->pkt.user_id->name); */
@@ -1679,7 +1680,8 @@ apply_drop_subkey_filter (ctrl_t ctrl, kbnode_t keyblock,
           || node->pkt->pkttype == PKT_SECRET_SUBKEY)
         {
           parm.node = node;
-          if (recsel_select (selector, impex_filter_getval, &parm))
+          if (recsel_select_ext (selector, impex_filter_getval,
+                                 impex_filter_getnum, &parm))
             {
               /*log_debug ("drop-subkey: deleting a key\n");*/
               /* The subkey packet and all following packets up to the
@@ -2230,6 +2232,275 @@ get_keywrap_key (ctrl_t ctrl, gcry_cipher_hd_t *r_cipherhd)
 }
 
 
+/* Get the next packet from the keyblock image at *BUFFER of length
+ * *BUFLEN.  The type of the packet is stored at R_TYPE, its body at
+ * R_BODY and R_BODYLEN, and the length of the entire packet at
+ * R_PKTLEN.  *BUFFER and *BUFLEN are advanced to the next packet.
+ * GPG_ERR_NOT_SUPPORTED is returned for anything we don't expect in a
+ * stored keyblock; for example partial lengths.  */
+static gpg_error_t
+next_image_packet (const byte **buffer, size_t *buflen, int *r_type,
+                   const byte **r_body, size_t *r_bodylen, size_t *r_pktlen)
+{
+  const byte *p = *buffer;
+  size_t n = *buflen;
+  size_t hdrlen, len;
+  int c;
+
+  if (n < 2 || !(*p & 0x80))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  c = *p;
+  if ((c & 0x40))
+    {
+      *r_type = (c & 0x3f);
+      c = p[1];
+      if (c < 192)
+        {
+          hdrlen = 2;
+          len = c;
+        }
+      else if (c < 224)
+        {
+          if (n < 3)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          hdrlen = 3;
+          len = ((c - 192) << 8) + p[2] + 192;
+        }
+      else if (c == 255)
+        {
+          if (n < 6)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          hdrlen = 6;
+          len = buf32_to_size_t (p+2);
+        }
+      else /* Partial length.  */
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  else
+    {
+      *r_type = ((c >> 2) & 0xf);
+      switch ((c & 3))
+        {
+        case 0: hdrlen = 2; len = p[1]; break;
+        case 1: hdrlen = 3; len = n < 3? 0 : buf16_to_ulong (p+1); break;
+        case 2: hdrlen = 5; len = n < 5? 0 : buf32_to_size_t (p+1); break;
+        default: /* Indeterminate length.  */
+          return gpg_error (GPG_ERR_NOT_SUPPORTED);
+        }
+    }
+  if (hdrlen > n || len > n - hdrlen)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  *r_body = p + hdrlen;
+  *r_bodylen = len;
+  *r_pktlen = hdrlen + len;
+  *buffer = p + hdrlen + len;
+  *buflen = n - hdrlen - len;
+  return 0;
+}
+
+
+/* Walk the subpacket AREA of length AREALEN of a v4 signature with
+ * class SIGCLASS.  Stores the value of the first exportable subpacket
+ * at R_EXPORTABLE or -1 if there is none or if that first one is
+ * invalid; this is what parse_sig_subpkt returns.  If R_SENSITIVE is
+ * not NULL true is stored there if the area has a sensitive
+ * revocation key.  */
+static gpg_error_t
+image_scan_subpkts (const byte *area, size_t arealen, int sigclass,
+                    int *r_exportable, int *r_sensitive)
+{
+  size_t sublen;
+  int type, seen = 0;
+
+  *r_exportable = -1;
+  if (r_sensitive)
+    *r_sensitive = 0;
+  while (arealen)
+    {
+      if (*area < 192)
+        {
+          sublen = *area;
+          area++; arealen--;
+        }
+      else if (*area < 255)
+        {
+          if (arealen < 2)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          sublen = ((area[0] - 192) << 8) + area[1] + 192;
+          area += 2; arealen -= 2;
+        }
+      else
+        {
+          if (arealen < 5)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          sublen = buf32_to_size_t (area+1);
+          area += 5; arealen -= 5;
+        }
+      if (!sublen || sublen > arealen)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+      type = (area[0] & 0x7f);
+      if (type == SIGSUBPKT_EXPORTABLE && !seen)
+        {
+          seen = 1;
+          if (sublen > 1)
+            *r_exportable = !!area[1];
+        }
+      else if (r_sensitive && type == SIGSUBPKT_REV_KEY && sigclass == 0x1f
+               && (sublen - 1 == 22 || sublen - 1 == 34)
+               && (area[1] & 0x80) && (area[1] & 0x40))
+        *r_sensitive = 1;
+
+      area += sublen; arealen -= sublen;
+    }
+
+  return 0;
+}
+
+
+/* Decide whether the signature packet with BODY and BODYLEN shall be
+ * exported the same way do_export_one_keyblock would do it with
+ * OPTIONS.  Stores true at R_EXPORT if so.  Returns
+ * GPG_ERR_NOT_SUPPORTED for signature versions we can't scan.  */
+static gpg_error_t
+image_sig_exportable (const byte *body, size_t bodylen,
+                      unsigned int options, int *r_export)
+{
+  gpg_error_t err;
+  const byte *hashed, *unhashed;
+  size_t hashedlen, unhashedlen;
+  int sigclass, exportable, sensitive;
+
+  *r_export = 1;
+  if (bodylen && body[0] == 3)
+    return 0;  /* No subpackets.  */
+  if (bodylen < 8 || body[0] != 4)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  sigclass = body[1];
+  hashedlen = buf16_to_ulong (body+4);
+  hashed = body + 6;
+  if (hashedlen > bodylen - 8)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  unhashedlen = buf16_to_ulong (hashed + hashedlen);
+  unhashed = hashed + hashedlen + 2;
+  if (unhashedlen > bodylen - 8 - hashedlen)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  /* Like parse_signature we take the exportable flag from the hashed
+   * area and only if it is not there from the unhashed area, because
+   * old versions of gpg put it there.  Revocation keys are only taken
+   * from the hashed area.  */
+  err = image_scan_subpkts (hashed, hashedlen, sigclass,
+                            &exportable, &sensitive);
+  if (!err && exportable == -1)
+    err = image_scan_subpkts (unhashed, unhashedlen, sigclass,
+                              &exportable, NULL);
+  if (err)
+    return err;
+
+  if (!exportable && !(options & EXPORT_LOCAL_SIGS))
+    *r_export = 0;
+  else if (sensitive && !(options & EXPORT_SENSITIVE_REVKEYS))
+    *r_export = 0;
+
+  return 0;
+}
+
+
+/* Helper for do_export_stream which copies the packets of the stored
+ * keyblock IMAGE of length IMAGELEN to OUT without parsing them.
+ * The same packets as with do_export_one_keyblock are skipped, which
+ * is only possible for the default set of OPTIONS.  Returns
+ * GPG_ERR_NOT_SUPPORTED without writing anything if the image can't
+ * be handled this way; the caller then needs to use the regular
+ * code.  */
+static gpg_error_t
+do_export_keyblock_image (ctrl_t ctrl, const byte *image, size_t imagelen,
+                          iobuf_t out, unsigned int options,
+                          export_stats_t stats, int *any)
+{
+  gpg_error_t err;
+  const byte *p, *body;
+  size_t n, bodylen, pktlen;
+  int pass, type, doit;
+
+  (void)ctrl;
+
+  /* The first pass only checks that we can handle the image.  */
+  for (pass = 0; pass < 2; pass++)
+    {
+      for (p = image, n = imagelen; n; )
+        {
+          const byte *pkt = p;
+
+          err = next_image_packet (&p, &n, &type, &body, &bodylen, &pktlen);
+          if (err)
+            return err;
+          if (pkt == image && type != PKT_PUBLIC_KEY)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+          switch (type)
+            {
+            case PKT_PUBLIC_KEY:
+            case PKT_PUBLIC_SUBKEY:
+            case PKT_USER_ID:
+            case PKT_ATTRIBUTE:
+              doit = 1;
+              break;
+            case PKT_SIGNATURE:
+              err = image_sig_exportable (body, bodylen, options, &doit);
+              if (err)
+                return err;
+              break;
+            case PKT_RING_TRUST:
+              doit = 0;
+              break;
+            default:
+              return gpg_error (GPG_ERR_NOT_SUPPORTED);
+            }
+
+          if (pass && doit)
+            {
+              err = iobuf_write (out, pkt, pktlen);
+              if (err)
+                {
+                  log_error ("error writing keyblock: %s\n",
+                             gpg_strerror (err));
+                  return err;
+                }
+            }
+        }
+    }
+
+  stats->exported++;
+  *any = 1;
+
+  if (is_status_enabled ())
+    {
+      /* We need the public key for the fingerprint.  */
+      struct parse_packet_ctx_s parsectx;
+      iobuf_t a;
+      PACKET pkt;
+
+      p = image;
+      n = imagelen;
+      next_image_packet (&p, &n, &type, &body, &bodylen, &pktlen);
+      a = iobuf_temp_with_content (image, pktlen);
+      init_packet (&pkt);
+      init_parse_packet (&parsectx, a);
+      if (!parse_packet (&parsectx, &pkt) && pkt.pkttype == PKT_PUBLIC_KEY)
+        print_status_exported (pkt.pkt.public_key);
+      free_packet (&pkt, &parsectx);
+      deinit_parse_packet (&parsectx);
+      iobuf_close (a);
+    }
+
+  return 0;
+}
+
+
 /* Export the keys identified by the list of strings in USERS to the
    stream OUT.  If SECRET is false public keys will be exported.  With
    secret true secret keys will be exported; in this case 1 means the
@@ -2255,6 +2526,7 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
   gcry_cipher_hd_t cipherhd = NULL;
   struct export_stats_s dummystats;
   iobuf_t out_help = NULL;
+  int raw_export;
 
   if (!stats)
     stats = &dummystats;
@@ -2307,6 +2579,19 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
   if (secret && (err = get_keywrap_key (ctrl, &cipherhd)))
     goto leave;
 
+  /* Without filters and cleaning we can copy the stored packets of
+   * the keyblocks directly to the output.  */
+  raw_export = (!secret && !keyblock_out
+                && (options & EXPORT_ATTRIBUTES)
+                && !(options & (EXPORT_MINIMAL | EXPORT_CLEAN
+                                | EXPORT_REALCLEAN | EXPORT_DANE_FORMAT
+                                | EXPORT_BACKUP | EXPORT_REVOCS))
+                && !export_keep_uid && !export_drop_subkey
+                && !export_select_filter);
+  for (descindex = 0; raw_export && descindex < ndesc; descindex++)
+    if (desc[descindex].exact)
+      raw_export = 0;
+
   for (;;)
     {
       u32 keyid[2];
@@ -2318,6 +2603,33 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
       if (err)
         break;
 
+      if (raw_export)
+        {
+          iobuf_t image;
+
+          err = keydb_get_keyblock_image (kdbhd, &image);
+          if (!err)
+            {
+              err = do_export_keyblock_image (ctrl,
+                                              iobuf_get_temp_buffer (image),
+                                              iobuf_get_temp_length (image),
+                                              out, options, stats, any);
+              iobuf_close (image);
+              if (!err)
+                {
+                  stats->count++;
+                  continue;
+                }
+            }
+          if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+            {
+              log_error (_("error reading keyblock: %s\n"),
+                         gpg_strerror (err));
+              goto leave;
+            }
+          err = 0;
+        }
+
       /* Read the keyblock. */
       release_kbnode (keyblock);
       keyblock = NULL;
@@ -2396,8 +2708,9 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
 
           for (parm.node = keyblock; parm.node; parm.node = parm.node->next)
             {
-              if (recsel_select (export_select_filter,
-                                 impex_filter_getval, &parm))
+              if (recsel_select_ext (export_select_filter,
+                                     impex_filter_getval,
+                                     impex_filter_getnum, &parm))
                 {
                   selected = 1;
                   break;
@@ -87,6 +87,8 @@ struct compress_filter_context_s {
     int algo1hack;
     int new_ctb;
     void (*release)(struct compress_filter_context_s*);
+    struct compress_thd_s *thd;  /* Used with --compress-threads.  */
+    struct compress_pz_s *pz;    /* Used with --parallel-compress.  */
 };
 typedef struct compress_filter_context_s compress_filter_context_t;
 
@@ -137,6 +139,9 @@ typedef struct
   size_t bufsize;  /* Allocated length.  */
   size_t buflen;   /* Used length.       */
 
+  /* State for the multi-threaded AEAD encryption or NULL.  */
+  struct aead_par_s *par;
+
 } cipher_filter_context_t;
 
 
@@ -183,6 +188,7 @@ gpg_error_t push_compress_filter (iobuf_t out, compress_filter_context_t *zfx,
                                   int algo);
 gpg_error_t push_compress_filter2 (iobuf_t out,compress_filter_context_t *zfx,
                                    int algo, int rel);
+int compress_probe (iobuf_t inp);
 
 /*-- cipher.c --*/
 int cipher_filter_cfb (void *opaque, int control,
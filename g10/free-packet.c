@@ -27,9 +27,150 @@
 #include "../common/util.h"
 #include "packet.h"
 #include "../common/iobuf.h"
+#include "../common/init.h"
 #include "options.h"
 
 
+/* Parsing a keyring allocates and releases a large number of packet,
+ * signature and public key objects of always the same size.  To cut
+ * down the malloc overhead we keep a bounded number of released
+ * objects on free lists and hand them out again.  Each object on a
+ * list is a regular malloced block so that it may still be released
+ * with xfree.  */
+#define POOL_MAX_ITEMS 1024
+
+struct pool_item_s
+{
+  struct pool_item_s *next;
+};
+
+struct object_pool_s
+{
+  struct pool_item_s *items;
+  unsigned int nitems;
+};
+
+static struct object_pool_s packet_pool;
+static struct object_pool_s signature_pool;
+static struct object_pool_s public_key_pool;
+static int pool_cleanup_registered;
+
+
+static void
+release_pool (struct object_pool_s *pool)
+{
+  struct pool_item_s *item;
+
+  while ((item = pool->items))
+    {
+      pool->items = item->next;
+      xfree (item);
+    }
+  pool->nitems = 0;
+}
+
+
+static void
+release_object_pools (void)
+{
+  release_pool (&packet_pool);
+  release_pool (&signature_pool);
+  release_pool (&public_key_pool);
+}
+
+
+/* Return a cleared object of SIZE bytes, taken from POOL if
+ * possible.  Returns NULL and sets ERRNO on error.  */
+static void *
+pool_alloc (struct object_pool_s *pool, size_t size)
+{
+  struct pool_item_s *item;
+
+  item = pool->items;
+  if (item)
+    {
+      pool->items = item->next;
+      pool->nitems--;
+      memset (item, 0, size);
+      return item;
+    }
+
+  if (!pool_cleanup_registered)
+    {
+      pool_cleanup_registered = 1;
+      register_mem_cleanup_func (release_object_pools);
+    }
+  return xtrycalloc (1, size);
+}
+
+
+/* Put OBJECT back into POOL or release it if the pool is full.  */
+static void
+pool_free (struct object_pool_s *pool, void *object)
+{
+  struct pool_item_s *item = object;
+
+  if (!object)
+    return;
+  if (pool->nitems >= POOL_MAX_ITEMS)
+    {
+      xfree (object);
+      return;
+    }
+  item->next = pool->items;
+  pool->items = item;
+  pool->nitems++;
+}
+
+
+/* Allocate a new packet object.  The caller needs to call
+ * init_packet on it.  Returns NULL and sets ERRNO on error.  The
+ * object may be released with xfree or with release_packet_object.  */
+PACKET *
+alloc_packet_object (void)
+{
+  return pool_alloc (&packet_pool, sizeof (PACKET));
+}
+
+
+/* Release the packet object PKT as allocated by alloc_packet_object
+ * or by a plain malloc.  This does not release the content of the
+ * packet; see free_packet for this.  */
+void
+release_packet_object (PACKET *pkt)
+{
+  pool_free (&packet_pool, pkt);
+}
+
+
+/* Allocate a cleared signature object.  Terminates the process on
+ * error.  */
+PKT_signature *
+alloc_signature_object (void)
+{
+  PKT_signature *sig;
+
+  sig = pool_alloc (&signature_pool, sizeof *sig);
+  if (!sig)
+    xoutofcore ();
+  return sig;
+}
+
+
+/* Allocate a cleared public key object.  Terminates the process on
+ * error.  */
+PKT_public_key *
+alloc_public_key_object (void)
+{
+  PKT_public_key *pk;
+
+  pk = pool_alloc (&public_key_pool, sizeof *pk);
+  if (!pk)
+    xoutofcore ();
+  return pk;
+}
+
+
 /* This is a wrapper for mpi_copy which handles opaque MPIs with a
  * NULL pointer as opaque data; e.g. gcry_mpi_set_opaque(a, NULL, 0).
  * It seems that at least gcry_mpi_set_opaque_copy does not yet handle
@@ -113,7 +254,7 @@ free_seckey_enc( PKT_signature *sig )
 
   xfree (sig->signers_uid);
 
-  xfree(sig);
+  pool_free (&signature_pool, sig);
 }
 
 
@@ -172,7 +313,7 @@ free_public_key (PKT_public_key *pk)
   if (pk)
     {
       release_public_key_parts (pk);
-      xfree(pk);
+      pool_free (&public_key_pool, pk);
     }
 }
 
@@ -187,6 +328,8 @@ cp_subpktarea (subpktarea_t *s )
     d = xmalloc (sizeof (*d) + s->size - 1 );
     d->size = s->size;
     d->len = s->len;
+    d->indexed = s->indexed;
+    memcpy (d->index, s->index, sizeof d->index);
     memcpy (d->data, s->data, s->len);
     return d;
 }
@@ -178,8 +178,8 @@ print_stats ()
  * copy_public_key.  Thus, any secret parts are not copied, for
  * instance.
  *
- * This cache is filled by get_pubkey and is read by get_pubkey and
- * get_pubkey_fast.  */
+ * This cache is filled by get_pubkey and get_pubkey_byfpr and is read
+ * by get_pubkey, get_pubkey_byfpr and get_pubkey_fast.  */
 void
 cache_public_key (PKT_public_key * pk)
 {
@@ -916,6 +916,111 @@ key_byname (ctrl_t ctrl, GETKEY_CTX *retctx, strlist_t namelist,
 }
 
 
+/* State of the concurrent lookup of the auto-key-locate mechanisms in
+ * get_pubkey_byname.  */
+struct akl_race_s
+{
+  int started;          /* The lookup has been run.  */
+  unsigned int pending; /* Bit mask of the AKL types not yet used.  */
+  int winner;           /* The AKL type which found the key or -1.  */
+  int winner_used;      /* The result of WINNER has been used.  */
+  gpg_error_t err;      /* The error of the import of the key.  */
+  unsigned char *fpr;   /* The fingerprint of the imported key.  */
+  size_t fprlen;
+};
+
+
+/* Run the mechanisms of the auto-key-locate list starting at AKL
+ * which are supported by dirmngr's LOCATE command concurrently.  The
+ * result is stored at RACE.  If less than two such mechanisms are
+ * listed or the dirmngr does not support this, RACE->PENDING is left
+ * at 0 so that all mechanisms are tried in turn.  */
+static void
+akl_race_run (ctrl_t ctrl, const char *name, struct akl *akl,
+              struct akl_race_s *race)
+{
+  char mechanisms[20];
+  char *mechname = NULL;
+  unsigned int mask = 0;
+  int n = 0;
+  gpg_error_t err;
+
+  race->started = 1;
+  race->winner = -1;
+  *mechanisms = 0;
+  for (; akl; akl = akl->next)
+    if ((akl->type == AKL_WKD || akl->type == AKL_DANE)
+        && !(mask & (1 << akl->type)))
+      {
+        mask |= 1 << akl->type;
+        if (n++)
+          strcat (mechanisms, ",");
+        strcat (mechanisms, akl->type == AKL_WKD? "wkd" : "dane");
+      }
+  if (n < 2)
+    return;
+
+  glo_ctrl.in_auto_key_retrieve++;
+  err = keyserver_import_concurrent (ctrl, name, mechanisms, &mechname,
+                                     &race->fpr, &race->fprlen);
+  glo_ctrl.in_auto_key_retrieve--;
+  if (mechname)
+    {
+      /* The key was found - ERR tells whether the import worked.  */
+      race->winner = !strcmp (mechname, "wkd")? AKL_WKD : AKL_DANE;
+      race->err = err;
+      race->pending = mask;
+    }
+  else if (gpg_err_code (err) == GPG_ERR_NO_DATA)
+    race->pending = mask;  /* None of the mechanisms found a key.  */
+  else if (opt.verbose)
+    log_info ("concurrent key lookup for '%s' failed: %s\n",
+              name, gpg_strerror (err));
+  xfree (mechname);
+}
+
+
+/* Take the result for the mechanism AKL from the concurrent lookup
+ * RACE; the lookup is run on the first call.  Returns false if the
+ * mechanism needs to be run directly.  If true is returned the
+ * result is stored at R_RC and, if a key was imported, its
+ * fingerprint at R_FPR and R_FPRLEN.  */
+static int
+akl_race_result (ctrl_t ctrl, const char *name, struct akl *akl,
+                 struct akl_race_s *race, int *r_rc,
+                 unsigned char **r_fpr, size_t *r_fprlen)
+{
+  if (!opt.flags.akl_concurrent)
+    return 0;
+  if (!race->started)
+    akl_race_run (ctrl, name, akl, race);
+  if (!(race->pending & (1 << akl->type)))
+    return 0;
+  race->pending &= ~(1 << akl->type);
+
+  if (akl->type == race->winner)
+    {
+      race->winner_used = 1;
+      *r_rc = race->err;
+      *r_fpr = race->fpr;
+      race->fpr = NULL;
+      *r_fprlen = race->fprlen;
+      return 1;
+    }
+  if (race->winner_used)
+    {
+      /* The key found by the winner was not usable and this
+       * mechanism may have found another key.  Because the dirmngr
+       * did not wait for it, run this mechanism again.  */
+      return 0;
+    }
+  /* This mechanism has a higher priority than the winner and failed
+   * or none of the mechanisms found a key.  */
+  *r_rc = GPG_ERR_NO_PUBKEY;
+  return 1;
+}
+
+
 /* Find a public key identified by NAME.
  *
  * If name appears to be a valid RFC822 mailbox (i.e., email address)
@@ -987,6 +1092,7 @@ get_pubkey_byname (ctrl_t ctrl, enum get_pubkey_modes mode,
   int anylocalfirst = 0;
   int mechanism_type = AKL_NODEFAULT;
   struct akl *used_akl = opt.auto_key_locate;
+  struct akl_race_s race = { 0 };
 
   /* If RETCTX is not NULL, then RET_KDBHD must be NULL.  */
   log_assert (retctx == NULL || ret_kdbhd == NULL);
@@ -1181,9 +1287,14 @@ get_pubkey_byname (ctrl_t ctrl, enum get_pubkey_modes mode,
               else
                 {
                   mechanism_string = "DANE";
-                  glo_ctrl.in_auto_key_retrieve++;
-                  rc = keyserver_import_cert (ctrl, name, 1, &fpr, &fpr_len);
-                  glo_ctrl.in_auto_key_retrieve--;
+                  if (!akl_race_result (ctrl, name, akl, &race,
+                                        &rc, &fpr, &fpr_len))
+                    {
+                      glo_ctrl.in_auto_key_retrieve++;
+                      rc = keyserver_import_cert (ctrl, name, 1,
+                                                  &fpr, &fpr_len);
+                      glo_ctrl.in_auto_key_retrieve--;
+                    }
                 }
 	      break;
 
@@ -1196,9 +1307,14 @@ get_pubkey_byname (ctrl_t ctrl, enum get_pubkey_modes mode,
               else
                 {
                   mechanism_string = "WKD";
-                  glo_ctrl.in_auto_key_retrieve++;
-                  rc = keyserver_import_wkd (ctrl, name, 0, &fpr, &fpr_len);
-                  glo_ctrl.in_auto_key_retrieve--;
+                  if (!akl_race_result (ctrl, name, akl, &race,
+                                        &rc, &fpr, &fpr_len))
+                    {
+                      glo_ctrl.in_auto_key_retrieve++;
+                      rc = keyserver_import_wkd (ctrl, name, 0,
+                                                 &fpr, &fpr_len);
+                      glo_ctrl.in_auto_key_retrieve--;
+                    }
                 }
 	      break;
 
@@ -1400,6 +1516,7 @@ get_pubkey_byname (ctrl_t ctrl, enum get_pubkey_modes mode,
   else
     free_strlist (namelist);
 
+  xfree (race.fpr);
   return rc;
 }
 
@@ -1896,14 +2013,48 @@ get_pubkey_byfpr (ctrl_t ctrl, PKT_public_key *pk, kbnode_t *r_keyblock,
       KBNODE kb = NULL;
       KBNODE found_key = NULL;
 
+#if MAX_PK_CACHE_ENTRIES
+      if (pk && !r_keyblock && !pk->req_usage && fprlen != 16)
+        {
+          /* Try to get it from the cache.  This is the common case
+           * when verifying many signatures issued by the same key.
+           * We compare the key id first to avoid computing the
+           * fingerprint of all cached keys.  */
+          pk_cache_entry_t ce;
+          u32 keyid[2];
+          byte cfpr[MAX_FINGERPRINT_LEN];
+          size_t cfprlen;
+
+          keyid_from_fingerprint (ctrl, fpr, fprlen, keyid);
+          for (ce = pk_cache; ce; ce = ce->next)
+            if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
+              {
+                fingerprint_from_pk (ce->pk, cfpr, &cfprlen);
+                if (cfprlen == fprlen && !memcmp (cfpr, fpr, fprlen))
+                  {
+                    copy_public_key (pk, ce->pk);
+                    return 0;
+                  }
+                break;
+              }
+        }
+#endif
+
       memset (&ctx, 0, sizeof ctx);
       ctx.exact = 1;
       ctx.not_allocated = 1;
-      /* FIXME: We should get the handle from the cache like we do in
-       * get_pubkey.  */
-      ctx.kr_handle = keydb_new (ctrl);
-      if (!ctx.kr_handle)
-        return gpg_error_from_syserror ();
+      if (ctrl && ctrl->cached_getkey_kdb)
+        {
+          ctx.kr_handle = ctrl->cached_getkey_kdb;
+          ctrl->cached_getkey_kdb = NULL;
+          keydb_search_reset (ctx.kr_handle);
+        }
+      else
+        {
+          ctx.kr_handle = keydb_new (ctrl);
+          if (!ctx.kr_handle)
+            return gpg_error_from_syserror ();
+        }
 
       ctx.nitems = 1;
       ctx.items[0].mode = KEYDB_SEARCH_MODE_FPR;
@@ -1913,7 +2064,11 @@ get_pubkey_byfpr (ctrl_t ctrl, PKT_public_key *pk, kbnode_t *r_keyblock,
         ctx.req_usage = pk->req_usage;
       rc = lookup (ctrl, &ctx, 0, &kb, &found_key);
       if (!rc && pk)
-	pk_from_block (pk, kb, found_key);
+        {
+          pk_from_block (pk, kb, found_key);
+          if (!pk->req_usage)
+            cache_public_key (pk);
+        }
       if (!rc && r_keyblock)
 	{
 	  *r_keyblock = kb;
@@ -2094,6 +2249,7 @@ parse_def_secret_key (ctrl_t ctrl)
         }
 
       merge_selfsigs (ctrl, kb);
+      keydb_put_sigcache (hd, kb);
 
       any_revoked = any_expired = any_disabled = 0;
       err = gpg_error (GPG_ERR_NO_SECKEY);
@@ -4058,6 +4214,7 @@ lookup (ctrl_t ctrl, getkey_ctx_t ctx, int want_secret,
       /* Warning: node flag bits 0 and 1 should be preserved by
        * merge_selfsigs.  */
       merge_selfsigs (ctrl, keyblock);
+      keydb_put_sigcache (ctx->kr_handle, keyblock);
       found_key = finish_lookup (keyblock, ctx->req_usage, ctx->exact,
                                  want_secret, ctx->allow_adsk,
                                  &infoflags);
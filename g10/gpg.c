@@ -31,6 +31,7 @@
 #include <sys/stat.h> /* for stat() */
 #endif
 #include <fcntl.h>
+#include <time.h>
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
 #  include <winsock2.h>
@@ -50,6 +51,7 @@
 #include "options.h"
 #include "keydb.h"
 #include "trustdb.h"
+#include "tdbio.h"
 #include "filter.h"
 #include "../common/ttyio.h"
 #include "../common/i18n.h"
@@ -62,6 +64,8 @@
 #include "call-dirmngr.h"
 #include "tofu.h"
 #include "objcache.h"
+#include "sigcache.h"
+#include "rcptcache.h"
 #include "../common/init.h"
 #include "../common/mbox-util.h"
 #include "../common/zb32.h"
@@ -108,6 +112,10 @@ enum cmd_and_opt_values
     oMaxOutput,
     oInputSizeHint,
     oChunkSize,
+    oAEADThreads,
+    oSigCheckThreads,
+    oPubkeyEncThreads,
+    oRecipientCacheTTL,
     oSigNotation,
     oCertNotation,
     oShowNotation,
@@ -139,6 +147,7 @@ enum cmd_and_opt_values
     aQuickSetPrimaryUid,
     aQuickUpdatePref,
     aQuickSetOwnertrust,
+    aQuickEditKey,
     aListConfig,
     aListGcryptConfig,
     aGPGConfList,
@@ -183,6 +192,7 @@ enum cmd_and_opt_values
     aEnArmor,
     aGenRandom,
     aRebuildKeydbCaches,
+    aMigrateToKeyboxd,
     aCardStatus,
     aCardEdit,
     aChangePIN,
@@ -238,6 +248,8 @@ enum cmd_and_opt_values
     oDebugAll,
     oDebugIOLBF,
     oDebugSetIobufSize,
+    oMmapInput,
+    oIoUring,
     oDebugAllowLargeChunks,
     oDebugIgnoreExpiration,
     oStatusFD,
@@ -268,6 +280,8 @@ enum cmd_and_opt_values
     oCompressAlgo,
     oCompressLevel,
     oBZ2CompressLevel,
+    oCompressThreads,
+    oParallelCompress,
     oBZ2DecompressLowmem,
     oPassphrase,
     oPassphraseFD,
@@ -390,6 +404,7 @@ enum cmd_and_opt_values
     oNoSigCache,
     oAutoCheckTrustDB,
     oNoAutoCheckTrustDB,
+    oTrustDBFidx,
     oPreservePermissions,
     oDefaultPreferenceList,
     oDefaultKeyserverURL,
@@ -426,6 +441,8 @@ enum cmd_and_opt_values
     oNoRequireCrossCert,
     oAutoKeyLocate,
     oNoAutoKeyLocate,
+    oAutoKeyLocateConcurrent,
+    oNoAutoKeyLocateConcurrent,
     oEnableLargeRSA,
     oDisableLargeRSA,
     oEnableDSA2,
@@ -514,6 +531,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_c (aQuickSetPrimaryUid,  "quick-set-primary-uid", "@"),
   ARGPARSE_c (aQuickUpdatePref,  "quick-update-pref", "@"),
   ARGPARSE_c (aQuickSetOwnertrust,  "quick-set-ownertrust", "@"),
+  ARGPARSE_c (aQuickEditKey,  "quick-edit-key",
+              N_("quickly apply a list of changes to a key")),
   ARGPARSE_c (aFullKeygen,  "full-generate-key" ,
               N_("full featured key pair generation")),
   ARGPARSE_c (aFullKeygen,  "full-gen-key", "@"),
@@ -594,6 +613,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_c (aDeleteSecretAndPublicKeys,
               "delete-secret-and-public-keys", "@"),
   ARGPARSE_c (aRebuildKeydbCaches, "rebuild-keydb-caches", "@"),
+  ARGPARSE_c (aMigrateToKeyboxd, "migrate-to-keyboxd", "@"),
   ARGPARSE_c (aListKeys, "list-key", "@"),   /* alias */
   ARGPARSE_c (aListSigs, "list-sig", "@"),   /* alias */
   ARGPARSE_c (aCheckKeys, "check-sig", "@"), /* alias */
@@ -613,6 +633,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDebugAll, "debug-all", "@"),
   ARGPARSE_s_n (oDebugIOLBF, "debug-iolbf", "@"),
   ARGPARSE_s_u (oDebugSetIobufSize, "debug-set-iobuf-size", "@"),
+  ARGPARSE_s_n (oMmapInput, "mmap-input", "@"),
+  ARGPARSE_s_n (oIoUring, "io-uring", "@"),
   ARGPARSE_s_u (oDebugAllowLargeChunks, "debug-allow-large-chunks", "@"),
   ARGPARSE_s_s (oDisplayCharset, "display-charset", "@"),
   ARGPARSE_s_s (oDisplayCharset, "charset", "@"),
@@ -724,6 +746,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (oTrustDBName, "trustdb-name", "@"),
   ARGPARSE_s_n (oAutoCheckTrustDB, "auto-check-trustdb", "@"),
   ARGPARSE_s_n (oNoAutoCheckTrustDB, "no-auto-check-trustdb", "@"),
+  ARGPARSE_s_n (oTrustDBFidx, "trustdb-fidx", "@"),
   ARGPARSE_s_s (oForceOwnertrust, "force-ownertrust", "@"),
   ARGPARSE_s_n (oNoAutoTrustNewKey, "no-auto-trust-new-key", "@"),
 #endif
@@ -783,6 +806,10 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oMangleDosFilenames,      "mangle-dos-filenames", "@"),
   ARGPARSE_s_n (oNoMangleDosFilenames, "no-mangle-dos-filenames", "@"),
   ARGPARSE_s_i (oChunkSize, "chunk-size", "@"),
+  ARGPARSE_s_i (oAEADThreads, "aead-threads", "@"),
+  ARGPARSE_s_i (oSigCheckThreads, "sig-check-threads", "@"),
+  ARGPARSE_s_i (oPubkeyEncThreads, "pubkey-enc-threads", "@"),
+  ARGPARSE_s_u (oRecipientCacheTTL, "recipient-cache-ttl", "@"),
   ARGPARSE_s_n (oNoSymkeyCache, "no-symkey-cache", "@"),
   ARGPARSE_s_n (oSkipVerify, "skip-verify", "@"),
   ARGPARSE_s_n (oListOnly, "list-only", "@"),
@@ -790,6 +817,8 @@ static gpgrt_opt_t opts[] = {
                 N_("|N|set compress level to N (0 disables)")),
   ARGPARSE_s_i (oCompressLevel, "compress-level", "@"),
   ARGPARSE_s_i (oBZ2CompressLevel, "bzip2-compress-level", "@"),
+  ARGPARSE_s_i (oCompressThreads, "compress-threads", "@"),
+  ARGPARSE_s_n (oParallelCompress, "parallel-compress", "@"),
   ARGPARSE_s_n (oDisableSignerUID, "disable-signer-uid", "@"),
 
   ARGPARSE_header ("ImportExport",
@@ -798,6 +827,9 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (oAutoKeyLocate, "auto-key-locate",
               N_("|MECHANISMS|use MECHANISMS to locate keys by mail address")),
   ARGPARSE_s_n (oNoAutoKeyLocate, "no-auto-key-locate", "@"),
+  ARGPARSE_s_n (oAutoKeyLocateConcurrent, "auto-key-locate-concurrent", "@"),
+  ARGPARSE_s_n (oNoAutoKeyLocateConcurrent,
+                "no-auto-key-locate-concurrent", "@"),
   ARGPARSE_s_n (oAutoKeyImport,   "auto-key-import",
                 N_("import missing key from a signature")),
   ARGPARSE_s_n (oNoAutoKeyImport, "no-auto-key-import", "@"),
@@ -1042,6 +1074,7 @@ static struct debug_flags_s debug_flags [] =
     { DBG_LOOKUP_VALUE , "lookup"  },
     { DBG_EXTPROG_VALUE, "extprog" },
     { DBG_KEYDB_VALUE,   "keydb"   },
+    { DBG_STARTUP_VALUE, "startup" },
     { 0, NULL }
   };
 
@@ -1082,6 +1115,14 @@ static int utf8_strings =
 #endif
   ;
 static int maybe_setuid = 1;
+
+/* Time stamps in microseconds for "--debug startup": the start of the
+ * process, the end of the basic initialization and the last phase
+ * printed by log_startup_phase.  */
+static unsigned long long startup_time_start;
+static unsigned long long startup_time_init;
+static unsigned long long startup_time_last;
+
 static unsigned int opt_set_iobuf_size;
 static unsigned int opt_set_iobuf_size_used;
 static int opt_log_time;
@@ -1397,6 +1438,8 @@ set_debug (const char *level)
     gcry_control (GCRYCTL_SET_DEBUG_FLAGS, 1);
   if ((opt.debug & DBG_IOBUF_VALUE))
     iobuf_debug_mode = 1;
+  if ((opt.debug & DBG_MEMSTAT_VALUE))
+    iobuf_profile_mode = 1;
   gcry_control (GCRYCTL_SET_VERBOSITY, (int)opt.verbose);
 
   if (opt.debug)
@@ -2355,6 +2398,46 @@ gpg_init_default_ctrl (ctrl_t ctrl)
 }
 
 
+/* Return a monotonic time stamp in microseconds.  */
+static unsigned long long
+startup_clock (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  return (unsigned long long)GetTickCount64 () * 1000;
+#else
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts))
+    return 0;
+  return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+
+/* Print the time from the last phase up to NOW as used by PHASE.  */
+static void
+log_startup_phase_at (const char *phase, unsigned long long now)
+{
+  unsigned long long delta = now - startup_time_last;
+  unsigned long long total = now - startup_time_start;
+
+  log_debug ("startup: %-14s %5llu.%03llums  (total %llu.%03llums)\n",
+             phase, delta / 1000, delta % 1000, total / 1000, total % 1000);
+  startup_time_last = now;
+}
+
+
+/* Print the time used by the startup PHASE if "--debug startup" is
+ * active.  A phase ends with the call.  This is also called by the
+ * lazy initialization functions of other modules.  */
+void
+log_startup_phase (const char *phase)
+{
+  if (DBG_STARTUP)
+    log_startup_phase_at (phase, startup_clock ());
+}
+
+
 /* This function is called to deinitialize a control object.  It is
    not deallocated. */
 static void
@@ -2366,6 +2449,7 @@ gpg_deinit_default_ctrl (ctrl_t ctrl)
   gpg_dirmngr_deinit_session_data (ctrl);
 
   keydb_release (ctrl->cached_getkey_kdb);
+  release_prefetched_session_keys (ctrl);
   gpg_keyboxd_deinit_session_data (ctrl);
   xfree (ctrl->secret_keygrips);
   ctrl->secret_keygrips = NULL;
@@ -2439,6 +2523,7 @@ main (int argc, char **argv)
     /* Please note that we may running SUID(ROOT), so be very CAREFUL
        when adding any stuff between here and the call to
        secmem_init() somewhere after the option parsing. */
+    startup_time_start = startup_clock ();
     early_system_init ();
     gnupg_reopen_std (GPG_NAME);
     trap_unaligned ();
@@ -2589,6 +2674,7 @@ main (int argc, char **argv)
     /* Initialize the secure memory. */
     if (!gcry_control (GCRYCTL_INIT_SECMEM, SECMEM_BUFFER_SIZE, 0))
       got_secmem = 1;
+    startup_time_init = startup_clock ();
 #if defined(HAVE_GETUID) && defined(HAVE_GETEUID)
     /* There should be no way to get to this spot while still carrying
        setuid privs.  Just in case, bomb out if we are. */
@@ -2740,9 +2826,11 @@ main (int argc, char **argv)
 	  case aQuickSetPrimaryUid:
 	  case aQuickUpdatePref:
 	  case aQuickSetOwnertrust:
+	  case aQuickEditKey:
 	  case aExportOwnerTrust:
 	  case aImportOwnerTrust:
           case aRebuildKeydbCaches:
+          case aMigrateToKeyboxd:
           case aAddRecipients:
           case aChangeRecipients:
             set_cmd (&cmd, pargs.r_opt);
@@ -2803,6 +2891,22 @@ main (int argc, char **argv)
             opt.chunk_size = pargs.r.ret_int;
             break;
 
+          case oAEADThreads:
+            opt.aead_threads = pargs.r.ret_int;
+            break;
+
+          case oSigCheckThreads:
+            opt.sig_check_threads = pargs.r.ret_int;
+            break;
+
+          case oPubkeyEncThreads:
+            opt.pubkey_enc_threads = pargs.r.ret_int;
+            break;
+
+          case oRecipientCacheTTL:
+            opt.recipient_cache_ttl = pargs.r.ret_ulong;
+            break;
+
 	  case oQuiet: opt.quiet = 1; break;
 	  case oNoTTY: tty_no_terminal(1); break;
 	  case oDryRun: opt.dry_run = 1; break;
@@ -2887,6 +2991,14 @@ main (int argc, char **argv)
             opt_set_iobuf_size_used = 1;
             break;
 
+          case oMmapInput:
+            iobuf_set_mmap_mode (1);
+            break;
+
+          case oIoUring:
+            iobuf_set_uring_mode (1);
+            break;
+
           case oDebugAllowLargeChunks:
             allow_large_chunks = 1;
             break;
@@ -3292,6 +3404,8 @@ main (int argc, char **argv)
 	    break;
 	  case oCompressLevel: opt.compress_level = pargs.r.ret_int; break;
 	  case oBZ2CompressLevel: opt.bz2_compress_level = pargs.r.ret_int; break;
+	  case oCompressThreads: opt.compress_threads = pargs.r.ret_int; break;
+	  case oParallelCompress: opt.parallel_compress = 1; break;
 	  case oBZ2DecompressLowmem: opt.bz2_decompress_lowmem=1; break;
 	  case oPassphrase:
             set_passphrase_from_string (pargs.r_type ? pargs.r.ret_str : "");
@@ -3612,6 +3726,7 @@ main (int argc, char **argv)
           case oNoExpensiveTrustChecks: opt.no_expensive_trust_checks=1; break;
           case oAutoCheckTrustDB: opt.no_auto_check_trustdb=0; break;
           case oNoAutoCheckTrustDB: opt.no_auto_check_trustdb=1; break;
+          case oTrustDBFidx: opt.trustdb_fidx = 1; break;
           case oPreservePermissions: opt.preserve_permissions=1; break;
           case oDefaultPreferenceList:
 	    opt.def_preference_list = pargs.r.ret_str;
@@ -3738,6 +3853,8 @@ main (int argc, char **argv)
 	  case oNoAutoKeyLocate:
 	    release_akl();
 	    break;
+	  case oAutoKeyLocateConcurrent: opt.flags.akl_concurrent = 1; break;
+	  case oNoAutoKeyLocateConcurrent: opt.flags.akl_concurrent = 0; break;
 
 	  case oKeyOrigin:
 	    if(!parse_key_origin (pargs.r.ret_str))
@@ -4042,6 +4159,14 @@ main (int argc, char **argv)
     gnupg_set_compliance_extra_info (opt.min_rsa_length);
     if (DBG_CLOCK)
       log_clock ("start");
+    if (DBG_STARTUP)
+      {
+        /* The debug flags are only known now; thus print the early
+         * phases in retrospect.  */
+        startup_time_last = startup_time_start;
+        log_startup_phase_at ("init", startup_time_init);
+        log_startup_phase ("options");
+      }
 
     /* Do these after the switch(), so they can override settings. */
     if (PGP7)
@@ -4146,6 +4271,31 @@ main (int argc, char **argv)
         log_info (_("chunk size invalid - using %d\n"), opt.chunk_size);
       }
 
+    /* Limit the number of worker threads to something sensible.  */
+    if (opt.aead_threads < 0)
+      opt.aead_threads = 0;
+    else if (opt.aead_threads > 64)
+      {
+        opt.aead_threads = 64;
+        log_info ("number of AEAD threads limited to %d\n", opt.aead_threads);
+      }
+    if (opt.sig_check_threads < 0)
+      opt.sig_check_threads = 0;
+    else if (opt.sig_check_threads > 64)
+      {
+        opt.sig_check_threads = 64;
+        log_info ("number of signature check threads limited to %d\n",
+                  opt.sig_check_threads);
+      }
+    if (opt.pubkey_enc_threads < 0)
+      opt.pubkey_enc_threads = 0;
+    else if (opt.pubkey_enc_threads > 64)
+      {
+        opt.pubkey_enc_threads = 64;
+        log_info ("number of public key encryption threads limited to %d\n",
+                  opt.pubkey_enc_threads);
+      }
+
     /* We don't support all possible commands with multifile yet */
     if(multifile)
       {
@@ -4334,7 +4484,10 @@ main (int argc, char **argv)
     if (!opt.use_keyboxd
         && default_keyring >= 0
         && (ALWAYS_ADD_KEYRINGS
-            || (cmd != aDeArmor && cmd != aEnArmor && cmd != aGPGConfTest)))
+            || (cmd != aDeArmor && cmd != aEnArmor && cmd != aGPGConfTest
+                && cmd != aPrintMD && cmd != aPrintMDs
+                && cmd != aGenRandom && cmd != aPrimegen
+                && cmd != aListGcryptConfig)))
       {
         tmperr = 0;
 	if (!nrings || default_keyring > 0)  /* Add default ring. */
@@ -4349,6 +4502,7 @@ main (int argc, char **argv)
           }
       }
     FREE_STRLIST(nrings);
+    log_startup_phase ("keydb");
 
     /* In loopback mode, never ask for the password multiple times.  */
     if (opt.pinentry_mode == PINENTRY_MODE_LOOPBACK)
@@ -4417,6 +4571,7 @@ main (int argc, char **argv)
       log_error (_("failed to initialize the TrustDB: %s\n"),
                  gpg_strerror (rc));
 #endif /*!NO_TRUST_MODELS*/
+    log_startup_phase ("trustdb-setup");
 
     switch (cmd)
       {
@@ -4459,6 +4614,7 @@ main (int argc, char **argv)
       case aQuickSetPrimaryUid:
       case aQuickUpdatePref:
       case aQuickSetOwnertrust:
+      case aQuickEditKey:
       case aFullKeygen:
       case aKeygen:
       case aImport:
@@ -4479,6 +4635,7 @@ main (int argc, char **argv)
       }
 
     /* The command dispatcher.  */
+    log_startup_phase ("command");
     switch( cmd )
       {
       case aServer:
@@ -5007,6 +5164,17 @@ main (int argc, char **argv)
         }
 	break;
 
+      case aQuickEditKey:
+        {
+          if (argc < 1 || argc > 2)
+            wrong_args ("--quick-edit-key FINGERPRINT [FILE]");
+          if (mopt.forbid_gen_key)
+            gen_key_forbidden ();
+          else
+            keyedit_quick_edit_key (ctrl, argv[0], argc > 1? argv[1] : NULL);
+        }
+	break;
+
       case aFastImport:
         opt.import_options |= IMPORT_FAST; /* fall through */
       case aImport:
@@ -5382,6 +5550,14 @@ main (int argc, char **argv)
         keydb_rebuild_caches (ctrl, 1);
         break;
 
+      case aMigrateToKeyboxd:
+        if (argc > 1)
+          wrong_args ("--migrate-to-keyboxd [file]");
+        rc = migrate_to_keyboxd (ctrl, argc? *argv : NULL);
+        if (rc)
+          write_status_failure ("migrate-to-keyboxd", rc);
+        break;
+
 #ifdef ENABLE_CARD_SUPPORT
       case aCardStatus:
         if (argc == 0)
@@ -5611,14 +5787,22 @@ g10_exit( int rc )
     write_status_failure ("gpg-exit", gpg_error (GPG_ERR_GENERAL));
 
   gcry_control (GCRYCTL_UPDATE_RANDOM_SEED_FILE);
+  sigcache_save ();
   if (DBG_CLOCK)
     log_clock ("stop");
+  log_startup_phase ("exit");
 
   if ( (opt.debug & DBG_MEMSTAT_VALUE) )
     {
       keydb_dump_stats ();
       sig_check_dump_stats ();
+      sigcache_dump_stats ();
+      rcptcache_dump_stats ();
       objcache_dump_stats ();
+      iobuf_dump_stats ();
+#ifndef NO_TRUST_MODELS
+      tdbio_dump_stats ();
+#endif
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
       gcry_control (GCRYCTL_DUMP_RANDOM_STATS);
     }
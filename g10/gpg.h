@@ -67,6 +67,12 @@ struct server_local_s;
 /* Object used to keep state locally to call-keyboxd.c .  */
 struct keyboxd_local_s;
 typedef struct keyboxd_local_s *keyboxd_local_t;
+struct keydb_prefetch_s;
+typedef struct keydb_prefetch_s *keydb_prefetch_t;
+
+/* Object used to keep prefetched session keys in pubkey-enc.c .  */
+struct pkdecrypt_prefetch_s;
+typedef struct pkdecrypt_prefetch_s *pkdecrypt_prefetch_t;
 
 /* Object used to keep state locally to call-dirmngr.c .  */
 struct dirmngr_local_s;
@@ -105,6 +111,7 @@ struct server_control_s
 
   /* Local data for call-keyboxd.c  */
   keyboxd_local_t keyboxd_local;
+  keydb_prefetch_t keydb_prefetch;
 
   /* Local data for tofu.c  */
   struct {
@@ -115,6 +122,9 @@ struct server_control_s
   /* This is used to cache a key data base handle.  */
   KEYDB_HANDLE cached_getkey_kdb;
 
+  /* Session key frames decrypted in advance; see pubkey-enc.c.  */
+  pkdecrypt_prefetch_t pkdecrypt_prefetch;
+
   /* Cached results from HAVEKEY --list.  They are used if the pointer
    * is not NULL.  The length gives the length in bytes and is a
    * multiple of 20.  If the no_more flag is set the list shall not
@@ -55,6 +55,99 @@ gpgsql_exec_printf (sqlite3 *db,
   return rc;
 }
 
+/* The number of statements kept by the statement cache.  */
+#define STMT_CACHE_SIZE 32
+
+/* A statement cache for gpgsql_stepx callers which don't manage the
+ * prepared statement themselves.  The entries are keyed by the
+ * database handle and the SQL text; the least recently used entry is
+ * evicted when the cache is full.  */
+struct stmt_cache_item_s
+{
+  sqlite3 *db;
+  char *sql;
+  sqlite3_stmt *stmt;
+  unsigned long lastuse;
+  int busy;   /* The statement is currently being stepped.  */
+};
+static struct stmt_cache_item_s stmt_cache[STMT_CACHE_SIZE];
+static unsigned long stmt_cache_clock;
+
+
+/* Return the cache entry for SQL on DB.  If there is none, a slot is
+ * allocated and its STMT field is NULL.  Returns NULL if the
+ * statement for SQL is already in use (i.e. a recursive call from a
+ * callback), in which case the caller needs to use a fresh
+ * statement.  */
+static struct stmt_cache_item_s *
+get_cached_stmt (sqlite3 *db, const char *sql)
+{
+  struct stmt_cache_item_s *item, *victim = NULL;
+  int i;
+
+  for (i = 0; i < STMT_CACHE_SIZE; i++)
+    {
+      item = stmt_cache + i;
+      if (item->db == db && !strcmp (item->sql, sql))
+        {
+          if (item->busy)
+            return NULL;
+          item->lastuse = ++stmt_cache_clock;
+          return item;
+        }
+      if (item->busy)
+        continue;
+      if (!victim || !item->db || (victim->db
+                                   && item->lastuse < victim->lastuse))
+        victim = item;
+    }
+
+  if (!victim)
+    return NULL;
+
+  if (victim->db)
+    {
+      sqlite3_finalize (victim->stmt);
+      xfree (victim->sql);
+    }
+  victim->sql = xtrystrdup (sql);
+  if (!victim->sql)
+    {
+      victim->db = NULL;
+      return NULL;
+    }
+  victim->db = db;
+  victim->stmt = NULL;
+  victim->lastuse = ++stmt_cache_clock;
+  return victim;
+}
+
+
+/* Finalize all statements cached for DB.  This must be called before
+ * DB is closed.  */
+void
+gpgsql_release_cache (sqlite3 *db)
+{
+  struct stmt_cache_item_s *item;
+  int i;
+
+  for (i = 0; i < STMT_CACHE_SIZE; i++)
+    {
+      item = stmt_cache + i;
+      if (item->db != db)
+        continue;
+      log_assert (!item->busy);
+      sqlite3_finalize (item->stmt);
+      xfree (item->sql);
+      memset (item, 0, sizeof *item);
+    }
+}
+
+
+/* Execute SQL on DB.  If STMTP is not NULL the prepared statement is
+ * stored there and reused by the next call with the same STMTP; if
+ * it is NULL the statement is taken from a small cache keyed by the
+ * SQL text.  */
 int
 gpgsql_stepx (sqlite3 *db,
               sqlite3_stmt **stmtp,
@@ -80,8 +173,20 @@ gpgsql_stepx (sqlite3 *db,
 
   const char **azVals = 0;
 
+  struct stmt_cache_item_s *cached = NULL;
+
   callback_initialized = 0;
 
+  if (!stmtp)
+    {
+      cached = get_cached_stmt (db, sql);
+      if (cached)
+        {
+          stmtp = &cached->stmt;
+          cached->busy = 1;
+        }
+    }
+
   if (stmtp && *stmtp)
     {
       stmt = *stmtp;
@@ -219,7 +324,12 @@ gpgsql_stepx (sqlite3 *db,
   xfree (azColName);
 
   if (stmtp)
-    rc = sqlite3_reset (stmt);
+    {
+      rc = sqlite3_reset (stmt);
+      /* Don't keep the bound values around; they might point to
+       * memory which is released by the caller.  */
+      sqlite3_clear_bindings (stmt);
+    }
   else
     rc = sqlite3_finalize (stmt);
   if (rc == SQLITE_OK && err)
@@ -247,5 +357,8 @@ gpgsql_stepx (sqlite3 *db,
       memcpy (*errmsg, e, l);
     }
 
+  if (cached)
+    cached->busy = 0;
+
   return rc;
 }
@@ -58,4 +58,6 @@ int gpgsql_stepx (sqlite3 *db,
                   char **errmsg,
                   const char *sql, ...);
 
+void gpgsql_release_cache (sqlite3 *db);
+
 #endif /*GNUPG_GPGSQL_H*/
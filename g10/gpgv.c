@@ -69,6 +69,7 @@ enum cmd_and_opt_values {
   oEnableSpecialFilenames,
   oDebug,
   oAssertPubkeyAlgo,
+  oVerifyPairs,
   aTest
 };
 
@@ -93,6 +94,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oEnableSpecialFilenames, "enable-special-filenames", "@"),
   ARGPARSE_s_s (oDebug, "debug", "@"),
   ARGPARSE_s_s (oAssertPubkeyAlgo,"assert-pubkey-algo", "@"),
+  ARGPARSE_s_n (oVerifyPairs, "verify-pairs",
+                N_("verify many detached signatures")),
 
   ARGPARSE_end ()
 };
@@ -123,6 +126,9 @@ int g10_errors_seen = 0;
 int assert_signer_true = 0;
 int assert_pubkey_algo_false = 0;
 
+/* Set by --verify-pairs.  */
+static int opt_verify_pairs;
+
 static char *
 make_libversion (const char *libname, const char *(*getfnc)(const char*))
 {
@@ -172,6 +178,77 @@ my_strusage( int level )
 
 
 
+/* Verify the detached signature in SIGFILE over DATAFILE.  If
+ * DATAFILE is NULL the usual rules to find the signed data apply.  */
+static int
+verify_one_pair (ctrl_t ctrl, char *sigfile, char *datafile)
+{
+  char *files[2];
+  int rc;
+
+  files[0] = sigfile;
+  files[1] = datafile;
+  print_file_status (STATUS_FILE_START, sigfile, 1);
+  rc = verify_signatures (ctrl, datafile? 2 : 1, files);
+  if (rc)
+    log_error ("%s: verify signatures failed: %s\n",
+               sigfile, gpg_strerror (rc));
+  write_status (STATUS_FILE_DONE);
+  reset_literals_seen ();
+  return rc;
+}
+
+
+/* Implementation of --verify-pairs.  The NFILES entries of FILES are
+ * pairs of a signature file and a data file.  If NFILES is 0 the
+ * pairs are read from stdin; one per line with a TAB between the
+ * signature file and the optional data file.  All pairs are
+ * processed in this process so that the keyring is opened only once
+ * and the keys are taken from the cache of getkey.c after their
+ * first use.  */
+static void
+verify_pairs (ctrl_t ctrl, int nfiles, char **files)
+{
+  char line[2048];
+  char *p;
+  unsigned int lno = 0;
+  unsigned int count = 0;
+  unsigned int nbad = 0;
+  int i;
+
+  if (nfiles)
+    {
+      for (i=0; i+1 < nfiles; i += 2, count++)
+        if (verify_one_pair (ctrl, files[i], files[i+1]))
+          nbad++;
+    }
+  else
+    {
+      while (fgets (line, DIM(line), stdin))
+        {
+          lno++;
+          if (!*line || line[strlen(line)-1] != '\n')
+            {
+              log_error (_("input line %u too long or missing LF\n"), lno);
+              break;
+            }
+          line[strlen(line)-1] = 0;
+          if (!*line || *line == '#')
+            continue;
+          p = strchr (line, '\t');
+          if (p)
+            *p++ = 0;
+          if (verify_one_pair (ctrl, line, (p && *p)? p : NULL))
+            nbad++;
+          count++;
+        }
+    }
+
+  if (opt.verbose)
+    log_info ("%u signature files processed, %u failed\n", count, nbad);
+}
+
+
 int
 main( int argc, char **argv )
 {
@@ -267,12 +344,17 @@ main( int argc, char **argv )
             }
           break;
 
+        case oVerifyPairs: opt_verify_pairs = 1; break;
+
         default : pargs.err = ARGPARSE_PRINT_ERROR; break;
 	}
     }
 
   gpgrt_argparse (NULL, &pargs, NULL);  /* Release internal state.  */
 
+  if (opt_verify_pairs && (argc & 1))
+    log_error (_("option '%s' requires pairs of files\n"), "--verify-pairs");
+
   if (log_get_errorcount (0))
     g10_exit(2);
 
@@ -291,7 +373,9 @@ main( int argc, char **argv )
 
   ctrl = xcalloc (1, sizeof *ctrl);
 
-  if ((rc = verify_signatures (ctrl, argc, argv)))
+  if (opt_verify_pairs)
+    verify_pairs (ctrl, argc, argv);
+  else if ((rc = verify_signatures (ctrl, argc, argv)))
     log_error("verify signatures failed: %s\n", gpg_strerror (rc) );
 
   keydb_release (ctrl->cached_getkey_kdb);
@@ -504,6 +588,20 @@ keyserver_import_wkd (ctrl_t ctrl, const char *name, unsigned int flags,
   return GPG_ERR_BUG;
 }
 
+gpg_error_t
+keyserver_import_concurrent (ctrl_t ctrl, const char *name,
+                             const char *mechanisms, char **r_mechanism,
+                             unsigned char **fpr, size_t *fpr_len)
+{
+  (void)ctrl;
+  (void)name;
+  (void)mechanisms;
+  (void)fpr;
+  (void)fpr_len;
+  *r_mechanism = NULL;
+  return GPG_ERR_BUG;
+}
+
 int
 keyserver_import_mbox (const char *name,struct keyserver_spec *spec)
 {
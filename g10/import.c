@@ -78,6 +78,15 @@ struct import_stats_s
 /* A flag used by transfer_secret_keys. */
 #define NODE_TRANSFER_SECKEY 16
 
+/* The number of keyblocks read ahead by import.  */
+#define IMPORT_QUEUE_SIZE 32
+
+/* If the packets read for a keyblock exceed this size, its third-party
+ * signatures are dropped while parsing the rest of it.  This is the
+ * limit of the keybox which would anyway reject such a keyblock and
+ * have us retry with self-sigs-only.  */
+#define MAX_IMPORT_KEYBLOCK_LEN (5*1024*1024)
+
 
 /* An object and a global instance to store selectors created from
  * --import-filter keep-uid=EXPR.
@@ -103,7 +112,8 @@ static int import (ctrl_t ctrl,
 		   import_screener_t screener, void *screener_arg,
                    int origin, const char *url);
 static int read_block (IOBUF a, unsigned int options,
-                       PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys);
+                       PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys,
+                       int *r_flooded);
 static void revocation_present (ctrl_t ctrl, kbnode_t keyblock);
 static gpg_error_t import_one (ctrl_t ctrl,
                        kbnode_t keyblock,
@@ -407,7 +417,7 @@ read_key_from_file_or_buffer (ctrl_t ctrl, const char *fname,
     }
 
   /* Read the first non-v3 keyblock.  */
-  while (!(err = read_block (inp, 0, &pending_pkt, &keyblock, &v3keys)))
+  while (!(err = read_block (inp, 0, &pending_pkt, &keyblock, &v3keys, NULL)))
     {
       if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
         break;
@@ -658,10 +668,29 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
                                 read_block. */
   kbnode_t secattic = NULL;  /* Kludge for PGP desktop percularity */
   int rc = 0;
-  int v3keys;
+  int v3keys = 0;
+  kbnode_t queue[IMPORT_QUEUE_SIZE];
+  int queue_v3keys[IMPORT_QUEUE_SIZE];
+  int queue_flooded[IMPORT_QUEUE_SIZE];
+  int queue_size, nqueued, qidx;
+  int read_rc = 0;
+  int read_v3keys, read_flooded;
+  int flooded;
 
   getkey_disable_caches ();
 
+  /* The keyblocks are read ahead into a queue so that the public key
+   * operations for the self-signatures of all queued keyblocks can
+   * be done in parallel.  The keyblocks are then imported one after
+   * the other exactly as without the queue.  Parsing and storing
+   * needs to stay sequential because the parser and the keydb are
+   * not thread safe.  */
+  if (opt.sig_check_threads < 2 || opt.no_sig_cache || origin == KEYORG_WKD)
+    queue_size = 1;
+  else
+    queue_size = IMPORT_QUEUE_SIZE;
+  nqueued = qidx = 0;
+
   if (!opt.no_armor) /* Armored reading is not disabled.  */
     {
       armor_filter_context_t *afx;
@@ -672,13 +701,46 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
       release_armor_context (afx);
     }
 
-  while (!(rc = read_block (inp, options, &pending_pkt, &keyblock, &v3keys)))
+  for (;;)
     {
+      if (qidx == nqueued)
+        {
+          nqueued = qidx = 0;
+          while (!read_rc && nqueued < queue_size)
+            {
+              read_rc = read_block (inp, options, &pending_pkt,
+                                    &keyblock, &read_v3keys, &read_flooded);
+              if (read_rc)
+                break;
+              queue_v3keys[nqueued] = read_v3keys;
+              queue_flooded[nqueued] = read_flooded;
+              queue[nqueued++] = keyblock;
+            }
+          if (!nqueued)
+            {
+              v3keys = read_v3keys;
+              rc = read_rc;
+              break;
+            }
+          if (nqueued > 1)
+            check_key_signatures_multi (ctrl, queue, nqueued, 1, NULL, NULL);
+        }
+      keyblock = queue[qidx];
+      v3keys = queue_v3keys[qidx];
+      flooded = queue_flooded[qidx];
+      queue[qidx++] = NULL;
+
       stats->v3keys += v3keys;
       if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
         {
+          /* The third-party signatures of a flooded keyblock have
+           * been dropped only in part while reading it.  Do this
+           * like the retry in import_one.  */
           rc = import_one (ctrl, keyblock,
-                           stats, fpr, fpr_len, options, 0, 0,
+                           stats, fpr, fpr_len,
+                           flooded? (options | IMPORT_SELF_SIGS_ONLY
+                                     | IMPORT_CLEAN) : options,
+                           0, 0,
                            screener, screener_arg, origin, url, NULL);
           if (secattic)
             {
@@ -764,6 +826,8 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
           break;
         }
     }
+  while (qidx < nqueued)
+    release_kbnode (queue[qidx++]);
   stats->v3keys += v3keys;
   if (rc == -1)
     rc = 0;
@@ -811,7 +875,7 @@ import_old_secring (ctrl_t ctrl, const char *fname)
 
   getkey_disable_caches();
   stats = import_new_stats_handle ();
-  while (!(err = read_block (inp, 0, &pending_pkt, &keyblock, &v3keys)))
+  while (!(err = read_block (inp, 0, &pending_pkt, &keyblock, &v3keys, NULL)))
     {
       if (keyblock->pkt->pkttype == PKT_SECRET_KEY)
         {
@@ -930,14 +994,19 @@ valid_keyblock_packet (int pkttype)
 /* Read the next keyblock from stream A.  Meta data (ring trust
  * packets) are only considered if OPTIONS has the IMPORT_RESTORE flag
  * set.  PENDING_PKT should be initialized to NULL and not changed by
- * the caller.
+ * the caller.  With IMPORT_SELF_SIGS_ONLY the third-party signatures
+ * are skipped by the parser before their MPIs are read.  If
+ * R_FLOODED is not NULL this is also done for the rest of a keyblock
+ * exceeding MAX_IMPORT_KEYBLOCK_LEN and true is stored at R_FLOODED;
+ * the caller should then import the keyblock with self-sigs-only.
  *
  * Returns 0 for okay, -1 no more blocks, or any other errorcode.  The
  * integer at R_V3KEY counts the number of unsupported v3 keyblocks.
  */
 static int
 read_block( IOBUF a, unsigned int options,
-            PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys)
+            PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys,
+            int *r_flooded)
 {
   int rc;
   struct parse_packet_ctx_s parsectx;
@@ -948,8 +1017,12 @@ read_block( IOBUF a, unsigned int options,
   u32 keyid[2];
   int got_keyid = 0;
   unsigned int dropped_nonselfsigs = 0;
+  off_t startpos;
 
   *r_v3keys = 0;
+  if (r_flooded)
+    *r_flooded = 0;
+  startpos = iobuf_tell (a);
 
   if (*pending_pkt)
     {
@@ -973,6 +1046,23 @@ read_block( IOBUF a, unsigned int options,
   skip_sigs = 0;
   while ((rc=parse_packet (&parsectx, pkt)) != -1)
     {
+      /* Let the parser drop the following third-party signatures.  */
+      if (got_keyid && in_cert && !parsectx.skip_nonself_sigs
+          && ((options & IMPORT_SELF_SIGS_ONLY)
+              || (r_flooded
+                  && iobuf_tell (a) - startpos > MAX_IMPORT_KEYBLOCK_LEN)))
+        {
+          if (!(options & IMPORT_SELF_SIGS_ONLY))
+            {
+              log_info ("key %s: keyblock too large,"
+                        " dropping non-self-signatures\n", keystr (keyid));
+              *r_flooded = 1;
+            }
+          parsectx.self_keyid[0] = keyid[0];
+          parsectx.self_keyid[1] = keyid[1];
+          parsectx.skip_nonself_sigs = 1;
+        }
+
       if (rc && (gpg_err_code (rc) == GPG_ERR_LEGACY_KEY
                  && (pkt->pkttype == PKT_PUBLIC_KEY
                      || pkt->pkttype == PKT_SECRET_KEY)))
@@ -1156,6 +1246,7 @@ read_block( IOBUF a, unsigned int options,
   free_packet (pkt, &parsectx);
   deinit_parse_packet (&parsectx);
   xfree( pkt );
+  dropped_nonselfsigs += parsectx.n_skipped_sigs;
   if (!rc && dropped_nonselfsigs && opt.verbose)
     log_info ("key %s: number of dropped non-self-signatures: %u\n",
               keystr (keyid), dropped_nonselfsigs);
@@ -1276,6 +1367,68 @@ fix_bad_direct_key_sigs (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid)
 }
 
 
+/* Store a SHA-1 digest over the packets of KEYBLOCK at R_DIGEST.
+ * The packets are serialized anew and the meta data is not included
+ * so that a parsed keyblock and the same keyblock read from the keydb
+ * give the same digest.  */
+static gpg_error_t
+keyblock_digest (kbnode_t keyblock, byte *r_digest)
+{
+  gpg_error_t err;
+  iobuf_t iobuf;
+  kbnode_t kbctx, node;
+
+  iobuf = iobuf_temp ();
+  for (kbctx = NULL; (node = walk_kbnode (keyblock, &kbctx, 0));)
+    {
+      switch (node->pkt->pkttype)
+        {
+        case PKT_PUBLIC_KEY:
+        case PKT_PUBLIC_SUBKEY:
+        case PKT_SIGNATURE:
+        case PKT_USER_ID:
+        case PKT_ATTRIBUTE:
+          break;
+        default:
+          continue;
+        }
+
+      err = build_packet (iobuf, node->pkt);
+      if (err)
+        {
+          iobuf_close (iobuf);
+          return err;
+        }
+    }
+
+  gcry_md_hash_buffer (GCRY_MD_SHA1, r_digest,
+                       iobuf_get_temp_buffer (iobuf),
+                       iobuf_get_temp_length (iobuf));
+  iobuf_close (iobuf);
+  return 0;
+}
+
+
+/* Return true if the keydb already holds KEYBLOCK, as identified by
+ * FPR and FPRLEN, in exactly the same form.  */
+static int
+is_unchanged_keyblock (ctrl_t ctrl, kbnode_t keyblock,
+                       const byte *fpr, size_t fprlen)
+{
+  kbnode_t keyblock_orig;
+  byte digest[20], digest_orig[20];
+  int same;
+
+  if (get_keyblock_byfpr_fast (ctrl, &keyblock_orig, NULL, fpr, fprlen, 0))
+    return 0;
+  same = (!keyblock_digest (keyblock, digest)
+          && !keyblock_digest (keyblock_orig, digest_orig)
+          && !memcmp (digest, digest_orig, sizeof digest));
+  release_kbnode (keyblock_orig);
+  return same;
+}
+
+
 static void
 print_import_ok (PKT_public_key *pk, unsigned int reason)
 {
@@ -1445,6 +1598,118 @@ check_prefs (ctrl_t ctrl, kbnode_t keyblock)
 }
 
 
+enum impex_filter_scope
+  { scpNone = 0, scpPub, scpSub, scpUid, scpSig };
+
+/* We allow a prefix delimited by a slash to limit the scope of the
+ * keyword.  Note that "pub" also includes "sec" and "sub" includes
+ * "ssb".  Return the scope and update *PROPNAME to point to the
+ * keyword.  */
+static enum impex_filter_scope
+impex_filter_scope (const char **propname)
+{
+  enum impex_filter_scope scope = scpNone;
+  const char *s;
+
+  if ((s=strchr (*propname, '/')) && s != *propname)
+    {
+      size_t n = s - *propname;
+      if (!strncmp (*propname, "pub", n))
+        scope = scpPub;
+      else if (!strncmp (*propname, "sub", n))
+        scope = scpSub;
+      else if (!strncmp (*propname, "uid", n))
+        scope = scpUid;
+      else if (!strncmp (*propname, "sig", n))
+        scope = scpSig;
+
+      *propname = s + 1;
+    }
+  return scope;
+}
+
+
+/* Helper for recsel_select_ext used along with impex_filter_getval.
+ * For properties with a numerical value store that value at R_VALUE
+ * and return true; return false for all other properties.  */
+int
+impex_filter_getnum (void *cookie, const char *propname, long *r_value)
+{
+  struct impex_filter_parm_s *parm = cookie;
+  kbnode_t node = parm->node;
+  enum impex_filter_scope scope;
+
+  scope = impex_filter_scope (&propname);
+
+  if ((node->pkt->pkttype == PKT_USER_ID
+       || node->pkt->pkttype == PKT_ATTRIBUTE)
+      && (!scope || scope == scpUid))
+    {
+      PKT_user_id *uid = node->pkt->pkt.user_id;
+
+      if (!strcmp (propname, "primary"))
+        *r_value = uid->flags.primary;
+      else if (!strcmp (propname, "expired"))
+        *r_value = uid->flags.expired;
+      else if (!strcmp (propname, "revoked"))
+        *r_value = uid->flags.revoked;
+      else
+        return 0;
+    }
+  else if (node->pkt->pkttype == PKT_SIGNATURE
+           && (!scope || scope == scpSig))
+    {
+      PKT_signature *sig = node->pkt->pkt.signature;
+
+      if (!strcmp (propname, "sig_created"))
+        *r_value = (long)sig->timestamp;
+      else if (!strcmp (propname, "sig_expires"))
+        *r_value = (long)sig->expiredate;
+      else if (!strcmp (propname, "sig_algo"))
+        *r_value = sig->pubkey_algo;
+      else if (!strcmp (propname, "sig_digest_algo"))
+        *r_value = sig->digest_algo;
+      else if (!strcmp (propname, "expired"))
+        *r_value = sig->flags.expired;
+      else
+        return 0;
+    }
+  else if (((node->pkt->pkttype == PKT_PUBLIC_KEY
+             || node->pkt->pkttype == PKT_SECRET_KEY)
+            && (!scope || scope == scpPub))
+           || ((node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+                || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+               && (!scope || scope == scpSub)))
+    {
+      PKT_public_key *pk = node->pkt->pkt.public_key;
+
+      if (!strcmp (propname, "secret"))
+        *r_value = (node->pkt->pkttype == PKT_SECRET_KEY
+                    || node->pkt->pkttype == PKT_SECRET_SUBKEY);
+      else if (!strcmp (propname, "key_algo"))
+        *r_value = pk->pubkey_algo;
+      else if (!strcmp (propname, "key_size"))
+        *r_value = nbits_from_pk (pk);
+      else if (!strcmp (propname, "key_created"))
+        *r_value = (long)pk->timestamp;
+      else if (!strcmp (propname, "key_expires"))
+        *r_value = (long)pk->expiredate;
+      else if (!strcmp (propname, "expired"))
+        *r_value = !!pk->has_expired;
+      else if (!strcmp (propname, "revoked"))
+        *r_value = !!pk->flags.revoked;
+      else if (!strcmp (propname, "lastupd"))
+        *r_value = (long)pk->keyupdate;
+      else
+        return 0;
+    }
+  else
+    return 0;
+
+  return 1;
+}
+
+
 /* Helper for apply_*_filter in import.c and export.c and also used by
  * keylist.c.  */
 const char *
@@ -1456,28 +1721,11 @@ impex_filter_getval (void *cookie, const char *propname)
   kbnode_t node = parm->node;
   static char numbuf[20];
   const char *result;
-  const char *s;
-  enum { scpNone = 0, scpPub, scpSub, scpUid, scpSig} scope = 0;
+  enum impex_filter_scope scope;
 
   log_assert (ctrl && ctrl->magic == SERVER_CONTROL_MAGIC);
 
-  /* We allow a prefix delimited by a slash to limit the scope of the
-   * keyword.  Note that "pub" also includes "sec" and "sub" includes
-   * "ssb".  */
-  if ((s=strchr (propname, '/')) && s != propname)
-    {
-      size_t n = s - propname;
-      if (!strncmp (propname, "pub", n))
-        scope = scpPub;
-      else if (!strncmp (propname, "sub", n))
-        scope = scpSub;
-      else if (!strncmp (propname, "uid", n))
-        scope = scpUid;
-      else if (!strncmp (propname, "sig", n))
-        scope = scpSig;
-
-      propname = s + 1;
-    }
+  scope = impex_filter_scope (&propname);
 
   if ((node->pkt->pkttype == PKT_USER_ID
        || node->pkt->pkttype == PKT_ATTRIBUTE)
@@ -1682,7 +1930,8 @@ apply_keep_uid_filter (ctrl_t ctrl, kbnode_t keyblock, recsel_expr_t selector)
       if (node->pkt->pkttype == PKT_USER_ID)
         {
           parm.node = node;
-          if (!recsel_select (selector, impex_filter_getval, &parm))
+          if (!recsel_select_ext (selector, impex_filter_getval,
+                                  impex_filter_getnum, &parm))
             {
 
               /* log_debug ("keep-uid: deleting '%s'\n", */
@@ -1745,7 +1994,8 @@ apply_drop_sig_filter (ctrl_t ctrl, kbnode_t keyblock, recsel_expr_t selector)
       if (IS_UID_SIG(sig) || IS_UID_REV(sig))
         {
           parm.node = node;
-          if (recsel_select (selector, impex_filter_getval, &parm))
+          if (recsel_select_ext (selector, impex_filter_getval,
+                                 impex_filter_getnum, &parm))
             delete_kbnode (node);
         }
     }
@@ -2062,6 +2312,35 @@ import_one_real (ctrl_t ctrl,
         return 0;
     }
 
+  /* If we already have exactly this keyblock there is nothing to
+   * merge.  Note that the options below only remove parts of the
+   * imported keyblock and thus can't change the result; we skip the
+   * shortcut for options which modify the stored keyblock or
+   * don't store anything at all.  */
+  if (!from_sk && !opt.dry_run
+      && !(options & (IMPORT_SHOW | IMPORT_DRY_RUN | IMPORT_EXPORT
+                      | IMPORT_CLEAN | IMPORT_RESTORE
+                      | IMPORT_REPAIR_PKS_SUBKEY_BUG))
+      && !import_filter.keep_uid && !import_filter.drop_sig
+      && is_unchanged_keyblock (ctrl, keyblock, fpr2, fpr2len))
+    {
+      if (r_valid)
+        *r_valid = 1;
+      same_key = 1;
+      if (is_status_enabled ())
+        print_import_ok (pk, 0);
+
+      if (!opt.quiet && !silent)
+        {
+          char *p = get_user_id_byfpr_native (ctrl, fpr2, fpr2len);
+          log_info( _("key %s: \"%s\" not changed\n"),keystr(keyid),p);
+          xfree(p);
+        }
+
+      stats->unchanged++;
+      goto leave;
+    }
+
   /* Remove all non-self-sigs if requested.  Note that this is a NOP if
    * that option has been globally set but we may also be called
    * latter with the already parsed keyblock and a locally changed
@@ -3739,6 +4018,9 @@ chk_self_sigs (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid, int *non_self)
   int rc;
   kbnode_t n;
 
+  /* Do the public key operations of the loop below in parallel.  */
+  check_key_signatures_batch (ctrl, keyblock, 1);
+
   for (n=keyblock; (n = find_next_kbnode (n, 0)); )
     {
       if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY)
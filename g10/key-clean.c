@@ -41,21 +41,262 @@
 #define NF_REVOC     11  /* Usable revocation.   */
 #define NF_NOKEY     12  /* Key not available.   */
 
+/* The maximum number of signers fetched with one keyboxd request.
+ * The prefetched results are searched linearly and thus for keys
+ * with more signers we only rely on KIDSET_T to avoid repeated
+ * lookups of missing keys.  */
+#define MAX_PREFETCH_SIGNERS 256
+
+
+/* A hash table of key IDs.  The key ID 0 0 is used to mark empty
+ * slots and can thus not be stored.  */
+struct kidset_s
+{
+  unsigned int size;   /* Number of slots; a power of 2.  */
+  unsigned int used;
+  u32 *kids;           /* SIZE pairs of u32.  */
+};
+typedef struct kidset_s *kidset_t;
+
+
+static void
+kidset_release (kidset_t set)
+{
+  xfree (set->kids);
+  set->kids = NULL;
+  set->size = set->used = 0;
+}
+
+
+/* Return the slot for KID in SET; this is either the slot holding KID
+ * or the empty slot where KID needs to be stored.  */
+static u32 *
+kidset_slot (kidset_t set, u32 *kid)
+{
+  unsigned int idx = kid[1] & (set->size - 1);
+  u32 *p;
+
+  for (;;)
+    {
+      p = set->kids + 2 * idx;
+      if ((p[0] == kid[0] && p[1] == kid[1]) || (!p[0] && !p[1]))
+        return p;
+      idx = (idx + 1) & (set->size - 1);
+    }
+}
+
+
+/* Return true if KID is in SET.  */
+static int
+kidset_contains (kidset_t set, u32 *kid)
+{
+  u32 *p;
+
+  if (!set || !set->used)
+    return 0;
+  p = kidset_slot (set, kid);
+  return p[0] || p[1];
+}
+
+
+/* Add KID to SET.  Returns true if KID was not yet in SET.  On
+ * malloc failure KID is silently not added.  */
+static int
+kidset_add (kidset_t set, u32 *kid)
+{
+  u32 *p, *oldkids;
+  unsigned int oldsize, i;
+
+  if (!kid[0] && !kid[1])
+    return 0;
+  if (2 * (set->used + 1) > set->size)
+    {
+      oldkids = set->kids;
+      oldsize = set->size;
+      set->size = oldsize? 2 * oldsize : 64;
+      set->kids = xtrycalloc (set->size, 2 * sizeof *set->kids);
+      if (!set->kids)
+        {
+          set->kids = oldkids;
+          set->size = oldsize;
+          return 0;
+        }
+      for (i=0; i < oldsize; i++)
+        if (oldkids[2*i] || oldkids[2*i+1])
+          {
+            p = kidset_slot (set, oldkids + 2*i);
+            p[0] = oldkids[2*i];
+            p[1] = oldkids[2*i+1];
+          }
+      xfree (oldkids);
+    }
+
+  p = kidset_slot (set, kid);
+  if (p[0] || p[1])
+    return 0;
+  p[0] = kid[0];
+  p[1] = kid[1];
+  set->used++;
+  return 1;
+}
+
+
+/* Return true if a failed lookup of the signer of SIG may be used to
+ * skip other signatures with the same key ID.  This is not the case
+ * if an issuer fingerprint does not match the key ID because the
+ * key is then first looked up by that fingerprint.  */
+static int
+nokey_is_cacheable (PKT_signature *sig)
+{
+  const byte *fpr;
+  size_t fprlen;
+  u32 kid[2];
+
+  fpr = issuer_fpr_raw (sig, &fprlen);
+  if (!fpr)
+    return 1;
+  keyid_from_fingerprint (NULL, fpr, fprlen, kid);
+  return kid[0] == sig->keyid[0] && kid[1] == sig->keyid[1];
+}
+
+
+/* Fetch the keys of the signers of the user ID certifications in
+ * KEYBLOCK with one keyboxd request so that the signature checks do
+ * not need to ask the keyboxd for each signer.  This is only an
+ * optimization and thus errors are ignored.  Returns true if
+ * keydb_prefetch has been called.  */
+static int
+prefetch_signers (ctrl_t ctrl, kbnode_t keyblock)
+{
+  struct kidset_s seen = { 0 };
+  KEYDB_SEARCH_DESC *desc = NULL;
+  size_t ndesc = 0;
+  kbnode_t node;
+  PKT_signature *sig;
+  const byte *fpr;
+  size_t fprlen;
+  u32 *main_kid;
+  int done = 0;
+
+  if (!opt.use_keyboxd)
+    return 0;
+
+  main_kid = pk_keyid (keyblock->pkt->pkt.public_key);
+  for (node = keyblock->next; node; node = node->next)
+    {
+      if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+          || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+        break;
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if (sig->flags.checked || !keyid_cmp (sig->keyid, main_kid)
+          || !(IS_UID_SIG (sig) || IS_UID_REV (sig)))
+        continue;
+      if (kidset_add (&seen, sig->keyid) && seen.used > MAX_PREFETCH_SIGNERS)
+        goto leave;
+    }
+  if (seen.used < 2)
+    goto leave;
+
+  /* get_pubkey_for_sig first looks for the issuer fingerprint and
+   * then for the key ID; thus we need both descriptions.  */
+  desc = xtrycalloc (2 * seen.used, sizeof *desc);
+  if (!desc)
+    goto leave;
+  kidset_release (&seen);
+  for (node = keyblock->next; node; node = node->next)
+    {
+      if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+          || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+        break;
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if (sig->flags.checked || !keyid_cmp (sig->keyid, main_kid)
+          || !(IS_UID_SIG (sig) || IS_UID_REV (sig))
+          || !kidset_add (&seen, sig->keyid))
+        continue;
+      fpr = issuer_fpr_raw (sig, &fprlen);
+      if (fpr)
+        {
+          desc[ndesc].mode = KEYDB_SEARCH_MODE_FPR;
+          memcpy (desc[ndesc].u.fpr, fpr, fprlen);
+          desc[ndesc].fprlen = fprlen;
+          ndesc++;
+        }
+      desc[ndesc].mode = KEYDB_SEARCH_MODE_LONG_KID;
+      desc[ndesc].u.kid[0] = sig->keyid[0];
+      desc[ndesc].u.kid[1] = sig->keyid[1];
+      ndesc++;
+    }
+
+  keydb_prefetch (ctrl, desc, ndesc);
+  done = 1;
+
+ leave:
+  xfree (desc);
+  kidset_release (&seen);
+  return done;
+}
+
+
+/* Return true if the signature SIG is a certification which is not
+ * revocable and not expired at CURTIME.  */
+static int
+is_nonrevocable_cert (PKT_signature *sig, u32 curtime)
+{
+  return (IS_UID_SIG (sig) && !sig->flags.revocable
+          && (!sig->expiredate || sig->expiredate > curtime));
+}
+
+
+/* The candidates of mark_usable_uid_certs sorted by signer.  */
+struct usable_cand_s
+{
+  kbnode_t node;
+  unsigned int seq;    /* Position in the keyblock.  */
+};
+
+
+/* Sort function for the candidates: by the key ID of the signer and
+ * then by position.  */
+static int
+cmp_usable_cand (const void *a_arg, const void *b_arg)
+{
+  const struct usable_cand_s *a = a_arg;
+  const struct usable_cand_s *b = b_arg;
+  const u32 *akid = a->node->pkt->pkt.signature->keyid;
+  const u32 *bkid = b->node->pkt->pkt.signature->keyid;
+
+  if (akid[0] != bkid[0])
+    return akid[0] < bkid[0]? -1 : 1;
+  if (akid[1] != bkid[1])
+    return akid[1] < bkid[1]? -1 : 1;
+  return a->seq < b->seq? -1 : a->seq > b->seq;
+}
+
+
 /*
  * Mark the signature of the given UID which are used to certify it.
  * To do this, we first remove all signatures which are not valid and
  * from the remaining we look for the latest one.  If this is not a
  * certification revocation signature we mark the signature by setting
  * node flag bit NF_USABLE.  Revocations are marked with NF_REVOC, and
- * sigs from unavailable keys are marked with NF_NOKEY.
+ * sigs from unavailable keys are marked with NF_NOKEY.  If NOKEY is
+ * not NULL, signatures from key IDs in this set are marked with
+ * NF_NOKEY without checking them and the key IDs of newly detected
+ * missing keys are added to the set.
  */
-void
-mark_usable_uid_certs (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
-                       u32 *main_kid, struct key_item *klist,
-                       u32 curtime, u32 *next_expire)
+static void
+do_mark_usable_uid_certs (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
+                          u32 *main_kid, struct key_item *klist,
+                          u32 curtime, u32 *next_expire, kidset_t nokey)
 {
   kbnode_t node;
   PKT_signature *sig;
+  struct usable_cand_s *cands;
+  unsigned int ncands, i, j;
 
   /* First check all signatures.  */
   for (node=uidnode->next; node; node = node->next)
@@ -82,12 +323,22 @@ mark_usable_uid_certs (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
 		     invalid signature */
       if (klist && !is_in_klist (klist, sig))
         continue;  /* no need to check it then */
+      if (nokey && !sig->flags.checked && kidset_contains (nokey, sig->keyid)
+          && nokey_is_cacheable (sig))
+        {
+          node->flag |= 1<<NF_NOKEY;
+          continue;
+        }
       if ((rc=check_key_signature (ctrl, keyblock, node, NULL)))
 	{
 	  /* we ignore anything that won't verify, but tag the
 	     no_pubkey case */
 	  if (gpg_err_code (rc) == GPG_ERR_NO_PUBKEY)
-            node->flag |= 1<<NF_NOKEY;
+            {
+              node->flag |= 1<<NF_NOKEY;
+              if (nokey && nokey_is_cacheable (sig))
+                kidset_add (nokey, sig->keyid);
+            }
           continue;
         }
       node->flag |= 1<<NF_CONSIDER;
@@ -103,39 +354,47 @@ mark_usable_uid_certs (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
    * processed, bit NF_USABLE will be set for the usable signatures, and bit
    * NF_REVOC will be set for usable revocations. */
 
-  /* For each cert figure out the latest valid one.  */
-  for (node=uidnode->next; node; node = node->next)
+  /* For each cert figure out the latest valid one.  To do this in
+   * O(n log n) even for keys with a huge number of certifications,
+   * the candidates are sorted by signer so that each series can be
+   * processed in one go.  Within a series the keyblock order is
+   * kept.  */
+  for (ncands=0, node=uidnode->next; node; node = node->next)
     {
-      KBNODE n, signode;
-      u32 kid[2];
-      u32 sigdate;
-
       if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY
           || node->pkt->pkttype == PKT_SECRET_SUBKEY)
         break;
-      if ( !(node->flag & (1<<NF_CONSIDER)) )
-        continue; /* not a node to look at */
-      if ( (node->flag & (1<<NF_PROCESSED)) )
-        continue; /* signature with a keyID already processed */
-      node->flag |= (1<<NF_PROCESSED); /* mark this node as processed */
-      sig = node->pkt->pkt.signature;
-      signode = node;
-      sigdate = sig->timestamp;
-      kid[0] = sig->keyid[0]; kid[1] = sig->keyid[1];
+      if ((node->flag & (1<<NF_CONSIDER)))
+        ncands++;
+    }
+  if (!ncands)
+    return;
+  cands = xmalloc (ncands * sizeof *cands);
+  for (i=0, node=uidnode->next; i < ncands; node = node->next)
+    if ((node->flag & (1<<NF_CONSIDER)))
+      {
+        cands[i].node = node;
+        cands[i].seq = i;
+        i++;
+      }
+  qsort (cands, ncands, sizeof *cands, cmp_usable_cand);
+
+  for (i=0; i < ncands; i = j)
+    {
+      KBNODE n, signode;
+      u32 sigdate;
+
+      signode = cands[i].node;
+      signode->flag |= (1<<NF_PROCESSED); /* mark this node as processed */
+      sigdate = signode->pkt->pkt.signature->timestamp;
 
       /* Now find the latest and greatest signature */
-      for (n=uidnode->next; n; n = n->next)
+      for (j=i+1; j < ncands; j++)
         {
-          if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY
-              || n->pkt->pkttype == PKT_SECRET_SUBKEY)
-            break;
-          if ( !(n->flag & (1<<NF_CONSIDER)) )
-            continue;
-          if ( (n->flag & (1<<NF_PROCESSED)) )
-            continue; /* shortcut already processed signatures */
+          n = cands[j].node;
           sig = n->pkt->pkt.signature;
-          if (kid[0] != sig->keyid[0] || kid[1] != sig->keyid[1])
-            continue;
+          if (keyid_cmp (sig->keyid, signode->pkt->pkt.signature->keyid))
+            break; /* Start of the next series.  */
           n->flag |= (1<<NF_PROCESSED); /* mark this node as processed */
 
 	  /* If signode is nonrevocable and unexpired and n isn't,
@@ -144,14 +403,8 @@ mark_usable_uid_certs (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
              as signode is nonrevocable.  If n was older then we're
              automatically fine. */
 
-	  if(((IS_UID_SIG(signode->pkt->pkt.signature) &&
-	       !signode->pkt->pkt.signature->flags.revocable &&
-	       (signode->pkt->pkt.signature->expiredate==0 ||
-		signode->pkt->pkt.signature->expiredate>curtime))) &&
-	     (!(IS_UID_SIG(n->pkt->pkt.signature) &&
-		!n->pkt->pkt.signature->flags.revocable &&
-		(n->pkt->pkt.signature->expiredate==0 ||
-		 n->pkt->pkt.signature->expiredate>curtime))))
+	  if (is_nonrevocable_cert (signode->pkt->pkt.signature, curtime)
+              && !is_nonrevocable_cert (sig, curtime))
 	    continue;
 
 	  /* If n is nonrevocable and unexpired and signode isn't,
@@ -160,14 +413,8 @@ mark_usable_uid_certs (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
              nonrevocable.  If signode was older then we're
              automatically fine. */
 
-	  if((!(IS_UID_SIG(signode->pkt->pkt.signature) &&
-		!signode->pkt->pkt.signature->flags.revocable &&
-		(signode->pkt->pkt.signature->expiredate==0 ||
-		 signode->pkt->pkt.signature->expiredate>curtime))) &&
-	     ((IS_UID_SIG(n->pkt->pkt.signature) &&
-	       !n->pkt->pkt.signature->flags.revocable &&
-	       (n->pkt->pkt.signature->expiredate==0 ||
-		n->pkt->pkt.signature->expiredate>curtime))))
+	  if (!is_nonrevocable_cert (signode->pkt->pkt.signature, curtime)
+              && is_nonrevocable_cert (sig, curtime))
             {
               signode = n;
               sigdate = sig->timestamp;
@@ -213,6 +460,18 @@ mark_usable_uid_certs (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
       else
 	signode->flag |= (1<<NF_REVOC);
     }
+  xfree (cands);
+}
+
+
+/* See do_mark_usable_uid_certs.  */
+void
+mark_usable_uid_certs (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
+                       u32 *main_kid, struct key_item *klist,
+                       u32 curtime, u32 *next_expire)
+{
+  do_mark_usable_uid_certs (ctrl, keyblock, uidnode, main_kid, klist,
+                            curtime, next_expire, NULL);
 }
 
 
@@ -228,10 +487,11 @@ is_trusted_key_sig (kbnode_t node)
 }
 
 
-/* Note: OPTIONS are from the EXPORT_* set. */
+/* Note: OPTIONS are from the EXPORT_* set.  NOKEY is passed to
+ * do_mark_usable_uid_certs.  */
 static int
 clean_sigs_from_uid (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
-                     int noisy, unsigned int options)
+                     int noisy, unsigned int options, kidset_t nokey)
 {
   int deleted = 0;
   kbnode_t node;
@@ -245,7 +505,8 @@ clean_sigs_from_uid (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
   /* Passing in a 0 for current time here means that we'll never weed
      out an expired sig.  This is correct behavior since we want to
      keep the most recent expired sig in a series. */
-  mark_usable_uid_certs (ctrl, keyblock, uidnode, NULL, NULL, 0, NULL);
+  do_mark_usable_uid_certs (ctrl, keyblock, uidnode, NULL, NULL, 0, NULL,
+                            nokey);
 
   /* What we want to do here is remove signatures that are not
      considered as part of the trust calculations.  Thus, all invalid
@@ -385,12 +646,11 @@ clean_uid_from_key (kbnode_t keyblock, kbnode_t uidnode, int noisy)
 }
 
 
-/* Needs to be called after a merge_keys_and_selfsig().
- * Note: OPTIONS are from the EXPORT_* set.  */
-void
-clean_one_uid (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
-               int noisy, unsigned int options,
-               int *uids_cleaned, int *sigs_cleaned)
+/* Worker for clean_one_uid and clean_all_uids.  */
+static void
+do_clean_one_uid (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
+                  int noisy, unsigned int options,
+                  int *uids_cleaned, int *sigs_cleaned, kidset_t nokey)
 {
   int dummy = 0;
 
@@ -409,18 +669,38 @@ clean_one_uid (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
   *uids_cleaned += clean_uid_from_key (keyblock, uidnode, noisy);
   if (!uidnode->pkt->pkt.user_id->flags.compacted)
     *sigs_cleaned += clean_sigs_from_uid (ctrl, keyblock, uidnode,
-                                          noisy, options);
+                                          noisy, options, nokey);
+}
+
+
+/* Needs to be called after a merge_keys_and_selfsig().
+ * Note: OPTIONS are from the EXPORT_* set.  */
+void
+clean_one_uid (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
+               int noisy, unsigned int options,
+               int *uids_cleaned, int *sigs_cleaned)
+{
+  struct kidset_s nokey = { 0 };
+
+  do_clean_one_uid (ctrl, keyblock, uidnode, noisy, options,
+                    uids_cleaned, sigs_cleaned, &nokey);
+  kidset_release (&nokey);
 }
 
 
 /* NB: This function marks the deleted nodes only and the caller is
  * responsible to skip or remove them.  Needs to be called after a
- * merge_keys_and_selfsig.  Note: OPTIONS are from the EXPORT_* set. */
+ * merge_keys_and_selfsig.  Note: OPTIONS are from the EXPORT_* set.
+ * The signers are looked up only once for all user IDs.  */
 void
 clean_all_uids (ctrl_t ctrl, kbnode_t keyblock, int noisy, unsigned int options,
                 int *uids_cleaned, int *sigs_cleaned)
 {
+  struct kidset_s nokey = { 0 };
   kbnode_t node;
+  int prefetched;
+
+  prefetched = prefetch_signers (ctrl, keyblock);
 
   for (node = keyblock->next;
        node && !(node->pkt->pkttype == PKT_PUBLIC_SUBKEY
@@ -428,9 +708,12 @@ clean_all_uids (ctrl_t ctrl, kbnode_t keyblock, int noisy, unsigned int options,
        node = node->next)
     {
       if (node->pkt->pkttype == PKT_USER_ID)
-        clean_one_uid (ctrl, keyblock, node, noisy, options,
-                       uids_cleaned, sigs_cleaned);
+        do_clean_one_uid (ctrl, keyblock, node, noisy, options,
+                          uids_cleaned, sigs_cleaned, &nokey);
     }
+  kidset_release (&nokey);
+  if (prefetched)
+    keydb_prefetch_release (ctrl);
 
   /* Remove bogus subkey binding signatures: The only signatures
    * allowed are of class 0x18 and 0x28.  */
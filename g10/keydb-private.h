@@ -52,6 +52,7 @@ struct resource_item
     KEYBOX_HANDLE kb;
   } u;
   void *token;
+  int read_only;  /* The resource was registered read-only.  */
 };
 
 
@@ -71,6 +72,7 @@ struct keyblock_cache {
   byte fpr[MAX_FINGERPRINT_LEN];
   byte fprlen;
   iobuf_t iobuf; /* Image of the keyblock.  */
+  u32 *sigstatus; /* The stored signature status or NULL.  */
   int pk_no;
   int uid_no;
   /* Offset of the record in the keybox.  */
@@ -86,6 +88,10 @@ struct keydb_handle_s
   /* Flag set if this handles pertains to call-keyboxd.c.  */
   int use_keyboxd;
 
+  /* The packet types keydb_get_keyblock shall not return; see
+   * keydb_set_skip_pkttypes.  */
+  unsigned int skip_pkttypes;
+
   /* BEGIN USE_KEYBOXD */
   /* (These fields are only valid if USE_KEYBOXD is set.) */
 
@@ -98,6 +104,15 @@ struct keydb_handle_s
 
   /* Various flags.  */
   unsigned int last_ubid_valid:1;
+  unsigned int pf_valid:1;  /* The PF_ fields are valid.  */
+
+  /* If PF_VALID is set the current search is served from the
+   * prefetched results with serial number PF_SERIAL.  PF_ENTRY is
+   * the index of the matching entry and PF_NEXT the index of the
+   * next result to return.  */
+  unsigned int pf_serial;
+  unsigned int pf_entry;
+  unsigned int pf_next;
 
   /* The UBID of the last returned keyblock.  */
   unsigned char last_ubid[UBID_LEN];
@@ -107,6 +122,15 @@ struct keydb_handle_s
   int last_uid_no;
   int last_pk_no;
 
+  /* The signature status for the last keyblock as sent by the
+   * keyboxd with the SIGCACHE status line or NULL.  */
+  char *last_sigstatus;
+
+  /* The SHA-256 of the keyblock last returned by keydb_get_keyblock;
+   * valid if sigcache_pending is set.  Used by keydb_put_sigcache.  */
+  unsigned char sigcache_digest[32];
+  unsigned int sigcache_pending:1;
+
   /* END USE_KEYBOXD */
 
   /* BEGIN !USE_KEYBOXD */
@@ -150,6 +174,11 @@ struct keydb_handle_s
      keyboxes, not keyrings).  */
   struct keyblock_cache keyblock_cache;
 
+  /* The signature status of the keyblock last returned by
+     keydb_get_keyblock as stored in the keybox or NULL.  Used by
+     keydb_put_sigcache to update the keybox.  */
+  u32 *sigstatus;
+
   /* Copy of ALL_RESOURCES when keydb_new is called.  */
   struct resource_item active[MAX_KEYDB_RESOURCES];
 
@@ -161,6 +190,7 @@ struct keydb_handle_s
 
 
 gpg_error_t keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
+                                  unsigned int skip_pkttypes,
                                   kbnode_t *r_keyblock);
 
 /* These are the functions call-keyboxd diverts to if the keyboxd is
@@ -171,6 +201,9 @@ void internal_keydb_deinit (KEYDB_HANDLE hd);
 gpg_error_t internal_keydb_lock (KEYDB_HANDLE hd);
 
 gpg_error_t internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb);
+gpg_error_t internal_keydb_get_keyblock_image (KEYDB_HANDLE hd,
+                                               iobuf_t *r_image);
+void internal_keydb_put_sigcache (KEYDB_HANDLE hd, kbnode_t keyblock);
 gpg_error_t internal_keydb_update_keyblock (ctrl_t ctrl,
                                             KEYDB_HANDLE hd, kbnode_t kb);
 gpg_error_t internal_keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb);
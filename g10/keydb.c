@@ -40,6 +40,7 @@
 #include "keydb.h"
 #include "../common/i18n.h"
 #include "../common/comopt.h"
+#include "tdbdeps.h"
 
 #include "keydb-private.h"  /* For struct keydb_handle_s */
 
@@ -47,6 +48,7 @@ static int active_handles;
 
 
 static struct resource_item all_resources[MAX_KEYDB_RESOURCES];
+static char *resource_fnames[MAX_KEYDB_RESOURCES];
 static int used_resources;
 
 /* A pointer used to check for the primary key database by comparing
@@ -199,6 +201,8 @@ keyblock_cache_clear (struct keydb_handle_s *hd)
   hd->keyblock_cache.state = KEYBLOCK_CACHE_EMPTY;
   iobuf_close (hd->keyblock_cache.iobuf);
   hd->keyblock_cache.iobuf = NULL;
+  xfree (hd->keyblock_cache.sigstatus);
+  hd->keyblock_cache.sigstatus = NULL;
   hd->keyblock_cache.resource = -1;
   hd->keyblock_cache.offset = -1;
 }
@@ -722,6 +726,7 @@ keydb_add_resource (const char *url, unsigned int flags)
               all_resources[used_resources].type = rt;
               all_resources[used_resources].u.kr = NULL; /* Not used here */
               all_resources[used_resources].token = token;
+              resource_fnames[used_resources] = xtrystrdup (filename);
               used_resources++;
             }
         }
@@ -753,6 +758,9 @@ keydb_add_resource (const char *url, unsigned int flags)
                 all_resources[used_resources].type = rt;
                 all_resources[used_resources].u.kb = NULL; /* Not used here */
                 all_resources[used_resources].token = token;
+                all_resources[used_resources].read_only
+                  = !!(flags & KEYDB_RESOURCE_FLAG_READONLY);
+                resource_fnames[used_resources] = xtrystrdup (filename);
 
                 if (!(flags & KEYDB_RESOURCE_FLAG_READONLY))
                   {
@@ -872,6 +880,7 @@ internal_keydb_init (KEYDB_HANDLE hd)
         case KEYDB_RESOURCE_TYPE_KEYBOX:
           hd->active[j].type   = all_resources[i].type;
           hd->active[j].token  = all_resources[i].token;
+          hd->active[j].read_only = all_resources[i].read_only;
           hd->active[j].u.kb   = keybox_new_openpgp (all_resources[i].token, 0);
           if (!hd->active[j].u.kb)
             {
@@ -924,6 +933,8 @@ internal_keydb_deinit (KEYDB_HANDLE hd)
     }
 
   keyblock_cache_clear (hd);
+  xfree (hd->sigstatus);
+  hd->sigstatus = NULL;
 }
 
 
@@ -955,6 +966,19 @@ keydb_disable_caching (KEYDB_HANDLE hd)
 }
 
 
+/* Tell keydb_get_keyblock to skip all packets with a type in the bit
+ * mask SKIP_PKTTYPES; see PKTTYPE_BIT.  Signatures bound to a skipped
+ * user id or subkey are skipped as well.  The returned keyblocks are
+ * thus incomplete and may only be used for read-only purposes.  This
+ * has no effect on keyring resources.  */
+void
+keydb_set_skip_pkttypes (KEYDB_HANDLE hd, unsigned int skip_pkttypes)
+{
+  if (hd)
+    hd->skip_pkttypes = skip_pkttypes;
+}
+
+
 /* Return the file name of the resource in which the current search
  * result was found or, if there is no search result, the filename of
  * the current resource (i.e., the resource that the file position
@@ -1159,10 +1183,11 @@ keydb_pop_found_state (KEYDB_HANDLE hd)
 
 
 
-/* Parse the keyblock in IOBUF and return at R_KEYBLOCK.  */
+/* Parse the keyblock in IOBUF and return at R_KEYBLOCK.  Packets
+ * with a type in the bit mask SKIP_PKTTYPES are not returned.  */
 gpg_error_t
 keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
-                      kbnode_t *r_keyblock)
+                      unsigned int skip_pkttypes, kbnode_t *r_keyblock)
 {
   gpg_error_t err;
   struct parse_packet_ctx_s parsectx;
@@ -1174,11 +1199,12 @@ keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
 
   *r_keyblock = NULL;
 
-  pkt = xtrymalloc (sizeof *pkt);
+  pkt = alloc_packet_object ();
   if (!pkt)
     return gpg_error_from_syserror ();
   init_packet (pkt);
   init_parse_packet (&parsectx, iobuf);
+  parsectx.skip_pkttypes = skip_pkttypes;
   save_mode = set_packet_list_mode (0);
   in_cert = 0;
   tail = NULL;
@@ -1252,12 +1278,12 @@ keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
         case PKT_PUBLIC_SUBKEY:
         case PKT_SECRET_KEY:
         case PKT_SECRET_SUBKEY:
-          if (++pk_count == pk_no)
+          if (++pk_count + parsectx.n_skipped_keys == pk_no)
             node->flag |= 1;
           break;
 
         case PKT_USER_ID:
-          if (++uid_count == uid_no)
+          if (++uid_count + parsectx.n_skipped_uids == uid_no)
             node->flag |= 2;
           break;
 
@@ -1270,7 +1296,7 @@ keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
       else
         *tail = node;
       tail = &node->next;
-      pkt = xtrymalloc (sizeof *pkt);
+      pkt = alloc_packet_object ();
       if (!pkt)
         {
           err = gpg_error_from_syserror ();
@@ -1292,11 +1318,56 @@ keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
     }
   free_packet (pkt, &parsectx);
   deinit_parse_packet (&parsectx);
-  xfree (pkt);
+  release_packet_object (pkt);
   return err;
 }
 
 
+/* Mark the signatures of KEYBLOCK as checked according to the status
+ * SIGSTATUS stored in a keybox blob.  Nothing is done if the number
+ * of signatures does not match.  */
+static void
+apply_keybox_sigstatus (kbnode_t keyblock, const u32 *sigstatus)
+{
+  kbnode_t node;
+  PKT_signature *sig;
+  u32 n;
+
+  if (opt.no_sig_cache)
+    return;
+
+  for (n = 0, node = keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_SIGNATURE)
+      n++;
+  if (n != sigstatus[0])
+    return;
+
+  for (n = 1, node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      switch (sigstatus[n++])
+        {
+        case 0: /* Not checked.  */
+        case 1: /* Missing key.  */
+          break;
+        case 2: /* Bad signature.  */
+          sig->flags.checked = 1;
+          sig->flags.valid = 0;
+          break;
+        default:
+          /* As with ring trust packets we don't trust a good status
+           * if the algorithms are not supported anymore.  */
+          if (!openpgp_md_test_algo (sig->digest_algo)
+              && !openpgp_pk_test_algo (sig->pubkey_algo))
+            sig->flags.checked = sig->flags.valid = 1;
+          break;
+        }
+    }
+}
+
+
 /* Return the keyblock last found by keydb_search() in *RET_KB.
  * keydb_get_keyblock divert to here in the non-keyboxd mode.
  *
@@ -1327,9 +1398,11 @@ internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
 	  err = keydb_parse_keyblock (hd->keyblock_cache.iobuf,
 				      hd->keyblock_cache.pk_no,
 				      hd->keyblock_cache.uid_no,
-				      ret_kb);
+				      hd->skip_pkttypes, ret_kb);
 	  if (err)
 	    keyblock_cache_clear (hd);
+          else if (hd->keyblock_cache.sigstatus)
+            apply_keybox_sigstatus (*ret_kb, hd->keyblock_cache.sigstatus);
 	  if (DBG_CLOCK)
 	    log_clock ("%s leave (cached mode)", __func__);
 	  return err;
@@ -1351,24 +1424,42 @@ internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
       {
         iobuf_t iobuf;
         int pk_no, uid_no;
+        u32 *sigstatus;
 
         err = keybox_get_keyblock (hd->active[hd->found].u.kb,
-                                   &iobuf, &pk_no, &uid_no);
+                                   &iobuf, &pk_no, &uid_no, &sigstatus);
         if (!err)
           {
-            err = keydb_parse_keyblock (iobuf, pk_no, uid_no, ret_kb);
+            err = keydb_parse_keyblock (iobuf, pk_no, uid_no,
+                                        hd->skip_pkttypes, ret_kb);
+            if (!err && sigstatus)
+              apply_keybox_sigstatus (*ret_kb, sigstatus);
             if (!err && hd->keyblock_cache.state == KEYBLOCK_CACHE_PREPARED)
               {
                 hd->keyblock_cache.state     = KEYBLOCK_CACHE_FILLED;
                 hd->keyblock_cache.iobuf     = iobuf;
                 hd->keyblock_cache.pk_no     = pk_no;
                 hd->keyblock_cache.uid_no    = uid_no;
+                if (sigstatus)
+                  hd->keyblock_cache.sigstatus
+                    = xtrymalloc ((1 + sigstatus[0]) * sizeof *sigstatus);
+                if (hd->keyblock_cache.sigstatus)
+                  memcpy (hd->keyblock_cache.sigstatus, sigstatus,
+                          (1 + sigstatus[0]) * sizeof *sigstatus);
               }
             else
               {
                 iobuf_close (iobuf);
               }
+            if (!err)
+              {
+                /* Keep it for keydb_put_sigcache.  */
+                xfree (hd->sigstatus);
+                hd->sigstatus = sigstatus;
+                sigstatus = NULL;
+              }
           }
+        xfree (sigstatus);
       }
       break;
     }
@@ -1383,6 +1474,164 @@ internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
 }
 
 
+/* Return the image of the keyblock last found by keydb_search() as
+ * stored in the keybox at R_IMAGE.  keydb_get_keyblock_image diverts
+ * to here in the non-keyboxd mode.  The image may contain ring trust
+ * packets.  GPG_ERR_NOT_SUPPORTED is returned for keyrings.  On
+ * success the caller must close the returned iobuf, which can be
+ * accessed with iobuf_get_temp_buffer and iobuf_get_temp_length.  */
+gpg_error_t
+internal_keydb_get_keyblock_image (KEYDB_HANDLE hd, iobuf_t *r_image)
+{
+  gpg_error_t err = 0;
+  int pk_no, uid_no;
+  u32 *sigstatus;
+
+  log_assert (!hd->use_keyboxd);
+
+  *r_image = NULL;
+
+  if (hd->keyblock_cache.state == KEYBLOCK_CACHE_FILLED)
+    {
+      *r_image = iobuf_temp_with_content
+        (iobuf_get_temp_buffer (hd->keyblock_cache.iobuf),
+         iobuf_get_temp_length (hd->keyblock_cache.iobuf));
+      return 0;
+    }
+
+  if (hd->found < 0 || hd->found >= hd->used)
+    return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
+
+  switch (hd->active[hd->found].type)
+    {
+    case KEYDB_RESOURCE_TYPE_KEYBOX:
+      err = keybox_get_keyblock (hd->active[hd->found].u.kb,
+                                 r_image, &pk_no, &uid_no, &sigstatus);
+      if (!err)
+        xfree (sigstatus);
+      break;
+
+    case KEYDB_RESOURCE_TYPE_KEYRING:
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      break;
+
+    default:
+      err = gpg_error (GPG_ERR_GENERAL); /* oops */
+      break;
+    }
+
+  if (!err)
+    keydb_stats.get_keyblocks++;
+
+  return err;
+}
+
+
+/* Map a keybox signature status to 0 for not checked, 1 for bad and
+ * 2 for good.  */
+static int
+sigstatus_class (u32 value)
+{
+  return value < 2? 0 : value == 2? 1 : 2;
+}
+
+
+/* Store the result of the signature checks of KEYBLOCK in the keybox
+ * record from which it was read by the last keydb_get_keyblock.  The
+ * keybox blob has a status word for each signature which is
+ * otherwise unused for OpenPGP.  Because the blob is rewritten for
+ * each update and keybox_set_sigstatus verifies that the blob has
+ * not changed, the status always belongs to this very keyblock.
+ * keydb_put_sigcache diverts to here in the non-keyboxd mode.  This
+ * is only an optimization and thus errors are ignored.  */
+void
+internal_keydb_put_sigcache (KEYDB_HANDLE hd, kbnode_t keyblock)
+{
+  gpg_error_t err;
+  kbnode_t node;
+  PKT_signature *sig;
+  KEYBOX_HANDLE kbx;
+  u32 *sigstatus = NULL;
+  u32 n;
+  int changed, took_lock = 0;
+  unsigned char oldstate[KEYDB_STATELEN];
+  int have_state;
+
+  log_assert (!hd->use_keyboxd);
+
+  if (!hd->sigstatus || opt.dry_run || opt.no_sig_cache)
+    goto leave;
+  if (hd->found < 0 || hd->found >= hd->used
+      || hd->active[hd->found].type != KEYDB_RESOURCE_TYPE_KEYBOX
+      || hd->active[hd->found].read_only)
+    goto leave;
+  kbx = hd->active[hd->found].u.kb;
+
+  for (n = 0, node = keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_SIGNATURE)
+      n++;
+  if (n != hd->sigstatus[0])
+    goto leave;
+
+  sigstatus = xtrymalloc ((1 + n) * sizeof *sigstatus);
+  if (!sigstatus)
+    goto leave;
+  sigstatus[0] = n;
+  changed = 0;
+  for (n = 1, node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if (!sig->flags.checked)
+        sigstatus[n] = hd->sigstatus[n];
+      else if (!sig->flags.valid)
+        sigstatus[n] = 2;
+      else if (sig->expiredate > 2)
+        sigstatus[n] = sig->expiredate;
+      else
+        sigstatus[n] = 0xffffffff;
+      if (sigstatus_class (sigstatus[n]) != sigstatus_class (hd->sigstatus[n]))
+        changed = 1;
+      n++;
+    }
+  if (!changed)
+    goto leave;
+
+  /* Don't wait for the lock; another process may do this as well.  */
+  if (!hd->locked)
+    {
+      if (keybox_lock (kbx, 1, 0))
+        goto leave;
+      took_lock = 1;
+    }
+  have_state = !keydb_get_state (oldstate);
+  err = keybox_set_sigstatus (kbx, sigstatus);
+  if (!err && have_state)
+    tdbdeps_keydb_changed (oldstate, NULL);
+  if (took_lock)
+    keybox_lock (kbx, 0, 0);
+  if (err)
+    {
+      if (DBG_LOOKUP)
+        log_debug ("%s: error storing the signature status: %s\n",
+                   __func__, gpg_strerror (err));
+      goto leave;
+    }
+
+  if (hd->keyblock_cache.state == KEYBLOCK_CACHE_FILLED
+      && hd->keyblock_cache.sigstatus)
+    memcpy (hd->keyblock_cache.sigstatus, sigstatus,
+            (1 + sigstatus[0]) * sizeof *sigstatus);
+  xfree (hd->sigstatus);
+  hd->sigstatus = sigstatus;
+  sigstatus = NULL;
+
+ leave:
+  xfree (sigstatus);
+}
+
+
 /* Update the keyblock KB (i.e., extract the fingerprint and find the
  * corresponding keyblock in the keyring).
  * keydb_update_keyblock diverts to here in the non-keyboxd mode.
@@ -1406,6 +1655,8 @@ internal_keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   PKT_public_key *pk;
   KEYDB_SEARCH_DESC desc;
   size_t len;
+  unsigned char oldstate[KEYDB_STATELEN];
+  int have_state;
 
   log_assert (!hd->use_keyboxd);
   pk = kb->pkt->pkt.public_key;
@@ -1419,6 +1670,7 @@ internal_keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   err = lock_all (hd);
   if (err)
     return err;
+  have_state = !keydb_get_state (oldstate);
 
 #ifdef USE_TOFU
   tofu_notice_key_changed (ctrl, kb);
@@ -1467,6 +1719,8 @@ internal_keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
       break;
     }
 
+  if (!err && have_state)
+    tdbdeps_keydb_changed (oldstate, kb);
   unlock_all (hd);
   if (!err)
     keydb_stats.update_keyblocks++;
@@ -1490,6 +1744,8 @@ internal_keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
 {
   gpg_error_t err;
   int idx;
+  unsigned char oldstate[KEYDB_STATELEN];
+  int have_state;
 
   log_assert (!hd->use_keyboxd);
 
@@ -1509,6 +1765,7 @@ internal_keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   err = lock_all (hd);
   if (err)
     return err;
+  have_state = !keydb_get_state (oldstate);
 
   switch (hd->active[idx].type)
     {
@@ -1538,6 +1795,8 @@ internal_keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
       break;
     }
 
+  if (!err && have_state)
+    tdbdeps_keydb_changed (oldstate, kb);
   unlock_all (hd);
   if (!err)
     keydb_stats.insert_keyblocks++;
@@ -1554,6 +1813,8 @@ gpg_error_t
 internal_keydb_delete_keyblock (KEYDB_HANDLE hd)
 {
   gpg_error_t rc;
+  unsigned char oldstate[KEYDB_STATELEN];
+  int have_state;
 
   log_assert (!hd->use_keyboxd);
 
@@ -1569,6 +1830,7 @@ internal_keydb_delete_keyblock (KEYDB_HANDLE hd)
   rc = lock_all (hd);
   if (rc)
     return rc;
+  have_state = !keydb_get_state (oldstate);
 
   switch (hd->active[hd->found].type)
     {
@@ -1583,6 +1845,8 @@ internal_keydb_delete_keyblock (KEYDB_HANDLE hd)
       break;
     }
 
+  if (!rc && have_state)
+    tdbdeps_keydb_changed (oldstate, NULL);
   unlock_all (hd);
   if (!rc)
     keydb_stats.delete_keyblocks++;
@@ -1687,6 +1951,71 @@ keydb_rebuild_caches (ctrl_t ctrl, int noisy)
 }
 
 
+/* Store a digest over the names, sizes, modification times and
+ * inodes of all registered resources at R_STATE, which must provide
+ * KEYDB_STATELEN bytes.  The nanoseconds of the modification times
+ * are included where available so that changes within the same
+ * second are detected.  Any change to a resource is expected to
+ * change this state.  GPG_ERR_NOT_SUPPORTED is returned if that is
+ * not possible, for example when the keyboxd is used.  */
+gpg_error_t
+keydb_get_state (unsigned char *r_state)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+  struct stat st;
+  unsigned char buf[8];
+  unsigned long long ull[4];
+  int i, j;
+
+  if (opt.use_keyboxd || !used_resources)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
+  if (err)
+    return err;
+  for (i=0; i < used_resources; i++)
+    {
+      if (!resource_fnames[i])
+        {
+          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+          break;
+        }
+      if (gnupg_stat (resource_fnames[i], &st))
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      gcry_md_putc (md, all_resources[i].type);
+      gcry_md_write (md, resource_fnames[i], strlen (resource_fnames[i]) + 1);
+      ull[0] = st.st_size;
+      ull[1] = st.st_mtime;
+      ull[2] = st.st_ino;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+      ull[3] = st.st_mtim.tv_nsec;
+#else
+      ull[3] = 0;
+#endif
+      for (j=0; j < DIM (ull); j++)
+        {
+          buf[0] = ull[j] >> 56;
+          buf[1] = ull[j] >> 48;
+          buf[2] = ull[j] >> 40;
+          buf[3] = ull[j] >> 32;
+          buf[4] = ull[j] >> 24;
+          buf[5] = ull[j] >> 16;
+          buf[6] = ull[j] >>  8;
+          buf[7] = ull[j];
+          gcry_md_write (md, buf, 8);
+        }
+    }
+  if (!err)
+    memcpy (r_state, gcry_md_read (md, GCRY_MD_SHA1), KEYDB_STATELEN);
+  gcry_md_close (md);
+  return err;
+}
+
+
 /* Return the number of skipped blocks (because they were too large to
    read from a keybox) since the last search reset.  */
 unsigned long
@@ -1713,6 +2042,8 @@ internal_keydb_search_reset (KEYDB_HANDLE hd)
   log_assert (!hd->use_keyboxd);
 
   keyblock_cache_clear (hd);
+  xfree (hd->sigstatus);
+  hd->sigstatus = NULL;
 
   hd->skipped_long_blobs = 0;
   hd->current = 0;
@@ -1770,6 +2101,9 @@ internal_keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 
   log_assert (!hd->use_keyboxd);
 
+  xfree (hd->sigstatus);
+  hd->sigstatus = NULL;
+
   if (!any_registered)
     {
       write_status_error ("keydb_search", gpg_error (GPG_ERR_KEYRING_OPEN));
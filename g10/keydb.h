@@ -188,12 +188,22 @@ gpg_error_t keydb_lock (KEYDB_HANDLE hd);
 /* Return the keyblock last found by keydb_search.  */
 gpg_error_t keydb_get_keyblock (KEYDB_HANDLE hd, kbnode_t *ret_kb);
 
+/* Return the stored image of the keyblock last found by keydb_search.  */
+gpg_error_t keydb_get_keyblock_image (KEYDB_HANDLE hd, iobuf_t *r_image);
+
+/* Tell the keyboxd about the checked signatures of KEYBLOCK.  */
+void keydb_put_sigcache (KEYDB_HANDLE hd, kbnode_t keyblock);
+
 /* Update the keyblock KB.  */
 gpg_error_t keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb);
 
 /* Insert a keyblock into one of the storage system.  */
 gpg_error_t keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb);
 
+/* Store a raw keyblock image in the keyboxd without replacing.  */
+gpg_error_t keydb_insert_keyblock_image (KEYDB_HANDLE hd,
+                                         const void *image, size_t imagelen);
+
 /* Delete the currently selected keyblock.  */
 gpg_error_t keydb_delete_keyblock (KEYDB_HANDLE hd);
 
@@ -204,6 +214,13 @@ gpg_error_t keydb_search_reset (KEYDB_HANDLE hd);
 gpg_error_t keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
                           size_t ndesc, size_t *descindex);
 
+/* Fetch the keys for several search descriptions at once.  */
+gpg_error_t keydb_prefetch (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc,
+                            size_t ndesc);
+
+/* Release the results of keydb_prefetch.  */
+void keydb_prefetch_release (ctrl_t ctrl);
+
 
 
 /*-- keydb.c --*/
@@ -228,6 +245,9 @@ void keydb_dump_stats (void);
    Using a new parameter for keydb_new might be a better solution.  */
 void keydb_disable_caching (KEYDB_HANDLE hd);
 
+/* Skip packets of the given types in keydb_get_keyblock.  */
+void keydb_set_skip_pkttypes (KEYDB_HANDLE hd, unsigned int skip_pkttypes);
+
 /* Save the last found state and invalidate the current selection.  */
 void keydb_push_found_state (KEYDB_HANDLE hd);
 
@@ -243,6 +263,12 @@ gpg_error_t keydb_locate_writable (KEYDB_HANDLE hd);
 /* Rebuild the on-disk caches of all key resources.  */
 void keydb_rebuild_caches (ctrl_t ctrl, int noisy);
 
+/* The length of the state returned by keydb_get_state.  */
+#define KEYDB_STATELEN 20
+
+/* Return a digest describing the current state of all resources.  */
+gpg_error_t keydb_get_state (unsigned char *r_state);
+
 /* Return the number of skipped blocks (because they were to large to
    read from a keybox) since the last search reset.  */
 unsigned long keydb_get_skipped_counter (KEYDB_HANDLE hd);
@@ -3423,56 +3423,27 @@ keyedit_quick_addadsk (ctrl_t ctrl, const char *fpr, const char *adskfpr)
 }
 
 
-/* Unattended expiration setting function for the main key.  If
- * SUBKEYFPRS is not NULL and SUBKEYSFPRS[0] is neither NULL, it is
- * expected to be an array of fingerprints for subkeys to change. It
- * may also be an array with only the item "*" to indicate that all
- * keys shall be set to that expiration date.
- */
-void
-keyedit_quick_set_expire (ctrl_t ctrl, const char *fpr, const char *expirestr,
-                          char **subkeyfprs)
+/* Helper for keyedit_quick_set_expire and keyedit_quick_edit_key.
+ * Set the expiration time EXPIRESTR for the primary key of KEYBLOCK or
+ * for the subkeys given by SUBKEYFPRS.  See keyedit_quick_set_expire
+ * for a description of SUBKEYFPRS.  Returns GPG_ERR_TRUE if the
+ * keyblock has been modified.  */
+static gpg_error_t
+quick_set_expire_keyblock (ctrl_t ctrl, kbnode_t keyblock,
+                           const char *expirestr, char **subkeyfprs)
 {
   gpg_error_t err;
-  kbnode_t keyblock, node;
-  KEYDB_HANDLE kdbhd;
-  int modified = 0;
+  kbnode_t node;
   PKT_public_key *pk;
   u32 expire;
   int primary_only = 0;
   int idx;
 
-#ifdef HAVE_W32_SYSTEM
-  /* See keyedit_menu for why we need this.  */
-  check_trustdb_stale (ctrl);
-#endif
-
-  /* We require a fingerprint because only this uniquely identifies a
-   * key and may thus be used to select a key for unattended
-   * expiration setting.  */
-  err = find_by_primary_fpr (ctrl, fpr, &keyblock, &kdbhd);
-  if (err)
-    goto leave;
-
-  if (fix_keyblock (ctrl, &keyblock))
-    modified++;
-
-  pk = keyblock->pkt->pkt.public_key;
-  if (pk->flags.revoked)
-    {
-      if (!opt.verbose)
-        show_key_with_all_names (ctrl, es_stdout, keyblock, 0, 0, 0, 0, 0, 1);
-      log_error ("%s%s", _("Key is revoked."), "\n");
-      err = gpg_error (GPG_ERR_CERT_REVOKED);
-      goto leave;
-    }
-
   expire = parse_expire_string (expirestr);
   if (expire == (u32)-1 )
     {
       log_error (_("'%s' is not a valid expiration time\n"), expirestr);
-      err = gpg_error (GPG_ERR_INV_VALUE);
-      goto leave;
+      return gpg_error (GPG_ERR_INV_VALUE);
     }
   if (expire)
     expire += make_timestamp ();
@@ -3543,11 +3514,56 @@ keyedit_quick_set_expire (ctrl_t ctrl, const char *fpr, const char *expirestr,
         }
 
       if (err)
-        goto leave;
+        return err;
     }
 
   /* Set the new expiration date.  */
-  err = menu_expire (ctrl, keyblock, primary_only? 1 : 2, expire);
+  return menu_expire (ctrl, keyblock, primary_only? 1 : 2, expire);
+}
+
+
+/* Unattended expiration setting function for the main key.  If
+ * SUBKEYFPRS is not NULL and SUBKEYSFPRS[0] is neither NULL, it is
+ * expected to be an array of fingerprints for subkeys to change. It
+ * may also be an array with only the item "*" to indicate that all
+ * keys shall be set to that expiration date.
+ */
+void
+keyedit_quick_set_expire (ctrl_t ctrl, const char *fpr, const char *expirestr,
+                          char **subkeyfprs)
+{
+  gpg_error_t err;
+  kbnode_t keyblock;
+  KEYDB_HANDLE kdbhd;
+  int modified = 0;
+  PKT_public_key *pk;
+
+#ifdef HAVE_W32_SYSTEM
+  /* See keyedit_menu for why we need this.  */
+  check_trustdb_stale (ctrl);
+#endif
+
+  /* We require a fingerprint because only this uniquely identifies a
+   * key and may thus be used to select a key for unattended
+   * expiration setting.  */
+  err = find_by_primary_fpr (ctrl, fpr, &keyblock, &kdbhd);
+  if (err)
+    goto leave;
+
+  if (fix_keyblock (ctrl, &keyblock))
+    modified++;
+
+  pk = keyblock->pkt->pkt.public_key;
+  if (pk->flags.revoked)
+    {
+      if (!opt.verbose)
+        show_key_with_all_names (ctrl, es_stdout, keyblock, 0, 0, 0, 0, 0, 1);
+      log_error ("%s%s", _("Key is revoked."), "\n");
+      err = gpg_error (GPG_ERR_CERT_REVOKED);
+      goto leave;
+    }
+
+  err = quick_set_expire_keyblock (ctrl, keyblock, expirestr, subkeyfprs);
   if (gpg_err_code (err) == GPG_ERR_TRUE)
     modified = 1;
   else if (err)
@@ -3577,6 +3593,235 @@ keyedit_quick_set_expire (ctrl_t ctrl, const char *fpr, const char *expirestr,
 }
 
 
+/* Unattended bulk editing of a key.  FPR is the fingerprint of the
+ * primary key and FNAME the name of a file ("-" for stdin) with one
+ * operation per line:
+ *
+ *   adduid USERID
+ *   revuid USERID
+ *   primary USERID
+ *   expire EXPIRE [SUBKEYFPRS|*]
+ *   addkey [ALGO [USAGE [EXPIRE]]]
+ *   updpref
+ *
+ * Empty lines and lines starting with a '#' are ignored.  All
+ * operations are applied to the keyblock in memory and the keyblock
+ * is written only once at the end.  If an operation fails nothing is
+ * written.  */
+void
+keyedit_quick_edit_key (ctrl_t ctrl, const char *fpr, const char *fname)
+{
+  gpg_error_t err;
+  kbnode_t keyblock = NULL;
+  kbnode_t node;
+  KEYDB_HANDLE kdbhd = NULL;
+  iobuf_t fp = NULL;
+  byte *line = NULL;
+  unsigned int maxlen, nline;
+  char *p, *keyword;
+  const char *fields[34];
+  int nfields;
+  int lnr = 0;
+  int modified = 0;
+  int uids_changed = 0;
+  PKT_public_key *pk;
+
+#ifdef HAVE_W32_SYSTEM
+  /* See keyedit_menu for why we need this.  */
+  check_trustdb_stale (ctrl);
+#endif
+
+  /* We require a fingerprint because only this uniquely identifies a
+   * key and may thus be used to select a key for unattended
+   * editing.  */
+  err = find_by_primary_fpr (ctrl, fpr, &keyblock, &kdbhd);
+  if (err)
+    goto leave;
+
+  if (fix_keyblock (ctrl, &keyblock))
+    modified++;
+  merge_keys_and_selfsig (ctrl, keyblock);
+
+  pk = keyblock->pkt->pkt.public_key;
+  if (pk->flags.revoked)
+    {
+      if (!opt.verbose)
+        show_key_with_all_names (ctrl, es_stdout, keyblock, 0, 0, 0, 0, 0, 1);
+      log_error ("%s%s", _("Key is revoked."), "\n");
+      err = gpg_error (GPG_ERR_CERT_REVOKED);
+      goto leave;
+    }
+
+  if (!fname || !*fname)
+    fname = "-";
+  fp = iobuf_open (fname);
+  if (fp && is_secured_file (iobuf_get_fd (fp)))
+    {
+      iobuf_close (fp);
+      fp = NULL;
+      gpg_err_set_errno (EPERM);
+    }
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("can't open '%s': %s\n"), fname, gpg_strerror (err));
+      goto leave;
+    }
+  iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+
+  maxlen = 1024;
+  nline = 0;
+  while (iobuf_read_line (fp, &line, &nline, &maxlen))
+    {
+      lnr++;
+      if (!maxlen)
+        {
+          err = gpg_error (GPG_ERR_LINE_TOO_LONG);
+          log_error ("%s:%d: %s\n", fname, lnr, gpg_strerror (err));
+          break;
+        }
+      p = trim_spaces ((char *)line);
+      if (!*p || *p == '#')
+        continue;
+      keyword = p;
+      for (; *p && !spacep (p); p++)
+        ;
+      if (*p)
+        *p++ = 0;
+      for (; spacep (p); p++)
+        ;
+
+      /* Clear the selection left over by the previous operation.  */
+      for (node = keyblock; node; node = node->next)
+        node->flag &= ~(NODFLG_SELUID | NODFLG_SELKEY);
+
+      if (!ascii_strcasecmp (keyword, "adduid"))
+        {
+          if (!*p)
+            err = gpg_error (GPG_ERR_INV_USER_ID);
+          else if (menu_adduid (ctrl, keyblock, 0, NULL, p))
+            uids_changed = modified = 1;
+          else
+            err = gpg_error (GPG_ERR_GENERAL);
+        }
+      else if (!ascii_strcasecmp (keyword, "revuid"))
+        {
+          struct revocation_reason_info *reason;
+          size_t valid_uids = 0;
+
+          for (node = keyblock; node; node = node->next)
+            valid_uids += (node->pkt->pkttype == PKT_USER_ID
+                           && !node->pkt->pkt.user_id->flags.revoked
+                           && !node->pkt->pkt.user_id->flags.expired);
+          node = find_userid (keyblock, p, 0);
+          if (!node)
+            err = gpg_error (GPG_ERR_NO_USER_ID);
+          else if (valid_uids == 1
+                   && !node->pkt->pkt.user_id->flags.revoked
+                   && !node->pkt->pkt.user_id->flags.expired)
+            {
+              log_error (_("cannot revoke the last valid user ID.\n"));
+              err = gpg_error (GPG_ERR_INV_USER_ID);
+            }
+          else
+            {
+              reason = get_default_uid_revocation_reason ();
+              err = core_revuid (ctrl, keyblock, node, reason, &modified);
+              release_revocation_reason_info (reason);
+              uids_changed = 1;
+            }
+        }
+      else if (!ascii_strcasecmp (keyword, "primary"))
+        {
+          node = find_userid (keyblock, p, 1);
+          if (!node)
+            err = gpg_error (GPG_ERR_NO_USER_ID);
+          else
+            {
+              node->flag |= NODFLG_SELUID;
+              if (menu_set_primary_uid (ctrl, keyblock))
+                uids_changed = modified = 1;
+              else
+                err = gpg_error (GPG_ERR_GENERAL);
+            }
+        }
+      else if (!ascii_strcasecmp (keyword, "expire"))
+        {
+          nfields = split_fields (p, fields, DIM (fields) - 1);
+          if (!nfields || nfields == DIM (fields) - 1)
+            err = gpg_error (GPG_ERR_INV_VALUE);
+          else
+            {
+              fields[nfields] = NULL;
+              err = quick_set_expire_keyblock (ctrl, keyblock, fields[0],
+                                               (char **)fields + 1);
+              if (gpg_err_code (err) == GPG_ERR_TRUE)
+                {
+                  modified = 1;
+                  err = 0;
+                }
+            }
+        }
+      else if (!ascii_strcasecmp (keyword, "addkey"))
+        {
+          nfields = split_fields (p, fields, 4);
+          if (nfields > 3)
+            err = gpg_error (GPG_ERR_TOO_MANY);
+          else
+            {
+              err = generate_subkeypair (ctrl, keyblock,
+                                         nfields > 0? fields[0] : "",
+                                         nfields > 1? fields[1] : "",
+                                         nfields > 2? fields[2] : "");
+              if (!err)
+                modified = 1;
+            }
+        }
+      else if (!ascii_strcasecmp (keyword, "updpref"))
+        {
+          if (menu_set_preferences (ctrl, keyblock, 1))
+            modified = 1;
+        }
+      else
+        err = gpg_error (GPG_ERR_UNKNOWN_COMMAND);
+
+      if (err)
+        {
+          log_error ("%s:%d: %s: %s\n", fname, lnr, keyword,
+                     gpg_strerror (err));
+          break;
+        }
+      merge_keys_and_selfsig (ctrl, keyblock);
+    }
+  es_fflush (es_stdout);
+  if (err)
+    goto leave;
+
+  /* Store.  */
+  if (modified)
+    {
+      err = keydb_update_keyblock (ctrl, kdbhd, keyblock);
+      if (err)
+        {
+          log_error (_("update failed: %s\n"), gpg_strerror (err));
+          goto leave;
+        }
+      if (uids_changed || update_trust)
+        revalidation_mark (ctrl);
+    }
+  else
+    log_info (_("Key not changed so no update needed.\n"));
+
+ leave:
+  if (err)
+    write_status_error ("keyedit.edit", err);
+  xfree (line);
+  iobuf_close (fp);
+  release_kbnode (keyblock);
+  keydb_release (kdbhd);
+}
+
+
 
 static void
 tty_print_notations (int indent, PKT_signature * sig)
@@ -59,6 +59,7 @@ void keyedit_quick_set_primary (ctrl_t ctrl, const char *username,
 void keyedit_quick_update_pref (ctrl_t ctrl, const char *username);
 void keyedit_quick_set_ownertrust (ctrl_t ctrl, const char *username,
                                    const char *value);
+void keyedit_quick_edit_key (ctrl_t ctrl, const char *fpr, const char *fname);
 gpg_error_t append_adsk_to_key (ctrl_t ctrl, kbnode_t keyblock,
                                 PKT_public_key *adsk);
 void show_basic_key_info (ctrl_t ctrl, kbnode_t keyblock, int print_sec);
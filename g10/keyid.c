@@ -1335,6 +1335,12 @@ keygrip_from_pk (PKT_public_key *pk, unsigned char *array, int get_second)
   if (get_second && pk->pubkey_algo != PUBKEY_ALGO_KYBER)
     return gpg_error (GPG_ERR_FALSE);
 
+  if (get_second? pk->flags.grip2_valid : pk->flags.grip_valid)
+    {
+      memcpy (array, pk->grip[!!get_second], KEYGRIP_LEN);
+      return 0;
+    }
+
   switch (pk->pubkey_algo)
     {
     case GCRY_PK_DSA:
@@ -1431,7 +1437,12 @@ keygrip_from_pk (PKT_public_key *pk, unsigned char *array, int get_second)
     {
       if (DBG_PACKET)
         log_printhex (array, 20, "keygrip=");
-      /* FIXME: Save the keygrip in PK.  */
+      /* Save the keygrip in PK; copies of PK take it along.  */
+      memcpy (pk->grip[!!get_second], array, KEYGRIP_LEN);
+      if (get_second)
+        pk->flags.grip2_valid = 1;
+      else
+        pk->flags.grip_valid = 1;
     }
   gcry_sexp_release (s_pkey);
 
@@ -50,6 +50,11 @@
 #include "../common/pkscreening.h"
 
 
+/* The number of keyblocks list_all reads ahead to verify their
+ * signatures in parallel.  */
+#define LIST_BATCH_SIZE 32
+
+
 static void list_all (ctrl_t, int, int);
 static void list_one (ctrl_t ctrl,
                       strlist_t names, int secret, int mark_secret);
@@ -740,7 +745,11 @@ static void
 list_all (ctrl_t ctrl, int secret, int mark_secret)
 {
   KEYDB_HANDLE hd;
-  KBNODE keyblock = NULL;
+  kbnode_t keyblocks[LIST_BATCH_SIZE];
+  const char *resnames[LIST_BATCH_SIZE];
+  int nkeyblocks = 0;
+  int batch_size, i;
+  int get_failed = 0;
   int rc = 0;
   int any_secret;
   const char *lastresname, *resname;
@@ -751,6 +760,14 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
   if (opt.check_sigs)
     listctx.check_sigs = 1;
 
+  /* With several signature check threads we read a batch of
+   * keyblocks and verify their signatures together before listing
+   * them in the order of the keydb.  */
+  if (opt.sig_check_threads >= 2 && !opt.no_sig_cache && !secret)
+    batch_size = LIST_BATCH_SIZE;
+  else
+    batch_size = 1;
+
   hd = keydb_new (ctrl);
   if (!hd)
     rc = gpg_error_from_syserror ();
@@ -766,50 +783,80 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
   lastresname = NULL;
   do
     {
-      if (secret)
-        glo_ctrl.silence_parse_warnings++;
-      rc = keydb_get_keyblock (hd, &keyblock);
-      if (secret)
-        glo_ctrl.silence_parse_warnings--;
-      if (rc)
-	{
-          if (gpg_err_code (rc) == GPG_ERR_LEGACY_KEY)
-            continue;  /* Skip legacy keys.  */
-	  log_error ("keydb_get_keyblock failed: %s\n", gpg_strerror (rc));
-	  goto leave;
-	}
+      for (nkeyblocks = 0; !rc && nkeyblocks < batch_size;
+           rc = keydb_search_next (hd))
+        {
+          if (secret)
+            glo_ctrl.silence_parse_warnings++;
+          rc = keydb_get_keyblock (hd, keyblocks + nkeyblocks);
+          if (secret)
+            glo_ctrl.silence_parse_warnings--;
+          if (rc)
+            {
+              if (gpg_err_code (rc) == GPG_ERR_LEGACY_KEY)
+                {
+                  rc = 0;
+                  continue;  /* Skip legacy keys.  */
+                }
+              log_error ("keydb_get_keyblock failed: %s\n",
+                         gpg_strerror (rc));
+              get_failed = 1;
+              break;
+            }
+          resnames[nkeyblocks++] = keydb_get_resource_name (hd);
+        }
 
-      if (secret || mark_secret)
-        any_secret = !agent_probe_any_secret_key (ctrl, keyblock);
-      else
-        any_secret = 0;
+      /* Do the public key operations of the self-signature checks in
+       * merge_keys_and_selfsig and of --check-signatures in
+       * parallel.  */
+      if (nkeyblocks > 1)
+        check_key_signatures_multi (ctrl, keyblocks, nkeyblocks,
+                                    !listctx.check_sigs, NULL, NULL);
 
-      if (secret && !any_secret)
-        ; /* Secret key listing requested but this isn't one.  */
-      else
+      for (i = 0; i < nkeyblocks; i++)
         {
-          if (!opt.with_colons && !(opt.list_options & LIST_SHOW_ONLY_FPR_MBOX))
+          kbnode_t keyblock = keyblocks[i];
+
+          if (listerr)
+            ;
+          else if (secret || mark_secret)
+            any_secret = !agent_probe_any_secret_key (ctrl, keyblock);
+          else
+            any_secret = 0;
+
+          if (listerr)
+            ;
+          else if (secret && !any_secret)
+            ; /* Secret key listing requested but this isn't one.  */
+          else
             {
-              resname = keydb_get_resource_name (hd);
-              if (lastresname != resname)
+              if (!opt.with_colons
+                  && !(opt.list_options & LIST_SHOW_ONLY_FPR_MBOX))
                 {
-                  int i;
+                  resname = resnames[i];
+                  if (lastresname != resname)
+                    {
+                      int j;
 
-                  es_fprintf (es_stdout, "%s\n", resname);
-                  for (i = strlen (resname); i; i--)
-                    es_putc ('-', es_stdout);
-                  es_putc ('\n', es_stdout);
-                  lastresname = resname;
+                      es_fprintf (es_stdout, "%s\n", resname);
+                      for (j = strlen (resname); j; j--)
+                        es_putc ('-', es_stdout);
+                      es_putc ('\n', es_stdout);
+                      lastresname = resname;
+                    }
                 }
+              merge_keys_and_selfsig (ctrl, keyblock);
+              listerr = list_keyblock (ctrl, keyblock, secret, any_secret,
+                                       opt.fingerprint, &listctx);
             }
-          merge_keys_and_selfsig (ctrl, keyblock);
-          listerr = list_keyblock (ctrl, keyblock, secret, any_secret,
-                                   opt.fingerprint, &listctx);
+          release_kbnode (keyblock);
+          keyblocks[i] = NULL;
         }
-      release_kbnode (keyblock);
-      keyblock = NULL;
+      nkeyblocks = 0;
+      if (get_failed)
+        goto leave;
     }
-  while (!listerr && !(rc = keydb_search_next (hd)));
+  while (!listerr && !rc);
   es_fflush (es_stdout);
   if (rc && gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
     log_error ("keydb_search_next failed: %s\n", gpg_strerror (rc));
@@ -824,11 +871,11 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
 
  leave:
   keylist_context_release (&listctx);
-  release_kbnode (keyblock);
+  for (i = 0; i < nkeyblocks; i++)
+    release_kbnode (keyblocks[i]);
   keydb_release (hd);
 }
 
-
 static void
 list_one (ctrl_t ctrl, strlist_t names, int secret, int mark_secret)
 {
@@ -2382,7 +2429,8 @@ list_keyblock (ctrl_t ctrl,
 
       for (parm.node = keyblock; parm.node; parm.node = parm.node->next)
         {
-          if (recsel_select (list_filter.selkey, impex_filter_getval, &parm))
+          if (recsel_select_ext (list_filter.selkey, impex_filter_getval,
+                                 impex_filter_getnum, &parm))
             {
               selected = 1;
               break;
@@ -2392,6 +2440,9 @@ list_keyblock (ctrl_t ctrl,
         return 0;  /* Skip this one.  */
     }
 
+  if (opt.check_sigs)
+    check_key_signatures_batch (ctrl, keyblock, 0);
+
   if (opt.with_colons)
     list_keyblock_colon (ctrl, keyblock, secret, has_secret);
   else if ((opt.list_options & LIST_SHOW_ONLY_FPR_MBOX))
@@ -0,0 +1,779 @@
+/* keyring-index.c - Sidecar index for keyring files
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The index maps fingerprints, long keyids and the mail addresses of
+ * the user ids to the file offsets of the keyblocks carrying them.
+ * It is stored next to the keyring as "<fname>.idx" and is only a
+ * cache: each candidate keyblock is still checked by keyring_search
+ * and a stale or broken index is simply rebuilt.  Whether an index
+ * is up to date is decided by comparing the size, mtime and inode of
+ * the keyring file with the values stored in the index header.  This
+ * is the same scheme as used by the keybox index.
+ *
+ * File format (all integers are big endian):
+ *
+ *   byte  0-3   magic "KRGi"
+ *   byte  4     version (1)
+ *   byte  5-7   reserved
+ *   byte  8-15  size of the keyring file
+ *   byte 16-23  mtime of the keyring file
+ *   byte 24-31  inode of the keyring file
+ *   byte 32-35  number of records
+ *   byte 36-39  reserved
+ *
+ * followed by the records sorted by key and then offset:
+ *
+ *   byte  0-7   key
+ *   byte  8-15  offset of the keyblock in the keyring file
+ *
+ * The key is the leftmost 8 bytes of the SHA-1 over a type byte and
+ * the fingerprint, keyid or lowercased mail address.  Collisions
+ * only lead to additional candidates.  Keyrings with v3 keys are not
+ * indexed.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/host2net.h"
+#include "../common/sysutils.h"
+#include "packet.h"
+#include "keydb.h"
+#include "options.h"
+#include "main.h"
+#include "keyring-index.h"
+
+#define INDEX_MAGIC      "KRGi"
+#define INDEX_VERSION    1
+#define INDEX_HDRLEN     40
+#define INDEX_RECLEN     16
+
+/* The type bytes used to build the keys.  */
+#define INDEX_TYPE_FPR   'F'
+#define INDEX_TYPE_KID   'K'
+#define INDEX_TYPE_MAIL  'M'
+
+
+struct index_rec_s
+{
+  unsigned char key[8];
+  uint64_t off;
+};
+
+struct index_recs_s
+{
+  struct index_rec_s *recs;
+  size_t nrecs;
+  size_t size;
+};
+
+
+static uint64_t
+get64 (const unsigned char *p)
+{
+  return (((uint64_t)buf32_to_u32 (p)) << 32) | buf32_to_u32 (p + 4);
+}
+
+
+static void
+put64 (unsigned char *p, uint64_t a)
+{
+  p[0] = a >> 56;
+  p[1] = a >> 48;
+  p[2] = a >> 40;
+  p[3] = a >> 32;
+  p[4] = a >> 24;
+  p[5] = a >> 16;
+  p[6] = a >>  8;
+  p[7] = a;
+}
+
+
+static void
+put32 (unsigned char *p, u32 a)
+{
+  p[0] = a >> 24;
+  p[1] = a >> 16;
+  p[2] = a >>  8;
+  p[3] = a;
+}
+
+
+static char *
+index_fname (const char *fname)
+{
+  return strconcat (fname, ".idx", NULL);
+}
+
+
+/* Store the state of the keyring file FNAME at STAMP.  */
+gpg_error_t
+keyring_index_stamp (const char *fname, struct keyring_stamp_s *stamp)
+{
+  struct stat st;
+
+  memset (stamp, 0, sizeof *stamp);
+  if (gnupg_stat (fname, &st))
+    return gpg_error_from_syserror ();
+  stamp->size = st.st_size;
+  stamp->mtime = st.st_mtime;
+  stamp->ino = st.st_ino;
+  return 0;
+}
+
+
+static int
+stamp_equal (const struct keyring_stamp_s *a,
+             const struct keyring_stamp_s *b)
+{
+  return a->size == b->size && a->mtime == b->mtime && a->ino == b->ino;
+}
+
+
+/* Compute the KEY for DATA of DATALEN bytes and the given TYPE.  If
+ * LOWERCASE is set DATA is mapped to lowercase first.  */
+static gpg_error_t
+make_key (unsigned char *key, int type, const void *data, size_t datalen,
+          int lowercase)
+{
+  gcry_buffer_t iov[2];
+  unsigned char typebuf[1];
+  unsigned char digest[20];
+  char *tmp = NULL;
+  size_t n;
+
+  if (lowercase)
+    {
+      tmp = xtrymalloc (datalen? datalen : 1);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      for (n=0; n < datalen; n++)
+        tmp[n] = ascii_tolower (((const char *)data)[n]);
+      data = tmp;
+    }
+
+  typebuf[0] = type;
+  memset (iov, 0, sizeof iov);
+  iov[0].data = typebuf;
+  iov[0].len = 1;
+  iov[1].data = (void *)data;
+  iov[1].len = datalen;
+  gcry_md_hash_buffers (GCRY_MD_SHA1, 0, digest, iov, 2);
+  memcpy (key, digest, 8);
+  xfree (tmp);
+  return 0;
+}
+
+
+static gpg_error_t
+add_rec (struct index_recs_s *r, int type, const void *data, size_t datalen,
+         int lowercase, uint64_t off)
+{
+  struct index_rec_s *rec;
+
+  if (r->nrecs == r->size)
+    {
+      size_t newsize = r->size? 2 * r->size : 1024;
+
+      rec = xtryrealloc (r->recs, newsize * sizeof *rec);
+      if (!rec)
+        return gpg_error_from_syserror ();
+      r->recs = rec;
+      r->size = newsize;
+    }
+  rec = r->recs + r->nrecs;
+  if (make_key (rec->key, type, data, datalen, lowercase))
+    return gpg_error_from_syserror ();
+  rec->off = off;
+  r->nrecs++;
+  return 0;
+}
+
+
+/* Locate the addr-spec in the user id UID of UIDLEN bytes the same
+ * way the mail search modes do.  On success the start is stored at
+ * R_S and the length at R_LEN.  Returns false if UID has no
+ * addr-spec.  */
+int
+keyring_mail_span (const char *uid, size_t uidlen,
+                   const char **r_s, size_t *r_len)
+{
+  const char *s, *se;
+  size_t i;
+
+  for (i=0, s=uid; i < uidlen && *s != '<'; s++, i++)
+    ;
+  if (i == uidlen)
+    {
+      /* The UID is a plain addr-spec (cf. RFC2822 section 4.3).  */
+      if (!uidlen)
+        return 0;
+      *r_s = uid;
+      *r_len = uidlen;
+      return 1;
+    }
+
+  /* Skip opening delim and one char and look for the closing one.  */
+  s++; i++;
+  for (se=s+1, i++; i < uidlen && *se != '>'; se++, i++)
+    ;
+  if (i >= uidlen)
+    return 0;
+  *r_s = s;
+  *r_len = se - s;
+  return 1;
+}
+
+
+/* Add the records for the packet PKT of the keyblock at offset OFF to
+ * R.  Returns GPG_ERR_LEGACY_KEY for v3 keys.  */
+static gpg_error_t
+add_packet_recs (struct index_recs_s *r, PACKET *pkt, uint64_t off)
+{
+  gpg_error_t err = 0;
+  PKT_public_key *pk;
+  PKT_user_id *uid;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  unsigned char kidbuf[8];
+  u32 kid[2];
+  const char *s;
+  size_t n;
+
+  switch (pkt->pkttype)
+    {
+    case PKT_PUBLIC_KEY:
+    case PKT_PUBLIC_SUBKEY:
+    case PKT_SECRET_KEY:
+    case PKT_SECRET_SUBKEY:
+      pk = pkt->pkt.public_key;
+      if (pk->version < 4)
+        return gpg_error (GPG_ERR_LEGACY_KEY);
+      fingerprint_from_pk (pk, fpr, &fprlen);
+      err = add_rec (r, INDEX_TYPE_FPR, fpr, fprlen, 0, off);
+      if (!err)
+        {
+          keyid_from_pk (pk, kid);
+          put32 (kidbuf, kid[0]);
+          put32 (kidbuf + 4, kid[1]);
+          err = add_rec (r, INDEX_TYPE_KID, kidbuf, 8, 0, off);
+        }
+      break;
+
+    case PKT_USER_ID:
+      uid = pkt->pkt.user_id;
+      if (!uid->attrib_data && keyring_mail_span (uid->name, uid->len, &s, &n))
+        err = add_rec (r, INDEX_TYPE_MAIL, s, n, 1, off);
+      break;
+
+    default:
+      break;
+    }
+
+  return err;
+}
+
+
+static int
+cmp_rec (const void *a_arg, const void *b_arg)
+{
+  const struct index_rec_s *a = a_arg;
+  const struct index_rec_s *b = b_arg;
+  int cmp;
+
+  cmp = memcmp (a->key, b->key, 8);
+  if (cmp)
+    return cmp;
+  return a->off < b->off? -1 : a->off > b->off;
+}
+
+
+/* Create a temporary file for the index of FNAME.  On success the
+ * stream is stored at R_FP and the name at R_TMPFNAME.  */
+static gpg_error_t
+create_index_file (const char *fname, estream_t *r_fp, char **r_tmpfname)
+{
+  gpg_error_t err;
+  char *idxfname, *tmpfname;
+
+  *r_fp = NULL;
+  *r_tmpfname = NULL;
+  idxfname = index_fname (fname);
+  if (!idxfname)
+    return gpg_error_from_syserror ();
+  tmpfname = xtryasprintf ("%s-%u.tmp", idxfname, (unsigned int)getpid ());
+  xfree (idxfname);
+  if (!tmpfname)
+    return gpg_error_from_syserror ();
+
+  *r_fp = es_fopen (tmpfname, "wb");
+  if (!*r_fp)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (tmpfname);
+      return err;
+    }
+  *r_tmpfname = tmpfname;
+  return 0;
+}
+
+
+/* Sort the records R and write them to the stream FP created by
+ * create_index_file.  On success the file is renamed to the index of
+ * FNAME.  FP and TMPFNAME are released in any case.  */
+static gpg_error_t
+finish_index_file (const char *fname, estream_t fp, char *tmpfname,
+                   struct index_recs_s *r,
+                   const struct keyring_stamp_s *stamp)
+{
+  gpg_error_t err = 0;
+  char *idxfname;
+  unsigned char buf[INDEX_HDRLEN];
+  size_t n;
+
+  if (r->nrecs > 0xffffffff)
+    err = gpg_error (GPG_ERR_TOO_LARGE);
+  else
+    qsort (r->recs, r->nrecs, sizeof *r->recs, cmp_rec);
+
+  memset (buf, 0, sizeof buf);
+  memcpy (buf, INDEX_MAGIC, 4);
+  buf[4] = INDEX_VERSION;
+  put64 (buf + 8, stamp->size);
+  put64 (buf + 16, stamp->mtime);
+  put64 (buf + 24, stamp->ino);
+  put32 (buf + 32, r->nrecs);
+  if (!err && es_fwrite (buf, INDEX_HDRLEN, 1, fp) != 1)
+    err = gpg_error_from_syserror ();
+  for (n=0; !err && n < r->nrecs; n++)
+    {
+      memcpy (buf, r->recs[n].key, 8);
+      put64 (buf + 8, r->recs[n].off);
+      if (es_fwrite (buf, INDEX_RECLEN, 1, fp) != 1)
+        err = gpg_error_from_syserror ();
+    }
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+
+  if (!err)
+    {
+      idxfname = index_fname (fname);
+      if (!idxfname)
+        err = gpg_error_from_syserror ();
+      else
+        err = gnupg_rename_file (tmpfname, idxfname, NULL);
+      xfree (idxfname);
+    }
+  if (err)
+    gnupg_remove (tmpfname);
+  xfree (tmpfname);
+  return err;
+}
+
+
+/* Open the index of FNAME and check its header against STAMP.  On
+ * success the stream positioned at the first record is stored at
+ * R_FP and the number of records at R_NRECS.  GPG_ERR_NOT_FOUND is
+ * returned for a missing or stale index.  */
+static gpg_error_t
+open_index (const char *fname, const struct keyring_stamp_s *stamp,
+            estream_t *r_fp, size_t *r_nrecs)
+{
+  gpg_error_t err;
+  char *idxfname;
+  estream_t fp;
+  unsigned char buf[INDEX_HDRLEN];
+  struct keyring_stamp_s idxstamp;
+
+  *r_fp = NULL;
+  idxfname = index_fname (fname);
+  if (!idxfname)
+    return gpg_error_from_syserror ();
+  fp = es_fopen (idxfname, "rb");
+  xfree (idxfname);
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      if (gpg_err_code (err) == GPG_ERR_ENOENT)
+        err = gpg_error (GPG_ERR_NOT_FOUND);
+      return err;
+    }
+
+  if (es_fread (buf, INDEX_HDRLEN, 1, fp) != 1
+      || memcmp (buf, INDEX_MAGIC, 4) || buf[4] != INDEX_VERSION)
+    {
+      es_fclose (fp);
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+  idxstamp.size  = get64 (buf + 8);
+  idxstamp.mtime = get64 (buf + 16);
+  idxstamp.ino   = get64 (buf + 24);
+  if (!stamp_equal (stamp, &idxstamp))
+    {
+      es_fclose (fp);
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+
+  *r_nrecs = buf32_to_size_t (buf + 32);
+  *r_fp = fp;
+  return 0;
+}
+
+
+/* Read all records from FP into R.  */
+static gpg_error_t
+read_all_recs (estream_t fp, size_t nrecs, struct index_recs_s *r)
+{
+  unsigned char buf[INDEX_RECLEN];
+  size_t n;
+
+  r->recs = xtrycalloc (nrecs? nrecs : 1, sizeof *r->recs);
+  if (!r->recs)
+    return gpg_error_from_syserror ();
+  r->size = nrecs? nrecs : 1;
+  for (n=0; n < nrecs; n++)
+    {
+      if (es_fread (buf, INDEX_RECLEN, 1, fp) != 1)
+        return gpg_error (GPG_ERR_INV_KEYRING);
+      memcpy (r->recs[n].key, buf, 8);
+      r->recs[n].off = get64 (buf + 8);
+    }
+  r->nrecs = nrecs;
+  return 0;
+}
+
+
+/* Build a new index for the keyring FNAME by scanning the whole
+ * file.  The index file is created first so that an unwritable
+ * directory does not cost a scan.  */
+static gpg_error_t
+rebuild_index (const char *fname)
+{
+  gpg_error_t err;
+  struct keyring_stamp_s stamp, stamp2;
+  struct index_recs_s r;
+  struct parse_packet_ctx_s parsectx;
+  PACKET pkt;
+  estream_t fp;
+  char *tmpfname;
+  iobuf_t a;
+  off_t offset, main_offset;
+  int save_mode, initial_skip;
+
+  memset (&r, 0, sizeof r);
+  err = keyring_index_stamp (fname, &stamp);
+  if (err)
+    return err;
+  err = create_index_file (fname, &fp, &tmpfname);
+  if (err)
+    return err;
+
+  a = iobuf_open (fname);
+  if (!a)
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+      xfree (tmpfname);
+      return err;
+    }
+
+  init_packet (&pkt);
+  init_parse_packet (&parsectx, a);
+  save_mode = set_packet_list_mode (0);
+  main_offset = 0;
+  initial_skip = 1;
+  while (!(err = search_packet (&parsectx, &pkt, &offset, 1)))
+    {
+      if (pkt.pkttype == PKT_PUBLIC_KEY || pkt.pkttype == PKT_SECRET_KEY)
+        {
+          main_offset = offset;
+          initial_skip = 0;
+        }
+      if (!initial_skip)
+        err = add_packet_recs (&r, &pkt, main_offset);
+      free_packet (&pkt, &parsectx);
+      if (err)
+        break;
+    }
+  free_packet (&pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  set_packet_list_mode (save_mode);
+  iobuf_close (a);
+  /* Don't let the next open of FNAME use the cached file descriptor.  */
+  iobuf_ioctl (NULL, IOBUF_IOCTL_INVALIDATE_CACHE, 0, (char*)fname);
+  if (err == -1)
+    err = 0;
+
+  /* Do not write an index if the file was changed meanwhile.  */
+  if (!err)
+    {
+      err = keyring_index_stamp (fname, &stamp2);
+      if (!err && !stamp_equal (&stamp, &stamp2))
+        err = gpg_error (GPG_ERR_EAGAIN);
+    }
+  if (!err)
+    err = finish_index_file (fname, fp, tmpfname, &r, &stamp);
+  else
+    {
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+      xfree (tmpfname);
+    }
+
+  xfree (r.recs);
+  return err;
+}
+
+
+/* Return true if the index can be used to search for DESC.  */
+int
+keyring_index_usable (KEYDB_SEARCH_DESC *desc)
+{
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_FPR:
+      return desc->fprlen == 20 || desc->fprlen == 32;
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      return 1;
+    case KEYDB_SEARCH_MODE_MAIL:
+      /* The name is given as "<addr-spec>".  */
+      return desc->u.name && strlen (desc->u.name) >= 2;
+    default:
+      return 0;
+    }
+}
+
+
+/* Return the offsets of the keyblocks which may match DESC from the
+ * index of the keyring FNAME.  If the index is missing or stale it is
+ * rebuilt.  On success a sorted array with the offsets is stored at
+ * R_OFFSETS and its length at R_COUNT; the caller must still check
+ * each candidate.  GPG_ERR_NOT_SUPPORTED is returned if the index
+ * can't be used and the caller needs to do a full scan.  An error
+ * other than GPG_ERR_NOT_SUPPORTED is returned if the index can't be
+ * built for this keyring.  */
+gpg_error_t
+keyring_index_lookup (const char *fname, KEYDB_SEARCH_DESC *desc,
+                      off_t **r_offsets, size_t *r_count)
+{
+  gpg_error_t err;
+  unsigned char key[8], buf[INDEX_RECLEN];
+  unsigned char kidbuf[8];
+  struct keyring_stamp_s stamp;
+  estream_t fp = NULL;
+  size_t nrecs, lo, hi, mid, n, count;
+  off_t *offsets = NULL;
+  int tries;
+
+  *r_offsets = NULL;
+  *r_count = 0;
+
+  if (!keyring_index_usable (desc))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_FPR:
+      err = make_key (key, INDEX_TYPE_FPR, desc->u.fpr, desc->fprlen, 0);
+      break;
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      put32 (kidbuf, desc->u.kid[0]);
+      put32 (kidbuf + 4, desc->u.kid[1]);
+      err = make_key (key, INDEX_TYPE_KID, kidbuf, 8, 0);
+      break;
+    default: /* KEYDB_SEARCH_MODE_MAIL */
+      err = make_key (key, INDEX_TYPE_MAIL, desc->u.name + 1,
+                      strlen (desc->u.name) - 2, 1);
+      break;
+    }
+  if (err)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  for (tries=0; ; tries++)
+    {
+      err = keyring_index_stamp (fname, &stamp);
+      if (err)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      err = open_index (fname, &stamp, &fp, &nrecs);
+      if (!err)
+        break;
+      if (gpg_err_code (err) != GPG_ERR_NOT_FOUND || tries)
+        return err;
+      err = rebuild_index (fname);
+      if (err)
+        {
+          if (gpg_err_code (err) == GPG_ERR_EAGAIN)
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          if (opt.verbose || DBG_KEYDB)
+            log_info ("%s: can't build index: %s\n", fname,
+                      gpg_strerror (err));
+          return err;
+        }
+    }
+
+  /* Binary search for the first record with KEY.  */
+  lo = 0;
+  hi = nrecs;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (es_fseeko (fp, INDEX_HDRLEN + (off_t)mid * INDEX_RECLEN, SEEK_SET)
+          || es_fread (buf, INDEX_RECLEN, 1, fp) != 1)
+        {
+          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+          goto leave;
+        }
+      if (memcmp (buf, key, 8) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  /* Collect the offsets.  A keyblock may have the same key several
+   * times; e.g. for two user ids with the same mail address.  */
+  if (es_fseeko (fp, INDEX_HDRLEN + (off_t)lo * INDEX_RECLEN, SEEK_SET))
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+  count = 0;
+  for (n = lo; n < nrecs; n++)
+    {
+      if (es_fread (buf, INDEX_RECLEN, 1, fp) != 1)
+        {
+          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+          goto leave;
+        }
+      if (memcmp (buf, key, 8))
+        break;
+      if (count && offsets[count-1] == (off_t)get64 (buf + 8))
+        continue;
+      if (!(count % 16))
+        {
+          off_t *tmp = xtryrealloc (offsets, (count + 16) * sizeof *offsets);
+          if (!tmp)
+            {
+              err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+              goto leave;
+            }
+          offsets = tmp;
+        }
+      offsets[count++] = get64 (buf + 8);
+    }
+
+  *r_offsets = offsets;
+  *r_count = count;
+  offsets = NULL;
+  err = 0;
+
+ leave:
+  es_fclose (fp);
+  xfree (offsets);
+  return err;
+}
+
+
+/* Update the index of the keyring FNAME after a change.  OLDSTAMP is
+ * the state of the keyring before the change.  The keyblock of
+ * OLDLEN bytes at offset OFF has been replaced by KEYBLOCK of NEWLEN
+ * bytes; OLDLEN is 0 for an insert and KEYBLOCK is NULL for a
+ * delete.  If the size of the keyring does not match these values,
+ * for example because garbage has been removed while copying, the
+ * index is removed.  If the index was not up to date with OLDSTAMP
+ * it is left alone because it will be rebuilt on the next lookup.
+ * Errors are not returned because the index is only a cache.  */
+void
+keyring_index_update (const char *fname,
+                      const struct keyring_stamp_s *oldstamp,
+                      off_t off, off_t oldlen, off_t newlen,
+                      kbnode_t keyblock)
+{
+  gpg_error_t err;
+  struct keyring_stamp_s stamp;
+  struct index_recs_s r;
+  estream_t fp;
+  char *tmpfname;
+  size_t nrecs, n, m;
+  int64_t delta;
+  kbnode_t node;
+
+  memset (&r, 0, sizeof r);
+  err = open_index (fname, oldstamp, &fp, &nrecs);
+  if (err)
+    return;
+  err = read_all_recs (fp, nrecs, &r);
+  es_fclose (fp);
+  if (err)
+    goto leave;
+
+  err = keyring_index_stamp (fname, &stamp);
+  if (err)
+    goto leave;
+  delta = (int64_t)newlen - (int64_t)oldlen;
+  if (oldlen < 0 || newlen < 0
+      || (int64_t)stamp.size != (int64_t)oldstamp->size + delta)
+    {
+      err = gpg_error (GPG_ERR_INV_KEYRING);
+      goto leave;
+    }
+
+  for (n = m = 0; n < r.nrecs; n++)
+    {
+      if (oldlen && r.recs[n].off == (uint64_t)off)
+        continue;
+      if (r.recs[n].off > (uint64_t)off)
+        r.recs[n].off += delta;
+      r.recs[m++] = r.recs[n];
+    }
+  r.nrecs = m;
+  for (node = keyblock; node && !err; node = node->next)
+    err = add_packet_recs (&r, node->pkt, off);
+  if (err)
+    goto leave;
+
+  err = create_index_file (fname, &fp, &tmpfname);
+  if (!err)
+    err = finish_index_file (fname, fp, tmpfname, &r, &stamp);
+
+ leave:
+  if (err)
+    keyring_index_remove (fname);
+  xfree (r.recs);
+}
+
+
+/* Remove the index of the keyring FNAME.  */
+void
+keyring_index_remove (const char *fname)
+{
+  char *idxfname;
+
+  idxfname = index_fname (fname);
+  if (idxfname)
+    gnupg_remove (idxfname);
+  xfree (idxfname);
+}
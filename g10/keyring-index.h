@@ -0,0 +1,46 @@
+/* keyring-index.h - Sidecar index for keyring files
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_G10_KEYRING_INDEX_H
+#define GNUPG_G10_KEYRING_INDEX_H
+
+/* The state of a keyring file as used to check whether its index is
+ * up to date.  */
+struct keyring_stamp_s
+{
+  uint64_t size;
+  uint64_t mtime;
+  uint64_t ino;
+};
+
+gpg_error_t keyring_index_stamp (const char *fname,
+                                 struct keyring_stamp_s *stamp);
+int keyring_mail_span (const char *uid, size_t uidlen,
+                       const char **r_s, size_t *r_len);
+int keyring_index_usable (KEYDB_SEARCH_DESC *desc);
+gpg_error_t keyring_index_lookup (const char *fname, KEYDB_SEARCH_DESC *desc,
+                                  off_t **r_offsets, size_t *r_count);
+void keyring_index_update (const char *fname,
+                           const struct keyring_stamp_s *oldstamp,
+                           off_t off, off_t oldlen, off_t newlen,
+                           kbnode_t keyblock);
+void keyring_index_remove (const char *fname);
+
+#endif /*GNUPG_G10_KEYRING_INDEX_H*/
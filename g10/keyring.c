@@ -36,6 +36,7 @@
 #include "main.h" /*for check_key_signature()*/
 #include "../common/i18n.h"
 #include "../kbx/keybox.h"
+#include "keyring-index.h"
 
 
 typedef struct keyring_resource *KR_RESOURCE;
@@ -46,6 +47,7 @@ struct keyring_resource
   dotlock_t lockhd;
   int is_locked;
   int did_full_scan;
+  int index_failed;  /* The index can't be used for this resource.  */
   char fname[1];
 };
 typedef struct keyring_resource const * CONST_KR_RESOURCE;
@@ -79,6 +81,7 @@ static int active_handles;
 
 static int do_copy (int mode, const char *fname, KBNODE root,
                     off_t start_offset, unsigned int n_packets );
+static int write_keyblock (IOBUF fp, KBNODE keyblock);
 
 
 
@@ -210,6 +213,7 @@ keyring_register_filename (const char *fname, int read_only, void **ptr)
     kr->lockhd = NULL;
     kr->is_locked = 0;
     kr->did_full_scan = 0;
+    kr->index_failed = 0;
     /* keep a list of all issued pointers */
     kr->next = kr_resources;
     kr_resources = kr;
@@ -406,7 +410,13 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
 	return GPG_ERR_KEYRING_OPEN;
     }
 
-    pkt = xmalloc (sizeof *pkt);
+    pkt = alloc_packet_object ();
+    if (!pkt)
+      {
+        rc = gpg_error_from_syserror ();
+        iobuf_close (a);
+        return rc;
+      }
     init_packet (pkt);
     init_parse_packet (&parsectx, a);
     hd->found.n_packets = 0;
@@ -500,7 +510,12 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
             break;
           }
 
-        pkt = xmalloc (sizeof *pkt);
+        pkt = alloc_packet_object ();
+        if (!pkt)
+          {
+            rc = gpg_error_from_syserror ();
+            break;
+          }
         init_packet(pkt);
     }
     set_packet_list_mode(save_mode);
@@ -515,7 +530,7 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
     }
     free_packet (pkt, &parsectx);
     deinit_parse_packet (&parsectx);
-    xfree (pkt);
+    release_packet_object (pkt);
     iobuf_close(a);
 
     /* Make sure that future search operations fail immediately when
@@ -754,6 +769,39 @@ prepare_search (KEYRING_HANDLE hd)
     return 0;
 }
 
+
+/* Disable the use of the index for the keyring RESOURCE.  */
+static void
+mark_index_failed (CONST_KR_RESOURCE resource)
+{
+  KR_RESOURCE kr;
+
+  for (kr=kr_resources; kr; kr = kr->next)
+    if (kr == resource)
+      {
+        kr->index_failed = 1;
+        break;
+      }
+}
+
+
+/* Continue the search of HD at the file offset OFFSET.  PARSECTX is
+ * re-initialized for the new position.  */
+static int
+seek_keyring (KEYRING_HANDLE hd, struct parse_packet_ctx_s *parsectx,
+              off_t offset)
+{
+  deinit_parse_packet (parsectx);
+  if (iobuf_seek (hd->current.iobuf, offset))
+    {
+      log_error ("can't seek '%s'\n", hd->current.kr->fname);
+      init_parse_packet (parsectx, hd->current.iobuf);
+      return gpg_error (GPG_ERR_KEYRING_OPEN);
+    }
+  init_parse_packet (parsectx, hd->current.iobuf);
+  return 0;
+}
+
 
 /* A map of the all characters valid used for word_match()
  * Valid characters are in this table converted to uppercase.
@@ -891,7 +939,7 @@ static int
 compare_name (int mode, const char *name, const char *uid, size_t uidlen)
 {
     int i;
-    const char *s, *se;
+    const char *s;
 
     if (mode == KEYDB_SEARCH_MODE_EXACT) {
 	for (i=0; name[i] && uidlen; i++, uidlen--)
@@ -907,41 +955,20 @@ compare_name (int mode, const char *name, const char *uid, size_t uidlen)
     else if (   mode == KEYDB_SEARCH_MODE_MAIL
              || mode == KEYDB_SEARCH_MODE_MAILSUB
              || mode == KEYDB_SEARCH_MODE_MAILEND) {
-        int have_angles = 1;
-	for (i=0, s= uid; i < uidlen && *s != '<'; s++, i++)
-	    ;
-	if (i == uidlen)
-	  {
-	    /* The UID is a plain addr-spec (cf. RFC2822 section 4.3).  */
-	    have_angles = 0;
-	    s = uid;
-	    i = 0;
-	  }
-	if (i < uidlen)  {
-	    if (have_angles)
-	      {
-		/* skip opening delim and one char and look for the closing one*/
-		s++; i++;
-		for (se=s+1, i++; i < uidlen && *se != '>'; se++, i++)
-		  ;
-	      }
-	    else
-	      se = s + uidlen;
-
-	    if (i < uidlen) {
-		i = se - s;
-		if (mode == KEYDB_SEARCH_MODE_MAIL) {
-		    if( strlen(name)-2 == i
-                        && !ascii_memcasecmp( s, name+1, i) )
-			return 0;
-		}
-		else if (mode == KEYDB_SEARCH_MODE_MAILSUB) {
-		    if( ascii_memistr( s, i, name ) )
-			return 0;
-		}
-		else { /* email from end */
-		    /* nyi */
-		}
+        size_t n;
+
+	if (keyring_mail_span (uid, uidlen, &s, &n)) {
+	    if (mode == KEYDB_SEARCH_MODE_MAIL) {
+		if( strlen(name)-2 == n
+		    && !ascii_memcasecmp( s, name+1, n) )
+		    return 0;
+	    }
+	    else if (mode == KEYDB_SEARCH_MODE_MAILSUB) {
+		if( ascii_memistr( s, n, name ) )
+		    return 0;
+	    }
+	    else { /* email from end */
+		/* nyi */
 	    }
 	}
     }
@@ -973,6 +1000,10 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   int initial_skip;
   int scanned_from_start;
   int use_key_present_hash;
+  int use_index, index_seeked;
+  off_t *candidates = NULL;
+  size_t ncandidates = 0, candidx = 0;
+  off_t start_offset;
   PKT_user_id *uid = NULL;
   PKT_public_key *pk = NULL;
   u32 aki[2];
@@ -1091,6 +1122,30 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       /*  name = hd->word_match.pattern; */
     }
 
+  /* For a lookup by fingerprint, keyid or mail address ask the index
+   * for the keyblocks which may match and look only at them.  */
+  start_offset = iobuf_tell (hd->current.iobuf);
+  use_index = 0;
+  if (ndesc == 1 && keyring_index_usable (desc)
+      && !hd->current.kr->index_failed)
+    {
+      gpg_error_t err;
+
+      err = keyring_index_lookup (hd->current.kr->fname, desc,
+                                  &candidates, &ncandidates);
+      if (!err)
+        {
+          use_index = 1;
+          while (candidx < ncandidates && candidates[candidx] < start_offset)
+            candidx++;
+          if (DBG_KEYDB)
+            log_debug ("%s: index has %zu candidates\n",
+                       __func__, ncandidates - candidx);
+        }
+      else if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+        mark_index_failed (hd->resource);
+    }
+
   init_packet(&pkt);
   save_mode = set_packet_list_mode(0);
 
@@ -1098,11 +1153,24 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   main_offset = 0;
   pk_no = uid_no = 0;
   initial_skip = 1; /* skip until we see the start of a keyblock */
-  scanned_from_start = iobuf_tell (hd->current.iobuf) == 0;
+  scanned_from_start = !use_index && start_offset == 0;
   if (DBG_KEYDB)
     log_debug ("%s: %ssearching from start of resource.\n",
                __func__, scanned_from_start ? "" : "not ");
   init_parse_packet (&parsectx, hd->current.iobuf);
+  index_seeked = 0;
+  if (use_index)
+    {
+      if (candidx == ncandidates)
+        {
+          rc = -1;
+          goto real_found;
+        }
+      rc = seek_keyring (hd, &parsectx, candidates[candidx]);
+      if (rc)
+        goto real_found;
+      index_seeked = 1;
+    }
   while (1)
     {
       byte afp[MAX_FINGERPRINT_LEN];
@@ -1117,6 +1185,49 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       if (rc)
         break;
 
+      if (use_index && index_seeked)
+        {
+          index_seeked = 0;
+          if ((pkt.pkttype != PKT_PUBLIC_KEY && pkt.pkttype != PKT_SECRET_KEY)
+              || offset != candidates[candidx])
+            {
+              /* The index does not match the keyring; fall back to a
+               * regular scan.  */
+              log_info ("%s: index does not match keyring - ignored\n",
+                        hd->current.kr->fname);
+              free_packet (&pkt, &parsectx);
+              keyring_index_remove (hd->current.kr->fname);
+              mark_index_failed (hd->resource);
+              use_index = 0;
+              rc = seek_keyring (hd, &parsectx, start_offset);
+              if (rc)
+                break;
+              continue;
+            }
+          candidx++;
+        }
+      else if (use_index
+               && (pkt.pkttype == PKT_PUBLIC_KEY
+                   || pkt.pkttype == PKT_SECRET_KEY))
+        {
+          if (candidx < ncandidates && offset == candidates[candidx])
+            candidx++;  /* The next candidate follows directly.  */
+          else
+            {
+              free_packet (&pkt, &parsectx);
+              if (candidx == ncandidates)
+                {
+                  rc = -1;
+                  break;
+                }
+              rc = seek_keyring (hd, &parsectx, candidates[candidx]);
+              if (rc)
+                break;
+              index_seeked = 1;
+              continue;
+            }
+        }
+
       if (pkt.pkttype == PKT_PUBLIC_KEY  || pkt.pkttype == PKT_SECRET_KEY)
         {
           main_offset = offset;
@@ -1242,6 +1353,7 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       free_packet (&pkt, &parsectx);
     }
  real_found:
+  xfree (candidates);
   if (!rc)
     {
       if (DBG_KEYDB)
@@ -1413,6 +1525,22 @@ write_keyblock (IOBUF fp, KBNODE keyblock)
   return 0;
 }
 
+
+/* Return the number of bytes write_keyblock emits for KEYBLOCK or -1
+ * on error.  */
+static off_t
+keyblock_length (KBNODE keyblock)
+{
+  iobuf_t a;
+  off_t len = -1;
+
+  a = iobuf_temp ();
+  if (!write_keyblock (a, keyblock))
+    len = iobuf_get_temp_length (a);
+  iobuf_close (a);
+  return len;
+}
+
 /*
  * Walk over all public keyrings, check the signatures and replace the
  * keyring with a new one where the signature cache is then updated.
@@ -1616,12 +1744,19 @@ do_copy (int mode, const char *fname, KBNODE root,
     int rc=0;
     char *bakfname = NULL;
     char *tmpfname = NULL;
+    struct keyring_stamp_s oldstamp;
+    int have_stamp;
+    off_t oldlen = 0, newlen = 0;
 
     /* Open the source file. Because we do a rename, we have to check the
        permissions of the file */
     if ((ec = gnupg_access (fname, W_OK)))
       return gpg_error (ec);
 
+    /* Remember the state of the file so that the index can be
+     * updated instead of being rebuilt on the next search.  */
+    have_stamp = !keyring_index_stamp (fname, &oldstamp);
+
     fp = iobuf_open (fname);
     if (mode == 1 && !fp && errno == ENOENT) {
 	/* insert mode but file does not exist: create a new file */
@@ -1708,9 +1843,12 @@ do_copy (int mode, const char *fname, KBNODE root,
 	    iobuf_cancel(newfp);
 	    goto leave;
 	}
+        oldlen = iobuf_tell (fp) - start_offset;
     }
 
     if( mode == 1 || mode == 3 ) { /* insert or update */
+        if (have_stamp)
+          newlen = keyblock_length (root);
         rc = write_keyblock (newfp, root);
         if (rc) {
           iobuf_close(fp);
@@ -1744,6 +1882,10 @@ do_copy (int mode, const char *fname, KBNODE root,
     }
 
     rc = rename_tmp_file (bakfname, tmpfname, fname);
+    if (!rc && have_stamp)
+      keyring_index_update (fname, &oldstamp,
+                            mode == 1? (off_t)oldstamp.size : start_offset,
+                            oldlen, newlen, mode == 2? NULL : root);
 
   leave:
     xfree(bakfname);
@@ -53,6 +53,11 @@ int keyserver_import_cert (ctrl_t ctrl, const char *name, int dane_mode,
 gpg_error_t keyserver_import_wkd (ctrl_t ctrl, const char *name,
                                   unsigned int flags,
                                   unsigned char **fpr, size_t *fpr_len);
+gpg_error_t keyserver_import_concurrent (ctrl_t ctrl, const char *name,
+                                         const char *mechanisms,
+                                         char **r_mechanism,
+                                         unsigned char **fpr,
+                                         size_t *fpr_len);
 int keyserver_import_ntds (ctrl_t ctrl, const char *name,
                            unsigned char **fpr,size_t *fpr_len);
 gpg_error_t keyserver_import_mbox (ctrl_t ctrl, const char *mbox,
@@ -644,10 +644,13 @@ search_line_handler (void *opaque, int special, char *line)
       line = NULL;
     }
 
-  /* Print the received line.  */
+  /* Print the received line.  The results arrive while dirmngr is
+     still reading from the keyserver; flush so that a consumer sees
+     them right away.  */
   if (opt.with_colons && line)
     {
       es_printf ("%s\n", line);
+      es_fflush (es_stdout);
     }
 
   /* Look for an info: line.  The only current info: values defined
@@ -737,9 +740,11 @@ search_line_handler (void *opaque, int special, char *line)
         }
       else if (parm->nkeys == parm->count)
         {
-          /* Keyserver sent more keys than claimed in the info: line. */
+          /* Keyserver sent more keys than claimed in the info: line.
+             Grow geometrically so that a long result does not require
+             a realloc every few keys.  */
           KEYDB_SEARCH_DESC *tmp;
-          int newcount = parm->count + 10;
+          int newcount = parm->count < 10? 10 : parm->count * 2;
 
           tmp = xtryrealloc (parm->desc, newcount * sizeof *parm->desc);
           if (!tmp)
@@ -770,6 +775,7 @@ search_line_handler (void *opaque, int special, char *line)
             }
 
           print_keyrec (parm->ctrl, parm->nkeys+1, keyrec);
+          es_fflush (es_stdout);
         }
 
       parm->numlines += keyrec->lines;
@@ -794,7 +800,7 @@ int
 keyserver_export (ctrl_t ctrl, strlist_t users)
 {
   gpg_error_t err;
-  strlist_t sl=NULL;
+  strlist_t sl=NULL, last=NULL;
   KEYDB_SEARCH_DESC desc;
   int rc=0;
 
@@ -810,7 +816,7 @@ keyserver_export (ctrl_t ctrl, strlist_t users)
 	  continue;
 	}
       else
-	append_to_strlist(&sl,users->d);
+	last = append_to_strlist (last? &last : &sl, users->d);
     }
 
   if(sl)
@@ -1047,6 +1053,9 @@ keyidlist (ctrl_t ctrl, strlist_t users, KEYDB_SEARCH_DESC **klist,
       goto leave;
     }
   keydb_disable_caching (kdbhd);  /* We are looping the search.  */
+  /* We need only the primary key and its user ids.  */
+  keydb_set_skip_pkttypes (kdbhd, (PKTTYPE_BIT (PKT_ATTRIBUTE)
+                                   | PKTTYPE_BIT (PKT_PUBLIC_SUBKEY)));
 
   if(!users)
     {
@@ -1705,6 +1714,40 @@ keyserver_fetch (ctrl_t ctrl, strlist_t urilist, int origin)
 
 /* Import key in a CERT or pointed to by a CERT.  In DANE_MODE fetch
    the certificate using the DANE method.  */
+/* Import the DANE key from the stream KEY.  Only user ids with the
+ * mailbox NAME are kept.  */
+static gpg_error_t
+import_dane_key (ctrl_t ctrl, const char *name, estream_t key,
+                 unsigned char **fpr, size_t *fpr_len)
+{
+  gpg_error_t err;
+  int armor_status = opt.no_armor;
+  import_filter_t save_filt;
+
+  /* DANE records are always in binary format.  */
+  opt.no_armor = 1;
+  save_filt = save_and_clear_import_filter ();
+  if (!save_filt)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      char *filtstr = es_bsprintf ("keep-uid=mbox = %s", name);
+      err = filtstr? 0 : gpg_error_from_syserror ();
+      if (!err)
+        err = parse_and_set_import_filter (filtstr);
+      xfree (filtstr);
+      if (!err)
+        err = import_keys_es_stream (ctrl, key, NULL, fpr, fpr_len,
+                                     IMPORT_ONLY_PUBKEYS,
+                                     NULL, NULL, KEYORG_DANE, NULL);
+      restore_import_filter (save_filt);
+    }
+  opt.no_armor = armor_status;
+
+  return err;
+}
+
+
 int
 keyserver_import_cert (ctrl_t ctrl, const char *name, int dane_mode,
                        unsigned char **fpr,size_t *fpr_len)
@@ -1728,40 +1771,21 @@ keyserver_import_cert (ctrl_t ctrl, const char *name, int dane_mode,
     ;
   else if (key)
     {
-      int armor_status=opt.no_armor;
-      import_filter_t save_filt;
-
-      /* CERTs and DANE records are always in binary format */
-      opt.no_armor=1;
       if (dane_mode)
-        {
-          save_filt = save_and_clear_import_filter ();
-          if (!save_filt)
-            err = gpg_error_from_syserror ();
-          else
-            {
-              char *filtstr = es_bsprintf ("keep-uid=mbox = %s", look);
-              err = filtstr? 0 : gpg_error_from_syserror ();
-              if (!err)
-                err = parse_and_set_import_filter (filtstr);
-              xfree (filtstr);
-              if (!err)
-                err = import_keys_es_stream (ctrl, key, NULL, fpr, fpr_len,
-                                             IMPORT_ONLY_PUBKEYS,
-                                             NULL, NULL, KEYORG_DANE, NULL);
-              restore_import_filter (save_filt);
-            }
-        }
+        err = import_dane_key (ctrl, look, key, fpr, fpr_len);
       else
         {
+          int armor_status=opt.no_armor;
+
+          /* CERTs are always in binary format */
+          opt.no_armor=1;
           err = import_keys_es_stream (ctrl, key, NULL, fpr, fpr_len,
                                        (opt.keyserver_options.import_options
                                         | IMPORT_ONLY_PUBKEYS),
                                        NULL, NULL, 0, NULL);
+          opt.no_armor=armor_status;
         }
 
-      opt.no_armor=armor_status;
-
       es_fclose (key);
       key = NULL;
     }
@@ -1805,6 +1829,43 @@ keyserver_import_cert (ctrl_t ctrl, const char *name, int dane_mode,
 
 
 /* Import a key using the Web Key Directory protocol.  */
+/* Import the WKD key from the stream KEY which was retrieved from
+ * URL.  Only user ids with the mailbox MBOX are kept.  */
+static gpg_error_t
+import_wkd_key (ctrl_t ctrl, const char *mbox, estream_t key,
+                const char *url, unsigned char **fpr, size_t *fpr_len)
+{
+  gpg_error_t err;
+  int armor_status = opt.no_armor;
+  import_filter_t save_filt;
+
+  /* Keys returned via WKD are in binary format.  However, we
+   * relax that requirement and allow also for armored data.  */
+  opt.no_armor = 0;
+  save_filt = save_and_clear_import_filter ();
+  if (!save_filt)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      char *filtstr = es_bsprintf ("keep-uid=mbox = %s", mbox);
+      err = filtstr? 0 : gpg_error_from_syserror ();
+      if (!err)
+        err = parse_and_set_import_filter (filtstr);
+      xfree (filtstr);
+      if (!err)
+        err = import_keys_es_stream (ctrl, key, NULL, fpr, fpr_len,
+                                     IMPORT_ONLY_PUBKEYS,
+                                     NULL, NULL, KEYORG_WKD, url);
+
+    }
+
+  restore_import_filter (save_filt);
+  opt.no_armor = armor_status;
+
+  return err;
+}
+
+
 gpg_error_t
 keyserver_import_wkd (ctrl_t ctrl, const char *name, unsigned int flags,
                       unsigned char **fpr, size_t *fpr_len)
@@ -1830,36 +1891,54 @@ keyserver_import_wkd (ctrl_t ctrl, const char *name, unsigned int flags,
     ;
   else if (key)
     {
-      int armor_status = opt.no_armor;
-      import_filter_t save_filt;
-
-      /* Keys returned via WKD are in binary format.  However, we
-       * relax that requirement and allow also for armored data.  */
-      opt.no_armor = 0;
-      save_filt = save_and_clear_import_filter ();
-      if (!save_filt)
-        err = gpg_error_from_syserror ();
-      else
-        {
-          char *filtstr = es_bsprintf ("keep-uid=mbox = %s", mbox);
-          err = filtstr? 0 : gpg_error_from_syserror ();
-          if (!err)
-            err = parse_and_set_import_filter (filtstr);
-          xfree (filtstr);
-          if (!err)
-            err = import_keys_es_stream (ctrl, key, NULL, fpr, fpr_len,
-                                         IMPORT_ONLY_PUBKEYS,
-                                         NULL, NULL, KEYORG_WKD, url);
+      err = import_wkd_key (ctrl, mbox, key, url, fpr, fpr_len);
+      es_fclose (key);
+      key = NULL;
+    }
 
-        }
+  xfree (url);
+  xfree (mbox);
+  return err;
+}
 
-      restore_import_filter (save_filt);
-      opt.no_armor = armor_status;
 
-      es_fclose (key);
-      key = NULL;
+/* Locate the key for NAME by running the comma delimited list of
+ * MECHANISMS ("wkd" and "dane") concurrently in the dirmngr.  The
+ * key of the first mechanism in the list which succeeds is imported.
+ * The name of that mechanism is stored as malloced string at
+ * R_MECHANISM.  Returns GPG_ERR_NO_DATA if all mechanisms failed.  */
+gpg_error_t
+keyserver_import_concurrent (ctrl_t ctrl, const char *name,
+                             const char *mechanisms, char **r_mechanism,
+                             unsigned char **fpr, size_t *fpr_len)
+{
+  gpg_error_t err;
+  char *mbox;
+  estream_t key = NULL;
+  char *url = NULL;
+
+  *r_mechanism = NULL;
+
+  mbox = mailbox_from_userid (name, 0);
+  if (!mbox)
+    {
+      err = gpg_error_from_syserror ();
+      if (gpg_err_code (err) == GPG_ERR_EINVAL)
+        err = gpg_error (GPG_ERR_INV_USER_ID);
+      return err;
     }
 
+  err = gpg_dirmngr_locate (ctrl, mbox, mechanisms, r_mechanism, &key, &url);
+  if (err)
+    ;
+  else if (!strcmp (*r_mechanism, "wkd"))
+    err = import_wkd_key (ctrl, mbox, key, url, fpr, fpr_len);
+  else if (!strcmp (*r_mechanism, "dane"))
+    err = import_dane_key (ctrl, mbox, key, fpr, fpr_len);
+  else
+    err = gpg_error (GPG_ERR_INV_RESPONSE);
+
+  es_fclose (key);
   xfree (url);
   xfree (mbox);
   return err;
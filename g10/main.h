@@ -91,6 +91,7 @@ extern int assert_pubkey_algo_false;
 #else
   void g10_exit(int rc);
 #endif
+void log_startup_phase (const char *phase);
 void print_pubkey_algo_note (pubkey_algo_t algo);
 void print_cipher_algo_note (cipher_algo_t algo);
 void print_digest_algo_note (digest_algo_t algo);
@@ -262,6 +263,8 @@ int write_pubkey_enc (ctrl_t ctrl, PKT_public_key *pk, int throw_keyid,
 /*-- sign.c --*/
 int sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	       int do_encrypt, strlist_t remusr, const char *outfile );
+int sign_fd (ctrl_t ctrl, gnupg_fd_t inp_fd, gnupg_fd_t out_fd, int detached,
+             strlist_t locusr);
 int clearsign_file (ctrl_t ctrl,
                     const char *fname, strlist_t locusr, const char *outfile);
 int sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr);
@@ -289,6 +292,16 @@ int check_key_signature2 (ctrl_t ctrl, kbnode_t root, kbnode_t node,
                           PKT_public_key *check_pk, PKT_public_key *ret_pk,
                           int *is_selfsig, u32 *r_expiredate, int *r_expired);
 
+/* Verify the key signatures of KEYBLOCK in parallel ahead of the
+   calls to check_key_signature.  */
+void check_key_signatures_batch (ctrl_t ctrl, kbnode_t keyblock,
+                                 int selfsigs_only);
+void check_key_signatures_multi (ctrl_t ctrl,
+                                 kbnode_t *keyblocks, int nkeyblocks,
+                                 int selfsigs_only,
+                                 int (*filter) (void *, PKT_signature *),
+                                 void *filter_arg);
+
 /* Returns whether SIGNER generated the signature SIG over the packet
    PACKET, which is a key, subkey or uid, and comes from the key block
    KB.  If SIGNER is NULL, it is looked up based on the information in
@@ -400,6 +413,7 @@ struct impex_filter_parm_s
 };
 
 const char *impex_filter_getval (void *cookie, const char *propname);
+int impex_filter_getnum (void *cookie, const char *propname, long *r_value);
 gpg_error_t transfer_secret_keys (ctrl_t ctrl, struct import_stats_s *stats,
                                   kbnode_t sec_keyblock, int batch, int force,
                                   int only_marked);
@@ -535,6 +549,7 @@ int  card_store_subkey (KBNODE node, int use, strlist_t *processed_keys);
 
 /*-- migrate.c --*/
 void migrate_secring (ctrl_t ctrl);
+gpg_error_t migrate_to_keyboxd (ctrl_t ctrl, const char *fname);
 
 
 #endif /*G10_MAIN_H*/
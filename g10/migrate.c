@@ -27,7 +27,10 @@
 #include "gpg.h"
 #include "options.h"
 #include "keydb.h"
+#include "keyring.h"
+#include "../kbx/keybox.h"
 #include "../common/util.h"
+#include "../common/i18n.h"
 #include "main.h"
 #include "call-agent.h"
 
@@ -116,3 +119,243 @@ migrate_secring (ctrl_t ctrl)
   xfree (flagfile);
   xfree (secring);
 }
+
+
+/* Return true if FNAME is a keybox file.  */
+static int
+is_keybox_file (const char *fname)
+{
+  estream_t fp;
+  unsigned char buf[12];
+  int result = 0;
+
+  fp = es_fopen (fname, "rb");
+  if (fp)
+    {
+      if (es_fread (buf, sizeof buf, 1, fp) == 1
+          && buf[4] == 1 && !memcmp (buf+8, "KBXf", 4))
+        result = 1;
+      es_fclose (fp);
+    }
+  return result;
+}
+
+
+/* Store the keyblock IMAGE of IMAGELEN bytes in the keyboxd and
+ * update the counters.  Returns an error only for fatal errors.  */
+static gpg_error_t
+store_migrated_key (KEYDB_HANDLE hd, const void *image, size_t imagelen,
+                    unsigned long *nstored, unsigned long *nskipped)
+{
+  gpg_error_t err;
+
+  err = keydb_insert_keyblock_image (hd, image, imagelen);
+  if (!err)
+    (*nstored)++;
+  else if (gpg_err_code (err) == GPG_ERR_CONFLICT)
+    {
+      (*nskipped)++;
+      err = 0;
+    }
+  else if (gpg_err_source (err) == GPG_ERR_SOURCE_ASSUAN)
+    log_error ("error storing a key in the keyboxd: %s\n",
+               gpg_strerror (err));
+  else
+    {
+      /* The keyboxd rejected this keyblock.  */
+      log_info ("skipping invalid keyblock: %s\n", gpg_strerror (err));
+      (*nskipped)++;
+      err = 0;
+    }
+  return err;
+}
+
+
+/* Copy all keys from the keybox FNAME to the keyboxd.  */
+static gpg_error_t
+migrate_keybox (KEYDB_HANDLE hd, const char *fname,
+                unsigned long *nstored, unsigned long *nskipped)
+{
+  gpg_error_t err;
+  void *token;
+  KEYBOX_HANDLE kbxhd;
+  KEYDB_SEARCH_DESC desc;
+  size_t dummy;
+  iobuf_t iobuf;
+  int pk_no, uid_no;
+  u32 *sigstatus;
+
+  err = keybox_register_file (fname, 0, &token);
+  if (err)
+    return err;
+  kbxhd = keybox_new_openpgp (token, 0);
+  if (!kbxhd)
+    return gpg_error_from_syserror ();
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  for (;;)
+    {
+      do
+        err = keybox_search (kbxhd, &desc, 1, KEYBOX_BLOBTYPE_PGP,
+                             NULL, &dummy);
+      while (gpg_err_code (err) == GPG_ERR_LEGACY_KEY);
+      if (err)
+        break;
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+
+      err = keybox_get_keyblock (kbxhd, &iobuf, &pk_no, &uid_no, &sigstatus);
+      if (err)
+        {
+          log_info ("skipping unreadable keyblock: %s\n", gpg_strerror (err));
+          (*nskipped)++;
+          continue;
+        }
+      xfree (sigstatus);
+      err = store_migrated_key (hd, iobuf_get_temp_buffer (iobuf),
+                                iobuf_get_temp_length (iobuf),
+                                nstored, nskipped);
+      iobuf_close (iobuf);
+      if (err)
+        break;
+    }
+  if (gpg_err_code (err) == GPG_ERR_EOF)
+    err = 0;
+
+  keybox_release (kbxhd);
+  return err;
+}
+
+
+/* Copy all keys from the keyring FNAME to the keyboxd.  */
+static gpg_error_t
+migrate_keyring (KEYDB_HANDLE hd, const char *fname,
+                 unsigned long *nstored, unsigned long *nskipped)
+{
+  gpg_error_t err;
+  void *token;
+  KEYRING_HANDLE krhd;
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t keyblock;
+  iobuf_t iobuf;
+  int rc;
+
+  keyring_register_filename (fname, 1, &token);
+  krhd = keyring_new (token);
+  if (!krhd)
+    return gpg_error_from_syserror ();
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  for (;;)
+    {
+      rc = keyring_search (krhd, &desc, 1, NULL, 1);
+      if (rc == -1)
+        {
+          err = 0;
+          break;
+        }
+      err = rc;
+      if (err)
+        break;
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+
+      err = keyring_get_keyblock (krhd, &keyblock);
+      if (!err)
+        {
+          err = build_keyblock_image (keyblock, &iobuf);
+          release_kbnode (keyblock);
+        }
+      if (err)
+        {
+          log_info ("skipping unreadable keyblock: %s\n", gpg_strerror (err));
+          (*nskipped)++;
+          continue;
+        }
+      err = store_migrated_key (hd, iobuf_get_temp_buffer (iobuf),
+                                iobuf_get_temp_length (iobuf),
+                                nstored, nskipped);
+      iobuf_close (iobuf);
+      if (err)
+        break;
+    }
+
+  keyring_release (krhd);
+  return err;
+}
+
+
+/* Copy all OpenPGP keys from the keyring or keybox FNAME to the
+ * keyboxd.  If FNAME is NULL the pubring.kbx or the pubring.gpg of
+ * the home directory is used.  The keyblocks are stored as they are;
+ * they are neither merged with existing keys nor are their
+ * signatures checked because they come from a local keyring which
+ * has already been populated by gpg.  Keys already in the keyboxd
+ * are not changed.  All keys are stored in one bulk transaction so
+ * that the keyboxd needs to build its search indices only once.  */
+gpg_error_t
+migrate_to_keyboxd (ctrl_t ctrl, const char *fname)
+{
+  gpg_error_t err;
+  char *filename;
+  KEYDB_HANDLE hd;
+  unsigned long nstored = 0;
+  unsigned long nskipped = 0;
+
+  if (!opt.use_keyboxd)
+    {
+      log_error ("%s requires the use of the keyboxd\n",
+                 "--migrate-to-keyboxd");
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  if (fname)
+    filename = make_filename (fname, NULL);
+  else
+    {
+      filename = make_filename (gnupg_homedir (),
+                                "pubring" EXTSEP_S "kbx", NULL);
+      if (gnupg_access (filename, F_OK))
+        {
+          xfree (filename);
+          filename = make_filename (gnupg_homedir (),
+                                    "pubring" EXTSEP_S "gpg", NULL);
+        }
+    }
+  if (gnupg_access (filename, R_OK))
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("can't access '%s': %s\n"), filename, gpg_strerror (err));
+      xfree (filename);
+      return err;
+    }
+
+  /* Make sure that the handle starts a bulk transaction.  It is
+   * committed when the session data is released.  */
+  opt.import_options |= IMPORT_BULK;
+  hd = keydb_new (ctrl);
+  if (!hd)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (filename);
+      return err;
+    }
+
+  if (!opt.quiet)
+    log_info ("migrating keys from '%s' to the keyboxd\n", filename);
+
+  if (is_keybox_file (filename))
+    err = migrate_keybox (hd, filename, &nstored, &nskipped);
+  else
+    err = migrate_keyring (hd, filename, &nstored, &nskipped);
+  if (err)
+    log_error ("migration from '%s' failed: %s\n",
+               filename, gpg_strerror (err));
+
+  if (!opt.quiet)
+    log_info ("%lu keys migrated, %lu keys skipped\n", nstored, nskipped);
+
+  keydb_release (hd);
+  xfree (filename);
+  return err;
+}
@@ -82,6 +82,22 @@ struct
   /* The AEAD chunk size expressed as a power of 2.  */
   int chunk_size;
 
+  /* Number of worker threads used for AEAD en- and decryption; 0 or
+   * 1 for the standard single threaded mode.  */
+  int aead_threads;
+
+  /* Number of threads used to verify the key signatures of a
+   * keyblock; 0 or 1 to verify them one after the other.  */
+  int sig_check_threads;
+
+  /* Number of threads used to encrypt the session key to the
+   * recipients; 0 or 1 to encrypt for one after the other.  */
+  int pubkey_enc_threads;
+
+  /* Lifetime in seconds of the entries of the recipient cache; 0 to
+   * disable the cache.  */
+  unsigned int recipient_cache_ttl;
+
   int dry_run;
   int autostart;
   int list_only;
@@ -122,6 +138,8 @@ struct
   int explicit_compress_option; /* A compress option was explicitly given. */
   int compress_level;
   int bz2_compress_level;
+  int compress_threads;  /* Run zlib in a separate thread if > 0.  */
+  int parallel_compress; /* Use several threads for deflate.  */
   int bz2_decompress_lowmem;
   strlist_t def_secret_key;
   char *def_recipient;
@@ -242,6 +260,7 @@ struct
   int no_expensive_trust_checks;
   int no_sig_cache;
   int no_auto_check_trustdb;
+  int trustdb_fidx;   /* Use trustdb version 4.  */
   int preserve_permissions;
   int no_homedir_creation;
   struct groupitem *grouplist;
@@ -285,6 +304,8 @@ struct
     unsigned int disable_signer_uid:1;
     unsigned int include_key_block:1;
     unsigned int auto_key_import:1;
+    /* Run the network auto-key-locate mechanisms concurrently.  */
+    unsigned int akl_concurrent:1;
     /* Flag to enable experimental features from RFC4880bis.  */
     unsigned int rfc4880bis:1;
     /* Hack: --output is not given but OUTFILE was temporary set to "-".  */
@@ -369,6 +390,7 @@ struct {
 #define DBG_LOOKUP_VALUE  8192	/* debug the key lookup */
 #define DBG_EXTPROG_VALUE 16384 /* debug external program calls */
 #define DBG_KEYDB_VALUE   32768 /* debug keydb and keyboxd searches. */
+#define DBG_STARTUP_VALUE 65536 /* time the startup phases.  */
 
 /* Tests for the debugging flags.  */
 #define DBG_PACKET (opt.debug & DBG_PACKET_VALUE)
@@ -383,6 +405,7 @@ struct {
 #define DBG_LOOKUP  (opt.debug & DBG_LOOKUP_VALUE)
 #define DBG_EXTPROG (opt.debug & DBG_EXTPROG_VALUE)
 #define DBG_KEYDB   (opt.debug & DBG_KEYDB_VALUE)
+#define DBG_STARTUP (opt.debug & DBG_STARTUP_VALUE)
 
 /* FIXME: We need to check why we did not put this into opt. */
 #define DBG_MEMORY    memory_debug_mode
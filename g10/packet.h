@@ -188,9 +188,15 @@ typedef struct {
    co-called signature subpackets (RFC 4880, Section 5.2.3).  These
    areas are described by this data structure.  Use enum_sig_subpkt to
    parse this area.  */
+#define SUBPKT_INDEX_TYPES 41  /* Number of types covered by the index.  */
 typedef struct {
     size_t size;  /* allocated */
     size_t len;   /* used (serialized) */
+    /* If INDEXED is set INDEX[T] gives the offset plus one of the
+       first subpacket of type T in DATA or 0 if there is none.  Code
+       modifying DATA needs to clear INDEXED.  */
+    unsigned int indexed:1;
+    unsigned short index[SUBPKT_INDEX_TYPES];
     byte data[1]; /* the serialized subpackes (serialized) */
 } subpktarea_t;
 
@@ -413,6 +419,9 @@ typedef struct
   u32     keyid[2];
   /* Fingerprint of the key.  Only valid if FPRLEN is not 0.  */
   byte    fpr[MAX_FINGERPRINT_LEN];
+  /* The keygrip and for dual algorithms the keygrip of the second
+     key.  Only valid if the respective GRIP_VALID flag is set.  */
+  byte    grip[2][KEYGRIP_LEN];
   prefitem_t *prefs;      /* list of preferences (may be NULL) */
   struct
   {
@@ -432,6 +441,8 @@ typedef struct
     unsigned int backsig:2;       /* 0=none, 1=bad, 2=good.  */
     unsigned int serialno_valid:1;/* SERIALNO below is valid.  */
     unsigned int exact:1;         /* Found via exact (!) search.  */
+    unsigned int grip_valid:1;    /* GRIP[0] is valid.  */
+    unsigned int grip2_valid:1;   /* GRIP[1] is valid.  */
   } flags;
   PKT_user_id *user_id;   /* If != NULL: found by that uid. */
   struct revocation_key *revkey;
@@ -676,9 +687,21 @@ struct parse_packet_ctx_s
   int free_last_pkt; /* Indicates that LAST_PKT must be freed.  */
   int skip_meta;     /* Skip ring trust packets.  */
   int only_fookey_enc;  /* Stop if the packet is not {sym,pub}key_enc. */
+  unsigned int skip_pkttypes; /* Bit mask of packet types to skip.  */
+  int skip_bound_sigs;  /* Internal: skip the signatures of a skipped
+                         * user id or subkey.  */
+  unsigned int n_skipped_uids;  /* User ids skipped due to the mask.  */
+  unsigned int n_skipped_keys;  /* Subkeys skipped due to the mask.  */
+  int skip_nonself_sigs;  /* Skip signatures not issued by SELF_KEYID.  */
+  u32 self_keyid[2];
+  unsigned int n_skipped_sigs;  /* Signatures skipped due to that.  */
   unsigned int n_parsed_packets;	/* Number of parsed packets.  */
   int last_ctb;      /* The last CTB read.  */
 };
+
+/* Return the bit for packet type T as used by SKIP_PKTTYPES.  Only
+ * the types below 32 may be skipped.  */
+#define PKTTYPE_BIT(t)  ((t) < 32? (1u << (t)) : 0)
 typedef struct parse_packet_ctx_s *parse_packet_ctx_t;
 
 #define init_parse_packet(a,i) do { \
@@ -688,6 +711,12 @@ typedef struct parse_packet_ctx_s *parse_packet_ctx_t;
     (a)->free_last_pkt = 0;         \
     (a)->skip_meta = 0;             \
     (a)->only_fookey_enc = 0;       \
+    (a)->skip_pkttypes = 0;         \
+    (a)->skip_bound_sigs = 0;       \
+    (a)->n_skipped_uids = 0;        \
+    (a)->n_skipped_keys = 0;        \
+    (a)->skip_nonself_sigs = 0;     \
+    (a)->n_skipped_sigs = 0;        \
     (a)->n_parsed_packets = 0;      \
     (a)->last_ctb = 1;              \
   } while (0)
@@ -897,6 +926,11 @@ struct notation *search_sig_notations (PKT_signature *sig, const char *name);
 void free_notation (struct notation *notation);
 
 /*-- free-packet.c --*/
+PACKET *alloc_packet_object (void);
+void release_packet_object (PACKET *pkt);
+PKT_signature *alloc_signature_object (void);
+PKT_public_key *alloc_public_key_object (void);
+
 void free_symkey_enc( PKT_symkey_enc *enc );
 
 void release_pubkey_enc_parts (PKT_pubkey_enc *enc);
@@ -944,6 +978,8 @@ gpg_error_t check_signature2 (ctrl_t ctrl,
 
 
 /*-- pubkey-enc.c --*/
+void release_prefetched_session_keys (ctrl_t ctrl);
+void prefetch_session_keys (ctrl_t ctrl, struct pubkey_enc_list *list);
 gpg_error_t get_session_key (ctrl_t ctrl, struct pubkey_enc_list *k, DEK *dek);
 gpg_error_t get_override_session_key (DEK *dek, const char *string);
 
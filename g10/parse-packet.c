@@ -63,6 +63,9 @@ static int parse_symkeyenc (IOBUF inp, int pkttype, unsigned long pktlen,
 			    PACKET * packet);
 static int parse_pubkeyenc (IOBUF inp, int pkttype, unsigned long pktlen,
 			    PACKET * packet);
+static int do_parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
+                               PKT_signature *sig, const u32 *self_keyid,
+                               int *r_skipped);
 static int parse_onepass_sig (IOBUF inp, int pkttype, unsigned long pktlen,
 			      PKT_onepass_sig * ops);
 static int parse_key (IOBUF inp, int pkttype, unsigned long pktlen,
@@ -938,6 +941,43 @@ parse (parse_packet_ctx_t ctx, PACKET *pkt, int onlykeypkts, off_t * retpos,
       goto leave;
     }
 
+  /* Skip the packet types the caller is not interested in.  A
+   * skipped user id, attribute or subkey takes its signatures with
+   * it so that they are not attached to the preceding packet.  */
+  if (ctx->skip_pkttypes && pkttype)
+    {
+      int mask_skip = 0;
+
+      if (ctx->skip_bound_sigs
+          && (pkttype == PKT_SIGNATURE || pkttype == PKT_RING_TRUST))
+        mask_skip = 1;
+      else if ((ctx->skip_pkttypes & PKTTYPE_BIT (pkttype)))
+        {
+          mask_skip = 1;
+          if (pkttype == PKT_USER_ID || pkttype == PKT_ATTRIBUTE)
+            {
+              ctx->n_skipped_uids++;
+              ctx->skip_bound_sigs = 1;
+            }
+          else if (pkttype == PKT_PUBLIC_SUBKEY
+                   || pkttype == PKT_SECRET_SUBKEY)
+            {
+              ctx->n_skipped_keys++;
+              ctx->skip_bound_sigs = 1;
+            }
+        }
+      else
+        ctx->skip_bound_sigs = 0;
+
+      if (mask_skip)
+        {
+          iobuf_skip_rest (inp, pktlen, partial);
+          *skip = 1;
+          rc = 0;
+          goto leave;
+        }
+    }
+
   if (with_uid && pkttype == PKT_USER_ID)
     /* If ONLYKEYPKTS is set to 2, then we never skip user id packets,
        even if DO_SKIP is set.  */
@@ -986,7 +1026,7 @@ parse (parse_packet_ctx_t ctx, PACKET *pkt, int onlykeypkts, off_t * retpos,
     case PKT_PUBLIC_SUBKEY:
     case PKT_SECRET_KEY:
     case PKT_SECRET_SUBKEY:
-      pkt->pkt.public_key = xmalloc_clear (sizeof *pkt->pkt.public_key);
+      pkt->pkt.public_key = alloc_public_key_object ();
       rc = parse_key (inp, pkttype, pktlen, hdr, hdrlen, pkt);
       break;
     case PKT_SYMKEY_ENC:
@@ -996,8 +1036,22 @@ parse (parse_packet_ctx_t ctx, PACKET *pkt, int onlykeypkts, off_t * retpos,
       rc = parse_pubkeyenc (inp, pkttype, pktlen, pkt);
       break;
     case PKT_SIGNATURE:
-      pkt->pkt.signature = xmalloc_clear (sizeof *pkt->pkt.signature);
-      rc = parse_signature (inp, pkttype, pktlen, pkt->pkt.signature);
+      {
+        int skipped = 0;
+
+        pkt->pkt.signature = alloc_signature_object ();
+        rc = do_parse_signature (inp, pkttype, pktlen, pkt->pkt.signature,
+                                 ctx->skip_nonself_sigs? ctx->self_keyid : NULL,
+                                 &skipped);
+        if (!rc && skipped)
+          {
+            free_packet (pkt, NULL);
+            init_packet (pkt);
+            ctx->n_skipped_sigs++;
+            *skip = 1;
+            goto leave;
+          }
+      }
       break;
     case PKT_ONEPASS_SIG:
       pkt->pkt.onepass_sig = xmalloc_clear (sizeof *pkt->pkt.onepass_sig);
@@ -2015,6 +2069,57 @@ can_handle_critical (const byte * buffer, size_t n, int type)
 }
 
 
+/* Build the index of the subpacket area AREA.  The index is only
+ * marked as valid if the entire area is well-formed; in all other
+ * cases enum_sig_subpkt walks the area and prints diagnostics.  */
+static void
+index_sig_subpkts (subpktarea_t *area)
+{
+  const byte *buffer;
+  size_t buflen, n;
+  int type;
+
+  area->indexed = 0;
+  memset (area->index, 0, sizeof area->index);
+  if (area->len >= 65535)
+    return;
+
+  buffer = area->data;
+  buflen = area->len;
+  while (buflen)
+    {
+      const byte *bufstart = buffer;
+
+      n = *buffer++;
+      buflen--;
+      if (n == 255)
+	{
+	  if (buflen < 4)
+	    return;
+	  n = buf32_to_size_t (buffer);
+	  buffer += 4;
+	  buflen -= 4;
+	}
+      else if (n >= 192)
+	{
+	  if (buflen < 2)
+	    return;
+	  n = ((n - 192) << 8) + *buffer + 192;
+	  buffer++;
+	  buflen--;
+	}
+      if (buflen < n || !buflen)
+	return;
+      type = *buffer & 0x7f;
+      if (type < SUBPKT_INDEX_TYPES && !area->index[type])
+        area->index[type] = (bufstart - area->data) + 1;
+      buffer += n;
+      buflen -= n;
+    }
+  area->indexed = 1;
+}
+
+
 const byte *
 enum_sig_subpkt (PKT_signature *sig, int want_hashed, sigsubpkttype_t reqtype,
 		 size_t *ret_n, int *start, int *critical)
@@ -2041,6 +2146,17 @@ enum_sig_subpkt (PKT_signature *sig, int want_hashed, sigsubpkttype_t reqtype,
     }
   buffer = pktbuf->data;
   buflen = pktbuf->len;
+  if (pktbuf->indexed && !start
+      && reqtype >= 0 && reqtype < SUBPKT_INDEX_TYPES)
+    {
+      /* Jump directly to the first subpacket of the requested type.
+       * The subpackets we skip are known to be well-formed.  */
+      offset = pktbuf->index[reqtype];
+      if (!offset)
+        return NULL;
+      buffer += offset - 1;
+      buflen -= offset - 1;
+    }
   while (buflen)
     {
       n = *buffer++;
@@ -2212,9 +2328,13 @@ parse_revkeys (PKT_signature * sig)
 }
 
 
-int
-parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
-		 PKT_signature * sig)
+/* Parse a signature packet into SIG.  If SELF_KEYID is not NULL and
+ * the signature has not been issued by that key, the MPIs are not
+ * parsed and true is stored at R_SKIPPED; the caller shall then
+ * ignore the signature.  */
+static int
+do_parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
+                    PKT_signature *sig, const u32 *self_keyid, int *r_skipped)
 {
   int md5_len = 0;
   unsigned n;
@@ -2294,6 +2414,7 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	  sig->hashed = xmalloc (sizeof (*sig->hashed) + n - 1);
 	  sig->hashed->size = n;
 	  sig->hashed->len = n;
+	  sig->hashed->indexed = 0;
 	  if (iobuf_read (inp, sig->hashed->data, n) != n)
 	    {
 	      log_error ("premature eof while reading "
@@ -2303,6 +2424,7 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	      rc = -1;
 	      goto leave;
 	    }
+	  index_sig_subpkts (sig->hashed);
 	  pktlen -= n;
 	}
       if (pktlen < 2)
@@ -2325,6 +2447,7 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	  sig->unhashed = xmalloc (sizeof (*sig->unhashed) + n - 1);
 	  sig->unhashed->size = n;
 	  sig->unhashed->len = n;
+	  sig->unhashed->indexed = 0;
 	  if (iobuf_read (inp, sig->unhashed->data, n) != n)
 	    {
 	      log_error ("premature eof while reading "
@@ -2334,6 +2457,7 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	      rc = -1;
 	      goto leave;
 	    }
+	  index_sig_subpkts (sig->unhashed);
 	  pktlen -= n;
 	}
     }
@@ -2462,6 +2586,13 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	parse_revkeys (sig);
     }
 
+  if (self_keyid && (sig->keyid[0] != self_keyid[0]
+                     || sig->keyid[1] != self_keyid[1]))
+    {
+      *r_skipped = 1;
+      goto leave;
+    }
+
   if (list_mode)
     {
       es_fprintf (listfp, ":signature packet: algo %d, keyid %08lX%08lX\n"
@@ -2540,6 +2671,14 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 }
 
 
+int
+parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
+		 PKT_signature * sig)
+{
+  return do_parse_signature (inp, pkttype, pktlen, sig, NULL, NULL);
+}
+
+
 static int
 parse_onepass_sig (IOBUF inp, int pkttype, unsigned long pktlen,
 		   PKT_onepass_sig * ops)
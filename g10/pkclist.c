@@ -40,6 +40,7 @@
 #include "../common/i18n.h"
 #include "../common/mbox-util.h"
 #include "tofu.h"
+#include "rcptcache.h"
 
 #define CONTROL_D ('D' - 'A' + 1)
 
@@ -836,6 +837,38 @@ default_recipient (ctrl_t ctrl)
 }
 
 
+/* Helper for build_pk_list to fetch the keys of all recipients in
+ * RCPTS with one request.  This is only an optimization and thus
+ * errors are ignored.  */
+static void
+prefetch_recipients (ctrl_t ctrl, strlist_t rcpts)
+{
+  KEYDB_SEARCH_DESC *desc;
+  strlist_t sl;
+  size_t n, ndesc;
+
+  if (!opt.use_keyboxd)
+    return;
+
+  for (n = 0, sl = rcpts; sl; sl = sl->next)
+    if (!(sl->flags & (PK_LIST_ENCRYPT_TO | PK_LIST_FROM_FILE)))
+      n++;
+  if (n < 2)
+    return;
+
+  desc = xtrycalloc (n, sizeof *desc);
+  if (!desc)
+    return;
+  for (ndesc = 0, sl = rcpts; sl; sl = sl->next)
+    if (!(sl->flags & (PK_LIST_ENCRYPT_TO | PK_LIST_FROM_FILE))
+        && !classify_user_id (sl->d, desc + ndesc, 1))
+      ndesc++;
+
+  keydb_prefetch (ctrl, desc, ndesc);
+  xfree (desc);
+}
+
+
 /* Helper for build_pk_list to find and check one key.  This helper is
  * also used directly in server mode by the RECIPIENTS command.  On
  * success the new key is added to PK_LIST_ADDR.  NAME is the user id
@@ -994,6 +1027,8 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
   strlist_t rov,remusr;
   char *def_rec = NULL;
   char pkstrbuf[PUBKEY_STRING_SIZE];
+  byte cachekey[RCPTCACHE_KEYLEN];
+  int use_cache;
 
   /* Try to expand groups if any have been defined. */
   if (opt.grouplist)
@@ -1001,6 +1036,12 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
   else
     remusr = rcpts;
 
+  /* With --recipient-cache-ttl try to take the entire list from the
+   * cache.  */
+  use_cache = !rcptcache_make_key (remusr, cachekey);
+  if (use_cache && !rcptcache_lookup (ctrl, cachekey, &pk_list))
+    goto fail;
+
   /* XXX: Change this function to use get_pubkeys instead of
      get_pubkey_byname to detect ambiguous key specifications and warn
      about duplicate keyblocks.  For ambiguous key specifications on
@@ -1338,6 +1379,7 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
     {
       /* General case: Check all keys. */
       any_recipients = 0;
+      prefetch_recipients (ctrl, remusr);
       for (; remusr; remusr = remusr->next )
         {
           if ( (remusr->flags & PK_LIST_ENCRYPT_TO) )
@@ -1351,6 +1393,8 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
             goto fail;
           any_recipients = 1;
         }
+      if (use_cache && any_recipients)
+        rcptcache_store (ctrl, cachekey, pk_list);
     }
 
   if ( !rc && !any_recipients )
@@ -1384,6 +1428,7 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
 #endif /*USE_TOFU*/
 
  fail:
+  keydb_prefetch_release (ctrl);
 
   if ( rc )
     release_pk_list( pk_list );
@@ -31,12 +31,30 @@
 #include "pkglue.h"
 #include "main.h"
 #include "options.h"
+#include "packet.h"
 
 
 /* Maximum buffer sizes required for ECC KEM.  */
 #define ECC_POINT_LEN_MAX (1+2*64)
 #define ECC_HASH_LEN_MAX 64
 
+/* The number of public key S-expressions cached by pk_verify.  */
+#define PKEY_SEXP_CACHE_SIZE 8
+
+
+/* Verifying many signatures of the same key is common; e.g. for a
+ * keyring or a package repository.  To avoid converting the public
+ * key parameters to an S-expression for each signature the last used
+ * ones are cached here.  The most recently used entry comes first.  */
+struct pkey_sexp_cache_s
+{
+  pubkey_algo_t algo;
+  int npkey;
+  gcry_mpi_t pkey[PUBKEY_MAX_NPKEY];
+  gcry_sexp_t sexp;
+};
+static struct pkey_sexp_cache_s pkey_sexp_cache[PKEY_SEXP_CACHE_SIZE];
+
 
 /* FIXME: Better change the function name because mpi_ is used by
    gcrypt macros.  */
@@ -206,6 +224,103 @@ get_data_from_sexp (gcry_sexp_t sexp, const char *item, size_t *r_size)
 }
 
 
+/* Return true if the MPIs A and B are equal.  Opaque MPIs are
+ * compared by their content.  */
+static int
+mpi_equal_p (gcry_mpi_t a, gcry_mpi_t b)
+{
+  const void *pa, *pb;
+  unsigned int na, nb;
+
+  if (!a || !b)
+    return a == b;
+  if (gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE)
+      != gcry_mpi_get_flag (b, GCRYMPI_FLAG_OPAQUE))
+    return 0;
+  if (!gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE))
+    return !gcry_mpi_cmp (a, b);
+  pa = gcry_mpi_get_opaque (a, &na);
+  pb = gcry_mpi_get_opaque (b, &nb);
+  return na == nb && (!na || !memcmp (pa, pb, (na+7)/8));
+}
+
+
+/* Return the cached S-expression for the public key PKEY of algorithm
+ * PKALGO or NULL.  The returned object is owned by the cache.  */
+static gcry_sexp_t
+get_cached_pkey_sexp (pubkey_algo_t pkalgo, gcry_mpi_t *pkey)
+{
+  int idx, i;
+
+  for (idx=0; idx < PKEY_SEXP_CACHE_SIZE; idx++)
+    {
+      if (!pkey_sexp_cache[idx].sexp)
+        break;
+      if (pkey_sexp_cache[idx].algo != pkalgo)
+        continue;
+      for (i=0; i < pkey_sexp_cache[idx].npkey; i++)
+        if (!mpi_equal_p (pkey_sexp_cache[idx].pkey[i], pkey[i]))
+          break;
+      if (i < pkey_sexp_cache[idx].npkey)
+        continue;
+
+      if (idx)
+        {
+          /* Move to the front.  */
+          struct pkey_sexp_cache_s tmp = pkey_sexp_cache[idx];
+
+          memmove (pkey_sexp_cache + 1, pkey_sexp_cache,
+                   idx * sizeof *pkey_sexp_cache);
+          pkey_sexp_cache[0] = tmp;
+        }
+      return pkey_sexp_cache[0].sexp;
+    }
+  return NULL;
+}
+
+
+/* Put the S-expression S_PKEY for the public key PKEY of algorithm
+ * PKALGO into the cache.  On success the cache takes ownership of
+ * S_PKEY and true is returned.  */
+static int
+put_cached_pkey_sexp (pubkey_algo_t pkalgo, gcry_mpi_t *pkey,
+                      gcry_sexp_t s_pkey)
+{
+  gcry_mpi_t copies[PUBKEY_MAX_NPKEY];
+  int npkey, i, last;
+
+  npkey = pubkey_get_npkey (pkalgo);
+  if (npkey <= 0 || npkey > PUBKEY_MAX_NPKEY)
+    return 0;
+  for (i=0; i < npkey; i++)
+    {
+      copies[i] = pkey[i]? gcry_mpi_copy (pkey[i]) : NULL;
+      if (pkey[i] && !copies[i])
+        {
+          while (i--)
+            gcry_mpi_release (copies[i]);
+          return 0;
+        }
+    }
+
+  /* Drop the least recently used entry.  */
+  last = PKEY_SEXP_CACHE_SIZE - 1;
+  for (i=0; i < pkey_sexp_cache[last].npkey; i++)
+    gcry_mpi_release (pkey_sexp_cache[last].pkey[i]);
+  gcry_sexp_release (pkey_sexp_cache[last].sexp);
+  memmove (pkey_sexp_cache + 1, pkey_sexp_cache,
+           last * sizeof *pkey_sexp_cache);
+
+  memset (&pkey_sexp_cache[0], 0, sizeof pkey_sexp_cache[0]);
+  pkey_sexp_cache[0].algo = pkalgo;
+  pkey_sexp_cache[0].npkey = npkey;
+  for (i=0; i < npkey; i++)
+    pkey_sexp_cache[0].pkey[i] = copies[i];
+  pkey_sexp_cache[0].sexp = s_pkey;
+  return 1;
+}
+
+
 /****************
  * Emulate our old PK interface here - sometime in the future we might
  * change the internal design to directly fit to libgcrypt.
@@ -215,10 +330,17 @@ pk_verify (pubkey_algo_t pkalgo, gcry_mpi_t hash,
            gcry_mpi_t *data, gcry_mpi_t *pkey)
 {
   gcry_sexp_t s_sig, s_hash, s_pkey;
+  int cached = 0;
   int rc;
 
   /* Make a sexp from pkey.  */
-  if (pkalgo == PUBKEY_ALGO_DSA)
+  s_pkey = get_cached_pkey_sexp (pkalgo, pkey);
+  if (s_pkey)
+    {
+      cached = 1;
+      rc = 0;
+    }
+  else if (pkalgo == PUBKEY_ALGO_DSA)
     {
       rc = gcry_sexp_build (&s_pkey, NULL,
 			    "(public-key(dsa(p%m)(q%m)(g%m)(y%m)))",
@@ -271,6 +393,8 @@ pk_verify (pubkey_algo_t pkalgo, gcry_mpi_t hash,
 
   if (rc)
     BUG ();  /* gcry_sexp_build should never fail.  */
+  if (!cached)
+    cached = put_cached_pkey_sexp (pkalgo, pkey, s_pkey);
 
   /* Put hash into a S-Exp s_hash. */
   if (pkalgo == PUBKEY_ALGO_EDDSA)
@@ -433,7 +557,8 @@ pk_verify (pubkey_algo_t pkalgo, gcry_mpi_t hash,
  leave:
   gcry_sexp_release (s_sig);
   gcry_sexp_release (s_hash);
-  gcry_sexp_release (s_pkey);
+  if (!cached)
+    gcry_sexp_release (s_pkey);
   return rc;
 }
 
@@ -175,6 +175,83 @@ get_output_file (const byte *embedded_name, int embedded_namelen,
   return 0;
 }
 
+/* The largest buffer used to copy the data of a plaintext packet.  */
+#define MAX_COPY_BUFFER_SIZE (1024*1024)
+
+
+/* Return the size of the buffer to copy the data of PT.  iobuf_read
+ * lets the filters fill our buffer directly; thus for large packets
+ * a larger buffer means fewer filter calls and write calls.  */
+static size_t
+copy_buffer_size (PKT_plaintext *pt)
+{
+  size_t size = iobuf_set_buffer_size (0) * 1024;
+
+  if ((pt->is_partial || pt->len > size) && size < MAX_COPY_BUFFER_SIZE)
+    {
+      size = MAX_COPY_BUFFER_SIZE;
+      if (!pt->is_partial && pt->len < size)
+        size = pt->len;
+    }
+  return size;
+}
+
+
+/* Write the LEN bytes of text at BUFFER to FP.  CONVERT is the mode
+ * of the plaintext packet.  On Unix carriage returns are removed by
+ * writing the spans between them.  COUNT is the number of bytes
+ * written so far and is updated to enforce --max-output.  */
+static gpg_error_t
+write_text (estream_t fp, const char *fname, int convert,
+            const byte *buffer, size_t len, off_t *count)
+{
+  const byte *p, *p2, *end;
+  size_t n;
+  gpg_error_t err;
+
+  (void)convert;
+  (void)p2;
+
+  for (p = buffer, end = buffer + len; p < end; p += n)
+    {
+#ifndef HAVE_DOSISH_SYSTEM
+      /* Convert to native line ending. */
+      /* fixme: this hack might be too simple */
+      if (convert != 'm')
+        {
+          if (*p == '\r')
+            {
+              n = 1;
+              continue;
+            }
+          p2 = memchr (p, '\r', end - p);
+          n = (p2? p2 : end) - p;
+        }
+      else
+#endif
+        n = end - p;
+
+      if (opt.max_output && (*count += n) > opt.max_output)
+        {
+          log_error ("error writing to '%s': %s\n",
+                     fname, "exceeded --max-output limit\n");
+          return gpg_error (GPG_ERR_TOO_LARGE);
+        }
+      if (es_fwrite (p, 1, n, fp) != n)
+        {
+          if (es_ferror (fp))
+            err = gpg_error_from_syserror ();
+          else
+            err = gpg_error (GPG_ERR_EOF);
+          log_error ("error writing to '%s': %s\n",
+                     fname, gpg_strerror (err));
+          return err;
+        }
+    }
+  return 0;
+}
+
+
 /* Handle a plaintext packet.  If MFX is not NULL, update the MDs
  * Note: We should have used the filter stuff here, but we have to add
  * some easy mimic to set a read limit, so we calculate only the bytes
@@ -243,48 +320,46 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 
       if (convert) /* Text mode.  */
 	{
-	  for (; pt->len; pt->len--)
+	  size_t temp_size = copy_buffer_size (pt);
+	  byte *buffer;
+
+	  buffer = xtrymalloc (temp_size);
+          if (!buffer)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+
+	  while (pt->len)
 	    {
-	      if ((c = iobuf_get (pt->buf)) == -1)
+	      int len = pt->len > temp_size ? temp_size : pt->len;
+	      len = iobuf_read (pt->buf, buffer, len);
+	      if (len == -1)
 		{
 		  err = gpg_error_from_syserror ();
 		  log_error ("problem reading source (%u bytes remaining)\n",
 			     (unsigned) pt->len);
+		  xfree (buffer);
 		  goto leave;
 		}
 	      if (mfx->md)
-		gcry_md_putc (mfx->md, c);
-#ifndef HAVE_DOSISH_SYSTEM
-              /* Convert to native line ending. */
-              /* fixme: this hack might be too simple */
-	      if (c == '\r' && convert != 'm')
-		continue;
-#endif
+		gcry_md_write (mfx->md, buffer, len);
 	      if (fp)
 		{
-		  if (opt.max_output && (++count) > opt.max_output)
+		  err = write_text (fp, fname, convert, buffer, len, &count);
+		  if (err)
 		    {
-		      log_error ("error writing to '%s': %s\n",
-				 fname, "exceeded --max-output limit\n");
-		      err = gpg_error (GPG_ERR_TOO_LARGE);
-		      goto leave;
-		    }
-		  else if (es_putc (c, fp) == EOF)
-		    {
-		      if (es_ferror (fp))
-			err = gpg_error_from_syserror ();
-		      else
-			err = gpg_error (GPG_ERR_EOF);
-		      log_error ("error writing to '%s': %s\n",
-				 fname, gpg_strerror (err));
+		      xfree (buffer);
 		      goto leave;
 		    }
 		}
+	      pt->len -= len;
 	    }
+	  xfree (buffer);
 	}
       else  /* Binary mode.  */
 	{
-	  size_t temp_size = iobuf_set_buffer_size(0) * 1024;
+	  size_t temp_size = copy_buffer_size (pt);
 	  byte *buffer;
 
 	  if (fp)
@@ -343,39 +418,38 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
     {
       if (convert)
 	{			/* text mode */
-	  while ((c = iobuf_get (pt->buf)) != -1)
+	  size_t temp_size = copy_buffer_size (pt);
+	  byte *buffer;
+	  int len;
+
+	  buffer = xtrymalloc (temp_size);
+          if (!buffer)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+
+	  /* Unlike the binary mode we read until iobuf_read returns
+	   * EOF; this is what the former byte wise loop did.  */
+	  while ((len = iobuf_read (pt->buf, buffer, temp_size)) != -1)
 	    {
 	      if (mfx->md)
-		gcry_md_putc (mfx->md, c);
-#ifndef HAVE_DOSISH_SYSTEM
-	      if (c == '\r' && convert != 'm')
-		continue;	/* fixme: this hack might be too simple */
-#endif
+		gcry_md_write (mfx->md, buffer, len);
 	      if (fp)
 		{
-		  if (opt.max_output && (++count) > opt.max_output)
+		  err = write_text (fp, fname, convert, buffer, len, &count);
+		  if (err)
 		    {
-		      log_error ("Error writing to '%s': %s\n",
-				 fname, "exceeded --max-output limit\n");
-		      err = gpg_error (GPG_ERR_TOO_LARGE);
-		      goto leave;
-		    }
-		  else if (es_putc (c, fp) == EOF)
-		    {
-		      if (es_ferror (fp))
-			err = gpg_error_from_syserror ();
-		      else
-			err = gpg_error (GPG_ERR_EOF);
-		      log_error ("error writing to '%s': %s\n",
-				 fname, gpg_strerror (err));
+		      xfree (buffer);
 		      goto leave;
 		    }
 		}
 	    }
+	  xfree (buffer);
 	}
       else
 	{			/* binary mode */
-	  size_t temp_size = iobuf_set_buffer_size(0) * 1024;
+	  size_t temp_size = copy_buffer_size (pt);
 	  byte *buffer;
 	  int eof_seen = 0;
 
@@ -527,6 +601,7 @@ static void
 do_hash (gcry_md_hd_t md, gcry_md_hd_t md2, IOBUF fp, int textmode)
 {
   text_filter_context_t tfx;
+  md_thd_filter_context_t mfx = NULL;
   int c;
 
   if (textmode)
@@ -566,11 +641,24 @@ do_hash (gcry_md_hd_t md, gcry_md_hd_t md2, IOBUF fp, int textmode)
       byte *buffer = xmalloc (temp_size);
       int ret;
 
-      while ((ret = iobuf_read (fp, buffer, temp_size)) != -1)
-	{
-	  if (md)
-	    gcry_md_write (md, buffer, ret);
-	}
+      /* With the threaded hashing the next block is read while the
+       * thread hashes the current one.  The filter removes itself at
+       * EOF and thus before MFX goes out of scope.  */
+      if (md && (opt.compat_flags & COMPAT_PARALLELIZED))
+        {
+          iobuf_push_filter (fp, md_thd_filter, &mfx);
+          md_thd_filter_set_md (mfx, md);
+          while (iobuf_read (fp, buffer, temp_size) != -1)
+            ;
+        }
+      else
+        {
+          while ((ret = iobuf_read (fp, buffer, temp_size)) != -1)
+            {
+              if (md)
+                gcry_md_write (md, buffer, ret);
+            }
+        }
 
       xfree (buffer);
     }
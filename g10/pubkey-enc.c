@@ -67,6 +67,312 @@ is_algo_in_prefs (kbnode_t keyblock, preftype_t type, int algo)
 }
 
 
+/* Convert the encrypted session key ENC for the key SK into an
+ * S-expression as used by gpg-agent and store it at R_S_DATA.  */
+static gpg_error_t
+pkesk_to_sexp (PKT_public_key *sk, PKT_pubkey_enc *enc, gcry_sexp_t *r_s_data)
+{
+  gpg_error_t err;
+
+  if (sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL
+      || sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL_E)
+    {
+      if (!enc->data[0] || !enc->data[1])
+        err = gpg_error (GPG_ERR_BAD_MPI);
+      else
+        err = gcry_sexp_build (r_s_data, NULL, "(enc-val(elg(a%m)(b%m)))",
+                               enc->data[0], enc->data[1]);
+    }
+  else if (sk->pubkey_algo == PUBKEY_ALGO_RSA
+           || sk->pubkey_algo == PUBKEY_ALGO_RSA_E)
+    {
+      if (!enc->data[0])
+        err = gpg_error (GPG_ERR_BAD_MPI);
+      else
+        err = gcry_sexp_build (r_s_data, NULL, "(enc-val(rsa(a%m)))",
+                               enc->data[0]);
+    }
+  else if (sk->pubkey_algo == PUBKEY_ALGO_ECDH)
+    {
+      if (!enc->data[0] || !enc->data[1])
+        err = gpg_error (GPG_ERR_BAD_MPI);
+      else
+        err = gcry_sexp_build (r_s_data, NULL, "(enc-val(ecdh(s%m)(e%m)))",
+                               enc->data[1], enc->data[0]);
+    }
+  else if (sk->pubkey_algo == PUBKEY_ALGO_KYBER)
+    {
+      char fixedinfo[1+MAX_FINGERPRINT_LEN];
+      int fixedlen;
+
+      if ((opt.compat_flags & COMPAT_T7014_OLD))
+        {
+          /* Temporary use for tests with original test vectors.  */
+          fixedinfo[0] = 0x69;
+          fixedlen = 1;
+        }
+      else
+        {
+          fixedinfo[0] = enc->seskey_algo;
+          v5_fingerprint_from_pk (sk, fixedinfo+1, NULL);
+          fixedlen = 33;
+        }
+
+      if (!enc->data[0] || !enc->data[1] || !enc->data[2])
+        err = gpg_error (GPG_ERR_BAD_MPI);
+      else
+        err = gcry_sexp_build (r_s_data, NULL,
+                           "(enc-val(pqc(e%m)(k%m)(s%m)(c%d)(fixed-info%b)))",
+                           enc->data[0], enc->data[1], enc->data[2],
+                           enc->seskey_algo, fixedlen, fixedinfo);
+    }
+  else
+    err = gpg_error (GPG_ERR_BUG);
+
+  return err;
+}
+
+
+/* A session key frame decrypted ahead of time by
+ * prefetch_session_keys.  Note that gpg.h defines the type
+ * pkdecrypt_prefetch_t for this structure.  */
+struct pkdecrypt_prefetch_s
+{
+  pkdecrypt_prefetch_t next;
+  char *keygrip;              /* The hexified keygrip.  */
+  unsigned char *ciphertext;  /* The canonical S-expression sent to the
+                               * agent.  */
+  size_t ciphertextlen;
+  unsigned char *frame;       /* The decrypted frame (secure memory).  */
+  size_t nframe;
+  int padding;                /* The padding info from the agent.  */
+};
+
+
+/* Release all prefetched session key frames of CTRL.  */
+void
+release_prefetched_session_keys (ctrl_t ctrl)
+{
+  pkdecrypt_prefetch_t pf;
+
+  while ((pf = ctrl->pkdecrypt_prefetch))
+    {
+      ctrl->pkdecrypt_prefetch = pf->next;
+      wipememory (pf->frame, pf->nframe);
+      xfree (pf->frame);
+      xfree (pf->ciphertext);
+      xfree (pf->keygrip);
+      xfree (pf);
+    }
+}
+
+
+/* Decrypt the session keys from LIST for which we have a secret key
+ * in advance.  LIST is usually collected from the PKESK packets of
+ * several messages; all session keys for the same key are decrypted
+ * with one request to gpg-agent and kept in CTRL until get_it asks
+ * for them.  Errors are not returned; the regular code path will
+ * then try again.  */
+void
+prefetch_session_keys (ctrl_t ctrl, struct pubkey_enc_list *list)
+{
+  struct {
+    PKT_public_key *sk;
+    char *keygrip;
+    gcry_sexp_t s_data;
+  } *items = NULL;
+  struct pubkey_enc_list *k;
+  unsigned int nitems, n, i, j, count;
+  unsigned int *idx = NULL;
+  gcry_sexp_t *s_data = NULL;
+  unsigned char **bufs = NULL;
+  size_t *buflens = NULL;
+  gpg_error_t *errs = NULL;
+  pkdecrypt_prefetch_t pf;
+  gpg_error_t err;
+  int padding;
+  char *desc;
+
+  for (n=0, k = list; k; k = k->next)
+    n++;
+  if (n < 2)
+    return;
+
+  items = xtrycalloc (n, sizeof *items);
+  idx = xtrycalloc (n, sizeof *idx);
+  s_data = xtrycalloc (n, sizeof *s_data);
+  bufs = xtrycalloc (n, sizeof *bufs);
+  buflens = xtrycalloc (n, sizeof *buflens);
+  errs = xtrycalloc (n, sizeof *errs);
+  if (!items || !idx || !s_data || !bufs || !buflens || !errs)
+    goto leave;
+
+  /* Find the keys we have; the session keys for anonymous recipients
+   * and for the KEM based algorithms are not prefetched.  */
+  for (nitems=0, k = list; k; k = k->next)
+    {
+      PKT_public_key *sk;
+
+      if (!(k->d.pubkey_algo == PUBKEY_ALGO_ELGAMAL_E
+            || k->d.pubkey_algo == PUBKEY_ALGO_ECDH
+            || k->d.pubkey_algo == PUBKEY_ALGO_RSA
+            || k->d.pubkey_algo == PUBKEY_ALGO_RSA_E
+            || k->d.pubkey_algo == PUBKEY_ALGO_ELGAMAL))
+        continue;
+      if (!k->d.keyid[0] && !k->d.keyid[1])
+        continue;
+      if (openpgp_pk_test_algo2 (k->d.pubkey_algo, PUBKEY_USAGE_ENC))
+        continue;
+
+      sk = xtrycalloc (1, sizeof *sk);
+      if (!sk)
+        goto leave;
+      sk->pubkey_algo = k->d.pubkey_algo;
+      sk->req_usage = PUBKEY_USAGE_ENC;
+      if (get_seckey (ctrl, sk, k->d.keyid)
+          || sk->pubkey_algo != k->d.pubkey_algo
+          || !gnupg_pk_is_allowed (opt.compliance, PK_USE_DECRYPTION,
+                                   sk->pubkey_algo, 0,
+                                   sk->pkey, nbits_from_pk (sk), NULL)
+          || hexkeygrip_from_pk (sk, &items[nitems].keygrip))
+        {
+          free_public_key (sk);
+          continue;
+        }
+      if (strchr (items[nitems].keygrip, ',')
+          || pkesk_to_sexp (sk, &k->d, &items[nitems].s_data))
+        {
+          xfree (items[nitems].keygrip);
+          items[nitems].keygrip = NULL;
+          free_public_key (sk);
+          continue;
+        }
+      items[nitems++].sk = sk;
+    }
+
+  /* Decrypt all session keys for the same key in one go.  */
+  for (i=0; i < nitems; i++)
+    {
+      if (!items[i].keygrip)
+        continue;  /* Already done.  */
+
+      for (count=0, j=i; j < nitems; j++)
+        if (items[j].keygrip && !strcmp (items[i].keygrip, items[j].keygrip))
+          {
+            idx[count] = j;
+            s_data[count] = items[j].s_data;
+            count++;
+          }
+
+      if (count > 1)
+        {
+          desc = gpg_format_keydesc (ctrl, items[i].sk,
+                                     FORMAT_KEYDESC_NORMAL, 1);
+          err = agent_pkdecrypt_batch (NULL, items[i].keygrip, desc,
+                                       items[i].sk->keyid,
+                                       items[i].sk->main_keyid,
+                                       items[i].sk->pubkey_algo,
+                                       s_data, count, bufs, buflens, errs,
+                                       &padding);
+          xfree (desc);
+          if (err)
+            {
+              if (DBG_CRYPTO || gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+                log_info ("prefetching session keys failed: %s\n",
+                          gpg_strerror (err));
+              goto leave;
+            }
+
+          for (j=0; j < count; j++)
+            {
+              if (errs[j] || !bufs[j])
+                continue;
+              pf = xtrycalloc (1, sizeof *pf);
+              if (!pf
+                  || !(pf->keygrip = xtrystrdup (items[i].keygrip))
+                  || make_canon_sexp (s_data[j], &pf->ciphertext,
+                                      &pf->ciphertextlen))
+                {
+                  if (pf)
+                    xfree (pf->keygrip);
+                  xfree (pf);
+                  wipememory (bufs[j], buflens[j]);
+                  xfree (bufs[j]);
+                  bufs[j] = NULL;
+                  continue;
+                }
+              pf->frame = bufs[j];
+              bufs[j] = NULL;
+              pf->nframe = buflens[j];
+              pf->padding = padding;
+              pf->next = ctrl->pkdecrypt_prefetch;
+              ctrl->pkdecrypt_prefetch = pf;
+            }
+        }
+
+      for (j=0; j < count; j++)
+        {
+          xfree (items[idx[j]].keygrip);
+          items[idx[j]].keygrip = NULL;
+        }
+    }
+
+ leave:
+  if (items)
+    {
+      for (i=0; i < n; i++)
+        {
+          free_public_key (items[i].sk);
+          xfree (items[i].keygrip);
+          gcry_sexp_release (items[i].s_data);
+        }
+    }
+  xfree (items);
+  xfree (idx);
+  xfree (s_data);
+  xfree (bufs);
+  xfree (buflens);
+  xfree (errs);
+}
+
+
+/* If the session key frame for S_DATA and the key KEYGRIP has been
+ * prefetched, store it at R_FRAME and R_NFRAME, the padding info at
+ * R_PADDING, remove it from CTRL, and return true.  */
+static int
+take_prefetched_frame (ctrl_t ctrl, const char *keygrip, gcry_sexp_t s_data,
+                       unsigned char **r_frame, size_t *r_nframe,
+                       int *r_padding)
+{
+  pkdecrypt_prefetch_t pf, *pfp;
+  unsigned char *ciphertext;
+  size_t ciphertextlen;
+
+  if (!ctrl || !ctrl->pkdecrypt_prefetch)
+    return 0;
+  if (make_canon_sexp (s_data, &ciphertext, &ciphertextlen))
+    return 0;
+
+  for (pfp = &ctrl->pkdecrypt_prefetch; (pf = *pfp); pfp = &pf->next)
+    if (pf->ciphertextlen == ciphertextlen
+        && !strcmp (pf->keygrip, keygrip)
+        && !memcmp (pf->ciphertext, ciphertext, ciphertextlen))
+      break;
+  xfree (ciphertext);
+  if (!pf)
+    return 0;
+
+  *pfp = pf->next;
+  *r_frame = pf->frame;
+  *r_nframe = pf->nframe;
+  *r_padding = pf->padding;
+  xfree (pf->ciphertext);
+  xfree (pf->keygrip);
+  xfree (pf);
+  return 1;
+}
+
+
 /*
  * Get the session key from a pubkey enc packet and return it in DEK,
  * which should have been allocated in secure memory by the caller.
@@ -212,61 +518,7 @@ get_it (ctrl_t ctrl,
     goto leave;
 
   /* Convert the data to an S-expression.  */
-  if (sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL
-      || sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL_E)
-    {
-      if (!enc->d.data[0] || !enc->d.data[1])
-        err = gpg_error (GPG_ERR_BAD_MPI);
-      else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(elg(a%m)(b%m)))",
-                               enc->d.data[0], enc->d.data[1]);
-    }
-  else if (sk->pubkey_algo == PUBKEY_ALGO_RSA
-           || sk->pubkey_algo == PUBKEY_ALGO_RSA_E)
-    {
-      if (!enc->d.data[0])
-        err = gpg_error (GPG_ERR_BAD_MPI);
-      else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(rsa(a%m)))",
-                               enc->d.data[0]);
-    }
-  else if (sk->pubkey_algo == PUBKEY_ALGO_ECDH)
-    {
-      if (!enc->d.data[0] || !enc->d.data[1])
-        err = gpg_error (GPG_ERR_BAD_MPI);
-      else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(ecdh(s%m)(e%m)))",
-                               enc->d.data[1], enc->d.data[0]);
-    }
-  else if (sk->pubkey_algo == PUBKEY_ALGO_KYBER)
-    {
-      char fixedinfo[1+MAX_FINGERPRINT_LEN];
-      int fixedlen;
-
-      if ((opt.compat_flags & COMPAT_T7014_OLD))
-        {
-          /* Temporary use for tests with original test vectors.  */
-          fixedinfo[0] = 0x69;
-          fixedlen = 1;
-        }
-      else
-        {
-          fixedinfo[0] = enc->d.seskey_algo;
-          v5_fingerprint_from_pk (sk, fixedinfo+1, NULL);
-          fixedlen = 33;
-        }
-
-      if (!enc->d.data[0] || !enc->d.data[1] || !enc->d.data[2])
-        err = gpg_error (GPG_ERR_BAD_MPI);
-      else
-        err = gcry_sexp_build (&s_data, NULL,
-                           "(enc-val(pqc(e%m)(k%m)(s%m)(c%d)(fixed-info%b)))",
-                           enc->d.data[0], enc->d.data[1], enc->d.data[2],
-                           enc->d.seskey_algo, fixedlen, fixedinfo);
-    }
-  else
-    err = gpg_error (GPG_ERR_BUG);
-
+  err = pkesk_to_sexp (sk, &enc->d, &s_data);
   if (err)
     goto leave;
 
@@ -274,12 +526,18 @@ get_it (ctrl_t ctrl,
     fingerprint_from_pk (sk, fp, NULL);
 
   /* Decrypt. */
-  desc = gpg_format_keydesc (ctrl, sk, FORMAT_KEYDESC_NORMAL, 1);
+  if (take_prefetched_frame (ctrl, keygrip, s_data,
+                             &frame, &nframe, &padding))
+    err = 0;
+  else
+    {
+      desc = gpg_format_keydesc (ctrl, sk, FORMAT_KEYDESC_NORMAL, 1);
 
-  err = agent_pkdecrypt (NULL, keygrip,
-                         desc, sk->keyid, sk->main_keyid, sk->pubkey_algo,
-                         s_data, &frame, &nframe, &padding);
-  xfree (desc);
+      err = agent_pkdecrypt (NULL, keygrip,
+                             desc, sk->keyid, sk->main_keyid, sk->pubkey_algo,
+                             s_data, &frame, &nframe, &padding);
+      xfree (desc);
+    }
   gcry_sexp_release (s_data);
   if (err)
     goto leave;
@@ -0,0 +1,469 @@
+/* rcptcache.c - Cache of resolved recipient sets
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Encrypting many times to the same large set of recipients spends
+ * most of the time in build_pk_list: each name is looked up, the
+ * best key is selected and its validity is computed.  With
+ * --recipient-cache-ttl this module keeps a file in the home
+ * directory which maps a digest over the list of recipient names and
+ * the options affecting their resolution to the fingerprints of the
+ * selected keys.  An entry is only used as long as the key database
+ * and the trustdb have not been changed (see keydb_get_state and
+ * tdb_get_state) and its lifetime has not expired.  On a hit the
+ * keys are fetched by fingerprint and only checked for revocation
+ * and expiration.
+ *
+ * File format (all integers are big endian):
+ *
+ *   byte  0-7   magic "GPGRCPT\x01"
+ *
+ * followed by entries of this form:
+ *
+ *   byte  0-31  key as computed by rcptcache_make_key
+ *   byte 32-51  state of the key database
+ *   byte 52-71  state of the trustdb
+ *   byte 72-75  expiration time of the entry
+ *   byte 76-79  number of records
+ *
+ * followed by the records in the order of the resulting list:
+ *
+ *   byte  0     length of the fingerprint
+ *   byte  1     flags of the list item
+ *   byte  2-3   reserved
+ *   byte  4-35  fingerprint of the key, zero padded
+ *
+ * New entries are appended; the last matching entry wins.  If the
+ * file grows too large it is truncated.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/dotlock.h"
+#include "../common/host2net.h"
+#include "packet.h"
+#include "keydb.h"
+#include "trustdb.h"
+#include "main.h"
+#include "options.h"
+#include "rcptcache.h"
+
+/* The name of the file in the home directory.  */
+#define RCPTCACHE_FILENAME "rcptcache.bin"
+
+/* The magic at the start of the file.  The last byte is the
+ * version.  */
+#define RCPTCACHE_MAGIC "GPGRCPT\x01"
+#define RCPTCACHE_MAGICLEN 8
+
+#define RCPTCACHE_HDRLEN (RCPTCACHE_KEYLEN + KEYDB_STATELEN \
+                          + TRUSTDB_STATELEN + 8)
+#define RCPTCACHE_RECLEN 36
+
+/* Entries with more records are considered garbage.  */
+#define RCPTCACHE_MAX_RECORDS 65536
+
+/* If the file is larger it is truncated with the next store.  */
+#define RCPTCACHE_MAX_FILESIZE (4*1024*1024)
+
+/* The timeout in milliseconds to wait for the lock when storing.  */
+#define RCPTCACHE_LOCK_TIMEOUT 1000
+
+
+static struct
+{
+  unsigned int hits;
+  unsigned int misses;
+  unsigned int stale;
+  unsigned int stored;
+} rcptcache_stats;
+
+
+
+static void
+put32 (unsigned char *p, u32 a)
+{
+  p[0] = a >> 24;
+  p[1] = a >> 16;
+  p[2] = a >>  8;
+  p[3] = a;
+}
+
+
+/* Return true if the recipient cache shall be used for RCPTS.  */
+static int
+rcptcache_usable (strlist_t rcpts)
+{
+  strlist_t sl;
+  int any = 0;
+
+  if (!opt.recipient_cache_ttl)
+    return 0;
+  if (opt.trust_model == TM_TOFU || opt.trust_model == TM_TOFU_PGP)
+    return 0;  /* The encryption needs to be registered.  */
+  if (PGP7 || PGP8)
+    return 0;  /* May need to print compliance warnings.  */
+
+  for (sl = rcpts; sl; sl = sl->next)
+    {
+      if ((sl->flags & PK_LIST_FROM_FILE))
+        return 0;
+      if (!(sl->flags & PK_LIST_ENCRYPT_TO))
+        any = 1;
+    }
+  /* Without regular recipients build_pk_list may prompt.  */
+  return any;
+}
+
+
+static void
+hash_int (gcry_md_hd_t md, int value)
+{
+  byte buf[4];
+
+  put32 (buf, value);
+  gcry_md_write (md, buf, 4);
+}
+
+
+static void
+hash_string (gcry_md_hd_t md, const char *string)
+{
+  gcry_md_write (md, string, strlen (string) + 1);
+}
+
+
+/* Compute the cache key for the list of recipients RCPTS after group
+ * expansion.  The key is stored at R_KEY which must provide
+ * RCPTCACHE_KEYLEN bytes.  GPG_ERR_NOT_SUPPORTED is returned if the
+ * cache shall not be used for this list.  */
+gpg_error_t
+rcptcache_make_key (strlist_t rcpts, byte *r_key)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+  strlist_t sl;
+
+  if (!rcptcache_usable (rcpts))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  err = gcry_md_open (&md, GCRY_MD_SHA256, 0);
+  if (err)
+    return err;
+
+  gcry_md_write (md, RCPTCACHE_MAGIC, RCPTCACHE_MAGICLEN);
+  hash_int (md, opt.trust_model);
+  hash_int (md, opt.compliance);
+  hash_int (md, opt.no_encrypt_to);
+  hash_int (md, opt.encrypt_to_default_key);
+  hash_int (md, opt.min_cert_level);
+  hash_int (md, opt.marginals_needed);
+  hash_int (md, opt.completes_needed);
+  hash_int (md, opt.max_cert_depth);
+  for (sl = opt.def_secret_key; sl; sl = sl->next)
+    hash_string (md, sl->d);
+  gcry_md_putc (md, 0);
+  for (sl = rcpts; sl; sl = sl->next)
+    {
+      hash_int (md, sl->flags);
+      hash_string (md, sl->d);
+    }
+
+  memcpy (r_key, gcry_md_read (md, GCRY_MD_SHA256), RCPTCACHE_KEYLEN);
+  gcry_md_close (md);
+  return 0;
+}
+
+
+/* Store the states of the key database and the trustdb at R_STATES
+ * which must provide KEYDB_STATELEN + TRUSTDB_STATELEN bytes.  */
+static gpg_error_t
+get_states (byte *r_states)
+{
+  gpg_error_t err;
+
+  err = keydb_get_state (r_states);
+#ifdef NO_TRUST_MODELS
+  if (!err)
+    memset (r_states + KEYDB_STATELEN, 0, TRUSTDB_STATELEN);
+#else
+  if (!err)
+    err = tdb_get_state (r_states + KEYDB_STATELEN);
+#endif
+  return err;
+}
+
+
+/* Fetch the key described by the record REC and append it to the
+ * list at *R_TAIL.  Returns an error if the key is not available or
+ * has become unusable.  */
+static gpg_error_t
+fetch_record (ctrl_t ctrl, const byte *rec, pk_list_t **r_tail)
+{
+  gpg_error_t err;
+  PKT_public_key *pk;
+  char hexfpr[2 * MAX_FINGERPRINT_LEN + 2];
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen = rec[0];
+  pk_list_t r;
+
+  if (fprlen != 20 && fprlen != 32)
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  pk = xtrycalloc (1, sizeof *pk);
+  if (!pk)
+    return gpg_error_from_syserror ();
+  /* The additional decryption subkeys are added by find_and_check_key
+   * and have only the RENC usage.  */
+  pk->req_usage = PUBKEY_USAGE_ENC | PUBKEY_USAGE_RENC;
+
+  bin2hex (rec + 4, fprlen, hexfpr);
+  strcat (hexfpr, "!");
+  err = get_pubkey_byname (ctrl, GET_PUBKEY_NO_AKL,
+                           NULL, pk, hexfpr, NULL, NULL, 1);
+  if (!err)
+    {
+      fingerprint_from_pk (pk, fpr, NULL);
+      if (memcmp (fpr, rec + 4, fprlen))
+        err = gpg_error (GPG_ERR_WRONG_PUBKEY_ALGO);
+      else if (pk->flags.revoked || pk->has_expired || !pk->flags.valid)
+        err = gpg_error (GPG_ERR_UNUSABLE_PUBKEY);
+      else if (!(pk->pubkey_usage & (PUBKEY_USAGE_ENC | PUBKEY_USAGE_RENC)))
+        err = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
+      else
+        err = openpgp_pk_test_algo2 (pk->pubkey_algo, PUBKEY_USAGE_ENC);
+    }
+  if (err)
+    {
+      if (DBG_CACHE)
+        log_debug ("%s: key %s not usable: %s\n",
+                   __func__, hexfpr, gpg_strerror (err));
+      free_public_key (pk);
+      return err;
+    }
+
+  r = xmalloc_clear (sizeof *r);
+  r->pk = pk;
+  r->flags = rec[1];
+  **r_tail = r;
+  *r_tail = &r->next;
+  return 0;
+}
+
+
+/* Look up the recipient set for KEY as computed by rcptcache_make_key.
+ * On success the resolved list of keys is stored at R_PK_LIST.
+ * GPG_ERR_NOT_FOUND is returned if there is no usable entry.  */
+gpg_error_t
+rcptcache_lookup (ctrl_t ctrl, const byte *key, pk_list_t *r_pk_list)
+{
+  gpg_error_t err;
+  char *fname;
+  estream_t fp;
+  byte states[KEYDB_STATELEN + TRUSTDB_STATELEN];
+  byte hdr[RCPTCACHE_HDRLEN];
+  byte *records = NULL;
+  size_t nrecords = 0;
+  u32 n, expires, now;
+  int found = 0;
+  pk_list_t pk_list = NULL;
+  pk_list_t *tail = &pk_list;
+  size_t i;
+
+  *r_pk_list = NULL;
+  if (get_states (states))
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  now = make_timestamp ();
+
+  fname = make_filename (gnupg_homedir (), RCPTCACHE_FILENAME, NULL);
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      if (errno != ENOENT && DBG_CACHE)
+        log_debug ("can't open '%s': %s\n", fname, strerror (errno));
+      xfree (fname);
+      rcptcache_stats.misses++;
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+
+  if (es_fread (hdr, RCPTCACHE_MAGICLEN, 1, fp) != 1
+      || memcmp (hdr, RCPTCACHE_MAGIC, RCPTCACHE_MAGICLEN))
+    goto leave;  /* Unknown version or garbage.  */
+
+  while (es_fread (hdr, RCPTCACHE_HDRLEN, 1, fp) == 1)
+    {
+      n = buf32_to_u32 (hdr + RCPTCACHE_HDRLEN - 4);
+      if (!n || n > RCPTCACHE_MAX_RECORDS)
+        break;
+      if (memcmp (hdr, key, RCPTCACHE_KEYLEN))
+        {
+          if (es_fseeko (fp, (off_t)n * RCPTCACHE_RECLEN, SEEK_CUR))
+            break;
+          continue;
+        }
+
+      /* The last matching entry wins; an older one is replaced.  */
+      xfree (records);
+      records = xtrymalloc (n * RCPTCACHE_RECLEN);
+      if (!records)
+        break;
+      if (es_fread (records, RCPTCACHE_RECLEN, n, fp) != n)
+        {
+          xfree (records);
+          records = NULL;
+          break;
+        }
+      nrecords = n;
+      expires = buf32_to_u32 (hdr + RCPTCACHE_HDRLEN - 8);
+      found = (!memcmp (hdr + RCPTCACHE_KEYLEN, states, sizeof states)
+               && now < expires);
+    }
+
+ leave:
+  es_fclose (fp);
+  xfree (fname);
+
+  if (!records || !found)
+    {
+      if (records)
+        rcptcache_stats.stale++;
+      else
+        rcptcache_stats.misses++;
+      xfree (records);
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+
+  err = 0;
+  for (i=0; !err && i < nrecords; i++)
+    err = fetch_record (ctrl, records + i * RCPTCACHE_RECLEN, &tail);
+  xfree (records);
+  if (err)
+    {
+      release_pk_list (pk_list);
+      rcptcache_stats.stale++;
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+
+  if (DBG_CACHE)
+    log_debug ("%s: using %zu cached recipients\n", __func__, nrecords);
+  rcptcache_stats.hits++;
+  *r_pk_list = pk_list;
+  return 0;
+}
+
+
+/* Store the resolved list of keys PK_LIST for KEY as computed by
+ * rcptcache_make_key.  Errors are ignored.  */
+void
+rcptcache_store (ctrl_t ctrl, const byte *key, pk_list_t pk_list)
+{
+  char *fname;
+  dotlock_t lockhd = NULL;
+  estream_t fp = NULL;
+  byte hdr[RCPTCACHE_HDRLEN];
+  byte rec[RCPTCACHE_RECLEN];
+  size_t fprlen;
+  pk_list_t r;
+  u32 n, expires;
+  off_t off;
+
+  (void)ctrl;
+
+  if (opt.dry_run || !pk_list)
+    return;
+  /* The trust model may only now be known.  */
+  if (opt.trust_model == TM_TOFU || opt.trust_model == TM_TOFU_PGP)
+    return;
+
+  memcpy (hdr, key, RCPTCACHE_KEYLEN);
+  if (get_states (hdr + RCPTCACHE_KEYLEN))
+    return;
+  expires = make_timestamp () + opt.recipient_cache_ttl;
+  for (n=0, r = pk_list; r; r = r->next, n++)
+    if (r->pk->expiredate && r->pk->expiredate < expires)
+      expires = r->pk->expiredate;
+  if (n > RCPTCACHE_MAX_RECORDS)
+    return;
+  put32 (hdr + RCPTCACHE_HDRLEN - 8, expires);
+  put32 (hdr + RCPTCACHE_HDRLEN - 4, n);
+
+  fname = make_filename (gnupg_homedir (), RCPTCACHE_FILENAME, NULL);
+  lockhd = dotlock_create (fname, 0);
+  if (!lockhd || dotlock_take (lockhd, RCPTCACHE_LOCK_TIMEOUT))
+    goto leave;
+
+  fp = es_fopen (fname, "ab");
+  if (!fp)
+    {
+      if (DBG_CACHE)
+        log_debug ("can't create '%s': %s\n", fname, strerror (errno));
+      goto leave;
+    }
+  if (es_fseeko (fp, 0, SEEK_END) || (off = es_ftello (fp)) < 0)
+    goto leave;
+  if (off > RCPTCACHE_MAX_FILESIZE)
+    {
+      es_fclose (fp);
+      fp = es_fopen (fname, "wb");
+      if (!fp)
+        goto leave;
+      off = 0;
+    }
+  if (!off)
+    es_fwrite (RCPTCACHE_MAGIC, RCPTCACHE_MAGICLEN, 1, fp);
+
+  es_fwrite (hdr, RCPTCACHE_HDRLEN, 1, fp);
+  for (r = pk_list; r; r = r->next)
+    {
+      memset (rec, 0, sizeof rec);
+      fingerprint_from_pk (r->pk, rec + 4, &fprlen);
+      rec[0] = fprlen;
+      rec[1] = r->flags;
+      es_fwrite (rec, RCPTCACHE_RECLEN, 1, fp);
+    }
+  if (es_fclose (fp))
+    log_info ("error writing '%s': %s\n", fname, strerror (errno));
+  else
+    rcptcache_stats.stored++;
+  fp = NULL;
+
+ leave:
+  es_fclose (fp);
+  if (lockhd)
+    {
+      dotlock_release (lockhd);
+      dotlock_destroy (lockhd);
+    }
+  xfree (fname);
+}
+
+
+void
+rcptcache_dump_stats (void)
+{
+  log_info ("rcptcache: %u hits, %u misses, %u stale, %u stored\n",
+            rcptcache_stats.hits, rcptcache_stats.misses,
+            rcptcache_stats.stale, rcptcache_stats.stored);
+}
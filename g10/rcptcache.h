@@ -0,0 +1,33 @@
+/* rcptcache.h - Definitions for the recipient cache
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_G10_RCPTCACHE_H
+#define GNUPG_G10_RCPTCACHE_H
+
+/* The length of a cache key.  */
+#define RCPTCACHE_KEYLEN 32
+
+gpg_error_t rcptcache_make_key (strlist_t rcpts, byte *r_key);
+gpg_error_t rcptcache_lookup (ctrl_t ctrl, const byte *key,
+                              pk_list_t *r_pk_list);
+void rcptcache_store (ctrl_t ctrl, const byte *key, pk_list_t pk_list);
+void rcptcache_dump_stats (void);
+
+#endif /*GNUPG_G10_RCPTCACHE_H*/
@@ -51,6 +51,12 @@ struct server_local_s
   /* List of prepared recipients.  */
   pk_list_t recplist;
 
+  /* List of signers as set by the SIGNER command.  */
+  strlist_t signers;
+
+  /* Set if the output shall be armored.  */
+  int armor_output;
+
   /* Set if pinentry notifications should be passed back to the
      client. */
   int allow_pinentry_notify;
@@ -126,6 +132,9 @@ reset_notify (assuan_context_t ctx, char *line)
 
   release_pk_list (ctrl->server_local->recplist);
   ctrl->server_local->recplist = NULL;
+  free_strlist (ctrl->server_local->signers);
+  ctrl->server_local->signers = NULL;
+  ctrl->server_local->armor_output = 0;
 
   close_message_fd (ctrl);
   assuan_close_input_fd (ctx);
@@ -160,12 +169,11 @@ input_notify (assuan_context_t ctx, char *line)
 static gpg_error_t
 output_notify (assuan_context_t ctx, char *line)
 {
-/*   ctrl_t ctrl = assuan_get_pointer (ctx); */
-
-  (void)ctx;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
 
-  if (strstr (line, "--armor"))
-    ; /* FIXME */
+  ctrl->server_local->armor_output = !!strstr (line, "--armor");
+  if (ctrl->server_local->armor_output)
+    ;
   else if (strstr (line, "--base64"))
     {
       /* FIXME */
@@ -234,9 +242,27 @@ cmd_recipient (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_signer (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  strlist_t sl = NULL;
+  SK_LIST sk_list = NULL;
+
+  line = skip_options (line);
+  if (!*line)
+    return set_error (GPG_ERR_ASS_PARAMETER, "no user ID given");
+
+  /* Check the key now so that the client gets an error for this
+   * command and not only with SIGN.  */
+  add_to_strlist (&sl, line);
+  err = build_sk_list (ctrl, sl, &sk_list, PUBKEY_USAGE_SIG);
+  release_sk_list (sk_list);
+  free_strlist (sl);
+  if (!err)
+    append_to_strlist (&ctrl->server_local->signers, line);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "SIGNER", gpg_strerror (err));
+  return err;
 }
 
 
@@ -266,6 +292,7 @@ cmd_encrypt (assuan_context_t ctx, char *line)
   ctrl_t ctrl = assuan_get_pointer (ctx);
   gpg_error_t err;
   gnupg_fd_t inp_fd, out_fd;
+  int save_armor;
 
   (void)line; /* LINE is not used.  */
 
@@ -295,9 +322,12 @@ cmd_encrypt (assuan_context_t ctx, char *line)
 
   /* fixme: err = ctrl->audit? 0 : start_audit_session (ctrl);*/
 
+  save_armor = opt.armor;
+  opt.armor = ctrl->server_local->armor_output;
   err = encrypt_crypt (ctrl, inp_fd, NULL, NULL, 0,
                        ctrl->server_local->recplist,
                        out_fd);
+  opt.armor = save_armor;
 
  leave:
   /* Release the recipient list on success.  */
@@ -415,13 +445,42 @@ cmd_verify (assuan_context_t ctx, char *line)
 
    Sign the data set with the INPUT command and write it to the sink
    set by OUTPUT.  With "--detached" specified, a detached signature
-   is created.  */
+   is created.  The keys set with SIGNER are used; without a SIGNER
+   command the default key is used.  The output is armored if the
+   OUTPUT command was given the option "--armor".
+
+   The input and output pipes are closed after this command.  */
 static gpg_error_t
 cmd_sign (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  gnupg_fd_t inp_fd, out_fd;
+  int detached, save_armor;
+
+  detached = has_option (line, "--detached");
+
+  inp_fd = assuan_get_input_fd (ctx);
+  if (inp_fd == GNUPG_INVALID_FD)
+    return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
+  out_fd = assuan_get_output_fd (ctx);
+  if (out_fd == GNUPG_INVALID_FD)
+    return set_error (GPG_ERR_ASS_NO_OUTPUT, NULL);
+
+  save_armor = opt.armor;
+  opt.armor = ctrl->server_local->armor_output;
+  err = sign_fd (ctrl, inp_fd, out_fd, detached,
+                 ctrl->server_local->signers);
+  opt.armor = save_armor;
+
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "SIGN", gpg_strerror (err));
+  return err;
 }
 
 
@@ -744,6 +803,7 @@ gpg_server (ctrl_t ctrl)
   if (ctrl->server_local)
     {
       release_pk_list (ctrl->server_local->recplist);
+      free_strlist (ctrl->server_local->signers);
 
       xfree (ctrl->server_local);
       ctrl->server_local = NULL;
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -33,6 +34,7 @@
 #include "../common/i18n.h"
 #include "options.h"
 #include "pkglue.h"
+#include "sigcache.h"
 #include "../common/compliance.h"
 
 static int check_signature_end (PKT_public_key *pk, PKT_signature *sig,
@@ -492,54 +494,12 @@ check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 }
 
 
-/* This function is similar to check_signature_end, but it only checks
- * whether the signature was generated by PK.  It does not check
- * expiration, revocation, etc.  */
-static int
-check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
-                            gcry_md_hd_t digest,
-                            const void *extrahash, size_t extrahashlen)
+/* Hash the trailer of SIG into DIGEST and finalize it.  EXTRAHASH
+ * and EXTRAHASHLEN are used for v5 signatures over literal data.  */
+static void
+hash_sig_trailer (PKT_signature *sig, gcry_md_hd_t digest,
+                  const void *extrahash, size_t extrahashlen)
 {
-  gcry_mpi_t result = NULL;
-  int rc = 0;
-
-  if (!opt.flags.allow_weak_digest_algos)
-    {
-      if (is_weak_digest (sig->digest_algo))
-        {
-          print_digest_rejected_note (sig->digest_algo);
-          return GPG_ERR_DIGEST_ALGO;
-        }
-    }
-
-  /* For key signatures check that the key has a cert usage.  We may
-   * do this only for subkeys because the primary may always issue key
-   * signature.  The latter may not be reflected in the pubkey_usage
-   * field because we need to check the key signatures to extract the
-   * key usage.  */
-  if (!pk->flags.primary
-      && IS_CERT (sig) && !(pk->pubkey_usage & PUBKEY_USAGE_CERT))
-    {
-      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
-      if (!opt.quiet)
-        log_info (_("bad key signature from key %s: %s (0x%02x, 0x%x)\n"),
-                  keystr_from_pk (pk), gpg_strerror (rc),
-                  sig->sig_class, pk->pubkey_usage);
-      return rc;
-    }
-
-  /* For data signatures check that the key has sign usage.  */
-  if (!IS_BACK_SIG (sig) && IS_SIG (sig)
-      && !(pk->pubkey_usage & PUBKEY_USAGE_SIG))
-    {
-      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
-      if (!opt.quiet)
-        log_info (_("bad data signature from key %s: %s (0x%02x, 0x%x)\n"),
-                  keystr_from_pk (pk), gpg_strerror (rc),
-                  sig->sig_class, pk->pubkey_usage);
-      return rc;
-    }
-
   /* Make sure the digest algo is enabled (in case of a detached
    * signature).  */
   gcry_md_enable (digest, sig->digest_algo);
@@ -620,20 +580,87 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
       buf[i++] = n;
       gcry_md_write (digest, buf, i);
     }
-    gcry_md_final( digest );
+  gcry_md_final( digest );
+}
+
+
+/* This function is similar to check_signature_end, but it only checks
+ * whether the signature was generated by PK.  It does not check
+ * expiration, revocation, etc.  */
+static int
+check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
+                            gcry_md_hd_t digest,
+                            const void *extrahash, size_t extrahashlen)
+{
+  gcry_mpi_t result = NULL;
+  int rc = 0;
+  byte cachekey[SIGCACHE_KEYLEN];
+  int use_sigcache;
+
+  if (!opt.flags.allow_weak_digest_algos)
+    {
+      if (is_weak_digest (sig->digest_algo))
+        {
+          print_digest_rejected_note (sig->digest_algo);
+          return GPG_ERR_DIGEST_ALGO;
+        }
+    }
+
+  /* For key signatures check that the key has a cert usage.  We may
+   * do this only for subkeys because the primary may always issue key
+   * signature.  The latter may not be reflected in the pubkey_usage
+   * field because we need to check the key signatures to extract the
+   * key usage.  */
+  if (!pk->flags.primary
+      && IS_CERT (sig) && !(pk->pubkey_usage & PUBKEY_USAGE_CERT))
+    {
+      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
+      if (!opt.quiet)
+        log_info (_("bad key signature from key %s: %s (0x%02x, 0x%x)\n"),
+                  keystr_from_pk (pk), gpg_strerror (rc),
+                  sig->sig_class, pk->pubkey_usage);
+      return rc;
+    }
 
-    /* Convert the digest to an MPI.  */
-    result = encode_md_value (pk, digest, sig->digest_algo );
-    if (!result)
-        return GPG_ERR_GENERAL;
+  /* For data signatures check that the key has sign usage.  */
+  if (!IS_BACK_SIG (sig) && IS_SIG (sig)
+      && !(pk->pubkey_usage & PUBKEY_USAGE_SIG))
+    {
+      rc = gpg_error (GPG_ERR_WRONG_KEY_USAGE);
+      if (!opt.quiet)
+        log_info (_("bad data signature from key %s: %s (0x%02x, 0x%x)\n"),
+                  keystr_from_pk (pk), gpg_strerror (rc),
+                  sig->sig_class, pk->pubkey_usage);
+      return rc;
+    }
 
-    /* Verify the signature.  */
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("enter pk_verify");
-    rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("leave pk_verify");
-    gcry_mpi_release (result);
+  hash_sig_trailer (sig, digest, extrahash, extrahashlen);
+
+    /* Key signatures are verified over and over again; thus look for
+     * the result of an earlier verification in the persistent
+     * cache.  */
+    use_sigcache = (!opt.no_sig_cache
+                    && sig->sig_class >= 0x10 && sig->sig_class <= 0x30
+                    && !sigcache_make_key (pk, sig, digest, cachekey));
+    if (use_sigcache && sigcache_lookup (cachekey))
+      rc = 0;
+    else
+      {
+        /* Convert the digest to an MPI.  */
+        result = encode_md_value (pk, digest, sig->digest_algo );
+        if (!result)
+          return GPG_ERR_GENERAL;
+
+        /* Verify the signature.  */
+        if (DBG_CLOCK && sig->sig_class <= 0x01)
+          log_clock ("enter pk_verify");
+        rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
+        if (DBG_CLOCK && sig->sig_class <= 0x01)
+          log_clock ("leave pk_verify");
+        gcry_mpi_release (result);
+        if (!rc && use_sigcache)
+          sigcache_add (cachekey);
+      }
 
   if (!rc && sig->flags.unknown_critical)
     {
@@ -681,6 +708,48 @@ hash_uid_packet (PKT_user_id *uid, gcry_md_hd_t md, PKT_signature *sig )
     }
 }
 
+
+/* Hash the data signed by the key signature SIG into MD.  PRIPK is
+ * the primary key of the keyblock, PACKET the key, subkey or user id
+ * the signature is over and SIGNER the alleged signer.  The caller
+ * must have checked that PACKET matches the class of SIG.  */
+static void
+hash_key_sig_data (gcry_md_hd_t md, PKT_signature *sig,
+                   PKT_public_key *pripk, PACKET *packet,
+                   PKT_public_key *signer)
+{
+  if (IS_KEY_SIG (sig) || IS_KEY_REV (sig))
+    {
+      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
+      hash_public_key (md, packet->pkt.public_key);
+    }
+  else if (IS_BACK_SIG (sig))
+    {
+      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
+      hash_public_key (md, packet->pkt.public_key);
+      hash_public_key (md, signer);
+    }
+  else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+    {
+      log_assert (packet->pkttype == PKT_PUBLIC_SUBKEY);
+      hash_public_key (md, pripk);
+      hash_public_key (md, packet->pkt.public_key);
+    }
+  else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
+    {
+      log_assert (packet->pkttype == PKT_USER_ID);
+      hash_public_key (md, pripk);
+      hash_uid_packet (packet->pkt.user_id, md, sig);
+    }
+  else
+    {
+      /* We should never get here.  (The caller should have already
+       * caught this error.)  */
+      BUG ();
+    }
+}
+
+
 static void
 cache_sig_result ( PKT_signature *sig, int result )
 {
@@ -1025,52 +1094,21 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
     BUG ();
 
   /* Hash the relevant data.  */
-
-  if (IS_KEY_SIG (sig) || IS_KEY_REV (sig))
+  if ((IS_UID_SIG (sig) || IS_UID_REV (sig))
+      && sig->digest_algo == DIGEST_ALGO_SHA1 && !*is_selfsig
+      && !opt.flags.allow_weak_key_signatures)
     {
-      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
-      hash_public_key (md, packet->pkt.public_key);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-    }
-  else if (IS_BACK_SIG (sig))
-    {
-      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
-      hash_public_key (md, packet->pkt.public_key);
-      hash_public_key (md, signer);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-    }
-  else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
-    {
-      log_assert (packet->pkttype == PKT_PUBLIC_SUBKEY);
-      hash_public_key (md, pripk);
-      hash_public_key (md, packet->pkt.public_key);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-    }
-  else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
-    {
-      log_assert (packet->pkttype == PKT_USER_ID);
-      if (sig->digest_algo == DIGEST_ALGO_SHA1 && !*is_selfsig
-          && !opt.flags.allow_weak_key_signatures)
-        {
-          /* If the signature was created using SHA-1 we consider this
-           * signature invalid because it makes it possible to mount a
-           * chosen-prefix collision.  We don't do this for
-           * self-signatures, though.  */
-          print_sha1_keysig_rejected_note ();
-          rc = gpg_error (GPG_ERR_DIGEST_ALGO);
-        }
-      else
-        {
-          hash_public_key (md, pripk);
-          hash_uid_packet (packet->pkt.user_id, md, sig);
-          rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-        }
+      /* If the signature was created using SHA-1 we consider this
+       * signature invalid because it makes it possible to mount a
+       * chosen-prefix collision.  We don't do this for
+       * self-signatures, though.  */
+      print_sha1_keysig_rejected_note ();
+      rc = gpg_error (GPG_ERR_DIGEST_ALGO);
     }
   else
     {
-      /* We should never get here.  (The first if above should have
-       * already caught this error.)  */
-      BUG ();
+      hash_key_sig_data (md, sig, pripk, packet, signer);
+      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
     }
 
   gcry_md_close (md);
@@ -1286,3 +1324,371 @@ check_key_signature2 (ctrl_t ctrl,
 
   return rc;
 }
+
+
+/* A public key operation for check_key_signatures_multi.  */
+struct sig_check_job_s
+{
+  PKT_signature *sig;
+  PKT_public_key *signer;
+  unsigned int signer_alloced:1; /* SIGNER was looked up.  */
+  gcry_mpi_t hash;               /* The encoded digest.    */
+  byte cachekey[SIGCACHE_KEYLEN];
+  int rc;
+};
+
+struct sig_check_batch_s
+{
+  npth_mutex_t lock;
+  npth_cond_t cond;       /* Signaled when the last job is done.  */
+  struct sig_check_job_s *jobs;
+  int njobs;
+  int npicked;            /* Number of jobs taken by the threads.  */
+  int ndone;              /* Number of finished jobs.              */
+};
+
+
+static void
+lock_batch (struct sig_check_batch_s *batch)
+{
+  int rc = npth_mutex_lock (&batch->lock);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_batch (struct sig_check_batch_s *batch)
+{
+  int rc = npth_mutex_unlock (&batch->lock);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* The thread function of the batch verification.  It is also run by
+ * the caller's thread.  */
+static void *
+sig_check_worker (void *arg)
+{
+  struct sig_check_batch_s *batch = arg;
+  struct sig_check_job_s *job;
+  int rc;
+
+  lock_batch (batch);
+  while (batch->npicked < batch->njobs)
+    {
+      job = batch->jobs + batch->npicked++;
+      unlock_batch (batch);
+
+      npth_unprotect ();
+      rc = pk_verify (job->signer->pubkey_algo, job->hash,
+                      job->sig->data, job->signer->pkey);
+      npth_protect ();
+
+      lock_batch (batch);
+      job->rc = rc;
+      if (++batch->ndone == batch->njobs)
+        npth_cond_broadcast (&batch->cond);
+    }
+  unlock_batch (batch);
+
+  return NULL;
+}
+
+
+/* Return true if encode_md_value would reject DIGEST_ALGO for the DSA
+ * or ECDSA key PK.  */
+static int
+dsa_digest_unsuitable (PKT_public_key *pk, int digest_algo)
+{
+  size_t qbits;
+
+  if (pk->pubkey_algo != PUBKEY_ALGO_DSA
+      && pk->pubkey_algo != PUBKEY_ALGO_ECDSA)
+    return 0;
+
+  qbits = gcry_mpi_get_nbits (pk->pkey[1]);
+  if (pk->pubkey_algo == PUBKEY_ALGO_ECDSA)
+    {
+      qbits = ecdsa_qbits_from_Q (qbits);
+      if (qbits > 512)
+        qbits = 512;
+    }
+  return ((qbits % 8) || qbits < 160
+          || gcry_md_get_algo_dlen (digest_algo) < qbits/8);
+}
+
+
+/* Prepare JOB for the signature SIG from KEYBLOCK over PACKET.  This
+ * resolves the signer the same way check_key_signature2 does and
+ * computes the digest.  Returns true if a public key operation is
+ * required.  Signatures which would yield a diagnostic or which need
+ * a designated revoker are left to the regular check.  Signatures
+ * not issued by the primary key are only considered if FILTER is
+ * NULL or returns true for them.  */
+static int
+prepare_sig_check_job (ctrl_t ctrl, kbnode_t keyblock, PACKET *packet,
+                       PKT_signature *sig, int selfsigs_only,
+                       int (*filter) (void *, PKT_signature *),
+                       void *filter_arg, struct sig_check_job_s *job)
+{
+  PKT_public_key *pripk = keyblock->pkt->pkt.public_key;
+  PKT_public_key *signer = NULL;
+  kbnode_t n;
+  gcry_md_hd_t md;
+  int is_selfsig;
+
+  memset (job, 0, sizeof *job);
+  job->sig = sig;
+  job->rc = GPG_ERR_NOT_PROCESSED;
+
+  if (!packet || sig->flags.checked || sig->flags.unknown_critical
+      || openpgp_pk_test_algo (sig->pubkey_algo)
+      || openpgp_md_test_algo (sig->digest_algo))
+    return 0;
+  if (!opt.flags.allow_weak_digest_algos && is_weak_digest (sig->digest_algo))
+    return 0;
+
+  is_selfsig = !keyid_cmp (pk_keyid (pripk), sig->keyid);
+  if (selfsigs_only && !is_selfsig)
+    return 0;
+  if (filter && !is_selfsig && !filter (filter_arg, sig))
+    return 0;
+
+  if (IS_KEY_SIG (sig) || IS_SUBKEY_REV (sig))
+    signer = pripk;
+  else if (IS_KEY_REV (sig))
+    {
+      if (!is_selfsig)
+        return 0;
+      signer = pripk;
+    }
+  else if ((IS_UID_SIG (sig) || IS_UID_REV (sig) || IS_SUBKEY_SIG (sig))
+           && is_selfsig)
+    signer = pripk;
+  else if (IS_SUBKEY_SIG (sig) || IS_UID_SIG (sig) || IS_UID_REV (sig))
+    {
+      for (n = keyblock; n && !signer; n = n->next)
+        if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY
+            && !keyid_cmp (pk_keyid (n->pkt->pkt.public_key), sig->keyid))
+          signer = n->pkt->pkt.public_key;
+      if (!signer)
+        {
+          signer = xtrycalloc (1, sizeof *signer);
+          if (!signer)
+            return 0;
+          if (IS_CERT (sig))
+            signer->req_usage = PUBKEY_USAGE_CERT;
+          if (get_pubkey_for_sig (ctrl, signer, sig, NULL))
+            {
+              xfree (signer);
+              return 0;
+            }
+          job->signer_alloced = 1;
+        }
+    }
+  else
+    return 0;
+  job->signer = signer;
+
+  if ((IS_UID_SIG (sig) || IS_UID_REV (sig))
+      && sig->digest_algo == DIGEST_ALGO_SHA1 && signer != pripk
+      && !opt.flags.allow_weak_key_signatures)
+    return 0;
+  if (!signer->flags.primary
+      && IS_CERT (sig) && !(signer->pubkey_usage & PUBKEY_USAGE_CERT))
+    return 0;
+  if (dsa_digest_unsuitable (signer, sig->digest_algo))
+    return 0;
+
+  if (gcry_md_open (&md, sig->digest_algo, 0))
+    return 0;
+  hash_key_sig_data (md, sig, pripk, packet, signer);
+  hash_sig_trailer (sig, md, NULL, 0);
+  if (!sigcache_make_key (signer, sig, md, job->cachekey)
+      && !sigcache_lookup (job->cachekey))
+    job->hash = encode_md_value (signer, md, sig->digest_algo);
+  gcry_md_close (md);
+
+  return !!job->hash;
+}
+
+
+/* Run the public key operations of the NJOBS JOBS using up to
+ * NTHREADS threads including the caller's thread.  */
+static void
+run_sig_check_jobs (struct sig_check_job_s *jobs, int njobs, int nthreads)
+{
+  struct sig_check_batch_s batch;
+  npth_t *threads = NULL;
+  npth_attr_t tattr;
+  int i, rc, nstarted;
+
+  memset (&batch, 0, sizeof batch);
+  batch.jobs = jobs;
+  batch.njobs = njobs;
+
+  if (nthreads > njobs)
+    nthreads = njobs;
+  if (nthreads > 1)
+    threads = xtrycalloc (nthreads - 1, sizeof *threads);
+
+  rc = npth_mutex_init (&batch.lock, NULL);
+  if (!rc)
+    {
+      rc = npth_cond_init (&batch.cond, NULL);
+      if (rc)
+        npth_mutex_destroy (&batch.lock);
+    }
+  if (rc)
+    {
+      /* Let the regular checks do the work.  */
+      log_error ("%s: error initializing mutex: %s\n", __func__,
+                 gpg_strerror (gpg_error_from_errno (rc)));
+      xfree (threads);
+      return;
+    }
+
+  nstarted = 0;
+  if (threads && !npth_attr_init (&tattr))
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      for (i=0; i < nthreads - 1; i++)
+        {
+          rc = npth_create (threads + nstarted, &tattr,
+                            sig_check_worker, &batch);
+          if (rc)
+            {
+              log_info ("only %d of %d signature check threads started: %s\n",
+                        nstarted + 1, nthreads,
+                        gpg_strerror (gpg_error_from_errno (rc)));
+              break;
+            }
+          nstarted++;
+        }
+      npth_attr_destroy (&tattr);
+    }
+
+  sig_check_worker (&batch);
+
+  lock_batch (&batch);
+  while (batch.ndone < batch.njobs)
+    npth_cond_wait (&batch.cond, &batch.lock);
+  unlock_batch (&batch);
+
+  for (i=0; i < nstarted; i++)
+    npth_join (threads[i], NULL);
+  npth_cond_destroy (&batch.cond);
+  npth_mutex_destroy (&batch.lock);
+  xfree (threads);
+}
+
+
+/* Verify the not yet checked key signatures of the NKEYBLOCKS
+ * KEYBLOCKS with OPT.SIG_CHECK_THREADS threads.  The results of the
+ * good signatures are stored in the signature cache so that the
+ * following calls to check_key_signature do not need a public key
+ * operation for them.  Nothing is printed and no flags of the
+ * signatures are changed; a bad signature is thus reported by the
+ * regular check.  If SELFSIGS_ONLY is set only signatures issued by
+ * the primary key are considered and no keys are looked up.  If
+ * FILTER is not NULL other signatures are only considered if FILTER
+ * returns true for them.  */
+void
+check_key_signatures_multi (ctrl_t ctrl, kbnode_t *keyblocks, int nkeyblocks,
+                            int selfsigs_only,
+                            int (*filter) (void *, PKT_signature *),
+                            void *filter_arg)
+{
+  struct sig_check_job_s *jobs;
+  PACKET *keypkt, *subkeypkt, *uidpkt, *packet;
+  PKT_signature *sig;
+  kbnode_t keyblock, n;
+  int i, k, nsigs, njobs;
+
+  if (opt.sig_check_threads < 2 || opt.no_sig_cache)
+    return;
+
+  nsigs = 0;
+  for (k=0; k < nkeyblocks; k++)
+    for (n = keyblocks[k]; n; n = n->next)
+      if (n->pkt->pkttype == PKT_SIGNATURE)
+        nsigs++;
+  if (nsigs < 2)
+    return;
+  jobs = xtrycalloc (nsigs, sizeof *jobs);
+  if (!jobs)
+    return;
+
+  njobs = 0;
+  for (k=0; k < nkeyblocks; k++)
+    {
+      keyblock = keyblocks[k];
+      if (keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+        continue;
+
+      /* The signed packet is determined like find_prev_kbnode does.  */
+      keypkt = keyblock->pkt;
+      subkeypkt = uidpkt = NULL;
+      for (n = keyblock; n; n = n->next)
+        {
+          if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+            subkeypkt = n->pkt;
+          else if (n->pkt->pkttype == PKT_USER_ID)
+            uidpkt = n->pkt;
+          if (n->pkt->pkttype != PKT_SIGNATURE || is_deleted_kbnode (n))
+            continue;
+
+          sig = n->pkt->pkt.signature;
+          if (IS_KEY_SIG (sig) || IS_KEY_REV (sig))
+            packet = keypkt;
+          else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+            packet = subkeypkt;
+          else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
+            packet = uidpkt;
+          else
+            continue;
+
+          if (prepare_sig_check_job (ctrl, keyblock, packet, sig,
+                                     selfsigs_only, filter, filter_arg,
+                                     jobs + njobs))
+            njobs++;
+          else if (jobs[njobs].signer_alloced)
+            {
+              free_public_key (jobs[njobs].signer);
+              jobs[njobs].signer = NULL;
+            }
+        }
+    }
+
+  if (njobs > 1)
+    {
+      if (DBG_CACHE)
+        log_debug ("%s: verifying %d signatures of %d keys with %d threads\n",
+                   __func__, njobs, nkeyblocks, opt.sig_check_threads);
+      run_sig_check_jobs (jobs, njobs, opt.sig_check_threads);
+      for (i=0; i < njobs; i++)
+        if (!jobs[i].rc)
+          sigcache_add (jobs[i].cachekey);
+    }
+
+  for (i=0; i < njobs; i++)
+    {
+      gcry_mpi_release (jobs[i].hash);
+      if (jobs[i].signer_alloced)
+        free_public_key (jobs[i].signer);
+    }
+  xfree (jobs);
+}
+
+
+/* Verify the not yet checked key signatures of KEYBLOCK in parallel.
+ * See check_key_signatures_multi for details.  */
+void
+check_key_signatures_batch (ctrl_t ctrl, kbnode_t keyblock, int selfsigs_only)
+{
+  check_key_signatures_multi (ctrl, &keyblock, 1, selfsigs_only, NULL, NULL);
+}
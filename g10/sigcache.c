@@ -0,0 +1,368 @@
+/* sigcache.c - Persistent cache of verified key signatures
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The signature cache flags of a keyblock are lost whenever the
+ * keyblock is updated and they are not available at all for other
+ * storage formats.  This module keeps a file in the home directory
+ * with the results of successful public key operations for key
+ * signatures.  An entry is the SHA-256 over the signer's
+ * fingerprint, the final digest of the signed data and the signature
+ * itself.  Because a verification depends on nothing else, the mere
+ * presence of the entry tells that the signature is good.  The file
+ * is a header followed by the entries; new entries are appended at
+ * the end of the process.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/dotlock.h"
+#include "../common/host2net.h"
+#include "packet.h"
+#include "keydb.h"
+#include "main.h"
+#include "options.h"
+#include "sigcache.h"
+
+/* The name of the file in the home directory.  */
+#define SIGCACHE_FILENAME "sigcache.bin"
+
+/* The magic at the start of the file.  The last byte is the
+ * version.  */
+#define SIGCACHE_MAGIC "GPGSIGC\x01"
+#define SIGCACHE_MAGICLEN 8
+
+/* If the file holds more entries, it is truncated with the next
+ * save.  This limits the file to 8 MiB.  */
+#define SIGCACHE_MAX_ENTRIES 262144
+
+/* The timeout in milliseconds to wait for the lock when saving.  */
+#define SIGCACHE_LOCK_TIMEOUT 1000
+
+
+/* The hash table with all entries.  Open addressing is used; an
+ * empty slot is all zero.  */
+static const byte zero_key[SIGCACHE_KEYLEN];
+static byte (*table)[SIGCACHE_KEYLEN];
+static size_t table_size;     /* Number of slots; a power of 2.   */
+static size_t table_used;     /* Number of used slots.            */
+static int table_loaded;      /* The file has been read.          */
+static int table_truncate;    /* Rewrite the file when saving.    */
+
+/* The entries not yet written to the file.  */
+static byte (*pending)[SIGCACHE_KEYLEN];
+static size_t pending_size;
+static size_t pending_used;
+
+static struct
+{
+  unsigned int hits;
+  unsigned int misses;
+  unsigned int added;
+} sigcache_stats;
+
+
+
+/* Hash a signature or public key parameter A into MD.  */
+static gpg_error_t
+hash_mpi (gcry_md_hd_t md, gcry_mpi_t a)
+{
+  gpg_error_t err;
+  unsigned char *buf;
+  const unsigned char *p;
+  unsigned int nbits;
+  size_t n;
+
+  if (!a)
+    {
+      gcry_md_putc (md, 0);
+      return 0;
+    }
+
+  if (gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE))
+    {
+      p = gcry_mpi_get_opaque (a, &nbits);
+      gcry_md_putc (md, nbits >> 8);
+      gcry_md_putc (md, nbits);
+      if (p)
+        gcry_md_write (md, p, (nbits+7)/8);
+      return 0;
+    }
+
+  err = gcry_mpi_aprint (GCRYMPI_FMT_PGP, &buf, &n, a);
+  if (err)
+    return err;
+  gcry_md_write (md, buf, n);
+  gcry_free (buf);
+  return 0;
+}
+
+
+/* Compute the cache key for the signature SIG by PK and store it at
+ * R_KEY which must provide SIGCACHE_KEYLEN bytes.  DIGEST is the
+ * final digest of the signed data as used for the verification.  */
+gpg_error_t
+sigcache_make_key (PKT_public_key *pk, PKT_signature *sig,
+                   gcry_md_hd_t digest, byte *r_key)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  const byte *dp;
+  int i, nsig, dlen;
+
+  dlen = gcry_md_get_algo_dlen (sig->digest_algo);
+  dp = gcry_md_read (digest, sig->digest_algo);
+  nsig = pubkey_get_nsig (sig->pubkey_algo);
+  if (!dlen || !dp || !nsig)
+    return gpg_error (GPG_ERR_DIGEST_ALGO);
+
+  err = gcry_md_open (&md, GCRY_MD_SHA256, 0);
+  if (err)
+    return err;
+
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  gcry_md_putc (md, fprlen);
+  gcry_md_write (md, fpr, fprlen);
+  gcry_md_putc (md, sig->pubkey_algo);
+  gcry_md_putc (md, sig->digest_algo);
+  gcry_md_write (md, dp, dlen);
+  for (i = 0; !err && i < nsig; i++)
+    err = hash_mpi (md, sig->data[i]);
+  if (!err)
+    memcpy (r_key, gcry_md_read (md, GCRY_MD_SHA256), SIGCACHE_KEYLEN);
+
+  gcry_md_close (md);
+  return err;
+}
+
+
+/* Return the slot for KEY in the hash table.  This is either the
+ * slot with KEY or the empty slot where it is to be inserted.  */
+static byte *
+find_slot (const byte *key)
+{
+  size_t idx;
+
+  idx = buf32_to_size_t (key) & (table_size - 1);
+  while (memcmp (table[idx], zero_key, SIGCACHE_KEYLEN)
+         && memcmp (table[idx], key, SIGCACHE_KEYLEN))
+    idx = (idx + 1) & (table_size - 1);
+  return table[idx];
+}
+
+
+/* Insert KEY into the table.  Returns true if the key is new.  */
+static int
+table_insert (const byte *key)
+{
+  byte (*oldtable)[SIGCACHE_KEYLEN];
+  size_t oldsize, n;
+  byte *slot;
+
+  /* Keep the table at most half full.  */
+  if (2 * (table_used + 1) > table_size)
+    {
+      oldtable = table;
+      oldsize = table_size;
+      table_size = oldsize? 2 * oldsize : 1024;
+      table = xtrycalloc (table_size, SIGCACHE_KEYLEN);
+      if (!table)
+        {
+          /* This is only a cache; continue with the old table.  */
+          table = oldtable;
+          table_size = oldsize;
+          if (!table || table_used + 1 >= table_size)
+            return 0;
+        }
+      else
+        {
+          for (n = 0; n < oldsize; n++)
+            if (memcmp (oldtable[n], zero_key, SIGCACHE_KEYLEN))
+              memcpy (find_slot (oldtable[n]), oldtable[n],
+                      SIGCACHE_KEYLEN);
+          xfree (oldtable);
+        }
+    }
+
+  slot = find_slot (key);
+  if (!memcmp (slot, key, SIGCACHE_KEYLEN))
+    return 0;
+  memcpy (slot, key, SIGCACHE_KEYLEN);
+  table_used++;
+  return 1;
+}
+
+
+/* Read the cache file into the table.  */
+static void
+load_table (void)
+{
+  char *fname;
+  estream_t fp;
+  byte buf[SIGCACHE_KEYLEN];
+  size_t count = 0;
+
+  table_loaded = 1;
+  fname = make_filename (gnupg_homedir (), SIGCACHE_FILENAME, NULL);
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      if (errno != ENOENT && DBG_CACHE)
+        log_debug ("can't open '%s': %s\n", fname, strerror (errno));
+      xfree (fname);
+      return;
+    }
+
+  if (es_fread (buf, SIGCACHE_MAGICLEN, 1, fp) != 1
+      || memcmp (buf, SIGCACHE_MAGIC, SIGCACHE_MAGICLEN))
+    {
+      /* Unknown version or garbage.  */
+      table_truncate = 1;
+      goto leave;
+    }
+
+  while (es_fread (buf, SIGCACHE_KEYLEN, 1, fp) == 1)
+    {
+      if (++count > SIGCACHE_MAX_ENTRIES)
+        {
+          table_truncate = 1;
+          break;
+        }
+      if (memcmp (buf, zero_key, SIGCACHE_KEYLEN))
+        table_insert (buf);
+    }
+
+ leave:
+  es_fclose (fp);
+  if (DBG_CACHE)
+    log_debug ("%s: loaded %zu entries from '%s'\n",
+               __func__, table_used, fname);
+  xfree (fname);
+}
+
+
+/* Return true if KEY is known to belong to a good signature.  */
+int
+sigcache_lookup (const byte *key)
+{
+  if (opt.no_sig_cache)
+    return 0;
+  if (!table_loaded)
+    load_table ();
+
+  if (table && !memcmp (find_slot (key), key, SIGCACHE_KEYLEN))
+    {
+      sigcache_stats.hits++;
+      return 1;
+    }
+  sigcache_stats.misses++;
+  return 0;
+}
+
+
+/* Record that KEY belongs to a good signature.  */
+void
+sigcache_add (const byte *key)
+{
+  void *tmp;
+
+  if (opt.no_sig_cache)
+    return;
+  if (!table_loaded)
+    load_table ();
+  if (!table_insert (key))
+    return;
+
+  if (pending_used == pending_size)
+    {
+      tmp = xtryrealloc (pending, (pending_size + 256) * SIGCACHE_KEYLEN);
+      if (!tmp)
+        return;
+      pending = tmp;
+      pending_size += 256;
+    }
+  memcpy (pending[pending_used++], key, SIGCACHE_KEYLEN);
+  sigcache_stats.added++;
+}
+
+
+/* Append the new entries to the cache file.  This is called at the
+ * end of the process.  Errors are ignored.  */
+void
+sigcache_save (void)
+{
+  char *fname;
+  dotlock_t lockhd = NULL;
+  estream_t fp = NULL;
+  off_t off;
+
+  if (!pending_used || opt.dry_run)
+    return;
+
+  fname = make_filename (gnupg_homedir (), SIGCACHE_FILENAME, NULL);
+  lockhd = dotlock_create (fname, 0);
+  if (!lockhd || dotlock_take (lockhd, SIGCACHE_LOCK_TIMEOUT))
+    goto leave;
+
+  fp = es_fopen (fname, table_truncate? "wb" : "ab");
+  if (!fp)
+    {
+      if (DBG_CACHE)
+        log_debug ("can't create '%s': %s\n", fname, strerror (errno));
+      goto leave;
+    }
+  if (es_fseeko (fp, 0, SEEK_END) || (off = es_ftello (fp)) < 0)
+    goto leave;
+  if (!off)
+    es_fwrite (SIGCACHE_MAGIC, SIGCACHE_MAGICLEN, 1, fp);
+  else if ((off - SIGCACHE_MAGICLEN) % SIGCACHE_KEYLEN)
+    goto leave;  /* Corrupted - don't make it worse.  */
+  es_fwrite (pending, SIGCACHE_KEYLEN, pending_used, fp);
+  if (es_fclose (fp))
+    log_info ("error writing '%s': %s\n", fname, strerror (errno));
+  fp = NULL;
+  pending_used = 0;
+  table_truncate = 0;
+
+ leave:
+  es_fclose (fp);
+  if (lockhd)
+    {
+      dotlock_release (lockhd);
+      dotlock_destroy (lockhd);
+    }
+  xfree (fname);
+}
+
+
+void
+sigcache_dump_stats (void)
+{
+  log_info ("sigcache: %zu entries, %u hits, %u misses, %u added\n",
+            table_used, sigcache_stats.hits, sigcache_stats.misses,
+            sigcache_stats.added);
+}
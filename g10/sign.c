@@ -1016,10 +1016,15 @@ write_signature_packets (ctrl_t ctrl,
  * If OUTFILE is not NULL; this file is used for output and the function
  * does not ask for overwrite permission; output is then always
  * uncompressed, non-armored and in binary mode.
+ * If INP_FD is valid, FILENAMES must be NULL and the data is read
+ * from that file descriptor.  If OUT_FD is valid and OUTFILE is NULL
+ * the output is written to that file descriptor.
  */
-int
-sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
-	   int encryptflag, strlist_t remusr, const char *outfile )
+static int
+do_sign_file (ctrl_t ctrl, strlist_t filenames,
+              gnupg_fd_t inp_fd, gnupg_fd_t out_fd, int detached,
+              strlist_t locusr, int encryptflag, strlist_t remusr,
+              const char *outfile)
 {
   const char *fname;
   armor_filter_context_t *afx;
@@ -1081,6 +1086,20 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
   /* Prepare iobufs. */
   if (multifile)    /* have list of filenames */
     inp = NULL;     /* we do it later */
+  else if (inp_fd != GNUPG_INVALID_FD)
+    {
+      inp = iobuf_fdopen_nc (inp_fd, "rb");
+      if (!inp)
+        {
+          char xname[64];
+
+          rc = gpg_error_from_syserror ();
+          snprintf (xname, sizeof xname, "[fd %d]", FD_DBG (inp_fd));
+          log_error (_("can't open '%s': %s\n"), xname, gpg_strerror (rc));
+          goto leave;
+        }
+      handle_progress (pfx, inp, NULL);
+    }
   else
     {
       inp = iobuf_open(fname);
@@ -1119,7 +1138,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
       else if (opt.verbose)
         log_info (_("writing to '%s'\n"), outfile);
     }
-  else if ((rc = open_outfile (GNUPG_INVALID_FD, fname,
+  else if ((rc = open_outfile (out_fd, fname,
                                opt.armor? 1 : detached? 2 : 0, 0, &out)))
     {
       goto leave;
@@ -1236,7 +1255,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 
   if (!multifile)
     {
-      if (encryptflag && (opt.compat_flags & COMPAT_PARALLELIZED))
+      if ((opt.compat_flags & COMPAT_PARALLELIZED))
         {
           iobuf_push_filter (inp, md_thd_filter, &mfx2);
           md_thd_filter_set_md (mfx2, md);
@@ -1266,7 +1285,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
       int compr_algo = opt.compress_algo;
 
       if (!opt.explicit_compress_option
-          && is_file_compressed (inp))
+          && (is_file_compressed (inp) || !compress_probe (inp)))
         {
           if (opt.verbose)
             log_info(_("'%s' already compressed\n"), fname? fname: "[stdin]");
@@ -1349,7 +1368,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
                   memset (&tfx, 0, sizeof tfx);
                   iobuf_push_filter (inp, text_filter, &tfx);
                 }
-              if (encryptflag && (opt.compat_flags & COMPAT_PARALLELIZED))
+              if ((opt.compat_flags & COMPAT_PARALLELIZED))
                 {
                   iobuf_push_filter (inp, md_thd_filter, &mfx2);
                   md_thd_filter_set_md (mfx2, md);
@@ -1415,6 +1434,33 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 }
 
 
+/*
+ * Sign the files whose names are in FILENAMES.  See do_sign_file for
+ * a description of the arguments.
+ */
+int
+sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
+	   int encryptflag, strlist_t remusr, const char *outfile )
+{
+  return do_sign_file (ctrl, filenames, GNUPG_INVALID_FD, GNUPG_INVALID_FD,
+                       detached, locusr, encryptflag, remusr, outfile);
+}
+
+
+/*
+ * Sign the data read from INP_FD using the secret keys taken from
+ * LOCUSR and write the signed data or, if DETACHED is set, a
+ * detached signature to OUT_FD.  This is used by the server mode.
+ */
+int
+sign_fd (ctrl_t ctrl, gnupg_fd_t inp_fd, gnupg_fd_t out_fd, int detached,
+         strlist_t locusr)
+{
+  return do_sign_file (ctrl, NULL, inp_fd, out_fd, detached, locusr,
+                       0, NULL, NULL);
+}
+
+
 /*
  * Make a clear signature.  Note that opt.armor is not needed.
  */
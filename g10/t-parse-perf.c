@@ -0,0 +1,313 @@
+/* t-parse-perf.c - Performance regression test for the packet parser
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This test feeds synthetic adversarial inputs of two sizes through
+ * parse_packet and through the packet processing of a verify
+ * operation.  The test fails if the time per byte of the large input
+ * is much higher than the time per byte of the small input; i.e. if
+ * the parser shows superlinear behaviour.  Files given on the command
+ * line are additionally run once and their time per byte is
+ * printed; this can be used with a corpus of real world messages.
+ * The timings are printed if the envvar "verbose" is set or files
+ * are given.  Because the result depends on the load of the machine
+ * this test is not run by "make check" but by "make check-perf".  */
+
+#include <config.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "gpg.h"
+#include "main.h"
+#include "packet.h"
+#include "options.h"
+#include "../common/membuf.h"
+
+#include "test.c"
+
+
+/* The factor between the small and the large input.  */
+#define SCALE 16
+
+/* The time per byte of the large input may be this many times the
+ * time per byte of the small input.  A quadratic algorithm has a
+ * factor of SCALE.  */
+#define MAX_SLOWDOWN 4
+
+/* Each measurement is repeated this many times and the fastest run
+ * is used.  */
+#define RUNS 3
+
+
+/* Return a monotonic time stamp in nanoseconds.  */
+static unsigned long long
+perf_time (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER count;
+
+  if (!freq.QuadPart && !QueryPerformanceFrequency (&freq))
+    return 0;
+  QueryPerformanceCounter (&count);
+  return (unsigned long long)(count.QuadPart / (freq.QuadPart / 1e9));
+#else
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts))
+    return 0;
+  return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+/* Write a literal data packet with partial body lengths.  The first
+ * chunk has 512 bytes, followed by N chunks of 2^K bytes each.  */
+static void
+put_partial_literal (membuf_t *mb, unsigned int n, int k)
+{
+  unsigned char chunk[512];
+  unsigned int i;
+
+  memset (chunk, 'x', sizeof chunk);
+  /* Format 'b', no file name and a time stamp.  */
+  chunk[0] = 'b';
+  chunk[1] = 0;
+  chunk[2] = 0x60;
+
+  put_membuf (mb, "\xcb\xe9", 2);
+  put_membuf (mb, chunk, 512);
+  for (i = 0; i < n; i++)
+    {
+      unsigned char ctb = 0xe0 + k;
+
+      put_membuf (mb, &ctb, 1);
+      put_membuf (mb, chunk, 1 << k);
+    }
+  /* The last chunk is empty.  */
+  put_membuf (mb, "", 1);
+}
+
+
+/* N marker packets.  */
+static void
+gen_markers (membuf_t *mb, unsigned int n)
+{
+  unsigned int i;
+
+  for (i = 0; i < n; i++)
+    put_membuf (mb, "\xa8\x03PGP", 5);
+}
+
+/* A huge literal data packet with partial body lengths.  */
+static void
+gen_partial (membuf_t *mb, unsigned int n)
+{
+  put_partial_literal (mb, n, 9);
+}
+
+/* A literal data packet with one byte partial body lengths.  */
+static void
+gen_tiny_partial (membuf_t *mb, unsigned int n)
+{
+  put_partial_literal (mb, n, 0);
+}
+
+/* Nested uncompressed compressed packets of indeterminate length
+ * with a literal data packet at the bottom.  */
+static void
+gen_nested (membuf_t *mb, unsigned int n)
+{
+  int i;
+
+  for (i = 0; i < 16; i++)
+    put_membuf (mb, "\xa3\x00", 2);
+  put_partial_literal (mb, n, 9);
+}
+
+
+static struct
+{
+  const char *name;
+  void (*generate) (membuf_t *mb, unsigned int n);
+  unsigned int n;                     /* The size of the small input.  */
+} generators[] =
+  {
+    { "markers",      gen_markers,      10000 },
+    { "partial",      gen_partial,        256 },
+    { "tiny-partial", gen_tiny_partial, 20000 },
+    { "nested",       gen_nested,         256 },
+    { NULL }
+  };
+
+
+/* Run parse_packet over the LEN bytes at DATA.  */
+static void
+run_parse (ctrl_t ctrl, const char *data, size_t len)
+{
+  struct parse_packet_ctx_s parsectx;
+  PACKET pkt;
+  iobuf_t inp;
+
+  (void)ctrl;
+
+  inp = iobuf_temp_with_content (data, len);
+  init_packet (&pkt);
+  init_parse_packet (&parsectx, inp);
+  while (parse_packet (&parsectx, &pkt) != -1)
+    free_packet (&pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  iobuf_close (inp);
+}
+
+/* Run the packet processing of a verify operation over the LEN bytes
+ * at DATA.  */
+static void
+run_proc (ctrl_t ctrl, const char *data, size_t len)
+{
+  iobuf_t inp;
+
+  inp = iobuf_temp_with_content (data, len);
+  reset_literals_seen ();
+  proc_signature_packets (ctrl, NULL, inp, NULL, NULL);
+  iobuf_close (inp);
+}
+
+
+/* Return the best time per byte in ns of RUN over DATA.  */
+static double
+measure (ctrl_t ctrl, void (*run) (ctrl_t, const char *, size_t),
+         const char *data, size_t len)
+{
+  unsigned long long t0, t, best = 0;
+  int i;
+
+  for (i = 0; i < RUNS; i++)
+    {
+      t0 = perf_time ();
+      run (ctrl, data, len);
+      t = perf_time () - t0;
+      if (!i || t < best)
+        best = t;
+    }
+  return (double)best / (len? len : 1);
+}
+
+
+static void
+check_generator (ctrl_t ctrl, int idx)
+{
+  static struct
+  {
+    const char *name;
+    void (*run) (ctrl_t, const char *, size_t);
+  } stages[] = { { "parse", run_parse }, { "proc", run_proc } };
+  membuf_t mb;
+  char *small, *large;
+  size_t smalllen, largelen;
+  double tsmall, tlarge;
+  int i;
+
+  init_membuf (&mb, 4096);
+  generators[idx].generate (&mb, generators[idx].n);
+  small = get_membuf (&mb, &smalllen);
+  init_membuf (&mb, 4096);
+  generators[idx].generate (&mb, generators[idx].n * SCALE);
+  large = get_membuf (&mb, &largelen);
+  if (!small || !large)
+    ABORT ("out of core");
+
+  for (i = 0; i < DIM (stages); i++)
+    {
+      tsmall = measure (ctrl, stages[i].run, small, smalllen);
+      tlarge = measure (ctrl, stages[i].run, large, largelen);
+      if (verbose)
+        printf ("%-6s %-13s %9zu bytes %8.2f ns/byte"
+                " %9zu bytes %8.2f ns/byte\n",
+                stages[i].name, generators[idx].name,
+                smalllen, tsmall, largelen, tlarge);
+      TEST_P (generators[idx].name, tlarge <= tsmall * MAX_SLOWDOWN);
+    }
+
+  xfree (small);
+  xfree (large);
+}
+
+
+static void
+check_file (ctrl_t ctrl, const char *fname)
+{
+  FILE *fp;
+  struct stat st;
+  char *data;
+  double tparse, tproc;
+
+  fp = fopen (fname, "rb");
+  if (!fp || fstat (fileno (fp), &st))
+    {
+      printf ("can't open '%s': %s\n", fname, strerror (errno));
+      exit_tests (1);
+    }
+  data = xmalloc (st.st_size + 1);
+  if (st.st_size && fread (data, st.st_size, 1, fp) != 1)
+    {
+      printf ("error reading '%s': %s\n", fname, strerror (errno));
+      exit_tests (1);
+    }
+  fclose (fp);
+
+  tparse = measure (ctrl, run_parse, data, st.st_size);
+  tproc = measure (ctrl, run_proc, data, st.st_size);
+  printf ("%-40s %9lu bytes %8.2f ns/byte parse %8.2f ns/byte proc\n",
+          fname, (unsigned long)st.st_size, tparse, tproc);
+  xfree (data);
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  ctrl_t ctrl;
+  int i;
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  if (argc > 1)
+    verbose = 1;
+
+  /* The processing logs an error for each input without a
+   * signature.  */
+  if (!verbose)
+    log_set_file ("/dev/null");
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+
+  for (i = 0; generators[i].name; i++)
+    {
+      TEST_GROUP ((char *)generators[i].name);
+      check_generator (ctrl, i);
+    }
+
+  for (i = 1; i < argc; i++)
+    check_file (ctrl, argv[i]);
+
+  xfree (ctrl);
+}
@@ -0,0 +1,619 @@
+/* tdbdeps.c - Certification index for the trustdb
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Each round of validate_keys needs the keys certified by the keys
+ * which became valid in the previous round.  Without help this
+ * requires a scan over the entire key database for each round.  This
+ * module maintains a file in the home directory which maps the keyid
+ * of a certifying key to the fingerprints of the keys it certified.
+ * The index is written after a complete scan of the key database and
+ * is then kept up to date by the keydb update functions.  Its header
+ * carries the state of the key database (see keydb_get_state) it
+ * belongs to; if the key database has been changed behind our back
+ * the index is not used and the next validation is done the old way.
+ * The index may list certifications which do not exist anymore;
+ * those only yield additional candidates.
+ *
+ * File format (all integers are big endian):
+ *
+ *   byte  0-7   magic "GPGTDEP\x01"
+ *   byte  8-27  state of the key database
+ *   byte 28-31  reserved
+ *
+ * followed by records of this form:
+ *
+ *   byte  0-7   keyid of the certifying key
+ *   byte  8     length of the fingerprint
+ *   byte  9-11  reserved
+ *   byte 12-43  fingerprint of the certified key, zero padded
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/dotlock.h"
+#include "../common/host2net.h"
+#include "../common/sysutils.h"
+#include "packet.h"
+#include "keydb.h"
+#include "main.h"
+#include "options.h"
+#include "tdbdeps.h"
+
+/* The name of the file in the home directory.  */
+#define TDBDEPS_FILENAME "tdbdeps.bin"
+
+/* The magic at the start of the file.  The last byte is the
+ * version.  */
+#define TDBDEPS_MAGIC "GPGTDEP\x01"
+#define TDBDEPS_MAGICLEN 8
+
+#define TDBDEPS_HDRLEN  (TDBDEPS_MAGICLEN + KEYDB_STATELEN + 4)
+#define TDBDEPS_RECLEN  44
+
+/* The number of buckets of the hash table.  Must be a power of 2.  */
+#define TDBDEPS_BUCKETS 65536
+
+/* The timeout in milliseconds to wait for the lock.  */
+#define TDBDEPS_LOCK_TIMEOUT 2000
+
+
+/* A certification of the key with fingerprint FPR by the key KID.  */
+struct dep_s
+{
+  struct dep_s *next;
+  u32 kid[2];
+  byte fprlen;
+  byte fpr[MAX_FINGERPRINT_LEN];
+};
+
+/* The hash table with all certifications indexed by KID.  */
+static struct dep_s **table;
+static int table_loaded;         /* TABLE mirrors the file.          */
+static unsigned long table_ino;  /* Inode and size of that file.     */
+static off_t table_fsize;
+
+/* Set while validate_keys is scanning the key database.  */
+static int rebuilding;
+static unsigned char rebuild_state[KEYDB_STATELEN];
+
+
+
+static char *
+deps_fname (void)
+{
+  return make_filename (gnupg_homedir (), TDBDEPS_FILENAME, NULL);
+}
+
+
+static void
+release_table (void)
+{
+  struct dep_s *d, *d2;
+  size_t n;
+
+  if (table)
+    {
+      for (n=0; n < TDBDEPS_BUCKETS; n++)
+        for (d = table[n]; d; d = d2)
+          {
+            d2 = d->next;
+            xfree (d);
+          }
+      xfree (table);
+    }
+  table = NULL;
+  table_loaded = 0;
+}
+
+
+/* Create an empty table.  */
+static gpg_error_t
+new_table (void)
+{
+  release_table ();
+  table = xtrycalloc (TDBDEPS_BUCKETS, sizeof *table);
+  if (!table)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Insert the certification of FPR by KID into the table.  Returns 1
+ * if it is new, 0 if it was already known and -1 on error. */
+static int
+table_insert (u32 *kid, const byte *fpr, size_t fprlen)
+{
+  struct dep_s *d, **bucket;
+
+  bucket = table + (kid[1] & (TDBDEPS_BUCKETS - 1));
+  for (d = *bucket; d; d = d->next)
+    if (d->kid[0] == kid[0] && d->kid[1] == kid[1]
+        && d->fprlen == fprlen && !memcmp (d->fpr, fpr, fprlen))
+      return 0;
+
+  d = xtrycalloc (1, sizeof *d);
+  if (!d)
+    return -1;
+  d->kid[0] = kid[0];
+  d->kid[1] = kid[1];
+  d->fprlen = fprlen;
+  memcpy (d->fpr, fpr, fprlen);
+  d->next = *bucket;
+  *bucket = d;
+  return 1;
+}
+
+
+/* Call FNC for each third-party user id certification in
+ * KEYBLOCK.  */
+static void
+enum_certs (kbnode_t keyblock,
+            void (*fnc) (void *opaque, u32 *kid,
+                         const byte *fpr, size_t fprlen),
+            void *opaque)
+{
+  kbnode_t node;
+  PKT_public_key *pk;
+  PKT_signature *sig;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  u32 main_kid[2];
+  int in_uid = 0;
+
+  if (!keyblock || keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    return;
+  pk = keyblock->pkt->pkt.public_key;
+  keyid_from_pk (pk, main_kid);
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  if (fprlen != 20 && fprlen != 32)
+    return;  /* Legacy keys are not part of the WoT.  */
+
+  for (node = keyblock->next; node; node = node->next)
+    {
+      if (node->pkt->pkttype == PKT_USER_ID)
+        in_uid = 1;
+      else if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        in_uid = 0;
+      else if (in_uid && node->pkt->pkttype == PKT_SIGNATURE)
+        {
+          sig = node->pkt->pkt.signature;
+          if (IS_UID_SIG (sig)
+              && (sig->keyid[0] != main_kid[0]
+                  || sig->keyid[1] != main_kid[1]))
+            fnc (opaque, sig->keyid, fpr, fprlen);
+        }
+    }
+}
+
+
+static void
+make_rec (byte *buf, u32 *kid, const byte *fpr, size_t fprlen)
+{
+  memset (buf, 0, TDBDEPS_RECLEN);
+  buf[0] = kid[0] >> 24;
+  buf[1] = kid[0] >> 16;
+  buf[2] = kid[0] >>  8;
+  buf[3] = kid[0];
+  buf[4] = kid[1] >> 24;
+  buf[5] = kid[1] >> 16;
+  buf[6] = kid[1] >>  8;
+  buf[7] = kid[1];
+  buf[8] = fprlen;
+  memcpy (buf + 12, fpr, fprlen);
+}
+
+
+/* Read the header of the index file FP and store the keydb state at
+ * R_STATE.  Returns false if this is not a valid index.  */
+static int
+read_header (estream_t fp, unsigned char *r_state)
+{
+  byte buf[TDBDEPS_HDRLEN];
+
+  if (es_fseeko (fp, 0, SEEK_SET)
+      || es_fread (buf, TDBDEPS_HDRLEN, 1, fp) != 1
+      || memcmp (buf, TDBDEPS_MAGIC, TDBDEPS_MAGICLEN))
+    return 0;
+  memcpy (r_state, buf + TDBDEPS_MAGICLEN, KEYDB_STATELEN);
+  return 1;
+}
+
+
+/* Read all records from the index file FNAME, which has been opened
+ * as FP, into a new table.  */
+static gpg_error_t
+load_table (const char *fname, estream_t fp)
+{
+  gpg_error_t err;
+  struct stat st;
+  byte buf[TDBDEPS_RECLEN];
+  u32 kid[2];
+  size_t count = 0;
+
+  if (gnupg_stat (fname, &st))
+    return gpg_error_from_syserror ();
+  if (st.st_size < TDBDEPS_HDRLEN
+      || (st.st_size - TDBDEPS_HDRLEN) % TDBDEPS_RECLEN)
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  err = new_table ();
+  if (err)
+    return err;
+  if (es_fseeko (fp, TDBDEPS_HDRLEN, SEEK_SET))
+    return gpg_error_from_syserror ();
+  while (es_fread (buf, TDBDEPS_RECLEN, 1, fp) == 1)
+    {
+      if (!buf[8] || buf[8] > MAX_FINGERPRINT_LEN)
+        {
+          release_table ();
+          return gpg_error (GPG_ERR_INV_DATA);
+        }
+      kid[0] = buf32_to_u32 (buf);
+      kid[1] = buf32_to_u32 (buf + 4);
+      if (table_insert (kid, buf + 12, buf[8]) < 0)
+        {
+          err = gpg_error_from_syserror ();
+          release_table ();
+          return err;
+        }
+      count++;
+    }
+
+  table_loaded = 1;
+  table_ino = st.st_ino;
+  table_fsize = st.st_size;
+  if (DBG_TRUST)
+    log_debug ("%s: loaded %zu records from '%s'\n", __func__, count, fname);
+  return 0;
+}
+
+
+static dotlock_t
+take_lock (const char *fname)
+{
+  dotlock_t lockhd;
+
+  lockhd = dotlock_create (fname, 0);
+  if (lockhd && dotlock_take (lockhd, TDBDEPS_LOCK_TIMEOUT))
+    {
+      dotlock_destroy (lockhd);
+      lockhd = NULL;
+    }
+  return lockhd;
+}
+
+
+static void
+release_lock (dotlock_t lockhd)
+{
+  if (lockhd)
+    {
+      dotlock_release (lockhd);
+      dotlock_destroy (lockhd);
+    }
+}
+
+
+/* Load the index and return true if it can be used for the current
+ * key database.  */
+int
+tdbdeps_usable (void)
+{
+  unsigned char state[KEYDB_STATELEN], filestate[KEYDB_STATELEN];
+  char *fname;
+  dotlock_t lockhd = NULL;
+  estream_t fp = NULL;
+  int okay = 0;
+
+  release_table ();
+  if (keydb_get_state (state))
+    return 0;
+
+  fname = deps_fname ();
+  lockhd = take_lock (fname);
+  if (!lockhd)
+    goto leave;
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    goto leave;
+  if (!read_header (fp, filestate)
+      || memcmp (state, filestate, KEYDB_STATELEN))
+    {
+      if (DBG_TRUST)
+        log_debug ("%s: index is stale\n", __func__);
+      goto leave;
+    }
+  if (load_table (fname, fp))
+    goto leave;
+  okay = 1;
+
+ leave:
+  es_fclose (fp);
+  release_lock (lockhd);
+  xfree (fname);
+  return okay;
+}
+
+
+/* Start a new index.  validate_keys calls this before scanning the
+ * key database and passes each keyblock to tdbdeps_add_keyblock.  */
+void
+tdbdeps_begin_rebuild (void)
+{
+  rebuilding = 0;
+  if (opt.dry_run || keydb_get_state (rebuild_state))
+    return;
+  if (new_table ())
+    return;
+  rebuilding = 1;
+}
+
+
+/* Return true if an index is being built.  */
+int
+tdbdeps_rebuilding (void)
+{
+  return rebuilding;
+}
+
+
+static void
+rebuild_cb (void *opaque, u32 *kid, const byte *fpr, size_t fprlen)
+{
+  (void)opaque;
+
+  if (rebuilding && table_insert (kid, fpr, fprlen) < 0)
+    {
+      /* Out of core - give up.  */
+      rebuilding = 0;
+      release_table ();
+    }
+}
+
+
+void
+tdbdeps_add_keyblock (kbnode_t keyblock)
+{
+  if (rebuilding)
+    enum_certs (keyblock, rebuild_cb, NULL);
+}
+
+
+/* Finish the rebuild started by tdbdeps_begin_rebuild.  If COMMIT is
+ * set the collected index is written.  */
+void
+tdbdeps_end_rebuild (int commit)
+{
+  char *fname, *tmpfname = NULL;
+  dotlock_t lockhd = NULL;
+  estream_t fp = NULL;
+  struct stat st;
+  struct dep_s *d;
+  byte buf[TDBDEPS_RECLEN];
+  size_t n;
+  int okay = 0;
+
+  if (!rebuilding)
+    return;
+  rebuilding = 0;
+  if (!commit)
+    {
+      release_table ();
+      return;
+    }
+
+  fname = deps_fname ();
+  lockhd = take_lock (fname);
+  if (!lockhd)
+    goto leave;
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  fp = es_fopen (tmpfname, "wb");
+  if (!fp)
+    {
+      if (DBG_TRUST)
+        log_debug ("can't create '%s': %s\n", tmpfname, strerror (errno));
+      goto leave;
+    }
+
+  memset (buf, 0, TDBDEPS_HDRLEN);
+  memcpy (buf, TDBDEPS_MAGIC, TDBDEPS_MAGICLEN);
+  memcpy (buf + TDBDEPS_MAGICLEN, rebuild_state, KEYDB_STATELEN);
+  es_fwrite (buf, TDBDEPS_HDRLEN, 1, fp);
+  for (n=0; n < TDBDEPS_BUCKETS; n++)
+    for (d = table[n]; d; d = d->next)
+      {
+        make_rec (buf, d->kid, d->fpr, d->fprlen);
+        es_fwrite (buf, TDBDEPS_RECLEN, 1, fp);
+      }
+  if (es_fclose (fp))
+    {
+      log_info ("error writing '%s': %s\n", tmpfname, strerror (errno));
+      fp = NULL;
+      goto leave;
+    }
+  fp = NULL;
+  if (gnupg_rename_file (tmpfname, fname, NULL) || gnupg_stat (fname, &st))
+    goto leave;
+
+  table_loaded = 1;
+  table_ino = st.st_ino;
+  table_fsize = st.st_size;
+  okay = 1;
+
+ leave:
+  es_fclose (fp);
+  if (!okay)
+    {
+      if (tmpfname)
+        gnupg_remove (tmpfname);
+      release_table ();
+    }
+  release_lock (lockhd);
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
+/* Return search descriptions for the keys certified by the key KID.
+ * The caller must release the array at R_DESCS.  */
+gpg_error_t
+tdbdeps_get_signees (u32 *kid, KEYDB_SEARCH_DESC **r_descs, size_t *r_ndescs)
+{
+  KEYDB_SEARCH_DESC *descs;
+  struct dep_s *d, *bucketstart;
+  size_t n;
+
+  *r_descs = NULL;
+  *r_ndescs = 0;
+  if (!table || (!table_loaded && !rebuilding))
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  bucketstart = table[kid[1] & (TDBDEPS_BUCKETS - 1)];
+  for (n=0, d = bucketstart; d; d = d->next)
+    if (d->kid[0] == kid[0] && d->kid[1] == kid[1])
+      n++;
+  if (!n)
+    return 0;
+
+  descs = xtrycalloc (n, sizeof *descs);
+  if (!descs)
+    return gpg_error_from_syserror ();
+  for (n=0, d = bucketstart; d; d = d->next)
+    if (d->kid[0] == kid[0] && d->kid[1] == kid[1])
+      {
+        descs[n].mode = KEYDB_SEARCH_MODE_FPR;
+        descs[n].fprlen = d->fprlen;
+        memcpy (descs[n].u.fpr, d->fpr, d->fprlen);
+        n++;
+      }
+
+  *r_descs = descs;
+  *r_ndescs = n;
+  return 0;
+}
+
+
+struct append_parm_s
+{
+  estream_t fp;
+  int error;
+};
+
+static void
+append_cb (void *opaque, u32 *kid, const byte *fpr, size_t fprlen)
+{
+  struct append_parm_s *parm = opaque;
+  byte buf[TDBDEPS_RECLEN];
+  int rc = -1;
+
+  if (table_loaded)
+    {
+      rc = table_insert (kid, fpr, fprlen);
+      if (!rc)
+        return;  /* Already in the file.  */
+      if (rc < 0)
+        release_table ();
+    }
+  make_rec (buf, kid, fpr, fprlen);
+  if (es_fwrite (buf, TDBDEPS_RECLEN, 1, parm->fp) != 1)
+    parm->error = 1;
+}
+
+
+/* This is called by the keydb update functions after KEYBLOCK has
+ * been stored or a keyblock has been deleted (KEYBLOCK is NULL).
+ * OLDSTATE is the state of the key database before that change.  If
+ * the index is up to date with OLDSTATE the certifications of
+ * KEYBLOCK are added and it is marked as up to date with the new
+ * state.  The caller must hold the keydb lock.  */
+void
+tdbdeps_keydb_changed (const unsigned char *oldstate, kbnode_t keyblock)
+{
+  unsigned char state[KEYDB_STATELEN], filestate[KEYDB_STATELEN];
+  char *fname;
+  dotlock_t lockhd = NULL;
+  struct append_parm_s parm;
+  struct stat st;
+
+  memset (&parm, 0, sizeof parm);
+  if (keydb_get_state (state))
+    return;
+
+  /* Carry an index being built forward.  This is required because
+   * the signature status may be stored while scanning.  */
+  if (rebuilding && !memcmp (oldstate, rebuild_state, KEYDB_STATELEN))
+    {
+      enum_certs (keyblock, rebuild_cb, NULL);
+      memcpy (rebuild_state, state, KEYDB_STATELEN);
+    }
+
+  fname = deps_fname ();
+  if (gnupg_access (fname, F_OK))
+    goto leave;  /* No index.  */
+  lockhd = take_lock (fname);
+  if (!lockhd)
+    goto leave;  /* The index will be stale.  */
+  parm.fp = es_fopen (fname, "r+b");
+  if (!parm.fp)
+    goto leave;
+  if (!read_header (parm.fp, filestate)
+      || memcmp (oldstate, filestate, KEYDB_STATELEN))
+    goto leave;  /* Not up to date anyway.  */
+
+  /* Make sure that TABLE mirrors the file so that it can be used to
+   * skip known certifications.  While rebuilding TABLE is in use for
+   * the new index and everything is appended.  */
+  if (!rebuilding && !gnupg_stat (fname, &st)
+      && (!table_loaded
+          || table_ino != (unsigned long)st.st_ino
+          || table_fsize != st.st_size))
+    load_table (fname, parm.fp);
+
+  if (es_fseeko (parm.fp, 0, SEEK_END))
+    goto leave;
+  enum_certs (keyblock, append_cb, &parm);
+  if (parm.error || es_fflush (parm.fp))
+    goto leave;
+  if (es_fseeko (parm.fp, TDBDEPS_MAGICLEN, SEEK_SET)
+      || es_fwrite (state, KEYDB_STATELEN, 1, parm.fp) != 1)
+    goto leave;
+  if (es_fclose (parm.fp))
+    log_info ("error writing '%s': %s\n", fname, strerror (errno));
+  parm.fp = NULL;
+
+  if (table_loaded && !gnupg_stat (fname, &st))
+    {
+      table_ino = st.st_ino;
+      table_fsize = st.st_size;
+    }
+
+ leave:
+  es_fclose (parm.fp);
+  release_lock (lockhd);
+  xfree (fname);
+}
@@ -0,0 +1,33 @@
+/* tdbdeps.h - Certification index for the trustdb
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_G10_TDBDEPS_H
+#define GNUPG_G10_TDBDEPS_H
+
+int tdbdeps_usable (void);
+void tdbdeps_begin_rebuild (void);
+int tdbdeps_rebuilding (void);
+void tdbdeps_add_keyblock (kbnode_t keyblock);
+void tdbdeps_end_rebuild (int commit);
+gpg_error_t tdbdeps_get_signees (u32 *kid, KEYDB_SEARCH_DESC **r_descs,
+                                 size_t *r_ndescs);
+void tdbdeps_keydb_changed (const unsigned char *oldstate, kbnode_t keyblock);
+
+#endif /*GNUPG_G10_TDBDEPS_H*/
@@ -50,14 +50,17 @@
 
 
 /*
- * Yes, this is a very simple implementation. We should really
- * use a page aligned buffer and read complete pages.
- * To implement a simple trannsaction system, this is sufficient.
+ * The record cache.  Records are kept in a hash table for fast lookup
+ * and are additionally linked into CACHE_LIST so that we can walk all
+ * of them.  Entries which are not used are kept on CACHE_FREE_LIST.
+ * Dirty records are written back in ascending order of their record
+ * numbers so that adjacent records are written with a single call.
  */
 typedef struct cache_ctrl_struct *CACHE_CTRL;
 struct cache_ctrl_struct
 {
-  CACHE_CTRL next;
+  CACHE_CTRL next;   /* Next item in CACHE_LIST or CACHE_FREE_LIST.  */
+  CACHE_CTRL hnext;  /* Next item in the hash bucket.  */
   struct {
     unsigned used:1;
     unsigned dirty:1;
@@ -66,18 +69,46 @@ struct cache_ctrl_struct
   char data[TRUST_RECORD_LEN];
 };
 
-/* Size of the cache.  The SOFT value is the general one.  While in a
-   transaction this may not be sufficient and thus we may increase it
-   then up to the HARD limit.  */
-#define MAX_CACHE_ENTRIES_SOFT	200
-#define MAX_CACHE_ENTRIES_HARD	10000
+/* Size of the cache.  The SOFT value is the minimum; the actual limit
+   grows with the size of the trustdb up to the ADAPT value.  While in
+   a transaction this may not be sufficient and thus we may increase
+   it then up to the HARD limit.  */
+#define MAX_CACHE_ENTRIES_SOFT	 200
+#define MAX_CACHE_ENTRIES_ADAPT	 65536
+#define MAX_CACHE_ENTRIES_HARD	 262144
+
+/* The number of hash buckets; must be a power of 2.  */
+#define CACHE_HASH_SIZE 4096
+
+/* The maximum number of records written with one write call.  */
+#define MAX_WRITE_BATCH  64
+
+/* The minimum number of records of the fingerprint index; must be a
+ * power of 2.  */
+#define FIDX_MIN_RECORDS 64
 
 
 /* The cache is controlled by these variables.  */
 static CACHE_CTRL cache_list;
+static CACHE_CTRL cache_free_list;
+static CACHE_CTRL cache_hash[CACHE_HASH_SIZE];
 static int cache_entries;
+static int cache_dirty_entries;
+static int cache_limit = MAX_CACHE_ENTRIES_SOFT;
 static int cache_is_dirty;
 
+/* Statistics for the cache.  */
+static struct
+{
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long writebacks;  /* Records written back.  */
+  unsigned long writecalls;  /* Calls to write(2) for them.  */
+  unsigned long flushes;
+  int peak;
+} cache_stats;
+
 
 /* An object to pass information to cmp_krec_fpr. */
 struct cmp_krec_fpr_struct
@@ -108,12 +139,15 @@ static unsigned int is_locked;
 static int  db_fd = -1;
 
 /* A flag indicating that a transaction is active.  */
-/* static int in_transaction;   Not yet used. */
+static int in_transaction;
 
 
 
 static void open_db (void);
+static int sync_cache (void);
 static void create_hashtable (ctrl_t ctrl, TRUSTREC *vr, int type);
+static gpg_error_t fidx_append_table (ulong nrecs, ulong *r_table);
+static gpg_error_t convert_to_fidx (ctrl_t ctrl);
 
 
 
@@ -181,6 +215,79 @@ release_write_lock (void)
  ************* record cache **********
  *************************************/
 
+/* Return the hash bucket for RECNO.  */
+static inline CACHE_CTRL *
+cache_bucket (ulong recno)
+{
+  return &cache_hash[recno & (CACHE_HASH_SIZE - 1)];
+}
+
+
+/* Return the cache item for RECNO or NULL if it is not cached.  */
+static CACHE_CTRL
+find_cache_item (ulong recno)
+{
+  CACHE_CTRL r;
+
+  for (r = *cache_bucket (recno); r; r = r->hnext)
+    if (r->recno == recno)
+      return r;
+  return NULL;
+}
+
+
+/* Mark the cache item R as dirty.  */
+static void
+set_cache_item_dirty (CACHE_CTRL r)
+{
+  if (!r->flags.dirty)
+    {
+      r->flags.dirty = 1;
+      cache_dirty_entries++;
+      cache_is_dirty = 1;
+    }
+}
+
+
+/* Remove the cache item R, which the caller has already unlinked
+ * from CACHE_LIST, from the hash table and put it onto the free
+ * list.  */
+static void
+release_cache_item (CACHE_CTRL r)
+{
+  CACHE_CTRL *rp;
+
+  for (rp = cache_bucket (r->recno); *rp; rp = &(*rp)->hnext)
+    if (*rp == r)
+      {
+        *rp = r->hnext;
+        break;
+      }
+  r->hnext = NULL;
+  if (r->flags.dirty)
+    cache_dirty_entries--;
+  r->flags.used = 0;
+  r->flags.dirty = 0;
+  r->next = cache_free_list;
+  cache_free_list = r;
+  cache_entries--;
+}
+
+
+/*
+ * Adjust the limit of the cache for a trustdb with NRECORDS records.
+ * Small trustdbs are cached completely; the limit is never lowered.
+ */
+static void
+adjust_cache_limit (ulong nrecords)
+{
+  if (nrecords > MAX_CACHE_ENTRIES_ADAPT)
+    nrecords = MAX_CACHE_ENTRIES_ADAPT;
+  if ((int)nrecords > cache_limit)
+    cache_limit = (int)nrecords;
+}
+
+
 /*
  * Get the data from the record cache and return a pointer into that
  * cache.  Caller should copy the returned data.  NULL is returned on
@@ -191,225 +298,219 @@ get_record_from_cache (ulong recno)
 {
   CACHE_CTRL r;
 
-  for (r = cache_list; r; r = r->next)
+  r = find_cache_item (recno);
+  if (!r)
     {
-      if (r->flags.used && r->recno == recno)
-        return r->data;
+      cache_stats.misses++;
+      return NULL;
     }
-  return NULL;
+  cache_stats.hits++;
+  return r->data;
 }
 
 
 /*
- * Write a cached item back to the trustdb file.
+ * Write NREC records from BUFFER to the trustdb file starting at
+ * record RECNO.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-write_cache_item (CACHE_CTRL r)
+write_records (ulong recno, const char *buffer, int nrec)
 {
   gpg_error_t err;
   int n;
 
-  if (lseek (db_fd, r->recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
+  if (lseek (db_fd, recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: lseek failed: %s\n"),
-                 r->recno, strerror (errno));
+                 recno, strerror (errno));
       return err;
     }
-  n = write (db_fd, r->data, TRUST_RECORD_LEN);
-  if (n != TRUST_RECORD_LEN)
+  n = write (db_fd, buffer, nrec * TRUST_RECORD_LEN);
+  if (n != nrec * TRUST_RECORD_LEN)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
-                 r->recno, n, strerror (errno) );
+                 recno, n, strerror (errno) );
       return err;
     }
-  r->flags.dirty = 0;
+  cache_stats.writecalls++;
+  cache_stats.writebacks += nrec;
   return 0;
 }
 
 
+/* Sort function for cache items by their record number.  */
+static int
+cmp_cache_items (const void *a, const void *b)
+{
+  ulong ra = (*(const CACHE_CTRL *)a)->recno;
+  ulong rb = (*(const CACHE_CTRL *)b)->recno;
+
+  return ra < rb ? -1 : ra > rb;
+}
+
+
 /*
- * Put data into the cache.  This function may flush
- * some cache entries if the cache is filled up.
+ * Write all dirty records back to the trustdb file.  The records are
+ * sorted by their record number so that the file is written
+ * sequentially and runs of adjacent records are written with a single
+ * call.  The caller must hold the write lock.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-put_record_into_cache (ulong recno, const char *data)
+write_back_cache (void)
 {
-  CACHE_CTRL r, unused;
-  int dirty_count = 0;
-  int clean_count = 0;
+  char buffer[MAX_WRITE_BATCH * TRUST_RECORD_LEN];
+  CACHE_CTRL r, *items;
+  int nitems, i, j, n;
+  int rc = 0;
 
-  /* See whether we already cached this one.  */
-  for (unused = NULL, r = cache_list; r; r = r->next)
+  if (!cache_dirty_entries)
     {
-      if (!r->flags.used)
-        {
-          if (!unused)
-            unused = r;
-	}
-      else if (r->recno == recno)
-        {
-          if (!r->flags.dirty)
-            {
-              /* Hmmm: should we use a copy and compare? */
-              if (memcmp (r->data, data, TRUST_RECORD_LEN))
-                {
-                  r->flags.dirty = 1;
-                  cache_is_dirty = 1;
-		}
-	    }
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          return 0;
-	}
-      if (r->flags.used)
-        {
-          if (r->flags.dirty)
-            dirty_count++;
-          else
-            clean_count++;
-	}
+      cache_is_dirty = 0;
+      return 0;
     }
 
-  /* Not in the cache: add a new entry. */
-  if (unused)
+  items = xmalloc (cache_dirty_entries * sizeof *items);
+  nitems = 0;
+  for (r = cache_list; r; r = r->next)
+    if (r->flags.dirty)
+      items[nitems++] = r;
+  log_assert (nitems == cache_dirty_entries);
+  qsort (items, nitems, sizeof *items, cmp_cache_items);
+
+  for (i = 0; i < nitems; i = j)
     {
-      /* Reuse this entry. */
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      memcpy (buffer, items[i]->data, TRUST_RECORD_LEN);
+      for (j = i + 1, n = 1;
+           (j < nitems && n < MAX_WRITE_BATCH
+            && items[j]->recno == items[i]->recno + n);
+           j++, n++)
+        memcpy (buffer + n * TRUST_RECORD_LEN, items[j]->data,
+                TRUST_RECORD_LEN);
+
+      rc = write_records (items[i]->recno, buffer, n);
+      if (rc)
+        break;
+      for (n = i; n < j; n++)
+        {
+          items[n]->flags.dirty = 0;
+          cache_dirty_entries--;
+        }
     }
+  xfree (items);
 
-  /* See whether we reached the limit. */
-  if (cache_entries < MAX_CACHE_ENTRIES_SOFT)
+  if (!rc)
     {
-      /* No: Put into cache.  */
-      r = xmalloc (sizeof *r);
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      r->next = cache_list;
-      cache_list = r;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      cache_is_dirty = 0;
+      cache_stats.flushes++;
     }
+  return rc;
+}
 
-  /* Cache is full: discard some clean entries.  */
-  if (clean_count)
-    {
-      int n;
 
-      /* We discard a third of the clean entries.  */
-      n = clean_count / 3;
-      if (!n)
-        n = 1;
+/* Discard a third of the clean entries from the cache.  */
+static void
+discard_clean_entries (void)
+{
+  CACHE_CTRL r, *rp;
+  int n;
 
-      for (unused = NULL, r = cache_list; r; r = r->next)
+  n = (cache_entries - cache_dirty_entries) / 3;
+  if (!n)
+    n = 1;
+
+  for (rp = &cache_list; n && (r = *rp); )
+    {
+      if (r->flags.dirty)
+        rp = &r->next;
+      else
         {
-          if (r->flags.used && !r->flags.dirty)
-            {
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
+          *rp = r->next;
+          release_cache_item (r);
+          cache_stats.evictions++;
+          n--;
+        }
+    }
+}
+
+
+/*
+ * Put data into the cache.  If DIRTY is set the record needs to be
+ * written back; otherwise it has just been read from the file.  This
+ * function may write back all dirty entries if the cache is filled
+ * up.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+put_record_into_cache (ulong recno, const char *data, int dirty)
+{
+  CACHE_CTRL r, *bucket;
+  int rc;
 
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
+  /* See whether we already cached this one.  */
+  r = find_cache_item (recno);
+  if (r)
+    {
+      /* Hmmm: should we use a copy and compare? */
+      if (dirty && !r->flags.dirty
+          && memcmp (r->data, data, TRUST_RECORD_LEN))
+        set_cache_item_dirty (r);
       memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
       return 0;
     }
 
-  /* No clean entries: We have to flush some dirty entries.  */
-#if 0 /* Transactions are not yet used.  */
-  if (in_transaction)
+  /* See whether we reached the limit.  While in a transaction we
+   * increase the cache size instead, up to the hard limit.  */
+  if (cache_entries >= cache_limit
+      && !(in_transaction && cache_entries < MAX_CACHE_ENTRIES_HARD))
     {
-      /* But we can't do this while in a transaction.  Thus we
-       * increase the cache size instead.  */
-      if (cache_entries < MAX_CACHE_ENTRIES_HARD)
+      if (cache_entries == cache_dirty_entries)
         {
-          if (opt.debug && !(cache_entries % 100))
-            log_debug ("increasing tdbio cache size\n");
-          r = xmalloc (sizeof *r);
-          r->flags.used = 1;
-          r->recno = recno;
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          r->flags.dirty = 1;
-          r->next = cache_list;
-          cache_list = r;
-          cache_is_dirty = 1;
-          cache_entries++;
-          return 0;
-	}
-      /* Hard limit for the cache size reached.  */
-      log_info (_("trustdb transaction too large\n"));
-      return GPG_ERR_RESOURCE_LIMIT;
+          /* No clean entries.  Records which have just been read are
+           * not worth a write back.  */
+          if (!dirty)
+            return 0;
+
+          if (in_transaction && DBG_TRUST)
+            log_debug ("tdbio: transaction exceeds the cache size\n");
+          take_write_lock ();
+          rc = write_back_cache ();
+          release_write_lock ();
+          if (rc)
+            return rc;
+        }
+      discard_clean_entries ();
     }
-#endif
 
-  if (dirty_count)
+  /* Not in the cache: add a new entry. */
+  if (cache_free_list)
     {
-      int n;
-
-      /* Discard some dirty entries. */
-      n = dirty_count / 5;
-      if (!n)
-        n = 1;
-
-      take_write_lock ();
-      for (unused = NULL, r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && r->flags.dirty)
-            {
-              int rc;
-
-              rc = write_cache_item (r);
-              if (rc)
-                return rc;
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
-      release_write_lock ();
-
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      r = cache_free_list;
+      cache_free_list = r->next;
     }
-
-  /* We should never reach this.  */
-  BUG();
+  else
+    r = xmalloc (sizeof *r);
+  r->flags.used = 1;
+  r->flags.dirty = 0;
+  r->recno = recno;
+  memcpy (r->data, data, TRUST_RECORD_LEN);
+  r->next = cache_list;
+  cache_list = r;
+  bucket = cache_bucket (recno);
+  r->hnext = *bucket;
+  *bucket = r;
+  cache_entries++;
+  if (cache_entries > cache_stats.peak)
+    cache_stats.peak = cache_entries;
+  if (dirty)
+    set_cache_item_dirty (r);
+  return 0;
 }
 
 
@@ -422,60 +523,60 @@ tdbio_is_dirty (void)
 
 
 /*
- * Flush the cache.  This cannot be used while in a transaction.
+ * Write back all dirty records, even while in a transaction.
  */
-int
-tdbio_sync (void)
+static int
+sync_cache (void)
 {
-    CACHE_CTRL r;
-    int did_lock = 0;
-
-    if( db_fd == -1 )
-	open_db();
-#if 0 /* Transactions are not yet used.  */
-    if( in_transaction )
-	log_bug("tdbio: syncing while in transaction\n");
-#endif
+  int did_lock = 0;
+  int rc;
+
+  if (db_fd == -1)
+    open_db ();
 
-    if( !cache_is_dirty )
-	return 0;
+  if (!cache_is_dirty)
+    return 0;
 
-    if (!take_write_lock ())
-        did_lock = 1;
+  if (!take_write_lock ())
+    did_lock = 1;
+  rc = write_back_cache ();
+  if (did_lock)
+    release_write_lock ();
+
+  return rc;
+}
 
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->flags.dirty ) {
-	    int rc = write_cache_item( r );
-	    if( rc )
-		return rc;
-	}
-    }
-    cache_is_dirty = 0;
-    if (did_lock)
-        release_write_lock ();
 
+/*
+ * Flush the cache.  While in a transaction this is deferred until
+ * the end of the transaction.
+ */
+int
+tdbio_sync (void)
+{
+  if (in_transaction)
     return 0;
+  return sync_cache ();
 }
 
 
-#if 0  /* Not yet used.  */
 /*
  * Simple transactions system:
- * Everything between begin_transaction and end/cancel_transaction
- * is not immediately written but at the time of end_transaction.
- *
- * NOTE: The transaction code is disabled in the 1.2 branch, as it is
- * not yet used.
+ * Everything between begin_transaction and end_transaction is not
+ * immediately written but at the time of end_transaction.  This is
+ * used to batch the updates done by a trustdb check.  Note that a
+ * transaction exceeding the hard cache limit is partly written back
+ * before its end; thus this does not provide atomicity.
  */
 int
-tdbio_begin_transaction ()  /* Not yet used.  */
+tdbio_begin_transaction (void)
 {
   int rc;
 
   if (in_transaction)
     log_bug ("tdbio: nested transactions\n");
   /* Flush everything out. */
-  rc = tdbio_sync();
+  rc = tdbio_sync ();
   if (rc)
     return rc;
   in_transaction = 1;
@@ -483,7 +584,7 @@ tdbio_begin_transaction ()  /* Not yet used.  */
 }
 
 int
-tdbio_end_transaction ()  /* Not yet used.  */
+tdbio_end_transaction (void)
 {
   int rc;
 
@@ -492,34 +593,34 @@ tdbio_end_transaction ()  /* Not yet used.  */
   take_write_lock ();
   gnupg_block_all_signals ();
   in_transaction = 0;
-  rc = tdbio_sync();
-  gnupg_unblock_all_signals();
+  rc = tdbio_sync ();
+  gnupg_unblock_all_signals ();
   release_write_lock ();
   return rc;
 }
 
+#if 0  /* Not yet used.  */
 int
-tdbio_cancel_transaction () /* Not yet used.  */
+tdbio_cancel_transaction (void)
 {
-  CACHE_CTRL r;
+  CACHE_CTRL r, *rp;
 
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
 
   /* Remove all dirty marked entries, so that the original ones are
    * read back the next time.  */
-  if (cache_is_dirty)
+  for (rp = &cache_list; (r = *rp); )
     {
-      for (r = cache_list; r; r = r->next)
+      if (r->flags.dirty)
         {
-          if (r->flags.used && r->flags.dirty)
-            {
-              r->flags.used = 0;
-              cache_entries--;
-	    }
-	}
-      cache_is_dirty = 0;
+          *rp = r->next;
+          release_cache_item (r);
+        }
+      else
+        rp = &r->next;
     }
+  cache_is_dirty = 0;
 
   in_transaction = 0;
   return 0;
@@ -527,7 +628,23 @@ tdbio_cancel_transaction () /* Not yet used.  */
 #endif  /* Not yet used.  */
 
 
-
+/* Print statistics about the record cache.  */
+void
+tdbio_dump_stats (void)
+{
+  if (!cache_stats.hits && !cache_stats.misses && !cache_stats.writebacks)
+    return;
+  log_info ("tdbio: cache: hits=%lu misses=%lu evictions=%lu"
+            " entries=%d peak=%d limit=%d\n",
+            cache_stats.hits, cache_stats.misses, cache_stats.evictions,
+            cache_entries, cache_stats.peak, cache_limit);
+  log_info ("tdbio: writeback: records=%lu writes=%lu flushes=%lu\n",
+            cache_stats.writebacks, cache_stats.writecalls,
+            cache_stats.flushes);
+}
+
+
+
 /********************************************************
  **************** cached I/O functions ******************
  ********************************************************/
@@ -565,6 +682,14 @@ tdbio_update_version_record (ctrl_t ctrl)
   memset (&rec, 0, sizeof rec);
 
   rc = tdbio_read_record (0, &rec, RECTYPE_VER);
+  if (!rc && rec.r.ver.version < 4 && opt.trustdb_fidx)
+    {
+      /* Switch to the fingerprint index as requested.  Older versions
+       * of GnuPG can't use the trustdb after that.  */
+      rc = convert_to_fidx (ctrl);
+      if (!rc)
+        rc = tdbio_read_record (0, &rec, RECTYPE_VER);
+    }
   if (!rc)
     {
       rec.r.ver.created     = make_timestamp();
@@ -598,7 +723,7 @@ create_version_record (ctrl_t ctrl)
     opt_tm = TM_PGP;
 
   memset (&rec, 0, sizeof rec);
-  rec.r.ver.version     = 3;
+  rec.r.ver.version     = opt.trustdb_fidx? 4 : 3;
   rec.r.ver.created     = make_timestamp ();
   rec.r.ver.marginals   = opt.marginals_needed;
   rec.r.ver.completes   = opt.completes_needed;
@@ -615,18 +740,62 @@ create_version_record (ctrl_t ctrl)
   if (!rc)
     tdbio_sync ();
 
-  if (!rc)
+  if (rc)
+    ;
+  else if (rec.r.ver.version < 4)
     create_hashtable (ctrl, &rec, 0);
+  else
+    {
+      rc = fidx_append_table (FIDX_MIN_RECORDS, &rec.r.ver.fidxtbl);
+      if (!rc)
+        {
+          rec.r.ver.fidxsize = FIDX_MIN_RECORDS;
+          rc = tdbio_write_record (ctrl, &rec);
+        }
+      if (!rc)
+        rc = tdbio_sync ();
+    }
 
   return rc;
 }
 
 
+/*
+ * Return a malloced string with the file name of the trustdb for
+ * NEW_DBNAME.  If NEW_DBNAME is NULL a default name is used, if the
+ * it does not contain a path component separator ('/') the global
+ * GnuPG home directory is used.
+ */
+char *
+tdbio_make_dbname (const char *new_dbname)
+{
+  char *fname;
+
+  if (!new_dbname)
+    {
+      fname = make_filename (gnupg_homedir (),
+                             "trustdb" EXTSEP_S GPGEXT_GPG, NULL);
+    }
+  else if (*new_dbname != DIRSEP_C )
+    {
+      if (strchr (new_dbname, DIRSEP_C))
+        fname = make_filename (new_dbname, NULL);
+      else
+        fname = make_filename (gnupg_homedir (), new_dbname, NULL);
+    }
+  else
+    {
+      fname = xstrdup (new_dbname);
+    }
+
+  return fname;
+}
+
+
 /*
  * Set the file name for the trustdb to NEW_DBNAME and if CREATE is
- * true create that file.  If NEW_DBNAME is NULL a default name is
- * used, if the it does not contain a path component separator ('/')
- * the global GnuPG home directory is used.
+ * true create that file.  See tdbio_make_dbname for the rules used
+ * to build the file name.
  *
  * Returns: 0 on success or an error code.
  *
@@ -650,23 +819,7 @@ tdbio_set_dbname (ctrl_t ctrl, const char *new_dbname,
 
   *r_nofile = 0;
 
-  if (!new_dbname)
-    {
-      fname = make_filename (gnupg_homedir (),
-                             "trustdb" EXTSEP_S GPGEXT_GPG, NULL);
-    }
-  else if (*new_dbname != DIRSEP_C )
-    {
-      if (strchr (new_dbname, DIRSEP_C))
-        fname = make_filename (new_dbname, NULL);
-      else
-        fname = make_filename (gnupg_homedir (), new_dbname, NULL);
-    }
-  else
-    {
-      fname = xstrdup (new_dbname);
-    }
-
+  fname = tdbio_make_dbname (new_dbname);
   xfree (db_name);
   db_name = fname;
 
@@ -780,6 +933,7 @@ static void
 open_db (void)
 {
   TRUSTREC rec;
+  off_t offset;
 
   log_assert( db_fd == -1 );
 
@@ -800,6 +954,11 @@ open_db (void)
 
   register_secured_file (db_name);
 
+  /* Size the cache according to the trustdb.  */
+  offset = lseek (db_fd, 0, SEEK_END);
+  if (offset != (off_t)(-1))
+    adjust_cache_limit (offset / TRUST_RECORD_LEN);
+
   /* Read the version record. */
   if (tdbio_read_record (0, &rec, RECTYPE_VER ) )
     log_fatal( _("%s: invalid trustdb\n"), db_name );
@@ -842,10 +1001,12 @@ create_hashtable (ctrl_t ctrl, TRUSTREC *vr, int type)
         log_fatal (_("%s: failed to create hashtable: %s\n"),
                    db_name, gpg_strerror (rc));
     }
-  /* Update the version record and flush. */
+  /* Update the version record and flush.  This must be done even
+   * while in a transaction because the new records are located
+   * beyond the end of the file.  */
   rc = tdbio_write_record (ctrl, vr);
   if (!rc)
-    rc = tdbio_sync ();
+    rc = sync_cache ();
   if (rc)
     log_fatal (_("%s: error updating version record: %s\n"),
                db_name, gpg_strerror (rc));
@@ -1388,6 +1549,424 @@ lookup_hashtable (ulong table, const byte *key, size_t keylen,
 }
 
 
+
+/*
+ * The fingerprint index of version 4 trustdbs.  This is a flat open
+ * addressing hash table with linear probing, stored in FIDXSIZE
+ * consecutive records starting at FIDXTBL.  Each slot holds the
+ * first 4 bytes of the fingerprint as a tag and the record number of
+ * the trust record; the tag also gives the home slot.  Because
+ * fingerprints are uniformly distributed and the table is kept at
+ * most half full, a lookup usually reads one index record and the
+ * trust record.  Empty slots have a record number of 0.
+ */
+
+
+/* Return the tag of the 20 byte fingerprint FPR.  */
+static u32
+fidx_tag (const byte *fpr)
+{
+  return buf32_to_u32 (fpr);
+}
+
+
+/* Read slot SLOT of the index at TABLE into R_TAG and R_RNUM.  */
+static gpg_error_t
+fidx_get_slot (ulong table, ulong slot, u32 *r_tag, ulong *r_rnum)
+{
+  TRUSTREC rec;
+  gpg_error_t err;
+
+  err = tdbio_read_record (table + slot / ITEMS_PER_FIDX_RECORD,
+                           &rec, RECTYPE_FIDX);
+  if (err)
+    {
+      log_error ("fidx: read failed: %s\n", gpg_strerror (err));
+      return err;
+    }
+  *r_tag  = rec.r.fidx.tag[slot % ITEMS_PER_FIDX_RECORD];
+  *r_rnum = rec.r.fidx.rnum[slot % ITEMS_PER_FIDX_RECORD];
+  return 0;
+}
+
+
+/* Store TAG and RNUM into slot SLOT of the index at TABLE.  */
+static gpg_error_t
+fidx_put_slot (ctrl_t ctrl, ulong table, ulong slot, u32 tag, ulong rnum)
+{
+  TRUSTREC rec;
+  gpg_error_t err;
+
+  err = tdbio_read_record (table + slot / ITEMS_PER_FIDX_RECORD,
+                           &rec, RECTYPE_FIDX);
+  if (!err)
+    {
+      rec.r.fidx.tag[slot % ITEMS_PER_FIDX_RECORD]  = tag;
+      rec.r.fidx.rnum[slot % ITEMS_PER_FIDX_RECORD] = rnum;
+      err = tdbio_write_record (ctrl, &rec);
+    }
+  if (err)
+    log_error ("fidx: update failed: %s\n", gpg_strerror (err));
+  return err;
+}
+
+
+/*
+ * Append an empty index of NRECS records to the trustdb and store the
+ * number of its first record at R_TABLE.  The records are directly
+ * written to the end of the file so that this may also be used while
+ * in a transaction.
+ */
+static gpg_error_t
+fidx_append_table (ulong nrecs, ulong *r_table)
+{
+  char buffer[MAX_WRITE_BATCH * TRUST_RECORD_LEN];
+  gpg_error_t err = 0;
+  off_t offset;
+  ulong recnum, n;
+  int i, did_lock = 0;
+
+  if (!take_write_lock ())
+    did_lock = 1;
+
+  offset = lseek (db_fd, 0, SEEK_END);
+  if (offset == (off_t)(-1))
+    log_fatal ("trustdb: lseek to end failed: %s\n", strerror (errno));
+  recnum = offset / TRUST_RECORD_LEN;
+  log_assert (recnum); /* This will never be the first record */
+
+  memset (buffer, 0, sizeof buffer);
+  for (i=0; i < MAX_WRITE_BATCH; i++)
+    buffer[i * TRUST_RECORD_LEN] = RECTYPE_FIDX;
+  for (n=0; n < nrecs && !err; n += i)
+    {
+      i = nrecs - n < MAX_WRITE_BATCH? nrecs - n : MAX_WRITE_BATCH;
+      err = write_records (recnum + n, buffer, i);
+    }
+
+  if (did_lock)
+    release_write_lock ();
+  if (err)
+    return err;
+
+  adjust_cache_limit (recnum + nrecs);
+  *r_table = recnum;
+  return 0;
+}
+
+
+/* Return the number of index records to hold COUNT entries.  */
+static ulong
+fidx_size_for (ulong count)
+{
+  ulong nrecs = FIDX_MIN_RECORDS;
+
+  while (nrecs * ITEMS_PER_FIDX_RECORD < 2 * count)
+    nrecs *= 2;
+  return nrecs;
+}
+
+
+/*
+ * Insert TAG and RNUM into the empty slot found first for TAG in the
+ * index at TABLE with NSLOTS slots.  The entry must not yet be in the
+ * index.
+ */
+static gpg_error_t
+fidx_insert_slot (ctrl_t ctrl, ulong table, ulong nslots, u32 tag, ulong rnum)
+{
+  gpg_error_t err;
+  ulong slot, n, r;
+  u32 t;
+
+  for (slot = tag & (nslots - 1), n = 0; n < nslots;
+       slot = (slot + 1) & (nslots - 1), n++)
+    {
+      err = fidx_get_slot (table, slot, &t, &r);
+      if (err)
+        return err;
+      if (!r)
+        return fidx_put_slot (ctrl, table, slot, tag, rnum);
+    }
+  log_error ("fidx: index is full\n");
+  return gpg_error (GPG_ERR_TRUSTDB);
+}
+
+
+/*
+ * Double the size of the index described by the version record VR.
+ * On success VR has been updated and written.
+ */
+static gpg_error_t
+fidx_grow (ctrl_t ctrl, TRUSTREC *vr)
+{
+  gpg_error_t err;
+  ulong oldtable, oldnrecs, newtable, newnrecs;
+  ulong slot, r;
+  u32 t;
+
+  oldtable = vr->r.ver.fidxtbl;
+  oldnrecs = vr->r.ver.fidxsize;
+  newnrecs = 2 * oldnrecs;
+  if (DBG_TRUST)
+    log_debug ("fidx: growing index to %lu records\n", newnrecs);
+
+  err = fidx_append_table (newnrecs, &newtable);
+  if (err)
+    return err;
+  for (slot=0; slot < oldnrecs * ITEMS_PER_FIDX_RECORD; slot++)
+    {
+      err = fidx_get_slot (oldtable, slot, &t, &r);
+      if (!err && r)
+        err = fidx_insert_slot (ctrl, newtable,
+                                newnrecs * ITEMS_PER_FIDX_RECORD, t, r);
+      if (err)
+        return err;
+    }
+
+  vr->r.ver.fidxtbl  = newtable;
+  vr->r.ver.fidxsize = newnrecs;
+  err = tdbio_write_record (ctrl, vr);
+  if (err)
+    return err;
+
+  /* Release the records of the old index.  */
+  for (r=0; r < oldnrecs && !err; r++)
+    err = tdbio_delete_record (ctrl, oldtable + r);
+  if (!err)
+    err = tdbio_read_record (0, vr, RECTYPE_VER);
+  return err;
+}
+
+
+/*
+ * Lookup the 20 byte fingerprint FPR in the index described by the
+ * version record VR and return the trust record at REC.
+ *
+ * Return: 0 if found, GPG_ERR_NOT_FOUND, or another error code.
+ */
+static gpg_error_t
+fidx_lookup (TRUSTREC *vr, const byte *fpr, TRUSTREC *rec)
+{
+  gpg_error_t err;
+  ulong nslots = vr->r.ver.fidxsize * ITEMS_PER_FIDX_RECORD;
+  ulong slot, n, r;
+  u32 tag, t;
+
+  tag = fidx_tag (fpr);
+  for (slot = tag & (nslots - 1), n = 0; n < nslots;
+       slot = (slot + 1) & (nslots - 1), n++)
+    {
+      err = fidx_get_slot (vr->r.ver.fidxtbl, slot, &t, &r);
+      if (err)
+        return err;
+      if (!r)
+        break;
+      if (t != tag)
+        continue;
+      err = tdbio_read_record (r, rec, RECTYPE_TRUST);
+      if (err)
+        {
+          log_error ("fidx: read item failed: %s\n", gpg_strerror (err));
+          return err;
+        }
+      if (!memcmp (rec->r.trust.fingerprint, fpr, 20))
+        return 0;
+    }
+
+  return gpg_error (GPG_ERR_NOT_FOUND);
+}
+
+
+/*
+ * Insert the trust record number RECNUM with the 20 byte fingerprint
+ * FPR into the index.  Nothing is done if it is already there.
+ *
+ * Return: 0 on success or an error code.
+ */
+static gpg_error_t
+fidx_insert (ctrl_t ctrl, const byte *fpr, ulong recnum)
+{
+  gpg_error_t err;
+  TRUSTREC vr;
+  ulong nslots, slot, n, r;
+  u32 tag, t;
+
+  err = tdbio_read_record (0, &vr, RECTYPE_VER);
+  if (err)
+    return err;
+
+  tag = fidx_tag (fpr);
+ again:
+  nslots = vr.r.ver.fidxsize * ITEMS_PER_FIDX_RECORD;
+  for (slot = tag & (nslots - 1), n = 0; n < nslots;
+       slot = (slot + 1) & (nslots - 1), n++)
+    {
+      err = fidx_get_slot (vr.r.ver.fidxtbl, slot, &t, &r);
+      if (err)
+        return err;
+      if (r == recnum)
+        return 0;  /* Already in the index.  */
+      if (!r)
+        break;
+    }
+
+  if (2 * (vr.r.ver.fidxcount + 1) > nslots)
+    {
+      err = fidx_grow (ctrl, &vr);
+      if (err)
+        return err;
+      goto again;
+    }
+
+  err = fidx_put_slot (ctrl, vr.r.ver.fidxtbl, slot, tag, recnum);
+  if (err)
+    return err;
+  vr.r.ver.fidxcount++;
+  return tdbio_write_record (ctrl, &vr);
+}
+
+
+/*
+ * Remove the trust record number RECNUM with the 20 byte fingerprint
+ * FPR from the index.  To keep the probe sequences intact the
+ * following entries are shifted back instead of leaving a tombstone.
+ *
+ * Return: 0 on success or an error code.
+ */
+static gpg_error_t
+fidx_remove (ctrl_t ctrl, const byte *fpr, ulong recnum)
+{
+  gpg_error_t err;
+  TRUSTREC vr;
+  ulong table, nslots, mask, slot, home, hole, n, r;
+  u32 tag, t;
+
+  err = tdbio_read_record (0, &vr, RECTYPE_VER);
+  if (err)
+    return err;
+  table  = vr.r.ver.fidxtbl;
+  nslots = vr.r.ver.fidxsize * ITEMS_PER_FIDX_RECORD;
+  mask   = nslots - 1;
+
+  tag = fidx_tag (fpr);
+  for (slot = tag & mask, n = 0; n < nslots; slot = (slot + 1) & mask, n++)
+    {
+      err = fidx_get_slot (table, slot, &t, &r);
+      if (err)
+        return err;
+      if (!r)
+        return 0;  /* Not in the index - forget about it.  */
+      if (r == recnum)
+        break;
+    }
+  if (n == nslots)
+    return 0;
+
+  hole = slot;
+  for (n = 1; n < nslots; n++)
+    {
+      slot = (slot + 1) & mask;
+      err = fidx_get_slot (table, slot, &t, &r);
+      if (err)
+        return err;
+      if (!r)
+        break;
+      /* The entry stays if its home is cyclically in (HOLE,SLOT].  */
+      home = t & mask;
+      if (hole <= slot? (hole < home && home <= slot)
+          /*        */: (hole < home || home <= slot))
+        continue;
+      err = fidx_put_slot (ctrl, table, hole, t, r);
+      if (err)
+        return err;
+      hole = slot;
+    }
+  err = fidx_put_slot (ctrl, table, hole, 0, 0);
+  if (err)
+    return err;
+
+  if (vr.r.ver.fidxcount)
+    vr.r.ver.fidxcount--;
+  return tdbio_write_record (ctrl, &vr);
+}
+
+
+/*
+ * Convert a version 3 trustdb to version 4 by building the
+ * fingerprint index and releasing the records of the old hash table.
+ * The version record is only switched after the new index has been
+ * written; thus an interrupted conversion leaves a valid trustdb.
+ *
+ * Return: 0 on success or an error code.
+ */
+static gpg_error_t
+convert_to_fidx (ctrl_t ctrl)
+{
+  gpg_error_t err;
+  TRUSTREC vr, rec;
+  ulong recnum, ntrust, table, nrecs, count;
+
+  /* Count the trust records.  */
+  ntrust = 0;
+  for (recnum=1; !(err = tdbio_read_record (recnum, &rec, 0)); recnum++)
+    if (rec.rectype == RECTYPE_TRUST)
+      ntrust++;
+  if (gpg_err_code (err) != GPG_ERR_EOF)
+    return err;
+
+  nrecs = fidx_size_for (ntrust);
+  err = fidx_append_table (nrecs, &table);
+  if (err)
+    return err;
+
+  count = 0;
+  for (recnum=1; recnum < table; recnum++)
+    {
+      err = tdbio_read_record (recnum, &rec, 0);
+      if (err)
+        return err;
+      if (rec.rectype != RECTYPE_TRUST)
+        continue;
+      err = fidx_insert_slot (ctrl, table, nrecs * ITEMS_PER_FIDX_RECORD,
+                              fidx_tag (rec.r.trust.fingerprint), recnum);
+      if (err)
+        return err;
+      count++;
+    }
+
+  err = tdbio_read_record (0, &vr, RECTYPE_VER);
+  if (err)
+    return err;
+  vr.r.ver.version   = 4;
+  vr.r.ver.fidxtbl   = table;
+  vr.r.ver.fidxsize  = nrecs;
+  vr.r.ver.fidxcount = count;
+  vr.r.ver.trusthashtbl = 0;
+  err = tdbio_write_record (ctrl, &vr);
+  if (!err)
+    err = sync_cache ();
+  if (err)
+    return err;
+
+  /* Release the old hash table and the remains of an interrupted
+   * conversion.  */
+  for (recnum=1; recnum < table; recnum++)
+    {
+      err = tdbio_read_record (recnum, &rec, 0);
+      if (!err && (rec.rectype == RECTYPE_HTBL || rec.rectype == RECTYPE_HLST
+                   || rec.rectype == RECTYPE_FIDX))
+        err = tdbio_delete_record (ctrl, recnum);
+      if (err)
+        return err;
+    }
+
+  if (!opt.quiet)
+    log_info (_("%s: trustdb converted to version %d\n"), db_name, 4);
+  return 0;
+}
+
+
 /*
  * Update the trust hash table TR or create the table if it does not
  * exist.
@@ -1397,6 +1976,15 @@ lookup_hashtable (ulong table, const byte *key, size_t keylen,
 static int
 update_trusthashtbl (ctrl_t ctrl, TRUSTREC *tr)
 {
+  TRUSTREC vr;
+  int rc;
+
+  rc = tdbio_read_record (0, &vr, RECTYPE_VER);
+  if (rc)
+    return rc;
+  if (vr.r.ver.version >= 4)
+    return fidx_insert (ctrl, tr->r.trust.fingerprint, tr->recnum);
+
   return upd_hashtable (ctrl, get_trusthashrec (ctrl),
                         tr->r.trust.fingerprint, 20, tr->recnum);
 }
@@ -1420,8 +2008,14 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
       break;
 
     case RECTYPE_VER:
+      if (rec->r.ver.version >= 4)
+        es_fprintf (fp, "version 4, fidx=%lu/%lu/%lu, ",
+                    rec->r.ver.fidxtbl, rec->r.ver.fidxsize,
+                    rec->r.ver.fidxcount);
+      else
+        es_fprintf (fp, "version, ");
       es_fprintf (fp,
-         "version, td=%lu, f=%lu, m/c/d=%d/%d/%d tm=%d mcl=%d nc=%lu (%s)\n",
+         "td=%lu, f=%lu, m/c/d=%d/%d/%d tm=%d mcl=%d nc=%lu (%s)\n",
                   rec->r.ver.trusthashtbl,
                   rec->r.ver.firstfree,
                   rec->r.ver.marginals,
@@ -1452,6 +2046,14 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
       es_putc ('\n', fp);
       break;
 
+    case RECTYPE_FIDX:
+      es_fprintf (fp, "fidx,");
+      for (i=0; i < ITEMS_PER_FIDX_RECORD; i++)
+        es_fprintf (fp, " %08lX:%lu",
+                    (ulong)rec->r.fidx.tag[i], rec->r.fidx.rnum[i]);
+      es_putc ('\n', fp);
+      break;
+
     case RECTYPE_TRUST:
       es_fprintf (fp, "trust ");
       for (i=0; i < 20; i++)
@@ -1518,6 +2120,9 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
           return err;
 	}
       buf = readbuf;
+      err = put_record_into_cache (recnum, buf, 0);
+      if (err)
+        return err;
     }
   rec->recnum = recnum;
   rec->dirty = 0;
@@ -1555,10 +2160,13 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
           p += 4;
           rec->r.ver.nextcheck = buf32_to_ulong(p);
           p += 4;
+          rec->r.ver.fidxtbl = buf32_to_ulong(p);
           p += 4;
+          rec->r.ver.fidxsize = buf32_to_ulong(p);
           p += 4;
           rec->r.ver.firstfree = buf32_to_ulong(p);
           p += 4;
+          rec->r.ver.fidxcount = buf32_to_ulong(p);
           p += 4;
           rec->r.ver.trusthashtbl = buf32_to_ulong(p);
           if (recnum)
@@ -1567,12 +2175,19 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
                          (ulong)recnum );
               err = gpg_error (GPG_ERR_TRUSTDB);
             }
-          else if (rec->r.ver.version != 3)
+          else if (rec->r.ver.version != 3 && rec->r.ver.version != 4)
             {
               log_error( _("%s: invalid file version %d\n"), db_name,
                          rec->r.ver.version );
               err = gpg_error (GPG_ERR_TRUSTDB);
             }
+          else if (rec->r.ver.version == 4
+                   && (!rec->r.ver.fidxtbl || !rec->r.ver.fidxsize
+                       || (rec->r.ver.fidxsize & (rec->r.ver.fidxsize - 1))))
+            {
+              log_error ("%s: invalid fingerprint index\n", db_name);
+              err = gpg_error (GPG_ERR_TRUSTDB);
+            }
         }
       break;
 
@@ -1598,6 +2213,16 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
 	}
       break;
 
+    case RECTYPE_FIDX:
+      for (i=0; i < ITEMS_PER_FIDX_RECORD; i++)
+        {
+          rec->r.fidx.tag[i] = buf32_to_u32 (p);
+          p += 4;
+          rec->r.fidx.rnum[i] = buf32_to_ulong (p);
+          p += 4;
+	}
+      break;
+
     case RECTYPE_TRUST:
       memcpy (rec->r.trust.fingerprint, p, 20);
       p+=20;
@@ -1668,10 +2293,10 @@ tdbio_write_record (ctrl_t ctrl, TRUSTREC *rec)
       p += 2;
       ulongtobuf(p, rec->r.ver.created); p += 4;
       ulongtobuf(p, rec->r.ver.nextcheck); p += 4;
-      p += 4;
-      p += 4;
+      ulongtobuf(p, rec->r.ver.fidxtbl); p += 4;
+      ulongtobuf(p, rec->r.ver.fidxsize); p += 4;
       ulongtobuf(p, rec->r.ver.firstfree ); p += 4;
-      p += 4;
+      ulongtobuf(p, rec->r.ver.fidxcount); p += 4;
       ulongtobuf(p, rec->r.ver.trusthashtbl ); p += 4;
       break;
 
@@ -1694,6 +2319,14 @@ tdbio_write_record (ctrl_t ctrl, TRUSTREC *rec)
 	}
       break;
 
+    case RECTYPE_FIDX:
+      for (i=0; i < ITEMS_PER_FIDX_RECORD; i++)
+        {
+          ulongtobuf (p, rec->r.fidx.tag[i]); p += 4;
+          ulongtobuf (p, rec->r.fidx.rnum[i]); p += 4;
+	}
+      break;
+
     case RECTYPE_TRUST:
       memcpy (p, rec->r.trust.fingerprint, 20); p += 20;
       *p++ = rec->r.trust.ownertrust;
@@ -1715,7 +2348,7 @@ tdbio_write_record (ctrl_t ctrl, TRUSTREC *rec)
       BUG();
     }
 
-  rc = put_record_into_cache (recnum, buf);
+  rc = put_record_into_cache (recnum, buf, 1);
   if (rc)
     ;
   else if (rec->rectype == RECTYPE_TRUST)
@@ -1742,8 +2375,14 @@ tdbio_delete_record (ctrl_t ctrl, ulong recnum)
     ;
   else if (rec.rectype == RECTYPE_TRUST)
     {
-      rc = drop_from_hashtable (ctrl, get_trusthashrec (ctrl),
-                                rec.r.trust.fingerprint, 20, rec.recnum);
+      rc = tdbio_read_record (0, &vr, RECTYPE_VER);
+      if (rc)
+        ;
+      else if (vr.r.ver.version >= 4)
+        rc = fidx_remove (ctrl, rec.r.trust.fingerprint, rec.recnum);
+      else
+        rc = drop_from_hashtable (ctrl, get_trusthashrec (ctrl),
+                                  rec.r.trust.fingerprint, 20, rec.recnum);
     }
 
   if (rc)
@@ -1841,6 +2480,7 @@ tdbio_new_recnum (ctrl_t ctrl)
       if (rc)
         log_fatal (_("%s: failed to append a record: %s\n"),
                    db_name, gpg_strerror (rc));
+      adjust_cache_limit (recnum + 1);
     }
 
   return recnum ;
@@ -1869,6 +2509,7 @@ tdbio_search_trust_byfpr (ctrl_t ctrl, const byte *fpr, unsigned int fprlen,
 {
   int rc;
   byte fingerprint[20];
+  TRUSTREC vr;
 
   if (fprlen != 20)
     {
@@ -1876,6 +2517,12 @@ tdbio_search_trust_byfpr (ctrl_t ctrl, const byte *fpr, unsigned int fprlen,
       fpr = fingerprint;
     }
 
+  rc = tdbio_read_record (0, &vr, RECTYPE_VER);
+  if (rc)
+    return rc;
+  if (vr.r.ver.version >= 4)
+    return fidx_lookup (&vr, fpr, rec);
+
   /* Locate the trust record using the hash table */
   rc = lookup_hashtable (get_trusthashrec (ctrl), fpr, 20,
                          cmp_trec_fpr, fpr, rec);
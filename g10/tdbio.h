@@ -27,6 +27,7 @@
 #define ITEMS_PER_HTBL_RECORD	((TRUST_RECORD_LEN-2)/4)
 #define ITEMS_PER_HLST_RECORD	((TRUST_RECORD_LEN-6)/5)
 #define ITEMS_PER_PREF_RECORD	(TRUST_RECORD_LEN-10)
+#define ITEMS_PER_FIDX_RECORD	((TRUST_RECORD_LEN-2)/8)
 #if ITEMS_PER_PREF_RECORD % 2
 #error ITEMS_PER_PREF_RECORD must be even
 #endif
@@ -38,6 +39,7 @@
 #define RECTYPE_HLST 11
 #define RECTYPE_TRUST 12
 #define RECTYPE_VALID 13
+#define RECTYPE_FIDX 14
 #define RECTYPE_FREE 254
 
 
@@ -49,7 +51,7 @@ struct trust_record {
     ulong recnum;
     union {
 	struct {	     /* version record: */
-	    byte  version;   /* should be 3 */
+	    byte  version;   /* should be 3 or 4 */
 	    byte  marginals;
 	    byte  completes;
 	    byte  cert_depth;
@@ -57,11 +59,11 @@ struct trust_record {
 	    byte  min_cert_level;
 	    ulong created;   /* timestamp of trustdb creation  */
 	    ulong nextcheck; /* timestamp of next scheduled check */
-	    ulong reserved;
-	    ulong reserved2;
+	    ulong fidxtbl;   /* first record of the fingerprint index (v4) */
+	    ulong fidxsize;  /* number of records of that index (v4) */
 	    ulong firstfree;
-	    ulong reserved3;
-            ulong trusthashtbl;
+	    ulong fidxcount; /* number of used slots of that index (v4) */
+            ulong trusthashtbl; /* (v3) */
 	} ver;
 	struct {	    /* free record */
 	    ulong next;
@@ -73,6 +75,10 @@ struct trust_record {
 	    ulong next;
 	    ulong rnum[ITEMS_PER_HLST_RECORD]; /* of another record */
 	} hlst;
+	struct {
+	    u32   tag[ITEMS_PER_FIDX_RECORD];  /* first 4 bytes of the fpr */
+	    ulong rnum[ITEMS_PER_FIDX_RECORD]; /* of the trust record */
+	} fidx;
       struct {
         byte fingerprint[20];
         byte ownertrust;
@@ -94,6 +100,7 @@ typedef struct trust_record TRUSTREC;
 
 /*-- tdbio.c --*/
 int tdbio_update_version_record (ctrl_t ctrl);
+char *tdbio_make_dbname (const char *new_dbname);
 int tdbio_set_dbname (ctrl_t ctrl, const char *new_dbname,
                       int create, int *r_nofile);
 const char *tdbio_get_dbname(void);
@@ -110,6 +117,7 @@ int tdbio_begin_transaction(void);
 int tdbio_end_transaction(void);
 int tdbio_cancel_transaction(void);
 int tdbio_delete_record (ctrl_t ctrl, ulong recnum);
+void tdbio_dump_stats (void);
 ulong tdbio_new_recnum (ctrl_t ctrl);
 gpg_error_t tdbio_search_trust_byfpr (ctrl_t ctrl,
                                       const byte *fpr, unsigned int fprlen,
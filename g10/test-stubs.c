@@ -242,6 +242,20 @@ keyserver_import_wkd (ctrl_t ctrl, const char *name, unsigned int flags,
   return GPG_ERR_BUG;
 }
 
+gpg_error_t
+keyserver_import_concurrent (ctrl_t ctrl, const char *name,
+                             const char *mechanisms, char **r_mechanism,
+                             unsigned char **fpr, size_t *fpr_len)
+{
+  (void)ctrl;
+  (void)name;
+  (void)mechanisms;
+  (void)fpr;
+  (void)fpr_len;
+  *r_mechanism = NULL;
+  return GPG_ERR_BUG;
+}
+
 int
 keyserver_import_mbox (ctrl_t ctrl, const char *mbox, unsigned char **fpr,
                        size_t *fprlen, struct keyserver_spec *keyserver)
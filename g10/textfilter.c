@@ -42,22 +42,16 @@
 			  /* to make sure that a warning is displayed while */
 			  /* creating a message */
 
+/* Return the length of LINE without the trailing characters from
+ * TRIMCHARS.  We scan backwards so that the cost depends only on the
+ * number of trailing characters and not on the length of the line.  */
 static unsigned
 len_without_trailing_chars( byte *line, unsigned len, const char *trimchars )
 {
-    byte *p, *mark;
-    unsigned n;
+    while( len && strchr( trimchars, line[len-1] ) )
+	len--;
 
-    for(mark=NULL, p=line, n=0; n < len; n++, p++ ) {
-	if( strchr( trimchars, *p ) ) {
-	    if( !mark )
-		mark = p;
-	}
-	else
-	    mark = NULL;
-    }
-
-    return mark? (mark - line) : len;
+    return len;
 }
 
 
@@ -74,8 +68,15 @@ standard( text_filter_context_t *tfx, IOBUF a,
     while( !rc && len < size ) {
 	int lf_seen;
 
-	while( len < size && tfx->buffer_pos < tfx->buffer_len )
-	    buf[len++] = tfx->buffer[tfx->buffer_pos++];
+	if( tfx->buffer_pos < tfx->buffer_len ) {
+	    size_t n = tfx->buffer_len - tfx->buffer_pos;
+
+	    if( n > size - len )
+		n = size - len;
+	    memcpy( buf + len, tfx->buffer + tfx->buffer_pos, n );
+	    len += n;
+	    tfx->buffer_pos += n;
+	}
 	if( len >= size )
 	    continue;
 
@@ -110,11 +111,13 @@ standard( text_filter_context_t *tfx, IOBUF a,
 	   this actually makes us compatible with PGP textmode
 	   detached signatures for the first time. */
 	if(opt.rfc2440_text)
-	  tfx->buffer_len=trim_trailing_chars(tfx->buffer,tfx->buffer_len,
-					      " \t\r\n");
+	  tfx->buffer_len=len_without_trailing_chars(tfx->buffer,
+						     tfx->buffer_len,
+						     " \t\r\n");
 	else
-	  tfx->buffer_len=trim_trailing_chars(tfx->buffer,tfx->buffer_len,
-					      "\r\n");
+	  tfx->buffer_len=len_without_trailing_chars(tfx->buffer,
+						     tfx->buffer_len,
+						     "\r\n");
 
 	if( lf_seen ) {
 	    tfx->buffer[tfx->buffer_len++] = '\r';
@@ -185,10 +188,8 @@ copy_clearsig_text( IOBUF out, IOBUF inp, gcry_md_hd_t md,
 
 	/* update the message digest */
 	if( escape_dash ) {
-	    if( pending_lf ) {
-		gcry_md_putc ( md, '\r' );
-		gcry_md_putc ( md, '\n' );
-	    }
+	    if( pending_lf )
+		gcry_md_write ( md, "\r\n", 2 );
 	    gcry_md_write ( md, buffer,
                             len_without_trailing_chars (buffer, n, " \t\r\n"));
 	}
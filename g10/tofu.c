@@ -82,6 +82,9 @@ struct tofu_dbs_s
     sqlite3_stmt *register_already_seen;
     sqlite3_stmt *register_signature;
     sqlite3_stmt *register_encryption;
+    sqlite3_stmt *get_conflict_set;
+    sqlite3_stmt *put_conflict_set;
+    sqlite3_stmt *forget_conflict_sets;
   } s;
 
   int in_batch_transaction;
@@ -172,6 +175,7 @@ begin_transaction (ctrl_t ctrl, int only_batch)
   tofu_dbs_t dbs = ctrl->tofu.dbs;
   int rc;
   char *err = NULL;
+  char sql[32];
 
   log_assert (dbs);
 
@@ -247,9 +251,10 @@ begin_transaction (ctrl_t ctrl, int only_batch)
   log_assert (dbs->in_transaction >= 0);
   dbs->in_transaction ++;
 
-  rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
-                           "savepoint inner%d;",
-                           dbs->in_transaction);
+  /* The savepoint names only depend on the nesting level, thus the
+   * statements are picked up by gpgsql's statement cache.  */
+  snprintf (sql, sizeof sql, "savepoint inner%d;", dbs->in_transaction);
+  rc = gpgsql_stepx (dbs->db, NULL, NULL, NULL, &err, sql, GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error beginning transaction on TOFU database: %s\n"),
@@ -272,6 +277,7 @@ end_transaction (ctrl_t ctrl, int only_batch)
   tofu_dbs_t dbs = ctrl->tofu.dbs;
   int rc;
   char *err = NULL;
+  char sql[32];
 
   if (only_batch || (! only_batch && dbs->in_transaction == 1))
     {
@@ -314,8 +320,8 @@ end_transaction (ctrl_t ctrl, int only_batch)
   log_assert (dbs);
   log_assert (dbs->in_transaction > 0);
 
-  rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
-                           "release inner%d;", dbs->in_transaction);
+  snprintf (sql, sizeof sql, "release inner%d;", dbs->in_transaction);
+  rc = gpgsql_stepx (dbs->db, NULL, NULL, NULL, &err, sql, GPGSQL_ARG_END);
 
   dbs->in_transaction --;
 
@@ -337,15 +343,15 @@ rollback_transaction (ctrl_t ctrl)
   tofu_dbs_t dbs = ctrl->tofu.dbs;
   int rc;
   char *err = NULL;
+  char sql[32];
 
   log_assert (dbs);
   log_assert (dbs->in_transaction > 0);
 
   /* Be careful to not undo any progress made by closed transactions in
      batch mode.  */
-  rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
-                           "rollback to inner%d;",
-                           dbs->in_transaction);
+  snprintf (sql, sizeof sql, "rollback to inner%d;", dbs->in_transaction);
+  rc = gpgsql_stepx (dbs->db, NULL, NULL, NULL, &err, sql, GPGSQL_ARG_END);
 
   dbs->in_transaction --;
 
@@ -845,6 +851,27 @@ initdb (sqlite3 *db)
           sqlite3_free (err);
         }
     }
+  if (! rc)
+    {
+      /* The conflict sets computed by build_conflict_set.  This is a
+       * cache: an entry is only valid for the state of the key
+       * database it was computed for and until VALID_UNTIL (if not
+       * 0).  All entries for an email address are removed when one
+       * of its bindings changes.  */
+      rc = sqlite3_exec (db,
+                         "create table if not exists conflict_sets"
+                         " (email TEXT NOT NULL, fingerprint TEXT NOT NULL,"
+                         "  keydb_state BLOB, valid_until INTEGER,"
+                         "  members TEXT,"
+                         "  primary key (email, fingerprint));",
+                         NULL, NULL, &err);
+      if (rc)
+        {
+	  log_error ("error creating 'conflict_sets' TOFU table: %s\n",
+		     err);
+          sqlite3_free (err);
+        }
+    }
   if (! rc)
     {
       /* The effective policy for a binding.  If a key is ultimately
@@ -1009,6 +1036,7 @@ tofu_closedbs (ctrl_t ctrl)
        (void *) statements < (void *) &(&dbs->s)[1];
        statements ++)
     sqlite3_finalize (*statements);
+  gpgsql_release_cache (dbs->db);
 
   sqlite3_close (dbs->db);
   xfree (dbs->want_lock_file);
@@ -1042,6 +1070,28 @@ get_single_long_cb2 (void *cookie, int argc, char **argv, char **azColName,
   return get_single_long_cb (cookie, argc, argv, azColName);
 }
 
+/* Remove the cached conflict sets of all bindings for EMAIL.  This
+ * needs to be called whenever a binding for EMAIL is added or its
+ * conflict is changed.  */
+static void
+forget_conflict_sets (tofu_dbs_t dbs, const char *email)
+{
+  int rc;
+  char *err = NULL;
+
+  rc = gpgsql_stepx (dbs->db, &dbs->s.forget_conflict_sets,
+                     NULL, NULL, &err,
+                     "delete from conflict_sets where email = ?;",
+                     GPGSQL_ARG_STRING, email, GPGSQL_ARG_END);
+  if (rc)
+    {
+      log_error (_("error updating TOFU database: %s\n"), err);
+      print_further_info ("dropping conflict sets for %s", email);
+      sqlite3_free (err);
+    }
+}
+
+
 /* Record (or update) a trust policy about a (possibly new)
    binding.
 
@@ -1152,6 +1202,8 @@ record_binding (tofu_dbs_t dbs, const char *fingerprint, const char *email,
       goto leave;
     }
 
+  forget_conflict_sets (dbs, email);
+
  leave:
   xfree (fingerprint_pp);
   return rc;
@@ -2034,6 +2086,116 @@ ask_about_binding (ctrl_t ctrl,
   signature_stats_free (stats);
 }
 
+/* Return the conflict set for the binding <FINGERPRINT, EMAIL> as
+ * cached by put_cached_conflict_set or NULL if there is no valid
+ * entry for the key database state STATE.  */
+static strlist_t
+get_cached_conflict_set (tofu_dbs_t dbs, const char *fingerprint,
+                         const char *email, const unsigned char *state)
+{
+  int rc;
+  char *sqerr = NULL;
+  strlist_t results = NULL;
+  strlist_t conflict_set = NULL;
+  strlist_t tail = NULL;
+  char *p, *pend, *flags;
+
+  rc = gpgsql_stepx
+    (dbs->db, &dbs->s.get_conflict_set,
+     strings_collect_cb2, &results, &sqerr,
+     "select members from conflict_sets"
+     " where email = ? and fingerprint = ? and keydb_state = ?"
+     "  and (valid_until = 0 or valid_until > ?);",
+     GPGSQL_ARG_STRING, email, GPGSQL_ARG_STRING, fingerprint,
+     GPGSQL_ARG_BLOB, state, (long long) KEYDB_STATELEN,
+     GPGSQL_ARG_LONG_LONG, (long long) gnupg_get_time (),
+     GPGSQL_ARG_END);
+  if (rc)
+    {
+      log_error (_("error reading TOFU database: %s\n"), sqerr);
+      print_further_info ("reading conflict set");
+      sqlite3_free (sqerr);
+      return NULL;
+    }
+  if (!results)
+    return NULL;
+
+  /* The members are stored as a space separated list of
+   * "FINGERPRINT:FLAGS" items with the binding itself first.  */
+  for (p = results->d; *p; p = pend)
+    {
+      pend = strchr (p, ' ');
+      if (pend)
+        *pend++ = 0;
+      else
+        pend = p + strlen (p);
+      flags = strchr (p, ':');
+      if (!flags)
+        break;
+      *flags++ = 0;
+      tail = append_to_strlist (tail? &tail : &conflict_set, p);
+      tail->flags = strtoul (flags, NULL, 10);
+    }
+  free_strlist (results);
+
+  if (!conflict_set || strcmp (conflict_set->d, fingerprint))
+    {
+      log_info (_("TOFU db corruption detected.\n"));
+      print_further_info ("bad conflict set for <key: %s, email: %s>",
+                          fingerprint, email);
+      free_strlist (conflict_set);
+      return NULL;
+    }
+
+  return conflict_set;
+}
+
+
+/* Store CONFLICT_SET as the conflict set for the binding
+ * <FINGERPRINT, EMAIL> and the key database state STATE.  The entry
+ * expires at VALID_UNTIL unless that is 0.  */
+static void
+put_cached_conflict_set (tofu_dbs_t dbs, const char *fingerprint,
+                         const char *email, const unsigned char *state,
+                         u32 valid_until, strlist_t conflict_set)
+{
+  int rc;
+  char *sqerr = NULL;
+  strlist_t iter;
+  size_t len;
+  char *members, *p;
+
+  if (opt.dry_run)
+    return;
+
+  for (len = 1, iter = conflict_set; iter; iter = iter->next)
+    len += strlen (iter->d) + 12;
+  p = members = xmalloc (len);
+  *p = 0;
+  for (iter = conflict_set; iter; iter = iter->next)
+    p += sprintf (p, "%s%s:%u", p == members ? "" : " ",
+                  iter->d, iter->flags);
+
+  rc = gpgsql_stepx
+    (dbs->db, &dbs->s.put_conflict_set, NULL, NULL, &sqerr,
+     "insert or replace into conflict_sets"
+     " (email, fingerprint, keydb_state, valid_until, members)"
+     " values (?, ?, ?, ?, ?);",
+     GPGSQL_ARG_STRING, email, GPGSQL_ARG_STRING, fingerprint,
+     GPGSQL_ARG_BLOB, state, (long long) KEYDB_STATELEN,
+     GPGSQL_ARG_LONG_LONG, (long long) valid_until,
+     GPGSQL_ARG_STRING, members,
+     GPGSQL_ARG_END);
+  xfree (members);
+  if (rc)
+    {
+      log_error (_("error updating TOFU database: %s\n"), sqerr);
+      print_further_info ("storing conflict set");
+      sqlite3_free (sqerr);
+    }
+}
+
+
 /* Return the set of keys that conflict with the binding <fingerprint,
    email> (including the binding itself, which will be first in the
    list).  For each returned key also sets BINDING_NEW, etc.  */
@@ -2050,6 +2212,21 @@ build_conflict_set (ctrl_t ctrl, tofu_dbs_t dbs,
   kbnode_t *kb_all;
   KEYDB_HANDLE hd;
   int i;
+  unsigned char state[KEYDB_STATELEN];
+  int have_state;
+  u32 now = make_timestamp ();
+  u32 valid_until = 0;
+
+  /* The result only depends on the bindings for EMAIL, which
+   * invalidate the cached sets when they change, on the keys and on
+   * the time, because keys and user ids may expire.  */
+  have_state = !keydb_get_state (state);
+  if (have_state)
+    {
+      conflict_set = get_cached_conflict_set (dbs, fingerprint, email, state);
+      if (conflict_set)
+        return conflict_set;
+    }
 
   /* Get the fingerprints of any bindings that share the email address
    * and whether the bindings have a known conflict.
@@ -2129,6 +2306,10 @@ build_conflict_set (ctrl_t ctrl, tofu_dbs_t dbs,
       if (pk->flags.revoked)
         conflict_set->flags |= BINDING_REVOKED;
 
+      if (have_state)
+        put_cached_conflict_set (dbs, fingerprint, email, state,
+                                 pk->has_expired? 0 : pk->expiredate,
+                                 conflict_set);
       return conflict_set;
     }
 
@@ -2199,6 +2380,9 @@ build_conflict_set (ctrl_t ctrl, tofu_dbs_t dbs,
         iter->flags |= BINDING_EXPIRED;
       if (binding_pk->flags.revoked)
         iter->flags |= BINDING_REVOKED;
+      if (binding_pk->expiredate > now
+          && (!valid_until || binding_pk->expiredate < valid_until))
+        valid_until = binding_pk->expiredate;
 
       /* The binding is also expired/revoked if the user id is
        * expired/revoked.  */
@@ -2222,6 +2406,9 @@ build_conflict_set (ctrl_t ctrl, tofu_dbs_t dbs,
                 iter->flags |= BINDING_REVOKED;
               if (user_id2->flags.expired)
                 iter->flags |= BINDING_EXPIRED;
+              if (user_id2->expiredate > now
+                  && (!valid_until || user_id2->expiredate < valid_until))
+                valid_until = user_id2->expiredate;
             }
 
           xfree (email2);
@@ -2308,6 +2495,10 @@ build_conflict_set (ctrl_t ctrl, tofu_dbs_t dbs,
         }
     }
 
+  if (have_state)
+    put_cached_conflict_set (dbs, fingerprint, email, state,
+                             valid_until, conflict_set);
+
   return conflict_set;
 }
 
@@ -2821,12 +3012,15 @@ get_trust (ctrl_t ctrl, PKT_public_key *pk,
     {
       /* We don't immediately set the effective policy to 'ask,
          because  */
-      rc = gpgsql_exec_printf
-        (dbs->db, NULL, NULL, &sqerr,
-         "update bindings set effective_policy = %d, conflict = %Q"
-         " where email = %Q and fingerprint = %Q and effective_policy != %d;",
-         TOFU_POLICY_NONE, fingerprint,
-         email, iter->d, TOFU_POLICY_ASK);
+      rc = gpgsql_stepx
+        (dbs->db, NULL, NULL, NULL, &sqerr,
+         "update bindings set effective_policy = ?, conflict = ?"
+         " where email = ? and fingerprint = ? and effective_policy != ?;",
+         GPGSQL_ARG_INT, (int) TOFU_POLICY_NONE,
+         GPGSQL_ARG_STRING, fingerprint,
+         GPGSQL_ARG_STRING, email, GPGSQL_ARG_STRING, iter->d,
+         GPGSQL_ARG_INT, (int) TOFU_POLICY_ASK,
+         GPGSQL_ARG_END);
       if (rc)
         {
           log_error (_("error changing TOFU policy: %s\n"), sqerr);
@@ -2840,6 +3034,7 @@ get_trust (ctrl_t ctrl, PKT_public_key *pk,
         log_debug ("Set %s to conflict with %s\n",
                    iter->d, fingerprint);
     }
+  forget_conflict_sets (dbs, email);
 
  out:
   if (in_transaction)
@@ -3011,14 +3206,15 @@ show_statistics (tofu_dbs_t dbs,
   fingerprint_pp = format_hexfingerprint (fingerprint, NULL, 0);
 
   /* Get the signature stats.  */
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
+  rc = gpgsql_stepx
+    (dbs->db, NULL, strings_collect_cb2, &strlist, &err,
      "select count (*), coalesce (min (signatures.time), 0),\n"
      "  coalesce (max (signatures.time), 0)\n"
      " from signatures\n"
      " left join bindings on signatures.binding = bindings.oid\n"
-     " where fingerprint = %Q and email = %Q;",
-     fingerprint, email);
+     " where fingerprint = ? and email = ?;",
+     GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+     GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -3027,15 +3223,16 @@ show_statistics (tofu_dbs_t dbs,
       rc = gpg_error (GPG_ERR_GENERAL);
       goto out;
     }
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
+  rc = gpgsql_stepx
+    (dbs->db, NULL, strings_collect_cb2, &strlist, &err,
      "select count (*) from\n"
      "  (select round(signatures.time / (24 * 60 * 60)) day\n"
      "    from signatures\n"
      "    left join bindings on signatures.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
+     "    where fingerprint = ? and email = ?\n"
      "    group by day);",
-     fingerprint, email);
+     GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+     GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -3065,14 +3262,15 @@ show_statistics (tofu_dbs_t dbs,
     }
 
   /* Get the encryption stats.  */
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
+  rc = gpgsql_stepx
+    (dbs->db, NULL, strings_collect_cb2, &strlist, &err,
      "select count (*), coalesce (min (encryptions.time), 0),\n"
      "  coalesce (max (encryptions.time), 0)\n"
      " from encryptions\n"
      " left join bindings on encryptions.binding = bindings.oid\n"
-     " where fingerprint = %Q and email = %Q;",
-     fingerprint, email);
+     " where fingerprint = ? and email = ?;",
+     GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+     GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -3081,15 +3279,16 @@ show_statistics (tofu_dbs_t dbs,
       rc = gpg_error (GPG_ERR_GENERAL);
       goto out;
     }
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
+  rc = gpgsql_stepx
+    (dbs->db, NULL, strings_collect_cb2, &strlist, &err,
      "select count (*) from\n"
      "  (select round(encryptions.time / (24 * 60 * 60)) day\n"
      "    from encryptions\n"
      "    left join bindings on encryptions.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
+     "    where fingerprint = ? and email = ?\n"
      "    group by day);",
-     fingerprint, email);
+     GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+     GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
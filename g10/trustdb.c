@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "gpg.h"
 #include "../common/status.h"
@@ -29,6 +30,7 @@
 #include "../regexp/jimregexp.h"
 #include "keydb.h"
 #include "../common/util.h"
+#include "../common/sysutils.h"
 #include "options.h"
 #include "packet.h"
 #include "main.h"
@@ -38,6 +40,7 @@
 #include "trustdb.h"
 #include "tofu.h"
 #include "key-clean.h"
+#include "tdbdeps.h"
 
 
 
@@ -604,6 +607,57 @@ how_to_fix_the_trustdb (void)
 }
 
 
+/* Store a digest over the name, size, modification time and inode
+ * of the trustdb file at R_STATE, which must provide TRUSTDB_STATELEN
+ * bytes.  The nanoseconds of the modification time are included
+ * where available.  The trustdb is not opened for this; a missing
+ * trustdb has a state as well.  */
+gpg_error_t
+tdb_get_state (unsigned char *r_state)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+  struct stat st;
+  char *fname;
+  unsigned char buf[8];
+  unsigned long long ull[4];
+  int i, j;
+
+  err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
+  if (err)
+    return err;
+
+  if (tdbio_get_dbname ())
+    fname = xstrdup (tdbio_get_dbname ());
+  else
+    fname = tdbio_make_dbname (trustdb_args.dbname);
+  gcry_md_write (md, fname, strlen (fname) + 1);
+  if (gnupg_stat (fname, &st))
+    memset (ull, 0, sizeof ull);
+  else
+    {
+      ull[0] = st.st_size;
+      ull[1] = st.st_mtime;
+      ull[2] = st.st_ino;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+      ull[3] = st.st_mtim.tv_nsec;
+#else
+      ull[3] = 0;
+#endif
+    }
+  for (i=0; i < DIM (ull); i++)
+    {
+      for (j=0; j < 8; j++)
+        buf[j] = ull[i] >> (56 - 8*j);
+      gcry_md_write (md, buf, 8);
+    }
+  memcpy (r_state, gcry_md_read (md, GCRY_MD_SHA1), TRUSTDB_STATELEN);
+  gcry_md_close (md);
+  xfree (fname);
+  return 0;
+}
+
+
 /* Initialize the trustdb.  With NO_CREATE set a missing trustdb is
  * not an error and the function won't terminate the process on error;
  * in that case 0 is returned if there is a trustdb or an error code
@@ -672,6 +726,7 @@ init_trustdb (ctrl_t ctrl, int no_create)
 	pending_check_trustdb=1;
     }
 
+  log_startup_phase ("trustdb-open");
   return 0;
 }
 
@@ -1264,12 +1319,20 @@ tdb_get_validity_core (ctrl_t ctrl,
   (void)may_ask;
 #endif
 
+  /* With the trust-model always we don't know the validity - return
+     immediately.  Nothing below would change that value and thus
+     there is no need to open the trustdb or the TOFU database; this
+     also keeps verification only services from taking the locks.  */
+  if (opt.trust_model == TM_ALWAYS)
+    return TRUST_UNKNOWN;
+
   init_trustdb (ctrl, 0);
 
   /* If we have no trustdb (which also means it has not been created)
-     and the trust-model is always, we don't know the validity -
-     return immediately.  If we won't do that the tdbio code would try
-     to open the trustdb and run into a fatal error.  */
+     and the trust-model is always (as read by init_trustdb for
+     --trust-model auto), we don't know the validity - return
+     immediately.  If we won't do that the tdbio code would try to
+     open the trustdb and run into a fatal error.  */
   if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
     return TRUST_UNKNOWN;
 
@@ -1996,46 +2059,229 @@ search_skipfnc (void *opaque, u32 *kid, int dummy_uid_no)
 }
 
 
+/* Prepare KEYBLOCK for validate_key_list and validate it against
+ * KLIST.  This implements steps 5 to 7 as described for
+ * validate_keys.  Returns true if the caller needs to keep the
+ * keyblock.  */
+static int
+validate_key_list_item (ctrl_t ctrl, kbnode_t keyblock,
+                        KeyHashTable full_trust, struct key_item *klist,
+                        u32 curtime, u32 *next_expire)
+{
+  PKT_public_key *pk;
+  kbnode_t node;
+
+  if ( keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    {
+      log_debug ("ooops: invalid pkttype %d encountered\n",
+                 keyblock->pkt->pkttype);
+      dump_kbnode (keyblock);
+      return 0;
+    }
+
+  /* prepare the keyblock for further processing */
+  merge_keys_and_selfsig (ctrl, keyblock);
+  clear_kbnode_flags (keyblock);
+  pk = keyblock->pkt->pkt.public_key;
+  if (pk->has_expired || pk->flags.revoked)
+    {
+      /* Step 5: Mark revoked and expired keys.
+       * (it does not make sense to look further at those keys.) */
+      mark_keyblock_seen (full_trust, keyblock);
+      return 0;
+    }
+
+  if (!validate_one_keyblock (ctrl, keyblock, klist, curtime, next_expire))
+    return 0;
+
+  /* Step 6 has been done by validate_one_keyblock.  This here
+   * is step 7.  */
+  if (pk->expiredate && pk->expiredate >= curtime
+      && pk->expiredate < *next_expire)
+    *next_expire = pk->expiredate;
+
+  /* Optimization - if all uids are fully trusted, then we
+     never need to consider this key as a candidate again. */
+  for (node=keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
+      break;
+
+  if(node==NULL)
+    mark_keyblock_seen (full_trust, keyblock);
+
+  return 1;
+}
+
+
+/* The number of keyblocks whose signatures are verified together
+ * with --sig-check-threads.  */
+#define VALIDATE_BATCH_SIZE 64
+
+/* The state while collecting the keys of one level.  */
+struct validate_level_s
+{
+  ctrl_t ctrl;
+  KeyHashTable full_trust;
+  struct key_item *klist;
+  u32 curtime;
+  u32 *next_expire;
+  struct key_array *keys;  /* The result.  */
+  size_t nkeys;
+  size_t maxkeys;
+  kbnode_t pending[VALIDATE_BATCH_SIZE];
+  int npending;
+};
+
+
+static void
+init_validate_level (struct validate_level_s *lv, ctrl_t ctrl,
+                     KeyHashTable full_trust, struct key_item *klist,
+                     u32 curtime, u32 *next_expire)
+{
+  memset (lv, 0, sizeof *lv);
+  lv->ctrl = ctrl;
+  lv->full_trust = full_trust;
+  lv->klist = klist;
+  lv->curtime = curtime;
+  lv->next_expire = next_expire;
+  lv->maxkeys = 1000;  /* Initially allocate space for 1000 keys.  */
+  lv->keys = xmalloc ((lv->maxkeys+1) * sizeof *lv->keys);
+}
+
+
+/* Filter for check_key_signatures_multi to consider only the
+ * certifications validate_one_keyblock looks at.  */
+static int
+klist_sig_filter (void *opaque, PKT_signature *sig)
+{
+  return !!is_in_klist (opaque, sig);
+}
+
+
+/* Validate the pending keyblocks of LV.  With --sig-check-threads
+ * their signatures are first verified in parallel; the validation
+ * itself and thus all updates are done in order.  */
+static void
+flush_validate_level (struct validate_level_s *lv)
+{
+  kbnode_t keyblock;
+  u32 kid[2];
+  int i;
+
+  if (lv->npending > 1)
+    check_key_signatures_multi (lv->ctrl, lv->pending, lv->npending, 0,
+                                klist_sig_filter, lv->klist);
+
+  for (i=0; i < lv->npending; i++)
+    {
+      keyblock = lv->pending[i];
+      lv->pending[i] = NULL;
+
+      /* The caller checked FULL_TRUST before queuing the keyblock but
+       * an earlier keyblock of the batch might have been a copy.  */
+      if (i && keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
+        {
+          keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+          if (test_key_hash_table (lv->full_trust, kid))
+            {
+              release_kbnode (keyblock);
+              continue;
+            }
+        }
+
+      if (validate_key_list_item (lv->ctrl, keyblock, lv->full_trust,
+                                  lv->klist, lv->curtime, lv->next_expire))
+        {
+          if (lv->nkeys == lv->maxkeys)
+            {
+              lv->maxkeys += 1000;
+              lv->keys = xrealloc (lv->keys,
+                                   (lv->maxkeys+1) * sizeof *lv->keys);
+            }
+          lv->keys[lv->nkeys++].keyblock = keyblock;
+        }
+      else
+        release_kbnode (keyblock);
+    }
+  lv->npending = 0;
+}
+
+
+/* Queue KEYBLOCK for validation; LV takes ownership.  */
+static void
+add_validate_level (struct validate_level_s *lv, kbnode_t keyblock)
+{
+  lv->pending[lv->npending++] = keyblock;
+  if (lv->npending == VALIDATE_BATCH_SIZE || opt.sig_check_threads < 2)
+    flush_validate_level (lv);
+}
+
+
+/* Validate the remaining keyblocks of LV and return the key array.
+ * On error ERROR is set and NULL is returned.  */
+static struct key_array *
+finish_validate_level (struct validate_level_s *lv, int error)
+{
+  int i;
+
+  if (error)
+    {
+      for (i=0; i < lv->npending; i++)
+        release_kbnode (lv->pending[i]);
+      lv->npending = 0;
+    }
+  else
+    flush_validate_level (lv);
+
+  lv->keys[lv->nkeys].keyblock = NULL;
+  if (error)
+    {
+      release_key_array (lv->keys);
+      lv->keys = NULL;
+    }
+  return lv->keys;
+}
+
+
 /* This implements steps 4 to 7 as described for validate_keys.
  *
  * Scan all keys and return a key_array of all suitable keys from
  * klist.  The caller has to pass keydb handle so that we don't need
  * to create our own.  Returns either a key_array or NULL in case of
  * an error.  No results found are indicated by an empty array.
- * Caller has to release the returned array.
+ * Caller has to release the returned array.  If RECORD_DEPS is set
+ * all keyblocks are also passed to the certification index.
  */
 static struct key_array *
 validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
-                   struct key_item *klist, u32 curtime, u32 *next_expire)
+                   struct key_item *klist, u32 curtime, u32 *next_expire,
+                   int record_deps)
 {
   KBNODE keyblock = NULL;
-  struct key_array *keys = NULL;
-  size_t nkeys, maxkeys;
+  struct validate_level_s lv;
   int rc;
   KEYDB_SEARCH_DESC desc;
 
-  maxkeys = 1000;  /* Initially allocate space for 1000 keys.  */
-  keys = xmalloc ((maxkeys+1) * sizeof *keys);
-  nkeys = 0;
-
   rc = keydb_search_reset (hd);
   if (rc)
     {
       log_error ("keydb_search_reset failed: %s\n", gpg_strerror (rc));
-      xfree (keys);
       return NULL;
     }
 
+  init_validate_level (&lv, ctrl, full_trust, klist, curtime, next_expire);
+
   memset (&desc, 0, sizeof desc);
   desc.mode = KEYDB_SEARCH_MODE_FIRST;
-  desc.skipfnc = search_skipfnc;
-  desc.skipfncvalue = full_trust;
-  rc = keydb_search (hd, &desc, 1, NULL);
-  if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
+  if (!record_deps)
     {
-      keys[nkeys].keyblock = NULL;
-      return keys;
+      /* The index needs to see all keys.  */
+      desc.skipfnc = search_skipfnc;
+      desc.skipfncvalue = full_trust;
     }
+  rc = keydb_search (hd, &desc, 1, NULL);
+  if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
+    return finish_validate_level (&lv, 0);
   if (rc)
     {
       log_error ("keydb_search(first) failed: %s\n", gpg_strerror (rc));
@@ -2045,8 +2291,6 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
   desc.mode = KEYDB_SEARCH_MODE_NEXT; /* change mode */
   do
     {
-      PKT_public_key *pk;
-
       rc = keydb_get_keyblock (hd, &keyblock);
       if (rc)
         {
@@ -2054,56 +2298,24 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
 	  goto die;
         }
 
-      if ( keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+      if (record_deps)
         {
-          log_debug ("ooops: invalid pkttype %d encountered\n",
-                     keyblock->pkt->pkttype);
-          dump_kbnode (keyblock);
-          release_kbnode(keyblock);
-          continue;
-        }
-
-      /* prepare the keyblock for further processing */
-      merge_keys_and_selfsig (ctrl, keyblock);
-      clear_kbnode_flags (keyblock);
-      pk = keyblock->pkt->pkt.public_key;
-      if (pk->has_expired || pk->flags.revoked)
-        {
-          /* Step 5: Mark revoked and expired keys.
-           * (it does not make sense to look further at those keys.) */
-          mark_keyblock_seen (full_trust, keyblock);
-        }
-      else if (validate_one_keyblock (ctrl, keyblock, klist,
-                                      curtime, next_expire))
-        {
-          /* Step 6 has been done by validate_one_keyblock.  This here
-           * is step 7.  */
-	  kbnode_t node;
-
-          if (pk->expiredate && pk->expiredate >= curtime
-              && pk->expiredate < *next_expire)
-            *next_expire = pk->expiredate;
-
-          if (nkeys == maxkeys) {
-            maxkeys += 1000;
-            keys = xrealloc (keys, (maxkeys+1) * sizeof *keys);
-          }
-          keys[nkeys++].keyblock = keyblock;
-
-	  /* Optimization - if all uids are fully trusted, then we
-	     never need to consider this key as a candidate again. */
-
-	  for (node=keyblock; node; node = node->next)
-	    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
-	      break;
-
-	  if(node==NULL)
-	    mark_keyblock_seen (full_trust, keyblock);
+          u32 kid[2];
 
-          keyblock = NULL;
+          tdbdeps_add_keyblock (keyblock);
+          if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
+            {
+              keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+              if (test_key_hash_table (full_trust, kid))
+                {
+                  release_kbnode (keyblock);
+                  keyblock = NULL;
+                  continue;
+                }
+            }
         }
 
-      release_kbnode (keyblock);
+      add_validate_level (&lv, keyblock);
       keyblock = NULL;
     }
   while (!(rc = keydb_search (hd, &desc, 1, NULL)));
@@ -2114,13 +2326,80 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
       goto die;
     }
 
-  keys[nkeys].keyblock = NULL;
-  return keys;
+  return finish_validate_level (&lv, 0);
 
  die:
-  keys[nkeys].keyblock = NULL;
-  release_key_array (keys);
-  return NULL;
+  return finish_validate_level (&lv, 1);
+}
+
+
+/* This is a variant of validate_key_list which uses the
+ * certification index to look only at the keys certified by a key in
+ * KLIST instead of scanning all keys.  The result is the same because
+ * validate_one_keyblock does not accept any other key.  */
+static struct key_array *
+validate_signed_keys (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
+                      struct key_item *klist, u32 curtime, u32 *next_expire)
+{
+  gpg_error_t err;
+  KBNODE keyblock = NULL;
+  struct validate_level_s lv;
+  struct key_item *k;
+  KEYDB_SEARCH_DESC *descs = NULL;
+  size_t ndescs, n;
+  KeyHashTable done;
+  u32 kid[2];
+
+  init_validate_level (&lv, ctrl, full_trust, klist, curtime, next_expire);
+  done = new_key_hash_table ();
+
+  for (k=klist; k; k = k->next)
+    {
+      err = tdbdeps_get_signees (k->kid, &descs, &ndescs);
+      if (err)
+        {
+          log_error ("tdbdeps_get_signees failed: %s\n", gpg_strerror (err));
+          goto die;
+        }
+      for (n=0; n < ndescs; n++)
+        {
+          keyid_from_fingerprint (ctrl, descs[n].u.fpr, descs[n].fprlen, kid);
+          if (test_key_hash_table (done, kid)
+              || test_key_hash_table (full_trust, kid))
+            continue;
+          add_key_hash_table (done, kid);
+
+          keydb_search_reset (hd);
+          err = keydb_search (hd, descs + n, 1, NULL);
+          if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+            continue;  /* The key has been deleted.  */
+          if (err)
+            {
+              log_error ("keydb_search failed: %s\n", gpg_strerror (err));
+              goto die;
+            }
+          err = keydb_get_keyblock (hd, &keyblock);
+          if (err)
+            {
+              log_error ("keydb_get_keyblock failed: %s\n",
+                         gpg_strerror (err));
+              goto die;
+            }
+
+          add_validate_level (&lv, keyblock);
+          keyblock = NULL;
+        }
+      xfree (descs);
+      descs = NULL;
+    }
+
+  release_key_hash_table (done);
+  return finish_validate_level (&lv, 0);
+
+ die:
+  xfree (descs);
+  release_key_hash_table (done);
+  return finish_validate_level (&lv, 1);
 }
 
 /* Caller must sync */
@@ -2207,13 +2486,25 @@ validate_keys (ctrl_t ctrl, int interactive)
   int ot_unknown, ot_undefined, ot_never, ot_marginal, ot_full, ot_ultimate;
   KeyHashTable used, full_trust;
   u32 start_time, next_expire;
+  int use_deps, deps_started = 0, deps_scanned = 0;
+  int in_transaction = 0;
+
+  /* If the certification index is up to date, only the keys
+   * reachable from the ultimately trusted keys need to be looked at;
+   * otherwise the first round scans all keys and rebuilds the
+   * index.  */
+  use_deps = tdbdeps_usable ();
+  if (DBG_TRUST)
+    log_debug ("%s: %s the certification index\n",
+               __func__, use_deps? "using" : "rebuilding");
 
   /* Make sure we have all sigs cached.  TODO: This is going to
      require some architectural re-thinking, as it is agonizingly slow.
      Perhaps combine this with reset_trust_records(), or only check
      the caches on keys that are actually involved in the web of
      trust. */
-  keydb_rebuild_caches (ctrl, 0);
+  if (!use_deps)
+    keydb_rebuild_caches (ctrl, 0);
 
   kdb = keydb_new (ctrl);
   if (!kdb)
@@ -2224,6 +2515,11 @@ validate_keys (ctrl_t ctrl, int interactive)
   used = new_key_hash_table ();
   full_trust = new_key_hash_table ();
 
+  /* Keep all updates in the record cache and write them back sorted
+   * at the end of the check.  */
+  if (!tdbio_begin_transaction ())
+    in_transaction = 1;
+
   reset_trust_records (ctrl);
 
   /* Step 1 */
@@ -2294,6 +2590,12 @@ validate_keys (ctrl_t ctrl, int interactive)
               opt.marginals_needed, opt.completes_needed,
               trust_model_string (opt.trust_model));
 
+  if (!use_deps)
+    {
+      tdbdeps_begin_rebuild ();
+      deps_started = 1;
+    }
+
   /* Step 2 */
   for (depth=0; depth < opt.max_cert_depth; depth++)
     {
@@ -2361,8 +2663,21 @@ validate_keys (ctrl_t ctrl, int interactive)
         }
 
       /* Step 4: Find all keys which are signed by a key in klist */
-      keys = validate_key_list (ctrl, kdb, full_trust, klist,
-				start_time, &next_expire);
+      if (use_deps)
+        keys = validate_signed_keys (ctrl, kdb, full_trust, klist,
+                                     start_time, &next_expire);
+      else
+        {
+          keys = validate_key_list (ctrl, kdb, full_trust, klist,
+                                    start_time, &next_expire, !depth);
+          if (keys && !depth)
+            {
+              /* The new index is complete now; use it for the next
+               * rounds.  */
+              deps_scanned = 1;
+              use_deps = tdbdeps_rebuilding ();
+            }
+        }
       if (!keys)
         {
           log_error ("validate_key_list failed\n");
@@ -2445,6 +2760,15 @@ validate_keys (ctrl_t ctrl, int interactive)
   release_key_items (valid_utk_list);
   release_key_hash_table (full_trust);
   release_key_hash_table (used);
+  if (in_transaction)
+    {
+      int rc2 = tdbio_end_transaction ();
+      if (rc2)
+        {
+          log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc2));
+          g10_exit (2);
+        }
+    }
   if (!rc && !quit) /* mark trustDB as checked */
     {
       int rc2;
@@ -2470,6 +2794,8 @@ validate_keys (ctrl_t ctrl, int interactive)
       do_sync ();
       pending_check_trustdb = 0;
     }
+  if (deps_started)
+    tdbdeps_end_rebuild (deps_scanned && !rc && !quit);
 
   return rc;
 }
@@ -45,6 +45,9 @@
 /* Length of the hash used to select UIDs in keyedit.c.  */
 #define NAMEHASH_LEN  20
 
+/* The length of the state returned by tdb_get_state.  */
+#define TRUSTDB_STATELEN 20
+
 
 /*-- trust.c --*/
 int cache_disabled_value (ctrl_t ctrl, PKT_public_key *pk);
@@ -85,6 +88,7 @@ void check_trustdb (ctrl_t ctrl);
 void update_trustdb (ctrl_t ctrl);
 int setup_trustdb( int level, const char *dbname );
 void how_to_fix_the_trustdb (void);
+gpg_error_t tdb_get_state (unsigned char *r_state);
 const char *trust_model_string (int model);
 gpg_error_t init_trustdb (ctrl_t ctrl, int no_create);
 int have_trustdb (ctrl_t ctrl);
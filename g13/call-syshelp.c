@@ -410,7 +410,18 @@ call_syshelp_run_create (ctrl_t ctrl, int conttype)
   init_membuf (&parm.plaintext, 512);
   if (conttype == CONTTYPE_DM_CRYPT)
     {
-      err = assuan_transact (ctx, "CREATE dm-crypt",
+      const char *command;
+
+      if (!opt.dmcrypt_tuning || !strcmp (opt.dmcrypt_tuning, "auto"))
+        command = "CREATE dm-crypt";
+      else if (!strcmp (opt.dmcrypt_tuning, "none"))
+        command = "CREATE --no-tuning dm-crypt";
+      else if (!strcmp (opt.dmcrypt_tuning, "hdd"))
+        command = "CREATE --hdd dm-crypt";
+      else
+        command = "CREATE --ssd dm-crypt";
+
+      err = assuan_transact (ctx, command,
                              create_data_cb, &parm,
                              create_inq_cb, &parm,
                              create_status_cb, &parm);
@@ -83,6 +83,10 @@ struct
 
   int no_mount; /* Stop right before mounting a device.  */
 
+  /* The dm-crypt performance settings for new containers: NULL or
+     "auto" for the default, "none", "hdd" or "ssd".  */
+  const char *dmcrypt_tuning;
+
 } opt;
 
 
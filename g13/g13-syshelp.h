@@ -79,11 +79,24 @@ gpg_error_t sh_encrypt_keyblob (ctrl_t ctrl,
 
 /*-- sh-blockdev.c --*/
 gpg_error_t sh_blockdev_getsz (const char *name, unsigned long long *r_nblocks);
+gpg_error_t sh_blockdev_getss (const char *name, unsigned int *r_size);
+int sh_blockdev_is_rotational (const char *name);
 gpg_error_t sh_is_empty_partition (const char *name);
 
 /*-- sh-dmcrypt.c --*/
+
+/* Values for the TUNING argument of sh_dmcrypt_create_container.  */
+enum sh_dmcrypt_tuning
+  {
+    SH_DMCRYPT_TUNING_AUTO = 0,  /* Depending on the device.  */
+    SH_DMCRYPT_TUNING_NONE,      /* No optional parameters.  */
+    SH_DMCRYPT_TUNING_HDD,       /* Settings for rotational devices.  */
+    SH_DMCRYPT_TUNING_SSD        /* Settings for SSDs and NVMe.  */
+  };
+
 gpg_error_t sh_dmcrypt_create_container (ctrl_t ctrl, const char *devname,
-                                         estream_t devfp);
+                                         estream_t devfp,
+                                         enum sh_dmcrypt_tuning tuning);
 gpg_error_t sh_dmcrypt_mount_container (ctrl_t ctrl, const char *devname,
                                         tupledesc_t keyblob, int nomount);
 gpg_error_t sh_dmcrypt_umount_container (ctrl_t ctrl, const char *devname);
@@ -61,6 +61,7 @@ enum cmd_and_opt_values {
   aGPGConfTest,
   aCreate,
   aMount,
+  aMountMany,
   aUmount,
   aSuspend,
   aResume,
@@ -104,6 +105,7 @@ enum cmd_and_opt_values {
   oDryRun,
   oNoDetach,
   oNoMount,
+  oDmcryptTuning,
 
   oNoRandomSeedFile,
   oFakedSystemTime
@@ -116,6 +118,8 @@ static gpgrt_opt_t opts[] = {
 
   ARGPARSE_c (aCreate, "create", N_("Create a new file system container")),
   ARGPARSE_c (aMount,  "mount",  N_("Mount a file system container") ),
+  ARGPARSE_c (aMountMany, "mount-many",
+              N_("Mount several file system containers") ),
   ARGPARSE_c (aUmount, "umount", N_("Unmount a file system container") ),
   ARGPARSE_c (aSuspend, "suspend", N_("Suspend a file system container") ),
   ARGPARSE_c (aResume,  "resume",  N_("Resume a file system container") ),
@@ -139,6 +143,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oNoLogFile, "no-log-file", "@"),
   ARGPARSE_s_i (oLoggerFD, "logger-fd", "@"),
   ARGPARSE_s_n (oNoMount, "no-mount", N_("stop right before running mount")),
+  ARGPARSE_s_s (oDmcryptTuning, "dmcrypt-tuning",
+                N_("|NAME|use dm-crypt settings for device type NAME")),
 
   ARGPARSE_s_n (oDryRun, "dry-run", N_("do not make any changes")),
 
@@ -490,6 +496,7 @@ main (int argc, char **argv)
 
         case aServer:
         case aMount:
+        case aMountMany:
         case aUmount:
         case aSuspend:
         case aResume:
@@ -521,6 +528,18 @@ main (int argc, char **argv)
         case oNoDetach: /*nodetach = 1; */break;
 
         case oNoMount: opt.no_mount = 1; break;
+        case oDmcryptTuning:
+          if (!strcmp (pargs.r.ret_str, "auto")
+              || !strcmp (pargs.r.ret_str, "none")
+              || !strcmp (pargs.r.ret_str, "hdd")
+              || !strcmp (pargs.r.ret_str, "ssd"))
+            opt.dmcrypt_tuning = pargs.r.ret_str;
+          else
+            {
+              pargs.r_opt = ARGPARSE_INVALID_ARG;
+              pargs.err = ARGPARSE_PRINT_ERROR;
+            }
+          break;
 
         case oDebug:
           if (parse_debug_flag (pargs.r.ret_str, &opt.debug, debug_flags))
@@ -782,6 +801,15 @@ main (int argc, char **argv)
       }
       break;
 
+    case aMountMany: /* Mount several containers.  */
+      {
+        if (argc < 1)
+          wrong_args ("--mount-many filenames");
+        start_idle_task ();
+        err = g13_mount_containers (&ctrl, argc, argv);
+      }
+      break;
+
     case aUmount: /* Unmount a mounted container.  */
       {
         if (argc != 1)
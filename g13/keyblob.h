@@ -99,6 +99,12 @@
 /* For a dm-crypt container this is the used algorithm string.  For
    example: "aes-cbc-essiv:sha256".  */
 
+#define KEYBLOB_TAG_DMOPTS 11
+/* For a dm-crypt container these are the optional parameters of the
+   crypt target as a space separated list.  For example:
+   "no_read_workqueue no_write_workqueue sector_size:4096".  This tag
+   is optional.  */
+
 #define KEYBLOB_TAG_KEYNO  16
 /* This tag indicates a new key.  The value is a 4 byte big endian
    integer giving the key number.  If the container type does only
@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <npth.h>
 
 #include "g13.h"
 #include "../common/i18n.h"
@@ -41,6 +42,19 @@
 #include "call-syshelp.h"
 
 
+/* The maximum number of containers mounted at the same time by
+   g13_mount_containers.  */
+#define MAX_MOUNT_THREADS 8
+
+/* The parameters of a mount thread.  */
+struct mount_thread_parm_s
+{
+  ctrl_t parent;          /* The control object of the caller.  */
+  const char *filename;   /* The container to mount.  */
+  gpg_error_t err;        /* The result.  */
+};
+
+
 /* Mount the container with name FILENAME at MOUNTPOINT.  */
 gpg_error_t
 g13_mount_container (ctrl_t ctrl, const char *filename, const char *mountpoint)
@@ -210,6 +224,88 @@ g13_mount_container (ctrl_t ctrl, const char *filename, const char *mountpoint)
 }
 
 
+/* The thread used by g13_mount_containers.  */
+static void *
+mount_thread (void *arg)
+{
+  struct mount_thread_parm_s *parm = arg;
+  struct server_control_s ctrl;
+
+  /* Each thread needs its own control object because it keeps the
+     connection to the syshelp.  */
+  memset (&ctrl, 0, sizeof ctrl);
+  g13_init_default_ctrl (&ctrl);
+  ctrl.no_server = parm->parent->no_server;
+  ctrl.status_fd = parm->parent->status_fd;
+  ctrl.conttype = parm->parent->conttype;
+
+  parm->err = g13_mount_container (&ctrl, parm->filename, NULL);
+  if (parm->err)
+    log_error ("error mounting container '%s': %s <%s>\n",
+               parm->filename, gpg_strerror (parm->err),
+               gpg_strsource (parm->err));
+
+  g13_deinit_default_ctrl (&ctrl);
+  return NULL;
+}
+
+
+/* Mount the NFILES containers with the names FILES concurrently.
+   Each container is mounted as if g13_mount_container had been called
+   without a mountpoint.  Returns the first error.  */
+gpg_error_t
+g13_mount_containers (ctrl_t ctrl, int nfiles, char **files)
+{
+  gpg_error_t err = 0;
+  struct mount_thread_parm_s parms[MAX_MOUNT_THREADS];
+  npth_t threads[MAX_MOUNT_THREADS];
+  int started[MAX_MOUNT_THREADS];
+  npth_attr_t tattr;
+  int idx, i, n, rc;
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    return gpg_error_from_errno (rc);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+
+  for (idx=0; idx < nfiles; idx += n)
+    {
+      n = nfiles - idx;
+      if (n > MAX_MOUNT_THREADS)
+        n = MAX_MOUNT_THREADS;
+      for (i=0; i < n; i++)
+        {
+          parms[i].parent = ctrl;
+          parms[i].filename = files[idx+i];
+          parms[i].err = 0;
+          rc = npth_create (&threads[i], &tattr, mount_thread, &parms[i]);
+          started[i] = !rc;
+          if (rc)
+            {
+              /* Mount it in this thread instead.  */
+              log_info ("error spawning mount thread: %s\n", strerror (rc));
+              mount_thread (&parms[i]);
+            }
+        }
+      for (i=0; i < n; i++)
+        {
+          if (started[i])
+            {
+              rc = npth_join (threads[i], NULL);
+              if (rc)
+                log_error ("waiting for mount thread failed: %s\n",
+                           strerror (rc));
+            }
+          if (parms[i].err && !err)
+            err = parms[i].err;
+        }
+    }
+
+  npth_attr_destroy (&tattr);
+  return err;
+}
+
+
 /* Unmount the container with name FILENAME or the one mounted at
    MOUNTPOINT.  If both are given the FILENAME takes precedence.  */
 gpg_error_t
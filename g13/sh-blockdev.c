@@ -25,11 +25,22 @@
 #include <errno.h>
 #include <assert.h>
 #include <limits.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_MKDEV_H
+#include <sys/mkdev.h>
+#endif
+#ifdef HAVE_SYS_SYSMACROS_H
+# include <sys/sysmacros.h>
+#endif
+#ifdef HAVE_STAT
+# include <sys/stat.h>
+#endif
 
 #include "g13-syshelp.h"
 #include <assuan.h>
 #include "../common/i18n.h"
 #include "../common/exectool.h"
+#include "../common/sysutils.h"
 #include "keyblob.h"
 
 #ifndef HAVE_STRTOULL
@@ -69,6 +80,75 @@ sh_blockdev_getsz (const char *name, unsigned long long *r_nblocks)
 }
 
 
+/* Return the logical sector size in bytes for the block device NAME
+   at R_SIZE.  */
+gpg_error_t
+sh_blockdev_getss (const char *name, unsigned int *r_size)
+{
+  gpg_error_t err;
+  const char *argv[3];
+  char *result;
+  unsigned long ul;
+
+  *r_size = 0;
+  argv[0] = "--getss";
+  argv[1] = name;
+  argv[2] = NULL;
+  err = gnupg_exec_tool ("/sbin/blockdev", argv, NULL, &result, NULL);
+  if (!err)
+    {
+      ul = strtoul (result, NULL, 10);
+      if (!ul || ul > 65536 || (ul & (ul - 1)))
+        err = gpg_error (GPG_ERR_INV_VALUE);
+      else
+        *r_size = ul;
+      xfree (result);
+    }
+  return err;
+}
+
+
+/* Return true if the block device NAME is a rotational device.  If
+   this can't be determined, true is returned because that is the
+   conservative choice.  */
+int
+sh_blockdev_is_rotational (const char *name)
+{
+  struct stat sb;
+  char *fname;
+  estream_t fp;
+  int c;
+
+  if (gnupg_stat (name, &sb) || !S_ISBLK (sb.st_mode))
+    return 1;
+
+  /* The queue attributes are only available for the entire disk; for
+     a partition we need to look at the parent directory.  */
+  fname = xtryasprintf ("/sys/dev/block/%u:%u/queue/rotational",
+                        (unsigned int)major (sb.st_rdev),
+                        (unsigned int)minor (sb.st_rdev));
+  if (!fname)
+    return 1;
+  fp = es_fopen (fname, "r");
+  xfree (fname);
+  if (!fp)
+    {
+      fname = xtryasprintf ("/sys/dev/block/%u:%u/../queue/rotational",
+                            (unsigned int)major (sb.st_rdev),
+                            (unsigned int)minor (sb.st_rdev));
+      if (!fname)
+        return 1;
+      fp = es_fopen (fname, "r");
+      xfree (fname);
+      if (!fp)
+        return 1;
+    }
+  c = es_getc (fp);
+  es_fclose (fp);
+  return c != '0';
+}
+
+
 /* Return 0 if the device NAME looks like an empty partition. */
 gpg_error_t
 sh_is_empty_partition (const char *name)
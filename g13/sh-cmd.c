@@ -313,16 +313,26 @@ cmd_device (assuan_context_t ctx, char *line)
 
 
 static const char hlp_create[] =
-  "CREATE <type>\n"
+  "CREATE [--no-tuning|--hdd|--ssd] <type>\n"
   "\n"
   "Create a new encrypted partition on the current device.\n"
-  "<type> must be \"dm-crypt\" for now.";
+  "<type> must be \"dm-crypt\" for now.  The options select the\n"
+  "performance settings for the device; by default they are chosen\n"
+  "depending on whether the device is rotational.";
 static gpg_error_t
 cmd_create (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
   gpg_error_t err = 0;
   estream_t fp = NULL;
+  enum sh_dmcrypt_tuning tuning = SH_DMCRYPT_TUNING_AUTO;
+
+  if (has_option (line, "--no-tuning"))
+    tuning = SH_DMCRYPT_TUNING_NONE;
+  else if (has_option (line, "--hdd"))
+    tuning = SH_DMCRYPT_TUNING_HDD;
+  else if (has_option (line, "--ssd"))
+    tuning = SH_DMCRYPT_TUNING_SSD;
 
   line = skip_options (line);
   if (strcmp (line, "dm-crypt"))
@@ -367,7 +377,7 @@ cmd_create (assuan_context_t ctx, char *line)
 
   err = sh_dmcrypt_create_container (ctrl,
                                      ctrl->server_local->devicename,
-                                     fp);
+                                     fp, tuning);
   if (es_fclose (fp))
     {
       gpg_error_t err2 = gpg_error_from_syserror ();
@@ -176,6 +176,105 @@ check_blockdev (const char *devname, int expect_busy)
 }
 
 
+/* Return the version of the crypt target of the kernel as a number
+ * major*1000+minor.  Returns 0 if the version can't be determined.  */
+static unsigned int
+get_crypt_target_version (void)
+{
+  const char *argv[2];
+  char *result = NULL;
+  char **lines;
+  unsigned int vmajor, vminor, version = 0;
+  int lno;
+
+  argv[0] = "targets";
+  argv[1] = NULL;
+  if (gnupg_exec_tool ("/sbin/dmsetup", argv, NULL, &result, NULL))
+    return 0;
+  lines = strsplit (result, '\n', 0, NULL);
+  for (lno=0; lines && lines[lno]; lno++)
+    if (!strncmp (lines[lno], "crypt", 5) && spacep (lines[lno]+5)
+        && sscanf (lines[lno]+5, " v%u.%u", &vmajor, &vminor) == 2)
+      {
+        version = vmajor * 1000 + vminor;
+        break;
+      }
+  xfree (lines);
+  xfree (result);
+  return version;
+}
+
+
+/* Return the optional parameters for a crypt target on DEVNAME with
+ * NBLOCKS sectors of encrypted data according to TUNING.  The result
+ * is a static string which may be empty.  */
+static const char *
+select_dmcrypt_options (const char *devname, unsigned long long nblocks,
+                        enum sh_dmcrypt_tuning tuning)
+{
+  static char buffer[100];
+  unsigned int version, ss;
+  int ssd;
+
+  *buffer = 0;
+  if (tuning == SH_DMCRYPT_TUNING_NONE)
+    return buffer;
+
+  version = get_crypt_target_version ();
+  if (sh_blockdev_getss (devname, &ss))
+    ss = SECTOR_SIZE;
+  if (tuning == SH_DMCRYPT_TUNING_AUTO)
+    ssd = !sh_blockdev_is_rotational (devname);
+  else
+    ssd = (tuning == SH_DMCRYPT_TUNING_SSD);
+
+  /* On fast devices the work queues of dm-crypt only add latency;
+   * bypassing them is supported since version 1.22 (Linux 5.9).  */
+  if (ssd && version >= 1022)
+    strcpy (buffer, "same_cpu_crypt no_read_workqueue no_write_workqueue");
+
+  /* Encrypting in units of 4 KiB reduces the per-sector overhead and
+   * matches the physical sector size of modern devices.  This is
+   * supported since version 1.17 (Linux 4.12) and requires that the
+   * size of the encrypted area is a multiple of that size.  The
+   * offset is a multiple of that size by design.  */
+  if ((ssd || ss >= PHY_SECTOR_SIZE) && ss <= PHY_SECTOR_SIZE
+      && version >= 1017
+      && !(nblocks % (PHY_SECTOR_SIZE / SECTOR_SIZE)))
+    strcat (buffer, *buffer? " sector_size:4096" : "sector_size:4096");
+
+  return buffer;
+}
+
+
+/* Return the number of optional parameters in OPTS which has a
+ * length of OPTSLEN.  Returns -1 if OPTS has an invalid value.  */
+static int
+count_dmcrypt_options (const char *opts, size_t optslen)
+{
+  int count = 0;
+  int inword = 0;
+
+  if (optslen > 100)
+    return -1;
+  for (; optslen; opts++, optslen--)
+    {
+      if (*opts == ' ')
+        inword = 0;
+      else if ((*opts >= 'a' && *opts <= 'z') || digitp (opts)
+               || *opts == '_' || *opts == ':')
+        {
+          if (!inword)
+            count++;
+          inword = 1;
+        }
+      else
+        return -1;
+    }
+  return count;
+}
+
+
 /* Return a malloced buffer with the prefix of the setup area.  This
    is the data written right before the encrypted keyblob.  Return NULL
    on error and sets ERRNO.  */
@@ -220,9 +319,11 @@ mk_setup_area_prefix (size_t *r_length)
 }
 
 
-/* Create a new g13 style DM-Crypt container on device DEVNAME.  */
+/* Create a new g13 style DM-Crypt container on device DEVNAME.
+ * TUNING selects the optional parameters of the crypt target.  */
 gpg_error_t
-sh_dmcrypt_create_container (ctrl_t ctrl, const char *devname, estream_t devfp)
+sh_dmcrypt_create_container (ctrl_t ctrl, const char *devname, estream_t devfp,
+                             enum sh_dmcrypt_tuning tuning)
 {
   gpg_error_t err;
   char *header_space;
@@ -235,6 +336,7 @@ sh_dmcrypt_create_container (ctrl_t ctrl, const char *devname, estream_t devfp)
   char *table = NULL;
   unsigned long long nblocks;
   char *result = NULL;
+  const char *dmopts;
   unsigned char twobyte[2];
   membuf_t keyblob;
   void  *keyblob_buf = NULL;
@@ -355,8 +457,20 @@ sh_dmcrypt_create_container (ctrl_t ctrl, const char *devname, estream_t devfp)
   /* Build dmcrypt table. */
   s = "aes-cbc-essiv:sha256";
   append_tuple (&keyblob, KEYBLOB_TAG_ALGOSTR, s, strlen (s));
-  table = es_bsprintf ("0 %llu crypt %s %s 0 %s %d",
-                       nblocks, s, hexkey, devname, HEADER_SECTORS);
+  dmopts = select_dmcrypt_options (devname, nblocks, tuning);
+  if (*dmopts)
+    {
+      append_tuple (&keyblob, KEYBLOB_TAG_DMOPTS, dmopts, strlen (dmopts));
+      if (opt.verbose)
+        log_info ("using dm-crypt options '%s'\n", dmopts);
+      table = es_bsprintf ("0 %llu crypt %s %s 0 %s %d %d %s",
+                           nblocks, s, hexkey, devname, HEADER_SECTORS,
+                           count_dmcrypt_options (dmopts, strlen (dmopts)),
+                           dmopts);
+    }
+  else
+    table = es_bsprintf ("0 %llu crypt %s %s 0 %s %d",
+                         nblocks, s, hexkey, devname, HEADER_SECTORS);
   if (!table)
     {
       err = gpg_error_from_syserror ();
@@ -555,6 +669,9 @@ sh_dmcrypt_mount_container (ctrl_t ctrl, const char *devname,
   const char *s;
   const char *algostr;
   size_t algostrlen;
+  const char *dmopts;
+  size_t dmoptslen;
+  int ndmopts;
 
   if (!ctrl->devti)
     return gpg_error (GPG_ERR_INV_ARG);
@@ -652,6 +769,19 @@ sh_dmcrypt_mount_container (ctrl_t ctrl, const char *devname,
       goto leave;
     }
 
+  /* Get the optional parameters; they are not used by older
+   * containers.  */
+  dmopts = find_tuple (keyblob, KEYBLOB_TAG_DMOPTS, &dmoptslen);
+  if (!dmopts)
+    dmoptslen = 0;
+  ndmopts = count_dmcrypt_options (dmopts, dmoptslen);
+  if (ndmopts < 0)
+    {
+      log_error ("invalid dm-crypt options in keyblob\n");
+      err = gpg_error (GPG_ERR_INV_DATA);
+      goto leave;
+    }
+
   /* Get the key.  */
   s = find_tuple (keyblob, KEYBLOB_TAG_ENCKEY, &n);
   if (!s || n != 16)
@@ -666,9 +796,15 @@ sh_dmcrypt_mount_container (ctrl_t ctrl, const char *devname,
   bin2hex (s, 16, hexkey);
 
   /* Build dmcrypt table. */
-  table = es_bsprintf ("0 %llu crypt %.*s %s 0 %s %d",
-                       nblocks, (int)algostrlen, algostr,
-                       hexkey, devname, HEADER_SECTORS);
+  if (ndmopts)
+    table = es_bsprintf ("0 %llu crypt %.*s %s 0 %s %d %d %.*s",
+                         nblocks, (int)algostrlen, algostr,
+                         hexkey, devname, HEADER_SECTORS,
+                         ndmopts, (int)dmoptslen, dmopts);
+  else
+    table = es_bsprintf ("0 %llu crypt %.*s %s 0 %s %d",
+                         nblocks, (int)algostrlen, algostr,
+                         hexkey, devname, HEADER_SECTORS);
   wipememory (hexkey, sizeof hexkey);
   if (!table)
     {
@@ -39,11 +39,11 @@
 
 
 /* Standard values for the number of buckets and the threshold we use
- * to flush items.  */
+ * to flush key items.  The number of blobs is not limited per bucket
+ * but by the total size of all cached blobs (opt.cache_size).  */
 #define NO_OF_KEY_ITEM_BUCKETS          383
 #define KEY_ITEMS_PER_BUCKET_THRESHOLD  40
 #define NO_OF_BLOB_BUCKETS              383
-#define BLOBS_PER_BUCKET_THRESHOLD      20
 
 
 /* Our definition of the backend handle.  */
@@ -58,22 +58,32 @@ struct backend_handle_s
 typedef struct blob_s
 {
   struct blob_s *next;
+  struct blob_s *lru_prev;    /* Towards the most recently used blob.  */
+  struct blob_s *lru_next;    /* Towards the least recently used blob. */
   enum pubkey_types pktype;
   unsigned int refcount;
   unsigned int usecount;
   unsigned int datalen;
   unsigned char *data;        /* The actual data of length DATALEN.  */
+  char *sigstatus;            /* Malloced signature status or NULL.   */
   unsigned char ubid[UBID_LEN];
 } *blob_t;
 
 
 static blob_t *blob_table;                /* Hash table with the blobs.   */
 static size_t blob_table_size;            /* Number of allocated buckets. */
-static unsigned int blob_table_threshold; /* Max. # of items per bucket.  */
 static unsigned int blob_table_added;     /* Number of items added.       */
 static unsigned int blob_table_dropped;   /* Number of items dropped.     */
+static unsigned int blob_table_count;     /* Number of cached blobs.      */
+static size_t blob_table_bytes;           /* Memory used by cached blobs. */
+static blob_t blob_lru_head;              /* Most recently used blob.     */
+static blob_t blob_lru_tail;              /* Least recently used blob.    */
 static blob_t blob_attic;                 /* List of freed blobs.         */
 
+/* Counters for the lookups done by be_cache_search.  */
+static unsigned long cache_hits;
+static unsigned long cache_misses;
+
 
 /* A list item to blob data.  This is so that a next operation on a
  * cached key item can actually work.  Things are complicated because
@@ -140,7 +150,6 @@ blob_table_init (void)
   if (blob_table)
     return 0;
   blob_table_size = NO_OF_BLOB_BUCKETS;
-  blob_table_threshold  = BLOBS_PER_BUCKET_THRESHOLD;
   blob_table = xtrycalloc (blob_table_size, sizeof *blob_table);
   if (!blob_table)
     return gpg_error_from_syserror ();
@@ -160,6 +169,8 @@ blob_unref (blob_t blob)
     {
       p = blob->data;
       blob->data = NULL;
+      xfree (blob->sigstatus);
+      blob->sigstatus = NULL;
       blob->next = blob_attic;
       blob_attic = blob;
       xfree (p);
@@ -187,41 +198,126 @@ find_blob (unsigned int hash, const unsigned char *ubid,
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_blobs (const void *arg_a, const void *arg_b)
+/* Return the memory accounted for a blob with DATALEN bytes.  */
+static inline size_t
+blob_cost (unsigned int datalen)
 {
-  const blob_t a = *(const blob_t *)arg_a;
-  const blob_t b = *(const blob_t *)arg_b;
+  return sizeof (struct blob_s) + datalen;
+}
 
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
+
+/* Unlink the blob B from the LRU list.  Must not call a system
+ * function.  */
+static void
+blob_lru_unlink (blob_t b)
+{
+  if (b->lru_prev)
+    b->lru_prev->lru_next = b->lru_next;
   else
-    return 1;
+    blob_lru_head = b->lru_next;
+  if (b->lru_next)
+    b->lru_next->lru_prev = b->lru_prev;
+  else
+    blob_lru_tail = b->lru_prev;
+  b->lru_prev = b->lru_next = NULL;
+}
+
+
+/* Put the blob B at the head of the LRU list.  Must not call a
+ * system function.  */
+static void
+blob_lru_push (blob_t b)
+{
+  b->lru_prev = NULL;
+  b->lru_next = blob_lru_head;
+  if (blob_lru_head)
+    blob_lru_head->lru_prev = b;
+  else
+    blob_lru_tail = b;
+  blob_lru_head = b;
+}
+
+
+/* Remove the blob B from the hash table and the LRU list.  The
+ * reference held by the table is not released.  Must not call a
+ * system function.  */
+static void
+blob_table_unlink (blob_t b)
+{
+  blob_t *bp;
+
+  blob_lru_unlink (b);
+  for (bp = &blob_table[blob_table_hasher (b->ubid)]; *bp; bp = &(*bp)->next)
+    if (*bp == b)
+      {
+        *bp = b->next;
+        break;
+      }
+  b->next = NULL;
+  blob_table_bytes -= blob_cost (b->datalen);
+  blob_table_count--;
+}
+
+
+/* Remove the least recently used blobs until the cached blobs fit
+ * into LIMIT bytes.  Blobs still referenced by a search are released
+ * only when that search drops its reference.  */
+static void
+blob_table_evict (size_t limit)
+{
+  blob_t b, victims = NULL;
+
+  /* First unlink all victims without doing any system calls so that
+   * other threads see a consistent table.  */
+  while (blob_table_bytes > limit && (b = blob_lru_tail))
+    {
+      blob_table_unlink (b);
+      blob_table_dropped++;
+      b->next = victims;
+      victims = b;
+    }
+
+  for (; victims; victims = b)
+    {
+      b = victims->next;
+      blob_unref (victims);
+    }
 }
 
 
 /* Put the blob (BLOBDATA, BLOBDATALEN) into the cache using UBID as
- * the index.  If it is already in the cache nothing happens.  */
+ * the index.  If it is already in the cache with the same data
+ * nothing happens; if the data changed, the old blob and its
+ * signature status are replaced.  If the memory used by the cached
+ * blobs exceeds opt.cache_size the least recently used blobs are
+ * removed.  */
 static void
 blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
                 const void *blobdata, unsigned int blobdatalen)
 {
   unsigned int hash;
   blob_t b;
-  unsigned int count, n;
+  unsigned int n;
   void *blobdatacopy = NULL;
 
+  if (blob_cost (blobdatalen) > opt.cache_size)
+    return;  /* Too large for the cache or caching disabled.  */
+
   hash = blob_table_hasher (ubid);
  find_again:
-  b = find_blob (hash, ubid, &count);
+  b = find_blob (hash, ubid, NULL);
   if (b)
     {
-      xfree (blobdatacopy);
-      return;  /* Already got this blob.  */
+      if (b->datalen == blobdatalen && !memcmp (b->data, blobdata, blobdatalen))
+        {
+          xfree (blobdatacopy);
+          return;  /* Already got this blob.  */
+        }
+      /* The keyblock has been updated.  Searches may still use the
+       * old data and thus we only drop the table's reference.  */
+      blob_table_unlink (b);
+      blob_unref (b);
+      goto find_again;
     }
 
   /* Create a copy of the blob if not yet done.  */
@@ -235,72 +331,8 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
           return;  /* Out of core - ignore.  */
         }
       memcpy (blobdatacopy, blobdata, blobdatalen);
-    }
-
-  /* If the bucket is full remove a couple of items. */
-  if (count >= blob_table_threshold)
-    {
-      blob_t list_head, *list_tailp, b_next;
-      blob_t *array;
-      int narray, idx;
-
-      /* Unlink from the global list so that other threads don't
-       * disturb us.  If another thread adds or removes something only
-       * one will be the winner.  Bad luck for the dropped cache items
-       * but after all it is just a cache.  */
-      list_head = blob_table[hash];
-      blob_table[hash] = NULL;
-
-      /* Put all items into an array for sorting.  */
-      array = xtrycalloc (count, sizeof *array);
-      if (!array)
-        {
-          /* That's bad; give up all  items of the bucket.  */
-          log_info ("Note: malloc failed while purging blobs from the "
-                    "cache: %s\n", gpg_strerror (gpg_error_from_syserror ()));
-          goto leave_drop;
-        }
-      narray = 0;
-      for (b = list_head; b; b = b_next)
-        {
-          b_next = b->next;
-          array[narray++] = b;
-          b->next = NULL;
-        }
-      log_assert (narray == count);
-
-      /* Sort the array and put half of it onto a new list.  */
-      qsort (array, narray, sizeof *array, compare_blobs);
-      list_head = NULL;
-      list_tailp = &list_head;
-      for (idx=0; idx < narray/2; idx++)
-        {
-          *list_tailp = array[idx];
-          list_tailp = &array[idx]->next;
-        }
-
-      /* Put the new list into the bucket.  */
-      b = blob_table[hash];
-      blob_table[hash] = list_head;
-      list_head = b;
-
-      /* Free the remaining items and the array.  */
-      for (; idx < narray; idx++)
-        {
-          blob_unref (array[idx]);
-          blob_table_dropped++;
-        }
-      xfree (array);
-
-    leave_drop:
-      /* Free any items added in the meantime by other threads.  This
-       * is also used in case of a malloc problem (which won't update
-       * the counters, though). */
-      for ( ; list_head; list_head = b_next)
-        {
-          b_next = list_head->next;
-          blob_unref (list_head);
-        }
+      /* During the malloc another thread might have added the blob.  */
+      goto find_again;
     }
 
   /* Add an item to the bucket.  We allocate a whole block of items
@@ -338,12 +370,19 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
   b->pktype = pktype;
   b->data = blobdatacopy;
   b->datalen = blobdatalen;
+  b->sigstatus = NULL;
   memcpy (b->ubid, ubid, UBID_LEN);
   b->usecount = 1;
   b->refcount = 1;
   b->next = blob_table[hash];
   blob_table[hash] = b;
+  blob_lru_push (b);
+  blob_table_bytes += blob_cost (blobdatalen);
+  blob_table_count++;
   blob_table_added++;
+
+  if (blob_table_bytes > opt.cache_size)
+    blob_table_evict (opt.cache_size);
 }
 
 
@@ -361,6 +400,11 @@ blob_table_get (const unsigned char *ubid)
     {
       b->usecount++;
       b->refcount++;
+      if (b != blob_lru_head)
+        {
+          blob_lru_unlink (b);
+          blob_lru_push (b);
+        }
       return b;  /* Found  */
     }
 
@@ -859,6 +903,84 @@ be_cache_initialize (void)
 }
 
 
+/* Store the current cache statistics at R_STATS.  */
+void
+be_cache_get_stats (struct be_cache_stats_s *r_stats)
+{
+  r_stats->hits = cache_hits;
+  r_stats->misses = cache_misses;
+  r_stats->evictions = (unsigned long)blob_table_dropped + key_table_dropped;
+  r_stats->blobs = blob_table_count;
+  r_stats->bytes = blob_table_bytes;
+  r_stats->limit = opt.cache_size;
+}
+
+
+/* Return a malloced copy of the signature status stored for the
+ * blob with UBID or NULL if there is none.  A status is only
+ * returned if the cached blob is identical to (BLOB,BLOBLEN) so that
+ * a status never applies to a different version of the keyblock.  */
+char *
+be_cache_get_sigstatus (const unsigned char *ubid,
+                        const void *blob, size_t bloblen)
+{
+  blob_t b;
+  char *result = NULL;
+
+  if (!blob_table)
+    return NULL;
+  b = blob_table_get (ubid);
+  if (!b)
+    return NULL;
+  if (b->sigstatus && b->datalen == bloblen
+      && !memcmp (b->data, blob, bloblen))
+    result = xtrystrdup (b->sigstatus);
+  blob_unref (b);
+  return result;
+}
+
+
+/* Store the signature status STATUS for the blob with UBID.  DIGEST
+ * is the SHA-256 of the keyblock the client checked; if that does
+ * not match the cached blob the status is ignored.  */
+gpg_error_t
+be_cache_put_sigstatus (const unsigned char *ubid,
+                        const unsigned char *digest, const char *status)
+{
+  gpg_error_t err;
+  blob_t b;
+  unsigned char hash[32];
+  char *copy, *old;
+
+  if (!blob_table)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  b = blob_table_get (ubid);
+  if (!b)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  gcry_md_hash_buffer (GCRY_MD_SHA256, hash, b->data, b->datalen);
+  if (memcmp (hash, digest, sizeof hash))
+    {
+      err = gpg_error (GPG_ERR_CHECKSUM);
+      goto leave;
+    }
+  copy = xtrystrdup (status);
+  if (!copy)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  old = b->sigstatus;
+  b->sigstatus = copy;
+  xfree (old);
+  err = 0;
+
+ leave:
+  blob_unref (b);
+  return err;
+}
+
+
 /* Install a new resource and return a handle for that backend.  */
 gpg_error_t
 be_cache_add_resource (ctrl_t ctrl, backend_handle_t *r_hd)
@@ -1079,6 +1201,14 @@ be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd, db_request_t request,
     err = gpg_error (GPG_ERR_EOF);
 
  leave:
+  if (desc)
+    {
+      if (!err || gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+        cache_hits++;
+      else if (gpg_err_code (err) == GPG_ERR_EOF
+               || gpg_err_code (err) == GPG_ERR_MISSING_VALUE)
+        cache_misses++;
+    }
   return err;
 }
 
@@ -45,12 +45,20 @@ struct backend_handle_s
 };
 
 
+/* The number of slots in the statement cache.  There is one slot for
+ * each search mode and combination of the two filter flags.  */
+#define STMT_CACHE_SIZE ((KEYDB_SEARCH_MODE_NEXT + 1) * 4)
+
 /* Definition of local request data.  */
 struct be_sqlite_local_s
 {
-  /* The statement object of the current select command.  */
+  /* The statement object of the current select command.  This is
+   * one of the statements from STMT_CACHE.  */
   sqlite3_stmt *select_stmt;
 
+  /* Prepared select statements indexed by stmt_cache_slot.  */
+  sqlite3_stmt *stmt_cache[STMT_CACHE_SIZE];
+
   /* The column numbers for UIDNO and SUBKEY or 0.  */
   int select_col_uidno;
   int select_col_subkey;
@@ -89,21 +97,23 @@ static sqlite3 *database_hd;
 /* A lockfile used make sure only we are accessing the database.  */
 static dotlock_t database_lock;
 
-/* The version of our current database schema.  */
-#define DATABASE_VERSION 1
+/* The version of our current database schema.  Version 2 added the
+ * keyid indices to the fingerprint table.  */
+#define DATABASE_VERSION 2
 
 /* Table definitions for the database.  */
 static struct
 {
   const char *sql;
   int special;
+  const char *index;  /* Name of an index not needed for storing.  */
 } table_definitions[] =
   {
    { "PRAGMA foreign_keys = ON" },
 
    /* Table to store config values:
     * Standard name value pairs:
-    *   dbversion = 1
+    *   dbversion = 2
     *   created = <ISO time string>
     */
    { "CREATE TABLE IF NOT EXISTS config ("
@@ -147,7 +157,15 @@ static struct
    /* Indices for the fingerprint table.  */
    { "CREATE INDEX IF NOT EXISTS fingerprintidx0 on fingerprint (ubid)"    },
    { "CREATE INDEX IF NOT EXISTS fingerprintidx1 on fingerprint (fpr)"     },
-   { "CREATE INDEX IF NOT EXISTS fingerprintidx2 on fingerprint (keygrip)" },
+   { "CREATE INDEX IF NOT EXISTS fingerprintidx2 on fingerprint (keygrip)",
+     0, "fingerprintidx2" },
+   /* Indices for the long and the short keyid searches.  The second
+    * one needs to use the same expression as the select.  */
+   { "CREATE INDEX IF NOT EXISTS fingerprintidx3 on fingerprint (kid)",
+     0, "fingerprintidx3" },
+   { "CREATE INDEX IF NOT EXISTS fingerprintidx4"
+     "   on fingerprint (substr(kid,5))",
+     0, "fingerprintidx4" },
 
    /* Table to allow fast access via user ids or mail addresses.  */
    { "CREATE TABLE IF NOT EXISTS userid ("
@@ -168,8 +186,10 @@ static struct
 
    /* Indices for the userid table.  */
    { "CREATE INDEX IF NOT EXISTS userididx0 on userid (ubid)"     },
-   { "CREATE INDEX IF NOT EXISTS userididx1 on userid (uid)"      },
-   { "CREATE INDEX IF NOT EXISTS userididx3 on userid (addrspec)" },
+   { "CREATE INDEX IF NOT EXISTS userididx1 on userid (uid)",
+     0, "userididx1" },
+   { "CREATE INDEX IF NOT EXISTS userididx3 on userid (addrspec)",
+     0, "userididx3" },
 
    /* Table to allow fast access via s/n + issuer DN  (X.509 only).  */
    { "CREATE TABLE IF NOT EXISTS issuer ("
@@ -180,7 +200,8 @@ static struct
      /* The Unique Blob ID (usually the truncated fingerprint).  */
      "ubid BLOB NOT NULL REFERENCES pubkey"
      ")"  },
-   { "CREATE INDEX IF NOT EXISTS issueridx1 on issuer (dn)" }
+   { "CREATE INDEX IF NOT EXISTS issueridx1 on issuer (dn)",
+     0, "issueridx1" }
 
   };
 
@@ -565,7 +586,7 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
   int res;
   int idx;
   char *value;
-  int dbversion;
+  int dbversion = 0;
   int setdbversion = 0;
 
   acquire_mutex ();
@@ -683,6 +704,15 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
       if (!err)
         err = set_config_value ("created", isotimestamp (gnupg_get_time ()));
     }
+  else if (dbversion && dbversion < DATABASE_VERSION)
+    {
+      /* The new tables and indices have been created by the above
+       * loop; thus all we need to do is to update the version.  */
+      err = set_config_value ("dbversion", STR2(DATABASE_VERSION));
+      if (err)
+        goto leave;
+      log_info ("database version updated to %d\n", DATABASE_VERSION);
+    }
 
 
   err = 0;
@@ -757,16 +787,79 @@ be_sqlite_init_local (backend_handle_t backend_hd, db_request_part_t part)
 void
 be_sqlite_release_local (be_sqlite_local_t ctx)
 {
-  if (ctx->select_stmt)
-    sqlite3_finalize (ctx->select_stmt);
+  int i;
+
+  for (i = 0; i < STMT_CACHE_SIZE; i++)
+    if (ctx->stmt_cache[i])
+      sqlite3_finalize (ctx->stmt_cache[i]);
   xfree (ctx);
 }
 
 
+/* Begin the global transaction requested by the TRANSACTION command.
+ * In bulk mode the indices which are only used for searching are
+ * dropped; they are created again by be_sqlite_commit.  Given that
+ * this is done within the transaction a rollback restores them.  */
+static gpg_error_t
+begin_global_transaction (void)
+{
+  gpg_error_t err;
+  char *sqlstr;
+  int idx;
+
+  err = run_sql_statement ("begin transaction");
+  if (err)
+    return err;
+  opt.active_transaction = 1;
+
+  if (!opt.bulk_transaction)
+    return 0;
+
+  for (idx=0; idx < DIM(table_definitions); idx++)
+    {
+      if (!table_definitions[idx].index)
+        continue;
+      sqlstr = strconcat ("DROP INDEX IF EXISTS ",
+                          table_definitions[idx].index, NULL);
+      if (!sqlstr)
+        return gpg_error_from_syserror ();
+      err = run_sql_statement (sqlstr);
+      xfree (sqlstr);
+      if (err)
+        return err;
+    }
+  if (opt.verbose)
+    log_info ("bulk transaction started - search indices dropped\n");
+  return 0;
+}
+
+
+/* Create the indices dropped by begin_global_transaction.  */
+static gpg_error_t
+rebuild_search_indices (void)
+{
+  gpg_error_t err;
+  int idx;
+
+  for (idx=0; idx < DIM(table_definitions); idx++)
+    {
+      if (!table_definitions[idx].index)
+        continue;
+      err = run_sql_statement (table_definitions[idx].sql);
+      if (err)
+        return err;
+    }
+  if (opt.verbose)
+    log_info ("bulk transaction finished - search indices rebuilt\n");
+  return 0;
+}
+
+
 gpg_error_t
 be_sqlite_rollback (void)
 {
   opt.in_transaction = 0;
+  opt.bulk_transaction = 0;
   if (!opt.active_transaction)
     return 0;  /* Nothing to do.  */
 
@@ -784,7 +877,11 @@ be_sqlite_rollback (void)
 gpg_error_t
 be_sqlite_commit (void)
 {
+  gpg_error_t err;
+  int bulk = opt.bulk_transaction;
+
   opt.in_transaction = 0;
+  opt.bulk_transaction = 0;
   if (!opt.active_transaction)
     return 0;  /* Nothing to do.  */
 
@@ -795,6 +892,19 @@ be_sqlite_commit (void)
     }
 
   opt.active_transaction = 0;
+  if (bulk)
+    {
+      err = rebuild_search_indices ();
+      if (err)
+        {
+          log_error ("error rebuilding the indices: %s\n",
+                     gpg_strerror (err));
+          if (run_sql_statement ("rollback"))
+            log_error ("Warning: database rollback failed"
+                       " - should not happen!\n");
+          return err;
+        }
+    }
   return run_sql_statement ("commit");
 }
 
@@ -866,6 +976,16 @@ set_config_value (const char *name, const char *value)
 }
 
 
+/* Return the index into the statement cache for MODE and the filter
+ * flags FILTER_OPGP and FILTER_X509.  */
+static int
+stmt_cache_slot (KeydbSearchMode mode, int filter_opgp, int filter_x509)
+{
+  log_assert (mode <= KEYDB_SEARCH_MODE_NEXT);
+  return mode * 4 + (filter_opgp? 2:0) + (filter_x509? 1:0);
+}
+
+
 /* Run a select for the search given by (DESC,NDESC).  The data is not
  * returned but stored in the request item.  */
 static gpg_error_t
@@ -878,6 +998,7 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
   unsigned char kidbuf[8];
   const char *s;
   size_t n;
+  int slot;
 
 
   descidx = ctx->descidx;
@@ -887,21 +1008,15 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       goto leave;
     }
 
-  /* Check whether we can reuse the current select statement.  */
-  if (!ctx->select_stmt)
-    ;
-  else if (ctx->select_mode != desc[descidx].mode)
-    {
-      sqlite3_finalize (ctx->select_stmt);
-      ctx->select_stmt = NULL;
-    }
-  else if (ctx->filter_opgp != ctrl->filter_opgp
-           || ctx->filter_x509 != ctrl->filter_x509)
-    {
-      /* The filter flags changed, thus we can't reuse the statement.  */
-      sqlite3_finalize (ctx->select_stmt);
-      ctx->select_stmt = NULL;
-    }
+  /* Take the statement from the cache.  A statement depends only on
+   * the search mode and the filter flags; the search values are bound
+   * below.  A previous statement is reset so that it does not keep
+   * the read transaction open.  */
+  slot = stmt_cache_slot (desc[descidx].mode,
+                          ctrl->filter_opgp, ctrl->filter_x509);
+  if (ctx->select_stmt && ctx->select_stmt != ctx->stmt_cache[slot])
+    sqlite3_reset (ctx->select_stmt);
+  ctx->select_stmt = ctx->stmt_cache[slot];
 
   ctx->select_mode = desc[descidx].mode;
   ctx->filter_opgp = ctrl->filter_opgp;
@@ -1156,6 +1271,9 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       break;
     }
 
+  /* Remember a newly prepared statement.  */
+  ctx->stmt_cache[slot] = ctx->select_stmt;
+
  leave:
   return err;
 }
@@ -1172,6 +1290,14 @@ be_sqlite_search (ctrl_t ctrl,
   gpg_error_t err;
   db_request_part_t part;
   be_sqlite_local_t ctx;
+  unsigned char ubidbuf[UBID_LEN];
+  void *keyblobcopy = NULL;
+  size_t keybloblen = 0;
+  enum pubkey_types pubkey_type = PUBKEY_TYPE_UNKNOWN;
+  int is_ephemeral = 0;
+  int is_revoked = 0;
+  int pk_no = 0;
+  int uid_no = 0;
 
   log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
   log_assert (request);
@@ -1209,10 +1335,9 @@ be_sqlite_search (ctrl_t ctrl,
   /* Start a global transaction if needed.  */
   if (!opt.active_transaction && opt.in_transaction)
     {
-      err = run_sql_statement ("begin transaction");
+      err = begin_global_transaction ();
       if (err)
         goto leave;
-      opt.active_transaction = 1;
     }
 
 
@@ -1234,10 +1359,6 @@ be_sqlite_search (ctrl_t ctrl,
     {
       int n;
       const void *ubid, *keyblob;
-      size_t keybloblen;
-      enum pubkey_types pubkey_type;
-      int is_ephemeral, is_revoked;
-      int pk_no, uid_no;
 
       ubid = sqlite3_column_blob (ctx->select_stmt, 0);
       n = sqlite3_column_bytes (ctx->select_stmt, 0);
@@ -1361,10 +1482,18 @@ be_sqlite_search (ctrl_t ctrl,
       else
         pk_no = 0;
 
-      err = be_return_pubkey (ctrl, keyblob, keybloblen, pubkey_type,
-                              ubid, is_ephemeral, is_revoked, uid_no, pk_no);
-      if (!err)
-        be_cache_pubkey (ctrl, ubid, keyblob, keybloblen, pubkey_type);
+      /* Copy the result so that we can return it after releasing the
+       * mutex.  Sending the data to a slow client would otherwise
+       * block all other connections.  */
+      keyblobcopy = xtrymalloc (keybloblen? keybloblen : 1);
+      if (!keyblobcopy)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      memcpy (keyblobcopy, keyblob, keybloblen);
+      memcpy (ubidbuf, ubid, UBID_LEN);
+      err = 0;
     }
   else if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
     {
@@ -1383,6 +1512,16 @@ be_sqlite_search (ctrl_t ctrl,
 
  leave:
   release_mutex ();
+
+  if (keyblobcopy)
+    {
+      err = be_return_pubkey (ctrl, keyblobcopy, keybloblen, pubkey_type,
+                              ubidbuf, is_ephemeral, is_revoked,
+                              uid_no, pk_no);
+      if (!err)
+        be_cache_pubkey (ctrl, ubidbuf, keyblobcopy, keybloblen, pubkey_type);
+      xfree (keyblobcopy);
+    }
   return err;
 }
 
@@ -1629,11 +1768,12 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
 
   if (!opt.active_transaction)
     {
-      err = run_sql_statement ("begin transaction");
+      if (opt.in_transaction)
+        err = begin_global_transaction ();
+      else
+        err = run_sql_statement ("begin transaction");
       if (err)
         goto leave;
-      if (opt.in_transaction)
-        opt.active_transaction = 1;
     }
   in_transaction = 1;
 
@@ -1832,11 +1972,12 @@ be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
 
   if (!opt.active_transaction)
     {
-      err = run_sql_statement ("begin transaction");
+      if (opt.in_transaction)
+        err = begin_global_transaction ();
+      else
+        err = run_sql_statement ("begin transaction");
       if (err)
         goto leave;
-      if (opt.in_transaction)
-        opt.active_transaction = 1;
     }
   in_transaction = 1;
 
@@ -181,6 +181,21 @@ be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
   if (err)
     goto leave;
 
+  /* Tell the client which signatures have already been verified by
+   * another client for exactly this keyblock.  */
+  if (pubkey_type == PUBKEY_TYPE_OPGP && !ctrl->no_data_return)
+    {
+      char *sigstatus = be_cache_get_sigstatus (ubid, buffer, buflen);
+
+      if (sigstatus)
+        {
+          err = kbxd_status_printf (ctrl, "SIGCACHE", "%s", sigstatus);
+          xfree (sigstatus);
+          if (err)
+            goto leave;
+        }
+    }
+
   if (ctrl->no_data_return)
     err = 0;
   else
@@ -121,7 +121,20 @@ gpg_error_t be_get_x509_keygrip (ksba_cert_t cert, unsigned char *keygrip);
 
 
 /*-- backend-cache.c --*/
+
+/* Statistics as returned by be_cache_get_stats.  */
+struct be_cache_stats_s
+{
+  unsigned long hits;       /* Lookups answered by the cache.       */
+  unsigned long misses;     /* Lookups not answered by the cache.   */
+  unsigned long evictions;  /* Items removed to make room.          */
+  unsigned int blobs;       /* Number of cached blobs.              */
+  size_t bytes;             /* Memory used by the cached blobs.     */
+  size_t limit;             /* The configured limit for BYTES.      */
+};
+
 gpg_error_t be_cache_initialize (void);
+void be_cache_get_stats (struct be_cache_stats_s *r_stats);
 gpg_error_t be_cache_add_resource (ctrl_t ctrl, backend_handle_t *r_hd);
 void be_cache_release_resource (ctrl_t ctrl, backend_handle_t hd);
 gpg_error_t be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd,
@@ -133,6 +146,11 @@ void be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
                       enum pubkey_types pubkey_type);
 void be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
                          KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
+char *be_cache_get_sigstatus (const unsigned char *ubid,
+                              const void *blob, size_t bloblen);
+gpg_error_t be_cache_put_sigstatus (const unsigned char *ubid,
+                                    const unsigned char *digest,
+                                    const char *status);
 
 
 /*-- backend-kbx.c --*/
@@ -0,0 +1,373 @@
+/* bench-search.c - Microbenchmark for the keybox search predicates
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This tool loads all blobs of a keybox file into memory and runs
+ * the predicates used by keybox_search over all of them.  For each
+ * predicate the time per blob is printed so that changes to the blob
+ * layout or to the matching code can be compared.  The predicates
+ * are static functions; thus we include keybox-search.c instead of
+ * linking it.  Without explicit search values random values are
+ * used which do not match any blob; this is the common case of
+ * scanning the entire keybox.  */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_W32_SYSTEM
+# include <windows.h>
+#endif
+
+#include "../common/util.h"
+#include "../common/i18n.h"
+#include "../common/init.h"
+
+#include "keybox-search.c"
+
+
+enum cmd_and_opt_values {
+  aNull = 0,
+  oQuiet	  = 'q',
+  oVerbose	  = 'v',
+
+  oNoSuchOpt    = 500,   /* force other values not to be a letter */
+  oPasses,
+  oFingerprint,
+  oMail,
+  oKeygrip,
+  oIssuer,
+  oSerial,
+
+  oLastOpt
+};
+
+
+static gpgrt_opt_t opts[] = {
+  ARGPARSE_s_u (oPasses, "passes",
+                "|N|run each predicate N times over all blobs (default 10)"),
+  ARGPARSE_s_s (oFingerprint, "fingerprint", "|HEX|search for fingerprint HEX"),
+  ARGPARSE_s_s (oMail,    "mail",    "|ADDR|search for mail address ADDR"),
+  ARGPARSE_s_s (oKeygrip, "keygrip", "|HEX|search for keygrip HEX"),
+  ARGPARSE_s_s (oIssuer,  "issuer",  "|DN|search for issuer DN"),
+  ARGPARSE_s_s (oSerial,  "serial",  "|HEX|search for serial number HEX"),
+  ARGPARSE_s_n (oVerbose, "verbose", "verbose"),
+  ARGPARSE_s_n (oQuiet,   "quiet",   "be somewhat more quiet"),
+
+  ARGPARSE_end ()
+};
+
+
+/* The values to search for.  */
+struct needle_s
+{
+  unsigned char fpr[32];
+  unsigned int fprlen;
+  u32 kid[2];
+  const char *mail;
+  u32 mail_hash;
+  unsigned char grip[20];
+  const char *issuer;
+  u32 issuer_hash;
+  unsigned char sn[64];
+  int snlen;
+};
+typedef struct needle_s *needle_t;
+
+
+/* The predicates to measure.  */
+static int
+pred_fpr (KEYBOXBLOB blob, needle_t nd)
+{
+  return blob_cmp_fpr (blob, nd->fpr, nd->fprlen);
+}
+
+static int
+pred_long_kid (KEYBOXBLOB blob, needle_t nd)
+{
+  return has_long_kid (blob, nd->kid[0], nd->kid[1]);
+}
+
+static int
+pred_mail (KEYBOXBLOB blob, needle_t nd)
+{
+  return has_mail (blob, nd->mail, 0, &nd->mail_hash);
+}
+
+static int
+pred_mail_substr (KEYBOXBLOB blob, needle_t nd)
+{
+  return has_mail (blob, nd->mail, 1, NULL);
+}
+
+static int
+pred_keygrip (KEYBOXBLOB blob, needle_t nd)
+{
+  return has_keygrip (blob, nd->grip);
+}
+
+static int
+pred_issuer_sn (KEYBOXBLOB blob, needle_t nd)
+{
+  return has_issuer_sn (blob, nd->issuer, nd->sn, nd->snlen,
+                        &nd->issuer_hash);
+}
+
+static struct
+{
+  const char *name;
+  int (*func) (KEYBOXBLOB blob, needle_t nd);
+} predicates[] =
+  {
+    { "fpr",         pred_fpr },
+    { "long-kid",    pred_long_kid },
+    { "mail",        pred_mail },
+    { "mail-substr", pred_mail_substr },
+    { "keygrip",     pred_keygrip },
+    { "issuer-sn",   pred_issuer_sn },
+    { NULL }
+  };
+
+
+static int opt_verbose = 1;
+static unsigned int opt_passes = 10;
+
+
+static const char *
+my_strusage (int level)
+{
+  const char *p;
+
+  switch (level)
+    {
+    case  9: p = "GPL-3.0-or-later"; break;
+    case 11: p = "bench-search (@GNUPG@)";
+      break;
+    case 13: p = VERSION; break;
+    case 14: p = GNUPG_DEF_COPYRIGHT_LINE; break;
+    case 17: p = PRINTABLE_OS_NAME; break;
+    case 19: p = _("Please report bugs to <@EMAIL@>.\n"); break;
+
+    case 1:
+    case 40:	p =
+        _("Usage: bench-search [options] KEYBOX (-h for help)");
+      break;
+    case 41:	p =
+        _("Syntax: bench-search [options] KEYBOX\n"
+          "Measure the search predicates over all blobs of KEYBOX\n");
+      break;
+
+    default:	p = NULL;
+    }
+  return p;
+}
+
+
+/* Return a monotonic time stamp in nanoseconds.  */
+static unsigned long long
+bench_time (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER count;
+
+  if (!freq.QuadPart && !QueryPerformanceFrequency (&freq))
+    return 0;
+  QueryPerformanceCounter (&count);
+  return (unsigned long long)(count.QuadPart / (freq.QuadPart / 1e9));
+#else
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts))
+    return 0;
+  return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+/* Convert the hex string HEXSTR of at most MAXLEN bytes to BUFFER and
+ * return the length.  Terminates the process on error.  */
+static int
+parse_hex (const char *option, const char *hexstr,
+           unsigned char *buffer, size_t maxlen)
+{
+  size_t len = strlen (hexstr);
+
+  if (!len || (len & 1) || len/2 > maxlen
+      || hex2bin (hexstr, buffer, len/2) < 0)
+    log_fatal ("invalid hex string for --%s\n", option);
+  return len/2;
+}
+
+
+/* Read all blobs from FNAME and return them in a malloced array.
+ * The number of blobs is stored at R_NBLOBS.  */
+static KEYBOXBLOB *
+load_blobs (const char *fname, size_t *r_nblobs)
+{
+  estream_t fp;
+  KEYBOXBLOB *blobs = NULL;
+  size_t nblobs = 0, size = 0;
+  KEYBOXBLOB blob;
+  int rc;
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    log_fatal ("can't open '%s': %s\n",
+               fname, gpg_strerror (gpg_error_from_syserror ()));
+
+  while (!(rc = _keybox_read_blob (&blob, fp, NULL)))
+    {
+      if (nblobs == size)
+        {
+          size = size? size * 2 : 1024;
+          blobs = xrealloc (blobs, size * sizeof *blobs);
+        }
+      blobs[nblobs++] = blob;
+    }
+  if (rc != -1)
+    log_fatal ("error reading '%s': %s\n", fname, gpg_strerror (rc));
+  es_fclose (fp);
+
+  *r_nblobs = nblobs;
+  return blobs;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  gpgrt_argparse_t pargs;
+  struct needle_s needle;
+  KEYBOXBLOB *blobs;
+  size_t nblobs, i;
+  unsigned int pass;
+  int idx;
+
+  early_system_init ();
+  gpgrt_set_strusage (my_strusage);
+  log_set_prefix ("bench-search", GPGRT_LOG_WITH_PREFIX);
+
+  /* Make sure that our subsystems are ready.  */
+  i18n_init ();
+  init_common_subsystems (&argc, &argv);
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  /* Defaults which will not match.  */
+  memset (&needle, 0, sizeof needle);
+  gcry_create_nonce (needle.fpr, 20);
+  needle.fprlen = 20;
+  gcry_create_nonce (needle.grip, sizeof needle.grip);
+  gcry_create_nonce (needle.sn, 8);
+  needle.snlen = 8;
+  needle.mail = "bench-search@example.invalid";
+  needle.issuer = "CN=bench-search,O=Example";
+
+  pargs.argc = &argc;
+  pargs.argv = &argv;
+  pargs.flags= ARGPARSE_FLAG_KEEP;
+  while (gpgrt_argparse (NULL, &pargs, opts))
+    {
+      switch (pargs.r_opt)
+        {
+        case oVerbose: opt_verbose++; break;
+        case oQuiet: opt_verbose = 0; break;
+        case oPasses: opt_passes = pargs.r.ret_ulong; break;
+        case oFingerprint:
+          needle.fprlen = parse_hex ("fingerprint", pargs.r.ret_str,
+                                     needle.fpr, sizeof needle.fpr);
+          if (needle.fprlen != 20 && needle.fprlen != 32)
+            log_error ("a fingerprint needs to have 20 or 32 bytes\n");
+          break;
+        case oMail: needle.mail = pargs.r.ret_str; break;
+        case oKeygrip:
+          if (parse_hex ("keygrip", pargs.r.ret_str,
+                         needle.grip, sizeof needle.grip) != 20)
+            log_error ("a keygrip needs to have 20 bytes\n");
+          break;
+        case oIssuer: needle.issuer = pargs.r.ret_str; break;
+        case oSerial:
+          needle.snlen = parse_hex ("serial", pargs.r.ret_str,
+                                    needle.sn, sizeof needle.sn);
+          break;
+
+        default: pargs.err = ARGPARSE_PRINT_ERROR; break;
+	}
+    }
+  gpgrt_argparse (NULL, &pargs, NULL);
+
+  if (argc != 1)
+    gpgrt_usage (1);
+  if (!opt_passes)
+    opt_passes = 1;
+  if (log_get_errorcount (0))
+    exit (2);
+
+  /* Take the key ID from the fingerprint the same way as
+   * classify_user_id does for a long key ID.  */
+  if (needle.fprlen == 32)
+    {
+      needle.kid[0] = buf32_to_u32 (needle.fpr);
+      needle.kid[1] = buf32_to_u32 (needle.fpr + 4);
+    }
+  else
+    {
+      needle.kid[0] = buf32_to_u32 (needle.fpr + 12);
+      needle.kid[1] = buf32_to_u32 (needle.fpr + 16);
+    }
+  needle.issuer_hash = _keybox_dn_hash (needle.issuer,
+                                        strlen (needle.issuer));
+  needle.mail_hash = _keybox_mail_hash (needle.mail, strlen (needle.mail));
+
+  blobs = load_blobs (*argv, &nblobs);
+  if (!nblobs)
+    log_fatal ("no blobs found in '%s'\n", *argv);
+  if (opt_verbose)
+    log_info ("%zu blobs loaded; %u passes\n", nblobs, opt_passes);
+
+  es_printf ("%-12s %10s %10s %10s\n", "predicate", "blobs", "matches",
+             "ns/blob");
+  for (idx = 0; predicates[idx].name; idx++)
+    {
+      unsigned long long t0, elapsed;
+      unsigned long matches = 0;
+
+      t0 = bench_time ();
+      for (pass = 0; pass < opt_passes; pass++)
+        for (i = 0; i < nblobs; i++)
+          if (predicates[idx].func (blobs[i], &needle))
+            matches++;
+      elapsed = bench_time () - t0;
+
+      es_printf ("%-12s %10zu %10lu %10.1f\n", predicates[idx].name,
+                 nblobs, matches / opt_passes,
+                 (double)elapsed / ((double)nblobs * opt_passes));
+    }
+
+  for (i = 0; i < nblobs; i++)
+    _keybox_release_blob (blobs[i]);
+  xfree (blobs);
+  return 0;
+}
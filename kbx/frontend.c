@@ -23,15 +23,21 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <npth.h>
 
 #include "keyboxd.h"
 #include <assuan.h>
 #include "../common/i18n.h"
 #include "../common/userids.h"
+#include "../common/gettime.h"
 #include "backend.h"
 #include "frontend.h"
 
 
+/* The number of changes kept in the change log.  */
+#define CHANGE_LOG_SIZE 1024
+
+
 /* An object to keep infos about the database.  */
 struct
 {
@@ -40,6 +46,31 @@ struct
 } the_database;
 
 
+/* The change log.  Each store or delete of a keyblock assigns the
+ * next change counter to its UBID.  Clients which cache keyblocks
+ * ask for the UBIDs changed since the last counter they have seen.
+ * The log is a ring buffer indexed by the counter; a client which is
+ * further behind than CHANGE_LOG_SIZE changes is told to flush its
+ * cache.  */
+static struct kbxd_change_s change_log[CHANGE_LOG_SIZE];
+
+/* The last assigned change counter.  */
+static uint64_t change_seqno;
+
+/* The changes up to this counter can't be reported anymore; for
+ * example due to a rollback.  */
+static uint64_t change_flush_seqno;
+
+/* Identifies this instance of keyboxd because the counters start
+ * again at zero with each instance.  */
+static unsigned long change_epoch;
+
+/* Used to wake up the clients waiting for changes.  */
+static npth_mutex_t change_lock = NPTH_MUTEX_INITIALIZER;
+static npth_cond_t change_cond;
+static int change_cond_initialized;
+
+
 
 /* Take a lock for reading the databases.  */
 static void
@@ -110,6 +141,11 @@ kbxd_set_database (ctrl_t ctrl, const char *filename_arg, int readonly)
   if (err)
     goto leave;
 
+  /* Init the change log.  */
+  change_epoch = (unsigned long)gnupg_get_time ();
+  if (!change_cond_initialized && !npth_cond_init (&change_cond, NULL))
+    change_cond_initialized = 1;
+
   n = strlen (filename);
   if (db_type)
     ; /* We already know it.  */
@@ -176,7 +212,17 @@ kbxd_release_session_info (ctrl_t ctrl)
 gpg_error_t
 kbxd_rollback (void)
 {
-  return be_sqlite_rollback ();
+  gpg_error_t err;
+
+  err = be_sqlite_rollback ();
+  /* The changes recorded since the begin of the transaction are not
+   * known; thus all clients need to flush their caches.  */
+  npth_mutex_lock (&change_lock);
+  change_flush_seqno = ++change_seqno;
+  if (change_cond_initialized)
+    npth_cond_broadcast (&change_cond);
+  npth_mutex_unlock (&change_lock);
+  return err;
 }
 
 
@@ -402,6 +448,91 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
 
 
 
+/* Assign the next change counter to UBID and wake up the clients
+ * waiting for changes.  */
+static void
+record_change (const unsigned char *ubid)
+{
+  struct kbxd_change_s *ch;
+
+  npth_mutex_lock (&change_lock);
+  change_seqno++;
+  ch = change_log + (change_seqno % CHANGE_LOG_SIZE);
+  ch->seqno = change_seqno;
+  memcpy (ch->ubid, ubid, UBID_LEN);
+  if (change_cond_initialized)
+    npth_cond_broadcast (&change_cond);
+  npth_mutex_unlock (&change_lock);
+}
+
+
+/* Return the changes made after the change counter SINCE of the
+ * keyboxd instance EPOCH.  The changes are stored as a malloced array
+ * at R_CHANGES with the number of items at R_NCHANGES; each UBID is
+ * listed only once with the counter of its last change.  If the
+ * changes are not anymore known, *R_FLUSH is set to true and no
+ * changes are returned.  The current epoch and change counter are
+ * stored at R_EPOCH and R_SEQNO.  If WAIT is set the function blocks
+ * until there is a change after SINCE.  */
+gpg_error_t
+kbxd_get_changes (unsigned long epoch, uint64_t since, int wait,
+                  struct kbxd_change_s **r_changes, unsigned int *r_nchanges,
+                  int *r_flush, unsigned long *r_epoch, uint64_t *r_seqno)
+{
+  gpg_error_t err = 0;
+  struct kbxd_change_s *changes = NULL;
+  unsigned int nchanges = 0;
+  uint64_t seqno, later;
+  int flush;
+
+  *r_changes = NULL;
+  *r_nchanges = 0;
+
+  npth_mutex_lock (&change_lock);
+  if (wait && epoch == change_epoch && change_cond_initialized)
+    while (since >= change_seqno)
+      npth_cond_wait (&change_cond, &change_lock);
+
+  flush = (epoch != change_epoch
+           || since < change_flush_seqno
+           || since > change_seqno
+           || change_seqno - since > CHANGE_LOG_SIZE);
+  if (!flush && change_seqno > since)
+    {
+      changes = xtrymalloc ((change_seqno - since) * sizeof *changes);
+      if (!changes)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      for (seqno = since + 1; seqno <= change_seqno; seqno++)
+        {
+          const struct kbxd_change_s *ch;
+
+          ch = change_log + (seqno % CHANGE_LOG_SIZE);
+          /* Skip if the UBID has been changed again later.  */
+          for (later = seqno + 1; later <= change_seqno; later++)
+            if (!memcmp (change_log[later % CHANGE_LOG_SIZE].ubid,
+                         ch->ubid, UBID_LEN))
+              break;
+          if (later > change_seqno)
+            changes[nchanges++] = *ch;
+        }
+    }
+  *r_flush = flush;
+  *r_epoch = change_epoch;
+  *r_seqno = change_seqno;
+  *r_changes = changes;
+  *r_nchanges = nchanges;
+  changes = NULL;
+
+ leave:
+  npth_mutex_unlock (&change_lock);
+  xfree (changes);
+  return err;
+}
+
+
 /* Store; that is insert or update the key (BLOB,BLOBLEN).  MODE
  * controls whether only updates or only inserts are allowed.  */
 gpg_error_t
@@ -486,6 +617,9 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
       err = gpg_error (GPG_ERR_INTERNAL);
     }
 
+  if (!err)
+    record_change ((unsigned char *)ubid);
+
 
  leave:
   release_lock (ctrl);
@@ -557,6 +691,9 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
       err = gpg_error (GPG_ERR_INTERNAL);
     }
 
+  if (!err)
+    record_change (ubid);
+
 
  leave:
   release_lock (ctrl);
@@ -564,3 +701,62 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
     log_clock ("%s: leave", __func__);
   return err;
 }
+
+
+/* Return a malloced string with the statistics of the cache.  Returns
+ * NULL on malloc failure.  */
+char *
+kbxd_get_cache_stats (void)
+{
+  struct be_cache_stats_s stats;
+
+  be_cache_get_stats (&stats);
+  return xtryasprintf ("hits=%lu misses=%lu evictions=%lu"
+                       " blobs=%u bytes=%lu limit=%lu",
+                       stats.hits, stats.misses, stats.evictions,
+                       stats.blobs, (unsigned long)stats.bytes,
+                       (unsigned long)stats.limit);
+}
+
+
+/* The metrics source for keyboxd.  */
+void
+kbxd_metrics (metrics_writer_t w)
+{
+  struct be_cache_stats_s stats;
+
+  metrics_begin (w, METRIC_GAUGE, "connections",
+                 "Number of active connections.");
+  metrics_put (w, NULL, NULL, get_kbxd_active_connection_count ());
+
+  be_cache_get_stats (&stats);
+  metrics_begin (w, METRIC_COUNTER, "cache_lookups_total",
+                 "Number of blob cache lookups by result.");
+  metrics_put (w, "result", "hit", stats.hits);
+  metrics_put (w, "result", "miss", stats.misses);
+  metrics_begin (w, METRIC_COUNTER, "cache_evictions_total",
+                 "Number of blobs removed from the cache to make room.");
+  metrics_put (w, NULL, NULL, stats.evictions);
+  metrics_begin (w, METRIC_GAUGE, "cache_blobs",
+                 "Number of cached blobs.");
+  metrics_put (w, NULL, NULL, stats.blobs);
+  metrics_begin (w, METRIC_GAUGE, "cache_bytes",
+                 "Memory used by the cached blobs.");
+  metrics_put (w, NULL, NULL, stats.bytes);
+  metrics_begin (w, METRIC_GAUGE, "cache_limit_bytes",
+                 "The configured limit for the cache memory.");
+  metrics_put (w, NULL, NULL, stats.limit);
+}
+
+
+/* Attach the signature status STATUS to the cached keyblock UBID.
+ * DIGEST is the SHA-256 of the keyblock the status was computed
+ * for.  */
+gpg_error_t
+kbxd_put_sigstatus (const unsigned char *ubid, const unsigned char *digest,
+                    const char *status)
+{
+  if (!opt.cache_size)
+    return gpg_error (GPG_ERR_NOT_ENABLED);
+  return be_cache_put_sigstatus (ubid, digest, status);
+}
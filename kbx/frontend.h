@@ -23,6 +23,14 @@
 #include "keybox-search-desc.h"
 
 
+/* An entry of the change log.  */
+struct kbxd_change_s
+{
+  uint64_t seqno;                  /* The change counter.  */
+  unsigned char ubid[UBID_LEN];    /* The changed keyblock.  */
+};
+
+
 gpg_error_t kbxd_set_database (ctrl_t ctrl,
                                const char *filename_arg, int readonly);
 
@@ -36,6 +44,15 @@ gpg_error_t kbxd_search (ctrl_t ctrl,
 gpg_error_t kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
                         enum kbxd_store_modes mode);
 gpg_error_t kbxd_delete (ctrl_t ctrl, const unsigned char *ubid);
+gpg_error_t kbxd_get_changes (unsigned long epoch, uint64_t since, int wait,
+                              struct kbxd_change_s **r_changes,
+                              unsigned int *r_nchanges, int *r_flush,
+                              unsigned long *r_epoch, uint64_t *r_seqno);
+char *kbxd_get_cache_stats (void);
+void kbxd_metrics (metrics_writer_t w);
+gpg_error_t kbxd_put_sigstatus (const unsigned char *ubid,
+                                const unsigned char *digest,
+                                const char *status);
 
 
 #endif /*KBX_FRONTEND_H*/
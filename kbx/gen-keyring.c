@@ -0,0 +1,630 @@
+/* gen-keyring.c - Create large synthetic OpenPGP keyrings
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This tool writes a stream of valid OpenPGP keyblocks to be used
+ * for benchmarking the keyring, keybox and keyboxd backends.  Each
+ * key has an Ed25519 primary key, one or more user IDs, a Curve25519
+ * subkey and a number of certifications by other keys of the set.
+ * The number of user IDs and certifications follows a geometric
+ * distribution; certifications are preferably issued by the older
+ * keys so that a few keys act as hubs of the web of trust.  All
+ * signatures are real so the output can be imported by gpg.  The
+ * distributions are reproducible with --seed; the key material is
+ * not.  */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../common/util.h"
+#include "../common/i18n.h"
+#include "../common/init.h"
+#include <gcrypt.h>
+
+
+enum cmd_and_opt_values {
+  aNull = 0,
+  oOutput	  = 'o',
+  oQuiet	  = 'q',
+  oVerbose	  = 'v',
+
+  oNoSuchOpt    = 500,   /* force other values not to be a letter */
+  oKeys,
+  oSeed,
+  oMaxUids,
+  oCerts,
+  oList,
+
+  oLastOpt
+};
+
+
+static gpgrt_opt_t opts[] = {
+  ARGPARSE_s_s (oOutput, "output", "|FILE|write the keyblocks to FILE"),
+  ARGPARSE_s_s (oList,   "list",
+                "|FILE|write the fingerprints and mail addresses to FILE"),
+  ARGPARSE_s_u (oKeys,   "keys",   "|N|create N keys (default 1000)"),
+  ARGPARSE_s_u (oSeed,   "seed",   "|N|seed for the distributions"),
+  ARGPARSE_s_u (oMaxUids, "max-uids", "|N|use at most N user IDs per key"),
+  ARGPARSE_s_u (oCerts,  "certs",
+                "|N|create on average N certifications per user ID"),
+  ARGPARSE_s_n (oVerbose, "verbose", "verbose"),
+  ARGPARSE_s_n (oQuiet,   "quiet",   "be somewhat more quiet"),
+
+  ARGPARSE_end ()
+};
+
+
+/* The OIDs of Ed25519 and Curve25519 as used in OpenPGP.  */
+static const unsigned char oid_ed25519[] =
+  { 0x2b, 0x06, 0x01, 0x04, 0x01, 0xda, 0x47, 0x0f, 0x01 };
+static const unsigned char oid_cv25519[] =
+  { 0x2b, 0x06, 0x01, 0x04, 0x01, 0x97, 0x55, 0x01, 0x05, 0x01 };
+
+#define PUBKEY_ALGO_ECDH  18
+#define PUBKEY_ALGO_EDDSA 22
+#define DIGEST_ALGO_SHA256 8
+#define CIPHER_ALGO_AES 7
+
+/* The start of the creation time window.  */
+#define BASE_TIME 1400000000
+
+
+/* The secret and public parameters of a generated primary key.  */
+struct synth_key_s
+{
+  unsigned char d[32];
+  unsigned char q[33];     /* With the 0x40 prefix.  */
+  unsigned char fpr[20];
+  uint32_t created;
+};
+typedef struct synth_key_s *synth_key_t;
+
+
+static const char *first_names[] = {
+  "Alice", "Bob", "Carol", "Dave", "Erin", "Frank", "Grace", "Heidi",
+  "Ivan", "Judy", "Karl", "Laura", "Mallory", "Niaj", "Olivia", "Peggy",
+  "Quentin", "Rupert", "Sybil", "Trent", "Ursula", "Victor", "Walter",
+  "Xavier", "Yvonne", "Zoe", "Werner", "Ingrid", "Juergen", "Asa",
+  "Marcus", "Nadia"
+};
+
+static const char *last_names[] = {
+  "Smith", "Jones", "Miller", "Schmidt", "Mueller", "Rossi", "Dubois",
+  "Novak", "Kowalski", "Larsen", "Jensen", "Garcia", "Silva", "Tanaka",
+  "Nguyen", "Kim", "Ivanova", "Papadopoulos", "Yilmaz", "Horvat",
+  "Andersson", "Meyer", "Fischer", "Weber", "Wagner", "Becker", "Koch",
+  "Hoffmann", "Doe", "Roe", "Bauer", "Wolf"
+};
+
+static const char *domains[] = {
+  "example.org", "example.com", "example.net", "mail.example",
+  "test.example", "corp.example", "uni.example", "lists.example"
+};
+
+
+static unsigned int opt_verbose;
+static unsigned int opt_keys = 1000;
+static unsigned int opt_max_uids = 5;
+static unsigned int opt_certs = 2;
+static uint64_t rng_state = 42;
+
+
+
+static const char *
+my_strusage (int level)
+{
+  const char *p;
+
+  switch (level)
+    {
+    case  9: p = "GPL-3.0-or-later"; break;
+    case 11: p = "gen-keyring (@GNUPG@)";
+      break;
+    case 13: p = VERSION; break;
+    case 14: p = GNUPG_DEF_COPYRIGHT_LINE; break;
+    case 17: p = PRINTABLE_OS_NAME; break;
+    case 19: p = _("Please report bugs to <@EMAIL@>.\n"); break;
+
+    case 1:
+    case 40:	p =
+        _("Usage: gen-keyring [options] (-h for help)");
+      break;
+    case 41:	p =
+        _("Syntax: gen-keyring [options]\n"
+          "Create a synthetic OpenPGP keyring for benchmarks\n");
+      break;
+
+    default:	p = NULL;
+    }
+  return p;
+}
+
+
+/* Return a pseudo random number in the range [0,N) from the
+ * reproducible xorshift64* generator.  */
+static unsigned int
+rnd (unsigned int n)
+{
+  uint64_t x = rng_state;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  rng_state = x;
+  return n? (unsigned int)(((x * 0x2545f4914f6cdd1dULL) >> 32) % n) : 0;
+}
+
+
+/* Return a geometric distributed number with a mean of NUM/(DEN-NUM)
+ * but not larger than MAX.  */
+static unsigned int
+geometric (unsigned int num, unsigned int den, unsigned int max)
+{
+  unsigned int n = 0;
+
+  while (n < max && rnd (den) < num)
+    n++;
+  return n;
+}
+
+
+/* Write an OpenPGP packet with TAG and body (BODY,LEN) to FP using
+ * the new packet format.  */
+static void
+write_packet (estream_t fp, int tag, const void *body, size_t len)
+{
+  unsigned char hdr[6];
+  size_t n = 0;
+
+  hdr[n++] = 0xc0 | tag;
+  if (len < 192)
+    hdr[n++] = len;
+  else if (len < 8384)
+    {
+      hdr[n++] = ((len - 192) >> 8) + 192;
+      hdr[n++] = (len - 192);
+    }
+  else
+    {
+      hdr[n++] = 0xff;
+      hdr[n++] = len >> 24;
+      hdr[n++] = len >> 16;
+      hdr[n++] = len >> 8;
+      hdr[n++] = len;
+    }
+  es_write (fp, hdr, n, NULL);
+  es_write (fp, body, len, NULL);
+}
+
+
+/* Store an MPI with value (A,ALEN) at P and return the new end.  */
+static unsigned char *
+put_mpi (unsigned char *p, const unsigned char *a, size_t alen)
+{
+  unsigned int nbits;
+  int i;
+
+  for (; alen && !*a; a++, alen--)
+    ;
+  nbits = alen? (alen - 1) * 8 : 0;
+  if (alen)
+    for (i = 7; i >= 0; i--)
+      if ((*a & (1 << i)))
+        {
+          nbits += i + 1;
+          break;
+        }
+  *p++ = nbits >> 8;
+  *p++ = nbits;
+  memcpy (p, a, alen);
+  return p + alen;
+}
+
+
+static unsigned char *
+put_u32 (unsigned char *p, uint32_t v)
+{
+  *p++ = v >> 24;
+  *p++ = v >> 16;
+  *p++ = v >> 8;
+  *p++ = v;
+  return p;
+}
+
+
+/* Build the body of a public key packet into BUF and return its
+ * length.  With KDF set an ECDH key is built.  */
+static size_t
+build_key_body (unsigned char *buf, int algo, uint32_t created,
+                const unsigned char *oid, size_t oidlen,
+                const unsigned char *q, int kdf)
+{
+  unsigned char *p = buf;
+
+  *p++ = 4;
+  p = put_u32 (p, created);
+  *p++ = algo;
+  *p++ = oidlen;
+  memcpy (p, oid, oidlen);
+  p += oidlen;
+  p = put_mpi (p, q, 33);
+  if (kdf)
+    {
+      *p++ = 3;
+      *p++ = 1;
+      *p++ = DIGEST_ALGO_SHA256;
+      *p++ = CIPHER_ALGO_AES;
+    }
+  return p - buf;
+}
+
+
+/* Hash the key packet body (BODY,LEN) as done for signatures.  */
+static void
+hash_key (gcry_md_hd_t md, const unsigned char *body, size_t len)
+{
+  unsigned char hdr[3];
+
+  hdr[0] = 0x99;
+  hdr[1] = len >> 8;
+  hdr[2] = len;
+  gcry_md_write (md, hdr, 3);
+  gcry_md_write (md, body, len);
+}
+
+
+/* Hash the user ID (UID,LEN) as done for certifications.  */
+static void
+hash_uid (gcry_md_hd_t md, const char *uid, size_t len)
+{
+  unsigned char hdr[5];
+
+  hdr[0] = 0xb4;
+  put_u32 (hdr+1, len);
+  gcry_md_write (md, hdr, 5);
+  gcry_md_write (md, uid, len);
+}
+
+
+/* Generate a new Ed25519 key into KEY.  */
+static void
+generate_key (synth_key_t key, uint32_t created)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_parms, s_key, l;
+  const unsigned char *s;
+  size_t n;
+  unsigned char body[64];
+  size_t bodylen;
+  gcry_md_hd_t md;
+
+  err = gcry_sexp_build (&s_parms, NULL,
+                         "(genkey(ecc(curve Ed25519)(flags eddsa)))");
+  if (!err)
+    err = gcry_pk_genkey (&s_key, s_parms);
+  gcry_sexp_release (s_parms);
+  if (err)
+    log_fatal ("error generating a key: %s\n", gpg_strerror (err));
+
+  l = gcry_sexp_find_token (s_key, "q", 0);
+  s = l? (const unsigned char *)gcry_sexp_nth_data (l, 1, &n) : NULL;
+  if (s && n == 32)  /* Libgcrypt omits the prefix.  */
+    {
+      key->q[0] = 0x40;
+      memcpy (key->q + 1, s, 32);
+    }
+  else if (s && n == 33 && *s == 0x40)
+    memcpy (key->q, s, 33);
+  else
+    log_fatal ("unexpected Ed25519 public key\n");
+  gcry_sexp_release (l);
+  l = gcry_sexp_find_token (s_key, "d", 0);
+  s = l? (const unsigned char *)gcry_sexp_nth_data (l, 1, &n) : NULL;
+  if (!s || n > 32)
+    log_fatal ("unexpected Ed25519 secret key\n");
+  memset (key->d, 0, 32 - n);
+  memcpy (key->d + 32 - n, s, n);
+  gcry_sexp_release (l);
+  gcry_sexp_release (s_key);
+
+  key->created = created;
+  bodylen = build_key_body (body, PUBKEY_ALGO_EDDSA, created,
+                            oid_ed25519, sizeof oid_ed25519, key->q, 0);
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    log_fatal ("error opening SHA-1\n");
+  hash_key (md, body, bodylen);
+  memcpy (key->fpr, gcry_md_read (md, GCRY_MD_SHA1), 20);
+  gcry_md_close (md);
+}
+
+
+/* Finish the signature over the data already hashed into MD and write
+ * it as a signature packet to FP.  SIGNER issues the signature of
+ * class SIGCLASS at time CREATED.  KEYFLAGS are put into the hashed
+ * area if not 0.  MD is closed.  */
+static void
+write_signature (estream_t fp, gcry_md_hd_t md, synth_key_t signer,
+                 int sigclass, uint32_t created, int keyflags)
+{
+  gpg_error_t err;
+  unsigned char buf[256];
+  unsigned char *p, *hashed;
+  unsigned char trailer[6];
+  unsigned char digest[32];
+  size_t hashedlen, n;
+  gcry_sexp_t s_skey, s_data, s_sig, l;
+  const unsigned char *r, *s;
+  size_t rlen, slen;
+
+  p = buf;
+  *p++ = 4;
+  *p++ = sigclass;
+  *p++ = PUBKEY_ALGO_EDDSA;
+  *p++ = DIGEST_ALGO_SHA256;
+  hashed = p;
+  p += 2;
+  *p++ = 5;     /* Signature creation time.  */
+  *p++ = 2;
+  p = put_u32 (p, created);
+  if (keyflags)
+    {
+      *p++ = 2;
+      *p++ = 27;
+      *p++ = keyflags;
+    }
+  *p++ = 22;    /* Issuer fingerprint.  */
+  *p++ = 33;
+  *p++ = 4;
+  memcpy (p, signer->fpr, 20);
+  p += 20;
+  hashedlen = p - hashed - 2;
+  hashed[0] = hashedlen >> 8;
+  hashed[1] = hashedlen;
+
+  gcry_md_write (md, buf, p - buf);
+  trailer[0] = 4;
+  trailer[1] = 0xff;
+  put_u32 (trailer+2, p - buf);
+  gcry_md_write (md, trailer, 6);
+  gcry_md_final (md);
+  memcpy (digest, gcry_md_read (md, GCRY_MD_SHA256), 32);
+  gcry_md_close (md);
+
+  *p++ = 0;     /* Unhashed: the issuer key ID.  */
+  *p++ = 10;
+  *p++ = 9;
+  *p++ = 16;
+  memcpy (p, signer->fpr + 12, 8);
+  p += 8;
+  *p++ = digest[0];
+  *p++ = digest[1];
+
+  err = gcry_sexp_build (&s_skey, NULL,
+                         "(private-key(ecc(curve Ed25519)(flags eddsa)"
+                         "(q%b)(d%b)))",
+                         33, signer->q, 32, signer->d);
+  if (!err)
+    err = gcry_sexp_build (&s_data, NULL,
+                           "(data(flags eddsa)(hash-algo sha512)(value %b))",
+                           32, digest);
+  if (!err)
+    {
+      err = gcry_pk_sign (&s_sig, s_data, s_skey);
+      gcry_sexp_release (s_data);
+    }
+  gcry_sexp_release (s_skey);
+  if (err)
+    log_fatal ("signing failed: %s\n", gpg_strerror (err));
+
+  l = gcry_sexp_find_token (s_sig, "r", 0);
+  r = l? (const unsigned char *)gcry_sexp_nth_data (l, 1, &rlen) : NULL;
+  if (!r || rlen > 32)
+    log_fatal ("unexpected signature\n");
+  p = put_mpi (p, r, rlen);
+  gcry_sexp_release (l);
+  l = gcry_sexp_find_token (s_sig, "s", 0);
+  s = l? (const unsigned char *)gcry_sexp_nth_data (l, 1, &slen) : NULL;
+  if (!s || slen > 32)
+    log_fatal ("unexpected signature\n");
+  p = put_mpi (p, s, slen);
+  gcry_sexp_release (l);
+  gcry_sexp_release (s_sig);
+
+  n = p - buf;
+  write_packet (fp, 2, buf, n);
+}
+
+
+/* Return a new hash context for a signature over the key with BODY
+ * and optionally the user ID UID.  */
+static gcry_md_hd_t
+start_sig_hash (const unsigned char *body, size_t bodylen, const char *uid)
+{
+  gcry_md_hd_t md;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    log_fatal ("error opening SHA-256\n");
+  hash_key (md, body, bodylen);
+  if (uid)
+    hash_uid (md, uid, strlen (uid));
+  return md;
+}
+
+
+/* Write the keyblock for key number IDX of KEYS to FP and the
+ * fingerprint and primary mail address to LISTFP.  */
+static void
+write_keyblock (estream_t fp, estream_t listfp,
+                synth_key_t keys, unsigned int idx)
+{
+  synth_key_t key = keys + idx;
+  unsigned char body[64], subbody[64];
+  size_t bodylen, subbodylen;
+  unsigned char subq[33];
+  char uid[200];
+  char mail[150];
+  char hexfpr[41];
+  unsigned int nuids, ncerts, i, j;
+  synth_key_t signer;
+  gcry_md_hd_t md;
+
+  bodylen = build_key_body (body, PUBKEY_ALGO_EDDSA, key->created,
+                            oid_ed25519, sizeof oid_ed25519, key->q, 0);
+  write_packet (fp, 6, body, bodylen);
+
+  nuids = 1 + geometric (1, 3, opt_max_uids - 1);
+  for (i = 0; i < nuids; i++)
+    {
+      const char *first = first_names[rnd (DIM (first_names))];
+      const char *last = last_names[rnd (DIM (last_names))];
+
+      snprintf (mail, sizeof mail, "%s.%s%u@%s",
+                first, last, idx, domains[(idx + i) % DIM (domains)]);
+      ascii_strlwr (mail);
+      snprintf (uid, sizeof uid, "%s %s <%s>", first, last, mail);
+      if (!i && listfp)
+        es_fprintf (listfp, "%s %s\n", bin2hex (key->fpr, 20, hexfpr), mail);
+
+      write_packet (fp, 13, uid, strlen (uid));
+      md = start_sig_hash (body, bodylen, uid);
+      write_signature (fp, md, key, 0x13, key->created, 0x03);
+
+      /* Third party certifications by preferably older keys.  */
+      ncerts = idx? geometric (opt_certs, opt_certs + 1, 1000) : 0;
+      for (j = 0; j < ncerts; j++)
+        {
+          unsigned int a = rnd (idx), b = rnd (idx), c = rnd (idx);
+
+          if (b < a)
+            a = b;
+          if (c < a)
+            a = c;
+          signer = keys + a;
+          md = start_sig_hash (body, bodylen, uid);
+          write_signature (fp, md, signer, 0x10,
+                           (key->created > signer->created
+                            ? key->created : signer->created)
+                           + rnd (20000000), 0);
+        }
+    }
+
+  /* The encryption subkey.  Its public value is random; that is a
+   * valid Curve25519 point.  */
+  subq[0] = 0x40;
+  gcry_create_nonce (subq + 1, 32);
+  subbodylen = build_key_body (subbody, PUBKEY_ALGO_ECDH, key->created,
+                               oid_cv25519, sizeof oid_cv25519, subq, 1);
+  write_packet (fp, 14, subbody, subbodylen);
+  md = start_sig_hash (body, bodylen, NULL);
+  hash_key (md, subbody, subbodylen);
+  write_signature (fp, md, key, 0x18, key->created, 0x0c);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  gpgrt_argparse_t pargs;
+  const char *output = NULL;
+  const char *listname = NULL;
+  estream_t fp, listfp = NULL;
+  synth_key_t keys;
+  unsigned int i;
+
+  early_system_init ();
+  gpgrt_set_strusage (my_strusage);
+  log_set_prefix ("gen-keyring", GPGRT_LOG_WITH_PREFIX);
+
+  /* Make sure that our subsystems are ready.  */
+  i18n_init ();
+  init_common_subsystems (&argc, &argv);
+
+  pargs.argc = &argc;
+  pargs.argv = &argv;
+  pargs.flags= ARGPARSE_FLAG_KEEP;
+  while (gpgrt_argparse (NULL, &pargs, opts))
+    {
+      switch (pargs.r_opt)
+        {
+        case oVerbose: opt_verbose++; break;
+        case oQuiet: opt_verbose = 0; break;
+        case oOutput: output = pargs.r.ret_str; break;
+        case oList: listname = pargs.r.ret_str; break;
+        case oKeys: opt_keys = pargs.r.ret_ulong; break;
+        case oSeed:  /* Note that xorshift must not be seeded with 0.  */
+          rng_state = pargs.r.ret_ulong? pargs.r.ret_ulong : 42;
+          break;
+        case oMaxUids: opt_max_uids = pargs.r.ret_ulong; break;
+        case oCerts: opt_certs = pargs.r.ret_ulong; break;
+
+        default: pargs.err = ARGPARSE_PRINT_ERROR; break;
+	}
+    }
+  gpgrt_argparse (NULL, &pargs, NULL);
+
+  if (argc)
+    gpgrt_usage (1);
+  if (!opt_max_uids)
+    opt_max_uids = 1;
+  if (log_get_errorcount (0))
+    exit (2);
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  if (!output || !strcmp (output, "-"))
+    {
+      fp = es_stdout;
+      es_set_binary (fp);
+    }
+  else if (!(fp = es_fopen (output, "wb")))
+    log_fatal ("error creating '%s': %s\n",
+               output, gpg_strerror (gpg_error_from_syserror ()));
+
+  if (listname && !(listfp = es_fopen (listname, "w")))
+    log_fatal ("error creating '%s': %s\n",
+               listname, gpg_strerror (gpg_error_from_syserror ()));
+
+  keys = xcalloc (opt_keys? opt_keys : 1, sizeof *keys);
+  for (i = 0; i < opt_keys; i++)
+    {
+      generate_key (keys + i, BASE_TIME + rnd (300000000));
+      write_keyblock (fp, listfp, keys, i);
+      if (opt_verbose && !((i+1) % 10000))
+        log_info ("%u keys written\n", i+1);
+    }
+
+  if (es_fflush (fp) || (fp != es_stdout && es_fclose (fp)))
+    log_fatal ("error writing '%s': %s\n", output? output : "[stdout]",
+               gpg_strerror (gpg_error_from_syserror ()));
+  if (listfp && es_fclose (listfp))
+    log_fatal ("error writing '%s': %s\n",
+               listname, gpg_strerror (gpg_error_from_syserror ()));
+
+  wipememory (keys, opt_keys * sizeof *keys);
+  xfree (keys);
+  return 0;
+}
@@ -45,6 +45,18 @@
 #define set_error(e,t) (ctx ? assuan_set_error (ctx, gpg_error (e), (t)) \
                         /**/: gpg_error (e))
 
+/* The maximum number of patterns accepted by SEARCH --batch.  */
+#define MAX_BATCH_PATTERNS 1000
+
+/* The maximum size of the data returned by SEARCH --batch.  This
+ * needs to be in sync with MAX_DATABLOB_SIZE in kbx-client-util.c.  */
+#define MAX_BATCH_DATA (16*1024*1024)
+
+/* The maximum number of keys returned by NEXT --batch.  NEXT --batch
+ * stops collecting keys once half of MAX_BATCH_DATA is used so that
+ * the next key always fits.  */
+#define MAX_BATCH_KEYS 1000
+
 
 /* Helper to provide packing memory for search descriptions.  */
 struct search_backing_store_s
@@ -103,6 +115,13 @@ struct server_local_s
 
   /* If not NULL write output to this stream instead of using D lines.  */
   estream_t outstream;
+
+  /* If this flag is set kbxd_write_data_line does not send the data
+   * but appends it to BATCH_DATA, prefixed by BATCH_INDEX and the
+   * length of the data.  Used by SEARCH --batch.  */
+  unsigned int batch_mode : 1;
+  unsigned int batch_index;
+  membuf_t batch_data;
 };
 
 
@@ -207,6 +226,21 @@ kbxd_write_data_line (ctrl_t ctrl, const void *buffer_arg, size_t size)
   if (!ctx) /* Oops - no assuan context.  */
     return gpg_error (GPG_ERR_NOT_PROCESSED);
 
+  /* Collect the data of a batched search.  */
+  if (ctrl && ctrl->server_local && ctrl->server_local->batch_mode)
+    {
+      unsigned char hdr[8];
+
+      if (get_membuf_len (&ctrl->server_local->batch_data) + size + 8
+          > MAX_BATCH_DATA)
+        return gpg_error (GPG_ERR_TOO_LARGE);
+      ulongtobuf (hdr, ctrl->server_local->batch_index);
+      ulongtobuf (hdr+4, size);
+      put_membuf (&ctrl->server_local->batch_data, hdr, 8);
+      put_membuf (&ctrl->server_local->batch_data, buffer, size);
+      return 0;
+    }
+
   /* Write toa file descriptor if enabled.  */
   if (ctrl && ctrl->server_local && ctrl->server_local->outstream)
     {
@@ -320,19 +354,143 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Helper for cmd_search to implement the --batch option.  The
+ * patterns are requested by an inquiry and each one is searched on
+ * its own.  All matching keys are returned in one data item which
+ * consists of records with a 4 byte index of the pattern, the 4 byte
+ * length of the keyblock and the keyblock itself; all in network
+ * byte order.  The PUBKEY_INFO status lines are emitted in the same
+ * order as the records.  */
+static gpg_error_t
+batch_search (assuan_context_t ctx, ctrl_t ctrl)
+{
+  gpg_error_t err;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  char *patterns = NULL;
+  char *p, *pend;
+  KEYBOX_SEARCH_DESC *desc = NULL;
+  unsigned int ndesc, idx;
+  int any_found = 0;
+  char *data;
+  size_t datalen;
+
+  init_membuf (&ctrl->server_local->batch_data, 8192);
+
+  err = assuan_inquire (ctx, "PATTERNS", &value, &valuelen, 0);
+  if (err)
+    {
+      log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+
+  /* Make a string from the inquired data so that the search
+   * descriptions can point into it.  */
+  patterns = xtrymalloc (valuelen + 1);
+  if (!patterns)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (patterns, value, valuelen);
+  patterns[valuelen] = 0;
+
+  desc = xtrycalloc (MAX_BATCH_PATTERNS, sizeof *desc);
+  if (!desc)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (ndesc = 0, p = patterns; *p; p = pend)
+    {
+      pend = strchr (p, '\n');
+      if (pend)
+        *pend++ = 0;
+      else
+        pend = p + strlen (p);
+      trim_spaces (p);
+      if (!*p)
+        continue;
+      if (ndesc == MAX_BATCH_PATTERNS)
+        {
+          err = set_error (GPG_ERR_TOO_MANY, "too many patterns");
+          goto leave;
+        }
+      err = classify_user_id (p, desc + ndesc, 1);
+      if (err)
+        goto leave;
+      ndesc++;
+    }
+  if (!ndesc)
+    {
+      err = set_error (GPG_ERR_INV_ARG, "no patterns");
+      goto leave;
+    }
+
+  ctrl->server_local->batch_mode = 1;
+  for (idx = 0; idx < ndesc; idx++)
+    {
+      ctrl->server_local->batch_index = idx;
+      err = kbxd_search (ctrl, desc + idx, 1, 1);
+      while (!err)
+        {
+          any_found = 1;
+          err = kbxd_search (ctrl, desc + idx, 1, 0);
+        }
+      if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+        goto leave;
+      err = 0;
+    }
+  ctrl->server_local->batch_mode = 0;
+
+  if (!any_found)
+    {
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+
+  data = get_membuf (&ctrl->server_local->batch_data, &datalen);
+  if (!data)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  err = kbxd_write_data_line (ctrl, data, datalen);
+  xfree (data);
+
+ leave:
+  ctrl->server_local->batch_mode = 0;
+  xfree (get_membuf (&ctrl->server_local->batch_data, NULL));
+  xfree (desc);
+  xfree (patterns);
+  xfree (value);
+  return err;
+}
+
+
 static const char hlp_search[] =
   "SEARCH [--no-data] [--openpgp|--x509] [[--more] PATTERN]\n"
+  "SEARCH --batch [--openpgp|--x509]\n"
   "\n"
   "Search for the keys identified by PATTERN.  With --more more\n"
   "patterns to be used for the search are expected with the next\n"
   "command.  With --no-data only the search status is returned but\n"
   "not the actual data.  With --openpgp or --x509 only the respective\n"
-  "keys are returned.  See also \"NEXT\".";
+  "keys are returned.  See also \"NEXT\".\n"
+  "\n"
+  "With --batch the patterns are requested using\n"
+  "  INQUIRE PATTERNS\n"
+  "and LF delimited.  In contrast to --more each pattern is searched\n"
+  "separately and all matching keys for all patterns are returned\n"
+  "at once.  The data consists of records, each made up of the 4 byte\n"
+  "index of the pattern, the 4 byte length of the keyblock and the\n"
+  "keyblock; the PUBKEY_INFO status lines are emitted in the same\n"
+  "order.  \"NEXT\" can't be used after a batched search.";
 static gpg_error_t
 cmd_search (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
-  int opt_more, opt_no_data, opt_openpgp, opt_x509;
+  int opt_more, opt_no_data, opt_openpgp, opt_x509, opt_batch;
   gpg_error_t err;
   unsigned int n, k;
 
@@ -340,10 +498,32 @@ cmd_search (assuan_context_t ctx, char *line)
   opt_more = has_option (line, "--more");
   opt_openpgp = has_option (line, "--openpgp");
   opt_x509 = has_option (line, "--x509");
+  opt_batch = has_option (line, "--batch");
   line = skip_options (line);
 
   ctrl->server_local->search_any_found = 0;
 
+  if (opt_batch)
+    {
+      if (opt_more || opt_no_data || *line
+          || ctrl->server_local->search_expecting_more)
+        {
+          err = set_error (GPG_ERR_INV_ARG,
+                           "--batch does not allow patterns or options");
+          goto leave;
+        }
+      ctrl->server_local->multi_search_desc_len = 0;
+      ctrl->server_local->inhibit_data_logging = 1;
+      ctrl->server_local->inhibit_data_logging_now = 0;
+      ctrl->server_local->inhibit_data_logging_count = 0;
+      ctrl->filter_opgp = opt_openpgp;
+      ctrl->filter_x509 = opt_x509;
+      err = prepare_outstream (ctrl);
+      if (!err)
+        err = batch_search (ctx, ctrl);
+      goto leave;
+    }
+
   if (!*line)
     {
       if (opt_more)
@@ -505,20 +685,84 @@ cmd_search (assuan_context_t ctx, char *line)
 }
 
 
+/* Helper for cmd_next to return up to MAXKEYS results of the current
+ * search (DESC,NDESC) as one data item.  The format of the data is
+ * the same as for SEARCH --batch with all indices being 0.  */
+static gpg_error_t
+batch_next (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
+            unsigned int maxkeys)
+{
+  gpg_error_t err = 0;
+  unsigned int count;
+  char *data;
+  size_t datalen;
+
+  init_membuf (&ctrl->server_local->batch_data, 65536);
+  ctrl->server_local->batch_mode = 1;
+  ctrl->server_local->batch_index = 0;
+  for (count = 0; count < maxkeys; count++)
+    {
+      if (get_membuf_len (&ctrl->server_local->batch_data)
+          > MAX_BATCH_DATA / 2)
+        break;
+      err = kbxd_search (ctrl, desc, ndesc, 0);
+      if (err)
+        break;
+    }
+  ctrl->server_local->batch_mode = 0;
+  if (count && gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    err = 0;  /* Return what we have; the next call returns NOT_FOUND.  */
+  if (err)
+    goto leave;
+
+  data = get_membuf (&ctrl->server_local->batch_data, &datalen);
+  if (!data)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  err = kbxd_write_data_line (ctrl, data, datalen);
+  xfree (data);
+
+ leave:
+  xfree (get_membuf (&ctrl->server_local->batch_data, NULL));
+  return err;
+}
+
+
 static const char hlp_next[] =
-  "NEXT [--no-data]\n"
+  "NEXT [--no-data] [--batch=N]\n"
   "\n"
-  "Get the next search result from a previous search.";
+  "Get the next search result from a previous search.  With --batch\n"
+  "up to N results are returned using one data item in the format\n"
+  "described for SEARCH --batch.";
 static gpg_error_t
 cmd_next (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
   int opt_no_data;
+  unsigned int opt_batch = 0;
+  const char *s;
   gpg_error_t err;
 
   opt_no_data = has_option (line, "--no-data");
+  if ((s = option_value (line, "--batch")))
+    {
+      opt_batch = atoi (s);
+      if (!opt_batch || opt_batch > MAX_BATCH_KEYS)
+        {
+          err = set_error (GPG_ERR_INV_ARG, "invalid value for --batch");
+          goto leave;
+        }
+    }
   line = skip_options (line);
 
+  if (opt_batch && opt_no_data)
+    {
+      err = set_error (GPG_ERR_CONFLICT, "--batch used with --no-data");
+      goto leave;
+    }
+
   if (*line)
     {
       err = set_error (GPG_ERR_INV_ARG, "no args expected");
@@ -546,8 +790,13 @@ cmd_next (assuan_context_t ctx, char *line)
           == KEYDB_SEARCH_MODE_FIRST)
         ctrl->server_local->multi_search_desc[0].mode = KEYDB_SEARCH_MODE_NEXT;
 
-      err = kbxd_search (ctrl, ctrl->server_local->multi_search_desc,
-                         ctrl->server_local->multi_search_desc_len, 0);
+      if (opt_batch)
+        err = batch_next (ctrl, ctrl->server_local->multi_search_desc,
+                          ctrl->server_local->multi_search_desc_len,
+                          opt_batch);
+      else
+        err = kbxd_search (ctrl, ctrl->server_local->multi_search_desc,
+                           ctrl->server_local->multi_search_desc_len, 0);
     }
   else
     {
@@ -555,7 +804,11 @@ cmd_next (assuan_context_t ctx, char *line)
       if (ctrl->server_local->search_desc.mode == KEYDB_SEARCH_MODE_FIRST)
         ctrl->server_local->search_desc.mode = KEYDB_SEARCH_MODE_NEXT;
 
-      err = kbxd_search (ctrl, &ctrl->server_local->search_desc, 1, 0);
+      if (opt_batch)
+        err = batch_next (ctrl, &ctrl->server_local->search_desc, 1,
+                          opt_batch);
+      else
+        err = kbxd_search (ctrl, &ctrl->server_local->search_desc, 1, 0);
     }
   if (err)
     goto leave;
@@ -665,20 +918,166 @@ cmd_delete (assuan_context_t ctx, char *line)
 }
 
 
+static const char hlp_sigcache[] =
+  "SIGCACHE <ubid> <sha256> <status>\n"
+  "\n"
+  "Store the result of the signature checks done by the client for\n"
+  "the key UBID.  SHA256 is the hex encoded hash of the keyblock as\n"
+  "returned by SEARCH or NEXT; the status is ignored if that keyblock\n"
+  "is not cached anymore or has changed.  STATUS has one character\n"
+  "for each signature packet of the keyblock in order: 'g' for a good\n"
+  "signature, 'b' for a bad one and '-' if it has not been checked.\n"
+  "The status is returned with a SIGCACHE status line before the\n"
+  "keyblock to later searches.";
+static gpg_error_t
+cmd_sigcache (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  int n;
+  const char *s;
+  unsigned char ubid[UBID_LEN];
+  unsigned char digest[32];
+
+  line = skip_options (line);
+  if ((n=hex2bin (line, ubid, UBID_LEN)) < 0)
+    {
+      err = set_error (GPG_ERR_INV_USER_ID, "invalid UBID");
+      goto leave;
+    }
+  line += n;
+  while (spacep (line))
+    line++;
+  if ((n=hex2bin (line, digest, sizeof digest)) < 0)
+    {
+      err = set_error (GPG_ERR_INV_ARG, "invalid hash");
+      goto leave;
+    }
+  line += n;
+  while (spacep (line))
+    line++;
+  for (s = line; *s == 'g' || *s == 'b' || *s == '-'; s++)
+    ;
+  if (s == line || *s)
+    {
+      err = set_error (GPG_ERR_INV_ARG, "invalid status");
+      goto leave;
+    }
+
+  err = kbxd_put_sigstatus (ubid, digest, line);
+
+ leave:
+  return leave_cmd (ctx, err);
+}
+
+
+
 
+static const char hlp_changes[] =
+  "CHANGES [--wait] [<epoch> <counter>]\n"
+  "\n"
+  "Return the keyblocks changed after change COUNTER of the keyboxd\n"
+  "instance EPOCH.  Each store or delete of a keyblock increments the\n"
+  "change counter.  For each changed keyblock the status line\n"
+  "\n"
+  "  CHANGED <ubid> <counter>\n"
+  "\n"
+  "is emitted with the counter of its last change.  If the changes\n"
+  "after COUNTER are not anymore known or EPOCH is not the current\n"
+  "instance, only the status line\n"
+  "\n"
+  "  CHANGED FLUSH\n"
+  "\n"
+  "is emitted to tell the client that all its cached keyblocks may be\n"
+  "stale.  The OK line returns \"<epoch> <counter>\" to be used for\n"
+  "the next CHANGES command; without arguments nothing else is done.\n"
+  "With --wait the command returns only after a change; this allows\n"
+  "a client to subscribe to changes on a dedicated connection.";
+static gpg_error_t
+cmd_changes (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int opt_wait;
+  unsigned long epoch = 0;
+  uint64_t since = 0, seqno;
+  struct kbxd_change_s *changes = NULL;
+  unsigned int nchanges, n;
+  int flush;
+  char *endp;
+  char hexubid[2*UBID_LEN+1];
+  char numbuf[60];
+
+  opt_wait = has_option (line, "--wait");
+  line = skip_options (line);
+  if (*line)
+    {
+      epoch = strtoul (line, &endp, 10);
+      line = endp;
+      while (spacep (line))
+        line++;
+      if (!digitp (line))
+        {
+          err = set_error (GPG_ERR_INV_ARG, "counter missing");
+          goto leave;
+        }
+      since = strtoull (line, &endp, 10);
+      if (*endp)
+        {
+          err = set_error (GPG_ERR_INV_ARG, "garbage after counter");
+          goto leave;
+        }
+      err = kbxd_get_changes (epoch, since, opt_wait, &changes, &nchanges,
+                              &flush, &epoch, &seqno);
+      if (err)
+        goto leave;
+      if (flush)
+        err = kbxd_status_printf (ctrl, "CHANGED", "FLUSH");
+      for (n=0; !err && n < nchanges; n++)
+        {
+          bin2hex (changes[n].ubid, UBID_LEN, hexubid);
+          err = kbxd_status_printf (ctrl, "CHANGED", "%s %llu", hexubid,
+                                    (unsigned long long)changes[n].seqno);
+        }
+      if (err)
+        goto leave;
+    }
+  else
+    {
+      err = kbxd_get_changes (0, 0, 0, &changes, &nchanges,
+                              &flush, &epoch, &seqno);
+      if (err)
+        goto leave;
+    }
+
+  snprintf (numbuf, sizeof numbuf, "%lu %llu",
+            epoch, (unsigned long long)seqno);
+  err = assuan_set_okay_line (ctx, numbuf);
+
+ leave:
+  xfree (changes);
+  return leave_cmd (ctx, err);
+}
+
+
+
 static const char hlp_transaction[] =
-  "TRANSACTION [begin|commit|rollback]\n"
+  "TRANSACTION [--bulk] [begin|commit|rollback]\n"
   "\n"
   "For bulk import of data it is often useful to run everything\n"
   "in one transaction.  This can be achieved with this command.\n"
   "If the last connection of client is closed before a commit\n"
   "or rollback an implicit rollback is done.  With no argument\n"
-  "the status of the current transaction is returned.";
+  "the status of the current transaction is returned.  With option\n"
+  "--bulk given to \"begin\" the indices used only for searching are\n"
+  "not maintained during the transaction but rebuilt by the commit;\n"
+  "this speeds up the initial load of a large number of keys.";
 static gpg_error_t
 cmd_transaction (assuan_context_t ctx, char *line)
 {
   gpg_error_t err = 0;
+  int opt_bulk;
 
+  opt_bulk = has_option (line, "--bulk");
   line = skip_options (line);
 
   if (!strcmp (line, "begin"))
@@ -690,6 +1089,7 @@ cmd_transaction (assuan_context_t ctx, char *line)
       else
         {
           opt.in_transaction = 1;
+          opt.bulk_transaction = opt_bulk;
           opt.transaction_pid = assuan_get_pid (ctx);
         }
     }
@@ -746,6 +1146,8 @@ static const char hlp_getinfo[] =
   "socket_name - Return the name of the socket.\n"
   "session_id  - Return the current session_id.\n"
   "connections - Return number of active connections.\n"
+  "cache_stats - Return hit, miss and eviction counters of the cache.\n"
+  "metrics     - Return all metrics in the Prometheus text format.\n"
   "getenv NAME - Return value of envvar NAME\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
@@ -799,6 +1201,28 @@ cmd_getinfo (assuan_context_t ctx, char *line)
                 get_kbxd_active_connection_count ());
       err = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *s = metrics_format ();
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
+  else if (!strcmp (line, "cache_stats"))
+    {
+      char *s = kbxd_get_cache_stats ();
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
   else
     err = set_error (GPG_ERR_ASS_PARAMETER, "unknown value for WHAT");
 
@@ -862,6 +1286,8 @@ register_commands (assuan_context_t ctx)
     { "NEXT",       cmd_next,       hlp_next   },
     { "STORE",      cmd_store,      hlp_store  },
     { "DELETE",     cmd_delete,     hlp_delete  },
+    { "SIGCACHE",   cmd_sigcache,   hlp_sigcache },
+    { "CHANGES",    cmd_changes,    hlp_changes },
     { "TRANSACTION",cmd_transaction,hlp_transaction },
     { "GETINFO",    cmd_getinfo,    hlp_getinfo },
     { "OUTPUT",     NULL,           hlp_output },
@@ -45,12 +45,13 @@
    - u16  Header flags
           bit 0 - RFU
           bit 1 - Is being or has been used for OpenPGP blobs
+          bit 2 - An append is in progress
    - b4   Magic 'KBXf'
    - u32  RFU
    - u32  file_created_at
    - u32  last_maintenance_run
-   - u32  RFU
-   - u32  RFU
+   - u32  Number of bytes in blobs deleted since the last maintenance run
+   - u32  Offset of the blob replaced by a pending append
 
 ** The OpenPGP and X.509 blobs
 
@@ -85,7 +86,10 @@
              to the version 2 blob format.
       - u16  Key flags
              bit 0 = qualified signature (not yet implemented}
+             bit 1 = keygrip stored.
       - u16  RFU
+      - b20  Only if the size of the structure is at least 48: The
+             keygrip if bit 1 of the key flags is set.
       - bN   Optional filler up to the specified length of this
              structure.
      Version 2 blob:
@@ -94,11 +98,16 @@
              right filled with zeroes.
       - u16  Key flags
              bit 0 = qualified signature (not yet implemented}
+             bit 1 = keygrip stored.
              bit 7 = 32 byte fingerprint in use.
       - u16  RFU
-      - b20  keygrip  FIXME: Support a second grip.
+      - b20  The keygrip if bit 1 of the key flags is set; older
+             versions wrote zeroes here.  FIXME: Support a second grip.
       - bN   Optional filler up to the specified length of this
              structure.
+
+     The fixed offset of the keygrips allows a search by keygrip
+     without parsing the keyblock or certificate.
    - u16  Size of the serial number (may be zero)
       -  bN  The serial number. N as given above.
    - u16  Number of user IDs
@@ -115,13 +124,19 @@
              (not yet used)
       - byte Validity
       - byte RFU
+      - u32  Only if the size of the structure is at least 16:
+             For X.509 the hash of the name as computed by
+             _keybox_dn_hash.  For OpenPGP the hash of the mail
+             address of the user ID as computed by _keybox_mail_hash
+             or 0 if the user ID has no mail address.
 
    - u16  [NSIGS] Number of signatures
    - u16  Size of signature information (4)
    - NSIGS times:
       - u32  Expiration time of signature with some special values.
-             Since version 2.1.20 these special valuesare not anymore
-             used for OpenPGP:
+             For OpenPGP gpg stores the result of its signature checks
+             here (see keybox_set_sigstatus); any value not listed
+             below means valid:
              - 0x00000000 = not checked
              - 0x00000001 = missing key
              - 0x00000002 = bad signature
@@ -200,6 +215,7 @@ struct keyboxblob_key {
   ulong  off_kid_addr;
   u16    flags;
   u16    fprlen;  /* Either 20 or 32 */
+  unsigned char grip[20];  /* Valid if bit 1 of FLAGS is set.  */
 };
 struct keyboxblob_uid {
   u32    off;
@@ -208,6 +224,7 @@ struct keyboxblob_uid {
   u32    len;
   u16    flags;
   byte   validity;
+  u32    mailhash;  /* used only with OpenPGP */
 };
 
 struct keyid_list {
@@ -227,6 +244,7 @@ struct keyboxblob {
   byte *blob;
   size_t bloblen;
   off_t fileoffset;
+  int image_mapped;  /* BLOB points into a mapped file.  */
 
   /* stuff used only by keybox_create_blob */
   unsigned char *serialbuf;
@@ -412,7 +430,8 @@ pgp_create_key_part_single (KEYBOXBLOB blob, int n,
     }
   else
     blob->keys[n].off_kid = 0; /* Will be fixed up later */
-  blob->keys[n].flags = 0;
+  memcpy (blob->keys[n].grip, kinfo->grip, 20);
+  blob->keys[n].flags = 0x02; /* keygrip stored */
   return 0;
 }
 
@@ -438,10 +457,12 @@ pgp_create_key_part (KEYBOXBLOB blob, keybox_openpgp_info_t info)
 
 
 static void
-pgp_create_uid_part (KEYBOXBLOB blob, keybox_openpgp_info_t info)
+pgp_create_uid_part (KEYBOXBLOB blob, keybox_openpgp_info_t info,
+                     const unsigned char *image, size_t imagelen)
 {
   int n = 0;
   struct _keybox_openpgp_uid_info *u;
+  size_t off, len;
 
   if (info->nuids)
     {
@@ -451,6 +472,13 @@ pgp_create_uid_part (KEYBOXBLOB blob, keybox_openpgp_info_t info)
           blob->uids[n].len = u->len;
           blob->uids[n].flags = 0;
           blob->uids[n].validity = 0;
+          if (u->off + u->len <= imagelen
+              && _keybox_openpgp_mailbox (image + u->off, u->len,
+                                          &off, &len))
+            blob->uids[n].mailhash
+              = _keybox_mail_hash (image + u->off + off, len);
+          else
+            blob->uids[n].mailhash = 0;
           n++;
         }
     }
@@ -497,6 +525,32 @@ pgp_create_blob_keyblock (KEYBOXBLOB blob,
    X.509 specific stuff
  */
 
+/* Compute the keygrip of CERT and store it at GRIP.  Returns 0 on
+   success.  */
+static int
+x509_compute_grip (ksba_cert_t cert, unsigned char *grip)
+{
+  ksba_sexp_t p;
+  gcry_sexp_t s_pkey;
+  size_t n;
+  int rc;
+
+  p = ksba_cert_get_public_key (cert);
+  if (!p)
+    return -1;
+  n = gcry_sexp_canon_len (p, 0, NULL, NULL);
+  if (!n || gcry_sexp_sscan (&s_pkey, NULL, (char*)p, n))
+    {
+      xfree (p);
+      return -1;
+    }
+  xfree (p);
+  rc = gcry_pk_get_keygrip (s_pkey, grip)? 0 : -1;
+  gcry_sexp_release (s_pkey);
+  return rc;
+}
+
+
 /* Write the raw certificate out */
 static int
 x509_create_blob_cert (KEYBOXBLOB blob, ksba_cert_t cert)
@@ -572,7 +626,7 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
   if (want_fpr32)
     put16 ( a, 32 + 2 + 2 + 20);  /* size of key info */
   else
-    put16 ( a, 20 + 4 + 2 + 2 );  /* size of key info */
+    put16 ( a, 20 + 4 + 2 + 2 + 20 );  /* size of key info */
   for ( i=0; i < blob->nkeys; i++ )
     {
       if (want_fpr32)
@@ -586,8 +640,10 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
           else
             put16 ( a, blob->keys[i].flags);
           put16 ( a, 0 ); /* reserved */
-          /* FIXME: Put the real grip here instead of the filler.  */
-          put_membuf (a, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 20);
+          if ((blob->keys[i].flags & 0x02))
+            put_membuf (a, blob->keys[i].grip, 20);
+          else
+            put_membuf (a, NULL, 20);
         }
       else
         {
@@ -597,6 +653,10 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
           put32 ( a, 0 ); /* offset to keyid, fixed up later */
           put16 ( a, blob->keys[i].flags );
           put16 ( a, 0 ); /* reserved */
+          if ((blob->keys[i].flags & 0x02))
+            put_membuf (a, blob->keys[i].grip, 20);
+          else
+            put_membuf (a, NULL, 20);
         }
     }
 
@@ -605,7 +665,7 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
     put_membuf (a, blob->serial, blob->seriallen);
 
   put16 ( a, blob->nuids );
-  put16 ( a, 4 + 4 + 2 + 1 + 1 );  /* size of uid info */
+  put16 ( a, 4 + 4 + 2 + 1 + 1 + 4 );  /* size of uid info */
   for (i=0; i < blob->nuids; i++)
     {
       blob->uids[i].off_addr = a->len;
@@ -614,6 +674,10 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
       put16 ( a, blob->uids[i].flags );
       put8  ( a, 0 ); /* validity */
       put8  ( a, 0 ); /* reserved */
+      if (blobtype == KEYBOX_BLOBTYPE_X509)
+        put32 ( a, _keybox_dn_hash (blob->uids[i].name, blob->uids[i].len));
+      else
+        put32 ( a, blob->uids[i].mailhash );
     }
 
   put16 ( a, blob->nsigs );
@@ -813,7 +877,7 @@ _keybox_create_openpgp_blob (KEYBOXBLOB *r_blob,
   err = pgp_create_key_part (blob, info);
   if (err)
     goto leave;
-  pgp_create_uid_part (blob, info);
+  pgp_create_uid_part (blob, info, image, imagelen);
   pgp_create_sig_part (blob, NULL);
 
   init_membuf (&blob->bufbuf, 1024);
@@ -985,7 +1049,10 @@ _keybox_create_x509_blob (KEYBOXBLOB *r_blob, ksba_cert_t cert,
 
   memcpy (blob->keys[0].fpr, sha1_digest, 20);
   blob->keys[0].off_kid = 0; /* We don't have keyids */
-  blob->keys[0].flags = 0;
+  if (!x509_compute_grip (cert, blob->keys[0].grip))
+    blob->keys[0].flags = 0x02; /* keygrip stored */
+  else
+    blob->keys[0].flags = 0;
 
   /* issuer and subject names */
   for (i=0; i < blob->nuids; i++)
@@ -1063,6 +1130,41 @@ _keybox_new_blob (KEYBOXBLOB *r_blob,
 }
 
 
+/* Create a blob for IMAGE which points into a mapped keybox file.
+ * The image must be copied using _keybox_detach_blob before the file
+ * is unmapped.  */
+int
+_keybox_new_mapped_blob (KEYBOXBLOB *r_blob,
+                         const unsigned char *image, size_t imagelen,
+                         off_t off)
+{
+  int rc;
+
+  rc = _keybox_new_blob (r_blob, (unsigned char *)image, imagelen, off);
+  if (!rc)
+    (*r_blob)->image_mapped = 1;
+  return rc;
+}
+
+
+/* Make sure that BLOB owns its image.  */
+gpg_error_t
+_keybox_detach_blob (KEYBOXBLOB blob)
+{
+  unsigned char *image;
+
+  if (!blob->image_mapped)
+    return 0;
+  image = xtrymalloc (blob->bloblen);
+  if (!image)
+    return gpg_error_from_syserror ();
+  memcpy (image, blob->blob, blob->bloblen);
+  blob->blob = image;
+  blob->image_mapped = 0;
+  return 0;
+}
+
+
 void
 _keybox_release_blob (KEYBOXBLOB blob)
 {
@@ -1080,7 +1182,8 @@ _keybox_release_blob (KEYBOXBLOB blob)
     xfree (blob->uids[i].name);
   xfree (blob->uids );
   xfree (blob->sigs );
-  xfree (blob->blob );
+  if (!blob->image_mapped)
+    xfree (blob->blob );
   xfree (blob );
 }
 
@@ -1114,6 +1217,12 @@ _keybox_update_header_blob (KEYBOXBLOB blob, int for_openpgp)
       blob->blob[20+2] = (val >>  8);
       blob->blob[20+3] = (val      );
 
+      /* The deleted blobs are gone after a maintenance run.  */
+      memset (blob->blob+24, 0, 4);
+      /* A pending append has been finished before.  */
+      blob->blob[7] &= ~0x04;
+      memset (blob->blob+28, 0, 4);
+
       if (for_openpgp)
         blob->blob[7] |= 0x02;  /* OpenPGP data may be available.  */
     }
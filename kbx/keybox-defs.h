@@ -37,6 +37,19 @@ typedef struct keyboxblob *KEYBOXBLOB;
 
 
 typedef struct keybox_name *KB_NAME;
+
+
+/* The state of a keybox file as used to check whether its index is
+ * up to date.  */
+struct keybox_stamp_s
+{
+  uint64_t size;
+  uint64_t mtime;
+  uint64_t ino;
+  uint32_t mtime_nsec;  /* 0 if not supported.  */
+};
+
+
 struct keybox_name
 {
   /* Link to the next resources, so that we can walk all
@@ -61,6 +74,21 @@ struct keybox_name
   /* Not yet used.  */
   int did_full_scan;
 
+  /* Set if the index can't be used for this resource.  */
+  int index_failed;
+
+  /* Set during a batch of inserts; the lock is then kept and the
+   * records of the new blobs are collected in INDEX_BATCH.  */
+  int in_batch;
+  struct index_batch_s *index_batch;
+
+  /* The Bloom filter of the index, the state of the keybox it is
+   * valid for and the flags of the index.  */
+  unsigned char *bloom;
+  size_t bloomlen;
+  struct keybox_stamp_s bloom_stamp;
+  unsigned int bloom_flags;
+
   /* The name of the resource file. */
   char fname[1];
 };
@@ -77,6 +105,11 @@ struct keybox_handle {
   KB_NAME kb;
   int secret;             /* this is for a secret keybox */
   estream_t fp;
+  /* If MAP is not NULL the file opened as FP is mapped into memory
+   * and MAPPOS is used instead of the file position of FP.  */
+  unsigned char *map;
+  size_t maplen;
+  size_t mappos;
   int eof;
   int error;
   int ephemeral;
@@ -137,6 +170,11 @@ typedef struct _keybox_openpgp_info *keybox_openpgp_info_t;
 
 /*-- keybox-init.c --*/
 
+/* The header flag marking a pending append.  While it is set the
+ * u32 at offset 28 of the header blob holds the offset of the blob
+ * replaced by that append or 0 for an insert.  */
+#define HEADER_FLAG_APPENDING 0x04
+
 #define KEYBOX_LL_OPEN_READ    0
 #define KEYBOX_LL_OPEN_UPDATE  1
 #define KEYBOX_LL_OPEN_CREATE  2
@@ -145,6 +183,8 @@ gpg_error_t _keybox_ll_open (estream_t *rfp, const char *fname,
 gpg_error_t _keybox_ll_close (estream_t fp);
 
 void _keybox_close_file (KEYBOX_HANDLE hd);
+void _keybox_map_file (KEYBOX_HANDLE hd);
+void _keybox_unmap_file (KEYBOX_HANDLE hd);
 
 
 /*-- keybox-blob.c --*/
@@ -163,6 +203,10 @@ int _keybox_create_x509_blob (KEYBOXBLOB *r_blob, ksba_cert_t cert,
 int  _keybox_new_blob (KEYBOXBLOB *r_blob,
                        unsigned char *image, size_t imagelen,
                        off_t off);
+int  _keybox_new_mapped_blob (KEYBOXBLOB *r_blob,
+                              const unsigned char *image, size_t imagelen,
+                              off_t off);
+gpg_error_t _keybox_detach_blob (KEYBOXBLOB blob);
 void _keybox_release_blob (KEYBOXBLOB blob);
 const unsigned char *_keybox_get_blob_image (KEYBOXBLOB blob, size_t *n);
 off_t _keybox_get_blob_fileoffset (KEYBOXBLOB blob);
@@ -177,6 +221,9 @@ void _keybox_destroy_openpgp_info (keybox_openpgp_info_t info);
 
 /*-- keybox-file.c --*/
 int _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted);
+int _keybox_read_blob_hd (KEYBOXBLOB *r_blob, KEYBOX_HANDLE hd);
+off_t _keybox_tell (KEYBOX_HANDLE hd);
+gpg_error_t _keybox_seek (KEYBOX_HANDLE hd, off_t off);
 int _keybox_write_blob (KEYBOXBLOB blob, estream_t fp, FILE *outfp);
 
 /*-- keybox-search.c --*/
@@ -199,6 +246,21 @@ blob_get_type (KEYBOXBLOB blob)
 }
 
 
+/*-- keybox-index.c --*/
+gpg_error_t _keybox_index_stamp (const char *fname,
+                                 struct keybox_stamp_s *stamp);
+gpg_error_t _keybox_index_lookup (KB_NAME kb, KEYBOX_SEARCH_DESC *desc,
+                                  int want_blobtype,
+                                  off_t **r_offsets, size_t *r_count);
+void _keybox_index_update (const char *fname,
+                           const struct keybox_stamp_s *oldstamp,
+                           off_t off, KEYBOXBLOB newblob);
+void _keybox_index_begin_batch (KB_NAME kb);
+void _keybox_index_batch_add (KB_NAME kb, KEYBOXBLOB blob, off_t off);
+void _keybox_index_end_batch (KB_NAME kb);
+void _keybox_index_remove (const char *fname);
+
+
 /*-- keybox-dump.c --*/
 int _keybox_dump_blob (KEYBOXBLOB blob, FILE *fp);
 int _keybox_dump_file (const char *filename, int stats_only, FILE *outfp);
@@ -208,6 +270,10 @@ int _keybox_dump_cut_records (const char *filename, unsigned long from,
 
 
 /*-- keybox-util.c --*/
+u32 _keybox_dn_hash (const void *name, size_t namelen);
+u32 _keybox_mail_hash (const void *mbox, size_t mboxlen);
+int _keybox_openpgp_mailbox (const unsigned char *uid, size_t uidlen,
+                             size_t *r_off, size_t *r_len);
 
 /*
  * A couple of handy macros
@@ -328,6 +328,13 @@ _keybox_dump_blob (KEYBOXBLOB blob, FILE *fp)
           kflags = get16 (p + 24);
         }
       fprintf( fp, "\nKey-Flags[%lu]: %04lX\n", n, kflags);
+      if ((kflags & 0x02) && keyinfolen >= (is_fpr32? 56 : 48))
+        {
+          fprintf (fp, "Key-Grip[%lu]: ", n);
+          for (i=0; i < 20; i++ )
+            fprintf (fp, "%02X", p[(is_fpr32? 36 : 28) + i]);
+          putc ('\n', fp);
+        }
     }
 
   /* serial number */
@@ -414,16 +421,23 @@ _keybox_dump_blob (KEYBOXBLOB blob, FILE *fp)
         {
           fprintf (fp, "Issuer-Flags: %04lX\n", uflags );
           fprintf (fp, "Issuer-Validity: %d\n", p[10] );
+          if (uidinfolen >= 16 && p + 16 < pend)
+            fprintf (fp, "Issuer-Hash: %08lX\n", get32 (p + 12));
         }
       else if (type == KEYBOX_BLOBTYPE_X509 && n == 1)
         {
           fprintf (fp, "Subject-Flags: %04lX\n", uflags );
           fprintf (fp, "Subject-Validity: %d\n", p[10] );
+          if (uidinfolen >= 16 && p + 16 < pend)
+            fprintf (fp, "Subject-Hash: %08lX\n", get32 (p + 12));
         }
       else
         {
           fprintf (fp, "Uid-Flags[%lu]: %04lX\n", n, uflags );
           fprintf (fp, "Uid-Validity[%lu]: %d\n", n, p[10] );
+          if (type == KEYBOX_BLOBTYPE_PGP && uidinfolen >= 16
+              && p + 16 < pend)
+            fprintf (fp, "Uid-Mail-Hash[%lu]: %08lX\n", n, get32 (p + 12));
         }
     }
 
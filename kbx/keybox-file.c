@@ -46,7 +46,11 @@ ftello (FILE *stream)
 
 
 /* Read a block at the current position and return it in R_BLOB.
-   R_BLOB may be NULL to simply skip the current block.  */
+   R_BLOB may be NULL to simply skip the current block.  A truncated
+   blob at the end of the file is treated as end of file: It is
+   either being appended right now by a process holding the lock or
+   is the remains of an interrupted append which will be removed by
+   the next update (see blob_append).  */
 int
 _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted)
 {
@@ -71,10 +75,8 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted)
       || (c4 = es_getc (fp)) == EOF
       || (type = es_getc (fp)) == EOF)
     {
-      if ( c1 == EOF && !es_ferror (fp) )
-        return -1; /* eof */
       if (!es_ferror (fp))
-        return gpg_error (GPG_ERR_TOO_SHORT);
+        return -1; /* eof or truncated blob */
       return gpg_error_from_syserror ();
     }
 
@@ -116,9 +118,12 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted)
   image[0] = c1; image[1] = c2; image[2] = c3; image[3] = c4; image[4] = type;
   if (es_fread (image+5, imagelen-5, 1, fp) != 1)
     {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
+      if (!es_ferror (fp))
+        rc = -1; /* Truncated blob.  */
+      else
+        rc = gpg_error_from_syserror ();
       xfree (image);
-      return tmperr;
+      return rc;
     }
 
   rc = _keybox_new_blob (r_blob, image, imagelen, off);
@@ -128,6 +133,73 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted)
 }
 
 
+/* Read the next blob of HD and return it in R_BLOB.  If the file is
+ * mapped the returned blob points into the mapping; this is the same
+ * as _keybox_read_blob but avoids copying the blob.  */
+int
+_keybox_read_blob_hd (KEYBOXBLOB *r_blob, KEYBOX_HANDLE hd)
+{
+  const unsigned char *p;
+  size_t imagelen, pos;
+  int type;
+
+  if (!hd->map)
+    return _keybox_read_blob (r_blob, hd->fp, NULL);
+
+ again:
+  *r_blob = NULL;
+  pos = hd->mappos;
+  if (pos >= hd->maplen)
+    return -1; /* eof */
+  if (hd->maplen - pos < 5)
+    return -1; /* Truncated blob.  */
+
+  p = hd->map + pos;
+  imagelen = ((size_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8 ) | p[3];
+  type = p[4];
+  if (imagelen < 5)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+  if (imagelen > hd->maplen - pos)
+    return -1; /* Truncated blob.  */
+
+  hd->mappos += imagelen;
+  if (!type)
+    goto again;  /* Skip empty blobs.  */
+
+  if (imagelen > IMAGELEN_LIMIT) /* Sanity check. */
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  return _keybox_new_mapped_blob (r_blob, p, imagelen, pos);
+}
+
+
+/* Return the current read position of HD.  */
+off_t
+_keybox_tell (KEYBOX_HANDLE hd)
+{
+  if (hd->map)
+    return hd->mappos;
+  return es_ftello (hd->fp);
+}
+
+
+/* Set the read position of HD to OFF.  */
+gpg_error_t
+_keybox_seek (KEYBOX_HANDLE hd, off_t off)
+{
+  if (hd->map)
+    {
+      if (off < 0 || (uint64_t)off > (uint64_t)hd->maplen)
+        return gpg_error (GPG_ERR_EINVAL);
+      hd->mappos = off;
+      return 0;
+    }
+  if (es_fseeko (hd->fp, off, SEEK_SET))
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
 /* Write the block to the current file position */
 int
 _keybox_write_blob (KEYBOXBLOB blob, estream_t fp, FILE *outfp)
@@ -0,0 +1,1283 @@
+/* keybox-index.c - Sidecar index for keybox files
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The index maps fingerprints, long keyids, keygrips and, for X.509
+ * blobs, the issuer and serial number and the subject to the file
+ * offsets of the blobs carrying them.  It is stored next to the
+ * keybox as "<fname>.idx" and is only a cache: each candidate blob
+ * is still checked by the regular search code and a stale or broken
+ * index is simply rebuilt.  Whether an index is up to date is
+ * decided by comparing the size, mtime and inode of the keybox file
+ * with the values stored in the index header.  The nanoseconds of
+ * the mtime are included where available so that an in-place change
+ * which does not change the size is detected even within the same
+ * second.
+ *
+ * File format (all integers are big endian):
+ *
+ *   byte  0-3   magic "KBXi"
+ *   byte  4     version (3)
+ *   byte  5     flags; bit 0 is set if the keybox has X.509 blobs
+ *               whose keygrips are not indexed.
+ *   byte  6-7   reserved
+ *   byte  8-15  size of the keybox file
+ *   byte 16-23  mtime of the keybox file
+ *   byte 24-31  inode of the keybox file
+ *   byte 32-35  number of records
+ *   byte 36-39  length of the Bloom filter in bytes or 0
+ *   byte 40-43  nanoseconds of the mtime of the keybox file or 0
+ *   byte 44-47  reserved
+ *
+ * followed by the records sorted by key and then offset:
+ *
+ *   byte  0-7   key
+ *   byte  8-15  offset of the blob in the keybox file
+ *
+ * and the Bloom filter over the keys of all records.
+ *
+ * The key is the leftmost 8 bytes of the SHA-1 over a type byte and
+ * the fingerprint, keyid or keygrip.  For the issuer and serial number
+ * the SHA-1 is taken over the type byte, the length of the serial
+ * number as 2 byte value, the serial number and the issuer's DN; for
+ * the subject over the type byte and the DN.  The DNs are used as
+ * stored in the blob which are also the strings compared by the
+ * search code.  Collisions only lead to additional candidates.
+ *
+ * Most lookups for keys not in the keybox come from third-party key
+ * signatures.  To answer them without opening the index, the Bloom
+ * filter is kept in memory as long as the keybox does not change.
+ * It uses INDEX_BLOOM_HASHES bit positions derived from the two
+ * halves of the key and INDEX_BLOOM_BITS bits per record which gives
+ * a false positive rate of about 1%.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "keybox-defs.h"
+#include <gcrypt.h>
+#include "../common/sysutils.h"
+#include "../common/host2net.h"
+
+#define INDEX_MAGIC      "KBXi"
+#define INDEX_VERSION    3
+#define INDEX_HDRLEN     48
+#define INDEX_RECLEN     16
+
+#define INDEX_FLAG_X509_NOGRIP 1
+
+#define INDEX_BLOOM_BITS    10
+#define INDEX_BLOOM_HASHES  7
+#define INDEX_BLOOM_MAXLEN  (16*1024*1024)
+
+/* The type bytes used to build the keys.  */
+#define INDEX_TYPE_FPR   'F'
+#define INDEX_TYPE_KID   'K'
+#define INDEX_TYPE_GRIP  'G'
+#define INDEX_TYPE_ISN   'I'
+#define INDEX_TYPE_SUBJ  'S'
+
+
+/* Set after the first failure to build an index has been logged.  */
+static int index_error_logged;
+
+
+struct index_rec_s
+{
+  unsigned char key[8];
+  uint64_t off;
+};
+
+struct index_recs_s
+{
+  struct index_rec_s *recs;
+  size_t nrecs;
+  size_t size;
+  unsigned int flags;
+};
+
+
+/* The records of the blobs appended during a batch of inserts.  They
+ * are hashed by their key to answer lookups until the index file is
+ * written at the end of the batch.  */
+struct index_batch_s
+{
+  struct keybox_stamp_s stamp;  /* The state the index file is for.  */
+  uint64_t end;                 /* The expected size of the keybox.  */
+  struct index_recs_s r;
+  size_t *chain;                /* Next record + 1 for each record.  */
+  size_t *buckets;              /* First record + 1 for each bucket.  */
+  size_t nbuckets;              /* A power of 2.  */
+};
+
+
+static uint64_t
+get64 (const unsigned char *p)
+{
+  return (((uint64_t)buf32_to_u32 (p)) << 32) | buf32_to_u32 (p + 4);
+}
+
+
+static void
+put64 (unsigned char *p, uint64_t a)
+{
+  p[0] = a >> 56;
+  p[1] = a >> 48;
+  p[2] = a >> 40;
+  p[3] = a >> 32;
+  p[4] = a >> 24;
+  p[5] = a >> 16;
+  p[6] = a >>  8;
+  p[7] = a;
+}
+
+
+static void
+put32 (unsigned char *p, u32 a)
+{
+  p[0] = a >> 24;
+  p[1] = a >> 16;
+  p[2] = a >>  8;
+  p[3] = a;
+}
+
+
+static char *
+index_fname (const char *fname)
+{
+  return strconcat (fname, ".idx", NULL);
+}
+
+
+/* Store the state of the keybox file FNAME at STAMP.  */
+gpg_error_t
+_keybox_index_stamp (const char *fname, struct keybox_stamp_s *stamp)
+{
+  struct stat st;
+
+  memset (stamp, 0, sizeof *stamp);
+  if (gnupg_stat (fname, &st))
+    return gpg_error_from_syserror ();
+  stamp->size = st.st_size;
+  stamp->mtime = st.st_mtime;
+  stamp->ino = st.st_ino;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  stamp->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+  return 0;
+}
+
+
+static int
+stamp_equal (const struct keybox_stamp_s *a, const struct keybox_stamp_s *b)
+{
+  return (a->size == b->size && a->mtime == b->mtime
+          && a->mtime_nsec == b->mtime_nsec && a->ino == b->ino);
+}
+
+
+/* Return true if an index for the keybox FNAME can be written.  */
+static int
+index_writable (const char *fname)
+{
+  char *dname;
+  int okay;
+
+  dname = make_dirname (fname);
+  okay = !gnupg_access (dname, W_OK);
+  xfree (dname);
+  return okay;
+}
+
+
+static void
+make_key (unsigned char *key, int type, const void *data, size_t datalen)
+{
+  unsigned char buf[1 + 32];
+  unsigned char digest[20];
+
+  log_assert (datalen <= 32);
+  buf[0] = type;
+  memcpy (buf + 1, data, datalen);
+  gcry_md_hash_buffer (GCRY_MD_SHA1, digest, buf, 1 + datalen);
+  memcpy (key, digest, 8);
+}
+
+
+/* Store at KEY the key for the X.509 issuer ISSUER of ISSUERLEN
+ * bytes and the serial number SN of SNLEN bytes.  */
+static void
+make_isn_key (unsigned char *key, const void *issuer, size_t issuerlen,
+              const void *sn, size_t snlen)
+{
+  unsigned char prefix[3];
+  unsigned char digest[20];
+  gcry_buffer_t iov[3];
+
+  prefix[0] = INDEX_TYPE_ISN;
+  prefix[1] = snlen >> 8;
+  prefix[2] = snlen;
+  memset (iov, 0, sizeof iov);
+  iov[0].data = prefix;
+  iov[0].len = 3;
+  iov[1].data = (void *)sn;
+  iov[1].len = snlen;
+  iov[2].data = (void *)issuer;
+  iov[2].len = issuerlen;
+  gcry_md_hash_buffers (GCRY_MD_SHA1, 0, digest, iov, 3);
+  memcpy (key, digest, 8);
+}
+
+
+/* Store at KEY the key for the X.509 subject SUBJECT of SUBJECTLEN
+ * bytes.  */
+static void
+make_subject_key (unsigned char *key, const void *subject, size_t subjectlen)
+{
+  unsigned char prefix[1];
+  unsigned char digest[20];
+  gcry_buffer_t iov[2];
+
+  prefix[0] = INDEX_TYPE_SUBJ;
+  memset (iov, 0, sizeof iov);
+  iov[0].data = prefix;
+  iov[0].len = 1;
+  iov[1].data = (void *)subject;
+  iov[1].len = subjectlen;
+  gcry_md_hash_buffers (GCRY_MD_SHA1, 0, digest, iov, 2);
+  memcpy (key, digest, 8);
+}
+
+
+/* Return a new record slot in R or NULL on error.  */
+static struct index_rec_s *
+new_rec (struct index_recs_s *r)
+{
+  struct index_rec_s *rec;
+
+  if (r->nrecs == r->size)
+    {
+      size_t newsize = r->size? 2 * r->size : 1024;
+
+      rec = xtryrealloc (r->recs, newsize * sizeof *rec);
+      if (!rec)
+        return NULL;
+      r->recs = rec;
+      r->size = newsize;
+    }
+  return r->recs + r->nrecs++;
+}
+
+
+static gpg_error_t
+add_rec (struct index_recs_s *r, int type, const void *data, size_t datalen,
+         uint64_t off)
+{
+  struct index_rec_s *rec;
+
+  rec = new_rec (r);
+  if (!rec)
+    return gpg_error_from_syserror ();
+  make_key (rec->key, type, data, datalen);
+  rec->off = off;
+  return 0;
+}
+
+
+/* Add the records for the issuer and serial number and the subject
+ * of the X.509 blob image BUFFER of LENGTH bytes located at offset
+ * OFF to R.  This mirrors the parsing done by blob_cmp_name.  */
+static gpg_error_t
+add_x509_name_recs (struct index_recs_s *r, const unsigned char *buffer,
+                    size_t length, uint64_t off)
+{
+  struct index_rec_s *rec;
+  size_t pos, nkeys, keyinfolen, nserial, serialoff;
+  size_t nuids, uidinfolen, nameoff, namelen;
+
+  nkeys = buf16_to_ulong (buffer + 16);
+  keyinfolen = buf16_to_ulong (buffer + 18);
+  pos = 20 + (uint64_t)keyinfolen*nkeys;
+  if ((uint64_t)pos+2 > (uint64_t)length)
+    return 0;
+  nserial = buf16_to_ulong (buffer + pos);
+  serialoff = pos + 2;
+  pos += 2 + nserial;
+  if ((uint64_t)pos+4 > (uint64_t)length)
+    return 0;
+  nuids = buf16_to_ulong (buffer + pos);
+  uidinfolen = buf16_to_ulong (buffer + pos + 2);
+  pos += 4;
+  if (uidinfolen < 12 || nuids < 2
+      || (uint64_t)pos + (uint64_t)uidinfolen*2 > (uint64_t)length)
+    return 0;
+
+  /* The issuer is stored at index 0.  */
+  nameoff = buf32_to_size_t (buffer + pos);
+  namelen = buf32_to_size_t (buffer + pos + 4);
+  if (namelen && (uint64_t)nameoff+(uint64_t)namelen <= (uint64_t)length)
+    {
+      rec = new_rec (r);
+      if (!rec)
+        return gpg_error_from_syserror ();
+      make_isn_key (rec->key, buffer + nameoff, namelen,
+                    buffer + serialoff, nserial);
+      rec->off = off;
+    }
+
+  /* The subject is stored at index 1.  */
+  pos += uidinfolen;
+  nameoff = buf32_to_size_t (buffer + pos);
+  namelen = buf32_to_size_t (buffer + pos + 4);
+  if (namelen && (uint64_t)nameoff+(uint64_t)namelen <= (uint64_t)length)
+    {
+      rec = new_rec (r);
+      if (!rec)
+        return gpg_error_from_syserror ();
+      make_subject_key (rec->key, buffer + nameoff, namelen);
+      rec->off = off;
+    }
+
+  return 0;
+}
+
+
+/* Add the records for BLOB located at offset OFF to R.  */
+static gpg_error_t
+add_blob_recs (struct index_recs_s *r, KEYBOXBLOB blob, uint64_t off)
+{
+  gpg_error_t err;
+  const unsigned char *buffer;
+  size_t length, pos, koff;
+  size_t nkeys, keyinfolen, cert_off, cert_len, gripoff;
+  int idx, fpr32, blobtype, ngrips;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *k;
+
+  blobtype = blob_get_type (blob);
+  if (blobtype != KEYBOX_BLOBTYPE_PGP && blobtype != KEYBOX_BLOBTYPE_X509)
+    return 0;
+
+  /* This mirrors the checks done by blob_cmp_fpr.  */
+  buffer = _keybox_get_blob_image (blob, &length);
+  if (length < 48)
+    return 0;
+  fpr32 = buffer[5] == 2;
+  nkeys = buf16_to_ulong (buffer + 16);
+  keyinfolen = buf16_to_ulong (buffer + 18);
+  if (keyinfolen < (fpr32?56:28))
+    return 0;
+  pos = 20;
+  if (pos + (uint64_t)keyinfolen*nkeys > (uint64_t)length)
+    return 0;
+  gripoff = fpr32? 36 : 28;
+
+  for (ngrips=idx=0; idx < nkeys; idx++)
+    {
+      koff = pos + idx*keyinfolen;
+      if (fpr32 && (buf16_to_ulong (buffer + koff + 32) & 0x80))
+        {
+          err = add_rec (r, INDEX_TYPE_FPR, buffer + koff, 32, off);
+          if (!err)
+            err = add_rec (r, INDEX_TYPE_KID, buffer + koff, 8, off);
+        }
+      else
+        {
+          err = add_rec (r, INDEX_TYPE_FPR, buffer + koff, 20, off);
+          if (!err)
+            err = add_rec (r, INDEX_TYPE_KID, buffer + koff + 12, 8, off);
+        }
+      /* Use the keygrip stored in the key table if there is one.  */
+      if (!err && keyinfolen >= gripoff + 20
+          && (buf16_to_ulong (buffer + koff + (fpr32? 32:24)) & 0x02))
+        {
+          err = add_rec (r, INDEX_TYPE_GRIP, buffer + koff + gripoff, 20,
+                         off);
+          ngrips++;
+        }
+      if (err)
+        return err;
+    }
+
+  if (blobtype == KEYBOX_BLOBTYPE_X509)
+    {
+      /* Computing the keygrip requires parsing the certificate
+       * which we don't want to do here.  Blobs written by older
+       * versions don't have the keygrip stored.  */
+      if (ngrips != nkeys)
+        r->flags |= INDEX_FLAG_X509_NOGRIP;
+      return add_x509_name_recs (r, buffer, length, off);
+    }
+  if (ngrips == nkeys)
+    return 0;  /* All keygrips are already indexed.  */
+
+  cert_off = buf32_to_size_t (buffer+8);
+  cert_len = buf32_to_size_t (buffer+12);
+  if ((uint64_t)cert_off+(uint64_t)cert_len > (uint64_t)length)
+    return 0;
+  if (_keybox_parse_openpgp (buffer + cert_off, cert_len, NULL, &info))
+    return 0;
+  err = add_rec (r, INDEX_TYPE_GRIP, info.primary.grip, 20, off);
+  if (!err && info.nsubkeys)
+    for (k = &info.subkeys; k && !err; k = k->next)
+      err = add_rec (r, INDEX_TYPE_GRIP, k->grip, 20, off);
+  _keybox_destroy_openpgp_info (&info);
+  return err;
+}
+
+
+/* Return the length in bytes of the Bloom filter for NRECS records.  */
+static size_t
+bloom_length (size_t nrecs)
+{
+  uint64_t n = ((uint64_t)nrecs * INDEX_BLOOM_BITS + 7) / 8;
+
+  if (n < 64)
+    n = 64;
+  else if (n > INDEX_BLOOM_MAXLEN)
+    n = INDEX_BLOOM_MAXLEN;
+  return n;
+}
+
+
+/* Set the bits for KEY in the Bloom filter BLOOM of BLOOMLEN bytes.
+ * If TEST is set the bits are only tested; the return value is then
+ * false if KEY is definitely not in the filter.  */
+static int
+bloom_bits (unsigned char *bloom, size_t bloomlen, const unsigned char *key,
+            int test)
+{
+  uint64_t nbits = (uint64_t)bloomlen * 8;
+  u32 h1, h2;
+  uint64_t bit;
+  int i;
+
+  h1 = buf32_to_u32 (key);
+  h2 = buf32_to_u32 (key + 4) | 1;
+  for (i=0; i < INDEX_BLOOM_HASHES; i++)
+    {
+      bit = ((uint64_t)h1 + (uint64_t)i * h2) % nbits;
+      if (!test)
+        bloom[bit / 8] |= 1 << (bit % 8);
+      else if (!(bloom[bit / 8] & (1 << (bit % 8))))
+        return 0;
+    }
+  return 1;
+}
+
+
+static int
+cmp_rec (const void *a_arg, const void *b_arg)
+{
+  const struct index_rec_s *a = a_arg;
+  const struct index_rec_s *b = b_arg;
+  int cmp;
+
+  cmp = memcmp (a->key, b->key, 8);
+  if (cmp)
+    return cmp;
+  return a->off < b->off? -1 : a->off > b->off;
+}
+
+
+/* Sort the records R and write them as index for the keybox FNAME
+ * with the given STAMP.  */
+static gpg_error_t
+write_index (const char *fname, struct index_recs_s *r,
+             const struct keybox_stamp_s *stamp)
+{
+  gpg_error_t err = 0;
+  char *idxfname, *tmpfname;
+  estream_t fp;
+  unsigned char buf[INDEX_HDRLEN];
+  unsigned char *bloom;
+  size_t n, bloomlen;
+
+  if (r->nrecs > 0xffffffff)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  bloomlen = bloom_length (r->nrecs);
+  bloom = xtrycalloc (1, bloomlen);
+  if (!bloom)
+    return gpg_error_from_syserror ();
+  for (n=0; n < r->nrecs; n++)
+    bloom_bits (bloom, bloomlen, r->recs[n].key, 0);
+
+  idxfname = index_fname (fname);
+  if (!idxfname)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (bloom);
+      return err;
+    }
+  tmpfname = xtryasprintf ("%s-%u.tmp", idxfname, (unsigned int)getpid ());
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (idxfname);
+      xfree (bloom);
+      return err;
+    }
+
+  qsort (r->recs, r->nrecs, sizeof *r->recs, cmp_rec);
+
+  fp = es_fopen (tmpfname, "wb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  memset (buf, 0, sizeof buf);
+  memcpy (buf, INDEX_MAGIC, 4);
+  buf[4] = INDEX_VERSION;
+  buf[5] = r->flags;
+  put64 (buf + 8, stamp->size);
+  put64 (buf + 16, stamp->mtime);
+  put64 (buf + 24, stamp->ino);
+  put32 (buf + 32, r->nrecs);
+  put32 (buf + 36, bloomlen);
+  put32 (buf + 40, stamp->mtime_nsec);
+  if (es_fwrite (buf, INDEX_HDRLEN, 1, fp) != 1)
+    err = gpg_error_from_syserror ();
+  for (n=0; !err && n < r->nrecs; n++)
+    {
+      memcpy (buf, r->recs[n].key, 8);
+      put64 (buf + 8, r->recs[n].off);
+      if (es_fwrite (buf, INDEX_RECLEN, 1, fp) != 1)
+        err = gpg_error_from_syserror ();
+    }
+  if (!err && es_fwrite (bloom, bloomlen, 1, fp) != 1)
+    err = gpg_error_from_syserror ();
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+
+  if (!err)
+    err = gnupg_rename_file (tmpfname, idxfname, NULL);
+  if (err)
+    gnupg_remove (tmpfname);
+
+ leave:
+  xfree (bloom);
+  xfree (tmpfname);
+  xfree (idxfname);
+  return err;
+}
+
+
+/* Open the index of FNAME and check its header against STAMP.  On
+ * success the stream positioned at the first record is stored at
+ * R_FP, the number of records at R_NRECS, the flags at R_FLAGS and,
+ * if R_BLOOMLEN is not NULL, the length of the Bloom filter at
+ * R_BLOOMLEN.  GPG_ERR_NOT_FOUND is returned for a missing or stale
+ * index.  */
+static gpg_error_t
+open_index (const char *fname, const struct keybox_stamp_s *stamp,
+            estream_t *r_fp, size_t *r_nrecs, unsigned int *r_flags,
+            size_t *r_bloomlen)
+{
+  gpg_error_t err;
+  char *idxfname;
+  estream_t fp;
+  unsigned char buf[INDEX_HDRLEN];
+  struct keybox_stamp_s idxstamp;
+
+  *r_fp = NULL;
+  idxfname = index_fname (fname);
+  if (!idxfname)
+    return gpg_error_from_syserror ();
+  fp = es_fopen (idxfname, "rb");
+  xfree (idxfname);
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      if (gpg_err_code (err) == GPG_ERR_ENOENT)
+        err = gpg_error (GPG_ERR_NOT_FOUND);
+      return err;
+    }
+
+  if (es_fread (buf, INDEX_HDRLEN, 1, fp) != 1
+      || memcmp (buf, INDEX_MAGIC, 4) || buf[4] != INDEX_VERSION)
+    {
+      es_fclose (fp);
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+  idxstamp.size  = get64 (buf + 8);
+  idxstamp.mtime = get64 (buf + 16);
+  idxstamp.ino   = get64 (buf + 24);
+  idxstamp.mtime_nsec = buf32_to_u32 (buf + 40);
+  if (!stamp_equal (stamp, &idxstamp))
+    {
+      es_fclose (fp);
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+
+  *r_nrecs = buf32_to_size_t (buf + 32);
+  *r_flags = buf[5];
+  if (r_bloomlen)
+    *r_bloomlen = buf32_to_size_t (buf + 36);
+  *r_fp = fp;
+  return 0;
+}
+
+
+/* Read all records from FP into R.  */
+static gpg_error_t
+read_all_recs (estream_t fp, size_t nrecs, struct index_recs_s *r)
+{
+  unsigned char buf[INDEX_RECLEN];
+  size_t n;
+
+  r->recs = xtrycalloc (nrecs? nrecs : 1, sizeof *r->recs);
+  if (!r->recs)
+    return gpg_error_from_syserror ();
+  r->size = nrecs? nrecs : 1;
+  for (n=0; n < nrecs; n++)
+    {
+      if (es_fread (buf, INDEX_RECLEN, 1, fp) != 1)
+        return gpg_error (GPG_ERR_INV_KEYRING);
+      memcpy (r->recs[n].key, buf, 8);
+      r->recs[n].off = get64 (buf + 8);
+    }
+  r->nrecs = nrecs;
+  return 0;
+}
+
+
+/* Build a new index for the keybox FNAME by scanning the whole file.  */
+static gpg_error_t
+rebuild_index (const char *fname)
+{
+  gpg_error_t err;
+  struct keybox_stamp_s stamp, stamp2;
+  struct index_recs_s r;
+  estream_t fp;
+  KEYBOXBLOB blob;
+
+  memset (&r, 0, sizeof r);
+  err = _keybox_index_stamp (fname, &stamp);
+  if (err)
+    return err;
+  err = _keybox_ll_open (&fp, fname, 0);
+  if (err)
+    return err;
+
+  while (!(err = _keybox_read_blob (&blob, fp, NULL))
+         || (gpg_err_code (err) == GPG_ERR_TOO_LARGE
+             && gpg_err_source (err) == GPG_ERR_SOURCE_KEYBOX))
+    {
+      if (err)
+        continue;  /* Too large blobs are also skipped by the search.  */
+      err = add_blob_recs (&r, blob, _keybox_get_blob_fileoffset (blob));
+      _keybox_release_blob (blob);
+      if (err)
+        break;
+    }
+  _keybox_ll_close (fp);
+  if (err == -1 || gpg_err_code (err) == GPG_ERR_EOF)
+    err = 0;
+  if (err)
+    goto leave;
+
+  /* Do not write an index if the file was changed meanwhile.  */
+  err = _keybox_index_stamp (fname, &stamp2);
+  if (!err && !stamp_equal (&stamp, &stamp2))
+    err = gpg_error (GPG_ERR_EAGAIN);
+  if (!err)
+    err = write_index (fname, &r, &stamp);
+
+ leave:
+  xfree (r.recs);
+  return err;
+}
+
+
+/* Read the Bloom filter of BLOOMLEN bytes following the NRECS records
+ * of the index FP and store it in KB together with STAMP and FLAGS.
+ * On error KB is left without a filter.  */
+static void
+load_bloom (KB_NAME kb, estream_t fp, size_t nrecs, size_t bloomlen,
+            const struct keybox_stamp_s *stamp, unsigned int flags)
+{
+  xfree (kb->bloom);
+  kb->bloom = NULL;
+  kb->bloomlen = 0;
+
+  if (!bloomlen || bloomlen > INDEX_BLOOM_MAXLEN)
+    return;
+  kb->bloom = xtrymalloc (bloomlen);
+  if (!kb->bloom)
+    return;
+  if (es_fseeko (fp, INDEX_HDRLEN + (off_t)nrecs * INDEX_RECLEN, SEEK_SET)
+      || es_fread (kb->bloom, bloomlen, 1, fp) != 1)
+    {
+      xfree (kb->bloom);
+      kb->bloom = NULL;
+      return;
+    }
+  kb->bloomlen = bloomlen;
+  kb->bloom_stamp = *stamp;
+  kb->bloom_flags = flags;
+}
+
+
+/* Return the offsets of the blobs having the index key KEY of TYPE.
+ * If FIXED_STAMP is not NULL the index must be valid for that state
+ * of the keybox; else it is checked against the current state and
+ * rebuilt if needed.  See _keybox_index_lookup for the other args.  */
+static gpg_error_t
+lookup_key (KB_NAME kb, const unsigned char *key, int type,
+            int want_blobtype, const struct keybox_stamp_s *fixed_stamp,
+            off_t **r_offsets, size_t *r_count)
+{
+  gpg_error_t err;
+  unsigned char buf[INDEX_RECLEN];
+  struct keybox_stamp_s stamp;
+  estream_t fp = NULL;
+  size_t nrecs, lo, hi, mid, n, count, bloomlen;
+  unsigned int flags;
+  off_t *offsets = NULL;
+  int tries;
+
+  *r_offsets = NULL;
+  *r_count = 0;
+
+  if (fixed_stamp)
+    stamp = *fixed_stamp;
+  else if (_keybox_index_stamp (kb->fname, &stamp))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  /* A key not in the Bloom filter of the unchanged keybox has no
+   * candidates.  This does not work for keygrips of X.509 blobs.  */
+  if (kb->bloom && stamp_equal (&stamp, &kb->bloom_stamp)
+      && !(type == INDEX_TYPE_GRIP
+           && (kb->bloom_flags & INDEX_FLAG_X509_NOGRIP))
+      && !bloom_bits (kb->bloom, kb->bloomlen, key, 1))
+    return 0;
+
+  for (tries=0; ; tries++)
+    {
+      if (tries && _keybox_index_stamp (kb->fname, &stamp))
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      err = open_index (kb->fname, &stamp, &fp, &nrecs, &flags, &bloomlen);
+      if (!err)
+        break;
+      if (fixed_stamp)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      if (gpg_err_code (err) != GPG_ERR_NOT_FOUND || tries)
+        {
+          kb->index_failed = 1;
+          return gpg_error (GPG_ERR_NOT_SUPPORTED);
+        }
+      /* Do not scan the keybox for an index which can't be stored,
+       * for example in a read-only home directory.  The search works
+       * without it.  */
+      if (!index_writable (kb->fname))
+        {
+          kb->index_failed = 1;
+          return gpg_error (GPG_ERR_NOT_SUPPORTED);
+        }
+      err = rebuild_index (kb->fname);
+      if (err)
+        {
+          if (gpg_err_code (err) != GPG_ERR_EAGAIN)
+            {
+              if (!index_error_logged)
+                log_info ("%s: can't build index: %s\n",
+                          kb->fname, gpg_strerror (err));
+              index_error_logged = 1;
+              kb->index_failed = 1;
+            }
+          return gpg_error (GPG_ERR_NOT_SUPPORTED);
+        }
+    }
+
+  if (type == INDEX_TYPE_GRIP && (flags & INDEX_FLAG_X509_NOGRIP)
+      && want_blobtype != KEYBOX_BLOBTYPE_PGP)
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
+  if (!kb->bloom || !stamp_equal (&stamp, &kb->bloom_stamp))
+    load_bloom (kb, fp, nrecs, bloomlen, &stamp, flags);
+  if (kb->bloom && !bloom_bits (kb->bloom, kb->bloomlen, key, 1))
+    {
+      err = 0;
+      goto leave;
+    }
+
+  /* Binary search for the first record with KEY.  */
+  lo = 0;
+  hi = nrecs;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (es_fseeko (fp, INDEX_HDRLEN + (off_t)mid * INDEX_RECLEN, SEEK_SET)
+          || es_fread (buf, INDEX_RECLEN, 1, fp) != 1)
+        {
+          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+          goto leave;
+        }
+      if (memcmp (buf, key, 8) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  /* Collect the offsets.  */
+  if (es_fseeko (fp, INDEX_HDRLEN + (off_t)lo * INDEX_RECLEN, SEEK_SET))
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+  count = 0;
+  for (n = lo; n < nrecs; n++)
+    {
+      if (es_fread (buf, INDEX_RECLEN, 1, fp) != 1)
+        {
+          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+          goto leave;
+        }
+      if (memcmp (buf, key, 8))
+        break;
+      if (!(count % 16))
+        {
+          off_t *tmp = xtryrealloc (offsets, (count + 16) * sizeof *offsets);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          offsets = tmp;
+        }
+      offsets[count++] = get64 (buf + 8);
+    }
+
+  *r_offsets = offsets;
+  *r_count = count;
+  offsets = NULL;
+  err = 0;
+
+ leave:
+  es_fclose (fp);
+  xfree (offsets);
+  return err;
+}
+
+
+/* Return the index of the hash bucket for KEY in BATCH.  */
+static size_t
+batch_bucket (struct index_batch_s *batch, const unsigned char *key)
+{
+  return buf32_to_u32 (key) & (batch->nbuckets - 1);
+}
+
+
+/* Link the records of BATCH starting at FIRST into the hash table.
+ * If needed the table is enlarged and all records are linked anew.  */
+static gpg_error_t
+batch_link (struct index_batch_s *batch, size_t first)
+{
+  size_t n, b, *tmp;
+
+  if (!batch->buckets || batch->r.size > batch->nbuckets)
+    {
+      size_t nbuckets = batch->nbuckets? batch->nbuckets : 1024;
+
+      while (nbuckets < batch->r.size)
+        nbuckets *= 2;
+      tmp = xtrycalloc (nbuckets, sizeof *tmp);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      xfree (batch->buckets);
+      batch->buckets = tmp;
+      batch->nbuckets = nbuckets;
+      first = 0;
+    }
+  if (!batch->r.size)
+    return 0;
+  tmp = xtryrealloc (batch->chain, batch->r.size * sizeof *tmp);
+  if (!tmp)
+    return gpg_error_from_syserror ();
+  batch->chain = tmp;
+
+  for (n = first; n < batch->r.nrecs; n++)
+    {
+      b = batch_bucket (batch, batch->r.recs[n].key);
+      batch->chain[n] = batch->buckets[b];
+      batch->buckets[b] = n + 1;
+    }
+  return 0;
+}
+
+
+static void
+release_batch (struct index_batch_s *batch)
+{
+  if (!batch)
+    return;
+  xfree (batch->r.recs);
+  xfree (batch->chain);
+  xfree (batch->buckets);
+  xfree (batch);
+}
+
+
+static int
+cmp_offset (const void *a_arg, const void *b_arg)
+{
+  off_t a = *(const off_t *)a_arg;
+  off_t b = *(const off_t *)b_arg;
+
+  return a < b? -1 : a > b;
+}
+
+
+/* Lookup KEY during a batch of inserts: The candidates from the index
+ * file, which is still valid for the state of the keybox at the start
+ * of the batch, are merged with those from the appended blobs.  */
+static gpg_error_t
+batch_lookup (KB_NAME kb, const unsigned char *key, int type,
+              int want_blobtype, off_t **r_offsets, size_t *r_count)
+{
+  struct index_batch_s *batch = kb->index_batch;
+  gpg_error_t err;
+  off_t *offsets, *tmp;
+  size_t count, n, extra;
+
+  if (type == INDEX_TYPE_GRIP && (batch->r.flags & INDEX_FLAG_X509_NOGRIP)
+      && want_blobtype != KEYBOX_BLOBTYPE_PGP)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  err = lookup_key (kb, key, type, want_blobtype, &batch->stamp,
+                    &offsets, &count);
+  if (err)
+    return err;
+
+  extra = 0;
+  for (n = batch->buckets[batch_bucket (batch, key)]; n; n = batch->chain[n-1])
+    if (!memcmp (batch->r.recs[n-1].key, key, 8))
+      extra++;
+  if (extra)
+    {
+      tmp = xtryrealloc (offsets, (count + extra) * sizeof *offsets);
+      if (!tmp)
+        {
+          err = gpg_error_from_syserror ();
+          xfree (offsets);
+          return err;
+        }
+      offsets = tmp;
+      for (n = batch->buckets[batch_bucket (batch, key)]; n;
+           n = batch->chain[n-1])
+        if (!memcmp (batch->r.recs[n-1].key, key, 8))
+          offsets[count++] = batch->r.recs[n-1].off;
+      qsort (offsets, count, sizeof *offsets, cmp_offset);
+    }
+
+  *r_offsets = offsets;
+  *r_count = count;
+  return 0;
+}
+
+
+/* Start a batch of inserts into the keybox KB.  Until the batch is
+ * finished by _keybox_index_end_batch, appended blobs are only added
+ * to an in-memory table and the index file is written once at the
+ * end.  The caller must hold the lock of the keybox for the entire
+ * batch.  If the index can't be used, no batch is started and the
+ * inserts update the index as usual.  */
+void
+_keybox_index_begin_batch (KB_NAME kb)
+{
+  struct index_batch_s *batch;
+  struct keybox_stamp_s stamp;
+  estream_t fp;
+  size_t nrecs;
+  unsigned int flags;
+  int tries;
+
+  if (kb->index_batch || kb->index_failed)
+    return;
+
+  for (tries=0; ; tries++)
+    {
+      if (_keybox_index_stamp (kb->fname, &stamp))
+        return;
+      if (!open_index (kb->fname, &stamp, &fp, &nrecs, &flags, NULL))
+        break;
+      if (tries || rebuild_index (kb->fname))
+        return;
+    }
+  es_fclose (fp);
+
+  batch = xtrycalloc (1, sizeof *batch);
+  if (!batch)
+    return;
+  batch->stamp = stamp;
+  batch->end = stamp.size;
+  batch->r.flags = flags;
+  if (batch_link (batch, 0))
+    {
+      release_batch (batch);
+      return;
+    }
+  kb->index_batch = batch;
+}
+
+
+/* Add the records for BLOB which has been appended at offset OFF to
+ * the batch of KB.  On error the batch is given up and the index
+ * removed so that it will be rebuilt on the next lookup.  */
+void
+_keybox_index_batch_add (KB_NAME kb, KEYBOXBLOB blob, off_t off)
+{
+  struct index_batch_s *batch = kb->index_batch;
+  gpg_error_t err;
+  size_t first, length;
+
+  if (!batch)
+    return;
+
+  _keybox_get_blob_image (blob, &length);
+  if ((uint64_t)off != batch->end)
+    err = gpg_error (GPG_ERR_CONFLICT);  /* Not a pure append.  */
+  else
+    {
+      first = batch->r.nrecs;
+      err = add_blob_recs (&batch->r, blob, off);
+      if (!err)
+        err = batch_link (batch, first);
+    }
+  if (err)
+    {
+      kb->index_batch = NULL;
+      release_batch (batch);
+      _keybox_index_remove (kb->fname);
+      return;
+    }
+  batch->end = (uint64_t)off + length;
+}
+
+
+/* Finish a batch of inserts into the keybox KB and write the index.  */
+void
+_keybox_index_end_batch (KB_NAME kb)
+{
+  struct index_batch_s *batch = kb->index_batch;
+  gpg_error_t err;
+  struct keybox_stamp_s stamp;
+  struct index_recs_s r;
+  estream_t fp;
+  size_t nrecs, n;
+  unsigned int flags;
+
+  if (!batch)
+    return;
+  kb->index_batch = NULL;
+
+  memset (&r, 0, sizeof r);
+  err = _keybox_index_stamp (kb->fname, &stamp);
+  if (!err && stamp.size != batch->end)
+    err = gpg_error (GPG_ERR_CONFLICT);  /* Changed by other means.  */
+  if (!err)
+    err = open_index (kb->fname, &batch->stamp, &fp, &nrecs, &flags, NULL);
+  if (!err)
+    {
+      err = read_all_recs (fp, nrecs, &r);
+      es_fclose (fp);
+    }
+  if (!err && batch->r.nrecs)
+    {
+      struct index_rec_s *tmp;
+
+      tmp = xtryrealloc (r.recs, (r.nrecs + batch->r.nrecs) * sizeof *tmp);
+      if (!tmp)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          r.recs = tmp;
+          for (n=0; n < batch->r.nrecs; n++)
+            r.recs[r.nrecs++] = batch->r.recs[n];
+          r.size = r.nrecs;
+        }
+    }
+  if (!err)
+    {
+      r.flags = flags | batch->r.flags;
+      err = write_index (kb->fname, &r, &stamp);
+    }
+  if (err)
+    _keybox_index_remove (kb->fname);
+
+  xfree (r.recs);
+  release_batch (batch);
+}
+
+
+/* Return the offsets of the blobs which may match the single search
+ * description DESC from the index of the keybox KB.  If the index is
+ * missing or stale it is rebuilt.  On success a sorted array with the
+ * offsets is stored at R_OFFSETS and its length at R_COUNT; the
+ * caller must still check each candidate.  GPG_ERR_NOT_SUPPORTED is
+ * returned if the index can't be used for DESC and the caller needs
+ * to do a full scan.  */
+gpg_error_t
+_keybox_index_lookup (KB_NAME kb, KEYBOX_SEARCH_DESC *desc,
+                      int want_blobtype,
+                      off_t **r_offsets, size_t *r_count)
+{
+  unsigned char key[8];
+  unsigned char kidbuf[8];
+  int type;
+
+  *r_offsets = NULL;
+  *r_count = 0;
+
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_FPR:
+      if (desc->fprlen != 20 && desc->fprlen != 32)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      make_key (key, INDEX_TYPE_FPR, desc->u.fpr, desc->fprlen);
+      type = INDEX_TYPE_FPR;
+      break;
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      put32 (kidbuf, desc->u.kid[0]);
+      put32 (kidbuf + 4, desc->u.kid[1]);
+      make_key (key, INDEX_TYPE_KID, kidbuf, 8);
+      type = INDEX_TYPE_KID;
+      break;
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      make_key (key, INDEX_TYPE_GRIP, desc->u.grip, 20);
+      type = INDEX_TYPE_GRIP;
+      break;
+    case KEYDB_SEARCH_MODE_ISSUER_SN:
+      /* The caller needs to convert a hex serial number.  */
+      if (!desc->u.name || !desc->sn || desc->snhex)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      make_isn_key (key, desc->u.name, strlen (desc->u.name),
+                    desc->sn, desc->snlen);
+      type = INDEX_TYPE_ISN;
+      break;
+    case KEYDB_SEARCH_MODE_SUBJECT:
+      if (!desc->u.name)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      make_subject_key (key, desc->u.name, strlen (desc->u.name));
+      type = INDEX_TYPE_SUBJ;
+      break;
+    default:
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  if (kb->index_failed)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  if (kb->index_batch)
+    return batch_lookup (kb, key, type, want_blobtype, r_offsets, r_count);
+
+  return lookup_key (kb, key, type, want_blobtype, NULL, r_offsets, r_count);
+}
+
+
+/* Update the index of the keybox FNAME after a change.  OLDSTAMP is
+ * the state of the keybox before the change.  If OFF is -1 NEWBLOB
+ * has been appended; otherwise the blob at OFF has been replaced by
+ * NEWBLOB or removed if NEWBLOB is NULL.  An in-place change which
+ * does not move any blobs is indicated by OFF being -1 and NEWBLOB
+ * being NULL.  If the index was not up to date with OLDSTAMP it is
+ * left alone because it will be rebuilt on the next lookup.  Errors
+ * are not returned because the index is only a cache; the index is
+ * removed instead.  */
+void
+_keybox_index_update (const char *fname,
+                      const struct keybox_stamp_s *oldstamp,
+                      off_t off, KEYBOXBLOB newblob)
+{
+  gpg_error_t err;
+  struct keybox_stamp_s stamp;
+  struct index_recs_s r;
+  estream_t fp;
+  size_t nrecs, n, m;
+  unsigned int flags;
+  int64_t delta;
+
+  memset (&r, 0, sizeof r);
+  err = open_index (fname, oldstamp, &fp, &nrecs, &flags, NULL);
+  if (err)
+    return;
+  err = read_all_recs (fp, nrecs, &r);
+  es_fclose (fp);
+  if (err)
+    goto leave;
+  r.flags = flags;
+
+  err = _keybox_index_stamp (fname, &stamp);
+  if (err)
+    goto leave;
+
+  if (off == -1)
+    {
+      if (newblob)
+        err = add_blob_recs (&r, newblob, oldstamp->size);
+    }
+  else
+    {
+      delta = (int64_t)stamp.size - (int64_t)oldstamp->size;
+      for (n = m = 0; n < r.nrecs; n++)
+        {
+          if (r.recs[n].off == (uint64_t)off)
+            continue;
+          if (r.recs[n].off > (uint64_t)off)
+            r.recs[n].off += delta;
+          r.recs[m++] = r.recs[n];
+        }
+      r.nrecs = m;
+      if (newblob)
+        err = add_blob_recs (&r, newblob, off);
+    }
+
+  if (!err)
+    err = write_index (fname, &r, &stamp);
+
+ leave:
+  if (err)
+    _keybox_index_remove (fname);
+  xfree (r.recs);
+}
+
+
+/* Remove the index of the keybox FNAME.  */
+void
+_keybox_index_remove (const char *fname)
+{
+  char *idxfname;
+
+  idxfname = index_fname (fname);
+  if (idxfname)
+    gnupg_remove (idxfname);
+  xfree (idxfname);
+}
@@ -23,10 +23,20 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+# define USE_KEYBOX_MMAP 1
+#endif
 
 #include "keybox-defs.h"
 #include "../common/sysutils.h"
 #include "../common/mischelp.h"
+#include "../common/host2net.h"
 
 #ifdef HAVE_W32_SYSTEM
 # define DEFAULT_LL_BUFFER_SIZE 128
@@ -82,6 +92,11 @@ keybox_register_file (const char *fname, int secret, void **r_token)
   kr->lockhd = NULL;
   kr->is_locked = 0;
   kr->did_full_scan = 0;
+  kr->index_failed = 0;
+  kr->in_batch = 0;
+  kr->index_batch = NULL;
+  kr->bloom = NULL;
+  kr->bloomlen = 0;
   /* keep a list of all issued pointers */
   kr->next = kb_names;
   kb_names = kr;
@@ -206,6 +221,7 @@ keybox_release (KEYBOX_HANDLE hd)
     }
   _keybox_release_blob (hd->found.blob);
   _keybox_release_blob (hd->saved_found.blob);
+  _keybox_unmap_file (hd);
   if (hd->fp)
     {
       _keybox_ll_close (hd->fp);
@@ -373,6 +389,7 @@ _keybox_close_file (KEYBOX_HANDLE hd)
   for (idx=0; idx < hd->kb->handle_table_size; idx++)
     if ((roverhd = hd->kb->handle_table[idx]))
       {
+        _keybox_unmap_file (roverhd);
         if (roverhd->fp)
           {
             _keybox_ll_close (roverhd->fp);
@@ -383,6 +400,91 @@ _keybox_close_file (KEYBOX_HANDLE hd)
 }
 
 
+/* Map the file opened as HD->FP into memory so that a search does not
+ * need to copy each blob.  The current file position is taken over.
+ * If mapping is not possible the plain file is used.
+ *
+ * Appends change the file in place and truncate a partly written
+ * blob; touching a mapped page beyond the end of the file raises
+ * SIGBUS.  Thus the size is taken while holding the lock and only if
+ * no append is pending, as marked in the header blob.  All later
+ * truncations then stop at or beyond that size; keybox_compress
+ * replaces the file by a new one and leaves the mapping intact.
+ * Without the lock, for example if the keybox is not writable by us
+ * or another process holds the lock, the plain file is used.  */
+void
+_keybox_map_file (KEYBOX_HANDLE hd)
+{
+#ifdef USE_KEYBOX_MMAP
+  struct stat st;
+  unsigned char *p;
+  off_t off;
+  int locked = 0;
+
+  if (hd->map || !hd->fp)
+    return;
+  if (!keybox_is_writable (hd->kb))
+    return;
+  if (!hd->kb->is_locked)
+    {
+      if (keybox_lock (hd, 1, 0))
+        return;
+      locked = 1;
+    }
+
+  if (fstat (es_fileno (hd->fp), &st) || !S_ISREG (st.st_mode)
+      || !st.st_size || (uint64_t)st.st_size > (size_t)(-1) / 2)
+    goto leave;
+  off = es_ftello (hd->fp);
+  if (off == (off_t)-1 || off > st.st_size)
+    goto leave;
+
+  p = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, es_fileno (hd->fp), 0);
+  if (p == MAP_FAILED)
+    goto leave;
+  if (st.st_size >= 32 && buf32_to_u32 (p) >= 32
+      && p[4] == KEYBOX_BLOBTYPE_HEADER && (p[7] & HEADER_FLAG_APPENDING))
+    {
+      /* An append is pending; the next update will truncate it.  */
+      munmap (p, st.st_size);
+      goto leave;
+    }
+#ifdef MADV_SEQUENTIAL
+  madvise (p, st.st_size, MADV_SEQUENTIAL);
+#endif
+  hd->map = p;
+  hd->maplen = st.st_size;
+  hd->mappos = off;
+
+ leave:
+  if (locked)
+    keybox_lock (hd, 0, 0);
+#else
+  (void)hd;
+#endif
+}
+
+
+/* Release the mapping of HD and set the file position of HD->FP to
+ * the current mapping position.  */
+void
+_keybox_unmap_file (KEYBOX_HANDLE hd)
+{
+#ifdef USE_KEYBOX_MMAP
+  if (!hd->map)
+    return;
+  munmap (hd->map, hd->maplen);
+  hd->map = NULL;
+  if (hd->fp)
+    es_fseeko (hd->fp, hd->mappos, SEEK_SET);
+  hd->maplen = 0;
+  hd->mappos = 0;
+#else
+  (void)hd;
+#endif
+}
+
+
 /*
  * Lock the keybox at handle HD, or unlock if YES is false.  TIMEOUT
  * is the value used for dotlock_take.  In general -1 should be used
@@ -437,7 +539,7 @@ keybox_lock (KEYBOX_HANDLE hd, int yes, long timeout)
     }
   else /* Release the lock.  */
     {
-      if (kb->is_locked)
+      if (kb->is_locked && !kb->in_batch)
         {
           if (dotlock_release (kb->lockhd))
             {
@@ -451,3 +553,40 @@ keybox_lock (KEYBOX_HANDLE hd, int yes, long timeout)
 
   return err;
 }
+
+
+/* Start a batch of inserts into the keybox of HD.  The caller must
+ * have taken the lock using keybox_lock; until keybox_end_batch is
+ * called that lock is not released by keybox_lock and the index file
+ * is only written at the end of the batch.  */
+gpg_error_t
+keybox_begin_batch (KEYBOX_HANDLE hd)
+{
+  KB_NAME kb = hd->kb;
+
+  if (!keybox_is_writable (kb))
+    return 0;
+  if (!kb->is_locked)
+    return gpg_error (GPG_ERR_NOT_LOCKED);
+  if (kb->in_batch)
+    return gpg_error (GPG_ERR_CONFLICT);
+
+  kb->in_batch = 1;
+  _keybox_index_begin_batch (kb);
+  return 0;
+}
+
+
+/* Finish a batch of inserts started with keybox_begin_batch.  The
+ * lock is still held and needs to be released by the caller.  */
+void
+keybox_end_batch (KEYBOX_HANDLE hd)
+{
+  KB_NAME kb = hd->kb;
+
+  if (!kb->in_batch)
+    return;
+
+  _keybox_index_end_batch (kb);
+  kb->in_batch = 0;
+}
@@ -28,7 +28,6 @@
 #include "keybox-defs.h"
 #include <gcrypt.h>
 #include "../common/host2net.h"
-#include "../common/mbox-util.h"
 
 #define xtoi_1(p)   (*(p) <= '9'? (*(p)- '0'): \
                      *(p) <= 'F'? (*(p)-'A'+10):(*(p)-'a'+10))
@@ -362,9 +361,14 @@ blob_cmp_ubid (KEYBOXBLOB blob, const unsigned char *ubid)
 }
 
 
+/* Compare NAME of NAMELEN bytes with the user ID at IDX or with all
+ * user IDs if IDX is negative.  If NAMEHASH is not NULL it gives the
+ * _keybox_dn_hash of NAME which is then compared first with the hash
+ * stored in X.509 blobs.  */
 static int
 blob_cmp_name (KEYBOXBLOB blob, int idx,
-               const char *name, size_t namelen, int substr, int x509)
+               const char *name, size_t namelen, int substr, int x509,
+               const u32 *namehash)
 {
   const unsigned char *buffer;
   size_t length;
@@ -437,6 +441,9 @@ blob_cmp_name (KEYBOXBLOB blob, int idx,
         return 0; /* out of bounds */
       if (len < 1)
         return 0; /* empty name */
+      if (namehash && x509 && !substr && uidinfolen >= 16
+          && get32 (buffer+pos+12) != *namehash)
+        return 0; /* Hash does not match.  */
 
       if (substr)
         {
@@ -455,10 +462,12 @@ blob_cmp_name (KEYBOXBLOB blob, int idx,
 
 /* Compare all email addresses of the subject.  With SUBSTR given as
    True a substring search is done in the mail address.  The X509 flag
-   indicated whether the search is done on an X.509 blob.  */
+   indicated whether the search is done on an X.509 blob.  If MAILHASH
+   is not NULL it gives the _keybox_mail_hash of NAME which is then
+   compared first with the hash stored in OpenPGP blobs.  */
 static int
 blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
-               int x509)
+               int x509, const u32 *mailhash)
 {
   const unsigned char *buffer;
   size_t length;
@@ -511,6 +520,9 @@ blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
       len = get32 (buffer+mypos+4);
       if ((uint64_t)off+(uint64_t)len > (uint64_t)length)
         return 0; /* error: better stop here - out of bounds */
+      if (mailhash && !x509 && !substr && uidinfolen >= 16
+          && get32 (buffer+mypos+12) != *mailhash)
+        continue; /* Can't match.  */
       if (x509)
         {
           if (len < 2 || buffer[off] != '<')
@@ -523,33 +535,10 @@ blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
         }
       else /* OpenPGP.  */
         {
-          /* We need to forward to the mailbox part.  */
-          mypos = off;
-          mylen = len;
-          for ( ; len && buffer[off] != '<'; len--, off++)
-            ;
-          if (len < 2 || buffer[off] != '<')
-            {
-              /* Mailbox not explicitly given or too short.  Restore
-                 OFF and LEN and check whether the entire string
-                 resembles a mailbox without the angle brackets.  */
-              off = mypos;
-              len = mylen;
-              if (!is_valid_mailbox_mem (buffer+off, len))
-                continue; /* Not a mail address. */
-            }
-          else /* Seems to be standard user id with mail address.  */
-            {
-              off++; /* Point to first char of the mail address.  */
-              len--;
-              /* Search closing '>'.  */
-              for (mypos=off; len && buffer[mypos] != '>'; len--, mypos++)
-                ;
-              if (!len || buffer[mypos] != '>' || off == mypos)
-                continue; /* Not a proper mail address.  */
-              len = mypos - off;
-            }
-
+          if (!_keybox_openpgp_mailbox (buffer+off, len, &mypos, &mylen))
+            continue; /* Not a mail address. */
+          off += mypos;
+          len = mylen;
         }
 
       if (substr)
@@ -567,9 +556,48 @@ blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
 }
 
 
+/* Check whether the keygrips are stored in the key table of BLOB.
+ * Returns -1 if not, 0 if GRIP does not match and 1 if it matches one
+ * of the keys.  */
+static int
+blob_cmp_stored_grip (KEYBOXBLOB blob, const unsigned char *grip)
+{
+  const unsigned char *buffer;
+  size_t length;
+  size_t pos, off;
+  size_t nkeys, keyinfolen, gripoff;
+  int idx, fpr32;
+
+  buffer = _keybox_get_blob_image (blob, &length);
+  if (length < 40)
+    return -1; /* blob too short */
+  fpr32 = buffer[5] == 2;
+
+  /*keys*/
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18 );
+  gripoff = fpr32? 36 : 28;
+  if (!nkeys || keyinfolen < gripoff + 20)
+    return -1; /* No room for the keygrips.  */
+  pos = 20;
+  if (pos + (uint64_t)keyinfolen*nkeys > (uint64_t)length)
+    return -1; /* out of bounds */
+
+  for (idx=0; idx < nkeys; idx++)
+    {
+      off = pos + idx*keyinfolen;
+      if (!(get16 (buffer + off + (fpr32? 32:24)) & 0x02))
+        return -1; /* Keygrip not stored.  */
+      if (!memcmp (buffer + off + gripoff, grip, 20))
+        return 1; /* found */
+    }
+  return 0; /* not found */
+}
+
+
 /* Return true if the key in BLOB matches the 20 bytes keygrip GRIP.
- * We don't have the keygrips as meta data, thus we need to parse the
- * certificate. Fixme: We might want to return proper error codes
+ * This is used for blobs without stored keygrips; thus we need to
+ * parse the keyblock.  Fixme: We might want to return proper error codes
  * instead of failing a search for invalid certificates etc.  */
 static int
 blob_openpgp_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
@@ -621,8 +649,8 @@ blob_openpgp_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
 
 #ifdef KEYBOX_WITH_X509
 /* Return true if the key in BLOB matches the 20 bytes keygrip GRIP.
-   We don't have the keygrips as meta data, thus we need to parse the
-   certificate. Fixme: We might want to return proper error codes
+   This is used for blobs without stored keygrips; thus we need to
+   parse the certificate. Fixme: We might want to return proper error codes
    instead of failing a search for invalid certificates etc.  */
 static int
 blob_x509_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
@@ -742,6 +770,11 @@ has_fingerprint (KEYBOXBLOB blob, const unsigned char *fpr, unsigned int fprlen)
 static inline int
 has_keygrip (KEYBOXBLOB blob, const unsigned char *grip)
 {
+  int rc;
+
+  rc = blob_cmp_stored_grip (blob, grip);
+  if (rc != -1)
+    return rc;
   if (blob_get_type (blob) == KEYBOX_BLOBTYPE_PGP)
     return blob_openpgp_has_grip (blob, grip);
 #ifdef KEYBOX_WITH_X509
@@ -762,7 +795,7 @@ has_ubid (KEYBOXBLOB blob, const unsigned char *ubid)
 
 
 static inline int
-has_issuer (KEYBOXBLOB blob, const char *name)
+has_issuer (KEYBOXBLOB blob, const char *name, const u32 *namehash)
 {
   size_t namelen;
 
@@ -772,12 +805,12 @@ has_issuer (KEYBOXBLOB blob, const char *name)
     return 0;
 
   namelen = strlen (name);
-  return blob_cmp_name (blob, 0 /* issuer */, name, namelen, 0, 1);
+  return blob_cmp_name (blob, 0 /* issuer */, name, namelen, 0, 1, namehash);
 }
 
 static inline int
 has_issuer_sn (KEYBOXBLOB blob, const char *name,
-               const unsigned char *sn, int snlen)
+               const unsigned char *sn, int snlen, const u32 *namehash)
 {
   size_t namelen;
 
@@ -790,7 +823,8 @@ has_issuer_sn (KEYBOXBLOB blob, const char *name,
   namelen = strlen (name);
 
   return (blob_cmp_sn (blob, sn, snlen)
-          && blob_cmp_name (blob, 0 /* issuer */, name, namelen, 0, 1));
+          && blob_cmp_name (blob, 0 /* issuer */, name, namelen, 0, 1,
+                            namehash));
 }
 
 static inline int
@@ -804,7 +838,7 @@ has_sn (KEYBOXBLOB blob, const unsigned char *sn, int snlen)
 }
 
 static inline int
-has_subject (KEYBOXBLOB blob, const char *name)
+has_subject (KEYBOXBLOB blob, const char *name, const u32 *namehash)
 {
   size_t namelen;
 
@@ -814,7 +848,8 @@ has_subject (KEYBOXBLOB blob, const char *name)
     return 0;
 
   namelen = strlen (name);
-  return blob_cmp_name (blob, 1 /* subject */, name, namelen, 0, 1);
+  return blob_cmp_name (blob, 1 /* subject */, name, namelen, 0, 1,
+                        namehash);
 }
 
 
@@ -832,12 +867,14 @@ has_username (KEYBOXBLOB blob, const char *name, int substr)
 
   namelen = strlen (name);
   return blob_cmp_name (blob, -1 /* all subject/user names */, name,
-                        namelen, substr, (btype == KEYBOX_BLOBTYPE_X509));
+                        namelen, substr, (btype == KEYBOX_BLOBTYPE_X509),
+                        NULL);
 }
 
 
 static inline int
-has_mail (KEYBOXBLOB blob, const char *name, int substr)
+has_mail (KEYBOXBLOB blob, const char *name, int substr,
+          const u32 *mailhash)
 {
   size_t namelen;
   int btype;
@@ -855,7 +892,7 @@ has_mail (KEYBOXBLOB blob, const char *name, int substr)
   if (namelen && name[namelen-1] == '>')
     namelen--;
   return blob_cmp_mail (blob, name, namelen, substr,
-                        (btype == KEYBOX_BLOBTYPE_X509));
+                        (btype == KEYBOX_BLOBTYPE_X509), mailhash);
 }
 
 
@@ -891,10 +928,11 @@ keybox_search_reset (KEYBOX_HANDLE hd)
 
   if (hd->fp)
     {
-      if (es_fseeko (hd->fp, 0, SEEK_SET))
+      if (_keybox_seek (hd, 0))
         {
           /* Ooops.  Seek did not work.  Close so that the search will
            * open the file again.  */
+          _keybox_unmap_file (hd);
           _keybox_ll_close (hd->fp);
           hd->fp = NULL;
         }
@@ -922,6 +960,11 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
   struct sn_array_s *sn_array = NULL;
   int pk_no, uid_no;
   off_t lastfoundoff;
+  int use_index = 0;
+  off_t *candidates = NULL;
+  size_t ncandidates = 0;
+  size_t candidx = 0;
+  u32 *namehashes = NULL;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -979,6 +1022,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
           xfree (sn_array);
           return rc;
         }
+      _keybox_map_file (hd);
       /* log_debug ("%s: re-opened file\n", __func__); */
       if (ndesc && desc[0].mode != KEYDB_SEARCH_MODE_FIRST && lastfoundoff)
         {
@@ -986,9 +1030,9 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
            * returned a blob which also was not the first one.  We now
            * need to skip over that blob and hope that the file has
            * not changed.  */
-          if (es_fseeko (hd->fp, lastfoundoff, SEEK_SET))
+          rc = _keybox_seek (hd, lastfoundoff);
+          if (rc)
             {
-              rc = gpg_error_from_syserror ();
               log_debug ("%s: seeking to last found offset failed: %s\n",
                          __func__, gpg_strerror (rc));
               xfree (sn_array);
@@ -996,7 +1040,9 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
             }
           /* log_debug ("%s: re-opened file and sought to last offset\n", */
           /*            __func__); */
-          rc = _keybox_read_blob (NULL, hd->fp, NULL);
+          rc = _keybox_read_blob_hd (&blob, hd);
+          _keybox_release_blob (blob);
+          blob = NULL;
           if (rc)
             {
               log_debug ("%s: skipping last found blob failed: %s\n",
@@ -1068,6 +1114,71 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
     }
 
 
+  /* Precompute the hashes of the names to be compared with X.509
+   * blobs and of the mail addresses to be compared with OpenPGP
+   * blobs.  This is only an optimization and thus errors are
+   * ignored.  */
+  for (n=0; n < ndesc; n++)
+    if ((desc[n].mode == KEYDB_SEARCH_MODE_ISSUER
+         || desc[n].mode == KEYDB_SEARCH_MODE_ISSUER_SN
+         || desc[n].mode == KEYDB_SEARCH_MODE_SUBJECT
+         || desc[n].mode == KEYDB_SEARCH_MODE_MAIL)
+        && desc[n].u.name)
+      {
+        if (!namehashes)
+          {
+            namehashes = xtrycalloc (ndesc, sizeof *namehashes);
+            if (!namehashes)
+              break;
+          }
+        if (desc[n].mode == KEYDB_SEARCH_MODE_MAIL)
+          {
+            /* Strip the angle brackets the same way has_mail does
+             * for OpenPGP blobs.  For X.509 blobs the hash is not
+             * used.  */
+            const char *name = desc[n].u.name;
+            size_t namelen;
+
+            if (*name == '<')
+              name++;
+            namelen = strlen (name);
+            if (namelen && name[namelen-1] == '>')
+              namelen--;
+            namehashes[n] = _keybox_mail_hash (name, namelen);
+          }
+        else
+          namehashes[n] = _keybox_dn_hash (desc[n].u.name,
+                                           strlen (desc[n].u.name));
+      }
+
+  /* For a lookup by fingerprint, keyid, keygrip, issuer and serial
+   * number or subject we ask the index for the candidate blobs and
+   * only look at those which are located at or after the current
+   * file position.  The index wants the serial number in binary.  */
+  if (ndesc == 1)
+    {
+      KEYBOX_SEARCH_DESC idxdesc = desc[0];
+
+      if (sn_array && sn_array[0].sn)
+        {
+          idxdesc.sn = sn_array[0].sn;
+          idxdesc.snlen = sn_array[0].snlen;
+          idxdesc.snhex = 0;
+        }
+      if (!_keybox_index_lookup (hd->kb, &idxdesc, want_blobtype,
+                                 &candidates, &ncandidates))
+        {
+          off_t curoff = _keybox_tell (hd);
+
+          if (curoff != (off_t)-1)
+            {
+              use_index = 1;
+              while (candidx < ncandidates && candidates[candidx] < curoff)
+                candidx++;
+            }
+        }
+    }
+
   pk_no = uid_no = 0;
   for (;;)
     {
@@ -1075,7 +1186,18 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
       int blobtype;
 
       _keybox_release_blob (blob); blob = NULL;
-      rc = _keybox_read_blob (&blob, hd->fp, NULL);
+      if (use_index)
+        {
+          if (candidx >= ncandidates)
+            {
+              rc = -1;  /* No more candidates.  */
+              break;
+            }
+          rc = _keybox_seek (hd, candidates[candidx++]);
+          if (rc)
+            break;
+        }
+      rc = _keybox_read_blob_hd (&blob, hd);
       if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
           && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
         {
@@ -1109,12 +1231,13 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_MAIL:
-              uid_no = has_mail (blob, desc[n].u.name, 0);
+              uid_no = has_mail (blob, desc[n].u.name, 0,
+                                 namehashes? namehashes + n : NULL);
               if (uid_no)
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_MAILSUB:
-              uid_no = has_mail (blob, desc[n].u.name, 1);
+              uid_no = has_mail (blob, desc[n].u.name, 1, NULL);
               if (uid_no)
                 goto found;
               break;
@@ -1128,13 +1251,15 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
               /* not yet implemented */
               break;
             case KEYDB_SEARCH_MODE_ISSUER:
-              if (has_issuer (blob, desc[n].u.name))
+              if (has_issuer (blob, desc[n].u.name,
+                              namehashes? namehashes + n : NULL))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_ISSUER_SN:
               if (has_issuer_sn (blob, desc[n].u.name,
                                  sn_array? sn_array[n].sn : desc[n].sn,
-                                 sn_array? sn_array[n].snlen : desc[n].snlen))
+                                 sn_array? sn_array[n].snlen : desc[n].snlen,
+                                 namehashes? namehashes + n : NULL))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_SN:
@@ -1143,7 +1268,8 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_SUBJECT:
-              if (has_subject (blob, desc[n].u.name))
+              if (has_subject (blob, desc[n].u.name,
+                               namehashes? namehashes + n : NULL))
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_SHORT_KID:
@@ -1201,6 +1327,10 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
         break; /* got it */
     }
 
+  /* The found blob may be used after the file has been unmapped.  */
+  if (!rc)
+    rc = _keybox_detach_blob (blob);
+
   if (!rc)
     {
       hd->found.blob = blob;
@@ -1220,6 +1350,8 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 
   if (sn_array)
     release_sn_array (sn_array, ndesc);
+  xfree (candidates);
+  xfree (namehashes);
 
   return rc;
 }
@@ -1310,10 +1442,14 @@ keybox_get_data (KEYBOX_HANDLE hd, void **r_buffer, size_t *r_length,
 /* Return the last found keyblock.  Returns 0 on success and stores a
  * new iobuf at R_IOBUF.  R_UID_NO and R_PK_NO are used to return the
  * index of the key or user id which matched the search criteria; if
- * not known they are set to 0. */
+ * not known they are set to 0.  If R_SIGSTATUS is not NULL a malloced
+ * array with the stored signature status is returned there; the
+ * first element gives the number of signatures and the others the
+ * status of each signature packet of the keyblock in order.  NULL is
+ * stored there if the blob has no signatures.  */
 gpg_error_t
 keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
-                     int *r_pk_no, int *r_uid_no)
+                     int *r_pk_no, int *r_uid_no, u32 **r_sigstatus)
 {
   gpg_error_t err;
   const unsigned char *buffer;
@@ -1322,6 +1458,8 @@ keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
   size_t siginfo_off, siginfo_len;
 
   *r_iobuf = NULL;
+  if (r_sigstatus)
+    *r_sigstatus = NULL;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -1344,6 +1482,23 @@ keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
   if (err)
     return err;
 
+  if (r_sigstatus && siginfo_len)
+    {
+      size_t n, nsigs, siginfolen;
+      u32 *sigstatus;
+
+      /* _keybox_get_flag_location checked the bounds.  */
+      nsigs = get16 (buffer + siginfo_off);
+      siginfolen = get16 (buffer + siginfo_off + 2);
+      sigstatus = xtrycalloc (1+nsigs, sizeof *sigstatus);
+      if (!sigstatus)
+        return gpg_error_from_syserror ();
+      sigstatus[0] = nsigs;
+      for (n=0; n < nsigs; n++)
+        sigstatus[1+n] = get32 (buffer + siginfo_off + 4 + n*siginfolen);
+      *r_sigstatus = sigstatus;
+    }
+
   *r_pk_no  = hd->found.pk_no;
   *r_uid_no = hd->found.uid_no;
   *r_iobuf = iobuf_temp_with_content (buffer+image_off, image_len);
@@ -1352,6 +1507,53 @@ keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
 
 
 #ifdef KEYBOX_WITH_X509
+/* A cache of parsed certificates.  While building chains and listing
+ * keys the same certificates are retrieved again and again; with the
+ * cache the DER encoding is parsed only once.  The cache is direct
+ * mapped by the SHA-1 fingerprint stored in the blob and each entry
+ * holds a reference to the certificate object.  */
+#define CERT_CACHE_SIZE 512
+static struct
+{
+  unsigned char fpr[20];
+  ksba_cert_t cert;
+} cert_cache[CERT_CACHE_SIZE];
+
+
+/* Return a new reference to the cached certificate with the
+ * fingerprint FPR and the DER encoding {DER,DERLEN} or NULL.  */
+static ksba_cert_t
+get_cached_cert (const unsigned char *fpr,
+                 const unsigned char *der, size_t derlen)
+{
+  int slot = get16 (fpr) % CERT_CACHE_SIZE;
+  ksba_cert_t cert = cert_cache[slot].cert;
+  const unsigned char *image;
+  size_t imagelen;
+
+  if (!cert || memcmp (cert_cache[slot].fpr, fpr, 20))
+    return NULL;
+  image = ksba_cert_get_image (cert, &imagelen);
+  if (!image || imagelen != derlen || memcmp (image, der, derlen))
+    return NULL;
+  ksba_cert_ref (cert);
+  return cert;
+}
+
+
+/* Put CERT with the fingerprint FPR into the cache.  */
+static void
+put_cached_cert (const unsigned char *fpr, ksba_cert_t cert)
+{
+  int slot = get16 (fpr) % CERT_CACHE_SIZE;
+
+  ksba_cert_release (cert_cache[slot].cert);
+  memcpy (cert_cache[slot].fpr, fpr, 20);
+  ksba_cert_ref (cert);
+  cert_cache[slot].cert = cert;
+}
+
+
 /*
   Return the last found cert.  Caller must free it.
  */
@@ -1359,6 +1561,7 @@ int
 keybox_get_cert (KEYBOX_HANDLE hd, ksba_cert_t *r_cert)
 {
   const unsigned char *buffer;
+  const unsigned char *fpr = NULL;
   size_t length;
   size_t cert_off, cert_len;
   ksba_reader_t reader = NULL;
@@ -1382,6 +1585,16 @@ keybox_get_cert (KEYBOX_HANDLE hd, ksba_cert_t *r_cert)
   if ((uint64_t)cert_off+(uint64_t)cert_len > (uint64_t)length)
     return gpg_error (GPG_ERR_TOO_SHORT);
 
+  /* The first key of an X.509 blob has the fingerprint of the cert.  */
+  if (get16 (buffer + 16) && get16 (buffer + 18) >= 28
+      && 20 + get16 (buffer + 18) <= length)
+    {
+      fpr = buffer + 20;
+      cert = get_cached_cert (fpr, buffer + cert_off, cert_len);
+      if (cert)
+        goto leave;
+    }
+
   rc = ksba_reader_new (&reader);
   if (rc)
     return rc;
@@ -1401,14 +1614,18 @@ keybox_get_cert (KEYBOX_HANDLE hd, ksba_cert_t *r_cert)
     }
 
   rc = ksba_cert_read_der (cert, reader);
+  ksba_reader_release (reader);
+  reader = NULL;
   if (rc)
     {
       ksba_cert_release (cert);
-      ksba_reader_release (reader);
       /* fixme: need to map the error codes */
       return gpg_error (GPG_ERR_GENERAL);
     }
+  if (fpr)
+    put_cached_cert (fpr, cert);
 
+ leave:
   rc = get_flag_from_image (buffer, length, KEYBOX_FLAG_BLOB, &blobflags);
   if (!rc)
     rc = ksba_cert_set_user_data (cert, "keydb.blobflags",
@@ -1416,12 +1633,10 @@ keybox_get_cert (KEYBOX_HANDLE hd, ksba_cert_t *r_cert)
   if (rc)
     {
       ksba_cert_release (cert);
-      ksba_reader_release (reader);
       return gpg_error (rc);
     }
 
   *r_cert = cert;
-  ksba_reader_release (reader);
   return 0;
 }
 
@@ -1453,7 +1668,7 @@ keybox_offset (KEYBOX_HANDLE hd)
 {
   if (!hd->fp)
     return 0;
-  return es_ftello (hd->fp);
+  return _keybox_tell (hd);
 }
 
 gpg_error_t
@@ -1476,10 +1691,10 @@ keybox_seek (KEYBOX_HANDLE hd, off_t offset)
       err = _keybox_ll_open (&hd->fp, hd->kb->fname, 0);
       if (err)
         return err;
+      _keybox_map_file (hd);
     }
 
-  err = es_fseeko (hd->fp, offset, SEEK_SET);
-  hd->error = gpg_error_from_errno (err);
+  hd->error = _keybox_seek (hd, offset);
 
   return hd->error;
 }
@@ -25,11 +25,13 @@
 #include <time.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/stat.h>
 
 #include "keybox-defs.h"
 #include "../common/sysutils.h"
 #include "../common/host2net.h"
 #include "../common/utilproto.h"
+#include "../common/uring.h"
 
 #define EXTSEP_S "."
 
@@ -37,6 +39,19 @@
 #define FILECOPY_DELETE 2
 #define FILECOPY_UPDATE 3
 
+/* A compress run rewrites the file only if at least one quarter of
+ * it are delete-marked blobs or the last run was a day ago.  */
+#define COMPRESS_GARBAGE_RATIO 4
+#define COMPRESS_MAX_INTERVAL  86400
+
+/* Parts of a keybox are copied using io_uring if they are at least
+ * this large and the kernel supports it.  */
+#define URING_COPY_THRESHOLD (1024*1024)
+
+#if defined(HAVE_DOSISH_SYSTEM) && !defined(ftruncate)
+#define ftruncate chsize
+#endif
+
 
 #if !defined(HAVE_FSEEKO) && !defined(fseeko)
 
@@ -153,6 +168,49 @@ rename_tmp_file (const char *bakfname, const char *tmpfname,
 
 
 
+/* Copy up to MAXLEN bytes or, if MAXLEN is negative, the rest of FP
+ * to NEWFP using io_uring.  The number of bytes copied is stored at
+ * R_NBYTES and both streams are positioned after the copied data.
+ * Returns GPG_ERR_NOT_SUPPORTED without doing anything if io_uring
+ * can't be used or the data is too short to benefit from it; the
+ * caller then copies the data itself.  */
+static gpg_error_t
+copy_with_uring (estream_t fp, estream_t newfp, off_t maxlen,
+                 off_t *r_nbytes)
+{
+  gpg_error_t err;
+  struct stat st;
+  off_t inoff, outoff;
+  int infd, outfd;
+
+  *r_nbytes = 0;
+  infd = es_fileno (fp);
+  outfd = es_fileno (newfp);
+  if (infd == -1 || outfd == -1 || fstat (infd, &st) || !S_ISREG (st.st_mode))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  inoff = es_ftello (fp);
+  if (inoff == (off_t)(-1) || inoff > st.st_size)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (maxlen < 0 || maxlen > st.st_size - inoff)
+    maxlen = st.st_size - inoff;
+  if (maxlen < URING_COPY_THRESHOLD)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (es_fflush (newfp) || (outoff = es_ftello (newfp)) == (off_t)(-1))
+    return gpg_error_from_syserror ();
+
+  err = gnupg_uring_copy (infd, inoff, outfd, outoff, maxlen, r_nbytes);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    return err;
+  if (es_fseeko (fp, inoff + *r_nbytes, SEEK_SET)
+      || es_fseeko (newfp, outoff + *r_nbytes, SEEK_SET))
+    {
+      if (!err)
+        err = gpg_error_from_syserror ();
+    }
+  return err;
+}
+
+
 /* Perform insert/delete/update operation.  MODE is one of
    FILECOPY_INSERT, FILECOPY_DELETE, FILECOPY_UPDATE.  FOR_OPENPGP
    indicates that this is called due to an OpenPGP keyblock change.  */
@@ -167,12 +225,17 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
   char *tmpfname = NULL;
   char buffer[4096];  /* (Must be at least 32 bytes) */
   int nread, nbytes;
+  struct keybox_stamp_s stamp;
 
   /* Open the source file. Because we do a rename, we have to check the
      permissions of the file */
   if ((ec = gnupg_access (fname, W_OK)))
     return gpg_error (ec);
 
+  /* Remember the state of the file to update its index.  */
+  if (_keybox_index_stamp (fname, &stamp))
+    memset (&stamp, 0, sizeof stamp);
+
   rc = _keybox_ll_open (&fp, fname, 0);
   if (mode == FILECOPY_INSERT && gpg_err_code (rc) == GPG_ERR_ENOENT)
     {
@@ -262,6 +325,15 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
       off_t current = 0;
 
       /* Copy first part to the new file. */
+      rc = copy_with_uring (fp, newfp, start_offset, &current);
+      if (gpg_err_code (rc) == GPG_ERR_NOT_SUPPORTED)
+        rc = 0;
+      else if (rc)
+        {
+          _keybox_ll_close (fp);
+          _keybox_ll_close (newfp);
+          goto leave;
+        }
       while ( current < start_offset )
         {
           nbytes = DIM(buffer);
@@ -313,6 +385,17 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
   /* Copy the rest of the packet for an delete or update. */
   if (mode == FILECOPY_DELETE || mode == FILECOPY_UPDATE)
     {
+      off_t copied;
+
+      rc = copy_with_uring (fp, newfp, -1, &copied);
+      if (gpg_err_code (rc) == GPG_ERR_NOT_SUPPORTED)
+        rc = 0;
+      else if (rc)
+        {
+          _keybox_ll_close (fp);
+          _keybox_ll_close (newfp);
+          goto leave;
+        }
       while ( (nread = es_fread (buffer, 1, DIM(buffer), fp)) > 0 )
         {
           if (es_fwrite (buffer, nread, 1, newfp) != 1)
@@ -345,6 +428,13 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
 
   rc = rename_tmp_file (bakfname, tmpfname, fname, secret);
 
+  /* Inserted blobs are appended; the others replace or remove the
+     blob at START_OFFSET.  */
+  if (!rc)
+    _keybox_index_update (fname, &stamp,
+                          mode == FILECOPY_INSERT? -1 : start_offset,
+                          mode == FILECOPY_DELETE? NULL : blob);
+
  leave:
   xfree(bakfname);
   xfree(tmpfname);
@@ -352,6 +442,310 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
 }
 
 
+/* Add N to the counter of bytes in delete-marked blobs which is
+ * kept in the header blob of the keybox opened at FP.  Nothing is
+ * done if the file has no header blob.  */
+static gpg_error_t
+add_to_garbage_count (estream_t fp, size_t n)
+{
+  unsigned char buf[32];
+  u32 val;
+
+  if (es_fseeko (fp, 0, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (es_fread (buf, sizeof buf, 1, fp) != 1)
+    return es_ferror (fp)? gpg_error_from_syserror () : 0;
+  if (buf32_to_u32 (buf) < 32 || buf[4] != KEYBOX_BLOBTYPE_HEADER)
+    return 0;
+
+  val = buf32_to_u32 (buf+24);
+  if (n > 0xffffffff - val)
+    val = 0xffffffff;
+  else
+    val += n;
+  buf[24] = val >> 24;
+  buf[25] = val >> 16;
+  buf[26] = val >>  8;
+  buf[27] = val;
+
+  if (es_fseeko (fp, 24, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (es_fwrite (buf+24, 4, 1, fp) != 1)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Make sure that the header blob of the keybox opened at FP has the
+ * OpenPGP flag set.  */
+static gpg_error_t
+set_openpgp_header_flag (estream_t fp)
+{
+  unsigned char buf[8];
+
+  if (es_fseeko (fp, 0, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (es_fread (buf, sizeof buf, 1, fp) != 1)
+    return es_ferror (fp)? gpg_error_from_syserror () : 0;
+  if (buf[4] != KEYBOX_BLOBTYPE_HEADER || (buf[7] & 0x02))
+    return 0;
+
+  buf[7] |= 0x02; /* OpenPGP data may be available.  */
+  if (es_fseeko (fp, 7, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (es_fwrite (buf+7, 1, 1, fp) != 1)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Set or clear the pending append flag in the header blob of the
+ * keybox opened at FP.  OLD_OFF is the offset of the blob to be
+ * replaced or -1 for an insert.  Nothing is done if the file has no
+ * header blob.  */
+static gpg_error_t
+set_pending_append (estream_t fp, int yes, off_t old_off)
+{
+  unsigned char buf[32];
+  u32 val;
+
+  if (es_fseeko (fp, 0, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (es_fread (buf, sizeof buf, 1, fp) != 1)
+    return es_ferror (fp)? gpg_error_from_syserror () : 0;
+  if (buf32_to_u32 (buf) < 32 || buf[4] != KEYBOX_BLOBTYPE_HEADER)
+    return 0;
+
+  /* An offset which does not fit is stored as 0; if the append is
+   * interrupted the replaced blob is then not removed.  */
+  if (!yes || old_off == -1 || (uint64_t)old_off > 0xffffffff)
+    val = 0;
+  else
+    val = old_off;
+  if (yes)
+    buf[7] |= HEADER_FLAG_APPENDING;
+  else
+    buf[7] &= ~HEADER_FLAG_APPENDING;
+  buf[28] = val >> 24;
+  buf[29] = val >> 16;
+  buf[30] = val >>  8;
+  buf[31] = val;
+
+  if (es_fseeko (fp, 7, SEEK_SET)
+      || es_fwrite (buf+7, 1, 1, fp) != 1
+      || es_fseeko (fp, 28, SEEK_SET)
+      || es_fwrite (buf+28, 4, 1, fp) != 1
+      || es_fflush (fp))
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Finish an append to the keybox FNAME opened at FP which has been
+ * interrupted by a crash.  The file is scanned and a truncated blob
+ * at its end is removed.  If the new blob is complete, the blob it
+ * replaces is marked as deleted so that no duplicate is left.  This
+ * reads the entire file but is only done after a crash.  */
+static gpg_error_t
+recover_pending_append (estream_t fp, const char *fname)
+{
+  unsigned char buf[32];
+  off_t off, filesize, old_off, last_off, found_off;
+  size_t len, old_len = 0;
+  int type;
+  gpg_error_t err;
+
+  if (es_fseeko (fp, 0, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (es_fread (buf, sizeof buf, 1, fp) != 1)
+    return es_ferror (fp)? gpg_error_from_syserror () : 0;
+  if (buf32_to_u32 (buf) < 32 || buf[4] != KEYBOX_BLOBTYPE_HEADER
+      || !(buf[7] & HEADER_FLAG_APPENDING))
+    return 0;  /* Nothing to do.  */
+  old_off = buf32_to_u32 (buf+28);
+
+  if (es_fseeko (fp, 0, SEEK_END) || (filesize = es_ftello (fp)) == (off_t)-1)
+    return gpg_error_from_syserror ();
+
+  log_info ("%s: finishing an interrupted update\n", fname);
+  last_off = found_off = -1;
+  for (off = buf32_to_u32 (buf); off < filesize; off += len)
+    {
+      if (filesize - off < 5)
+        break;
+      if (es_fseeko (fp, off, SEEK_SET) || es_fread (buf, 5, 1, fp) != 1)
+        return gpg_error_from_syserror ();
+      len = buf32_to_u32 (buf);
+      type = buf[4];
+      if (len < 5)
+        {
+          log_error ("%s: blob at offset %llu is corrupted\n",
+                     fname, (unsigned long long)off);
+          return gpg_error (GPG_ERR_TOO_SHORT);
+        }
+      if ((uint64_t)len > (uint64_t)(filesize - off))
+        break;
+      if (old_off && off == old_off && type)
+        {
+          found_off = off;
+          old_len = len;
+        }
+      last_off = off;
+    }
+
+  if (off < filesize)
+    {
+      /* The new blob is truncated; remove it and keep the old one.  */
+      es_fflush (fp);
+      if (ftruncate (es_fileno (fp), off))
+        return gpg_error_from_syserror ();
+    }
+  else if (found_off != -1 && found_off != last_off)
+    {
+      /* The new blob is complete; remove the blob it replaces.  */
+      if (es_fseeko (fp, found_off + 4, SEEK_SET))
+        return gpg_error_from_syserror ();
+      if (es_fputc (0, fp) == EOF)
+        return gpg_error_from_syserror ();
+      err = add_to_garbage_count (fp, old_len);
+      if (err)
+        return err;
+    }
+
+  err = set_pending_append (fp, 0, -1);
+  if (!err)
+    _keybox_index_remove (fname);
+  return err;
+}
+
+
+/* Append BLOB to the keybox KB.  If OLD_OFF is not -1 the blob at
+ * that offset with a length of OLD_LEN is marked as deleted after the
+ * new blob has been written; this is how an update is done.  Thus,
+ * unlike blob_filecopy, the cost of this function does not depend on
+ * the size of the keybox; the space of the deleted blobs is reclaimed
+ * by keybox_compress.  FOR_OPENPGP indicates that this is called due
+ * to an OpenPGP keyblock change.
+ *
+ * Other than blob_filecopy this changes the file in place.  Readers
+ * which do not take the lock may thus see a partly written new blob
+ * at the end of the file; _keybox_read_blob treats this as end of
+ * file.  The append is marked in the header blob until the old blob
+ * has been marked as deleted.  If the process dies before that, the
+ * next call finds the mark and calls recover_pending_append to
+ * remove a truncated new blob or, if the new blob is complete, the
+ * old blob.  Thus neither a damaged blob nor a duplicate keyblock
+ * is left behind.  */
+static gpg_error_t
+blob_append (KB_NAME kb, KEYBOXBLOB blob, int secret, int for_openpgp,
+             off_t old_off, size_t old_len)
+{
+  const char *fname = kb->fname;
+  gpg_error_t err, err2;
+  gpg_err_code_t ec;
+  estream_t fp;
+  off_t end_off;
+  struct keybox_stamp_s stamp;
+
+  if ((ec = gnupg_access (fname, W_OK)))
+    {
+      if (ec == GPG_ERR_ENOENT && old_off == -1)
+        return blob_filecopy (FILECOPY_INSERT, fname, blob,
+                              secret, for_openpgp, 0);
+      return gpg_error (ec);
+    }
+
+  /* Remember the state of the file to update its index.  */
+  if (_keybox_index_stamp (fname, &stamp))
+    memset (&stamp, 0, sizeof stamp);
+
+  err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
+  if (err)
+    return err;
+
+  err = recover_pending_append (fp, fname);
+  if (err)
+    {
+      _keybox_ll_close (fp);
+      return err;
+    }
+
+  if (es_fseeko (fp, 0, SEEK_END) || (end_off = es_ftello (fp)) == (off_t)-1)
+    {
+      err = gpg_error_from_syserror ();
+      _keybox_ll_close (fp);
+      return err;
+    }
+  if (!end_off)
+    {
+      /* An empty file has no header; let blob_filecopy handle it.  */
+      _keybox_ll_close (fp);
+      if (old_off != -1)
+        return gpg_error (GPG_ERR_GENERAL);
+      return blob_filecopy (FILECOPY_INSERT, fname, blob,
+                            secret, for_openpgp, 0);
+    }
+
+  err = set_pending_append (fp, 1, old_off);
+  if (err)
+    {
+      _keybox_ll_close (fp);
+      return err;
+    }
+
+  if (es_fseeko (fp, end_off, SEEK_SET))
+    err = gpg_error_from_syserror ();
+  else
+    err = _keybox_write_blob (blob, fp, NULL);
+  if (!err && es_fflush (fp))
+    err = gpg_error_from_syserror ();
+  if (err)
+    {
+      /* Do not leave a partial blob at the end of the file.  */
+      es_clearerr (fp);
+      if (ftruncate (es_fileno (fp), end_off))
+        log_error ("error truncating '%s': %s\n",
+                   fname, gpg_strerror (gpg_error_from_syserror ()));
+      else
+        set_pending_append (fp, 0, -1);
+      _keybox_ll_close (fp);
+      return err;
+    }
+
+  /* Now that the new blob is stored, remove the old one.  */
+  if (old_off != -1)
+    {
+      if (es_fseeko (fp, old_off + 4, SEEK_SET))
+        err = gpg_error_from_syserror ();
+      else if (es_fputc (0, fp) == EOF)
+        err = gpg_error_from_syserror ();
+      else
+        err = add_to_garbage_count (fp, old_len);
+    }
+  if (!err && for_openpgp)
+    err = set_openpgp_header_flag (fp);
+  if (!err)
+    err = set_pending_append (fp, 0, -1);
+
+  err2 = _keybox_ll_close (fp);
+  if (!err)
+    err = err2;
+
+  /* The delete-marked old blob is skipped when reading the file; thus
+   * its index entries are harmless.  The new blob has been appended
+   * at END_OFF which is the size recorded in STAMP.  During a batch
+   * the index is written only at its end.  */
+  if (!err && kb->index_batch)
+    _keybox_index_batch_add (kb, blob, end_off);
+  else if (!err)
+    _keybox_index_update (fname, &stamp, -1, blob);
+  else
+    _keybox_index_remove (fname);
+
+  return err;
+}
+
+
 /* Insert the OpenPGP keyblock {IMAGE,IMAGELEN} into HD. */
 gpg_error_t
 keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
@@ -385,7 +779,7 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   _keybox_destroy_openpgp_info (&info);
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
+      err = blob_append (hd->kb, blob, hd->secret, 1, -1, 0);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -404,6 +798,7 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   gpg_error_t err;
   const char *fname;
   off_t off;
+  size_t oldlen;
   KEYBOXBLOB blob;
   size_t nparsed;
   struct _keybox_openpgp_info info;
@@ -421,6 +816,7 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   off = _keybox_get_blob_fileoffset (hd->found.blob);
   if (off == (off_t)-1)
     return gpg_error (GPG_ERR_GENERAL);
+  _keybox_get_blob_image (hd->found.blob, &oldlen);
 
   /* Close the file so that we do no mess up the position for a
      next search.  */
@@ -438,7 +834,7 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   /* Update the keyblock.  */
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_UPDATE, fname, blob, hd->secret, 1, off);
+      err = blob_append (hd->kb, blob, hd->secret, 1, off, oldlen);
       _keybox_release_blob (blob);
     }
   return err;
@@ -471,7 +867,7 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   rc = _keybox_create_x509_blob (&blob, cert, sha1_digest, hd->ephemeral);
   if (!rc)
     {
-      rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
+      rc = blob_append (hd->kb, blob, hd->secret, 0, -1, 0);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -508,6 +904,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   size_t flag_pos, flag_size;
   const unsigned char *buffer;
   size_t length;
+  struct keybox_stamp_s stamp;
 
   (void)idx;  /* Not yet used.  */
 
@@ -536,6 +933,8 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
 
   _keybox_close_file (hd);
 
+  if (_keybox_index_stamp (fname, &stamp))
+    memset (&stamp, 0, sizeof stamp);
   err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
   if (err)
     return err;
@@ -573,10 +972,132 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
         ec = gpg_err_code (err);
     }
 
+  /* The blobs did not move; thus the index only needs a new stamp.  */
+  if (!ec)
+    _keybox_index_update (fname, &stamp, -1, NULL);
+
   return gpg_error (ec);
 }
 
 
+/* Store the signature status SIGSTATUS in the blob of the last found
+ * OpenPGP keyblock.  SIGSTATUS uses the format as returned by
+ * keybox_get_keyblock.  The blob is updated in place after checking
+ * that the file still holds the same blob; the checksum of the blob
+ * is updated as well.  As with keybox_set_flags the keybox must have
+ * been locked before the search.  */
+gpg_error_t
+keybox_set_sigstatus (KEYBOX_HANDLE hd, const u32 *sigstatus)
+{
+  gpg_error_t err;
+  gpg_err_code_t ec;
+  off_t off;
+  const char *fname;
+  estream_t fp;
+  const unsigned char *buffer;
+  unsigned char *copy = NULL;
+  unsigned char *filecopy = NULL;
+  size_t length, n, nsigs, siginfolen, siginfo_off, siginfo_len;
+  size_t image_off, image_len, unhashed;
+  struct keybox_stamp_s stamp;
+
+  if (!hd || !sigstatus)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (!hd->found.blob)
+    return gpg_error (GPG_ERR_NOTHING_FOUND);
+  if (!hd->kb || !(fname = hd->kb->fname))
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (blob_get_type (hd->found.blob) != KEYBOX_BLOBTYPE_PGP)
+    return gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+
+  off = _keybox_get_blob_fileoffset (hd->found.blob);
+  if (off == (off_t)-1)
+    return gpg_error (GPG_ERR_GENERAL);
+
+  buffer = _keybox_get_blob_image (hd->found.blob, &length);
+  if (length < 40)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+  image_off = buf32_to_size_t (buffer+8);
+  image_len = buf32_to_size_t (buffer+12);
+  if ((uint64_t)image_off+(uint64_t)image_len > (uint64_t)length)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+  unhashed = length - image_off - image_len;
+  ec = _keybox_get_flag_location (buffer, length, KEYBOX_FLAG_SIG_INFO,
+                                  &siginfo_off, &siginfo_len);
+  if (ec)
+    return gpg_error (ec);
+  nsigs = buf16_to_uint (buffer + siginfo_off);
+  siginfolen = buf16_to_uint (buffer + siginfo_off + 2);
+  if (sigstatus[0] != nsigs)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (!nsigs)
+    return 0;
+
+  /* Update a copy of the blob.  */
+  copy = xtrymalloc (length);
+  filecopy = xtrymalloc (length);
+  if (!copy || !filecopy)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (copy, buffer, length);
+  for (n=0; n < nsigs; n++)
+    {
+      unsigned char *p = copy + siginfo_off + 4 + n*siginfolen;
+      u32 value = sigstatus[1+n];
+
+      p[0] = value >> 24;
+      p[1] = value >> 16;
+      p[2] = value >>  8;
+      p[3] = value;
+    }
+  if (unhashed >= 20)
+    gcry_md_hash_buffer (GCRY_MD_SHA1, copy + length - 20,
+                         copy, length - unhashed);
+
+  _keybox_close_file (hd);
+
+  if (_keybox_index_stamp (fname, &stamp))
+    memset (&stamp, 0, sizeof stamp);
+  err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
+  if (err)
+    goto leave;
+
+  /* Make sure that the blob has not been changed or moved, for
+   * example by another process compressing the keybox, since
+   * searching for it.  */
+  ec = 0;
+  if (es_fseeko (fp, off, SEEK_SET))
+    ec = gpg_err_code_from_syserror ();
+  else if (es_fread (filecopy, length, 1, fp) != 1)
+    ec = GPG_ERR_TRUNCATED;
+  else if (memcmp (filecopy, buffer, length))
+    ec = GPG_ERR_CONFLICT;
+  else if (es_fseeko (fp, off + siginfo_off, SEEK_SET)
+           || es_fwrite (copy + siginfo_off, siginfo_len + 4, 1, fp) != 1)
+    ec = gpg_err_code_from_syserror ();
+  else if (unhashed >= 20
+           && (es_fseeko (fp, off + length - 20, SEEK_SET)
+               || es_fwrite (copy + length - 20, 20, 1, fp) != 1))
+    ec = gpg_err_code_from_syserror ();
+
+  err = _keybox_ll_close (fp);
+  if (!ec && err)
+    ec = gpg_err_code (err);
+
+  /* The blobs did not move; thus the index only needs a new stamp.  */
+  if (!ec)
+    _keybox_index_update (fname, &stamp, -1, NULL);
+  err = gpg_error (ec);
+
+ leave:
+  xfree (copy);
+  xfree (filecopy);
+  return err;
+}
+
+
 
 int
 keybox_delete (KEYBOX_HANDLE hd)
@@ -585,6 +1106,8 @@ keybox_delete (KEYBOX_HANDLE hd)
   const char *fname;
   estream_t fp;
   int rc, rc2;
+  size_t length;
+  struct keybox_stamp_s stamp;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -600,8 +1123,11 @@ keybox_delete (KEYBOX_HANDLE hd)
   if (off == (off_t)-1)
     return gpg_error (GPG_ERR_GENERAL);
   off += 4;
+  _keybox_get_blob_image (hd->found.blob, &length);
 
   _keybox_close_file (hd);
+  if (_keybox_index_stamp (fname, &stamp))
+    memset (&stamp, 0, sizeof stamp);
   rc = _keybox_ll_open (&fp, hd->kb->fname, KEYBOX_LL_OPEN_UPDATE);
   if (rc)
     return rc;
@@ -611,7 +1137,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   else if (es_fputc (0, fp) == EOF)
     rc = gpg_error_from_syserror ();
   else
-    rc = 0;
+    rc = add_to_garbage_count (fp, length);
 
   rc2 = _keybox_ll_close (fp);
   if (rc2)
@@ -620,10 +1146,45 @@ keybox_delete (KEYBOX_HANDLE hd)
         rc = rc2;
     }
 
+  /* The deleted blob is skipped when reading the file; thus its index
+     entries are harmless and only the stamp needs an update.  */
+  if (!rc)
+    _keybox_index_update (fname, &stamp, -1, NULL);
+
   return rc;
 }
 
 
+/* Set the last maintenance time of the keybox FNAME.  Errors are
+   ignored because this would only lead to another compress run.  */
+static void
+touch_header_blob (const char *fname)
+{
+  estream_t fp;
+  unsigned char buf[8];
+  u32 val;
+  struct keybox_stamp_s stamp;
+
+  if (_keybox_index_stamp (fname, &stamp))
+    memset (&stamp, 0, sizeof stamp);
+  if (_keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE))
+    return;
+  if (es_fread (buf, 8, 1, fp) == 1
+      && buf32_to_u32 (buf) >= 32 && buf[4] == KEYBOX_BLOBTYPE_HEADER
+      && !es_fseeko (fp, 20, SEEK_SET))
+    {
+      val = make_timestamp ();
+      buf[0] = val >> 24;
+      buf[1] = val >> 16;
+      buf[2] = val >>  8;
+      buf[3] = val;
+      es_fwrite (buf, 4, 1, fp);
+    }
+  if (!_keybox_ll_close (fp))
+    _keybox_index_update (fname, &stamp, -1, NULL);
+}
+
+
 /* Compress the keybox file.  This should be run with the file
    locked. */
 int
@@ -658,25 +1219,46 @@ keybox_compress (KEYBOX_HANDLE hd)
   if ((ec = gnupg_access (fname, W_OK)))
     return gpg_error (ec);
 
-  rc = _keybox_ll_open (&fp, fname, 0);
+  rc = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
   if (gpg_err_code (rc) == GPG_ERR_ENOENT)
     return 0; /* Ready. File has been deleted right after the access above. */
   if (rc)
     return rc;
 
+  /* Do not copy a duplicate left by an interrupted update.  */
+  rc = recover_pending_append (fp, fname);
+  if (rc || es_fseek (fp, 0, SEEK_SET))
+    {
+      if (!rc)
+        rc = gpg_error_from_syserror ();
+      _keybox_ll_close (fp);
+      return rc;
+    }
+
   /* A quick test to see if we need to compress the file at all.  We
-     schedule a compress run after 3 hours. */
+     schedule a compress run after 3 hours but do the actual rewrite
+     only if enough space is taken by deleted blobs or the last run
+     was a day ago.  Thus the cost of the rewrite is amortized over
+     the updates which created the deleted blobs. */
   if ( !_keybox_read_blob (&blob, fp, NULL) )
     {
       const unsigned char *buffer;
       size_t length;
 
       buffer = _keybox_get_blob_image (blob, &length);
-      if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+      if (length >= 32 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
         {
           u32 last_maint = buf32_to_u32 (buffer+20);
-
-          if ( (last_maint + 3*3600) > make_timestamp () )
+          u32 garbage = buf32_to_u32 (buffer+24);
+          u32 now = make_timestamp ();
+          off_t filesize;
+
+          if (es_fseeko (fp, 0, SEEK_END)
+              || (filesize = es_ftello (fp)) == (off_t)-1)
+            filesize = 0;
+          if ( (last_maint + 3*3600) > now
+               || ((last_maint + COMPRESS_MAX_INTERVAL) > now
+                   && (off_t)garbage * COMPRESS_GARBAGE_RATIO < filesize))
             {
               _keybox_ll_close (fp);
               _keybox_release_blob (blob);
@@ -786,11 +1368,21 @@ keybox_compress (KEYBOX_HANDLE hd)
   if ((rc2 = _keybox_ll_close (newfp)) && !rc)
     rc = rc2;
 
-  /* Rename or remove the temporary file. */
+  /* Rename or remove the temporary file.  If nothing changed we
+     only update the maintenance time stamp so that the next run does
+     not need to read the file again.  */
   if (rc || !any_changes)
-    gnupg_remove (tmpfname);
+    {
+      gnupg_remove (tmpfname);
+      if (!rc)
+        touch_header_blob (fname);
+    }
   else
-    rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+    {
+      rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+      if (!rc)
+        _keybox_index_remove (fname);
+    }
 
   xfree(bakfname);
   xfree(tmpfname);
@@ -27,6 +27,7 @@
 #endif
 
 #include "keybox-defs.h"
+#include "../common/mbox-util.h"
 
 
 /* Store the two malloced temporary file names used for keybox updates
@@ -100,3 +101,81 @@ keybox_tmp_names (const char *filename, int for_keyring,
   *r_tmpname = tmp_name;
   return 0;
 }
+
+
+/* Return a hash of the distinguished name NAME of NAMELEN bytes as
+ * stored in X.509 blobs.  The names are the RFC-2253 strings created
+ * by libksba from the DER encoding and thus already canonical for a
+ * given certificate; the hash is only used to skip names which can't
+ * match before doing the actual compare.  This is the 32 bit FNV-1a
+ * hash.  */
+u32
+_keybox_dn_hash (const void *name, size_t namelen)
+{
+  const unsigned char *s = name;
+  u32 hash = 2166136261U;
+
+  for (; namelen; namelen--, s++)
+    {
+      hash ^= *s;
+      hash *= 16777619U;
+    }
+  return hash;
+}
+
+
+/* Return the hash of the mail address MBOX of MBOXLEN bytes as stored
+ * in OpenPGP blobs.  Mail addresses are compared case-insensitive;
+ * thus this is the FNV-1a hash of the ASCII lowercased address.  */
+u32
+_keybox_mail_hash (const void *mbox, size_t mboxlen)
+{
+  const unsigned char *s = mbox;
+  u32 hash = 2166136261U;
+
+  for (; mboxlen; mboxlen--, s++)
+    {
+      hash ^= (*s >= 'A' && *s <= 'Z')? (*s + 'a' - 'A') : *s;
+      hash *= 16777619U;
+    }
+  return hash;
+}
+
+
+/* Locate the mail address in the OpenPGP user ID UID of UIDLEN bytes.
+ * On success the offset and the length of the address are stored at
+ * R_OFF and R_LEN and true is returned.  If the user ID has no
+ * proper mail address false is returned.  */
+int
+_keybox_openpgp_mailbox (const unsigned char *uid, size_t uidlen,
+                         size_t *r_off, size_t *r_len)
+{
+  size_t off, len, pos;
+
+  /* We need to forward to the mailbox part.  */
+  for (off=0, len=uidlen; len && uid[off] != '<'; len--, off++)
+    ;
+  if (len < 2 || uid[off] != '<')
+    {
+      /* Mailbox not explicitly given or too short.  Check whether
+         the entire string resembles a mailbox without the angle
+         brackets.  */
+      if (!is_valid_mailbox_mem (uid, uidlen))
+        return 0; /* Not a mail address. */
+      *r_off = 0;
+      *r_len = uidlen;
+      return 1;
+    }
+
+  /* Seems to be standard user id with mail address.  */
+  off++; /* Point to first char of the mail address.  */
+  len--;
+  /* Search closing '>'.  */
+  for (pos=off; len && uid[pos] != '>'; len--, pos++)
+    ;
+  if (!len || uid[pos] != '>' || off == pos)
+    return 0; /* Not a proper mail address.  */
+  *r_off = off;
+  *r_len = pos - off;
+  return 1;
+}
@@ -78,6 +78,8 @@ const char *keybox_get_resource_name (KEYBOX_HANDLE hd);
 int keybox_set_ephemeral (KEYBOX_HANDLE hd, int yes);
 
 gpg_error_t keybox_lock (KEYBOX_HANDLE hd, int yes, long timeout);
+gpg_error_t keybox_begin_batch (KEYBOX_HANDLE hd);
+void keybox_end_batch (KEYBOX_HANDLE hd);
 
 /*-- keybox-file.c --*/
 /* Fixme: This function does not belong here: Provide a better
@@ -90,7 +92,8 @@ gpg_error_t keybox_get_data (KEYBOX_HANDLE hd,
                              enum pubkey_types *r_pubkey_type,
                              unsigned char *r_ubid);
 gpg_error_t keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
-                                 int *r_pk_no, int *r_uid_no);
+                                 int *r_pk_no, int *r_uid_no,
+                                 u32 **r_sigstatus);
 #ifdef KEYBOX_WITH_X509
 int keybox_get_cert (KEYBOX_HANDLE hd, ksba_cert_t *ret_cert);
 #endif /*KEYBOX_WITH_X509*/
@@ -118,6 +121,7 @@ int keybox_update_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
                         unsigned char *sha1_digest);
 #endif /*KEYBOX_WITH_X509*/
 int keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value);
+gpg_error_t keybox_set_sigstatus (KEYBOX_HANDLE hd, const u32 *sigstatus);
 
 int keybox_delete (KEYBOX_HANDLE hd);
 int keybox_compress (KEYBOX_HANDLE hd);
@@ -55,6 +55,7 @@
 #include "../common/sysutils.h"
 #include "../common/asshelp.h"
 #include "../common/init.h"
+#include "../common/asynclog.h"
 #include "../common/gc-opt-flags.h"
 #include "../common/exechelp.h"
 #include "../common/comopt.h"
@@ -85,11 +86,14 @@ enum cmd_and_opt_values
     oNoDetach,
     oStealSocket,
     oLogFile,
+    oAsyncLog,
+    oMetricsLogInterval,
     oServer,
     oDaemon,
     oFakedSystemTime,
     oListenBacklog,
     oDisableCheckOwnSocket,
+    oCacheSize,
 
     oDummy
   };
@@ -116,6 +120,10 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDebugAll,  "debug-all",  "@"),
   ARGPARSE_s_i (oDebugWait, "debug-wait", "@"),
   ARGPARSE_s_s (oLogFile,   "log-file",  N_("use a log file for the server")),
+  ARGPARSE_s_n (oAsyncLog,  "async-log",
+                N_("write the log file in the background")),
+  ARGPARSE_s_u (oMetricsLogInterval, "metrics-log-interval",
+                N_("|N|log the metrics every N seconds")),
 
   ARGPARSE_header ("Configuration",
                    N_("Options controlling the configuration")),
@@ -123,6 +131,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDisableCheckOwnSocket, "disable-check-own-socket", "@"),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
+  ARGPARSE_s_u (oCacheSize, "cache-size",
+                N_("|N|use at most N KiB of memory for cached keys")),
 
   ARGPARSE_end () /* End of list */
 };
@@ -210,6 +220,14 @@ static char *config_filename;
  * the log file after a SIGHUP if it didn't changed.  Malloced. */
 static char *current_logfile;
 
+/* Flag indicating that the log file shall be written by a background
+ * thread; set by --async-log.  */
+static int async_log;
+
+/* If not 0, the interval in seconds for writing the metrics to the
+ * log; set by --metrics-log-interval.  */
+static unsigned int metrics_log_interval;
+
 /* Number of active connections.  */
 static int active_connections;
 
@@ -381,6 +399,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.verbose = 0;
       opt.debug = 0;
       disable_check_own_socket = 0;
+      opt.cache_size = (size_t)DEFAULT_CACHE_SIZE * 1024;
       return 1;
     }
 
@@ -408,6 +427,14 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
 
     case oDisableCheckOwnSocket: disable_check_own_socket = 1; break;
 
+    case oCacheSize:
+      opt.cache_size = pargs->r.ret_ulong;
+      if (opt.cache_size > (size_t)(-1) / 1024)
+        opt.cache_size = (size_t)(-1);
+      else
+        opt.cache_size *= 1024;
+      break;
+
     default:
       return 0; /* not handled */
     }
@@ -448,6 +475,26 @@ static void
 initialize_modules (void)
 {
   thread_init_once ();
+  metrics_set_prefix ("keyboxd");
+  metrics_register_source (kbxd_metrics);
+}
+
+
+/* Switch to the asynchronous log sink if requested by --async-log.
+ * This is a no-op if it is already active.  nPth needs to be
+ * initialized.  */
+static void
+start_async_log (void)
+{
+  gpg_error_t err;
+
+  if (!async_log || !current_logfile)
+    return;
+
+  err = async_log_set_file (current_logfile);
+  if (err)
+    log_info ("not using asynchronous logging for '%s': %s\n",
+              current_logfile, gpg_strerror (err));
 }
 
 
@@ -572,6 +619,10 @@ main (int argc, char **argv )
         case oNoDetach: nodetach = 1; break;
         case oStealSocket: steal_socket = 1; break;
         case oLogFile: logfile = pargs.r.ret_str; break;
+        case oAsyncLog: async_log = 1; break;
+        case oMetricsLogInterval:
+          metrics_log_interval = pargs.r.ret_ulong;
+          break;
         case oServer: pipe_server = 1; break;
         case oDaemon: is_daemon = 1; break;
         case oFakedSystemTime:
@@ -1043,6 +1094,8 @@ reread_configuration (void)
           current_logfile = comopt.logfile? xtrystrdup (comopt.logfile) : NULL;
         }
     }
+
+  start_async_log ();
 }
 
 
@@ -1511,6 +1564,11 @@ handle_connections (gnupg_fd_t listen_fd)
   };
   int have_homedir_inotify = 0;
 
+  start_async_log ();
+  if ((err = metrics_start_logging (metrics_log_interval)))
+    log_error ("error starting the metrics logging: %s\n",
+               gpg_strerror (err));
+
   ret = npth_attr_init(&tattr);
   if (ret)
     log_fatal ("error allocating thread attributes: %s\n", strerror (ret));
@@ -30,6 +30,7 @@
 #include "../common/util.h"
 #include "../common/membuf.h"
 #include "../common/sysutils.h" /* (gnupg_fd_t) */
+#include "../common/metrics.h"
 
 
 /* A large struct name "opt" to keep global flags */
@@ -43,18 +44,26 @@ struct
   /* True if we are running detached from the tty. */
   int running_detached;
 
+  /* Maximum number of bytes used for cached key blobs.  */
+  size_t cache_size;
+
   /*
    * Global state variables.
    */
 
   /* Whether a global transaction has been requested along with the
-   * caller's pid and whether a transaction is active.  */
+   * caller's pid and whether a transaction is active.  BULK_TRANSACTION
+   * is set if the transaction was requested with --bulk.  */
   pid_t transaction_pid;
   unsigned int in_transaction : 1;
   unsigned int active_transaction : 1;
+  unsigned int bulk_transaction : 1;
 } opt;
 
 
+/* The default for opt.cache_size in KiB.  */
+#define DEFAULT_CACHE_SIZE 32768
+
 /* Bit values for the --debug option.  */
 #define DBG_MPI_VALUE	  2	/* debug mpi details */
 #define DBG_CRYPTO_VALUE  4	/* debug low level crypto */
@@ -0,0 +1,489 @@
+/* t-keybox.c - Regression tests for the keybox update functions
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The keybox is changed in place by appending blobs and marking the
+ * replaced ones as deleted.  These tests insert, update and delete
+ * keys and simulate appends which have been interrupted by a crash,
+ * either with a truncated blob at the end of the file or with a
+ * complete new blob whose old version has not yet been deleted.  */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "keybox-defs.h"
+#include "../common/init.h"
+#include "../common/sysutils.h"
+#include "../common/host2net.h"
+
+#define PGM "t-keybox"
+
+#define NKEYS 8
+
+static int verbose;
+static char *fname;
+static char *idxfname;
+
+/* The version of each key expected in the keybox or -1 if the key
+ * is not expected.  */
+static int expected[NKEYS];
+
+
+static void
+die (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  fflush (stdout);
+  fprintf (stderr, "%s: ", PGM);
+  va_start (arg_ptr, format);
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  if (*format && format[strlen(format)-1] != '\n')
+    putc ('\n', stderr);
+  if (fname)
+    {
+      gnupg_remove (fname);
+      gnupg_remove (idxfname);
+    }
+  exit (1);
+}
+
+
+/* Return the user ID of KEYNO in VERSION.  */
+static const char *
+make_uid (int keyno, int version)
+{
+  static char buffer[64];
+
+  snprintf (buffer, sizeof buffer, "Test key %d version %d <k%d@example.org>",
+            keyno, version, keyno);
+  return buffer;
+}
+
+
+/* Store an OpenPGP keyblock for KEYNO in VERSION at BUFFER which
+ * must have room for 256 bytes and return its length.  The keyblock
+ * has a fake RSA key and one user ID; the versions differ only in
+ * the user ID.  This is sufficient for the keybox which neither
+ * checks the key nor requires signatures.  */
+static size_t
+make_keyblock (unsigned char *buffer, int keyno, int version)
+{
+  unsigned char *p = buffer;
+  const char *uid = make_uid (keyno, version);
+  int i;
+
+  *p++ = 0x99;  /* Public key packet with a two octet length.  */
+  *p++ = 0;
+  *p++ = 1 + 4 + 1 + 2 + 128 + 2 + 3;
+  *p++ = 4;     /* Version.  */
+  *p++ = 0x5f;  /* Creation time.  */
+  *p++ = 0x5e;
+  *p++ = 0x10;
+  *p++ = keyno;
+  *p++ = 1;     /* RSA.  */
+  *p++ = 0x04;  /* 1024 bit modulus.  */
+  *p++ = 0x00;
+  for (i=0; i < 128; i++)
+    *p++ = i? ((keyno * 31 + i * 7) & 0xff) : (0x80 | keyno);
+  *p++ = 0x00;  /* Exponent 65537.  */
+  *p++ = 0x11;
+  *p++ = 0x01;
+  *p++ = 0x00;
+  *p++ = 0x01;
+
+  *p++ = 0xb4;  /* User ID packet.  */
+  *p++ = strlen (uid);
+  memcpy (p, uid, strlen (uid));
+  p += strlen (uid);
+
+  return p - buffer;
+}
+
+
+/* Return the blob for KEYNO in VERSION.  */
+static KEYBOXBLOB
+make_blob (int keyno, int version)
+{
+  gpg_error_t err;
+  unsigned char image[256];
+  size_t imagelen, nparsed;
+  struct _keybox_openpgp_info info;
+  KEYBOXBLOB blob;
+
+  imagelen = make_keyblock (image, keyno, version);
+  err = _keybox_parse_openpgp (image, imagelen, &nparsed, &info);
+  if (err)
+    die ("error parsing keyblock %d: %s\n", keyno, gpg_strerror (err));
+  err = _keybox_create_openpgp_blob (&blob, &info, image, imagelen, 0);
+  _keybox_destroy_openpgp_info (&info);
+  if (err)
+    die ("error creating blob %d: %s\n", keyno, gpg_strerror (err));
+  return blob;
+}
+
+
+/* Return the keyno and version of the keyblock in (IMAGE,IMAGELEN)
+ * at R_KEYNO and R_VERSION.  */
+static void
+identify_keyblock (const unsigned char *image, size_t imagelen,
+                   int *r_keyno, int *r_version)
+{
+  unsigned char buffer[256];
+  int keyno, version;
+
+  for (keyno=0; keyno < NKEYS; keyno++)
+    for (version=0; version < 3; version++)
+      if (make_keyblock (buffer, keyno, version) == imagelen
+          && !memcmp (buffer, image, imagelen))
+        {
+          *r_keyno = keyno;
+          *r_version = version;
+          return;
+        }
+  die ("unexpected keyblock found\n");
+}
+
+
+/* List all keys using the normal search functions and check that the
+ * keybox has exactly the keys in EXPECTED.  */
+static void
+check_keys (void *token, const char *what)
+{
+  gpg_error_t err;
+  KEYBOX_HANDLE hd;
+  KEYBOX_SEARCH_DESC desc;
+  int seen[NKEYS];
+  void *image;
+  size_t imagelen;
+  int keyno, version;
+
+  for (keyno=0; keyno < NKEYS; keyno++)
+    seen[keyno] = -1;
+
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    die ("error creating handle: %s\n",
+         gpg_strerror (gpg_error_from_syserror ()));
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  while (!(err = keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP,
+                                NULL, NULL)))
+    {
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+      err = keybox_get_data (hd, &image, &imagelen, NULL, NULL);
+      if (err)
+        die ("%s: error getting keyblock: %s\n", what, gpg_strerror (err));
+      identify_keyblock (image, imagelen, &keyno, &version);
+      xfree (image);
+      if (verbose)
+        printf ("%s: found key %d version %d\n", what, keyno, version);
+      if (seen[keyno] != -1)
+        die ("%s: duplicate of key %d\n", what, keyno);
+      seen[keyno] = version;
+    }
+  if (err != -1 && gpg_err_code (err) != GPG_ERR_EOF)
+    die ("%s: error listing keys: %s\n", what, gpg_strerror (err));
+  keybox_release (hd);
+
+  for (keyno=0; keyno < NKEYS; keyno++)
+    if (seen[keyno] != expected[keyno])
+      die ("%s: key %d has version %d; expected %d\n",
+           what, keyno, seen[keyno], expected[keyno]);
+}
+
+
+/* Return a handle with the key KEYNO in VERSION as found key.  */
+static KEYBOX_HANDLE
+find_key (void *token, int keyno, int version)
+{
+  gpg_error_t err;
+  KEYBOX_HANDLE hd;
+  KEYBOX_SEARCH_DESC desc;
+
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    die ("error creating handle: %s\n",
+         gpg_strerror (gpg_error_from_syserror ()));
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_EXACT;
+  desc.u.name = make_uid (keyno, version);
+  desc.name_used = 1;
+  err = keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL);
+  if (err)
+    die ("error searching key %d: %s\n", keyno, gpg_strerror (err));
+  return hd;
+}
+
+
+static void
+insert_key (void *token, int keyno, int version)
+{
+  gpg_error_t err;
+  KEYBOX_HANDLE hd;
+  unsigned char image[256];
+  size_t imagelen;
+
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    die ("error creating handle: %s\n",
+         gpg_strerror (gpg_error_from_syserror ()));
+  imagelen = make_keyblock (image, keyno, version);
+  err = keybox_insert_keyblock (hd, image, imagelen);
+  if (err)
+    die ("error inserting key %d: %s\n", keyno, gpg_strerror (err));
+  keybox_release (hd);
+  expected[keyno] = version;
+}
+
+
+static void
+update_key (void *token, int keyno, int version)
+{
+  gpg_error_t err;
+  KEYBOX_HANDLE hd;
+  unsigned char image[256];
+  size_t imagelen;
+
+  hd = find_key (token, keyno, expected[keyno]);
+  imagelen = make_keyblock (image, keyno, version);
+  err = keybox_update_keyblock (hd, image, imagelen);
+  if (err)
+    die ("error updating key %d: %s\n", keyno, gpg_strerror (err));
+  keybox_release (hd);
+  expected[keyno] = version;
+}
+
+
+static void
+delete_key (void *token, int keyno)
+{
+  gpg_error_t err;
+  KEYBOX_HANDLE hd;
+
+  hd = find_key (token, keyno, expected[keyno]);
+  err = keybox_delete (hd);
+  if (err)
+    die ("error deleting key %d: %s\n", keyno, gpg_strerror (err));
+  keybox_release (hd);
+  expected[keyno] = -1;
+}
+
+
+/* Return the offset of the blob with KEYNO in VERSION in the file.  */
+static off_t
+blob_offset (int keyno, int version)
+{
+  FILE *fp;
+  unsigned char buffer[5];
+  unsigned char image[256];
+  size_t len, imagelen;
+  off_t off, result = -1;
+
+  imagelen = make_keyblock (image, keyno, version);
+  fp = fopen (fname, "rb");
+  if (!fp)
+    die ("can't open '%s': %s\n", fname, strerror (errno));
+  for (off = 0; fread (buffer, 5, 1, fp) == 1; off += len)
+    {
+      unsigned char *blob;
+
+      len = buf32_to_size_t (buffer);
+      if (len < 5)
+        die ("invalid blob at offset %lld\n", (long long)off);
+      blob = xmalloc (len);
+      memcpy (blob, buffer, 5);
+      if (fread (blob+5, len-5, 1, fp) != 1)
+        die ("truncated blob at offset %lld\n", (long long)off);
+      if (blob[4] == KEYBOX_BLOBTYPE_PGP && len >= 16
+          && buf32_to_size_t (blob+12) == imagelen
+          && buf32_to_size_t (blob+8) <= len - imagelen
+          && !memcmp (blob + buf32_to_size_t (blob+8), image, imagelen))
+        result = off;
+      xfree (blob);
+    }
+  fclose (fp);
+  if (result == -1)
+    die ("blob of key %d not found\n", keyno);
+  return result;
+}
+
+
+/* Append the first LEN bytes of BLOB to the file and mark an append
+ * of a blob replacing the one at OLD_OFF as pending.  This is what an
+ * interrupted blob_append leaves behind.  */
+static void
+simulate_crash (KEYBOXBLOB blob, size_t len, off_t old_off)
+{
+  FILE *fp;
+  const unsigned char *image;
+  size_t imagelen;
+  unsigned char header[32];
+
+  image = _keybox_get_blob_image (blob, &imagelen);
+  if (len > imagelen)
+    len = imagelen;
+
+  fp = fopen (fname, "r+b");
+  if (!fp)
+    die ("can't open '%s': %s\n", fname, strerror (errno));
+  if (fread (header, 32, 1, fp) != 1)
+    die ("error reading header: %s\n", strerror (errno));
+  header[7] |= 0x04;
+  header[28] = old_off >> 24;
+  header[29] = old_off >> 16;
+  header[30] = old_off >> 8;
+  header[31] = old_off;
+  if (fseek (fp, 0, SEEK_SET) || fwrite (header, 32, 1, fp) != 1
+      || fseek (fp, 0, SEEK_END) || fwrite (image, len, 1, fp) != 1
+      || fclose (fp))
+    die ("error writing '%s': %s\n", fname, strerror (errno));
+}
+
+
+/* Check that FNAME has no pending append and consists only of
+ * complete blobs.  */
+static void
+check_file (const char *what)
+{
+  FILE *fp;
+  unsigned char buffer[32];
+  long long off, filesize;
+
+  fp = fopen (fname, "rb");
+  if (!fp)
+    die ("can't open '%s': %s\n", fname, strerror (errno));
+  if (fread (buffer, 32, 1, fp) != 1)
+    die ("error reading header: %s\n", strerror (errno));
+  if ((buffer[7] & 0x04))
+    die ("%s: append still marked as pending\n", what);
+  fseek (fp, 0, SEEK_END);
+  filesize = ftell (fp);
+  for (off = 0; off < filesize; off += buf32_to_size_t (buffer))
+    {
+      if (fseek (fp, off, SEEK_SET) || fread (buffer, 5, 1, fp) != 1
+          || buf32_to_size_t (buffer) < 5)
+        die ("%s: invalid blob at offset %lld\n", what, off);
+    }
+  fclose (fp);
+  if (off != filesize)
+    die ("%s: truncated blob at offset %lld\n", what, off);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  gpg_error_t err;
+  void *token;
+  estream_t fp;
+  KEYBOXBLOB blob;
+  size_t bloblen;
+  int keyno;
+
+  if (argc)
+    { argc--; argv++; }
+  if (argc && !strcmp (argv[0], "--verbose"))
+    {
+      verbose = 1;
+      argc--; argv++;
+    }
+
+  init_common_subsystems (&argc, &argv);
+  if (!gcry_check_version (NEED_LIBGCRYPT_VERSION))
+    die ("Libgcrypt is too old (need %s, have %s)\n",
+         NEED_LIBGCRYPT_VERSION, gcry_check_version (NULL));
+
+  fname = xasprintf ("t-keybox-%u.kbx", (unsigned int)getpid ());
+  idxfname = strconcat (fname, ".idx", NULL);
+  for (keyno=0; keyno < NKEYS; keyno++)
+    expected[keyno] = -1;
+
+  /* Create the keybox the same way gpg does.  */
+  fp = es_fopen (fname, "wb");
+  if (!fp)
+    die ("can't create '%s': %s\n", fname, strerror (errno));
+  err = _keybox_write_header_blob (fp, 1);
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (err)
+    die ("error creating '%s': %s\n", fname, gpg_strerror (err));
+
+  err = keybox_register_file (fname, 0, &token);
+  if (err)
+    die ("error registering '%s': %s\n", fname, gpg_strerror (err));
+
+  /* Insert, update and delete.  */
+  for (keyno=0; keyno < 4; keyno++)
+    insert_key (token, keyno, 0);
+  check_keys (token, "insert");
+  update_key (token, 1, 1);
+  check_keys (token, "update");
+  update_key (token, 1, 2);
+  delete_key (token, 2);
+  check_keys (token, "delete");
+  check_file ("delete");
+
+  /* An insert which has been interrupted while writing the blob.  The
+   * readers shall ignore the truncated blob and the next update
+   * shall remove it.  */
+  blob = make_blob (4, 0);
+  _keybox_get_blob_image (blob, &bloblen);
+  simulate_crash (blob, bloblen / 2, 0);
+  _keybox_release_blob (blob);
+  check_keys (token, "truncated insert");
+  insert_key (token, 5, 0);
+  check_keys (token, "recovered insert");
+  check_file ("recovered insert");
+
+  /* An update which has been interrupted after writing the blob.  The
+   * next update shall remove the old version.  */
+  blob = make_blob (3, 1);
+  simulate_crash (blob, (size_t)-1, blob_offset (3, 0));
+  _keybox_release_blob (blob);
+  insert_key (token, 6, 0);
+  expected[3] = 1;
+  check_keys (token, "recovered update");
+  check_file ("recovered update");
+
+  /* An update which has been interrupted while writing the blob.  The
+   * old version shall be kept.  */
+  blob = make_blob (0, 1);
+  _keybox_get_blob_image (blob, &bloblen);
+  simulate_crash (blob, bloblen - 1, blob_offset (0, 0));
+  _keybox_release_blob (blob);
+  check_keys (token, "truncated update");
+  update_key (token, 0, 2);
+  check_keys (token, "recovered truncated update");
+  check_file ("recovered truncated update");
+
+  gnupg_remove (fname);
+  gnupg_remove (idxfname);
+  xfree (fname);
+  xfree (idxfname);
+  return 0;
+}
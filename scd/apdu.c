@@ -60,6 +60,10 @@ struct dev_list {
 };
 
 #define MAX_READER 16 /* Number of readers we support concurrently. */
+
+/* The maximum data length of an extended length APDU we use if the
+   reader driver does not tell us better.  */
+#define DEFAULT_MAX_EXLEN 2048
                       /* See also MAX_DEVICE in ccid-driver.c.  */
 
 
@@ -86,8 +90,25 @@ static struct pcsc_global_data {
   HANDLE context;
   int count;
   const char *rdrname[MAX_READER];
+  int pnp_valid;          /* PNP_STATE is valid.  */
+  pcsc_dword_t pnp_state; /* State of the PnP notification reader.  */
 } pcsc;
 
+/* The PC/SC status monitor.  This thread waits for status changes of
+   the open PC/SC readers and kicks the main loop so that no periodic
+   polling of the card status is required.  */
+static struct
+{
+  HANDLE context;  /* The thread's own PC/SC context.  */
+  int running;     /* The thread is running.  */
+  int failed;      /* The monitor can't be used; poll the status.  */
+} pcsc_monitor;
+
+/* This flag is set if the list of readers may have changed since the
+   last call to apdu_dev_list_start or if not all readers found by it
+   are in use.  See apdu_dev_list_changed.  */
+static int dev_list_dirty = 1;
+
 /* A structure to collect information pertaining to one reader
    slot. */
 struct reader_table_s {
@@ -132,6 +153,11 @@ struct reader_table_s {
                                               supports variable length pinpad
                                               input.  */
   unsigned int require_get_status:1;
+  unsigned int no_exlen:1;  /* Extended length APDUs failed.  */
+  size_t max_exlen;         /* Max. length of extended length data as
+                               supported by the reader or 0.  */
+  unsigned long apdu_count; /* Number of APDUs sent to the reader.  */
+  unsigned long io_usec;    /* Microseconds spent in sending APDUs.  */
   unsigned char atr[33];
   size_t atrlen;           /* A zero length indicates that the ATR has
                               not yet been read; i.e. the card is not
@@ -206,6 +232,8 @@ static npth_mutex_t reader_table_lock;
 # define PCSC_STATE_UNPOWERED  0x0400  /* Card not powerred up.  */
 #endif
 
+#define PCSC_INFINITE          0xFFFFFFFF  /* Timeout value.  */
+
 /* Some PC/SC error codes.  */
 #define PCSC_E_CANCELLED               0x80100002
 #define PCSC_E_CANT_DISPOSE            0x8010000E
@@ -355,6 +383,7 @@ static int reset_pcsc_reader (int slot);
 static int apdu_get_status_internal (int slot, int hang, unsigned int *status,
                                      int on_wire);
 static int check_pcsc_pinpad (int slot, int command, pininfo_t *pininfo);
+static void pcsc_monitor_update (void);
 static int pcsc_pinpad_verify (int slot, int class, int ins, int p0, int p1,
                                pininfo_t *pininfo);
 static int pcsc_pinpad_modify (int slot, int class, int ins, int p0, int p1,
@@ -471,6 +500,10 @@ new_reader_slot (void)
   reader_table[reader].is_t0 = 1;
   reader_table[reader].pinpad_varlen_supported = 0;
   reader_table[reader].require_get_status = 1;
+  reader_table[reader].no_exlen = 0;
+  reader_table[reader].max_exlen = DEFAULT_MAX_EXLEN;
+  reader_table[reader].apdu_count = 0;
+  reader_table[reader].io_usec = 0;
   reader_table[reader].pcsc.verify_ioctl = 0;
   reader_table[reader].pcsc.modify_ioctl = 0;
   reader_table[reader].pcsc.pinmin = -1;
@@ -839,6 +872,45 @@ release_pcsc_context (void)
   log_assert (pcsc.context != 0);
   pcsc_release_context (pcsc.context);
   pcsc.context = 0;
+  pcsc.pnp_valid = 0;
+}
+
+
+/* Name of the PC/SC pseudo reader to watch for reader changes.  */
+#define PCSC_PNP_READER "\\\\?PnP?\\Notification"
+
+/* Query the PnP notification pseudo reader of PC/SC without waiting.
+   With INIT set remember its state.  Otherwise return 1 if the list
+   of readers has changed since that, 0 if not, and -1 if this is not
+   known.  */
+static int
+pcsc_pnp_check (int init)
+{
+  long err;
+  struct pcsc_readerstate_s rdrstates[1];
+
+  if (!pcsc.context || (!init && !pcsc.pnp_valid))
+    return -1;
+
+  memset (rdrstates, 0, sizeof *rdrstates);
+  rdrstates[0].reader = PCSC_PNP_READER;
+  rdrstates[0].current_state = init? PCSC_STATE_UNAWARE : pcsc.pnp_state;
+  err = pcsc_get_status_change (pcsc.context, 0, rdrstates, 1);
+  if (!init && err == PCSC_E_TIMEOUT)
+    return 0;
+  if (err || (rdrstates[0].event_state & PCSC_STATE_UNKNOWN))
+    {
+      /* PnP notifications are not supported.  */
+      pcsc.pnp_valid = 0;
+      return -1;
+    }
+  if (init)
+    {
+      pcsc.pnp_state = (rdrstates[0].event_state & ~PCSC_STATE_CHANGED);
+      pcsc.pnp_valid = 1;
+      return 0;
+    }
+  return !!(rdrstates[0].event_state & PCSC_STATE_CHANGED);
 }
 
 static int
@@ -849,6 +921,8 @@ close_pcsc_reader (int slot)
   log_assert (pcsc.count > 0);
   if (!--pcsc.count)
     release_pcsc_context ();
+  if (pcsc_monitor.running)
+    pcsc_monitor_update ();
   return 0;
 }
 
@@ -1233,6 +1307,145 @@ pcsc_init (void)
   return 0;
 }
 
+/* The thread function of the PC/SC status monitor.  */
+static void *
+pcsc_monitor_thread (void *arg)
+{
+  struct pcsc_readerstate_s rdrstates[MAX_READER];
+  char *rdrnames[MAX_READER];
+  int nrdr, slot, i, changed;
+  long err = 0;
+
+  (void)arg;
+
+  for (;;)
+    {
+      /* Collect the open PC/SC readers.  */
+      nrdr = 0;
+      npth_mutex_lock (&reader_table_lock);
+      for (slot = 0; slot < MAX_READER; slot++)
+        if (reader_table[slot].used
+            && reader_table[slot].connect_card == connect_pcsc_card
+            && reader_table[slot].rdrname
+            && (rdrnames[nrdr] = xtrystrdup (reader_table[slot].rdrname)))
+          {
+            memset (&rdrstates[nrdr], 0, sizeof *rdrstates);
+            rdrstates[nrdr].reader = rdrnames[nrdr];
+            rdrstates[nrdr].current_state = PCSC_STATE_UNAWARE;
+            nrdr++;
+          }
+      npth_mutex_unlock (&reader_table_lock);
+      if (!nrdr)
+        break;  /* No more readers - terminate.  */
+
+      /* Wait for changes until the set of readers changes; this is
+       * signaled by pcsc_cancel.  The first call returns immediately
+       * with the current state.  */
+      for (;;)
+        {
+          npth_unprotect ();
+          err = pcsc_get_status_change (pcsc_monitor.context, PCSC_INFINITE,
+                                        rdrstates, nrdr);
+          npth_protect ();
+          if (err == PCSC_E_TIMEOUT)
+            continue;
+          if (err)
+            break;
+
+          changed = 0;
+          for (i = 0; i < nrdr; i++)
+            if ((rdrstates[i].event_state & PCSC_STATE_CHANGED))
+              {
+                if (rdrstates[i].current_state != PCSC_STATE_UNAWARE)
+                  changed = 1;
+                rdrstates[i].current_state =
+                  (rdrstates[i].event_state & ~PCSC_STATE_CHANGED);
+              }
+          if (changed)
+            {
+              if (DBG_READER)
+                log_debug ("pcsc_monitor: status changed\n");
+              scd_kick_the_loop ();
+            }
+        }
+
+      for (i = 0; i < nrdr; i++)
+        xfree (rdrnames[i]);
+
+      if (err != PCSC_E_CANCELLED)
+        {
+          log_error ("pcsc_monitor: pcsc_get_status_change failed:"
+                     " %s (0x%lx) - falling back to polling\n",
+                     pcsc_error_string (err), err);
+          pcsc_monitor.failed = 1;
+          scd_kick_the_loop ();
+          break;
+        }
+    }
+
+  pcsc_release_context (pcsc_monitor.context);
+  pcsc_monitor.context = 0;
+  pcsc_monitor.running = 0;
+  return NULL;
+}
+
+
+/* Start the PC/SC status monitor or tell it that the set of readers
+   has changed.  */
+static void
+pcsc_monitor_update (void)
+{
+  npth_t thread;
+  npth_attr_t tattr;
+  long err;
+  int rc;
+
+  if (pcsc_monitor.failed)
+    return;
+
+  if (pcsc_monitor.running)
+    {
+      err = pcsc_cancel (pcsc_monitor.context);
+      if (err)
+        log_error ("pcsc_monitor: pcsc_cancel failed: %s (0x%lx)\n",
+                   pcsc_error_string (err), err);
+      return;
+    }
+
+  /* We need pcsc_cancel to notify the thread about new readers.  */
+  if (!pcsc_cancel)
+    {
+      pcsc_monitor.failed = 1;
+      return;
+    }
+
+  err = pcsc_establish_context (PCSC_SCOPE_SYSTEM, NULL, NULL,
+                                &pcsc_monitor.context);
+  if (err)
+    {
+      log_error ("pcsc_monitor: pcsc_establish_context failed: %s (0x%lx)\n",
+                 pcsc_error_string (err), err);
+      pcsc_monitor.failed = 1;
+      return;
+    }
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  rc = npth_create (&thread, &tattr, pcsc_monitor_thread, NULL);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    {
+      log_error ("pcsc_monitor: error spawning thread: %s\n", strerror (rc));
+      pcsc_release_context (pcsc_monitor.context);
+      pcsc_monitor.context = 0;
+      pcsc_monitor.failed = 1;
+      return;
+    }
+  npth_setname_np (thread, "pcsc-monitor");
+  pcsc_monitor.running = 1;
+}
+
+
 /* Open the PC/SC reader.  Returns -1 on error or a slot number for
    the reader.  */
 static int
@@ -1266,6 +1479,10 @@ open_pcsc_reader (const char *rdrname)
   reader_table[slot].send_apdu_reader = pcsc_send_apdu;
   reader_table[slot].dump_status_reader = dump_pcsc_reader_status;
 
+  /* With a running status monitor we don't need to poll.  */
+  pcsc_monitor_update ();
+  reader_table[slot].require_get_status = !pcsc_monitor.running;
+
   dump_reader_status (slot);
   unlock_slot (slot);
   return slot;
@@ -1681,6 +1898,7 @@ open_ccid_reader (struct dev_list *dl, int *r_cciderr)
      flag.  */
   reader_table[slot].is_t0 = 0;
   reader_table[slot].require_get_status = require_get_status;
+  reader_table[slot].max_exlen = ccid_get_max_exlen (slotp->ccid.handle);
 
   dump_reader_status (slot);
   unlock_slot (slot);
@@ -2004,6 +2222,7 @@ apdu_dev_list_start (const char *portstr, struct dev_list **l_p)
   dl->portstr = portstr;
   dl->idx = 0;
   dl->idx_max = 0;
+  dev_list_dirty = 0;
 
 #ifdef HAVE_LIBUSB
   if (!opt.disable_ccid)
@@ -2107,12 +2326,34 @@ apdu_dev_list_start (const char *portstr, struct dev_list **l_p)
        * called.
        */
       pcsc.count++;
+
+      pcsc_pnp_check (1);
     }
 
   *l_p = dl;
   return 0;
 }
 
+
+/* Return true if the list of readers may have changed since the last
+   call to apdu_dev_list_start or if a reader found by it is not in
+   use; i.e. a new scan for readers and cards is required.  Changes
+   are detected with hotplug notifications of libusb or PC/SC; if they
+   are not available true is always returned.  */
+int
+apdu_dev_list_changed (void)
+{
+  if (dev_list_dirty)
+    return 1;
+
+#ifdef HAVE_LIBUSB
+  if (!opt.disable_ccid)
+    return ccid_dev_list_changed ();
+#endif
+
+  return pcsc_pnp_check (0) != 0;
+}
+
 void
 apdu_dev_list_finish (struct dev_list *dl)
 {
@@ -2231,6 +2472,7 @@ apdu_open_reader (struct dev_list *dl)
                 {
                   /* Skip this reader.  */
                   log_error ("ccid open error: skip\n");
+                  dev_list_dirty = 1;
                   if (cciderr == CCID_DRIVER_ERR_USB_ACCESS)
                     log_info ("check permission of USB device at"
                               " Bus %03d Device %03d\n",
@@ -2292,6 +2534,7 @@ apdu_open_reader (struct dev_list *dl)
                 {
                   /* Skip this reader.  */
                   log_error ("pcsc open error: skip\n");
+                  dev_list_dirty = 1;
                   continue;
                 }
             }
@@ -2365,6 +2608,9 @@ apdu_close_reader (int slot)
         log_debug ("leave: apdu_close_reader => SW_HOST_NO_DRIVER\n");
       return SW_HOST_NO_DRIVER;
     }
+  /* An unused reader or an empty slot needs a new scan.  */
+  dev_list_dirty = 1;
+
   sw = apdu_disconnect (slot);
   if (sw)
     {
@@ -2508,6 +2754,20 @@ apdu_connect (int slot)
 }
 
 
+/* Return true if the status of the reader in SLOT needs to be polled
+   because no status monitor is available.  */
+int
+apdu_require_status_polling (int slot)
+{
+  if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used)
+    return 0;
+  if (reader_table[slot].require_get_status)
+    return 1;
+  return (reader_table[slot].connect_card == connect_pcsc_card
+          && !pcsc_monitor.running);
+}
+
+
 int
 apdu_disconnect (int slot)
 {
@@ -2657,6 +2917,114 @@ apdu_get_atr (int slot, size_t *atrlen)
 
 
 
+/* Return true if the ATR in (ATR,ATRLEN) announces support for
+   extended Lc and Le fields in the card capabilities of its
+   historical bytes.  */
+static int
+atr_has_exlen (const unsigned char *atr, size_t atrlen)
+{
+  size_t idx, nhist;
+  unsigned int y, tag, len;
+
+  if (atrlen < 2)
+    return 0;
+  nhist = (atr[1] & 0x0f);
+  y = (atr[1] & 0xf0);
+  idx = 2;
+  for (;;)
+    {
+      /* Skip the interface bytes TAi, TBi and TCi.  */
+      idx += !!(y & 0x10) + !!(y & 0x20) + !!(y & 0x40);
+      if (!(y & 0x80))
+        break;
+      if (idx >= atrlen)
+        return 0;
+      y = (atr[idx++] & 0xf0);  /* TDi.  */
+    }
+  if (!nhist || idx + nhist > atrlen)
+    return 0;
+  atr += idx;
+
+  /* Category indicator: With 0x00 the last 3 bytes are the status
+     indicator, with 0x80 only Compact-TLV objects follow.  */
+  if (*atr == 0x00 && nhist >= 4)
+    nhist -= 3;
+  else if (*atr != 0x80)
+    return 0;
+  atr++;
+  nhist--;
+
+  while (nhist)
+    {
+      tag = (*atr >> 4);
+      len = (*atr & 0x0f);
+      if (len + 1 > nhist)
+        return 0;
+      if (tag == 7 && len == 3)
+        return !!(atr[3] & 0x40);  /* Card capabilities.  */
+      atr += len + 1;
+      nhist -= len + 1;
+    }
+  return 0;
+}
+
+
+/* Return the maximum length of the data in an extended length APDU
+   which may be used with the reader and card in SLOT.  Returns 0 if
+   not both, the reader and the card, support extended length APDUs
+   or if their use has been disabled by apdu_disable_exlen.  */
+size_t
+apdu_get_max_exlen (int slot)
+{
+  reader_table_t slotp;
+
+  if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used)
+    return 0;
+  slotp = reader_table + slot;
+  if (slotp->is_t0 || slotp->no_exlen || !slotp->atrlen
+      || !atr_has_exlen (slotp->atr, slotp->atrlen))
+    return 0;
+  return slotp->max_exlen;
+}
+
+
+/* Disable the automatic use of extended length APDUs for SLOT.  This
+   is used if the card or reader failed to process one.  */
+void
+apdu_disable_exlen (int slot)
+{
+  if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used)
+    return;
+  if (!reader_table[slot].no_exlen)
+    log_info ("slot %d: disabling extended length APDUs\n", slot);
+  reader_table[slot].no_exlen = 1;
+}
+
+
+/* Return the number of APDUs sent to the reader in SLOT.  This
+   includes chained commands and GET RESPONSE commands.  */
+unsigned long
+apdu_get_apdu_count (int slot)
+{
+  if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used)
+    return 0;
+  return reader_table[slot].apdu_count;
+}
+
+
+/* Return the accumulated time in microseconds the reader in SLOT
+   needed to process the APDUs.  This is the time spent in the
+   driver and thus includes the I/O to the reader and the processing
+   time of the card.  */
+unsigned long
+apdu_get_io_time (int slot)
+{
+  if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used)
+    return 0;
+  return reader_table[slot].io_usec;
+}
+
+
 /* Retrieve the status for SLOT. The function does only wait for the
    card to become available if HANG is set to true. On success the
    bits in STATUS will be set to
@@ -2804,11 +3172,29 @@ send_apdu (int slot, unsigned char *apdu, size_t apdulen,
   if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used )
     return SW_HOST_NO_DRIVER;
 
+  reader_table[slot].apdu_count++;
   if (reader_table[slot].send_apdu_reader)
-    return reader_table[slot].send_apdu_reader (slot,
+    {
+      int sw;
+#ifdef USE_NPTH
+      struct timespec start, now;
+      long usec;
+
+      npth_clock_gettime (&start);
+#endif
+      sw = reader_table[slot].send_apdu_reader (slot,
                                                 apdu, apdulen,
                                                 buffer, buflen,
                                                 pininfo);
+#ifdef USE_NPTH
+      npth_clock_gettime (&now);
+      usec = ((now.tv_sec - start.tv_sec) * 1000000
+              + (now.tv_nsec - start.tv_nsec) / 1000);
+      if (usec > 0)
+        reader_table[slot].io_usec += usec;
+#endif
+      return sw;
+    }
   else
     return SW_HOST_NOT_SUPPORTED;
 }
@@ -103,6 +103,7 @@ gpg_error_t apdu_init (void);
 
 gpg_error_t apdu_dev_list_start (const char *portstr, struct dev_list **l_p);
 void apdu_dev_list_finish (struct dev_list *l);
+int apdu_dev_list_changed (void);
 
 /* Note, that apdu_open_reader returns no status word but -1 on error. */
 int apdu_open_reader (struct dev_list *l);
@@ -120,6 +121,10 @@ int apdu_close_reader (int slot);
 void apdu_prepare_exit (void);
 int apdu_enum_reader (int slot, int *used);
 unsigned char *apdu_get_atr (int slot, size_t *atrlen);
+size_t apdu_get_max_exlen (int slot);
+void apdu_disable_exlen (int slot);
+unsigned long apdu_get_apdu_count (int slot);
+unsigned long apdu_get_io_time (int slot);
 
 const char *apdu_strerror (int rc);
 
@@ -128,6 +133,7 @@ const char *apdu_strerror (int rc);
 
 int apdu_connect (int slot);
 int apdu_disconnect (int slot);
+int apdu_require_status_polling (int slot);
 
 int apdu_set_progress_cb (int slot, gcry_handler_progress_t cb, void *cb_arg);
 int apdu_set_prompt_cb (int slot, void (*cb) (void *, int), void *cb_arg);
@@ -81,6 +81,7 @@ typedef enum
 struct card_ctx_s;
 struct app_ctx_s;
 struct app_local_s;  /* Defined by all app-*.c.  */
+struct card_cache_item_s;  /* Defined in app.c.  */
 
 
 typedef struct card_ctx_s *card_t;
@@ -103,6 +104,10 @@ struct card_ctx_s {
 
   unsigned int card_status;
 
+  /* The APDU counter of the reader at the time the card was locked;
+   * used for debug output.  */
+  unsigned long apdu_count;
+
   /* The serial number is associated with the card and not with a
    * specific app.  If a card uses different serial numbers for its
    * applications, our code picks the serial number of a specific
@@ -116,10 +121,15 @@ struct card_ctx_s {
    * put the active app at the head of the list.  */
   app_t app;
 
+  /* A list of certificates and public keys read from the card.  This
+   * avoids re-reading them over slow APDUs; see card_cache_get.  */
+  struct card_cache_item_s *cache;
+
   /* Various flags.  */
   unsigned int reset_requested:1;
   unsigned int periodical_check_needed:1;
   unsigned int maybe_check_aid:1;
+  unsigned int removed:1;  /* Card has been removed; to be released.  */
 };
 
 
@@ -245,6 +255,7 @@ const char *strapptype (apptype_t t);
 
 void app_update_priority_list (const char *arg);
 gpg_error_t app_send_card_list (ctrl_t ctrl);
+void app_metrics (metrics_writer_t w);
 gpg_error_t app_send_active_apps (card_t card, ctrl_t ctrl);
 char *card_get_serialno (card_t card);
 char *app_get_serialno (app_t app);
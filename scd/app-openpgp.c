@@ -221,6 +221,7 @@ struct app_local_s {
   struct
   {
     unsigned int cache_6e:1;
+    unsigned int batch;  /* Nesting level of begin_do_batch.  */
   } override;
 
   /* Keep track on whether we cache a certain PIN so that we get it
@@ -421,6 +422,8 @@ get_cached_data (app_t app, int tag,
 
   if (tag == 0x6E && app->app_local->override.cache_6e)
     get_immediate = 0;
+  else if (app->app_local->override.batch)
+    get_immediate = 0;
 
   if (!get_immediate)
     {
@@ -603,6 +606,43 @@ flush_cache (app_t app)
 }
 
 
+/* Start a batch of DO accesses.  The constructed DOs are read once
+   from the card and all DOs, including those which are marked as
+   dont_cache, are then taken from the cache until the matching
+   end_do_batch.  This reduces a LEARN to a few GET DATA commands.
+   Batches may be nested.  */
+static void
+begin_do_batch (app_t app)
+{
+  static const int tags[] = { 0x6E, 0x65, 0x7A };
+  unsigned char *buffer;
+  size_t buflen;
+  int i;
+
+  if (app->app_local->override.batch++)
+    return;
+
+  /* Make sure that volatile data like the PIN counters and the
+     signature counter are fresh.  */
+  flush_cache_item (app, 0x6E);
+  flush_cache_item (app, 0x7A);
+  for (i=0; i < DIM (tags); i++)
+    if (!get_cached_data (app, tags[i], &buffer, &buflen, 0, 0))
+      xfree (buffer);
+}
+
+
+/* End a batch started with begin_do_batch.  The cached constructed
+   DOs are kept but their dont_cache members are again read from the
+   card.  */
+static void
+end_do_batch (app_t app)
+{
+  if (app->app_local->override.batch)
+    app->app_local->override.batch--;
+}
+
+
 /* Get the DO identified by TAG from the card in SLOT and return a
    buffer with its content in RESULT and NBYTES.  The return value is
    NULL if not found or a pointer which must be used to release the
@@ -628,7 +668,8 @@ get_one_do (app_t app, int tag, unsigned char **result, size_t *nbytes,
   for (i=0; data_objects[i].tag && data_objects[i].tag != tag; i++)
     ;
 
-  if (app->appversion > 0x0100 && data_objects[i].get_immediate_in_v11)
+  if (app->appversion > 0x0100 && data_objects[i].get_immediate_in_v11
+      && !app->app_local->override.batch)
     {
       exmode = 0;
       rc = iso7816_get_data (app_get_slot (app), exmode, tag, &buffer, &buflen);
@@ -2193,6 +2234,8 @@ do_learn_status (app_t app, ctrl_t ctrl, unsigned int flags)
 
   (void)flags;
 
+  begin_do_batch (app);
+
   err = do_getattr (app, ctrl, "EXTCAP");
   if (!err)
     err = do_getattr (app, ctrl, "MANUFACTURER");
@@ -2257,6 +2300,7 @@ do_learn_status (app_t app, ctrl_t ctrl, unsigned int flags)
     err = send_keypair_info (app, ctrl, 3);
   if (gpg_err_code (err) == GPG_ERR_NO_OBJ)
     err = 0;
+  end_do_batch (app);
   /* Note: We do not send the Cardholder Certificate, because that is
      relatively long and for OpenPGP applications not really needed.  */
   return err;
@@ -2635,11 +2679,14 @@ cache_pin (app_t app, ctrl_t ctrl, int chvno, const char *pin)
   if (!keyref)
     return;
 
-  switch (APP_CARD(app)->cardtype)
-    {
-    case CARDTYPE_YUBIKEY: break;
-    default: return;
-    }
+  /* Caching is generally only used for Yubikeys but works for all
+   * cards during a batch session.  */
+  if (!pincache_batch_p (ctrl))
+    switch (APP_CARD(app)->cardtype)
+      {
+      case CARDTYPE_YUBIKEY: break;
+      default: return;
+      }
 
   pincache_put (ctrl, app_get_slot (app), "openpgp", keyref,
                 pin, pin? strlen (pin):0);
@@ -2666,11 +2713,12 @@ pin_from_cache (app_t app, ctrl_t ctrl, int chvno, char **r_pin)
 
   if (!keyref)
     return 0;
-  switch (APP_CARD(app)->cardtype)
-    {
-    case CARDTYPE_YUBIKEY: break;
-    default: return 0;
-    }
+  if (!pincache_batch_p (ctrl))
+    switch (APP_CARD(app)->cardtype)
+      {
+      case CARDTYPE_YUBIKEY: break;
+      default: return 0;
+      }
 
   switch (chvno)
     {
@@ -5532,8 +5580,11 @@ do_sign (app_t app, ctrl_t ctrl, const char *keyidstr, int hashalgo,
     clear_chv_status (app, ctrl, 1);
   else if (!rc && app->force_chv1)
     {
+      /* The card requires a new verification.  In a batch session we
+       * keep the PIN so that this can be done without the user.  */
       app->did_chv1 = 0;
-      cache_pin (app, ctrl, 1, NULL);
+      if (!pincache_batch_p (ctrl))
+        cache_pin (app, ctrl, 1, NULL);
     }
 
   return rc;
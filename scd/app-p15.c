@@ -462,6 +462,23 @@ struct aodf_object_s
 typedef struct aodf_object_s *aodf_object_t;
 
 
+/* An item of the persistent directory cache.  This stores the
+ * result of reading an EF or a record of it while parsing the PKCS#15
+ * structure.  */
+struct dircache_item_s
+{
+  struct dircache_item_s *next;
+  unsigned int used:1;     /* Item has been used for this card.  */
+  unsigned short efid;     /* The EF this item belongs to.  */
+  int recno;               /* The record number or 0 for binary.  */
+  gpg_err_code_t ec;       /* The error code returned by the read.  */
+  int sw;                  /* The status word in case of an error.  */
+  size_t datalen;          /* Length of DATA.  */
+  unsigned char data[1];   /* The content with DATALEN bytes.  */
+};
+typedef struct dircache_item_s *dircache_item_t;
+
+
 /* Context local to this application. */
 struct app_local_s
 {
@@ -532,6 +549,18 @@ struct app_local_s
   /* Information on all authentication objects. */
   aodf_object_t auth_object_info;
 
+  /* State of the persistent directory cache.  This is only active
+   * while read_p15_info runs.  */
+  struct
+  {
+    int mode;                      /* 0 = off, 1 = record, 2 = replay. */
+    unsigned int no_load:1;        /* Do not use an existing cache.  */
+    unsigned int skipped_select:1; /* The select of EFID was skipped.  */
+    unsigned short efid;           /* The currently selected EF.  */
+    char *fname;                   /* Malloced name of the cache file.  */
+    unsigned char hash[32];        /* Hash over TokenInfo and ODF.  */
+    dircache_item_t items;         /* The cached items.  */
+  } dircache;
 };
 
 
@@ -543,6 +572,7 @@ static gpg_error_t readcert_by_cdf (app_t app, cdf_object_t cdf,
                                     unsigned char **r_cert, size_t *r_certlen);
 static char *get_dispserialno (app_t app, prkdf_object_t prkdf);
 static gpg_error_t do_getattr (app_t app, ctrl_t ctrl, const char *name);
+static void dircache_release (app_t app);
 
 
 
@@ -687,12 +717,306 @@ do_deinit (app_t app)
     {
       release_lists (app);
       release_tokeninfo (app);
+      dircache_release (app);
       xfree (app->app_local);
       app->app_local = NULL;
     }
 }
 
 
+/* Release the directory cache state of APP.  */
+static void
+dircache_release (app_t app)
+{
+  dircache_item_t item;
+
+  while ((item = app->app_local->dircache.items))
+    {
+      app->app_local->dircache.items = item->next;
+      xfree (item);
+    }
+  xfree (app->app_local->dircache.fname);
+  app->app_local->dircache.fname = NULL;
+  app->app_local->dircache.mode = 0;
+  app->app_local->dircache.skipped_select = 0;
+}
+
+
+/* Start recording the reads of the directory files.  If NO_LOAD is
+ * set an existing cache file will not be used but overwritten.  */
+static void
+dircache_begin (app_t app, int no_load)
+{
+  dircache_release (app);
+  app->app_local->dircache.mode = 1;
+  app->app_local->dircache.no_load = !!no_load;
+  app->app_local->dircache.efid = 0;
+}
+
+
+/* Add an item for the current EF and record RECNO to the cache.  EC
+ * and SW describe an error, DATA and DATALEN the content read.  */
+static void
+dircache_put (app_t app, int recno, gpg_err_code_t ec, int sw,
+              const unsigned char *data, size_t datalen)
+{
+  dircache_item_t item;
+
+  if (app->app_local->dircache.mode != 1)
+    return;
+
+  if (ec)
+    datalen = 0;
+  item = xtrymalloc (sizeof *item + datalen);
+  if (!item)
+    {
+      /* We can't cache an incomplete structure; thus stop caching.  */
+      dircache_release (app);
+      return;
+    }
+  item->used = 1;
+  item->efid = app->app_local->dircache.efid;
+  item->recno = recno;
+  item->ec = ec;
+  item->sw = sw;
+  item->datalen = datalen;
+  if (datalen)
+    memcpy (item->data, data, datalen);
+  item->next = app->app_local->dircache.items;
+  app->app_local->dircache.items = item;
+}
+
+
+/* Look up the current EF and record RECNO in the cache.  If found,
+ * return true and store the result of the read at R_ERR, R_SW,
+ * R_BUFFER and R_BUFLEN the same way as select_and_read_binary
+ * does.  If not found, switch to recording mode so that the cache
+ * will be updated.  */
+static int
+dircache_get (app_t app, int recno, gpg_error_t *r_err, int *r_sw,
+              unsigned char **r_buffer, size_t *r_buflen)
+{
+  dircache_item_t item;
+
+  if (app->app_local->dircache.mode != 2)
+    return 0;
+
+  for (item = app->app_local->dircache.items; item; item = item->next)
+    if (item->efid == app->app_local->dircache.efid && item->recno == recno)
+      break;
+  if (!item)
+    {
+      app->app_local->dircache.mode = 1;
+      return 0;
+    }
+
+  item->used = 1;
+  *r_sw = item->sw;
+  if (item->ec)
+    {
+      *r_err = gpg_error (item->ec);
+      return 1;
+    }
+  *r_buffer = xtrymalloc (item->datalen? item->datalen : 1);
+  if (!*r_buffer)
+    *r_err = gpg_error_from_syserror ();
+  else
+    {
+      memcpy (*r_buffer, item->data, item->datalen);
+      *r_buflen = item->datalen;
+      *r_err = 0;
+    }
+  return 1;
+}
+
+
+/* Compute the hash over the items recorded so far; i.e. TokenInfo
+ * and ODF, and load the cache file of the card if that hash matches
+ * the one stored in the file.  */
+static void
+dircache_load (app_t app)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+  dircache_item_t item, newitem;
+  unsigned char buf[3];
+  char *hexsn, *fname;
+  estream_t fp;
+  char *line = NULL;
+  size_t linelen = 0;
+  ssize_t len;
+  int lnr = 0;
+  char *p, *endp;
+  unsigned long efid;
+  long recno;
+  unsigned long ec, sw;
+  int n;
+
+  if (app->app_local->dircache.mode != 1 || !APP_CARD(app)->serialno)
+    return;
+
+  err = gcry_md_open (&md, GCRY_MD_SHA256, 0);
+  if (err)
+    {
+      dircache_release (app);
+      return;
+    }
+  for (item = app->app_local->dircache.items; item; item = item->next)
+    {
+      buf[0] = item->efid >> 8;
+      buf[1] = item->efid;
+      buf[2] = item->recno;
+      gcry_md_write (md, buf, 3);
+      gcry_md_write (md, item->data, item->datalen);
+    }
+  memcpy (app->app_local->dircache.hash, gcry_md_read (md, 0), 32);
+  gcry_md_close (md);
+
+  hexsn = bin2hex (APP_CARD(app)->serialno, APP_CARD(app)->serialnolen, NULL);
+  if (!hexsn)
+    {
+      dircache_release (app);
+      return;
+    }
+  fname = strconcat ("p15cache-", hexsn, NULL);
+  xfree (hexsn);
+  if (fname)
+    {
+      app->app_local->dircache.fname = make_filename (gnupg_homedir (),
+                                                      fname, NULL);
+      xfree (fname);
+    }
+  if (!app->app_local->dircache.fname)
+    {
+      dircache_release (app);
+      return;
+    }
+
+  if (app->app_local->dircache.no_load)
+    return;
+
+  fp = es_fopen (app->app_local->dircache.fname, "r");
+  if (!fp)
+    return;  /* Not yet cached.  */
+
+  newitem = NULL;
+  while ((len = es_read_line (fp, &line, &linelen, NULL)) > 0)
+    {
+      lnr++;
+      if (line[len-1] == '\n')
+        line[--len] = 0;
+      if (lnr == 1)
+        {
+          if (strncmp (line, "P15DIRCACHE 1 ", 14)
+              || len != 14 + 64
+              || !(p = bin2hex (app->app_local->dircache.hash, 32, NULL)))
+            break;
+          n = !ascii_strcasecmp (line + 14, p);
+          xfree (p);
+          if (!n)
+            {
+              if (opt.verbose)
+                log_info ("p15: directory cache of card is outdated\n");
+              break;
+            }
+          continue;
+        }
+
+      /* Parse a line "EFID RECNO EC SW HEXDATA".  */
+      errno = 0;
+      efid = strtoul (line, &endp, 16);
+      recno = strtol (endp, &endp, 10);
+      ec = strtoul (endp, &endp, 10);
+      sw = strtoul (endp, &endp, 16);
+      if (errno || *endp != ' ' || efid > 0xffff || recno < 0)
+        goto bad;
+      p = endp + 1;
+      n = strlen (p);
+      if ((n & 1))
+        goto bad;
+      newitem = xtrymalloc (sizeof *newitem + n/2);
+      if (!newitem)
+        goto bad;
+      if (hex2bin (p, newitem->data, n/2) != n)
+        goto bad;
+      newitem->used = 0;
+      newitem->efid = efid;
+      newitem->recno = recno;
+      newitem->ec = ec;
+      newitem->sw = sw;
+      newitem->datalen = n/2;
+      /* Append so that the live items are found first.  */
+      for (item = app->app_local->dircache.items; item->next;
+           item = item->next)
+        ;
+      item->next = newitem;
+      newitem = NULL;
+    }
+  if (lnr > 1 && len >= 0 && !es_ferror (fp))
+    {
+      if (opt.verbose)
+        log_info ("p15: using directory cache '%s'\n",
+                  app->app_local->dircache.fname);
+      app->app_local->dircache.mode = 2;
+    }
+  goto leave;
+
+ bad:
+  xfree (newitem);
+  log_info ("p15: invalid directory cache '%s' at line %d - ignored\n",
+            app->app_local->dircache.fname, lnr);
+
+ leave:
+  es_free (line);
+  es_fclose (fp);
+}
+
+
+/* Write the cache file if the cache has been updated.  */
+static void
+dircache_save (app_t app)
+{
+  dircache_item_t item;
+  estream_t fp;
+  char *p;
+
+  if (app->app_local->dircache.mode != 1 || !app->app_local->dircache.fname)
+    return;
+
+  fp = es_fopen (app->app_local->dircache.fname, "w");
+  if (!fp)
+    {
+      log_info ("p15: can't create '%s': %s\n",
+                app->app_local->dircache.fname,
+                gpg_strerror (gpg_error_from_syserror ()));
+      return;
+    }
+  p = bin2hex (app->app_local->dircache.hash, 32, NULL);
+  if (p)
+    es_fprintf (fp, "P15DIRCACHE 1 %s\n", p);
+  xfree (p);
+  for (item = app->app_local->dircache.items; p && item; item = item->next)
+    {
+      if (!item->used)
+        continue;
+      es_fprintf (fp, "%04X %d %u %04X ",
+                  item->efid, item->recno, (unsigned int)item->ec, item->sw);
+      p = bin2hex (item->data, item->datalen, NULL);
+      if (p)
+        es_fprintf (fp, "%s\n", p);
+      xfree (p);
+    }
+  if (!p || es_ferror (fp))
+    {
+      es_fclose (fp);
+      gnupg_remove (app->app_local->dircache.fname);
+      return;
+    }
+  if (es_fclose (fp))
+    gnupg_remove (app->app_local->dircache.fname);
+}
+
+
 /* Do a select and a read for the file with EFID.  EFID_DESC is a
    desctription of the EF to be used with error messages.  On success
    BUFFER and BUFLEN contain the entire content of the EF.  The caller
@@ -704,8 +1028,20 @@ select_and_read_binary (app_t app, unsigned short efid, const char *efid_desc,
   gpg_error_t err;
   int sw;
 
+  if (efid)
+    app->app_local->dircache.efid = efid;
+  if (dircache_get (app, 0, &err, &sw, buffer, buflen))
+    {
+      if (efid)
+        app->app_local->dircache.skipped_select = 1;
+      return err;
+    }
+  if (!efid && app->app_local->dircache.skipped_select)
+    efid = app->app_local->dircache.efid;
+
   if (efid)
     {
+      app->app_local->dircache.skipped_select = 0;
       err = select_ef_by_path (app, &efid, 1);
       if (err)
         {
@@ -718,8 +1054,13 @@ select_and_read_binary (app_t app, unsigned short efid, const char *efid_desc,
   err = iso7816_read_binary_ext (app_get_slot (app),
                                  0, 0, 0, buffer, buflen, &sw);
   if (err)
-    log_error ("p15: error reading %s (0x%04X): %s (sw=%04X)\n",
-               efid_desc, efid, gpg_strerror (err), sw);
+    {
+      log_error ("p15: error reading %s (0x%04X): %s (sw=%04X)\n",
+                 efid_desc, efid, gpg_strerror (err), sw);
+      dircache_put (app, 0, gpg_err_code (err), sw, NULL, 0);
+    }
+  else
+    dircache_put (app, 0, 0, 0, *buffer, *buflen);
   return err;
 }
 
@@ -740,7 +1081,21 @@ select_and_read_record (app_t app, unsigned short efid, int recno,
     *r_sw = 0x9000;
 
   if (efid)
+    app->app_local->dircache.efid = efid;
+  if (dircache_get (app, recno, &err, &sw, buffer, buflen))
     {
+      if (efid)
+        app->app_local->dircache.skipped_select = 1;
+      if (r_sw && err)
+        *r_sw = sw;
+      return err;
+    }
+  if (!efid && app->app_local->dircache.skipped_select)
+    efid = app->app_local->dircache.efid;
+
+  if (efid)
+    {
+      app->app_local->dircache.skipped_select = 0;
       err = select_ef_by_path (app, &efid, 1);
       if (err)
         {
@@ -763,6 +1118,7 @@ select_and_read_record (app_t app, unsigned short efid, int recno,
       else
         log_error ("p15: error reading %s (0x%04X) record %d: %s (sw=%04X)\n",
                    efid_desc, efid, recno, gpg_strerror (err), sw);
+      dircache_put (app, recno, gpg_err_code (err), sw, NULL, 0);
       if (r_sw)
         *r_sw = sw;
       return err;
@@ -784,6 +1140,7 @@ select_and_read_record (app_t app, unsigned short efid, int recno,
       *buflen = *buflen - 2;
     }
 
+  dircache_put (app, recno, 0, 0, *buffer, *buflen);
   return 0;
 }
 
@@ -3651,7 +4008,7 @@ read_ef_tokeninfo (app_t app)
    structure and initialize our local context.  This is used once at
    application initialization. */
 static gpg_error_t
-read_p15_info (app_t app)
+read_p15_info_core (app_t app)
 {
   gpg_error_t err;
   prkdf_object_t prkdf;
@@ -3701,6 +4058,10 @@ read_p15_info (app_t app)
   if (err)
     return err;
 
+  /* Now that we have TokenInfo and ODF we can check whether the
+   * directory files are available from the cache.  */
+  dircache_load (app);
+
   /* Read certificate information. */
   log_assert (!app->app_local->certificate_info);
   log_assert (!app->app_local->trusted_certificate_info);
@@ -4015,6 +4376,27 @@ read_p15_info (app_t app)
 }
 
 
+/* Wrapper around read_p15_info_core to make use of the persistent
+ * directory cache.  Parsing the PKCS#15 structure requires to read
+ * all directory files which may take several seconds on some cards.
+ * Thus we store what we read in the homedir, keyed by the serial
+ * number of the card and validated by a hash over EF(TokenInfo) and
+ * EF(ODF) which are always read from the card.  If REREAD is set an
+ * existing cache is ignored and replaced.  */
+static gpg_error_t
+read_p15_info (app_t app, int reread)
+{
+  gpg_error_t err;
+
+  dircache_begin (app, reread);
+  err = read_p15_info_core (app);
+  if (!err)
+    dircache_save (app);
+  dircache_release (app);
+  return err;
+}
+
+
 /* Helper to do_learn_status: Send information about all certificates
    listed in CERTINFO back.  Use CERTTYPE as type of the
    certificate. */
@@ -4336,7 +4718,7 @@ do_learn_status (app_t app, ctrl_t ctrl, unsigned int flags)
 
   if (flags & APP_LEARN_FLAG_REREAD)
     {
-      err = read_p15_info (app);
+      err = read_p15_info (app, 1);
       if (err)
         return err;
     }
@@ -6552,7 +6934,7 @@ app_select_p15 (app_t app)
 
       /* Read basic information and thus check whether this is a real
          card.  */
-      rc = read_p15_info (app);
+      rc = read_p15_info (app, 0);
       if (rc)
         goto leave;
 
@@ -1686,11 +1686,14 @@ cache_pin (app_t app, ctrl_t ctrl, int pinno,
 
   if (pinno < 0)
     return;
-  switch (app->card->cardtype)
-    {
-    case CARDTYPE_YUBIKEY: break;
-    default: return;
-    }
+  /* Caching is generally only used for Yubikeys but works for all
+   * cards during a batch session.  */
+  if (!pincache_batch_p (ctrl))
+    switch (app->card->cardtype)
+      {
+      case CARDTYPE_YUBIKEY: break;
+      default: return;
+      }
 
 
 
@@ -1724,11 +1727,12 @@ pin_from_cache (app_t app, ctrl_t ctrl, int pinno, char **r_pin)
 
   if (pinno < 0)
     return 0;
-  switch (app->card->cardtype)
-    {
-    case CARDTYPE_YUBIKEY: break;
-    default: return 0;
-    }
+  if (!pincache_batch_p (ctrl))
+    switch (app->card->cardtype)
+      {
+      case CARDTYPE_YUBIKEY: break;
+      default: return 0;
+      }
 
   switch (pinno)
     {
@@ -1966,7 +1970,10 @@ verify_chv (app_t app, ctrl_t ctrl, int keyref, int force,
     remaining = -1;
 
 
-  err = ask_and_prepare_chv (app, ctrl, keyref, 0, remaining, force,
+  /* A forced verification must not use a cached PIN unless we are in
+   * a batch session.  */
+  err = ask_and_prepare_chv (app, ctrl, keyref, 0, remaining,
+                             force && !pincache_batch_p (ctrl),
                              pincb, pincb_arg,
                              &pin, &pinlen, &unpaddedpinlen);
   if (err)
@@ -43,6 +43,7 @@ select_additional_application_internal (card_t card, apptype_t req_apptype);
 static gpg_error_t
 send_serialno_and_app_status (card_t card, int with_apps, ctrl_t ctrl);
 static gpg_error_t run_reselect (ctrl_t ctrl, card_t c, app_t a, app_t a_prev);
+static void card_cache_flush (card_t card);
 
 /*
  * Multiple readers, single writer (MRSW) lock.
@@ -89,6 +90,32 @@ static struct mrsw_lock card_list_lock;
 static card_t card_top;
 
 
+/* An item of the per-card object cache.  The cache stores the
+ * certificates returned by app_readcert and the public keys returned
+ * by app_readkey so that repeated requests (e.g. gpg --card-status or
+ * gpgsm --learn-card) do not need to transfer them again over slow
+ * APDUs.  The items are keyed by the application type and the object
+ * ID; the serial number is stored too so that a re-munged or changed
+ * serial number never returns a stale object.  The cache is flushed
+ * on card removal, reset and after any operation which may modify
+ * the objects on the card.  */
+struct card_cache_item_s
+{
+  struct card_cache_item_s *next;
+  apptype_t apptype;
+  int is_key;               /* Object is a public key.  */
+  unsigned char *serialno;  /* Copy of the card's serialno.  */
+  size_t serialnolen;
+  size_t datalen;
+  unsigned char *data;
+  char objid[1];            /* Object ID as given to readcert/readkey.  */
+};
+typedef struct card_cache_item_s *card_cache_item_t;
+
+/* Maximum number of objects cached per card.  */
+#define CARD_CACHE_MAX_ITEMS 32
+
+
 /* The list of application names and their select function.  If no
  * specific application is selected the first available application on
  * a card is selected.  */
@@ -311,6 +338,32 @@ lock_card (card_t card, ctrl_t ctrl)
 
   apdu_set_progress_cb (card->slot, print_progress_line, ctrl);
   apdu_set_prompt_cb (card->slot, popup_prompt, ctrl);
+  card->apdu_count = apdu_get_apdu_count (card->slot);
+
+  return 0;
+}
+
+
+/* Same as lock_card but return GPG_ERR_EBUSY instead of waiting if
+ * the CARD is currently locked by another connection.  */
+static gpg_error_t
+trylock_card (card_t card, ctrl_t ctrl)
+{
+  int res;
+
+  res = npth_mutex_trylock (&card->lock);
+  if (res)
+    {
+      if (res == EBUSY)
+        return gpg_error (GPG_ERR_EBUSY);
+      log_error ("failed to acquire CARD lock for %p: %s\n",
+                 card, strerror (res));
+      return gpg_error_from_errno (res);
+    }
+
+  apdu_set_progress_cb (card->slot, print_progress_line, ctrl);
+  apdu_set_prompt_cb (card->slot, popup_prompt, ctrl);
+  card->apdu_count = apdu_get_apdu_count (card->slot);
 
   return 0;
 }
@@ -320,6 +373,19 @@ lock_card (card_t card, ctrl_t ctrl)
 static void
 unlock_card (card_t card)
 {
+  if (DBG_APP)
+    {
+      unsigned long n = apdu_get_apdu_count (card->slot);
+
+      /* Note that the counter is 0 for an already closed reader.  */
+      if (n > card->apdu_count)
+        {
+          n -= card->apdu_count;
+          log_debug ("slot %d: %lu APDU%s sent\n",
+                     card->slot, n, n == 1? "":"s");
+        }
+    }
+
   apdu_set_progress_cb (card->slot, NULL, NULL);
   apdu_set_prompt_cb (card->slot, NULL, NULL);
 
@@ -626,6 +692,7 @@ card_reset (card_t card)
   gpg_error_t err = 0;
   int sw;
 
+  card_cache_flush (card);
   sw = apdu_reset (card->slot);
   if (sw)
     err = gpg_error (GPG_ERR_CARD_RESET);
@@ -944,7 +1011,10 @@ select_application (ctrl_t ctrl, const char *name,
 
   ctrl->card_ctx = NULL;
 
-  if (scan || !card_top)
+  /* Scanning the devices is costly.  Thus we skip it if the devices
+   * have not changed since the last scan and all found readers are
+   * in use.  */
+  if ((scan || !card_top) && (!card_top || apdu_dev_list_changed ()))
     {
       struct dev_list *l;
       int new_card = 0;
@@ -1302,6 +1372,116 @@ get_supported_applications (void)
 }
 
 
+/* Release all items of the object cache of CARD.  */
+static void
+card_cache_flush (card_t card)
+{
+  card_cache_item_t item, next;
+
+  for (item = card->cache; item; item = next)
+    {
+      next = item->next;
+      xfree (item->serialno);
+      xfree (item->data);
+      xfree (item);
+    }
+  card->cache = NULL;
+}
+
+
+/* Look up the object OBJID of the current app of CARD in the object
+ * cache.  IS_KEY selects between public keys and certificates.  On
+ * success a copy of the object is stored at R_DATA and R_DATALEN and
+ * 0 is returned; if the object is not cached GPG_ERR_NOT_FOUND is
+ * returned.  */
+static gpg_error_t
+card_cache_get (card_t card, int is_key, const char *objid,
+                unsigned char **r_data, size_t *r_datalen)
+{
+  card_cache_item_t item;
+
+  for (item = card->cache; item; item = item->next)
+    if (item->is_key == is_key
+        && item->apptype == card->app->apptype
+        && !strcmp (item->objid, objid)
+        && item->serialnolen == card->serialnolen
+        && (!card->serialnolen
+            || !memcmp (item->serialno, card->serialno, card->serialnolen)))
+      break;
+  if (!item)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  *r_data = xtrymalloc (item->datalen? item->datalen : 1);
+  if (!*r_data)
+    return gpg_error_from_syserror ();
+  memcpy (*r_data, item->data, item->datalen);
+  *r_datalen = item->datalen;
+  if (DBG_APP)
+    log_debug ("slot %d app %s: %s(%s) served from cache\n",
+               card->slot, xstrapptype (card->app),
+               is_key? "readkey":"readcert", objid);
+  return 0;
+}
+
+
+/* Store a copy of the object (DATA,DATALEN) with OBJID of the current
+ * app of CARD in the object cache.  Errors are ignored because the
+ * cache is only an optimization.  */
+static void
+card_cache_put (card_t card, int is_key, const char *objid,
+                const unsigned char *data, size_t datalen)
+{
+  card_cache_item_t item, prev;
+  int count;
+
+  /* Remove an existing entry for the object and, to limit the memory
+   * use, the oldest entry if the cache is full.  New items are
+   * prepended thus the oldest is the last one.  */
+  for (count = 0, prev = NULL, item = card->cache; item;
+       prev = item, item = item->next)
+    {
+      if ((item->is_key == is_key
+           && item->apptype == card->app->apptype
+           && !strcmp (item->objid, objid))
+          || ++count >= CARD_CACHE_MAX_ITEMS)
+        {
+          if (prev)
+            prev->next = item->next;
+          else
+            card->cache = item->next;
+          xfree (item->serialno);
+          xfree (item->data);
+          xfree (item);
+          break;
+        }
+    }
+
+  item = xtrycalloc (1, sizeof *item + strlen (objid));
+  if (!item)
+    return;
+  strcpy (item->objid, objid);
+  item->data = xtrymalloc (datalen? datalen : 1);
+  if (card->serialnolen)
+    item->serialno = xtrymalloc (card->serialnolen);
+  if (!item->data || (card->serialnolen && !item->serialno))
+    {
+      xfree (item->data);
+      xfree (item->serialno);
+      xfree (item);
+      return;
+    }
+  memcpy (item->data, data, datalen);
+  item->datalen = datalen;
+  if (card->serialnolen)
+    memcpy (item->serialno, card->serialno, card->serialnolen);
+  item->serialnolen = card->serialnolen;
+  item->apptype = card->app->apptype;
+  item->is_key = is_key;
+  item->next = card->cache;
+  card->cache = item;
+}
+
+
 /* Deallocate the application.  */
 static void
 deallocate_card (card_t card)
@@ -1335,63 +1515,120 @@ deallocate_card (card_t card)
       xfree (a);
     }
 
+  card_cache_flush (card);
   xfree (card->serialno);
   unlock_card (card);
   xfree (card);
 }
 
 
+/* Walk over all cards and their apps and run the with_keygrip
+ * function of the apps.  The caller must hold the card list lock.
+ *
+ * For KEYGRIP_ACTION_LOOKUP the first card with a matching key is
+ * returned.  To allow parallel operations with several tokens, cards
+ * which are currently in use by another connection are first skipped
+ * and only waited for if no other card has the key.  Further, the
+ * search starts at the card after the one found last time; with
+ * several tokens holding the same key this distributes the
+ * operations round-robin over the tokens.  */
 static card_t
 do_with_keygrip (ctrl_t ctrl, int action, const char *keygrip_str,
                  int capability)
 {
+  static unsigned int lookup_start;
   int locked = 0;
   card_t c;
   app_t a, a_prev;
+  unsigned int ncards, n, i, idx;
+  unsigned int busy = 0;  /* Bit vector with the busy cards.  */
+  int pass;
 
-  for (c = card_top; c; c = c->next)
+  for (ncards = 0, c = card_top; c; c = c->next)
+    ncards++;
+
+  for (pass = 0; pass < 2; pass++)
     {
-      if (lock_card (c, ctrl))
-        {
-          c = NULL;
-          goto leave_the_loop;
-        }
-      locked = 1;
-      a_prev = NULL;
-      for (a = c->app; a; a = a->next)
+      for (n = 0; n < ncards; n++)
         {
-          if (!a->fnc.with_keygrip || a->need_reset)
-            continue;
+          idx = n;
+          if (action == KEYGRIP_ACTION_LOOKUP)
+            idx = (lookup_start + n) % ncards;
+          for (c = card_top, i = 0; c && i < idx; c = c->next, i++)
+            ;
 
-          /* Note that we need to do a re-select even for the current
-           * app because the last selected application (e.g. after
-           * init) might be a different one and we do not run
-           * maybe_switch_app here.  Of course we we do this only iff
-           * we have an additional app. */
-          if (c->app->next)
+          if (pass && !(busy & (1u << idx)))
+            continue;  /* Already checked in the first pass.  */
+
+          if (!pass && action == KEYGRIP_ACTION_LOOKUP
+              && ncards > 1 && idx < 8 * sizeof busy)
             {
-              if (run_reselect (ctrl, c, a, a_prev))
+              gpg_error_t err = trylock_card (c, ctrl);
+              if (gpg_err_code (err) == GPG_ERR_EBUSY)
+                {
+                  if (DBG_APP)
+                    log_debug ("slot %d: busy - trying other cards first\n",
+                               c->slot);
+                  busy |= (1u << idx);
+                  continue;
+                }
+              else if (err)
+                {
+                  c = NULL;
+                  goto leave_the_loop;
+                }
+            }
+          else if (lock_card (c, ctrl))
+            {
+              c = NULL;
+              goto leave_the_loop;
+            }
+          locked = 1;
+          a_prev = NULL;
+          for (a = c->app; a; a = a->next)
+            {
+              if (!a->fnc.with_keygrip || a->need_reset)
                 continue;
+
+              /* Note that we need to do a re-select even for the
+               * current app because the last selected application
+               * (e.g. after init) might be a different one and we do
+               * not run maybe_switch_app here.  Of course we we do
+               * this only iff we have an additional app. */
+              if (c->app->next)
+                {
+                  if (run_reselect (ctrl, c, a, a_prev))
+                    continue;
+                }
+              a_prev = a;
+
+              if (DBG_APP)
+                log_debug ("slot %d, app %s: calling with_keygrip(%s)\n",
+                           c->slot, xstrapptype (a),
+                           action == KEYGRIP_ACTION_SEND_DATA? "send_data":
+                           action == KEYGRIP_ACTION_WRITE_STATUS? "status":
+                           action == KEYGRIP_ACTION_LOOKUP? "lookup":"?");
+              if (!a->fnc.with_keygrip (a, ctrl, action, keygrip_str,
+                                        capability))
+                {
+                  /* ACTION_LOOKUP succeeded.  */
+                  lookup_start = idx + 1;
+                  goto leave_the_loop;
+                }
             }
-          a_prev = a;
 
-          if (DBG_APP)
-            log_debug ("slot %d, app %s: calling with_keygrip(%s)\n",
-                       c->slot, xstrapptype (a),
-                       action == KEYGRIP_ACTION_SEND_DATA? "send_data":
-                       action == KEYGRIP_ACTION_WRITE_STATUS? "status":
-                       action == KEYGRIP_ACTION_LOOKUP? "lookup":"?");
-          if (!a->fnc.with_keygrip (a, ctrl, action, keygrip_str, capability))
-            goto leave_the_loop; /* ACTION_LOOKUP succeeded.  */
-        }
+          /* Select the first app again.  */
+          if (c->app->next)
+            run_reselect (ctrl, c, c->app, a_prev);
 
-      /* Select the first app again.  */
-      if (c->app->next)
-        run_reselect (ctrl, c, c->app, a_prev);
+          unlock_card (c);
+          locked = 0;
+        }
 
-      unlock_card (c);
-      locked = 0;
+      if (!busy)
+        break;
     }
+  c = NULL;
 
  leave_the_loop:
   /* Force switching of the app if the selected one is not the current
@@ -1926,6 +2163,8 @@ write_learn_status_core (card_t card, app_t app, ctrl_t ctrl,
     err = gpg_error (GPG_ERR_CARD_RESET);
   else
     {
+      if ((flags & APP_LEARN_FLAG_REREAD))
+        card_cache_flush (card);
       err = app->fnc.learn_status (app, ctrl, flags);
       if (err && (flags & APP_LEARN_FLAG_REREAD))
         app->need_reset = 1;
@@ -2029,8 +2268,14 @@ app_readcert (card_t card, ctrl_t ctrl, const char *certid,
                    card->slot, xstrapptype (card->app), certid);
       if (card->app->need_reset)
         err = gpg_error (GPG_ERR_CARD_RESET);
+      else if (!card_cache_get (card, 0, certid, cert, certlen))
+        err = 0;
       else
-        err = card->app->fnc.readcert (card->app, certid, cert, certlen);
+        {
+          err = card->app->fnc.readcert (card->app, certid, cert, certlen);
+          if (!err)
+            card_cache_put (card, 0, certid, *cert, *certlen);
+        }
     }
 
   return err;
@@ -2070,8 +2315,18 @@ app_readkey (card_t card, ctrl_t ctrl, const char *keyid, unsigned int flags,
                    card->slot, xstrapptype (card->app), keyid);
       if (card->app->need_reset)
         err = gpg_error (GPG_ERR_CARD_RESET);
+      /* The cache can't be used with APP_READKEY_FLAG_INFO because
+       * the app needs to emit the KEYPAIRINFO status line.  */
+      else if (pk && pklen && !(flags & APP_READKEY_FLAG_INFO)
+               && !card_cache_get (card, 1, keyid, pk, pklen))
+        err = 0;
       else
-        err = card->app->fnc.readkey (card->app, ctrl, keyid, flags, pk, pklen);
+        {
+          err = card->app->fnc.readkey (card->app, ctrl, keyid, flags,
+                                        pk, pklen);
+          if (!err && pk && *pk && pklen)
+            card_cache_put (card, 1, keyid, *pk, *pklen);
+        }
     }
 
   return err;
@@ -2151,8 +2406,11 @@ app_setattr (card_t card, ctrl_t ctrl, const char *name,
       if (card->app->need_reset)
         err = gpg_error (GPG_ERR_CARD_RESET);
       else
-        err = card->app->fnc.setattr (card->app, ctrl, name, pincb, pincb_arg,
-                                      value, valuelen);
+        {
+          card_cache_flush (card);
+          err = card->app->fnc.setattr (card->app, ctrl, name,
+                                        pincb, pincb_arg, value, valuelen);
+        }
     }
 
   return err;
@@ -2310,8 +2568,11 @@ app_writecert (card_t card, ctrl_t ctrl,
       if (card->app->need_reset)
         err = gpg_error (GPG_ERR_CARD_RESET);
       else
-        err = card->app->fnc.writecert (card->app, ctrl, certidstr,
-                                        pincb, pincb_arg, data, datalen);
+        {
+          card_cache_flush (card);
+          err = card->app->fnc.writecert (card->app, ctrl, certidstr,
+                                          pincb, pincb_arg, data, datalen);
+        }
     }
 
   if (opt.verbose)
@@ -2345,8 +2606,12 @@ app_writekey (card_t card, ctrl_t ctrl,
       if (card->app->need_reset)
         err = gpg_error (GPG_ERR_CARD_RESET);
       else
-        err = card->app->fnc.writekey (card->app, ctrl, keyidstr, flags,
-                                       pincb, pincb_arg, keydata, keydatalen);
+        {
+          card_cache_flush (card);
+          err = card->app->fnc.writekey (card->app, ctrl, keyidstr, flags,
+                                         pincb, pincb_arg,
+                                         keydata, keydatalen);
+        }
     }
 
   if (opt.verbose)
@@ -2379,8 +2644,11 @@ app_genkey (card_t card, ctrl_t ctrl, const char *keynostr,
       if (card->app->need_reset)
         err = gpg_error (GPG_ERR_CARD_RESET);
       else
-        err = card->app->fnc.genkey (card->app, ctrl, keynostr, keytype, flags,
-                                     createtime, pincb, pincb_arg);
+        {
+          card_cache_flush (card);
+          err = card->app->fnc.genkey (card->app, ctrl, keynostr, keytype,
+                                       flags, createtime, pincb, pincb_arg);
+        }
     }
 
   if (opt.verbose)
@@ -2553,15 +2821,31 @@ scd_update_reader_status_file (void)
   card_t card, card_next;
   int periodical_check_needed = 0;
   int reported = 0;
+  int any_removed = 0;
 
-  card_list_w_lock ();
-  for (card = card_top; card; card = card_next)
+  /* Checking the status requires only read access to the card list.
+   * Taking the write lock here would block operations on all cards
+   * until a long running operation on one card has finished.  For
+   * the same reason cards currently in use are skipped; they are
+   * checked again at the next round.  */
+  card_list_r_lock ();
+  for (card = card_top; card; card = card->next)
     {
       int sw;
       unsigned int status;
 
-      lock_card (card, NULL);
-      card_next = card->next;
+      if (card->removed)
+        continue;
+      if (trylock_card (card, NULL))
+        {
+          periodical_check_needed = 1;
+          continue;
+        }
+
+      /* Fall back to polling if the status monitor went away.  */
+      if (!card->periodical_check_needed
+          && apdu_require_status_polling (card->slot))
+        card->periodical_check_needed = 1;
 
       if (card->reset_requested)
         {
@@ -2587,40 +2871,54 @@ scd_update_reader_status_file (void)
             }
         }
 
-      if (card->card_status != status)
+      if (card->card_status != status && status == 0)
+        {
+          /* The removal is done below with the write lock.  */
+          card->removed = 1;
+          any_removed = 1;
+        }
+      else if (card->card_status != status)
         {
           report_change (card->slot, card->card_status, status);
-          send_client_notifications (card, status == 0);
+          send_client_notifications (card, 0);
           reported++;
 
-          if (status == 0)
-            {
-              if (DBG_APP)
-                log_debug ("Removal of a card: %d\n", card->slot);
-              pincache_put (NULL, card->slot, NULL, NULL, NULL, 0);
-              apdu_close_reader (card->slot);
-              deallocate_card (card);
-            }
-          else
-            {
-              card->card_status = status;
-              if (card->periodical_check_needed)
-                periodical_check_needed = 1;
-              unlock_card (card);
-            }
+          card->card_status = status;
+          if (card->periodical_check_needed)
+            periodical_check_needed = 1;
         }
       else
         {
           if (card->periodical_check_needed)
             periodical_check_needed = 1;
-          unlock_card (card);
         }
+      unlock_card (card);
     }
+  card_list_r_unlock ();
 
-  if (reported)
-    card_list_signal ();
+  if (any_removed)
+    {
+      card_list_w_lock ();
+      for (card = card_top; card; card = card_next)
+        {
+          card_next = card->next;
+          if (!card->removed)
+            continue;
 
-  card_list_w_unlock ();
+          lock_card (card, NULL);
+          report_change (card->slot, card->card_status, 0);
+          send_client_notifications (card, 1);
+          if (DBG_APP)
+            log_debug ("Removal of a card: %d\n", card->slot);
+          pincache_put (NULL, card->slot, NULL, NULL, NULL, 0);
+          apdu_close_reader (card->slot);
+          deallocate_card (card);
+        }
+      card_list_signal ();
+      card_list_w_unlock ();
+    }
+  else if (reported)
+    card_list_signal ();
 
   return periodical_check_needed;
 }
@@ -2813,6 +3111,38 @@ app_send_card_list (ctrl_t ctrl)
 }
 
 
+/* The metrics source for the cards and their readers.  */
+void
+app_metrics (metrics_writer_t w)
+{
+  card_t c;
+  unsigned int ncards = 0;
+  char slotbuf[20];
+
+  card_list_r_lock ();
+  for (c = card_top; c; c = c->next)
+    ncards++;
+
+  metrics_begin (w, METRIC_GAUGE, "cards", "Number of inserted cards.");
+  metrics_put (w, NULL, NULL, ncards);
+  metrics_begin (w, METRIC_COUNTER, "apdus_total",
+                 "Number of APDUs sent to the reader.");
+  for (c = card_top; c; c = c->next)
+    {
+      snprintf (slotbuf, sizeof slotbuf, "%d", c->slot);
+      metrics_put (w, "slot", slotbuf, apdu_get_apdu_count (c->slot));
+    }
+  metrics_begin (w, METRIC_COUNTER, "apdu_io_microseconds_total",
+                 "Time the reader needed to process the APDUs.");
+  for (c = card_top; c; c = c->next)
+    {
+      snprintf (slotbuf, sizeof slotbuf, "%d", c->slot);
+      metrics_put (w, "slot", slotbuf, apdu_get_io_time (c->slot));
+    }
+  card_list_r_unlock ();
+}
+
+
 /* Send status lines with the serialno and appname of the current card
  * or of all cards if CARD is NULL.  */
 gpg_error_t
@@ -254,6 +254,14 @@ struct ccid_driver_s
 
   unsigned char intr_buf[64];
   struct libusb_transfer *transfer;
+
+  /* An asynchronous bulk-in transfer posted ahead of the bulk-out
+     request so that the response is picked up as soon as the reader
+     has it.  BULK_IN_POSTED is set while it has been submitted but
+     not yet consumed by bulk_in.  */
+  struct libusb_transfer *bulk_in_xfer;
+  int bulk_in_completed;
+  unsigned int bulk_in_posted:1;
 };
 
 
@@ -283,6 +291,12 @@ static int ccid_usb_thread_is_alive;
 static libusb_device **ccid_usb_dev_list;
 static struct ccid_dev_table ccid_dev_table[CCID_MAX_DEVICE];
 
+/* Hotplug tracking.  The counter is bumped by the hotplug callback
+   which runs in the USB thread.  */
+static int ccid_hotplug_registered;
+static volatile unsigned int ccid_hotplug_count;
+static unsigned int ccid_hotplug_count_at_scan;
+
 
 
 static unsigned int compute_edc (const unsigned char *data, size_t datalen,
@@ -293,6 +307,7 @@ static int bulk_in (ccid_driver_t handle, unsigned char *buffer, size_t length,
                     size_t *nread, int expected_type, int seqno, int timeout,
                     int no_debug);
 static int abort_cmd (ccid_driver_t handle, int seqno, int init);
+static void bulk_in_cancel (ccid_driver_t handle);
 static int send_escape_cmd (ccid_driver_t handle, const unsigned char *data,
                             size_t datalen, unsigned char *result,
                             size_t resultmax, size_t *resultlen);
@@ -1375,6 +1390,36 @@ ccid_vendor_specific_pinpad_setup (ccid_driver_t handle)
 }
 
 
+#ifdef LIBUSB_HOTPLUG_MATCH_ANY
+/* Callback for libusb hotplug events.  */
+static int LIBUSB_CALL
+hotplug_cb (libusb_context *ctx, libusb_device *dev,
+            libusb_hotplug_event event, void *user_data)
+{
+  (void)ctx;
+  (void)dev;
+  (void)event;
+  (void)user_data;
+
+  ccid_hotplug_count++;
+  return 0;  /* Keep the callback.  */
+}
+#endif /*LIBUSB_HOTPLUG_MATCH_ANY*/
+
+
+/* Return true if USB devices may have been added or removed since
+   the last ccid_dev_scan.  */
+int
+ccid_dev_list_changed (void)
+{
+  /* Hotplug events are only delivered while the USB thread handles
+     events; that is as long as a reader is open.  */
+  if (!ccid_hotplug_registered || !ccid_usb_thread_is_alive)
+    return 1;
+  return ccid_hotplug_count != ccid_hotplug_count_at_scan;
+}
+
+
 gpg_error_t
 ccid_dev_scan (int *idx_max_p, void **t_p)
 {
@@ -1398,8 +1443,19 @@ ccid_dev_scan (int *idx_max_p, void **t_p)
           return gpg_error (GPG_ERR_ENODEV);
         }
       initialized_usb = 1;
+
+#ifdef LIBUSB_HOTPLUG_MATCH_ANY
+      if (libusb_has_capability (LIBUSB_CAP_HAS_HOTPLUG)
+          && !libusb_hotplug_register_callback
+          (NULL, (LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED
+                  | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+           0, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+           LIBUSB_HOTPLUG_MATCH_ANY, hotplug_cb, NULL, NULL))
+        ccid_hotplug_registered = 1;
+#endif /*LIBUSB_HOTPLUG_MATCH_ANY*/
     }
 
+  ccid_hotplug_count_at_scan = ccid_hotplug_count;
   n = libusb_get_device_list (NULL, &ccid_usb_dev_list);
   for (i = 0; i < n; i++)
     {
@@ -1903,6 +1959,25 @@ ccid_require_get_status (ccid_driver_t handle)
   return 1;
 }
 
+
+/* Return the maximum length of the data part of an extended length
+   APDU which can be exchanged via HANDLE or 0 if the reader does not
+   support extended length APDUs.  */
+size_t
+ccid_get_max_exlen (ccid_driver_t handle)
+{
+  /* Readers doing only short APDU level exchanges can't send an
+     extended length APDU; except for the Omnikey escape hack in
+     ccid_transceive.  */
+  if (handle->apdu_level == 1 && handle->id_vendor != VENDOR_OMNIKEY)
+    return 0;
+
+  /* The command APDU needs to fit into our message buffer: up to 9
+     bytes for the header and the length fields and 10 bytes for the
+     CCID header.  */
+  return CCID_MAX_BUF - 10 - 9;
+}
+
 static int
 send_power_off (ccid_driver_t handle)
 {
@@ -1956,6 +2031,13 @@ do_close_reader (ccid_driver_t handle)
       handle->transfer = NULL;
     }
 
+  if (handle->bulk_in_xfer)
+    {
+      bulk_in_cancel (handle);
+      libusb_free_transfer (handle->bulk_in_xfer);
+      handle->bulk_in_xfer = NULL;
+    }
+
   DEBUGOUT ("libusb_release_interface and libusb_close\n");
   libusb_release_interface (handle->idev, handle->ifc_no);
   --ccid_usb_thread_is_alive;
@@ -2013,6 +2095,105 @@ ccid_check_card_presence (ccid_driver_t handle)
 }
 
 
+static void
+bulk_in_cb (struct libusb_transfer *transfer)
+{
+  ccid_driver_t handle = transfer->user_data;
+
+  handle->bulk_in_completed = 1;
+}
+
+
+/* Submit an asynchronous read of a maximum of LENGTH bytes from the
+   bulk in endpoint into BUFFER.  This is done before the request is
+   sent with bulk_out so that the reader's response does not have to
+   wait for a new transfer to be set up.  The next call to bulk_in
+   with the same BUFFER picks up the result.  TIMEOUT is the timeout
+   value in ms.  On error nothing is posted and bulk_in falls back to
+   a synchronous read.  */
+static void
+bulk_in_post (ccid_driver_t handle, unsigned char *buffer, size_t length,
+              int timeout)
+{
+  int rc;
+
+  if (handle->bulk_in_posted || handle->enodev_seen)
+    return;
+
+  if (!handle->bulk_in_xfer)
+    {
+      handle->bulk_in_xfer = libusb_alloc_transfer (0);
+      if (!handle->bulk_in_xfer)
+        return;
+    }
+
+  /* Fixme: The next line for the current Valgrind without support
+     for USB IOCTLs. */
+  memset (buffer, 0, length);
+  handle->bulk_in_completed = 0;
+  libusb_fill_bulk_transfer (handle->bulk_in_xfer, handle->idev,
+                             handle->ep_bulk_in, buffer, length,
+                             bulk_in_cb, handle, timeout);
+  my_npth_unprotect ();
+  rc = libusb_submit_transfer (handle->bulk_in_xfer);
+  my_npth_protect ();
+  if (rc)
+    DEBUGOUT_1 ("submitting bulk-in transfer failed: %s\n",
+                libusb_error_name (rc));
+  else
+    handle->bulk_in_posted = 1;
+}
+
+
+/* Wait for the transfer posted by bulk_in_post to finish.  Returns a
+   libusb error code and stores the number of bytes read at
+   TRANSFERRED.  */
+static int
+bulk_in_wait (ccid_driver_t handle, int *transferred)
+{
+  struct libusb_transfer *transfer = handle->bulk_in_xfer;
+
+  my_npth_unprotect ();
+  while (!handle->bulk_in_completed)
+    libusb_handle_events_completed (NULL, &handle->bulk_in_completed);
+  my_npth_protect ();
+  handle->bulk_in_posted = 0;
+
+  *transferred = transfer->actual_length;
+  switch (transfer->status)
+    {
+    case LIBUSB_TRANSFER_COMPLETED: return 0;
+    case LIBUSB_TRANSFER_TIMED_OUT: return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_STALL:     return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_NO_DEVICE: return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_OVERFLOW:  return LIBUSB_ERROR_OVERFLOW;
+    case LIBUSB_TRANSFER_CANCELLED: return LIBUSB_ERROR_INTERRUPTED;
+    default:                        return LIBUSB_ERROR_IO;
+    }
+}
+
+
+/* Cancel a transfer posted by bulk_in_post which will not be
+   consumed by bulk_in.  */
+static void
+bulk_in_cancel (ccid_driver_t handle)
+{
+  int rc;
+  int dummy;
+
+  if (!handle->bulk_in_posted)
+    return;
+
+  my_npth_unprotect ();
+  rc = libusb_cancel_transfer (handle->bulk_in_xfer);
+  my_npth_protect ();
+  if (rc && rc != LIBUSB_ERROR_NOT_FOUND)
+    DEBUGOUT_1 ("cancelling bulk-in transfer failed: %s\n",
+                libusb_error_name (rc));
+  bulk_in_wait (handle, &dummy);
+}
+
+
 /* Write a MSG of length MSGLEN to the designated bulk out endpoint.
    Returns 0 on success. */
 static int
@@ -2090,6 +2271,7 @@ bulk_out (ccid_driver_t handle, unsigned char *msg, size_t msglen,
   if (rc)
     {
       DEBUGOUT_1 ("usb_bulk_write error: %s\n", libusb_error_name (rc));
+      bulk_in_cancel (handle);
       if (rc == LIBUSB_ERROR_NO_DEVICE)
         {
           handle->enodev_seen = 1;
@@ -2120,13 +2302,20 @@ bulk_in (ccid_driver_t handle, unsigned char *buffer, size_t length,
 
   /* Fixme: The next line for the current Valgrind without support
      for USB IOCTLs. */
-  memset (buffer, 0, length);
+  if (!handle->bulk_in_posted)
+    memset (buffer, 0, length);
  retry:
 
-  my_npth_unprotect ();
-  rc = libusb_bulk_transfer (handle->idev, handle->ep_bulk_in,
-                             buffer, length, &msglen, bwi*timeout);
-  my_npth_protect ();
+  if (handle->bulk_in_posted && handle->bulk_in_xfer->buffer == buffer)
+    rc = bulk_in_wait (handle, &msglen);
+  else
+    {
+      bulk_in_cancel (handle);
+      my_npth_unprotect ();
+      rc = libusb_bulk_transfer (handle->idev, handle->ep_bulk_in,
+                                 buffer, length, &msglen, bwi*timeout);
+      my_npth_protect ();
+    }
   if (rc)
     {
       DEBUGOUT_1 ("usb_bulk_read error: %s\n", libusb_error_name (rc));
@@ -3297,6 +3486,10 @@ ccid_transceive (ccid_driver_t handle,
                     (!(msg[pcboff] & 0x80) && (msg[pcboff] & 0x20)?
                      " [more]":""));
 
+      /* Post the read for the response before sending the block so
+         that successive T=1 exchanges are pipelined.  */
+      bulk_in_post (handle, recv_buffer, sizeof recv_buffer,
+                    (wait_more ? wait_more : 1) * CCID_CMD_TIMEOUT);
       rc = bulk_out (handle, msg, msglen, 0);
       if (rc)
         return rc;
@@ -130,6 +130,7 @@ int ccid_set_debug_level (int level);
 char *ccid_get_reader_list (void);
 
 gpg_error_t ccid_dev_scan (int *idx_max, void **t_p);
+int ccid_dev_list_changed (void);
 void ccid_dev_scan_finish (void *tbl0, int max);
 unsigned int ccid_get_BAI (int, void *tbl0);
 int ccid_compare_BAI (ccid_driver_t handle, unsigned int);
@@ -158,6 +159,7 @@ int ccid_transceive_escape (ccid_driver_t handle,
                             unsigned char *resp, size_t maxresplen,
                             size_t *nresp);
 int ccid_require_get_status (ccid_driver_t handle);
+size_t ccid_get_max_exlen (ccid_driver_t handle);
 
 
 #endif /*CCID_DRIVER_H*/
@@ -65,6 +65,17 @@
 #define IS_LOCKED(c) (locked_session && locked_session != (c)->server_local)
 
 
+/* A PIN kept during a batch session.  */
+struct batch_pin_s
+{
+  struct batch_pin_s *next;
+  int slot;
+  char *appname;
+  char *pinref;
+  char *pin;            /* Allocated in secure memory.  */
+};
+
+
 /* Data used to associate an Assuan context with local server data.
    This object describes the local properties of one session.  */
 struct server_local_s
@@ -98,6 +109,15 @@ struct server_local_s
 
   /* If set to true, status change will be reported. */
   unsigned int watching_status:1;
+
+  /* The state of a batch session as started by the BATCH command.
+     The session is active as long as BATCH_OPS, the number of
+     remaining private key operations, is not zero and BATCH_EXPIRE
+     has not been reached.  BATCH_PINS holds the PINs entered during
+     the session.  */
+  unsigned int batch_ops;
+  time_t batch_expire;
+  struct batch_pin_s *batch_pins;
 };
 
 
@@ -113,6 +133,8 @@ static struct server_local_s *locked_session;
 
 /*  Local prototypes.  */
 static int command_has_option (const char *cmd, const char *cmdopt);
+static void batch_end (struct server_local_s *sl);
+static void batch_count_op (ctrl_t ctrl);
 
 
 
@@ -176,6 +198,8 @@ do_reset (ctrl_t ctrl, int send_reset, int keep_lock)
       locked_session = NULL;
       log_info ("implicitly unlocking due to RESET\n");
     }
+
+  batch_end (ctrl->server_local);
 }
 
 
@@ -1079,6 +1103,7 @@ cmd_pksign (assuan_context_t ctx, char *line)
     }
   else
     {
+      batch_count_op (ctrl);
       rc = assuan_send_data (ctx, outdata, outdatalen);
       xfree (outdata);
       if (rc)
@@ -1148,6 +1173,7 @@ cmd_pkauth (assuan_context_t ctx, char *line)
     }
   else
     {
+      batch_count_op (ctrl);
       if (!challenge_response)
         rc = assuan_send_data (ctx, outdata, outdatalen);
       xfree (outdata);
@@ -1201,6 +1227,7 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
     }
   else
     {
+      batch_count_op (ctrl);
       /* If the card driver told us that there is no padding, send a
          status line.  If there is a padding it is assumed that the
          caller knows what padding is used.  It would have been better
@@ -1881,7 +1908,11 @@ static const char hlp_getinfo[] =
   "  manufacturer NUMBER\n"
   "              - Return a description of the OpenPGP manufacturer id.\n"
   "  apdu_strerror NUMBER\n"
-  "              - Return a string for a status word.\n";
+  "              - Return a string for a status word.\n"
+  "  apdu_stats  - Return the number of APDUs sent to the reader of the\n"
+  "                current card and the time in microseconds the reader\n"
+  "                needed for them.\n"
+  "  metrics     - Return all metrics in the Prometheus text format.\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
@@ -2006,6 +2037,34 @@ cmd_getinfo (assuan_context_t ctx, char *line)
     {
       rc = app_send_active_apps (NULL, ctrl);
     }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *p = metrics_format ();
+
+      if (!p)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          rc = assuan_send_data (ctx, p, strlen (p));
+          xfree (p);
+        }
+    }
+  else if (!strcmp (line, "apdu_stats"))
+    {
+      card_t card = card_get (ctrl, NULL);
+      char numbuf[50];
+
+      if (!card)
+        rc = gpg_error (GPG_ERR_CARD_NOT_PRESENT);
+      else
+        {
+          snprintf (numbuf, sizeof numbuf, "%lu %lu",
+                    apdu_get_apdu_count (card->slot),
+                    apdu_get_io_time (card->slot));
+          card_put (card);
+          rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
+        }
+    }
   else if ((s=has_leading_keyword (line, "manufacturer")))
     {
       unsigned long ul = strtoul (s, NULL, 0);
@@ -2058,6 +2117,7 @@ cmd_restart (assuan_context_t ctx, char *line)
       locked_session = NULL;
       log_info ("implicitly unlocking due to RESTART\n");
     }
+  batch_end (ctrl->server_local);
   return 0;
 }
 
@@ -2413,6 +2473,210 @@ cmd_devinfo (assuan_context_t ctx, char *line)
   ctrl->server_local->watching_status = 0;
   return err;
 }
+
+
+/* Wipe the PINs of the batch session SL for SLOT or all PINs if SLOT
+ * is -1.  */
+static void
+batch_wipe (struct server_local_s *sl, int slot)
+{
+  struct batch_pin_s *bp, **bpp;
+
+  for (bpp = &sl->batch_pins; (bp = *bpp); )
+    {
+      if (slot == -1 || bp->slot == slot)
+        {
+          *bpp = bp->next;
+          wipememory (bp->pin, strlen (bp->pin));
+          xfree (bp->pin);
+          xfree (bp->appname);
+          xfree (bp->pinref);
+          xfree (bp);
+        }
+      else
+        bpp = &bp->next;
+    }
+}
+
+
+/* End the batch session SL and wipe all its PINs.  */
+static void
+batch_end (struct server_local_s *sl)
+{
+  if (!sl)
+    return;
+
+  batch_wipe (sl, -1);
+  if (sl->batch_ops)
+    log_info ("batch session ended\n");
+  sl->batch_ops = 0;
+}
+
+
+/* Return true if CTRL is in an active batch session.  */
+int
+pincache_batch_p (ctrl_t ctrl)
+{
+  struct server_local_s *sl;
+
+  if (!ctrl || !(sl = ctrl->server_local) || !sl->batch_ops)
+    return 0;
+
+  if (gnupg_get_time () >= sl->batch_expire)
+    {
+      log_info ("batch session timed out\n");
+      batch_end (sl);
+      return 0;
+    }
+
+  return 1;
+}
+
+
+/* Account a private key operation to the batch session of CTRL.  */
+static void
+batch_count_op (ctrl_t ctrl)
+{
+  if (!pincache_batch_p (ctrl))
+    return;
+
+  if (!--ctrl->server_local->batch_ops)
+    {
+      log_info ("batch session reached its operation limit\n");
+      batch_end (ctrl->server_local);
+    }
+}
+
+
+/* Store PIN for (SLOT,APPNAME,PINREF) in the batch session of SL.
+ * The semantics for clearing are as described for pincache_put.  */
+static void
+batch_put_pin (struct server_local_s *sl, int slot, const char *appname,
+               const char *pinref, const char *pin, unsigned int pinlen)
+{
+  struct batch_pin_s *bp, **bpp;
+
+  if (slot == -1 || !appname || !pinref)
+    {
+      batch_wipe (sl, slot);
+      return;
+    }
+
+  /* Remove an existing entry.  */
+  for (bpp = &sl->batch_pins; (bp = *bpp); bpp = &bp->next)
+    if (bp->slot == slot
+        && !strcmp (bp->appname, appname) && !strcmp (bp->pinref, pinref))
+      {
+        *bpp = bp->next;
+        wipememory (bp->pin, strlen (bp->pin));
+        xfree (bp->pin);
+        xfree (bp->appname);
+        xfree (bp->pinref);
+        xfree (bp);
+        break;
+      }
+
+  if (!pin)
+    return;
+
+  bp = xtrycalloc (1, sizeof *bp);
+  if (!bp)
+    return;
+  bp->slot = slot;
+  bp->appname = xtrystrdup (appname);
+  bp->pinref = xtrystrdup (pinref);
+  bp->pin = xtrymalloc_secure (pinlen + 1);
+  if (!bp->appname || !bp->pinref || !bp->pin)
+    {
+      xfree (bp->appname);
+      xfree (bp->pinref);
+      xfree (bp->pin);
+      xfree (bp);
+      return;
+    }
+  memcpy (bp->pin, pin, pinlen);
+  bp->pin[pinlen] = 0;
+  bp->next = sl->batch_pins;
+  sl->batch_pins = bp;
+}
+
+
+/* Return a copy of the PIN stored in the batch session of SL.  */
+static gpg_error_t
+batch_get_pin (struct server_local_s *sl, int slot, const char *appname,
+               const char *pinref, char **r_pin)
+{
+  struct batch_pin_s *bp;
+
+  *r_pin = NULL;
+  for (bp = sl->batch_pins; bp; bp = bp->next)
+    if (bp->slot == slot
+        && !strcmp (bp->appname, appname) && !strcmp (bp->pinref, pinref))
+      break;
+  if (!bp)
+    return gpg_error (GPG_ERR_NO_DATA);
+
+  *r_pin = xtrymalloc_secure (strlen (bp->pin) + 1);
+  if (!*r_pin)
+    return gpg_error_from_syserror ();
+  strcpy (*r_pin, bp->pin);
+  return 0;
+}
+
+
+static const char hlp_batch[] =
+  "BATCH [--count=N] [--timeout=N]\n"
+  "BATCH --end\n"
+  "\n"
+  "Start a batch session on this connection.  PINs entered during the\n"
+  "session are kept by scdaemon so that cards which require a PIN\n"
+  "verification for each operation can be used without asking the\n"
+  "user again.  The session ends after N private key operations\n"
+  "(default 100), after N seconds (default 300), with --end, RESET,\n"
+  "RESTART or when the connection is closed.  The PINs are then\n"
+  "wiped.";
+static gpg_error_t
+cmd_batch (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  char *value;
+  long count = 100;
+  long timeout = 300;
+
+  if (has_option (line, "--end"))
+    {
+      batch_end (ctrl->server_local);
+      return 0;
+    }
+
+  err = get_option_value (line, "--count", &value);
+  if (err)
+    return err;
+  if (value)
+    {
+      count = atol (value);
+      xfree (value);
+    }
+  err = get_option_value (line, "--timeout", &value);
+  if (err)
+    return err;
+  if (value)
+    {
+      timeout = atol (value);
+      xfree (value);
+    }
+  if (count < 1 || count > 100000 || timeout < 1 || timeout > 86400)
+    return set_error (GPG_ERR_ASS_PARAMETER, "value out of range");
+
+  /* Start over with a fresh session.  */
+  batch_end (ctrl->server_local);
+  ctrl->server_local->batch_ops = count;
+  ctrl->server_local->batch_expire = gnupg_get_time () + timeout;
+  log_info ("batch session started (%ld operations, %ld seconds)\n",
+            count, timeout);
+  return 0;
+}
 
 /* Return true if the command CMD implements the option OPT.  */
 static int
@@ -2466,6 +2730,7 @@ register_commands (assuan_context_t ctx)
     { "KILLSCD",      cmd_killscd,  hlp_killscd },
     { "KEYINFO",      cmd_keyinfo,  hlp_keyinfo },
     { "DEVINFO",      cmd_devinfo,  hlp_devinfo },
+    { "BATCH",        cmd_batch,    hlp_batch },
     { NULL }
   };
   int i, rc;
@@ -2731,6 +2996,15 @@ pincache_put (ctrl_t ctrl, int slot, const char *appname, const char *pinref,
       /*       ctrl = sl->ctrl_backlink; */
       /*       break; */
       /*     } */
+
+      /* However, PINs kept by batch sessions need to be wiped.  */
+      if (!pin)
+        {
+          struct server_local_s *sl;
+
+          for (sl=session_list; sl; sl = sl->next_session)
+            batch_wipe (sl, slot);
+        }
     }
 
   if (!ctrl || !ctrl->server_local || !(ctx=ctrl->server_local->assuan_ctx))
@@ -2738,6 +3012,13 @@ pincache_put (ctrl_t ctrl, int slot, const char *appname, const char *pinref,
   if (pin && !pinlen)
     return;  /* Ignore an empty PIN.  */
 
+  /* During a batch session we keep the PIN ourselves.  */
+  if (pincache_batch_p (ctrl))
+    {
+      batch_put_pin (ctrl->server_local, slot, appname, pinref, pin, pinlen);
+      return;
+    }
+
   snprintf (line, sizeof line, "%d/%s/%s ",
             slot, appname? appname:"", pinref? pinref:"");
 
@@ -2835,6 +3116,12 @@ pincache_get (ctrl_t ctrl, int slot, const char *appname, const char *pinref,
       goto leave;
     }
 
+  if (pincache_batch_p (ctrl))
+    {
+      err = batch_get_pin (ctrl->server_local, slot, appname, pinref, r_pin);
+      goto leave;
+    }
+
   snprintf (command, sizeof command, "PINCACHE_GET %d/%s/%s",
             slot, appname? appname:"", pinref? pinref:"");
 
@@ -126,6 +126,18 @@ iso7816_map_sw (int sw)
 }
 
 
+/* Return true if the status word SW indicates that an extended length
+   APDU, which we selected on our own, was not accepted by the card or
+   the reader.  */
+static int
+exlen_failed_p (int sw)
+{
+  return (sw == SW_WRONG_LENGTH
+          || sw == SW_BAD_LC
+          || sw == SW_HOST_NOT_SUPPORTED);
+}
+
+
 /* This function is specialized version of the SELECT FILE command.
    SLOT is the card and reader as created for example by
    apdu_open_reader (), AID is a buffer of size AIDLEN holding the
@@ -712,12 +724,29 @@ iso7816_decipher (int slot, int extended_mode,
 {
   int sw;
   unsigned char *buf;
+  int orig_extended_mode = extended_mode;
+  int orig_le = le;
+  size_t lc = datalen + (padind >= 0);
+  int auto_exlen = 0;
 
   if (!data || !datalen || !result || !resultlen)
     return gpg_error (GPG_ERR_INV_VALUE);
   *result = NULL;
   *resultlen = 0;
 
+ again:
+  /* If the caller did not ask for extended length but the data does
+     not fit into a short APDU, we use extended length if the reader
+     and the card support it.  This avoids the round trips for
+     command chaining and GET RESPONSE.  The plaintext can't be longer
+     than the cryptogram and thus DATALEN is a suitable Le.  */
+  if (extended_mode <= 0 && lc > 255 && apdu_get_max_exlen (slot) >= lc)
+    {
+      auto_exlen = 1;
+      extended_mode = 1;
+      le = datalen;
+    }
+
   if (!extended_mode)
     le = 256;  /* Ignore provided Le and use what apdu_send uses. */
   else if (le >= 0 && le < 256)
@@ -745,6 +774,18 @@ iso7816_decipher (int slot, int extended_mode,
                          datalen, (const char *)data, le,
                          result, resultlen);
     }
+  if (auto_exlen && exlen_failed_p (sw))
+    {
+      /* Retry the way the caller requested it.  */
+      xfree (*result);
+      *result = NULL;
+      *resultlen = 0;
+      apdu_disable_exlen (slot);
+      auto_exlen = 0;
+      extended_mode = orig_extended_mode;
+      le = orig_le;
+      goto again;
+    }
   if (sw != SW_SUCCESS)
     {
       /* Make sure that pending buffers are released. */
@@ -990,7 +1031,9 @@ iso7816_get_challenge (int slot, int length, unsigned char *buffer)
  * from OFFSET.  With NMAX = 0 the entire file is read. The result is
  * stored in a newly allocated buffer at the address passed by RESULT.
  * Returns the length of this data at the address of RESULTLEN.  If
- * R_SW is not NULL the last status word is stored there. */
+ * R_SW is not NULL the last status word is stored there.  If
+ * EXTENDED_MODE is 0 but the reader and the card support extended
+ * length APDUs, those are used to read larger chunks.  */
 gpg_error_t
 iso7816_read_binary_ext (int slot, int extended_mode,
                          size_t offset, size_t nmax,
@@ -1001,7 +1044,8 @@ iso7816_read_binary_ext (int slot, int extended_mode,
   unsigned char *buffer;
   size_t bufferlen;
   int read_all = !nmax;
-  size_t n;
+  size_t n, maxlen;
+  int exmode;
 
   if (r_sw)
     *r_sw = 0;
@@ -1021,13 +1065,33 @@ iso7816_read_binary_ext (int slot, int extended_mode,
       buffer = NULL;
       bufferlen = 0;
       n = read_all? 0 : nmax;
-      sw = apdu_send_le (slot, extended_mode, 0x00, CMD_READ_BINARY,
+      exmode = extended_mode;
+      if (!extended_mode && (read_all || nmax > 256)
+          && (maxlen = apdu_get_max_exlen (slot)) > 256)
+        {
+          exmode = 1;
+          n = (read_all || nmax > maxlen)? maxlen : nmax;
+        }
+      sw = apdu_send_le (slot, exmode, 0x00, CMD_READ_BINARY,
                          ((offset>>8) & 0xff), (offset & 0xff) , -1, NULL,
                          n, &buffer, &bufferlen);
+      if (exmode != extended_mode && exlen_failed_p (sw))
+        {
+          /* Retry with short APDUs.  */
+          xfree (buffer);
+          buffer = NULL;
+          bufferlen = 0;
+          apdu_disable_exlen (slot);
+          exmode = extended_mode;
+          n = read_all? 0 : nmax;
+          sw = apdu_send_le (slot, exmode, 0x00, CMD_READ_BINARY,
+                             ((offset>>8) & 0xff), (offset & 0xff) , -1, NULL,
+                             n, &buffer, &bufferlen);
+        }
       if ( SW_EXACT_LENGTH_P(sw) )
         {
           n = (sw & 0x00ff);
-          sw = apdu_send_le (slot, extended_mode, 0x00, CMD_READ_BINARY,
+          sw = apdu_send_le (slot, exmode, 0x00, CMD_READ_BINARY,
                              ((offset>>8) & 0xff), (offset & 0xff) , -1, NULL,
                              n, &buffer, &bufferlen);
         }
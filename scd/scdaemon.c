@@ -87,6 +87,7 @@ enum cmd_and_opt_values
   oNoDetach,
   oNoGrab,
   oLogFile,
+  oMetricsLogInterval,
   oServer,
   oMultiServer,
   oDaemon,
@@ -143,6 +144,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDebugAllowPINLogging, "debug-allow-pin-logging", "@"),
   ARGPARSE_p_u (oDebugAssuanLogCats, "debug-assuan-log-cats", "@"),
   ARGPARSE_s_s (oLogFile,  "log-file", N_("|FILE|write a log to FILE")),
+  ARGPARSE_s_u (oMetricsLogInterval, "metrics-log-interval",
+                N_("|N|log the metrics every N seconds")),
 
 
   ARGPARSE_header ("Configuration",
@@ -262,6 +265,10 @@ static assuan_sock_nonce_t socket_nonce;
  * --listen-backlog.  */
 static int listen_backlog = 64;
 
+/* If not 0, the interval in seconds for writing the metrics to the
+ * log; set by --metrics-log-interval.  */
+static unsigned int metrics_log_interval;
+
 #ifdef HAVE_W32_SYSTEM
 static HANDLE the_event;
 #else
@@ -280,6 +287,7 @@ static gnupg_fd_t create_server_socket (const char *name,
 
 static void *start_connection_thread (void *arg);
 static void handle_connections (gnupg_fd_t listen_fd);
+static void scd_connection_metrics (metrics_writer_t w);
 
 static int active_connections;
 
@@ -604,6 +612,9 @@ main (int argc, char **argv )
         case oHomedir: gnupg_set_homedir (pargs.r.ret_str); break;
         case oNoDetach: nodetach = 1; break;
         case oLogFile: logfile = pargs.r.ret_str; break;
+        case oMetricsLogInterval:
+          metrics_log_interval = pargs.r.ret_ulong;
+          break;
         case oCsh: csh_style = 1; break;
         case oSh: csh_style = 0; break;
         case oServer: pipe_server = 1; break;
@@ -720,6 +731,9 @@ main (int argc, char **argv )
       cleanup ();
       exit (1);
     }
+  metrics_set_prefix ("scdaemon");
+  metrics_register_source (scd_connection_metrics);
+  metrics_register_source (app_metrics);
 
   if (gpgconf_list == 2)
     scd_exit (0);
@@ -1300,6 +1314,7 @@ handle_connections (gnupg_fd_t listen_fd)
   fd_set fdset, read_fdset;
   int nfd;
   int ret;
+  gpg_error_t err;
   struct timespec timeout;
   struct timespec *t;
   int saved_errno;
@@ -1321,6 +1336,10 @@ handle_connections (gnupg_fd_t listen_fd)
   notify_fd = pipe_fd[1];
 #endif
 
+  if ((err = metrics_start_logging (metrics_log_interval)))
+    log_error ("error starting the metrics logging: %s\n",
+               gpg_strerror (err));
+
   ret = npth_attr_init(&tattr);
   if (ret)
     {
@@ -1473,6 +1492,16 @@ handle_connections (gnupg_fd_t listen_fd)
 }
 
 /* Return the number of active connections. */
+/* The metrics source for the connections.  */
+static void
+scd_connection_metrics (metrics_writer_t w)
+{
+  metrics_begin (w, METRIC_GAUGE, "connections",
+                 "Number of active connections.");
+  metrics_put (w, NULL, NULL, active_connections);
+}
+
+
 int
 get_active_connection_count (void)
 {
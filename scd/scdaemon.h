@@ -30,6 +30,7 @@
 #include <gcrypt.h>
 #include "../common/util.h"
 #include "../common/sysutils.h"
+#include "../common/metrics.h"
 #include "app-common.h"
 
 
@@ -160,6 +161,7 @@ void pincache_put (ctrl_t ctrl, int slot, const char *appname,
                    const char *pinref, const char *pin, unsigned int pinlen);
 gpg_error_t pincache_get (ctrl_t ctrl, int slot, const char *appname,
                           const char *pinref, char **r_pin);
+int pincache_batch_p (ctrl_t ctrl);
 
 void popup_prompt (void *opaque, int on);
 
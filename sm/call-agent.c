@@ -424,7 +424,8 @@ gpgsm_scd_pksign (ctrl_t ctrl, const char *keyid, const char *desc,
   unsigned char *sigbuf;
   size_t sigbuflen;
   struct default_inq_parm_s inq_parm;
-  gcry_sexp_t sig;
+  struct canon_sexp_value_s args[2];
+  const char *tmpl;
 
   (void)desc;
 
@@ -487,35 +488,28 @@ gpgsm_scd_pksign (ctrl_t ctrl, const char *keyid, const char *desc,
     }
   sigbuf = get_membuf (&data, &sigbuflen);
 
+  /* The card returns the plain signature; R and S are the two
+   * halves for the ECC algorithms.  */
+  args[0].data = sigbuf;
+  args[0].len = sigbuflen/2;
+  args[1].data = sigbuf + sigbuflen/2;
+  args[1].len = sigbuflen/2;
   switch(pkalgo)
     {
     case GCRY_PK_RSA:
-      rc = gcry_sexp_build (&sig, NULL, "(sig-val(rsa(s%b)))",
-                            (int)sigbuflen, sigbuf);
+      args[0].len = sigbuflen;
+      tmpl = CANON_SEXP_RSA_SIGVAL;
       break;
-
-    case GCRY_PK_ECC:
-      rc = gcry_sexp_build (&sig, NULL, "(sig-val(ecdsa(r%b)(s%b)))",
-                            (int)sigbuflen/2, sigbuf,
-                            (int)sigbuflen/2, sigbuf + sigbuflen/2);
-      break;
-
-    case GCRY_PK_EDDSA:
-      rc = gcry_sexp_build (&sig, NULL, "(sig-val(eddsa(r%b)(s%b)))",
-                            (int)sigbuflen/2, sigbuf,
-                            (int)sigbuflen/2, sigbuf + sigbuflen/2);
-      break;
-
+    case GCRY_PK_ECC:   tmpl = CANON_SEXP_ECDSA_SIGVAL; break;
+    case GCRY_PK_EDDSA: tmpl = CANON_SEXP_EDDSA_SIGVAL; break;
     default:
-      rc = gpg_error (GPG_ERR_WRONG_PUBKEY_ALGO);
-      break;
+      xfree (sigbuf);
+      return gpg_error (GPG_ERR_WRONG_PUBKEY_ALGO);
     }
-  xfree (sigbuf);
-  if (rc)
-    return rc;
 
-  rc = make_canon_sexp (sig, r_buf, r_buflen);
-  gcry_sexp_release (sig);
+  *r_buf = make_canon_sexp_from_template (tmpl, args, r_buflen);
+  rc = *r_buf? 0 : gpg_error_from_syserror ();
+  xfree (sigbuf);
   if (rc)
     return rc;
 
@@ -1150,6 +1144,60 @@ gpgsm_agent_havekey (ctrl_t ctrl, const char *hexkeygrip)
   return rc;
 }
 
+
+static int
+cmp_keygrips (const void *a, const void *b)
+{
+  return memcmp (a, b, 20);
+}
+
+
+/* Ask the agent for the keygrips of all available secret keys.  On
+ * success a sorted array of 20 byte keygrips is stored at R_GRIPS
+ * and the number of keygrips at R_COUNT.  At most LIMIT keygrips are
+ * returned; if the agent has more keys GPG_ERR_TRUNCATED is
+ * returned.  */
+gpg_error_t
+gpgsm_agent_havekey_list (ctrl_t ctrl, unsigned int limit,
+                          unsigned char **r_grips, size_t *r_count)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  membuf_t data;
+  unsigned char *grips;
+  size_t len;
+
+  *r_grips = NULL;
+  *r_count = 0;
+
+  err = start_agent (ctrl);
+  if (err)
+    return err;
+
+  snprintf (line, DIM(line), "HAVEKEY --list=%u", limit);
+  init_membuf (&data, 4096);
+  err = assuan_transact (agent_ctx, line, put_membuf_cb, &data,
+                         NULL, NULL, NULL, NULL);
+  if (err)
+    {
+      xfree (get_membuf (&data, NULL));
+      return err;
+    }
+  grips = get_membuf (&data, &len);
+  if (!grips)
+    return gpg_error_from_syserror ();
+  if ((len % 20))
+    {
+      xfree (grips);
+      return gpg_error (GPG_ERR_INV_DATA);
+    }
+
+  qsort (grips, len / 20, 20, cmp_keygrips);
+  *r_grips = grips;
+  *r_count = len / 20;
+  return 0;
+}
+
 
 static gpg_error_t
 learn_status_cb (void *opaque, const char *line)
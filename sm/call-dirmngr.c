@@ -58,6 +58,8 @@ struct inq_certificate_parm_s {
   assuan_context_t ctx;
   ksba_cert_t cert;
   ksba_cert_t issuer_cert;
+  isvalid_item_t items;   /* The certificates of an ISVALID --multi.  */
+  int nitems;
 };
 
 struct isvalid_status_parm_s {
@@ -386,9 +388,22 @@ inq_certificate (void *opaque, const char *line)
     { /* Send the given certificate. */
       int err;
       ksba_cert_t cert;
-
-      err = gpgsm_find_cert (parm->ctrl, line, ski, &cert,
-                             FIND_CERT_ALLOW_AMBIG|FIND_CERT_WITH_EPHEM);
+      int i;
+
+      /* The certificates of a multi request are asked for by their
+       * fingerprint; they may not yet be stored.  */
+      for (i=0; !ski && i < parm->nitems; i++)
+        if (!ascii_strcasecmp (line, parm->items[i].fpr))
+          break;
+      if (!ski && i < parm->nitems)
+        {
+          cert = parm->items[i].cert;
+          ksba_cert_ref (cert);
+          err = 0;
+        }
+      else
+        err = gpgsm_find_cert (parm->ctrl, line, ski, &cert,
+                               FIND_CERT_ALLOW_AMBIG|FIND_CERT_WITH_EPHEM);
       if (err)
         {
           log_error ("certificate not found: %s\n", gpg_strerror (err));
@@ -517,6 +532,80 @@ isvalid_status_cb (void *opaque, const char *line)
 
 
 
+/* Check the certificate with the fingerprint FPR which the dirmngr
+ * used to sign a CRL or OCSP response and for which it told us that
+ * its result is only valid if that certificate is valid.  */
+static gpg_error_t
+check_isvalid_signer (ctrl_t ctrl, const unsigned char *fpr)
+{
+  gpg_error_t rc = 0;
+  ksba_cert_t rspcert = NULL;
+
+  if (get_cached_cert (dirmngr_ctx, fpr, &rspcert))
+    {
+      /* Ooops: Something went wrong getting the certificate
+         from the dirmngr.  Try our own cert store now.  */
+      KEYDB_HANDLE kh;
+
+      kh = keydb_new (ctrl);
+      if (!kh)
+        rc = gpg_error (GPG_ERR_ENOMEM);
+      if (!rc)
+        rc = keydb_search_fpr (ctrl, kh, fpr);
+      if (!rc)
+        rc = keydb_get_cert (kh, &rspcert);
+      if (rc)
+        {
+          log_error ("unable to find the certificate used "
+                     "by the dirmngr: %s\n", gpg_strerror (rc));
+          rc = gpg_error (GPG_ERR_INV_CRL);
+        }
+      keydb_release (kh);
+    }
+
+  if (!rc)
+    {
+      rc = gpgsm_cert_use_ocsp_p (rspcert);
+      if (rc)
+        rc = gpg_error (GPG_ERR_INV_CRL);
+      else
+        {
+          /* Note the no_dirmngr flag: This avoids checking
+             this certificate over and over again. */
+          rc = gpgsm_validate_chain (ctrl, rspcert, GNUPG_ISOTIME_NONE,
+                                     NULL, 0, NULL,
+                                     VALIDATE_FLAG_NO_DIRMNGR, NULL);
+          if (rc)
+            {
+              log_error ("invalid certificate used for CRL/OCSP: %s\n",
+                         gpg_strerror (rc));
+              rc = gpg_error (GPG_ERR_INV_CRL);
+            }
+        }
+    }
+  ksba_cert_release (rspcert);
+  return rc;
+}
+
+
+/* Send the options for ISVALID to the dirmngr.  It is sufficient to
+ * do this only once because we have one connection per process
+ * only.  */
+static void
+send_isvalid_options (void)
+{
+  static int did_options;
+
+  if (!did_options)
+    {
+      if (opt.force_crl_refresh)
+        assuan_transact (dirmngr_ctx, "OPTION force-crl-refresh=1",
+                         NULL, NULL, NULL, NULL, NULL, NULL);
+      did_options = 1;
+    }
+}
+
+
 /* Call the directory manager to check whether the certificate is valid
    Returns 0 for valid or usually one of the errors:
 
@@ -539,7 +628,6 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
                        ksba_cert_t cert, ksba_cert_t issuer_cert, int use_ocsp,
                        gnupg_isotime_t r_revoked_at, char **r_reason)
 {
-  static int did_options;
   int rc;
   char *certid, *certfpr;
   char line[ASSUAN_LINELENGTH];
@@ -576,6 +664,8 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
   parm.ctrl = ctrl;
   parm.cert = cert;
   parm.issuer_cert = issuer_cert;
+  parm.items = NULL;
+  parm.nitems = 0;
 
   stparm.ctrl = ctrl;
   stparm.seen = 0;
@@ -583,15 +673,7 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
   stparm.revoked_at[0] = 0;
   stparm.revocation_reason = NULL;
 
-  /* It is sufficient to send the options only once because we have
-   * one connection per process only.  */
-  if (!did_options)
-    {
-      if (opt.force_crl_refresh)
-        assuan_transact (dirmngr_ctx, "OPTION force-crl-refresh=1",
-                         NULL, NULL, NULL, NULL, NULL, NULL);
-      did_options = 1;
-    }
+  send_isvalid_options ();
   snprintf (line, DIM(line), "ISVALID%s %s%s%s",
             (use_ocsp == 2 || opt.no_crl_check) ? " --only-ocsp":"",
             certid,
@@ -628,57 +710,175 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
           rc = gpg_error (GPG_ERR_INV_CRL);
         }
       else
-        {
-          ksba_cert_t rspcert = NULL;
+        rc = check_isvalid_signer (ctrl, stparm.fpr);
+    }
+
+  release_dirmngr (ctrl);
+  xfree (stparm.revocation_reason);
+  return rc;
+}
+
+
+/* Status parameters for gpgsm_dirmngr_isvalid_multi.  */
+struct isvalid_multi_status_parm_s
+{
+  ctrl_t ctrl;
+  isvalid_item_t items;
+  int nitems;
+};
 
-          if (get_cached_cert (dirmngr_ctx, stparm.fpr, &rspcert))
-            {
-              /* Ooops: Something went wrong getting the certificate
-                 from the dirmngr.  Try our own cert store now.  */
-              KEYDB_HANDLE kh;
-
-              kh = keydb_new (ctrl);
-              if (!kh)
-                rc = gpg_error (GPG_ERR_ENOMEM);
-              if (!rc)
-                rc = keydb_search_fpr (ctrl, kh, stparm.fpr);
-              if (!rc)
-                rc = keydb_get_cert (kh, &rspcert);
-              if (rc)
-                {
-                  log_error ("unable to find the certificate used "
-                             "by the dirmngr: %s\n", gpg_strerror (rc));
-                  rc = gpg_error (GPG_ERR_INV_CRL);
-                }
-              keydb_release (kh);
-            }
 
-          if (!rc)
+static gpg_error_t
+isvalid_multi_status_cb (void *opaque, const char *line)
+{
+  struct isvalid_multi_status_parm_s *parm = opaque;
+  isvalid_item_t item;
+  const char *s;
+  char *buffer;
+  const char *fields[5];
+  int i;
+
+  if ((s = has_leading_keyword (line, "PROGRESS")))
+    {
+      if (parm->ctrl)
+        {
+          line = s;
+          if (gpgsm_status (parm->ctrl, STATUS_PROGRESS, line))
+            return gpg_error (GPG_ERR_ASS_CANCELED);
+        }
+    }
+  else if ((s = has_leading_keyword (line, "ISVALID_RESULT")))
+    {
+      buffer = xtrystrdup (s);
+      if (!buffer)
+        return gpg_error_from_syserror ();
+      if (split_fields (buffer, fields, DIM (fields)) == DIM (fields))
+        {
+          for (i=0; i < parm->nitems; i++)
+            if (!ascii_strcasecmp (fields[0], parm->items[i].fpr))
+              break;
+          if (i < parm->nitems && !parm->items[i].seen)
             {
-              rc = gpgsm_cert_use_ocsp_p (rspcert);
-              if (rc)
-                rc = gpg_error (GPG_ERR_INV_CRL);
+              item = parm->items + i;
+              item->seen = 1;
+              item->err = strtoul (fields[1], NULL, 10);
+              if (strcmp (fields[2], "-")
+                  && !unhexify_fpr (fields[2], item->signer_fpr))
+                item->err = gpg_error (GPG_ERR_INV_CRL);
               else
+                item->want_signer_check = !!strcmp (fields[2], "-");
+              if (gpg_err_code (item->err) == GPG_ERR_CERT_REVOKED
+                  && !check_isotime (fields[3]))
                 {
-                  /* Note the no_dirmngr flag: This avoids checking
-                     this certificate over and over again. */
-                  rc = gpgsm_validate_chain (ctrl, rspcert, GNUPG_ISOTIME_NONE,
-                                             NULL, 0, NULL,
-                                             VALIDATE_FLAG_NO_DIRMNGR, NULL);
-                  if (rc)
-                    {
-                      log_error ("invalid certificate used for CRL/OCSP: %s\n",
-                                 gpg_strerror (rc));
-                      rc = gpg_error (GPG_ERR_INV_CRL);
-                    }
+                  gnupg_copy_time (item->revoked_at, fields[3]);
+                  if (strcmp (fields[4], "-"))
+                    item->reason = xtrystrdup (fields[4]);
                 }
             }
-          ksba_cert_release (rspcert);
         }
+      xfree (buffer);
+    }
+  else if (warning_and_note_printer (line))
+    {
+    }
+
+  return 0;
+}
+
+
+/* Ask the dirmngr about the validity of the NITEMS certificates
+ * given by ITEMS in one request.  The dirmngr runs these checks in
+ * parallel.  USE_OCSP has the same meaning as for
+ * gpgsm_dirmngr_isvalid.  The result for each certificate is stored
+ * in its item.  An error is returned if the request as a whole
+ * failed; for example because the dirmngr does not support it.  In
+ * this case the caller should fall back to gpgsm_dirmngr_isvalid.  */
+gpg_error_t
+gpgsm_dirmngr_isvalid_multi (ctrl_t ctrl, isvalid_item_t items, int nitems,
+                             int use_ocsp)
+{
+  gpg_error_t rc;
+  char line[ASSUAN_LINELENGTH];
+  char *p;
+  struct inq_certificate_parm_s parm;
+  struct isvalid_multi_status_parm_s stparm;
+  char *fpr;
+  int i;
+
+  if (nitems > MAX_ISVALID_MULTI)
+    return gpg_error (GPG_ERR_TOO_MANY);
+
+  for (i=0; i < nitems; i++)
+    {
+      items[i].err = gpg_error (GPG_ERR_GENERAL);
+      items[i].revoked_at[0] = 0;
+      items[i].reason = NULL;
+      items[i].seen = 0;
+      items[i].want_signer_check = 0;
+      fpr = gpgsm_get_fingerprint_hexstring (items[i].cert, GCRY_MD_SHA1);
+      if (!fpr)
+        return gpg_error (GPG_ERR_GENERAL);
+      strcpy (items[i].fpr, fpr);
+      xfree (fpr);
+    }
+
+  rc = start_dirmngr (ctrl);
+  if (rc)
+    return rc;
+
+  if (opt.verbose > 1)
+    log_info ("asking dirmngr about %d certificates%s\n", nitems,
+              use_ocsp? " (using OCSP)":"");
+
+  parm.ctx = dirmngr_ctx;
+  parm.ctrl = ctrl;
+  parm.cert = NULL;
+  parm.issuer_cert = NULL;
+  parm.items = items;
+  parm.nitems = nitems;
+
+  stparm.ctrl = ctrl;
+  stparm.items = items;
+  stparm.nitems = nitems;
+
+  send_isvalid_options ();
+  p = stpcpy (line, "ISVALID --multi");
+  if (use_ocsp)
+    p = stpcpy (p, " --ocsp");
+  if (use_ocsp == 2 || opt.no_crl_check)
+    p = stpcpy (p, " --only-ocsp");
+  for (i=0; i < nitems; i++)
+    {
+      *p++ = ' ';
+      p = stpcpy (p, items[i].fpr);
     }
 
+  rc = assuan_transact (dirmngr_ctx, line, NULL, NULL,
+                        inq_certificate, &parm,
+                        isvalid_multi_status_cb, &stparm);
+  if (opt.verbose > 1)
+    log_info ("response of dirmngr: %s\n", rc? gpg_strerror (rc): "okay");
+
+  for (i=0; !rc && i < nitems; i++)
+    if (!items[i].seen)
+      {
+        log_error ("communication problem with dirmngr detected\n");
+        rc = gpg_error (GPG_ERR_INV_CRL);
+      }
+
+  /* Check the responder certificates only after the command has
+   * finished because this may again call the dirmngr.  */
+  for (i=0; !rc && i < nitems; i++)
+    if (!items[i].err && items[i].want_signer_check)
+      items[i].err = check_isvalid_signer (ctrl, items[i].signer_fpr);
+
   release_dirmngr (ctrl);
-  xfree (stparm.revocation_reason);
+  if (rc)
+    for (i=0; i < nitems; i++)
+      {
+        xfree (items[i].reason);
+        items[i].reason = NULL;
+      }
   return rc;
 }
 
@@ -1191,3 +1391,81 @@ gpgsm_dirmngr_run_command (ctrl_t ctrl, const char *command,
   release_dirmngr (ctrl);
   return rc;
 }
+
+
+
+/* Status callback for gpgsm_dirmngr_get_validcache.  */
+static gpg_error_t
+get_validcache_status_cb (void *opaque, const char *line)
+{
+  char **r_value = opaque;
+  const char *s;
+
+  if ((s = has_leading_keyword (line, "VALIDCACHE")) && !*r_value)
+    {
+      *r_value = xtrystrdup (s);
+      if (!*r_value)
+        return gpg_error_from_syserror ();
+    }
+  return 0;
+}
+
+
+/* Ask the dirmngr for the value stored under KEY in its cache of
+ * validation results.  On success a malloced string with the
+ * expiration time of the entry and the value delimited by a space is
+ * stored at R_VALUE.  GPG_ERR_NOT_FOUND is returned if there is no current
+ * entry.  This is only a shortcut and thus a busy dirmngr connection
+ * is not waited for.  */
+gpg_error_t
+gpgsm_dirmngr_get_validcache (ctrl_t ctrl, const char *key, char **r_value)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+
+  *r_value = NULL;
+  if (dirmngr_ctx_locked)
+    return gpg_error (GPG_ERR_EAGAIN);
+
+  err = start_dirmngr (ctrl);
+  if (err)
+    return err;
+
+  snprintf (line, sizeof line, "VALIDCACHE --get %s", key);
+  err = assuan_transact (dirmngr_ctx, line, NULL, NULL, NULL, NULL,
+                         get_validcache_status_cb, r_value);
+  if (!err && !*r_value)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+  if (err)
+    {
+      xfree (*r_value);
+      *r_value = NULL;
+    }
+  release_dirmngr (ctrl);
+  return err;
+}
+
+
+/* Store VALUE under KEY in the dirmngr's cache of validation results
+ * so that other gpgsm processes can use it up to the time EXPIRES.  */
+gpg_error_t
+gpgsm_dirmngr_put_validcache (ctrl_t ctrl, const char *key,
+                              const char *expires, const char *value)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+
+  if (dirmngr_ctx_locked)
+    return gpg_error (GPG_ERR_EAGAIN);
+
+  err = start_dirmngr (ctrl);
+  if (err)
+    return err;
+
+  snprintf (line, sizeof line, "VALIDCACHE --put %s %s %s",
+            key, expires, value);
+  err = assuan_transact (dirmngr_ctx, line, NULL, NULL, NULL, NULL,
+                         NULL, NULL);
+  release_dirmngr (ctrl);
+  return err;
+}
@@ -60,6 +60,20 @@ struct chain_item_s
 };
 typedef struct chain_item_s *chain_item_t;
 
+/* The revocation checks deferred by do_validate_chain.  */
+struct revocation_batch_s
+{
+  int nitems;
+  struct isvalid_item_s items[MAX_ISVALID_MULTI];
+  ksba_cert_t issuer_certs[MAX_ISVALID_MULTI];
+};
+typedef struct revocation_batch_s *revocation_batch_t;
+
+/* The number of seconds a successful chain validation is cached and
+ * the maximum number of cached validations per session.  */
+#define VALIDATED_CHAIN_TTL   300
+#define MAX_VALIDATED_CHAINS   64
+
 
 static int is_root_cert (ksba_cert_t cert,
                          const char *issuerdn, const char *subjectdn);
@@ -1249,15 +1263,13 @@ gpgsm_is_root_cert (ksba_cert_t cert)
 }
 
 
-/* This is a helper for gpgsm_validate_chain. */
-static gpg_error_t
-is_cert_still_valid (ctrl_t ctrl, int chain_model, int lm, estream_t fp,
-                     ksba_cert_t subject_cert, ksba_cert_t issuer_cert,
-                     int *any_revoked, int *any_no_crl, int *any_crl_too_old)
+/* This is a helper for is_cert_still_valid.  Returns true if the
+ * revocation status of SUBJECT_CERT needs to be asked from the
+ * dirmngr.  */
+static int
+need_revocation_check (ctrl_t ctrl, int chain_model, ksba_cert_t subject_cert)
 {
   gpg_error_t err;
-  gnupg_isotime_t revoked_at;
-  char *reason;
 
   if (ctrl->offline || (opt.no_crl_check && !ctrl->use_ocsp))
     {
@@ -1284,10 +1296,20 @@ is_cert_still_valid (ctrl_t ctrl, int chain_model, int lm, estream_t fp,
         }
     }
 
-  err = gpgsm_dirmngr_isvalid (ctrl,
-                               subject_cert, issuer_cert,
-                               chain_model? 2 : !!ctrl->use_ocsp,
-                               revoked_at, &reason);
+  return 1;
+}
+
+
+/* This is a helper for is_cert_still_valid to act on the result ERR
+ * of the dirmngr's check of SUBJECT_CERT.  REVOKED_AT and REASON are
+ * the revocation info; the function takes ownership of REASON.  */
+static gpg_error_t
+process_revocation_check (ctrl_t ctrl, int lm, estream_t fp,
+                          ksba_cert_t subject_cert, gpg_error_t err,
+                          gnupg_isotime_t revoked_at, char *reason,
+                          int *any_revoked, int *any_no_crl,
+                          int *any_crl_too_old)
+{
   if (gpg_err_code (err) == GPG_ERR_CERT_REVOKED)
     {
       gnupg_copy_time (ctrl->revoked_at, revoked_at);
@@ -1361,6 +1383,125 @@ is_cert_still_valid (ctrl_t ctrl, int chain_model, int lm, estream_t fp,
 }
 
 
+/* This is a helper for gpgsm_validate_chain. */
+static gpg_error_t
+is_cert_still_valid (ctrl_t ctrl, int chain_model, int lm, estream_t fp,
+                     ksba_cert_t subject_cert, ksba_cert_t issuer_cert,
+                     int *any_revoked, int *any_no_crl, int *any_crl_too_old)
+{
+  gpg_error_t err;
+  gnupg_isotime_t revoked_at;
+  char *reason;
+
+  if (!need_revocation_check (ctrl, chain_model, subject_cert))
+    return 0;
+
+  err = gpgsm_dirmngr_isvalid (ctrl,
+                               subject_cert, issuer_cert,
+                               chain_model? 2 : !!ctrl->use_ocsp,
+                               revoked_at, &reason);
+  return process_revocation_check (ctrl, lm, fp, subject_cert, err,
+                                   revoked_at, reason,
+                                   any_revoked, any_no_crl, any_crl_too_old);
+}
+
+
+/* Helper for do_validate_chain to check the revocation status of
+ * SUBJECT_CERT.  If BATCH is not NULL the check is deferred by
+ * putting the certificate into BATCH; the checks of all certificates
+ * of the chain are then done in parallel by check_revocation_batch.  */
+static gpg_error_t
+check_or_defer_revocation (ctrl_t ctrl, int chain_model, int lm, estream_t fp,
+                           ksba_cert_t subject_cert, ksba_cert_t issuer_cert,
+                           revocation_batch_t batch, int *any_revoked,
+                           int *any_no_crl, int *any_crl_too_old)
+{
+  if (!batch || batch->nitems >= MAX_ISVALID_MULTI)
+    return is_cert_still_valid (ctrl, chain_model, lm, fp,
+                                subject_cert, issuer_cert,
+                                any_revoked, any_no_crl, any_crl_too_old);
+
+  if (!need_revocation_check (ctrl, chain_model, subject_cert))
+    return 0;
+
+  memset (batch->items + batch->nitems, 0, sizeof *batch->items);
+  ksba_cert_ref (subject_cert);
+  batch->items[batch->nitems].cert = subject_cert;
+  ksba_cert_ref (issuer_cert);
+  batch->issuer_certs[batch->nitems] = issuer_cert;
+  batch->nitems++;
+  return 0;
+}
+
+
+/* Run the revocation checks deferred to BATCH and act on their
+ * results in the order of the chain.  */
+static gpg_error_t
+check_revocation_batch (ctrl_t ctrl, int chain_model, int lm, estream_t fp,
+                        revocation_batch_t batch, int *any_revoked,
+                        int *any_no_crl, int *any_crl_too_old)
+{
+  gpg_error_t err;
+  isvalid_item_t item;
+  int i;
+
+  if (!batch->nitems)
+    return 0;
+
+  if (batch->nitems > 1)
+    {
+      err = gpgsm_dirmngr_isvalid_multi (ctrl, batch->items, batch->nitems,
+                                         chain_model? 2 : !!ctrl->use_ocsp);
+      if (!err)
+        {
+          for (i=0; i < batch->nitems; i++)
+            {
+              item = batch->items + i;
+              err = process_revocation_check (ctrl, lm, fp, item->cert,
+                                              item->err, item->revoked_at,
+                                              item->reason, any_revoked,
+                                              any_no_crl, any_crl_too_old);
+              item->reason = NULL;
+              if (err)
+                return err;
+            }
+          return 0;
+        }
+      if (opt.verbose)
+        log_info ("checking the chain at once failed: %s\n",
+                  gpg_strerror (err));
+    }
+
+  /* Fallback to one request per certificate; e.g. for an old
+   * dirmngr.  */
+  for (i=0; i < batch->nitems; i++)
+    {
+      err = is_cert_still_valid (ctrl, chain_model, lm, fp,
+                                 batch->items[i].cert, batch->issuer_certs[i],
+                                 any_revoked, any_no_crl, any_crl_too_old);
+      if (err)
+        return err;
+    }
+  return 0;
+}
+
+
+/* Release the objects in BATCH.  */
+static void
+release_revocation_batch (revocation_batch_t batch)
+{
+  int i;
+
+  for (i=0; i < batch->nitems; i++)
+    {
+      ksba_cert_release (batch->items[i].cert);
+      ksba_cert_release (batch->issuer_certs[i]);
+      xfree (batch->items[i].reason);
+    }
+  batch->nitems = 0;
+}
+
+
 /* Helper for gpgsm_validate_chain to check the validity period of
    SUBJECT_CERT.  The caller needs to pass EXPTIME which will be
    updated to the nearest expiration time seen.  A DEPTH of 0 indicates
@@ -1625,7 +1766,14 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
                             from a qualified root certificate.
                             -1 = unknown, 0 = no, 1 = yes. */
   chain_item_t chain = NULL; /* A list of all certificates in the chain.  */
+  struct revocation_batch_s batch_buffer;
+  revocation_batch_t batch;
 
+  /* Except for listings where the diagnostics shall show up along
+     with the certificate in question, the revocation checks are
+     collected and done for all certificates of the chain at once.  */
+  batch_buffer.nitems = 0;
+  batch = listmode? NULL : &batch_buffer;
 
   gnupg_get_isotime (current_time);
   gnupg_copy_time (ctrl->current_time, current_time);
@@ -1881,12 +2029,12 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
           else if (opt.no_trusted_cert_crl_check || rootca_flags->relax)
             ;
           else
-            rc = is_cert_still_valid (ctrl,
-                                      (flags & VALIDATE_FLAG_CHAIN_MODEL),
-                                      listmode, listfp,
-                                      subject_cert, subject_cert,
-                                      &any_revoked, &any_no_crl,
-                                      &any_crl_too_old);
+            rc = check_or_defer_revocation (ctrl,
+                                            (flags & VALIDATE_FLAG_CHAIN_MODEL),
+                                            listmode, listfp,
+                                            subject_cert, subject_cert, batch,
+                                            &any_revoked, &any_no_crl,
+                                            &any_crl_too_old);
           if (rc)
             goto leave;
 
@@ -2105,11 +2253,12 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
                            || (!istrusted_rc && rootca_flags->relax)))
         rc = 0;
       else
-        rc = is_cert_still_valid (ctrl,
-                                  (flags & VALIDATE_FLAG_CHAIN_MODEL),
-                                  listmode, listfp,
-                                  subject_cert, issuer_cert,
-                                  &any_revoked, &any_no_crl, &any_crl_too_old);
+        rc = check_or_defer_revocation (ctrl,
+                                        (flags & VALIDATE_FLAG_CHAIN_MODEL),
+                                        listmode, listfp,
+                                        subject_cert, issuer_cert, batch,
+                                        &any_revoked, &any_no_crl,
+                                        &any_crl_too_old);
       if (rc)
         goto leave;
 
@@ -2140,6 +2289,15 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
       depth++;
     } /* End chain traversal. */
 
+  if (batch)
+    {
+      rc = check_revocation_batch (ctrl, (flags & VALIDATE_FLAG_CHAIN_MODEL),
+                                   listmode, listfp, batch, &any_revoked,
+                                   &any_no_crl, &any_crl_too_old);
+      if (rc)
+        goto leave;
+    }
+
   if (!listmode && !opt.quiet)
     {
       if (opt.no_policy_check)
@@ -2247,6 +2405,7 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
 
   if (r_exptime)
     gnupg_copy_time (r_exptime, exptime);
+  release_revocation_batch (&batch_buffer);
   xfree (issuer);
   xfree (subject);
   keydb_release (kh);
@@ -2263,6 +2422,172 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
 }
 
 
+/* Compute the key for the cache of validated chains for validating
+ * CERT with FLAGS and store it at the 82 byte buffer KEY.  Besides
+ * the fingerprint the key covers the options which affect the result
+ * so that a validation result can be shared with other gpgsm
+ * processes.  Returns false on error.  */
+static int
+validated_chain_key (ctrl_t ctrl, ksba_cert_t cert, unsigned int flags,
+                     char *key)
+{
+  gcry_md_hd_t md;
+  strlist_t sl;
+  char numbuf[100];
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    return 0;
+  snprintf (numbuf, sizeof numbuf, "%u %d %d %d %d %d %d %d %d %d",
+            flags & (VALIDATE_FLAG_NO_DIRMNGR | VALIDATE_FLAG_STEED
+                     | VALIDATE_FLAG_CHAIN_MODEL),
+            ctrl->use_ocsp, ctrl->offline, opt.disable_dirmngr,
+            opt.no_crl_check, opt.no_trusted_cert_crl_check,
+            opt.enable_issuer_based_crl_check, opt.no_policy_check,
+            opt.ignore_expiration, (int)opt.compliance);
+  gcry_md_write (md, numbuf, strlen (numbuf) + 1);
+  gcry_md_write (md, gnupg_homedir (), strlen (gnupg_homedir ()) + 1);
+  if (opt.policy_file)
+    gcry_md_write (md, opt.policy_file, strlen (opt.policy_file) + 1);
+  for (sl = opt.ignored_cert_extensions; sl; sl = sl->next)
+    gcry_md_write (md, sl->d, strlen (sl->d) + 1);
+
+  gpgsm_get_fingerprint (cert, GCRY_MD_SHA1, (unsigned char *)numbuf, NULL);
+  bin2hex (numbuf, 20, key);
+  key[40] = '.';
+  bin2hex (gcry_md_read (md, GCRY_MD_SHA1), 20, key + 41);
+  gcry_md_close (md);
+  return 1;
+}
+
+
+/* Put the successful validation of CERT described by KEY, EXPTIME
+ * and RETFLAGS into the cache of validated chains of this session
+ * and into the one of the dirmngr.  */
+static void
+put_validated_chain (ctrl_t ctrl, ksba_cert_t cert, const char *key,
+                     const ksba_isotime_t exptime, unsigned int retflags,
+                     unsigned int flags)
+{
+  validated_chain_t vc, *vcp;
+  size_t buflen;
+  char buf[1];
+  char value[50];
+  int n;
+
+  vc = xtrycalloc (1, sizeof *vc);
+  if (!vc)
+    return;
+  strcpy (vc->key, key);
+  gnupg_copy_time (vc->exptime, exptime);
+  vc->retflags = retflags;
+  if (!ksba_cert_get_user_data (cert, "is_qualified", &buf, sizeof (buf),
+                                &buflen) && buflen)
+    vc->is_qualified = !!*buf;
+  else
+    vc->is_qualified = -1;
+
+  /* The results from the dirmngr are cached by the dirmngr only up to
+   * their nextUpdate; we limit the time we use the outcome of those
+   * checks without asking the dirmngr again.  */
+  gnupg_copy_time (vc->expires, ctrl->current_time);
+  add_seconds_to_isotime (vc->expires, VALIDATED_CHAIN_TTL);
+  if (*exptime && strcmp (exptime, vc->expires) < 0)
+    gnupg_copy_time (vc->expires, exptime);
+
+  vc->next = ctrl->validated_chains;
+  ctrl->validated_chains = vc;
+  for (n=0, vcp = &ctrl->validated_chains; *vcp; vcp = &(*vcp)->next, n++)
+    if (n == MAX_VALIDATED_CHAINS)
+      {
+        while ((vc = *vcp))
+          {
+            *vcp = vc->next;
+            xfree (vc);
+          }
+        break;
+      }
+
+  vc = ctrl->validated_chains;
+  if (!ctrl->offline && !opt.disable_dirmngr
+      && !(flags & VALIDATE_FLAG_NO_DIRMNGR))
+    {
+      snprintf (value, sizeof value, "%u %s %d", vc->retflags,
+                *vc->exptime? vc->exptime : "-", vc->is_qualified);
+      gpgsm_dirmngr_put_validcache (ctrl, vc->key, vc->expires, value);
+    }
+}
+
+
+/* Look up the validation of CERT described by KEY in the cache of
+ * validated chains.  If found the values are stored at R_EXPTIME and
+ * RETFLAGS and true is returned.  */
+static int
+get_validated_chain (ctrl_t ctrl, ksba_cert_t cert, const char *key,
+                     unsigned int flags,
+                     ksba_isotime_t r_exptime, unsigned int *retflags)
+{
+  validated_chain_t vc, *vcp;
+  char *value = NULL;
+  const char *fields[4];
+  char buf[1];
+
+  gnupg_get_isotime (ctrl->current_time);
+  for (vcp = &ctrl->validated_chains; (vc = *vcp); )
+    {
+      if (strcmp (vc->expires, ctrl->current_time) < 0)
+        {
+          *vcp = vc->next;  /* Expired.  */
+          xfree (vc);
+          continue;
+        }
+      if (!strcmp (vc->key, key))
+        break;
+      vcp = &vc->next;
+    }
+
+  if (!vc && !ctrl->offline && !opt.disable_dirmngr
+      && !(flags & VALIDATE_FLAG_NO_DIRMNGR)
+      && !gpgsm_dirmngr_get_validcache (ctrl, key, &value))
+    {
+      /* Another process validated this chain.  */
+      vc = xtrycalloc (1, sizeof *vc);
+      if (vc && split_fields (value, fields, DIM (fields)) == DIM (fields)
+          && !check_isotime (fields[0]))
+        {
+          strcpy (vc->key, key);
+          gnupg_copy_time (vc->expires, fields[0]);
+          vc->retflags = strtoul (fields[1], NULL, 10);
+          if (strcmp (fields[2], "-") && !check_isotime (fields[2]))
+            gnupg_copy_time (vc->exptime, fields[2]);
+          vc->is_qualified = atoi (fields[3]);
+          vc->next = ctrl->validated_chains;
+          ctrl->validated_chains = vc;
+        }
+      else
+        {
+          xfree (vc);
+          vc = NULL;
+        }
+      xfree (value);
+    }
+
+  if (!vc)
+    return 0;
+
+  if (r_exptime)
+    gnupg_copy_time (r_exptime, vc->exptime);
+  *retflags |= vc->retflags;
+  if (vc->is_qualified != -1)
+    {
+      buf[0] = !!vc->is_qualified;
+      ksba_cert_set_user_data (cert, "is_qualified", buf, 1);
+    }
+  if (opt.verbose)
+    log_info ("chain validation result taken from the cache\n");
+  return 1;
+}
+
+
 /* Validate a certificate chain.  For a description see
    do_validate_chain.  This function is a wrapper to handle a root
    certificate with the chain_model flag set.  If RETFLAGS is not
@@ -2274,7 +2599,10 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
    creation time of the signature.  If your are verifying a
    certificate, set it nil (i.e. the empty string).  If the creation
    date of the signature is not known use the special date
-   "19700101T000000" which is treated in a special way here. */
+   "19700101T000000" which is treated in a special way here.
+
+   Successful validations in the shell model are cached for a few
+   minutes and shared with other processes via the dirmngr.  */
 int
 gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
                       ksba_isotime_t r_exptime,
@@ -2284,6 +2612,9 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
   int rc;
   struct rootca_flags_s rootca_flags;
   unsigned int dummy_retflags;
+  ksba_isotime_t exptime;
+  char cachekey[82];
+  int use_cache;
 
   if (!retflags)
     retflags = &dummy_retflags;
@@ -2300,15 +2631,31 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
   *retflags = (flags & VALIDATE_FLAG_CHAIN_MODEL);
 
   memset (&rootca_flags, 0, sizeof rootca_flags);
+  *exptime = 0;
+
+  /* Only the chain model depends on CHECKTIME.  Listings and audit
+     logs need the details of the actual validation.  */
+  use_cache = (!listmode && !ctrl->audit
+               && !(flags & (VALIDATE_FLAG_BYPASS|VALIDATE_FLAG_CHAIN_MODEL))
+               && !opt.no_chain_validation && !opt.force_crl_refresh
+               && !(opt.compat_flags & COMPAT_NO_CHAIN_CACHE)
+               && validated_chain_key (ctrl, cert, flags, cachekey));
 
   if ((flags & VALIDATE_FLAG_BYPASS))
     {
       *retflags |= VALIDATE_FLAG_BYPASS;
       rc = 0;
     }
+  else if (use_cache
+           && get_validated_chain (ctrl, cert, cachekey, flags,
+                                   exptime, retflags))
+    {
+      rc = 0;
+      use_cache = 0;  /* No need to store it again.  */
+    }
   else
     rc = do_validate_chain (ctrl, cert, checktime,
-                            r_exptime, listmode, listfp, flags,
+                            exptime, listmode, listfp, flags,
                             &rootca_flags);
   if (!rc && (flags & VALIDATE_FLAG_STEED))
     {
@@ -2323,12 +2670,17 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
       if (opt.verbose)
         do_list (0, listmode, listfp, _("switching to chain model"));
       rc = do_validate_chain (ctrl, cert, checktime,
-                              r_exptime, listmode, listfp,
+                              exptime, listmode, listfp,
                               (flags |= VALIDATE_FLAG_CHAIN_MODEL),
                               &rootca_flags);
       *retflags |= VALIDATE_FLAG_CHAIN_MODEL;
     }
 
+  if (!rc && use_cache && !(*retflags & VALIDATE_FLAG_CHAIN_MODEL))
+    put_validated_chain (ctrl, cert, cachekey, exptime, *retflags, flags);
+  if (r_exptime)
+    gnupg_copy_time (r_exptime, exptime);
+
   if (opt.verbose)
     do_list (0, listmode, listfp, _("validation model used: %s"),
              (*retflags & VALIDATE_FLAG_BYPASS)?
@@ -58,9 +58,11 @@ struct encrypt_cb_parm_s
   int eof_seen;
   int ready;
   int readerror;
-  int bufsize;
+  size_t bufsize;
   unsigned char *buffer;
-  int buflen;
+  size_t buflen;
+  size_t bufpos;     /* Start of the not yet encrypted data.  */
+  uint64_t nbytes;   /* Number of bytes read from FP.  */
 };
 
 
@@ -507,7 +509,7 @@ encrypt_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
   struct encrypt_cb_parm_s *parm = cb_value;
   int blklen = parm->dek->ivlen;
   unsigned char *p;
-  size_t n;
+  size_t n, avail;
 
   *nread = 0;
   if (!buffer)
@@ -519,36 +521,44 @@ encrypt_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
   if (count < blklen)
     BUG ();
 
-  if (!parm->eof_seen)
-    { /* fillup the buffer */
-      p = parm->buffer;
-      for (n=parm->buflen; n < parm->bufsize; n++)
+  avail = parm->buflen - parm->bufpos;
+  if (parm->bufpos && (parm->eof_seen? avail < blklen : avail < count))
+    { /* Move the remaining data to the start of the buffer.  */
+      memmove (parm->buffer, parm->buffer + parm->bufpos,
+               parm->buflen - parm->bufpos);
+      parm->buflen -= parm->bufpos;
+      parm->bufpos = 0;
+    }
+
+  if (!parm->eof_seen && parm->buflen < count)
+    { /* Fill up the buffer using large reads.  */
+      while (parm->buflen < parm->bufsize)
         {
-          int c = es_getc (parm->fp);
-          if (c == EOF)
+          if (es_read (parm->fp, parm->buffer + parm->buflen,
+                       parm->bufsize - parm->buflen, &n))
+            {
+              parm->readerror = errno;
+              return -1;
+            }
+          if (!n)
             {
-              if (es_ferror (parm->fp))
-                {
-                  parm->readerror = errno;
-                  return -1;
-                }
               parm->eof_seen = 1;
               break;
             }
-          p[n] = c;
+          parm->buflen += n;
+          parm->nbytes += n;
         }
-      parm->buflen = n;
     }
 
-  n = parm->buflen < count? parm->buflen : count;
+  avail = parm->buflen - parm->bufpos;
+  n = avail < count? avail : count;
   n = n/blklen * blklen;
   if (n)
     { /* encrypt the stuff */
-      gcry_cipher_encrypt (parm->dek->chd, buffer, n, parm->buffer, n);
+      gcry_cipher_encrypt (parm->dek->chd, buffer, n,
+                           parm->buffer + parm->bufpos, n);
       *nread = n;
-      /* Who cares about cycles, take the easy way and shift the buffer */
-      parm->buflen -= n;
-      memmove (parm->buffer, parm->buffer+n, parm->buflen);
+      parm->bufpos += n;
     }
   else if (parm->eof_seen)
     { /* no complete block but eof: add padding */
@@ -567,7 +577,7 @@ encrypt_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
 
 
 
-
+
 /* Perform an encrypt operation.
 
    Encrypt the data received on DATA-FD and write it to OUT_FP.  The
@@ -590,6 +600,7 @@ gpgsm_encrypt (ctrl_t ctrl, certlist_t recplist, estream_t data_fp,
   certlist_t cl;
   int count;
   int compliant;
+  time_t started;
 
   memset (&encparm, 0, sizeof encparm);
 
@@ -719,8 +730,10 @@ gpgsm_encrypt (ctrl_t ctrl, certlist_t recplist, estream_t data_fp,
     }
 
   encparm.dek = dek;
-  /* Use a ~8k (AES) or ~4k (3DES) buffer */
-  encparm.bufsize = 500 * dek->ivlen;
+  /* Use a 64k (AES) or 32k (3DES) buffer.  Only complete blocks are
+   * passed to the cipher and thus the size must be a multiple of the
+   * block length.  */
+  encparm.bufsize = 4096 * dek->ivlen;
   encparm.buffer = xtrymalloc (encparm.bufsize);
   if (!encparm.buffer)
     {
@@ -811,6 +824,7 @@ gpgsm_encrypt (ctrl_t ctrl, certlist_t recplist, estream_t data_fp,
 
   /* Main control loop for encryption. */
   recpno = 0;
+  started = gnupg_get_time ();
   do
     {
       err = ksba_cms_build (cms, &stopreason);
@@ -837,6 +851,18 @@ gpgsm_encrypt (ctrl_t ctrl, certlist_t recplist, estream_t data_fp,
       goto leave;
     }
   audit_log (ctrl->audit, AUDIT_ENCRYPTION_DONE);
+  if (opt.verbose)
+    {
+      unsigned long elapsed = gnupg_get_time () - started;
+
+      if (elapsed)
+        log_info ("%llu bytes encrypted in %lu seconds (%llu KiB/s)\n",
+                  (unsigned long long)encparm.nbytes, elapsed,
+                  (unsigned long long)(encparm.nbytes / 1024 / elapsed));
+      else
+        log_info ("%llu bytes encrypted\n",
+                  (unsigned long long)encparm.nbytes);
+    }
   if (!opt.quiet)
     log_info ("encrypted data created\n");
 
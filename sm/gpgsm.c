@@ -86,6 +86,7 @@ enum cmd_and_opt_values {
   aExportSecretKeyP8,
   aExportSecretKeyRaw,
   aServer,
+  aDaemon,
   aLearnCard,
   aCallDirmngr,
   aCallProtectTool,
@@ -258,6 +259,7 @@ static gpgrt_opt_t opts[] = {
 
   ARGPARSE_c (aLearnCard, "learn-card", N_("register a smartcard")),
   ARGPARSE_c (aServer, "server", N_("run in server mode")),
+  ARGPARSE_c (aDaemon, "daemon", N_("run in daemon mode")),
   ARGPARSE_c (aCallDirmngr, "call-dirmngr",
               N_("pass a command to the dirmngr")),
   ARGPARSE_c (aCallProtectTool, "call-protect-tool",
@@ -1085,6 +1087,11 @@ main ( int argc, char **argv)
           set_cmd (&cmd, aServer);
           break;
 
+        case aDaemon:
+          opt.batch = 1;
+          set_cmd (&cmd, aDaemon);
+          break;
+
         case aCallDirmngr:
           opt.batch = 1;
           set_cmd (&cmd, aCallDirmngr);
@@ -1639,7 +1646,7 @@ main ( int argc, char **argv)
 /*                 "create and verify\n" */
 /*                 "qualified signatures according to German law.\n")); */
 
-  if (logfile && cmd == aServer)
+  if (logfile && (cmd == aServer || cmd == aDaemon))
     {
       log_set_file (logfile);
       log_set_prefix (NULL, GPGRT_LOG_WITH_PREFIX | GPGRT_LOG_WITH_TIME | GPGRT_LOG_WITH_PID);
@@ -1943,6 +1950,10 @@ main ( int argc, char **argv)
       gpgsm_server (recplist);
       break;
 
+    case aDaemon:
+      gpgsm_daemon (recplist);
+      break;
+
     case aCallDirmngr:
       if (!argc)
         wrong_args ("--call-dirmngr <command> {args}");
@@ -2414,6 +2425,12 @@ gpgsm_deinit_default_ctrl (ctrl_t ctrl)
     }
   if (n > parent_cache_stats)
     parent_cache_stats = n;
+  while (ctrl->validated_chains)
+    {
+      validated_chain_t next = ctrl->validated_chains->next;
+      xfree (ctrl->validated_chains);
+      ctrl->validated_chains = next;
+    }
 }
 
 
@@ -243,6 +243,18 @@ struct cert_cache_item_s
 };
 typedef struct cert_cache_item_s *cert_cache_item_t;
 
+/* An object to cache the result of a successful chain validation.  */
+struct validated_chain_s
+{
+  struct validated_chain_s *next;
+  char key[82];             /* Fingerprint and context of the check.  */
+  ksba_isotime_t expires;   /* The entry may be used up to this time.  */
+  ksba_isotime_t exptime;   /* The nearest expiration time of the chain.  */
+  unsigned int retflags;    /* The flags returned by the validation.  */
+  int is_qualified;         /* -1 = unknown, 0 = no, 1 = yes.  */
+};
+typedef struct validated_chain_s *validated_chain_t;
+
 /* On object used to keep a KEYINFO data from the agent. */
 struct keyinfo_cache_item_s
 {
@@ -311,6 +323,9 @@ struct server_control_s
   /* The cache used to find the parent cert.  */
   cert_cache_item_t parent_cert_cache;
 
+  /* The cache of successfully validated chains.  */
+  validated_chain_t validated_chains;
+
   /* Cache of recently gathered KEYINFO data.  */
   keyinfo_cache_item_t keyinfo_cache;
   int keyinfo_cache_valid;
@@ -330,6 +345,24 @@ struct certlist_s
 };
 typedef struct certlist_s *certlist_t;
 
+/* The maximum number of certificates for gpgsm_dirmngr_isvalid_multi.  */
+#define MAX_ISVALID_MULTI 8
+
+/* A certificate to be checked by gpgsm_dirmngr_isvalid_multi.  */
+struct isvalid_item_s
+{
+  ksba_cert_t cert;            /* The certificate to check.  */
+  gpg_error_t err;             /* The result of the check.  */
+  gnupg_isotime_t revoked_at;  /* The revocation time if known.  */
+  char *reason;                /* Malloced revocation reason or NULL.  */
+  /* Internal use by gpgsm_dirmngr_isvalid_multi.  */
+  char fpr[41];
+  unsigned char signer_fpr[20];
+  unsigned int seen:1;
+  unsigned int want_signer_check:1;
+};
+typedef struct isvalid_item_s *isvalid_item_t;
+
 
 /* A structure carrying information about trusted root certificates. */
 struct rootca_flags_s
@@ -355,6 +388,7 @@ int  gpgsm_parse_validation_model (const char *model);
 
 /*-- server.c --*/
 void gpgsm_server (certlist_t default_recplist);
+void gpgsm_daemon (certlist_t default_recplist);
 void gpgsm_init_statusfp (ctrl_t ctrl);
 gpg_error_t gpgsm_status (ctrl_t ctrl, int no, const char *text);
 gpg_error_t gpgsm_status2 (ctrl_t ctrl, int no, ...) GPGRT_ATTR_SENTINEL(0);
@@ -535,6 +569,9 @@ int gpgsm_agent_scd_keypairinfo (ctrl_t ctrl, strlist_t *r_list);
 int gpgsm_agent_istrusted (ctrl_t ctrl, ksba_cert_t cert, const char *hexfpr,
                            struct rootca_flags_s *rootca_flags);
 int gpgsm_agent_havekey (ctrl_t ctrl, const char *hexkeygrip);
+gpg_error_t gpgsm_agent_havekey_list (ctrl_t ctrl, unsigned int limit,
+                                      unsigned char **r_grips,
+                                      size_t *r_count);
 int gpgsm_agent_marktrusted (ctrl_t ctrl, ksba_cert_t cert);
 int gpgsm_agent_learn (ctrl_t ctrl);
 int gpgsm_agent_passwd (ctrl_t ctrl, const char *hexkeygrip, const char *desc);
@@ -559,6 +596,13 @@ gpg_error_t gpgsm_dirmngr_isvalid (ctrl_t ctrl,
                                    int use_ocsp,
                                    gnupg_isotime_t r_revoked_at,
                                    char **r_reason);
+gpg_error_t gpgsm_dirmngr_isvalid_multi (ctrl_t ctrl, isvalid_item_t items,
+                                         int nitems, int use_ocsp);
+gpg_error_t gpgsm_dirmngr_get_validcache (ctrl_t ctrl, const char *key,
+                                          char **r_value);
+gpg_error_t gpgsm_dirmngr_put_validcache (ctrl_t ctrl, const char *key,
+                                          const char *expires,
+                                          const char *value);
 int gpgsm_dirmngr_lookup (ctrl_t ctrl, strlist_t names, const char *uri,
                           int cache_only,
                           void (*cb)(void*, ksba_cert_t), void *cb_value);
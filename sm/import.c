@@ -496,17 +496,44 @@ reimport_one (ctrl_t ctrl, struct stats_s *stats, estream_t fp)
 
 
 
+/* Return a handle with a batch of inserts started or NULL if that is
+ * not possible.  Keeping the keybox locked for all certificates and
+ * writing its index only once speeds up the import of many
+ * certificates; the batch is finished by releasing the handle.  */
+static KEYDB_HANDLE
+begin_import_batch (ctrl_t ctrl)
+{
+  KEYDB_HANDLE kh;
+  gpg_error_t err;
+
+  kh = keydb_new (ctrl);
+  if (!kh)
+    return NULL;
+  err = keydb_begin_batch (kh);
+  if (err)
+    {
+      log_info ("can't start a batch import: %s\n", gpg_strerror (err));
+      keydb_release (kh);
+      return NULL;
+    }
+  return kh;
+}
+
+
 int
 gpgsm_import (ctrl_t ctrl, estream_t in_fp, int reimport_mode)
 {
   int rc;
   struct stats_s stats;
+  KEYDB_HANDLE batch;
 
   memset (&stats, 0, sizeof stats);
+  batch = begin_import_batch (ctrl);
   if (reimport_mode)
     rc = reimport_one (ctrl, &stats, in_fp);
   else
     rc = import_one (ctrl, &stats, in_fp);
+  keydb_release (batch);
   print_imported_summary (ctrl, &stats);
   /* If we never printed an error message do it now so that a command
      line invocation will return with an error (log_error keeps a
@@ -523,8 +550,10 @@ gpgsm_import_files (ctrl_t ctrl, int nfiles, char **files,
 {
   int rc = 0;
   struct stats_s stats;
+  KEYDB_HANDLE batch;
 
   memset (&stats, 0, sizeof stats);
+  batch = begin_import_batch (ctrl);
 
   if (!nfiles)
     {
@@ -544,6 +573,7 @@ gpgsm_import_files (ctrl_t ctrl, int nfiles, char **files,
             rc = 0;
         }
     }
+  keydb_release (batch);
   print_imported_summary (ctrl, &stats);
   /* If we never printed an error message do it now so that a command
      line invocation will return with an error (log_error keeps a
@@ -132,6 +132,10 @@ struct keydb_handle {
    * keydb_release.  */
   int keep_lock;
 
+  /* If this flag is set a batch of inserts has been started with
+   * keydb_begin_batch; it is finished by keydb_release.  */
+  int in_batch;
+
   int found;
   int saved_found;
   int current;
@@ -694,6 +698,13 @@ keydb_release (KEYDB_HANDLE hd)
     }
   else
     {
+      if (hd->in_batch)
+        {
+          for (i=0; i < hd->used; i++)
+            if (hd->active[i].type == KEYDB_RESOURCE_TYPE_KEYBOX)
+              keybox_end_batch (hd->active[i].u.kr);
+          hd->in_batch = 0;
+        }
       hd->keep_lock = 0;
       unlock_all (hd);
       for (i=0; i < hd->used; i++)
@@ -814,6 +825,43 @@ keydb_lock (KEYDB_HANDLE hd)
 }
 
 
+/* Lock the keyring like keydb_lock and start a batch of inserts.
+ * Until HD is released the lock is not released by the inserts done
+ * with other handles and the index of the keybox is written only
+ * once.  This is used when importing many certificates.  */
+gpg_error_t
+keydb_begin_batch (KEYDB_HANDLE hd)
+{
+  gpg_error_t err;
+  int i;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (hd->use_keyboxd || hd->in_batch)
+    return 0;
+
+  err = keydb_lock (hd);
+  if (err)
+    return err;
+
+  for (i=0; i < hd->used; i++)
+    {
+      if (hd->active[i].type != KEYDB_RESOURCE_TYPE_KEYBOX)
+        continue;
+      err = keybox_begin_batch (hd->active[i].u.kr);
+      if (err)
+        {
+          for (i--; i >= 0; i--)
+            if (hd->active[i].type == KEYDB_RESOURCE_TYPE_KEYBOX)
+              keybox_end_batch (hd->active[i].u.kr);
+          return err;
+        }
+    }
+  hd->in_batch = 1;
+  return 0;
+}
+
+
 
 static int
 lock_all (KEYDB_HANDLE hd)
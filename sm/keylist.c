@@ -1542,6 +1542,13 @@ list_cert_chain (ctrl_t ctrl, KEYDB_HANDLE hd,
 
 
 
+static int
+cmp_keygrip (const void *a, const void *b)
+{
+  return memcmp (a, b, 20);
+}
+
+
 /* List all internal keys or just the keys given as NAMES.  MODE is a
    bit vector to specify what keys are to be included; see
    gpgsm_list_keys (below) for details.  If RAW_MODE is true, the raw
@@ -1561,6 +1568,9 @@ list_internal_keys (ctrl_t ctrl, strlist_t names, estream_t fp,
   const char *lastresname, *resname;
   int have_secret;
   int want_ephemeral = ctrl->with_ephemeral_keys;
+  unsigned char *seckeygrips = NULL;
+  size_t nseckeygrips = 0;
+  int have_seckeygrips = 0;
 
   hd = keydb_new (ctrl);
   if (!hd)
@@ -1623,6 +1633,20 @@ list_internal_keys (ctrl_t ctrl, strlist_t names, estream_t fp,
   if (want_ephemeral)
     keydb_set_ephemeral (hd, 1);
 
+  /* To check for secret keys, get the list of all secret keys of the
+   * agent once instead of asking for each certificate.  If the agent
+   * has too many keys we fall back to single requests.  */
+  if (mode && !names)
+    {
+      rc = gpgsm_agent_havekey_list (ctrl, 1000, &seckeygrips, &nseckeygrips);
+      if (!rc)
+        have_seckeygrips = 1;
+      else if (opt.verbose)
+        log_info ("problem with fast path key listing: %s - ignored\n",
+                  gpg_strerror (rc));
+      rc = 0;
+    }
+
   /* It would be nice to see which of the given users did actually
      match one in the keyring.  To implement this we need to have a
      found flag for each entry in desc and to set this we must check
@@ -1679,18 +1703,26 @@ list_internal_keys (ctrl_t ctrl, strlist_t names, estream_t fp,
         }
 
       have_secret = 0;
-      if (mode)
+      if (mode && have_seckeygrips)
+        {
+          unsigned char grip[20];
+
+          if (gpgsm_get_keygrip (cert, grip)
+              && bsearch (grip, seckeygrips, nseckeygrips, 20, cmp_keygrip))
+            have_secret = 1;
+        }
+      else if (mode)
         {
           char *p = gpgsm_get_keygrip_hexstring (cert);
           if (p)
             {
               rc = gpgsm_agent_havekey (ctrl, p);
+              xfree (p);
               if (!rc)
                 have_secret = 1;
               else if ( gpg_err_code (rc) != GPG_ERR_NO_SECKEY)
                 goto leave;
               rc = 0;
-              xfree (p);
             }
         }
 
@@ -1740,6 +1772,7 @@ list_internal_keys (ctrl_t ctrl, strlist_t names, estream_t fp,
  leave:
   ksba_cert_release (cert);
   ksba_cert_release (lastcert);
+  xfree (seckeygrips);
   xfree (desc);
   keydb_release (hd);
   return rc;
@@ -148,6 +148,23 @@ struct buffer_s
 
 
 /* Parser communication object.  */
+/* An entry of the cache for derived keys.  Archives with many bags
+ * often use the same salt and iteration count for several of them.
+ * Only a hash of the password is stored.  */
+struct kdf_cache_s
+{
+  struct kdf_cache_s *next;
+  int id;             /* The PKCS#12 KDF id or 0 for PBKDF2.  */
+  int digest_algo;    /* The digest algo used with PBKDF2.  */
+  int iter;
+  size_t saltlen;
+  char salt[32];
+  unsigned char pwhash[20];
+  size_t keylen;
+  unsigned char key[32];
+};
+
+
 struct p12_parse_ctx_s
 {
   /* The callback for parsed certificates and its arg.  */
@@ -168,6 +185,12 @@ struct p12_parse_ctx_s
 
   /* A second private key as an MPI array.   */
   gcry_mpi_t *privatekey2;
+
+  /* The cache of derived keys.  */
+  struct kdf_cache_s *kdfcache;
+
+  /* The index of the charset which worked for the last bag.  */
+  int charsetidx;
 };
 
 
@@ -421,15 +444,89 @@ string_to_key (int id, char *salt, size_t saltlen, int iter, const char *pw,
 }
 
 
+/* Derive a key of KEYLEN bytes into KEYBUF.  ID is the PKCS#12 KDF
+ * id or 0 to use PBKDF2 with DIGEST_ALGO.  If CACHE is not NULL the
+ * key is taken from or stored in that list.  */
+static int
+derive_key (struct kdf_cache_s **cache, int id, int digest_algo,
+            char *salt, size_t saltlen, int iter, const char *pw,
+            size_t keylen, unsigned char *keybuf)
+{
+  struct kdf_cache_s *ce;
+  unsigned char pwhash[20];
+  int rc;
+
+  if (cache && saltlen <= sizeof ce->salt && keylen <= sizeof ce->key)
+    {
+      gcry_md_hash_buffer (GCRY_MD_SHA1, pwhash, pw, strlen (pw));
+      for (ce = *cache; ce; ce = ce->next)
+        if (ce->id == id && ce->digest_algo == digest_algo
+            && ce->iter == iter && ce->keylen == keylen
+            && ce->saltlen == saltlen && !memcmp (ce->salt, salt, saltlen)
+            && !memcmp (ce->pwhash, pwhash, 20))
+          {
+            memcpy (keybuf, ce->key, keylen);
+            return 0;
+          }
+    }
+  else
+    cache = NULL;
+
+  if (id)
+    rc = string_to_key (id, salt, saltlen, iter, pw, keylen, keybuf);
+  else
+    {
+      rc = gcry_kdf_derive (pw, strlen (pw),
+                            GCRY_KDF_PBKDF2, digest_algo,
+                            salt, saltlen, iter, keylen, keybuf);
+      if (rc)
+        log_error ("gcry_kdf_derive failed: %s\n", gpg_strerror (rc));
+    }
+  if (rc)
+    return rc;
+
+  if (cache && (ce = gcry_calloc_secure (1, sizeof *ce)))
+    {
+      ce->id = id;
+      ce->digest_algo = digest_algo;
+      ce->iter = iter;
+      ce->saltlen = saltlen;
+      memcpy (ce->salt, salt, saltlen);
+      memcpy (ce->pwhash, pwhash, 20);
+      ce->keylen = keylen;
+      memcpy (ce->key, keybuf, keylen);
+      ce->next = *cache;
+      *cache = ce;
+    }
+  return 0;
+}
+
+
+/* Release the cache of derived keys.  */
+static void
+release_kdf_cache (struct kdf_cache_s *cache)
+{
+  struct kdf_cache_s *next;
+
+  for (; cache; cache = next)
+    {
+      next = cache->next;
+      wipememory (cache, sizeof *cache);
+      gcry_free (cache);
+    }
+}
+
+
 static int
-set_key_iv (gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
+set_key_iv (struct kdf_cache_s **cache,
+            gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
             const char *pw, int keybytes)
 {
   unsigned char keybuf[24];
   int rc;
 
   log_assert (keybytes == 5 || keybytes == 24);
-  if (string_to_key (1, salt, saltlen, iter, pw, keybytes, keybuf))
+  if (derive_key (cache, 1, 0, salt, saltlen, iter, pw, keybytes, keybuf))
     return -1;
   rc = gcry_cipher_setkey (chd, keybuf, keybytes);
   if (rc)
@@ -438,7 +535,7 @@ set_key_iv (gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
       return -1;
     }
 
-  if (string_to_key (2, salt, saltlen, iter, pw, 8, keybuf))
+  if (derive_key (cache, 2, 0, salt, saltlen, iter, pw, 8, keybuf))
     return -1;
   rc = gcry_cipher_setiv (chd, keybuf, 8);
   if (rc)
@@ -451,7 +548,8 @@ set_key_iv (gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
 
 
 static int
-set_key_iv_pbes2 (gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
+set_key_iv_pbes2 (struct kdf_cache_s **cache,
+                  gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
                   const void *iv, size_t ivlen, const char *pw,
                   int cipher_algo, int digest_algo)
 {
@@ -466,12 +564,9 @@ set_key_iv_pbes2 (gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
   if (!keybuf)
     return -1;
 
-  rc = gcry_kdf_derive (pw, strlen (pw),
-                        GCRY_KDF_PBKDF2, digest_algo,
-                        salt, saltlen, iter, keylen, keybuf);
-  if (rc)
+  if (derive_key (cache, 0, digest_algo, salt, saltlen, iter, pw,
+                  keylen, keybuf))
     {
-      log_error ("gcry_kdf_derive failed: %s\n", gpg_strerror (rc));
       gcry_free (keybuf);
       return -1;
     }
@@ -496,7 +591,8 @@ set_key_iv_pbes2 (gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
 
 
 static void
-crypt_block (unsigned char *buffer, size_t length, char *salt, size_t saltlen,
+crypt_block (struct kdf_cache_s **cache,
+             unsigned char *buffer, size_t length, char *salt, size_t saltlen,
              int iter, const void *iv, size_t ivlen,
              const char *pw, int cipher_algo, int digest_algo, int encrypt)
 {
@@ -512,9 +608,9 @@ crypt_block (unsigned char *buffer, size_t length, char *salt, size_t saltlen,
     }
 
   if ((cipher_algo == GCRY_CIPHER_AES128 || cipher_algo == GCRY_CIPHER_AES256)
-      ? set_key_iv_pbes2 (chd, salt, saltlen, iter, iv, ivlen, pw,
+      ? set_key_iv_pbes2 (cache, chd, salt, saltlen, iter, iv, ivlen, pw,
                           cipher_algo, digest_algo)
-      : set_key_iv (chd, salt, saltlen, iter, pw,
+      : set_key_iv (cache, chd, salt, saltlen, iter, pw,
                     cipher_algo == GCRY_CIPHER_RFC2268_40? 5:24))
     {
       wipememory (buffer, length);
@@ -544,10 +640,12 @@ crypt_block (unsigned char *buffer, size_t length, char *salt, size_t saltlen,
    and CIPHER_ALGO is the algorithm id to use.  CHECK_FNC is a
    function called with the plaintext and used to check whether the
    decryption succeeded; i.e. that a correct passphrase has been
-   given.  The function returns the length of the unpadded plaintext
-   or 0 on error.  */
+   given.  The charset which worked for the last block is tried
+   first and the derived keys are cached in CTX.  The function
+   returns the length of the unpadded plaintext or 0 on error.  */
 static size_t
-decrypt_block (const void *ciphertext, unsigned char *plaintext, size_t length,
+decrypt_block (struct p12_parse_ctx_s *ctx,
+               const void *ciphertext, unsigned char *plaintext, size_t length,
                char *salt, size_t saltlen,
                int iter, const void *iv, size_t ivlen,
                const char *pw, int cipher_algo, int digest_algo,
@@ -573,12 +671,18 @@ decrypt_block (const void *ciphertext, unsigned char *plaintext, size_t length,
     NULL
   };
   int charsetidx = 0;
+  int hint, pass;
   char *convertedpw = NULL;   /* Malloced and converted password or NULL.  */
   size_t convertedpwsize = 0; /* Allocated length.  */
   size_t plainlen = 0;
 
-  for (charsetidx=0; charsets[charsetidx]; charsetidx++)
+  hint = ctx->charsetidx;
+  if (hint < 0 || hint >= (int)DIM (charsets) - 1)
+    hint = 0;
+  for (pass=0; charsets[pass]; pass++)
     {
+      /* Try the hint first and then the others in their order.  */
+      charsetidx = !pass? hint : pass <= hint? pass - 1 : pass;
       if (*charsets[charsetidx])
         {
           jnlib_iconv_t cd;
@@ -618,12 +722,14 @@ decrypt_block (const void *ciphertext, unsigned char *plaintext, size_t length,
             }
           *outptr = 0;
           jnlib_iconv_close (cd);
-          log_info ("decryption failed; trying charset '%s'\n",
-                    charsets[charsetidx]);
+          if (pass)
+            log_info ("decryption failed; trying charset '%s'\n",
+                      charsets[charsetidx]);
         }
       memcpy (plaintext, ciphertext, length);
-      crypt_block (plaintext, length, salt, saltlen, iter, iv, ivlen,
-                   convertedpw? convertedpw:pw, cipher_algo, digest_algo, 0);
+      crypt_block (&ctx->kdfcache, plaintext, length, salt, saltlen,
+                   iter, iv, ivlen, *charsets[charsetidx]? convertedpw:pw,
+                   cipher_algo, digest_algo, 0);
       dump_to_file (plaintext, length, "raw-decrypt");
       if (check_fnc (plaintext, length))
         {
@@ -643,7 +749,10 @@ decrypt_block (const void *ciphertext, unsigned char *plaintext, size_t length,
                   if (i < n)
                     log_info ("decryption failed; invalid padding octet\n");
                   else
-                    plainlen = length - n;
+                    {
+                      plainlen = length - n;
+                      ctx->charsetidx = charsetidx;
+                    }
                 }
             }
           break; /* Decryption probably succeeded. */
@@ -942,7 +1051,7 @@ parse_bag_encrypted_data (struct p12_parse_ctx_s *ctx, tlv_parser_t tlv)
       log_error ("error allocating decryption buffer\n");
       goto bailout;
     }
-  datalen = decrypt_block (data, plain, datalen, salt, saltlen, iter,
+  datalen = decrypt_block (ctx, data, plain, datalen, salt, saltlen, iter,
                  iv, is_pbes2?16:0, ctx->password,
                  is_pbes2 ? (is_aes256?GCRY_CIPHER_AES256:GCRY_CIPHER_AES128) :
                  is_3des  ? GCRY_CIPHER_3DES : GCRY_CIPHER_RFC2268_40,
@@ -1468,7 +1577,7 @@ parse_shrouded_key_bag (struct p12_parse_ctx_s *ctx, tlv_parser_t tlv)
       log_error ("error allocating decryption buffer\n");
       goto bailout;
     }
-  datalen = decrypt_block (data, plain, datalen, salt, saltlen, iter,
+  datalen = decrypt_block (ctx, data, plain, datalen, salt, saltlen, iter,
                  iv, is_pbes2? 16:0, ctx->password,
                  is_pbes2 ? (is_aes256?GCRY_CIPHER_AES256:GCRY_CIPHER_AES128)
                           : GCRY_CIPHER_3DES,
@@ -2116,6 +2225,7 @@ p12_parse (const unsigned char *buffer, size_t length, const char *pw,
       ctx.privatekey2 = NULL;
     }
 
+  release_kdf_cache (ctx.kdfcache);
   return ctx.privatekey;
 
  bailout:
@@ -2148,6 +2258,7 @@ p12_parse (const unsigned char *buffer, size_t length, const char *pw,
       ctx.privatekey2 = NULL;
     }
   tlv_parser_release (tlv);
+  release_kdf_cache (ctx.kdfcache);
   gcry_free (ctx.curve);
   if (r_curve)
     *r_curve = NULL;
@@ -3104,7 +3215,7 @@ p12_build (gcry_mpi_t *kparms, const void *cert, size_t certlen,
 
       /* Encrypt it. */
       gcry_randomize (salt, 8, GCRY_STRONG_RANDOM);
-      crypt_block (buffer, buflen, salt, 8, 2048, NULL, 0, pw,
+      crypt_block (NULL, buffer, buflen, salt, 8, 2048, NULL, 0, pw,
                    GCRY_CIPHER_RFC2268_40, GCRY_MD_SHA1, 1);
 
       /* Encode the encrypted stuff into a bag. */
@@ -3136,7 +3247,7 @@ p12_build (gcry_mpi_t *kparms, const void *cert, size_t certlen,
 
       /* Encrypt it. */
       gcry_randomize (salt, 8, GCRY_STRONG_RANDOM);
-      crypt_block (buffer, buflen, salt, 8, 2048, NULL, 0,
+      crypt_block (NULL, buffer, buflen, salt, 8, 2048, NULL, 0,
                    pw, GCRY_CIPHER_3DES, GCRY_MD_SHA1, 1);
 
       /* Encode the encrypted stuff into a bag. */
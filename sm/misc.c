@@ -135,7 +135,7 @@ transform_sigval (const unsigned char *sigval, size_t sigvallen, int mdalgo,
   const unsigned char *rsa_s, *ecc_r, *ecc_s;
   size_t rsa_s_len, ecc_r_len, ecc_s_len;
   const char *oid;
-  gcry_sexp_t sexp;
+  struct canon_sexp_value_s args[3];
   const char *eddsa_curve = NULL;
 
   rsa_s = ecc_r = ecc_s = NULL;
@@ -290,20 +290,37 @@ transform_sigval (const unsigned char *sigval, size_t sigvallen, int mdalgo,
         }
     }
 
+  /* The layout is fixed; thus build the canonical S-expression
+   * directly instead of going through gcry_sexp_build.  */
+  args[0].data = oid;
   if (is_pubkey)
-    err = gcry_sexp_build (&sexp, NULL, "(sig-val(%s))", oid);
+    *r_newsigval = make_canon_sexp_from_template
+      ("(7:sig-val(" CANON_SEXP_STRING "))", args, r_newsigvallen);
   else if (pkalgo == GCRY_PK_RSA)
-    err = gcry_sexp_build (&sexp, NULL, "(sig-val(%s(s%b)))", oid,
-                           (int)rsa_s_len, rsa_s);
+    {
+      args[1].data = rsa_s;
+      args[1].len = rsa_s_len;
+      *r_newsigval = make_canon_sexp_from_template
+        ("(7:sig-val(" CANON_SEXP_STRING "(1:s" CANON_SEXP_BYTES ")))",
+         args, r_newsigvallen);
+    }
   else if (pkalgo == GCRY_PK_ECC || pkalgo == GCRY_PK_EDDSA)
-    err = gcry_sexp_build (&sexp, NULL, "(sig-val(%s(r%b)(s%b)))", oid,
-                           (int)ecc_r_len, ecc_r, (int)ecc_s_len, ecc_s);
-  if (err)
-    return err;
-  err = make_canon_sexp (sexp, r_newsigval, r_newsigvallen);
-  gcry_sexp_release (sexp);
+    {
+      args[1].data = ecc_r;
+      args[1].len = ecc_r_len;
+      args[2].data = ecc_s;
+      args[2].len = ecc_s_len;
+      *r_newsigval = make_canon_sexp_from_template
+        ("(7:sig-val(" CANON_SEXP_STRING
+         "(1:r" CANON_SEXP_BYTES ")(1:s" CANON_SEXP_BYTES ")))",
+         args, r_newsigvallen);
+    }
+  else
+    return gpg_error (GPG_ERR_PUBKEY_ALGO);
+  if (!*r_newsigval)
+    return gpg_error_from_syserror ();
 
-  return err;
+  return 0;
 }
 
 
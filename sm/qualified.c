@@ -23,19 +23,40 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include "gpgsm.h"
 #include "../common/i18n.h"
+#include "../common/sysutils.h"
 #include <ksba.h>
 
 
-/* We open the file only once and keep the open file pointer as well
-   as the name of the file here.  Note that, a listname not equal to
-   NULL indicates that this module has been initialized and if the
-   LISTFP is also NULL, no list of qualified signatures exists. */
+/* An entry of the list of qualified certificates.  */
+struct qualified_item_s
+{
+  unsigned char fpr[20];
+  char country[3];
+  int lnr;         /* Line number; used to keep the first duplicate.  */
+};
+
+/* The name of the list file and the stream used while reading it.
+   Note, that a listname not equal to NULL indicates that this module
+   has been initialized.  */
 static char *listname;
 static estream_t listfp;
 
+/* The entries of the list sorted by fingerprint.  The list is read
+   on first use and read again if the size or the mtime of the file
+   changes.  LIST_ERR is the error which stopped reading the list; it
+   is returned for fingerprints not found in the entries read before
+   the error.  */
+static struct qualified_item_s *list_items;
+static size_t list_nitems;
+static gpg_error_t list_err;
+static int list_loaded;
+static uint64_t list_size;
+static uint64_t list_mtime;
+
 
 /* Read the trustlist and return entry by entry.  KEY must point to a
    buffer of at least 41 characters. COUNTRY shall be a buffer of at
@@ -55,18 +76,6 @@ read_list (char *key, char *country, int *lnr)
   *key = 0;
   *country = 0;
 
-  if (!listname)
-    {
-      listname = make_filename (gnupg_sysconfdir (), "qualified.txt", NULL);
-      listfp = es_fopen (listname, "r");
-      if (!listfp && errno != ENOENT)
-        {
-          err = gpg_error_from_syserror ();
-          log_error (_("can't open '%s': %s\n"), listname, gpg_strerror (err));
-          return err;
-        }
-    }
-
   if (!listfp)
     return gpg_error (GPG_ERR_EOF);
 
@@ -127,6 +136,110 @@ read_list (char *key, char *country, int *lnr)
 }
 
 
+static int
+cmp_item (const void *a, const void *b)
+{
+  return memcmp (a, b, 20);
+}
+
+
+static int
+cmp_item_lnr (const void *a_arg, const void *b_arg)
+{
+  const struct qualified_item_s *a = a_arg;
+  const struct qualified_item_s *b = b_arg;
+  int cmp;
+
+  cmp = memcmp (a->fpr, b->fpr, 20);
+  return cmp? cmp : a->lnr - b->lnr;
+}
+
+
+/* Read the list of qualified certificates into LIST_ITEMS unless it
+   has already been read and did not change.  */
+static void
+load_list (void)
+{
+  gpg_error_t err;
+  struct stat st;
+  uint64_t size = 0, mtime = 0;
+  struct qualified_item_s *items = NULL, *tmp;
+  size_t nitems = 0, nalloced = 0;
+  char key[41];
+  char country[3];
+  int lnr = 0;
+
+  if (!listname)
+    listname = make_filename (gnupg_sysconfdir (), "qualified.txt", NULL);
+
+  if (!gnupg_stat (listname, &st))
+    {
+      size = st.st_size;
+      mtime = st.st_mtime;
+    }
+  if (list_loaded && size == list_size && mtime == list_mtime)
+    return;  /* Unchanged.  */
+
+  xfree (list_items);
+  list_items = NULL;
+  list_nitems = 0;
+  list_err = 0;
+  list_loaded = 1;
+  list_size = size;
+  list_mtime = mtime;
+
+  listfp = es_fopen (listname, "r");
+  if (!listfp)
+    {
+      if (errno != ENOENT)
+        {
+          list_err = gpg_error_from_syserror ();
+          log_error (_("can't open '%s': %s\n"),
+                     listname, gpg_strerror (list_err));
+        }
+      return;
+    }
+
+  while (!(err = read_list (key, country, &lnr)))
+    {
+      if (nitems == nalloced)
+        {
+          nalloced += 32;
+          tmp = xtryrealloc (items, nalloced * sizeof *items);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              break;
+            }
+          items = tmp;
+        }
+      hex2bin (key, items[nitems].fpr, 20);
+      strcpy (items[nitems].country, country);
+      items[nitems].lnr = lnr;
+      nitems++;
+    }
+  if (gpg_err_code (err) != GPG_ERR_EOF)
+    list_err = err;
+  es_fclose (listfp);
+  listfp = NULL;
+
+  /* Sort the list and keep only the first entry of a fingerprint
+     as that one was used when the file was scanned for each
+     lookup.  */
+  if (nitems)
+    {
+      size_t i, j;
+
+      qsort (items, nitems, sizeof *items, cmp_item_lnr);
+      for (i=j=1; i < nitems; i++)
+        if (memcmp (items[i].fpr, items[j-1].fpr, 20))
+          items[j++] = items[i];
+      nitems = j;
+    }
+  list_items = items;
+  list_nitems = nitems;
+}
+
 
 
 /* Check whether the certificate CERT is included in the list of
@@ -145,38 +258,34 @@ gpg_error_t
 gpgsm_is_in_qualified_list (ctrl_t ctrl, ksba_cert_t cert, char *country)
 {
   gpg_error_t err;
-  char *fpr;
-  char key[41];
-  char mycountry[3];
-  int lnr = 0;
+  unsigned char fpr[20];
+  const struct qualified_item_s *item;
 
   (void)ctrl;
 
   if (country)
     *country = 0;
 
-  fpr = gpgsm_get_fingerprint_hexstring (cert, GCRY_MD_SHA1);
-  if (!fpr)
+  if (!ksba_cert_get_image (cert, NULL))
     return gpg_error (GPG_ERR_GENERAL);
+  gpgsm_get_fingerprint (cert, GCRY_MD_SHA1, fpr, NULL);
 
-  if (listfp)
-    {
-      /* W32ce has no rewind, thus we use the equivalent code.  */
-      es_fseek (listfp, 0, SEEK_SET);
-      es_clearerr (listfp);
-    }
-  while (!(err = read_list (key, mycountry, &lnr)))
-    {
-      if (!strcmp (key, fpr))
-        break;
-    }
-  if (gpg_err_code (err) == GPG_ERR_EOF)
+  load_list ();
+
+  item = NULL;
+  if (list_nitems)
+    item = bsearch (fpr, list_items, list_nitems, sizeof *list_items,
+                    cmp_item);
+  if (item)
+    err = 0;
+  else if (list_err)
+    err = list_err;
+  else
     err = gpg_error (GPG_ERR_NOT_FOUND);
 
   if (!err && country)
-    strcpy (country, mycountry);
+    strcpy (country, item->country);
 
-  xfree (fpr);
   return err;
 }
 
@@ -26,6 +26,12 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <unistd.h>
+#ifdef HAVE_W32_SYSTEM
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif
 
 #include "gpgsm.h"
 #include <assuan.h>
@@ -572,15 +578,102 @@ cmd_decrypt (assuan_context_t ctx, char *line)
 }
 
 
+/* Helper for cmd_verify to verify the signatures in the files
+ * listed in LISTFP.  */
+static gpg_error_t
+verify_files (ctrl_t ctrl, estream_t listfp)
+{
+  gpg_error_t err;
+  gpg_error_t first_err = 0;
+  char *line = NULL;
+  size_t linelen = 0;
+  size_t maxlen;
+  ssize_t n;
+  unsigned int lno = 0;
+  char *datafile;
+  estream_t fp, datafp;
+
+  for (;;)
+    {
+      maxlen = 2048;
+      n = es_read_line (listfp, &line, &linelen, &maxlen);
+      if (n < 0)
+        {
+          err = gpg_error_from_syserror ();
+          if (!first_err)
+            first_err = err;
+          break;
+        }
+      if (!n)
+        break;  /* EOF.  */
+      lno++;
+      if (!maxlen)
+        {
+          log_error ("input line %u too long or missing LF\n", lno);
+          if (!first_err)
+            first_err = gpg_error (GPG_ERR_LINE_TOO_LONG);
+          break;
+        }
+      /* Strip NL and CR, if present.  We don't strip any spaces so
+       * that we can process nearly all file names.  */
+      while (n && (line[n-1] == '\n' || line[n-1] == '\r'))
+        line[--n] = 0;
+      if (!n)
+        continue;
+      datafile = strchr (line, '\t');
+      if (datafile)
+        *datafile++ = 0;
+
+      gpgsm_status2 (ctrl, STATUS_FILE_START, "1", line, NULL);
+      datafp = NULL;
+      fp = es_fopen (line, "rb");
+      if (fp && datafile)
+        datafp = es_fopen (datafile, "rb");
+      if (!fp || (datafile && !datafp))
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("can't open '%s': %s\n",
+                     fp? datafile : line, gpg_strerror (err));
+          gpgsm_status2 (ctrl, STATUS_FILE_ERROR, "1", line, NULL);
+        }
+      else
+        {
+          err = start_audit_session (ctrl);
+          if (!err)
+            err = gpgsm_verify (ctrl, fp, datafp, NULL);
+        }
+      es_fclose (datafp);
+      es_fclose (fp);
+      gpgsm_status (ctrl, STATUS_FILE_DONE, NULL);
+      if (err && !first_err)
+        first_err = err;
+      if (gpg_err_code (err) == GPG_ERR_ASS_CANCELED)
+        break;
+    }
+
+  xfree (line);
+  return first_err;
+}
+
+
 static const char hlp_verify[] =
-  "VERIFY\n"
+  "VERIFY [--files]\n"
   "\n"
   "This does a verify operation on the message send to the input FD.\n"
   "The result is written out using status lines.  If an output FD was\n"
   "given, the signed text will be written to that.\n"
   "\n"
   "If the signature is a detached one, the server will inquire about\n"
-  "the signed material and the client must provide it.";
+  "the signed material and the client must provide it.\n"
+  "\n"
+  "With --files the input FD provides a list of file names, one per\n"
+  "line, and the signature in each file is verified.  For a detached\n"
+  "signature the name of the file with the signed data is given after\n"
+  "a TAB.  The status lines for each file are framed by FILE_START\n"
+  "and FILE_DONE; FILE_ERROR indicates that a file could not be\n"
+  "opened.  The connections and caches are kept across the files which\n"
+  "is much faster than a VERIFY command for each message.  The first\n"
+  "error is returned.";
 static gpg_error_t
 cmd_verify (assuan_context_t ctx, char *line)
 {
@@ -590,8 +683,9 @@ cmd_verify (assuan_context_t ctx, char *line)
   gnupg_fd_t out_fd = assuan_get_output_fd (ctx);
   estream_t fp = NULL;
   estream_t out_fp = NULL;
+  int files;
 
-  (void)line;
+  files = has_option (line, "--files");
 
   if (fd == GNUPG_INVALID_FD)
     return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
@@ -600,6 +694,16 @@ cmd_verify (assuan_context_t ctx, char *line)
   if (!fp)
     return set_error (gpg_err_code_from_syserror (), "fdopen() failed");
 
+  if (files)
+    {
+      rc = verify_files (ctrl, fp);
+      es_fclose (fp);
+      close_message_fp (ctrl);
+      assuan_close_input_fd (ctx);
+      assuan_close_output_fd (ctx);
+      return rc;
+    }
+
   if (out_fd != GNUPG_INVALID_FD)
     {
       out_fp = open_stream_nc (out_fd, "w");
@@ -1406,8 +1510,13 @@ register_commands (assuan_context_t ctx)
 /* Startup the server. DEFAULT_RECPLIST is the list of recipients as
    set from the command line or config file.  We only require those
    marked as encrypt-to. */
-void
-gpgsm_server (certlist_t default_recplist)
+/* Serve one client.  If FD is ASSUAN_INVALID_FD the client is
+ * connected via stdin and stdout and errors are fatal; else FD is an
+ * accepted socket connection.  CHAINS is used to keep the cache of
+ * validated chains across connections.  */
+static void
+serve_client (assuan_fd_t fd, certlist_t default_recplist,
+              validated_chain_t *chains)
 {
   int rc;
   assuan_fd_t filedes[2];
@@ -1418,29 +1527,48 @@ gpgsm_server (certlist_t default_recplist)
 
   memset (&ctrl, 0, sizeof ctrl);
   gpgsm_init_default_ctrl (&ctrl);
+  if (chains)
+    {
+      ctrl.validated_chains = *chains;
+      *chains = NULL;
+    }
 
-  /* We use a pipe based server so that we can work from scripts.
-     assuan_init_pipe_server will automagically detect when we are
-     called with a socketpair and ignore FILEDES in this case. */
-#define SERVER_STDIN 0
-#define SERVER_STDOUT 1
-
-  filedes[0] = assuan_fdopen (SERVER_STDIN);
-  filedes[1] = assuan_fdopen (SERVER_STDOUT);
   rc = assuan_new (&ctx);
   if (rc)
     {
       log_error ("failed to allocate assuan context: %s\n",
                  gpg_strerror (rc));
-      gpgsm_exit (2);
+      if (fd == ASSUAN_INVALID_FD)
+        gpgsm_exit (2);
+      assuan_sock_close (fd);
+      goto leave;
     }
 
-  rc = assuan_init_pipe_server (ctx, filedes);
+  if (fd == ASSUAN_INVALID_FD)
+    {
+      /* We use a pipe based server so that we can work from scripts.
+         assuan_init_pipe_server will automagically detect when we are
+         called with a socketpair and ignore FILEDES in this case. */
+#define SERVER_STDIN 0
+#define SERVER_STDOUT 1
+
+      filedes[0] = assuan_fdopen (SERVER_STDIN);
+      filedes[1] = assuan_fdopen (SERVER_STDOUT);
+      rc = assuan_init_pipe_server (ctx, filedes);
+    }
+  else
+    rc = assuan_init_socket_server (ctx, fd,
+                                    (ASSUAN_SOCKET_SERVER_ACCEPTED
+                                     |ASSUAN_SOCKET_SERVER_FDPASSING));
   if (rc)
     {
       log_error ("failed to initialize the server: %s\n",
                  gpg_strerror (rc));
-      gpgsm_exit (2);
+      if (fd == ASSUAN_INVALID_FD)
+        gpgsm_exit (2);
+      assuan_sock_close (fd);
+      assuan_release (ctx);
+      goto leave;
     }
   rc = register_commands (ctx);
   if (rc)
@@ -1503,6 +1631,10 @@ gpgsm_server (certlist_t default_recplist)
           log_info ("Assuan processing failed: %s\n", gpg_strerror (rc));
           continue;
         }
+
+      /* With a socket connection there is only one session.  */
+      if (fd != ASSUAN_INVALID_FD)
+        break;
     }
 
   gpgsm_release_certlist (ctrl.server_local->recplist);
@@ -1514,9 +1646,172 @@ gpgsm_server (certlist_t default_recplist)
   audit_release (ctrl.audit);
   ctrl.audit = NULL;
 
+  assuan_release (ctx);
+
+ leave:
+  if (chains)
+    {
+      *chains = ctrl.validated_chains;
+      ctrl.validated_chains = NULL;
+    }
   gpgsm_deinit_default_ctrl (&ctrl);
+}
 
-  assuan_release (ctx);
+
+void
+gpgsm_server (certlist_t default_recplist)
+{
+  serve_client (ASSUAN_INVALID_FD, default_recplist, NULL);
+}
+
+
+/* Return 0 if a gpgsm daemon is listening on SOCKNAME.  */
+static int
+check_for_running_daemon (const char *sockname)
+{
+  gpg_error_t err;
+  assuan_context_t ctx = NULL;
+
+  err = assuan_new (&ctx);
+  if (!err)
+    err = assuan_socket_connect (ctx, sockname, (pid_t)(-1), 0);
+  if (ctx)
+    assuan_release (ctx);
+  return err? -1 : 0;
+}
+
+
+/* Create the listening socket SOCKNAME for the daemon and store its
+ * nonce at NONCE.  Errors are fatal.  */
+static assuan_fd_t
+create_daemon_socket (const char *sockname, assuan_sock_nonce_t *nonce)
+{
+  struct sockaddr_un unaddr;
+  struct sockaddr *addr = (struct sockaddr*)&unaddr;
+  socklen_t len;
+  assuan_fd_t fd;
+  int rc;
+
+  fd = assuan_sock_new (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == ASSUAN_INVALID_FD)
+    {
+      log_error ("can't create socket: %s\n", strerror (errno));
+      gpgsm_exit (2);
+    }
+
+  memset (&unaddr, 0, sizeof unaddr);
+  if (assuan_sock_set_sockaddr_un (sockname, addr, NULL))
+    {
+      if (errno == ENAMETOOLONG)
+        log_error ("socket name '%s' is too long\n", sockname);
+      else
+        log_error ("error preparing socket '%s': %s\n",
+                   sockname, gpg_strerror (gpg_error_from_syserror ()));
+      assuan_sock_close (fd);
+      gpgsm_exit (2);
+    }
+
+  len = SUN_LEN (&unaddr);
+  rc = assuan_sock_bind (fd, addr, len);
+  if (rc == -1
+      && (errno == EADDRINUSE
+#ifdef HAVE_W32_SYSTEM
+          || errno == EEXIST
+#endif
+          ))
+    {
+      if (!check_for_running_daemon (sockname))
+        {
+          log_error ("a gpgsm daemon is already running -"
+                     " not starting a new one\n");
+          assuan_sock_close (fd);
+          gpgsm_exit (2);
+        }
+      gnupg_remove (unaddr.sun_path);
+      rc = assuan_sock_bind (fd, addr, len);
+    }
+  if (rc != -1 && (rc=assuan_sock_get_nonce (addr, len, nonce)))
+    log_error ("error getting nonce for the socket\n");
+  if (rc == -1)
+    {
+      log_error ("error binding socket to '%s': %s\n",
+                 unaddr.sun_path, gpg_strerror (gpg_error_from_syserror ()));
+      assuan_sock_close (fd);
+      gpgsm_exit (2);
+    }
+
+  if (gnupg_chmod (unaddr.sun_path, "-rwx"))
+    log_error ("can't set permissions of '%s': %s\n",
+               unaddr.sun_path, strerror (errno));
+
+  if (listen (FD2INT (fd), 64) == -1)
+    {
+      log_error ("listen(fd,%d) failed: %s\n", 64, strerror (errno));
+      assuan_sock_close (fd);
+      gnupg_remove (unaddr.sun_path);
+      gpgsm_exit (2);
+    }
+
+  if (opt.verbose)
+    log_info ("listening on socket '%s'\n", unaddr.sun_path);
+  return fd;
+}
+
+
+/* Run gpgsm as a daemon listening on the socket GPGSM_SOCK_NAME in
+ * the socket directory.  Each connection is served like a --server
+ * session.  The process stays alive between the connections so that
+ * the keybox handles, the connections to the gpg-agent and the
+ * dirmngr as well as the cache of validated chains are re-used.
+ * gpgsm is not threaded and thus the connections are served one
+ * after the other; additional clients wait in the listen queue.  */
+void
+gpgsm_daemon (certlist_t default_recplist)
+{
+  char *sockname;
+  assuan_fd_t listen_fd, fd;
+  assuan_sock_nonce_t nonce;
+  struct sockaddr_un paddr;
+  socklen_t plen;
+  validated_chain_t chains = NULL;
+
+  sockname = make_filename (gnupg_socketdir (), GPGSM_SOCK_NAME, NULL);
+  listen_fd = create_daemon_socket (sockname, &nonce);
+
+  for (;;)
+    {
+      plen = sizeof paddr;
+      fd = assuan_sock_accept (listen_fd, (struct sockaddr *)&paddr, &plen);
+      if (fd == ASSUAN_INVALID_FD)
+        {
+          if (errno == EINTR)
+            continue;
+          log_error ("accept failed: %s\n", strerror (errno));
+          break;
+        }
+      if (assuan_sock_check_nonce (fd, &nonce))
+        {
+          log_info ("error reading nonce on fd %d: %s\n",
+                    FD2INT (fd), strerror (errno));
+          assuan_sock_close (fd);
+          continue;
+        }
+      if (opt.verbose)
+        log_info ("handler for fd %d started\n", FD2INT (fd));
+      serve_client (fd, default_recplist, &chains);
+      if (opt.verbose)
+        log_info ("handler for fd %d terminated\n", FD2INT (fd));
+    }
+
+  assuan_sock_close (listen_fd);
+  gnupg_remove (sockname);
+  xfree (sockname);
+  while (chains)
+    {
+      validated_chain_t tmp = chains->next;
+      xfree (chains);
+      chains = tmp;
+    }
 }
 
 
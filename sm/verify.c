@@ -36,6 +36,7 @@
 #include "keydb.h"
 #include "../common/i18n.h"
 #include "../common/compliance.h"
+#include "../common/mdfanout.h"
 
 
 static void check_assert_signer_list (ctrl_t ctrl, const char *pkhex);
@@ -56,18 +57,53 @@ strtimestamp_r (ksba_isotime_t atime)
 
 
 
-/* Hash the data for a detached signature.  Returns 0 on success.  */
+/* Enable ALGO for the fan-out object at R_FAN.  On error the object
+   is released so that the caller falls back to a single context.  */
+static void
+md_fanout_enable_or_drop (md_fanout_t *r_fan, int algo)
+{
+  gpg_error_t err;
+
+  err = md_fanout_enable (*r_fan, algo);
+  if (err)
+    {
+      log_info ("not using parallel hashing: %s\n", gpg_strerror (err));
+      md_fanout_release (*r_fan);
+      *r_fan = NULL;
+    }
+}
+
+
+/* The size of the read buffer for detached data.  This is well above
+   the minimum length for which the fan-out object uses its worker
+   threads.  */
+#define HASH_DATA_BUFSIZE (64 * 1024)
+
+/* Hash the data for a detached signature.  If FAN is not NULL the
+   data is fed to all its digest contexts instead of to MD.  Returns 0
+   on success.  */
 static gpg_error_t
-hash_data (estream_t fp, gcry_md_hd_t md)
+hash_data (estream_t fp, gcry_md_hd_t md, md_fanout_t fan)
 {
   gpg_error_t err = 0;
-  char buffer[4096];
+  char *buffer;
   int nread;
 
+  buffer = xtrymalloc (HASH_DATA_BUFSIZE);
+  if (!buffer)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error allocating hash buffer: %s\n", gpg_strerror (err));
+      return err;
+    }
+
   do
     {
-      nread = es_fread (buffer, 1, DIM(buffer), fp);
-      gcry_md_write (md, buffer, nread);
+      nread = es_fread (buffer, 1, HASH_DATA_BUFSIZE, fp);
+      if (fan)
+        md_fanout_write (fan, buffer, nread);
+      else
+        gcry_md_write (md, buffer, nread);
     }
   while (nread);
   if (es_ferror (fp))
@@ -75,10 +111,31 @@ hash_data (estream_t fp, gcry_md_hd_t md)
       err = gpg_error_from_syserror ();
       log_error ("read error on fp %p: %s\n", fp, gpg_strerror (err));
     }
+  xfree (buffer);
   return err;
 }
 
 
+/* Return the context with the digest of the data for ALGO.  With a
+   fan-out object the lane for ALGO is returned.  ALGO is 0 for a
+   signer without signed attributes; gcry_md_read then takes the
+   first enabled algorithm of DATA_MD and thus we use the lane of
+   FIRST_ALGO.  Every algorithm enabled in DATA_MD has a lane,
+   because the fan-out object is dropped if enabling fails; thus
+   without a lane DATA_MD is returned which has ALGO not enabled
+   either.  */
+static gcry_md_hd_t
+get_data_md (gcry_md_hd_t data_md, md_fanout_t fan, int algo, int first_algo)
+{
+  gcry_md_hd_t md;
+
+  if (!fan)
+    return data_md;
+  md = md_fanout_get_md (fan, algo? algo : first_algo);
+  return md? md : data_md;
+}
+
+
 
 
 /* Perform a verify operation.  To verify detached signatures, DATA_FP
@@ -98,6 +155,8 @@ gpgsm_verify (ctrl_t ctrl, estream_t in_fp, estream_t data_fp,
   ksba_cert_t cert;
   KEYDB_HANDLE kh;
   gcry_md_hd_t data_md = NULL;
+  md_fanout_t data_fan = NULL;
+  int first_data_algo = 0;
   int signer;
   const char *algoid;
   int algo;
@@ -195,6 +254,21 @@ gpgsm_verify (ctrl_t ctrl, estream_t in_fp, estream_t data_fp,
         {
           audit_log (ctrl->audit, AUDIT_GOT_DATA);
 
+          /* For a detached signature we hash the data ourselves and
+             can thus compute the digests of all algorithms in
+             parallel.  DATA_MD is then only used to track the
+             enabled algorithms.  */
+          if (is_detached && data_fp && !DBG_HASHING && !data_fan)
+            {
+              rc = md_fanout_new (&data_fan, MD_FANOUT_THREADS);
+              if (rc)
+                {
+                  log_error ("md_fanout_new failed: %s\n",
+                             gpg_strerror (rc));
+                  goto leave;
+                }
+            }
+
           /* We are now able to enable the hash algorithms */
           for (i=0; (algoid=ksba_cms_get_digest_algo_list (cms, i)); i++)
             {
@@ -215,6 +289,10 @@ gpgsm_verify (ctrl_t ctrl, estream_t in_fp, estream_t data_fp,
                     log_debug ("enabling hash algorithm %d (%s)\n",
                                algo, algoid? algoid:"");
                   gcry_md_enable (data_md, algo);
+                  if (!first_data_algo)
+                    first_data_algo = algo;
+                  if (data_fan)
+                    md_fanout_enable_or_drop (&data_fan, algo);
                   audit_log_i (ctrl->audit, AUDIT_DATA_HASH_ALGO, algo);
                 }
             }
@@ -224,6 +302,10 @@ gpgsm_verify (ctrl_t ctrl, estream_t in_fp, estream_t data_fp,
                 log_debug ("enabling extra hash algorithm %d\n",
                            opt.extra_digest_algo);
               gcry_md_enable (data_md, opt.extra_digest_algo);
+              if (!first_data_algo)
+                first_data_algo = opt.extra_digest_algo;
+              if (data_fan)
+                md_fanout_enable_or_drop (&data_fan, opt.extra_digest_algo);
               audit_log_i (ctrl->audit, AUDIT_DATA_HASH_ALGO,
                            opt.extra_digest_algo);
             }
@@ -237,7 +319,7 @@ gpgsm_verify (ctrl_t ctrl, estream_t in_fp, estream_t data_fp,
                 }
               else
                 audit_log_ok (ctrl->audit, AUDIT_DATA_HASHING,
-                              hash_data (data_fp, data_md));
+                              hash_data (data_fp, data_md, data_fan));
             }
           else
             {
@@ -545,7 +627,8 @@ gpgsm_verify (ctrl_t ctrl, estream_t in_fp, estream_t data_fp,
 
           /* Check that the message digest in the signed attributes
              matches the one we calculated on the data.  */
-          s = gcry_md_read (data_md, algo);
+          s = gcry_md_read (get_data_md (data_md, data_fan, algo,
+                                         first_data_algo), algo);
           if ( !s || !msgdigestlen
                || gcry_md_get_algo_dlen (algo) != msgdigestlen
                || memcmp (s, msgdigest, msgdigestlen) )
@@ -596,7 +679,9 @@ gpgsm_verify (ctrl_t ctrl, estream_t in_fp, estream_t data_fp,
         }
       else
         {
-          rc = gpgsm_check_cms_signature (cert, sigval, data_md,
+          rc = gpgsm_check_cms_signature (cert, sigval,
+                                          get_data_md (data_md, data_fan,
+                                                       algo, first_data_algo),
                                           algo, pkalgoflags, &info_pkalgo);
         }
 
@@ -737,6 +822,7 @@ gpgsm_verify (ctrl_t ctrl, estream_t in_fp, estream_t data_fp,
   gnupg_ksba_destroy_reader (b64reader);
   gnupg_ksba_destroy_writer (b64writer);
   keydb_release (kh);
+  md_fanout_release (data_fan);
   gcry_md_close (data_md);
 
   if (rc)
@@ -47,6 +47,10 @@
 
 #ifdef HAVE_W32_SYSTEM
 #include <windows.h>
+#else
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #endif
 
 #include "private.h"
@@ -541,6 +545,64 @@ do_get_time (scheme *sc, pointer args)
   FFI_RETURN_INT (sc, gnupg_get_time ());
 }
 
+/* Return a monotonic time stamp in microseconds.  */
+static pointer
+do_get_monotonic_time (scheme *sc, pointer args)
+{
+  FFI_PROLOG ();
+#ifdef HAVE_W32_SYSTEM
+  long long usec = (long long)GetTickCount64 () * 1000;
+#else
+  struct timespec ts;
+  long long usec;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts))
+    FFI_RETURN_ERR (sc, errno);
+  usec = (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+  FFI_ARGS_DONE_OR_RETURN (sc, args);
+  FFI_RETURN_INT (sc, usec);
+}
+
+/* Return the user and system time in microseconds used by all
+ * terminated child processes which have been waited for.  */
+static pointer
+do_get_child_cpu_time (scheme *sc, pointer args)
+{
+  FFI_PROLOG ();
+#ifdef HAVE_W32_SYSTEM
+  long long usec = 0;  /* Not available.  */
+#else
+  struct rusage ru;
+  long long usec;
+
+  if (getrusage (RUSAGE_CHILDREN, &ru))
+    FFI_RETURN_ERR (sc, errno);
+  usec = ((long long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+          + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+#endif
+  FFI_ARGS_DONE_OR_RETURN (sc, args);
+  FFI_RETURN_INT (sc, usec);
+}
+
+/* Return the number of online processors.  */
+static pointer
+do_get_cpu_count (scheme *sc, pointer args)
+{
+  FFI_PROLOG ();
+  long n;
+#ifdef HAVE_W32_SYSTEM
+  SYSTEM_INFO si;
+
+  GetSystemInfo (&si);
+  n = si.dwNumberOfProcessors;
+#else
+  n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+  FFI_ARGS_DONE_OR_RETURN (sc, args);
+  FFI_RETURN_INT (sc, n > 0 ? n : 1);
+}
+
 static pointer
 do_getpid (scheme *sc, pointer args)
 {
@@ -1681,6 +1743,9 @@ ffi_init (scheme *sc, const char *argv0, const char *scriptname,
   ffi_define_function (sc, rmdir);
   ffi_define_function (sc, get_isotime);
   ffi_define_function (sc, get_time);
+  ffi_define_function (sc, get_monotonic_time);
+  ffi_define_function (sc, get_child_cpu_time);
+  ffi_define_function (sc, get_cpu_count);
   ffi_define_function (sc, getpid);
 
   /* Random numbers.  */
@@ -115,6 +115,14 @@ int tracing;
 #ifndef CELL_MINRECOVER
 #define CELL_MINRECOVER    (CELL_SEGSIZE >> 2)
 #endif
+
+/* If less than this percentage of all cells are free after a garbage
+ * collector run, allocate new cell segments until it is reached.
+ * This keeps the cost of the collections proportional to the
+ * allocation rate instead of the size of the live data.  */
+#ifndef CELL_MINFREE
+#define CELL_MINFREE       50
+#endif
 struct cell_segment *cell_segments;
 
 /* We use 4 registers. */
@@ -1695,7 +1695,8 @@ E6:   /* up.  Undo the link switching from steps E4 and E5. */
 static void gc(scheme *sc, pointer a, pointer b) {
   pointer p;
   struct cell_segment *s;
-  int i;
+  size_t total = 0;
+  int i, n;
 
   assert (gc_enabled (sc));
 
@@ -1742,6 +1743,7 @@ static void gc(scheme *sc, pointer a, pointer b) {
      free-list in sorted order.
   */
   for (s = sc->cell_segments; s; s = s->next) {
+    total += s->cells_len;
     p = s->cells + s->cells_len;
     while (--p >= s->cells) {
       if ((typeflag(p) & 1) == 0)
@@ -1770,9 +1772,18 @@ static void gc(scheme *sc, pointer a, pointer b) {
     putstr(sc,msg);
   }
 
-  /* if only a few recovered, get more to avoid fruitless gc's */
-  if (sc->fcells < CELL_MINRECOVER
-       && alloc_cellseg(sc, 1) == 0)
+  /* If only a few recovered, get more to avoid fruitless gc's.  The
+     heap is also grown until CELL_MINFREE percent of it are free.
+     Otherwise a program with a lot of live data would collect after
+     every few allocations, each time marking all the live data.  */
+  for (n = 0;
+       ((size_t) sc->fcells + n * CELL_SEGSIZE < CELL_MINRECOVER
+        || (((size_t) sc->fcells + n * CELL_SEGSIZE) * 100
+            < (total + n * CELL_SEGSIZE) * CELL_MINFREE));
+       n++)
+    ;
+  if (n && alloc_cellseg(sc, n) == 0
+      && sc->fcells < CELL_MINRECOVER)
        sc->no_memory = 1;
 }
 
@@ -2680,7 +2691,7 @@ int eqv(pointer a, pointer b) {
 
 /* ========== Environment implementation  ========== */
 
-#if !defined(USE_ALIST_ENV) || !defined(USE_OBJECT_LIST)
+#ifndef USE_OBJECT_LIST
 
 static int hash_fn(const char *key, int table_size)
 {
@@ -2717,12 +2728,22 @@ pointercmp(pointer a, pointer b)
 
 /*
  * In this implementation, each frame of the environment may be
- * a hash table: a vector of alists hashed by variable name.
+ * a hash table: a vector of alists hashed by variable.
  * In practice, we use a vector only for the initial frame;
  * subsequent frames are too small and transient for the lookup
  * speed to out-weigh the cost of making a new vector.
  */
 
+/* Return the hash of the symbol SYM for a frame of TABLE_SIZE
+ * buckets.  Symbols are interned and cells are never moved,
+ * therefore the address of the symbol can be used instead of hashing
+ * its name on every lookup.  */
+static INLINE int
+env_hash(pointer sym, int table_size)
+{
+  return ((uintptr_t) sym / sizeof (struct cell)) % table_size;
+}
+
 static void new_frame_in_env(scheme *sc, pointer old_env)
 {
   pointer new_frame;
@@ -2755,7 +2776,7 @@ find_slot_spec_in_env(scheme *sc, pointer env, pointer hdl, int all, pointer **s
 
   for (x = env; x != sc->NIL; x = cdr(x)) {
     if (is_vector(car(x))) {
-      location = hash_fn(symname(hdl), vector_length(car(x)));
+      location = env_hash(hdl, vector_length(car(x)));
       sl = vector_elem_slot(car(x), location);
     } else {
       sl = &car(x);
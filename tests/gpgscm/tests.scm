@@ -591,6 +591,15 @@
 	(current-environment))
       (define (filter-tests status)
 	(filter (lambda (p) (eq? status (p::status))) procs))
+      ;; The number of tests listed as the slowest ones.
+      (define slowest-tests 10)
+      (define (print-slowest-tests)
+	(when (> (length procs) 1)
+	      (echo "Slowest tests:")
+	      (for-each
+	       (lambda (t)
+		 (echo "  " (format-duration (t::duration)) (t::qualified-name)))
+	       (greatest slowest-tests (lambda (t) (t::duration)) procs))))
       (define (report)
 	(define (print-tests tests message)
 	  (unless (null? tests)
@@ -612,6 +621,7 @@
 	  (print-tests xfailed "Expectedly failed tests:")
 	  (print-tests xpassed "Unexpectedly passed tests:")
 	  (print-tests skipped "Skipped tests:")
+	  (print-slowest-tests)
           (echo "===================")
 	  (+ (length failed) (length xpassed))))
 
@@ -629,6 +639,38 @@
 (define (locate-test path)
   (if (absolute-path? path) path (in-srcdir path)))
 
+;; Format the duration USEC given in microseconds as seconds with
+;; three decimals.
+(define (format-duration' usec)
+  (let ((msec (quotient usec 1000)))
+    (string-append (number->string (quotient msec 1000)) "."
+		   (substring (number->string (+ 1000 (remainder msec 1000)))
+			      1 4))))
+(assert (equal? (format-duration' 0) "0.000"))
+(assert (equal? (format-duration' 1234567) "1.234"))
+(assert (equal? (format-duration' 60010000) "60.010"))
+
+;; Likewise, but with the unit for humans.
+(define (format-duration usec)
+  (string-append (format-duration' usec) "s"))
+
+;; Return the N elements of LIST which are the greatest according to
+;; KEY in descending order.
+(define (greatest n key list)
+  (define (insert x sorted)
+    (cond
+     ((null? sorted) (cons x '()))
+     ((> (key x) (key (car sorted))) (cons x sorted))
+     (else (cons (car sorted) (insert x (cdr sorted))))))
+  (let loop ((list list) (acc '()))
+    (if (null? list)
+	acc
+	(let ((acc' (insert (car list) acc)))
+	  (loop (cdr list)
+		(if (> (length acc') n) (reverse (cdr (reverse acc'))) acc'))))))
+(assert (equal? (greatest 2 (lambda (x) x) '(3 1 4 1 5)) '(5 4)))
+(assert (equal? (greatest 3 (lambda (x) x) '(2)) '(2)))
+
 ;; A single test.
 (define test
  (begin
@@ -687,16 +729,19 @@
       ;; The log is written here.
       (define log-file-name #f)
 
-      ;; Record time stamps.
+      ;; Record time stamps.  The duration is measured using the
+      ;; monotonic clock in microseconds.
       (define timestamp #f)
-      (define start-time 0)
-      (define end-time 0)
+      (define start-usec 0)
+      (define end-usec 0)
 
       (define (set-start-time!)
 	(set! timestamp (isotime->junit (get-isotime)))
-	(set! start-time (get-time)))
+	(set! start-usec (get-monotonic-time)))
       (define (set-end-time!)
-	(set! end-time (get-time)))
+	(set! end-usec (get-monotonic-time)))
+      (define (duration)
+	(- end-usec start-usec))
 
       ;; Has the test been started yet?
       (define (started?)
@@ -723,6 +768,7 @@
 	      (close (:read-end p))
 	      (set! proc proc')
 	      (set! retcode (process-wait proc' #t)))))
+	(set-end-time!)
 	(report)
 	(current-environment))
       (define (run-sync-quiet . args)
@@ -758,15 +804,18 @@
 		(splice logfd STDERR_FILENO)
 		(close logfd))
 	(echo (string-append (status-string) ":")
-	      (if variant
-		  (string-append "<" variant ">" name)
-		  name)))
+	      (qualified-name)
+	      (string-append "(" (format-duration (duration)) ")")))
+      (define (qualified-name)
+	(if variant
+	    (string-append "<" variant ">" name)
+	    name))
 
       (define (xml)
 	(xx::tag
 	 'testsuite
 	 `((name ,name)
-	   (time ,(- end-time start-time))
+	   (time ,(format-duration' (duration)))
 	   (package ,(dirname name))
 	   (id 0)
 	   (timestamp ,timestamp)
@@ -779,7 +828,7 @@
 	  (xx::tag 'testcase
 		   `((name ,(basename name))
 		     (classname ,(string-translate (dirname name) "/" "."))
-		     (time ,(- end-time start-time)))
+		     (time ,(format-duration' (duration))))
 		   `(,@(case (status)
 			 ((PASS XFAIL) '())
 			 ((SKIP) (list (xx::tag 'skipped)))
@@ -820,10 +869,13 @@
 		(cdr tests'))))))
 
 ;; Run tests either in sequence or in parallel, depending on the
-;; number of tests and the command line flags.
+;; number of tests and the command line flags.  Without an explicit
+;; number of jobs, --parallel runs two tests per processor core
+;; because the tests spend much of their time waiting for the
+;; daemons.
 (define (run-tests tests)
   (let ((parallel (flag "--parallel" *args*))
-	(default-parallel-jobs 32))
+	(default-parallel-jobs (* 2 (get-cpu-count))))
     (if (and parallel (> (length tests) 1))
 	(run-tests-parallel tests (if (and (pair? parallel)
 					   (string->number (car parallel)))
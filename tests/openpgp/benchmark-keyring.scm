@@ -0,0 +1,139 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+;; Benchmark for the key database backends using a large synthetic
+;; keyring created by kbx/gen-keyring.  This is not part of the
+;; regular test suite; run it using
+;;
+;;   make -C tests/openpgp bench-keyring
+;;
+;; The environment variable GNUPG_BENCH_KEYS gives the number of keys
+;; (default 10000) and GNUPG_BENCH_LOOKUPS the number of lookups of
+;; each kind (default 100).  The results are appended to
+;; GNUPG_BENCH_RESULTS in the same format as used by benchmark.scm;
+;; the ALGO field names the backend and BYTES is the number of keys
+;; or lookups.  Without keyboxd both the keyring and the keybox file
+;; format are measured.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-legacy-environment)
+
+(define (getenv-or name default)
+  (let ((value (getenv name)))
+    (if (string=? value "") default value)))
+
+(define bench-keys
+  (string->number (getenv-or "GNUPG_BENCH_KEYS" "10000")))
+
+(define bench-lookups
+  (string->number (getenv-or "GNUPG_BENCH_LOOKUPS" "100")))
+
+(define bench-results
+  (getenv-or "GNUPG_BENCH_RESULTS" (path-join (getenv "objdir")
+					     "benchmark.tsv")))
+
+(define (report op backend count wall cpu)
+  (let ((line (string-append op "\t" backend "\t"
+			     (number->string count) "\t"
+			     (number->string wall) "\t"
+			     (number->string cpu) "\t"
+			     ;; Operations per second.
+			     (number->string
+			      (quotient (* count 1000000) (max wall 1))))))
+    (info line)
+    (letfd ((fd (open bench-results
+		      (logior O_WRONLY O_CREAT O_APPEND O_BINARY) #o644)))
+      (let ((port (fdopen fd "ab")))
+	(display line port)
+	(newline port)))))
+
+;; Run THUNK and report the time used as OP on BACKEND for COUNT
+;; items.
+(define (bench op backend count thunk)
+  (let ((wall0 (get-monotonic-time))
+	(cpu0 (get-child-cpu-time)))
+    (thunk)
+    (report op backend count
+	    (- (get-monotonic-time) wall0)
+	    (- (get-child-cpu-time) cpu0))))
+
+(info "Creating" bench-keys "synthetic keys")
+(call-check `(,(tool-hardcoded 'gen-keyring) --quiet
+	      --keys ,(number->string bench-keys) --list "bench-keys.lst"
+	      --output "bench-keys.gpg"))
+
+;; The list has one line "FINGERPRINT MAILBOX" per key.  Pick
+;; BENCH-LOOKUPS entries spread over the whole keyring.
+(define samples
+  (let* ((entries (map (lambda (line) (string-split line #\space))
+		       (filter (lambda (line) (not (string=? line "")))
+			       (string-split-newlines
+				(call-with-input-file "bench-keys.lst"
+				  read-all)))))
+	 (count (length entries))
+	 (step (max 1 (quotient count bench-lookups))))
+    (let loop ((entries entries) (left count) (acc '()))
+      (if (or (null? entries) (>= (length acc) bench-lookups))
+	  (reverse acc)
+	  (loop (if (> left step) (list-tail entries step) '())
+		(- left step) (cons (car entries) acc))))))
+
+;; Time the operations using the extra gpg arguments KEYRING-ARGS and
+;; name them BACKEND.
+(define (bench-backend backend keyring-args)
+  (define (gpg args)
+    (call-check `(,@GPG --batch --yes ,@keyring-args ,@args)))
+
+  (bench "import" backend bench-keys
+	 (lambda () (gpg '(--quiet --import "bench-keys.gpg"))))
+  (bench "list-keys" backend bench-keys
+	 (lambda () (gpg '(--list-keys))))
+  (bench "lookup-fpr" backend (length samples)
+	 (lambda ()
+	   (for-each (lambda (s) (gpg `(--list-keys ,(car s)))) samples)))
+  (bench "lookup-keyid" backend (length samples)
+	 (lambda ()
+	   (for-each (lambda (s)
+		       (gpg `(--list-keys
+			      ,(substring (car s) 24 (string-length (car s))))))
+		     samples)))
+  (bench "lookup-mail" backend (length samples)
+	 (lambda ()
+	   (for-each (lambda (s) (gpg `(--list-keys ,(string-append "<" (cadr s)
+								      ">"))))
+		     samples)))
+  (bench "check-trustdb" backend bench-keys
+	 (lambda ()
+	   (catch #f (unlink "trustdb.gpg"))
+	   (gpg `(--trusted-key ,(car (car samples)) --check-trustdb)))))
+
+(if (flag "--use-keyboxd" *args*)
+    (bench-backend "keyboxd" '())
+    (for-each
+     (lambda (backend)
+       (let ((name (string-append "bench-" backend)))
+	 (catch #f (unlink name))
+	 (bench-backend backend
+			`(--no-default-keyring
+			  --keyring ,(string-append "gnupg-" backend ":"
+						    (path-join (getcwd) name))))))
+     '("ring" "kbx")))
+
+(for-each (lambda (name) (catch #f (unlink name)))
+	  '("bench-keys.gpg" "bench-keys.lst" "bench-ring" "bench-kbx"))
@@ -0,0 +1,136 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+;; Throughput benchmark for the OpenPGP data pipeline.  This is not
+;; part of the regular test suite; run it using
+;;
+;;   make -C tests/openpgp bench
+;;
+;; The environment variable GNUPG_BENCH_SIZES gives the sizes of the
+;; inputs in MiB (default "1 16").  For each size, cipher algorithm,
+;; AEAD mode and compression algorithm one line with the fields
+;;
+;;   OPERATION ALGO BYTES WALL-USEC CPU-USEC MB/S
+;;
+;; separated by tabs is appended to the file given by
+;; GNUPG_BENCH_RESULTS (default "benchmark.tsv" in the build
+;; directory).  CPU-USEC is the user and system time of the gpg
+;; process; the time spent in gpg-agent is not included.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-legacy-environment)
+
+(define (getenv-or name default)
+  (let ((value (getenv name)))
+    (if (string=? value "") default value)))
+
+(define bench-sizes
+  (map string->number
+       (filter (lambda (s) (not (string=? s "")))
+	       (string-split (getenv-or "GNUPG_BENCH_SIZES" "1 16") #\space))))
+
+(define bench-results
+  (getenv-or "GNUPG_BENCH_RESULTS" (path-join (getenv "objdir")
+					     "benchmark.tsv")))
+
+;; Create a file of MIB MiB.  Half of each block is random and the
+;; other half repeats a single character, so that the compression
+;; algorithms have something to do.
+(define (make-bench-data filename mib)
+  (let ((block (string-append (make-random-string 32768)
+			      (make-string 32768 #\x))))
+    (call-with-binary-output-file
+     filename
+     (lambda (port)
+       (let loop ((n (* mib 16)))
+	 (when (> n 0)
+	       (display block port)
+	       (loop (- n 1))))))))
+
+;; Format BYTES per WALL microseconds as MB/s with one decimal.
+(define (mbps bytes wall)
+  (let ((x (quotient (* 10 bytes) (max wall 1))))
+    (string-append (number->string (quotient x 10)) "."
+		   (number->string (remainder x 10)))))
+
+(define (report op algo bytes wall cpu)
+  (let ((line (string-append op "\t" algo "\t"
+			     (number->string bytes) "\t"
+			     (number->string wall) "\t"
+			     (number->string cpu) "\t"
+			     (mbps bytes wall))))
+    (info line)
+    (letfd ((fd (open bench-results
+		      (logior O_WRONLY O_CREAT O_APPEND O_BINARY) #o644)))
+      (let ((port (fdopen fd "ab")))
+	(display line port)
+	(newline port)))))
+
+;; Run gpg with ARGS on INPUT writing to OUTPUT and report the time
+;; used as OP with ALGO for BYTES of payload.
+(define (bench op algo bytes args input output)
+  (catch #f (unlink output))
+  (let ((wall0 (get-monotonic-time))
+	(cpu0 (get-child-cpu-time)))
+    (pipe:do
+     (pipe:open input (logior O_RDONLY O_BINARY))
+     (pipe:spawn `(,@GPG --yes --batch ,@args))
+     (pipe:write-to output (logior O_WRONLY O_CREAT O_BINARY) #o600))
+    (report op algo bytes
+	    (- (get-monotonic-time) wall0)
+	    (- (get-child-cpu-time) cpu0))))
+
+;; Benchmark encryption and decryption of SOURCE with the extra
+;; arguments ARGS and name the result ALGO.
+(define (bench-crypt algo bytes source args)
+  (bench "encrypt" algo bytes
+	 `(--encrypt --recipient ,usrname2 ,@args) source "bench.gpg")
+  (bench "decrypt" algo bytes '(--decrypt) "bench.gpg" "bench.out"))
+
+(for-each
+ (lambda (mib)
+   (let ((source "bench.dat")
+	 (bytes (* mib 1024 1024)))
+     (info "Creating" mib "MiB of input")
+     (make-bench-data source mib)
+
+     (for-each
+      (lambda (cipher)
+	(bench-crypt cipher bytes source
+		     `(--cipher-algo ,cipher --compress-algo none)))
+      (force all-cipher-algos))
+
+     (bench-crypt "OCB" bytes source '(--force-ocb --compress-algo none))
+
+     (for-each
+      (lambda (compression)
+	(bench-crypt compression bytes source
+		     `(--compress-algo ,compression)))
+      (force all-compression-algos))
+
+     (bench "sign" "default" bytes '(--sign --compress-algo none)
+	    source "bench.sig")
+     (bench "verify" "default" bytes '(--verify) "bench.sig" "bench.out")
+
+     (bench "armor" "enarmor" bytes '(--enarmor) source "bench.asc")
+     (bench "dearmor" "dearmor" bytes '(--dearmor) "bench.asc" "bench.out")
+
+     (for-each (lambda (name) (catch #f (unlink name)))
+	       '("bench.dat" "bench.gpg" "bench.sig" "bench.asc" "bench.out"))))
+ bench-sizes)
@@ -122,6 +122,7 @@
     (gpg-preset-passphrase "GPG_PRESET_PASSPHRASE"
 			   "agent/gpg-preset-passphrase")
     (gpgtar "GPGTAR" "tools/gpgtar")
+    (gen-keyring "GEN_KEYRING" "kbx/gen-keyring")
     (pinentry "PINENTRY" "tests/openpgp/fake-pinentry")))
 
 (define (tool-hardcoded which)
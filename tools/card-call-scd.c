@@ -1855,6 +1855,86 @@ scd_delete_key (const unsigned char *grip, int force)
 }
 
 
+/* Run the private key operation CMD, which is one of "PKSIGN",
+ * "PKAUTH" or "PKDECRYPT", using the key KEYREF on DATA of DATALEN
+ * bytes.  OPTIONS are passed verbatim to the command.  The result of
+ * the operation is not returned because this is only used for
+ * benchmarking.  */
+gpg_error_t
+scd_pkop (const char *cmd, const char *options, const char *keyref,
+          const void *data, size_t datalen)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  const unsigned char *p = data;
+  size_t n, chunk;
+  struct default_inq_parm_s parm;
+
+  err = start_agent (0);
+  if (err)
+    return err;
+
+  /* Send the data in chunks which fit into an Assuan line.  */
+  chunk = (DIM (line) - 30) / 2;
+  for (n = 0; !n || n < datalen; n += chunk)
+    {
+      size_t len = datalen - n > chunk? chunk : datalen - n;
+
+      snprintf (line, DIM (line), "SCD SETDATA %s",
+                n? "--append ":"");
+      bin2hex (p + n, len, line + strlen (line));
+      err = assuan_transact (agent_ctx, line,
+                             NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err || !datalen)
+        break;
+    }
+  if (err)
+    return err;
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctx = agent_ctx;
+  snprintf (line, DIM (line), "SCD %s %s%s%s", cmd,
+            options? options:"", options? " ":"", keyref);
+  err = assuan_transact (agent_ctx, line, dummy_data_cb, NULL,
+                         default_inq_cb, &parm, NULL, NULL);
+  return status_sc_op_failure (err);
+}
+
+
+/* Return the number of APDUs sent to the current card's reader and
+ * the accumulated time in microseconds the reader needed for them
+ * at R_COUNT and R_USEC.  */
+gpg_error_t
+scd_apdu_stats (unsigned long *r_count, unsigned long *r_usec)
+{
+  gpg_error_t err;
+  membuf_t data;
+  char *buf;
+
+  *r_count = *r_usec = 0;
+
+  err = start_agent (0);
+  if (err)
+    return err;
+
+  init_membuf (&data, 64);
+  err = assuan_transact (agent_ctx, "SCD GETINFO apdu_stats",
+                         put_membuf_cb, &data, NULL, NULL, NULL, NULL);
+  if (err)
+    {
+      xfree (get_membuf (&data, NULL));
+      return err;
+    }
+  put_membuf (&data, "", 1);
+  buf = get_membuf (&data, NULL);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  if (sscanf (buf, "%lu %lu", r_count, r_usec) != 2)
+    err = gpg_error (GPG_ERR_INV_RESPONSE);
+  xfree (buf);
+  return err;
+}
+
 
 /* Return a malloced string describing the statusword SW.  On error
  * NULL is returned.  */
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 #ifdef HAVE_LIBREADLINE
 # define GNUPG_LIBREADLINE_H_INCLUDED
 # include <readline/readline.h>
@@ -3795,6 +3796,198 @@ cmd_apdu (card_info_t info, char *argstr)
 }
 
 
+/* Return a timestamp in microseconds for measuring durations.  */
+static unsigned long
+bench_timestamp (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+#else
+  return gnupg_get_time () * 1000000UL;
+#endif
+}
+
+
+static int
+cmp_ulong (const void *a, const void *b)
+{
+  unsigned long x = *(const unsigned long *)a;
+  unsigned long y = *(const unsigned long *)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+static gpg_error_t
+cmd_bench (card_info_t info, char *argstr)
+{
+  gpg_error_t err;
+  estream_t fp = opt.interactive? NULL : es_stdout;
+  const char *cmd, *options;
+  char *value = NULL;
+  char *keyref;
+  unsigned char *data = NULL;
+  size_t datalen;
+  unsigned char digest[32];
+  unsigned long *times = NULL;
+  unsigned long start, elapsed, total;
+  unsigned long count0, usec0, count1, usec1;
+  int opt_decrypt;
+  int repeat, i, nfailed;
+
+  if (!info)
+    return print_help
+      ("BENCH [--repeat=N] [--auth|--decrypt] KEYREF [HEXDATA]\n"
+       "\n"
+       "Run a private key operation with the key KEYREF N times and\n"
+       "print statistics about the time needed.  The default is to\n"
+       "create a signature over a SHA-256 hash; with \"--auth\" an\n"
+       "authentication is done instead.  With \"--decrypt\" HEXDATA is\n"
+       "decrypted; it must be a valid ciphertext for the key.  A first\n"
+       "operation, which may ask for the PIN, is not accounted.\n",
+       0);
+
+  opt_decrypt = has_option (argstr, "--decrypt");
+  if (opt_decrypt)
+    {
+      cmd = "PKDECRYPT";
+      options = NULL;
+    }
+  else if (has_option (argstr, "--auth"))
+    {
+      cmd = "PKAUTH";
+      options = NULL;
+    }
+  else
+    {
+      cmd = "PKSIGN";
+      options = "--hash=sha256";
+    }
+  err = get_option_value (argstr, "--repeat", &value);
+  if (err)
+    goto leave;
+  repeat = value? atoi (value) : 10;
+  if (repeat < 1 || repeat > 100000)
+    {
+      err = gpg_error (GPG_ERR_INV_ARG);
+      goto leave;
+    }
+  argstr = skip_options (argstr);
+
+  keyref = argstr;
+  if ((argstr = strchr (keyref, ' ')))
+    {
+      *argstr++ = 0;
+      trim_spaces (argstr);
+    }
+  else /* Let argstr point to an empty string.  */
+    argstr = keyref + strlen (keyref);
+  if (!*keyref)
+    {
+      err = gpg_error (GPG_ERR_MISSING_VALUE);
+      goto leave;
+    }
+
+  if (opt_decrypt)
+    {
+      if (!*argstr)
+        {
+          log_error (_("Option --decrypt requires HEXDATA\n"));
+          err = gpg_error (GPG_ERR_MISSING_VALUE);
+          goto leave;
+        }
+      datalen = strlen (argstr) / 2;
+      data = xtrymalloc (datalen + 1);
+      if (!data)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      if (hex2bin (argstr, data, datalen) < 0)
+        {
+          err = gpg_error (GPG_ERR_INV_ARG);
+          goto leave;
+        }
+    }
+  else if (*argstr)
+    {
+      err = gpg_error (GPG_ERR_INV_ARG);
+      goto leave;
+    }
+  else
+    {
+      gcry_md_hash_buffer (GCRY_MD_SHA256, digest, "GnuPG card bench", 16);
+      datalen = sizeof digest;
+    }
+
+  times = xtrycalloc (repeat, sizeof *times);
+  if (!times)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* A first run to get the PIN verified.  */
+  err = scd_pkop (cmd, options, keyref, data? data : digest, datalen);
+  if (err)
+    goto leave;
+
+  if (scd_apdu_stats (&count0, &usec0))
+    count0 = usec0 = 0;
+  total = 0;
+  nfailed = 0;
+  for (i=0; i < repeat; i++)
+    {
+      start = bench_timestamp ();
+      err = scd_pkop (cmd, options, keyref, data? data : digest, datalen);
+      elapsed = bench_timestamp () - start;
+      if (err)
+        {
+          log_info ("%s failed: %s\n", cmd, gpg_strerror (err));
+          nfailed++;
+          if (gpg_err_code (err) == GPG_ERR_CARD_REMOVED
+              || gpg_err_code (err) == GPG_ERR_CARD_NOT_PRESENT)
+            goto leave;
+        }
+      times[i] = elapsed;
+      total += elapsed;
+    }
+  err = 0;
+  if (scd_apdu_stats (&count1, &usec1))
+    count1 = usec1 = 0;
+
+  qsort (times, repeat, sizeof *times, cmp_ulong);
+
+  tty_fprintf (fp, "Operation .....: %s %s\n", cmd, keyref);
+  tty_fprintf (fp, "Repetitions ...: %d (%d failed)\n", repeat, nfailed);
+  tty_fprintf (fp, "Time [ms] .....: min=%.1f p50=%.1f p90=%.1f p99=%.1f"
+               " max=%.1f avg=%.1f\n",
+               times[0] / 1000.0,
+               times[(repeat - 1) * 50 / 100] / 1000.0,
+               times[(repeat - 1) * 90 / 100] / 1000.0,
+               times[(repeat - 1) * 99 / 100] / 1000.0,
+               times[repeat - 1] / 1000.0,
+               total / 1000.0 / repeat);
+  if (count1 >= count0 && usec1 >= usec0)
+    {
+      tty_fprintf (fp, "APDUs per op ..: %.1f\n",
+                   (double)(count1 - count0) / repeat);
+      tty_fprintf (fp, "Reader [ms] ...: %.1f per op (%.0f%%)\n",
+                   (usec1 - usec0) / 1000.0 / repeat,
+                   total? (usec1 - usec0) * 100.0 / total : 0.0);
+    }
+
+ leave:
+  xfree (times);
+  xfree (data);
+  xfree (value);
+  return err;
+}
+
+
 static gpg_error_t
 cmd_gpg (card_info_t info, char *argstr, int use_gpgsm)
 {
@@ -3887,7 +4080,7 @@ enum cmdids
     cmdFORCESIG, cmdGENERATE, cmdPASSWD, cmdPRIVATEDO, cmdWRITECERT,
     cmdREADCERT, cmdWRITEKEY,  cmdUNBLOCK, cmdFACTRST, cmdKDFSETUP,
     cmdUIF, cmdAUTH, cmdYUBIKEY, cmdAPDU, cmdGPG, cmdGPGSM, cmdHISTORY,
-    cmdCHECKKEYS,
+    cmdCHECKKEYS, cmdBENCH,
     cmdINVCMD
   };
 
@@ -3932,6 +4125,7 @@ static struct
   { "gpg",       cmdGPG,        NULL},
   { "gpgsm",     cmdGPGSM,      NULL},
   { "apdu",      cmdAPDU,       NULL},
+  { "bench",     cmdBENCH,      N_("benchmark a private key operation")},
   { "history",   cmdHISTORY,    N_("manage the command history")},
   { NULL, cmdINVCMD, NULL }
 };
@@ -4065,6 +4259,7 @@ dispatch_command (card_info_t info, const char *orig_command)
     case cmdGPGSM:        err = cmd_gpg (info, argstr, 1); break;
     case cmdHISTORY:      err = 0; break; /* Only used in interactive mode.  */
     case cmdCHECKKEYS:    err = cmd_checkkeys (info, argstr); break;
+    case cmdBENCH:        err = cmd_bench (info, argstr); break;
 
     case cmdINVCMD:
     default:
@@ -4325,6 +4520,7 @@ interactive_loop (void)
         case cmdGPGSM:     err = cmd_gpg (info, argstr, 1); break;
         case cmdHISTORY:   err = cmd_history (info, argstr); break;
         case cmdCHECKKEYS: err = cmd_checkkeys (info, argstr); break;
+        case cmdBENCH:     err = cmd_bench (info, argstr); break;
 
         case cmdINVCMD:
         default:
@@ -248,6 +248,9 @@ gpg_error_t scd_change_pin (const char *pinref, int reset_mode, int nullpin);
 gpg_error_t scd_checkpin (const char *serialno);
 gpg_error_t scd_havekey_info (const unsigned char *grip, char **r_result);
 gpg_error_t scd_delete_key (const unsigned char *grip, int force);
+gpg_error_t scd_pkop (const char *cmd, const char *options, const char *keyref,
+                      const void *data, size_t datalen);
+gpg_error_t scd_apdu_stats (unsigned long *r_count, unsigned long *r_usec);
 
 unsigned long agent_get_s2k_count (void);
 
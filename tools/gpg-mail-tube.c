@@ -407,6 +407,66 @@ mail_tube_message_cb (void *opaque,
 }
 
 
+/* The size of the buffer used to copy the body of a mail.  */
+#define BODY_CHUNK_SIZE 65536
+
+
+/* Copy the remaining input from FPIN to FPOUT and convert the line
+ * endings to CR,LF.  The data is processed in fixed size chunks and
+ * thus lines of any length are passed through unchanged and the
+ * memory use does not depend on the size of the mail.  */
+static gpg_error_t
+copy_body_as_crlf (estream_t fpin, estream_t fpout)
+{
+  gpg_error_t err = 0;
+  char *buffer;
+  size_t nread, start, i;
+  int last_cr = 0;    /* The last byte seen was a CR.  */
+  int last_lf = 1;    /* The last byte seen was a LF.  */
+
+  buffer = xtrymalloc (BODY_CHUNK_SIZE);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+
+  while (!es_read (fpin, buffer, BODY_CHUNK_SIZE, &nread) && nread)
+    {
+      for (start = i = 0; i < nread; i++)
+        {
+          if (buffer[i] == '\n' && !last_cr)
+            {
+              if ((i > start && es_write (fpout, buffer+start, i-start, NULL))
+                  || es_write (fpout, "\r", 1, NULL))
+                goto write_error;
+              start = i;
+            }
+          last_cr = (buffer[i] == '\r');
+        }
+      if (nread > start && es_write (fpout, buffer+start, nread-start, NULL))
+        goto write_error;
+      last_lf = (buffer[nread-1] == '\n');
+    }
+  if (es_ferror (fpin))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error reading mail: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
+  /* Terminate a last line without a line ending.  */
+  if (!last_lf && es_fputs (last_cr? "\n" : "\r\n", fpout))
+    goto write_error;
+  goto leave;
+
+ write_error:
+  err = gpg_error_from_syserror ();
+  log_error ("error writing to pipe: %s\n", gpg_strerror (err));
+
+ leave:
+  xfree (buffer);
+  return err;
+}
+
+
 /* Receive a mail from FPIN and process to STDOUT.  RECIPIENTS is a
  * string list with the recipients of for this message. */
 static gpg_error_t
@@ -623,20 +683,9 @@ mail_tube_encrypt (estream_t fpin, strlist_t recipients)
     }
 
   /* Read the remaining input and feed it to gpg.  */
-  while (es_fgets (ctx->line, sizeof (ctx->line), fpin))
-    {
-      lineno++;
-      line = ctx->line;
-      length = strlen (line);
-      if (length && line[length - 1] == '\n')
-	line[--length] = 0;
-      else
-        log_error ("mail parser detected too long or"
-                   " non terminated last line (lnr=%u)\n", lineno);
-      if (length && line[length - 1] == '\r')
-	line[--length] = 0;
-      es_fprintf (gpginfp, "%s\r\n", line);
-    }
+  err = copy_body_as_crlf (fpin, gpginfp);
+  if (err)
+    goto leave;
 
   /* Wait for gpg to finish.  */
   err = es_fclose (gpginfp);
@@ -69,6 +69,7 @@ enum cmd_and_opt_values
     aCron,
     aListDomains,
     aInstallKey,
+    aInstallKeys,
     aRevokeKey,
     aRemoveKey,
     aCheck,
@@ -99,6 +100,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_c (aCheck, "check-key", "@"),
   ARGPARSE_c (aInstallKey, "install-key",
               "install a key from FILE into the WKD"),
+  ARGPARSE_c (aInstallKeys, "install-keys",
+              "install all keys from the export FILE into the WKD"),
   ARGPARSE_c (aRemoveKey, "remove-key",
               "remove a key from the WKD"),
   ARGPARSE_c (aRevokeKey, "revoke-key",
@@ -162,6 +165,7 @@ static gpg_error_t command_receive_cb (void *opaque,
 static gpg_error_t command_list_domains (void);
 static gpg_error_t command_revoke_key (const char *mailaddr);
 static gpg_error_t command_check_key (const char *mailaddr);
+static gpg_error_t command_install_keys (const char *fname);
 static gpg_error_t command_cron (void);
 
 
@@ -257,6 +261,7 @@ parse_arguments (gpgrt_argparse_t *pargs, gpgrt_opt_t *popts)
         case aListDomains:
         case aCheck:
         case aInstallKey:
+        case aInstallKeys:
         case aRemoveKey:
         case aRevokeKey:
           cmd = pargs->r_opt;
@@ -395,6 +400,12 @@ main (int argc, char **argv)
         wrong_args ("--install-key [FILE|FINGERPRINT USER-ID]");
       break;
 
+    case aInstallKeys:
+      if (argc != 1)
+        wrong_args ("--install-keys FILE");
+      err = command_install_keys (*argv);
+      break;
+
     case aRemoveKey:
       if (argc != 1)
         wrong_args ("--remove-key USER-ID");
@@ -2057,3 +2068,432 @@ command_revoke_key (const char *mailaddr)
    * defined a suitable way to do this.  */
   return wks_cmd_remove_key (mailaddr);
 }
+
+
+/* Helper for command_install_keys.  Run gpg on the keyring export
+ * KEYS and store the list of mailboxes of all valid user ids of all
+ * valid keys at R_MBOXES.  */
+static gpg_error_t
+list_export_mboxes (estream_t keys, strlist_t *r_mboxes)
+{
+  gpg_error_t err;
+  ccparray_t ccp;
+  const char **argv;
+  estream_t listing;
+  char *line = NULL;
+  size_t length_of_line = 0;
+  size_t maxlen;
+  ssize_t len;
+  char **fields = NULL;
+  int nfields;
+  int skip_key = 0;
+  char *plainuid, *mbox;
+  strlist_t mboxes = NULL;
+
+  *r_mboxes = NULL;
+
+  listing = es_fopenmem (0, "w+b");
+  if (!listing)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error allocating memory buffer: %s\n", gpg_strerror (err));
+      return err;
+    }
+
+  ccparray_init (&ccp, 0);
+
+  ccparray_put (&ccp, "--no-options");
+  if (opt.verbose < 2)
+    ccparray_put (&ccp, "--quiet");
+  else
+    ccparray_put (&ccp, "--verbose");
+  ccparray_put (&ccp, "--batch");
+  ccparray_put (&ccp, "--always-trust");
+  ccparray_put (&ccp, "--with-colons");
+  ccparray_put (&ccp, "--dry-run");
+  ccparray_put (&ccp, "--import-options=import-minimal,import-show");
+  ccparray_put (&ccp, "--import");
+
+  ccparray_put (&ccp, NULL);
+  argv = ccparray_get (&ccp, NULL);
+  if (!argv)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  err = gnupg_exec_tool_stream (opt.gpg_program, argv, keys,
+                                NULL, listing, NULL, NULL);
+  if (err)
+    {
+      log_error ("import failed: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
+  es_rewind (listing);
+  maxlen = 2048; /* Set limit.  */
+  while ((len = es_read_line (listing, &line, &length_of_line, &maxlen)) > 0)
+    {
+      if (!maxlen)
+        {
+          log_error ("received line too long\n");
+          err = gpg_error (GPG_ERR_LINE_TOO_LONG);
+          goto leave;
+        }
+      /* Strip newline and carriage return, if present.  */
+      while (len > 0
+	     && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+	line[--len] = '\0';
+
+      xfree (fields);
+      fields = strtokenize_nt (line, ":");
+      if (!fields)
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("strtokenize failed: %s\n", gpg_strerror (err));
+          goto leave;
+        }
+      for (nfields = 0; fields[nfields]; nfields++)
+        ;
+      if (!nfields)
+        continue;
+
+      if (!strcmp (fields[0], "sec"))
+        {
+          /* We do not accept secret keys.  */
+          err = gpg_error (GPG_ERR_NO_PUBKEY);
+          goto leave;
+        }
+      if (!strcmp (fields[0], "pub"))
+        skip_key = (nfields > 1 && (strchr (fields[1], 'e')
+                                    || strchr (fields[1], 'r')));
+      else if (!strcmp (fields[0], "uid") && nfields > 9 && !skip_key)
+        {
+          if (strchr (fields[1], 'e') || strchr (fields[1], 'r'))
+            continue;  /* Expired or revoked user id.  */
+          plainuid = decode_c_string (fields[9]);
+          if (!plainuid)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          mbox = mailbox_from_userid (plainuid, 0);
+          xfree (plainuid);
+          if (mbox && !strlist_find (mboxes, mbox)
+              && !append_to_strlist_try (&mboxes, mbox))
+            {
+              err = gpg_error_from_syserror ();
+              xfree (mbox);
+              goto leave;
+            }
+          xfree (mbox);
+        }
+    }
+  if (len < 0 || es_ferror (listing))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error reading memory stream\n");
+      goto leave;
+    }
+
+  *r_mboxes = mboxes;
+  mboxes = NULL;
+
+ leave:
+  free_strlist (mboxes);
+  xfree (fields);
+  es_free (line);
+  xfree (argv);
+  es_fclose (listing);
+  return err;
+}
+
+
+/* Helper for command_install_keys.  Take all keys with a user id
+ * matching ADDRSPEC from the keyring export KEYS and return them,
+ * stripped down to that user id, as a binary keyblock in a new memory
+ * stream at R_KEY.  */
+static gpg_error_t
+filter_export_for_mbox (estream_t *r_key, estream_t keys,
+                        const char *addrspec)
+{
+  gpg_error_t err;
+  ccparray_t ccp;
+  const char **argv = NULL;
+  char *filterexp = NULL;
+  estream_t key;
+
+  *r_key = NULL;
+
+  key = es_fopenmem (0, "w+b");
+  if (!key)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error allocating memory buffer: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
+  filterexp = es_bsprintf ("keep-uid=mbox = %s", addrspec);
+  if (!filterexp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error allocating memory buffer: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
+  ccparray_init (&ccp, 0);
+
+  ccparray_put (&ccp, "--no-options");
+  if (!opt.verbose)
+    ccparray_put (&ccp, "--quiet");
+  else if (opt.verbose > 1)
+    ccparray_put (&ccp, "--verbose");
+  ccparray_put (&ccp, "--batch");
+  ccparray_put (&ccp, "--always-trust");
+  ccparray_put (&ccp, "--no-keyring");
+  ccparray_put (&ccp, "--import-options=import-export");
+  ccparray_put (&ccp, "--import-filter");
+  ccparray_put (&ccp, filterexp);
+  ccparray_put (&ccp, "--import");
+
+  ccparray_put (&ccp, NULL);
+  argv = ccparray_get (&ccp, NULL);
+  if (!argv)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  es_rewind (keys);
+  err = gnupg_exec_tool_stream (opt.gpg_program, argv, keys,
+                                NULL, key, NULL, NULL);
+  if (err)
+    {
+      log_error ("%s failed: %s\n", __func__, gpg_strerror (err));
+      goto leave;
+    }
+
+  es_rewind (key);
+  *r_key = key;
+  key = NULL;
+
+ leave:
+  es_fclose (key);
+  xfree (filterexp);
+  xfree (argv);
+  return err;
+}
+
+
+/* Helper for command_install_keys.  Return true if the file FNAME
+ * exists and has the same content as the LENGTH bytes at DATA.  */
+static int
+is_same_key_file (const char *fname, const void *data, size_t length)
+{
+  estream_t fp;
+  gcry_md_hd_t md;
+  char buffer[4096];
+  unsigned char newhash[32];
+  size_t nread, total = 0;
+  int same;
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    return 0;
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    {
+      es_fclose (fp);
+      return 0;
+    }
+  while (!es_read (fp, buffer, sizeof buffer, &nread) && nread)
+    {
+      gcry_md_write (md, buffer, nread);
+      total += nread;
+    }
+  same = (!es_ferror (fp) && total == length);
+  es_fclose (fp);
+  if (same)
+    {
+      gcry_md_hash_buffer (GCRY_MD_SHA256, newhash, data, length);
+      same = !memcmp (gcry_md_read (md, GCRY_MD_SHA256), newhash, 32);
+    }
+  gcry_md_close (md);
+  return same;
+}
+
+
+/* Install all keys from the keyring export FNAME into the WKD.  For
+ * each mailbox of a configured domain one file is created in the hu
+ * directory.  Files with an unchanged content are not touched; all
+ * other files are first written as temporary files and only renamed
+ * after all keys have been processed.  */
+static gpg_error_t
+command_install_keys (const char *fname)
+{
+  gpg_error_t err;
+  estream_t keys = NULL;
+  estream_t key = NULL;
+  strlist_t mboxes = NULL;
+  strlist_t pending = NULL;
+  strlist_t sl;
+  const char *domain;
+  char *dname = NULL;
+  char *huname = NULL;
+  char *tmpname = NULL;
+  void *data = NULL;
+  size_t datalen;
+  estream_t fp;
+  unsigned int nupdated = 0;
+  unsigned int nunchanged = 0;
+  unsigned int nskipped = 0;
+
+  keys = es_fopen (fname, "rb");
+  if (!keys)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error reading '%s': %s\n", fname, gpg_strerror (err));
+      goto leave;
+    }
+
+  err = list_export_mboxes (keys, &mboxes);
+  if (err)
+    {
+      log_error ("error parsing keys in '%s': %s\n", fname, gpg_strerror (err));
+      goto leave;
+    }
+
+  for (sl = mboxes; sl; sl = sl->next)
+    {
+      domain = strchr (sl->d, '@');
+      log_assert (domain);
+      domain++;
+      xfree (dname);
+      dname = make_filename_try (opt.directory, domain, NULL);
+      if (!dname)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      if (strchr (domain, '/') || strchr (domain, '\\')
+          || gnupg_access (dname, F_OK))
+        {
+          if (opt.verbose)
+            log_info ("skipping '%s': domain not configured\n", sl->d);
+          nskipped++;
+          continue;
+        }
+
+      es_fclose (key);
+      err = filter_export_for_mbox (&key, keys, sl->d);
+      if (err)
+        goto leave;
+      xfree (data);
+      data = NULL;
+      if (es_fclose_snatch (key, &data, &datalen))
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      key = NULL;
+      if (!datalen)
+        {
+          log_info ("no key left for '%s'\n", sl->d);
+          nskipped++;
+          continue;
+        }
+
+      xfree (huname);
+      err = wks_compute_hu_fname (&huname, sl->d);
+      if (err)
+        goto leave;
+      if (is_same_key_file (huname, data, datalen))
+        {
+          nunchanged++;
+          continue;
+        }
+
+      xfree (tmpname);
+      tmpname = strconcat (huname, ".tmp", NULL);
+      if (!tmpname)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      fp = es_fopen (tmpname, "wb");
+      if (!fp)
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("error creating '%s': %s\n", tmpname, gpg_strerror (err));
+          goto leave;
+        }
+      if (es_fwrite (data, datalen, 1, fp) != 1)
+        {
+          err = gpg_error_from_syserror ();
+          es_fclose (fp);
+          gnupg_remove (tmpname);
+          log_error ("error writing '%s': %s\n", tmpname, gpg_strerror (err));
+          goto leave;
+        }
+      if (es_fclose (fp))
+        {
+          err = gpg_error_from_syserror ();
+          gnupg_remove (tmpname);
+          log_error ("error writing '%s': %s\n", tmpname, gpg_strerror (err));
+          goto leave;
+        }
+      /* Make sure it is world readable.  */
+      if (gnupg_chmod (tmpname, "-rw-r--r--"))
+        log_error ("can't set permissions of '%s': %s\n",
+                   tmpname, gpg_strerror (gpg_err_code_from_syserror()));
+      if (!add_to_strlist_try (&pending, huname))
+        {
+          err = gpg_error_from_syserror ();
+          gnupg_remove (tmpname);
+          goto leave;
+        }
+      if (opt.verbose)
+        log_info ("key for '%s' will be updated\n", sl->d);
+    }
+
+  /* All keys are ready - now replace the files.  */
+  for (sl = pending; sl; sl = sl->next)
+    {
+      xfree (tmpname);
+      tmpname = strconcat (sl->d, ".tmp", NULL);
+      if (!tmpname)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      err = gnupg_rename_file (tmpname, sl->d, NULL);
+      if (err)
+        {
+          log_error ("renaming '%s' failed: %s\n", tmpname, gpg_strerror (err));
+          goto leave;
+        }
+      nupdated++;
+    }
+  free_strlist (pending);
+  pending = NULL;
+
+  if (!opt.quiet)
+    log_info ("published keys: %u updated, %u unchanged, %u skipped\n",
+              nupdated, nunchanged, nskipped);
+
+ leave:
+  /* Remove the temporary files not yet renamed.  */
+  for (sl = pending; sl; sl = sl->next)
+    {
+      xfree (tmpname);
+      tmpname = strconcat (sl->d, ".tmp", NULL);
+      if (tmpname)
+        gnupg_remove (tmpname);
+    }
+  free_strlist (pending);
+  free_strlist (mboxes);
+  xfree (data);
+  xfree (tmpname);
+  xfree (huname);
+  xfree (dname);
+  es_fclose (key);
+  es_fclose (keys);
+  return err;
+}
@@ -48,6 +48,7 @@
 #include "../common/i18n.h"
 #include "../common/sysutils.h"
 #include "../common/status.h"
+#include "../common/membuf.h"
 
 #include "../common/gc-opt-flags.h"
 #include "gpgconf.h"
@@ -338,6 +339,9 @@ static known_option_t known_options_gpg_agent[] =
    { "default-cache-ttl-ssh", GC_OPT_FLAG_RUNTIME, GC_LEVEL_ADVANCED },
    { "max-cache-ttl", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "max-cache-ttl-ssh", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
+   { "seckey-cache-ttl", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
+   { "session-key-cache-ttl", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
+   { "genkey-pool-size", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "ignore-cache-for-signing", GC_OPT_FLAG_RUNTIME, GC_LEVEL_BASIC },
    { "allow-emacs-pinentry", GC_OPT_FLAG_RUNTIME, GC_LEVEL_ADVANCED },
    { "grab", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
@@ -355,6 +359,7 @@ static known_option_t known_options_gpg_agent[] =
    { "max-passphrase-days", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "enable-passphrase-history", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
    { "pinentry-timeout", GC_OPT_FLAG_RUNTIME, GC_LEVEL_ADVANCED },
+   { "pinentry-idle-timeout", GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
 
    { NULL }
  };
@@ -538,6 +543,7 @@ static known_option_t known_options_keyboxd[] =
    { "log-file",          GC_OPT_FLAG_NONE, GC_LEVEL_ADVANCED,
                           GC_ARG_TYPE_FILENAME },
    { "faked-system-time", GC_OPT_FLAG_NONE, GC_LEVEL_INVISIBLE },
+   { "cache-size",        GC_OPT_FLAG_RUNTIME, GC_LEVEL_EXPERT },
 
    { NULL }
  };
@@ -931,25 +937,17 @@ keyboxd_runtime_change (int killflag)
 }
 
 
-/* Launch the gpg-agent or the dirmngr if not already running.  */
-gpg_error_t
-gc_component_launch (int component)
+/* Start gpg-connect-agent to launch COMPONENT.  The process is
+ * stored at R_PROC and must be finished by launch_component_finish.
+ * Returns an error if it could not be spawned.  */
+static gpg_error_t
+launch_component_start (int component, gpgrt_process_t *r_proc)
 {
-  gpg_error_t err;
   const char *pgmname;
   const char *argv[6];
   int i;
-  gpgrt_process_t proc = NULL;
 
-  if (component < 0)
-    {
-      err = gc_component_launch (GC_COMPONENT_GPG_AGENT);
-      if (!err)
-        err = gc_component_launch (GC_COMPONENT_KEYBOXD);
-      if (!err)
-        err = gc_component_launch (GC_COMPONENT_DIRMNGR);
-      return err;
-    }
+  *r_proc = NULL;
 
   if (!(component == GC_COMPONENT_GPG_AGENT
         || component == GC_COMPONENT_KEYBOXD
@@ -987,12 +985,22 @@ gc_component_launch (int component)
   argv[i] = NULL;
   log_assert (i < DIM(argv));
 
-  err = gpgrt_process_spawn (pgmname, argv, 0, NULL, &proc);
+  return gpgrt_process_spawn (pgmname, argv, 0, NULL, r_proc);
+}
+
+
+/* Wait for the process PROC started by launch_component_start for
+ * COMPONENT and release it.  ERR is the error returned by
+ * launch_component_start.  */
+static gpg_error_t
+launch_component_finish (int component, gpgrt_process_t proc,
+                         gpg_error_t err)
+{
   if (!err)
     err = gpgrt_process_wait (proc, 1);
   if (err)
     gc_error (0, 0, "error running '%s%s%s': %s",
-              pgmname,
+              gnupg_module_name (GNUPG_MODULE_NAME_CONNECT_AGENT),
               component == GC_COMPONENT_DIRMNGR? " --dirmngr"
               : component == GC_COMPONENT_KEYBOXD? " --keyboxd":"",
               " NOP",
@@ -1002,6 +1010,41 @@ gc_component_launch (int component)
 }
 
 
+/* Launch the gpg-agent or the dirmngr if not already running.  With
+ * COMPONENT -1 all daemons are launched; they are started all at
+ * once and only then we wait for them so that their startup times
+ * overlap.  */
+gpg_error_t
+gc_component_launch (int component)
+{
+  static const int daemons[] = { GC_COMPONENT_GPG_AGENT,
+                                 GC_COMPONENT_KEYBOXD,
+                                 GC_COMPONENT_DIRMNGR };
+  gpgrt_process_t procs[DIM (daemons)];
+  gpg_error_t errs[DIM (daemons)];
+  gpg_error_t err, tmperr;
+  gpgrt_process_t proc;
+  int i;
+
+  if (component < 0)
+    {
+      for (i=0; i < DIM (daemons); i++)
+        errs[i] = launch_component_start (daemons[i], &procs[i]);
+      err = 0;
+      for (i=0; i < DIM (daemons); i++)
+        {
+          tmperr = launch_component_finish (daemons[i], procs[i], errs[i]);
+          if (tmperr && !err)
+            err = tmperr;
+        }
+      return err;
+    }
+
+  err = launch_component_start (component, &proc);
+  return launch_component_finish (component, proc, err);
+}
+
+
 static void
 do_runtime_change (int component, int killflag)
 {
@@ -1721,17 +1764,230 @@ read_line_wrapper (struct read_line_wrapper_parm_s *parm)
   return strlen (parm->extra_line_buffer);
 }
 
+/* The directory below the homedir used to cache the output of
+ * "--dump-option-table" and "--gpgconf-list".  */
+#define OPTION_CACHE_DIR "gpgconf-cache.d"
+
+
+/* Return the first line of a cache file for the output of PGMNAME
+ * run with ARGOPT.  The line identifies the binary and the config
+ * files of COMPONENT by their mtime and size so that a cached output
+ * is not used after any of them changed.  Returns NULL if caching is
+ * not possible.  */
+static char *
+option_cache_key (gc_component_id_t component, const char *pgmname,
+                  const char *argopt)
+{
+#ifdef HAVE_STAT
+  const char *config_name = gc_component[component].option_config_filename;
+  struct stat sb;
+  unsigned long stamps[6];
+  char *fname;
+
+  memset (stamps, 0, sizeof stamps);
+  if (gnupg_stat (pgmname, &sb))
+    return NULL;
+  stamps[0] = (unsigned long)sb.st_mtime;
+  stamps[1] = (unsigned long)sb.st_size;
+  if (config_name)
+    {
+      fname = make_filename (gnupg_homedir (), config_name, NULL);
+      if (!gnupg_stat (fname, &sb))
+        {
+          stamps[2] = (unsigned long)sb.st_mtime;
+          stamps[3] = (unsigned long)sb.st_size;
+        }
+      xfree (fname);
+      fname = make_filename (gnupg_sysconfdir (), config_name, NULL);
+      if (!gnupg_stat (fname, &sb))
+        {
+          stamps[4] = (unsigned long)sb.st_mtime;
+          stamps[5] = (unsigned long)sb.st_size;
+        }
+      xfree (fname);
+    }
+
+  return xasprintf ("# %s %s %lu %lu %lu %lu %lu %lu\n", pgmname, argopt,
+                    stamps[0], stamps[1], stamps[2], stamps[3],
+                    stamps[4], stamps[5]);
+#else /*!HAVE_STAT*/
+  (void)component;
+  (void)pgmname;
+  (void)argopt;
+  return NULL;
+#endif /*!HAVE_STAT*/
+}
+
+
+/* Return the name of the cache file for COMPONENT and ARGOPT.  */
+static char *
+option_cache_fname (gc_component_id_t component, const char *argopt)
+{
+  char *tmp, *fname;
+
+  tmp = xstrconcat (gc_component[component].name, argopt, ".cache", NULL);
+  fname = make_filename (gnupg_homedir (), OPTION_CACHE_DIR, tmp, NULL);
+  xfree (tmp);
+  return fname;
+}
+
+
+/* Try to open the cache file FNAME and check that its first line
+ * matches KEY.  On success the stream is returned positioned after
+ * that line; NULL is returned if there is no usable cache.  */
+static estream_t
+open_option_cache (const char *fname, const char *key)
+{
+  estream_t fp;
+  char *line = NULL;
+  size_t line_len = 0;
+  ssize_t length;
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    return NULL;
+  length = es_read_line (fp, &line, &line_len, NULL);
+  if (length <= 0 || strcmp (line, key))
+    {
+      es_fclose (fp);
+      fp = NULL;
+    }
+  xfree (line);
+  return fp;
+}
+
+
+/* Store the output BUFFER of length LENGTH under KEY in the cache
+ * file FNAME.  Errors are not fatal; the cache is then just not
+ * used.  */
+static void
+write_option_cache (const char *fname, const char *key,
+                    const void *buffer, size_t length)
+{
+  char *dname, *tmpname;
+  estream_t fp;
+  int okay;
+
+  dname = make_filename (gnupg_homedir (), OPTION_CACHE_DIR, NULL);
+  if (gnupg_access (dname, F_OK) && gnupg_mkdir (dname, "-rwx"))
+    {
+      xfree (dname);
+      return;
+    }
+  xfree (dname);
+
+  tmpname = xasprintf ("%s.%u.tmp", fname, (unsigned int)getpid ());
+  fp = es_fopen (tmpname, "wb");
+  if (!fp)
+    {
+      xfree (tmpname);
+      return;
+    }
+  okay = (!es_fputs (key, fp)
+          && (!length || es_fwrite (buffer, length, 1, fp) == 1));
+  if (es_fclose (fp))
+    okay = 0;
+  if (!okay || gnupg_rename_file (tmpname, fname, NULL))
+    {
+      gnupg_remove (tmpname);
+      if (opt.verbose)
+        gc_error (0, 0, "note: can't update option cache '%s'", fname);
+    }
+  xfree (tmpname);
+}
+
+
+/* Return a stream with the output of PGMNAME run with the single
+ * option ARGOPT.  WHAT describes that output for error messages.
+ * Running the program is skipped if a matching output is found in
+ * the cache below the homedir.  The caller must close the returned
+ * stream.  */
+static estream_t
+get_program_output (gc_component_id_t component, const char *pgmname,
+                    const char *argopt, const char *what)
+{
+  gpg_error_t err;
+  const char *argv[2];
+  gpgrt_process_t proc;
+  estream_t outfp, memfp;
+  char *key, *fname = NULL;
+  membuf_t mb;
+  char buffer[4096];
+  size_t nread;
+  const void *data;
+  size_t datalen;
+
+  key = option_cache_key (component, pgmname, argopt);
+  if (key)
+    {
+      fname = option_cache_fname (component, argopt);
+      outfp = open_option_cache (fname, key);
+      if (outfp)
+        {
+          xfree (fname);
+          xfree (key);
+          return outfp;
+        }
+    }
+
+  argv[0] = argopt;
+  argv[1] = NULL;
+  err = gpgrt_process_spawn (pgmname, argv, GPGRT_PROCESS_STDOUT_PIPE,
+                             NULL, &proc);
+  if (err)
+    {
+      gc_error (1, 0, "could not gather %s from '%s': %s",
+                what, pgmname, gpg_strerror (err));
+    }
+
+  gpgrt_process_get_streams (proc, 0, NULL, &outfp, NULL);
+
+  init_membuf (&mb, 4096);
+  while (!es_read (outfp, buffer, sizeof buffer, &nread) && nread)
+    put_membuf (&mb, buffer, nread);
+  if (es_ferror (outfp))
+    gc_error (1, errno, "error reading from %s", pgmname);
+  if (es_fclose (outfp))
+    gc_error (1, errno, "error closing %s", pgmname);
+
+  err = gpgrt_process_wait (proc, 1);
+  if (!err)
+    {
+      int exitcode;
+
+      gpgrt_process_ctl (proc, GPGRT_PROCESS_GET_EXIT_ID, &exitcode);
+      if (exitcode)
+        gc_error (1, 0, "running %s failed (exitcode=%d): %s",
+                  pgmname, exitcode, gpg_strerror (err));
+    }
+  gpgrt_process_release (proc);
+
+  data = peek_membuf (&mb, &datalen);
+  if (!data)
+    gc_error (1, errno, "error reading from %s", pgmname);
+
+  if (key && !err)
+    write_option_cache (fname, key, data, datalen);
+
+  memfp = get_membuf_stream (&mb, "rb");
+  if (!memfp)
+    gc_error (1, errno, "error reading from %s", pgmname);
+
+  xfree (fname);
+  xfree (key);
+  return memfp;
+}
+
+
 /* Retrieve the options for the component COMPONENT.  With
  * ONLY_INSTALLED set components which are not installed are silently
- * ignored. */
+ * ignored.  The output of the component program is cached below the
+ * homedir; see get_program_output.  */
 static void
 retrieve_options_from_program (gc_component_id_t component, int only_installed)
 {
-  gpg_error_t err;
   const char *pgmname;
-  const char *argv[2];
   estream_t outfp;
-  gpgrt_process_t proc;
   known_option_t *known_option;
   gc_option_t *option;
   char *line = NULL;
@@ -1762,17 +2018,8 @@ retrieve_options_from_program (gc_component_id_t component, int only_installed)
 
 
   /* First we need to read the option table from the program.  */
-  argv[0] = "--dump-option-table";
-  argv[1] = NULL;
-  err = gpgrt_process_spawn (pgmname, argv, GPGRT_PROCESS_STDOUT_PIPE,
-                             NULL, &proc);
-  if (err)
-    {
-      gc_error (1, 0, "could not gather option table from '%s': %s",
-                pgmname, gpg_strerror (err));
-    }
-
-  gpgrt_process_get_streams (proc, 0, NULL, &outfp, NULL);
+  outfp = get_program_output (component, pgmname,
+                              "--dump-option-table", "option table");
 
   read_line_parm.pgmname = pgmname;
   read_line_parm.fp = outfp;
@@ -1932,35 +2179,14 @@ retrieve_options_from_program (gc_component_id_t component, int only_installed)
   line_len = read_line_parm.line_len;
   log_assert (opt_table_used + pseudo_count == opt_info_used);
 
-  err = gpgrt_process_wait (proc, 1);
-  if (!err)
-    {
-      int exitcode;
-
-      gpgrt_process_ctl (proc, GPGRT_PROCESS_GET_EXIT_ID, &exitcode);
-      if (exitcode)
-        gc_error (1, 0, "running %s failed (exitcode=%d): %s",
-                  pgmname, exitcode, gpg_strerror (err));
-    }
-  gpgrt_process_release (proc);
-
   /* Make the gpgrt option table and the internal option table available.  */
   gc_component[component].opt_table = opt_table;
   gc_component[component].options = opt_info;
 
 
   /* Now read the default options.  */
-  argv[0] = "--gpgconf-list";
-  argv[1] = NULL;
-  err = gpgrt_process_spawn (pgmname, argv, GPGRT_PROCESS_STDOUT_PIPE,
-                             NULL, &proc);
-  if (err)
-    {
-      gc_error (1, 0, "could not gather active options from '%s': %s",
-                pgmname, gpg_strerror (err));
-    }
-
-  gpgrt_process_get_streams (proc, 0, NULL, &outfp, NULL);
+  outfp = get_program_output (component, pgmname,
+                              "--gpgconf-list", "active options");
 
   while ((length = es_read_line (outfp, &line, &line_len, NULL)) > 0)
     {
@@ -2044,18 +2270,6 @@ retrieve_options_from_program (gc_component_id_t component, int only_installed)
   if (es_fclose (outfp))
     gc_error (1, errno, "error closing %s", pgmname);
 
-  err = gpgrt_process_wait (proc, 1);
-  if (!err)
-    {
-      int exitcode;
-
-      gpgrt_process_ctl (proc, GPGRT_PROCESS_GET_EXIT_ID, &exitcode);
-      if (exitcode)
-        gc_error (1, 0, "running %s failed (exitcode=%d): %s",
-                  pgmname, exitcode, gpg_strerror (err));
-    }
-  gpgrt_process_release (proc);
-
 
   /* At this point, we can parse the configuration file.  */
   config_name = gc_component[component].option_config_filename;
@@ -29,6 +29,11 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <fcntl.h>
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+# include <sys/sendfile.h>
+# define USE_SENDFILE 1
+#endif
 #ifdef HAVE_W32_SYSTEM
 # define WIN32_LEAN_AND_MEAN
 # include <windows.h>
@@ -61,6 +66,19 @@ static unsigned long long global_total_data;
 /* Number of data bytes written so far.  */
 static unsigned long long global_written_data;
 
+/* Number of regular files opened ahead of the file being written.
+ * This lets the kernel read them while we are busy with the current
+ * file.  */
+#define PREFETCH_FILES 16
+
+/* Data progress is shown in steps of this many bytes.  */
+#define DATA_PROGRESS_STEP (100ULL * 1024 * 1024)
+
+/* Files with at least this many bytes of complete records are sent
+ * with sendfile, in chunks of SENDFILE_CHUNK bytes.  */
+#define SENDFILE_MIN   (64 * 1024)
+#define SENDFILE_CHUNK (1024 * 1024)
+
 
 
 /* Object to control the file scanning.  */
@@ -75,6 +93,21 @@ struct scanctrl_s
 };
 
 
+/* Object to keep track of the files opened in advance.  */
+struct prefetch_s
+{
+  tar_header_t next;        /* The next entry to consider.  */
+  unsigned int head;        /* Index of the oldest used slot.  */
+  unsigned int count;       /* Number of used slots.  */
+  struct {
+    tar_header_t hdr;
+    estream_t fp;           /* NULL if the file could not be opened.  */
+    gpg_error_t err;        /* The error from opening the file.  */
+  } slot[PREFETCH_FILES];
+};
+typedef struct prefetch_s *prefetch_t;
+
+
 /* See ../g10/progress.c:write_status_progress for some background.  */
 static void
 write_progress (int countmode, unsigned long long current,
@@ -946,16 +979,150 @@ write_extended_header (estream_t stream, const void *record, strlist_t exthdr)
 }
 
 
+/* Account for NBYTES of written file data and show the progress.  */
+static void
+add_written_data (size_t nbytes)
+{
+  if ((global_written_data + nbytes) / DATA_PROGRESS_STEP
+      != global_written_data / DATA_PROGRESS_STEP)
+    write_progress (0, global_written_data + nbytes, global_total_data);
+  global_written_data += nbytes;
+}
+
+
+#ifdef USE_SENDFILE
+/* Send the complete records of the regular file INFP described by
+ * HDR by means of sendfile directly to the file descriptor of STREAM.
+ * This avoids copying the data through our buffers.  The number of
+ * bytes sent is stored at R_SENT and INFP is positioned after them;
+ * that number is less than expected if the file shrunk.  If nothing
+ * could be sent GPG_ERR_NOT_SUPPORTED is returned and the caller
+ * should copy the data itself.  */
 static gpg_error_t
-write_file (estream_t stream, tar_header_t hdr, unsigned int *skipped_open)
+send_file_data (estream_t stream, estream_t infp, tar_header_t hdr,
+                unsigned long long *r_sent)
+{
+  gpg_error_t err;
+  unsigned long long total;
+  off_t offset = 0;
+  size_t chunk;
+  ssize_t n;
+  int outfd, infd;
+
+  *r_sent = 0;
+  total = hdr->size - (hdr->size % RECORDSIZE);
+  if (total < SENDFILE_MIN)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  outfd = es_fileno (stream);
+  infd = es_fileno (infp);
+  if (outfd == -1 || infd == -1)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  /* Write out the buffered header first.  */
+  if (es_fflush (stream))
+    return gpg_error_from_syserror ();
+
+  while (*r_sent < total)
+    {
+      chunk = (total - *r_sent > SENDFILE_CHUNK)? SENDFILE_CHUNK
+                                                 : (total - *r_sent);
+      n = sendfile (outfd, infd, &offset, chunk);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        {
+          if (!*r_sent && (errno == EINVAL || errno == ENOSYS))
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          return gpg_error_from_syserror ();
+        }
+      if (!n)
+        break;  /* The file shrunk; the caller will notice.  */
+      *r_sent += n;
+      add_written_data (n);
+    }
+
+  if (es_fseeko (infp, offset, SEEK_SET))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error seeking in '%s': %s\n", hdr->name, gpg_strerror (err));
+      return err;
+    }
+  return 0;
+}
+#endif /*USE_SENDFILE*/
+
+
+/* Open the regular files following the last opened one until all
+ * slots of PF are used.  */
+static void
+prefetch_fill (prefetch_t pf)
+{
+  unsigned int idx;
+  estream_t fp;
+
+  for (; pf->next && pf->count < PREFETCH_FILES; pf->next = pf->next->next)
+    {
+      if (pf->next->typeflag != TF_REGULAR)
+        continue;
+      idx = (pf->head + pf->count++) % PREFETCH_FILES;
+      pf->slot[idx].hdr = pf->next;
+      fp = es_fopen (pf->next->name, "rb,sysopen");
+      pf->slot[idx].fp = fp;
+      pf->slot[idx].err = fp? 0 : gpg_error_from_syserror ();
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+      if (fp && pf->next->size)
+        posix_fadvise (es_fileno (fp), 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    }
+}
+
+
+/* Return the stream opened in advance for HDR.  If opening the file
+ * failed NULL is returned and the error stored at R_ERR.  */
+static estream_t
+prefetch_take (prefetch_t pf, tar_header_t hdr, gpg_error_t *r_err)
+{
+  estream_t fp;
+
+  prefetch_fill (pf);
+  log_assert (pf->count && pf->slot[pf->head].hdr == hdr);
+  fp = pf->slot[pf->head].fp;
+  *r_err = pf->slot[pf->head].err;
+  pf->head = (pf->head + 1) % PREFETCH_FILES;
+  pf->count--;
+  return fp;
+}
+
+
+/* Close all streams still held by PF.  */
+static void
+prefetch_release (prefetch_t pf)
+{
+  for (; pf->count; pf->count--, pf->head = (pf->head + 1) % PREFETCH_FILES)
+    es_fclose (pf->slot[pf->head].fp);
+  pf->next = NULL;
+}
+
+
+static gpg_error_t
+write_file (estream_t stream, tar_header_t hdr, prefetch_t pf,
+            unsigned int *skipped_open)
 {
   gpg_error_t err;
   char record[RECORDSIZE];
+  char *buffer = NULL;
+  char *block;
   estream_t infp;
-  size_t nread, nbytes;
+  size_t nread, nbytes, nrecs;
+  unsigned long long remaining;
   strlist_t exthdr = NULL;
   int any;
 
+  if (hdr->typeflag == TF_REGULAR)
+    infp = prefetch_take (pf, hdr, &err);
+  else
+    infp = NULL;
+
   err = build_header (record, hdr, &exthdr);
   if (err)
     {
@@ -964,25 +1131,19 @@ write_file (estream_t stream, tar_header_t hdr, unsigned int *skipped_open)
           log_info ("silently skipping unsupported file '%s'\n", hdr->name);
           err = 0;
         }
+      es_fclose (infp);
       return err;
     }
 
-  if (hdr->typeflag == TF_REGULAR)
+  if (hdr->typeflag == TF_REGULAR && !infp)
     {
-      infp = es_fopen (hdr->name, "rb,sysopen");
-      if (!infp)
-        {
-          err = gpg_error_from_syserror ();
-          log_info ("can't open '%s': %s - skipped\n",
-                     hdr->name, gpg_strerror (err));
-          ++*skipped_open;
-          if (!*skipped_open) /* Protect against overflow.  */
-            --*skipped_open;
-          return 0;
-        }
+      log_info ("can't open '%s': %s - skipped\n",
+                hdr->name, gpg_strerror (err));
+      ++*skipped_open;
+      if (!*skipped_open) /* Protect against overflow.  */
+        --*skipped_open;
+      return 0;
     }
-  else
-    infp = NULL;
 
   if (exthdr && (err = write_extended_header (stream, record, exthdr)))
     goto leave;
@@ -995,14 +1156,48 @@ write_file (estream_t stream, tar_header_t hdr, unsigned int *skipped_open)
 
   if (hdr->typeflag == TF_REGULAR)
     {
+      /* Copy the data in blocks of several records; only the last
+       * record of the file needs padding.  */
       hdr->nrecords = (hdr->size + RECORDSIZE-1)/RECORDSIZE;
+      remaining = hdr->size;
       any = 0;
-      while (hdr->nrecords--)
+#ifdef USE_SENDFILE
+      {
+        unsigned long long sent;
+
+        err = send_file_data (stream, infp, hdr, &sent);
+        if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+          err = 0;
+        else if (err)
+          {
+            log_error ("error writing '%s': %s\n",
+                       es_fname_get (stream), gpg_strerror (err));
+            goto leave;
+          }
+        hdr->nrecords -= sent / RECORDSIZE;
+        remaining -= sent;
+        any = !!sent;
+      }
+#endif /*USE_SENDFILE*/
+      if (hdr->nrecords > 1)
         {
-          nbytes = hdr->nrecords? RECORDSIZE : (hdr->size % RECORDSIZE);
-          if (!nbytes)
-            nbytes = RECORDSIZE;
-          nread = es_fread (record, 1, nbytes, infp);
+          buffer = xtrymalloc (RECORDS_PER_BLOCK * RECORDSIZE);
+          if (!buffer)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+        }
+      block = buffer? buffer : record;
+      while (hdr->nrecords)
+        {
+          nrecs = buffer? RECORDS_PER_BLOCK : 1;
+          if (nrecs > hdr->nrecords)
+            nrecs = hdr->nrecords;
+          nbytes = nrecs * RECORDSIZE;
+          if (nbytes > remaining)
+            nbytes = remaining;
+          nread = es_fread (block, 1, nbytes, infp);
           if (nread != nbytes)
             {
               err = gpg_error_from_syserror ();
@@ -1011,15 +1206,19 @@ write_file (estream_t stream, tar_header_t hdr, unsigned int *skipped_open)
                          any? " (file shrunk?)":"");
               goto leave;
             }
-          else if (nbytes < RECORDSIZE)
-            memset (record + nbytes, 0, RECORDSIZE - nbytes);
+          else if (nbytes < nrecs * RECORDSIZE)
+            memset (block + nbytes, 0, nrecs * RECORDSIZE - nbytes);
           any = 1;
-          err = write_record (stream, record);
-          if (err)
-            goto leave;
-          global_written_data += nbytes;
-          if (!((global_written_data/nbytes) % (2048*100)))
-            write_progress (0, global_written_data, global_total_data);
+          if (es_fwrite (block, RECORDSIZE, nrecs, stream) != nrecs)
+            {
+              err = gpg_error_from_syserror ();
+              log_error ("error writing '%s': %s\n",
+                         es_fname_get (stream), gpg_strerror (err));
+              goto leave;
+            }
+          hdr->nrecords -= nrecs;
+          remaining -= nbytes;
+          add_written_data (nbytes);
         }
       nread = es_fread (record, 1, 1, infp);
       if (nread)
@@ -1032,6 +1231,7 @@ write_file (estream_t stream, tar_header_t hdr, unsigned int *skipped_open)
   else if ((err = es_fclose (infp)))
     log_error ("error closing file '%s': %s\n", hdr->name, gpg_strerror (err));
 
+  xfree (buffer);
   free_strlist (exthdr);
   return err;
 }
@@ -1070,9 +1270,12 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
   int eof_seen = 0;
   gpgrt_process_t proc = NULL;
   unsigned int skipped_open = 0;
+  struct prefetch_s prefetch_buffer;
+  prefetch_t prefetch = &prefetch_buffer;
 
   memset (scanctrl, 0, sizeof *scanctrl);
   scanctrl->flist_tail = &scanctrl->flist;
+  memset (prefetch, 0, sizeof *prefetch);
 
   if (!inpattern)
     {
@@ -1318,6 +1521,7 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
         goto leave;
       /* Note that OUTSTREAM is our tar output which is fed to gpg.  */
       gpgrt_process_get_streams (proc, 0, &outstream, NULL, NULL);
+      es_setvbuf (outstream, NULL, _IOFBF, PIPE_BUFFER_SIZE);
       es_set_binary (outstream);
     }
   else if (opt.outfile) /* No crypto  */
@@ -1342,9 +1546,10 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
     }
 
   skipped_open = 0;
+  prefetch->next = scanctrl->flist;
   for (hdr = scanctrl->flist; hdr; hdr = hdr->next)
     {
-      err = write_file (outstream, hdr, &skipped_open);
+      err = write_file (outstream, hdr, prefetch, &skipped_open);
       if (err)
         goto leave;
     }
@@ -1404,6 +1609,7 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
       if (opt.outfile)
         gnupg_remove (opt.outfile);
     }
+  prefetch_release (prefetch);
   scanctrl->flist_tail = NULL;
   while ( (hdr = scanctrl->flist) )
     {
@@ -77,7 +77,7 @@ try_mkdir_p (const char *directory, size_t prefixlen, int strip, int verbose)
 {
   gpg_error_t err = 0;
   char *fname;
-  char *p;
+  char *p, *end;
 
   fname = xtrystrdup (directory);
   if (!fname)
@@ -98,20 +98,30 @@ try_mkdir_p (const char *directory, size_t prefixlen, int strip, int verbose)
   if (prefixlen >= strlen (fname))
     goto leave; /* Nothing to create */
 
-  for (p = fname+prefixlen; (p = strchr (p, '/')); p++)
+  /* Usually only the last few directories are missing.  Thus we go
+   * up from the full name until a mkdir does not fail with ENOENT
+   * and then create the remaining directories downwards.  This needs
+   * far less system calls than starting at the prefix.  */
+  end = fname + strlen (fname);
+  for (;;)
     {
-      *p = 0;
       err = gnupg_mkdir (fname, "-rwx------");
-      if (gpg_err_code (err) == GPG_ERR_EEXIST)
-        err = 0;
+      if (!err || gpg_err_code (err) == GPG_ERR_EEXIST)
+        break;
+      if (gpg_err_code (err) != GPG_ERR_ENOENT
+          || !(p = strrchr (fname, '/')) || p < fname + prefixlen)
+        goto leave;
+      *p = 0;
+    }
+  while ((p = fname + strlen (fname)) < end)
+    {
       *p = '/';
-      if (err)
+      err = gnupg_mkdir (fname, "-rwx------");
+      if (err && gpg_err_code (err) != GPG_ERR_EEXIST)
         goto leave;
     }
-  err = gnupg_mkdir (fname, "-rwx------");
-  if (gpg_err_code (err) == GPG_ERR_EEXIST)
-    err = 0;
-  if (!err && verbose)
+  err = 0;
+  if (verbose)
     log_info ("created   '%s/'\n", fname);
 
  leave:
@@ -127,7 +137,10 @@ extract_regular (estream_t stream, const char *dirname,
 {
   gpg_error_t err;
   char record[RECORDSIZE];
-  size_t n, nbytes, nwritten;
+  char *buffer = NULL;
+  char *block;
+  size_t nrecs, nbytes, nwritten;
+  unsigned long long n, remaining;
   char *fname_buffer = NULL;
   const char *fname;
   estream_t outfp = NULL;
@@ -159,7 +172,7 @@ extract_regular (estream_t stream, const char *dirname,
     {
       err = gpg_error_from_syserror ();
       /* On ENOENT, try afain after trying to create the directories.  */
-      if (!opt.dry_run && gpg_err_code (GPG_ERR_ENOENT)
+      if (!opt.dry_run && gpg_err_code (err) == GPG_ERR_ENOENT
           && !try_mkdir_p (fname, strlen (dirname) + 1, 1, opt.verbose))
         {
           outfp = es_fopen (fname, "wb,sysopen");
@@ -172,19 +185,33 @@ extract_regular (estream_t stream, const char *dirname,
         }
     }
 
-  for (n=0; n < hdr->nrecords;)
+  /* Copy the data in blocks of several records.  */
+  if (hdr->nrecords > 1)
     {
-      err = read_record (stream, record);
+      buffer = xtrymalloc (RECORDS_PER_BLOCK * RECORDSIZE);
+      if (!buffer)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+  block = buffer? buffer : record;
+  remaining = hdr->size;
+  for (n=0; n < hdr->nrecords; n += nrecs)
+    {
+      nrecs = buffer? RECORDS_PER_BLOCK : 1;
+      if (nrecs > hdr->nrecords - n)
+        nrecs = hdr->nrecords - n;
+      err = read_records (stream, block, nrecs);
       if (err)
         goto leave;
-      info->nblocks++;
-      n++;
-      if (n < hdr->nrecords || (hdr->size && !(hdr->size % RECORDSIZE)))
-        nbytes = RECORDSIZE;
-      else
-        nbytes = (hdr->size % RECORDSIZE);
+      info->nblocks += nrecs;
+      nbytes = nrecs * RECORDSIZE;
+      if (nbytes > remaining)
+        nbytes = remaining;
+      remaining -= nbytes;
 
-      nwritten = es_fwrite (record, 1, nbytes, outfp);
+      nwritten = es_fwrite (block, 1, nbytes, outfp);
       if (nwritten != nbytes)
         {
           err = gpg_error_from_syserror ();
@@ -208,6 +235,7 @@ extract_regular (estream_t stream, const char *dirname,
         log_error ("error removing incomplete file '%s': %s\n",
                    fname, gpg_strerror (gpg_error_from_syserror ()));
     }
+  xfree (buffer);
   xfree (fname_buffer);
   return err;
 }
@@ -274,7 +302,6 @@ extract (estream_t stream, const char *dirname, tarinfo_t info,
          tar_header_t hdr, strlist_t exthdr)
 {
   gpg_error_t err;
-  size_t n;
 
   if (hdr->typeflag == TF_REGULAR || hdr->typeflag == TF_UNKNOWN)
     err = extract_regular (stream, dirname, info, hdr, exthdr);
@@ -282,8 +309,6 @@ extract (estream_t stream, const char *dirname, tarinfo_t info,
     err = extract_directory (dirname, info, hdr, exthdr);
   else
     {
-      char record[RECORDSIZE];
-
       log_info ("unsupported file type %d for '%s' - skipped\n",
                 (int)hdr->typeflag, hdr->name);
       if (hdr->typeflag == TF_SYMLINK)
@@ -292,12 +317,7 @@ extract (estream_t stream, const char *dirname, tarinfo_t info,
         info->skipped_hardlinks++;
       else
         info->skipped_other++;
-      for (err = 0, n=0; !err && n < hdr->nrecords; n++)
-        {
-          err = read_record (stream, record);
-          if (!err)
-            info->nblocks++;
-        }
+      err = skip_records (stream, info, hdr->nrecords);
     }
   return err;
 }
@@ -498,6 +518,7 @@ gpgtar_extract (const char *filename, int decrypt)
       if (err)
         goto leave;
       gpgrt_process_get_streams (proc, 0, NULL, &stream, NULL);
+      es_setvbuf (stream, NULL, _IOFBF, PIPE_BUFFER_SIZE);
       es_set_binary (stream);
     }
   else if (filename)
@@ -505,7 +526,10 @@ gpgtar_extract (const char *filename, int decrypt)
       if (!strcmp (filename, "-"))
         stream = es_stdin;
       else
-        stream = es_fopen (filename, "rb,sysopen");
+        {
+          stream = es_fopen (filename, "rb,sysopen");
+          tarinfo->seekable = 1;
+        }
       if (!stream)
         {
           err = gpg_error_from_syserror ();
@@ -375,15 +375,8 @@ read_header (estream_t stream, tarinfo_t info,
 static int
 skip_data (estream_t stream, tarinfo_t info, tar_header_t header)
 {
-  char record[RECORDSIZE];
-  unsigned long long n;
-
-  for (n=0; n < header->nrecords; n++)
-    {
-      if (read_record (stream, record))
-        return -1;
-      info->nblocks++;
-    }
+  if (skip_records (stream, info, header->nrecords))
+    return -1;
 
   return 0;
 }
@@ -533,6 +526,7 @@ gpgtar_list (const char *filename, int decrypt)
       if (err)
         goto leave;
       gpgrt_process_get_streams (proc, 0, NULL, &stream, NULL);
+      es_setvbuf (stream, NULL, _IOFBF, PIPE_BUFFER_SIZE);
       es_set_binary (stream);
     }
   else if (filename)  /* No decryption requested.  */
@@ -540,7 +534,10 @@ gpgtar_list (const char *filename, int decrypt)
       if (!strcmp (filename, "-"))
         stream = es_stdin;
       else
-        stream = es_fopen (filename, "rb,sysopen");
+        {
+          stream = es_fopen (filename, "rb,sysopen");
+          tarinfo->seekable = 1;
+        }
       if (!stream)
         {
           err = gpg_error_from_syserror ();
@@ -619,12 +619,21 @@ main (int argc, char **argv)
    because a tarball has an explicit EOF record. */
 gpg_error_t
 read_record (estream_t stream, void *record)
+{
+  return read_records (stream, record, 1);
+}
+
+
+/* Read the next NRECORDS records from STREAM into BUFFER which must
+   be at least of size NRECORDS * RECORDSIZE.  See read_record.  */
+gpg_error_t
+read_records (estream_t stream, void *buffer, size_t nrecords)
 {
   gpg_error_t err;
   size_t nread;
 
-  nread = es_fread (record, 1, RECORDSIZE, stream);
-  if (nread != RECORDSIZE)
+  nread = es_fread (buffer, 1, nrecords * RECORDSIZE, stream);
+  if (nread != nrecords * RECORDSIZE)
     {
       err = gpg_error_from_syserror ();
       if (es_ferror (stream))
@@ -633,7 +642,7 @@ read_record (estream_t stream, void *record)
       else
         log_error ("error reading '%s': premature EOF "
                    "(size of last record: %zu)\n",
-                   es_fname_get (stream), nread);
+                   es_fname_get (stream), nread % RECORDSIZE);
     }
   else
     err = 0;
@@ -642,6 +651,39 @@ read_record (estream_t stream, void *record)
 }
 
 
+/* Skip the next NRECORDS records of STREAM.  If the stream is
+   seekable as indicated by INFO we seek instead of reading the data;
+   this makes listing a plain tarball fast.  */
+gpg_error_t
+skip_records (estream_t stream, tarinfo_t info, unsigned long long nrecords)
+{
+  gpg_error_t err;
+  char buffer[RECORDS_PER_BLOCK * RECORDSIZE];
+  size_t n;
+
+  if (!nrecords)
+    return 0;
+
+  if (info->seekable
+      && !es_fseeko (stream, (off_t)(nrecords * RECORDSIZE), SEEK_CUR))
+    {
+      info->nblocks += nrecords;
+      return 0;
+    }
+
+  while (nrecords)
+    {
+      n = nrecords > RECORDS_PER_BLOCK? RECORDS_PER_BLOCK : nrecords;
+      err = read_records (stream, buffer, n);
+      if (err)
+        return err;
+      info->nblocks += n;
+      nrecords -= n;
+    }
+  return 0;
+}
+
+
 /* Write the RECORD of size RECORDSIZE to STREAM.  FILENAME is the
    name of the file used for diagnostics.  */
 gpg_error_t
@@ -63,6 +63,7 @@ struct tarinfo_s
   unsigned long skipped_symlinks;
   unsigned long skipped_hardlinks;
   unsigned long skipped_other;
+  int seekable;                   /* The input stream is seekable.   */
 };
 typedef struct tarinfo_s *tarinfo_t;
 
@@ -74,6 +75,14 @@ typedef struct tarinfo_s *tarinfo_t;
    useless.  */
 #define RECORDSIZE 512
 
+/* The size of the stream buffer used for the pipe to and from gpg.
+ * A larger buffer than the default means fewer system calls and
+ * context switches for the pipe.  */
+#define PIPE_BUFFER_SIZE (64 * 1024)
+
+/* Number of records read or written at once for file data.  */
+#define RECORDS_PER_BLOCK 64
+
 
 /* Description of the USTAR header format.  */
 struct ustar_raw_header
@@ -144,6 +153,9 @@ struct tar_header_s
 
 /*-- gpgtar.c --*/
 gpg_error_t read_record (estream_t stream, void *record);
+gpg_error_t read_records (estream_t stream, void *buffer, size_t nrecords);
+gpg_error_t skip_records (estream_t stream, tarinfo_t info,
+                          unsigned long long nrecords);
 gpg_error_t write_record (estream_t stream, const void *record);
 
 /*-- gpgtar-create.c --*/
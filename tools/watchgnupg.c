@@ -61,6 +61,12 @@
 #endif
 
 
+/* The size of the buffer used to read from the clients and the size
+ * of the stdout buffer.  stdout is flushed whenever we are about to
+ * wait for new input.  */
+#define READ_BUFFER_SIZE   8192
+#define OUTPUT_BUFFER_SIZE 65536
+
 static int verbose;
 static int time_only;
 
@@ -129,7 +135,9 @@ struct client_s {
   size_t size;  /* Allocated size of buffer. */
   size_t len;   /* Current length of buffer. */
   unsigned char *buffer; /* Buffer to with data already read. */
-
+  time_t connected;      /* Time the client connected.  */
+  unsigned long nlines;  /* Number of lines received.  */
+  unsigned long long nbytes; /* Number of bytes received.  */
 };
 typedef struct client_s *client_t;
 
@@ -142,6 +150,8 @@ static client_t client_list;
 static void
 print_fd_and_time (int fd)
 {
+  static time_t last_time = (time_t)(-1);
+  static char last_stamp[80];
   struct tm *tp;
   time_t atime;
 
@@ -165,17 +175,45 @@ print_fd_and_time (int fd)
     }
 #endif /* ENABLE_LOG_CLOCK */
 
+  /* Busy clients send many lines per second; thus we format the
+   * time only once per second.  */
   atime = time (NULL);
-  tp = localtime (&atime);
-  if (time_only)
-    printf ("%3d - %02d:%02d:%02d ",
-            fd,
-            tp->tm_hour, tp->tm_min, tp->tm_sec );
-  else
-    printf ("%3d - %04d-%02d-%02d %02d:%02d:%02d ",
-            fd,
-            1900+tp->tm_year, tp->tm_mon+1, tp->tm_mday,
-            tp->tm_hour, tp->tm_min, tp->tm_sec );
+  if (atime != last_time)
+    {
+      last_time = atime;
+      tp = localtime (&atime);
+      if (time_only)
+        snprintf (last_stamp, sizeof last_stamp, "%02d:%02d:%02d",
+                  tp->tm_hour, tp->tm_min, tp->tm_sec );
+      else
+        snprintf (last_stamp, sizeof last_stamp,
+                  "%04d-%02d-%02d %02d:%02d:%02d",
+                  1900+tp->tm_year, tp->tm_mon+1, tp->tm_mday,
+                  tp->tm_hour, tp->tm_min, tp->tm_sec );
+    }
+  printf ("%3d - %s ", fd, last_stamp);
+}
+
+
+/* Print the disconnect message for client C.  With --verbose the
+   number of received lines and bytes and the rate are also shown.  */
+static void
+print_disconnect (client_t c, const char *reason)
+{
+  unsigned long secs;
+
+  if (!verbose)
+    {
+      printf ("[client at fd %d %s]\n", c->fd, reason);
+      return;
+    }
+
+  secs = (unsigned long)(time (NULL) - c->connected);
+  printf ("[client at fd %d %s: %lu lines, %llu bytes in %lus"
+          " (%lu lines/s, %llu bytes/s)]\n",
+          c->fd, reason, c->nlines, c->nbytes, secs,
+          secs? c->nlines / secs : c->nlines,
+          secs? c->nbytes / secs : c->nbytes);
 }
 
 
@@ -191,6 +229,7 @@ print_line (client_t c, const char *line)
     {
       if (c->buffer && c->len)
         {
+          c->nlines++;
           print_fd_and_time (c->fd);
           fwrite (c->buffer, c->len, 1, stdout);
           putc ('\n', stdout);
@@ -201,6 +240,7 @@ print_line (client_t c, const char *line)
 
   while ((s = strchr (line, '\n')))
     {
+      c->nlines++;
       print_fd_and_time (c->fd);
       if (c->buffer && c->len)
         {
@@ -270,6 +310,9 @@ setup_client (int server_fd, int is_un)
           client_list = client;
         }
       client->fd = fd;
+      client->connected = time (NULL);
+      client->nlines = 0;
+      client->nbytes = 0;
       printf ("[client at fd %d connected (%s)]\n",
               client->fd, is_un? "local":"tcp");
     }
@@ -489,7 +532,10 @@ main (int argc, char **argv)
   if (argc)
     logname = *argv;
 
-  setvbuf (stdout, NULL, _IOLBF, 0);
+  /* We use a large buffer for stdout and flush it before waiting for
+     new input.  This avoids a write for each log line and thus keeps
+     up with busy clients without delaying the output.  */
+  setvbuf (stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
 
   if (tcp)
     {
@@ -610,6 +656,7 @@ main (int argc, char **argv)
               max_fd = client->fd;
           }
 
+      fflush (stdout);
       if (select (max_fd + 1, &rfds, NULL, NULL, NULL) <= 0)
         continue;  /* Ignore any errors. */
 
@@ -621,7 +668,7 @@ main (int argc, char **argv)
       for (client = client_list; client; client = client->next)
         if (client->fd != -1 && FD_ISSET (client->fd, &rfds))
           {
-            char line[256];
+            char line[READ_BUFFER_SIZE];
             int n;
 
             n = read (client->fd, line, sizeof line - 1);
@@ -631,6 +678,8 @@ main (int argc, char **argv)
                 print_line (client, NULL); /* flush */
                 printf ("[client at fd %d read error: %s]\n",
                         client->fd, strerror (save_errno));
+                if (verbose)
+                  print_disconnect (client, "closed");
                 close (client->fd);
                 client->fd = -1;
               }
@@ -638,12 +687,13 @@ main (int argc, char **argv)
               {
                 print_line (client, NULL); /* flush */
                 close (client->fd);
-                printf ("[client at fd %d disconnected]\n", client->fd);
+                print_disconnect (client, "disconnected");
                 client->fd = -1;
               }
             else
               {
                 line[n] = 0;
+                client->nbytes += n;
                 print_line (client, line);
               }
           }
@@ -259,7 +259,7 @@ cmd_pksign (assuan_context_t ctx, char *line)
   rc = tpm2_sign (ctrl, tssc, key, pin_cb, type, digest, digestlen,
 		 &sig, &siglen);
 
-  tpm2_flush_handle (tssc, key);
+  tpm2_release_key (tssc, key, rc);
 
  end_out:
   tpm2_end (tssc);
@@ -330,12 +330,9 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
     rc = tpm2_ecc_decrypt (ctrl, tssc, key, pin_cb, crypto,
 			   cryptolen, &buf, &buflen);
   else
-    {
-      rc = GPG_ERR_PUBKEY_ALGO;
-      goto end_out;
-    }
+    rc = GPG_ERR_PUBKEY_ALGO;
 
-  tpm2_flush_handle (tssc, key);
+  tpm2_release_key (tssc, key, rc);
 
  end_out:
   tpm2_end (tssc);
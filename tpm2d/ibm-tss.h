@@ -252,7 +252,7 @@ tpm2_Sign (TSS_CONTEXT *tssContext, TPM_HANDLE keyHandle, DIGEST_2B *digest,
 		    (COMMAND_PARAMETERS *)&in,
 		    NULL,
 		    TPM_CC_Sign,
-		    auth, authVal, 0,
+		    auth, authVal, TPMA_SESSION_CONTINUESESSION,
 		    TPM_RH_NULL, NULL, 0);
 
   *signature = out.signature;
@@ -277,7 +277,8 @@ tpm2_ECDH_ZGen (TSS_CONTEXT *tssContext, TPM_HANDLE keyHandle,
 		    (COMMAND_PARAMETERS *)&in,
 		    NULL,
 		    TPM_CC_ECDH_ZGen,
-		    auth, authVal, TPMA_SESSION_ENCRYPT,
+		    auth, authVal,
+		    TPMA_SESSION_ENCRYPT | TPMA_SESSION_CONTINUESESSION,
 		    TPM_RH_NULL, NULL, 0);
 
   *outPoint = out.outPoint;
@@ -62,6 +62,7 @@
 #define TPM_RC_FAILURE		TPM2_RC_FAILURE
 #define TPM_RC_AUTH_FAIL	TPM2_RC_AUTH_FAIL
 #define TPM_RC_BAD_AUTH		TPM2_RC_BAD_AUTH
+#define TPM_RC_OBJECT_MEMORY	TPM2_RC_OBJECT_MEMORY
 
 #define RC_VER1			TPM2_RC_VER1
 #define RC_FMT1			TPM2_RC_FMT1
@@ -552,7 +553,7 @@ tpm2_Sign(TSS_CONTEXT *tssContext, TPM_HANDLE keyHandle, DIGEST_2B *digest,
   validation.digest.size = 0;
 
   intel_auth_helper(tssContext, keyHandle, authVal);
-  intel_sess_helper(tssContext, auth, 0);
+  intel_sess_helper(tssContext, auth, TPMA_SESSION_CONTINUESESSION);
   rc = Esys_Sign(tssContext, keyHandle, auth, ESYS_TR_NONE,
 		 ESYS_TR_NONE, digest, inScheme, &validation, &out);
 
@@ -574,7 +575,8 @@ tpm2_ECDH_ZGen(TSS_CONTEXT *tssContext, TPM_HANDLE keyHandle,
   TPM_RC rc;
 
   intel_auth_helper(tssContext, keyHandle, authVal);
-  intel_sess_helper(tssContext, auth, TPMA_SESSION_ENCRYPT);
+  intel_sess_helper(tssContext, auth,
+		    TPMA_SESSION_ENCRYPT | TPMA_SESSION_CONTINUESESSION);
   rc = Esys_ECDH_ZGen(tssContext, keyHandle, auth, ESYS_TR_NONE,
 		      ESYS_TR_NONE, inPoint, &out);
 
@@ -34,16 +34,74 @@
 #include "../common/i18n.h"
 #include "../common/sexp-parse.h"
 
+/* The TSS context is shared by all connections and kept open for the
+ * lifetime of the daemon.  This is required to keep keys loaded
+ * between commands because a resource manager flushes all transient
+ * objects of a connection once the connection is closed.  */
+static TSS_CONTEXT *shared_tssc;
+
+/* Number of loaded keys we keep in the TPM.  A TPM is only required
+ * to provide three transient object slots and tpm2_load_key needs
+ * one for the new key and one for a transient primary key.  */
+#define KEYCACHE_SIZE 2
+
+struct keycache_item_s
+{
+  unsigned char hash[32];  /* SHA-256 of the shadow info.  */
+  TPM_HANDLE key;          /* The loaded key or 0 for an unused slot.  */
+  TPMI_ALG_PUBLIC type;    /* The type of the key.  */
+  unsigned int refcount;   /* Number of commands using the key.  */
+  unsigned long lru;       /* Value of keycache_tick at the last use.  */
+};
+static struct keycache_item_s keycache[KEYCACHE_SIZE];
+static unsigned long keycache_tick;
+
+/* An HMAC session kept open by the last successful operation or 0.
+ * The session is neither bound nor salted and thus carries no secret;
+ * it is merely an optimization to save a StartAuthSession.  */
+static TPM_HANDLE cached_session;
+
+static int keycache_evict (TSS_CONTEXT *tssc);
+static void tpm2_flush_cache (TSS_CONTEXT *tssc);
+
+
 int
 tpm2_start (TSS_CONTEXT **tssc)
 {
-  return TSS_start(tssc);
+  int rc;
+
+  if (!shared_tssc)
+    {
+      rc = TSS_start (&shared_tssc);
+      if (rc)
+        {
+          shared_tssc = NULL;
+          return rc;
+        }
+    }
+
+  *tssc = shared_tssc;
+  return 0;
 }
 
 void
 tpm2_end (TSS_CONTEXT *tssc)
 {
-  TSS_Delete (tssc);
+  /* The context is kept open until tpm2_shutdown.  */
+  (void)tssc;
+}
+
+/* Flush all cached objects and close the TSS context.  This is called
+ * at daemon exit.  */
+void
+tpm2_shutdown (void)
+{
+  if (!shared_tssc)
+    return;
+
+  tpm2_flush_cache (shared_tssc);
+  TSS_Delete (shared_tssc);
+  shared_tssc = NULL;
 }
 
 static TPM_HANDLE
@@ -152,6 +210,16 @@ tpm2_pre_auth (ctrl_t ctrl, TSS_CONTEXT *tssc,
       (*auth)[32] = '\0';
     }
 
+  /* Take the cached session if there is one so that a concurrent
+   * command running while we are waiting for the PIN won't use it as
+   * well.  */
+  if (cached_session)
+    {
+      *ah = cached_session;
+      cached_session = 0;
+      return 0;
+    }
+
   rc = tpm2_get_hmac_handle (tssc, ah, TPM_RH_NULL);
 
   return rc;
@@ -176,6 +244,13 @@ tpm2_post_auth (TSS_CONTEXT *tssc, TPM_RC rc, TPM_HANDLE ah,
 	  return GPG_ERR_CARD;
 	}
     }
+
+  /* The operation has been run with continueSession set; keep the
+   * session for the next operation.  */
+  if (!cached_session)
+    cached_session = ah;
+  else
+    tpm2_flush_handle (tssc, ah);
   return 0;
 }
 
@@ -243,9 +318,9 @@ parse_tpm2_shadow_info (const unsigned char *shadow_info,
   return 0;
 }
 
-int
-tpm2_load_key (TSS_CONTEXT *tssc, const unsigned char *shadow_info,
-	       TPM_HANDLE *key, TPMI_ALG_PUBLIC *type)
+static int
+tpm2_load_key_nocache (TSS_CONTEXT *tssc, const unsigned char *shadow_info,
+                       TPM_HANDLE *key, TPMI_ALG_PUBLIC *type)
 {
   uint32_t parent;
   TPM_HANDLE parentHandle;
@@ -274,8 +349,15 @@ tpm2_load_key (TSS_CONTEXT *tssc, const unsigned char *shadow_info,
 
   *type = inPublic.publicArea.type;
 
-  rc = tpm2_Load (tssc, parentHandle, &inPrivate, &inPublic, key,
-		  TPM_RS_PW, NULL);
+  for (;;)
+    {
+      rc = tpm2_Load (tssc, parentHandle, &inPrivate, &inPublic, key,
+                      TPM_RS_PW, NULL);
+      /* If the TPM is out of object slots, make room by flushing
+       * unused keys from the cache and try again.  */
+      if (rc != TPM_RC_OBJECT_MEMORY || !keycache_evict (tssc))
+        break;
+    }
 
   tpm2_flush_handle (tssc, parentHandle);
 
@@ -288,6 +370,132 @@ tpm2_load_key (TSS_CONTEXT *tssc, const unsigned char *shadow_info,
   return 0;
 }
 
+
+/* Flush the least recently used key which is not in use from the
+ * cache.  Returns true if a key has been flushed.  */
+static int
+keycache_evict (TSS_CONTEXT *tssc)
+{
+  struct keycache_item_s *item = NULL;
+  int i;
+
+  for (i = 0; i < KEYCACHE_SIZE; i++)
+    if (keycache[i].key && !keycache[i].refcount
+        && (!item || keycache[i].lru < item->lru))
+      item = keycache + i;
+  if (!item)
+    return 0;
+
+  tpm2_flush_handle (tssc, item->key);
+  item->key = 0;
+  return 1;
+}
+
+
+/* Flush all cached keys and the cached session.  */
+static void
+tpm2_flush_cache (TSS_CONTEXT *tssc)
+{
+  int i;
+
+  for (i = 0; i < KEYCACHE_SIZE; i++)
+    if (keycache[i].key)
+      {
+        tpm2_flush_handle (tssc, keycache[i].key);
+        keycache[i].key = 0;
+        keycache[i].refcount = 0;
+      }
+
+  if (cached_session)
+    {
+      tpm2_flush_handle (tssc, cached_session);
+      cached_session = 0;
+    }
+}
+
+
+/* Load the key described by SHADOW_INFO into the TPM and store its
+ * handle at KEY and its type at TYPE.  Recently used keys are kept
+ * loaded; the caller must return the handle with tpm2_release_key.  */
+int
+tpm2_load_key (TSS_CONTEXT *tssc, const unsigned char *shadow_info,
+	       TPM_HANDLE *key, TPMI_ALG_PUBLIC *type)
+{
+  unsigned char hash[32];
+  struct keycache_item_s *item;
+  size_t n;
+  int i, ret;
+
+  n = gcry_sexp_canon_len (shadow_info, 0, NULL, NULL);
+  if (!n)
+    return gpg_error (GPG_ERR_INV_SEXP);
+  gcry_md_hash_buffer (GCRY_MD_SHA256, hash, shadow_info, n);
+
+  for (i = 0; i < KEYCACHE_SIZE; i++)
+    if (keycache[i].key && !memcmp (keycache[i].hash, hash, sizeof hash))
+      {
+        item = keycache + i;
+        item->refcount++;
+        item->lru = ++keycache_tick;
+        *key = item->key;
+        *type = item->type;
+        return 0;
+      }
+
+  /* Make sure there is a free slot; this also frees the TPM object
+   * slot we need for the new key.  */
+  item = NULL;
+  for (i = 0; i < KEYCACHE_SIZE && !item; i++)
+    if (!keycache[i].key)
+      item = keycache + i;
+  if (!item && keycache_evict (tssc))
+    for (i = 0; i < KEYCACHE_SIZE && !item; i++)
+      if (!keycache[i].key)
+        item = keycache + i;
+
+  ret = tpm2_load_key_nocache (tssc, shadow_info, key, type);
+  if (ret)
+    return ret;
+
+  /* If all keys in the cache are in use, the key is flushed by
+   * tpm2_release_key.  */
+  if (item)
+    {
+      memcpy (item->hash, hash, sizeof hash);
+      item->key = *key;
+      item->type = *type;
+      item->refcount = 1;
+      item->lru = ++keycache_tick;
+    }
+
+  return 0;
+}
+
+
+/* Release the KEY returned by tpm2_load_key.  RC is the result of the
+ * operation done with the key; on a TPM error the key is flushed so
+ * that a stale handle is not used again.  */
+void
+tpm2_release_key (TSS_CONTEXT *tssc, TPM_HANDLE key, int rc)
+{
+  int i;
+
+  for (i = 0; i < KEYCACHE_SIZE; i++)
+    if (keycache[i].key == key)
+      {
+        if (keycache[i].refcount)
+          keycache[i].refcount--;
+        if (gpg_err_code (rc) == GPG_ERR_CARD && !keycache[i].refcount)
+          {
+            tpm2_flush_handle (tssc, key);
+            keycache[i].key = 0;
+          }
+        return;
+      }
+
+  tpm2_flush_handle (tssc, key);
+}
+
 int
 tpm2_sign (ctrl_t ctrl, TSS_CONTEXT *tssc, TPM_HANDLE key,
 	   gpg_error_t (*pin_cb)(ctrl_t ctrl, const char *info,
@@ -1028,7 +1236,8 @@ tpm2_rsa_decrypt (ctrl_t ctrl, TSS_CONTEXT *tssc, TPM_HANDLE key,
   if (ret)
     return ret;
   ret = tpm2_RSA_Decrypt (tssc, key, &cipherText, &inScheme, &message,
-			  ah, auth, TPMA_SESSION_ENCRYPT);
+			  ah, auth,
+			  TPMA_SESSION_ENCRYPT | TPMA_SESSION_CONTINUESESSION);
   ret = tpm2_post_auth (tssc, ret, ah, &auth, "TPM2_RSA_Decrypt");
   if (ret)
     return ret;
@@ -41,6 +41,7 @@
 #define INCLUDED_BY_MAIN_MODULE 1
 #define GNUPG_COMMON_NEED_AFLOCAL
 #include "tpm2daemon.h"
+#include "tpm2.h"
 #include <gcrypt.h>
 
 #include <assuan.h> /* malloc hooks */
@@ -309,6 +310,8 @@ set_debug (const char *level)
 static void
 cleanup (void)
 {
+  tpm2_shutdown ();
+
   if (socket_name && *socket_name)
     {
       char *name;